@@ -2,6 +2,7 @@
 
 #include <event2/http.h>
 #include <glog/logging.h>
+#include <string.h>
 #include <algorithm>
 #include <iterator>
 #include <memory>
@@ -9,11 +10,13 @@
 #include "log/cert.h"
 #include "proto/cert_serializer.h"
 #include "proto/serializer.h"
+#include "util/json_reader.h"
 #include "util/json_wrapper.h"
 
 using cert_trans::AsyncLogClient;
 using cert_trans::Cert;
 using cert_trans::CertChain;
+using cert_trans::JsonReader;
 using cert_trans::PreCertChain;
 using cert_trans::URL;
 using cert_trans::UrlFetcher;
@@ -23,6 +26,7 @@ using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
 using std::back_inserter;
 using std::bind;
+using std::make_pair;
 using std::move;
 using std::placeholders::_1;
 using std::string;
@@ -57,6 +61,79 @@ bool SanityCheck(UrlFetcher::Response* resp,
 }
 
 
+const char kBinaryContentType[] = "application/octet-stream";
+
+
+// Whether |resp| is in the binary form of its endpoint, rather than JSON.
+bool IsBinary(const UrlFetcher::Response& resp) {
+  const auto it(resp.headers.find("Content-Type"));
+  return it != resp.headers.end() &&
+         it->second.compare(0, strlen(kBinaryContentType),
+                            kBinaryContentType) == 0;
+}
+
+
+// Reads a 64-bit big-endian integer at |*pos| in |body|.
+bool ReadUint64(const string& body, size_t* pos, uint64_t* value) {
+  if (body.size() - *pos < 8) {
+    return false;
+  }
+  *value = 0;
+  for (int i = 0; i < 8; ++i) {
+    *value = (*value << 8) | static_cast<unsigned char>(body[*pos + i]);
+  }
+  *pos += 8;
+  return true;
+}
+
+
+// Reads a field of the binary replies at |*pos| in |body|, preceded by
+// its length as a 32-bit big-endian integer.
+bool ReadFrameField(const string& body, size_t* pos, string* field) {
+  if (body.size() - *pos < 4) {
+    return false;
+  }
+  uint32_t size(0);
+  for (int i = 0; i < 4; ++i) {
+    size = (size << 8) | static_cast<unsigned char>(body[*pos + i]);
+  }
+  *pos += 4;
+  if (body.size() - *pos < size) {
+    return false;
+  }
+  field->assign(body, *pos, size);
+  *pos += size;
+  return true;
+}
+
+
+// Decodes the binary form of get-sth: the tree size, the timestamp, the
+// root hash and the signature.
+bool DecodeBinarySTH(const string& body, SignedTreeHead* sth) {
+  size_t pos(0);
+  uint64_t tree_size;
+  uint64_t timestamp;
+  string root_hash;
+  string signature;
+  if (!ReadUint64(body, &pos, &tree_size) ||
+      !ReadUint64(body, &pos, &timestamp) ||
+      !ReadFrameField(body, &pos, &root_hash) ||
+      !ReadFrameField(body, &pos, &signature) || pos != body.size() ||
+      static_cast<int64_t>(tree_size) < 0 ||
+      static_cast<int64_t>(timestamp) < 0) {
+    return false;
+  }
+
+  sth->Clear();
+  sth->set_version(ct::V1);
+  sth->set_tree_size(tree_size);
+  sth->set_timestamp(timestamp);
+  sth->set_sha256_root_hash(root_hash);
+  return Deserializer::DeserializeDigitallySigned(
+             signature, sth->mutable_signature()) == DeserializeResult::OK;
+}
+
+
 void DoneGetSTH(UrlFetcher::Response* resp, SignedTreeHead* sth,
                 const AsyncLogClient::Callback& done, util::Task* task) {
   unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
@@ -68,6 +145,12 @@ void DoneGetSTH(UrlFetcher::Response* resp, SignedTreeHead* sth,
     return;
   }
 
+  if (IsBinary(*resp)) {
+    return done(DecodeBinarySTH(resp->body, sth)
+                    ? AsyncLogClient::OK
+                    : AsyncLogClient::BAD_RESPONSE);
+  }
+
   JsonObject jresponse(resp->body);
   if (!jresponse.Ok())
     return done(AsyncLogClient::BAD_RESPONSE);
@@ -142,7 +225,70 @@ void DoneGetRoots(UrlFetcher::Response* resp, vector<unique_ptr<Cert>>* roots,
 }
 
 
-void DoneGetEntries(UrlFetcher::Response* resp,
+// Decodes the fields of an entry of get-entries, or of the binary format
+// of stream-entries. |sct_data| is null if the entry has no SCT.
+bool DecodeEntry(const string& leaf_input, const string& extra_data,
+                 const string* sct_data, AsyncLogClient::Entry* log_entry) {
+  if (Deserializer::DeserializeMerkleTreeLeaf(leaf_input, &log_entry->leaf) !=
+      DeserializeResult::OK) {
+    return false;
+  }
+
+  // This is an optional non-standard extension, used only by the log
+  // internally when running in clustered mode.
+  if (sct_data) {
+    unique_ptr<SignedCertificateTimestamp> sct(new SignedCertificateTimestamp);
+    if (Deserializer::DeserializeSCT(*sct_data, sct.get()) !=
+        DeserializeResult::OK) {
+      return false;
+    }
+    log_entry->sct.reset(sct.release());
+  }
+
+  switch (log_entry->leaf.timestamped_entry().entry_type()) {
+    case ct::X509_ENTRY:
+      DeserializeX509Chain(extra_data, log_entry->entry.mutable_x509_entry());
+      break;
+    case ct::PRECERT_ENTRY:
+      DeserializePrecertChainEntry(extra_data,
+                                   log_entry->entry.mutable_precert_entry());
+      break;
+    case ct::X_JSON_ENTRY:
+      // nothing to do
+      break;
+    default:
+      LOG(FATAL) << "Don't understand entry type: "
+                 << log_entry->leaf.timestamped_entry().entry_type();
+  }
+  return true;
+}
+
+
+// Decodes the entries of the binary format of stream-entries in |body|,
+// each with an SCT if |with_scts|, into |entries|.
+bool DecodeBinaryEntries(const string& body, bool with_scts,
+                         vector<AsyncLogClient::Entry>* entries) {
+  string leaf_input;
+  string extra_data;
+  string sct_data;
+  for (size_t pos = 0; pos < body.size();) {
+    if (!ReadFrameField(body, &pos, &leaf_input) ||
+        !ReadFrameField(body, &pos, &extra_data) ||
+        (with_scts && !ReadFrameField(body, &pos, &sct_data))) {
+      return false;
+    }
+    AsyncLogClient::Entry log_entry;
+    if (!DecodeEntry(leaf_input, extra_data, with_scts ? &sct_data : nullptr,
+                     &log_entry)) {
+      return false;
+    }
+    entries->emplace_back(move(log_entry));
+  }
+  return true;
+}
+
+
+void DoneGetEntries(UrlFetcher::Response* resp, bool with_scts,
                     vector<AsyncLogClient::Entry>* entries,
                     const AsyncLogClient::Callback& done, util::Task* task) {
   unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
@@ -152,71 +298,98 @@ void DoneGetEntries(UrlFetcher::Response* resp,
     return;
   }
 
-  JsonObject jresponse(resp->body);
-  if (!jresponse.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
-
-  JsonArray jentries(jresponse, "entries");
-  if (!jentries.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
-
-  vector<AsyncLogClient::Entry> new_entries;
-  new_entries.reserve(jentries.Length());
-
-  for (int n = 0; n < jentries.Length(); ++n) {
-    JsonObject entry(jentries, n);
-    if (!entry.Ok()) {
-      return done(AsyncLogClient::BAD_RESPONSE);
-    }
-
-    JsonString leaf_input(entry, "leaf_input");
-    if (!leaf_input.Ok()) {
+  if (IsBinary(*resp)) {
+    vector<AsyncLogClient::Entry> new_entries;
+    if (!DecodeBinaryEntries(resp->body, with_scts, &new_entries)) {
       return done(AsyncLogClient::BAD_RESPONSE);
     }
+    entries->reserve(entries->size() + new_entries.size());
+    move(new_entries.begin(), new_entries.end(), back_inserter(*entries));
+    return done(AsyncLogClient::OK);
+  }
 
-    AsyncLogClient::Entry log_entry;
-    if (Deserializer::DeserializeMerkleTreeLeaf(leaf_input.FromBase64(),
-                                                &log_entry.leaf) !=
-        DeserializeResult::OK) {
-      return done(AsyncLogClient::BAD_RESPONSE);
+  // The response can hold many entries, so it is read in place rather
+  // than parsed into a JsonObject, decoding the fields of each entry
+  // into the same strings.
+  JsonReader json(resp->body);
+  vector<AsyncLogClient::Entry> new_entries;
+  string name;
+  string leaf_input;
+  string extra_data;
+  string sct_data;
+  bool found_entries(false);
+  if (!json.StartObject()) {
+    return done(AsyncLogClient::BAD_RESPONSE);
+  }
+  while (json.NextMember(&name)) {
+    if (found_entries || name != "entries") {
+      json.Skip();
+      continue;
     }
-
-    JsonString extra_data(entry, "extra_data");
-    if (!extra_data.Ok()) {
+    found_entries = true;
+    if (!json.StartArray()) {
       return done(AsyncLogClient::BAD_RESPONSE);
     }
+    while (json.NextElement()) {
+      bool has_leaf_input(false);
+      bool has_extra_data(false);
+      bool has_sct(false);
+      if (!json.StartObject()) {
+        return done(AsyncLogClient::BAD_RESPONSE);
+      }
+      // Base64 that is not valid leaves its field empty, which does not
+      // deserialize.
+      while (json.NextMember(&name)) {
+        if (name == "leaf_input") {
+          has_leaf_input = true;
+          json.ReadBase64(&leaf_input);
+        } else if (name == "extra_data") {
+          has_extra_data = true;
+          json.ReadBase64(&extra_data);
+        } else if (name == "sct" && json.Peek() == JsonReader::STRING) {
+          has_sct = true;
+          json.ReadBase64(&sct_data);
+        } else {
+          json.Skip();
+        }
+      }
+      if (!json.ok() || !has_leaf_input || !has_extra_data) {
+        return done(AsyncLogClient::BAD_RESPONSE);
+      }
 
-    // This is an optional non-standard extension, used only by the log
-    // internally when running in clustered mode.
-    JsonString sct_data(entry, "sct");
-    if (sct_data.Ok()) {
-      unique_ptr<SignedCertificateTimestamp> sct(
-          new SignedCertificateTimestamp);
-      if (Deserializer::DeserializeSCT(sct_data.FromBase64(), sct.get()) !=
-          DeserializeResult::OK) {
+      AsyncLogClient::Entry log_entry;
+      if (!DecodeEntry(leaf_input, extra_data,
+                       has_sct ? &sct_data : nullptr, &log_entry)) {
         return done(AsyncLogClient::BAD_RESPONSE);
       }
-      log_entry.sct.reset(sct.release());
+      new_entries.emplace_back(move(log_entry));
     }
+  }
+  if (!json.ok() || !found_entries) {
+    return done(AsyncLogClient::BAD_RESPONSE);
+  }
 
-    switch (log_entry.leaf.timestamped_entry().entry_type()) {
-      case ct::X509_ENTRY:
-        DeserializeX509Chain(extra_data.FromBase64(),
-                             log_entry.entry.mutable_x509_entry());
-        break;
-      case ct::PRECERT_ENTRY:
-        DeserializePrecertChainEntry(extra_data.FromBase64(),
-                                     log_entry.entry.mutable_precert_entry());
-        break;
-      case ct::X_JSON_ENTRY:
-        // nothing to do
-        break;
-      default:
-        LOG(FATAL) << "Don't understand entry type: "
-                   << log_entry.leaf.timestamped_entry().entry_type();
-    }
+  entries->reserve(entries->size() + new_entries.size());
+  move(new_entries.begin(), new_entries.end(), back_inserter(*entries));
+
+  return done(AsyncLogClient::OK);
+}
+
+
+void DoneStreamEntries(UrlFetcher::Response* resp,
+                       vector<AsyncLogClient::Entry>* entries,
+                       const AsyncLogClient::Callback& done,
+                       util::Task* task) {
+  unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
+  unique_ptr<util::Task> task_deleter(CHECK_NOTNULL(task));
+
+  if (!SanityCheck(resp, done, task)) {
+    return;
+  }
 
-    new_entries.emplace_back(move(log_entry));
+  vector<AsyncLogClient::Entry> new_entries;
+  if (!DecodeBinaryEntries(resp->body, true /* with_scts */, &new_entries)) {
+    return done(AsyncLogClient::BAD_RESPONSE);
   }
 
   entries->reserve(entries->size() + new_entries.size());
@@ -238,23 +411,40 @@ void DoneQueryInclusionProof(UrlFetcher::Response* resp,
     return;
   }
 
-  JsonObject jresponse(resp->body);
-  if (!jresponse.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
+  int64_t leaf_index;
+  vector<string> path_nodes;
+  if (IsBinary(*resp)) {
+    // The leaf index, then the nodes of the audit path.
+    size_t pos(0);
+    uint64_t index;
+    if (!ReadUint64(resp->body, &pos, &index) ||
+        static_cast<int64_t>(index) < 0)
+      return done(AsyncLogClient::BAD_RESPONSE);
+    leaf_index = index;
+    while (pos < resp->body.size()) {
+      path_nodes.emplace_back();
+      if (!ReadFrameField(resp->body, &pos, &path_nodes.back()))
+        return done(AsyncLogClient::BAD_RESPONSE);
+    }
+  } else {
+    JsonObject jresponse(resp->body);
+    if (!jresponse.Ok())
+      return done(AsyncLogClient::BAD_RESPONSE);
 
-  JsonInt leaf_index(jresponse, "leaf_index");
-  if (!leaf_index.Ok() || leaf_index.Value() < 0)
-    return done(AsyncLogClient::BAD_RESPONSE);
+    JsonInt jleaf_index(jresponse, "leaf_index");
+    if (!jleaf_index.Ok() || jleaf_index.Value() < 0)
+      return done(AsyncLogClient::BAD_RESPONSE);
+    leaf_index = jleaf_index.Value();
 
-  JsonArray audit_path(jresponse, "audit_path");
-  if (!audit_path.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
+    JsonArray audit_path(jresponse, "audit_path");
+    if (!audit_path.Ok())
+      return done(AsyncLogClient::BAD_RESPONSE);
 
-  vector<string> path_nodes;
-  for (int n = 0; n < audit_path.Length(); ++n) {
-    JsonString path_node(audit_path, n);
-    CHECK(path_node.Ok());
-    path_nodes.push_back(path_node.FromBase64());
+    for (int n = 0; n < audit_path.Length(); ++n) {
+      JsonString path_node(audit_path, n);
+      CHECK(path_node.Ok());
+      path_nodes.push_back(path_node.FromBase64());
+    }
   }
 
   proof->Clear();
@@ -262,7 +452,7 @@ void DoneQueryInclusionProof(UrlFetcher::Response* resp,
   proof->set_tree_size(sth.tree_size());
   proof->set_timestamp(sth.timestamp());
   proof->mutable_tree_head_signature()->CopyFrom(sth.signature());
-  proof->set_leaf_index(leaf_index.Value());
+  proof->set_leaf_index(leaf_index);
   for (vector<string>::const_iterator it = path_nodes.begin();
        it != path_nodes.end(); ++it) {
     proof->add_path_node(*it);
@@ -282,21 +472,29 @@ void DoneGetSTHConsistency(UrlFetcher::Response* resp, vector<string>* proof,
     return;
   }
 
-  JsonObject jresponse(resp->body);
-  if (!jresponse.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
-
-  JsonArray jproof(jresponse, "consistency");
-  if (!jproof.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
-
   vector<string> entries;
-  for (int i = 0; i < jproof.Length(); ++i) {
-    JsonString entry(jproof, i);
-    if (!entry.Ok())
+  if (IsBinary(*resp)) {
+    for (size_t pos = 0; pos < resp->body.size();) {
+      entries.emplace_back();
+      if (!ReadFrameField(resp->body, &pos, &entries.back()))
+        return done(AsyncLogClient::BAD_RESPONSE);
+    }
+  } else {
+    JsonObject jresponse(resp->body);
+    if (!jresponse.Ok())
       return done(AsyncLogClient::BAD_RESPONSE);
 
-    entries.push_back(entry.FromBase64());
+    JsonArray jproof(jresponse, "consistency");
+    if (!jproof.Ok())
+      return done(AsyncLogClient::BAD_RESPONSE);
+
+    for (int i = 0; i < jproof.Length(); ++i) {
+      JsonString entry(jproof, i);
+      if (!entry.Ok())
+        return done(AsyncLogClient::BAD_RESPONSE);
+
+      entries.push_back(entry.FromBase64());
+    }
   }
 
   proof->reserve(proof->size() + entries.size());
@@ -306,45 +504,32 @@ void DoneGetSTHConsistency(UrlFetcher::Response* resp, vector<string>* proof,
 }
 
 
-void DoneInternalAddChain(UrlFetcher::Response* resp,
-                          SignedCertificateTimestamp* sct,
-                          const AsyncLogClient::Callback& done,
-                          util::Task* task) {
-  unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
-  unique_ptr<util::Task> task_deleter(CHECK_NOTNULL(task));
-
-  if (!SanityCheck(resp, done, task)) {
-    return;
-  }
-
-  JsonObject jresponse(resp->body);
-  if (!jresponse.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
-
+// Parses the add-chain response |jresponse| into |sct|.
+bool ParseSCT(const JsonObject& jresponse, SignedCertificateTimestamp* sct) {
   if (!jresponse.IsType(json_type_object))
-    return done(AsyncLogClient::BAD_RESPONSE);
+    return false;
 
   JsonString id(jresponse, "id");
   if (!id.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
+    return false;
 
   JsonInt timestamp(jresponse, "timestamp");
   if (!timestamp.Ok() || timestamp.Value() < 0)
-    return done(AsyncLogClient::BAD_RESPONSE);
+    return false;
 
   JsonString extensions(jresponse, "extensions");
   if (!extensions.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
+    return false;
 
   JsonString jsignature(jresponse, "signature");
   if (!jsignature.Ok())
-    return done(AsyncLogClient::BAD_RESPONSE);
+    return false;
 
   DigitallySigned signature;
   if (Deserializer::DeserializeDigitallySigned(jsignature.FromBase64(),
                                                &signature) !=
       DeserializeResult::OK)
-    return done(AsyncLogClient::BAD_RESPONSE);
+    return false;
 
   sct->Clear();
   sct->set_version(ct::V1);
@@ -353,10 +538,85 @@ void DoneInternalAddChain(UrlFetcher::Response* resp,
   sct->set_extensions(extensions.FromBase64());
   sct->mutable_signature()->CopyFrom(signature);
 
+  return true;
+}
+
+
+void DoneInternalAddChain(UrlFetcher::Response* resp,
+                          SignedCertificateTimestamp* sct,
+                          const AsyncLogClient::Callback& done,
+                          util::Task* task) {
+  unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
+  unique_ptr<util::Task> task_deleter(CHECK_NOTNULL(task));
+
+  if (!SanityCheck(resp, done, task)) {
+    return;
+  }
+
+  JsonObject jresponse(resp->body);
+  if (!jresponse.Ok() || !ParseSCT(jresponse, sct))
+    return done(AsyncLogClient::BAD_RESPONSE);
+
+  return done(AsyncLogClient::OK);
+}
+
+
+void DoneAddCertChains(UrlFetcher::Response* resp, size_t num_chains,
+                       vector<AsyncLogClient::AddChainResult>* results,
+                       const AsyncLogClient::Callback& done,
+                       util::Task* task) {
+  unique_ptr<UrlFetcher::Response> resp_deleter(CHECK_NOTNULL(resp));
+  unique_ptr<util::Task> task_deleter(CHECK_NOTNULL(task));
+
+  if (!SanityCheck(resp, done, task)) {
+    return;
+  }
+
+  JsonObject jresponse(resp->body);
+  if (!jresponse.Ok() || !jresponse.IsType(json_type_object))
+    return done(AsyncLogClient::BAD_RESPONSE);
+
+  JsonArray jresults(jresponse, "results");
+  if (!jresults.Ok() || jresults.Length() != static_cast<int>(num_chains))
+    return done(AsyncLogClient::BAD_RESPONSE);
+
+  vector<AsyncLogClient::AddChainResult> new_results(num_chains);
+  for (int i = 0; i < jresults.Length(); ++i) {
+    JsonObject jresult(jresults, i);
+    if (!jresult.Ok())
+      return done(AsyncLogClient::BAD_RESPONSE);
+
+    AsyncLogClient::AddChainResult* const result(&new_results[i]);
+    JsonBoolean success(jresult, "success");
+    if (success.Ok() && !success.Value()) {
+      JsonString error_message(jresult, "error_message");
+      result->status = AsyncLogClient::UPLOAD_FAILED;
+      if (error_message.Ok())
+        result->error_message = error_message.Value();
+      continue;
+    }
+
+    if (!ParseSCT(jresult, &result->sct))
+      return done(AsyncLogClient::BAD_RESPONSE);
+    result->status = AsyncLogClient::OK;
+  }
+
+  results->swap(new_results);
+
   return done(AsyncLogClient::OK);
 }
 
 
+// Encodes |cert_chain| as the JSON array of add-chain requests.
+void AddJsonChain(const CertChain& cert_chain, JsonArray* jchain) {
+  for (size_t n = 0; n < cert_chain.Length(); ++n) {
+    string cert;
+    CHECK_EQ(util::Status::OK, cert_chain.CertAt(n)->DerEncoding(&cert));
+    jchain->AddBase64(cert);
+  }
+}
+
+
 URL NormalizeURL(const string& server_url) {
   URL retval(server_url);
   string newpath(retval.Path());
@@ -381,13 +641,19 @@ AsyncLogClient::AsyncLogClient(util::Executor* const executor,
                                UrlFetcher* fetcher, const string& server_url)
     : executor_(CHECK_NOTNULL(executor)),
       fetcher_(CHECK_NOTNULL(fetcher)),
-      server_url_(NormalizeURL(server_url)) {
+      server_url_(NormalizeURL(server_url)),
+      binary_responses_(false) {
+}
+
+
+void AsyncLogClient::SetBinaryResponses(bool binary) {
+  binary_responses_ = binary;
 }
 
 
 void AsyncLogClient::GetSTH(SignedTreeHead* sth, const Callback& done) {
   UrlFetcher::Response* const resp(new UrlFetcher::Response);
-  fetcher_->Fetch(GetURL("get-sth"), resp,
+  fetcher_->Fetch(ReadRequest(GetURL("get-sth")), resp,
                   new util::Task(bind(DoneGetSTH, resp, sth, done, _1),
                                  executor_));
 }
@@ -403,14 +669,14 @@ void AsyncLogClient::GetRoots(vector<unique_ptr<Cert>>* roots,
 }
 
 
-void AsyncLogClient::GetEntries(int first, int last, vector<Entry>* entries,
-                                const Callback& done) {
+void AsyncLogClient::GetEntries(int64_t first, int64_t last,
+                                vector<Entry>* entries, const Callback& done) {
   return InternalGetEntries(first, last, entries, false /* request_scts */,
                             done);
 }
 
 
-void AsyncLogClient::GetEntriesAndSCTs(int first, int last,
+void AsyncLogClient::GetEntriesAndSCTs(int64_t first, int64_t last,
                                        vector<Entry>* entries,
                                        const Callback& done) {
   return InternalGetEntries(first, last, entries, true /* request_scts */,
@@ -418,7 +684,29 @@ void AsyncLogClient::GetEntriesAndSCTs(int first, int last,
 }
 
 
-void AsyncLogClient::InternalGetEntries(int first, int last,
+void AsyncLogClient::StreamEntriesAndSCTs(int64_t first, int64_t last,
+                                          vector<Entry>* entries,
+                                          const Callback& done) {
+  CHECK_GE(first, 0);
+  CHECK_GE(last, 0);
+
+  if (last < first) {
+    done(INVALID_INPUT);
+    return;
+  }
+
+  URL url(GetURL("stream-entries"));
+  url.SetQuery("start=" + to_string(first) + "&end=" + to_string(last) +
+               "&format=binary&include_scts=true");
+
+  UrlFetcher::Response* const resp(new UrlFetcher::Response);
+  fetcher_->Fetch(url, resp, new util::Task(bind(DoneStreamEntries, resp,
+                                                 entries, done, _1),
+                                            executor_));
+}
+
+
+void AsyncLogClient::InternalGetEntries(int64_t first, int64_t last,
                                         vector<Entry>* entries,
                                         bool request_scts,
                                         const Callback& done) {
@@ -435,8 +723,9 @@ void AsyncLogClient::InternalGetEntries(int first, int last,
                (request_scts ? "&include_scts=true" : ""));
 
   UrlFetcher::Response* const resp(new UrlFetcher::Response);
-  fetcher_->Fetch(url, resp,
-                  new util::Task(bind(DoneGetEntries, resp, entries, done, _1),
+  fetcher_->Fetch(ReadRequest(url), resp,
+                  new util::Task(bind(DoneGetEntries, resp, request_scts,
+                                      entries, done, _1),
                                  executor_));
 }
 
@@ -452,9 +741,10 @@ void AsyncLogClient::QueryInclusionProof(const SignedTreeHead& sth,
                "&tree_size=" + to_string(sth.tree_size()));
 
   UrlFetcher::Response* const resp(new UrlFetcher::Response);
-  fetcher_->Fetch(url, resp, new util::Task(bind(DoneQueryInclusionProof, resp,
-                                                 sth, proof, done, _1),
-                                            executor_));
+  fetcher_->Fetch(ReadRequest(url), resp,
+                  new util::Task(bind(DoneQueryInclusionProof, resp, sth,
+                                      proof, done, _1),
+                                 executor_));
 }
 
 
@@ -468,9 +758,10 @@ void AsyncLogClient::GetSTHConsistency(int64_t first, int64_t second,
   url.SetQuery("first=" + to_string(first) + "&second=" + to_string(second));
 
   UrlFetcher::Response* const resp(new UrlFetcher::Response);
-  fetcher_->Fetch(url, resp, new util::Task(bind(DoneGetSTHConsistency, resp,
-                                                 proof, done, _1),
-                                            executor_));
+  fetcher_->Fetch(ReadRequest(url), resp,
+                  new util::Task(bind(DoneGetSTHConsistency, resp, proof,
+                                      done, _1),
+                                 executor_));
 }
 
 
@@ -488,6 +779,34 @@ void AsyncLogClient::AddPreCertChain(const PreCertChain& pre_cert_chain,
 }
 
 
+void AsyncLogClient::AddCertChains(const vector<const CertChain*>& cert_chains,
+                                   vector<AddChainResult>* results,
+                                   const Callback& done) {
+  JsonArray jchains;
+  for (const CertChain* cert_chain : cert_chains) {
+    if (!cert_chain->IsLoaded())
+      return done(INVALID_INPUT);
+
+    JsonArray jchain;
+    AddJsonChain(*cert_chain, &jchain);
+    jchains.Add(&jchain);
+  }
+
+  JsonObject jsend;
+  jsend.Add("chains", jchains);
+
+  UrlFetcher::Request req(GetURL("add-chains"));
+  req.verb = UrlFetcher::Verb::POST;
+  req.body = jsend.ToString();
+
+  UrlFetcher::Response* const resp(new UrlFetcher::Response);
+  fetcher_->Fetch(req, resp,
+                  new util::Task(bind(DoneAddCertChains, resp,
+                                      cert_chains.size(), results, done, _1),
+                                 executor_));
+}
+
+
 URL AsyncLogClient::GetURL(const std::string& subpath) const {
   URL retval(server_url_);
   CHECK(!retval.Path().empty());
@@ -497,6 +816,15 @@ URL AsyncLogClient::GetURL(const std::string& subpath) const {
 }
 
 
+UrlFetcher::Request AsyncLogClient::ReadRequest(const URL& url) const {
+  UrlFetcher::Request req(url);
+  if (binary_responses_) {
+    req.headers.insert(make_pair("Accept", kBinaryContentType));
+  }
+  return req;
+}
+
+
 void AsyncLogClient::InternalAddChain(const CertChain& cert_chain,
                                       SignedCertificateTimestamp* sct,
                                       bool pre_cert, const Callback& done) {
@@ -504,11 +832,7 @@ void AsyncLogClient::InternalAddChain(const CertChain& cert_chain,
     return done(INVALID_INPUT);
 
   JsonArray jchain;
-  for (size_t n = 0; n < cert_chain.Length(); ++n) {
-    string cert;
-    CHECK_EQ(util::Status::OK, cert_chain.CertAt(n)->DerEncoding(&cert));
-    jchain.AddBase64(cert);
-  }
+  AddJsonChain(cert_chain, &jchain);
 
   JsonObject jsend;
   jsend.Add("chain", jchain);
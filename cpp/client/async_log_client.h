@@ -41,6 +41,16 @@ class AsyncLogClient {
     std::unique_ptr<ct::SignedCertificateTimestamp> sct;
   };
 
+  // The outcome of adding one of the chains of AddCertChains().
+  struct AddChainResult {
+    // UPLOAD_FAILED if the log rejected the chain.
+    Status status;
+    // Set if "status" is UPLOAD_FAILED.
+    std::string error_message;
+    // Set if "status" is OK.
+    ct::SignedCertificateTimestamp sct;
+  };
+
   typedef std::function<void(Status)> Callback;
 
   // The "executor" will be used to run callbacks.
@@ -51,6 +61,13 @@ class AsyncLogClient {
   AsyncLogClient(util::Executor* const executor, UrlFetcher* fetcher,
                  const std::string& server_uri);
 
+  // Whether to ask for the binary form of the replies of get-sth,
+  // get-entries, get-proof-by-hash and get-sth-consistency (see
+  // HttpHandler::GetEntries()), which saves their JSON and base64 on
+  // both ends. Logs which do not have it still reply in JSON, which is
+  // decoded as usual. Must be called before any request is made.
+  void SetBinaryResponses(bool binary);
+
   void GetSTH(ct::SignedTreeHead* sth, const Callback& done);
 
   // This does not clear "roots" before appending to it.
@@ -59,15 +76,27 @@ class AsyncLogClient {
 
   // This does not clear "entries" before appending the retrieved
   // entries.
-  void GetEntries(int first, int last, std::vector<Entry>* entries,
+  void GetEntries(int64_t first, int64_t last, std::vector<Entry>* entries,
                   const Callback& done);
 
   // This is NON-standard, and only works with SuperDuper logs.
   // It's intended for internal use when running in a clustered configuration.
   // This does not clear "entries" before appending the retrieved
   // entries.
-  void GetEntriesAndSCTs(int first, int last, std::vector<Entry>* entries,
-                         const Callback& done);
+  void GetEntriesAndSCTs(int64_t first, int64_t last,
+                         std::vector<Entry>* entries, const Callback& done);
+
+  // Like GetEntriesAndSCTs(), but through the binary format of the
+  // NON-standard stream-entries, which the log must serve (with
+  // --enable_stream_entries). That saves the base64 and JSON of
+  // get-entries on both ends, and the response is not cut at
+  // --max_leaf_entries_per_response, only at the first entry the log
+  // does not have.
+  // This does not clear "entries" before appending the retrieved
+  // entries.
+  void StreamEntriesAndSCTs(int64_t first, int64_t last,
+                            std::vector<Entry>* entries,
+                            const Callback& done);
 
   void QueryInclusionProof(const ct::SignedTreeHead& sth,
                            const std::string& merkle_leaf_hash,
@@ -86,11 +115,25 @@ class AsyncLogClient {
                        ct::SignedCertificateTimestamp* sct,
                        const Callback& done);
 
+  // This is NON-standard, and only works with SuperDuper logs. Adds all
+  // of |cert_chains| in one add-chains request, and sets |results| to
+  // the outcome for each of them, in the same order. The chains need
+  // not outlive this call.
+  // Note: this method can call "done" inline (before it returns), if
+  // there is a problem with any of the certificate chains.
+  void AddCertChains(const std::vector<const CertChain*>& cert_chains,
+                     std::vector<AddChainResult>* results,
+                     const Callback& done);
+
  private:
   URL GetURL(const std::string& subpath) const;
+  // A GET of |url|, asking for the binary form of the reply if
+  // |binary_responses_|.
+  UrlFetcher::Request ReadRequest(const URL& url) const;
 
-  void InternalGetEntries(int first, int last, std::vector<Entry>* entries,
-                          bool request_scts, const Callback& done);
+  void InternalGetEntries(int64_t first, int64_t last,
+                          std::vector<Entry>* entries, bool request_scts,
+                          const Callback& done);
 
   void InternalAddChain(const CertChain& cert_chain,
                         ct::SignedCertificateTimestamp* sct, bool pre_cert,
@@ -99,6 +142,7 @@ class AsyncLogClient {
   util::Executor* const executor_;
   UrlFetcher* const fetcher_;
   const URL server_url_;
+  bool binary_responses_;
 
   DISALLOW_COPY_AND_ASSIGN(AsyncLogClient);
 };
@@ -0,0 +1,450 @@
+// Load generator for a log server, sending a mix of requests at a
+// target rate. The requests are scheduled open-loop: each is due at a
+// fixed time, whether the earlier ones have completed or not, and its
+// latency is counted from that time, so that a server stalling does
+// not hide the latency of the requests that would have been sent in
+// the meantime (i.e. it is corrected for coordinated omission). The
+// time from actually sending the request is reported too, and the
+// results also go to --bench_results_out for test/perf_check.py.
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/notification.h"
+#include "client/async_log_client.h"
+#include "log/cert.h"
+#include "log/logged_entry.h"
+#include "net/url_fetcher.h"
+#include "proto/ct.pb.h"
+#include "util/bench_results.h"
+#include "util/init.h"
+#include "util/libevent_wrapper.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+namespace libevent = cert_trans::libevent;
+
+using cert_trans::AsyncLogClient;
+using cert_trans::BenchResults;
+using cert_trans::CertChain;
+using cert_trans::LoggedEntry;
+using cert_trans::Notification;
+using cert_trans::PreCertChain;
+using cert_trans::ThreadPool;
+using cert_trans::UrlFetcher;
+using std::bind;
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::chrono::steady_clock;
+using std::condition_variable;
+using std::lock_guard;
+using std::mt19937_64;
+using std::mutex;
+using std::placeholders::_1;
+using std::string;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+
+DEFINE_string(ct_server, "http://127.0.0.1:8888", "log server to load");
+DEFINE_double(qps, 100, "number of requests to send per second");
+DEFINE_int32(duration_seconds, 60, "how long to send requests for");
+DEFINE_string(mix,
+              "get-sth=10,get-entries=10,get-proof-by-hash=10,"
+              "get-sth-consistency=5,add-chain=0,add-pre-chain=0",
+              "relative weights of the kinds of requests to send");
+DEFINE_string(chains, "",
+              "comma-separated PEM files, each with a certificate chain, "
+              "which add-chain requests submit in turn (the log will "
+              "only add each once, and return the same SCT after that)");
+DEFINE_string(pre_chains, "",
+              "comma-separated PEM files, each with a precertificate "
+              "chain, which add-pre-chain requests submit in turn");
+DEFINE_int32(get_entries_batch_size, 20,
+             "number of entries asked for by each get-entries request");
+DEFINE_int32(num_proof_hashes, 1000,
+             "number of the latest entries, fetched at startup, whose "
+             "leaf hashes get-proof-by-hash requests ask for");
+DEFINE_int32(max_outstanding, 10000,
+             "most requests waiting for a response; requests due when "
+             "there are this many are counted as skipped rather than "
+             "sent");
+
+namespace {
+
+
+enum RequestType {
+  ADD_CHAIN,
+  ADD_PRE_CHAIN,
+  GET_STH,
+  GET_ENTRIES,
+  GET_PROOF_BY_HASH,
+  GET_STH_CONSISTENCY,
+  NUM_REQUEST_TYPES,
+};
+
+
+// Indexed by RequestType.
+const char* const kRequestNames[] = {
+    "add-chain",         "add-pre-chain",     "get-sth",
+    "get-entries",       "get-proof-by-hash", "get-sth-consistency",
+};
+
+
+// Latencies of requests, in seconds.
+class Latencies {
+ public:
+  void Add(const duration<double>& latency) {
+    latencies_.push_back(latency.count());
+  }
+
+  size_t size() const {
+    return latencies_.size();
+  }
+
+  string Summary() {
+    std::sort(latencies_.begin(), latencies_.end());
+    std::ostringstream out;
+    out << "p50 " << Percentile(0.5) * 1e3 << "ms, p90 "
+        << Percentile(0.9) * 1e3 << "ms, p99 " << Percentile(0.99) * 1e3
+        << "ms, p99.9 " << Percentile(0.999) * 1e3 << "ms, max "
+        << Percentile(1) * 1e3 << "ms";
+    return out.str();
+  }
+
+  // Records the percentiles as "<name>/p50" and "<name>/p99", once
+  // Summary() has been called.
+  void Record(const string& name, BenchResults* results) const {
+    results->AddLatency(name + "/p50", Percentile(0.5));
+    results->AddLatency(name + "/p99", Percentile(0.99));
+  }
+
+ private:
+  double Percentile(double p) const {
+    if (latencies_.empty()) {
+      return 0;
+    }
+    return latencies_[p * (latencies_.size() - 1)];
+  }
+
+  vector<double> latencies_;
+};
+
+
+// The state of one request, until it completes.
+struct Request {
+  RequestType type;
+  // When it was due, and when it was actually sent.
+  steady_clock::time_point due;
+  steady_clock::time_point sent;
+
+  ct::SignedTreeHead sth;
+  ct::SignedCertificateTimestamp sct;
+  vector<AsyncLogClient::Entry> entries;
+  ct::MerkleAuditProof proof;
+  vector<string> consistency;
+};
+
+
+class LoadGenerator {
+ public:
+  LoadGenerator(AsyncLogClient* client, const ct::SignedTreeHead& sth,
+                vector<string> leaf_hashes,
+                vector<unique_ptr<CertChain>> chains,
+                vector<unique_ptr<PreCertChain>> pre_chains,
+                const vector<double>& weights)
+      : client_(CHECK_NOTNULL(client)),
+        sth_(sth),
+        leaf_hashes_(std::move(leaf_hashes)),
+        chains_(std::move(chains)),
+        pre_chains_(std::move(pre_chains)),
+        pick_type_(weights.begin(), weights.end()),
+        rand_(1234),
+        next_chain_(0),
+        outstanding_(0) {
+    for (int i = 0; i < NUM_REQUEST_TYPES; ++i) {
+      errors_[i] = 0;
+      skipped_[i] = 0;
+    }
+  }
+
+  // Sends requests at --qps for --duration_seconds, then waits for the
+  // outstanding ones and reports.
+  void Run(BenchResults* results);
+
+ private:
+  void Send(Request* request);
+  void Done(Request* request, AsyncLogClient::Status status);
+  void Report(const duration<double>& elapsed, BenchResults* results);
+
+  AsyncLogClient* const client_;
+  const ct::SignedTreeHead sth_;
+  const vector<string> leaf_hashes_;
+  const vector<unique_ptr<CertChain>> chains_;
+  const vector<unique_ptr<PreCertChain>> pre_chains_;
+  // Only used by the thread sending the requests.
+  std::discrete_distribution<int> pick_type_;
+  mt19937_64 rand_;
+  size_t next_chain_;
+
+  mutex lock_;
+  condition_variable all_done_;
+  int outstanding_;
+  Latencies from_due_[NUM_REQUEST_TYPES];
+  Latencies from_sent_[NUM_REQUEST_TYPES];
+  int64_t errors_[NUM_REQUEST_TYPES];
+  int64_t skipped_[NUM_REQUEST_TYPES];
+};
+
+
+void LoadGenerator::Run(BenchResults* results) {
+  const duration<double> interval(1 / FLAGS_qps);
+  const steady_clock::time_point start(steady_clock::now());
+  const int64_t num_requests(FLAGS_qps * FLAGS_duration_seconds);
+
+  for (int64_t i = 0; i < num_requests; ++i) {
+    Request* const request(new Request);
+    request->type = static_cast<RequestType>(pick_type_(rand_));
+    request->due =
+        start + duration_cast<steady_clock::duration>(interval * i);
+    std::this_thread::sleep_until(request->due);
+
+    {
+      lock_guard<mutex> lock(lock_);
+      if (outstanding_ >= FLAGS_max_outstanding) {
+        ++skipped_[request->type];
+        delete request;
+        continue;
+      }
+      ++outstanding_;
+    }
+    Send(request);
+  }
+
+  {
+    unique_lock<mutex> lock(lock_);
+    all_done_.wait(lock, [this]() { return outstanding_ == 0; });
+  }
+  Report(steady_clock::now() - start, results);
+}
+
+
+void LoadGenerator::Send(Request* request) {
+  const AsyncLogClient::Callback done(
+      bind(&LoadGenerator::Done, this, request, _1));
+  const int64_t tree_size(sth_.tree_size());
+  request->sent = steady_clock::now();
+  switch (request->type) {
+    case ADD_CHAIN:
+      client_->AddCertChain(*chains_[next_chain_++ % chains_.size()],
+                            &request->sct, done);
+      break;
+    case ADD_PRE_CHAIN:
+      client_->AddPreCertChain(
+          *pre_chains_[next_chain_++ % pre_chains_.size()], &request->sct,
+          done);
+      break;
+    case GET_STH:
+      client_->GetSTH(&request->sth, done);
+      break;
+    case GET_ENTRIES: {
+      const int64_t batch(
+          std::min<int64_t>(FLAGS_get_entries_batch_size, tree_size));
+      const int64_t first(rand_() % (tree_size - batch + 1));
+      client_->GetEntries(first, first + batch - 1, &request->entries, done);
+      break;
+    }
+    case GET_PROOF_BY_HASH:
+      client_->QueryInclusionProof(
+          sth_, leaf_hashes_[rand_() % leaf_hashes_.size()], &request->proof,
+          done);
+      break;
+    case GET_STH_CONSISTENCY:
+      client_->GetSTHConsistency(1 + rand_() % tree_size, tree_size,
+                                 &request->consistency, done);
+      break;
+    case NUM_REQUEST_TYPES:
+      LOG(FATAL) << "not a request type";
+  }
+}
+
+
+void LoadGenerator::Done(Request* request, AsyncLogClient::Status status) {
+  const steady_clock::time_point now(steady_clock::now());
+  {
+    lock_guard<mutex> lock(lock_);
+    if (status == AsyncLogClient::OK) {
+      from_due_[request->type].Add(now - request->due);
+      from_sent_[request->type].Add(now - request->sent);
+    } else {
+      VLOG(1) << kRequestNames[request->type] << " failed: " << status;
+      ++errors_[request->type];
+    }
+    if (--outstanding_ == 0) {
+      all_done_.notify_all();
+    }
+  }
+  delete request;
+}
+
+
+void LoadGenerator::Report(const duration<double>& elapsed,
+                           BenchResults* results) {
+  lock_guard<mutex> lock(lock_);
+  int64_t total(0);
+  for (int i = 0; i < NUM_REQUEST_TYPES; ++i) {
+    const int64_t ok(from_due_[i].size());
+    total += ok;
+    if (ok + errors_[i] + skipped_[i] == 0) {
+      continue;
+    }
+    LOG(INFO) << kRequestNames[i] << ": " << ok << " ok, " << errors_[i]
+              << " failed, " << skipped_[i] << " skipped";
+    LOG(INFO) << kRequestNames[i]
+              << " latency from due: " << from_due_[i].Summary();
+    LOG(INFO) << kRequestNames[i]
+              << " latency from sent: " << from_sent_[i].Summary();
+    const string name(kRequestNames[i]);
+    from_due_[i].Record(name + "/from_due", results);
+    from_sent_[i].Record(name + "/from_sent", results);
+    results->Add(name + "/errors", errors_[i] + skipped_[i], "requests",
+                 BenchResults::LOWER_IS_BETTER);
+  }
+  LOG(INFO) << total << " successful requests in " << elapsed.count()
+            << "s (" << total / elapsed.count() << " qps, target "
+            << FLAGS_qps << ")";
+  results->AddThroughput("qps", total / elapsed.count(), "requests/s");
+}
+
+
+vector<double> ParseMix(const string& mix) {
+  vector<double> weights(NUM_REQUEST_TYPES, 0);
+  for (const string& item : util::split(mix, ',')) {
+    const vector<string> name_weight(util::split(item, '='));
+    CHECK_EQ(static_cast<size_t>(2), name_weight.size())
+        << "bad --mix item: " << item;
+    const char* const* const name(
+        std::find(kRequestNames, kRequestNames + NUM_REQUEST_TYPES,
+                  name_weight[0]));
+    CHECK(name != kRequestNames + NUM_REQUEST_TYPES)
+        << "unknown request in --mix: " << name_weight[0];
+    weights[name - kRequestNames] = std::stod(name_weight[1]);
+    CHECK_GE(weights[name - kRequestNames], 0) << item;
+  }
+  return weights;
+}
+
+
+template <class Chain>
+vector<unique_ptr<Chain>> LoadChains(const string& files) {
+  vector<unique_ptr<Chain>> chains;
+  for (const string& file : util::split(files, ',')) {
+    string pem;
+    CHECK(util::ReadTextFile(file, &pem)) << "could not read " << file;
+    chains.emplace_back(new Chain(pem));
+    CHECK(chains.back()->IsLoaded()) << "could not load a chain from "
+                                     << file;
+  }
+  return chains;
+}
+
+
+// Runs |request|, passing it its callback, and waits for it.
+AsyncLogClient::Status Wait(
+    const std::function<void(const AsyncLogClient::Callback&)>& request) {
+  AsyncLogClient::Status ret(AsyncLogClient::UNKNOWN_ERROR);
+  Notification done;
+  request([&ret, &done](AsyncLogClient::Status status) {
+    ret = status;
+    done.Notify();
+  });
+  done.WaitForNotification();
+  return ret;
+}
+
+
+// Fetches the leaf hashes of up to --num_proof_hashes of the latest
+// entries in the tree of |sth|.
+vector<string> GetLeafHashes(AsyncLogClient* client,
+                             const ct::SignedTreeHead& sth) {
+  vector<string> ret;
+  const int64_t last(sth.tree_size() - 1);
+  int64_t next(std::max<int64_t>(0, sth.tree_size() - FLAGS_num_proof_hashes));
+  while (next <= last) {
+    vector<AsyncLogClient::Entry> entries;
+    CHECK_EQ(AsyncLogClient::OK,
+             Wait(bind(&AsyncLogClient::GetEntries, client, next, last,
+                       &entries, _1)));
+    CHECK(!entries.empty());
+    for (const AsyncLogClient::Entry& entry : entries) {
+      LoggedEntry logged;
+      CHECK(logged.CopyFromClientLogEntry(entry));
+      ret.emplace_back(logged.MerkleLeafHash());
+    }
+    next += entries.size();
+  }
+  return ret;
+}
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  util::InitCT(&argc, &argv);
+
+  CHECK_GT(FLAGS_qps, 0);
+  CHECK_GT(FLAGS_duration_seconds, 0);
+  CHECK_GT(FLAGS_get_entries_batch_size, 0);
+  CHECK_GT(FLAGS_num_proof_hashes, 0);
+  CHECK_GT(FLAGS_max_outstanding, 0);
+  const vector<double> weights(ParseMix(FLAGS_mix));
+  CHECK(weights[ADD_CHAIN] == 0 || !FLAGS_chains.empty())
+      << "add-chain requests need --chains";
+  CHECK(weights[ADD_PRE_CHAIN] == 0 || !FLAGS_pre_chains.empty())
+      << "add-pre-chain requests need --pre_chains";
+
+  const std::shared_ptr<libevent::Base> event_base(
+      std::make_shared<libevent::Base>());
+  libevent::EventPumpThread pump(event_base);
+  ThreadPool pool("bench_log");
+  UrlFetcher fetcher(event_base.get(), &pool);
+  AsyncLogClient client(&pool, &fetcher, FLAGS_ct_server);
+
+  ct::SignedTreeHead sth;
+  CHECK_EQ(AsyncLogClient::OK,
+           Wait(bind(&AsyncLogClient::GetSTH, &client, &sth, _1)));
+  CHECK(sth.tree_size() > 0 ||
+        (weights[GET_ENTRIES] == 0 && weights[GET_PROOF_BY_HASH] == 0 &&
+         weights[GET_STH_CONSISTENCY] == 0))
+      << "the log is empty, so only add-chain, add-pre-chain and get-sth "
+         "requests can be sent";
+  vector<string> leaf_hashes;
+  if (weights[GET_PROOF_BY_HASH] > 0) {
+    leaf_hashes = GetLeafHashes(&client, sth);
+  }
+  LOG(INFO) << "loading " << FLAGS_ct_server << ", with a tree of "
+            << sth.tree_size() << " entries, at " << FLAGS_qps << " qps for "
+            << FLAGS_duration_seconds << "s";
+
+  LoadGenerator generator(&client, sth, std::move(leaf_hashes),
+                          LoadChains<CertChain>(FLAGS_chains),
+                          LoadChains<PreCertChain>(FLAGS_pre_chains),
+                          weights);
+  BenchResults results("bench_log");
+  generator.Run(&results);
+
+  results.Write();
+  return 0;
+}
@@ -1,8 +1,12 @@
 /* -*- indent-tabs-mode: nil -*- */
+#include <arpa/inet.h>
+#include <dirent.h>
+#include <errno.h>
 #include <event2/thread.h>
 #include <fcntl.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <inttypes.h>
 #include <openssl/asn1.h>
 #include <openssl/bio.h>
 #include <openssl/bn.h>
@@ -13,30 +17,44 @@
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
 
 #include "client/http_log_client.h"
+#include "client/sct_verification_cache.h"
 #include "client/ssl_client.h"
 #include "log/cert.h"
 #include "log/cert_submission_handler.h"
 #include "log/ct_extensions.h"
 #include "log/log_signer.h"
 #include "log/log_verifier.h"
+#include "log/logged_entry.h"
 #include "merkletree/merkle_tree.h"
 #include "merkletree/merkle_verifier.h"
 #include "merkletree/serial_hasher.h"
 #include "monitor/database.h"
 #include "monitor/monitor.h"
+#include "monitor/multi_monitor.h"
 #include "monitor/sqlite_db.h"
+#include "proto/cert_serializer.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
 #include "util/init.h"
+#include "util/libevent_wrapper.h"
 #include "util/openssl_scoped_types.h"
 #include "util/read_key.h"
+#include "util/thread_pool.h"
 
 DEFINE_string(ssl_client_trusted_cert_dir, "",
               "Trusted root certificates for the ssl client");
@@ -44,6 +62,17 @@ DEFINE_string(ct_server_public_key, "",
               "PEM-encoded public key file of the CT log server");
 DEFINE_string(ssl_server, "", "SSL server to connect to");
 DEFINE_int32(ssl_server_port, 0, "SSL server port");
+DEFINE_string(ssl_servers_in, "",
+              "With connect, instead of --ssl_server, scan each server of "
+              "this file, which has one \"<address> <port>\" per line, and "
+              "write a line for each to the standard output with the result "
+              "of the handshake and the number of SCTs verified");
+DEFINE_int32(ssl_scan_concurrency, 16,
+             "How many servers of --ssl_servers_in are connected to at once");
+DEFINE_int32(sct_verification_cache_size, 100000,
+             "How many of the SCTs verified while scanning --ssl_servers_in "
+             "are remembered, so as not to check their signatures again "
+             "when other servers present them");
 DEFINE_string(ct_server_submission, "",
               "Certificate chain to submit to a CT log server. "
               "The file must consist of concatenated PEM certificates.");
@@ -51,11 +80,32 @@ DEFINE_string(ct_server, "", "CT log server to connect to");
 DEFINE_string(ct_server_response_out, "",
               "Output file for the Signed Certificate Timestamp received from "
               "the CT log server");
+DEFINE_string(ct_server_submissions_in, "",
+              "Upload, instead of --ct_server_submission, each file of "
+              "this directory, or each of the submissions of this file "
+              "(\"-\" for the standard input), separated by blank lines. "
+              "A line is written to the standard output for each, as it "
+              "is done, with its name (the file name, or its index in the "
+              "file) and its verified SCT, in base64, or the error");
+DEFINE_int32(upload_concurrency, 4,
+             "How many upload requests are in flight at once with "
+             "--ct_server_submissions_in");
+DEFINE_int32(upload_batch_size, 100,
+             "How many certificate chains are uploaded in each add-chains "
+             "request with --ct_server_submissions_in, where the log has "
+             "that NON-standard endpoint");
 DEFINE_bool(precert, false, "The submission is a CA precertificate chain");
 DEFINE_string(sct_token, "",
               "Input file containing the SCT of the certificate");
 DEFINE_string(ssl_client_ct_data_in, "",
               "Input file for reading the SSLClientCTData");
+DEFINE_string(audit_leaf_hashes_in, "",
+              "If set, the 'audit' command checks the inclusion of each "
+              "of the base64 Merkle leaf hashes in this file, one per "
+              "line, instead of the SCTs of --ssl_client_ct_data_in");
+DEFINE_int32(audit_concurrency, 16,
+             "Number of proof requests in flight with "
+             "--audit_leaf_hashes_in");
 DEFINE_string(ssl_client_ct_data_out, "",
               "Output file for recording the server's leaf certificate, "
               "as well as all received and validated SCTs.");
@@ -78,11 +128,30 @@ DEFINE_string(certificate_chain_in, "",
               "Certificate chain to analyze, "
               "in PEM format");
 DEFINE_string(sct_in, "", "SCT to wrap");
-DEFINE_int32(get_first, 0, "First entry to retrieve with the 'get' command");
-DEFINE_int32(get_last, 0, "Last entry to retrieve with the 'get' command");
+DEFINE_int64(get_first, 0, "First entry to retrieve with the 'get' command");
+DEFINE_int64(get_last, 0,
+             "Last entry to retrieve with the 'get' command. With "
+             "--entries_dump_dir, a negative value means the last entry "
+             "of the log's current tree.");
 DEFINE_string(certificate_base, "",
               "Base name for retrieved certificates - "
               "files will be <base><entry>.<cert>.der");
+DEFINE_string(entries_dump_dir, "",
+              "If set, get_entries downloads the entries with several "
+              "requests in flight, and writes them to segment files in "
+              "this directory instead of under --certificate_base. "
+              "Running it again with the same directory resumes after "
+              "the last segment written.");
+DEFINE_int32(entries_dump_concurrency, 8,
+             "Number of get-entries requests in flight with "
+             "--entries_dump_dir");
+DEFINE_int32(entries_dump_retries, 5,
+             "Number of times a failed get-entries request is sent again "
+             "with --entries_dump_dir");
+DEFINE_int64(entries_dump_segment_size, 100000,
+             "Number of entries in each segment file of --entries_dump_dir");
+DEFINE_bool(entries_dump_gzip, false,
+            "Whether to gzip the segment files of --entries_dump_dir");
 DEFINE_string(
     monitor_action, "loop",
     "Step the monitor shall do (or loop). "
@@ -92,7 +161,9 @@ DEFINE_string(
     "get_entries - put entries from log into monitor database\n"
     "confirm_tree - build merkletree (latest STH in db OR a given timestamp)\n"
     "init - initiate monitor (i.e. database) prior to its first run\n"
-    "loop - start the monitor in a loop (default)");
+    "loop - start the monitor in a loop (default)\n"
+    "find_names - print the entries indexed with --monitor_index_names "
+    "for the names in --monitor_domain");
 DEFINE_string(sqlite_db, "", "Database for certificate and tree storage");
 DEFINE_uint64(timestamp, 0,
               "The timestamp to be used in the monitor actions "
@@ -102,13 +173,26 @@ DEFINE_string(sth2, "", "File containing second STH");
 DEFINE_uint64(monitor_sleep_time_secs, 60,
               "Amount of time the monitor shall "
               "sleep between probing for a new STH.");
+DEFINE_string(monitor_domain, "",
+              "The domain the find_names monitor action prints the "
+              "entries of, its own and those of the names within it.");
+DEFINE_string(monitor_logs, "",
+              "If set, a file listing logs to monitor at once instead of "
+              "--ct_server, one per line as \"<name> <server> <public key "
+              "file>\", with their state in --sqlite_db. Only the init and "
+              "loop monitor actions are available for them.");
+DEFINE_int32(monitor_threads, 4,
+             "Number of threads that the logs of --monitor_logs share to "
+             "verify and write what they get");
 
 
 static const char kUsage[] =
     " <command> ...\n"
     "Known commands:\n"
-    "connect - connect to an SSL server\n"
-    "upload - upload a submission to a CT log server\n"
+    "connect - connect to an SSL server, or scan many with "
+    "--ssl_servers_in\n"
+    "upload - upload a submission, or many with\n"
+    "         --ct_server_submissions_in, to a CT log server\n"
     "certificate - make a superfluous proof certificate\n"
     "extension_data - convert an audit proof to TLS extension format\n"
     "configure_proof - write the proof in an X509v3 configuration file\n"
@@ -124,6 +208,8 @@ static const char kUsage[] =
     "monitor - use the monitor (see monitor_action flag)\n"
     "Use --help to display command-line flag options\n";
 
+namespace libevent = cert_trans::libevent;
+
 using cert_trans::AsyncLogClient;
 using cert_trans::Cert;
 using cert_trans::CertChain;
@@ -131,6 +217,7 @@ using cert_trans::CertSubmissionHandler;
 using cert_trans::HTTPLogClient;
 using cert_trans::PreCertChain;
 using cert_trans::ReadPublicKey;
+using cert_trans::SCTVerificationCache;
 using cert_trans::SSLClient;
 using cert_trans::ScopedASN1_OCTET_STRING;
 using cert_trans::ScopedBIGNUM;
@@ -140,6 +227,8 @@ using cert_trans::ScopedRSA;
 using cert_trans::ScopedX509;
 using cert_trans::ScopedX509_NAME;
 using cert_trans::TbsCertificate;
+using cert_trans::ThreadPool;
+using cert_trans::UrlFetcher;
 using ct::LogEntry;
 using ct::MerkleAuditProof;
 using ct::SSLClientCTData;
@@ -147,6 +236,7 @@ using ct::SignedCertificateTimestamp;
 using ct::SignedCertificateTimestampList;
 using std::shared_ptr;
 using std::string;
+using std::to_string;
 using std::unique_ptr;
 using std::vector;
 using util::StatusOr;
@@ -162,17 +252,20 @@ static string SCTToList(const string& serialized_sct) {
   return result;
 }
 
-static LogVerifier* GetLogVerifierFromFlags() {
-  CHECK(!FLAGS_ct_server_public_key.empty());
-
-  StatusOr<EVP_PKEY*> pkey(ReadPublicKey(FLAGS_ct_server_public_key));
-  CHECK(pkey.ok()) << "could not read CT server public key file: "
-                   << pkey.status();
+static LogVerifier* GetLogVerifier(const string& public_key_file) {
+  StatusOr<EVP_PKEY*> pkey(ReadPublicKey(public_key_file));
+  CHECK(pkey.ok()) << "could not read CT server public key file "
+                   << public_key_file << ": " << pkey.status();
 
   return new LogVerifier(new LogSigVerifier(pkey.ValueOrDie()),
                          new MerkleVerifier(new Sha256Hasher()));
 }
 
+static LogVerifier* GetLogVerifierFromFlags() {
+  CHECK(!FLAGS_ct_server_public_key.empty());
+  return GetLogVerifier(FLAGS_ct_server_public_key);
+}
+
 // Adds the data to the cert as an extension, formatted as a single
 // ASN.1 octet string.
 static void AddOctetExtension(X509* cert, int nid, const unsigned char* data,
@@ -379,6 +472,148 @@ static int Upload() {
   return 0;
 }
 
+// Returns a source of the submissions of --ct_server_submissions_in,
+// which sets |*name| to that of each.
+static HTTPLogClient::SubmissionSource SubmissionsIn(string* name) {
+  const string& in(FLAGS_ct_server_submissions_in);
+  struct stat st;
+  if (in != "-" && stat(in.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+    DIR* const dir(opendir(in.c_str()));
+    PCHECK(dir != nullptr) << "opendir " << in;
+    shared_ptr<vector<string>> files(new vector<string>);
+    for (const dirent* ent; (ent = readdir(dir)) != nullptr;) {
+      if (ent->d_name[0] != '.') {
+        files->push_back(ent->d_name);
+      }
+    }
+    closedir(dir);
+    std::sort(files->begin(), files->end());
+    LOG(INFO) << "Uploading the " << files->size() << " files of " << in;
+
+    shared_ptr<size_t> next(new size_t(0));
+    return [in, files, next, name](string* submission) {
+      while (*next < files->size()) {
+        const string& file((*files)[(*next)++]);
+        const string path(in + "/" + file);
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+          continue;
+        }
+        PCHECK(util::ReadBinaryFile(path, submission))
+            << "Could not read CT log server submission from " << path;
+        *name = file;
+        return true;
+      }
+      return false;
+    };
+  }
+
+  shared_ptr<std::istream> stream;
+  if (in == "-") {
+    stream.reset(&std::cin, [](std::istream*) {});
+  } else {
+    stream.reset(new std::ifstream(in.c_str(), std::ios::in));
+    PCHECK(stream->good()) << "Could not open " << in;
+  }
+  shared_ptr<size_t> next(new size_t(0));
+  return [stream, next, name](string* submission) {
+    submission->clear();
+    for (string line; std::getline(*stream, line);) {
+      if (line.empty() || line == "\r") {
+        if (!submission->empty()) {
+          break;
+        }
+        continue;
+      }
+      submission->append(line).append("\n");
+    }
+    if (submission->empty()) {
+      return false;
+    }
+    *name = to_string((*next)++);
+    return true;
+  };
+}
+
+
+// Uploads the submissions of --ct_server_submissions_in, and verifies
+// their SCTs on a thread pool while the uploads carry on.
+// 0 - all uploaded, and their SCTs verified
+// 1 - some were not
+static int UploadMany() {
+  HTTPLogClient client(FLAGS_ct_server);
+  // The names of the submissions in flight, by index.
+  std::map<size_t, string> names;
+  string name;
+  const HTTPLogClient::SubmissionSource source(SubmissionsIn(&name));
+  size_t count(0);
+
+  std::mutex output_lock;
+  const auto output([&output_lock](const string& line) {
+    std::lock_guard<std::mutex> lock(output_lock);
+    std::cout << line << std::endl;
+  });
+  std::atomic<size_t> num_failed(0);
+  {
+    ThreadPool verify_pool("ct verify");
+    client.UploadSubmissionsPipelined(
+        [&names, &name, &source, &count](string* submission) {
+          if (!source(submission)) {
+            return false;
+          }
+          names[count++] = name;
+          return true;
+        },
+        FLAGS_precert, FLAGS_upload_concurrency, FLAGS_upload_batch_size,
+        [&names, &verify_pool, &output, &num_failed](
+            size_t index, const string& submission,
+            const AsyncLogClient::AddChainResult& result) {
+          const auto it(names.find(index));
+          CHECK(it != names.end());
+          const string name(it->second);
+          names.erase(it);
+          if (result.status != AsyncLogClient::OK) {
+            ++num_failed;
+            output(name + " error " + to_string(result.status) +
+                   (result.error_message.empty()
+                        ? ""
+                        : " " + result.error_message));
+            return;
+          }
+
+          const SignedCertificateTimestamp sct(result.sct);
+          verify_pool.Add([name, submission, sct, &output, &num_failed]() {
+            SSLClientCTData ct_data;
+            bool verified(true);
+            if (FLAGS_precert) {
+              PreCertChain chain(submission);
+              // As in Upload(), this needs the issuing certificate.
+              if (chain.Length() > 1) {
+                verified = CheckSCT(sct, chain, &ct_data);
+              }
+            } else {
+              verified = CheckSCT(sct, CertChain(submission), &ct_data);
+            }
+            string serialized;
+            if (!verified ||
+                Serializer::SerializeSCT(sct, &serialized) !=
+                    SerializeResult::OK) {
+              ++num_failed;
+              output(name + " invalid SCT");
+              return;
+            }
+            output(name + " " + util::ToBase64(serialized));
+          });
+        });
+    // The pool waits for the verifications still running.
+  }
+
+  LOG(INFO) << count - num_failed << " of " << count
+            << " submissions uploaded and verified";
+  return num_failed == 0 ? 0 : 1;
+}
+
+
 // FIXME: fix all the memory leaks in this code.
 static void MakeCert() {
   string sct;
@@ -598,6 +833,73 @@ static SSLClient::HandshakeResult Connect() {
   return result;
 }
 
+// Connects to each server of --ssl_servers_in, with up to
+// --ssl_scan_concurrency handshakes at once, sharing the SCTs verified.
+// 0 - all handshakes succeeded
+// 1 - some did not
+static int ScanServers() {
+  string servers_file;
+  PCHECK(util::ReadTextFile(FLAGS_ssl_servers_in, &servers_file))
+      << "Could not read servers from " << FLAGS_ssl_servers_in;
+  vector<std::pair<string, uint16_t>> servers;
+  std::istringstream lines(servers_file);
+  for (string line; std::getline(lines, line);) {
+    if (line.empty())
+      continue;
+    std::istringstream fields(line);
+    string address;
+    int port;
+    CHECK(fields >> address >> port) << "Invalid server line " << line;
+    CHECK(port > 0 && port < 65536) << "Invalid port in " << line;
+    struct in_addr addr;
+    CHECK_EQ(1, inet_aton(address.c_str(), &addr))
+        << "Invalid address in " << line;
+    servers.emplace_back(address, port);
+  }
+
+  CHECK_GT(FLAGS_sct_verification_cache_size, 0);
+  SCTVerificationCache cache(FLAGS_sct_verification_cache_size);
+  std::mutex output_lock;
+  std::atomic<size_t> num_failed(0);
+  {
+    ThreadPool pool("ct scan", std::max(FLAGS_ssl_scan_concurrency, 1));
+    for (const auto& server : servers) {
+      pool.Add([&server, &cache, &output_lock, &num_failed]() {
+        SSLClient client(server.first, server.second,
+                         FLAGS_ssl_client_trusted_cert_dir,
+                         GetLogVerifierFromFlags(), &cache);
+        const SSLClient::HandshakeResult result(
+            FLAGS_ssl_client_require_sct ? client.SSLConnectStrict()
+                                         : client.SSLConnect());
+        int num_scts(0);
+        if (result == SSLClient::OK) {
+          SSLClientCTData ct_data;
+          client.GetSSLClientCTData(&ct_data);
+          num_scts = ct_data.attached_sct_info_size();
+        } else {
+          ++num_failed;
+        }
+
+        std::lock_guard<std::mutex> lock(output_lock);
+        std::cout << server.first << " " << server.second << " "
+                  << (result == SSLClient::OK
+                          ? "OK"
+                          : result == SSLClient::HANDSHAKE_FAILED
+                                ? "HANDSHAKE_FAILED"
+                                : "SERVER_UNAVAILABLE")
+                  << " " << num_scts << std::endl;
+      });
+    }
+    // The pool waits for the scans still running.
+  }
+
+  LOG(INFO) << servers.size() - num_failed << " of " << servers.size()
+            << " handshakes succeeded, " << cache.hits() << " of "
+            << cache.hits() + cache.misses()
+            << " SCTs were already verified";
+  return num_failed == 0 ? 0 : 1;
+}
+
 enum AuditResult {
   // At least one SCT has a valid proof.
   // (Should be unusual to have more than one SCT from the same log,
@@ -622,6 +924,7 @@ static AuditResult Audit() {
   string key_id = verifier->KeyID();
 
   AuditResult audit_result = PROOF_NOT_FOUND;
+  HTTPLogClient client(FLAGS_ct_server);
 
   for (int i = 0; i < ct_data.attached_sct_info_size(); ++i) {
     LOG(INFO) << "Signed Certificate Timestamp number " << i + 1 << ":\n"
@@ -635,7 +938,6 @@ static AuditResult Audit() {
     }
 
     MerkleAuditProof proof;
-    HTTPLogClient client(FLAGS_ct_server);
 
     LOG(INFO) << "info = " << ct_data.attached_sct_info(i).DebugString();
     AsyncLogClient::Status ret =
@@ -672,6 +974,80 @@ static AuditResult Audit() {
   return audit_result;
 }
 
+// Audits the leaf hashes of --audit_leaf_hashes_in against the current
+// STH, printing a line for each with its leaf index, or why it failed.
+static AuditResult AuditLeafHashes() {
+  string hashes_file;
+  PCHECK(util::ReadTextFile(FLAGS_audit_leaf_hashes_in, &hashes_file))
+      << "Could not read leaf hashes from " << FLAGS_audit_leaf_hashes_in;
+  vector<string> leaf_hashes;
+  std::istringstream lines(hashes_file);
+  for (string line; std::getline(lines, line);) {
+    if (line.empty())
+      continue;
+    leaf_hashes.push_back(util::FromBase64(line.c_str()));
+    CHECK_EQ(leaf_hashes.back().size(), 32U) << "Invalid leaf hash " << line;
+  }
+
+  HTTPLogClient client(FLAGS_ct_server);
+  ct::SignedTreeHead sth;
+  vector<MerkleAuditProof> proofs;
+  vector<AsyncLogClient::Status> statuses;
+  const AsyncLogClient::Status ret(client.QueryAuditProofs(
+      leaf_hashes, FLAGS_audit_concurrency, &sth, &proofs, &statuses));
+  if (ret == AsyncLogClient::CONNECT_FAILED) {
+    LOG(ERROR) << "Unable to connect";
+    return CT_SERVER_UNAVAILABLE;
+  }
+  CHECK_EQ(ret, AsyncLogClient::OK) << "Could not get the STH";
+
+  const unique_ptr<LogVerifier> verifier(GetLogVerifierFromFlags());
+  const LogVerifier::LogVerifyResult sth_result(
+      verifier->VerifySignedTreeHead(sth));
+  if (sth_result != LogVerifier::VERIFY_OK) {
+    LOG(ERROR) << "STH verify error: "
+               << LogVerifier::VerifyResultString(sth_result);
+    return PROOF_NOT_FOUND;
+  }
+
+  // Check all the paths that were received against the STH at once.
+  vector<size_t> received;
+  vector<MerkleVerifier::AuditPath> paths;
+  for (size_t i = 0; i < leaf_hashes.size(); ++i) {
+    if (statuses[i] != AsyncLogClient::OK)
+      continue;
+    received.push_back(i);
+    paths.emplace_back();
+    // Leaf indexing in the MerkleTree starts from 1.
+    paths.back().leaf = proofs[i].leaf_index() + 1;
+    paths.back().leaf_hash = leaf_hashes[i];
+    paths.back().path.assign(proofs[i].path_node().begin(),
+                             proofs[i].path_node().end());
+  }
+  MerkleVerifier merkle_verifier(new Sha256Hasher);
+  vector<bool> valid;
+  const size_t num_valid(merkle_verifier.VerifyPaths(
+      sth.tree_size(), sth.sha256_root_hash(), paths, &valid));
+
+  vector<string> results(leaf_hashes.size());
+  for (size_t i = 0; i < leaf_hashes.size(); ++i) {
+    results[i] = "error " + to_string(statuses[i]);
+  }
+  for (size_t p = 0; p < paths.size(); ++p) {
+    const MerkleAuditProof& proof(proofs[received[p]]);
+    results[received[p]] = valid[p] ? to_string(proof.leaf_index())
+                                    : "invalid proof";
+  }
+  for (size_t i = 0; i < leaf_hashes.size(); ++i) {
+    std::cout << util::ToBase64(leaf_hashes[i]) << " " << results[i] << "\n";
+  }
+
+  LOG(INFO) << num_valid << " of " << leaf_hashes.size()
+            << " leaf hashes verified in the tree of size "
+            << sth.tree_size();
+  return num_valid == leaf_hashes.size() ? PROOF_OK : PROOF_NOT_FOUND;
+}
+
 static int CheckConsistency() {
   HTTPLogClient client(FLAGS_ct_server);
   LogVerifier* verifier = GetLogVerifierFromFlags();
@@ -844,7 +1220,7 @@ void WrapEmbedded() {
   WriteSSLClientCTData(ct_data, FLAGS_ssl_client_ct_data_out);
 }
 
-static void WriteCertificate(const std::string& cert, int entry,
+static void WriteCertificate(const std::string& cert, int64_t entry,
                              int cert_number, const char* type) {
   std::ostringstream outname;
   outname << FLAGS_certificate_base << entry << '.' << cert_number << '.'
@@ -854,6 +1230,138 @@ static void WriteCertificate(const std::string& cert, int entry,
   out << cert;
 }
 
+// The file of --entries_dump_dir that holds the index of the first
+// entry not yet written to a segment, in decimal.
+static const char kDumpCheckpointFile[] = "checkpoint";
+
+static string DumpSegmentPath(int64_t first) {
+  char name[32];
+  snprintf(name, sizeof(name), "entries-%020" PRId64, first);
+  return FLAGS_entries_dump_dir + "/" + name +
+         (FLAGS_entries_dump_gzip ? ".gz" : "");
+}
+
+static void AppendLengthPrefixed(const string& data, string* out) {
+  CHECK_LE(data.size(), 0xffffffffUL);
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out->push_back(static_cast<char>(data.size() >> shift));
+  out->append(data);
+}
+
+static string Gzip(const string& data) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // 16 more window bits ask for a gzip header and trailer.
+  CHECK_EQ(Z_OK, deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                              15 + 16, 8, Z_DEFAULT_STRATEGY));
+  string out(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+  stream.avail_out = out.size();
+  CHECK_EQ(Z_STREAM_END, deflate(&stream, Z_FINISH));
+  out.resize(stream.total_out);
+  CHECK_EQ(Z_OK, deflateEnd(&stream));
+  return out;
+}
+
+// Writes |contents| to |path| through a temporary file, so that |path|
+// is either complete or as it was before.
+static void WriteFileAtomically(const string& path, const string& contents) {
+  const string tmp_path(path + ".tmp");
+  const int fd(open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  PCHECK(fd >= 0) << "open " << tmp_path;
+  for (size_t written = 0; written < contents.size();) {
+    const ssize_t ret(
+        write(fd, contents.data() + written, contents.size() - written));
+    if (ret < 0 && errno == EINTR)
+      continue;
+    PCHECK(ret > 0) << "write " << tmp_path;
+    written += ret;
+  }
+  PCHECK(fdatasync(fd) == 0) << "fdatasync " << tmp_path;
+  PCHECK(close(fd) == 0) << "close " << tmp_path;
+  PCHECK(rename(tmp_path.c_str(), path.c_str()) == 0) << "rename "
+                                                      << tmp_path;
+}
+
+// Downloads [--get_first, --get_last] into --entries_dump_dir. Each
+// segment file is named after the index of its first entry, and holds
+// up to --entries_dump_segment_size consecutive entries, each as the
+// leaf_input and then the extra_data of get-entries, both in binary
+// with a 4-byte big-endian length before them.
+static int DumpEntries() {
+  CHECK_NE(FLAGS_ct_server, "");
+  CHECK_GT(FLAGS_entries_dump_segment_size, 0);
+  HTTPLogClient client(FLAGS_ct_server);
+
+  int64_t last(FLAGS_get_last);
+  if (last < 0) {
+    ct::SignedTreeHead sth;
+    CHECK_EQ(AsyncLogClient::OK, client.GetSTH(&sth));
+    last = sth.tree_size() - 1;
+  }
+
+  PCHECK(mkdir(FLAGS_entries_dump_dir.c_str(), 0755) == 0 || errno == EEXIST)
+      << "mkdir " << FLAGS_entries_dump_dir;
+  const string checkpoint_path(FLAGS_entries_dump_dir + "/" +
+                               kDumpCheckpointFile);
+  int64_t next(FLAGS_get_first);
+  string checkpoint;
+  if (util::ReadTextFile(checkpoint_path, &checkpoint)) {
+    next = std::max<int64_t>(next, std::stoll(checkpoint));
+    LOG(INFO) << "Resuming from entry " << next;
+  }
+  if (next > last) {
+    LOG(INFO) << "All entries up to " << last << " are already written";
+    return 0;
+  }
+
+  // The segment being filled, the entries of it so far, and where it
+  // starts.
+  string segment;
+  int64_t segment_size(0);
+  int64_t segment_first(next);
+  const auto flush([&]() {
+    if (segment_size == 0)
+      return;
+    WriteFileAtomically(DumpSegmentPath(segment_first),
+                        FLAGS_entries_dump_gzip ? Gzip(segment) : segment);
+    segment_first += segment_size;
+    WriteFileAtomically(checkpoint_path, to_string(segment_first) + "\n");
+    LOG(INFO) << "Wrote entries up to " << segment_first - 1;
+    segment.clear();
+    segment_size = 0;
+  });
+
+  const AsyncLogClient::Status status(client.GetEntriesPipelined(
+      next, last, FLAGS_entries_dump_concurrency, FLAGS_entries_dump_retries,
+      [&](int64_t first, vector<AsyncLogClient::Entry>* entries) {
+        CHECK_EQ(segment_first + segment_size, first);
+        cert_trans::LoggedEntry logged;
+        string leaf_input;
+        string extra_data;
+        for (const AsyncLogClient::Entry& entry : *entries) {
+          CHECK(logged.CopyFromClientLogEntry(entry));
+          CHECK(logged.SerializeForLeaf(&leaf_input));
+          CHECK(logged.SerializeExtraData(&extra_data));
+          AppendLengthPrefixed(leaf_input, &segment);
+          AppendLengthPrefixed(extra_data, &segment);
+          if (++segment_size == FLAGS_entries_dump_segment_size)
+            flush();
+        }
+      }));
+  // Keep what was received before a failure, to resume after it.
+  flush();
+  if (status != AsyncLogClient::OK) {
+    LOG(ERROR) << "get-entries failed with status " << status
+               << " after entry " << segment_first - 1
+               << ", run again to resume";
+    return 1;
+  }
+  return 0;
+}
+
 void GetEntries() {
   CHECK_NE(FLAGS_ct_server, "");
   HTTPLogClient client(FLAGS_ct_server);
@@ -864,7 +1372,7 @@ void GetEntries() {
 
   CHECK(!FLAGS_certificate_base.empty());
 
-  int e = FLAGS_get_first;
+  int64_t e = FLAGS_get_first;
   for (std::vector<AsyncLogClient::Entry>::const_iterator
            entry = entries.begin();
        entry != entries.end(); ++entry, ++e) {
@@ -950,10 +1458,49 @@ static monitor::Database* GetMonitorDBFromFlags() {
   return db;
 }
 
+// Monitors the logs of --monitor_logs, sharing an event loop and the
+// connections to them.
+static int MonitorLogs() {
+  CHECK_NE(FLAGS_sqlite_db, "");
+  CHECK_GT(FLAGS_monitor_threads, 0);
+  std::ifstream list(FLAGS_monitor_logs);
+  CHECK(list) << "could not open " << FLAGS_monitor_logs;
+
+  const shared_ptr<libevent::Base> base(std::make_shared<libevent::Base>());
+  libevent::EventPumpThread pump(base);
+  ThreadPool fetcher_pool;
+  UrlFetcher fetcher(base.get(), &fetcher_pool);
+  ThreadPool pool("monitor", FLAGS_monitor_threads);
+  monitor::MultiMonitor monitor(FLAGS_sqlite_db, base.get(), &fetcher, &pool,
+                                FLAGS_monitor_sleep_time_secs);
+
+  string line;
+  while (getline(list, line)) {
+    std::istringstream fields(line);
+    string name, server, public_key_file;
+    if (!(fields >> name) || name[0] == '#')
+      continue;
+    CHECK(fields >> server >> public_key_file)
+        << "malformed line in " << FLAGS_monitor_logs << ": " << line;
+    monitor.AddLog(name, server, GetLogVerifier(public_key_file));
+  }
+
+  if (FLAGS_monitor_action == "init") {
+    monitor.Init();
+  } else if (FLAGS_monitor_action == "loop") {
+    monitor.Loop();
+  } else {
+    LOG(FATAL) << "Wrong monitor_action flag given for --monitor_logs.";
+  }
+  return 0;
+}
+
 // Return code 0 indicates success.
 // See monitor class for the monitor action specific return codes.
 int Monitor() {
   CHECK_NE(FLAGS_monitor_action, "");
+  if (!FLAGS_monitor_logs.empty())
+    return MonitorLogs();
   CHECK_NE(FLAGS_ct_server, "");
 
   HTTPLogClient client(FLAGS_ct_server);
@@ -973,6 +1520,12 @@ int Monitor() {
     monitor.Init();
   } else if (FLAGS_monitor_action == "loop") {
     monitor.Loop();
+  } else if (FLAGS_monitor_action == "find_names") {
+    CHECK_NE(FLAGS_monitor_domain, "");
+    std::vector<std::pair<string, int64_t>> found;
+    monitor.FindNames(FLAGS_monitor_domain, &found);
+    for (const std::pair<string, int64_t>& name : found)
+      std::cout << name.second << " " << name.first << std::endl;
   } else {
     LOG(FATAL) << "Wrong monitor_action flag given.";
   }
@@ -992,6 +1545,7 @@ int Monitor() {
 int main(int argc, char** argv) {
   google::SetUsageMessage(argv[0] + string(kUsage));
   util::InitCT(&argc, &argv);
+  ConfigureSerializerForV1CT();
 
   const string main_command(argv[0]);
   if (argc < 2) {
@@ -1002,16 +1556,18 @@ int main(int argc, char** argv) {
   const string cmd(argv[1]);
 
   int ret = 0;
-  if (cmd == "connect") {
+  if (cmd == "connect" && !FLAGS_ssl_servers_in.empty()) {
+    ret = ScanServers();
+  } else if (cmd == "connect") {
     bool want_fail = FLAGS_ssl_client_expect_handshake_failure;
     SSLClient::HandshakeResult result = Connect();
     if ((!want_fail && result != SSLClient::OK) ||
         (want_fail && result != SSLClient::HANDSHAKE_FAILED))
       ret = 1;
   } else if (cmd == "upload") {
-    ret = Upload();
+    ret = FLAGS_ct_server_submissions_in.empty() ? Upload() : UploadMany();
   } else if (cmd == "audit") {
-    ret = Audit();
+    ret = FLAGS_audit_leaf_hashes_in.empty() ? Audit() : AuditLeafHashes();
   } else if (cmd == "consistency") {
     ret = CheckConsistency();
   } else if (cmd == "certificate") {
@@ -1027,7 +1583,11 @@ int main(int argc, char** argv) {
   } else if (cmd == "wrap_embedded") {
     WrapEmbedded();
   } else if (cmd == "get_entries") {
-    GetEntries();
+    if (FLAGS_entries_dump_dir.empty()) {
+      GetEntries();
+    } else {
+      ret = DumpEntries();
+    }
   } else if (cmd == "get_roots") {
     ret = GetRoots();
   } else if (cmd == "monitor") {
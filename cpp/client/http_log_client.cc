@@ -3,6 +3,9 @@
 
 #include <event2/buffer.h>
 #include <glog/logging.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <functional>
 #include <memory>
 
@@ -10,6 +13,7 @@
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
 #include "util/json_wrapper.h"
+#include "util/task.h"
 #include "util/util.h"
 
 namespace libevent = cert_trans::libevent;
@@ -23,29 +27,115 @@ using cert_trans::ThreadPool;
 using ct::MerkleAuditProof;
 using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
-using std::bind;
+using std::chrono::duration;
+using std::deque;
+using std::lock_guard;
+using std::min;
+using std::move;
+using std::mutex;
 using std::unique_ptr;
-using std::placeholders::_1;
 using std::string;
+using std::unique_lock;
 using std::vector;
 
 namespace {
 
+// The delay before the first retry of a failed request of
+// GetEntriesPipelined(), which doubles for each retry after it.
+const double kFirstRetryDelaySeconds = 1;
 
-void DoneRequest(AsyncLogClient::Status status, AsyncLogClient::Status* retval,
-                 bool* done) {
-  *retval = status;
-  *done = true;
-}
+
+// A get-entries request of GetEntriesPipelined().
+struct EntriesRequest {
+  EntriesRequest(int64_t first, int64_t last)
+      : first(first),
+        last(last),
+        status(AsyncLogClient::UNKNOWN_ERROR),
+        done(false),
+        retries(0) {
+  }
+
+  const int64_t first;
+  const int64_t last;
+  AsyncLogClient::Status status;
+  bool done;
+  int retries;
+  vector<AsyncLogClient::Entry> entries;
+};
+
+
+// A get-proof-by-hash request of QueryAuditProofs().
+struct ProofRequest {
+  ProofRequest() : status(AsyncLogClient::UNKNOWN_ERROR), done(false) {
+  }
+
+  AsyncLogClient::Status status;
+  bool done;
+};
+
+
+// An add-chains, add-chain or add-pre-chain request of
+// UploadSubmissionsPipelined(), for the submissions from |first| on.
+struct UploadRequest {
+  UploadRequest(size_t first, bool batched)
+      : first(first),
+        batched(batched),
+        sent(false),
+        status(AsyncLogClient::UNKNOWN_ERROR),
+        done(false) {
+  }
+
+  const size_t first;
+  const bool batched;
+  vector<string> submissions;
+  bool sent;
+  AsyncLogClient::Status status;
+  bool done;
+  // For batched requests, one for each of |submissions|.
+  vector<AsyncLogClient::AddChainResult> results;
+  // For the others.
+  SignedCertificateTimestamp sct;
+};
 
 
 }  // namespace
 
 HTTPLogClient::HTTPLogClient(const string& server)
-    : base_(new libevent::Base()),
-      pool_(),
-      fetcher_(base_.get(), &pool_),
-      client_(base_.get(), &fetcher_, server) {
+    : own_base_(new libevent::Base),
+      own_pool_(new ThreadPool),
+      own_fetcher_(new UrlFetcher(own_base_.get(), own_pool_.get())),
+      base_(own_base_.get()),
+      client_(base_, own_fetcher_.get(), server) {
+}
+
+
+HTTPLogClient::HTTPLogClient(libevent::Base* base, UrlFetcher* fetcher,
+                             const string& server)
+    : base_(CHECK_NOTNULL(base)),
+      client_(base_, CHECK_NOTNULL(fetcher), server) {
+}
+
+
+AsyncLogClient::Callback HTTPLogClient::Done(AsyncLogClient::Status* retval,
+                                             bool* done) {
+  return [this, retval, done](AsyncLogClient::Status status) {
+    lock_guard<mutex> lock(mutex_);
+    *retval = status;
+    *done = true;
+    done_cv_.notify_all();
+  };
+}
+
+
+void HTTPLogClient::Wait(const bool* done) {
+  if (own_base_) {
+    while (!*done) {
+      base_->DispatchOnce();
+    }
+    return;
+  }
+  unique_lock<mutex> lock(mutex_);
+  done_cv_.wait(lock, [done]() { return *done; });
 }
 
 AsyncLogClient::Status HTTPLogClient::UploadSubmission(
@@ -55,30 +145,149 @@ AsyncLogClient::Status HTTPLogClient::UploadSubmission(
 
   if (pre) {
     PreCertChain pre_cert_chain(submission);
-    client_.AddPreCertChain(pre_cert_chain, sct,
-                            bind(&DoneRequest, _1, &retval, &done));
+    client_.AddPreCertChain(pre_cert_chain, sct, Done(&retval, &done));
   } else {
     CertChain cert_chain(submission);
-    client_.AddCertChain(cert_chain, sct,
-                         bind(&DoneRequest, _1, &retval, &done));
+    client_.AddCertChain(cert_chain, sct, Done(&retval, &done));
   }
 
-  while (!done) {
-    base_->DispatchOnce();
+  Wait(&done);
+
+  return retval;
+}
+
+
+AsyncLogClient::Status HTTPLogClient::UploadSubmissions(
+    const vector<string>& submissions,
+    vector<AsyncLogClient::AddChainResult>* results) {
+  AsyncLogClient::Status retval(AsyncLogClient::UNKNOWN_ERROR);
+  bool done(false);
+
+  vector<unique_ptr<CertChain>> cert_chains;
+  vector<const CertChain*> chains;
+  for (const string& submission : submissions) {
+    cert_chains.emplace_back(new CertChain(submission));
+    chains.push_back(cert_chains.back().get());
   }
 
+  client_.AddCertChains(chains, results,
+                        Done(&retval, &done));
+  Wait(&done);
+
   return retval;
 }
 
 
+void HTTPLogClient::UploadSubmissionsPipelined(const SubmissionSource& next,
+                                               bool pre, int concurrency,
+                                               int batch_size,
+                                               const UploadCallback& handle) {
+  CHECK_GT(concurrency, 0);
+  CHECK_GT(batch_size, 0);
+  // The requests in flight, in order, followed by those waiting for
+  // room among them.
+  deque<unique_ptr<UploadRequest>> requests;
+  const auto send([this, pre](UploadRequest* request) {
+    request->sent = true;
+    if (request->batched) {
+      vector<unique_ptr<CertChain>> cert_chains;
+      vector<const CertChain*> chains;
+      for (const string& submission : request->submissions) {
+        cert_chains.emplace_back(new CertChain(submission));
+        chains.push_back(cert_chains.back().get());
+      }
+      client_.AddCertChains(chains, &request->results,
+                            Done(&request->status, &request->done));
+    } else if (pre) {
+      client_.AddPreCertChain(PreCertChain(request->submissions.front()),
+                              &request->sct,
+                              Done(&request->status, &request->done));
+    } else {
+      client_.AddCertChain(CertChain(request->submissions.front()),
+                           &request->sct,
+                           Done(&request->status, &request->done));
+    }
+  });
+
+  // Whether add-chains is used, and whether the log has served it.
+  bool batched(!pre);
+  bool batched_ok(false);
+  size_t index(0);
+  bool more(true);
+  while (true) {
+    while (more && static_cast<int>(requests.size()) < concurrency) {
+      unique_ptr<UploadRequest> request(new UploadRequest(index, batched));
+      string submission;
+      while (static_cast<int>(request->submissions.size()) <
+                 (batched ? batch_size : 1) &&
+             (more = next(&submission))) {
+        request->submissions.emplace_back(move(submission));
+      }
+      if (request->submissions.empty()) {
+        break;
+      }
+      index += request->submissions.size();
+      requests.emplace_back(move(request));
+    }
+    if (requests.empty()) {
+      break;
+    }
+    for (size_t i = 0;
+         i < requests.size() && static_cast<int>(i) < concurrency; ++i) {
+      if (!requests[i]->sent) {
+        send(requests[i].get());
+      }
+    }
+
+    Wait(&requests.front()->done);
+    unique_ptr<UploadRequest> request(move(requests.front()));
+    requests.pop_front();
+    if (request->batched && request->status != AsyncLogClient::OK) {
+      if (!batched_ok && batched) {
+        LOG(WARNING) << "add-chains failed with status " << request->status
+                     << ", uploading one chain per request";
+        batched = false;
+      }
+      // Those after it still in flight are waited for, so that only
+      // those among the first |concurrency| ever are.
+      for (const auto& other : requests) {
+        if (other->sent) {
+          Wait(&other->done);
+        }
+      }
+      // One request per chain, taking the place of this one.
+      for (size_t i = request->submissions.size(); i-- > 0;) {
+        unique_ptr<UploadRequest> single(
+            new UploadRequest(request->first + i, false));
+        single->submissions.emplace_back(move(request->submissions[i]));
+        requests.emplace_front(move(single));
+      }
+      continue;
+    }
+
+    if (request->batched) {
+      batched_ok = true;
+    } else {
+      request->results.resize(1);
+      request->results.front().status = request->status;
+      if (request->status == AsyncLogClient::OK) {
+        request->results.front().sct.Swap(&request->sct);
+      }
+    }
+    for (size_t i = 0; i < request->submissions.size(); ++i) {
+      handle(request->first + i, request->submissions[i],
+             request->results[i]);
+    }
+  }
+}
+
+
 AsyncLogClient::Status HTTPLogClient::GetSTH(SignedTreeHead* sth) {
   AsyncLogClient::Status retval(AsyncLogClient::UNKNOWN_ERROR);
   bool done(false);
 
-  client_.GetSTH(sth, bind(&DoneRequest, _1, &retval, &done));
-  while (!done) {
-    base_->DispatchOnce();
-  }
+  client_.GetSTH(sth, Done(&retval, &done));
+  Wait(&done);
 
   return retval;
 }
@@ -88,10 +297,8 @@ AsyncLogClient::Status HTTPLogClient::GetRoots(
   AsyncLogClient::Status retval(AsyncLogClient::UNKNOWN_ERROR);
   bool done(false);
 
-  client_.GetRoots(roots, bind(&DoneRequest, _1, &retval, &done));
-  while (!done) {
-    base_->DispatchOnce();
-  }
+  client_.GetRoots(roots, Done(&retval, &done));
+  Wait(&done);
 
   return retval;
 }
@@ -102,10 +309,8 @@ AsyncLogClient::Status HTTPLogClient::QueryAuditProof(
   bool done(false);
   SignedTreeHead sth;
 
-  client_.GetSTH(&sth, bind(&DoneRequest, _1, &retval, &done));
-  while (!done) {
-    base_->DispatchOnce();
-  }
+  client_.GetSTH(&sth, Done(&retval, &done));
+  Wait(&done);
 
   if (retval != AsyncLogClient::OK)
     return retval;
@@ -113,39 +318,156 @@ AsyncLogClient::Status HTTPLogClient::QueryAuditProof(
   retval = AsyncLogClient::UNKNOWN_ERROR;
   done = false;
   client_.QueryInclusionProof(sth, merkle_leaf_hash, proof,
-                              bind(&DoneRequest, _1, &retval, &done));
+                              Done(&retval, &done));
+
+  Wait(&done);
+
+  return retval;
+}
 
-  while (!done) {
-    base_->DispatchOnce();
+AsyncLogClient::Status HTTPLogClient::QueryAuditProofs(
+    const vector<string>& merkle_leaf_hashes, int concurrency,
+    SignedTreeHead* sth, vector<MerkleAuditProof>* proofs,
+    vector<AsyncLogClient::Status>* statuses) {
+  CHECK_GT(concurrency, 0);
+  proofs->clear();
+  statuses->assign(merkle_leaf_hashes.size(), AsyncLogClient::UNKNOWN_ERROR);
+
+  AsyncLogClient::Status retval(AsyncLogClient::UNKNOWN_ERROR);
+  bool done(false);
+  client_.GetSTH(sth, Done(&retval, &done));
+  Wait(&done);
+  if (retval != AsyncLogClient::OK)
+    return retval;
+
+  // Neither is resized after this, as the requests write to them.
+  proofs->resize(merkle_leaf_hashes.size());
+  vector<ProofRequest> requests(merkle_leaf_hashes.size());
+  size_t next(0);
+  for (size_t i = 0; i < requests.size(); ++i) {
+    for (; next < requests.size() && next < i + concurrency; ++next) {
+      client_.QueryInclusionProof(*sth, merkle_leaf_hashes[next],
+                                  &(*proofs)[next],
+                                  Done(&requests[next].status,
+                                       &requests[next].done));
+    }
+    Wait(&requests[i].done);
+    (*statuses)[i] = requests[i].status;
   }
 
   return retval;
 }
 
 AsyncLogClient::Status HTTPLogClient::GetEntries(
-    int first, int last, vector<AsyncLogClient::Entry>* entries) {
+    int64_t first, int64_t last, vector<AsyncLogClient::Entry>* entries) {
   AsyncLogClient::Status retval(AsyncLogClient::UNKNOWN_ERROR);
   bool done(false);
 
-  client_.GetEntries(first, last, entries,
-                     bind(&DoneRequest, _1, &retval, &done));
-  while (!done) {
-    base_->DispatchOnce();
+  client_.GetEntries(first, last, entries, Done(&retval, &done));
+  Wait(&done);
+
+  return retval;
+}
+
+AsyncLogClient::Status HTTPLogClient::GetEntriesPipelined(
+    int64_t first, int64_t last, int concurrency, int max_retries,
+    const EntriesCallback& handle) {
+  CHECK_GE(first, 0);
+  CHECK_GT(concurrency, 0);
+  CHECK_GE(max_retries, 0);
+  // The requests in flight, in order. Until the first response tells
+  // how many entries the log returns at once, it is the only one.
+  deque<unique_ptr<EntriesRequest>> requests;
+  int64_t next(first);
+  int64_t batch_size(0);
+  const auto fetch([this](EntriesRequest* request) {
+    client_.GetEntries(request->first, request->last, &request->entries,
+                       Done(&request->status, &request->done));
+  });
+  const auto send([&requests, &fetch](int64_t begin, int64_t end,
+                                      bool urgent) {
+    unique_ptr<EntriesRequest> request(new EntriesRequest(begin, end));
+    fetch(request.get());
+    if (urgent) {
+      requests.emplace_front(move(request));
+    } else {
+      requests.emplace_back(move(request));
+    }
+  });
+
+  AsyncLogClient::Status retval(AsyncLogClient::OK);
+  while (true) {
+    while (next <= last &&
+           static_cast<int>(requests.size()) <
+               (batch_size > 0 ? concurrency : 1)) {
+      const int64_t request_last(
+          batch_size > 0 ? min(last, next + batch_size - 1) : last);
+      send(next, request_last, false);
+      next = request_last + 1;
+    }
+    if (requests.empty()) {
+      break;
+    }
+
+    Wait(&requests.front()->done);
+    unique_ptr<EntriesRequest> request(move(requests.front()));
+    requests.pop_front();
+    if (request->status != AsyncLogClient::OK &&
+        request->retries < max_retries) {
+      const double delay(kFirstRetryDelaySeconds * (1 << request->retries));
+      LOG(WARNING) << "get-entries " << request->first << " to "
+                   << request->last << " failed with status "
+                   << request->status << ", retrying in " << delay << "s";
+      ++request->retries;
+      request->done = false;
+      request->entries.clear();
+      // It stays first in line, so nothing else is handled before it.
+      EntriesRequest* const retry(request.get());
+      base_->Delay(duration<double>(delay),
+                   new util::Task([&fetch, retry](util::Task* task) {
+                     delete task;
+                     fetch(retry);
+                   }, base_));
+      requests.emplace_front(move(request));
+      continue;
+    }
+    if (request->status != AsyncLogClient::OK) {
+      retval = request->status;
+      break;
+    }
+    const int64_t received(request->entries.size());
+    if (received == 0 || received > request->last - request->first + 1) {
+      retval = AsyncLogClient::BAD_RESPONSE;
+      break;
+    }
+    if (batch_size == 0) {
+      batch_size = received;
+    }
+    // The log returned fewer entries than asked for, ask for the rest
+    // before the requests for the entries after them.
+    if (request->first + received <= request->last) {
+      send(request->first + received, request->last, true);
+    }
+
+    handle(request->first, &request->entries);
   }
 
+  // Wait for the requests still in flight, which write to them.
+  for (const auto& request : requests) {
+    Wait(&request->done);
+  }
   return retval;
 }
 
+
 AsyncLogClient::Status HTTPLogClient::GetSTHConsistency(
     int64_t size1, int64_t size2, vector<string>* proof) {
   AsyncLogClient::Status retval(AsyncLogClient::UNKNOWN_ERROR);
   bool done(false);
 
   client_.GetSTHConsistency(size1, size2, proof,
-                            bind(&DoneRequest, _1, &retval, &done));
-  while (!done) {
-    base_->DispatchOnce();
-  }
+                            Done(&retval, &done));
+  Wait(&done);
 
   return retval;
 }
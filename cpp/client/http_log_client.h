@@ -3,8 +3,12 @@
 #define HTTP_LOG_CLIENT_H
 
 #include <stdint.h>
+#include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "client/async_log_client.h"
@@ -21,10 +25,49 @@ class HTTPLogClient {
  public:
   explicit HTTPLogClient(const std::string& server);
 
+  // Shares |base| and |fetcher|, and so the connections of |fetcher|,
+  // with the other clients using them, such as those of the other logs
+  // of a MultiMonitor. Something else must be running the event loop of
+  // |base|, such as a libevent::EventPumpThread: the calls below wait
+  // for it to handle their responses rather than running it themselves,
+  // so that several threads can make them at once.
+  HTTPLogClient(libevent::Base* base, UrlFetcher* fetcher,
+                const std::string& server);
+
   AsyncLogClient::Status UploadSubmission(const std::string& submission,
                                           bool pre,
                                           ct::SignedCertificateTimestamp* sct);
 
+  // Uploads all of the (non-pre-)certificate chains of |submissions| in
+  // one NON-standard add-chains request, see
+  // AsyncLogClient::AddCertChains().
+  AsyncLogClient::Status UploadSubmissions(
+      const std::vector<std::string>& submissions,
+      std::vector<AsyncLogClient::AddChainResult>* results);
+
+  // Returns the next submission to upload in |*submission|, or false
+  // if there are none left.
+  typedef std::function<bool(std::string* submission)> SubmissionSource;
+
+  // Called by UploadSubmissionsPipelined() with the index of each of its
+  // submissions, counting from 0, the submission, and the outcome of
+  // uploading it.
+  typedef std::function<void(size_t index, const std::string& submission,
+                             const AsyncLogClient::AddChainResult& result)>
+      UploadCallback;
+
+  // Uploads the submissions of |next|, with up to |concurrency| requests
+  // in flight over the same connections, and passes the outcome of each
+  // to |handle| in order, as they come in. Certificate chains are sent
+  // in add-chains requests of up to |batch_size| chains each. A failed
+  // add-chains request is sent again as one add-chain request per
+  // chain, and if none had succeeded before it, the log is taken not to
+  // have the NON-standard endpoint, and the others are sent that way
+  // too. Pre-certificate chains (|pre|) always are.
+  void UploadSubmissionsPipelined(const SubmissionSource& next, bool pre,
+                                  int concurrency, int batch_size,
+                                  const UploadCallback& handle);
+
   AsyncLogClient::Status GetSTH(ct::SignedTreeHead* sth);
 
   AsyncLogClient::Status GetRoots(std::vector<std::unique_ptr<Cert>>* roots);
@@ -32,18 +75,61 @@ class HTTPLogClient {
   AsyncLogClient::Status QueryAuditProof(const std::string& merkle_leaf_hash,
                                          ct::MerkleAuditProof* proof);
 
+  // Gets the current STH into |sth|, then the proofs of all of
+  // |merkle_leaf_hashes| in its tree, with up to |concurrency| requests
+  // in flight over the same connections. Sets (*proofs)[i] and
+  // (*statuses)[i] for each hash. Returns the status of getting the
+  // STH; if it is not OK, no proof is requested.
+  AsyncLogClient::Status QueryAuditProofs(
+      const std::vector<std::string>& merkle_leaf_hashes, int concurrency,
+      ct::SignedTreeHead* sth, std::vector<ct::MerkleAuditProof>* proofs,
+      std::vector<AsyncLogClient::Status>* statuses);
+
   AsyncLogClient::Status GetSTHConsistency(int64_t size1, int64_t size2,
                                            std::vector<std::string>* proof);
 
   // This does not clear |entries| before appending the retrieved
   // entries.
   AsyncLogClient::Status GetEntries(
-      int first, int last, std::vector<AsyncLogClient::Entry>* entries);
+      int64_t first, int64_t last,
+      std::vector<AsyncLogClient::Entry>* entries);
+
+  // Called by GetEntriesPipelined() with the index of the first of
+  // |entries|, which it can take.
+  typedef std::function<void(int64_t first,
+                             std::vector<AsyncLogClient::Entry>* entries)>
+      EntriesCallback;
+
+  // Retrieves the entries [first, last] with up to |concurrency|
+  // get-entries requests in flight, each for as many entries as the log
+  // returned for the first one, and passes them to |handle| in order, one
+  // response at a time, as they come in. The requests after the one being
+  // handled carry on in the meantime, at least on the log's side.
+  //
+  // A failed request is sent again up to |max_retries| times, after a
+  // delay that doubles each time. Stops at the first request that fails
+  // after that, whose status is returned once the entries before it have
+  // all been handled.
+  AsyncLogClient::Status GetEntriesPipelined(int64_t first, int64_t last,
+                                             int concurrency, int max_retries,
+                                             const EntriesCallback& handle);
 
  private:
-  const std::unique_ptr<libevent::Base> base_;
-  ThreadPool pool_;
-  UrlFetcher fetcher_;
+  // Returns a callback for |client_| which sets |*retval| to its status,
+  // then |*done| to true.
+  AsyncLogClient::Callback Done(AsyncLogClient::Status* retval, bool* done);
+
+  // Waits until a callback returned by Done() sets |*done|.
+  void Wait(const bool* done);
+
+  // Only set if this client has its own event loop, which it runs while
+  // it waits.
+  const std::unique_ptr<libevent::Base> own_base_;
+  const std::unique_ptr<ThreadPool> own_pool_;
+  const std::unique_ptr<UrlFetcher> own_fetcher_;
+  libevent::Base* const base_;
+  std::mutex mutex_;
+  std::condition_variable done_cv_;
   AsyncLogClient client_;
 
   DISALLOW_COPY_AND_ASSIGN(HTTPLogClient);
@@ -0,0 +1,89 @@
+#include "client/sct_verification_cache.h"
+
+#include <glog/logging.h>
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+
+namespace cert_trans {
+namespace {
+
+
+// The hashes have a fixed size, and come first, so that keys made of
+// different parts never collide.
+string Key(const string& log_id, const string& sct_hash,
+           const string& leaf_hash) {
+  CHECK_EQ(sct_hash.size(), 32U);
+  CHECK_EQ(leaf_hash.size(), 32U);
+  return sct_hash + leaf_hash + log_id;
+}
+
+
+}  // namespace
+
+
+SCTVerificationCache::SCTVerificationCache(size_t max_entries)
+    : max_entries_(max_entries), hits_(0), misses_(0) {
+  CHECK_GT(max_entries_, 0U);
+}
+
+
+bool SCTVerificationCache::Lookup(const string& log_id,
+                                  const string& sct_hash,
+                                  const string& leaf_hash,
+                                  string* merkle_leaf_hash) {
+  const string key(Key(log_id, sct_hash, leaf_hash));
+  lock_guard<mutex> lock(lock_);
+  const auto it(items_.find(key));
+  if (it == items_.end()) {
+    ++misses_;
+    return false;
+  }
+  ++hits_;
+  lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+  *CHECK_NOTNULL(merkle_leaf_hash) = it->second.merkle_leaf_hash;
+  return true;
+}
+
+
+void SCTVerificationCache::Add(const string& log_id, const string& sct_hash,
+                               const string& leaf_hash,
+                               const string& merkle_leaf_hash) {
+  const string key(Key(log_id, sct_hash, leaf_hash));
+  lock_guard<mutex> lock(lock_);
+  const auto it(items_.find(key));
+  if (it != items_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+    it->second.merkle_leaf_hash = merkle_leaf_hash;
+    return;
+  }
+
+  lru_.push_front(key);
+  items_[key] = Item{merkle_leaf_hash, lru_.begin()};
+  while (items_.size() > max_entries_) {
+    items_.erase(lru_.back());
+    lru_.pop_back();
+  }
+}
+
+
+size_t SCTVerificationCache::size() const {
+  lock_guard<mutex> lock(lock_);
+  return items_.size();
+}
+
+
+uint64_t SCTVerificationCache::hits() const {
+  lock_guard<mutex> lock(lock_);
+  return hits_;
+}
+
+
+uint64_t SCTVerificationCache::misses() const {
+  lock_guard<mutex> lock(lock_);
+  return misses_;
+}
+
+
+}  // namespace cert_trans
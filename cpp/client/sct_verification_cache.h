@@ -0,0 +1,62 @@
+#ifndef CERT_TRANS_CLIENT_SCT_VERIFICATION_CACHE_H_
+#define CERT_TRANS_CLIENT_SCT_VERIFICATION_CACHE_H_
+
+#include <stdint.h>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// The SCTs already verified by SSLClient, so that those served again,
+// as most are when scanning many servers with the same certificates,
+// do not have their signatures checked again. Each is keyed by the key
+// ID of the log it was verified against, the SHA-256 hash of the
+// serialized SCT, and that of the leaf data of the entry it was
+// verified for, and holds the Merkle leaf hash of the SCT and entry.
+// Only SCTs which verified are kept, and at most a given number of
+// them, the least recently used being dropped first.
+//
+// This class is thread-safe.
+class SCTVerificationCache {
+ public:
+  explicit SCTVerificationCache(size_t max_entries);
+
+  // Sets |*merkle_leaf_hash| to that of the SCT, and returns whether it
+  // is in the cache.
+  bool Lookup(const std::string& log_id, const std::string& sct_hash,
+              const std::string& leaf_hash, std::string* merkle_leaf_hash);
+
+  void Add(const std::string& log_id, const std::string& sct_hash,
+           const std::string& leaf_hash, const std::string& merkle_leaf_hash);
+
+  size_t size() const;
+  uint64_t hits() const;
+  uint64_t misses() const;
+
+ private:
+  struct Item {
+    std::string merkle_leaf_hash;
+    std::list<std::string>::iterator lru_pos;
+  };
+
+  const size_t max_entries_;
+
+  mutable std::mutex lock_;
+  // The keys, the most recently used first.
+  std::list<std::string> lru_;
+  std::unordered_map<std::string, Item> items_;
+  uint64_t hits_;
+  uint64_t misses_;
+
+  DISALLOW_COPY_AND_ASSIGN(SCTVerificationCache);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_CLIENT_SCT_VERIFICATION_CACHE_H_
@@ -0,0 +1,78 @@
+#include "client/sct_verification_cache.h"
+
+#include <gtest/gtest.h>
+#include <string>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+
+
+string Hash(char c) {
+  return string(32, c);
+}
+
+
+TEST(SCTVerificationCacheTest, LookupAfterAdd) {
+  SCTVerificationCache cache(10);
+  string merkle_leaf_hash;
+  EXPECT_FALSE(cache.Lookup("log", Hash('s'), Hash('l'), &merkle_leaf_hash));
+
+  cache.Add("log", Hash('s'), Hash('l'), "leaf");
+  EXPECT_TRUE(cache.Lookup("log", Hash('s'), Hash('l'), &merkle_leaf_hash));
+  EXPECT_EQ("leaf", merkle_leaf_hash);
+  EXPECT_EQ(1U, cache.hits());
+  EXPECT_EQ(1U, cache.misses());
+}
+
+
+TEST(SCTVerificationCacheTest, KeyedByEveryPart) {
+  SCTVerificationCache cache(10);
+  cache.Add("log", Hash('s'), Hash('l'), "leaf");
+  string merkle_leaf_hash;
+  EXPECT_FALSE(
+      cache.Lookup("other log", Hash('s'), Hash('l'), &merkle_leaf_hash));
+  EXPECT_FALSE(cache.Lookup("log", Hash('t'), Hash('l'), &merkle_leaf_hash));
+  EXPECT_FALSE(cache.Lookup("log", Hash('s'), Hash('m'), &merkle_leaf_hash));
+}
+
+
+TEST(SCTVerificationCacheTest, DropsLeastRecentlyUsed) {
+  SCTVerificationCache cache(2);
+  cache.Add("log", Hash('a'), Hash('l'), "a");
+  cache.Add("log", Hash('b'), Hash('l'), "b");
+  string merkle_leaf_hash;
+  // "a" is now more recently used than "b".
+  EXPECT_TRUE(cache.Lookup("log", Hash('a'), Hash('l'), &merkle_leaf_hash));
+
+  cache.Add("log", Hash('c'), Hash('l'), "c");
+  EXPECT_EQ(2U, cache.size());
+  EXPECT_TRUE(cache.Lookup("log", Hash('a'), Hash('l'), &merkle_leaf_hash));
+  EXPECT_FALSE(cache.Lookup("log", Hash('b'), Hash('l'), &merkle_leaf_hash));
+  EXPECT_TRUE(cache.Lookup("log", Hash('c'), Hash('l'), &merkle_leaf_hash));
+  EXPECT_EQ("c", merkle_leaf_hash);
+}
+
+
+TEST(SCTVerificationCacheTest, AddAgainReplaces) {
+  SCTVerificationCache cache(2);
+  cache.Add("log", Hash('a'), Hash('l'), "old");
+  cache.Add("log", Hash('a'), Hash('l'), "new");
+  EXPECT_EQ(1U, cache.size());
+  string merkle_leaf_hash;
+  EXPECT_TRUE(cache.Lookup("log", Hash('a'), Hash('l'), &merkle_leaf_hash));
+  EXPECT_EQ("new", merkle_leaf_hash);
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
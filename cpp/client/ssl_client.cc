@@ -6,6 +6,7 @@
 #include <openssl/x509.h>
 
 #include "client/client.h"
+#include "client/sct_verification_cache.h"
 #include "log/cert.h"
 #include "log/cert_submission_handler.h"
 #include "log/ct_extensions.h"
@@ -67,9 +68,14 @@ int SSLClient::ExtensionCallback(SSL*, unsigned ext_type,
 // TODO(ekasper): handle Cert::Status errors.
 SSLClient::SSLClient(const string& server, uint16_t port, const string& ca_dir,
                      LogVerifier* verifier)
+    : SSLClient(server, port, ca_dir, verifier, nullptr) {
+}
+
+SSLClient::SSLClient(const string& server, uint16_t port, const string& ca_dir,
+                     LogVerifier* verifier, SCTVerificationCache* cache)
     : client_(server, port),
       ctx_(CHECK_NOTNULL(SSL_CTX_new(TLSv1_client_method()))),
-      verify_args_(verifier),
+      verify_args_(verifier, cache),
       connected_(false) {
   // SSL_VERIFY_PEER makes the connection abort immediately
   // if verification fails.
@@ -126,6 +132,7 @@ void SSLClient::GetSSLClientCTData(SSLClientCTData* data) const {
 // static
 LogVerifier::LogVerifyResult SSLClient::VerifySCT(const string& token,
                                                   LogVerifier* verifier,
+                                                  SCTVerificationCache* cache,
                                                   SSLClientCTData* data) {
   CHECK(data->has_reconstructed_entry());
   SignedCertificateTimestamp local_sct;
@@ -134,12 +141,24 @@ LogVerifier::LogVerifyResult SSLClient::VerifySCT(const string& token,
   if (Deserializer::DeserializeSCT(token, &local_sct) != DeserializeResult::OK)
     return LogVerifier::INVALID_FORMAT;
 
-  string merkle_leaf;
-  LogVerifier::LogVerifyResult result =
-      verifier->VerifySignedCertificateTimestamp(data->reconstructed_entry(),
-                                                 local_sct, &merkle_leaf);
-  if (result != LogVerifier::VERIFY_OK)
-    return result;
+  // A cached SCT stays valid, as its timestamp only had to be in the
+  // past.
+  string sct_hash, leaf_hash, merkle_leaf;
+  if (cache) {
+    sct_hash = Sha256Hasher::Sha256Digest(token);
+    leaf_hash = Sha256Hasher::Sha256Digest(
+        Serializer::LeafData(data->reconstructed_entry()));
+  }
+  if (!cache ||
+      !cache->Lookup(verifier->KeyID(), sct_hash, leaf_hash, &merkle_leaf)) {
+    LogVerifier::LogVerifyResult result =
+        verifier->VerifySignedCertificateTimestamp(data->reconstructed_entry(),
+                                                   local_sct, &merkle_leaf);
+    if (result != LogVerifier::VERIFY_OK)
+      return result;
+    if (cache)
+      cache->Add(verifier->KeyID(), sct_hash, leaf_hash, merkle_leaf);
+  }
   SSLClientCTData::SCTInfo* sct_info = data->add_attached_sct_info();
   sct_info->set_merkle_leaf_hash(merkle_leaf);
   sct_info->mutable_sct()->CopyFrom(local_sct);
@@ -231,9 +250,9 @@ int SSLClient::VerifyCallback(X509_STORE_CTX* ctx, void* arg) {
       args->ct_data.mutable_reconstructed_entry()->CopyFrom(entry);
       args->ct_data.set_certificate_sha256_hash(
           Sha256Hasher::Sha256Digest(Serializer::LeafData(entry)));
-      // Only writes the checkpoint if verification succeeds.
-      // Note: an optimized client could only verify the signature if it's
-      // a certificate it hasn't seen before.
+      // Only writes the checkpoint if verification succeeds. With
+      // |args->cache|, the signatures of SCTs already seen are not
+      // checked again.
       SignedCertificateTimestampList sct_list;
       if (Deserializer::DeserializeSCTList(serialized_scts, &sct_list) !=
           DeserializeResult::OK) {
@@ -242,7 +261,8 @@ int SSLClient::VerifyCallback(X509_STORE_CTX* ctx, void* arg) {
         LOG(INFO) << "Received " << sct_list.sct_list_size() << " SCTs";
         for (int i = 0; i < sct_list.sct_list_size(); ++i) {
           LogVerifier::LogVerifyResult result =
-              VerifySCT(sct_list.sct_list(i), verifier, &args->ct_data);
+              VerifySCT(sct_list.sct_list(i), verifier, args->cache,
+                        &args->ct_data);
 
           if (result == LogVerifier::VERIFY_OK) {
             LOG(INFO) << "SCT number " << i + 1 << " verified";
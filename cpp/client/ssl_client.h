@@ -16,6 +16,8 @@ class LogVerifier;
 
 namespace cert_trans {
 
+class SCTVerificationCache;
+
 
 class SSLClient {
  public:
@@ -25,6 +27,13 @@ class SSLClient {
   SSLClient(const std::string& server, uint16_t port,
             const std::string& ca_dir, LogVerifier* verifier);
 
+  // Same as above, but skips checking the SCTs already in |cache|, and
+  // adds those it verifies to it. |cache| must outlive this client, and
+  // can be shared with others, such as those of concurrent scans.
+  SSLClient(const std::string& server, uint16_t port,
+            const std::string& ca_dir, LogVerifier* verifier,
+            SCTVerificationCache* cache);
+
   ~SSLClient();
 
   enum HandshakeResult {
@@ -48,9 +57,10 @@ class SSLClient {
 
   void GetSSLClientCTData(ct::SSLClientCTData* data) const;
 
-  // Need a static wrapper for the callback.
+  // Need a static wrapper for the callback. |cache| may be NULL.
   static LogVerifier::LogVerifyResult VerifySCT(const std::string& token,
                                                 LogVerifier* verifier,
+                                                SCTVerificationCache* cache,
                                                 ct::SSLClientCTData* data);
 
   // Custom verification callback for verifying the SCT token
@@ -78,8 +88,10 @@ class SSLClient {
   cert_trans::ScopedSSL_CTX ctx_;
   cert_trans::ScopedSSL ssl_;
   struct VerifyCallbackArgs {
-    VerifyCallbackArgs(LogVerifier* log_verifier)
+    VerifyCallbackArgs(LogVerifier* log_verifier,
+                       SCTVerificationCache* sct_cache)
         : verifier(log_verifier),
+          cache(sct_cache),
           sct_verified(false),
           require_sct(false),
           ct_data() {
@@ -87,6 +99,8 @@ class SSLClient {
 
     // The verifier for checking log proofs.
     std::unique_ptr<LogVerifier> verifier;
+    // The SCTs already verified, or NULL.
+    SCTVerificationCache* const cache;
     // SCT verification result.
     bool sct_verified;
     bool require_sct;
@@ -2,13 +2,16 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <condition_variable>
 
 #include "fetcher/fetcher.h"
 #include "fetcher/peer_group.h"
 #include "log/log_verifier.h"
 
 using std::bind;
+using std::chrono::milliseconds;
 using std::chrono::seconds;
+using std::condition_variable;
 using std::lock_guard;
 using std::map;
 using std::move;
@@ -35,11 +38,17 @@ class ContinuousFetcherImpl : public ContinuousFetcher {
 
   void AddPeer(const string& node_id, const shared_ptr<Peer>& peer) override;
   void RemovePeer(const string& node_id) override;
+  void FetchNow() override;
+  bool WaitForTreeSize(int64_t tree_size,
+                       const milliseconds& timeout) override;
 
  private:
   void StartFetch(const unique_lock<mutex>& lock);
   void FetchDone(Task* task);
   void FetchDelayDone(Task* task);
+  // Whether the last fetch added entries to the database, and any of
+  // the peers still has more.
+  bool CatchingUp(const unique_lock<mutex>& lock) const;
 
   libevent::Base* const base_;
   Executor* const executor_;
@@ -52,6 +61,10 @@ class ContinuousFetcherImpl : public ContinuousFetcher {
 
   bool restart_fetch_;
   unique_ptr<Task> fetch_task_;
+  // The size of the database when the current fetch was started.
+  int64_t fetch_start_size_;
+  // Signalled whenever a fetch ends, for WaitForTreeSize().
+  condition_variable fetch_done_;
 
   DISALLOW_COPY_AND_ASSIGN(ContinuousFetcherImpl);
 };
@@ -65,7 +78,8 @@ ContinuousFetcherImpl::ContinuousFetcherImpl(
       db_(CHECK_NOTNULL(db)),
       log_verifier_(CHECK_NOTNULL(log_verifier)),
       fetch_scts_(fetch_scts),
-      restart_fetch_(false) {
+      restart_fetch_(false),
+      fetch_start_size_(0) {
 }
 
 
@@ -105,11 +119,33 @@ void ContinuousFetcherImpl::RemovePeer(const string& node_id) {
 }
 
 
+void ContinuousFetcherImpl::FetchNow() {
+  unique_lock<mutex> lock(lock_);
+  if (fetch_task_) {
+    // Let it finish, as the entries it is fetching are also wanted,
+    // and go again right after.
+    restart_fetch_ = true;
+  } else {
+    StartFetch(lock);
+  }
+}
+
+
+bool ContinuousFetcherImpl::WaitForTreeSize(int64_t tree_size,
+                                            const milliseconds& timeout) {
+  unique_lock<mutex> lock(lock_);
+  return fetch_done_.wait_for(lock, timeout, [this, tree_size]() {
+    return db_->TreeSize() >= tree_size;
+  });
+}
+
+
 void ContinuousFetcherImpl::StartFetch(const unique_lock<mutex>& lock) {
   CHECK(lock.owns_lock());
   CHECK(!fetch_task_);
 
   restart_fetch_ = false;
+  fetch_start_size_ = db_->TreeSize();
 
   unique_ptr<PeerGroup> peer_group(new PeerGroup(fetch_scts_));
   for (const auto& peer : peers_) {
@@ -129,10 +165,14 @@ void ContinuousFetcherImpl::FetchDone(Task* task) {
     LOG(WARNING) << "error while fetching: " << task->status();
   }
 
-  lock_guard<mutex> lock(lock_);
+  unique_lock<mutex> lock(lock_);
   fetch_task_.reset();
+  fetch_done_.notify_all();
 
-  if (restart_fetch_) {
+  // The peers may have grown while we were fetching, in which case we
+  // go again straight away, unless the fetch failed or got nowhere, so
+  // as not to keep hammering them.
+  if (restart_fetch_ || (task->status().ok() && CatchingUp(lock))) {
     executor_->Add(
         bind(&ContinuousFetcherImpl::FetchDelayDone, this, nullptr));
   } else {
@@ -144,6 +184,22 @@ void ContinuousFetcherImpl::FetchDone(Task* task) {
 }
 
 
+bool ContinuousFetcherImpl::CatchingUp(
+    const unique_lock<mutex>& lock) const {
+  CHECK(lock.owns_lock());
+  const int64_t tree_size(db_->TreeSize());
+  if (tree_size <= fetch_start_size_) {
+    return false;
+  }
+  for (const auto& peer : peers_) {
+    if (peer.second->TreeSize() > tree_size) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
 void ContinuousFetcherImpl::FetchDelayDone(Task* task) {
   // "task" can be null, if we're restarting a fetch.
   if (task) {
@@ -1,6 +1,8 @@
 #ifndef CERT_TRANS_FETCHER_CONTINUOUS_FETCHER_H_
 #define CERT_TRANS_FETCHER_CONTINUOUS_FETCHER_H_
 
+#include <stdint.h>
+#include <chrono>
 #include <map>
 #include <memory>
 #include <mutex>
@@ -33,6 +35,20 @@ class ContinuousFetcher {
 
   virtual void RemovePeer(const std::string& node_id) = 0;
 
+  // Starts fetching as soon as possible, rather than at the end of the
+  // delay between fetches, for when a peer has announced new entries. A
+  // fetch that is already running is followed by another one straight
+  // away, so that it also picks up the new entries.
+  virtual void FetchNow() = 0;
+
+  // Blocks until the database has at least |tree_size| contiguous
+  // entries, returning false if that has not happened within |timeout|.
+  // A fetch that ends with the database still behind the peers is
+  // followed by another one straight away, without the usual delay, so
+  // that a node joining a cluster catches up as quickly as it can.
+  virtual bool WaitForTreeSize(int64_t tree_size,
+                               const std::chrono::milliseconds& timeout) = 0;
+
  protected:
   ContinuousFetcher() = default;
 
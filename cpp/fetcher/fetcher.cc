@@ -2,8 +2,12 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <algorithm>
+#include <deque>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <set>
 
 #include "base/macros.h"
 #include "log/log_verifier.h"
@@ -13,10 +17,15 @@ using cert_trans::AsyncLogClient;
 using cert_trans::LoggedEntry;
 using cert_trans::PeerGroup;
 using std::bind;
+using std::deque;
 using std::lock_guard;
+using std::map;
+using std::max;
+using std::min;
 using std::move;
 using std::mutex;
 using std::placeholders::_1;
+using std::set;
 using std::string;
 using std::to_string;
 using std::unique_lock;
@@ -27,9 +36,24 @@ using util::Task;
 using util::TaskHold;
 
 DEFINE_int32(fetcher_concurrent_fetches, 2,
-             "number of concurrent fetch requests");
+             "initial number of concurrent fetch requests");
+DEFINE_int32(fetcher_max_concurrent_fetches, 32,
+             "maximum number of concurrent fetch requests, the fetcher "
+             "increases the concurrency from --fetcher_concurrent_fetches up "
+             "to this while fetches succeed, and halves it on errors");
 DEFINE_int32(fetcher_batch_size, 1000,
              "maximum number of entries to fetch per request");
+DEFINE_int32(fetcher_max_pending_ranges, 8,
+             "maximum number of fetched ranges waiting to be verified and "
+             "written to the database, no new fetches are started while "
+             "there are this many");
+DEFINE_int32(fetcher_max_tracked_ranges, 10000,
+             "maximum number of ranges of entries the fetcher keeps track "
+             "of, no new fetches are started while there are this many");
+DEFINE_int32(fetcher_catch_up_entries, 100000,
+             "fetches that start more than this many entries behind the "
+             "peers start at --fetcher_max_concurrent_fetches rather than "
+             "--fetcher_concurrent_fetches, to catch up quickly");
 
 namespace cert_trans {
 
@@ -38,6 +62,10 @@ Counter<string>* num_invalid_entries_fetched =
                          "Number of invalid entries fetched from remote peers "
                          "broken down by reason.");
 
+Gauge<>* fetcher_concurrency =
+    Gauge<>::New("fetcher_concurrency",
+                 "Current maximum number of concurrent fetch requests.");
+
 
 namespace {
 
@@ -46,31 +74,70 @@ struct Range {
   enum State {
     HAVE,
     FETCHING,
+    // Fetched, but not verified and written to the database yet.
+    RECEIVED,
     WANT,
   };
 
-  Range(State state, int64_t size, unique_ptr<Range> next = nullptr)
-      : state_(state), size_(size), next_(move(next)) {
-    CHECK(state_ == HAVE || state_ == FETCHING || state_ == WANT);
+  Range(State state, int64_t size) : state_(state), size_(size) {
+    CHECK(state_ == HAVE || state_ == FETCHING || state_ == RECEIVED ||
+          state_ == WANT);
     CHECK_GT(size_, 0);
   };
 
   State state_;
   int64_t size_;
-  unique_ptr<Range> next_;
 };
 
 
+// Ranges by the index of their first entry.
+typedef map<int64_t, Range> RangeMap;
+
+
+// A range which has been fetched and verified, waiting to be written
+// to the database.
+struct VerifiedRange {
+  int64_t index;
+  size_t num_received;
+  vector<LoggedEntry> certs;
+  Task* write_task;
+};
+
+
+// Fetched ranges go through three stages: the fetch itself, then the
+// conversion and verification of the entries (run on the executor, so
+// that several ranges can be verified concurrently), and finally the
+// write to the database, where everything verified in the meantime is
+// written in one batch. The next fetch starts as soon as a range has
+// been received, as long as no more than --fetcher_max_pending_ranges
+// are waiting in the later stages.
 struct FetchState {
   FetchState(Database* db, unique_ptr<PeerGroup> peer_group,
              const LogVerifier* log_verifier, Task* task);
 
   void WalkEntries();
-  void FetchRange(const unique_lock<mutex>& lock, Range* current,
-                  int64_t index, Task* range_task);
-  void WriteToDatabase(int64_t index, Range* range,
-                       const vector<AsyncLogClient::Entry>* retval,
-                       Task* range_task, Task* fetch_task);
+  void FetchRange(const unique_lock<mutex>& lock, int64_t index, int64_t size,
+                  Task* range_task);
+  void FetchDone(int64_t index, vector<AsyncLogClient::Entry>* retval,
+                 Task* range_task, Task* fetch_task);
+  void VerifyEntries(int64_t index,
+                     const vector<AsyncLogClient::Entry>* entries,
+                     Task* write_task);
+  void WriteToDatabase();
+  // Additive increase, multiplicative decrease of |concurrency_|.
+  void FetchSucceeded(const unique_lock<mutex>& lock);
+  void FetchFailed(const unique_lock<mutex>& lock);
+
+  // Returns the range starting at |index|, which must exist.
+  RangeMap::iterator FindRange(const unique_lock<mutex>& lock, int64_t index);
+  // Changes the state of |it|, keeping the counts and |wanted_| up to
+  // date, and merges it with its neighbours if they are in the same
+  // HAVE or WANT state. |it| is invalidated.
+  void SetState(const unique_lock<mutex>& lock, RangeMap::iterator it,
+                Range::State state);
+  // Shrinks |it| to |size| entries, and makes the rest a new WANT range.
+  void SplitOffWant(const unique_lock<mutex>& lock, RangeMap::iterator it,
+                    int64_t size);
 
   Database* const db_;
   const unique_ptr<PeerGroup> peer_group_;
@@ -78,8 +145,21 @@ struct FetchState {
   Task* const task_;
 
   mutex lock_;
+  // The ranges cover the entries from |start_| up to the remote tree
+  // size when the fetch was started, without gaps. Adjacent ranges which
+  // are both HAVE or both WANT are always merged.
   int64_t start_;
-  unique_ptr<Range> entries_;
+  RangeMap ranges_;
+  // Index of the first entry of all the WANT ranges.
+  set<int64_t> wanted_;
+  // Number of fetches to keep in flight, grows by about one for every
+  // round of successful fetches.
+  double concurrency_;
+  // Number of ranges in the FETCHING and RECEIVED states.
+  int num_fetching_;
+  int num_received_;
+  deque<VerifiedRange> write_queue_;
+  bool writing_;
 
  private:
   DISALLOW_COPY_AND_ASSIGN(FetchState);
@@ -92,7 +172,12 @@ FetchState::FetchState(Database* db, unique_ptr<PeerGroup> peer_group,
       peer_group_(move(peer_group)),
       log_verifier_(CHECK_NOTNULL(log_verifier)),
       task_(CHECK_NOTNULL(task)),
-      start_(db_->TreeSize()) {
+      start_(db_->TreeSize()),
+      concurrency_(max(1, min(FLAGS_fetcher_concurrent_fetches,
+                              FLAGS_fetcher_max_concurrent_fetches))),
+      num_fetching_(0),
+      num_received_(0),
+      writing_(false) {
   // TODO(pphaneuf): Might be better to get that as a parameter?
   const int64_t remote_tree_size(peer_group_->TreeSize());
   CHECK_GE(start_, 0);
@@ -105,7 +190,15 @@ FetchState::FetchState(Database* db, unique_ptr<PeerGroup> peer_group,
     return;
   }
 
-  entries_.reset(new Range(Range::WANT, remote_tree_size - start_));
+  if (remote_tree_size - start_ > FLAGS_fetcher_catch_up_entries) {
+    concurrency_ = max(1, FLAGS_fetcher_max_concurrent_fetches);
+    VLOG(1) << "catching up on " << remote_tree_size - start_
+            << " entries, starting at concurrency " << concurrency_;
+  }
+  fetcher_concurrency->Set(concurrency_);
+
+  ranges_.emplace(start_, Range(Range::WANT, remote_tree_size - start_));
+  wanted_.insert(start_);
 
   WalkEntries();
 }
@@ -130,104 +223,81 @@ void FetchState::WalkEntries() {
 
   // Prune fetched and unavailable sequences at the beginning.
   const int64_t remote_tree_size(peer_group_->TreeSize());
-  while (entries_ &&
-         (entries_->state_ == Range::HAVE ||
-          (entries_->state_ == Range::WANT && remote_tree_size < start_))) {
-    VLOG(1) << "pruning " << entries_->size_ << " at offset " << start_;
-    start_ += entries_->size_;
-    entries_ = move(entries_->next_);
+  while (!ranges_.empty()) {
+    const RangeMap::iterator first(ranges_.begin());
+    const Range& range(first->second);
+    if (range.state_ != Range::HAVE &&
+        (range.state_ != Range::WANT || remote_tree_size >= start_)) {
+      break;
+    }
+    VLOG(1) << "pruning " << range.size_ << " at offset " << start_;
+    start_ += range.size_;
+    wanted_.erase(first->first);
+    ranges_.erase(first);
   }
 
   // Are we done?
-  if (!entries_) {
+  if (ranges_.empty()) {
     task_->Return();
     return;
   }
 
-  int64_t index(start_);
-  int num_fetch(0);
-  for (Range *current = entries_.get(); current;
-       index += current->size_, current = current->next_.get()) {
-    // Coalesce with the next Range, if possible.
-    if (current->state_ != Range::FETCHING) {
-      while (current->next_ && current->next_->state_ == current->state_) {
-        current->size_ += current->next_->size_;
-        current->next_ = move(current->next_->next_);
-      }
+  VLOG(2) << ranges_.size() << " ranges from offset " << start_ << ", "
+          << num_fetching_ << " fetching, " << num_received_
+          << " being written, " << wanted_.size() << " wanted";
+
+  // Start fetching the lowest ranges we want, as long as the later
+  // stages keep up.
+  while (!wanted_.empty() && num_fetching_ < static_cast<int>(concurrency_) &&
+         num_received_ < FLAGS_fetcher_max_pending_ranges &&
+         ranges_.size() <
+             static_cast<size_t>(FLAGS_fetcher_max_tracked_ranges)) {
+    const int64_t index(*wanted_.begin());
+    // Do not start a fetch if we think our peer group does not have it.
+    if (index >= remote_tree_size) {
+      break;
     }
 
-    switch (current->state_) {
-      case Range::HAVE:
-        VLOG(2) << "at offset " << index << ", we have " << current->size_
-                << " entries";
-        break;
-
-      case Range::FETCHING:
-        VLOG(2) << "at offset " << index << ", fetching " << current->size_
-                << " entries";
-        ++num_fetch;
-        break;
-
-      case Range::WANT:
-        VLOG(2) << "at offset " << index << ", we want " << current->size_
-                << " entries";
-
-        // Do not start a fetch if we think our peer group does not
-        // have it.
-        if (index >= remote_tree_size) {
-          break;
-        }
-
-        // If the range is bigger than the maximum batch size, split it.
-        if (current->size_ > FLAGS_fetcher_batch_size) {
-          current->next_.reset(
-              new Range(Range::WANT, current->size_ - FLAGS_fetcher_batch_size,
-                        move(current->next_)));
-          current->size_ = FLAGS_fetcher_batch_size;
-        }
-
-        FetchRange(lock, current, index,
-                   task_->AddChild(bind(&FetchState::WalkEntries, this)));
-        ++num_fetch;
-
-        break;
+    const RangeMap::iterator it(FindRange(lock, index));
+    // If the range is bigger than the maximum batch size, split it.
+    if (it->second.size_ > FLAGS_fetcher_batch_size) {
+      SplitOffWant(lock, it, FLAGS_fetcher_batch_size);
     }
+    const int64_t size(it->second.size_);
+    SetState(lock, it, Range::FETCHING);
 
-    if (num_fetch >= FLAGS_fetcher_concurrent_fetches ||
-        index >= remote_tree_size) {
-      break;
-    }
+    FetchRange(lock, index, size,
+               task_->AddChild(bind(&FetchState::WalkEntries, this)));
   }
 }
 
 
-void FetchState::FetchRange(const unique_lock<mutex>& lock, Range* current,
-                            int64_t index, Task* range_task) {
+void FetchState::FetchRange(const unique_lock<mutex>& lock, int64_t index,
+                            int64_t size, Task* range_task) {
   CHECK(lock.owns_lock());
-  const int64_t end_index(index + current->size_ - 1);
+  const int64_t end_index(index + size - 1);
   VLOG(1) << "fetching from offset " << index << " to " << end_index;
 
   vector<AsyncLogClient::Entry>* const retval(
       new vector<AsyncLogClient::Entry>);
   range_task->DeleteWhenDone(retval);
 
-  current->state_ = Range::FETCHING;
-
   peer_group_->FetchEntries(index, end_index, retval,
                             range_task->AddChild(
-                                bind(&FetchState::WriteToDatabase, this, index,
-                                     current, retval, range_task, _1)));
+                                bind(&FetchState::FetchDone, this, index,
+                                     retval, range_task, _1)));
 }
 
 
-void FetchState::WriteToDatabase(int64_t index, Range* range,
-                                 const vector<AsyncLogClient::Entry>* retval,
-                                 Task* range_task, Task* fetch_task) {
+void FetchState::FetchDone(int64_t index,
+                           vector<AsyncLogClient::Entry>* retval,
+                           Task* range_task, Task* fetch_task) {
   if (!fetch_task->status().ok()) {
     LOG(INFO) << "error fetching entries at index " << index << ": "
               << fetch_task->status();
-    lock_guard<mutex> lock(lock_);
-    range->state_ = Range::WANT;
+    unique_lock<mutex> lock(lock_);
+    SetState(lock, FindRange(lock, index), Range::WANT);
+    FetchFailed(lock);
     range_task->Return(fetch_task->status());
     return;
   }
@@ -235,72 +305,263 @@ void FetchState::WriteToDatabase(int64_t index, Range* range,
   CHECK_GT(retval->size(), static_cast<size_t>(0));
 
   VLOG(1) << "received " << retval->size() << " entries at offset " << index;
-  int64_t processed(0);
-  for (const auto& entry : *retval) {
-    LoggedEntry cert;
+  // The entries outlive |range_task|, which is returned right away so
+  // that the next fetch can be started.
+  Task* const write_task(
+      task_->AddChild(bind(&FetchState::WalkEntries, this)));
+  vector<AsyncLogClient::Entry>* const entries(
+      new vector<AsyncLogClient::Entry>(move(*retval)));
+  write_task->DeleteWhenDone(entries);
+
+  {
+    unique_lock<mutex> lock(lock_);
+    SetState(lock, FindRange(lock, index), Range::RECEIVED);
+    FetchSucceeded(lock);
+  }
+
+  write_task->executor()->Add(bind(&FetchState::VerifyEntries, this, index,
+                                   entries, write_task));
+  range_task->Return();
+}
+
+
+void FetchState::VerifyEntries(int64_t index,
+                               const vector<AsyncLogClient::Entry>* entries,
+                               Task* write_task) {
+  if (write_task->CancelRequested()) {
+    write_task->Return(Status::CANCELLED);
+    return;
+  }
+
+  VerifiedRange verified{index, entries->size(), {}, write_task};
+  verified.certs.reserve(entries->size());
+  // The entries that came with an SCT, to verify them together.
+  vector<size_t> sct_certs;
+  vector<ct::LogEntry> sct_entries;
+  vector<ct::SignedCertificateTimestamp> scts;
+  for (const auto& entry : *entries) {
+    verified.certs.emplace_back();
+    LoggedEntry& cert(verified.certs.back());
     if (!cert.CopyFromClientLogEntry(entry)) {
+      verified.certs.pop_back();
       LOG(WARNING) << "could not convert entry to a LoggedEntry";
       num_invalid_entries_fetched->Increment("format");
       break;
     }
     if (entry.sct) {
       *cert.mutable_sct() = *entry.sct;
-      // If we have the full SCT (because this LogEntry came from another
-      // internal node which supports our private "give me the SCT too"
-      // option), then verify that the signature is good.
-      const LogVerifier::LogVerifyResult verify_result(
-          log_verifier_->VerifySignedCertificateTimestamp(
-              cert.contents().entry(), cert.sct()));
-      VLOG(1) << "SCT verify entry #" << index << ": "
-              << LogVerifier::VerifyResultString(verify_result);
-      if (verify_result != LogVerifier::VERIFY_OK) {
-        num_invalid_entries_fetched->Increment("sct_verify_failed");
-        const string msg("Failed to verify SCT signature for entry# " +
-                         to_string(index) + " : " +
-                         LogVerifier::VerifyResultString(verify_result));
-        LOG(WARNING) << msg;
-        task_->Return(Status(util::error::FAILED_PRECONDITION, msg));
-        return;
-      }
+      sct_certs.push_back(verified.certs.size() - 1);
+      sct_entries.push_back(cert.contents().entry());
+      scts.push_back(cert.sct());
     }
     cert.set_sequence_number(index++);
-    if (db_->CreateSequencedEntry(cert) == Database::OK) {
-      ++processed;
-    } else {
-      LOG(WARNING) << "could not insert entry into the database:\n"
-                   << cert.DebugString();
-      break;
+  }
+
+  // If we have the full SCTs (because these LogEntries came from another
+  // internal node which supports our private "give me the SCT too"
+  // option), then verify that the signatures are good. The ranges are
+  // already verified concurrently, so this does not fan out any further.
+  vector<LogVerifier::LogVerifyResult> verify_results;
+  log_verifier_->VerifySignedCertificateTimestamps(sct_entries, scts, nullptr,
+                                                   &verify_results, nullptr);
+  for (size_t i = 0; i < verify_results.size(); ++i) {
+    const int64_t cert_index(verified.certs[sct_certs[i]].sequence_number());
+    VLOG(1) << "SCT verify entry #" << cert_index << ": "
+            << LogVerifier::VerifyResultString(verify_results[i]);
+    if (verify_results[i] != LogVerifier::VERIFY_OK) {
+      num_invalid_entries_fetched->Increment("sct_verify_failed");
+      const string msg("Failed to verify SCT signature for entry# " +
+                       to_string(cert_index) + " : " +
+                       LogVerifier::VerifyResultString(verify_results[i]));
+      LOG(WARNING) << msg;
+      const Status status(util::error::FAILED_PRECONDITION, msg);
+      task_->Return(status);
+      write_task->Return(status);
+      return;
     }
   }
 
+  bool start_writer(false);
   {
     lock_guard<mutex> lock(lock_);
-    // TODO(pphaneuf): If we have problems fetching entries, to what
-    // point should we retry? Or should we just return on the task
-    // with an error?
-    if (processed > 0) {
-      // If we don't receive everything, split up the range.
-      if (range->size_ > processed) {
-        range->next_.reset(new Range(Range::WANT, range->size_ - processed,
-                                     move(range->next_)));
-        range->size_ = processed;
+    write_queue_.emplace_back(move(verified));
+    if (!writing_) {
+      writing_ = true;
+      start_writer = true;
+    }
+  }
+
+  if (start_writer) {
+    write_task->executor()->Add(bind(&FetchState::WriteToDatabase, this));
+  }
+}
+
+
+void FetchState::WriteToDatabase() {
+  // Returning the write tasks could otherwise let the fetch task finish,
+  // and delete us, while we are still going.
+  TaskHold hold(task_);
+  unique_lock<mutex> lock(lock_);
+  while (!write_queue_.empty()) {
+    deque<VerifiedRange> batch;
+    batch.swap(write_queue_);
+    lock.unlock();
+
+    // Write everything verified since the last write in one go.
+    std::sort(batch.begin(), batch.end(),
+              [](const VerifiedRange& a, const VerifiedRange& b) {
+                return a.index < b.index;
+              });
+    vector<LoggedEntry> certs;
+    for (auto& verified : batch) {
+      certs.insert(certs.end(),
+                   std::make_move_iterator(verified.certs.begin()),
+                   std::make_move_iterator(verified.certs.end()));
+    }
+
+    size_t num_created(0);
+    if (db_->CreateSequencedEntries(certs, &num_created) != Database::OK) {
+      LOG(WARNING) << "could not insert entry into the database:\n"
+                   << certs[num_created].DebugString();
+    }
+
+    bool write_failed(false);
+    lock.lock();
+    size_t remaining(num_created);
+    for (const auto& verified : batch) {
+      const RangeMap::iterator it(FindRange(lock, verified.index));
+      const int64_t processed(min(remaining, verified.certs.size()));
+      remaining -= processed;
+
+      // TODO(pphaneuf): If we have problems fetching entries, to what
+      // point should we retry? Or should we just return on the task
+      // with an error?
+      if (processed > 0) {
+        // If we don't receive everything, split up the range.
+        if (it->second.size_ > processed) {
+          SplitOffWant(lock, it, processed);
+        }
+
+        SetState(lock, it, Range::HAVE);
+      } else {
+        SetState(lock, it, Range::WANT);
+      }
+
+      // We couldn't insert everything that we received into the
+      // database, this is fairly serious, return an error for the
+      // overall operation and let the higher level deal with it.
+      if (static_cast<uint64_t>(processed) < verified.num_received) {
+        write_failed = true;
       }
+    }
+    lock.unlock();
 
-      range->state_ = Range::HAVE;
-    } else {
-      range->state_ = Range::WANT;
+    if (write_failed) {
+      task_->Return(Status(util::error::INTERNAL,
+                           "could not write some entries to the database"));
+    }
+    for (const auto& verified : batch) {
+      verified.write_task->Return();
     }
+
+    lock.lock();
   }
+  writing_ = false;
+}
+
+
+void FetchState::FetchSucceeded(const unique_lock<mutex>& lock) {
+  concurrency_ =
+      min(static_cast<double>(FLAGS_fetcher_max_concurrent_fetches),
+          concurrency_ + 1 / concurrency_);
+  fetcher_concurrency->Set(concurrency_);
+}
+
+
+void FetchState::FetchFailed(const unique_lock<mutex>& lock) {
+  concurrency_ = max(1.0, concurrency_ / 2);
+  VLOG(1) << "fetch failed, reducing concurrency to " << concurrency_;
+  fetcher_concurrency->Set(concurrency_);
+}
+
 
-  if (static_cast<uint64_t>(processed) < retval->size()) {
-    // We couldn't insert everything that we received into the
-    // database, this is fairly serious, return an error for the
-    // overall operation and let the higher level deal with it.
-    task_->Return(Status(util::error::INTERNAL,
-                         "could not write some entries to the database"));
+RangeMap::iterator FetchState::FindRange(const unique_lock<mutex>& lock,
+                                         int64_t index) {
+  CHECK(lock.owns_lock());
+  const RangeMap::iterator it(ranges_.find(index));
+  CHECK(it != ranges_.end()) << "no range at offset " << index;
+  return it;
+}
+
+
+void FetchState::SetState(const unique_lock<mutex>& lock,
+                          RangeMap::iterator it, Range::State state) {
+  CHECK(lock.owns_lock());
+  Range* const range(&it->second);
+  switch (range->state_) {
+    case Range::FETCHING:
+      --num_fetching_;
+      break;
+    case Range::RECEIVED:
+      --num_received_;
+      break;
+    case Range::WANT:
+      wanted_.erase(it->first);
+      break;
+    case Range::HAVE:
+      break;
+  }
+  range->state_ = state;
+  switch (state) {
+    case Range::FETCHING:
+      ++num_fetching_;
+      return;
+    case Range::RECEIVED:
+      ++num_received_;
+      return;
+    case Range::WANT:
+      wanted_.insert(it->first);
+      break;
+    case Range::HAVE:
+      break;
   }
 
-  range_task->Return();
+  // Coalesce with the next and previous ranges, if possible.
+  const RangeMap::iterator next(std::next(it));
+  if (next != ranges_.end() && next->second.state_ == state) {
+    range->size_ += next->second.size_;
+    wanted_.erase(next->first);
+    ranges_.erase(next);
+  }
+  if (it != ranges_.begin()) {
+    const RangeMap::iterator prev(std::prev(it));
+    if (prev->second.state_ == state) {
+      prev->second.size_ += range->size_;
+      wanted_.erase(it->first);
+      ranges_.erase(it);
+    }
+  }
+}
+
+
+void FetchState::SplitOffWant(const unique_lock<mutex>& lock,
+                              RangeMap::iterator it, int64_t size) {
+  CHECK(lock.owns_lock());
+  Range* const range(&it->second);
+  CHECK_GT(range->size_, size);
+  const int64_t rest_index(it->first + size);
+  const RangeMap::iterator rest(ranges_.emplace_hint(
+      std::next(it), rest_index, Range(Range::WANT, range->size_ - size)));
+  range->size_ = size;
+  wanted_.insert(rest_index);
+
+  // Coalesce the rest with the following range, if possible.
+  const RangeMap::iterator next(std::next(rest));
+  if (next != ranges_.end() && next->second.state_ == Range::WANT) {
+    rest->second.size_ += next->second.size_;
+    wanted_.erase(next->first);
+    ranges_.erase(next);
+  }
 }
 
 
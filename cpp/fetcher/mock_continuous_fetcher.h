@@ -13,6 +13,10 @@ class MockContinuousFetcher : public ContinuousFetcher {
   MOCK_METHOD2(AddPeer, void(const std::string& node_id,
                              const std::shared_ptr<Peer>& peer));
   MOCK_METHOD1(RemovePeer, void(const std::string& node_id));
+  MOCK_METHOD0(FetchNow, void());
+  MOCK_METHOD2(WaitForTreeSize,
+               bool(int64_t tree_size,
+                    const std::chrono::milliseconds& timeout));
 };
 
 
@@ -1,23 +1,62 @@
 #include "fetcher/peer_group.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <limits>
 
+#include "monitoring/monitoring.h"
+
+using std::chrono::duration;
+using std::chrono::steady_clock;
 using std::lock_guard;
+using std::make_shared;
 using std::max;
+using std::min;
 using std::mutex;
 using std::placeholders::_1;
 using std::shared_ptr;
+using std::string;
+using std::unique_lock;
+using std::unique_ptr;
 using std::vector;
 using util::Status;
 using util::Task;
 
+DEFINE_bool(fetcher_stream_entries, false,
+            "fetch entries and their SCTs from the other nodes of the "
+            "cluster through the binary format of the non-standard "
+            "/ct/v1/stream-entries, rather than get-entries; the nodes "
+            "must serve it, with --enable_stream_entries");
+DEFINE_double(fetcher_hedge_fraction, 0.05,
+              "largest fraction of the fetches of entries which are also "
+              "sent to a second peer, when the first one takes longer "
+              "than 95% of its latest fetches did; 0 disables hedging");
+
 namespace cert_trans {
 
 namespace {
 
 
-void GetEntriesDone(AsyncLogClient::Status client_status,
-                    const vector<AsyncLogClient::Entry>* entries, Task* task) {
+static Counter<string>* fetcher_hedged_fetches(
+    Counter<string>::New("fetcher_hedged_fetches", "outcome",
+                         "Number of fetches of entries also sent to a "
+                         "second peer because the first one was slow "
+                         "(\"sent\"), and of those which the second "
+                         "peer answered first (\"won\")."));
+
+// Weight of the latest fetch in the per-peer moving averages.
+const double kMovingAverageWeight = 0.25;
+// Number of latest fetches of each peer whose latencies are kept, and
+// how many are needed to decide when to hedge.
+const size_t kLatencyWindowSize = 100;
+const size_t kMinHedgeSamples = 20;
+const double kHedgeQuantile = 0.95;
+// Largest number of fetches hedged in a row.
+const double kHedgeBurst = 5;
+
+
+Status ClientStatusToStatus(AsyncLogClient::Status client_status,
+                            const vector<AsyncLogClient::Entry>* entries) {
   Status status;
 
   switch (client_status) {
@@ -36,14 +75,60 @@ void GetEntriesDone(AsyncLogClient::Status client_status,
         Status(util::error::INTERNAL, "log server did not return any entries");
   }
 
-  task->Return(status);
+  return status;
 }
 
 
 }  // namespace
 
 
-PeerGroup::PeerGroup(bool fetch_scts) : fetch_scts_(fetch_scts) {
+PeerGroup::PeerState::PeerState()
+    : num_errors(0),
+      num_in_flight(0),
+      max_batch_size(0),
+      latency(0),
+      entries_per_second(0),
+      recent_latencies(kLatencyWindowSize) {
+}
+
+
+struct PeerGroup::Fetch {
+  // A request for the entries of the fetch sent to a peer.
+  struct Request {
+    const shared_ptr<Peer> peer;
+    const int64_t end_index;
+    const steady_clock::time_point started_at;
+    vector<AsyncLogClient::Entry> entries;
+    bool done;
+  };
+
+  Fetch(PeerGroup* group, int64_t start_index, int64_t end_index,
+        vector<AsyncLogClient::Entry>* entries, Task* task)
+      : group(group),
+        start_index(start_index),
+        end_index(end_index),
+        entries(CHECK_NOTNULL(entries)),
+        task(task),
+        done(false) {
+  }
+
+  PeerGroup* const group;
+  const int64_t start_index;
+  const int64_t end_index;
+  vector<AsyncLogClient::Entry>* const entries;
+  Task* const task;
+
+  mutex lock;
+  // Set once |task| is returned, after which |group| and |entries| are
+  // not to be used anymore.
+  bool done;
+  std::vector<unique_ptr<Request>> requests;
+};
+
+
+PeerGroup::PeerGroup(bool fetch_scts)
+    : fetch_scts_(fetch_scts),
+      hedge_budget_(FLAGS_fetcher_hedge_fraction, kHedgeBurst) {
 }
 
 
@@ -72,42 +157,191 @@ void PeerGroup::FetchEntries(int64_t start_index, int64_t end_index,
   CHECK_GE(start_index, 0);
   CHECK_GE(end_index, start_index);
 
-  const shared_ptr<Peer> peer(PickPeer(end_index + 1));
-  if (!peer) {
+  const shared_ptr<Fetch> fetch(
+      make_shared<Fetch>(this, start_index, end_index, entries, task));
+  duration<double> hedge_delay;
+  bool hedge(false);
+  {
+    unique_lock<mutex> lock(lock_);
+    const shared_ptr<Peer> peer(PickPeer(lock, end_index + 1, nullptr));
+    if (peer) {
+      PeerState* const state(&peers_.at(peer));
+      ++state->num_in_flight;
+      // Don't ask for more than the peer is going to return anyway,
+      // the caller will come back for the rest.
+      const int64_t peer_end_index(
+          state->max_batch_size > 0
+              ? min(end_index, start_index + state->max_batch_size - 1)
+              : end_index);
+      fetch->requests.emplace_back(new Fetch::Request{
+          peer, peer_end_index, steady_clock::now(),
+          vector<AsyncLogClient::Entry>(), false});
+      hedge_budget_.AddRequest();
+      hedge = peers_.size() > 1 &&
+              state->recent_latencies.Quantile(kHedgeQuantile,
+                                               kMinHedgeSamples, &hedge_delay);
+    }
+  }
+  if (fetch->requests.empty()) {
     task->Return(Status(util::error::UNAVAILABLE,
                         "requested entries not available in the peer group"));
     return;
   }
 
+  if (hedge && FLAGS_fetcher_hedge_fraction > 0) {
+    // The timer is cancelled when |task| is returned.
+    task->executor()->Delay(hedge_delay,
+                            task->AddChild(
+                                bind(&PeerGroup::Hedge, this, fetch, _1)));
+  }
+  SendFetch(fetch, 0);
+}
+
+
+void PeerGroup::SendFetch(const shared_ptr<Fetch>& fetch, size_t index) {
+  Fetch::Request* request;
+  {
+    lock_guard<mutex> lock(fetch->lock);
+    request = fetch->requests.at(index).get();
+  }
+
+  const AsyncLogClient::Callback done(
+      bind(&PeerGroup::RequestDone, fetch, index, _1));
+  AsyncLogClient* const client(&request->peer->client());
   // TODO(pphaneuf): Handle the case where we have no peer more cleanly.
-  if (fetch_scts_) {
-    peer->client().GetEntriesAndSCTs(start_index, end_index,
-                                     CHECK_NOTNULL(entries),
-                                     bind(GetEntriesDone, _1, entries, task));
+  if (fetch_scts_ && FLAGS_fetcher_stream_entries) {
+    client->StreamEntriesAndSCTs(fetch->start_index, request->end_index,
+                                 &request->entries, done);
+  } else if (fetch_scts_) {
+    client->GetEntriesAndSCTs(fetch->start_index, request->end_index,
+                              &request->entries, done);
   } else {
-    peer->client().GetEntries(start_index, end_index, CHECK_NOTNULL(entries),
-                              bind(GetEntriesDone, _1, entries, task));
+    client->GetEntries(fetch->start_index, request->end_index,
+                       &request->entries, done);
   }
 }
 
 
-shared_ptr<Peer> PeerGroup::PickPeer(const int64_t needed_size) const {
-  lock_guard<mutex> lock(lock_);
+// static
+void PeerGroup::RequestDone(const shared_ptr<Fetch>& fetch, size_t index,
+                            AsyncLogClient::Status client_status) {
+  Status status;
+  {
+    lock_guard<mutex> lock(fetch->lock);
+    if (fetch->done) {
+      // The other request won.
+      return;
+    }
+    Fetch::Request* const request(fetch->requests.at(index).get());
+    request->done = true;
+    status = ClientStatusToStatus(client_status, &request->entries);
+    fetch->group->FetchDone(request->peer,
+                            request->end_index - fetch->start_index + 1,
+                            request->started_at, status,
+                            request->entries.size());
+
+    bool others_pending(false);
+    for (const unique_ptr<Fetch::Request>& other : fetch->requests) {
+      others_pending = others_pending || !other->done;
+    }
+    if (!status.ok() && others_pending) {
+      // The other request might still succeed.
+      return;
+    }
 
-  // TODO(pphaneuf): We should pick peers a bit more cleverly, to
-  // spread the load somewhat.
+    fetch->done = true;
+    for (const unique_ptr<Fetch::Request>& other : fetch->requests) {
+      if (!other->done) {
+        fetch->group->FetchAbandoned(other->peer, other->started_at);
+      }
+    }
+    if (status.ok()) {
+      fetch->entries->swap(request->entries);
+      if (index > 0) {
+        fetcher_hedged_fetches->Increment("won");
+      }
+    }
+  }
+
+  fetch->task->Return(status);
+}
+
+
+void PeerGroup::Hedge(const shared_ptr<Fetch>& fetch, Task* timer) {
+  if (!timer->status().ok()) {
+    // Cancelled, as the fetch is done.
+    return;
+  }
+
+  size_t index;
+  {
+    lock_guard<mutex> fetch_lock(fetch->lock);
+    if (fetch->done) {
+      return;
+    }
+    unique_lock<mutex> lock(lock_);
+    const shared_ptr<Peer> peer(
+        PickPeer(lock, fetch->end_index + 1, fetch->requests.front()->peer));
+    if (!peer || !hedge_budget_.TryHedge()) {
+      return;
+    }
+    PeerState* const state(&peers_.at(peer));
+    ++state->num_in_flight;
+    const int64_t peer_end_index(
+        state->max_batch_size > 0
+            ? min(fetch->end_index,
+                  fetch->start_index + state->max_batch_size - 1)
+            : fetch->end_index);
+    fetch->requests.emplace_back(new Fetch::Request{
+        peer, peer_end_index, steady_clock::now(),
+        vector<AsyncLogClient::Entry>(), false});
+    index = fetch->requests.size() - 1;
+  }
+
+  VLOG(1) << "hedging the fetch of entries from " << fetch->start_index;
+  fetcher_hedged_fetches->Increment("sent");
+  SendFetch(fetch, index);
+}
+
+
+shared_ptr<Peer> PeerGroup::PickPeer(const unique_lock<mutex>& lock,
+                                     const int64_t needed_size,
+                                     const shared_ptr<Peer>& excluded) {
+  CHECK(lock.owns_lock());
+
+  // Prefer the peer with the best throughput once the fetches already
+  // in flight to it are accounted for. Peers which have not completed a
+  // fetch yet go first, so that they get measured, unless all they did
+  // so far is fail.
   int64_t group_tree_size(-1);
-  vector<shared_ptr<Peer>> capable_peers;
+  vector<shared_ptr<Peer>> best_peers;
+  double best_score(-1);
   for (const auto& peer : peers_) {
     const int64_t tree_size(peer.first->TreeSize());
     group_tree_size = max(group_tree_size, tree_size);
-    if (tree_size >= needed_size) {
-      capable_peers.push_back(peer.first);
+    if (tree_size < needed_size || peer.first == excluded) {
+      continue;
+    }
+
+    const PeerState& state(peer.second);
+    double score(0);
+    if (state.entries_per_second > 0) {
+      score = state.entries_per_second / (1 + state.num_in_flight);
+    } else if (state.num_errors == 0) {
+      score = std::numeric_limits<double>::max();
+    }
+    if (score > best_score) {
+      best_peers.clear();
+      best_score = score;
+    }
+    if (score == best_score) {
+      best_peers.push_back(peer.first);
     }
   }
 
-  if (!capable_peers.empty()) {
-    return capable_peers[std::rand() % capable_peers.size()];
+  if (!best_peers.empty()) {
+    // Spread the load among equally good peers.
+    return best_peers[std::rand() % best_peers.size()];
   }
 
   LOG(INFO) << "requested a peer with " << needed_size
@@ -118,4 +352,50 @@ shared_ptr<Peer> PeerGroup::PickPeer(const int64_t needed_size) const {
 }
 
 
+void PeerGroup::FetchDone(const shared_ptr<Peer>& peer, int64_t num_requested,
+                          const steady_clock::time_point& started_at,
+                          const Status& status, int64_t num_received) {
+  const duration<double> latency(steady_clock::now() - started_at);
+
+  lock_guard<mutex> lock(lock_);
+  PeerState* const state(&peers_.at(peer));
+  --state->num_in_flight;
+  if (status.ok()) {
+    if (num_received < num_requested) {
+      VLOG(1) << "peer returned " << num_received << " of " << num_requested
+              << " entries, limiting its batch size";
+      state->max_batch_size = num_received;
+    }
+    const double entries_per_second(num_received /
+                                    max(latency.count(), 1e-3));
+    if (state->entries_per_second > 0) {
+      state->latency += kMovingAverageWeight * (latency - state->latency);
+      state->entries_per_second +=
+          kMovingAverageWeight *
+          (entries_per_second - state->entries_per_second);
+    } else {
+      state->latency = latency;
+      state->entries_per_second = entries_per_second;
+    }
+    state->recent_latencies.Add(latency);
+    VLOG(2) << "peer latency " << state->latency.count() << "s, "
+            << state->entries_per_second << " entries/s";
+  } else {
+    ++state->num_errors;
+    // Make this peer less attractive until it has proven itself again.
+    state->entries_per_second /= 2;
+  }
+}
+
+
+void PeerGroup::FetchAbandoned(const shared_ptr<Peer>& peer,
+                               const steady_clock::time_point& started_at) {
+  lock_guard<mutex> lock(lock_);
+  PeerState* const state(&peers_.at(peer));
+  --state->num_in_flight;
+  // It took at least this long.
+  state->recent_latencies.Add(steady_clock::now() - started_at);
+}
+
+
 }  // namespace cert_trans
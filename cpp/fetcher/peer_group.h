@@ -2,6 +2,7 @@
 #define CERT_TRANS_FETCHER_PEER_GROUP_H_
 
 #include <stdint.h>
+#include <chrono>
 #include <memory>
 #include <mutex>
 #include <set>
@@ -10,6 +11,7 @@
 #include "base/macros.h"
 #include "client/async_log_client.h"
 #include "fetcher/peer.h"
+#include "util/hedging.h"
 #include "util/task.h"
 
 namespace cert_trans {
@@ -20,6 +22,15 @@ namespace cert_trans {
 // errors will be retried, and unhealthy peers will be dropped (so the
 // available tree size can get smaller).
 // TODO(pphaneuf): Make that last sentence true!
+//
+// The latency and throughput of every fetch is tracked per peer, and
+// used to send requests to the peers which are serving them fastest.
+// Requests are also trimmed to the number of entries a peer has been
+// seen to return at most, so that a fetch does not come back short.
+//
+// A fetch which takes longer than the 95th percentile of the latencies
+// of its peer is hedged: it is sent to another peer as well, and the
+// first one to answer wins (see --fetcher_hedge_fraction).
 class PeerGroup {
  public:
   explicit PeerGroup(bool fetch_scts_);
@@ -30,21 +41,61 @@ class PeerGroup {
   // Returns the highest tree size of the peer group.
   int64_t TreeSize() const;
 
+  // Fetches the entries from |start_offset| to |end_offset| inclusively,
+  // although fewer entries than requested may be returned. Must outlive
+  // the fetches in progress, but not the ones abandoned for a hedge.
   void FetchEntries(int64_t start_offset, int64_t end_offset,
                     std::vector<AsyncLogClient::Entry>* entries,
                     util::Task* task);
 
  private:
   struct PeerState {
-    // TODO(pphaneuf): Keep a count of errors here, to prune away
-    // unhealthy peers.
+    PeerState();
+
+    // TODO(pphaneuf): Use this to prune away unhealthy peers.
+    int num_errors;
+    int num_in_flight;
+    // Largest number of entries the peer has been seen to return in
+    // one request, or 0 if it has not returned fewer than requested.
+    int64_t max_batch_size;
+    // Moving averages over the completed fetches, zero until there
+    // has been one.
+    std::chrono::duration<double> latency;
+    double entries_per_second;
+    // The latest latencies, to tell when to hedge.
+    LatencyWindow recent_latencies;
   };
 
-  std::shared_ptr<Peer> PickPeer(const int64_t needed_size) const;
+  // A call to FetchEntries(), sent to one peer, or two once hedged.
+  struct Fetch;
+
+  // Returns a peer with at least |needed_size| entries, other than
+  // |excluded| (if set), or NULL if there is none.
+  std::shared_ptr<Peer> PickPeer(const std::unique_lock<std::mutex>& lock,
+                                 const int64_t needed_size,
+                                 const std::shared_ptr<Peer>& excluded);
+  // Sends the request of |fetch| with |index|, which is counted as in
+  // flight already.
+  void SendFetch(const std::shared_ptr<Fetch>& fetch, size_t index);
+  // Called when the request of |fetch| with |index| is done, which
+  // might be after |fetch| is, and this instance is gone.
+  static void RequestDone(const std::shared_ptr<Fetch>& fetch, size_t index,
+                          AsyncLogClient::Status client_status);
+  // Sends |fetch| to a second peer, unless it is done already, or that
+  // would go over the hedging budget.
+  void Hedge(const std::shared_ptr<Fetch>& fetch, util::Task* timer);
+  void FetchDone(const std::shared_ptr<Peer>& peer, int64_t num_requested,
+                 const std::chrono::steady_clock::time_point& started_at,
+                 const util::Status& status, int64_t num_received);
+  // Stops counting the request sent to |peer| at |started_at| as in
+  // flight, as its response is not needed anymore.
+  void FetchAbandoned(const std::shared_ptr<Peer>& peer,
+                      const std::chrono::steady_clock::time_point& started_at);
 
   mutable std::mutex lock_;
   const bool fetch_scts_;
   std::map<std::shared_ptr<Peer>, PeerState> peers_;
+  HedgeBudget hedge_budget_;
 
   DISALLOW_COPY_AND_ASSIGN(PeerGroup);
 };
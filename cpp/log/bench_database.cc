@@ -0,0 +1,350 @@
+// Runs the same workloads against each database backend, to compare
+// them and their tuning (e.g. --leveldb_bloom_filter_bits_per_key or
+// --sqlite_cache_size, which can be passed along), reporting the rate
+// of operations, their latency percentiles, and the size of the
+// database on disk, also to --bench_results_out for test/perf_check.py.
+#include <ftw.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "log/database.h"
+#include "log/file_db.h"
+#include "log/file_storage.h"
+#include "log/leveldb_db.h"
+#include "log/logged_entry.h"
+#include "log/segmented_file_db.h"
+#include "log/sqlite_db.h"
+#include "log/test_signer.h"
+#include "proto/cert_serializer.h"
+#include "util/bench_results.h"
+#include "util/util.h"
+
+using cert_trans::BenchResults;
+using cert_trans::Database;
+using cert_trans::FileDB;
+using cert_trans::FileStorage;
+using cert_trans::LevelDB;
+using cert_trans::LoggedEntry;
+using cert_trans::SQLiteDB;
+using cert_trans::SegmentedFileDB;
+using std::atomic;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::mt19937_64;
+using std::mutex;
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+
+DEFINE_string(backends, "leveldb,sqlite,file",
+              "comma-separated backends to benchmark, among leveldb, "
+              "sqlite, file and segmented_file");
+DEFINE_string(db_dir, "",
+              "directory to create the databases in, a new temporary one "
+              "if empty");
+DEFINE_bool(keep_databases, false,
+            "keep the databases after benchmarking them");
+DEFINE_int32(num_entries, 100000,
+             "number of entries to insert, which are a few kB each");
+DEFINE_int32(batch_size, 1000,
+             "number of entries inserted at once, 1 for one at a time");
+DEFINE_int32(num_lookups, 100000,
+             "number of lookups by index and by hash, and of operations "
+             "of the mixed workload");
+DEFINE_int32(num_threads, 4,
+             "number of threads doing the lookups and the mixed workload");
+DEFINE_double(mixed_write_fraction, 0.1,
+              "fraction of the operations of the mixed workload that add "
+              "an entry, the others looking one up by index");
+
+namespace {
+
+
+const unsigned kCertStorageDepth = 3;
+const unsigned kTreeStorageDepth = 8;
+
+
+BenchResults results("bench_database");
+
+
+// Latencies of operations, in seconds.
+class Latencies {
+ public:
+  void Add(const duration<double>& latency) {
+    latencies_.push_back(latency.count());
+  }
+
+  void Merge(const Latencies& other) {
+    latencies_.insert(latencies_.end(), other.latencies_.begin(),
+                      other.latencies_.end());
+  }
+
+  // Logs the rate of |num_ops| done in |elapsed|, and the distribution
+  // of the latencies.
+  void Report(const string& backend, const string& workload, int64_t num_ops,
+              const duration<double>& elapsed) {
+    std::sort(latencies_.begin(), latencies_.end());
+    LOG(INFO) << backend << " " << workload << ": " << num_ops << " ops in "
+              << elapsed.count() << "s (" << num_ops / elapsed.count()
+              << " ops/s), latency p50 " << Percentile(0.5) * 1e6
+              << "us, p90 " << Percentile(0.9) * 1e6 << "us, p99 "
+              << Percentile(0.99) * 1e6 << "us, p99.9 "
+              << Percentile(0.999) * 1e6 << "us, max "
+              << Percentile(1) * 1e6 << "us";
+    const string name(backend + "/" + workload + "/");
+    results.AddThroughput(name + "ops_per_second", num_ops / elapsed.count(),
+                          "ops/s");
+    results.AddLatency(name + "p50", Percentile(0.5));
+    results.AddLatency(name + "p99", Percentile(0.99));
+  }
+
+ private:
+  double Percentile(double p) const {
+    if (latencies_.empty()) {
+      return 0;
+    }
+    const size_t index(p * (latencies_.size() - 1));
+    return latencies_[index];
+  }
+
+  vector<double> latencies_;
+};
+
+
+// Runs |op| |num_ops| times, over --num_threads threads, and reports
+// it.
+template <class Op>
+void RunConcurrently(const string& backend, const string& workload,
+                     int64_t num_ops, const Op& op) {
+  const int num_threads(FLAGS_num_threads);
+  vector<Latencies> latencies(num_threads);
+  vector<thread> threads;
+  const steady_clock::time_point start(steady_clock::now());
+  for (int i = 0; i < num_threads; ++i) {
+    threads.emplace_back([i, num_threads, num_ops, &latencies, &op]() {
+      mt19937_64 rand(i);
+      for (int64_t n = i; n < num_ops; n += num_threads) {
+        const steady_clock::time_point op_start(steady_clock::now());
+        op(&rand);
+        latencies[i].Add(steady_clock::now() - op_start);
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+  const duration<double> elapsed(steady_clock::now() - start);
+
+  for (int i = 1; i < num_threads; ++i) {
+    latencies[0].Merge(latencies[i]);
+  }
+  latencies[0].Report(backend, workload, num_ops, elapsed);
+}
+
+
+int64_t total_size(0);
+
+
+int AddSize(const char*, const struct stat* st, int type, struct FTW*) {
+  if (type == FTW_F) {
+    total_size += st->st_size;
+  }
+  return 0;
+}
+
+
+int64_t DiskSize(const string& dir) {
+  total_size = 0;
+  PCHECK(nftw(dir.c_str(), AddSize, 16, FTW_PHYS) == 0) << dir;
+  return total_size;
+}
+
+
+int RemoveFile(const char* path, const struct stat*, int, struct FTW*) {
+  PCHECK(remove(path) == 0) << path;
+  return 0;
+}
+
+
+void RemoveDir(const string& dir) {
+  PCHECK(nftw(dir.c_str(), RemoveFile, 16, FTW_DEPTH | FTW_PHYS) == 0)
+      << dir;
+}
+
+
+unique_ptr<Database> OpenDatabase(const string& backend, const string& dir) {
+  if (backend == "leveldb") {
+    return unique_ptr<Database>(new LevelDB(dir + "/leveldb"));
+  } else if (backend == "sqlite") {
+    return unique_ptr<Database>(new SQLiteDB(dir + "/sqlite"));
+  }
+  PCHECK(mkdir((dir + "/tree").c_str(), 0700) == 0);
+  PCHECK(mkdir((dir + "/meta").c_str(), 0700) == 0);
+  if (backend == "segmented_file") {
+    return unique_ptr<Database>(new SegmentedFileDB(
+        dir + "/segments", new FileStorage(dir + "/tree", kTreeStorageDepth),
+        new FileStorage(dir + "/meta", 0)));
+  }
+  CHECK_EQ("file", backend) << "unknown backend";
+  PCHECK(mkdir((dir + "/certs").c_str(), 0700) == 0);
+  return unique_ptr<Database>(
+      new FileDB(new FileStorage(dir + "/certs", kCertStorageDepth),
+                 new FileStorage(dir + "/tree", kTreeStorageDepth),
+                 new FileStorage(dir + "/meta", 0)));
+}
+
+
+void RunBenchmarks(const string& backend, const string& dir) {
+  PCHECK(mkdir(dir.c_str(), 0700) == 0) << dir;
+  const unique_ptr<Database> db(OpenDatabase(backend, dir));
+  TestSigner signer;
+
+  // Bulk sequenced inserts, timing each batch.
+  vector<string> hashes;
+  hashes.reserve(FLAGS_num_entries);
+  {
+    Latencies latencies;
+    duration<double> elapsed(0);
+    vector<LoggedEntry> batch;
+    for (int64_t seq = 0; seq < FLAGS_num_entries;) {
+      batch.clear();
+      for (; seq < FLAGS_num_entries &&
+             batch.size() < static_cast<size_t>(FLAGS_batch_size);
+           ++seq) {
+        batch.emplace_back();
+        signer.CreateUniqueFakeSignature(&batch.back());
+        batch.back().set_sequence_number(seq);
+        hashes.emplace_back(batch.back().Hash());
+      }
+      size_t num_created;
+      const steady_clock::time_point start(steady_clock::now());
+      CHECK_EQ(Database::OK, db->CreateSequencedEntries(batch, &num_created));
+      const duration<double> latency(steady_clock::now() - start);
+      latencies.Add(latency);
+      elapsed += latency;
+    }
+    latencies.Report(backend, "insert_batch",
+                     (FLAGS_num_entries + FLAGS_batch_size - 1) /
+                         FLAGS_batch_size,
+                     elapsed);
+    LOG(INFO) << backend << " insert: " << FLAGS_num_entries / elapsed.count()
+              << " entries/s";
+    results.AddThroughput(backend + "/insert/entries_per_second",
+                          FLAGS_num_entries / elapsed.count(), "entries/s");
+  }
+  const int64_t disk_size(DiskSize(dir));
+  LOG(INFO) << backend << " size on disk: " << disk_size << " bytes ("
+            << disk_size / FLAGS_num_entries << " per entry)";
+  results.Add(backend + "/disk_bytes_per_entry",
+              static_cast<double>(disk_size) / FLAGS_num_entries, "bytes",
+              BenchResults::LOWER_IS_BETTER);
+
+  RunConcurrently(backend, "lookup_by_index", FLAGS_num_lookups,
+                  [&db](mt19937_64* rand) {
+                    LoggedEntry entry;
+                    CHECK_EQ(Database::LOOKUP_OK,
+                             db->LookupByIndex((*rand)() % FLAGS_num_entries,
+                                               &entry));
+                  });
+
+  RunConcurrently(backend, "lookup_by_hash", FLAGS_num_lookups,
+                  [&db, &hashes](mt19937_64* rand) {
+                    LoggedEntry entry;
+                    CHECK_EQ(Database::LOOKUP_OK,
+                             db->LookupByHash(hashes[(*rand)() % hashes.size()],
+                                              &entry));
+                  });
+
+  {
+    Latencies latencies;
+    const steady_clock::time_point start(steady_clock::now());
+    unique_ptr<Database::Iterator> it(db->ScanEntries(0));
+    LoggedEntry entry;
+    int64_t num_read(0);
+    for (;;) {
+      const steady_clock::time_point entry_start(steady_clock::now());
+      if (!it->GetNextEntry(&entry)) {
+        break;
+      }
+      latencies.Add(steady_clock::now() - entry_start);
+      ++num_read;
+    }
+    CHECK_EQ(FLAGS_num_entries, num_read);
+    latencies.Report(backend, "scan_entries", num_read,
+                     steady_clock::now() - start);
+  }
+
+  // Lookups by index among the entries there are, while adding more.
+  mutex write_lock;
+  atomic<int64_t> tree_size(db->TreeSize());
+  RunConcurrently(backend, "mixed", FLAGS_num_lookups,
+                  [&](mt19937_64* rand) {
+                    if (std::uniform_real_distribution<double>()(*rand) <
+                        FLAGS_mixed_write_fraction) {
+                      lock_guard<mutex> lock(write_lock);
+                      LoggedEntry entry;
+                      signer.CreateUniqueFakeSignature(&entry);
+                      entry.set_sequence_number(tree_size.load());
+                      CHECK_EQ(Database::OK, db->CreateSequencedEntry(entry));
+                      ++tree_size;
+                    } else {
+                      LoggedEntry entry;
+                      CHECK_EQ(Database::LOOKUP_OK,
+                               db->LookupByIndex((*rand)() % tree_size.load(),
+                                                 &entry));
+                    }
+                  });
+}
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  ConfigureSerializerForV1CT();
+
+  CHECK_GT(FLAGS_num_entries, 0);
+  CHECK_GT(FLAGS_batch_size, 0);
+  CHECK_GT(FLAGS_num_lookups, 0);
+  CHECK_GT(FLAGS_num_threads, 0);
+  CHECK_GE(FLAGS_mixed_write_fraction, 0);
+  CHECK_LE(FLAGS_mixed_write_fraction, 1);
+
+  string dir(FLAGS_db_dir);
+  if (dir.empty()) {
+    char tmpl[] = "/tmp/bench_database.XXXXXX";
+    PCHECK(mkdtemp(tmpl)) << tmpl;
+    dir = tmpl;
+  }
+
+  for (const string& backend : util::split(FLAGS_backends, ',')) {
+    const string backend_dir(dir + "/" + backend);
+    RunBenchmarks(backend, backend_dir);
+    if (!FLAGS_keep_databases) {
+      RemoveDir(backend_dir);
+    }
+  }
+  if (!FLAGS_keep_databases && FLAGS_db_dir.empty()) {
+    PCHECK(rmdir(dir.c_str()) == 0) << dir;
+  }
+
+  results.Write();
+  return 0;
+}
@@ -0,0 +1,371 @@
+// Runs the whole sequencing pipeline of a log in one process, with a
+// FakeEtcd for the consistent store, to measure its throughput without
+// a cluster: --num_submitters threads add entries through a
+// FrontendSigner, while a sequencer thread runs rounds of sequencing,
+// signing a tree head, serving it, and cleaning up the store, back to
+// back, as the master of a cluster does.
+//
+// It reports the rate of SCTs issued and the latency of submissions,
+// the duration of the sequencing rounds and of their steps, and the
+// rate at which the store is cleaned up. The flags of the components
+// (e.g. --etcd_cleanup_max_entries_per_run) can be passed along, to
+// compare batching changes. The results also go to --bench_results_out
+// for test/perf_check.py.
+#include <event2/thread.h>
+#include <ftw.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gmock/gmock.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "log/database.h"
+#include "log/etcd_consistent_store.h"
+#include "log/file_db.h"
+#include "log/file_storage.h"
+#include "log/frontend_signer.h"
+#include "log/leveldb_db.h"
+#include "log/log_signer.h"
+#include "log/logged_entry.h"
+#include "log/sqlite_db.h"
+#include "log/test_signer.h"
+#include "log/tree_signer.h"
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "proto/cert_serializer.h"
+#include "util/bench_results.h"
+#include "util/fake_etcd.h"
+#include "util/libevent_wrapper.h"
+#include "util/mock_masterelection.h"
+#include "util/thread_pool.h"
+
+namespace libevent = cert_trans::libevent;
+
+using cert_trans::BenchResults;
+using cert_trans::Database;
+using cert_trans::EtcdConsistentStore;
+using cert_trans::FakeEtcdClient;
+using cert_trans::FileDB;
+using cert_trans::FileStorage;
+using cert_trans::LevelDB;
+using cert_trans::LoggedEntry;
+using cert_trans::MockMasterElection;
+using cert_trans::SQLiteDB;
+using cert_trans::ThreadPool;
+using cert_trans::TreeSigner;
+using ct::LogEntry;
+using ct::SignedCertificateTimestamp;
+using ct::SignedTreeHead;
+using std::atomic;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+using testing::NiceMock;
+using testing::Return;
+using util::Status;
+
+DEFINE_string(backend, "leveldb",
+              "database backend of the log, among leveldb, sqlite and file");
+DEFINE_string(db_dir, "",
+              "directory to create the database in, a new temporary one if "
+              "empty");
+DEFINE_bool(keep_database, false, "keep the database after the benchmark");
+DEFINE_int32(num_submitters, 8,
+             "number of threads adding entries concurrently");
+DEFINE_int32(entries_per_submitter, 1000,
+             "number of entries added by each submitter");
+DEFINE_int32(submit_batch_size, 1,
+             "number of entries each submitter adds at once, as "
+             "add-chains-batch would");
+DEFINE_int32(round_interval_ms, 0,
+             "pause between the sequencing rounds, 0 to run them back to "
+             "back");
+
+namespace {
+
+
+const unsigned kCertStorageDepth = 3;
+const unsigned kTreeStorageDepth = 8;
+
+
+BenchResults results("bench_sequencing");
+
+
+// Latencies of operations, in seconds.
+class Latencies {
+ public:
+  void Add(const duration<double>& latency) {
+    latencies_.push_back(latency.count());
+    total_ += latency.count();
+  }
+
+  void Merge(const Latencies& other) {
+    latencies_.insert(latencies_.end(), other.latencies_.begin(),
+                      other.latencies_.end());
+    total_ += other.total_;
+  }
+
+  // The sum of the latencies, in seconds.
+  double Total() const {
+    return total_;
+  }
+
+  // Logs the latencies as |what|, and records their percentiles as
+  // "<name>/p50" and "<name>/p99".
+  void Report(const string& what, const string& name) {
+    std::sort(latencies_.begin(), latencies_.end());
+    LOG(INFO) << what << ": " << latencies_.size() << " times, "
+              << total_ << "s in total, p50 " << Percentile(0.5) * 1e3
+              << "ms, p90 " << Percentile(0.9) * 1e3 << "ms, p99 "
+              << Percentile(0.99) * 1e3 << "ms, max "
+              << Percentile(1) * 1e3 << "ms";
+    results.AddLatency(name + "/p50", Percentile(0.5));
+    results.AddLatency(name + "/p99", Percentile(0.99));
+  }
+
+ private:
+  double Percentile(double p) const {
+    if (latencies_.empty()) {
+      return 0;
+    }
+    const size_t index(p * (latencies_.size() - 1));
+    return latencies_[index];
+  }
+
+  vector<double> latencies_;
+  double total_ = 0;
+};
+
+
+int RemoveFile(const char* path, const struct stat*, int, struct FTW*) {
+  PCHECK(remove(path) == 0) << path;
+  return 0;
+}
+
+
+void RemoveDir(const string& dir) {
+  PCHECK(nftw(dir.c_str(), RemoveFile, 16, FTW_DEPTH | FTW_PHYS) == 0)
+      << dir;
+}
+
+
+unique_ptr<Database> OpenDatabase(const string& backend, const string& dir) {
+  if (backend == "leveldb") {
+    return unique_ptr<Database>(new LevelDB(dir + "/leveldb"));
+  } else if (backend == "sqlite") {
+    return unique_ptr<Database>(new SQLiteDB(dir + "/sqlite"));
+  }
+  CHECK_EQ("file", backend) << "unknown backend";
+  PCHECK(mkdir((dir + "/certs").c_str(), 0700) == 0);
+  PCHECK(mkdir((dir + "/tree").c_str(), 0700) == 0);
+  PCHECK(mkdir((dir + "/meta").c_str(), 0700) == 0);
+  return unique_ptr<Database>(
+      new FileDB(new FileStorage(dir + "/certs", kCertStorageDepth),
+                 new FileStorage(dir + "/tree", kTreeStorageDepth),
+                 new FileStorage(dir + "/meta", 0)));
+}
+
+
+// Adds |entries|, --submit_batch_size at a time, recording the latency
+// of each call in |latencies|.
+void Submit(FrontendSigner* frontend, const vector<LogEntry>& entries,
+            Latencies* latencies) {
+  for (size_t i = 0; i < entries.size();) {
+    vector<const LogEntry*> batch;
+    for (; i < entries.size() &&
+           batch.size() < static_cast<size_t>(FLAGS_submit_batch_size);
+         ++i) {
+      batch.push_back(&entries[i]);
+    }
+    vector<SignedCertificateTimestamp> scts(batch.size());
+    vector<SignedCertificateTimestamp*> sct_ptrs;
+    for (auto& sct : scts) {
+      sct_ptrs.push_back(&sct);
+    }
+    vector<Status> statuses;
+    const steady_clock::time_point start(steady_clock::now());
+    frontend->QueueEntries(batch, sct_ptrs, &statuses);
+    latencies->Add(steady_clock::now() - start);
+    for (const Status& status : statuses) {
+      CHECK(status.ok()) << status;
+    }
+  }
+}
+
+
+void RunBenchmark(const string& dir) {
+  const shared_ptr<libevent::Base> base(make_shared<libevent::Base>());
+  libevent::EventPumpThread pump(base);
+  ThreadPool pool;
+  FakeEtcdClient etcd(base.get());
+  NiceMock<MockMasterElection> election;
+  ON_CALL(election, IsMaster()).WillByDefault(Return(true));
+
+  const unique_ptr<Database> db(OpenDatabase(FLAGS_backend, dir));
+  EtcdConsistentStore<LoggedEntry> store(base.get(), &pool, &etcd, &election,
+                                         "/root", "id");
+  CHECK(store.SetServingSTH(SignedTreeHead()).ok());
+  const unique_ptr<LogSigner> log_signer(TestSigner::DefaultLogSigner());
+  FrontendSigner frontend(db.get(), &store, log_signer.get());
+  TreeSigner<LoggedEntry> tree_signer(
+      duration<double>(0), db.get(),
+      unique_ptr<CompactMerkleTree>(new CompactMerkleTree(new Sha256Hasher)),
+      &store, log_signer.get());
+
+  // The entries are made up front, so that the submitters only time
+  // adding them.
+  vector<vector<LogEntry>> entries(FLAGS_num_submitters);
+  TestSigner test_signer;
+  for (auto& submitter_entries : entries) {
+    submitter_entries.resize(FLAGS_entries_per_submitter);
+    for (LogEntry& entry : submitter_entries) {
+      test_signer.CreateUnique(&entry);
+    }
+  }
+  const int64_t num_entries(static_cast<int64_t>(FLAGS_num_submitters) *
+                            FLAGS_entries_per_submitter);
+
+  vector<Latencies> submit_latencies(FLAGS_num_submitters);
+  atomic<int> num_submitting(FLAGS_num_submitters);
+  duration<double> submit_elapsed(0);
+  vector<thread> submitters;
+  const steady_clock::time_point start(steady_clock::now());
+  for (int i = 0; i < FLAGS_num_submitters; ++i) {
+    submitters.emplace_back([&, i]() {
+      Submit(&frontend, entries[i], &submit_latencies[i]);
+      if (--num_submitting == 0) {
+        submit_elapsed = steady_clock::now() - start;
+      }
+    });
+  }
+
+  // The sequencing rounds, until everything is in a served tree head,
+  // and cleaned up from the store.
+  Latencies rounds, sequencing, signing, serving, cleanup;
+  int64_t num_cleaned(0);
+  int64_t tree_size(0);
+  for (;;) {
+    const bool submitted(num_submitting.load() == 0);
+    const steady_clock::time_point round_start(steady_clock::now());
+
+    Status status(tree_signer.SequenceNewEntries());
+    LOG_IF(WARNING, !status.ok()) << "could not sequence: " << status;
+    const steady_clock::time_point sequenced(steady_clock::now());
+    sequencing.Add(sequenced - round_start);
+
+    CHECK_EQ(TreeSigner<LoggedEntry>::OK, tree_signer.UpdateTree());
+    const steady_clock::time_point signed_sth(steady_clock::now());
+    signing.Add(signed_sth - sequenced);
+    const SignedTreeHead sth(tree_signer.LatestSTH());
+    status = store.SetServingSTH(sth);
+    LOG_IF(WARNING, !status.ok()) << "could not serve the tree head: "
+                                  << status;
+    const steady_clock::time_point served(steady_clock::now());
+    serving.Add(served - signed_sth);
+
+    int64_t round_cleaned(0);
+    for (;;) {
+      const util::StatusOr<int64_t> cleaned(store.CleanupOldEntries());
+      if (!cleaned.ok()) {
+        LOG(WARNING) << "could not clean up: " << cleaned.status();
+        break;
+      }
+      if (cleaned.ValueOrDie() == 0) {
+        break;
+      }
+      round_cleaned += cleaned.ValueOrDie();
+    }
+    num_cleaned += round_cleaned;
+    const steady_clock::time_point round_end(steady_clock::now());
+    cleanup.Add(round_end - served);
+    rounds.Add(round_end - round_start);
+    VLOG(1) << "round sequenced up to " << sth.tree_size() << ", cleaned "
+            << round_cleaned;
+
+    tree_size = sth.tree_size();
+    if (submitted && tree_size >= num_entries && round_cleaned == 0) {
+      break;
+    }
+    std::this_thread::sleep_for(
+        std::chrono::milliseconds(FLAGS_round_interval_ms));
+  }
+  const duration<double> elapsed(steady_clock::now() - start);
+  for (auto& t : submitters) {
+    t.join();
+  }
+  CHECK_EQ(num_entries, tree_size);
+
+  for (int i = 1; i < FLAGS_num_submitters; ++i) {
+    submit_latencies[0].Merge(submit_latencies[i]);
+  }
+  LOG(INFO) << FLAGS_backend << ": " << num_entries << " SCTs in "
+            << submit_elapsed.count() << "s ("
+            << num_entries / submit_elapsed.count() << " SCTs/s), all "
+            << "sequenced and served in " << elapsed.count() << "s ("
+            << num_entries / elapsed.count() << " entries/s)";
+  results.AddThroughput(FLAGS_backend + "/submission/scts_per_second",
+                        num_entries / submit_elapsed.count(), "SCTs/s");
+  results.AddThroughput(FLAGS_backend + "/sequenced/entries_per_second",
+                        num_entries / elapsed.count(), "entries/s");
+  submit_latencies[0].Report(FLAGS_backend + " submission (per batch)",
+                             FLAGS_backend + "/submission_batch");
+  rounds.Report(FLAGS_backend + " sequencing round", FLAGS_backend + "/round");
+  sequencing.Report(FLAGS_backend + " sequencing",
+                    FLAGS_backend + "/sequencing");
+  signing.Report(FLAGS_backend + " tree head signing",
+                 FLAGS_backend + "/signing");
+  serving.Report(FLAGS_backend + " tree head serving",
+                 FLAGS_backend + "/serving");
+  cleanup.Report(FLAGS_backend + " cleanup", FLAGS_backend + "/cleanup");
+  LOG(INFO) << FLAGS_backend << " cleanup: " << num_cleaned
+            << " entries cleaned up ("
+            << (cleanup.Total() > 0 ? num_cleaned / cleanup.Total() : 0)
+            << " entries/s)";
+}
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  evthread_use_pthreads();
+  ConfigureSerializerForV1CT();
+
+  CHECK_GT(FLAGS_num_submitters, 0);
+  CHECK_GT(FLAGS_entries_per_submitter, 0);
+  CHECK_GT(FLAGS_submit_batch_size, 0);
+  CHECK_GE(FLAGS_round_interval_ms, 0);
+
+  string dir(FLAGS_db_dir);
+  if (dir.empty()) {
+    char tmpl[] = "/tmp/bench_sequencing.XXXXXX";
+    PCHECK(mkdtemp(tmpl)) << tmpl;
+    dir = tmpl;
+  } else {
+    PCHECK(mkdir(dir.c_str(), 0700) == 0) << dir;
+  }
+
+  RunBenchmark(dir);
+  if (!FLAGS_keep_database) {
+    RemoveDir(dir);
+  }
+
+  results.Write();
+  return 0;
+}
@@ -1,6 +1,7 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "log/cert.h"
 #include "log/ct_extensions.h"
+#include "log/der.h"
 #include "merkletree/serial_hasher.h"
 #include "util/openssl_util.h"  // For LOG_OPENSSL_ERRORS
 #include "util/util.h"
@@ -20,6 +21,8 @@
 #include <string>
 #include <vector>
 
+using std::lock_guard;
+using std::mutex;
 using std::string;
 using std::to_string;
 using std::unique_ptr;
@@ -98,6 +101,12 @@ Cert::Cert(const string& pem_string) {
 }
 
 
+void Cert::ClearEncodings() {
+  lock_guard<mutex> lock(encodings_lock_);
+  encodings_ = Encodings();
+}
+
+
 Cert* Cert::Clone() const {
   X509* x509(nullptr);
   if (x509_) {
@@ -105,11 +114,17 @@ Cert* Cert::Clone() const {
     if (!x509)
       LOG_OPENSSL_ERRORS(ERROR);
   }
-  return new Cert(x509);
+  Cert* const clone(new Cert(x509));
+  if (x509) {
+    lock_guard<mutex> lock(encodings_lock_);
+    clone->encodings_ = encodings_;
+  }
+  return clone;
 }
 
 
 util::Status Cert::LoadFromDerString(const string& der_string) {
+  ClearEncodings();
   const unsigned char* start =
       reinterpret_cast<const unsigned char*>(der_string.data());
   x509_.reset(d2i_X509(nullptr, &start, der_string.size()));
@@ -123,6 +138,7 @@ util::Status Cert::LoadFromDerString(const string& der_string) {
 
 
 util::Status Cert::LoadFromDerBio(BIO* bio_in) {
+  ClearEncodings();
   x509_.reset(d2i_X509_bio(bio_in, nullptr));
   CHECK_NOTNULL(bio_in);
 
@@ -410,19 +426,24 @@ util::Status Cert::DerEncoding(string* result) const {
     return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded");
   }
 
-  unsigned char* der_buf(nullptr);
-  int der_length = i2d_X509(x509_.get(), &der_buf);
+  lock_guard<mutex> lock(encodings_lock_);
+  if (encodings_.der.empty()) {
+    unsigned char* der_buf(nullptr);
+    int der_length = i2d_X509(x509_.get(), &der_buf);
 
-  if (der_length < 0) {
-    // What does this return value mean? Let's assume it means the cert
-    // is bad until proven otherwise.
-    LOG(WARNING) << "Failed to serialize cert";
-    LOG_OPENSSL_ERRORS(WARNING);
-    return util::Status(Code::INVALID_ARGUMENT, "DER decoding failed");
+    if (der_length < 0) {
+      // What does this return value mean? Let's assume it means the cert
+      // is bad until proven otherwise.
+      LOG(WARNING) << "Failed to serialize cert";
+      LOG_OPENSSL_ERRORS(WARNING);
+      return util::Status(Code::INVALID_ARGUMENT, "DER decoding failed");
+    }
+
+    encodings_.der.assign(reinterpret_cast<char*>(der_buf), der_length);
+    OPENSSL_free(der_buf);
   }
 
-  result->assign(reinterpret_cast<char*>(der_buf), der_length);
-  OPENSSL_free(der_buf);
+  result->assign(encodings_.der);
   return util::Status::OK;
 }
 
@@ -457,38 +478,145 @@ util::Status Cert::Sha256Digest(string* result) const {
     return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded");
   }
 
-  unsigned char digest[EVP_MAX_MD_SIZE];
-  unsigned int len;
-  if (X509_digest(x509_.get(), EVP_sha256(), digest, &len) != 1) {
-    // What does this return value mean? Let's assume it means the cert
-    // is bad until proven otherwise.
-    LOG(WARNING) << "Failed to compute cert digest";
-    LOG_OPENSSL_ERRORS(WARNING);
-    return util::Status(Code::INVALID_ARGUMENT, "SHA256 digest failed");
+  lock_guard<mutex> lock(encodings_lock_);
+  if (encodings_.sha256_digest.empty()) {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int len;
+    if (X509_digest(x509_.get(), EVP_sha256(), digest, &len) != 1) {
+      // What does this return value mean? Let's assume it means the cert
+      // is bad until proven otherwise.
+      LOG(WARNING) << "Failed to compute cert digest";
+      LOG_OPENSSL_ERRORS(WARNING);
+      return util::Status(Code::INVALID_ARGUMENT, "SHA256 digest failed");
+    }
+
+    encodings_.sha256_digest.assign(reinterpret_cast<char*>(digest), len);
   }
 
-  result->assign(reinterpret_cast<char*>(digest), len);
+  result->assign(encodings_.sha256_digest);
   return util::Status::OK;
 }
 
 
+namespace {
+
+
+// The DER header of an element with |tag| and contents of |length|.
+string DerHeader(unsigned char tag, size_t length) {
+  string header(1, tag);
+  if (length < 0x80) {
+    header.push_back(length);
+    return header;
+  }
+  string length_bytes;
+  for (; length > 0; length >>= 8) {
+    length_bytes.insert(length_bytes.begin(), length & 0xff);
+  }
+  header.push_back(0x80 | length_bytes.size());
+  return header + length_bytes;
+}
+
+
+}  // namespace
+
+
 util::Status Cert::DerEncodedTbsCertificate(string* result) const {
   if (!IsLoaded()) {
     LOG(ERROR) << "Cert not loaded";
     return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded");
   }
 
-  unsigned char* der_buf(nullptr);
-  int der_length = i2d_re_X509_tbs(x509_.get(), &der_buf);
-  if (der_length < 0) {
-    // What does this return value mean? Let's assume it means the cert
-    // is bad until proven otherwise.
-    LOG(WARNING) << "Failed to serialize the TBS component";
-    LOG_OPENSSL_ERRORS(WARNING);
-    return util::Status(Code::INVALID_ARGUMENT, "TBS DER serialize failed");
+  lock_guard<mutex> lock(encodings_lock_);
+  if (encodings_.der_tbs.empty()) {
+    unsigned char* der_buf(nullptr);
+    int der_length = i2d_re_X509_tbs(x509_.get(), &der_buf);
+    if (der_length < 0) {
+      // What does this return value mean? Let's assume it means the cert
+      // is bad until proven otherwise.
+      LOG(WARNING) << "Failed to serialize the TBS component";
+      LOG_OPENSSL_ERRORS(WARNING);
+      return util::Status(Code::INVALID_ARGUMENT, "TBS DER serialize failed");
+    }
+    encodings_.der_tbs.assign(reinterpret_cast<char*>(der_buf), der_length);
+    OPENSSL_free(der_buf);
   }
-  result->assign(reinterpret_cast<char*>(der_buf), der_length);
-  OPENSSL_free(der_buf);
+
+  result->assign(encodings_.der_tbs);
+  return util::Status::OK;
+}
+
+
+util::Status Cert::DerEncodedTbsCertificateWithoutExtension(
+    int extension_nid, string* result) const {
+  ASN1_OBJECT* const object(OBJ_nid2obj(extension_nid));
+  if (!object) {
+    LOG(ERROR) << "OBJ_nid2obj failed for NID " << extension_nid;
+    LOG_OPENSSL_ERRORS(ERROR);
+    return util::Status(Code::INTERNAL, "Unknown extension NID");
+  }
+  unsigned char* oid_buf(nullptr);
+  const int oid_length(i2d_ASN1_OBJECT(object, &oid_buf));
+  if (oid_length < 0) {
+    LOG_OPENSSL_ERRORS(ERROR);
+    return util::Status(Code::INTERNAL, "Failed to encode extension OID");
+  }
+  const string oid(reinterpret_cast<char*>(oid_buf), oid_length);
+  OPENSSL_free(oid_buf);
+
+  string der;
+  const util::Status status(DerEncoding(&der));
+  if (!status.ok()) {
+    return status;
+  }
+
+  const util::Status unsupported(Code::UNIMPLEMENTED,
+                                 "Unsupported TBS encoding");
+  DerCertificate cert;
+  if (!ReadDerCertificate(der, &cert)) {
+    return unsupported;
+  }
+  if (cert.extensions.tag == 0) {
+    return util::Status(Code::NOT_FOUND, "Extension not found.");
+  }
+  vector<DerElement> found_extensions;
+  if (!FindDerExtensions(der, cert, oid, &found_extensions)) {
+    return unsupported;
+  }
+  if (found_extensions.empty()) {
+    return util::Status(Code::NOT_FOUND, "Extension not found.");
+  }
+  if (found_extensions.size() > 1) {
+    LOG(WARNING) << "Failed to delete the extension. Does the certificate "
+                 << "have duplicate extensions?";
+    return util::Status(Code::ALREADY_EXISTS, "Multiple extensions in cert");
+  }
+  const DerElement& tbs(cert.tbs);
+  const DerElement& extensions(cert.extensions);
+  const DerElement& extension_list(cert.extension_list);
+  const DerElement& found(found_extensions[0]);
+  const size_t list_length(extension_list.end - extension_list.contents -
+                           (found.end - found.start));
+  if (list_length == 0) {
+    // Whether the extensions would then be left out is up to OpenSSL.
+    return unsupported;
+  }
+
+  const string list_header(DerHeader(kDerSequence, list_length));
+  const string extensions_header(
+      DerHeader(kDerExtensions, list_header.size() + list_length));
+  const size_t tbs_length(extensions.start - tbs.contents +
+                          extensions_header.size() + list_header.size() +
+                          list_length);
+
+  result->clear();
+  result->reserve(tbs.end - tbs.start);
+  result->append(DerHeader(kDerSequence, tbs_length));
+  result->append(der, tbs.contents, extensions.start - tbs.contents);
+  result->append(extensions_header);
+  result->append(list_header);
+  result->append(der, extension_list.contents,
+                 found.start - extension_list.contents);
+  result->append(der, found.end, extension_list.end - found.end);
   return util::Status::OK;
 }
 
@@ -554,22 +682,75 @@ util::Status Cert::SPKISha256Digest(string* result) const {
     return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded");
   }
 
-  unsigned char* der_buf(nullptr);
-  int der_length =
-      i2d_X509_PUBKEY(X509_get_X509_PUBKEY(x509_.get()), &der_buf);
-  if (der_length < 0) {
-    // What does this return value mean? Let's assume it means the cert
-    // is bad until proven otherwise.
-    LOG(WARNING) << "Failed to serialize the Subject Public Key Info";
+  lock_guard<mutex> lock(encodings_lock_);
+  if (encodings_.spki_sha256_digest.empty()) {
+    unsigned char* der_buf(nullptr);
+    int der_length =
+        i2d_X509_PUBKEY(X509_get_X509_PUBKEY(x509_.get()), &der_buf);
+    if (der_length < 0) {
+      // What does this return value mean? Let's assume it means the cert
+      // is bad until proven otherwise.
+      LOG(WARNING) << "Failed to serialize the Subject Public Key Info";
+      LOG_OPENSSL_ERRORS(WARNING);
+      return util::Status(Code::INVALID_ARGUMENT,
+                          "SPKI SHA256 digest failed");
+    }
+
+    encodings_.spki_sha256_digest = Sha256Hasher::Sha256Digest(
+        string(reinterpret_cast<char*>(der_buf), der_length));
+    OPENSSL_free(der_buf);
+  }
+
+  result->assign(encodings_.spki_sha256_digest);
+  return util::Status::OK;
+}
+
+
+util::Status Cert::SubjectKeyIdentifier(string* result) const {
+  if (!IsLoaded()) {
+    LOG(ERROR) << "Cert not loaded";
+    return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded");
+  }
+
+  const util::Status status(
+      OctetStringExtensionData(NID_subject_key_identifier, result));
+  if (status.CanonicalCode() != Code::NOT_FOUND) {
+    return status;
+  }
+
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int len;
+  if (X509_pubkey_digest(x509_.get(), EVP_sha1(), digest, &len) != 1) {
+    LOG(WARNING) << "Failed to compute public key digest";
     LOG_OPENSSL_ERRORS(WARNING);
-    return util::Status(Code::INVALID_ARGUMENT, "SPKI SHA256 digest failed");
+    return util::Status(Code::INVALID_ARGUMENT, "SHA1 digest failed");
+  }
+  result->assign(reinterpret_cast<char*>(digest), len);
+  return util::Status::OK;
+}
+
+
+util::Status Cert::AuthorityKeyIdentifier(string* result) const {
+  if (!IsLoaded()) {
+    LOG(ERROR) << "Cert not loaded";
+    return util::Status(Code::FAILED_PRECONDITION, "Cert not loaded");
+  }
+
+  const StatusOr<void*> ext_struct(
+      ExtensionStructure(NID_authority_key_identifier));
+  if (!ext_struct.ok()) {
+    return ext_struct.status();
   }
 
-  string sha256_digest = Sha256Hasher::Sha256Digest(
-      string(reinterpret_cast<char*>(der_buf), der_length));
+  // |akid| is never null upon success.
+  ScopedAUTHORITY_KEYID akid(
+      static_cast<AUTHORITY_KEYID*>(ext_struct.ValueOrDie()));
+  if (!akid->keyid) {
+    return util::Status(Code::NOT_FOUND, "No authority key identifier");
+  }
 
-  result->assign(sha256_digest);
-  OPENSSL_free(der_buf);
+  result->assign(reinterpret_cast<const char*>(akid->keyid->data),
+                 akid->keyid->length);
   return util::Status::OK;
 }
 
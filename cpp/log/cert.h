@@ -4,6 +4,7 @@
 #include <gtest/gtest_prod.h>
 #include <openssl/asn1.h>
 #include <openssl/x509.h>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -19,6 +20,10 @@ bool IsRedactedHost(const std::string& hostname);
 // Tests if a hostname containing any redactions follows the RFC rules
 bool IsValidRedactedHost(const std::string& hostname);
 
+class CertPool;
+
+// The DER encodings and digests of a cert are computed once, on first
+// use, and kept with the cert, which is never modified once loaded.
 class Cert {
  public:
   // Takes ownership of the X509 structure. It's advisable to check
@@ -129,6 +134,20 @@ class Cert {
   // Returns ERROR if the cert is not loaded.
   util::Status DerEncodedTbsCertificate(std::string* result) const;
 
+  // Sets |result| to the DER-encoded TBS component of the cert without
+  // the extension |extension_nid|, like DeleteExtension() and
+  // DerEncoding() on a TbsCertificate would, but by cutting the
+  // extension out of the DER encoding of the cert, and fixing up the
+  // lengths around it, which is much cheaper.
+  // Returns OK if the extension was present and was removed.
+  // Returns NOT_FOUND if the extension was not present.
+  // Returns ALREADY_EXISTS if it is present more than once.
+  // Returns UNIMPLEMENTED if it is the only extension, or the encoding
+  // cannot be handled, in which case a TbsCertificate has to be used.
+  // Returns ERROR if the cert is not loaded or something else failed.
+  util::Status DerEncodedTbsCertificateWithoutExtension(
+      int extension_nid, std::string* result) const;
+
   // Sets the DER-encoded subject Name component of the cert in |result|.
   // Returns TRUE if the encoding succeeded.
   // Returns FALSE if the encoding failed.
@@ -153,6 +172,21 @@ class Cert {
   // Returns ERROR if the cert is not loaded.
   util::Status SPKISha256Digest(std::string* result) const;
 
+  // Sets the identifier of the cert's public key in |result|: the
+  // contents of its subjectKeyIdentifier extension, or if it has none,
+  // the SHA-1 digest of its subjectPublicKey (as in method (1) of RFC
+  // 5280, section 4.2.1.2).
+  // Returns OK if the identifier was found or computed.
+  // Returns ERROR if the cert is not loaded or something else failed.
+  util::Status SubjectKeyIdentifier(std::string* result) const;
+
+  // Sets the keyIdentifier of the cert's authorityKeyIdentifier
+  // extension in |result|.
+  // Returns OK if the key identifier is present.
+  // Returns NOT_FOUND if the extension or its keyIdentifier are absent.
+  // Returns ERROR if the cert is not loaded or the extension is corrupt.
+  util::Status AuthorityKeyIdentifier(std::string* result) const;
+
   // Fetch data from an extension if encoded as an ASN1_OCTET_STRING.
   // Useful for handling custom extensions registered with X509V3_EXT_add.
   // Returns true if the extension is present and the data could be decoded.
@@ -185,6 +219,8 @@ class Cert {
   // CmsVerifier needs access to the x509_ structure directly.
   friend class CmsVerifier;
   friend class TbsCertificate;
+  // CertPool shares the X509 structure and encodings of pooled certs.
+  friend class CertPool;
   // Allow CtExtensions tests to poke around the private members
   // for convenience.
   FRIEND_TEST(CtExtensionsTest, TestSCTExtension);
@@ -202,7 +238,19 @@ class Cert {
   static std::string PrintName(X509_NAME* name);
   static std::string PrintTime(ASN1_TIME* when);
   static util::Status DerEncodedName(X509_NAME* name, std::string* result);
+  void ClearEncodings();
+
+  // The memoized encodings, each empty until it is first computed.
+  struct Encodings {
+    std::string der;
+    std::string der_tbs;
+    std::string sha256_digest;
+    std::string spki_sha256_digest;
+  };
+
   ScopedX509 x509_;
+  mutable std::mutex encodings_lock_;
+  mutable Encodings encodings_;
 
   DISALLOW_COPY_AND_ASSIGN(Cert);
 };
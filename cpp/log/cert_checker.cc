@@ -1,6 +1,7 @@
 /* -*- indent-tabs-mode: nil -*- */
 #include "log/cert_checker.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <openssl/asn1.h>
 #include <openssl/bio.h>
@@ -8,7 +9,10 @@
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
 #include <string.h>
+#include <algorithm>
+#include <map>
 #include <memory>
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
@@ -19,6 +23,13 @@
 #include "util/openssl_util.h"  // for LOG_OPENSSL_ERRORS
 #include "util/util.h"
 
+using std::lock_guard;
+using std::make_shared;
+using std::map;
+using std::multimap;
+using std::mutex;
+using std::set;
+using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
 using std::vector;
@@ -27,13 +38,53 @@ using util::Status;
 using util::StatusOr;
 using util::error::Code;
 
+DEFINE_int32(cert_checker_signature_cache_size, 10000,
+             "maximum number of verified certificate chain signatures "
+             "remembered by CertChecker, or 0 to verify every signature of "
+             "every submission");
+
 namespace cert_trans {
 
+struct CertChecker::TrustedStore {
+  // The certificates that the indexes below point to. Shared with the
+  // stores that are built by adding to this one.
+  vector<shared_ptr<const Cert>> certs;
+
+  // A map by the DER encoding of the subject name.
+  multimap<string, const Cert*> by_subject_name;
+
+  // The certificates by subject key identifier, to find the issuer
+  // named by the authority key identifier of a certificate first, among
+  // those with the same subject name.
+  multimap<string, const Cert*> by_key_id;
+
+  // The SHA256 digest of the subjectPublicKeyInfo of the certificates,
+  // or an empty string if it could not be computed. Certificates with
+  // the same key (e.g. cross-signs) verify the same signatures, so only
+  // one of them needs to be tried.
+  map<const Cert*, string> spki_digests;
+};
+
+CertChecker::CertChecker()
+    : store_(make_shared<const TrustedStore>()),
+      has_not_after_range_(false),
+      not_after_start_(0),
+      not_after_limit_(0) {
+}
+
 CertChecker::~CertChecker() {
-  ClearAllTrustedCertificates();
 }
 
 bool CertChecker::LoadTrustedCertificates(const string& cert_file) {
+  return LoadTrustedCertificatesFromFile(cert_file, false /* replace */);
+}
+
+bool CertChecker::ReloadTrustedCertificates(const string& cert_file) {
+  return LoadTrustedCertificatesFromFile(cert_file, true /* replace */);
+}
+
+bool CertChecker::LoadTrustedCertificatesFromFile(const string& cert_file,
+                                                  bool replace) {
   // A read-only BIO.
   ScopedBIO bio_in(BIO_new(BIO_s_file()));
   if (!bio_in) {
@@ -47,7 +98,7 @@ bool CertChecker::LoadTrustedCertificates(const string& cert_file) {
     return false;
   }
 
-  return LoadTrustedCertificatesFromBIO(bio_in.get());
+  return LoadTrustedCertificatesFromBIO(bio_in.get(), replace);
 }
 
 bool CertChecker::LoadTrustedCertificates(
@@ -66,15 +117,21 @@ bool CertChecker::LoadTrustedCertificates(
     return false;
   }
 
-  return LoadTrustedCertificatesFromBIO(bio_in.get());
+  return LoadTrustedCertificatesFromBIO(bio_in.get(), false /* replace */);
 }
 
-bool CertChecker::LoadTrustedCertificatesFromBIO(BIO* bio_in) {
+bool CertChecker::LoadTrustedCertificatesFromBIO(BIO* bio_in, bool replace) {
   CHECK_NOTNULL(bio_in);
-  std::vector<std::pair<string, Cert*> > certs_to_add;
+  lock_guard<mutex> lock(update_lock_);
+  // The new store is built on the side, and only published once
+  // complete, so that a bad file changes nothing.
+  const shared_ptr<TrustedStore> store(
+      replace ? make_shared<TrustedStore>()
+              : make_shared<TrustedStore>(*CurrentStore()));
+  const size_t old_size(store->certs.size());
   bool error = false;
-  // certs_to_add may be empty if no new certs were added, so keep track of
-  // successfully parsed cert count separately.
+  // No certificates may be new, so keep track of successfully parsed
+  // cert count separately.
   size_t cert_count = 0;
 
   while (!error) {
@@ -84,7 +141,7 @@ bool CertChecker::LoadTrustedCertificatesFromBIO(BIO* bio_in) {
       // and at least warn if it isn't.
       unique_ptr<Cert> cert(new Cert(x509.release()));
       string subject_name;
-      const StatusOr<bool> is_trusted(IsTrusted(*cert, &subject_name));
+      const StatusOr<bool> is_trusted(IsTrusted(*store, *cert, &subject_name));
       if (!is_trusted.ok()) {
         error = true;
         break;
@@ -92,7 +149,7 @@ bool CertChecker::LoadTrustedCertificatesFromBIO(BIO* bio_in) {
 
       ++cert_count;
       if (!is_trusted.ValueOrDie()) {
-        certs_to_add.push_back(make_pair(subject_name, cert.release()));
+        AddTrustedCertificate(subject_name, cert.release(), store.get());
       }
     } else {
       // See if we reached the end of the file.
@@ -112,29 +169,100 @@ bool CertChecker::LoadTrustedCertificatesFromBIO(BIO* bio_in) {
   }
 
   if (error || !cert_count) {
-    while (!certs_to_add.empty()) {
-      delete certs_to_add.back().second;
-      certs_to_add.pop_back();
-    }
     return false;
   }
 
-  size_t new_certs = certs_to_add.size();
-  while (!certs_to_add.empty()) {
-    trusted_.insert(certs_to_add.back());
-    certs_to_add.pop_back();
+  if (replace) {
+    LOG(INFO) << "Replaced trusted store with " << store->certs.size()
+              << " certificate(s)";
+  } else {
+    LOG(INFO) << "Added " << store->certs.size() - old_size
+              << " new certificate(s) to trusted store";
   }
-  LOG(INFO) << "Added " << new_certs << " new certificate(s) to trusted store";
+  PublishStore(store);
 
   return true;
 }
 
 void CertChecker::ClearAllTrustedCertificates() {
-  std::multimap<string, const Cert*>::iterator it = trusted_.begin();
-  for (; it != trusted_.end(); ++it) {
-    delete it->second;
+  lock_guard<mutex> lock(update_lock_);
+  PublishStore(make_shared<const TrustedStore>());
+}
+
+// static
+void CertChecker::AddTrustedCertificate(const string& subject_name,
+                                        const Cert* cert,
+                                        TrustedStore* store) {
+  store->certs.emplace_back(cert);
+  store->by_subject_name.insert(make_pair(subject_name, cert));
+
+  string key_id;
+  if (cert->SubjectKeyIdentifier(&key_id).ok()) {
+    store->by_key_id.insert(make_pair(key_id, cert));
+  }
+
+  string spki_digest;
+  if (!cert->SPKISha256Digest(&spki_digest).ok()) {
+    spki_digest.clear();
+  }
+  store->spki_digests[cert] = spki_digest;
+}
+
+shared_ptr<const CertChecker::TrustedStore> CertChecker::CurrentStore()
+    const {
+  return std::atomic_load(&store_);
+}
+
+void CertChecker::PublishStore(const shared_ptr<const TrustedStore>& store) {
+  std::atomic_store(&store_, store);
+  // Signatures do not depend on which certificates are trusted, but
+  // keep the cache from holding on to those of removed ones.
+  ClearSignatureCache();
+}
+
+shared_ptr<const multimap<string, const Cert*>>
+CertChecker::GetTrustedCertificates() const {
+  const shared_ptr<const TrustedStore> store(CurrentStore());
+  return shared_ptr<const multimap<string, const Cert*>>(
+      store, &store->by_subject_name);
+}
+
+size_t CertChecker::NumTrustedCertificates() const {
+  return CurrentStore()->by_subject_name.size();
+}
+
+size_t CertChecker::NumCachedSignatures() const {
+  lock_guard<mutex> lock(signature_cache_lock_);
+  return signature_cache_.size();
+}
+
+void CertChecker::SetNotAfterRange(int64_t start, int64_t limit) {
+  CHECK_LT(start, limit);
+  has_not_after_range_ = true;
+  not_after_start_ = start;
+  not_after_limit_ = limit;
+}
+
+Status CertChecker::CheckNotAfter(const Cert& cert) const {
+  if (!has_not_after_range_) {
+    return Status::OK;
+  }
+  ASN1_TIME* const not_after(X509_get_notAfter(cert.x509_.get()));
+  // X509_cmp_time() returns -1 if |not_after| is at or before the time,
+  // 1 if it is after, and 0 if it cannot be parsed.
+  time_t before_start(not_after_start_ - 1);
+  time_t before_limit(not_after_limit_ - 1);
+  const int after_start(X509_cmp_time(not_after, &before_start));
+  const int before_end(X509_cmp_time(not_after, &before_limit));
+  if (after_start == 0 || before_end == 0) {
+    ClearOpenSSLErrors();
+    return Status(util::error::INVALID_ARGUMENT, "invalid expiry time");
+  }
+  if (after_start < 0 || before_end > 0) {
+    return Status(util::error::INVALID_ARGUMENT,
+                  "certificate expiry outside the range of this log");
   }
-  trusted_.clear();
+  return Status::OK;
 }
 
 Status CertChecker::CheckCertChain(CertChain* chain) const {
@@ -152,6 +280,11 @@ Status CertChecker::CheckCertChain(CertChain* chain) const {
                   "precert extension in certificate chain");
   }
 
+  const Status not_after_status(CheckNotAfter(*chain->LeafCert()));
+  if (!not_after_status.ok()) {
+    return not_after_status;
+  }
+
   return CheckIssuerChain(chain);
 }
 
@@ -169,9 +302,18 @@ Status CertChecker::CheckIssuerChain(CertChain* chain) const {
     return Status(status.CanonicalCode(), "invalid certificate chain");
   }
 
-  const Status valid_chain(chain->IsValidSignatureChain());
-  if (!valid_chain.ok()) {
-    return valid_chain;
+  // This is CertChain::IsValidSignatureChain(), through the signature
+  // cache.
+  for (size_t i = 0; i + 1 < chain->Length(); ++i) {
+    const StatusOr<bool> signed_by_issuer(
+        IsSignedBy(*chain->CertAt(i), *chain->CertAt(i + 1)));
+    if (!signed_by_issuer.ok()) {
+      return signed_by_issuer.status();
+    }
+    if (!signed_by_issuer.ValueOrDie()) {
+      return Status(util::error::INVALID_ARGUMENT,
+                    "invalid certificate chain");
+    }
   }
 
   return GetTrustedCa(chain);
@@ -193,6 +335,12 @@ Status CertChecker::CheckPreCertChain(PreCertChain* chain,
     return Status(util::error::INTERNAL, "internal error");
   }
 
+  // Before the signatures, which are much more expensive to check.
+  const Status not_after_status(CheckNotAfter(*chain->PreCert()));
+  if (!not_after_status.ok()) {
+    return not_after_status;
+  }
+
   // Check the issuer and signature chain.
   // We do not, at this point, concern ourselves with whether the CA
   // certificate that issued the precert is a Precertificate Signing
@@ -230,8 +378,44 @@ Status CertChecker::CheckPreCertChain(PreCertChain* chain,
                  util::Status::OK) {
     return Status(util::error::INTERNAL, "internal error");
   }
-  // A well-formed chain always has a precert.
-  TbsCertificate tbs(*chain->PreCert());
+  // A well-formed chain always has a precert. Without a Precert Signing
+  // Certificate, the poison extension is simply cut out of its DER
+  // encoding, which is much cheaper than going through a TbsCertificate.
+  string der_tbs;
+  Status status(util::error::UNIMPLEMENTED, "issuer to replace");
+  if (!uses_pre_issuer.ValueOrDie()) {
+    status = chain->PreCert()->DerEncodedTbsCertificateWithoutExtension(
+        cert_trans::NID_ctPoison, &der_tbs);
+#ifndef NDEBUG
+    string openssl_tbs;
+    if (status.ok() &&
+        PrecertTbsCertificate(*chain, false, &openssl_tbs).ok()) {
+      CHECK_EQ(util::HexString(openssl_tbs), util::HexString(der_tbs))
+          << "The DER rewriting of the TBS certificate differs from "
+          << "that of OpenSSL";
+    }
+#endif
+  }
+  if (status.CanonicalCode() == util::error::UNIMPLEMENTED) {
+    status =
+        PrecertTbsCertificate(*chain, uses_pre_issuer.ValueOrDie(), &der_tbs);
+  } else if (!status.ok()) {
+    return Status(util::error::INTERNAL, "internal error");
+  }
+  if (!status.ok()) {
+    return status;
+  }
+
+  issuer_key_hash->assign(key_hash);
+  tbs_certificate->assign(der_tbs);
+  return Status::OK;
+}
+
+// static
+Status CertChecker::PrecertTbsCertificate(const PreCertChain& chain,
+                                          bool uses_pre_issuer,
+                                          string* tbs_certificate) {
+  TbsCertificate tbs(*chain.PreCert());
   if (!tbs.IsLoaded() || !tbs.DeleteExtension(cert_trans::NID_ctPoison).ok()) {
     return Status(util::error::INTERNAL, "internal error");
   }
@@ -240,19 +424,15 @@ Status CertChecker::CheckPreCertChain(PreCertChain* chain,
   // replace the issuer with the one that will sign the final cert.
   // Should always succeed as we've already verified that the chain
   // is well-formed.
-  if (uses_pre_issuer.ValueOrDie() &&
-      !tbs.CopyIssuerFrom(*chain->PrecertIssuingCert()).ok()) {
+  if (uses_pre_issuer &&
+      !tbs.CopyIssuerFrom(*chain.PrecertIssuingCert()).ok()) {
     return Status(util::error::INTERNAL, "internal error");
   }
 
-  string der_tbs;
-  if (!tbs.DerEncoding(&der_tbs).ok()) {
+  if (!tbs.DerEncoding(tbs_certificate).ok()) {
     return Status(util::error::INTERNAL,
                   "could not DER-encode tbs certificate");
   }
-
-  issuer_key_hash->assign(key_hash);
-  tbs_certificate->assign(der_tbs);
   return Status::OK;
 }
 
@@ -263,15 +443,17 @@ Status CertChecker::GetTrustedCa(CertChain* chain) const {
     return Status(util::error::INTERNAL, "chain has no valid certificate");
   }
 
-  // Look up issuer from the trusted store.
-  if (trusted_.empty()) {
+  // Look up issuer from the trusted store, as it is now: it stays the
+  // same for the rest of the check, even if it is replaced meanwhile.
+  const shared_ptr<const TrustedStore> store(CurrentStore());
+  if (store->by_subject_name.empty()) {
     LOG(WARNING) << "No trusted certificates loaded";
     return Status(util::error::FAILED_PRECONDITION,
                   "no trusted certificates loaded");
   }
 
   string subject_name;
-  const StatusOr<bool> is_trusted(IsTrusted(*subject, &subject_name));
+  const StatusOr<bool> is_trusted(IsTrusted(*store, *subject, &subject_name));
   // Either an error, or true, meaning the last cert is in our trusted
   // store.  Note the trusted cert need not necessarily be
   // self-signed.
@@ -292,17 +474,38 @@ Status CertChecker::GetTrustedCa(CertChain* chain) const {
                   "untrusted self-signed certificate");
   }
 
-  std::pair<std::multimap<string, const Cert*>::const_iterator,
-            std::multimap<string, const Cert*>::const_iterator> issuer_range =
-      trusted_.equal_range(issuer_name);
+  // Try the trusted certificates with the key named by the authority
+  // key identifier first, as it is usually the only right one.
+  vector<const Cert*> candidates;
+  string authority_key_id;
+  if (subject->AuthorityKeyIdentifier(&authority_key_id).ok()) {
+    const auto key_id_range(store->by_key_id.equal_range(authority_key_id));
+    for (auto it = key_id_range.first; it != key_id_range.second; ++it) {
+      string candidate_name;
+      if (it->second->DerEncodedSubjectName(&candidate_name).ok() &&
+          candidate_name == issuer_name) {
+        candidates.push_back(it->second);
+      }
+    }
+  }
+  const size_t num_key_id_candidates(candidates.size());
+  const auto issuer_range(store->by_subject_name.equal_range(issuer_name));
+  for (auto it = issuer_range.first; it != issuer_range.second; ++it) {
+    if (find(candidates.begin(), candidates.begin() + num_key_id_candidates,
+             it->second) == candidates.begin() + num_key_id_candidates) {
+      candidates.push_back(it->second);
+    }
+  }
 
   const Cert* issuer(nullptr);
-  for (std::multimap<string, const Cert*>::const_iterator it =
-           issuer_range.first;
-       it != issuer_range.second; ++it) {
-    const Cert* issuer_cand = it->second;
+  set<string> failed_keys;
+  for (const Cert* issuer_cand : candidates) {
+    const string& spki_digest(store->spki_digests.at(issuer_cand));
+    if (failed_keys.count(spki_digest) > 0) {
+      continue;
+    }
 
-    StatusOr<bool> signed_by_issuer = subject->IsSignedBy(*issuer_cand);
+    StatusOr<bool> signed_by_issuer = IsSignedBy(*subject, *issuer_cand);
     if (signed_by_issuer.status().CanonicalCode() == Code::UNIMPLEMENTED) {
       // If the cert's algorithm is unsupported, then there's no point
       // continuing: it's unconditionally invalid.
@@ -318,6 +521,9 @@ Status CertChecker::GetTrustedCa(CertChain* chain) const {
       issuer = issuer_cand;
       break;
     }
+    if (!spki_digest.empty()) {
+      failed_keys.insert(spki_digest);
+    }
   }
 
   if (!issuer) {
@@ -336,8 +542,10 @@ Status CertChecker::GetTrustedCa(CertChain* chain) const {
   return Status::OK;
 }
 
-StatusOr<bool> CertChecker::IsTrusted(const Cert& cert,
-                                      string* subject_name) const {
+// static
+StatusOr<bool> CertChecker::IsTrusted(const TrustedStore& store,
+                                      const Cert& cert,
+                                      string* subject_name) {
   string cert_name;
   util::Status status = cert.DerEncodedSubjectName(&cert_name);
   if (status != util::Status::OK) {
@@ -349,7 +557,7 @@ StatusOr<bool> CertChecker::IsTrusted(const Cert& cert,
 
   std::pair<std::multimap<string, const Cert*>::const_iterator,
             std::multimap<string, const Cert*>::const_iterator> cand_range =
-      trusted_.equal_range(cert_name);
+      store.by_subject_name.equal_range(cert_name);
   for (std::multimap<string, const Cert*>::const_iterator it =
            cand_range.first;
        it != cand_range.second; ++it) {
@@ -361,5 +569,44 @@ StatusOr<bool> CertChecker::IsTrusted(const Cert& cert,
   return false;
 }
 
+StatusOr<bool> CertChecker::IsSignedBy(const Cert& subject,
+                                       const Cert& issuer) const {
+  // If either digest fails, just don't use the cache, and leave it to
+  // Cert::IsSignedBy to report the problem.
+  string key, subject_digest;
+  if (FLAGS_cert_checker_signature_cache_size <= 0 ||
+      !issuer.SPKISha256Digest(&key).ok() ||
+      !subject.Sha256Digest(&subject_digest).ok()) {
+    return subject.IsSignedBy(issuer);
+  }
+  key.append(subject_digest);
+
+  {
+    lock_guard<mutex> lock(signature_cache_lock_);
+    if (signature_cache_.count(key) > 0) {
+      return true;
+    }
+  }
+
+  const StatusOr<bool> signed_by_issuer(subject.IsSignedBy(issuer));
+  if (signed_by_issuer.ok() && signed_by_issuer.ValueOrDie()) {
+    lock_guard<mutex> lock(signature_cache_lock_);
+    // Evict an arbitrary signature when full, it will simply get
+    // verified again if it is still in use.
+    if (signature_cache_.size() >=
+        static_cast<size_t>(FLAGS_cert_checker_signature_cache_size)) {
+      signature_cache_.erase(signature_cache_.begin());
+    }
+    signature_cache_.insert(key);
+  }
+
+  return signed_by_issuer;
+}
+
+void CertChecker::ClearSignatureCache() {
+  lock_guard<mutex> lock(signature_cache_lock_);
+  signature_cache_.clear();
+}
+
 
 }  // namespace cert_trans
@@ -5,9 +5,13 @@
 #include <openssl/pem.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
+#include <stdint.h>
 
 #include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 #include "base/macros.h"
@@ -31,7 +35,7 @@ class PreCertChain;
 // (2) we get some spam protection.
 class CertChecker {
  public:
-  CertChecker() = default;
+  CertChecker();
 
   virtual ~CertChecker();
 
@@ -47,16 +51,33 @@ class CertChecker {
   virtual bool LoadTrustedCertificates(
       const std::vector<std::string>& trusted_certs);
 
+  // Like LoadTrustedCertificates(), but replaces all of the trusted
+  // certificates with those of |trusted_cert_file|, e.g. to rotate the
+  // roots of a running log. The new set is published in one go, while
+  // checks in progress finish with the old one. Returns false, keeping
+  // the current certificates, if the file could not be loaded.
+  bool ReloadTrustedCertificates(const std::string& trusted_cert_file);
+
   virtual void ClearAllTrustedCertificates();
 
-  virtual const std::multimap<std::string, const Cert*>&
-  GetTrustedCertificates() const {
-    return trusted_;
-  }
+  // The trusted certificates by the DER encoding of their subject name.
+  // They stay valid for as long as the returned pointer is held, even if
+  // the trusted store is changed in the meantime.
+  virtual std::shared_ptr<const std::multimap<std::string, const Cert*>>
+  GetTrustedCertificates() const;
+
+  virtual size_t NumTrustedCertificates() const;
+
+  // The number of issuer-to-subject signatures currently remembered as
+  // verified (see --cert_checker_signature_cache_size).
+  size_t NumCachedSignatures() const;
 
-  virtual size_t NumTrustedCertificates() const {
-    return trusted_.size();
-  }
+  // Only accepts the chains of (pre-)certificates expiring from |start|
+  // (inclusive) to |limit| (exclusive), in seconds since the epoch, as
+  // one of the temporal shards of a log does, which are then frozen once
+  // everything they accept has expired. Other chains fail with
+  // INVALID_ARGUMENT. Must be called before any check.
+  void SetNotAfterRange(int64_t start, int64_t limit);
 
   // Check that:
   // (1) Each certificate is correctly signed by the next one in the chain; and
@@ -84,25 +105,74 @@ class CertChecker {
                                          std::string* tbs_certificate) const;
 
  private:
+  // The trusted certificates and their indexes, which are never changed
+  // once published: changes to the trusted store build a new one.
+  struct TrustedStore;
+
   util::Status CheckIssuerChain(CertChain* chain) const;
 
+  // Checks that |cert| expires in the range set by SetNotAfterRange(),
+  // if any.
+  util::Status CheckNotAfter(const Cert& cert) const;
+
   // Look issuer up from the trusted store, and verify signature.
   util::Status GetTrustedCa(CertChain* chain) const;
 
-  // Returns true if the cert is trusted, false if it's not,
+  // Sets |tbs_certificate| to the TBS of the precert of |chain| as it
+  // will be in the final certificate, through a TbsCertificate.
+  static util::Status PrecertTbsCertificate(const PreCertChain& chain,
+                                            bool uses_pre_issuer,
+                                            std::string* tbs_certificate);
+
+  // Returns true if the cert is in |store|, false if it's not,
   // INVALID_ARGUMENT if something is wrong with the cert, and
   // INTERNAL if something terrible happened.
-  util::StatusOr<bool> IsTrusted(const Cert& cert,
-                                 std::string* subject_name) const;
+  static util::StatusOr<bool> IsTrusted(const TrustedStore& store,
+                                        const Cert& cert,
+                                        std::string* subject_name);
+
+  // Like subject.IsSignedBy(issuer), but skips the signature check if
+  // it has already succeeded for the same pair of certificates.
+  util::StatusOr<bool> IsSignedBy(const Cert& subject,
+                                  const Cert& issuer) const;
+
+  void ClearSignatureCache();
+
+  // Adds |cert|, which must not be in |store| yet, to it and its
+  // indexes. Takes ownership of |cert|.
+  static void AddTrustedCertificate(const std::string& subject_name,
+                                    const Cert* cert, TrustedStore* store);
 
-  // A map by the DER encoding of the subject name.
-  // All code manipulating this container must ensure contained elements are
-  // deallocated appropriately.
-  std::multimap<std::string, const Cert*> trusted_;
+  std::shared_ptr<const TrustedStore> CurrentStore() const;
+  // Replaces the trusted store, and clears the signature cache.
+  void PublishStore(const std::shared_ptr<const TrustedStore>& store);
 
+  bool LoadTrustedCertificatesFromFile(const std::string& trusted_cert_file,
+                                       bool replace);
   // Helper for LoadTrustedCertificates, whether reading from file or memory.
-  // Takes ownership of bio_in and frees it.
-  bool LoadTrustedCertificatesFromBIO(BIO* bio_in);
+  // Adds the certificates to those already trusted, or replaces them if
+  // |replace| is set. Does not take ownership of bio_in.
+  bool LoadTrustedCertificatesFromBIO(BIO* bio_in, bool replace);
+
+  // Serializes the changes to the trusted store.
+  std::mutex update_lock_;
+  // Only read and written with std::atomic_load() and std::atomic_store(),
+  // so that checks need no lock.
+  std::shared_ptr<const TrustedStore> store_;
+
+  // The issuer-to-subject signatures that have been verified, each keyed
+  // by the SHA256 digests of the issuer's subjectPublicKeyInfo and of
+  // the whole subject certificate, so that a certificate with the same
+  // TBSCertificate but another signature does not match. Almost all
+  // submissions share a small number of intermediates, whose links to
+  // each other and to the roots are then only verified once. This is
+  // cleared whenever the trusted store changes.
+  mutable std::mutex signature_cache_lock_;
+  mutable std::unordered_set<std::string> signature_cache_;
+
+  bool has_not_after_range_;
+  int64_t not_after_start_;
+  int64_t not_after_limit_;
 
   DISALLOW_COPY_AND_ASSIGN(CertChecker);
 };
@@ -4,6 +4,7 @@
 #include <gtest/gtest.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
+#include <map>
 #include <memory>
 #include <string>
 
@@ -18,6 +19,8 @@ using cert_trans::Cert;
 using cert_trans::CertChain;
 using cert_trans::CertChecker;
 using cert_trans::PreCertChain;
+using std::multimap;
+using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
 using std::vector;
@@ -199,6 +202,27 @@ TEST_F(CertCheckerTest, LoadTrustedCertificatesCorruptedFile) {
   EXPECT_EQ(0U, checker_.NumTrustedCertificates());
 }
 
+TEST_F(CertCheckerTest, ReloadTrustedCertificates) {
+  ASSERT_TRUE(checker_.LoadTrustedCertificates(cert_dir_ + "/" + kCaCert));
+  ASSERT_TRUE(
+      checker_.LoadTrustedCertificates(cert_dir_ + "/" + kIntermediateCert));
+  EXPECT_EQ(2U, checker_.NumTrustedCertificates());
+  const shared_ptr<const multimap<string, const Cert*>> old_roots(
+      checker_.GetTrustedCertificates());
+
+  EXPECT_TRUE(checker_.ReloadTrustedCertificates(cert_dir_ + "/" + kCaCert));
+  EXPECT_EQ(1U, checker_.NumTrustedCertificates());
+  // Whoever still holds the old certificates can keep using them.
+  EXPECT_EQ(2U, old_roots->size());
+
+  // A file that cannot be loaded changes nothing.
+  EXPECT_FALSE(
+      checker_.ReloadTrustedCertificates(cert_dir_ + "/" + kNonexistent));
+  EXPECT_FALSE(
+      checker_.ReloadTrustedCertificates(cert_dir_ + "/" + kCorrupted));
+  EXPECT_EQ(1U, checker_.NumTrustedCertificates());
+}
+
 TEST_F(CertCheckerTest, Certificate) {
   CertChain chain(leaf_pem_);
   ASSERT_TRUE(chain.IsLoaded());
@@ -213,6 +237,31 @@ TEST_F(CertCheckerTest, Certificate) {
   EXPECT_EQ(2U, chain.Length());
 }
 
+TEST_F(CertCheckerTest, NotAfterRange) {
+  // Both expire on Jun  1 00:00:00 2022 GMT.
+  const int64_t not_after(1654041600);
+  EXPECT_TRUE(checker_.LoadTrustedCertificates(cert_dir_ + "/" + kCaCert));
+  CertChain chain(leaf_pem_);
+  PreCertChain prechain(precert_pem_ + ca_pem_);
+  ASSERT_TRUE(chain.IsLoaded());
+  ASSERT_TRUE(prechain.IsLoaded());
+  string issuer_key_hash, tbs;
+
+  checker_.SetNotAfterRange(not_after, not_after + 1);
+  EXPECT_OK(checker_.CheckCertChain(&chain));
+  EXPECT_OK(checker_.CheckPreCertChain(&prechain, &issuer_key_hash, &tbs));
+
+  checker_.SetNotAfterRange(not_after - 100, not_after);
+  EXPECT_THAT(checker_.CheckCertChain(&chain),
+              StatusIs(util::error::INVALID_ARGUMENT));
+  EXPECT_THAT(checker_.CheckPreCertChain(&prechain, &issuer_key_hash, &tbs),
+              StatusIs(util::error::INVALID_ARGUMENT));
+
+  checker_.SetNotAfterRange(not_after + 1, not_after + 100);
+  EXPECT_THAT(checker_.CheckCertChain(&chain),
+              StatusIs(util::error::INVALID_ARGUMENT));
+}
+
 TEST_F(CertCheckerTest, CertificateWithRoot) {
   CertChain chain(leaf_pem_);
   ASSERT_TRUE(chain.IsLoaded());
@@ -262,6 +311,38 @@ TEST_F(CertCheckerTest, Intermediates) {
               StatusIs(util::error::INVALID_ARGUMENT));
 }
 
+TEST_F(CertCheckerTest, CachesVerifiedSignatures) {
+  EXPECT_TRUE(checker_.LoadTrustedCertificates(cert_dir_ + "/" + kCaCert));
+  EXPECT_EQ(0U, checker_.NumCachedSignatures());
+
+  CertChain chain(chain_leaf_pem_ + intermediate_pem_);
+  ASSERT_TRUE(chain.IsLoaded());
+  EXPECT_OK(checker_.CheckCertChain(&chain));
+  // The leaf to the intermediate, and the intermediate to the root.
+  EXPECT_EQ(2U, checker_.NumCachedSignatures());
+
+  CertChain again(chain_leaf_pem_ + intermediate_pem_);
+  ASSERT_TRUE(again.IsLoaded());
+  EXPECT_OK(checker_.CheckCertChain(&again));
+  EXPECT_EQ(3U, again.Length());
+  EXPECT_EQ(2U, checker_.NumCachedSignatures());
+
+  // Failed checks are not cached.
+  CertChain invalid(intermediate_pem_ + chain_leaf_pem_);
+  ASSERT_TRUE(invalid.IsLoaded());
+  EXPECT_THAT(checker_.CheckCertChain(&invalid),
+              StatusIs(util::error::INVALID_ARGUMENT));
+  EXPECT_EQ(2U, checker_.NumCachedSignatures());
+
+  // Nothing verified against the old roots is kept.
+  checker_.ClearAllTrustedCertificates();
+  EXPECT_EQ(0U, checker_.NumCachedSignatures());
+  CertChain untrusted(chain_leaf_pem_ + intermediate_pem_);
+  ASSERT_TRUE(untrusted.IsLoaded());
+  EXPECT_THAT(checker_.CheckCertChain(&untrusted),
+              StatusIs(util::error::FAILED_PRECONDITION));
+}
+
 TEST_F(CertCheckerTest, PreCert) {
   const string chain_pem = precert_pem_ + ca_pem_;
   PreCertChain chain(chain_pem);
@@ -0,0 +1,203 @@
+#include "log/cert_names.h"
+
+#include <algorithm>
+
+#include "log/der.h"
+#include "proto/ct.pb.h"
+
+using std::string;
+using std::vector;
+
+namespace cert_trans {
+
+namespace {
+
+
+const unsigned char kDerBoolean = 0x01;
+// The [2] tag of a dNSName GeneralName, which is an IA5String.
+const unsigned char kDerDnsName = 0x82;
+
+// The encoded OIDs (tag and length included) of the commonName
+// attribute and of the subjectAltName extension.
+const char kCommonNameOid[] = "\x06\x03\x55\x04\x03";
+const char kSubjectAltNameOid[] = "\x06\x03\x55\x1d\x11";
+
+
+bool IsOid(const string& der, const DerElement& element, const char* oid,
+           size_t oid_size) {
+  return element.tag == kDerObjectIdentifier &&
+         der.compare(element.start, element.end - element.start, oid,
+                     oid_size) == 0;
+}
+
+
+// Adds the contents of |element| to |*names| if it is a DNS name,
+// wildcards and redacted labels included, lower-casing it.
+void AddIfDnsName(const string& der, const DerElement& element,
+                  vector<string>* names) {
+  string name(der, element.contents, element.end - element.contents);
+  if (!name.empty() && name.back() == '.') {
+    name.pop_back();
+  }
+  if (name.find('.') == string::npos) {
+    return;
+  }
+  for (char& c : name) {
+    if (c >= 'A' && c <= 'Z') {
+      c += 'a' - 'A';
+    } else if (!((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') ||
+                 c == '.' || c == '-' || c == '_' || c == '*' || c == '?')) {
+      return;
+    }
+  }
+  names->push_back(name);
+}
+
+
+// Name ::= SEQUENCE OF SET OF SEQUENCE { type OID, value ANY }
+bool ReadCommonNames(const string& der, const DerElement& name,
+                     vector<string>* names) {
+  if (name.tag != kDerSequence) {
+    return false;
+  }
+  DerElement rdn;
+  for (size_t pos = name.contents; pos < name.end; pos = rdn.end) {
+    if (!ReadDerElement(der, pos, name.end, &rdn) || rdn.tag != kDerSet) {
+      return false;
+    }
+    DerElement attribute;
+    for (size_t apos = rdn.contents; apos < rdn.end; apos = attribute.end) {
+      DerElement type, value;
+      if (!ReadDerElement(der, apos, rdn.end, &attribute) ||
+          attribute.tag != kDerSequence ||
+          !ReadDerElement(der, attribute.contents, attribute.end, &type) ||
+          !ReadDerElement(der, type.end, attribute.end, &value)) {
+        return false;
+      }
+      if (IsOid(der, type, kCommonNameOid, sizeof(kCommonNameOid) - 1)) {
+        AddIfDnsName(der, value, names);
+      }
+    }
+  }
+  return true;
+}
+
+
+// Extension ::= SEQUENCE { extnID OID, critical BOOLEAN DEFAULT FALSE,
+//                          extnValue OCTET STRING }
+// GeneralNames ::= SEQUENCE OF GeneralName
+bool ReadAltNames(const string& der, const DerCertificate& cert,
+                  vector<string>* names) {
+  vector<DerElement> found;
+  if (!FindDerExtensions(der, cert,
+                         string(kSubjectAltNameOid,
+                                sizeof(kSubjectAltNameOid) - 1),
+                         &found)) {
+    return false;
+  }
+  for (const DerElement& extension : found) {
+    DerElement extn_id, value;
+    if (!ReadDerElement(der, extension.contents, extension.end, &extn_id) ||
+        !ReadDerElement(der, extn_id.end, extension.end, &value)) {
+      return false;
+    }
+    if (value.tag == kDerBoolean &&
+        !ReadDerElement(der, value.end, extension.end, &value)) {
+      return false;
+    }
+    DerElement general_names;
+    if (value.tag != kDerOctetString ||
+        !ReadDerElement(der, value.contents, value.end, &general_names) ||
+        general_names.tag != kDerSequence) {
+      return false;
+    }
+    DerElement general_name;
+    for (size_t gpos = general_names.contents; gpos < general_names.end;
+         gpos = general_name.end) {
+      if (!ReadDerElement(der, gpos, general_names.end, &general_name)) {
+        return false;
+      }
+      if (general_name.tag == kDerDnsName) {
+        AddIfDnsName(der, general_name, names);
+      }
+    }
+  }
+  return true;
+}
+
+
+bool ReadNames(const string& der, const DerCertificate& cert,
+               vector<string>* names) {
+  names->clear();
+  if (!ReadCommonNames(der, cert.subject, names) ||
+      !ReadAltNames(der, cert, names)) {
+    return false;
+  }
+  std::sort(names->begin(), names->end());
+  names->erase(std::unique(names->begin(), names->end()), names->end());
+  return true;
+}
+
+
+}  // namespace
+
+
+bool ExtractDnsNames(const string& der, vector<string>* names) {
+  DerCertificate cert;
+  return ReadDerCertificate(der, &cert) && ReadNames(der, cert, names);
+}
+
+
+bool ExtractDnsNamesFromTbs(const string& tbs_der, vector<string>* names) {
+  DerCertificate cert;
+  return ReadDerTbsCertificate(tbs_der, &cert) &&
+         ReadNames(tbs_der, cert, names);
+}
+
+
+bool ExtractDnsNames(const ct::LogEntry& entry, vector<string>* names) {
+  switch (entry.type()) {
+    case ct::X509_ENTRY:
+      if (entry.x509_entry().has_leaf_certificate()) {
+        return ExtractDnsNames(entry.x509_entry().leaf_certificate(), names);
+      }
+      return ExtractDnsNamesFromTbs(
+          entry.x509_entry().cert_info().tbs_certificate(), names);
+
+    case ct::PRECERT_ENTRY:
+      if (entry.precert_entry().has_pre_cert()) {
+        return ExtractDnsNamesFromTbs(
+            entry.precert_entry().pre_cert().tbs_certificate(), names);
+      }
+      if (entry.precert_entry().has_cert_info()) {
+        return ExtractDnsNamesFromTbs(
+            entry.precert_entry().cert_info().tbs_certificate(), names);
+      }
+      return ExtractDnsNames(entry.precert_entry().pre_certificate(), names);
+
+    default:
+      names->clear();
+      return true;
+  }
+}
+
+
+string ReverseDnsName(const string& name) {
+  string reversed;
+  reversed.reserve(name.size());
+  size_t end(name.size());
+  while (true) {
+    const size_t dot(end == 0 ? string::npos : name.rfind('.', end - 1));
+    const size_t start(dot == string::npos ? 0 : dot + 1);
+    reversed.append(name, start, end - start);
+    if (dot == string::npos) {
+      break;
+    }
+    reversed.push_back('.');
+    end = dot;
+  }
+  return reversed;
+}
+
+
+}  // namespace cert_trans
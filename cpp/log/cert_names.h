@@ -0,0 +1,41 @@
+#ifndef CERT_TRANS_LOG_CERT_NAMES_H_
+#define CERT_TRANS_LOG_CERT_NAMES_H_
+
+#include <string>
+#include <vector>
+
+namespace ct {
+class LogEntry;
+}
+
+namespace cert_trans {
+
+
+// Sets |*names| to the DNS names that the DER-encoded certificate |der|
+// is for: the dNSNames of its subjectAltName extension, and those of its
+// subject common names that look like DNS names, in lower case, sorted
+// and without duplicates. Only these parts of the encoding are read,
+// without parsing the whole certificate as OpenSSL would. Returns false
+// if they cannot be read.
+bool ExtractDnsNames(const std::string& der, std::vector<std::string>* names);
+
+// The same for a DER-encoded TBSCertificate, such as that of a
+// precertificate entry.
+bool ExtractDnsNamesFromTbs(const std::string& tbs_der,
+                            std::vector<std::string>* names);
+
+// The same for the certificate or precertificate of |entry|. Entries of
+// other types have no names.
+bool ExtractDnsNames(const ct::LogEntry& entry,
+                     std::vector<std::string>* names);
+
+// Returns |name| with its labels in reverse order, "com.example.www" for
+// "www.example.com", so that the reversed names of a domain and of all
+// the names within it start with that of the domain, and a range of an
+// index of reversed names has them all.
+std::string ReverseDnsName(const std::string& name);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_CERT_NAMES_H_
@@ -0,0 +1,132 @@
+#include "log/cert_names.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <openssl/bio.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <string>
+#include <vector>
+
+#include "log/der.h"
+#include "proto/ct.pb.h"
+#include "util/openssl_scoped_types.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::vector;
+
+// CN=?.example.com, with the dNSNames ?.example.com and ?.?.example.com.
+const char kRedactedCert[] = "v2/redact_test14.pem";
+// The first is CN=service.o2.co.uk, without a subjectAltName.
+const char kCommonNameChain[] = "test-issuer-collision-chain.pem";
+// No CN nor subjectAltName.
+const char kLeafCert[] = "test-cert.pem";
+
+
+class CertNamesTest : public ::testing::Test {
+ protected:
+  string ReadDer(const char* file) {
+    string pem;
+    CHECK(util::ReadTextFile(FLAGS_test_srcdir + "/test/testdata/" + file,
+                             &pem))
+        << "Could not read " << file << ". Wrong --test_srcdir?";
+    ScopedBIO bio(BIO_new_mem_buf(const_cast<char*>(pem.data()),
+                                  pem.size()));
+    ScopedX509 x509(PEM_read_bio_X509(bio.get(), NULL, NULL, NULL));
+    CHECK_NOTNULL(x509.get());
+    unsigned char* buf(NULL);
+    const int length(i2d_X509(x509.get(), &buf));
+    CHECK_GT(length, 0);
+    const string der(reinterpret_cast<char*>(buf), length);
+    OPENSSL_free(buf);
+    return der;
+  }
+
+  // The TBSCertificate is the first element of the Certificate.
+  string ReadTbsDer(const char* file) {
+    const string der(ReadDer(file));
+    DerElement cert, tbs;
+    CHECK(ReadDerElement(der, 0, der.size(), &cert));
+    CHECK(ReadDerElement(der, cert.contents, cert.end, &tbs));
+    return der.substr(tbs.start, tbs.end - tbs.start);
+  }
+};
+
+
+TEST_F(CertNamesTest, AltNamesAndCommonName) {
+  vector<string> names;
+  ASSERT_TRUE(ExtractDnsNames(ReadDer(kRedactedCert), &names));
+  EXPECT_EQ(vector<string>({"?.?.example.com", "?.example.com"}), names);
+
+  ASSERT_TRUE(ExtractDnsNamesFromTbs(ReadTbsDer(kRedactedCert), &names));
+  EXPECT_EQ(vector<string>({"?.?.example.com", "?.example.com"}), names);
+}
+
+
+TEST_F(CertNamesTest, CommonNameOnly) {
+  vector<string> names;
+  ASSERT_TRUE(ExtractDnsNames(ReadDer(kCommonNameChain), &names));
+  EXPECT_EQ(vector<string>({"service.o2.co.uk"}), names);
+}
+
+
+TEST_F(CertNamesTest, NoNames) {
+  vector<string> names{"stale"};
+  ASSERT_TRUE(ExtractDnsNames(ReadDer(kLeafCert), &names));
+  EXPECT_TRUE(names.empty());
+}
+
+
+TEST_F(CertNamesTest, RejectsBadEncodings) {
+  const string der(ReadDer(kRedactedCert));
+  vector<string> names;
+  EXPECT_FALSE(ExtractDnsNames("", &names));
+  EXPECT_FALSE(ExtractDnsNames(der.substr(0, der.size() / 2), &names));
+  EXPECT_FALSE(ExtractDnsNamesFromTbs(der, &names));
+}
+
+
+TEST_F(CertNamesTest, LogEntries) {
+  vector<string> names;
+  ct::LogEntry entry;
+  entry.set_type(ct::X509_ENTRY);
+  entry.mutable_x509_entry()->set_leaf_certificate(ReadDer(kRedactedCert));
+  ASSERT_TRUE(ExtractDnsNames(entry, &names));
+  EXPECT_EQ(2U, names.size());
+
+  entry.Clear();
+  entry.set_type(ct::PRECERT_ENTRY);
+  entry.mutable_precert_entry()->mutable_pre_cert()->set_tbs_certificate(
+      ReadTbsDer(kCommonNameChain));
+  ASSERT_TRUE(ExtractDnsNames(entry, &names));
+  EXPECT_EQ(vector<string>({"service.o2.co.uk"}), names);
+
+  entry.Clear();
+  entry.set_type(ct::X_JSON_ENTRY);
+  ASSERT_TRUE(ExtractDnsNames(entry, &names));
+  EXPECT_TRUE(names.empty());
+}
+
+
+TEST(ReverseDnsNameTest, Reverses) {
+  EXPECT_EQ("com.example.www", ReverseDnsName("www.example.com"));
+  EXPECT_EQ("com.example.*", ReverseDnsName("*.example.com"));
+  EXPECT_EQ("localhost", ReverseDnsName("localhost"));
+  EXPECT_EQ("", ReverseDnsName(""));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
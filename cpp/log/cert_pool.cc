@@ -0,0 +1,87 @@
+#include "log/cert_pool.h"
+
+#include <openssl/crypto.h>
+#include <openssl/x509v3.h>
+#include <utility>
+
+#include "merkletree/serial_hasher.h"
+
+using std::lock_guard;
+using std::move;
+using std::mutex;
+using std::string;
+using std::unique_ptr;
+
+namespace cert_trans {
+
+namespace {
+
+
+// Returns |x509|, with one more reference to it.
+X509* UpRef(X509* x509) {
+#if OPENSSL_VERSION_NUMBER < 0x10100000L && !defined(OPENSSL_IS_BORINGSSL)
+  CRYPTO_add(&x509->references, 1, CRYPTO_LOCK_X509);
+#else
+  X509_up_ref(x509);
+#endif
+  return x509;
+}
+
+
+}  // namespace
+
+
+CertPool::CertPool(size_t max_certs) : max_certs_(max_certs) {
+}
+
+
+unique_ptr<Cert> CertPool::Load(const string& der) {
+  const string key(Sha256Hasher::Sha256Digest(der));
+  {
+    lock_guard<mutex> lock(lock_);
+    const auto it(certs_.find(key));
+    if (it != certs_.end()) {
+      unique_ptr<Cert> cert(new Cert(UpRef(it->second.x509.get())));
+      cert->encodings_ = it->second.encodings;
+      return cert;
+    }
+  }
+
+  unique_ptr<Cert> cert(new Cert);
+  if (!cert->LoadFromDerString(der).ok() || max_certs_ == 0) {
+    return cert;
+  }
+
+  // Everything that OpenSSL computes lazily, and caches in the X509
+  // structure, is computed now, so that the certs sharing it never
+  // modify it. Re-encoding the TBS component invalidates the cached
+  // encoding of the whole cert, so that has to come after it.
+  string unused;
+  if (!cert->DerEncodedTbsCertificate(&unused).ok() ||
+      !cert->DerEncoding(&unused).ok() || !cert->Sha256Digest(&unused).ok() ||
+      !cert->SPKISha256Digest(&unused).ok()) {
+    return cert;
+  }
+  X509_check_purpose(cert->x509_.get(), -1, 0);
+
+  PooledCert pooled;
+  pooled.x509.reset(UpRef(cert->x509_.get()));
+  pooled.encodings = cert->encodings_;
+
+  lock_guard<mutex> lock(lock_);
+  if (certs_.size() >= max_certs_) {
+    certs_.erase(certs_.begin());
+  }
+  certs_.emplace(key, move(pooled));
+
+  return cert;
+}
+
+
+size_t CertPool::size() const {
+  lock_guard<mutex> lock(lock_);
+  return certs_.size();
+}
+
+
+}  // namespace cert_trans
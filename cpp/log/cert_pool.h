@@ -0,0 +1,56 @@
+#ifndef CERT_TRANS_LOG_CERT_POOL_H_
+#define CERT_TRANS_LOG_CERT_POOL_H_
+
+#include <stddef.h>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "base/macros.h"
+#include "log/cert.h"
+
+namespace cert_trans {
+
+
+// A bounded pool of parsed certificates, by the SHA256 digest of their
+// DER encoding, for certificates that are submitted over and over, such
+// as intermediates.
+//
+// The certs returned for the same DER encoding all share one
+// (reference-counted) X509 structure, so that it is only parsed once,
+// and the encodings and digests memoized by Cert, which are computed
+// when the cert is added to the pool. When the pool is full, arbitrary
+// certs are evicted from it; certs already returned are not affected.
+//
+// This class is thread-safe.
+class CertPool {
+ public:
+  // Keeps up to |max_certs| certs, or none at all if it is 0.
+  explicit CertPool(size_t max_certs);
+  ~CertPool() = default;
+
+  // Returns a new cert loaded from |der|, which is not loaded if |der| is
+  // not a valid DER-encoded certificate.
+  std::unique_ptr<Cert> Load(const std::string& der);
+
+  size_t size() const;
+
+ private:
+  struct PooledCert {
+    ScopedX509 x509;
+    Cert::Encodings encodings;
+  };
+
+  const size_t max_certs_;
+
+  mutable std::mutex lock_;
+  std::unordered_map<std::string, PooledCert> certs_;
+
+  DISALLOW_COPY_AND_ASSIGN(CertPool);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_CERT_POOL_H_
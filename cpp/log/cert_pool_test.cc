@@ -0,0 +1,104 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <memory>
+#include <string>
+
+#include "log/cert.h"
+#include "log/cert_pool.h"
+#include "util/status_test_util.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+using cert_trans::Cert;
+using cert_trans::CertPool;
+using std::string;
+using std::unique_ptr;
+
+// Valid certificates.
+static const char kCaCert[] = "ca-cert.pem";
+// Issued by ca-cert.pem
+static const char kLeafCert[] = "test-cert.pem";
+
+namespace {
+
+
+class CertPoolTest : public ::testing::Test {
+ protected:
+  void SetUp() {
+    const string cert_dir(FLAGS_test_srcdir + "/test/testdata/");
+    string pem;
+    CHECK(util::ReadTextFile(cert_dir + kLeafCert, &pem))
+        << "Could not read test data from " << cert_dir
+        << ". Wrong --test_srcdir?";
+    CHECK(Cert(pem).DerEncoding(&leaf_der_).ok());
+    CHECK(util::ReadTextFile(cert_dir + kCaCert, &pem));
+    CHECK(Cert(pem).DerEncoding(&ca_der_).ok());
+  }
+
+  string leaf_der_;
+  string ca_der_;
+};
+
+
+TEST_F(CertPoolTest, SharesCerts) {
+  CertPool pool(10);
+  const unique_ptr<Cert> first(pool.Load(leaf_der_));
+  ASSERT_TRUE(first->IsLoaded());
+  EXPECT_EQ(1U, pool.size());
+
+  const unique_ptr<Cert> second(pool.Load(leaf_der_));
+  ASSERT_TRUE(second->IsLoaded());
+  EXPECT_EQ(1U, pool.size());
+  EXPECT_TRUE(first->IsIdenticalTo(*second));
+
+  string der, first_digest, second_digest;
+  EXPECT_OK(second->DerEncoding(&der));
+  EXPECT_EQ(leaf_der_, der);
+  EXPECT_OK(first->Sha256Digest(&first_digest));
+  EXPECT_OK(second->Sha256Digest(&second_digest));
+  EXPECT_EQ(first_digest, second_digest);
+
+  const unique_ptr<Cert> ca(pool.Load(ca_der_));
+  ASSERT_TRUE(ca->IsLoaded());
+  EXPECT_EQ(2U, pool.size());
+  EXPECT_TRUE(second->IsSignedBy(*ca).ValueOrDie());
+}
+
+
+TEST_F(CertPoolTest, PooledCertsOutliveEviction) {
+  CertPool pool(1);
+  const unique_ptr<Cert> leaf(pool.Load(leaf_der_));
+  const unique_ptr<Cert> ca(pool.Load(ca_der_));
+  EXPECT_EQ(1U, pool.size());
+
+  // The leaf was evicted, but is still usable.
+  ASSERT_TRUE(leaf->IsLoaded());
+  EXPECT_TRUE(leaf->IsSignedBy(*ca).ValueOrDie());
+}
+
+
+TEST_F(CertPoolTest, Invalid) {
+  CertPool pool(10);
+  EXPECT_FALSE(pool.Load("not a certificate")->IsLoaded());
+  EXPECT_EQ(0U, pool.size());
+}
+
+
+TEST_F(CertPoolTest, Disabled) {
+  CertPool pool(0);
+  EXPECT_TRUE(pool.Load(leaf_der_)->IsLoaded());
+  EXPECT_EQ(0U, pool.size());
+}
+
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  OpenSSL_add_all_algorithms();
+  ERR_load_crypto_strings();
+  return RUN_ALL_TESTS();
+}
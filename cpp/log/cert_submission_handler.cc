@@ -6,6 +6,7 @@
 #include "log/cert.h"
 #include "log/cert_checker.h"
 #include "log/ct_extensions.h"
+#include "monitoring/trace.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
 
@@ -13,6 +14,7 @@ using cert_trans::Cert;
 using cert_trans::CertChain;
 using cert_trans::CertChecker;
 using cert_trans::PreCertChain;
+using cert_trans::ScopedSpan;
 using cert_trans::TbsCertificate;
 using ct::LogEntry;
 using ct::PrecertChainEntry;
@@ -30,6 +32,21 @@ bool SerializedTbs(const Cert& cert, string* result) {
     return false;
   }
 
+  // Cutting the embedded proof out of the encoding of the cert saves
+  // copying and re-encoding it as a TbsCertificate, which is only needed
+  // for the encodings that this cannot handle.
+  const Status cut(cert.DerEncodedTbsCertificateWithoutExtension(
+      cert_trans::NID_ctEmbeddedSignedCertificateTimestampList, result));
+  if (cut.ok()) {
+    return true;
+  }
+  if (cut.CanonicalCode() == util::error::NOT_FOUND) {
+    return cert.DerEncodedTbsCertificate(result).ok();
+  }
+  if (cut.CanonicalCode() != util::error::UNIMPLEMENTED) {
+    return false;
+  }
+
   const StatusOr<bool> has_embedded_proof = cert.HasExtension(
       cert_trans::NID_ctEmbeddedSignedCertificateTimestampList);
   if (!has_embedded_proof.ok()) {
@@ -124,7 +141,11 @@ Status CertSubmissionHandler::ProcessX509Submission(CertChain* chain,
   if (!chain->IsLoaded())
     return Status(util::error::INVALID_ARGUMENT, "empty submission");
 
-  const Status status(cert_checker_->CheckCertChain(chain));
+  Status status;
+  {
+    ScopedSpan span("check_chain");
+    status = cert_checker_->CheckCertChain(chain);
+  }
   if (!status.ok())
     return status;
 
@@ -151,9 +172,13 @@ Status CertSubmissionHandler::ProcessPreCertSubmission(PreCertChain* chain,
                                                        LogEntry* entry) const {
   entry->set_type(ct::PRECERT_ENTRY);
   PrecertChainEntry* precert_entry = entry->mutable_precert_entry();
-  const Status status(cert_checker_->CheckPreCertChain(
-      chain, precert_entry->mutable_pre_cert()->mutable_issuer_key_hash(),
-      precert_entry->mutable_pre_cert()->mutable_tbs_certificate()));
+  Status status;
+  {
+    ScopedSpan span("check_chain");
+    status = cert_checker_->CheckPreCertChain(
+        chain, precert_entry->mutable_pre_cert()->mutable_issuer_key_hash(),
+        precert_entry->mutable_pre_cert()->mutable_tbs_certificate());
+  }
 
   if (!status.ok())
     return status;
@@ -417,6 +417,18 @@ TEST_F(CertTest, Issuers) {
   EXPECT_TRUE(ca.IsSelfSigned().ValueOrDie());
 }
 
+TEST_F(CertTest, KeyIdentifiers) {
+  Cert leaf(leaf_pem_);
+  Cert ca(ca_pem_);
+
+  string leaf_authority_key_id, ca_key_id, leaf_key_id;
+  EXPECT_OK(leaf.AuthorityKeyIdentifier(&leaf_authority_key_id));
+  EXPECT_OK(ca.SubjectKeyIdentifier(&ca_key_id));
+  EXPECT_OK(leaf.SubjectKeyIdentifier(&leaf_key_id));
+  EXPECT_EQ(leaf_authority_key_id, ca_key_id);
+  EXPECT_NE(leaf_key_id, ca_key_id);
+}
+
 TEST_F(CertTest, DerEncodedNames) {
   Cert leaf(leaf_pem_);
   Cert ca(ca_pem_);
@@ -679,6 +691,25 @@ TEST_F(TbsCertificateTest, CopyIssuer) {
   EXPECT_EQ(der_before2, der_after2);
 }
 
+TEST_F(TbsCertificateTest, DerEncodingWithoutExtension) {
+  Cert pre(precert_pem_);
+
+  TbsCertificate tbs(pre);
+  string expected_der, der;
+  EXPECT_OK(tbs.DeleteExtension(cert_trans::NID_ctPoison));
+  EXPECT_OK(tbs.DerEncoding(&expected_der));
+  EXPECT_OK(
+      pre.DerEncodedTbsCertificateWithoutExtension(cert_trans::NID_ctPoison,
+                                                   &der));
+  EXPECT_EQ(expected_der, der);
+
+  Cert leaf(leaf_pem_);
+  EXPECT_THAT(
+      leaf.DerEncodedTbsCertificateWithoutExtension(cert_trans::NID_ctPoison,
+                                                    &der),
+      StatusIs(util::error::NOT_FOUND));
+}
+
 TEST_F(CertChainTest, LoadValid) {
   // A single certificate.
   CertChain chain(leaf_pem_);
@@ -35,7 +35,8 @@ std::unique_ptr<AsyncLogClient> BuildAsyncLogClient(
   // TODO(pphaneuf): We'd like to support HTTPS at some point.
   return std::unique_ptr<AsyncLogClient>(new AsyncLogClient(
       base.get(), fetcher,
-      "http://" + state.hostname() + ":" + std::to_string(state.log_port())));
+      "http://" + state.hostname() + ":" + std::to_string(state.log_port()) +
+          state.log_path_prefix()));
 }
 
 
@@ -103,7 +104,8 @@ ClusterStateController<Logged>::ClusterStateController(
       update_required_(false),
       cluster_serving_sth_update_thread_(
           std::bind(&ClusterStateController<Logged>::ClusterServingSTHUpdater,
-                    this)) {
+                    this)),
+      fresh_nodes_(new std::vector<ct::ClusterNodeState>) {
   CHECK_NOTNULL(base_.get());
   store_->WatchClusterNodeStates(
       std::bind(&ClusterStateController::OnClusterStateUpdated, this,
@@ -204,12 +206,24 @@ void ClusterStateController<Logged>::GetLocalNodeState(
 
 
 template <class Logged>
-void ClusterStateController<Logged>::SetNodeHostPort(const std::string& host,
-                                                     const uint16_t port) {
+void ClusterStateController<Logged>::SetNodeHostPort(
+    const std::string& host, const uint16_t port,
+    const std::string& path_prefix) {
   std::unique_lock<std::mutex> lock(mutex_);
   local_node_state_.set_hostname(host);
   local_node_state_.set_log_port(port);
+  local_node_state_.set_log_path_prefix(path_prefix);
   PushLocalNodeState(lock);
+  // Which node is this one may have changed.
+  UpdateFreshNodes(lock);
+}
+
+
+template <class Logged>
+void ClusterStateController<Logged>::SetNodeLoad(
+    int64_t requests_per_second) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  local_node_state_.set_requests_per_second(requests_per_second);
 }
 
 
@@ -231,27 +245,68 @@ bool ClusterStateController<Logged>::NodeIsStale() const {
 
 
 template <class Logged>
-std::vector<ct::ClusterNodeState>
+std::shared_ptr<const std::vector<ct::ClusterNodeState>>
 ClusterStateController<Logged>::GetFreshNodes() const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (!actual_serving_sth_) {
-    LOG(WARNING) << "Cluster has no ServingSTH, all nodes are stale.";
-    return {};
+  std::lock_guard<std::mutex> lock(fresh_nodes_mutex_);
+  return fresh_nodes_;
+}
+
+
+template <class Logged>
+void ClusterStateController<Logged>::IndexNodeSth(
+    const std::unique_lock<std::mutex>& lock, const std::string& node_id,
+    const ct::ClusterNodeState* state) {
+  CHECK(lock.owns_lock());
+
+  const auto old_key(node_sth_keys_.find(node_id));
+  if (old_key != node_sth_keys_.end()) {
+    const auto old_entry(sth_index_.find(old_key->second));
+    CHECK(old_entry != sth_index_.end());
+    if (--old_entry->second.num_nodes == 0) {
+      sth_index_.erase(old_entry);
+    }
+    node_sth_keys_.erase(old_key);
+  }
+
+  if (!state || !state->has_newest_sth()) {
+    return;
   }
-  std::vector<ct::ClusterNodeState> fresh;  // for 1983.
-  // Here we go:
-  for (const auto& node : all_peers_) {
-    const bool is_self(
-        node.second->state().hostname() == local_node_state_.hostname() &&
-        node.second->state().log_port() == local_node_state_.log_port());
-    if (!is_self && node.second->state().has_newest_sth() &&
-        node.second->state().newest_sth().tree_size() >=
-            actual_serving_sth_->tree_size()) {
-      VLOG(1) << "Node is fresh: " << node.second->state().node_id();
-      fresh.push_back(node.second->state());
+  const int64_t tree_size(state->newest_sth().tree_size());
+  CHECK_LE(0, tree_size);
+  const SthKey key(tree_size, state->newest_sth().timestamp());
+  IndexedSth* const entry(&sth_index_[key]);
+  if (entry->num_nodes == 0) {
+    entry->sth = state->newest_sth();
+  }
+  ++entry->num_nodes;
+  node_sth_keys_[node_id] = key;
+}
+
+
+template <class Logged>
+void ClusterStateController<Logged>::UpdateFreshNodes(
+    const std::unique_lock<std::mutex>& lock) {
+  CHECK(lock.owns_lock());
+
+  // Without a serving STH, all nodes are stale.
+  const std::shared_ptr<std::vector<ct::ClusterNodeState>> fresh(
+      new std::vector<ct::ClusterNodeState>);
+  if (actual_serving_sth_) {
+    for (const auto& node : all_peers_) {
+      const ct::ClusterNodeState state(node.second->state());
+      const bool is_self(state.hostname() == local_node_state_.hostname() &&
+                         state.log_port() == local_node_state_.log_port());
+      if (!is_self && state.has_newest_sth() &&
+          state.newest_sth().tree_size() >=
+              actual_serving_sth_->tree_size()) {
+        VLOG(1) << "Node is fresh: " << state.node_id();
+        fresh->push_back(state);
+      }
     }
   }
-  return fresh;
+
+  std::lock_guard<std::mutex> fresh_lock(fresh_nodes_mutex_);
+  fresh_nodes_ = fresh;
 }
 
 
@@ -285,8 +340,16 @@ void ClusterStateController<Logged>::OnClusterStateUpdated(
         it = all_peers_.end();
       }
 
+      IndexNodeSth(lock, node_id, &update.handle_.Entry());
       if (it != all_peers_.end()) {
         it->second->UpdateClusterNodeState(update.handle_.Entry());
+        // A peer announcing a tree head with entries we don't have yet
+        // (typically the master, having integrated newly sequenced
+        // entries) is fetched from right away, rather than when the
+        // fetcher next polls.
+        if (it->second->TreeSize() > database_->TreeSize()) {
+          fetcher_->FetchNow();
+        }
       } else {
         const std::shared_ptr<ClusterPeer> peer(
             std::make_shared<ClusterPeer>(base_, url_fetcher_,
@@ -301,10 +364,12 @@ void ClusterStateController<Logged>::OnClusterStateUpdated(
     } else {
       VLOG(1) << "Node left: " << node_id;
       CHECK_EQ(static_cast<size_t>(1), all_peers_.erase(node_id));
+      IndexNodeSth(lock, node_id, nullptr);
       fetcher_->RemovePeer(node_id);
     }
   }
 
+  UpdateFreshNodes(lock);
   CalculateServingSTH(lock);
 }
 
@@ -391,6 +456,7 @@ void ClusterStateController<Logged>::OnServingSthUpdated(
       write_sth = false;
     }
   }
+  UpdateFreshNodes(lock);
 
   ct::SignedTreeHead sth_to_write;
   if (write_sth) {
@@ -412,29 +478,11 @@ void ClusterStateController<Logged>::CalculateServingSTH(
   VLOG(1) << "Calculating new ServingSTH...";
   CHECK(lock.owns_lock());
 
-  // First, create a mapping of tree size to number of nodes at that size, and
-  // a mapping of the newst STH for any given size:
-  std::map<int64_t, ct::SignedTreeHead> sth_by_size;
-  std::map<int64_t, int> num_nodes_by_sth_size;
-  for (const auto& node : all_peers_) {
-    const ct::ClusterNodeState node_state(node.second->state());
-    if (node_state.has_newest_sth()) {
-      const int64_t tree_size(node_state.newest_sth().tree_size());
-      CHECK_LE(0, tree_size);
-      const int64_t timestamp(node_state.newest_sth().timestamp());
-      CHECK_LE(0, timestamp);
-
-      num_nodes_by_sth_size[tree_size]++;
-
-      // Default timestamp (first call in here) will be 0
-      if (node_state.newest_sth().timestamp() >
-          sth_by_size[tree_size].timestamp()) {
-        sth_by_size[tree_size] = node_state.newest_sth();
-      }
-    }
-  }
-
-  // Next calculate the newest STH we've seen which satisfies the following
+  // The newest STHs of the nodes are kept in |sth_index_|, ordered by
+  // tree size and then timestamp, so this only looks at the sizes from
+  // the largest one down to the first one that can be served.
+  //
+  // Calculate the newest STH we've seen which satisfies the following
   // criteria:
   //   - at least minimum_serving_nodes have an STH at least as large
   //   - at least minimum_serving_fraction have an STH at least as large
@@ -449,18 +497,21 @@ void ClusterStateController<Logged>::CalculateServingSTH(
   // Work backwards (from largest STH size) until we see that there's enough
   // coverage (according to the criteria above) to serve an STH (or determine
   // that there are insufficient nodes to serve anything.)
-  for (auto it = num_nodes_by_sth_size.rbegin();
-       it != num_nodes_by_sth_size.rend() && it->first >= current_tree_size;
-       ++it) {
+  auto it(sth_index_.rbegin());
+  while (it != sth_index_.rend() && it->first.first >= current_tree_size) {
+    const int64_t tree_size(it->first.first);
+    // The newest STH of this size comes first.
+    const ct::SignedTreeHead& candidate_sth(it->second.sth);
     // num_nodes_seen keeps track of the number of nodes we've seen so far (and
     // since we're working from larger to smaller size STH, they should all be
     // able to serve this [and smaller] STHs.)
-    num_nodes_seen += it->second;
+    for (; it != sth_index_.rend() && it->first.first == tree_size; ++it) {
+      num_nodes_seen += it->second.num_nodes;
+    }
     const double serving_fraction(static_cast<double>(num_nodes_seen) /
                                   all_peers_.size());
     if (serving_fraction >= cluster_config_.minimum_serving_fraction() &&
         num_nodes_seen >= cluster_config_.minimum_serving_nodes()) {
-      const ct::SignedTreeHead& candidate_sth(sth_by_size[it->first]);
 
       // This STH isn't a viable candidate unless its timestamp is strictly
       // newer than any current serving STH:
@@ -474,10 +525,9 @@ void ClusterStateController<Logged>::CalculateServingSTH(
         continue;
       }
 
-      LOG(INFO) << "Can serve @" << it->first << " with " << num_nodes_seen
+      LOG(INFO) << "Can serve @" << tree_size << " with " << num_nodes_seen
                 << " nodes (" << (serving_fraction * 100) << "% of cluster)";
-      calculated_serving_sth_.reset(
-          new ct::SignedTreeHead(sth_by_size[it->first]));
+      calculated_serving_sth_.reset(new ct::SignedTreeHead(candidate_sth));
       // Push this STH out to the cluster if we're master:
       if (election_->IsMaster()) {
         VLOG(1) << "Pushing new STH out to cluster";
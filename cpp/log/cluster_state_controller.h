@@ -7,6 +7,8 @@
 #include <memory>
 #include <queue>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "fetcher/continuous_fetcher.h"
 #include "log/etcd_consistent_store.h"
@@ -56,8 +58,15 @@ class ClusterStateController {
   void GetLocalNodeState(ct::ClusterNodeState* state) const;
 
   // Publishes this node's listening address in its ClusterNodeState, so that
-  // other nodes can request entries from its database.
-  void SetNodeHostPort(const std::string& host, const uint16_t port);
+  // other nodes can request entries from its database. |path_prefix| is
+  // the path under which the log is served, if any (see
+  // HttpHandler::Add()).
+  void SetNodeHostPort(const std::string& host, const uint16_t port,
+                       const std::string& path_prefix);
+
+  // Sets the load published in this node's ClusterNodeState, which goes
+  // out with the next RefreshNodeState().
+  void SetNodeLoad(int64_t requests_per_second);
 
   void RefreshNodeState();
 
@@ -66,11 +75,35 @@ class ClusterStateController {
   // Returns a vector of the other nodes in the cluster which are able to serve
   // the cluster's current ServingSTH. Does not include this node in the
   // returned list regardless of its freshness.
-  std::vector<ct::ClusterNodeState> GetFreshNodes() const;
+  //
+  // The list is kept up to date as the node states and serving STH
+  // change, so this only takes a reference to it, without waiting for
+  // the writes to the consistent store done with the main lock held.
+  std::shared_ptr<const std::vector<ct::ClusterNodeState>> GetFreshNodes()
+      const;
 
  private:
   class ClusterPeer;
 
+  // The tree size and timestamp of an STH, ordered by tree size first.
+  typedef std::pair<int64_t, uint64_t> SthKey;
+
+  // An STH which some nodes have as their newest.
+  struct IndexedSth {
+    ct::SignedTreeHead sth;
+    int num_nodes;
+  };
+
+  // Moves the node |node_id| to the entry of the newest STH in |state|
+  // in |sth_index_|, or just removes it if |state| is null or has no
+  // STH.
+  void IndexNodeSth(const std::unique_lock<std::mutex>& lock,
+                    const std::string& node_id,
+                    const ct::ClusterNodeState* state);
+
+  // Recomputes the list returned by GetFreshNodes().
+  void UpdateFreshNodes(const std::unique_lock<std::mutex>& lock);
+
   // Updates the representation of *this* node's state in the consistent store.
   void PushLocalNodeState(const std::unique_lock<std::mutex>& lock);
 
@@ -115,6 +148,10 @@ class ClusterStateController {
   mutable std::mutex mutex_;  // covers the members below:
   ct::ClusterNodeState local_node_state_;
   std::map<std::string, const std::shared_ptr<ClusterPeer>> all_peers_;
+  // The key in |sth_index_| of the nodes whose newest STH is there.
+  std::map<std::string, SthKey> node_sth_keys_;
+  // The newest STHs of the nodes, in order.
+  std::map<SthKey, IndexedSth> sth_index_;
   std::unique_ptr<ct::SignedTreeHead> calculated_serving_sth_;
   std::unique_ptr<ct::SignedTreeHead> actual_serving_sth_;
   bool exiting_;
@@ -122,6 +159,9 @@ class ClusterStateController {
   std::condition_variable update_required_cv_;
   std::thread cluster_serving_sth_update_thread_;
 
+  mutable std::mutex fresh_nodes_mutex_;  // covers the member below:
+  std::shared_ptr<const std::vector<ct::ClusterNodeState>> fresh_nodes_;
+
   friend class ClusterStateControllerTest;
 
   DISALLOW_COPY_AND_ASSIGN(ClusterStateController);
@@ -69,6 +69,7 @@ class ClusterStateControllerTest : public ::testing::Test {
     // this test, but this isn't what we're testing here, so just
     // ignore them.
     EXPECT_CALL(fetcher_, AddPeer(_, _)).Times(AnyNumber());
+    EXPECT_CALL(fetcher_, FetchNow()).Times(AnyNumber());
 
     // Set default cluster config:
     ct::ClusterConfig default_config;
@@ -76,7 +77,7 @@ class ClusterStateControllerTest : public ::testing::Test {
     default_config.set_minimum_serving_fraction(1);
     store1_->SetClusterConfig(default_config);
 
-    controller_.SetNodeHostPort(kNodeId1, 9001);
+    controller_.SetNodeHostPort(kNodeId1, 9001, "");
 
     // Set up some handy STHs
     sth100_.set_tree_size(100);
@@ -153,6 +154,20 @@ TEST_F(ClusterStateControllerTest, TestNewTreeHead) {
 }
 
 
+TEST_F(ClusterStateControllerTest, TestFetchesNewEntriesFromPeers) {
+  store2_->SetClusterNodeState(cns100_);
+  sleep(1);
+
+  // The database is empty, so a peer announcing a bigger tree head is
+  // fetched from straight away.
+  EXPECT_CALL(fetcher_, FetchNow()).Times(1);
+  ct::ClusterNodeState cns(cns100_);
+  cns.mutable_newest_sth()->CopyFrom(sth200_);
+  store2_->SetClusterNodeState(cns);
+  sleep(1);
+}
+
+
 TEST_F(ClusterStateControllerTest, TestCalculateServingSTHAt50Percent) {
   NiceMock<MockMasterElection> election_is_master;
   EXPECT_CALL(election_is_master, IsMaster()).WillRepeatedly(Return(true));
@@ -521,13 +536,15 @@ TEST_F(ClusterStateControllerTest, TestNodeHostPort) {
   // to update
   const string kHost("myhostname");
   const int kPort(9999);
+  const string kPathPrefix("/logs/2024h1");
 
-  controller_.SetNodeHostPort(kHost, kPort);
+  controller_.SetNodeHostPort(kHost, kPort, kPathPrefix);
   sleep(1);
 
   const ClusterNodeState node_state(GetNodeStateView(kNodeId1));
   EXPECT_EQ(kHost, node_state.hostname());
   EXPECT_EQ(kPort, node_state.log_port());
+  EXPECT_EQ(kPathPrefix, node_state.log_path_prefix());
 }
 
 
@@ -635,9 +652,10 @@ TEST_F(ClusterStateControllerTest, TestGetFreshNodes) {
   store3_->SetClusterNodeState(cns300_);
 
   {
-    vector<ClusterNodeState> fresh(controller_.GetFreshNodes());
+    const shared_ptr<const vector<ClusterNodeState>> fresh(
+        controller_.GetFreshNodes());
     EXPECT_EQ(static_cast<size_t>(0),
-              fresh.size());  // no STH yet - everyone is stale.
+              fresh->size());  // no STH yet - everyone is stale.
   }
 
   // The 3 nodes have states which claim to have 100, 200, and 300 certs in
@@ -661,7 +679,7 @@ TEST_F(ClusterStateControllerTest, TestGetFreshNodes) {
     sleep(1);
 
     vector<string> ids;
-    for (const auto& n : controller_.GetFreshNodes()) {
+    for (const auto& n : *controller_.GetFreshNodes()) {
       ids.push_back(n.node_id());
     }
     EXPECT_EQ(ids, kExpectedFreshNodes[i]);
@@ -4,12 +4,113 @@
 #include "util/cms_scoped_types.h"
 #include "util/openssl_scoped_types.h"
 
+using std::lock_guard;
+using std::mutex;
 using std::string;
 using std::unique_ptr;
 using util::Status;
 using util::StatusOr;
 
 namespace cert_trans {
+namespace {
+
+
+// Enough for the few certificates a log accepts CMS objects from.
+const size_t kMaxSigners = 64;
+
+// Must set CMS_NOINTERN as the RFC says certs SHOULD be omitted from the
+// message but the client might not have obeyed this. CMS_BINARY is required
+// to avoid MIME-related translation. CMS_NO_SIGNER_CERT_VERIFY because we
+// will do our own checks that the chain is valid and the message may not
+// be signed directly by a trusted cert. We don't check it's a signed data
+// object CMS type as OpenSSL does this.
+const unsigned int kVerifyFlags =
+    CMS_NO_SIGNER_CERT_VERIFY | CMS_NOINTERN | CMS_BINARY;
+
+
+// Parses a DER CMS object without going through a BIO.
+ScopedCMS_ContentInfo ParseCms(const string& cms_object) {
+  const unsigned char* der(
+      reinterpret_cast<const unsigned char*>(cms_object.data()));
+  ScopedCMS_ContentInfo cms_content_info(
+      d2i_CMS_ContentInfo(nullptr, &der, cms_object.size()));
+  if (!cms_content_info) {
+    LOG(ERROR) << "Could not parse CMS data";
+    LOG_OPENSSL_ERRORS(WARNING);
+  }
+  return cms_content_info;
+}
+
+
+void CheckContentType(CMS_ContentInfo* cms_content_info) {
+  const ASN1_OBJECT* message_content_type(
+      CMS_get0_eContentType(cms_content_info));
+  const int content_type_nid = OBJ_obj2nid(message_content_type);
+  // TODO: Enforce content type here. This is not yet defined in the RFC.
+  if (content_type_nid != NID_ctV2CmsPayloadContentType) {
+    LOG(WARNING) << "CMS message content has unexpected type: "
+                 << content_type_nid;
+  }
+}
+
+
+}  // namespace
+
+
+X509* CmsVerifier::SignerCert(const Cert& cert) const {
+  string digest;
+  if (!cert.Sha256Digest(&digest).ok()) {
+    return nullptr;
+  }
+
+  lock_guard<mutex> lock(mutex_);
+  const auto it(signers_.find(digest));
+  if (it != signers_.end()) {
+    return it->second.get();
+  }
+  if (signers_.size() >= kMaxSigners) {
+    return cert.x509_.get();
+  }
+
+  ScopedX509 signer(X509_dup(cert.x509_.get()));
+  if (!signer) {
+    LOG_OPENSSL_ERRORS(WARNING);
+    return cert.x509_.get();
+  }
+  // The key is decoded on first use, and kept in the certificate.
+  ScopedEVP_PKEY key(X509_get_pubkey(signer.get()));
+  if (!key) {
+    LOG_OPENSSL_ERRORS(WARNING);
+    return cert.x509_.get();
+  }
+  X509* const ret(signer.get());
+  signers_.emplace(digest, std::move(signer));
+  return ret;
+}
+
+
+Status CmsVerifier::VerifyCms(CMS_ContentInfo* cms_content_info,
+                              const Cert& cert, BIO* cms_bio_out) const {
+  X509* const signer(SignerCert(cert));
+  if (!signer) {
+    return Status(util::error::INTERNAL, "Cert could not be digested");
+  }
+
+  // Create a certificate stack from our expected signing cert that can be
+  // used by CMS_verify.
+  ScopedWeakX509Stack validation_chain(sk_X509_new(nullptr));
+  sk_X509_push(validation_chain.get(), signer);
+
+  const int verified =
+      CMS_verify(cms_content_info, validation_chain.get(), nullptr, nullptr,
+                 cms_bio_out, kVerifyFlags);
+
+  return (verified == 1) ? util::Status::OK
+                         : util::Status(util::error::INVALID_ARGUMENT,
+                                        "CMS verification failed");
+}
+
+
 util::StatusOr<bool> CmsVerifier::IsCmsSignedByCert(BIO* cms_bio_in,
                                                     const Cert& cert) const {
   CHECK_NOTNULL(cms_bio_in);
@@ -54,39 +155,16 @@ StatusOr<bool> CmsVerifier::IsCmsSignedByCert(const string& cms_object,
     return Status(util::error::FAILED_PRECONDITION, "Cert not loaded");
   }
 
-  // Load a source bio with the CMS signed data object and parse it
-  ScopedBIO source_bio(BIO_new(BIO_s_mem()));
-  BIO_write(source_bio.get(), cms_object.c_str(), cms_object.length());
-
-  ScopedCMS_ContentInfo cms_content_info(
-      d2i_CMS_bio(source_bio.get(), nullptr));
+  ScopedCMS_ContentInfo cms_content_info(ParseCms(cms_object));
 
   if (!cms_content_info) {
-    LOG(ERROR) << "Could not parse CMS data";
-    LOG_OPENSSL_ERRORS(WARNING);
     return Status(util::error::INVALID_ARGUMENT,
                   "CMS data could not be parsed");
   }
 
   // Now that we've got the CMS unpacked check it has a valid signature using
-  // the same key as the cert. First create a certificate stack from our
-  // expected signing cert that can be used by CMS_verify.
-  ScopedWeakX509Stack validation_chain(sk_X509_new(nullptr));
-
-  sk_X509_push(validation_chain.get(), cert->x509_.get());
-
-  // Must set CMS_NOINTERN as the RFC says certs SHOULD be omitted from the
-  // message but the client might not have obeyed this. CMS_BINARY is required
-  // to avoid MIME-related translation. CMS_NO_SIGNER_CERT_VERIFY because we
-  // will do our own checks that the chain is valid and the message may not
-  // be signed directly by a trusted cert. We don't check it's a signed data
-  // object CMS type as OpenSSL does this.
-  const int verified =
-      CMS_verify(cms_content_info.get(), validation_chain.get(), nullptr,
-                 nullptr, nullptr,
-                 CMS_NO_SIGNER_CERT_VERIFY | CMS_NOINTERN | CMS_BINARY);
-
-  if (verified != 1) {
+  // the same key as the cert.
+  if (!VerifyCms(cms_content_info.get(), *cert, nullptr).ok()) {
     // Most likely, was not CMS signed by the precert
     return false;
   }
@@ -127,35 +205,9 @@ util::Status CmsVerifier::UnpackCmsDerBio(BIO* cms_bio_in, const Cert& cert,
                   "CMS data could not be parsed");
   }
 
-  const ASN1_OBJECT* message_content_type(
-      CMS_get0_eContentType(cms_content_info.get()));
-  int content_type_nid = OBJ_obj2nid(message_content_type);
-  // TODO: Enforce content type here. This is not yet defined in the RFC.
-  if (content_type_nid != NID_ctV2CmsPayloadContentType) {
-    LOG(WARNING) << "CMS message content has unexpected type: "
-                 << content_type_nid;
-  }
-
-  // Create a certificate stack from our expected signing cert that can be used
-  // by CMS_verify.
-  ScopedWeakX509Stack validation_chain(sk_X509_new(nullptr));
-
-  sk_X509_push(validation_chain.get(), cert.x509_.get());
-
-  // Must set CMS_NOINTERN as the RFC says certs SHOULD be omitted from the
-  // message but the client might not have obeyed this. CMS_BINARY is required
-  // to avoid MIME-related translation. CMS_NO_SIGNER_CERT_VERIFY because we
-  // will do our own checks that the chain is valid and the message may not
-  // be signed directly by a trusted cert. We don't check it's a signed data
-  // object CMS type as OpenSSL does this.
-  int verified =
-      CMS_verify(cms_content_info.get(), validation_chain.get(), nullptr,
-                 nullptr, cms_bio_out,
-                 CMS_NO_SIGNER_CERT_VERIFY | CMS_NOINTERN | CMS_BINARY);
+  CheckContentType(cms_content_info.get());
 
-  return (verified == 1) ? util::Status::OK
-                         : util::Status(util::error::INVALID_ARGUMENT,
-                                        "CMS verification failed");
+  return VerifyCms(cms_content_info.get(), cert, cms_bio_out);
 }
 
 
@@ -172,27 +224,13 @@ util::Status CmsVerifier::UnpackCmsDerBio(BIO* cms_bio_in, BIO* cms_bio_out) {
                   "CMS data could not be parsed");
   }
 
-  const ASN1_OBJECT* message_content_type(
-      CMS_get0_eContentType(cms_content_info.get()));
-  const int content_type_nid = OBJ_obj2nid(message_content_type);
-  // TODO: Enforce content type here. This is not yet defined in the RFC.
-  if (content_type_nid != NID_ctV2CmsPayloadContentType) {
-    LOG(WARNING) << "CMS message content has unexpected type: "
-                 << content_type_nid;
-  }
+  CheckContentType(cms_content_info.get());
 
-  // Must set CMS_NOINTERN as the RFC says certs SHOULD be omitted from the
-  // message but the client might not have obeyed this. CMS_BINARY is required
-  // to avoid MIME-related translation. CMS_NO_SIGNER_CERT_VERIFY because we
-  // will do our own checks that the chain is valid and the message may not
-  // be signed directly by a trusted cert. CMS_NO_CONTENT_VERIFY because we
-  // can't apply the RFC mandated signature checks until we have the unpacked
-  // cert to examine. We don't check it's a signed data object CMS type as
-  // OpenSSL does this.
+  // CMS_NO_CONTENT_VERIFY because we can't apply the RFC mandated signature
+  // checks until we have the unpacked cert to examine.
   const int verified =
       CMS_verify(cms_content_info.get(), nullptr, nullptr, nullptr,
-                 cms_bio_out, CMS_NO_SIGNER_CERT_VERIFY | CMS_NOINTERN |
-                                  CMS_BINARY | CMS_NO_CONTENT_VERIFY);
+                 cms_bio_out, kVerifyFlags | CMS_NO_CONTENT_VERIFY);
 
   return (verified == 1) ? util::Status::OK
                          : util::Status(util::error::INVALID_ARGUMENT,
@@ -246,4 +284,37 @@ Cert* CmsVerifier::UnpackCmsSignedCertificate(const string& cms_object) {
   return cert.release();
 }
 
+Cert* CmsVerifier::UnpackCmsSignedCertificate(const string& cms_object,
+                                              const Cert& verify_cert) {
+  unique_ptr<Cert> cert(new Cert);
+
+  if (!verify_cert.IsLoaded()) {
+    LOG(ERROR) << "Cert for CMS verify not loaded";
+    return cert.release();
+  }
+
+  ScopedCMS_ContentInfo cms_content_info(ParseCms(cms_object));
+  if (!cms_content_info) {
+    return cert.release();
+  }
+  CheckContentType(cms_content_info.get());
+
+  ScopedBIO unpacked_bio(BIO_new(BIO_s_mem()));
+  if (VerifyCms(cms_content_info.get(), verify_cert, unpacked_bio.get())
+          .ok()) {
+    // The unpacked data should be a valid DER certificate.
+    // TODO: The RFC does not yet define this as the format so this may
+    // need to change.
+    const Status status = cert->LoadFromDerBio(unpacked_bio.get());
+
+    if (!status.ok()) {
+      LOG(WARNING) << "Could not unpack cert from CMS DER encoded data";
+    }
+  } else {
+    LOG_OPENSSL_ERRORS(ERROR);
+  }
+
+  return cert.release();
+}
+
 }  // namespace cert_trans
@@ -5,7 +5,10 @@
 #include <openssl/asn1.h>
 #include <openssl/bio.h>
 #include <openssl/cms.h>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
 
 #include "base/macros.h"
 #include "log/cert.h"
@@ -53,7 +56,25 @@ class CmsVerifier {
   virtual Cert* UnpackCmsSignedCertificate(BIO* cms_bio_in,
                                            const Cert& verify_cert);
 
+  // As above, but parses the CMS object straight from memory, checking
+  // the signature and unpacking the certificate in the same pass, rather
+  // than calling IsCmsSignedByCert() and UnpackCmsSignedCertificate().
+  virtual Cert* UnpackCmsSignedCertificate(const std::string& cms_object,
+                                           const Cert& verify_cert);
+
  private:
+  // Returns the copy of |cert| that is kept for verifying the signatures
+  // it makes, its public key already decoded, so that the many objects
+  // signed by the same certificate only pay for that once. The copies
+  // stay until the verifier is destroyed, and past kMaxSigners |cert|
+  // itself is used. Returns NULL if |cert| cannot be digested.
+  X509* SignerCert(const Cert& cert) const;
+
+  // Verifies |cms_content_info| as signed by |cert|, writing its content
+  // to |cms_bio_out| unless that is NULL.
+  util::Status VerifyCms(CMS_ContentInfo* cms_content_info, const Cert& cert,
+                         BIO* cms_bio_out) const;
+
   // Verifies that data from a DER BIO is signed by a given certificate.
   // and writes the unwrapped content to another BIO. NULL can be passed for
   // cms_bio_out if the caller just wishes to verify the signature. Does
@@ -68,6 +89,10 @@ class CmsVerifier {
   // apply any additional checks necessary.
   util::Status UnpackCmsDerBio(BIO* cms_bio_in, BIO* cms_bio_out);
 
+  mutable std::mutex mutex_;
+  // Keyed by the SHA-256 digest of the certificate.
+  mutable std::map<std::string, ScopedX509> signers_;
+
   DISALLOW_COPY_AND_ASSIGN(CmsVerifier);
 };
 
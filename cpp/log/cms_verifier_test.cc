@@ -203,6 +203,39 @@ TEST_F(CmsVerifierTest, CmsVerifyTestCase8) {
   ASSERT_FALSE(unpacked_cert->IsLoaded());
 }
 
+
+TEST_F(CmsVerifierTest, CmsVerifyAndUnpackInOnePass) {
+  string cms_object;
+  ASSERT_TRUE(util::ReadBinaryFile(cert_dir_v2_ + kCmsSignedDataTest5,
+                                   &cms_object));
+
+  // Twice, with distinct copies of the signer, which are then verified
+  // against the same cached one.
+  for (int i = 0; i < 2; ++i) {
+    Cert cert(intermediate_pem_);
+    ASSERT_TRUE(cert.IsLoaded());
+    EXPECT_TRUE(verifier_.IsCmsSignedByCert(cms_object, &cert).ValueOrDie());
+
+    unique_ptr<Cert> unpacked_cert(
+        verifier_.UnpackCmsSignedCertificate(cms_object, cert));
+    ASSERT_TRUE(unpacked_cert->IsLoaded());
+    ASSERT_OK(unpacked_cert->IsValidWildcardRedaction());
+    ASSERT_EQ(kCmsTestSubject, unpacked_cert->PrintSubjectName());
+  }
+
+  // Not signed by the CA, nor by the leaf.
+  Cert ca(ca_pem_);
+  unique_ptr<Cert> unpacked_cert(
+      verifier_.UnpackCmsSignedCertificate(cms_object, ca));
+  EXPECT_FALSE(unpacked_cert->IsLoaded());
+  Cert leaf(leaf_pem_);
+  unpacked_cert.reset(verifier_.UnpackCmsSignedCertificate(cms_object, leaf));
+  EXPECT_FALSE(unpacked_cert->IsLoaded());
+
+  unpacked_cert.reset(verifier_.UnpackCmsSignedCertificate("bogus", ca));
+  EXPECT_FALSE(unpacked_cert->IsLoaded());
+}
+
 }  // namespace
 
 
@@ -125,17 +125,46 @@ class ConsistentStore {
 
   virtual util::Status AddPendingEntry(Logged* entry) = 0;
 
+  // Like AddPendingEntry() for each of |entries|, setting the
+  // corresponding element of |statuses|. Implementations may write them
+  // concurrently, the default one adds them one at a time.
+  virtual void AddPendingEntries(const std::vector<Logged*>& entries,
+                                 std::vector<util::Status>* statuses) {
+    statuses->clear();
+    for (Logged* entry : entries) {
+      statuses->push_back(AddPendingEntry(entry));
+    }
+  }
+
+  // Like AddPendingEntries(), but rather than blocking the caller,
+  // returns |task| once |statuses| is set. |entries| and |statuses| must
+  // remain valid until then. The default implementation runs
+  // AddPendingEntries() on the executor of |task|, which blocks one of
+  // its threads meanwhile.
+  virtual void AddPendingEntriesAsync(const std::vector<Logged*>& entries,
+                                      std::vector<util::Status>* statuses,
+                                      util::Task* task) {
+    task->executor()->Add([this, entries, statuses, task]() {
+      AddPendingEntries(entries, statuses);
+      task->Return();
+    });
+  }
+
   virtual util::Status GetPendingEntryForHash(
       const std::string& hash, EntryHandle<Logged>* entry) const = 0;
 
   virtual util::Status GetPendingEntries(
       std::vector<EntryHandle<Logged>>* entries) const = 0;
 
+  // Returns all the sequence mappings, ordered by sequence number.
   virtual util::Status GetSequenceMapping(
       EntryHandle<ct::SequenceMapping>* entry) const = 0;
 
-  virtual util::Status UpdateSequenceMapping(
-      EntryHandle<ct::SequenceMapping>* entry) = 0;
+  // Appends |mappings|, which must have consecutive sequence numbers
+  // following those already mapped. Mappings are only removed by
+  // CleanupOldEntries().
+  virtual util::Status AddSequenceMappings(
+      const ct::SequenceMapping& mappings) = 0;
 
   virtual util::StatusOr<ct::ClusterNodeState> GetClusterNodeState() const = 0;
 
@@ -1,30 +1,234 @@
 #include "log/database.h"
 
+#include <gflags/gflags.h>
+#include <utility>
+
+#include "util/thread_pool.h"
+
+DEFINE_int32(database_io_threads, 4,
+             "number of threads which carry out the asynchronous database "
+             "reads, such as those of get-entry-and-proof, so that the "
+             "threads serving requests do not wait on the disk");
+DEFINE_bool(database_async_sth_notifications, false,
+            "Run the database callbacks for new tree heads (e.g. the "
+            "update of the in-memory Merkle tree) on a thread of their own, "
+            "rather than in the writer of each tree head. Only the newest "
+            "tree head is delivered when several are written while the "
+            "callbacks run.");
+
 namespace cert_trans {
+namespace {
+
+
+// Stops a ScanEntries() iterator after the end of a range.
+class RangeIterator : public ReadOnlyDatabase::Iterator {
+ public:
+  RangeIterator(std::unique_ptr<ReadOnlyDatabase::Iterator> it, int64_t end)
+      : it_(std::move(it)), end_(end), done_(false) {
+  }
+
+  bool GetNextEntry(LoggedEntry* entry) override {
+    if (done_ || !it_->GetNextEntry(entry) ||
+        entry->sequence_number() > end_) {
+      done_ = true;
+      return false;
+    }
+    return true;
+  }
+
+  void SetFields(int fields) override {
+    it_->SetFields(fields);
+  }
+
+ private:
+  const std::unique_ptr<ReadOnlyDatabase::Iterator> it_;
+  const int64_t end_;
+  bool done_;
+};
+
+
+// The pool of the default asynchronous reads, shared by all the
+// databases, and never destroyed, as databases may be.
+ThreadPool* IoPool() {
+  static ThreadPool* const pool(
+      new ThreadPool("database_io", FLAGS_database_io_threads));
+  return pool;
+}
+
+
+}  // namespace
+
+
+void ReadOnlyDatabase::LookupByIndexAsync(
+    const std::vector<int64_t>& sequence_numbers,
+    std::vector<LoggedEntry>* results, util::Task* task) const {
+  CHECK_NOTNULL(results);
+  CHECK_NOTNULL(task);
+  IoPool()->Add([this, sequence_numbers, results, task]() {
+    if (task->CancelRequested()) {
+      task->Return(util::Status::CANCELLED);
+      return;
+    }
+    results->resize(sequence_numbers.size());
+    for (size_t i = 0; i < sequence_numbers.size(); ++i) {
+      if (LookupByIndex(sequence_numbers[i], &(*results)[i]) != LOOKUP_OK) {
+        task->Return(util::Status(util::error::NOT_FOUND,
+                                  "no entry " +
+                                      std::to_string(sequence_numbers[i])));
+        return;
+      }
+    }
+    task->Return();
+  });
+}
+
+
+void ReadOnlyDatabase::ScanRangeAsync(int64_t start, int64_t end,
+                                      std::vector<LoggedEntry>* entries,
+                                      util::Task* task) const {
+  CHECK_NOTNULL(entries);
+  CHECK_NOTNULL(task);
+  IoPool()->Add([this, start, end, entries, task]() {
+    if (task->CancelRequested()) {
+      task->Return(util::Status::CANCELLED);
+      return;
+    }
+    entries->clear();
+    const std::unique_ptr<Iterator> it(ScanRange(start, end));
+    entries->emplace_back();
+    while (it->GetNextEntry(&entries->back())) {
+      entries->emplace_back();
+    }
+    entries->pop_back();
+    task->Return();
+  });
+}
+
+
+std::unique_ptr<ReadOnlyDatabase::Iterator> ReadOnlyDatabase::ScanRange(
+    int64_t start, int64_t end) const {
+  return std::unique_ptr<Iterator>(new RangeIterator(ScanEntries(start), end));
+}
+
+
+bool ReadOnlyDatabase::LookupJsonEntries(int64_t, int64_t,
+                                         std::vector<JsonEntry>*) const {
+  return false;
+}
+
+
+std::vector<ct::SignedTreeHead> ReadOnlyDatabase::ScanTreeHeads() const {
+  std::vector<ct::SignedTreeHead> sths(1);
+  if (LatestTreeHead(&sths.back()) != LOOKUP_OK) {
+    sths.clear();
+  }
+  return sths;
+}
+
+
+Database::WriteResult Database::CreateSequencedEntries_(
+    const std::vector<LoggedEntry>& logged, size_t* num_created) {
+  for (*num_created = 0; *num_created < logged.size(); ++*num_created) {
+    const WriteResult result(CreateSequencedEntry_(logged[*num_created]));
+    if (result != OK) {
+      return result;
+    }
+  }
+  return OK;
+}
+
+
+DatabaseNotifierHelper::DatabaseNotifierHelper()
+    : DatabaseNotifierHelper(FLAGS_database_async_sth_notifications) {
+}
+
+
+DatabaseNotifierHelper::DatabaseNotifierHelper(bool asynchronous)
+    : running_(nullptr), stopping_(false) {
+  if (asynchronous) {
+    delivery_thread_.reset(
+        new std::thread(&DatabaseNotifierHelper::DeliverPending, this));
+  }
+}
 
 
 DatabaseNotifierHelper::~DatabaseNotifierHelper() {
-  CHECK(callbacks_.empty());
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    CHECK(callbacks_.empty());
+    stopping_ = true;
+  }
+  cond_.notify_all();
+  if (delivery_thread_) {
+    delivery_thread_->join();
+  }
 }
 
 
 void DatabaseNotifierHelper::Add(const NotifySTHCallback* callback) {
+  std::lock_guard<std::mutex> lock(lock_);
   CHECK(callbacks_.insert(callback).second);
 }
 
 
 void DatabaseNotifierHelper::Remove(const NotifySTHCallback* callback) {
+  std::unique_lock<std::mutex> lock(lock_);
   Map::iterator it(callbacks_.find(callback));
   CHECK(it != callbacks_.end());
 
   callbacks_.erase(it);
+  if (delivery_thread_) {
+    CHECK(std::this_thread::get_id() != delivery_thread_->get_id())
+        << "A callback cannot be removed from a callback";
+    cond_.wait(lock, [this, callback]() { return running_ != callback; });
+  }
+}
+
+
+void DatabaseNotifierHelper::Call(const ct::SignedTreeHead& sth) {
+  std::unique_lock<std::mutex> lock(lock_);
+  if (!delivery_thread_) {
+    // Writers may call concurrently, and the callbacks may add or remove
+    // callbacks, so they run without the lock.
+    const std::vector<const NotifySTHCallback*> callbacks(callbacks_.begin(),
+                                                          callbacks_.end());
+    lock.unlock();
+    for (const NotifySTHCallback* callback : callbacks) {
+      (*callback)(sth);
+    }
+    return;
+  }
+
+  if (!pending_ || pending_->timestamp() < sth.timestamp()) {
+    pending_.reset(new ct::SignedTreeHead(sth));
+  }
+  lock.unlock();
+  cond_.notify_all();
 }
 
 
-void DatabaseNotifierHelper::Call(const ct::SignedTreeHead& sth) const {
-  for (Map::const_iterator it = callbacks_.begin(); it != callbacks_.end();
-       ++it) {
-    (**it)(sth);
+void DatabaseNotifierHelper::DeliverPending() {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    cond_.wait(lock, [this]() { return pending_ || stopping_; });
+    if (stopping_) {
+      return;
+    }
+    const std::unique_ptr<ct::SignedTreeHead> sth(std::move(pending_));
+    const std::vector<const NotifySTHCallback*> callbacks(callbacks_.begin(),
+                                                          callbacks_.end());
+    for (const NotifySTHCallback* callback : callbacks) {
+      // It may have been removed while the ones before it were running.
+      if (callbacks_.count(callback) == 0) {
+        continue;
+      }
+      running_ = callback;
+      lock.unlock();
+      (*callback)(*sth);
+      lock.lock();
+      running_ = nullptr;
+      cond_.notify_all();
+    }
   }
 }
 
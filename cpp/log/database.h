@@ -4,13 +4,18 @@
 
 #include <glog/logging.h>
 #include <stdint.h>
+#include <condition_variable>
 #include <functional>
 #include <memory>
+#include <mutex>
 #include <set>
+#include <thread>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/logged_entry.h"
 #include "proto/ct.pb.h"
+#include "util/task.h"
 
 namespace cert_trans {
 
@@ -42,13 +47,56 @@ class ReadOnlyDatabase {
     virtual ~Iterator() = default;
 
     // If there is an entry available, fill *entry and return true,
-    // otherwise return false.
+    // otherwise return false. Whatever was in *entry is replaced, but
+    // the memory of its fields is kept and reused (as by
+    // Message::Clear()), so reading many entries into the same one
+    // allocates little once it has held a large one.
     virtual bool GetNextEntry(LoggedEntry* entry) = 0;
 
+    // Makes the following calls to GetNextEntry() only parse |fields| (a
+    // mask of LoggedEntry::ParseFields) of the entries, so that scans
+    // which need little of each entry, such as its hash, skip over the
+    // certificate chains. The other fields may be left unset, or not.
+    virtual void SetFields(int fields) {
+      fields_ = fields;
+    }
+
+   protected:
+    int fields() const {
+      return fields_;
+    }
+
    private:
+    int fields_ = LoggedEntry::PARSE_ALL;
+
     DISALLOW_COPY_AND_ASSIGN(Iterator);
   };
 
+  class LeafHashIterator {
+   public:
+    LeafHashIterator() = default;
+    virtual ~LeafHashIterator() = default;
+
+    // If there is an entry available, fill *sequence_number and
+    // *leaf_hash with its sequence number and Merkle leaf hash (see
+    // LoggedEntry::MerkleLeafHash()) and return true, otherwise return
+    // false.
+    virtual bool GetNextLeafHash(int64_t* sequence_number,
+                                 std::string* leaf_hash) = 0;
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(LeafHashIterator);
+  };
+
+  // The JSON object of an entry in get-entries responses, i.e.
+  // {"leaf_input":"<base64>","extra_data":"<base64>"}, rendered when it
+  // was sequenced. |data| stays valid for as long as |holder| is.
+  struct JsonEntry {
+    const char* data;
+    size_t size;
+    std::shared_ptr<const void> holder;
+  };
+
   virtual ~ReadOnlyDatabase() = default;
 
   // Look up by hash. If the entry exists write the result. If the
@@ -60,12 +108,57 @@ class ReadOnlyDatabase {
   virtual LookupResult LookupByIndex(int64_t sequence_number,
                                      LoggedEntry* result) const = 0;
 
+  // Asynchronous versions of LookupByIndex() and ScanRange(), for the
+  // callers which must not block on the disk, such as the HTTP handlers.
+  // They return through |task|, possibly on another thread. The default
+  // implementations make the synchronous calls on a pool of threads
+  // shared by all the databases (see --database_io_threads), where many
+  // reads can be queued at once.
+  //
+  // Looks up the entries with |sequence_numbers| into |*results|, in the
+  // same order, and returns NOT_FOUND if any of them is missing.
+  virtual void LookupByIndexAsync(const std::vector<int64_t>& sequence_numbers,
+                                  std::vector<LoggedEntry>* results,
+                                  util::Task* task) const;
+  // Reads the entries from |start| to |end| inclusive into |*entries|,
+  // stopping before the first one that does not exist, like ScanRange().
+  virtual void ScanRangeAsync(int64_t start, int64_t end,
+                              std::vector<LoggedEntry>* entries,
+                              util::Task* task) const;
+
   // Return the tree head with the freshest timestamp.
   virtual LookupResult LatestTreeHead(ct::SignedTreeHead* result) const = 0;
 
+  // Return all the tree heads, in order of timestamp. The default
+  // implementation only returns the latest one, for databases that keep
+  // no others.
+  virtual std::vector<ct::SignedTreeHead> ScanTreeHeads() const;
+
   // Scan the entries, starting with the given index.
   virtual std::unique_ptr<Iterator> ScanEntries(int64_t start_index) const = 0;
 
+  // Scan the entries from |start| to |end| inclusive, like
+  // ScanEntries(start) but stopping after |end|, so that the database can
+  // read the whole range at once rather than guess how far the scan goes.
+  // The default implementation wraps ScanEntries().
+  virtual std::unique_ptr<Iterator> ScanRange(int64_t start,
+                                              int64_t end) const;
+
+  // Scan the Merkle leaf hashes of the entries, in the same order as
+  // ScanEntries(). The hashes are stored along with the entries, so this
+  // is much cheaper than reading the entries themselves.
+  virtual std::unique_ptr<LeafHashIterator> ScanLeafHashes(
+      int64_t start_index) const = 0;
+
+  // Look up the JSON objects of the consecutive entries from |start| to
+  // |end| inclusive, stopping before the first one that does not exist.
+  // Return false if the database does not have them for some of these
+  // entries, which must then be rendered from ScanEntries() instead, and
+  // |entries| is left unchanged. The default implementation always
+  // returns false.
+  virtual bool LookupJsonEntries(int64_t start, int64_t end,
+                                 std::vector<JsonEntry>* entries) const;
+
   // Return the number of entries of contiguous entries (what could be
   // put in a signed tree head). This can be greater than the tree
   // size returned by LatestTreeHead.
@@ -121,6 +214,29 @@ class Database : public ReadOnlyDatabase {
     return CreateSequencedEntry_(logged);
   }
 
+  // Attempt to create several entries at once, as if by calling
+  // CreateSequencedEntry() on each of them in turn until one fails. This
+  // is much cheaper than creating them one at a time, as they are written
+  // together (e.g. in a single transaction).
+  //
+  // Returns the result for the first entry that failed, which is not
+  // written, nor are any entries after it, or OK. If |num_created| is not
+  // NULL, it is set to the number of entries before that, all of which are
+  // in the database.
+  WriteResult CreateSequencedEntries(const std::vector<LoggedEntry>& logged,
+                                     size_t* num_created) {
+    for (const LoggedEntry& entry : logged) {
+      CHECK(entry.has_sequence_number());
+      CHECK_GE(entry.sequence_number(), 0);
+    }
+    size_t created(0);
+    const WriteResult result(CreateSequencedEntries_(logged, &created));
+    if (num_created) {
+      *num_created = created;
+    }
+    return result;
+  }
+
   // Attempt to write a tree head. Fails only if a tree head with this
   // timestamp already exists (i.e., |timestamp| is primary key). Does
   // not check that the timestamp is newer than previous entries.
@@ -136,6 +252,10 @@ class Database : public ReadOnlyDatabase {
   // See the inline methods with similar names defined above for more
   // documentation.
   virtual WriteResult CreateSequencedEntry_(const LoggedEntry& logged) = 0;
+  // The default implementation calls CreateSequencedEntry_() for each
+  // entry.
+  virtual WriteResult CreateSequencedEntries_(
+      const std::vector<LoggedEntry>& logged, size_t* num_created);
   virtual WriteResult WriteTreeHead_(const ct::SignedTreeHead& sth) = 0;
 
  private:
@@ -143,21 +263,45 @@ class Database : public ReadOnlyDatabase {
 };
 
 
+// Keeps the callbacks of a database, and runs them on each new tree head.
+//
+// If it is asynchronous, Call() only queues the tree head, and returns
+// right away: the callbacks are run on a thread of its own, so that
+// writers do not wait for them (e.g. for a LogLookup to hash the new
+// entries). Only the newest tree head queued is delivered, so that the
+// callbacks skip those which were replaced while they were running. Once
+// Remove() returns, the callback is not running, and will not be run
+// again, so it cannot be called from a callback.
+//
+// Either way, the callbacks may also be run by the database when they
+// are added, which may be at the same time.
 class DatabaseNotifierHelper {
  public:
   typedef std::function<void(const ct::SignedTreeHead&)> NotifySTHCallback;
 
-  DatabaseNotifierHelper() = default;
+  // Asynchronous if --database_async_sth_notifications is set.
+  DatabaseNotifierHelper();
+  explicit DatabaseNotifierHelper(bool asynchronous);
   ~DatabaseNotifierHelper();
 
   void Add(const NotifySTHCallback* callback);
   void Remove(const NotifySTHCallback* callback);
-  void Call(const ct::SignedTreeHead& sth) const;
+  void Call(const ct::SignedTreeHead& sth);
 
  private:
   typedef std::set<const NotifySTHCallback*> Map;
 
+  void DeliverPending();
+
+  mutable std::mutex lock_;
+  std::condition_variable cond_;
   Map callbacks_;
+  // The callback being run by |delivery_thread_|, if any.
+  const NotifySTHCallback* running_;
+  // For asynchronous delivery, the newest tree head not delivered yet.
+  std::unique_ptr<ct::SignedTreeHead> pending_;
+  bool stopping_;
+  std::unique_ptr<std::thread> delivery_thread_;
 
   DISALLOW_COPY_AND_ASSIGN(DatabaseNotifierHelper);
 };
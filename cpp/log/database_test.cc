@@ -1,32 +1,70 @@
 /* -*- indent-tabs-mode: nil -*- */
+#include <gflags/gflags.h>
 #include <gtest/gtest.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <condition_variable>
+#include <mutex>
 #include <set>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include "log/database.h"
 #include "log/file_db.h"
 #include "log/file_storage.h"
+#include "log/hash_filtered_database.h"
 #include "log/leveldb_db.h"
 #include "log/logged_entry.h"
+#include "log/monitored_database.h"
+#include "log/segmented_file_db.h"
+#include "log/sharded_database.h"
 #include "log/sqlite_db.h"
 #include "log/test_db.h"
 #include "log/test_signer.h"
+#include "monitoring/metric.h"
+#include "monitoring/registry.h"
 #include "proto/cert_serializer.h"
+#include "util/sync_task.h"
 #include "util/testing.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 
+DECLARE_int32(file_db_index_checkpoint_interval);
+DECLARE_int32(leveldb_build_index_threads);
+DECLARE_bool(leveldb_dedup_chains);
+DECLARE_int32(leveldb_frozen_hash_index_entries);
+DECLARE_bool(leveldb_hash_index_on_disk);
+DECLARE_int32(leveldb_hash_index_cache_size);
+DECLARE_int32(segmented_file_db_entries_per_segment);
+DECLARE_bool(segmented_file_db_json_entries);
+DECLARE_int32(segmented_file_db_hot_segments);
+DECLARE_int32(segmented_file_db_cold_block_bytes);
+DECLARE_bool(sqlite_batch_into_transactions);
+
 // TODO(benl): Introduce a test |Logged| type.
 
 namespace {
 
 using cert_trans::Database;
+using cert_trans::DatabaseNotifierHelper;
 using cert_trans::FileDB;
+using cert_trans::HashFilteredDatabase;
 using cert_trans::LevelDB;
 using cert_trans::LoggedEntry;
+using cert_trans::Metric;
+using cert_trans::MonitoredDatabase;
+using cert_trans::Registry;
 using cert_trans::SQLiteDB;
+using cert_trans::SegmentedFileDB;
+using cert_trans::ShardedDatabase;
+using cert_trans::ThreadPool;
 using ct::SignedTreeHead;
 using std::string;
 using std::unique_ptr;
+using std::vector;
+using util::SyncTask;
 
 
 template <class T>
@@ -46,7 +84,8 @@ class DBTest : public ::testing::Test {
   TestSigner test_signer_;
 };
 
-typedef testing::Types<FileDB, SQLiteDB, LevelDB> Databases;
+typedef testing::Types<FileDB, SQLiteDB, LevelDB, SegmentedFileDB,
+                       MonitoredDatabase, HashFilteredDatabase> Databases;
 
 
 template <class T>
@@ -172,6 +211,58 @@ TYPED_TEST(DBTest, CreateSequencedDuplicateSequenceNumber) {
 }
 
 
+TYPED_TEST(DBTest, CreateSequencedEntries) {
+  std::vector<LoggedEntry> entries(5);
+  for (int i = 0; i < 5; ++i) {
+    this->test_signer_.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+  }
+  // Identical entries already in the database are fine.
+  EXPECT_EQ(Database::OK, this->db()->CreateSequencedEntry(entries[1]));
+
+  size_t num_created(0);
+  EXPECT_EQ(Database::OK,
+            this->db()->CreateSequencedEntries(entries, &num_created));
+  EXPECT_EQ(5U, num_created);
+  EXPECT_EQ(5, this->db()->TreeSize());
+  for (const LoggedEntry& entry : entries) {
+    LoggedEntry lookup_cert;
+    EXPECT_EQ(Database::LOOKUP_OK,
+              this->db()->LookupByHash(entry.Hash(), &lookup_cert));
+    TestSigner::TestEqualLoggedCerts(entry, lookup_cert);
+  }
+
+  // Writing stops at the first entry with a sequence number in use.
+  std::vector<LoggedEntry> more_entries(3);
+  for (int i = 0; i < 3; ++i) {
+    this->test_signer_.CreateUnique(&more_entries[i]);
+    more_entries[i].set_sequence_number(5 + i);
+  }
+  more_entries[1].set_sequence_number(2);
+  EXPECT_EQ(Database::SEQUENCE_NUMBER_ALREADY_IN_USE,
+            this->db()->CreateSequencedEntries(more_entries, &num_created));
+  EXPECT_EQ(1U, num_created);
+  EXPECT_EQ(6, this->db()->TreeSize());
+  LoggedEntry lookup_cert;
+  EXPECT_EQ(Database::LOOKUP_OK,
+            this->db()->LookupByHash(more_entries[0].Hash(), &lookup_cert));
+  EXPECT_EQ(Database::NOT_FOUND,
+            this->db()->LookupByHash(more_entries[2].Hash(), &lookup_cert));
+
+  // Including within the same batch.
+  more_entries.erase(more_entries.begin());
+  more_entries[0].set_sequence_number(6);
+  more_entries[1].set_sequence_number(6);
+  EXPECT_EQ(Database::SEQUENCE_NUMBER_ALREADY_IN_USE,
+            this->db()->CreateSequencedEntries(more_entries, &num_created));
+  EXPECT_EQ(1U, num_created);
+  EXPECT_EQ(7, this->db()->TreeSize());
+
+  EXPECT_EQ(Database::OK, this->db()->CreateSequencedEntries(
+                              std::vector<LoggedEntry>(), NULL));
+}
+
+
 TYPED_TEST(DBTest, TreeSize) {
   LoggedEntry logged_cert;
 
@@ -299,6 +390,31 @@ TYPED_TEST(DBTest, WriteTreeHeadOlderTimestamp) {
 }
 
 
+TYPED_TEST(DBTest, ScanTreeHeads) {
+  EXPECT_TRUE(this->db()->ScanTreeHeads().empty());
+
+  SignedTreeHead sth, sth2, sth3;
+  this->test_signer_.CreateUnique(&sth);
+  this->test_signer_.CreateUnique(&sth2);
+  this->test_signer_.CreateUnique(&sth3);
+  sth2.set_timestamp(sth.timestamp() - 1000);
+  sth3.set_timestamp(sth.timestamp() + 1000);
+  EXPECT_EQ(Database::OK, this->db()->WriteTreeHead(sth));
+  EXPECT_EQ(Database::OK, this->db()->WriteTreeHead(sth2));
+  EXPECT_EQ(Database::OK, this->db()->WriteTreeHead(sth3));
+
+  // All of them, oldest first, whichever order they were written in.
+  const std::vector<SignedTreeHead> sths(this->db()->ScanTreeHeads());
+  ASSERT_EQ(3U, sths.size());
+  TestSigner::TestEqualTreeHeads(sth2, sths[0]);
+  TestSigner::TestEqualTreeHeads(sth, sths[1]);
+  TestSigner::TestEqualTreeHeads(sth3, sths[2]);
+
+  unique_ptr<Database> db2(this->test_db_.SecondDB());
+  EXPECT_EQ(3U, db2->ScanTreeHeads().size());
+}
+
+
 TYPED_TEST(DBTest, Resume) {
   LoggedEntry logged_cert, logged_cert2, lookup_cert, lookup_cert2;
   const int64_t kSeq1(129);
@@ -428,6 +544,1225 @@ TYPED_TEST(DBTest, Iterator) {
 }
 
 
+TYPED_TEST(DBTest, IteratorParsesOnlyFields) {
+  LoggedEntry logged;
+  this->test_signer_.CreateUnique(&logged);
+  logged.set_sequence_number(0);
+  ASSERT_EQ(Database::OK, this->db()->CreateSequencedEntry(logged));
+
+  unique_ptr<Database::Iterator> it(this->db()->ScanRange(0, 0));
+  it->SetFields(LoggedEntry::PARSE_SCT | LoggedEntry::PARSE_LEAF);
+  LoggedEntry it_entry;
+  ASSERT_TRUE(it->GetNextEntry(&it_entry));
+  EXPECT_EQ(0, it_entry.sequence_number());
+  EXPECT_EQ(logged.Hash(), it_entry.Hash());
+  EXPECT_EQ(logged.MerkleLeafHash(), it_entry.MerkleLeafHash());
+  EXPECT_FALSE(it->GetNextEntry(&it_entry));
+
+  it = this->db()->ScanEntries(0);
+  ASSERT_TRUE(it->GetNextEntry(&it_entry));
+  TestSigner::TestEqualLoggedCerts(logged, it_entry);
+}
+
+
+TYPED_TEST(DBTest, AsyncReads) {
+  vector<LoggedEntry> logged(3);
+  for (int64_t i = 0; i < 3; ++i) {
+    this->test_signer_.CreateUnique(&logged[i]);
+    logged[i].set_sequence_number(i);
+    ASSERT_EQ(Database::OK, this->db()->CreateSequencedEntry(logged[i]));
+  }
+  ThreadPool pool(1);
+
+  vector<LoggedEntry> entries;
+  {
+    SyncTask task(&pool);
+    this->db()->LookupByIndexAsync({2, 0}, &entries, task.task());
+    task.Wait();
+    ASSERT_TRUE(task.status().ok()) << task.status();
+    ASSERT_EQ(2U, entries.size());
+    TestSigner::TestEqualLoggedCerts(logged[2], entries[0]);
+    TestSigner::TestEqualLoggedCerts(logged[0], entries[1]);
+  }
+  {
+    SyncTask task(&pool);
+    this->db()->LookupByIndexAsync({1, 3}, &entries, task.task());
+    task.Wait();
+    EXPECT_EQ(util::error::NOT_FOUND, task.status().CanonicalCode());
+  }
+  {
+    SyncTask task(&pool);
+    this->db()->ScanRangeAsync(1, 5, &entries, task.task());
+    task.Wait();
+    ASSERT_TRUE(task.status().ok()) << task.status();
+    ASSERT_EQ(2U, entries.size());
+    TestSigner::TestEqualLoggedCerts(logged[1], entries[0]);
+    TestSigner::TestEqualLoggedCerts(logged[2], entries[1]);
+  }
+}
+
+
+TYPED_TEST(DBTest, ScanRange) {
+  // Enough to take several batches in databases that read them.
+  const int kNumEntries(1000);
+  std::vector<LoggedEntry> entries(kNumEntries);
+  for (int i = 0; i < kNumEntries; ++i) {
+    this->test_signer_.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+  }
+  size_t num_created;
+  ASSERT_EQ(Database::OK,
+            this->db()->CreateSequencedEntries(entries, &num_created));
+
+  LoggedEntry it_cert;
+  unique_ptr<Database::Iterator> it(this->db()->ScanRange(0, kNumEntries));
+  for (int i = 0; i < kNumEntries; ++i) {
+    ASSERT_TRUE(it->GetNextEntry(&it_cert));
+    TestSigner::TestEqualLoggedCerts(entries[i], it_cert);
+  }
+  EXPECT_FALSE(it->GetNextEntry(&it_cert));
+
+  it = this->db()->ScanRange(10, 700);
+  for (int i = 10; i <= 700; ++i) {
+    ASSERT_TRUE(it->GetNextEntry(&it_cert));
+    TestSigner::TestEqualLoggedCerts(entries[i], it_cert);
+  }
+  EXPECT_FALSE(it->GetNextEntry(&it_cert));
+
+  it = this->db()->ScanRange(5, 5);
+  ASSERT_TRUE(it->GetNextEntry(&it_cert));
+  TestSigner::TestEqualLoggedCerts(entries[5], it_cert);
+  EXPECT_FALSE(it->GetNextEntry(&it_cert));
+
+  it = this->db()->ScanRange(kNumEntries, 2 * kNumEntries);
+  EXPECT_FALSE(it->GetNextEntry(&it_cert));
+}
+
+
+TYPED_TEST(DBTest, LeafHashIterator) {
+  LoggedEntry logged_cert1, logged_cert2;
+  const int64_t kSeq1(17);
+  const int64_t kSeq2(3);
+
+  this->test_signer_.CreateUnique(&logged_cert1);
+  logged_cert1.set_sequence_number(kSeq1);
+  ASSERT_EQ(Database::OK, this->db()->CreateSequencedEntry(logged_cert1));
+
+  this->test_signer_.CreateUnique(&logged_cert2);
+  logged_cert2.set_sequence_number(kSeq2);
+  ASSERT_EQ(Database::OK, this->db()->CreateSequencedEntry(logged_cert2));
+  // Writing the same entry again doesn't add another leaf hash.
+  ASSERT_EQ(Database::OK, this->db()->CreateSequencedEntry(logged_cert2));
+
+  // The leaf hashes are those the signer put in the tree.
+  EXPECT_EQ(logged_cert1.merkle_leaf_hash(), logged_cert1.MerkleLeafHash());
+
+  unique_ptr<Database::LeafHashIterator> it(this->db()->ScanLeafHashes(0));
+  int64_t seq;
+  string leaf_hash;
+  ASSERT_TRUE(it->GetNextLeafHash(&seq, &leaf_hash));
+  EXPECT_EQ(kSeq2, seq);
+  EXPECT_EQ(logged_cert2.MerkleLeafHash(), leaf_hash);
+
+  ASSERT_TRUE(it->GetNextLeafHash(&seq, &leaf_hash));
+  EXPECT_EQ(kSeq1, seq);
+  EXPECT_EQ(logged_cert1.MerkleLeafHash(), leaf_hash);
+
+  EXPECT_FALSE(it->GetNextLeafHash(&seq, &leaf_hash));
+
+  it = this->db()->ScanLeafHashes(kSeq2 + 1);
+  ASSERT_TRUE(it->GetNextLeafHash(&seq, &leaf_hash));
+  EXPECT_EQ(kSeq1, seq);
+  EXPECT_FALSE(it->GetNextLeafHash(&seq, &leaf_hash));
+}
+
+
+class LevelDBTest : public ::testing::Test {
+ protected:
+  LevelDBTest()
+      : dbfile_(tmp_.TmpStorageDir() + "/leveldb"),
+        saved_on_disk_(FLAGS_leveldb_hash_index_on_disk),
+        saved_cache_size_(FLAGS_leveldb_hash_index_cache_size),
+        saved_dedup_chains_(FLAGS_leveldb_dedup_chains),
+        saved_build_index_threads_(FLAGS_leveldb_build_index_threads),
+        saved_frozen_entries_(FLAGS_leveldb_frozen_hash_index_entries) {
+  }
+
+  ~LevelDBTest() {
+    FLAGS_leveldb_hash_index_on_disk = saved_on_disk_;
+    FLAGS_leveldb_hash_index_cache_size = saved_cache_size_;
+    FLAGS_leveldb_dedup_chains = saved_dedup_chains_;
+    FLAGS_leveldb_build_index_threads = saved_build_index_threads_;
+    FLAGS_leveldb_frozen_hash_index_entries = saved_frozen_entries_;
+  }
+
+  // Closes the database, if open, and reopens it with the hash index on
+  // disk or in memory.
+  void Reopen(bool on_disk) {
+    db_.reset();
+    FLAGS_leveldb_hash_index_on_disk = on_disk;
+    db_.reset(new LevelDB(dbfile_));
+  }
+
+  void AddEntries(int count) {
+    for (int i = 0; i < count; ++i) {
+      entries_.emplace_back();
+      test_signer_.CreateUnique(&entries_.back());
+      entries_.back().set_sequence_number(entries_.size() - 1);
+      ASSERT_EQ(Database::OK, db_->CreateSequencedEntry(entries_.back()));
+    }
+  }
+
+  void ExpectAllFound() {
+    EXPECT_EQ(static_cast<int64_t>(entries_.size()), db_->TreeSize());
+    for (const LoggedEntry& entry : entries_) {
+      LoggedEntry lookup;
+      ASSERT_EQ(Database::LOOKUP_OK, db_->LookupByHash(entry.Hash(), &lookup));
+      TestSigner::TestEqualLoggedCerts(entry, lookup);
+    }
+  }
+
+  TmpStorage tmp_;
+  const string dbfile_;
+  const bool saved_on_disk_;
+  const int saved_cache_size_;
+  const bool saved_dedup_chains_;
+  const int saved_build_index_threads_;
+  const int saved_frozen_entries_;
+  TestSigner test_signer_;
+  std::vector<LoggedEntry> entries_;
+  unique_ptr<LevelDB> db_;
+};
+
+
+TEST_F(LevelDBTest, OnDisk) {
+  Reopen(true);
+  AddEntries(20);
+  ExpectAllFound();
+
+  LoggedEntry missing, lookup;
+  test_signer_.CreateUnique(&missing);
+  EXPECT_EQ(Database::NOT_FOUND, db_->LookupByHash(missing.Hash(), &lookup));
+
+  Reopen(true);
+  ExpectAllFound();
+}
+
+
+TEST_F(LevelDBTest, OnDiskKeepsLowestSequenceNumber) {
+  Reopen(true);
+  LoggedEntry logged_cert, duplicate_cert, lookup_cert;
+  test_signer_.CreateUnique(&logged_cert);
+  logged_cert.set_sequence_number(7);
+  duplicate_cert.CopyFrom(logged_cert);
+  duplicate_cert.mutable_sct()->set_timestamp(logged_cert.sct().timestamp() +
+                                              1000);
+  duplicate_cert.set_sequence_number(3);
+
+  ASSERT_EQ(Database::OK, db_->CreateSequencedEntry(logged_cert));
+  // Cache the current entry for that hash.
+  ASSERT_EQ(Database::LOOKUP_OK,
+            db_->LookupByHash(logged_cert.Hash(), &lookup_cert));
+  EXPECT_EQ(7, lookup_cert.sequence_number());
+
+  ASSERT_EQ(Database::OK, db_->CreateSequencedEntry(duplicate_cert));
+  ASSERT_EQ(Database::LOOKUP_OK,
+            db_->LookupByHash(logged_cert.Hash(), &lookup_cert));
+  TestSigner::TestEqualLoggedCerts(duplicate_cert, lookup_cert);
+
+  Reopen(true);
+  ASSERT_EQ(Database::LOOKUP_OK,
+            db_->LookupByHash(logged_cert.Hash(), &lookup_cert));
+  EXPECT_EQ(3, lookup_cert.sequence_number());
+}
+
+
+TEST_F(LevelDBTest, SwitchBetweenMemoryAndDisk) {
+  Reopen(false);
+  AddEntries(10);
+  // The on-disk index is built on first use...
+  Reopen(true);
+  ExpectAllFound();
+  AddEntries(10);
+
+  // ...and rebuilt after being left behind by an in-memory index.
+  Reopen(false);
+  ExpectAllFound();
+  AddEntries(10);
+  Reopen(true);
+  ExpectAllFound();
+}
+
+
+TEST_F(LevelDBTest, ResumesFromContiguousSize) {
+  Reopen(true);
+  AddEntries(10);
+  // Leaves a gap at 10 and 11, which is not contiguous.
+  LoggedEntry sparse;
+  test_signer_.CreateUnique(&sparse);
+  sparse.set_sequence_number(12);
+  ASSERT_EQ(Database::OK, db_->CreateSequencedEntry(sparse));
+
+  Reopen(true);
+  EXPECT_EQ(10, db_->TreeSize());
+  AddEntries(2);
+  entries_.push_back(sparse);
+  ExpectAllFound();
+
+  Reopen(true);
+  ExpectAllFound();
+  AddEntries(5);
+  Reopen(true);
+  ExpectAllFound();
+
+  // Resuming is not done with the hash index in memory, which needs all
+  // the entries.
+  Reopen(false);
+  ExpectAllFound();
+  AddEntries(3);
+  Reopen(true);
+  ExpectAllFound();
+}
+
+
+TEST_F(LevelDBTest, BuildsIndexInParallel) {
+  FLAGS_leveldb_build_index_threads = 3;
+  Reopen(false);
+  AddEntries(10);
+  // Far apart, so that they are read by different threads, and in more
+  // than one round of them.
+  std::vector<LoggedEntry> sparse(4);
+  const int64_t sparse_seqs[] = {150000, 250001, 399999, 700000};
+  for (size_t i = 0; i < sparse.size(); ++i) {
+    test_signer_.CreateUnique(&sparse[i]);
+    sparse[i].set_sequence_number(sparse_seqs[i]);
+    ASSERT_EQ(Database::OK, db_->CreateSequencedEntry(sparse[i]));
+  }
+  // A duplicate of an entry read by another thread, in a later round.
+  LoggedEntry duplicate(sparse[0]);
+  duplicate.set_sequence_number(800000);
+  ASSERT_EQ(Database::OK, db_->CreateSequencedEntry(duplicate));
+
+  for (const bool on_disk : {false, true, true}) {
+    Reopen(on_disk);
+    ExpectAllFound();
+    for (const LoggedEntry& entry : sparse) {
+      LoggedEntry lookup;
+      ASSERT_EQ(Database::LOOKUP_OK, db_->LookupByHash(entry.Hash(), &lookup));
+      EXPECT_EQ(entry.sequence_number(), lookup.sequence_number());
+    }
+  }
+}
+
+
+TEST_F(LevelDBTest, FrozenHashIndex) {
+  FLAGS_leveldb_frozen_hash_index_entries = 8;
+  Reopen(false);
+  AddEntries(20);
+  ExpectAllFound();
+  EXPECT_NE(0, access((dbfile_ + "/frozen_hash_index-0").c_str(), F_OK));
+
+  // Freezes the first 16 entries...
+  Reopen(false);
+  ExpectAllFound();
+  EXPECT_EQ(0, access((dbfile_ + "/frozen_hash_index-8").c_str(), F_OK));
+  EXPECT_NE(0, access((dbfile_ + "/frozen_hash_index-16").c_str(), F_OK));
+  AddEntries(10);
+
+  // ...then reads only the entries after them, and freezes 8 more.
+  Reopen(false);
+  ExpectAllFound();
+  EXPECT_EQ(0, access((dbfile_ + "/frozen_hash_index-16").c_str(), F_OK));
+  LoggedEntry missing, lookup;
+  test_signer_.CreateUnique(&missing);
+  EXPECT_EQ(Database::NOT_FOUND, db_->LookupByHash(missing.Hash(), &lookup));
+
+  // The frozen indices are only used with the flag.
+  FLAGS_leveldb_frozen_hash_index_entries = 0;
+  Reopen(false);
+  ExpectAllFound();
+  FLAGS_leveldb_frozen_hash_index_entries = 8;
+  Reopen(true);
+  ExpectAllFound();
+
+  // A duplicate of a frozen entry in the live tail.
+  Reopen(false);
+  LoggedEntry duplicate(entries_[3]);
+  duplicate.set_sequence_number(entries_.size());
+  ASSERT_EQ(Database::OK, db_->CreateSequencedEntry(duplicate));
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(Database::LOOKUP_OK,
+              db_->LookupByHash(duplicate.Hash(), &lookup));
+    EXPECT_EQ(3, lookup.sequence_number());
+    Reopen(false);
+  }
+}
+
+
+TEST_F(LevelDBTest, SmallCache) {
+  FLAGS_leveldb_hash_index_cache_size = 16;
+  Reopen(true);
+  AddEntries(100);
+  ExpectAllFound();
+  ExpectAllFound();
+
+  FLAGS_leveldb_hash_index_cache_size = 0;
+  Reopen(true);
+  ExpectAllFound();
+}
+
+
+TEST_F(LevelDBTest, DedupChains) {
+  FLAGS_leveldb_dedup_chains = true;
+  Reopen(false);
+  // Entries of both types, all with the same intermediate.
+  const string intermediate(util::RandomString(512, 1024));
+  for (int i = 0; i < 10; ++i) {
+    entries_.emplace_back();
+    LoggedEntry* const entry(&entries_.back());
+    test_signer_.CreateUnique(entry);
+    entry->set_sequence_number(i);
+    if (entry->entry().type() == ct::X509_ENTRY) {
+      entry->mutable_entry()->mutable_x509_entry()->clear_certificate_chain();
+      entry->mutable_entry()->mutable_x509_entry()->add_certificate_chain(
+          intermediate);
+    } else {
+      entry->mutable_entry()
+          ->mutable_precert_entry()
+          ->add_precertificate_chain(intermediate);
+    }
+    ASSERT_EQ(Database::OK, db_->CreateSequencedEntry(*entry));
+  }
+  ExpectAllFound();
+
+  // Entries stored by digest can be read back without that flag, and
+  // rewritten as they are.
+  FLAGS_leveldb_dedup_chains = false;
+  Reopen(false);
+  ExpectAllFound();
+  unique_ptr<Database::Iterator> it(db_->ScanEntries(0));
+  for (const LoggedEntry& entry : entries_) {
+    LoggedEntry lookup;
+    ASSERT_TRUE(it->GetNextEntry(&lookup));
+    TestSigner::TestEqualLoggedCerts(entry, lookup);
+    EXPECT_EQ(Database::OK, db_->CreateSequencedEntry(entry));
+  }
+
+  // But not with another chain.
+  LoggedEntry other(entries_[0]);
+  if (other.entry().type() == ct::X509_ENTRY) {
+    other.mutable_entry()->mutable_x509_entry()->set_certificate_chain(
+        0, "other");
+  } else {
+    other.mutable_entry()->mutable_precert_entry()->set_precertificate_chain(
+        0, "other");
+  }
+  EXPECT_EQ(Database::SEQUENCE_NUMBER_ALREADY_IN_USE,
+            db_->CreateSequencedEntry(other));
+}
+
+
+TEST_F(LevelDBTest, ConcurrentReads) {
+  Reopen(false);
+  const int kNumEntries(200);
+  std::vector<LoggedEntry> entries(kNumEntries);
+  for (int i = 0; i < kNumEntries; ++i) {
+    test_signer_.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+  }
+
+  std::thread writer([this, &entries]() {
+    for (const LoggedEntry& entry : entries) {
+      EXPECT_EQ(Database::OK, db_->CreateSequencedEntry(entry));
+    }
+  });
+
+  // Everything within the tree size can be read while entries are being
+  // written.
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 4; ++r) {
+    readers.emplace_back([this, &entries, kNumEntries]() {
+      int64_t tree_size(0);
+      while (tree_size < kNumEntries) {
+        tree_size = db_->TreeSize();
+        if (tree_size == 0) {
+          continue;
+        }
+        LoggedEntry lookup;
+        ASSERT_EQ(Database::LOOKUP_OK,
+                  db_->LookupByIndex(tree_size - 1, &lookup));
+        EXPECT_EQ(entries[tree_size - 1].Hash(), lookup.Hash());
+        ASSERT_EQ(Database::LOOKUP_OK,
+                  db_->LookupByHash(entries[tree_size - 1].Hash(), &lookup));
+        EXPECT_EQ(tree_size - 1, lookup.sequence_number());
+
+        unique_ptr<Database::Iterator> it(db_->ScanEntries(0));
+        int64_t scanned(0);
+        while (it->GetNextEntry(&lookup)) {
+          EXPECT_EQ(scanned++, lookup.sequence_number());
+        }
+        EXPECT_LE(tree_size, scanned);
+      }
+    });
+  }
+
+  writer.join();
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(kNumEntries, db_->TreeSize());
+}
+
+
+// Reads entries while they are being written, which in WAL mode uses the
+// read-only connections for whatever has been committed.
+void SQLiteConcurrentReads(bool batch_into_transactions) {
+  const bool saved_batch(FLAGS_sqlite_batch_into_transactions);
+  FLAGS_sqlite_batch_into_transactions = batch_into_transactions;
+  TestDB<SQLiteDB> test_db;
+  FLAGS_sqlite_batch_into_transactions = saved_batch;
+  TestSigner test_signer;
+  SQLiteDB* const db(test_db.db());
+  const int kNumEntries(200);
+  std::vector<LoggedEntry> entries(kNumEntries);
+  for (int i = 0; i < kNumEntries; ++i) {
+    test_signer.CreateUnique(&entries[i]);
+    entries[i].set_sequence_number(i);
+  }
+
+  std::thread writer([db, &entries]() {
+    for (const LoggedEntry& entry : entries) {
+      EXPECT_EQ(Database::OK, db->CreateSequencedEntry(entry));
+    }
+  });
+
+  std::vector<std::thread> readers;
+  for (int r = 0; r < 8; ++r) {
+    readers.emplace_back([db, &entries, kNumEntries]() {
+      int64_t tree_size(0);
+      while (tree_size < kNumEntries) {
+        tree_size = db->TreeSize();
+        if (tree_size == 0) {
+          continue;
+        }
+        LoggedEntry lookup;
+        ASSERT_EQ(Database::LOOKUP_OK,
+                  db->LookupByIndex(tree_size - 1, &lookup));
+        EXPECT_EQ(entries[tree_size - 1].Hash(), lookup.Hash());
+        ASSERT_EQ(Database::LOOKUP_OK,
+                  db->LookupByHash(entries[tree_size - 1].Hash(), &lookup));
+        EXPECT_EQ(tree_size - 1, lookup.sequence_number());
+
+        unique_ptr<Database::Iterator> it(db->ScanEntries(0));
+        int64_t scanned(0);
+        while (it->GetNextEntry(&lookup)) {
+          EXPECT_EQ(scanned++, lookup.sequence_number());
+        }
+        EXPECT_LE(tree_size, scanned);
+      }
+    });
+  }
+
+  writer.join();
+  for (std::thread& reader : readers) {
+    reader.join();
+  }
+  EXPECT_EQ(kNumEntries, db->TreeSize());
+}
+
+
+TEST(SQLiteDBTest, ConcurrentReads) {
+  SQLiteConcurrentReads(false);
+}
+
+
+TEST(SQLiteDBTest, ConcurrentReadsOfUncommittedEntries) {
+  // The batch is bigger than the number of entries, so none of them are
+  // committed while they are read.
+  SQLiteConcurrentReads(true);
+}
+
+
+class FileDBTest : public ::testing::Test {
+ protected:
+  FileDBTest()
+      : saved_interval_(FLAGS_file_db_index_checkpoint_interval) {
+    FLAGS_file_db_index_checkpoint_interval = 10;
+    for (const char* dir : {"/certs", "/tree", "/meta"}) {
+      CHECK_ERR(mkdir((tmp_.TmpStorageDir() + dir).c_str(), 0700));
+    }
+  }
+
+  ~FileDBTest() {
+    FLAGS_file_db_index_checkpoint_interval = saved_interval_;
+  }
+
+  FileDB* Open() const {
+    return new FileDB(
+        new cert_trans::FileStorage(tmp_.TmpStorageDir() + "/certs",
+                                    kCertStorageDepth),
+        new cert_trans::FileStorage(tmp_.TmpStorageDir() + "/tree",
+                                    kTreeStorageDepth),
+        MetaStorage());
+  }
+
+  cert_trans::FileStorage* MetaStorage() const {
+    return new cert_trans::FileStorage(tmp_.TmpStorageDir() + "/meta", 0);
+  }
+
+  void AddEntries(Database* db, int count) {
+    for (int i = 0; i < count; ++i) {
+      entries_.emplace_back();
+      test_signer_.CreateUnique(&entries_.back());
+      entries_.back().set_sequence_number(entries_.size() - 1);
+      ASSERT_EQ(Database::OK, db->CreateSequencedEntry(entries_.back()));
+    }
+  }
+
+  void ExpectAllFound(const Database* db) {
+    EXPECT_EQ(static_cast<int64_t>(entries_.size()), db->TreeSize());
+    for (const LoggedEntry& entry : entries_) {
+      LoggedEntry lookup;
+      ASSERT_EQ(Database::LOOKUP_OK,
+                db->LookupByIndex(entry.sequence_number(), &lookup));
+      TestSigner::TestEqualLoggedCerts(entry, lookup);
+      // Duplicates are found with the lowest sequence number.
+      ASSERT_EQ(Database::LOOKUP_OK, db->LookupByHash(entry.Hash(), &lookup));
+      EXPECT_LE(lookup.sequence_number(), entry.sequence_number());
+    }
+    unique_ptr<Database::LeafHashIterator> it(db->ScanLeafHashes(0));
+    int64_t seq;
+    string leaf_hash;
+    for (const LoggedEntry& entry : entries_) {
+      ASSERT_TRUE(it->GetNextLeafHash(&seq, &leaf_hash));
+      EXPECT_EQ(entry.sequence_number(), seq);
+      EXPECT_EQ(entry.MerkleLeafHash(), leaf_hash);
+    }
+    EXPECT_FALSE(it->GetNextLeafHash(&seq, &leaf_hash));
+  }
+
+  const int saved_interval_;
+  TmpStorage tmp_;
+  TestSigner test_signer_;
+  std::vector<LoggedEntry> entries_;
+};
+
+
+TEST_F(FileDBTest, ResumesFromIndexCheckpoint) {
+  unique_ptr<FileDB> db(Open());
+  // Checkpointed after 10 and 20 of them, so 5 are not yet.
+  AddEntries(db.get(), 25);
+  // With the same hash as an entry in the checkpoint.
+  LoggedEntry duplicate(entries_[3]);
+  duplicate.set_sequence_number(25);
+  ASSERT_EQ(Database::OK, db->CreateSequencedEntry(duplicate));
+  entries_.push_back(duplicate);
+  AddEntries(db.get(), 10);
+
+  unique_ptr<FileDB> db2(Open());
+  ExpectAllFound(db2.get());
+  LoggedEntry lookup;
+  ASSERT_EQ(Database::LOOKUP_OK, db2->LookupByHash(duplicate.Hash(), &lookup));
+  EXPECT_EQ(3, lookup.sequence_number());
+
+  // Closing the databases checkpoints everything.
+  db.reset();
+  db2.reset();
+  db.reset(Open());
+  ExpectAllFound(db.get());
+  AddEntries(db.get(), 3);
+  db.reset(Open());
+  ExpectAllFound(db.get());
+}
+
+
+TEST_F(FileDBTest, CheckpointsSparseEntries) {
+  unique_ptr<FileDB> db(Open());
+  AddEntries(db.get(), 6);
+  // And 6 more after a gap, all of which are in the checkpoint.
+  std::vector<LoggedEntry> sparse(6);
+  for (size_t i = 0; i < sparse.size(); ++i) {
+    test_signer_.CreateUnique(&sparse[i]);
+    sparse[i].set_sequence_number(20 + i);
+    ASSERT_EQ(Database::OK, db->CreateSequencedEntry(sparse[i]));
+  }
+  db.reset(Open());
+  EXPECT_EQ(6, db->TreeSize());
+  LoggedEntry lookup;
+  EXPECT_EQ(Database::LOOKUP_OK, db->LookupByHash(sparse[2].Hash(), &lookup));
+  EXPECT_EQ(22, lookup.sequence_number());
+  unique_ptr<Database::LeafHashIterator> it(db->ScanLeafHashes(6));
+  int64_t seq;
+  string leaf_hash;
+  for (const LoggedEntry& entry : sparse) {
+    ASSERT_TRUE(it->GetNextLeafHash(&seq, &leaf_hash));
+    EXPECT_EQ(entry.sequence_number(), seq);
+    EXPECT_EQ(entry.MerkleLeafHash(), leaf_hash);
+  }
+  EXPECT_FALSE(it->GetNextLeafHash(&seq, &leaf_hash));
+
+  // Filling the gap makes them all contiguous.
+  AddEntries(db.get(), 14);
+  entries_.insert(entries_.end(), sparse.begin(), sparse.end());
+  EXPECT_EQ(26, db->TreeSize());
+  db.reset(Open());
+  ExpectAllFound(db.get());
+}
+
+
+TEST_F(FileDBTest, IgnoresInvalidIndexCheckpoint) {
+  unique_ptr<FileDB> db(Open());
+  AddEntries(db.get(), 15);
+  db.reset();
+
+  string checkpoint;
+  const unique_ptr<cert_trans::FileStorage> meta(MetaStorage());
+  ASSERT_TRUE(meta->LookupEntry("index_checkpoint", &checkpoint).ok());
+  for (const string& invalid :
+       {string(), string("garbage"), checkpoint.substr(1),
+        checkpoint.substr(0, checkpoint.size() - 1), checkpoint + "x"}) {
+    ASSERT_TRUE(meta->UpdateEntry("index_checkpoint", invalid).ok());
+    db.reset(Open());
+    ExpectAllFound(db.get());
+    db.reset();
+  }
+}
+
+
+TEST_F(FileDBTest, LatestTreeHead) {
+  unique_ptr<FileDB> db(Open());
+  SignedTreeHead sth, older, lookup;
+  test_signer_.CreateUnique(&sth);
+  test_signer_.CreateUnique(&older);
+  older.set_timestamp(sth.timestamp() - 1000);
+  EXPECT_EQ(Database::OK, db->WriteTreeHead(sth));
+  EXPECT_EQ(Database::OK, db->WriteTreeHead(older));
+
+  db.reset(Open());
+  EXPECT_EQ(Database::LOOKUP_OK, db->LatestTreeHead(&lookup));
+  TestSigner::TestEqualTreeHeads(sth, lookup);
+
+  // A pointer to a tree head that was not written is ignored.
+  const unique_ptr<cert_trans::FileStorage> meta(MetaStorage());
+  ASSERT_TRUE(meta->UpdateEntry("latest_tree_head", string(6, '\xff')).ok());
+  db.reset(Open());
+  EXPECT_EQ(Database::LOOKUP_OK, db->LatestTreeHead(&lookup));
+  TestSigner::TestEqualTreeHeads(sth, lookup);
+}
+
+
+const Metric* FindMetric(const string& name) {
+  for (const Metric* metric : Registry::Instance()->GetMetrics()) {
+    if (metric->Name() == name) {
+      return metric;
+    }
+  }
+  return nullptr;
+}
+
+
+TEST(DatabaseNotifierHelperTest, CoalescesAsynchronousCalls) {
+  DatabaseNotifierHelper helper(true);
+  std::mutex lock;
+  std::condition_variable cond;
+  bool released(false);
+  std::vector<uint64_t> timestamps;
+  const DatabaseNotifierHelper::NotifySTHCallback callback(
+      [&](const SignedTreeHead& sth) {
+        std::unique_lock<std::mutex> l(lock);
+        timestamps.push_back(sth.timestamp());
+        cond.notify_all();
+        cond.wait(l, [&]() { return released; });
+      });
+  helper.Add(&callback);
+
+  SignedTreeHead sth;
+  sth.set_timestamp(1);
+  helper.Call(sth);
+  {
+    std::unique_lock<std::mutex> l(lock);
+    cond.wait(l, [&]() { return !timestamps.empty(); });
+  }
+
+  // These do not wait for the callback, which only gets the newest.
+  sth.set_timestamp(3);
+  helper.Call(sth);
+  sth.set_timestamp(2);
+  helper.Call(sth);
+  {
+    std::unique_lock<std::mutex> l(lock);
+    released = true;
+    cond.notify_all();
+    cond.wait(l, [&]() { return timestamps.size() == 2; });
+  }
+  helper.Remove(&callback);
+  EXPECT_EQ(std::vector<uint64_t>({1, 3}), timestamps);
+
+  // Not delivered once removed.
+  sth.set_timestamp(4);
+  helper.Call(sth);
+  EXPECT_EQ(2U, timestamps.size());
+}
+
+
+TEST(MonitoredDatabaseTest, RecordsMetrics) {
+  TmpStorage tmp;
+  TestSigner test_signer;
+  MonitoredDatabase db("metrics_test", unique_ptr<Database>(new LevelDB(
+                                           tmp.TmpStorageDir() + "/leveldb")));
+
+  LoggedEntry entry, lookup;
+  test_signer.CreateUnique(&entry);
+  entry.set_sequence_number(0);
+  ASSERT_EQ(Database::OK, db.CreateSequencedEntry(entry));
+  ASSERT_EQ(Database::LOOKUP_OK, db.LookupByHash(entry.Hash(), &lookup));
+  {
+    unique_ptr<Database::Iterator> it(db.ScanEntries(0));
+    EXPECT_TRUE(it->GetNextEntry(&lookup));
+    EXPECT_FALSE(it->GetNextEntry(&lookup));
+  }
+
+  const Metric* const latency(FindMetric("database_latency_us"));
+  ASSERT_NE(nullptr, latency);
+  const auto counts(latency->CurrentValues());
+  EXPECT_EQ(1, counts.at({"metrics_test", "create_sequenced_entry"}).second);
+  EXPECT_EQ(1, counts.at({"metrics_test", "lookup_by_hash"}).second);
+  EXPECT_EQ(1, counts.at({"metrics_test", "scan_entries"}).second);
+  EXPECT_EQ(2, counts.at({"metrics_test", "next_entry"}).second);
+  EXPECT_EQ(0, counts.at({"metrics_test", "lookup_by_index"}).second);
+
+  const Metric* const written(FindMetric("database_bytes_written"));
+  ASSERT_NE(nullptr, written);
+  EXPECT_EQ(entry.ByteSize(),
+            written->CurrentValues()
+                .at({"metrics_test", "create_sequenced_entry"})
+                .second);
+  const Metric* const read(FindMetric("database_bytes_read"));
+  ASSERT_NE(nullptr, read);
+  const auto read_bytes(read->CurrentValues());
+  EXPECT_EQ(entry.ByteSize(),
+            read_bytes.at({"metrics_test", "lookup_by_hash"}).second);
+  EXPECT_EQ(entry.ByteSize(),
+            read_bytes.at({"metrics_test", "scan_entries"}).second);
+
+  const Metric* const lifetime(FindMetric("database_iterator_lifetime_ms"));
+  ASSERT_NE(nullptr, lifetime);
+  EXPECT_EQ(1,
+            lifetime->CurrentValues().at({"metrics_test", "entries"}).second);
+}
+
+
+TEST(HashFilteredDatabaseTest, FiltersLookupsOfNewEntries) {
+  TmpStorage tmp;
+  TestSigner test_signer;
+  LoggedEntry existing, lookup;
+  test_signer.CreateUnique(&existing);
+  existing.set_sequence_number(0);
+  {
+    LevelDB db(tmp.TmpStorageDir() + "/leveldb");
+    ASSERT_EQ(Database::OK, db.CreateSequencedEntry(existing));
+  }
+
+  HashFilteredDatabase db(unique_ptr<Database>(
+                              new LevelDB(tmp.TmpStorageDir() + "/leveldb")),
+                          1 << 20);
+  db.WaitUntilLoaded();
+  // The entries already in the database are loaded into the filter.
+  EXPECT_EQ(Database::LOOKUP_OK, db.LookupByHash(existing.Hash(), &lookup));
+  EXPECT_EQ(existing.Hash(), lookup.Hash());
+
+  LoggedEntry added;
+  test_signer.CreateUnique(&added);
+  added.set_sequence_number(1);
+  EXPECT_EQ(Database::NOT_FOUND, db.LookupByHash(added.Hash(), &lookup));
+  const Metric* const lookups(FindMetric("database_hash_filter_lookups"));
+  ASSERT_NE(nullptr, lookups);
+  EXPECT_LE(1, lookups->CurrentValues().at({"absent"}).second);
+
+  // As are those written after.
+  ASSERT_EQ(Database::OK, db.CreateSequencedEntry(added));
+  EXPECT_EQ(Database::LOOKUP_OK, db.LookupByHash(added.Hash(), &lookup));
+  EXPECT_EQ(added.Hash(), lookup.Hash());
+}
+
+
+class ShardedDatabaseTest : public ::testing::Test {
+ protected:
+  static const int64_t kEntriesPerShard = 3;
+
+  // A hash index over |entries_|.
+  class HashIndex : public ShardedDatabase::HashIndex {
+   public:
+    explicit HashIndex(const std::vector<LoggedEntry>* entries)
+        : entries_(entries) {
+    }
+
+    int64_t SequenceNumber(const string& hash) const override {
+      for (const LoggedEntry& entry : *entries_) {
+        if (entry.Hash() == hash) {
+          return entry.sequence_number();
+        }
+      }
+      return -1;
+    }
+
+   private:
+    const std::vector<LoggedEntry>* const entries_;
+  };
+
+  // Writes |num_entries| entries, numbered from 0, in shards of
+  // kEntriesPerShard (with the entries numbered from 0 in each), and
+  // returns a database made of the shards in |held|.
+  unique_ptr<ShardedDatabase> CreateShards(int64_t num_entries,
+                                           const std::set<int64_t>& held,
+                                           bool with_hash_index) {
+    std::map<int64_t, unique_ptr<cert_trans::ReadOnlyDatabase>> shards;
+    for (int64_t shard = 0; shard * kEntriesPerShard < num_entries;
+         ++shard) {
+      unique_ptr<LevelDB> db(new LevelDB(tmp_.TmpStorageDir() + "/shard-" +
+                                         std::to_string(shard)));
+      for (int64_t i = 0; i < kEntriesPerShard &&
+                          shard * kEntriesPerShard + i < num_entries;
+           ++i) {
+        LoggedEntry entry;
+        test_signer_.CreateUnique(&entry);
+        entry.set_sequence_number(i);
+        CHECK_EQ(Database::OK, db->CreateSequencedEntry(entry));
+        entry.set_sequence_number(shard * kEntriesPerShard + i);
+        entries_.push_back(entry);
+      }
+      if (held.count(shard) > 0) {
+        shards[shard] = std::move(db);
+      }
+    }
+    return unique_ptr<ShardedDatabase>(new ShardedDatabase(
+        kEntriesPerShard, std::move(shards),
+        unique_ptr<ShardedDatabase::HashIndex>(
+            with_hash_index ? new HashIndex(&entries_) : nullptr)));
+  }
+
+  TmpStorage tmp_;
+  TestSigner test_signer_;
+  std::vector<LoggedEntry> entries_;
+};
+
+
+const int64_t ShardedDatabaseTest::kEntriesPerShard;
+
+
+TEST_F(ShardedDatabaseTest, RoutesToShards) {
+  const unique_ptr<ShardedDatabase> db(CreateShards(8, {0, 1, 2}, false));
+  EXPECT_EQ(8, db->TreeSize());
+
+  LoggedEntry lookup;
+  for (const LoggedEntry& entry : entries_) {
+    ASSERT_EQ(Database::LOOKUP_OK,
+              db->LookupByIndex(entry.sequence_number(), &lookup));
+    EXPECT_EQ(entry.Hash(), lookup.Hash());
+    EXPECT_EQ(entry.sequence_number(), lookup.sequence_number());
+    ASSERT_EQ(Database::LOOKUP_OK, db->LookupByHash(entry.Hash(), &lookup));
+    EXPECT_EQ(entry.sequence_number(), lookup.sequence_number());
+  }
+  EXPECT_EQ(Database::NOT_FOUND, db->LookupByIndex(8, &lookup));
+
+  // Scans go across the shards.
+  unique_ptr<Database::Iterator> it(db->ScanEntries(1));
+  for (int64_t seq = 1; seq < 8; ++seq) {
+    ASSERT_TRUE(it->GetNextEntry(&lookup));
+    EXPECT_EQ(seq, lookup.sequence_number());
+    EXPECT_EQ(entries_[seq].Hash(), lookup.Hash());
+  }
+  EXPECT_FALSE(it->GetNextEntry(&lookup));
+
+  it = db->ScanRange(2, 6);
+  for (int64_t seq = 2; seq <= 6; ++seq) {
+    ASSERT_TRUE(it->GetNextEntry(&lookup));
+    EXPECT_EQ(seq, lookup.sequence_number());
+  }
+  EXPECT_FALSE(it->GetNextEntry(&lookup));
+
+  unique_ptr<Database::LeafHashIterator> leaves(db->ScanLeafHashes(0));
+  int64_t seq;
+  string leaf_hash;
+  for (const LoggedEntry& entry : entries_) {
+    ASSERT_TRUE(leaves->GetNextLeafHash(&seq, &leaf_hash));
+    EXPECT_EQ(entry.sequence_number(), seq);
+    EXPECT_EQ(entry.MerkleLeafHash(), leaf_hash);
+  }
+  EXPECT_FALSE(leaves->GetNextLeafHash(&seq, &leaf_hash));
+}
+
+
+TEST_F(ShardedDatabaseTest, HoldsOnlySomeShards) {
+  const unique_ptr<ShardedDatabase> db(CreateShards(8, {1, 2}, true));
+  EXPECT_EQ(8, db->TreeSize());
+
+  LoggedEntry lookup;
+  EXPECT_EQ(Database::NOT_FOUND, db->LookupByIndex(2, &lookup));
+  EXPECT_EQ(Database::NOT_FOUND, db->LookupByHash(entries_[2].Hash(), &lookup));
+  ASSERT_EQ(Database::LOOKUP_OK, db->LookupByIndex(3, &lookup));
+  EXPECT_EQ(entries_[3].Hash(), lookup.Hash());
+  // Found through the hash index.
+  ASSERT_EQ(Database::LOOKUP_OK, db->LookupByHash(entries_[7].Hash(), &lookup));
+  EXPECT_EQ(7, lookup.sequence_number());
+
+  // Scans start at the first shard held.
+  unique_ptr<Database::Iterator> it(db->ScanEntries(0));
+  ASSERT_TRUE(it->GetNextEntry(&lookup));
+  EXPECT_EQ(3, lookup.sequence_number());
+}
+
+
+class SegmentedFileDBTest : public ::testing::Test {
+ protected:
+  SegmentedFileDBTest()
+      : segment_dir_(tmp_.TmpStorageDir() + "/segments"),
+        saved_entries_per_segment_(
+            FLAGS_segmented_file_db_entries_per_segment),
+        saved_json_entries_(FLAGS_segmented_file_db_json_entries),
+        saved_hot_segments_(FLAGS_segmented_file_db_hot_segments),
+        saved_cold_block_bytes_(FLAGS_segmented_file_db_cold_block_bytes) {
+    FLAGS_segmented_file_db_entries_per_segment = kEntriesPerSegment;
+    CHECK_ERR(mkdir((tmp_.TmpStorageDir() + "/tree").c_str(), 0700));
+    CHECK_ERR(mkdir((tmp_.TmpStorageDir() + "/meta").c_str(), 0700));
+    Reopen();
+  }
+
+  ~SegmentedFileDBTest() {
+    FLAGS_segmented_file_db_entries_per_segment = saved_entries_per_segment_;
+    FLAGS_segmented_file_db_json_entries = saved_json_entries_;
+    FLAGS_segmented_file_db_hot_segments = saved_hot_segments_;
+    FLAGS_segmented_file_db_cold_block_bytes = saved_cold_block_bytes_;
+  }
+
+  // Closes the database, if open, and reopens it.
+  void Reopen() {
+    db_.reset();
+    db_.reset(new SegmentedFileDB(
+        segment_dir_, new cert_trans::FileStorage(tmp_.TmpStorageDir() +
+                                                      "/tree",
+                                                  kTreeStorageDepth),
+        new cert_trans::FileStorage(tmp_.TmpStorageDir() + "/meta", 0)));
+  }
+
+  // Adds entries with the sequence numbers [begin, end), all at once.
+  void AddEntries(int64_t begin, int64_t end) {
+    std::vector<LoggedEntry> batch;
+    for (int64_t seq = begin; seq < end; ++seq) {
+      batch.emplace_back();
+      test_signer_.CreateUnique(&batch.back());
+      batch.back().set_sequence_number(seq);
+      entries_.push_back(batch.back());
+    }
+    size_t num_created;
+    ASSERT_EQ(Database::OK, db_->CreateSequencedEntries(batch, &num_created));
+    ASSERT_EQ(batch.size(), num_created);
+  }
+
+  void ExpectAllFound() {
+    std::set<int64_t> sequence_numbers;
+    for (const LoggedEntry& entry : entries_) {
+      LoggedEntry lookup;
+      ASSERT_EQ(Database::LOOKUP_OK,
+                db_->LookupByIndex(entry.sequence_number(), &lookup));
+      TestSigner::TestEqualLoggedCerts(entry, lookup);
+      ASSERT_EQ(Database::LOOKUP_OK, db_->LookupByHash(entry.Hash(), &lookup));
+      EXPECT_EQ(entry.sequence_number(), lookup.sequence_number());
+      sequence_numbers.insert(entry.sequence_number());
+    }
+
+    unique_ptr<Database::Iterator> it(db_->ScanEntries(0));
+    unique_ptr<Database::LeafHashIterator> leaf_it(db_->ScanLeafHashes(0));
+    for (const int64_t seq : sequence_numbers) {
+      LoggedEntry lookup;
+      ASSERT_TRUE(it->GetNextEntry(&lookup));
+      EXPECT_EQ(seq, lookup.sequence_number());
+      int64_t leaf_seq;
+      string leaf_hash;
+      ASSERT_TRUE(leaf_it->GetNextLeafHash(&leaf_seq, &leaf_hash));
+      EXPECT_EQ(seq, leaf_seq);
+      EXPECT_EQ(lookup.MerkleLeafHash(), leaf_hash);
+    }
+    LoggedEntry lookup;
+    EXPECT_FALSE(it->GetNextEntry(&lookup));
+    int64_t leaf_seq;
+    string leaf_hash;
+    EXPECT_FALSE(leaf_it->GetNextLeafHash(&leaf_seq, &leaf_hash));
+  }
+
+  off_t DataFileSize(const string& first_sequence_number) {
+    struct stat st;
+    CHECK_ERR(stat((segment_dir_ + "/segment-" + first_sequence_number +
+                    ".data").c_str(),
+                   &st));
+    return st.st_size;
+  }
+
+  bool SegmentFileExists(const string& first_sequence_number,
+                         const string& suffix) {
+    return access((segment_dir_ + "/segment-" + first_sequence_number +
+                   suffix).c_str(),
+                  F_OK) == 0;
+  }
+
+  void ExpectJsonEntries(int64_t start, int64_t end) {
+    std::vector<Database::JsonEntry> json_entries;
+    ASSERT_TRUE(db_->LookupJsonEntries(start, end, &json_entries));
+    ASSERT_EQ(static_cast<size_t>(end - start + 1), json_entries.size());
+    for (size_t i = 0; i < json_entries.size(); ++i) {
+      string leaf_input;
+      ASSERT_TRUE(entries_[start + i].SerializeForLeaf(&leaf_input));
+      EXPECT_NE(string::npos,
+                string(json_entries[i].data, json_entries[i].size)
+                    .find(util::ToBase64(leaf_input)));
+    }
+  }
+
+  static const int kEntriesPerSegment = 4;
+
+  TmpStorage tmp_;
+  const string segment_dir_;
+  const int saved_entries_per_segment_;
+  const bool saved_json_entries_;
+  const int saved_hot_segments_;
+  const int saved_cold_block_bytes_;
+  TestSigner test_signer_;
+  std::vector<LoggedEntry> entries_;
+  unique_ptr<SegmentedFileDB> db_;
+};
+
+
+TEST_F(SegmentedFileDBTest, SpansSegments) {
+  AddEntries(0, 10);
+  AddEntries(25, 27);
+  EXPECT_EQ(10, db_->TreeSize());
+  ExpectAllFound();
+
+  Reopen();
+  EXPECT_EQ(10, db_->TreeSize());
+  ExpectAllFound();
+
+  AddEntries(10, 25);
+  EXPECT_EQ(27, db_->TreeSize());
+  ExpectAllFound();
+}
+
+
+TEST_F(SegmentedFileDBTest, KeepsEntriesPerSegment) {
+  AddEntries(0, 6);
+  FLAGS_segmented_file_db_entries_per_segment = 16;
+  Reopen();
+  AddEntries(6, 9);
+  ExpectAllFound();
+  // The third segment still starts at 8.
+  EXPECT_LT(0, DataFileSize("0000000000000008"));
+}
+
+
+TEST_F(SegmentedFileDBTest, DropsUnindexedData) {
+  AddEntries(0, 6);
+  const off_t size(DataFileSize("0000000000000004"));
+  db_.reset();
+
+  // Simulate a crash between appending an entry and indexing it.
+  const string garbage("not an entry");
+  FILE* const data_file(fopen(
+      (segment_dir_ + "/segment-0000000000000004.data").c_str(), "a"));
+  ASSERT_TRUE(data_file != NULL);
+  ASSERT_EQ(garbage.size(),
+            fwrite(garbage.data(), 1, garbage.size(), data_file));
+  ASSERT_EQ(0, fclose(data_file));
+
+  Reopen();
+  EXPECT_EQ(size, DataFileSize("0000000000000004"));
+  AddEntries(6, 7);
+  ExpectAllFound();
+}
+
+
+TEST_F(SegmentedFileDBTest, CompressesColdSegments) {
+  AddEntries(0, 14);
+  // Small enough for a few blocks per segment.
+  FLAGS_segmented_file_db_cold_block_bytes = 2000;
+  FLAGS_segmented_file_db_hot_segments = 1;
+  unique_ptr<Database::Iterator> it(db_->ScanEntries(0));
+  LoggedEntry lookup;
+  ASSERT_TRUE(it->GetNextEntry(&lookup));
+  db_->CompactColdSegments();
+
+  // Only the segments ending at least 4 entries before the tree size.
+  EXPECT_TRUE(SegmentFileExists("0000000000000000", ".cold"));
+  EXPECT_FALSE(SegmentFileExists("0000000000000000", ".data"));
+  EXPECT_TRUE(SegmentFileExists("0000000000000004", ".cold"));
+  EXPECT_FALSE(SegmentFileExists("0000000000000004", ".data"));
+  EXPECT_FALSE(SegmentFileExists("0000000000000008", ".cold"));
+  EXPECT_TRUE(SegmentFileExists("0000000000000008", ".data"));
+
+  // Scans that started before still go on.
+  for (int64_t seq = 1; seq < 14; ++seq) {
+    ASSERT_TRUE(it->GetNextEntry(&lookup));
+    TestSigner::TestEqualLoggedCerts(entries_[seq], lookup);
+  }
+  EXPECT_FALSE(it->GetNextEntry(&lookup));
+  ExpectAllFound();
+  ExpectJsonEntries(2, 10);
+
+  Reopen();
+  ExpectAllFound();
+  ExpectJsonEntries(0, 13);
+
+  // Opening the database compresses the segments that got full.
+  AddEntries(14, 20);
+  Reopen();
+  EXPECT_TRUE(SegmentFileExists("0000000000000008", ".cold"));
+  EXPECT_TRUE(SegmentFileExists("000000000000000c", ".cold"));
+  EXPECT_FALSE(SegmentFileExists("0000000000000010", ".cold"));
+  ExpectAllFound();
+  ExpectJsonEntries(6, 19);
+}
+
+
+TEST_F(SegmentedFileDBTest, JsonEntries) {
+  AddEntries(0, 6);
+  AddEntries(7, 8);
+  Reopen();
+
+  std::vector<Database::JsonEntry> json_entries;
+  ASSERT_TRUE(db_->LookupJsonEntries(2, 7, &json_entries));
+  // Stops before the missing entry 6.
+  ASSERT_EQ(4U, json_entries.size());
+  for (size_t i = 0; i < json_entries.size(); ++i) {
+    string leaf_input;
+    string extra_data;
+    ASSERT_TRUE(entries_[i + 2].SerializeForLeaf(&leaf_input));
+    ASSERT_TRUE(entries_[i + 2].SerializeExtraData(&extra_data));
+    EXPECT_EQ("{\"leaf_input\":\"" + util::ToBase64(leaf_input) +
+                  "\",\"extra_data\":\"" + util::ToBase64(extra_data) +
+                  "\"}",
+              string(json_entries[i].data, json_entries[i].size));
+  }
+
+  json_entries.clear();
+  ASSERT_TRUE(db_->LookupJsonEntries(6, 7, &json_entries));
+  EXPECT_TRUE(json_entries.empty());
+}
+
+
+TEST_F(SegmentedFileDBTest, NoJsonEntries) {
+  FLAGS_segmented_file_db_json_entries = false;
+  AddEntries(0, 3);
+  FLAGS_segmented_file_db_json_entries = true;
+  AddEntries(3, 6);
+  ExpectAllFound();
+
+  std::vector<Database::JsonEntry> json_entries;
+  EXPECT_FALSE(db_->LookupJsonEntries(0, 5, &json_entries));
+  json_entries.clear();
+  EXPECT_TRUE(db_->LookupJsonEntries(3, 5, &json_entries));
+  EXPECT_EQ(3U, json_entries.size());
+}
+
+
 }  // namespace
 
 
@@ -0,0 +1,175 @@
+#include "log/der.h"
+
+using std::string;
+using std::vector;
+
+namespace cert_trans {
+
+
+bool ReadDerElement(const string& der, size_t start, size_t limit,
+                    DerElement* element) {
+  if (limit > der.size() || start + 2 > limit) {
+    return false;
+  }
+  const unsigned char* const data(
+      reinterpret_cast<const unsigned char*>(der.data()));
+  element->tag = data[start];
+  // High tag numbers do not appear in certificates.
+  if ((element->tag & 0x1f) == 0x1f) {
+    return false;
+  }
+  size_t length(data[start + 1]);
+  size_t header(2);
+  if (length & 0x80) {
+    const size_t num_bytes(length & 0x7f);
+    if (num_bytes == 0 || num_bytes > 4 || start + 2 + num_bytes > limit) {
+      return false;
+    }
+    length = 0;
+    for (size_t i = 0; i < num_bytes; ++i) {
+      length = (length << 8) | data[start + 2 + i];
+    }
+    header += num_bytes;
+  }
+  element->start = start;
+  element->contents = start + header;
+  if (length > limit - element->contents) {
+    return false;
+  }
+  element->end = element->contents + length;
+  return true;
+}
+
+
+string DerElementBytes(const string& der, const DerElement& element) {
+  return der.substr(element.start, element.end - element.start);
+}
+
+
+namespace {
+
+
+// The [0] tag of the version of a TBSCertificate.
+const unsigned char kDerVersion = 0xa0;
+
+
+void SetAbsent(DerElement* element) {
+  element->tag = 0;
+  element->start = element->contents = element->end = 0;
+}
+
+
+// Reads the fields of the TBSCertificate |tbs| of |der| into |*cert|.
+bool ReadTbsFields(const string& der, const DerElement& tbs,
+                   DerCertificate* cert) {
+  if (tbs.tag != kDerSequence) {
+    return false;
+  }
+  cert->tbs = tbs;
+
+  size_t pos(tbs.contents);
+  SetAbsent(&cert->version);
+  if (!ReadDerElement(der, pos, tbs.end, &cert->version)) {
+    return false;
+  }
+  if (cert->version.tag == kDerVersion) {
+    pos = cert->version.end;
+  } else {
+    SetAbsent(&cert->version);
+  }
+
+  DerElement* const fields[] = {&cert->serial_number, &cert->signature,
+                                &cert->issuer, &cert->validity,
+                                &cert->subject,
+                                &cert->subject_public_key_info};
+  for (DerElement* field : fields) {
+    if (!ReadDerElement(der, pos, tbs.end, field)) {
+      return false;
+    }
+    pos = field->end;
+  }
+  if (cert->issuer.tag != kDerSequence || cert->subject.tag != kDerSequence ||
+      cert->subject_public_key_info.tag != kDerSequence) {
+    return false;
+  }
+
+  // The extensions come last, after the optional unique IDs.
+  SetAbsent(&cert->extensions);
+  SetAbsent(&cert->extension_list);
+  DerElement field;
+  SetAbsent(&field);
+  for (; pos < tbs.end; pos = field.end) {
+    if (!ReadDerElement(der, pos, tbs.end, &field)) {
+      return false;
+    }
+  }
+  if (field.tag == kDerExtensions) {
+    cert->extensions = field;
+    if (!ReadDerElement(der, field.contents, field.end,
+                        &cert->extension_list) ||
+        cert->extension_list.tag != kDerSequence ||
+        cert->extension_list.end != field.end) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+}  // namespace
+
+
+bool ReadDerCertificate(const string& der, DerCertificate* cert) {
+  DerElement tbs;
+  if (!ReadDerElement(der, 0, der.size(), &cert->certificate) ||
+      cert->certificate.tag != kDerSequence ||
+      !ReadDerElement(der, cert->certificate.contents, cert->certificate.end,
+                      &tbs) ||
+      !ReadTbsFields(der, tbs, cert) ||
+      !ReadDerElement(der, tbs.end, cert->certificate.end,
+                      &cert->signature_algorithm) ||
+      !ReadDerElement(der, cert->signature_algorithm.end,
+                      cert->certificate.end, &cert->signature_value)) {
+    return false;
+  }
+  return cert->signature_value.end == cert->certificate.end &&
+         cert->certificate.end == der.size();
+}
+
+
+bool ReadDerTbsCertificate(const string& der, DerCertificate* cert) {
+  SetAbsent(&cert->certificate);
+  SetAbsent(&cert->signature_algorithm);
+  SetAbsent(&cert->signature_value);
+  DerElement tbs;
+  return ReadDerElement(der, 0, der.size(), &tbs) &&
+         tbs.end == der.size() && ReadTbsFields(der, tbs, cert);
+}
+
+
+bool FindDerExtensions(const string& der, const DerCertificate& cert,
+                       const string& oid, vector<DerElement>* found) {
+  found->clear();
+  if (cert.extensions.tag == 0) {
+    return true;
+  }
+  // Extension ::= SEQUENCE { extnID OBJECT IDENTIFIER, ... }
+  const DerElement& list(cert.extension_list);
+  DerElement extension;
+  for (size_t pos = list.contents; pos < list.end; pos = extension.end) {
+    DerElement extn_id;
+    if (!ReadDerElement(der, pos, list.end, &extension) ||
+        extension.tag != kDerSequence ||
+        !ReadDerElement(der, extension.contents, extension.end, &extn_id) ||
+        extn_id.tag != kDerObjectIdentifier) {
+      return false;
+    }
+    if (der.compare(extn_id.start, extn_id.end - extn_id.start, oid) == 0) {
+      found->push_back(extension);
+    }
+  }
+  return true;
+}
+
+
+}  // namespace cert_trans
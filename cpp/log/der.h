@@ -0,0 +1,91 @@
+#ifndef CERT_TRANS_LOG_DER_H_
+#define CERT_TRANS_LOG_DER_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+namespace cert_trans {
+
+
+// DER tags, as found in certificates.
+const unsigned char kDerSequence = 0x30;
+const unsigned char kDerSet = 0x31;
+const unsigned char kDerObjectIdentifier = 0x06;
+const unsigned char kDerOctetString = 0x04;
+// The [3] tag of the extensions in a TBSCertificate.
+const unsigned char kDerExtensions = 0xa3;
+
+
+// An element of a DER encoding: its tag, and where its header and its
+// contents are.
+struct DerElement {
+  unsigned char tag;
+  size_t start;
+  size_t contents;
+  size_t end;
+};
+
+
+// Reads the element of |der| starting at |start|, which must end by
+// |limit|. Only definite lengths of up to 4 bytes are supported, which
+// is all that DER has for certificates.
+bool ReadDerElement(const std::string& der, size_t start, size_t limit,
+                    DerElement* element);
+
+// Returns a copy of |element| of |der|, its header included.
+std::string DerElementBytes(const std::string& der, const DerElement& element);
+
+
+// Where the fields of a DER-encoded certificate are, for the read paths
+// that only need some of its bytes and not an OpenSSL X509 with all of
+// its parts decoded. Nothing is copied: the elements are offsets into
+// the encoding, which must outlive them. Absent fields have a tag of 0.
+//
+// Only the structure is checked, not what the fields contain, so the
+// signature and anything else still have to be checked with OpenSSL.
+struct DerCertificate {
+  // Certificate ::= SEQUENCE { tbsCertificate, signatureAlgorithm,
+  //                            signatureValue }
+  // These are absent when only a TBSCertificate was read.
+  DerElement certificate;
+  DerElement signature_algorithm;
+  DerElement signature_value;
+
+  // TBSCertificate ::= SEQUENCE { version [0] EXPLICIT OPTIONAL,
+  //     serialNumber, signature, issuer, validity, subject,
+  //     subjectPublicKeyInfo, issuerUniqueID [1] OPTIONAL,
+  //     subjectUniqueID [2] OPTIONAL, extensions [3] EXPLICIT OPTIONAL }
+  DerElement tbs;
+  DerElement version;
+  DerElement serial_number;
+  DerElement signature;
+  DerElement issuer;
+  DerElement validity;
+  DerElement subject;
+  DerElement subject_public_key_info;
+  // The [3] element, and the SEQUENCE OF Extension within it.
+  DerElement extensions;
+  DerElement extension_list;
+};
+
+// Reads the fields of the DER-encoded certificate |der|. Returns false
+// if its structure is not that of a certificate, or there is more to
+// |der| than the certificate.
+bool ReadDerCertificate(const std::string& der, DerCertificate* cert);
+
+// The same for the DER-encoded TBSCertificate |der|, such as that of a
+// precertificate entry, which leaves the Certificate fields absent.
+bool ReadDerTbsCertificate(const std::string& der, DerCertificate* cert);
+
+// Sets |*found| to the Extension elements of |cert| whose extnID has
+// the encoding |oid|, its tag and length included. Returns false if the
+// extensions cannot be read.
+bool FindDerExtensions(const std::string& der, const DerCertificate& cert,
+                       const std::string& oid,
+                       std::vector<DerElement>* found);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_DER_H_
@@ -0,0 +1,158 @@
+#include "log/der.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <openssl/bio.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <string>
+#include <vector>
+
+#include "util/openssl_scoped_types.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::vector;
+
+// A v3 certificate with the subjectKeyIdentifier, authorityKeyIdentifier
+// and basicConstraints extensions.
+const char kLeafCert[] = "test-cert.pem";
+
+const char kSubjectKeyIdentifierOid[] = "\x06\x03\x55\x1d\x0e";
+const char kSubjectAltNameOid[] = "\x06\x03\x55\x1d\x11";
+
+
+// The DER encoding of |name| as OpenSSL has it.
+string NameDer(X509_NAME* name) {
+  unsigned char* buf(NULL);
+  const int length(i2d_X509_NAME(name, &buf));
+  CHECK_GT(length, 0);
+  const string der(reinterpret_cast<char*>(buf), length);
+  OPENSSL_free(buf);
+  return der;
+}
+
+
+class DerTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    string pem;
+    CHECK(util::ReadTextFile(FLAGS_test_srcdir + "/test/testdata/" +
+                                 kLeafCert,
+                             &pem))
+        << "Could not read " << kLeafCert << ". Wrong --test_srcdir?";
+    ScopedBIO bio(BIO_new_mem_buf(const_cast<char*>(pem.data()),
+                                  pem.size()));
+    x509_.reset(PEM_read_bio_X509(bio.get(), NULL, NULL, NULL));
+    CHECK_NOTNULL(x509_.get());
+    unsigned char* buf(NULL);
+    const int length(i2d_X509(x509_.get(), &buf));
+    CHECK_GT(length, 0);
+    der_.assign(reinterpret_cast<char*>(buf), length);
+    OPENSSL_free(buf);
+  }
+
+  ScopedX509 x509_;
+  string der_;
+};
+
+
+TEST_F(DerTest, ReadCertificate) {
+  DerCertificate cert;
+  ASSERT_TRUE(ReadDerCertificate(der_, &cert));
+  EXPECT_EQ(0U, cert.certificate.start);
+  EXPECT_EQ(der_.size(), cert.certificate.end);
+  EXPECT_EQ(0xa0, cert.version.tag);
+  EXPECT_EQ(kDerSequence, cert.signature_algorithm.tag);
+
+  EXPECT_EQ(NameDer(X509_get_issuer_name(x509_.get())),
+            DerElementBytes(der_, cert.issuer));
+  EXPECT_EQ(NameDer(X509_get_subject_name(x509_.get())),
+            DerElementBytes(der_, cert.subject));
+
+  unsigned char* buf(NULL);
+  int length(i2d_X509_PUBKEY(X509_get_X509_PUBKEY(x509_.get()), &buf));
+  ASSERT_GT(length, 0);
+  EXPECT_EQ(string(reinterpret_cast<char*>(buf), length),
+            DerElementBytes(der_, cert.subject_public_key_info));
+  OPENSSL_free(buf);
+
+  buf = NULL;
+  length = i2d_re_X509_tbs(x509_.get(), &buf);
+  ASSERT_GT(length, 0);
+  EXPECT_EQ(string(reinterpret_cast<char*>(buf), length),
+            DerElementBytes(der_, cert.tbs));
+  OPENSSL_free(buf);
+
+  EXPECT_EQ(kDerExtensions, cert.extensions.tag);
+  EXPECT_EQ(cert.tbs.end, cert.extensions.end);
+  EXPECT_EQ(kDerSequence, cert.extension_list.tag);
+}
+
+
+TEST_F(DerTest, ReadTbsCertificate) {
+  DerCertificate cert, tbs_only;
+  ASSERT_TRUE(ReadDerCertificate(der_, &cert));
+  const string tbs(DerElementBytes(der_, cert.tbs));
+  ASSERT_TRUE(ReadDerTbsCertificate(tbs, &tbs_only));
+
+  EXPECT_EQ(0, tbs_only.certificate.tag);
+  EXPECT_EQ(0, tbs_only.signature_value.tag);
+  EXPECT_EQ(DerElementBytes(der_, cert.subject),
+            DerElementBytes(tbs, tbs_only.subject));
+  EXPECT_EQ(DerElementBytes(der_, cert.extension_list),
+            DerElementBytes(tbs, tbs_only.extension_list));
+
+  // A TBSCertificate is not a whole certificate, nor the other way
+  // around.
+  EXPECT_FALSE(ReadDerCertificate(tbs, &cert));
+  EXPECT_FALSE(ReadDerTbsCertificate(der_, &tbs_only));
+}
+
+
+TEST_F(DerTest, FindExtensions) {
+  DerCertificate cert;
+  ASSERT_TRUE(ReadDerCertificate(der_, &cert));
+
+  vector<DerElement> found;
+  ASSERT_TRUE(FindDerExtensions(
+      der_, cert, string(kSubjectKeyIdentifierOid,
+                         sizeof(kSubjectKeyIdentifierOid) - 1),
+      &found));
+  ASSERT_EQ(1U, found.size());
+  EXPECT_EQ(kDerSequence, found[0].tag);
+  EXPECT_EQ(0, der_.compare(found[0].contents,
+                            sizeof(kSubjectKeyIdentifierOid) - 1,
+                            kSubjectKeyIdentifierOid));
+
+  EXPECT_TRUE(FindDerExtensions(
+      der_, cert,
+      string(kSubjectAltNameOid, sizeof(kSubjectAltNameOid) - 1), &found));
+  EXPECT_TRUE(found.empty());
+}
+
+
+TEST_F(DerTest, RejectsTruncatedCertificates) {
+  DerCertificate cert;
+  for (size_t length = 0; length < der_.size(); ++length) {
+    EXPECT_FALSE(ReadDerCertificate(der_.substr(0, length), &cert))
+        << length;
+  }
+  // Nor does it read past the end of a certificate.
+  EXPECT_FALSE(ReadDerCertificate(der_ + string(1, '\0'), &cert));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -3,15 +3,22 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <iomanip>
+#include <sstream>
 #include <unordered_map>
 #include <vector>
 
 #include "base/notification.h"
 #include "log/etcd_consistent_store.h"
+#include "log/file_storage.h"
+#include "merkletree/serial_hasher.h"
 #include "monitoring/event_metric.h"
 #include "monitoring/latency.h"
 #include "monitoring/monitoring.h"
+#include "monitoring/trace.h"
 #include "util/etcd_delete.h"
 #include "util/executor.h"
 #include "util/masterelection.h"
@@ -21,13 +28,22 @@ DECLARE_int32(etcd_stats_collection_interval_seconds);
 
 DECLARE_int32(node_state_ttl_seconds);
 
+DECLARE_bool(etcd_cache_pending_entries);
+
+DECLARE_int32(etcd_read_cache_max_staleness_seconds);
+
+DECLARE_int32(etcd_cleanup_max_entries_per_run);
+
 namespace cert_trans {
 namespace {
 
 // etcd path constants.
 const char kClusterConfigFile[] = "/cluster_config";
 const char kEntriesDir[] = "/entries/";
+// The single sequence mapping file used by older versions, which is
+// still read until it has been cleaned up.
 const char kSequenceFile[] = "/sequence_mapping";
+const char kSequenceMappingsDir[] = "/sequence_mappings/";
 const char kServingSthFile[] = "/serving_sth";
 const char kNodesDir[] = "/nodes/";
 
@@ -104,6 +120,15 @@ util::StatusOr<int64_t> CalculateNumEtcdEntries(
   return created.ValueOrDie() - num_removed;
 }
 
+
+// Whether a value that etcd confirmed at |confirmed| can still be used
+// without checking it again at |now|.
+bool IsFresh(const std::chrono::steady_clock::time_point& confirmed,
+             const std::chrono::steady_clock::time_point& now) {
+  return now - confirmed <
+         std::chrono::seconds(FLAGS_etcd_read_cache_max_staleness_seconds);
+}
+
 }  // namespace
 
 
@@ -111,19 +136,23 @@ template <class Logged>
 EtcdConsistentStore<Logged>::EtcdConsistentStore(
     libevent::Base* base, util::Executor* executor, EtcdClient* client,
     const MasterElection* election, const std::string& root,
-    const std::string& node_id)
+    const std::string& node_id, FileStorage* entry_blobs)
     : client_(CHECK_NOTNULL(client)),
       base_(CHECK_NOTNULL(base)),
       executor_(CHECK_NOTNULL(executor)),
       election_(CHECK_NOTNULL(election)),
       root_(root),
       node_id_(node_id),
+      entry_blobs_(entry_blobs),
       serving_sth_watch_task_(CHECK_NOTNULL(executor)),
       cluster_config_watch_task_(CHECK_NOTNULL(executor)),
+      pending_entries_watch_task_(CHECK_NOTNULL(executor)),
       etcd_stats_task_(executor_),
       received_initial_sth_(false),
       exiting_(false),
-      num_etcd_entries_(0) {
+      num_etcd_entries_(0),
+      cleaned_up_to_(-1),
+      pending_entries_synced_(false) {
   // Set up watches on things we're interested in...
   WatchServingSTH(
       std::bind(&EtcdConsistentStore<Logged>::OnEtcdServingSTHUpdated, this,
@@ -133,6 +162,18 @@ EtcdConsistentStore<Logged>::EtcdConsistentStore(
       std::bind(&EtcdConsistentStore<Logged>::OnClusterConfigUpdated, this,
                 std::placeholders::_1),
       cluster_config_watch_task_.task());
+  if (FLAGS_etcd_cache_pending_entries) {
+    const PendingEntriesCallback cb(
+        std::bind(&EtcdConsistentStore<Logged>::OnPendingEntriesUpdated, this,
+                  std::placeholders::_1));
+    client_->Watch(GetFullPath(kEntriesDir),
+                   std::bind(&ConvertMultipleUpdate<Logged,
+                                                    PendingEntriesCallback>,
+                             cb, std::placeholders::_1),
+                   pending_entries_watch_task_.task());
+  } else {
+    pending_entries_watch_task_.task()->Return();
+  }
 
   StartEtcdStatsFetch();
 
@@ -150,9 +191,11 @@ EtcdConsistentStore<Logged>::~EtcdConsistentStore() {
   VLOG(1) << "Cancelling watch tasks.";
   serving_sth_watch_task_.Cancel();
   cluster_config_watch_task_.Cancel();
+  pending_entries_watch_task_.Cancel();
   VLOG(1) << "Waiting for watch tasks to return.";
   serving_sth_watch_task_.Wait();
   cluster_config_watch_task_.Wait();
+  pending_entries_watch_task_.Wait();
   VLOG(1) << "Cancelling stats task.";
   etcd_stats_task_.Cancel();
   etcd_stats_task_.Wait();
@@ -256,12 +299,53 @@ util::Status EtcdConsistentStore<Logged>::SetServingSTH(
 template <class Logged>
 util::StatusOr<ct::SignedTreeHead> EtcdConsistentStore<Logged>::GetServingSTH()
     const {
+  return GetServingSTH(false);
+}
+
+
+template <class Logged>
+util::StatusOr<ct::SignedTreeHead> EtcdConsistentStore<Logged>::GetServingSTH(
+    bool consistent) const {
+  const std::chrono::steady_clock::time_point now(
+      std::chrono::steady_clock::now());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!consistent && IsFresh(serving_sth_confirmed_, now)) {
+      if (serving_sth_) {
+        return serving_sth_->Entry();
+      } else {
+        return util::Status(util::error::NOT_FOUND, "No current Serving STH.");
+      }
+    }
+  }
+
+  ScopedLatency scoped_latency(
+      etcd_latency_by_op_ms.GetScopedLatency("get_serving_sth"));
+
+  EntryHandle<ct::SignedTreeHead> handle;
+  const util::Status status(
+      GetEntry(GetFullPath(kServingSthFile), &handle, consistent));
+  if (!status.ok() && status.CanonicalCode() != util::error::NOT_FOUND) {
+    return status;
+  }
+
   std::lock_guard<std::mutex> lock(mutex_);
-  if (serving_sth_) {
+  // Only the watch updates serving_sth_, so that it never goes back, and
+  // a read just confirms it if it found the same version.
+  if (status.ok() ? serving_sth_ && serving_sth_->Handle() == handle.Handle()
+                  : !serving_sth_) {
+    serving_sth_confirmed_ = now;
+  }
+  // Without a quorum, the read might have been answered by an etcd
+  // server which is behind the watch.
+  if (!consistent && serving_sth_ &&
+      (!status.ok() || handle.Handle() < serving_sth_->Handle())) {
     return serving_sth_->Entry();
-  } else {
+  }
+  if (!status.ok()) {
     return util::Status(util::error::NOT_FOUND, "No current Serving STH.");
   }
+  return handle.Entry();
 }
 
 
@@ -308,24 +392,152 @@ util::Status EtcdConsistentStore<Logged>::AddPendingEntry(Logged* entry) {
   status = CreateEntry(&handle);
   if (status.CanonicalCode() == util::error::FAILED_PRECONDITION) {
     // Entry with that hash already exists.
-    EntryHandle<Logged> preexisting_entry;
-    status = GetEntry(full_path, &preexisting_entry);
-    if (!status.ok()) {
-      LOG(ERROR) << "Couldn't create or fetch " << full_path << " : "
-                 << status;
-      return status;
-    }
-
-    // Check the leaf certs are the same (we might be seeing the same cert
-    // submitted with a different chain.)
-    CHECK(LeafEntriesMatch(preexisting_entry.Entry(), *entry));
-    *entry->mutable_sct() = preexisting_entry.Entry().sct();
-    return util::Status(util::error::ALREADY_EXISTS,
-                        "Pending entry already exists.");
+    return GetPreexistingPendingEntry(full_path, entry);
   }
   return status;
 }
 
+template <class Logged>
+struct EtcdConsistentStore<Logged>::AddPendingEntriesState {
+  AddPendingEntriesState(const std::vector<Logged*>& entries,
+                         std::vector<util::Status>* statuses,
+                         util::Task* task)
+      : entries(entries),
+        statuses(CHECK_NOTNULL(statuses)),
+        task(CHECK_NOTNULL(task)),
+        paths(entries.size()),
+        create_resps(entries.size()),
+        get_resps(entries.size()),
+        num_left(entries.size()),
+        started_at(std::chrono::steady_clock::now()),
+        trace(Trace::Current() ? Trace::Current()->shared_from_this()
+                               : nullptr) {
+  }
+
+  const std::vector<Logged*> entries;
+  std::vector<util::Status>* const statuses;
+  util::Task* const task;
+  std::vector<std::string> paths;
+  std::vector<EtcdClient::Response> create_resps;
+  std::vector<EtcdClient::GetResponse> get_resps;
+  std::atomic<size_t> num_left;
+  const std::chrono::steady_clock::time_point started_at;
+  // The trace of the request adding the entries, if any.
+  const std::shared_ptr<Trace> trace;
+};
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::AddPendingEntries(
+    const std::vector<Logged*>& entries, std::vector<util::Status>* statuses) {
+  util::SyncTask task(executor_);
+  AddPendingEntriesAsync(entries, statuses, task.task());
+  task.Wait();
+}
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::AddPendingEntriesAsync(
+    const std::vector<Logged*>& entries, std::vector<util::Status>* statuses,
+    util::Task* task) {
+  CHECK_NOTNULL(statuses);
+  CHECK_NOTNULL(task);
+  const util::Status status(MaybeReject("add_pending_entries"));
+  if (!status.ok() || entries.empty()) {
+    statuses->assign(entries.size(), status);
+    task->Return();
+    return;
+  }
+
+  statuses->assign(entries.size(), util::Status::OK);
+  AddPendingEntriesState* const state(
+      new AddPendingEntriesState(entries, statuses, task));
+  task->DeleteWhenDone(state);
+  for (size_t i = 0; i < entries.size(); ++i) {
+    CHECK_NOTNULL(entries[i]);
+    CHECK(!entries[i]->has_sequence_number());
+    state->paths[i] = GetEntryPath(*entries[i]);
+    client_->Create(state->paths[i], EncodeEntry(*entries[i]),
+                    &state->create_resps[i],
+                    task->AddChild(
+                        std::bind(&EtcdConsistentStore::PendingEntryCreated,
+                                  this, state, i, std::placeholders::_1)));
+  }
+}
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::PendingEntryCreated(
+    AddPendingEntriesState* state, size_t index, util::Task* task) {
+  if (task->status().CanonicalCode() == util::error::FAILED_PRECONDITION) {
+    // Entry with that hash already exists.
+    ScopedTrace scoped_trace(state->trace);
+    client_->Get(EtcdClient::Request(state->paths[index]),
+                 &state->get_resps[index],
+                 state->task->AddChild(std::bind(
+                     &EtcdConsistentStore::PreexistingPendingEntryFetched,
+                     this, state, index, std::placeholders::_1)));
+    return;
+  }
+
+  (*state->statuses)[index] = task->status();
+  PendingEntryDone(state);
+}
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::PreexistingPendingEntryFetched(
+    AddPendingEntriesState* state, size_t index, util::Task* task) {
+  util::Status status(task->status());
+  Logged preexisting;
+  if (status.ok()) {
+    status = DecodeEntry(state->get_resps[index].node.value_, &preexisting);
+  }
+  (*state->statuses)[index] =
+      UsePreexistingPendingEntry(state->paths[index], status, preexisting,
+                                 state->entries[index]);
+  PendingEntryDone(state);
+}
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::PendingEntryDone(
+    AddPendingEntriesState* state) {
+  if (--state->num_left > 0) {
+    return;
+  }
+  const std::chrono::steady_clock::time_point now(
+      std::chrono::steady_clock::now());
+  etcd_latency_by_op_ms.RecordLatency("add_pending_entries",
+                                      now - state->started_at);
+  if (state->trace) {
+    state->trace->AddSpan("etcd_add_pending_entries", state->started_at, now);
+  }
+  state->task->Return();
+}
+
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::GetPreexistingPendingEntry(
+    const std::string& path, Logged* entry) const {
+  EntryHandle<Logged> preexisting_entry;
+  const util::Status status(GetEntry(path, &preexisting_entry));
+  return UsePreexistingPendingEntry(path, status, preexisting_entry.Entry(),
+                                    entry);
+}
+
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::UsePreexistingPendingEntry(
+    const std::string& path, const util::Status& status,
+    const Logged& preexisting, Logged* entry) const {
+  if (!status.ok()) {
+    LOG(ERROR) << "Couldn't create or fetch " << path << " : " << status;
+    return status;
+  }
+  DropEntryBlob(*entry, preexisting);
+
+  // Check the leaf certs are the same (we might be seeing the same cert
+  // submitted with a different chain.)
+  CHECK(LeafEntriesMatch(preexisting, *entry));
+  *entry->mutable_sct() = preexisting.sct();
+  return util::Status(util::error::ALREADY_EXISTS,
+                      "Pending entry already exists.");
+}
+
 template <class Logged>
 util::Status EtcdConsistentStore<Logged>::GetPendingEntryForHash(
     const std::string& hash, EntryHandle<Logged>* entry) const {
@@ -347,6 +559,20 @@ util::Status EtcdConsistentStore<Logged>::GetPendingEntries(
   ScopedLatency scoped_latency(
       etcd_latency_by_op_ms.GetScopedLatency("get_pending_entries"));
 
+  if (FLAGS_etcd_cache_pending_entries) {
+    std::lock_guard<std::mutex> lock(pending_entries_mutex_);
+    if (pending_entries_synced_) {
+      CHECK_NOTNULL(entries);
+      CHECK(entries->empty());
+      entries->reserve(pending_entries_.size());
+      for (const auto& entry : pending_entries_) {
+        entries->emplace_back(entry.second);
+      }
+      etcd_total_entries->Set("entries", entries->size());
+      return util::Status::OK;
+    }
+  }
+
   util::Status status(GetAllEntriesInDir(GetFullPath(kEntriesDir), entries));
   if (status.ok()) {
     for (const auto& entry : *entries) {
@@ -364,42 +590,81 @@ util::Status EtcdConsistentStore<Logged>::GetSequenceMapping(
   ScopedLatency scoped_latency(
       etcd_latency_by_op_ms.GetScopedLatency("get_sequence_mapping"));
 
-  util::Status status(GetEntry(GetFullPath(kSequenceFile), sequence_mapping));
+  std::vector<EntryHandle<ct::SequenceMapping>> shards;
+  util::Status status(GetSequenceMappingShards(&shards));
   if (!status.ok()) {
     return status;
   }
-  CheckMappingIsOrdered(sequence_mapping->Entry());
-  CheckMappingIsContiguousWithServingTree(sequence_mapping->Entry());
-  etcd_total_entries->Set("sequenced",
-                          sequence_mapping->Entry().mapping_size());
+  ct::SequenceMapping mapping;
+  for (const auto& shard : shards) {
+    mapping.mutable_mapping()->MergeFrom(shard.Entry().mapping());
+  }
+  CheckMappingIsOrdered(mapping);
+  CheckMappingIsContiguousWithServingTree(mapping);
+  etcd_total_entries->Set("sequenced", mapping.mapping_size());
+  sequence_mapping->SetKey(GetFullPath(kSequenceMappingsDir));
+  sequence_mapping->MutableEntry()->Swap(&mapping);
   return util::Status::OK;
 }
 
 
 template <class Logged>
-util::Status EtcdConsistentStore<Logged>::UpdateSequenceMapping(
-    EntryHandle<ct::SequenceMapping>* entry) {
+util::Status EtcdConsistentStore<Logged>::AddSequenceMappings(
+    const ct::SequenceMapping& mappings) {
   ScopedLatency scoped_latency(
-      etcd_latency_by_op_ms.GetScopedLatency("update_sequence_mapping"));
+      etcd_latency_by_op_ms.GetScopedLatency("add_sequence_mappings"));
 
-  CHECK(entry->HasHandle());
-  CheckMappingIsOrdered(entry->Entry());
-  CheckMappingIsContiguousWithServingTree(entry->Entry());
-  return UpdateEntry(entry);
+  if (mappings.mapping_size() == 0) {
+    return util::Status::OK;
+  }
+  for (int i = 0; i < mappings.mapping_size() - 1; ++i) {
+    CHECK_EQ(mappings.mapping(i).sequence_number() + 1,
+             mappings.mapping(i + 1).sequence_number());
+  }
+
+  // Creating the shard fails if another node has already mapped entries
+  // from the same sequence number.
+  EntryHandle<ct::SequenceMapping> shard(
+      GetSequenceMappingShardPath(mappings.mapping(0).sequence_number()),
+      mappings);
+  return CreateEntry(&shard);
 }
 
 
 template <class Logged>
 util::StatusOr<ct::ClusterNodeState>
 EtcdConsistentStore<Logged>::GetClusterNodeState() const {
+  return GetClusterNodeState(false);
+}
+
+
+template <class Logged>
+util::StatusOr<ct::ClusterNodeState>
+EtcdConsistentStore<Logged>::GetClusterNodeState(bool consistent) const {
+  const std::chrono::steady_clock::time_point now(
+      std::chrono::steady_clock::now());
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!consistent && node_state_ && IsFresh(node_state_confirmed_, now)) {
+      return *node_state_;
+    }
+  }
+
   ScopedLatency scoped_latency(
       etcd_latency_by_op_ms.GetScopedLatency("get_cluster_node_state"));
 
   EntryHandle<ct::ClusterNodeState> handle;
-  util::Status status(GetEntry(GetNodePath(node_id_), &handle));
+  util::Status status(GetEntry(GetNodePath(node_id_), &handle, consistent));
   if (!status.ok()) {
     return status;
   }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Unless the state was written since this read started.
+  if (!node_state_ || node_state_confirmed_ <= now) {
+    node_state_.reset(new ct::ClusterNodeState(handle.Entry()));
+    node_state_confirmed_ = now;
+  }
   return handle.Entry();
 }
 
@@ -416,7 +681,13 @@ util::Status EtcdConsistentStore<Logged>::SetClusterNodeState(
   local_state.set_node_id(node_id_);
   EntryHandle<ct::ClusterNodeState> entry(GetNodePath(node_id_), local_state);
   const std::chrono::seconds ttl(FLAGS_node_state_ttl_seconds);
-  return ForceSetEntryWithTTL(ttl, &entry);
+  const util::Status status(ForceSetEntryWithTTL(ttl, &entry));
+  if (status.ok()) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    node_state_.reset(new ct::ClusterNodeState(local_state));
+    node_state_confirmed_ = std::chrono::steady_clock::now();
+  }
+  return status;
 }
 
 
@@ -510,20 +781,25 @@ util::Status EtcdConsistentStore<Logged>::SetClusterConfig(
 template <class Logged>
 template <class T>
 util::Status EtcdConsistentStore<Logged>::GetEntry(
-    const std::string& path, EntryHandle<T>* entry) const {
+    const std::string& path, EntryHandle<T>* entry, bool quorum) const {
   ScopedLatency scoped_latency(
       etcd_latency_by_op_ms.GetScopedLatency("get_entry"));
 
   CHECK_NOTNULL(entry);
   util::SyncTask task(executor_);
+  EtcdClient::Request req(path);
+  req.quorum = quorum;
   EtcdClient::GetResponse resp;
-  client_->Get(path, &resp, task.task());
+  client_->Get(req, &resp, task.task());
   task.Wait();
   if (!task.status().ok()) {
     return task.status();
   }
   T t;
-  CHECK(t.ParseFromString(util::FromBase64(resp.node.value_.c_str())));
+  const util::Status status(DecodeEntry(resp.node.value_, &t));
+  if (!status.ok()) {
+    return status;
+  }
   entry->Set(path, t, resp.node.modified_index_);
   return util::Status::OK;
 }
@@ -551,9 +827,11 @@ util::Status EtcdConsistentStore<Logged>::GetAllEntriesInDir(
   }
   for (const auto& node : resp.node.nodes_) {
     T t;
-    CHECK(t.ParseFromString(util::FromBase64(node.value_.c_str())));
-    entries->emplace_back(
-        EntryHandle<Logged>(node.key_, t, node.modified_index_));
+    if (!DecodeEntry(node.value_, &t).ok()) {
+      // Removed by a cleanup since.
+      continue;
+    }
+    entries->emplace_back(EntryHandle<T>(node.key_, t, node.modified_index_));
   }
   return util::Status::OK;
 }
@@ -568,11 +846,9 @@ util::Status EtcdConsistentStore<Logged>::UpdateEntry(EntryHandle<T>* t) {
   CHECK_NOTNULL(t);
   CHECK(t->HasHandle());
   CHECK(t->HasKey());
-  std::string flat_entry;
-  CHECK(t->Entry().SerializeToString(&flat_entry));
   util::SyncTask task(executor_);
   EtcdClient::Response resp;
-  client_->Update(t->Key(), util::ToBase64(flat_entry), t->Handle(), &resp,
+  client_->Update(t->Key(), EncodeEntry(t->Entry()), t->Handle(), &resp,
                   task.task());
   task.Wait();
   if (task.status().ok()) {
@@ -591,11 +867,9 @@ util::Status EtcdConsistentStore<Logged>::CreateEntry(EntryHandle<T>* t) {
   CHECK_NOTNULL(t);
   CHECK(!t->HasHandle());
   CHECK(t->HasKey());
-  std::string flat_entry;
-  CHECK(t->Entry().SerializeToString(&flat_entry));
   util::SyncTask task(executor_);
   EtcdClient::Response resp;
-  client_->Create(t->Key(), util::ToBase64(flat_entry), &resp, task.task());
+  client_->Create(t->Key(), EncodeEntry(t->Entry()), &resp, task.task());
   task.Wait();
   if (task.status().ok()) {
     t->SetHandle(resp.etcd_index);
@@ -617,11 +891,9 @@ util::Status EtcdConsistentStore<Logged>::ForceSetEntry(EntryHandle<T>* t) {
   // calling code should be doing an UpdateEntry() here since they have the
   // handle.
   CHECK(!t->HasHandle());
-  std::string flat_entry;
-  CHECK(t->Entry().SerializeToString(&flat_entry));
   util::SyncTask task(executor_);
   EtcdClient::Response resp;
-  client_->ForceSet(t->Key(), util::ToBase64(flat_entry), &resp, task.task());
+  client_->ForceSet(t->Key(), EncodeEntry(t->Entry()), &resp, task.task());
   task.Wait();
   if (task.status().ok()) {
     t->SetHandle(resp.etcd_index);
@@ -645,11 +917,9 @@ util::Status EtcdConsistentStore<Logged>::ForceSetEntryWithTTL(
   // the handle.
   CHECK(!t->HasHandle());
   CHECK_LE(0, ttl.count());
-  std::string flat_entry;
-  CHECK(t->Entry().SerializeToString(&flat_entry));
   util::SyncTask task(executor_);
   EtcdClient::Response resp;
-  client_->ForceSetWithTTL(t->Key(), util::ToBase64(flat_entry), ttl, &resp,
+  client_->ForceSetWithTTL(t->Key(), EncodeEntry(t->Entry()), ttl, &resp,
                            task.task());
   task.Wait();
   if (task.status().ok()) {
@@ -675,6 +945,103 @@ util::Status EtcdConsistentStore<Logged>::DeleteEntry(EntryHandle<T>* entry) {
 }
 
 
+template <class Logged>
+template <class T>
+std::string EtcdConsistentStore<Logged>::EncodeEntry(const T& entry) const {
+  std::string flat_entry;
+  CHECK(entry.SerializeToString(&flat_entry));
+  return util::ToBase64(flat_entry);
+}
+
+
+template <class Logged>
+std::string EtcdConsistentStore<Logged>::EncodeEntry(
+    const Logged& entry) const {
+  std::string flat_entry;
+  CHECK(entry.SerializeToString(&flat_entry));
+  if (!entry_blobs_) {
+    return util::ToBase64(flat_entry);
+  }
+  CHECK(!entry.has_blob_key());
+
+  // The blobs are keyed by their contents, so that concurrent writers of
+  // entries for the same leaf (say, with different chains) do not
+  // overwrite each other's blob: only the stub that etcd takes is used.
+  const std::string blob_key(Sha256Hasher::Sha256Digest(flat_entry));
+  const util::Status status(entry_blobs_->CreateEntry(blob_key, flat_entry));
+  // If it already exists, this is a retry of the same entry.
+  CHECK(status.ok() ||
+        status.CanonicalCode() == util::error::ALREADY_EXISTS)
+      << status;
+
+  ct::LoggedEntryPB stub;
+  stub.mutable_contents();
+  stub.set_blob_key(blob_key);
+  std::string flat_stub;
+  CHECK(stub.SerializeToString(&flat_stub));
+  return util::ToBase64(flat_stub);
+}
+
+
+template <class Logged>
+template <class T>
+util::Status EtcdConsistentStore<Logged>::DecodeEntry(const std::string& value,
+                                                      T* entry) const {
+  CHECK(entry->ParseFromString(util::FromBase64(value.c_str()))) << value;
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::DecodeEntry(const std::string& value,
+                                                      Logged* entry) const {
+  CHECK(entry->ParseFromString(util::FromBase64(value.c_str()))) << value;
+  return ReadEntryBlob(entry);
+}
+
+
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::ReadEntryBlob(Logged* entry) const {
+  if (!entry->has_blob_key()) {
+    return util::Status::OK;
+  }
+  CHECK(entry_blobs_) << "Found the stub of an entry in etcd, but there is "
+                      << "no entry blob store.";
+  std::string flat_entry;
+  const util::Status status(
+      entry_blobs_->LookupEntry(entry->blob_key(), &flat_entry));
+  if (!status.ok()) {
+    CHECK_EQ(util::error::NOT_FOUND, status.CanonicalCode()) << status;
+    return status;
+  }
+  CHECK_EQ(entry->blob_key(), Sha256Hasher::Sha256Digest(flat_entry));
+  CHECK(entry->ParseFromString(flat_entry));
+  return util::Status::OK;
+}
+
+
+template <class Logged>
+void EtcdConsistentStore<Logged>::DropEntryBlob(
+    const Logged& entry, const Logged& preexisting) const {
+  if (!entry_blobs_) {
+    return;
+  }
+  std::string flat_entry;
+  CHECK(entry.SerializeToString(&flat_entry));
+  std::string flat_preexisting;
+  CHECK(preexisting.SerializeToString(&flat_preexisting));
+  if (flat_entry == flat_preexisting) {
+    return;
+  }
+  const util::Status status(
+      entry_blobs_->DeleteEntry(Sha256Hasher::Sha256Digest(flat_entry)));
+  if (!status.ok()) {
+    LOG(WARNING) << "Couldn't remove the blob of a duplicate entry: "
+                 << status;
+  }
+}
+
+
 template <class Logged>
 std::string EtcdConsistentStore<Logged>::GetEntryPath(
     const Logged& entry) const {
@@ -705,6 +1072,60 @@ std::string EtcdConsistentStore<Logged>::GetFullPath(
 }
 
 
+template <class Logged>
+std::string EtcdConsistentStore<Logged>::GetSequenceMappingShardPath(
+    int64_t first_sequence_number) const {
+  CHECK_GE(first_sequence_number, 0);
+  // Zero-padded, so that the shards sort by sequence number.
+  std::ostringstream key;
+  key << kSequenceMappingsDir << std::setfill('0') << std::setw(20)
+      << first_sequence_number;
+  return GetFullPath(key.str());
+}
+
+
+template <class Logged>
+util::Status EtcdConsistentStore<Logged>::GetSequenceMappingShards(
+    std::vector<EntryHandle<ct::SequenceMapping>>* shards) const {
+  CHECK_NOTNULL(shards);
+  CHECK(shards->empty());
+
+  EntryHandle<ct::SequenceMapping> legacy;
+  util::Status status(GetEntry(GetFullPath(kSequenceFile), &legacy));
+  if (status.ok()) {
+    shards->emplace_back(std::move(legacy));
+  } else if (status.CanonicalCode() != util::error::NOT_FOUND) {
+    return status;
+  }
+
+  std::vector<EntryHandle<ct::SequenceMapping>> dir_shards;
+  status = GetAllEntriesInDir(GetFullPath(kSequenceMappingsDir), &dir_shards);
+  if (!status.ok() && status.CanonicalCode() != util::error::NOT_FOUND) {
+    return status;
+  }
+  for (auto& shard : dir_shards) {
+    shards->emplace_back(std::move(shard));
+  }
+
+  shards->erase(
+      std::remove_if(shards->begin(), shards->end(),
+                     [](const EntryHandle<ct::SequenceMapping>& shard) {
+                       return shard.Entry().mapping_size() == 0;
+                     }),
+      shards->end());
+  for (const auto& shard : *shards) {
+    CheckMappingIsOrdered(shard.Entry());
+  }
+  std::sort(shards->begin(), shards->end(),
+            [](const EntryHandle<ct::SequenceMapping>& a,
+               const EntryHandle<ct::SequenceMapping>& b) {
+              return a.Entry().mapping(0).sequence_number() <
+                     b.Entry().mapping(0).sequence_number();
+            });
+  return util::Status::OK;
+}
+
+
 template <class Logged>
 void EtcdConsistentStore<Logged>::CheckMappingIsContiguousWithServingTree(
     const ct::SequenceMapping& mapping) const {
@@ -741,14 +1162,18 @@ template <class Logged>
 template <class T>
 Update<T> EtcdConsistentStore<Logged>::TypedUpdateFromNode(
     const EtcdClient::Node& node) {
+  if (node.deleted_) {
+    // Deleted nodes come without a value.
+    EntryHandle<T> handle;
+    handle.SetKey(node.key_);
+    return Update<T>(handle, false /* exists */);
+  }
   const std::string raw_value(util::FromBase64(node.value_.c_str()));
   T thing;
   CHECK(thing.ParseFromString(raw_value)) << raw_value;
   EntryHandle<T> handle(node.key_, thing);
-  if (!node.deleted_) {
-    handle.SetHandle(node.modified_index_);
-  }
-  return Update<T>(handle, !node.deleted_);
+  handle.SetHandle(node.modified_index_);
+  return Update<T>(handle, true /* exists */);
 }
 
 
@@ -779,6 +1204,7 @@ void EtcdConsistentStore<Logged>::OnEtcdServingSTHUpdated(
     // TODO(alcutter): What to do here?
     serving_sth_.reset();
   }
+  serving_sth_confirmed_ = std::chrono::steady_clock::now();
   received_initial_sth_ = true;
   lock.unlock();
   serving_sth_cv_.notify_all();
@@ -818,29 +1244,69 @@ util::StatusOr<int64_t> EtcdConsistentStore<Logged>::CleanupOldEntries() {
   }
   const int64_t clean_up_to_sequence_number(serving_sth_->Entry().tree_size() -
                                             1);
+  const int64_t cleaned_up_to(cleaned_up_to_);
   lock.unlock();
 
-  LOG(INFO) << "Cleaning old entries up to and including sequence number: "
+  LOG(INFO) << "Cleaning old entries after sequence number " << cleaned_up_to
+            << ", up to and including sequence number: "
             << clean_up_to_sequence_number;
 
-  EntryHandle<ct::SequenceMapping> sequence_mapping;
-  util::Status status(GetSequenceMapping(&sequence_mapping));
+  std::vector<EntryHandle<ct::SequenceMapping>> shards;
+  util::Status status(GetSequenceMappingShards(&shards));
   if (!status.ok()) {
     LOG(WARNING) << "Couldn't get sequence mapping: " << status;
     return status;
   }
 
+  // Walks the shards in order of sequence number, skipping the entries
+  // deleted by previous runs, and stopping after
+  // --etcd_cleanup_max_entries_per_run of them.
   std::vector<std::string> keys_to_delete;
-  for (int mapping_index = 0;
-       mapping_index < sequence_mapping.Entry().mapping_size() &&
-       sequence_mapping.Entry().mapping(mapping_index).sequence_number() <=
-           clean_up_to_sequence_number;
-       ++mapping_index) {
-    // Delete the entry from /entries.
-    keys_to_delete.emplace_back(GetEntryPath(
-        sequence_mapping.Entry().mapping(mapping_index).entry_hash()));
+  int64_t last_sequence_number(cleaned_up_to);
+  for (const auto& shard : shards) {
+    const ct::SequenceMapping& mapping(shard.Entry());
+    for (int mapping_index = 0;
+         mapping_index < mapping.mapping_size() &&
+         mapping.mapping(mapping_index).sequence_number() <=
+             clean_up_to_sequence_number &&
+         keys_to_delete.size() <
+             static_cast<size_t>(FLAGS_etcd_cleanup_max_entries_per_run);
+         ++mapping_index) {
+      const int64_t sequence_number(
+          mapping.mapping(mapping_index).sequence_number());
+      if (sequence_number <= cleaned_up_to) {
+        continue;
+      }
+      // Delete the entry from /entries.
+      keys_to_delete.emplace_back(
+          GetEntryPath(mapping.mapping(mapping_index).entry_hash()));
+      last_sequence_number = sequence_number;
+    }
   }
 
+  // The stubs are small, so rather than reading the ones to delete one
+  // by one, read them all to find the blobs to remove.
+  std::vector<std::string> blob_keys;
+  if (entry_blobs_ && !keys_to_delete.empty()) {
+    std::vector<EntryHandle<ct::LoggedEntryPB>> stubs;
+    status = GetAllEntriesInDir(GetFullPath(kEntriesDir), &stubs);
+    if (!status.ok() && status.CanonicalCode() != util::error::NOT_FOUND) {
+      LOG(WARNING) << "Couldn't get the pending entries: " << status;
+      return status;
+    }
+    std::unordered_map<std::string, std::string> blob_key_by_path;
+    for (const auto& stub : stubs) {
+      if (stub.Entry().has_blob_key()) {
+        blob_key_by_path[stub.Key()] = stub.Entry().blob_key();
+      }
+    }
+    for (const auto& key : keys_to_delete) {
+      const auto it(blob_key_by_path.find(key));
+      if (it != blob_key_by_path.end()) {
+        blob_keys.emplace_back(it->second);
+      }
+    }
+  }
 
   const int64_t num_entries_cleaned(keys_to_delete.size());
   util::SyncTask task(executor_);
@@ -849,11 +1315,71 @@ util::StatusOr<int64_t> EtcdConsistentStore<Logged>::CleanupOldEntries() {
   status = task.status();
   if (!status.ok()) {
     LOG(WARNING) << "EtcdDeleteKeys failed: " << task.status();
+    return status;
+  }
+
+  // Only once their stubs are gone.
+  for (const auto& blob_key : blob_keys) {
+    const util::Status blob_status(entry_blobs_->DeleteEntry(blob_key));
+    if (!blob_status.ok()) {
+      LOG(WARNING) << "Couldn't remove entry blob: " << blob_status;
+    }
+  }
+
+  lock.lock();
+  cleaned_up_to_ = std::max(cleaned_up_to_, last_sequence_number);
+  lock.unlock();
+
+  // Only drop the shards once all their entries are gone, so that they
+  // get retried otherwise.
+  for (auto& shard : shards) {
+    const ct::SequenceMapping& mapping(shard.Entry());
+    if (mapping.mapping(mapping.mapping_size() - 1).sequence_number() >
+        last_sequence_number) {
+      break;
+    }
+    status = DeleteEntry(&shard);
+    if (!status.ok()) {
+      LOG(WARNING) << "Couldn't delete sequence mapping shard "
+                   << shard.Key() << ": " << status;
+    }
   }
   return num_entries_cleaned;
 }
 
 
+template <class Logged>
+void EtcdConsistentStore<Logged>::OnPendingEntriesUpdated(
+    const std::vector<Update<Logged>>& updates) {
+  // Read the blobs of the stubs before taking the lock.
+  std::vector<EntryHandle<Logged>> handles;
+  std::vector<bool> exists;
+  handles.reserve(updates.size());
+  exists.reserve(updates.size());
+  for (const auto& update : updates) {
+    handles.emplace_back(update.handle_);
+    exists.push_back(update.exists_ &&
+                     ReadEntryBlob(handles.back().MutableEntry()).ok());
+  }
+
+  std::lock_guard<std::mutex> lock(pending_entries_mutex_);
+  for (size_t i = 0; i < handles.size(); ++i) {
+    const EntryHandle<Logged>& handle(handles[i]);
+    if (exists[i]) {
+      CHECK(!handle.Entry().has_sequence_number());
+      pending_entries_[handle.Key()] = handle;
+    } else {
+      pending_entries_.erase(handle.Key());
+    }
+  }
+  if (!pending_entries_synced_) {
+    VLOG(1) << "Pending entries cache synced with " << pending_entries_.size()
+            << " entries.";
+    pending_entries_synced_ = true;
+  }
+}
+
+
 template <class Logged>
 void EtcdConsistentStore<Logged>::StartEtcdStatsFetch() {
   if (etcd_stats_task_.task()->CancelRequested()) {
@@ -2,6 +2,9 @@
 #define CERT_TRANS_LOG_ETCD_CONSISTENT_STORE_H_
 
 #include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <vector>
@@ -16,6 +19,7 @@
 
 namespace cert_trans {
 
+class FileStorage;
 class MasterElection;
 
 
@@ -25,34 +29,77 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
   // No change of ownership for |client|, |executor| must continue to be valid
   // at least as long as this object is, and should not be the libevent::Base
   // used by |client|.
+  //
+  // If |entry_blobs| is set (this takes ownership of it), the pending
+  // entries are written to it, and etcd only holds stubs naming their
+  // blobs, so it must be shared by all the nodes of the cluster. Entries
+  // written without it are still read from etcd as before.
   EtcdConsistentStore(libevent::Base* base, util::Executor* executor,
                       EtcdClient* client, const MasterElection* election,
-                      const std::string& root, const std::string& node_id);
+                      const std::string& root, const std::string& node_id,
+                      FileStorage* entry_blobs = nullptr);
 
   virtual ~EtcdConsistentStore();
 
+  // This is on the sequencing path of the master, so it always reads the
+  // sequence mappings from etcd, with a quorum read.
   util::StatusOr<int64_t> NextAvailableSequenceNumber() const override;
 
   util::Status SetServingSTH(const ct::SignedTreeHead& new_sth) override;
 
+  // Same as GetServingSTH(false).
   util::StatusOr<ct::SignedTreeHead> GetServingSTH() const override;
 
+  // Unless |consistent|, this returns the copy of the serving STH kept
+  // by its watch, provided that etcd confirmed it less than
+  // --etcd_read_cache_max_staleness_seconds ago, or else checks it with
+  // a read that any etcd server can answer. If |consistent|, it is
+  // always read from etcd, with a quorum read.
+  util::StatusOr<ct::SignedTreeHead> GetServingSTH(bool consistent) const;
+
   util::Status AddPendingEntry(Logged* entry) override;
 
+  // Sends the creation requests of all of |entries| at once, so that the
+  // batch waits for about one etcd write, rather than one per entry.
+  void AddPendingEntries(const std::vector<Logged*>& entries,
+                         std::vector<util::Status>* statuses) override;
+
+  // Does not block: the callbacks of the etcd requests run on the
+  // executor of |task|.
+  void AddPendingEntriesAsync(const std::vector<Logged*>& entries,
+                              std::vector<util::Status>* statuses,
+                              util::Task* task) override;
+
   util::Status GetPendingEntryForHash(
       const std::string& hash, EntryHandle<Logged>* entry) const override;
 
+  // Unless --etcd_cache_pending_entries is false, this returns the entries
+  // from a local cache, kept current by watching the entries directory, as
+  // soon as the watch got its initial view. So it can miss the most recent
+  // changes of the pending entries, and callers needing an entry to still
+  // exist should check it with GetPendingEntryForHash().
   util::Status GetPendingEntries(
       std::vector<EntryHandle<Logged>>* entries) const override;
 
   util::Status GetSequenceMapping(
       EntryHandle<ct::SequenceMapping>* entry) const override;
 
-  util::Status UpdateSequenceMapping(
-      EntryHandle<ct::SequenceMapping>* entry) override;
+  // Each call writes a new shard, keyed by the first sequence number of
+  // |mappings|.
+  util::Status AddSequenceMappings(
+      const ct::SequenceMapping& mappings) override;
 
+  // Same as GetClusterNodeState(false).
   util::StatusOr<ct::ClusterNodeState> GetClusterNodeState() const override;
 
+  // Unless |consistent|, this returns the state of this node as last
+  // written or read here, if that was less than
+  // --etcd_read_cache_max_staleness_seconds ago, and otherwise reads it
+  // from any etcd server. If |consistent|, it is always read from etcd,
+  // with a quorum read.
+  util::StatusOr<ct::ClusterNodeState> GetClusterNodeState(
+      bool consistent) const;
+
   util::Status SetClusterNodeState(const ct::ClusterNodeState& state) override;
 
   void WatchServingSTH(
@@ -70,15 +117,23 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
   util::Status SetClusterConfig(const ct::ClusterConfig& config) override;
 
   // Removes sequenced entries with sequence numbers covered by the current
-  // serving STH.
+  // serving STH (and their blobs), and the sequence mapping shards that
+  // only map such entries. Each call removes at most
+  // --etcd_cleanup_max_entries_per_run entries, in order of sequence
+  // number, carrying on after those removed by the previous calls (on
+  // this node), and returns how many it removed.
   util::StatusOr<int64_t> CleanupOldEntries() override;
 
  private:
+  struct AddPendingEntriesState;
+
   void WaitForServingSTHVersion(std::unique_lock<std::mutex>* lock,
                                 const int version);
 
+  // Unless |quorum|, the read can be answered by any etcd server.
   template <class T>
-  util::Status GetEntry(const std::string& path, EntryHandle<T>* entry) const;
+  util::Status GetEntry(const std::string& path, EntryHandle<T>* entry,
+                        bool quorum = true) const;
 
   template <class T>
   util::Status GetAllEntriesInDir(const std::string& dir,
@@ -90,6 +145,28 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
   template <class T>
   util::Status CreateEntry(EntryHandle<T>* entry);
 
+  // Returns the value to store in etcd for |entry|.
+  template <class T>
+  std::string EncodeEntry(const T& entry) const;
+  // With an entry blob store, writes the blob of |entry| and returns its
+  // stub.
+  std::string EncodeEntry(const Logged& entry) const;
+
+  // Parses |value|, as returned by EncodeEntry().
+  template <class T>
+  util::Status DecodeEntry(const std::string& value, T* entry) const;
+  // Also replaces a stub by its blob (see ReadEntryBlob()).
+  util::Status DecodeEntry(const std::string& value, Logged* entry) const;
+
+  // If |entry| is a stub, replaces it by the entry in its blob, or
+  // returns NOT_FOUND if the blob has been removed by a cleanup since.
+  util::Status ReadEntryBlob(Logged* entry) const;
+
+  // Called when |entry| could not be added because |preexisting| was
+  // already there, to remove the blob written for it, unless they are
+  // the same.
+  void DropEntryBlob(const Logged& entry, const Logged& preexisting) const;
+
   template <class T>
   util::Status ForceSetEntry(EntryHandle<T>* entry);
 
@@ -108,6 +185,14 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
 
   std::string GetFullPath(const std::string& key) const;
 
+  std::string GetSequenceMappingShardPath(int64_t first_sequence_number) const;
+
+  // Fetches the non-empty sequence mapping shards, ordered by sequence
+  // number. This includes the single mapping file used by older
+  // versions, if it is still present.
+  util::Status GetSequenceMappingShards(
+      std::vector<EntryHandle<ct::SequenceMapping>>* shards) const;
+
   void CheckMappingIsContiguousWithServingTree(
       const ct::SequenceMapping& mapping) const;
 
@@ -140,29 +225,69 @@ class EtcdConsistentStore : public ConsistentStore<Logged> {
 
   void OnClusterConfigUpdated(const Update<ct::ClusterConfig>& update);
 
+  typedef std::function<void(const std::vector<Update<Logged>>& updates)>
+      PendingEntriesCallback;
+
+  void OnPendingEntriesUpdated(const std::vector<Update<Logged>>& updates);
+
   void StartEtcdStatsFetch();
   void EtcdStatsFetchDone(EtcdClient::StatsResponse* response,
                           util::Task* task);
 
   util::Status MaybeReject(const std::string& type) const;
 
+  // Called when the creation of |entry| at |path| failed because there
+  // is already an entry there, which must be for the same leaf. Sets the
+  // SCT of |entry| to that of the existing one.
+  util::Status GetPreexistingPendingEntry(const std::string& path,
+                                          Logged* entry) const;
+  // The part of GetPreexistingPendingEntry() once |preexisting| has
+  // been read, with |status|.
+  util::Status UsePreexistingPendingEntry(const std::string& path,
+                                          const util::Status& status,
+                                          const Logged& preexisting,
+                                          Logged* entry) const;
+
+  void PendingEntryCreated(AddPendingEntriesState* state, size_t index,
+                           util::Task* task);
+  void PreexistingPendingEntryFetched(AddPendingEntriesState* state,
+                                      size_t index, util::Task* task);
+  void PendingEntryDone(AddPendingEntriesState* state);
+
   EtcdClient* const client_;              // We don't own this.
   libevent::Base* base_;                  // We don't own this.
   util::Executor* const executor_;        // We don't own this.
   const MasterElection* const election_;  // We don't own this.
   const std::string root_;
   const std::string node_id_;
+  const std::unique_ptr<FileStorage> entry_blobs_;
   std::condition_variable serving_sth_cv_;
   util::SyncTask serving_sth_watch_task_;
   util::SyncTask cluster_config_watch_task_;
+  util::SyncTask pending_entries_watch_task_;
   util::SyncTask etcd_stats_task_;
 
   mutable std::mutex mutex_;
   bool received_initial_sth_;
   std::unique_ptr<EntryHandle<ct::SignedTreeHead>> serving_sth_;
+  // When etcd last confirmed |serving_sth_|, by its watch or a read.
+  mutable std::chrono::steady_clock::time_point serving_sth_confirmed_;
+  // The state of this node as last written or read, and when.
+  mutable std::unique_ptr<ct::ClusterNodeState> node_state_;
+  mutable std::chrono::steady_clock::time_point node_state_confirmed_;
   std::unique_ptr<ct::ClusterConfig> cluster_config_;
   bool exiting_;
   int64_t num_etcd_entries_;
+  // The highest sequence number whose entry CleanupOldEntries() removed,
+  // or -1.
+  int64_t cleaned_up_to_;
+
+  mutable std::mutex pending_entries_mutex_;
+  // Whether the watch of the entries directory has delivered its initial
+  // view, after which "pending_entries_" is used by GetPendingEntries().
+  bool pending_entries_synced_;
+  // The pending entries, by etcd key.
+  std::map<std::string, EntryHandle<Logged>> pending_entries_;
 
   friend class EtcdConsistentStoreTest;
   template <class T>
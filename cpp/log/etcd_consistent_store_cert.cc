@@ -9,6 +9,18 @@ DEFINE_int32(etcd_stats_collection_interval_seconds, 2,
              "Number of seconds between fetches of etcd stats.");
 DEFINE_int32(node_state_ttl_seconds, 60,
              "TTL in seconds on the node state files.");
+DEFINE_bool(etcd_cache_pending_entries, true,
+            "Whether to keep the pending entries in memory, using a watch on "
+            "etcd, rather than fetching all of them each time they are "
+            "needed.");
+DEFINE_int32(etcd_read_cache_max_staleness_seconds, 10,
+             "How long the serving STH and the state of this node, once "
+             "confirmed by etcd, are returned without checking them again. "
+             "Zero checks them every time.");
+DEFINE_int32(etcd_cleanup_max_entries_per_run, 10000,
+             "Maximum number of sequenced entries to remove from etcd in each "
+             "run of the cleanup, so that it makes progress in steps when "
+             "there is a large backlog.");
 
 namespace cert_trans {
 template class EtcdConsistentStore<LoggedEntry>;
@@ -12,7 +12,9 @@
 #include <unordered_map>
 #include <unordered_set>
 
+#include "log/file_storage.h"
 #include "log/logged_entry.h"
+#include "merkletree/serial_hasher.h"
 #include "monitoring/registry.h"
 #include "proto/cert_serializer.h"
 #include "proto/ct.pb.h"
@@ -20,12 +22,16 @@
 #include "util/libevent_wrapper.h"
 #include "util/mock_masterelection.h"
 #include "util/status_test_util.h"
+#include "util/test_db.h"
 #include "util/testing.h"
 #include "util/thread_pool.h"
 #include "util/util.h"
 
 DECLARE_int32(node_state_ttl_seconds);
 DECLARE_int32(etcd_stats_collection_interval_seconds);
+DECLARE_bool(etcd_cache_pending_entries);
+DECLARE_int32(etcd_read_cache_max_staleness_seconds);
+DECLARE_int32(etcd_cleanup_max_entries_per_run);
 
 namespace cert_trans {
 
@@ -80,10 +86,14 @@ class EtcdConsistentStoreTest : public ::testing::Test {
   void SetUp() override {
     Registry::Instance()->ResetForTestingOnly();
     FLAGS_etcd_stats_collection_interval_seconds = 1;
+    // Most tests expect their changes to the entries to be visible right
+    // away, see TestGetPendingEntriesFromCache for the cache.
+    FLAGS_etcd_cache_pending_entries = false;
+    FLAGS_etcd_read_cache_max_staleness_seconds = 10;
+    FLAGS_etcd_cleanup_max_entries_per_run = 10000;
     store_.reset(new EtcdConsistentStore<LoggedEntry>(base_.get(), &executor_,
                                                       &client_, &election_,
                                                       kRoot, kNodeId));
-    InsertEntry("/root/sequence_mapping", SequenceMapping());
   }
 
   LoggedEntry DefaultCert() {
@@ -120,19 +130,17 @@ class EtcdConsistentStoreTest : public ::testing::Test {
                                int starting_seq) {
     int timestamp(345345);
     int seq(starting_seq);
-    EntryHandle<SequenceMapping> mapping;
-    Status status(store_->GetSequenceMapping(&mapping));
-    CHECK_EQ(Status::OK, status);
+    SequenceMapping mapping;
     for (int i = 0; i < num_seq; ++i) {
       std::ostringstream ss;
       ss << "sequenced body " << i;
       LoggedEntry lc(MakeCert(timestamp++, ss.str()));
       CHECK(store_->AddPendingEntry(&lc).ok());
-      SequenceMapping::Mapping* m(mapping.MutableEntry()->add_mapping());
+      SequenceMapping::Mapping* m(mapping.add_mapping());
       m->set_entry_hash(lc.Hash());
       m->set_sequence_number(seq++);
     }
-    CHECK_EQ(Status::OK, store_->UpdateSequenceMapping(&mapping));
+    CHECK_EQ(Status::OK, store_->AddSequenceMappings(mapping));
     for (int i = 0; i < num_pending; ++i) {
       std::ostringstream ss;
       ss << "pending body " << i;
@@ -146,13 +154,11 @@ class EtcdConsistentStoreTest : public ::testing::Test {
   }
 
   void AddSequenceMapping(int64_t seq, const string& hash) {
-    EntryHandle<SequenceMapping> mapping;
-    Status status(store_->GetSequenceMapping(&mapping));
-    CHECK_EQ(Status::OK, status);
-    SequenceMapping::Mapping* m(mapping.MutableEntry()->add_mapping());
+    SequenceMapping mapping;
+    SequenceMapping::Mapping* m(mapping.add_mapping());
     m->set_sequence_number(seq);
     m->set_entry_hash(hash);
-    CHECK_EQ(Status::OK, store_->UpdateSequenceMapping(&mapping));
+    CHECK_EQ(Status::OK, store_->AddSequenceMappings(mapping));
   }
 
 
@@ -213,6 +219,26 @@ class EtcdConsistentStoreTest : public ::testing::Test {
     return store_->num_etcd_entries_;
   }
 
+  bool PendingEntriesSynced(const EtcdConsistentStore<LoggedEntry>& store) {
+    std::lock_guard<std::mutex> lock(store.pending_entries_mutex_);
+    return store.pending_entries_synced_;
+  }
+
+  // Waits for |store| to return |num_entries| pending entries.
+  vector<EntryHandle<LoggedEntry>> WaitForPendingEntries(
+      const EtcdConsistentStore<LoggedEntry>& store, size_t num_entries) {
+    vector<EntryHandle<LoggedEntry>> entries;
+    for (int i = 0; i < 100; ++i) {
+      entries.clear();
+      CHECK_EQ(Status::OK, store.GetPendingEntries(&entries));
+      if (entries.size() == num_entries) {
+        break;
+      }
+      std::this_thread::sleep_for(milliseconds(10));
+    }
+    return entries;
+  }
+
 
   shared_ptr<libevent::Base> base_;
   ThreadPool executor_;
@@ -339,6 +365,84 @@ TEST_F(EtcdConsistentStoreTest,
 }
 
 
+TEST_F(EtcdConsistentStoreTest, TestPendingEntriesInBlobStore) {
+  TmpStorage tmp;
+  FileStorage* const blobs(new FileStorage(tmp.TmpStorageDir(), 0));
+  store_.reset(new EtcdConsistentStore<LoggedEntry>(base_.get(), &executor_,
+                                                    &client_, &election_,
+                                                    kRoot, kNodeId, blobs));
+
+  LoggedEntry cert(DefaultCert());
+  ASSERT_OK(store_->AddPendingEntry(&cert));
+
+  // etcd only has a stub, naming the blob.
+  const string kPath(string(kRoot) + "/entries/" +
+                     util::HexString(cert.Hash()));
+  ct::LoggedEntryPB stub;
+  PeekEntry(kPath, &stub);
+  string flat_cert;
+  ASSERT_TRUE(cert.SerializeToString(&flat_cert));
+  EXPECT_EQ(Sha256Hasher::Sha256Digest(flat_cert), stub.blob_key());
+  EXPECT_FALSE(stub.contents().has_entry());
+  EXPECT_OK(blobs->LookupEntry(stub.blob_key(), nullptr));
+
+  EntryHandle<LoggedEntry> entry;
+  ASSERT_OK(store_->GetPendingEntryForHash(cert.Hash(), &entry));
+  EXPECT_EQ(cert, entry.Entry());
+  vector<EntryHandle<LoggedEntry>> entries;
+  ASSERT_OK(store_->GetPendingEntries(&entries));
+  ASSERT_EQ(static_cast<size_t>(1), entries.size());
+  EXPECT_EQ(cert, entries[0].Entry());
+
+  // The blob of a duplicate is removed.
+  LoggedEntry other_cert(DefaultCert());
+  other_cert.mutable_sct()->set_timestamp(55555);
+  EXPECT_THAT(store_->AddPendingEntry(&other_cert),
+              StatusIs(util::error::ALREADY_EXISTS));
+  EXPECT_EQ(cert.timestamp(), other_cert.timestamp());
+  EXPECT_EQ(static_cast<size_t>(1), blobs->Scan().size());
+
+  // And that of a sequenced entry along with its stub.
+  AddSequenceMapping(0, cert.Hash());
+  EXPECT_CALL(election_, IsMaster()).WillRepeatedly(Return(true));
+  SignedTreeHead sth;
+  sth.set_timestamp(kTimestamp);
+  sth.set_tree_size(1);
+  ASSERT_OK(store_->SetServingSTH(sth));
+  const StatusOr<int64_t> num_cleaned(CleanupOldEntries());
+  ASSERT_OK(num_cleaned.status());
+  EXPECT_EQ(1, num_cleaned.ValueOrDie());
+  EXPECT_THAT(blobs->LookupEntry(stub.blob_key(), nullptr),
+              StatusIs(util::error::NOT_FOUND));
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestAddPendingEntriesWorks) {
+  LoggedEntry one(MakeCert(123, "one"));
+  LoggedEntry two(MakeCert(456, "two"));
+  LoggedEntry existing(MakeCert(789, "existing"));
+  LoggedEntry other_existing(existing);
+  other_existing.mutable_sct()->set_timestamp(55555);
+  InsertEntry(string(kRoot) + "/entries/" + util::HexString(existing.Hash()),
+              other_existing);
+
+  vector<Status> statuses;
+  store_->AddPendingEntries({&one, &existing, &two}, &statuses);
+  ASSERT_EQ(3U, statuses.size());
+  EXPECT_EQ(Status::OK, statuses[0]);
+  EXPECT_THAT(statuses[1], StatusIs(util::error::ALREADY_EXISTS));
+  EXPECT_EQ(Status::OK, statuses[2]);
+  EXPECT_EQ(other_existing.timestamp(), existing.timestamp());
+
+  for (const LoggedEntry* cert : {&one, &two}) {
+    EntryHandle<LoggedEntry> handle;
+    EXPECT_EQ(Status::OK, store_->GetPendingEntryForHash(cert->Hash(),
+                                                         &handle));
+    EXPECT_EQ(cert->timestamp(), handle.Entry().timestamp());
+  }
+}
+
+
 TEST_F(EtcdConsistentStoreDeathTest,
        TestAddPendingEntryForExistingNonIdenticalEntry) {
   LoggedEntry cert(DefaultCert());
@@ -403,6 +507,33 @@ TEST_F(EtcdConsistentStoreTest, TestGetPendingEntries) {
 }
 
 
+TEST_F(EtcdConsistentStoreTest, TestGetPendingEntriesFromCache) {
+  FLAGS_etcd_cache_pending_entries = true;
+  EtcdConsistentStore<LoggedEntry> store(base_.get(), &executor_, &client_,
+                                         &election_, kRoot, kNodeId);
+  for (int i = 0; i < 100 && !PendingEntriesSynced(store); ++i) {
+    std::this_thread::sleep_for(milliseconds(10));
+  }
+  ASSERT_TRUE(PendingEntriesSynced(store));
+
+  const string kPath(string(kRoot) + "/entries/");
+  const LoggedEntry one(MakeCert(123, "one"));
+  const LoggedEntry two(MakeCert(456, "two"));
+  InsertEntry(kPath + "one", one);
+  InsertEntry(kPath + "two", two);
+  EXPECT_EQ(static_cast<size_t>(2), WaitForPendingEntries(store, 2).size());
+
+  SyncTask task(base_.get());
+  client_.ForceDelete(kPath + "one", task.task());
+  task.Wait();
+  ASSERT_EQ(Status::OK, task.status());
+  const vector<EntryHandle<LoggedEntry>> entries(
+      WaitForPendingEntries(store, 1));
+  ASSERT_EQ(static_cast<size_t>(1), entries.size());
+  EXPECT_EQ(two, entries[0].Entry());
+}
+
+
 TEST_F(EtcdConsistentStoreDeathTest,
        TestGetPendingEntriesBarfsWithSequencedEntry) {
   const string kPath(string(kRoot) + "/entries/");
@@ -458,62 +589,87 @@ TEST_F(EtcdConsistentStoreDeathTest,
 }
 
 
-TEST_F(EtcdConsistentStoreTest, TestUpdateSequenceMapping) {
-  EntryHandle<SequenceMapping> mapping;
-  Status status(store_->GetSequenceMapping(&mapping));
-  EXPECT_EQ(Status::OK, status);
+TEST_F(EtcdConsistentStoreTest, TestAddSequenceMappings) {
+  SequenceMapping mapping;
+  for (int i = 0; i < 2; ++i) {
+    SequenceMapping::Mapping* m(mapping.add_mapping());
+    m->set_sequence_number(i);
+    m->set_entry_hash(i == 0 ? "zero" : "one");
+  }
+  EXPECT_EQ(Status::OK, store_->AddSequenceMappings(mapping));
+  AddSequenceMapping(2, "two");
+
+  // Each call is written to its own shard.
+  EtcdClient::GetResponse resp;
+  SyncTask task(base_.get());
+  client_.Get(string(kRoot) + "/sequence_mappings/", &resp, task.task());
+  task.Wait();
+  ASSERT_EQ(Status::OK, task.status());
+  EXPECT_EQ(static_cast<size_t>(2), resp.node.nodes_.size());
+
+  EntryHandle<SequenceMapping> merged;
+  EXPECT_EQ(Status::OK, store_->GetSequenceMapping(&merged));
+  ASSERT_EQ(3, merged.Entry().mapping_size());
+  EXPECT_EQ(0, merged.Entry().mapping(0).sequence_number());
+  EXPECT_EQ("zero", merged.Entry().mapping(0).entry_hash());
+  EXPECT_EQ(1, merged.Entry().mapping(1).sequence_number());
+  EXPECT_EQ("one", merged.Entry().mapping(1).entry_hash());
+  EXPECT_EQ(2, merged.Entry().mapping(2).sequence_number());
+  EXPECT_EQ("two", merged.Entry().mapping(2).entry_hash());
+}
 
-  const SequenceMapping original(mapping.Entry());
 
-  SequenceMapping::Mapping* m(mapping.MutableEntry()->add_mapping());
+TEST_F(EtcdConsistentStoreTest, TestAddSequenceMappingsMergesLegacyFile) {
+  SequenceMapping legacy;
+  SequenceMapping::Mapping* m(legacy.add_mapping());
   m->set_sequence_number(0);
   m->set_entry_hash("zero");
-  EXPECT_EQ(Status::OK, store_->UpdateSequenceMapping(&mapping));
+  ForceSetEntry("/root/sequence_mapping", legacy);
+  AddSequenceMapping(1, "one");
+
+  EntryHandle<SequenceMapping> merged;
+  EXPECT_EQ(Status::OK, store_->GetSequenceMapping(&merged));
+  ASSERT_EQ(2, merged.Entry().mapping_size());
+  EXPECT_EQ("zero", merged.Entry().mapping(0).entry_hash());
+  EXPECT_EQ("one", merged.Entry().mapping(1).entry_hash());
+}
 
-  status = store_->GetSequenceMapping(&mapping);
-  EXPECT_EQ(Status::OK, status);
 
-  EXPECT_EQ(mapping.Entry().mapping_size(), original.mapping_size() + 1);
-  EXPECT_EQ(0, mapping.Entry()
-                   .mapping(mapping.Entry().mapping_size() - 1)
-                   .sequence_number());
-  EXPECT_EQ("zero", mapping.Entry()
-                        .mapping(mapping.Entry().mapping_size() - 1)
-                        .entry_hash());
+TEST_F(EtcdConsistentStoreTest, TestAddSequenceMappingsRejectsSameShard) {
+  AddSequenceMapping(0, "zero");
+  SequenceMapping mapping;
+  SequenceMapping::Mapping* m(mapping.add_mapping());
+  m->set_sequence_number(0);
+  m->set_entry_hash("other");
+  EXPECT_THAT(store_->AddSequenceMappings(mapping),
+              StatusIs(util::error::FAILED_PRECONDITION));
 }
 
 
 TEST_F(EtcdConsistentStoreDeathTest,
-       TestUpdateSequenceMappingBarfsWithOutOfOrderSequenceNumber) {
-  EntryHandle<SequenceMapping> mapping;
-  Status status(store_->GetSequenceMapping(&mapping));
-  EXPECT_EQ(Status::OK, status);
-
-  SequenceMapping::Mapping* m1(mapping.MutableEntry()->add_mapping());
+       TestAddSequenceMappingsBarfsWithNonConsecutiveSequenceNumbers) {
+  SequenceMapping mapping;
+  SequenceMapping::Mapping* m1(mapping.add_mapping());
   m1->set_sequence_number(2);
   m1->set_entry_hash("two");
-  SequenceMapping::Mapping* m2(mapping.MutableEntry()->add_mapping());
+  SequenceMapping::Mapping* m2(mapping.add_mapping());
   m2->set_sequence_number(0);
   m2->set_entry_hash("zero");
-  EXPECT_DEATH(store_->UpdateSequenceMapping(&mapping),
-               "sequence_number\\(\\) < mapping");
+  EXPECT_DEATH(store_->AddSequenceMappings(mapping),
+               "sequence_number\\(\\) \\+ 1");
 }
 
+
 TEST_F(EtcdConsistentStoreDeathTest,
-       TestUpdateSequenceMappingBarfsMappingNonContiguousToServingTree) {
+       TestGetSequenceMappingBarfsMappingNonContiguousToServingTree) {
   SignedTreeHead sth;
   sth.set_timestamp(123);
   sth.set_tree_size(1000);
   CHECK_EQ(Status::OK, store_->SetServingSTH(sth));
 
+  AddSequenceMapping(sth.tree_size() + 1, "zero");
   EntryHandle<SequenceMapping> mapping;
-  Status status(store_->GetSequenceMapping(&mapping));
-  EXPECT_EQ(Status::OK, status);
-
-  SequenceMapping::Mapping* m1(mapping.MutableEntry()->add_mapping());
-  m1->set_sequence_number(sth.tree_size() + 1);
-  m1->set_entry_hash("zero");
-  EXPECT_DEATH(store_->UpdateSequenceMapping(&mapping),
+  EXPECT_DEATH(store_->GetSequenceMapping(&mapping),
                "lowest_sequence_number <= tree_size");
 }
 
@@ -557,6 +713,61 @@ TEST_F(EtcdConsistentStoreTest, TestSetClusterNodeStateHasTTL) {
 }
 
 
+TEST_F(EtcdConsistentStoreTest, TestGetClusterNodeStateIsCached) {
+  const string kPath(string(kRoot) + "/nodes/" + kNodeId);
+
+  ct::ClusterNodeState state;
+  state.set_node_id(kNodeId);
+  state.set_hostname("written");
+  util::Status status(store_->SetClusterNodeState(state));
+  EXPECT_TRUE(status.ok()) << status;
+
+  ct::ClusterNodeState other_state(state);
+  other_state.set_hostname("changed");
+  ForceSetEntry(kPath, other_state);
+
+  StatusOr<ct::ClusterNodeState> got(store_->GetClusterNodeState());
+  ASSERT_OK(got);
+  EXPECT_EQ("written", got.ValueOrDie().hostname());
+
+  got = store_->GetClusterNodeState(true /* consistent */);
+  ASSERT_OK(got);
+  EXPECT_EQ("changed", got.ValueOrDie().hostname());
+
+  // The consistent read refreshed the cache.
+  got = store_->GetClusterNodeState();
+  ASSERT_OK(got);
+  EXPECT_EQ("changed", got.ValueOrDie().hostname());
+
+  FLAGS_etcd_read_cache_max_staleness_seconds = 0;
+  other_state.set_hostname("changed again");
+  ForceSetEntry(kPath, other_state);
+  got = store_->GetClusterNodeState();
+  ASSERT_OK(got);
+  EXPECT_EQ("changed again", got.ValueOrDie().hostname());
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestGetServingSTHChecksEtcdWhenStale) {
+  FLAGS_etcd_read_cache_max_staleness_seconds = 0;
+  EXPECT_THAT(store_->GetServingSTH().status(),
+              StatusIs(util::error::NOT_FOUND));
+
+  ct::SignedTreeHead sth;
+  sth.set_timestamp(123);
+  sth.set_tree_size(4);
+  util::Status status(store_->SetServingSTH(sth));
+  EXPECT_TRUE(status.ok()) << status;
+
+  StatusOr<SignedTreeHead> got(store_->GetServingSTH());
+  ASSERT_OK(got);
+  EXPECT_EQ(sth.timestamp(), got.ValueOrDie().timestamp());
+  got = store_->GetServingSTH(true /* consistent */);
+  ASSERT_OK(got);
+  EXPECT_EQ(sth.timestamp(), got.ValueOrDie().timestamp());
+}
+
+
 TEST_F(EtcdConsistentStoreTest, WatchServingSTH) {
   Notification notify;
 
@@ -736,9 +947,10 @@ TEST_F(EtcdConsistentStoreTest, TestCleansUpToNewSTH) {
   sth.set_tree_size(105);
   CHECK(store_->SetServingSTH(sth).ok());
   {
+    // Entries 100 to 102 were removed by the previous run.
     const StatusOr<int64_t> num_cleaned(CleanupOldEntries());
     ASSERT_OK(num_cleaned.status());
-    EXPECT_EQ(5, num_cleaned.ValueOrDie());
+    EXPECT_EQ(2, num_cleaned.ValueOrDie());
   }
 
 
@@ -748,10 +960,9 @@ TEST_F(EtcdConsistentStoreTest, TestCleansUpToNewSTH) {
   EXPECT_THAT(store_->GetPendingEntryForHash(seq_to_hash[104], &unused),
               StatusIs(util::error::NOT_FOUND));
 
-  // Check that we didn't modify the sequence mapping:
+  // Check that the shard mapping them was dropped:
   CHECK(store_->GetSequenceMapping(&seq_mapping).ok());
-  EXPECT_EQ(orig_seq_mapping.Entry().DebugString(),
-            seq_mapping.Entry().DebugString());
+  EXPECT_EQ(0, seq_mapping.Entry().mapping_size());
 
   // Check we've not touched the pending entries:
   vector<EntryHandle<LoggedEntry>> pending_entries_post;
@@ -765,6 +976,61 @@ TEST_F(EtcdConsistentStoreTest, TestCleansUpToNewSTH) {
 }
 
 
+TEST_F(EtcdConsistentStoreTest, TestCleansUpWithPendingEntriesCache) {
+  FLAGS_etcd_cache_pending_entries = true;
+  store_.reset(new EtcdConsistentStore<LoggedEntry>(base_.get(), &executor_,
+                                                    &client_, &election_,
+                                                    kRoot, kNodeId));
+  PopulateForCleanupTests(5, 4, 100);
+  ASSERT_EQ(static_cast<size_t>(9),
+            WaitForPendingEntries(*store_, 9).size());
+
+  // The watch sees the sequenced entries get deleted, without a value.
+  EXPECT_CALL(election_, IsMaster()).WillRepeatedly(Return(true));
+  SignedTreeHead sth;
+  sth.set_timestamp(345345);
+  sth.set_tree_size(105);
+  CHECK(store_->SetServingSTH(sth).ok());
+  const StatusOr<int64_t> num_cleaned(CleanupOldEntries());
+  ASSERT_OK(num_cleaned.status());
+  EXPECT_EQ(5, num_cleaned.ValueOrDie());
+
+  const vector<EntryHandle<LoggedEntry>> entries(
+      WaitForPendingEntries(*store_, 4));
+  ASSERT_EQ(static_cast<size_t>(4), entries.size());
+  for (const auto& entry : entries) {
+    EXPECT_FALSE(entry.Entry().has_sequence_number());
+  }
+}
+
+
+TEST_F(EtcdConsistentStoreTest, TestCleanupIsIncremental) {
+  FLAGS_etcd_cleanup_max_entries_per_run = 2;
+  PopulateForCleanupTests(5, 0, 100);
+  EXPECT_CALL(election_, IsMaster()).WillRepeatedly(Return(true));
+
+  SignedTreeHead sth;
+  sth.set_timestamp(345345);
+  sth.set_tree_size(105);
+  CHECK(store_->SetServingSTH(sth).ok());
+
+  for (const int64_t expected : {2, 2, 1, 0}) {
+    const StatusOr<int64_t> num_cleaned(CleanupOldEntries());
+    ASSERT_OK(num_cleaned.status());
+    EXPECT_EQ(expected, num_cleaned.ValueOrDie());
+  }
+
+  vector<EntryHandle<LoggedEntry>> pending_entries;
+  CHECK(store_->GetPendingEntries(&pending_entries).ok());
+  EXPECT_TRUE(pending_entries.empty());
+
+  // The shard was dropped once all its entries were gone.
+  EntryHandle<SequenceMapping> seq_mapping;
+  CHECK(store_->GetSequenceMapping(&seq_mapping).ok());
+  EXPECT_EQ(0, seq_mapping.Entry().mapping_size());
+}
+
+
 TEST_F(EtcdConsistentStoreTest, TestStoreStatsFetcher) {
   EXPECT_EQ(0, GetNumEtcdEntries());
   PopulateForCleanupTests(100, 100, 100);
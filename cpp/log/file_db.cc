@@ -1,10 +1,13 @@
 #include "log/file_db.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <stdint.h>
 #include <map>
 #include <set>
 #include <string>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "log/file_storage.h"
@@ -19,12 +22,20 @@ using std::lock_guard;
 using std::make_pair;
 using std::min;
 using std::mutex;
+using std::pair;
 using std::set;
 using std::stoll;
 using std::string;
 using std::to_string;
 using std::unique_lock;
 using std::unique_ptr;
+using std::vector;
+
+DEFINE_int32(file_db_index_checkpoint_interval, 100000,
+             "Write a checkpoint of the FileDB index to its meta storage "
+             "every this many new entries (and when closing it), so that "
+             "opening the database only reads the entries written since. "
+             "Each checkpoint holds the whole index. 0 disables them.");
 
 namespace cert_trans {
 namespace {
@@ -36,6 +47,17 @@ static Latency<milliseconds, string> latency_by_op_ms(
 
 
 const char kMetaNodeIdKey[] = "node_id";
+const char kMetaIndexCheckpointKey[] = "index_checkpoint";
+const char kMetaLatestTreeHeadKey[] = "latest_tree_head";
+
+// The index checkpoint is made of this version, followed by the number
+// of contiguous entries from sequence number 0, the number of other
+// entries and, for each of them, its sequence number, and then the
+// number of entries by hash and, for each, the hash and lowest sequence
+// number with it.
+const int kIndexCheckpointVersion = 2;
+// Of SHA-256.
+const size_t kHashSize = 32;
 
 
 string FormatSequenceNumber(const int64_t seq) {
@@ -54,6 +76,41 @@ int64_t ParseSequenceNumber(const string& seq) {
 const size_t FileDB::kTimestampBytesIndexed = 6;
 
 
+class FileDB::LeafHashIterator : public Database::LeafHashIterator {
+ public:
+  LeafHashIterator(const FileDB* db, int64_t start_index)
+      : db_(CHECK_NOTNULL(db)), next_index_(start_index) {
+    CHECK_GE(next_index_, 0);
+  }
+
+  bool GetNextLeafHash(int64_t* sequence_number, string* leaf_hash) override {
+    {
+      lock_guard<mutex> lock(db_->lock_);
+      if (next_index_ >= db_->contiguous_size_ &&
+          !db_->sparse_entries_.LowerBound(next_index_, &next_index_)) {
+        return false;
+      }
+    }
+
+    // The leaf hashes are not kept, so they are computed from what they
+    // cover of the entries.
+    LoggedEntry logged;
+    CHECK_EQ(db_->LookupFieldsByIndex(
+                 next_index_, LoggedEntry::PARSE_SCT | LoggedEntry::PARSE_LEAF,
+                 &logged),
+             Database::LOOKUP_OK);
+    *sequence_number = next_index_;
+    *leaf_hash = logged.MerkleLeafHash();
+    ++next_index_;
+    return true;
+  }
+
+ private:
+  const FileDB* const db_;
+  int64_t next_index_;
+};
+
+
 class FileDB::Iterator : public Database::Iterator {
  public:
   Iterator(const FileDB* db, int64_t start_index)
@@ -65,18 +122,14 @@ class FileDB::Iterator : public Database::Iterator {
     CHECK_NOTNULL(entry);
     {
       lock_guard<mutex> lock(db_->lock_);
-      if (next_index_ >= db_->contiguous_size_) {
-        set<int64_t>::const_iterator it(
-            db_->sparse_entries_.lower_bound(next_index_));
-        if (it == db_->sparse_entries_.end()) {
-          return false;
-        }
-
-        next_index_ = *it;
+      if (next_index_ >= db_->contiguous_size_ &&
+          !db_->sparse_entries_.LowerBound(next_index_, &next_index_)) {
+        return false;
       }
     }
 
-    CHECK_EQ(db_->LookupByIndex(next_index_, entry), Database::LOOKUP_OK);
+    CHECK_EQ(db_->LookupFieldsByIndex(next_index_, fields(), entry),
+             Database::LOOKUP_OK);
     ++next_index_;
     return true;
   }
@@ -93,6 +146,7 @@ FileDB::FileDB(FileStorage* cert_storage, FileStorage* tree_storage,
       tree_storage_(CHECK_NOTNULL(tree_storage)),
       meta_storage_(CHECK_NOTNULL(meta_storage)),
       contiguous_size_(0),
+      entries_since_checkpoint_(0),
       latest_tree_timestamp_(0) {
   ScopedLatency latency(latency_by_op_ms.GetScopedLatency("open"));
   BuildIndex();
@@ -100,6 +154,11 @@ FileDB::FileDB(FileStorage* cert_storage, FileStorage* tree_storage,
 
 
 FileDB::~FileDB() {
+  unique_lock<mutex> lock(lock_);
+  if (FLAGS_file_db_index_checkpoint_interval > 0 &&
+      entries_since_checkpoint_ > 0) {
+    WriteIndexCheckpoint(lock);
+  }
 }
 
 
@@ -113,10 +172,78 @@ Database::WriteResult FileDB::CreateSequencedEntry_(
   string data;
   CHECK(logged.SerializeToString(&data));
 
-  const string seq_str(FormatSequenceNumber(logged.sequence_number()));
+  unique_lock<mutex> lock(lock_);
+
+  return WriteSequencedEntry(lock, logged, data);
+}
+
+
+Database::WriteResult FileDB::CreateSequencedEntries_(
+    const vector<LoggedEntry>& logged, size_t* num_created) {
+  ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("create_sequenced_entries"));
+
+  // Serialize everything before taking the lock, which is then only
+  // taken once.
+  vector<string> data(logged.size());
+  for (size_t i = 0; i < logged.size(); ++i) {
+    CHECK(logged[i].SerializeToString(&data[i]));
+  }
 
   unique_lock<mutex> lock(lock_);
 
+  // Find which entries are new, up to the first one whose sequence
+  // number is in use by another entry, so that they can all be written
+  // together. The index has every entry in storage.
+  vector<pair<string, string>> files;
+  files.reserve(logged.size());
+  vector<size_t> new_entries;
+  // The data of the new entries, by sequence number, for those repeated
+  // in |logged|.
+  std::unordered_map<int64_t, const string*> new_data;
+  WriteResult result(this->OK);
+  for (*num_created = 0; *num_created < logged.size(); ++*num_created) {
+    const size_t i(*num_created);
+    const int64_t seq(logged[i].sequence_number());
+    const string* existing(nullptr);
+    string existing_data;
+    const auto in_batch(new_data.find(seq));
+    if (in_batch != new_data.end()) {
+      existing = in_batch->second;
+    } else if (HasEntry(lock, seq)) {
+      CHECK_EQ(cert_storage_->LookupEntry(FormatSequenceNumber(seq),
+                                          &existing_data),
+               util::Status::OK);
+      existing = &existing_data;
+    }
+    if (existing) {
+      if (*existing != data[i]) {
+        result = this->SEQUENCE_NUMBER_ALREADY_IN_USE;
+        break;
+      }
+      continue;
+    }
+    files.emplace_back(FormatSequenceNumber(seq), string());
+    files.back().second.swap(data[i]);
+    new_data[seq] = &files.back().second;
+    new_entries.push_back(i);
+  }
+
+  CHECK_EQ(cert_storage_->CreateEntries(files), util::Status::OK);
+  for (size_t i : new_entries) {
+    InsertEntryMapping(logged[i]);
+  }
+  MaybeWriteIndexCheckpoint(lock);
+  return result;
+}
+
+
+Database::WriteResult FileDB::WriteSequencedEntry(
+    const unique_lock<mutex>& lock, const LoggedEntry& logged,
+    const string& data) {
+  CHECK(lock.owns_lock());
+  const string seq_str(FormatSequenceNumber(logged.sequence_number()));
+
   // Try to create.
   util::Status status(cert_storage_->CreateEntry(seq_str, data));
   if (status.CanonicalCode() == util::error::ALREADY_EXISTS) {
@@ -130,7 +257,8 @@ Database::WriteResult FileDB::CreateSequencedEntry_(
   }
   CHECK_EQ(status, util::Status::OK);
 
-  InsertEntryMapping(logged.sequence_number(), logged.Hash());
+  InsertEntryMapping(logged);
+  MaybeWriteIndexCheckpoint(lock);
 
   return this->OK;
 }
@@ -169,6 +297,13 @@ Database::LookupResult FileDB::LookupByHash(const string& hash,
 
 Database::LookupResult FileDB::LookupByIndex(int64_t sequence_number,
                                              LoggedEntry* result) const {
+  return LookupFieldsByIndex(sequence_number, LoggedEntry::PARSE_ALL, result);
+}
+
+
+Database::LookupResult FileDB::LookupFieldsByIndex(int64_t sequence_number,
+                                                   int fields,
+                                                   LoggedEntry* result) const {
   CHECK_GE(sequence_number, 0);
   ScopedLatency latency(latency_by_op_ms.GetScopedLatency("lookup_by_index"));
 
@@ -179,7 +314,8 @@ Database::LookupResult FileDB::LookupByIndex(int64_t sequence_number,
     return this->NOT_FOUND;
   }
   if (result) {
-    CHECK(result->ParseFromString(cert_data));
+    CHECK(result->ParseFieldsFromArray(cert_data.data(), cert_data.size(),
+                                       fields));
     CHECK_EQ(result->sequence_number(), sequence_number);
   }
   return this->LOOKUP_OK;
@@ -191,6 +327,13 @@ unique_ptr<Database::Iterator> FileDB::ScanEntries(int64_t start_index) const {
 }
 
 
+unique_ptr<Database::LeafHashIterator> FileDB::ScanLeafHashes(
+    int64_t start_index) const {
+  return unique_ptr<LeafHashIterator>(
+      new LeafHashIterator(this, start_index));
+}
+
+
 Database::WriteResult FileDB::WriteTreeHead_(const ct::SignedTreeHead& sth) {
   CHECK_GE(sth.tree_size(), 0);
   ScopedLatency latency(latency_by_op_ms.GetScopedLatency("write_tree_head"));
@@ -203,6 +346,13 @@ Database::WriteResult FileDB::WriteTreeHead_(const ct::SignedTreeHead& sth) {
   CHECK(sth.SerializeToString(&data));
 
   unique_lock<mutex> lock(lock_);
+  // The pointer to the latest tree head is written first, so that it is
+  // never older than the tree heads in storage. One to a tree head that
+  // is not there is ignored when building the index.
+  const bool latest(sth.timestamp() > latest_tree_timestamp_);
+  if (latest) {
+    WriteMetaEntry(kMetaLatestTreeHeadKey, timestamp_key);
+  }
   util::Status status(tree_storage_->CreateEntry(timestamp_key, data));
   if (status.CanonicalCode() == util::error::ALREADY_EXISTS) {
     string existing_sth_data;
@@ -216,7 +366,7 @@ Database::WriteResult FileDB::WriteTreeHead_(const ct::SignedTreeHead& sth) {
   }
   CHECK_EQ(status, util::Status::OK);
 
-  if (sth.timestamp() > latest_tree_timestamp_) {
+  if (latest) {
     latest_tree_timestamp_ = sth.timestamp();
     latest_timestamp_key_ = timestamp_key;
   }
@@ -237,6 +387,22 @@ Database::LookupResult FileDB::LatestTreeHead(
 }
 
 
+vector<ct::SignedTreeHead> FileDB::ScanTreeHeads() const {
+  ScopedLatency latency(latency_by_op_ms.GetScopedLatency("scan_tree_heads"));
+  lock_guard<mutex> lock(lock_);
+
+  // The keys are big-endian timestamps, so they sort in that order.
+  vector<ct::SignedTreeHead> sths;
+  string tree_data;
+  for (const string& key : tree_storage_->Scan()) {
+    CHECK_EQ(tree_storage_->LookupEntry(key, &tree_data), util::Status::OK);
+    sths.emplace_back();
+    CHECK(sths.back().ParseFromString(tree_data));
+  }
+  return sths;
+}
+
+
 int64_t FileDB::TreeSize() const {
   ScopedLatency latency(latency_by_op_ms.GetScopedLatency("tree_size"));
   lock_guard<mutex> lock(lock_);
@@ -293,21 +459,29 @@ void FileDB::BuildIndex() {
   ScopedLatency latency(latency_by_op_ms.GetScopedLatency("build_index"));
   // Technically, this should only be called from the constructor, so
   // this should not be necessarily, but just to be sure...
-  lock_guard<mutex> lock(lock_);
+  unique_lock<mutex> lock(lock_);
 
   const set<string> sequence_numbers(cert_storage_->Scan());
   id_by_hash_.reserve(sequence_numbers.size());
+  LoadIndexCheckpoint(lock, sequence_numbers);
 
+  // Read the entries that are not in the checkpoint.
   for (const auto& seq_path : sequence_numbers) {
     const int64_t seq(ParseSequenceNumber(seq_path));
+    if (HasEntry(lock, seq)) {
+      continue;
+    }
     string cert_data;
     // Read the data; tolerate no errors.
     CHECK_EQ(cert_storage_->LookupEntry(seq_path, &cert_data),
              util::Status::OK)
         << "Failed to read entry with sequence number " << seq;
 
+    // Only what the hashes cover, without the chain.
     LoggedEntry logged;
-    CHECK(logged.ParseFromString(cert_data))
+    CHECK(logged.ParseFieldsFromArray(
+        cert_data.data(), cert_data.size(),
+        LoggedEntry::PARSE_SCT | LoggedEntry::PARSE_LEAF))
         << "Failed to parse entry with sequence number " << seq;
     CHECK(logged.has_sequence_number())
         << "sequence_number() is unset for for entry with sequence number "
@@ -315,13 +489,24 @@ void FileDB::BuildIndex() {
     CHECK_EQ(logged.sequence_number(), seq)
         << "Entry has a negative sequence_number(): " << seq;
 
-    InsertEntryMapping(logged.sequence_number(), logged.Hash());
+    InsertEntryMapping(logged);
   }
-
-  // Now read the STH entries.
-  set<string> sth_timestamps = tree_storage_->Scan();
-  if (!sth_timestamps.empty()) {
-    latest_timestamp_key_ = *sth_timestamps.rbegin();
+  // So that the next time does not read them again.
+  MaybeWriteIndexCheckpoint(lock);
+
+  // Now find the latest STH, from its pointer, or else by listing them
+  // all.
+  string latest_key;
+  if (meta_storage_->LookupEntry(kMetaLatestTreeHeadKey, &latest_key).ok() &&
+      tree_storage_->LookupEntry(latest_key, NULL).ok()) {
+    latest_timestamp_key_ = latest_key;
+  } else {
+    set<string> sth_timestamps = tree_storage_->Scan();
+    if (!sth_timestamps.empty()) {
+      latest_timestamp_key_ = *sth_timestamps.rbegin();
+    }
+  }
+  if (!latest_timestamp_key_.empty()) {
     CHECK_EQ(DeserializeResult::OK,
              Deserializer::DeserializeUint<uint64_t>(
                  latest_timestamp_key_, FileDB::kTimestampBytesIndexed,
@@ -330,6 +515,118 @@ void FileDB::BuildIndex() {
 }
 
 
+void FileDB::LoadIndexCheckpoint(const unique_lock<mutex>& lock,
+                                 const set<string>& sequence_numbers) {
+  CHECK(lock.owns_lock());
+  string data;
+  if (!meta_storage_->LookupEntry(kMetaIndexCheckpointKey, &data).ok()) {
+    return;
+  }
+
+  // Only used if all of it is valid.
+  vector<uint64_t> sparse;
+  vector<pair<string, int64_t>> ids_by_hash;
+  TLSDeserializer deserializer(data);
+  int version;
+  uint64_t contiguous;
+  uint64_t num_sparse;
+  bool ok(deserializer.ReadUint(1, &version) &&
+          version == kIndexCheckpointVersion &&
+          deserializer.ReadUint(8, &contiguous) &&
+          contiguous <= sequence_numbers.size() &&
+          deserializer.ReadUint(8, &num_sparse) &&
+          num_sparse <= sequence_numbers.size() - contiguous);
+  // Entries are never removed, so they are all still there.
+  for (uint64_t seq = 0; ok && seq < contiguous; ++seq) {
+    ok = sequence_numbers.count(FormatSequenceNumber(seq)) > 0;
+  }
+  if (ok) {
+    sparse.resize(num_sparse);
+  }
+  for (uint64_t i = 0; ok && i < num_sparse; ++i) {
+    ok = deserializer.ReadUint(8, &sparse[i]) && sparse[i] > contiguous &&
+         (i == 0 || sparse[i] > sparse[i - 1]) &&
+         sequence_numbers.count(FormatSequenceNumber(sparse[i])) > 0;
+  }
+  const uint64_t num_entries(contiguous + num_sparse);
+  uint64_t num_hashes;
+  ok = ok && deserializer.ReadUint(8, &num_hashes) &&
+       num_hashes <= num_entries;
+  if (ok) {
+    ids_by_hash.resize(num_hashes);
+  }
+  for (uint64_t i = 0; ok && i < num_hashes; ++i) {
+    ok = deserializer.ReadFixedBytes(kHashSize, &ids_by_hash[i].first) &&
+         deserializer.ReadUint(8, &ids_by_hash[i].second);
+  }
+  if (!ok || !deserializer.ReachedEnd()) {
+    LOG(WARNING) << "Ignoring invalid FileDB index checkpoint, reading all "
+                 << "the entries instead.";
+    return;
+  }
+
+  for (uint64_t seq = 0; seq < contiguous; ++seq) {
+    InsertSequenceNumber(seq);
+  }
+  for (const uint64_t seq : sparse) {
+    InsertSequenceNumber(seq);
+  }
+  id_by_hash_.insert(ids_by_hash.begin(), ids_by_hash.end());
+  LOG(INFO) << "Loaded FileDB index checkpoint of " << num_entries
+            << " entries.";
+}
+
+
+void FileDB::MaybeWriteIndexCheckpoint(const unique_lock<mutex>& lock) {
+  if (FLAGS_file_db_index_checkpoint_interval > 0 &&
+      entries_since_checkpoint_ >= FLAGS_file_db_index_checkpoint_interval) {
+    WriteIndexCheckpoint(lock);
+  }
+}
+
+
+void FileDB::WriteIndexCheckpoint(const unique_lock<mutex>& lock) {
+  CHECK(lock.owns_lock());
+  ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("write_index_checkpoint"));
+  TLSSerializer serializer;
+  serializer.WriteUint(kIndexCheckpointVersion, 1);
+  serializer.WriteUint(contiguous_size_, 8);
+  serializer.WriteUint(sparse_entries_.size(), 8);
+  int64_t seq(contiguous_size_);
+  while (sparse_entries_.LowerBound(seq, &seq)) {
+    serializer.WriteUint(seq, 8);
+    ++seq;
+  }
+  serializer.WriteUint(id_by_hash_.size(), 8);
+  for (const auto& id : id_by_hash_) {
+    CHECK_EQ(kHashSize, id.first.size());
+    serializer.WriteFixedBytes(id.first);
+    serializer.WriteUint(id.second, 8);
+  }
+  WriteMetaEntry(kMetaIndexCheckpointKey, serializer.SerializedString());
+  entries_since_checkpoint_ = 0;
+}
+
+
+void FileDB::WriteMetaEntry(const string& key, const string& data) {
+  const util::Status status(meta_storage_->CreateEntry(key, data));
+  if (status.CanonicalCode() == util::error::ALREADY_EXISTS) {
+    CHECK_EQ(meta_storage_->UpdateEntry(key, data), util::Status::OK);
+  } else {
+    CHECK_EQ(status, util::Status::OK);
+  }
+}
+
+
+bool FileDB::HasEntry(const unique_lock<mutex>& lock,
+                      int64_t sequence_number) const {
+  CHECK(lock.owns_lock());
+  return sequence_number < contiguous_size_ ||
+         sparse_entries_.Contains(sequence_number);
+}
+
+
 Database::LookupResult FileDB::LatestTreeHeadNoLock(
     ct::SignedTreeHead* result) const {
   if (latest_tree_timestamp_ == 0) {
@@ -348,23 +645,26 @@ Database::LookupResult FileDB::LatestTreeHeadNoLock(
 
 
 // This must be called with "lock_" held.
-void FileDB::InsertEntryMapping(int64_t sequence_number, const string& hash) {
+void FileDB::InsertEntryMapping(const LoggedEntry& logged) {
+  const int64_t sequence_number(logged.sequence_number());
+  const string hash(logged.Hash());
   if (!id_by_hash_.insert(make_pair(hash, sequence_number)).second) {
     // This is a duplicate hash under a new sequence number.
     // Make sure we track the entry with the lowest sequence number:
     id_by_hash_[hash] = min(id_by_hash_[hash], sequence_number);
   }
+  InsertSequenceNumber(sequence_number);
+  ++entries_since_checkpoint_;
+}
 
+
+// This must be called with "lock_" held.
+void FileDB::InsertSequenceNumber(int64_t sequence_number) {
   if (sequence_number == contiguous_size_) {
-    ++contiguous_size_;
-    for (auto i = sparse_entries_.find(contiguous_size_);
-         i != sparse_entries_.end() && *i == contiguous_size_;) {
-      ++contiguous_size_;
-      i = sparse_entries_.erase(i);
-    }
+    contiguous_size_ = sparse_entries_.TakeRunFrom(sequence_number + 1);
   } else {
     // It's not contiguous, put it with the other sparse entries.
-    CHECK(sparse_entries_.insert(sequence_number).second)
+    CHECK(sparse_entries_.Insert(sequence_number))
         << "sequence number " << sequence_number << " already assigned.";
   }
 }
@@ -13,6 +13,7 @@
 #include "base/macros.h"
 #include "log/database.h"
 #include "proto/ct.pb.h"
+#include "util/range_set.h"
 #include "util/statusor.h"
 
 namespace cert_trans {
@@ -24,11 +25,15 @@ class FileStorage;
 // signatures in the filesystem.
 class FileDB : public Database {
  public:
-  // Reference implementation: reads the entire database on boot
-  // and builds an in-memory index.
+  // Reference implementation: builds an in-memory index on boot, from
+  // the checkpoint of it in |meta_storage| (see
+  // --file_db_index_checkpoint_interval) and the entries written after
+  // it, which still means listing all the entries.
   // Writes to the underlying FileStorage are atomic (assuming underlying
   // file system operations such as 'rename' are atomic) which should
-  // guarantee full recoverability from crashes/power failures.
+  // guarantee full recoverability from crashes, and from power failures
+  // with --file_storage_fsync. CreateSequencedEntries() writes its
+  // entries as one batch, syncing each directory once.
   // The tree head database uses 6-byte primary keys corresponding to the
   // 6 lower bytes of the (unique) timestamp, so the storage depth of
   // the FileDB should be set up accordingly. For example, a storage depth
@@ -45,6 +50,9 @@ class FileDB : public Database {
   Database::WriteResult CreateSequencedEntry_(
       const LoggedEntry& logged) override;
 
+  Database::WriteResult CreateSequencedEntries_(
+      const std::vector<LoggedEntry>& logged, size_t* num_created) override;
+
   Database::LookupResult LookupByHash(const std::string& hash,
                                       LoggedEntry* result) const override;
 
@@ -54,11 +62,16 @@ class FileDB : public Database {
   std::unique_ptr<Database::Iterator> ScanEntries(
       int64_t start_index) const override;
 
+  std::unique_ptr<Database::LeafHashIterator> ScanLeafHashes(
+      int64_t start_index) const override;
+
   Database::WriteResult WriteTreeHead_(const ct::SignedTreeHead& sth) override;
 
   Database::LookupResult LatestTreeHead(
       ct::SignedTreeHead* result) const override;
 
+  std::vector<ct::SignedTreeHead> ScanTreeHeads() const override;
+
   int64_t TreeSize() const override;
 
   void AddNotifySTHCallback(
@@ -73,11 +86,34 @@ class FileDB : public Database {
 
  private:
   class Iterator;
+  class LeafHashIterator;
 
+  // Stores |logged|, serialized as |data|.
+  Database::WriteResult WriteSequencedEntry(
+      const std::unique_lock<std::mutex>& lock, const LoggedEntry& logged,
+      const std::string& data);
   void BuildIndex();
+  // Like LookupByIndex(), but only parses |fields| (see
+  // LoggedEntry::ParseFields) of the entry.
+  Database::LookupResult LookupFieldsByIndex(int64_t sequence_number,
+                                             int fields,
+                                             LoggedEntry* result) const;
+  // Fills the index from the checkpoint in |meta_storage_|, if there is
+  // a valid one, all of whose entries are among |sequence_numbers|.
+  void LoadIndexCheckpoint(const std::unique_lock<std::mutex>& lock,
+                           const std::set<std::string>& sequence_numbers);
+  // Writes a checkpoint of the index, if there have been enough new
+  // entries since the last one.
+  void MaybeWriteIndexCheckpoint(const std::unique_lock<std::mutex>& lock);
+  void WriteIndexCheckpoint(const std::unique_lock<std::mutex>& lock);
+  void WriteMetaEntry(const std::string& key, const std::string& data);
   Database::LookupResult LatestTreeHeadNoLock(
       ct::SignedTreeHead* result) const;
-  void InsertEntryMapping(int64_t sequence_number, const std::string& hash);
+  void InsertEntryMapping(const LoggedEntry& logged);
+  void InsertSequenceNumber(int64_t sequence_number);
+  // Whether the entry with |sequence_number| is in the index.
+  bool HasEntry(const std::unique_lock<std::mutex>& lock,
+                int64_t sequence_number) const;
 
   const std::unique_ptr<FileStorage> cert_storage_;
   // Store all tree heads, but currently only support looking up the latest
@@ -91,11 +127,14 @@ class FileDB : public Database {
 
   int64_t contiguous_size_;
   std::unordered_map<std::string, int64_t> id_by_hash_;
+  // The number of entries in the index that are not in the checkpoint.
+  int64_t entries_since_checkpoint_;
 
   // This is a mapping of the non-contiguous entries of the log (which
   // can happen while it is being fetched). When entries here become
-  // contiguous with the head of the tree they'll be removed.
-  std::set<int64_t> sparse_entries_;
+  // contiguous with the head of the tree they'll be removed. They are
+  // kept as ranges, as they mostly arrive a fetched batch at a time.
+  RangeSet sparse_entries_;
 
   uint64_t latest_tree_timestamp_;
   // The same as a string;
@@ -3,19 +3,42 @@
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <algorithm>
 #include <cstdlib>
 #include <set>
 #include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 
 #include "log/filesystem_ops.h"
+#include "log/uring_filesystem_ops.h"
 #include "util/util.h"
 
+DEFINE_bool(file_storage_fsync, false,
+            "Whether FileStorage syncs new files to disk before moving them "
+            "into place, and their directories after, so that entries "
+            "survive power failures and not just crashes.");
+DEFINE_int32(file_storage_sync_threads, 8,
+             "How many threads FileStorage::CreateEntries() writes and syncs "
+             "the files of a batch with, with --file_storage_fsync.");
+DEFINE_bool(file_storage_io_uring, false,
+            "Whether FileStorage writes its files through io_uring, which "
+            "submits the write, sync and rename of every file of a batch "
+            "at once, where the kernel supports it.");
+
 using cert_trans::BasicFilesystemOps;
 using cert_trans::FilesystemOps;
+using cert_trans::UringFilesystemOps;
+using std::pair;
 using std::string;
+using std::thread;
+using std::vector;
 
 namespace cert_trans {
 
@@ -25,7 +48,9 @@ FileStorage::FileStorage(const string& file_base, int storage_depth)
       tmp_dir_(file_base + "/tmp"),
       tmp_file_template_(tmp_dir_ + "/tmpXXXXXX"),
       storage_depth_(storage_depth),
-      file_op_(new BasicFilesystemOps()) {
+      file_op_(FLAGS_file_storage_io_uring
+                   ? static_cast<FilesystemOps*>(new UringFilesystemOps)
+                   : new BasicFilesystemOps) {
   CHECK_GE(storage_depth_, 0);
   CreateMissingDirectory(storage_dir_);
   CreateMissingDirectory(tmp_dir_);
@@ -67,6 +92,58 @@ util::Status FileStorage::CreateEntry(const string& key, const string& data) {
 }
 
 
+util::Status FileStorage::CreateEntries(
+    const vector<pair<string, string>>& entries) {
+  std::unordered_set<string> keys;
+  for (const pair<string, string>& entry : entries) {
+    if (!keys.insert(entry.first).second ||
+        LookupEntry(entry.first, NULL).ok()) {
+      return util::Status(util::error::ALREADY_EXISTS,
+                          "entry already exists: " + entry.first);
+    }
+  }
+
+  std::set<string> made;
+  std::set<string> to_sync;
+  vector<string> paths;
+  paths.reserve(entries.size());
+  for (const pair<string, string>& entry : entries) {
+    paths.push_back(MakeStorageDirectories(entry.first, &made, &to_sync));
+  }
+
+  // Syncing files one at a time mostly waits for the disk, so unless
+  // |file_op_| overlaps them itself, they are written on several
+  // threads, each taking every n-th one.
+  const size_t num_threads(
+      FLAGS_file_storage_fsync && !file_op_->BatchesWrites()
+          ? std::min<size_t>(std::max(FLAGS_file_storage_sync_threads, 1),
+                             entries.size())
+          : 1);
+  const auto write_files([this, &entries, &paths, num_threads](
+      size_t first) {
+    vector<FilesystemOps::AtomicWrite> writes;
+    for (size_t i = first; i < entries.size(); i += num_threads) {
+      writes.push_back(
+          FilesystemOps::AtomicWrite{paths[i], &entries[i].second});
+    }
+    PCHECK(file_op_->AtomicWriteFiles(tmp_file_template_, writes,
+                                      FLAGS_file_storage_fsync) == 0)
+        << "writing " << writes.size() << " files";
+  });
+  vector<thread> threads;
+  for (size_t t = 1; t < num_threads; ++t) {
+    threads.emplace_back(write_files, t);
+  }
+  write_files(0);
+  for (thread& t : threads) {
+    t.join();
+  }
+
+  SyncDirectories(to_sync);
+  return util::Status::OK;
+}
+
+
 util::Status FileStorage::UpdateEntry(const string& key, const string& data) {
   if (!LookupEntry(key, NULL).ok()) {
     return util::Status(util::error::NOT_FOUND,
@@ -90,6 +167,17 @@ util::Status FileStorage::LookupEntry(const string& key,
 }
 
 
+util::Status FileStorage::DeleteEntry(const string& key) {
+  const string data_file(StoragePath(key));
+  if (!FileExists(data_file)) {
+    return util::Status(util::error::NOT_FOUND,
+                        "tried to delete non-existent entry: " + key);
+  }
+  CHECK_EQ(file_op_->remove(data_file), 0);
+  return util::Status::OK;
+}
+
+
 string FileStorage::StoragePathBasename(const string& hex) const {
   if (hex.length() <= static_cast<uint>(storage_depth_))
     return "-";
@@ -133,19 +221,33 @@ string FileStorage::StorageKey(const string& storage_path) const {
 
 
 void FileStorage::WriteStorageEntry(const string& key, const string& data) {
+  std::set<string> made;
+  std::set<string> to_sync;
+  AtomicWriteBinaryFile(MakeStorageDirectories(key, &made, &to_sync), data);
+  SyncDirectories(to_sync);
+}
+
+
+string FileStorage::MakeStorageDirectories(const string& key,
+                                           std::set<string>* made,
+                                           std::set<string>* to_sync) {
   string hex = util::HexString(key);
 
-  // Make the intermediate directories, if needed.
+  // Make the intermediate directories, if needed. A new directory is
+  // only durable once its parent is synced.
   // TODO(ekasper): we can skip this if we know we're updating.
   string dir = storage_dir_;
   for (int n = 0; n < storage_depth_; ++n) {
+    const string parent(dir);
     dir += "/" + StoragePathComponent(hex, n);
-    CreateMissingDirectory(dir);
+    if (made->insert(dir).second && CreateMissingDirectory(dir)) {
+      to_sync->insert(parent);
+    }
   }
+  to_sync->insert(dir);
 
   // == StoragePath(key)
-  string filename = dir + "/" + StoragePathBasename(hex);
-  AtomicWriteBinaryFile(filename, data);
+  return dir + "/" + StoragePathBasename(hex);
 }
 
 
@@ -195,17 +297,32 @@ bool FileStorage::FileExists(const string& file_path) const {
 
 void FileStorage::AtomicWriteBinaryFile(const string& file_path,
                                         const string& data) {
-  const string tmp_file(
-      util::WriteTemporaryBinaryFile(tmp_file_template_, data));
-
-  CHECK(!tmp_file.empty());
-  CHECK_EQ(file_op_->rename(tmp_file, file_path), 0);
+  PCHECK(file_op_->AtomicWriteFiles(
+             tmp_file_template_,
+             {FilesystemOps::AtomicWrite{file_path, &data}},
+             FLAGS_file_storage_fsync) == 0)
+      << "writing " << file_path;
 }
 
 
-void FileStorage::CreateMissingDirectory(const string& dir_path) {
+bool FileStorage::CreateMissingDirectory(const string& dir_path) {
   if (file_op_->mkdir(dir_path, 0700) != 0) {
     CHECK_EQ(errno, EEXIST);
+    return false;
+  }
+  return true;
+}
+
+
+void FileStorage::SyncDirectories(const std::set<string>& dirs) const {
+  if (!FLAGS_file_storage_fsync) {
+    return;
+  }
+  for (const string& dir : dirs) {
+    const int fd(open(dir.c_str(), O_RDONLY | O_DIRECTORY));
+    PCHECK(fd >= 0) << "open " << dir;
+    PCHECK(fsync(fd) == 0) << "fsync " << dir;
+    PCHECK(close(fd) == 0) << "close " << dir;
   }
 }
 
@@ -5,6 +5,8 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "base/macros.h"
 #include "util/status.h"
@@ -36,6 +38,9 @@ class FilesystemOps;
 //                  Each key corresponds to a file with the
 //                  data. Writes to these files are atomic
 //                  (i.e. create a new file and move into place).
+//                  With --file_storage_fsync, they are also durable:
+//                  the new file is synced before being moved into
+//                  place, and its directory after.
 //
 // <root>/tmp     - Temporary storage for atomicity. Must be on the
 //                  same filesystem as <root>/storage.
@@ -57,12 +62,23 @@ class FileStorage {
   // Write (key, data) unless an entry matching |key| already exists.
   util::Status CreateEntry(const std::string& key, const std::string& data);
 
+  // Write each (key, data) of |entries|, as CreateEntry() would, but all
+  // together: every directory is only created, and synced, once, and
+  // the files are written and synced in parallel, each before it is
+  // moved into place. Write nothing, and return ALREADY_EXISTS, if one of
+  // the keys already has an entry, or is repeated.
+  util::Status CreateEntries(
+      const std::vector<std::pair<std::string, std::string>>& entries);
+
   // Update an existing entry; fail if it doesn't already exist.
   util::Status UpdateEntry(const std::string& key, const std::string& data);
 
   // Lookup entry based on key.
   util::Status LookupEntry(const std::string& key, std::string* result) const;
 
+  // Remove an existing entry; fail if it doesn't exist.
+  util::Status DeleteEntry(const std::string& key);
+
  private:
   std::string StoragePathBasename(const std::string& hex) const;
   std::string StoragePathComponent(const std::string& hex, int n) const;
@@ -70,6 +86,12 @@ class FileStorage {
   std::string StorageKey(const std::string& storage_path) const;
   // Write or overwrite.
   void WriteStorageEntry(const std::string& key, const std::string& data);
+  // Returns StoragePath(key), having made the directories for it that
+  // are missing, except those in |*made|, to which they are then added,
+  // and added the directories to sync for it to |*to_sync|.
+  std::string MakeStorageDirectories(const std::string& key,
+                                     std::set<std::string>* made,
+                                     std::set<std::string>* to_sync);
   void ScanFiles(const std::string& dir_path,
                  std::set<std::string>* keys) const;
   void ScanDir(const std::string& dir_path, int depth,
@@ -79,8 +101,10 @@ class FileStorage {
   bool FileExists(const std::string& file_path) const;
   void AtomicWriteBinaryFile(const std::string& file_path,
                              const std::string& data);
-  // Create directory, unless it already exists.
-  void CreateMissingDirectory(const std::string& dir_path);
+  // Create directory, unless it already exists. Returns whether it did.
+  bool CreateMissingDirectory(const std::string& dir_path);
+  // Syncs |dirs|, with --file_storage_fsync.
+  void SyncDirectories(const std::set<std::string>& dirs) const;
 
   const std::string storage_dir_;
   const std::string tmp_dir_;
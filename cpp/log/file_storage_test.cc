@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <gflags/gflags.h>
 #include <gtest/gtest.h>
 #include <stdio.h>
 #include <sys/stat.h>
@@ -6,17 +7,26 @@
 #include <iostream>
 #include <set>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "log/file_storage.h"
 #include "log/filesystem_ops.h"
 #include "log/test_db.h"
+#include "log/uring_filesystem_ops.h"
 #include "util/status_test_util.h"
 #include "util/testing.h"
 #include "util/util.h"
 
+DECLARE_bool(file_storage_fsync);
+
 using cert_trans::FailingFilesystemOps;
 using cert_trans::FileStorage;
+using cert_trans::UringFilesystemOps;
+using std::make_pair;
+using std::pair;
 using std::string;
+using std::vector;
 using util::testing::StatusIs;
 
 namespace {
@@ -94,6 +104,49 @@ TEST_F(BasicFileStorageTest, CreateDuplicate) {
   EXPECT_EQ(value, lookup_result);
 }
 
+TEST_F(BasicFileStorageTest, CreateEntries) {
+  const bool saved_fsync(FLAGS_file_storage_fsync);
+  for (bool fsync : {false, true}) {
+    FLAGS_file_storage_fsync = fsync;
+    // Several in the same directories, and some in different ones.
+    vector<pair<string, string>> entries;
+    for (int i = 0; i < 40; ++i) {
+      entries.push_back(make_pair(string(fsync ? "a" : "b") +
+                                      std::to_string(i * 7),
+                                  "value" + std::to_string(i)));
+    }
+    EXPECT_OK(fs()->CreateEntries(entries));
+    string lookup_result;
+    for (const pair<string, string>& entry : entries) {
+      EXPECT_OK(fs()->LookupEntry(entry.first, &lookup_result));
+      EXPECT_EQ(entry.second, lookup_result);
+    }
+    EXPECT_OK(fs()->CreateEntries(vector<pair<string, string>>()));
+  }
+  FLAGS_file_storage_fsync = saved_fsync;
+}
+
+TEST_F(BasicFileStorageTest, CreateEntriesDuplicate) {
+  EXPECT_OK(fs()->CreateEntry("1234xyzw", "unicorn"));
+
+  // Nothing is written if one of the keys exists...
+  EXPECT_THAT(fs()->CreateEntries({make_pair("1245abcd", "Alice"),
+                                   make_pair("1234xyzw", "Bob")}),
+              StatusIs(util::error::ALREADY_EXISTS));
+  EXPECT_THAT(fs()->LookupEntry("1245abcd", NULL),
+              StatusIs(util::error::NOT_FOUND));
+  string lookup_result;
+  EXPECT_OK(fs()->LookupEntry("1234xyzw", &lookup_result));
+  EXPECT_EQ("unicorn", lookup_result);
+
+  // ...or is repeated.
+  EXPECT_THAT(fs()->CreateEntries({make_pair("1245abcd", "Alice"),
+                                   make_pair("1245abcd", "Bob")}),
+              StatusIs(util::error::ALREADY_EXISTS));
+  EXPECT_THAT(fs()->LookupEntry("1245abcd", NULL),
+              StatusIs(util::error::NOT_FOUND));
+}
+
 TEST_F(BasicFileStorageTest, Update) {
   string key("1234xyzw", 8);
   string value("unicorn", 7);
@@ -113,6 +166,30 @@ TEST_F(BasicFileStorageTest, Update) {
   EXPECT_EQ(new_value, lookup_result);
 }
 
+TEST_F(BasicFileStorageTest, Delete) {
+  string key0("1234xyzw", 8);
+  string value0("unicorn", 7);
+
+  string key1("1245abcd", 8);
+  string value1("Alice", 5);
+
+  EXPECT_THAT(fs()->DeleteEntry(key0), StatusIs(util::error::NOT_FOUND));
+  EXPECT_OK(fs()->CreateEntry(key0, value0));
+  EXPECT_OK(fs()->CreateEntry(key1, value1));
+
+  EXPECT_OK(fs()->DeleteEntry(key0));
+  EXPECT_THAT(fs()->LookupEntry(key0, NULL), StatusIs(util::error::NOT_FOUND));
+  EXPECT_THAT(fs()->DeleteEntry(key0), StatusIs(util::error::NOT_FOUND));
+  string lookup_result;
+  EXPECT_OK(fs()->LookupEntry(key1, &lookup_result));
+  EXPECT_EQ(value1, lookup_result);
+
+  // It can be created again.
+  EXPECT_OK(fs()->CreateEntry(key0, value1));
+  EXPECT_OK(fs()->LookupEntry(key0, &lookup_result));
+  EXPECT_EQ(value1, lookup_result);
+}
+
 // Test for non-existing keys that are similar to  existing ones.
 TEST_F(BasicFileStorageTest, LookupInvalidKey) {
   string key("1234xyzw", 8);
@@ -181,6 +258,38 @@ TEST_F(BasicFileStorageTest, ScanOnResume) {
   delete db2;
 }
 
+// Falls back to BasicFilesystemOps where io_uring is not available,
+// and these then only check the fallback.
+TEST(UringFileStorageTest, CreateUpdateAndCreateEntries) {
+  TmpStorage tmp;
+  const bool saved_fsync(FLAGS_file_storage_fsync);
+  for (bool fsync : {false, true}) {
+    FLAGS_file_storage_fsync = fsync;
+    FileStorage db(util::CreateTemporaryDirectory(tmp.TmpStorageDir() +
+                                                  "/ctlogXXXXXX"),
+                   kStorageDepth, new UringFilesystemOps);
+
+    // More than fit in the ring at once.
+    vector<pair<string, string>> entries;
+    for (int i = 0; i < 500; ++i) {
+      entries.push_back(make_pair("key" + std::to_string(i * 7),
+                                  string(i * 13, 'x')));
+    }
+    EXPECT_OK(db.CreateEntries(entries));
+    string lookup_result;
+    for (const pair<string, string>& entry : entries) {
+      EXPECT_OK(db.LookupEntry(entry.first, &lookup_result));
+      EXPECT_EQ(entry.second, lookup_result);
+    }
+
+    EXPECT_OK(db.CreateEntry("1234xyzw", "unicorn"));
+    EXPECT_OK(db.UpdateEntry("1234xyzw", "alice"));
+    EXPECT_OK(db.LookupEntry("1234xyzw", &lookup_result));
+    EXPECT_EQ("alice", lookup_result);
+  }
+  FLAGS_file_storage_fsync = saved_fsync;
+}
+
 class FailingFileStorageDeathTest : public ::testing::Test {
  protected:
   string GetTemporaryDirectory() {
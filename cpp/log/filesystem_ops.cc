@@ -2,8 +2,11 @@
 
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <string>
+#include <vector>
 
 namespace cert_trans {
 
@@ -29,6 +32,56 @@ int BasicFilesystemOps::access(const std::string& path, int amode) {
 }
 
 
+int BasicFilesystemOps::AtomicWriteFiles(
+    const std::string& tmp_template, const std::vector<AtomicWrite>& writes,
+    bool sync) {
+  std::string tmp_path;
+  for (const AtomicWrite& write : writes) {
+    if (WriteTemporaryFile(tmp_template, *write.data, sync, &tmp_path) != 0 ||
+        rename(tmp_path, write.path) != 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+
+int BasicFilesystemOps::WriteTemporaryFile(const std::string& tmp_template,
+                                           const std::string& data,
+                                           bool sync, std::string* tmp_path) {
+  std::vector<char> path(tmp_template.begin(), tmp_template.end());
+  path.push_back('\0');
+  const int fd(mkstemp(path.data()));
+  if (fd < 0) {
+    return -1;
+  }
+  for (size_t written = 0; written < data.size();) {
+    const ssize_t ret(
+        ::write(fd, data.data() + written, data.size() - written));
+    if (ret < 0 && errno != EINTR) {
+      const int saved_errno(errno);
+      ::close(fd);
+      errno = saved_errno;
+      return -1;
+    }
+    if (ret > 0) {
+      written += ret;
+    }
+  }
+  if (sync && fdatasync(fd) != 0) {
+    const int saved_errno(errno);
+    ::close(fd);
+    errno = saved_errno;
+    return -1;
+  }
+  if (::close(fd) != 0) {
+    return -1;
+  }
+  tmp_path->assign(path.data());
+  return 0;
+}
+
+
 FailingFilesystemOps::FailingFilesystemOps(int fail_point)
     : op_count_(0), fail_point_(fail_point) {
 }
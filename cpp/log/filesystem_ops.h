@@ -3,6 +3,7 @@
 
 #include <sys/types.h>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 
@@ -13,6 +14,13 @@ namespace cert_trans {
 // to simulate filesystem errors.
 class FilesystemOps {
  public:
+  // A file to replace atomically, see AtomicWriteFiles().
+  struct AtomicWrite {
+    std::string path;
+    // Must stay valid for the duration of the call.
+    const std::string* data;
+  };
+
   virtual ~FilesystemOps() = default;
 
   virtual int mkdir(const std::string& path, mode_t mode) = 0;
@@ -21,6 +29,23 @@ class FilesystemOps {
                      const std::string& new_name) = 0;
   virtual int access(const std::string& path, int amode) = 0;
 
+  // For each of |writes|, writes its data to a new file made from
+  // |tmp_template| (as by mkstemp(), which must be on the same
+  // filesystem as its path), syncs it if |sync|, and renames it to its
+  // path, so that the path goes atomically from its old contents, if
+  // any, to the new ones. Returns 0, or -1 with errno set if any of them
+  // failed, in which case any of the others may have been made.
+  virtual int AtomicWriteFiles(const std::string& tmp_template,
+                               const std::vector<AtomicWrite>& writes,
+                               bool sync) = 0;
+
+  // Whether AtomicWriteFiles() overlaps the writes and syncs of a batch
+  // by itself, rather than its callers having to split big batches
+  // across threads.
+  virtual bool BatchesWrites() const {
+    return false;
+  }
+
  protected:
   FilesystemOps() = default;
 
@@ -38,6 +63,18 @@ class BasicFilesystemOps : public FilesystemOps {
   int rename(const std::string& old_name,
              const std::string& new_name) override;
   int access(const std::string& path, int amode) override;
+  // One file after the other, with the other operations of this class.
+  int AtomicWriteFiles(const std::string& tmp_template,
+                       const std::vector<AtomicWrite>& writes,
+                       bool sync) override;
+
+ protected:
+  // Writes |data| to a new file made from |tmp_template|, syncing it if
+  // |sync|, and sets |*tmp_path| to its path. Returns 0 or -1 with errno
+  // set.
+  int WriteTemporaryFile(const std::string& tmp_template,
+                         const std::string& data, bool sync,
+                         std::string* tmp_path);
 };
 
 
@@ -9,6 +9,7 @@
 #include "monitoring/event_metric.h"
 #include "proto/ct.pb.h"
 #include "util/status.h"
+#include "util/task.h"
 
 using cert_trans::CertChain;
 using cert_trans::PreCertChain;
@@ -17,7 +18,9 @@ using ct::SignedCertificateTimestamp;
 using std::string;
 using std::lock_guard;
 using std::mutex;
+using std::vector;
 using util::Status;
+using util::Task;
 
 namespace {
 
@@ -55,3 +58,77 @@ Status Frontend::QueueProcessedEntry(Status pre_status, const LogEntry& entry,
   // Step 2. Submit to database.
   return UpdateStats(entry.type(), signer_->QueueEntry(entry, sct));
 }
+
+// The entries of a QueueProcessedEntries() call that passed the
+// pre-checks.
+struct Frontend::QueuedEntries {
+  vector<size_t> indices;
+  vector<ct::LogEntryType> types;
+  vector<const LogEntry*> entries;
+  vector<SignedCertificateTimestamp*> scts;
+  vector<Status> statuses;
+};
+
+void Frontend::QueueProcessedEntries(
+    const vector<const LogEntry*>& entries,
+    const vector<SignedCertificateTimestamp*>& scts,
+    vector<Status>* statuses) {
+  QueuedEntries queued;
+  if (!PrepareEntries(entries, scts, *statuses, &queued)) {
+    return;
+  }
+
+  // Step 2. Submit to database.
+  signer_->QueueEntries(queued.entries, queued.scts, &queued.statuses);
+  FinishEntries(queued, statuses);
+}
+
+void Frontend::QueueProcessedEntries(
+    const vector<const LogEntry*>& entries,
+    const vector<SignedCertificateTimestamp*>& scts, vector<Status>* statuses,
+    Task* task) {
+  QueuedEntries* const queued(new QueuedEntries);
+  task->DeleteWhenDone(queued);
+  if (!PrepareEntries(entries, scts, *statuses, queued)) {
+    task->Return();
+    return;
+  }
+
+  // Step 2. Submit to database.
+  signer_->QueueEntries(queued->entries, queued->scts, &queued->statuses,
+                        task->AddChild([queued, statuses, task](Task*) {
+                          FinishEntries(*queued, statuses);
+                          task->Return();
+                        }));
+}
+
+// static
+bool Frontend::PrepareEntries(const vector<const LogEntry*>& entries,
+                              const vector<SignedCertificateTimestamp*>& scts,
+                              const vector<Status>& statuses,
+                              QueuedEntries* queued) {
+  CHECK_EQ(entries.size(), scts.size());
+  CHECK_EQ(entries.size(), statuses.size());
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    CHECK(entries[i]->has_type());
+    if (!statuses[i].ok()) {
+      UpdateStats(entries[i]->type(), statuses[i]);
+      continue;
+    }
+    queued->indices.push_back(i);
+    queued->types.push_back(entries[i]->type());
+    queued->entries.push_back(entries[i]);
+    queued->scts.push_back(scts[i]);
+  }
+  return !queued->indices.empty();
+}
+
+// static
+void Frontend::FinishEntries(const QueuedEntries& queued,
+                             vector<Status>* statuses) {
+  for (size_t j = 0; j < queued.indices.size(); ++j) {
+    (*statuses)[queued.indices[j]] =
+        UpdateStats(queued.types[j], queued.statuses[j]);
+  }
+}
@@ -4,6 +4,7 @@
 
 #include <memory>
 #include <mutex>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/cert.h"
@@ -14,6 +15,7 @@ class FrontendSigner;
 
 namespace util {
 class Status;
+class Task;
 }  // namespace util
 
 // Frontend for accepting new submissions.
@@ -27,7 +29,34 @@ class Frontend {
                                    const ct::LogEntry& entry,
                                    ct::SignedCertificateTimestamp* sct);
 
+  // Like QueueProcessedEntry(), for each of |entries| and the
+  // corresponding element of |scts|, with |statuses| holding the
+  // pre-statuses on input, and the results on output. The entries that
+  // get new SCTs have them signed in one batch.
+  void QueueProcessedEntries(
+      const std::vector<const ct::LogEntry*>& entries,
+      const std::vector<ct::SignedCertificateTimestamp*>& scts,
+      std::vector<util::Status>* statuses);
+
+  // Like the above, but returns |task| once done rather than blocking
+  // the caller on the store. |scts| and |statuses| must remain valid
+  // until then, |entries| need not.
+  void QueueProcessedEntries(
+      const std::vector<const ct::LogEntry*>& entries,
+      const std::vector<ct::SignedCertificateTimestamp*>& scts,
+      std::vector<util::Status>* statuses, util::Task* task);
+
  private:
+  struct QueuedEntries;
+
+  // Returns false if none of |entries| passed the pre-checks.
+  static bool PrepareEntries(
+      const std::vector<const ct::LogEntry*>& entries,
+      const std::vector<ct::SignedCertificateTimestamp*>& scts,
+      const std::vector<util::Status>& statuses, QueuedEntries* queued);
+  static void FinishEntries(const QueuedEntries& queued,
+                            std::vector<util::Status>* statuses);
+
   const std::unique_ptr<FrontendSigner> signer_;
 
   DISALLOW_COPY_AND_ASSIGN(Frontend);
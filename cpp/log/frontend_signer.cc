@@ -6,18 +6,35 @@
 #include "log/database.h"
 #include "log/log_signer.h"
 #include "merkletree/serial_hasher.h"
+#include "monitoring/trace.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
 #include "util/status.h"
+#include "util/task.h"
 #include "util/util.h"
 
 using cert_trans::ConsistentStore;
 using cert_trans::Database;
 using cert_trans::LoggedEntry;
+using cert_trans::ScopedSpan;
 using ct::LogEntry;
 using ct::SignedCertificateTimestamp;
+using std::placeholders::_1;
 using std::string;
+using std::vector;
 using util::Status;
+using util::Task;
+
+
+// The entries of a QueueEntries() call that are not in the local DB
+// yet, with their new SCTs.
+struct FrontendSigner::NewEntries {
+  vector<size_t> indices;
+  vector<string> hashes;
+  vector<cert_trans::LoggedEntry> logged;
+  vector<cert_trans::LoggedEntry*> pending;
+  vector<Status> pending_statuses;
+};
 
 
 FrontendSigner::FrontendSigner(Database* db,
@@ -30,58 +47,191 @@ FrontendSigner::FrontendSigner(Database* db,
 
 Status FrontendSigner::QueueEntry(const LogEntry& entry,
                                   SignedCertificateTimestamp* sct) {
-  const string sha256_hash(
-      Sha256Hasher::Sha256Digest(Serializer::LeafData(entry)));
-  CHECK(!sha256_hash.empty());
-
-  // Check if the entry already exists in the local DB (i.e. it's been
-  // integrated into the tree.)
-  // This isn't foolproof; it could be that the local node doesn't yet have
-  // a copy of this if the cert was added recently, but it's not fatal if the
-  // same cert gets added twice.
-  // TODO(ekasper): switch to using SignedEntryWithType as the DB key.
-  cert_trans::LoggedEntry logged;
-  Database::LookupResult db_result = db_->LookupByHash(sha256_hash, &logged);
-
-  if (db_result == Database::LOOKUP_OK) {
-    // If we did find a local copy, return the previously issued SCT.
-    if (sct != nullptr) {
-      *sct = logged.sct();
+  vector<Status> statuses;
+  QueueEntries({&entry}, {sct}, &statuses);
+  return statuses[0];
+}
+
+
+void FrontendSigner::QueueEntries(
+    const vector<const LogEntry*>& entries,
+    const vector<SignedCertificateTimestamp*>& scts,
+    vector<Status>* statuses) {
+  NewEntries new_entries;
+  if (!PrepareEntries(entries, scts, statuses, &new_entries)) {
+    return;
+  }
+
+  // If any of these certs has already been added (but not yet integrated
+  // into the tree), then this call will update its sct with the
+  // previously issued one.
+  store_->AddPendingEntries(new_entries.pending,
+                            &new_entries.pending_statuses);
+  FinishEntries(new_entries, scts, statuses);
+}
+
+
+void FrontendSigner::QueueEntries(
+    const vector<const LogEntry*>& entries,
+    const vector<SignedCertificateTimestamp*>& scts, vector<Status>* statuses,
+    Task* task) {
+  NewEntries* const new_entries(new NewEntries);
+  task->DeleteWhenDone(new_entries);
+  if (!signer_->HasExecutor()) {
+    if (!PrepareEntries(entries, scts, statuses, new_entries)) {
+      task->Return();
+      return;
+    }
+    AddPendingEntries(new_entries, scts, statuses, task);
+    return;
+  }
+
+  // The signer keeps its own threads busy meanwhile, rather than this
+  // one.
+  if (!LookupEntries(entries, scts, statuses, new_entries)) {
+    task->Return();
+    return;
+  }
+  vector<const LogEntry*> sign_entries;
+  vector<SignedCertificateTimestamp*> sign_scts;
+  SignInputs(new_entries, &sign_entries, &sign_scts);
+  // The submission handler has already verified the format of these
+  // entries, so this should never fail.
+  CHECK_EQ(LogSigner::OK,
+           signer_->SignCertificateTimestampsAsync(
+               sign_entries, sign_scts,
+               task->AddChild(
+                   [this, new_entries, scts, statuses, task](Task* child) {
+                     CHECK(child->status().ok()) << child->status();
+                     SetPending(new_entries);
+                     AddPendingEntries(new_entries, scts, statuses, task);
+                   })));
+}
+
+
+void FrontendSigner::AddPendingEntries(
+    NewEntries* new_entries, const vector<SignedCertificateTimestamp*>& scts,
+    vector<Status>* statuses, Task* task) {
+  store_->AddPendingEntriesAsync(
+      new_entries->pending, &new_entries->pending_statuses,
+      task->AddChild([this, new_entries, scts, statuses, task](Task*) {
+        FinishEntries(*new_entries, scts, statuses);
+        task->Return();
+      }));
+}
+
+
+bool FrontendSigner::PrepareEntries(
+    const vector<const LogEntry*>& entries,
+    const vector<SignedCertificateTimestamp*>& scts, vector<Status>* statuses,
+    NewEntries* new_entries) const {
+  if (!LookupEntries(entries, scts, statuses, new_entries)) {
+    return false;
+  }
+
+  vector<const LogEntry*> sign_entries;
+  vector<SignedCertificateTimestamp*> sign_scts;
+  SignInputs(new_entries, &sign_entries, &sign_scts);
+  // The submission handler has already verified the format of these
+  // entries, so this should never fail.
+  {
+    ScopedSpan span("sign");
+    CHECK_EQ(LogSigner::OK,
+             signer_->SignCertificateTimestamps(sign_entries, sign_scts));
+  }
+
+  SetPending(new_entries);
+  return true;
+}
+
+
+bool FrontendSigner::LookupEntries(
+    const vector<const LogEntry*>& entries,
+    const vector<SignedCertificateTimestamp*>& scts, vector<Status>* statuses,
+    NewEntries* new_entries) const {
+  CHECK_EQ(entries.size(), scts.size());
+  statuses->assign(entries.size(), Status::OK);
+
+  // The entries that are not in the local DB yet, which get new SCTs.
+  vector<size_t>& new_indices(new_entries->indices);
+  vector<string>& new_hashes(new_entries->hashes);
+  vector<cert_trans::LoggedEntry>& new_logged(new_entries->logged);
+  new_logged.reserve(entries.size());
+  ScopedSpan span("db_lookup");
+  for (size_t i = 0; i < entries.size(); ++i) {
+    string sha256_hash(
+        Sha256Hasher::Sha256Digest(Serializer::LeafData(*entries[i])));
+    CHECK(!sha256_hash.empty());
+
+    // Check if the entry already exists in the local DB (i.e. it's been
+    // integrated into the tree.)
+    // This isn't foolproof; it could be that the local node doesn't yet
+    // have a copy of this if the cert was added recently, but it's not
+    // fatal if the same cert gets added twice.
+    // TODO(ekasper): switch to using SignedEntryWithType as the DB key.
+    cert_trans::LoggedEntry logged;
+    Database::LookupResult db_result = db_->LookupByHash(sha256_hash, &logged);
+
+    if (db_result == Database::LOOKUP_OK) {
+      // If we did find a local copy, return the previously issued SCT.
+      if (scts[i] != nullptr) {
+        *scts[i] = logged.sct();
+      }
+      (*statuses)[i] = Status(util::error::ALREADY_EXISTS,
+                              "entry already exists in Database");
+      continue;
     }
-    return Status(util::error::ALREADY_EXISTS,
-                  "entry already exists in Database");
+    CHECK_EQ(Database::NOT_FOUND, db_result);
+
+    // Dont have the cert locally, so create an SCT and store it and the
+    // cert.
+    new_indices.push_back(i);
+    new_hashes.push_back(std::move(sha256_hash));
+    new_logged.emplace_back();
+    new_logged.back().mutable_entry()->CopyFrom(*entries[i]);
+    Timestamp(new_logged.back().mutable_sct());
   }
-  CHECK_EQ(Database::NOT_FOUND, db_result);
+  return !new_indices.empty();
+}
 
-  // Dont have the cert locally, so create an SCT and store it and the cert.
-  SignedCertificateTimestamp local_sct;
-  TimestampAndSign(entry, &local_sct);
 
-  cert_trans::LoggedEntry new_logged;
-  new_logged.mutable_sct()->CopyFrom(local_sct);
-  new_logged.mutable_entry()->CopyFrom(entry);
-  CHECK_EQ(new_logged.Hash(), sha256_hash);
+// static
+void FrontendSigner::SignInputs(NewEntries* new_entries,
+                                vector<const LogEntry*>* entries,
+                                vector<SignedCertificateTimestamp*>* scts) {
+  for (cert_trans::LoggedEntry& logged : new_entries->logged) {
+    entries->push_back(&logged.entry());
+    scts->push_back(logged.mutable_sct());
+  }
+}
 
-  // If this cert has already been added (but not yet integrated into the
-  // tree), then this call will update new_logged.sct with the previously
-  // issued one.
-  util::Status status(store_->AddPendingEntry(&new_logged));
-  CHECK_EQ(new_logged.Hash(), sha256_hash);
 
-  if (sct != nullptr) {
-    *sct = new_logged.sct();
+// static
+void FrontendSigner::SetPending(NewEntries* new_entries) {
+  for (size_t j = 0; j < new_entries->logged.size(); ++j) {
+    CHECK_EQ(new_entries->logged[j].Hash(), new_entries->hashes[j]);
+    new_entries->pending.push_back(&new_entries->logged[j]);
   }
+}
+
 
-  return status;
+void FrontendSigner::FinishEntries(
+    const NewEntries& new_entries,
+    const vector<SignedCertificateTimestamp*>& scts,
+    vector<Status>* statuses) const {
+  CHECK_EQ(new_entries.pending.size(), new_entries.pending_statuses.size());
+  for (size_t j = 0; j < new_entries.indices.size(); ++j) {
+    const size_t i(new_entries.indices[j]);
+    (*statuses)[i] = new_entries.pending_statuses[j];
+    if (scts[i] != nullptr) {
+      *scts[i] = new_entries.logged[j].sct();
+    }
+  }
 }
 
 
-void FrontendSigner::TimestampAndSign(const LogEntry& entry,
-                                      SignedCertificateTimestamp* sct) const {
+void FrontendSigner::Timestamp(SignedCertificateTimestamp* sct) const {
   sct->set_version(ct::V1);
   sct->set_timestamp(util::TimeInMilliseconds());
   sct->clear_extensions();
-  // The submission handler has already verified the format of this entry,
-  // so this should never fail.
-  CHECK_EQ(LogSigner::OK, signer_->SignCertificateTimestamp(entry, sct));
 }
@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/consistent_store.h"
@@ -12,6 +13,7 @@ class LogSigner;
 
 namespace util {
 class Status;
+class Task;
 }  // namespace util
 
 namespace cert_trans {
@@ -33,9 +35,53 @@ class FrontendSigner {
   util::Status QueueEntry(const ct::LogEntry& entry,
                           ct::SignedCertificateTimestamp* sct);
 
+  // Like QueueEntry(), for each of |entries| and the corresponding
+  // element of |scts| (which may be NULL), setting the corresponding
+  // element of |statuses|. The new SCTs are all signed in one batch.
+  void QueueEntries(const std::vector<const ct::LogEntry*>& entries,
+                    const std::vector<ct::SignedCertificateTimestamp*>& scts,
+                    std::vector<util::Status>* statuses);
+
+  // Like the above, but returns |task| once done rather than blocking
+  // the caller on the store. |scts| and |statuses| must remain valid
+  // until then, |entries| need not.
+  void QueueEntries(const std::vector<const ct::LogEntry*>& entries,
+                    const std::vector<ct::SignedCertificateTimestamp*>& scts,
+                    std::vector<util::Status>* statuses, util::Task* task);
+
  private:
-  void TimestampAndSign(const ct::LogEntry& entry,
-                        ct::SignedCertificateTimestamp* sct) const;
+  struct NewEntries;
+
+  // Sets |statuses| for the entries already in the DB, and the SCTs of
+  // the others, in |new_entries|. Returns false if there are none of
+  // those.
+  bool PrepareEntries(const std::vector<const ct::LogEntry*>& entries,
+                      const std::vector<ct::SignedCertificateTimestamp*>& scts,
+                      std::vector<util::Status>* statuses,
+                      NewEntries* new_entries) const;
+  // Like PrepareEntries(), but leaves the SCTs of |new_entries| to be
+  // signed, and |new_entries->pending| to be set by SetPending() then.
+  bool LookupEntries(const std::vector<const ct::LogEntry*>& entries,
+                     const std::vector<ct::SignedCertificateTimestamp*>& scts,
+                     std::vector<util::Status>* statuses,
+                     NewEntries* new_entries) const;
+  // Sets |entries| and |scts| to those of |new_entries|, for signing.
+  static void SignInputs(NewEntries* new_entries,
+                         std::vector<const ct::LogEntry*>* entries,
+                         std::vector<ct::SignedCertificateTimestamp*>* scts);
+  static void SetPending(NewEntries* new_entries);
+  // Adds |new_entries| to the store, then finishes them and returns
+  // |task|.
+  void AddPendingEntries(
+      NewEntries* new_entries,
+      const std::vector<ct::SignedCertificateTimestamp*>& scts,
+      std::vector<util::Status>* statuses, util::Task* task);
+  // Sets |statuses| and |scts| for |new_entries|, once in the store.
+  void FinishEntries(const NewEntries& new_entries,
+                     const std::vector<ct::SignedCertificateTimestamp*>& scts,
+                     std::vector<util::Status>* statuses) const;
+
+  void Timestamp(ct::SignedCertificateTimestamp* sct) const;
 
   cert_trans::Database* const db_;
   cert_trans::ConsistentStore<cert_trans::LoggedEntry>* const store_;
@@ -23,6 +23,7 @@
 #include "util/mock_masterelection.h"
 #include "util/status.h"
 #include "util/status_test_util.h"
+#include "util/sync_task.h"
 #include "util/testing.h"
 #include "util/thread_pool.h"
 #include "util/util.h"
@@ -215,6 +216,36 @@ TYPED_TEST(FrontendSignerTest, Verify) {
             LogVerifier::INVALID_SIGNATURE);
 }
 
+TYPED_TEST(FrontendSignerTest, SignsOnExecutor) {
+  ThreadPool signing_pool(3);
+  this->log_signer_->SetExecutor(&signing_pool, 3);
+
+  const size_t kNumEntries(10);
+  vector<LogEntry> entries(kNumEntries);
+  vector<const LogEntry*> entry_ptrs;
+  vector<SignedCertificateTimestamp> scts(kNumEntries);
+  vector<SignedCertificateTimestamp*> sct_ptrs;
+  for (size_t i = 0; i < kNumEntries; ++i) {
+    this->test_signer_.CreateUnique(&entries[i]);
+    entry_ptrs.push_back(&entries[i]);
+    sct_ptrs.push_back(&scts[i]);
+  }
+
+  vector<util::Status> statuses;
+  util::SyncTask task(&this->pool_);
+  this->frontend_.QueueEntries(entry_ptrs, sct_ptrs, &statuses, task.task());
+  task.Wait();
+  EXPECT_OK(task.status());
+
+  ASSERT_EQ(kNumEntries, statuses.size());
+  for (size_t i = 0; i < kNumEntries; ++i) {
+    EXPECT_OK(statuses[i]);
+    EXPECT_EQ(LogVerifier::VERIFY_OK,
+              this->verifier_.VerifySignedCertificateTimestamp(entries[i],
+                                                               scts[i]));
+  }
+}
+
 TYPED_TEST(FrontendSignerTest, TimedVerify) {
   LogEntry entry0, entry1;
   this->test_signer_.CreateUnique(&entry0);
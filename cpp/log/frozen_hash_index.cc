@@ -0,0 +1,341 @@
+#include "log/frozen_hash_index.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+using std::pair;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace cert_trans {
+
+namespace {
+
+
+// The file is a header of kHeaderWords 64-bit words:
+//   magic, begin, end, number of hashes, number of levels
+// followed by, all in the byte order of the machine, as the file is only
+// ever read where it was written:
+//   the first word of each level and the end of the last one, 64 bits
+//     each,
+//   the bits of the levels, 64 bits at a time,
+//   the number of bits set before each block of kRankBlockWords words,
+//     64 bits each,
+//   the fingerprint of the hash in each slot, 16 bits each, padded to a
+//     whole number of words,
+//   the sequence number of each slot, relative to begin, 32 bits each.
+const uint64_t kMagic = 0x3158444948465443ULL;  // "CTFHIDX1"
+const size_t kHeaderWords = 5;
+const size_t kRankBlockWords = 8;
+// Each level resolves about 1/e of the hashes left, so this is never
+// reached in practice.
+const size_t kMaxLevels = 64;
+const char kTmpSuffix[] = ".tmp";
+
+
+uint64_t Mix(uint64_t x) {
+  // The finalizer of splitmix64.
+  x ^= x >> 30;
+  x *= 0xbf58476d1ce4e5b9ULL;
+  x ^= x >> 27;
+  x *= 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+
+// The hashes are uniformly distributed, so their first bytes can be used
+// as is, and mixed differently for each level.
+struct Key {
+  explicit Key(const string& hash) {
+    memcpy(&k0, hash.data(), sizeof(k0));
+    memcpy(&k1, hash.data() + sizeof(k0), sizeof(k1));
+  }
+
+  uint64_t LevelHash(size_t level) const {
+    return Mix(k0 + Mix(k1 ^ ((level + 1) * 0x9e3779b97f4a7c15ULL)));
+  }
+
+  uint16_t Fingerprint() const {
+    return static_cast<uint16_t>(Mix(k1 + 0x632be59bd9b4e019ULL) >> 48);
+  }
+
+  uint64_t k0;
+  uint64_t k1;
+};
+
+
+bool TestBit(const uint64_t* bits, uint64_t bit) {
+  return (bits[bit / 64] >> (bit % 64)) & 1;
+}
+
+
+void SetBit(uint64_t bit, vector<uint64_t>* bits) {
+  (*bits)[bit / 64] |= static_cast<uint64_t>(1) << (bit % 64);
+}
+
+
+// The number of bits set before |bit|.
+uint64_t Rank(const uint64_t* bits, const uint64_t* ranks, uint64_t bit) {
+  const uint64_t word(bit / 64);
+  uint64_t rank(ranks[word / kRankBlockWords]);
+  for (uint64_t i = word - word % kRankBlockWords; i < word; ++i) {
+    rank += __builtin_popcountll(bits[i]);
+  }
+  const uint64_t below((static_cast<uint64_t>(1) << (bit % 64)) - 1);
+  return rank + __builtin_popcountll(bits[word] & below);
+}
+
+
+// Returns the bit of |key| in the levels starting at |level_starts|, or
+// -1 if it has none.
+int64_t FindBit(const Key& key, const uint64_t* bits,
+                const vector<uint64_t>& level_starts) {
+  for (size_t level = 0; level + 1 < level_starts.size(); ++level) {
+    const uint64_t num_bits((level_starts[level + 1] - level_starts[level]) *
+                            64);
+    const uint64_t bit(level_starts[level] * 64 +
+                       key.LevelHash(level) % num_bits);
+    if (TestBit(bits, bit)) {
+      return bit;
+    }
+  }
+  return -1;
+}
+
+
+size_t WordsFor(size_t bytes) {
+  return (bytes + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+}
+
+
+void WriteAll(int fd, const string& path, const void* data, size_t size) {
+  const char* p(static_cast<const char*>(data));
+  while (size > 0) {
+    const ssize_t written(write(fd, p, size));
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    PCHECK(written > 0) << "write " << path;
+    p += written;
+    size -= written;
+  }
+}
+
+
+}  // namespace
+
+
+const size_t FrozenHashIndex::kMinHashSize = 2 * sizeof(uint64_t);
+
+
+FrozenHashIndex::FrozenHashIndex(void* data, size_t mapped_size)
+    : data_(data),
+      mapped_size_(mapped_size),
+      begin_(0),
+      end_(0),
+      size_(0),
+      bits_(nullptr),
+      ranks_(nullptr),
+      fingerprints_(nullptr),
+      offsets_(nullptr) {
+}
+
+
+FrozenHashIndex::~FrozenHashIndex() {
+  PCHECK(munmap(data_, mapped_size_) == 0);
+}
+
+
+// static
+void FrozenHashIndex::Write(const string& path, int64_t begin, int64_t end,
+                            vector<pair<string, int64_t>> entries) {
+  CHECK_GE(begin, 0);
+  CHECK_LE(begin, end);
+  CHECK_LE(end - begin, static_cast<int64_t>(UINT32_MAX));
+  // Sorted by hash, then sequence number, so that the first of each hash
+  // is the one to keep.
+  std::sort(entries.begin(), entries.end());
+  entries.erase(std::unique(entries.begin(), entries.end(),
+                            [](const pair<string, int64_t>& a,
+                               const pair<string, int64_t>& b) {
+                              return a.first == b.first;
+                            }),
+                entries.end());
+
+  vector<Key> keys;
+  keys.reserve(entries.size());
+  for (const auto& entry : entries) {
+    CHECK_GE(entry.first.size(), kMinHashSize);
+    CHECK_GE(entry.second, begin);
+    CHECK_LT(entry.second, end);
+    keys.emplace_back(entry.first);
+  }
+
+  // Each level has as many bits as there are hashes left, those which
+  // land on a bit of their own get it, and the others go on to the next
+  // level.
+  vector<uint64_t> level_starts{0};
+  vector<uint64_t> bits;
+  vector<int64_t> key_bits(keys.size(), -1);
+  vector<size_t> pending(keys.size());
+  for (size_t i = 0; i < pending.size(); ++i) {
+    pending[i] = i;
+  }
+  for (size_t level = 0; !pending.empty(); ++level) {
+    CHECK_LT(level, kMaxLevels) << "Hashes are not distinct enough";
+    const size_t num_words(pending.size() / 64 + 1);
+    const uint64_t num_bits(num_words * 64);
+    vector<uint64_t> taken(num_words), collided(num_words);
+    for (const size_t key : pending) {
+      const uint64_t bit(keys[key].LevelHash(level) % num_bits);
+      if (TestBit(taken.data(), bit)) {
+        SetBit(bit, &collided);
+      } else {
+        SetBit(bit, &taken);
+      }
+    }
+    for (size_t w = 0; w < num_words; ++w) {
+      taken[w] &= ~collided[w];
+    }
+
+    vector<size_t> left;
+    for (const size_t key : pending) {
+      const uint64_t bit(keys[key].LevelHash(level) % num_bits);
+      if (TestBit(taken.data(), bit)) {
+        key_bits[key] = level_starts.back() * 64 + bit;
+      } else {
+        left.push_back(key);
+      }
+    }
+    pending.swap(left);
+    bits.insert(bits.end(), taken.begin(), taken.end());
+    level_starts.push_back(bits.size());
+  }
+
+  vector<uint64_t> ranks;
+  uint64_t rank(0);
+  for (size_t w = 0; w < bits.size(); ++w) {
+    if (w % kRankBlockWords == 0) {
+      ranks.push_back(rank);
+    }
+    rank += __builtin_popcountll(bits[w]);
+  }
+  CHECK_EQ(keys.size(), rank);
+
+  vector<uint16_t> fingerprints(WordsFor(keys.size() * sizeof(uint16_t)) *
+                                sizeof(uint64_t) / sizeof(uint16_t));
+  vector<uint32_t> offsets(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    const uint64_t slot(Rank(bits.data(), ranks.data(), key_bits[i]));
+    fingerprints[slot] = keys[i].Fingerprint();
+    offsets[slot] = static_cast<uint32_t>(entries[i].second - begin);
+  }
+
+  const uint64_t header[kHeaderWords] = {
+      kMagic, static_cast<uint64_t>(begin), static_cast<uint64_t>(end),
+      keys.size(), level_starts.size() - 1};
+  const string tmp_path(path + kTmpSuffix);
+  const int fd(open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600));
+  PCHECK(fd >= 0) << "open " << tmp_path;
+  WriteAll(fd, tmp_path, header, sizeof(header));
+  WriteAll(fd, tmp_path, level_starts.data(),
+           level_starts.size() * sizeof(level_starts[0]));
+  WriteAll(fd, tmp_path, bits.data(), bits.size() * sizeof(bits[0]));
+  WriteAll(fd, tmp_path, ranks.data(), ranks.size() * sizeof(ranks[0]));
+  WriteAll(fd, tmp_path, fingerprints.data(),
+           fingerprints.size() * sizeof(fingerprints[0]));
+  WriteAll(fd, tmp_path, offsets.data(), offsets.size() * sizeof(offsets[0]));
+  PCHECK(fsync(fd) == 0) << "fsync " << tmp_path;
+  PCHECK(close(fd) == 0) << "close " << tmp_path;
+  PCHECK(rename(tmp_path.c_str(), path.c_str()) == 0) << "rename "
+                                                       << tmp_path;
+}
+
+
+// static
+unique_ptr<FrozenHashIndex> FrozenHashIndex::Open(const string& path) {
+  const int fd(open(path.c_str(), O_RDONLY));
+  if (fd < 0) {
+    if (errno != ENOENT) {
+      PLOG(WARNING) << "open " << path;
+    }
+    return nullptr;
+  }
+  struct stat st;
+  PCHECK(fstat(fd, &st) == 0) << "fstat " << path;
+  const size_t file_size(st.st_size);
+  if (file_size < kHeaderWords * sizeof(uint64_t)) {
+    LOG(WARNING) << path << " is too short for a hash index";
+    PCHECK(close(fd) == 0);
+    return nullptr;
+  }
+  void* const data(mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0));
+  PCHECK(data != MAP_FAILED) << "mmap " << path;
+  PCHECK(close(fd) == 0);
+  unique_ptr<FrozenHashIndex> index(new FrozenHashIndex(data, file_size));
+
+  const uint64_t* const words(static_cast<const uint64_t*>(data));
+  const size_t file_words(file_size / sizeof(uint64_t));
+  const uint64_t num_levels(words[4]);
+  if (words[0] != kMagic || num_levels > kMaxLevels ||
+      file_words < kHeaderWords + num_levels + 1) {
+    LOG(WARNING) << path << " is not a valid hash index";
+    return nullptr;
+  }
+  index->begin_ = words[1];
+  index->end_ = words[2];
+  index->size_ = words[3];
+  index->level_starts_.assign(words + kHeaderWords,
+                              words + kHeaderWords + num_levels + 1);
+  const uint64_t num_words(index->level_starts_.back());
+  const size_t num_ranks((num_words + kRankBlockWords - 1) /
+                         kRankBlockWords);
+  const size_t fingerprint_words(WordsFor(index->size_ * sizeof(uint16_t)));
+  if (index->begin_ < 0 || index->end_ < index->begin_ ||
+      index->level_starts_[0] != 0 ||
+      !std::is_sorted(index->level_starts_.begin(),
+                      index->level_starts_.end()) ||
+      file_size != index->size_ * sizeof(uint32_t) +
+                       (kHeaderWords + num_levels + 1 + num_words +
+                        num_ranks + fingerprint_words) *
+                           sizeof(uint64_t)) {
+    LOG(WARNING) << path << " is not a valid hash index";
+    return nullptr;
+  }
+  index->bits_ = words + kHeaderWords + num_levels + 1;
+  index->ranks_ = index->bits_ + num_words;
+  index->fingerprints_ =
+      reinterpret_cast<const uint16_t*>(index->ranks_ + num_ranks);
+  index->offsets_ = reinterpret_cast<const uint32_t*>(
+      reinterpret_cast<const uint64_t*>(index->fingerprints_) +
+      fingerprint_words);
+  return index;
+}
+
+
+int64_t FrozenHashIndex::Find(const string& hash) const {
+  if (hash.size() < kMinHashSize) {
+    return -1;
+  }
+  const Key key(hash);
+  const int64_t bit(FindBit(key, bits_, level_starts_));
+  if (bit < 0) {
+    return -1;
+  }
+  const uint64_t slot(Rank(bits_, ranks_, bit));
+  CHECK_LT(slot, size_);
+  if (fingerprints_[slot] != key.Fingerprint()) {
+    return -1;
+  }
+  return begin_ + offsets_[slot];
+}
+
+
+}  // namespace cert_trans
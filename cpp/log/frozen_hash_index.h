@@ -0,0 +1,96 @@
+#ifndef CERT_TRANS_LOG_FROZEN_HASH_INDEX_H_
+#define CERT_TRANS_LOG_FROZEN_HASH_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// A read-only index from the hashes of the entries of a range of
+// sequence numbers which never changes any more to their sequence
+// numbers, kept in a file which is mapped into memory.
+//
+// The index does not hold the hashes, which must be cryptographic ones:
+// it is a minimal perfect hash function over them (a cascade of bit
+// arrays, as in BBHash, of about 3.5 bits per hash with their rank
+// table), which maps each of them to a slot of its own holding a 16-bit
+// fingerprint and the sequence number. That is about 7 bytes per entry,
+// against 50 or more for a std::unordered_map<std::string, int64_t>.
+//
+// A hash which is not in the index gets through the fingerprint about
+// once in 2^16 times, so Find() only returns a candidate, whose hash the
+// caller must check.
+//
+// This class is thread-safe.
+class FrozenHashIndex {
+ public:
+  // The hashes must have at least that many bytes.
+  static const size_t kMinHashSize;
+
+  ~FrozenHashIndex();
+
+  // Writes to |path| the index of |entries|, pairs of hashes and
+  // sequence numbers within [|begin|, |end|), keeping the lowest
+  // sequence number of any duplicate hashes. The file is written in
+  // full under another name first, so that |path| is either missing or
+  // complete.
+  static void Write(const std::string& path, int64_t begin, int64_t end,
+                    std::vector<std::pair<std::string, int64_t>> entries);
+
+  // Maps the index in |path|, or returns NULL if there is none, or it is
+  // not a valid index.
+  static std::unique_ptr<FrozenHashIndex> Open(const std::string& path);
+
+  // Returns the sequence number that |hash| would have if it were in the
+  // index, or -1 if it is certainly not.
+  int64_t Find(const std::string& hash) const;
+
+  // The range of sequence numbers covered, which must all have been
+  // present when it was written.
+  int64_t begin() const {
+    return begin_;
+  }
+  int64_t end() const {
+    return end_;
+  }
+
+  // The number of hashes in the index.
+  size_t size() const {
+    return size_;
+  }
+
+  // The size of the file, all of which is mapped.
+  size_t MappedBytes() const {
+    return mapped_size_;
+  }
+
+ private:
+  FrozenHashIndex(void* data, size_t mapped_size);
+
+  void* const data_;
+  const size_t mapped_size_;
+  int64_t begin_;
+  int64_t end_;
+  size_t size_;
+  // The first word of each level of bits, and the end of the last one.
+  std::vector<uint64_t> level_starts_;
+  // Point into |data_|.
+  const uint64_t* bits_;
+  const uint64_t* ranks_;
+  const uint16_t* fingerprints_;
+  const uint32_t* offsets_;
+
+  DISALLOW_COPY_AND_ASSIGN(FrozenHashIndex);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_FROZEN_HASH_INDEX_H_
@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "log/frozen_hash_index.h"
+#include "merkletree/serial_hasher.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using std::make_pair;
+using std::pair;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+
+string Hash(const string& data) {
+  return Sha256Hasher::Sha256Digest(data);
+}
+
+
+class FrozenHashIndexTest : public ::testing::Test {
+ protected:
+  FrozenHashIndexTest() : path_(tmp_.TmpStorageDir() + "/index") {
+  }
+
+  TmpStorage tmp_;
+  const string path_;
+};
+
+
+TEST_F(FrozenHashIndexTest, Empty) {
+  FrozenHashIndex::Write(path_, 5, 5, {});
+  unique_ptr<FrozenHashIndex> index(FrozenHashIndex::Open(path_));
+  ASSERT_TRUE(index);
+  EXPECT_EQ(5, index->begin());
+  EXPECT_EQ(5, index->end());
+  EXPECT_EQ(0U, index->size());
+  EXPECT_EQ(-1, index->Find(Hash("data")));
+  EXPECT_EQ(-1, index->Find(""));
+}
+
+
+TEST_F(FrozenHashIndexTest, FindsAllHashes) {
+  const int64_t kBegin = 1000;
+  const int kCount = 100000;
+  vector<pair<string, int64_t>> entries;
+  for (int i = 0; i < kCount; ++i) {
+    entries.push_back(make_pair(Hash(std::to_string(i)), kBegin + i));
+  }
+  FrozenHashIndex::Write(path_, kBegin, kBegin + kCount, entries);
+  unique_ptr<FrozenHashIndex> index(FrozenHashIndex::Open(path_));
+  ASSERT_TRUE(index);
+  EXPECT_EQ(kBegin, index->begin());
+  EXPECT_EQ(kBegin + kCount, index->end());
+  EXPECT_EQ(static_cast<size_t>(kCount), index->size());
+
+  for (int i = 0; i < kCount; ++i) {
+    ASSERT_EQ(kBegin + i, index->Find(Hash(std::to_string(i)))) << i;
+  }
+  // Only the fingerprint lets hashes which are not in the index through.
+  int false_positives(0);
+  for (int i = kCount; i < 2 * kCount; ++i) {
+    if (index->Find(Hash(std::to_string(i))) >= 0) {
+      ++false_positives;
+    }
+  }
+  EXPECT_LT(false_positives, 20);
+  // A fraction of what a std::unordered_map would use.
+  EXPECT_LE(index->MappedBytes(), kCount * 7U);
+}
+
+
+TEST_F(FrozenHashIndexTest, KeepsLowestSequenceNumber) {
+  FrozenHashIndex::Write(path_, 0, 10, {make_pair(Hash("a"), 7),
+                                        make_pair(Hash("b"), 1),
+                                        make_pair(Hash("a"), 3),
+                                        make_pair(Hash("a"), 9)});
+  unique_ptr<FrozenHashIndex> index(FrozenHashIndex::Open(path_));
+  ASSERT_TRUE(index);
+  EXPECT_EQ(2U, index->size());
+  EXPECT_EQ(3, index->Find(Hash("a")));
+  EXPECT_EQ(1, index->Find(Hash("b")));
+}
+
+
+TEST_F(FrozenHashIndexTest, RejectsInvalidFiles) {
+  EXPECT_FALSE(FrozenHashIndex::Open(path_));
+
+  FrozenHashIndex::Write(path_, 0, 2, {make_pair(Hash("a"), 0),
+                                       make_pair(Hash("b"), 1)});
+  string contents;
+  ASSERT_TRUE(util::ReadBinaryFile(path_, &contents));
+  ASSERT_TRUE(FrozenHashIndex::Open(path_));
+
+  for (const string& bad :
+       {contents.substr(0, contents.size() - 1), contents + "x",
+        string(contents.size(), '\0'), string("short")}) {
+    std::ofstream(path_, std::ios::binary | std::ios::trunc) << bad;
+    EXPECT_FALSE(FrozenHashIndex::Open(path_));
+  }
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,241 @@
+#include "log/hash_filtered_database.h"
+
+#include <glog/logging.h>
+#include <string.h>
+#include <chrono>
+#include <utility>
+
+#include "log/prefetching_iterator.h"
+#include "monitoring/counter.h"
+
+using std::atomic;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::memory_order_relaxed;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+static Counter<string>* const hash_filter_lookups(
+    Counter<string>::New("database_hash_filter_lookups", "result",
+                         "Lookups of entries by hash, by whether the hash "
+                         "filter answered them (\"absent\") or they were "
+                         "forwarded to the database (\"forwarded\")."));
+
+
+// The number of bits set for each hash, which makes for about one false
+// positive in a hundred lookups at 10 bits per entry.
+const int kNumHashes = 7;
+
+// The hashes are SHA-256 digests, which are uniformly distributed
+// already, and of which the first 16 bytes give the two hash functions
+// that the positions of the bits are made of. Shorter ones are never
+// filtered.
+const size_t kMinHashSize = 16;
+
+
+void HashFunctions(const string& hash, uint64_t* h1, uint64_t* h2) {
+  CHECK_GE(hash.size(), kMinHashSize);
+  memcpy(h1, hash.data(), sizeof(*h1));
+  memcpy(h2, hash.data() + sizeof(*h1), sizeof(*h2));
+  // Odd, so that the positions do not repeat too early.
+  *h2 |= 1;
+}
+
+
+}  // namespace
+
+
+HashFilteredDatabase::HashFilteredDatabase(unique_ptr<Database> db,
+                                           int64_t filter_bytes)
+    : db_(std::move(db)),
+      num_bits_(filter_bytes / sizeof(uint64_t) * 64),
+      bits_(new atomic<uint64_t>[num_bits_ / 64]),
+      stop_(false) {
+  CHECK(db_);
+  CHECK_GT(num_bits_, 0) << "The hash filter needs at least 8 bytes";
+  for (int64_t i = 0; i < num_bits_ / 64; ++i) {
+    bits_[i].store(0, memory_order_relaxed);
+  }
+  load_thread_ = std::thread(&HashFilteredDatabase::Load, this);
+}
+
+
+HashFilteredDatabase::~HashFilteredDatabase() {
+  stop_ = true;
+  load_thread_.join();
+}
+
+
+void HashFilteredDatabase::WaitUntilLoaded() const {
+  loaded_.WaitForNotification();
+}
+
+
+Database::LookupResult HashFilteredDatabase::LookupByHash(
+    const string& hash, LoggedEntry* result) const {
+  if (!MightContain(hash)) {
+    hash_filter_lookups->Increment("absent");
+    return NOT_FOUND;
+  }
+  hash_filter_lookups->Increment("forwarded");
+  return db_->LookupByHash(hash, result);
+}
+
+
+Database::LookupResult HashFilteredDatabase::LookupByIndex(
+    int64_t sequence_number, LoggedEntry* result) const {
+  return db_->LookupByIndex(sequence_number, result);
+}
+
+
+Database::LookupResult HashFilteredDatabase::LatestTreeHead(
+    ct::SignedTreeHead* result) const {
+  return db_->LatestTreeHead(result);
+}
+
+
+vector<ct::SignedTreeHead> HashFilteredDatabase::ScanTreeHeads() const {
+  return db_->ScanTreeHeads();
+}
+
+
+unique_ptr<Database::Iterator> HashFilteredDatabase::ScanEntries(
+    int64_t start_index) const {
+  return db_->ScanEntries(start_index);
+}
+
+
+unique_ptr<Database::Iterator> HashFilteredDatabase::ScanRange(
+    int64_t start, int64_t end) const {
+  return db_->ScanRange(start, end);
+}
+
+
+unique_ptr<Database::LeafHashIterator> HashFilteredDatabase::ScanLeafHashes(
+    int64_t start_index) const {
+  return db_->ScanLeafHashes(start_index);
+}
+
+
+bool HashFilteredDatabase::LookupJsonEntries(
+    int64_t start, int64_t end, vector<JsonEntry>* entries) const {
+  return db_->LookupJsonEntries(start, end, entries);
+}
+
+
+int64_t HashFilteredDatabase::TreeSize() const {
+  return db_->TreeSize();
+}
+
+
+void HashFilteredDatabase::AddNotifySTHCallback(
+    const Database::NotifySTHCallback* callback) {
+  db_->AddNotifySTHCallback(callback);
+}
+
+
+void HashFilteredDatabase::RemoveNotifySTHCallback(
+    const Database::NotifySTHCallback* callback) {
+  db_->RemoveNotifySTHCallback(callback);
+}
+
+
+void HashFilteredDatabase::InitializeNode(const string& node_id) {
+  db_->InitializeNode(node_id);
+}
+
+
+Database::LookupResult HashFilteredDatabase::NodeId(string* node_id) {
+  return db_->NodeId(node_id);
+}
+
+
+Database::WriteResult HashFilteredDatabase::CreateSequencedEntry_(
+    const LoggedEntry& logged) {
+  // Added before it is written, so that a lookup never misses an entry
+  // that is in the database. Should the write fail, this only costs a
+  // false positive.
+  Add(logged.Hash());
+  return db_->CreateSequencedEntry(logged);
+}
+
+
+Database::WriteResult HashFilteredDatabase::CreateSequencedEntries_(
+    const vector<LoggedEntry>& logged, size_t* num_created) {
+  for (const LoggedEntry& entry : logged) {
+    Add(entry.Hash());
+  }
+  return db_->CreateSequencedEntries(logged, num_created);
+}
+
+
+Database::WriteResult HashFilteredDatabase::WriteTreeHead_(
+    const ct::SignedTreeHead& sth) {
+  return db_->WriteTreeHead(sth);
+}
+
+
+void HashFilteredDatabase::Load() {
+  const steady_clock::time_point start(steady_clock::now());
+  const unique_ptr<Database::Iterator> it(MaybeReadAhead(db_->ScanEntries(0)));
+  it->SetFields(LoggedEntry::PARSE_LEAF);
+  int64_t num_entries(0);
+  LoggedEntry logged;
+  while (!stop_ && it->GetNextEntry(&logged)) {
+    Add(logged.Hash());
+    ++num_entries;
+  }
+  if (stop_) {
+    return;
+  }
+
+  LOG(INFO) << "Loaded the hashes of " << num_entries << " entries into "
+            << "the hash filter in "
+            << duration_cast<milliseconds>(steady_clock::now() - start)
+                   .count()
+            << "ms";
+  if (num_entries * 10 > num_bits_) {
+    LOG(WARNING) << "The hash filter has fewer than 10 bits per entry, and "
+                 << "will let through many lookups of new entries";
+  }
+  loaded_.Notify();
+}
+
+
+void HashFilteredDatabase::Add(const string& hash) {
+  if (hash.size() < kMinHashSize) {
+    return;
+  }
+  uint64_t h1, h2;
+  HashFunctions(hash, &h1, &h2);
+  for (int i = 0; i < kNumHashes; ++i) {
+    const uint64_t bit((h1 + i * h2) % num_bits_);
+    bits_[bit / 64].fetch_or(uint64_t(1) << (bit % 64), memory_order_relaxed);
+  }
+}
+
+
+bool HashFilteredDatabase::MightContain(const string& hash) const {
+  if (!loaded_.HasBeenNotified() || hash.size() < kMinHashSize) {
+    return true;
+  }
+  uint64_t h1, h2;
+  HashFunctions(hash, &h1, &h2);
+  for (int i = 0; i < kNumHashes; ++i) {
+    const uint64_t bit((h1 + i * h2) % num_bits_);
+    if (!(bits_[bit / 64].load(memory_order_relaxed) &
+          (uint64_t(1) << (bit % 64)))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+}  // namespace cert_trans
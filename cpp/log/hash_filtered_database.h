@@ -0,0 +1,105 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef CERT_TRANS_LOG_HASH_FILTERED_DATABASE_H_
+#define CERT_TRANS_LOG_HASH_FILTERED_DATABASE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/macros.h"
+#include "base/notification.h"
+#include "log/database.h"
+
+namespace cert_trans {
+
+
+// A Database that forwards everything to another one, but keeps a Bloom
+// filter of the hashes of its entries in memory, so that LookupByHash()
+// can tell that most new submissions are not in the database without
+// reaching the storage.
+//
+// The filter is loaded by scanning the database on a thread of its own,
+// started by the constructor; until that is done, every lookup is
+// forwarded. The entries written afterwards, whether sequenced locally or
+// fetched from other nodes, are added to it as they are written.
+class HashFilteredDatabase : public Database {
+ public:
+  // The filter takes |filter_bytes| of memory, which should be at least
+  // about 1.2 bytes per entry the database is expected to hold, for one
+  // lookup in a hundred of new entries to be forwarded anyway.
+  HashFilteredDatabase(std::unique_ptr<Database> db, int64_t filter_bytes);
+  ~HashFilteredDatabase();
+
+  // Blocks until the filter has been loaded from the database.
+  void WaitUntilLoaded() const;
+
+  Database::LookupResult LookupByHash(const std::string& hash,
+                                      LoggedEntry* result) const override;
+
+  Database::LookupResult LookupByIndex(int64_t sequence_number,
+                                       LoggedEntry* result) const override;
+
+  Database::LookupResult LatestTreeHead(
+      ct::SignedTreeHead* result) const override;
+
+  std::vector<ct::SignedTreeHead> ScanTreeHeads() const override;
+
+  std::unique_ptr<Database::Iterator> ScanEntries(
+      int64_t start_index) const override;
+
+  std::unique_ptr<Database::Iterator> ScanRange(int64_t start,
+                                                int64_t end) const override;
+
+  std::unique_ptr<Database::LeafHashIterator> ScanLeafHashes(
+      int64_t start_index) const override;
+
+  bool LookupJsonEntries(int64_t start, int64_t end,
+                         std::vector<JsonEntry>* entries) const override;
+
+  int64_t TreeSize() const override;
+
+  void AddNotifySTHCallback(
+      const Database::NotifySTHCallback* callback) override;
+
+  void RemoveNotifySTHCallback(
+      const Database::NotifySTHCallback* callback) override;
+
+  void InitializeNode(const std::string& node_id) override;
+
+  Database::LookupResult NodeId(std::string* node_id) override;
+
+ protected:
+  Database::WriteResult CreateSequencedEntry_(
+      const LoggedEntry& logged) override;
+
+  Database::WriteResult CreateSequencedEntries_(
+      const std::vector<LoggedEntry>& logged, size_t* num_created) override;
+
+  Database::WriteResult WriteTreeHead_(const ct::SignedTreeHead& sth) override;
+
+ private:
+  void Load();
+  void Add(const std::string& hash);
+  // Returns false only if |hash| was never added.
+  bool MightContain(const std::string& hash) const;
+
+  const std::unique_ptr<Database> db_;
+  const int64_t num_bits_;
+  // The bits of the filter, set with atomic ORs, so that neither adding
+  // to it nor reading from it takes a lock.
+  const std::unique_ptr<std::atomic<uint64_t>[]> bits_;
+  // Set to stop loading the filter when destroyed before it is done.
+  std::atomic<bool> stop_;
+  Notification loaded_;
+  std::thread load_thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(HashFilteredDatabase);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_HASH_FILTERED_DATABASE_H_
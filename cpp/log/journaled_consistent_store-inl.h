@@ -0,0 +1,327 @@
+#ifndef CERT_TRANS_LOG_JOURNALED_CONSISTENT_STORE_INL_H_
+#define CERT_TRANS_LOG_JOURNALED_CONSISTENT_STORE_INL_H_
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+
+#include "log/database.h"
+#include "log/journaled_consistent_store.h"
+#include "monitoring/monitoring.h"
+#include "util/util.h"
+
+DECLARE_int32(pending_journal_report_batch_size);
+
+DECLARE_int32(pending_journal_max_unreported);
+
+DECLARE_double(pending_journal_retry_delay_seconds);
+
+namespace cert_trans {
+namespace {
+
+
+static Counter<std::string>* pending_journal_entries_reported =
+    Counter<std::string>::New(
+        "pending_journal_entries_reported", "result",
+        "Number of journaled pending entries added to the store, by result "
+        "(added, already_added, conflict, or retried).");
+
+static Gauge<>* pending_journal_unreported_entries = Gauge<>::New(
+    "pending_journal_unreported_entries",
+    "Number of journaled pending entries not added to the store yet.");
+
+
+}  // namespace
+
+
+template <class Logged>
+struct JournaledConsistentStore<Logged>::AppendState {
+  AppendState(const std::vector<Logged*>& entries,
+              std::vector<util::Status>* statuses, util::Task* task)
+      : entries(entries), statuses(statuses), task(task), segment(-1) {
+  }
+
+  const std::vector<Logged*> entries;
+  std::vector<util::Status>* const statuses;
+  util::Task* const task;
+  // The indices in |entries| of those which are being journaled.
+  std::vector<size_t> indices;
+  int64_t segment;
+};
+
+
+template <class Logged>
+struct JournaledConsistentStore<Logged>::ReportState {
+  std::vector<std::unique_ptr<JournaledEntry>> journaled;
+  // Copies of the entries of |journaled|, which the store may change.
+  std::vector<Logged> entries;
+  std::vector<Logged*> entry_ptrs;
+  std::vector<util::Status> statuses;
+};
+
+
+template <class Logged>
+JournaledConsistentStore<Logged>::JournaledConsistentStore(
+    PendingJournal* journal, const ReadOnlyDatabase* db,
+    util::Executor* executor, ConsistentStore<Logged>* peer)
+    : journal_(CHECK_NOTNULL(journal)),
+      executor_(CHECK_NOTNULL(executor)),
+      peer_(CHECK_NOTNULL(peer)),
+      num_reporting_(0),
+      reporting_(false),
+      stopping_(false),
+      task_(executor_) {
+  CHECK_NOTNULL(db);
+  size_t num_sequenced(0);
+  for (PendingJournal::Record& record : journal_->TakeRecovered()) {
+    std::unique_ptr<JournaledEntry> journaled(new JournaledEntry);
+    CHECK(journaled->entry.ParseFromString(record.data))
+        << "could not parse an entry of segment " << record.segment;
+    journaled->segment = record.segment;
+
+    LoggedEntry sequenced;
+    if (db->LookupByHash(journaled->entry.Hash(), &sequenced) ==
+        ReadOnlyDatabase::LOOKUP_OK) {
+      ++num_sequenced;
+      journal_->Release(record.segment, 1);
+      continue;
+    }
+    by_hash_.emplace(journaled->entry.Hash(), journaled.get());
+    unreported_.emplace_back(std::move(journaled));
+  }
+  LOG_IF(INFO, !unreported_.empty() || num_sequenced > 0)
+      << "replaying " << unreported_.size()
+      << " journaled pending entries, skipping " << num_sequenced
+      << " already sequenced";
+  pending_journal_unreported_entries->Set(unreported_.size());
+  MaybeReport();
+}
+
+
+template <class Logged>
+JournaledConsistentStore<Logged>::~JournaledConsistentStore() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    stopping_ = true;
+  }
+  task_.task()->Return();
+  task_.Wait();
+}
+
+
+template <class Logged>
+util::Status JournaledConsistentStore<Logged>::AddPendingEntry(
+    Logged* entry) {
+  std::vector<util::Status> statuses;
+  AddPendingEntries({entry}, &statuses);
+  return statuses[0];
+}
+
+
+template <class Logged>
+void JournaledConsistentStore<Logged>::AddPendingEntries(
+    const std::vector<Logged*>& entries, std::vector<util::Status>* statuses) {
+  util::SyncTask task(executor_);
+  AddPendingEntriesAsync(entries, statuses, task.task());
+  task.Wait();
+}
+
+
+template <class Logged>
+void JournaledConsistentStore<Logged>::AddPendingEntriesAsync(
+    const std::vector<Logged*>& entries, std::vector<util::Status>* statuses,
+    util::Task* task) {
+  CHECK_NOTNULL(statuses);
+  CHECK_NOTNULL(task);
+  statuses->assign(entries.size(), util::Status::OK);
+
+  AppendState* const state(new AppendState(entries, statuses, task));
+  task->DeleteWhenDone(state);
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (unreported_.size() + num_reporting_ + entries.size() >
+        static_cast<size_t>(
+            std::max(FLAGS_pending_journal_max_unreported, 0))) {
+      statuses->assign(entries.size(),
+                       util::Status(util::error::RESOURCE_EXHAUSTED,
+                                    "Too many pending entries not in the "
+                                    "store yet."));
+      task->Return();
+      return;
+    }
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+      CHECK_NOTNULL(entries[i]);
+      CHECK(!entries[i]->has_sequence_number());
+      const auto it(by_hash_.find(entries[i]->Hash()));
+      if (it == by_hash_.end()) {
+        state->indices.push_back(i);
+        continue;
+      }
+      *entries[i]->mutable_sct() = it->second->entry.sct();
+      (*statuses)[i] = util::Status(util::error::ALREADY_EXISTS,
+                                    "Pending entry already exists.");
+    }
+  }
+
+  std::vector<std::string> records(state->indices.size());
+  for (size_t i = 0; i < state->indices.size(); ++i) {
+    CHECK(entries[state->indices[i]]->SerializeToString(&records[i]));
+  }
+  journal_->Append(records, &state->segment,
+                   task->AddChild(
+                       std::bind(&JournaledConsistentStore::EntriesJournaled,
+                                 this, state, std::placeholders::_1)));
+}
+
+
+template <class Logged>
+util::Status JournaledConsistentStore<Logged>::GetPendingEntryForHash(
+    const std::string& hash, EntryHandle<Logged>* entry) const {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    const auto it(by_hash_.find(hash));
+    if (it != by_hash_.end()) {
+      *entry->MutableEntry() = it->second->entry;
+      return util::Status::OK;
+    }
+  }
+  return peer_->GetPendingEntryForHash(hash, entry);
+}
+
+
+template <class Logged>
+size_t JournaledConsistentStore<Logged>::NumUnreported() const {
+  std::lock_guard<std::mutex> lock(lock_);
+  return unreported_.size() + num_reporting_;
+}
+
+
+template <class Logged>
+void JournaledConsistentStore<Logged>::EntriesJournaled(AppendState* state,
+                                                        util::Task* task) {
+  CHECK(task->status().ok()) << task->status();
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    for (const size_t index : state->indices) {
+      std::unique_ptr<JournaledEntry> journaled(
+          new JournaledEntry{*state->entries[index], state->segment});
+      // The same entry may have been added concurrently, in which case
+      // the first one is kept for the lookups, and the store decides.
+      by_hash_.emplace(journaled->entry.Hash(), journaled.get());
+      unreported_.emplace_back(std::move(journaled));
+    }
+    pending_journal_unreported_entries->Set(unreported_.size() +
+                                            num_reporting_);
+  }
+  MaybeReport();
+  state->task->Return();
+}
+
+
+template <class Logged>
+void JournaledConsistentStore<Logged>::MaybeReport() {
+  std::unique_ptr<ReportState> state(new ReportState);
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    if (reporting_ || stopping_ || unreported_.empty()) {
+      return;
+    }
+    reporting_ = true;
+    const size_t batch_size(std::min<size_t>(
+        unreported_.size(),
+        std::max(FLAGS_pending_journal_report_batch_size, 1)));
+    for (size_t i = 0; i < batch_size; ++i) {
+      state->journaled.emplace_back(std::move(unreported_.front()));
+      unreported_.pop_front();
+    }
+    num_reporting_ = batch_size;
+  }
+
+  state->entries.reserve(state->journaled.size());
+  for (const auto& journaled : state->journaled) {
+    state->entries.push_back(journaled->entry);
+  }
+  for (Logged& entry : state->entries) {
+    state->entry_ptrs.push_back(&entry);
+  }
+  ReportState* const raw_state(state.release());
+  peer_->AddPendingEntriesAsync(
+      raw_state->entry_ptrs, &raw_state->statuses,
+      task_.task()->AddChild(std::bind(&JournaledConsistentStore::Reported,
+                                       this, raw_state,
+                                       std::placeholders::_1)));
+}
+
+
+template <class Logged>
+void JournaledConsistentStore<Logged>::Reported(ReportState* state,
+                                                util::Task* task) {
+  const std::unique_ptr<ReportState> deleter(state);
+  bool retry(false);
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    // Put back those to retry, in the same order, ahead of the others.
+    for (size_t i = state->journaled.size(); i-- > 0;) {
+      std::unique_ptr<JournaledEntry>& journaled(state->journaled[i]);
+      const util::Status& status(task->status().ok() ? state->statuses[i]
+                                                     : task->status());
+      if (!status.ok() &&
+          status.CanonicalCode() != util::error::ALREADY_EXISTS) {
+        if (!retry) {
+          LOG(WARNING) << "could not add journaled pending entries to the "
+                       << "store, retrying: " << status;
+        }
+        retry = true;
+        pending_journal_entries_reported->Increment("retried");
+        unreported_.emplace_front(std::move(journaled));
+        continue;
+      }
+
+      if (status.ok()) {
+        pending_journal_entries_reported->Increment("added");
+      } else if (state->entries[i].sct().SerializeAsString() ==
+                 journaled->entry.sct().SerializeAsString()) {
+        // Added by an earlier attempt, or before a restart.
+        pending_journal_entries_reported->Increment("already_added");
+      } else {
+        LOG(ERROR) << "journaled pending entry "
+                   << util::HexString(journaled->entry.Hash())
+                   << " was added to the store by another node, with a "
+                   << "different SCT";
+        pending_journal_entries_reported->Increment("conflict");
+      }
+      const auto it(by_hash_.find(journaled->entry.Hash()));
+      if (it != by_hash_.end() && it->second == journaled.get()) {
+        by_hash_.erase(it);
+      }
+      journal_->Release(journaled->segment, 1);
+    }
+    num_reporting_ = 0;
+    pending_journal_unreported_entries->Set(unreported_.size());
+
+    if (retry && !stopping_) {
+      // Stays |reporting_| until the delay is over.
+      executor_->Delay(
+          std::chrono::duration<double>(
+              FLAGS_pending_journal_retry_delay_seconds),
+          task_.task()->AddChild([this](util::Task*) {
+            {
+              std::lock_guard<std::mutex> lock(lock_);
+              reporting_ = false;
+            }
+            MaybeReport();
+          }));
+      return;
+    }
+    reporting_ = false;
+  }
+  MaybeReport();
+}
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_JOURNALED_CONSISTENT_STORE_INL_H_
@@ -0,0 +1,174 @@
+#ifndef CERT_TRANS_LOG_JOURNALED_CONSISTENT_STORE_H_
+#define CERT_TRANS_LOG_JOURNALED_CONSISTENT_STORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/consistent_store.h"
+#include "log/pending_journal.h"
+#include "util/executor.h"
+#include "util/sync_task.h"
+
+namespace cert_trans {
+
+class ReadOnlyDatabase;
+
+
+// A wrapper around a ConsistentStore which adds pending entries to a
+// local PendingJournal, rather than to the store, before returning, so
+// that the latency of adding an entry is that of syncing the journal
+// rather than that of a round trip to the store (e.g. an etcd quorum).
+//
+// The journaled entries are added to the store in the background, in
+// batches of --pending_journal_report_batch_size, as soon as the
+// previous batch is done, and retried until they are in. Until then,
+// they are only visible to GetPendingEntryForHash() on this node, so
+// that the master sequences them once they are in the store, as before.
+//
+// An entry submitted to this node again while it is in the journal gets
+// the same SCT back. One submitted to several nodes at once may be in
+// several journals with different SCTs, of which the store only keeps
+// one: the others are logged, and counted in the
+// pending_journal_entries_reported{result=conflict} metric.
+//
+// When it is created, the entries left in the journal by a previous run
+// are added to the store again, unless they were sequenced into |db|
+// meanwhile.
+//
+// All the other methods are passed through to the store.
+template <class Logged>
+class JournaledConsistentStore : public ConsistentStore<Logged> {
+ public:
+  // Takes ownership of |journal|, but not |db|, |executor| or |peer|.
+  // The reports to |peer| are made on |executor|.
+  JournaledConsistentStore(PendingJournal* journal, const ReadOnlyDatabase* db,
+                           util::Executor* executor,
+                           ConsistentStore<Logged>* peer);
+
+  // Waits for the batch being added to the store, if any, but does not
+  // wait for the others, which are left in the journal.
+  ~JournaledConsistentStore() override;
+
+  util::Status AddPendingEntry(Logged* entry) override;
+
+  void AddPendingEntries(const std::vector<Logged*>& entries,
+                         std::vector<util::Status>* statuses) override;
+
+  void AddPendingEntriesAsync(const std::vector<Logged*>& entries,
+                              std::vector<util::Status>* statuses,
+                              util::Task* task) override;
+
+  util::Status GetPendingEntryForHash(
+      const std::string& hash, EntryHandle<Logged>* entry) const override;
+
+  // The number of journaled entries not in the store yet.
+  size_t NumUnreported() const;
+
+  // Methods passed through to the store:
+
+  util::StatusOr<int64_t> NextAvailableSequenceNumber() const override {
+    return peer_->NextAvailableSequenceNumber();
+  }
+
+  util::Status SetServingSTH(const ct::SignedTreeHead& new_sth) override {
+    return peer_->SetServingSTH(new_sth);
+  }
+
+  util::StatusOr<ct::SignedTreeHead> GetServingSTH() const override {
+    return peer_->GetServingSTH();
+  }
+
+  util::Status GetPendingEntries(
+      std::vector<EntryHandle<Logged>>* entries) const override {
+    return peer_->GetPendingEntries(entries);
+  }
+
+  util::Status GetSequenceMapping(
+      EntryHandle<ct::SequenceMapping>* entry) const override {
+    return peer_->GetSequenceMapping(entry);
+  }
+
+  util::Status AddSequenceMappings(
+      const ct::SequenceMapping& mappings) override {
+    return peer_->AddSequenceMappings(mappings);
+  }
+
+  util::StatusOr<ct::ClusterNodeState> GetClusterNodeState() const override {
+    return peer_->GetClusterNodeState();
+  }
+
+  util::Status SetClusterNodeState(
+      const ct::ClusterNodeState& state) override {
+    return peer_->SetClusterNodeState(state);
+  }
+
+  void WatchServingSTH(
+      const typename ConsistentStore<Logged>::ServingSTHCallback& cb,
+      util::Task* task) override {
+    return peer_->WatchServingSTH(cb, task);
+  }
+
+  void WatchClusterNodeStates(
+      const typename ConsistentStore<Logged>::ClusterNodeStateCallback& cb,
+      util::Task* task) override {
+    return peer_->WatchClusterNodeStates(cb, task);
+  }
+
+  void WatchClusterConfig(
+      const typename ConsistentStore<Logged>::ClusterConfigCallback& cb,
+      util::Task* task) override {
+    return peer_->WatchClusterConfig(cb, task);
+  }
+
+  util::Status SetClusterConfig(const ct::ClusterConfig& config) override {
+    return peer_->SetClusterConfig(config);
+  }
+
+  util::StatusOr<int64_t> CleanupOldEntries() override {
+    return peer_->CleanupOldEntries();
+  }
+
+ private:
+  // An entry in the journal, but not in the store yet.
+  struct JournaledEntry {
+    Logged entry;
+    int64_t segment;
+  };
+  struct AppendState;
+  struct ReportState;
+
+  void EntriesJournaled(AppendState* state, util::Task* task);
+  // Starts adding a batch of entries to the store, unless one is already
+  // being added.
+  void MaybeReport();
+  void Reported(ReportState* state, util::Task* task);
+
+  const std::unique_ptr<PendingJournal> journal_;
+  util::Executor* const executor_;
+  ConsistentStore<Logged>* const peer_;
+
+  mutable std::mutex lock_;
+  std::deque<std::unique_ptr<JournaledEntry>> unreported_;
+  // The entries of |unreported_| and of the batch being reported, by
+  // hash.
+  std::unordered_map<std::string, const JournaledEntry*> by_hash_;
+  size_t num_reporting_;
+  bool reporting_;
+  bool stopping_;
+
+  util::SyncTask task_;
+
+  DISALLOW_COPY_AND_ASSIGN(JournaledConsistentStore);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_JOURNALED_CONSISTENT_STORE_H_
@@ -0,0 +1,19 @@
+#include <gflags/gflags.h>
+
+#include "log/journaled_consistent_store-inl.h"
+#include "log/logged_entry.h"
+
+DEFINE_int32(pending_journal_report_batch_size, 500,
+             "Maximum number of journaled pending entries to add to the "
+             "store at once.");
+DEFINE_int32(pending_journal_max_unreported, 100000,
+             "Maximum number of journaled pending entries not in the store "
+             "yet, beyond which new ones are rejected, so that a store which "
+             "is down does not let the journal grow without bounds.");
+DEFINE_double(pending_journal_retry_delay_seconds, 1,
+              "How long to wait before adding journaled pending entries to "
+              "the store again, after it failed.");
+
+namespace cert_trans {
+template class JournaledConsistentStore<LoggedEntry>;
+}  // namespace cert_trans
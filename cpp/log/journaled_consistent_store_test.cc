@@ -0,0 +1,190 @@
+#include "log/journaled_consistent_store.h"
+
+#include <gflags/gflags.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "log/file_db.h"
+#include "log/logged_entry.h"
+#include "log/mock_consistent_store.h"
+#include "log/test_db.h"
+#include "log/test_signer.h"
+#include "proto/cert_serializer.h"
+#include "util/status_test_util.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+
+DECLARE_int32(pending_journal_max_unreported);
+DECLARE_double(pending_journal_retry_delay_seconds);
+
+namespace cert_trans {
+namespace {
+
+using std::atomic;
+using std::chrono::milliseconds;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using testing::_;
+using testing::Invoke;
+using testing::NiceMock;
+using util::Status;
+using util::testing::StatusIs;
+
+
+class JournaledConsistentStoreTest : public ::testing::Test {
+ protected:
+  JournaledConsistentStoreTest()
+      : pool_(2),
+        journal_dir_(tmp_.TmpStorageDir() + "/journal"),
+        peer_status_(util::error::OK),
+        num_added_(0) {
+    FLAGS_pending_journal_max_unreported = 100;
+    FLAGS_pending_journal_retry_delay_seconds = 0.01;
+    ON_CALL(peer_, AddPendingEntry(_))
+        .WillByDefault(Invoke([this](LoggedEntry*) {
+          const util::error::Code code(peer_status_.load());
+          if (code == util::error::OK) {
+            ++num_added_;
+          }
+          return Status(code, "");
+        }));
+    Open();
+  }
+
+  void Open() {
+    store_.reset();
+    store_.reset(new JournaledConsistentStore<LoggedEntry>(
+        new PendingJournal(journal_dir_, 1 << 20), db(), &pool_, &peer_));
+  }
+
+  Database* db() {
+    return test_db_.db();
+  }
+
+  LoggedEntry MakeEntry() {
+    LoggedEntry entry;
+    test_signer_.CreateUniqueFakeSignature(&entry);
+    entry.clear_sequence_number();
+    return entry;
+  }
+
+  // Waits for the journaled entries to be in |peer_|.
+  void WaitForReports() {
+    while (store_->NumUnreported() > 0) {
+      std::this_thread::sleep_for(milliseconds(1));
+    }
+  }
+
+  ThreadPool pool_;
+  TestSigner test_signer_;
+  TestDB<FileDB> test_db_;
+  TmpStorage tmp_;
+  const string journal_dir_;
+  NiceMock<MockConsistentStore<LoggedEntry>> peer_;
+  atomic<util::error::Code> peer_status_;
+  atomic<int> num_added_;
+  unique_ptr<JournaledConsistentStore<LoggedEntry>> store_;
+};
+
+
+TEST_F(JournaledConsistentStoreTest, AddsJournaledEntriesToTheStore) {
+  LoggedEntry one(MakeEntry()), two(MakeEntry());
+  vector<Status> statuses;
+  store_->AddPendingEntries({&one, &two}, &statuses);
+  ASSERT_EQ(2U, statuses.size());
+  EXPECT_OK(statuses[0]);
+  EXPECT_OK(statuses[1]);
+
+  WaitForReports();
+  EXPECT_EQ(2, num_added_.load());
+}
+
+
+TEST_F(JournaledConsistentStoreTest, RetriesUntilInTheStore) {
+  peer_status_ = util::error::UNAVAILABLE;
+  LoggedEntry one(MakeEntry());
+  EXPECT_OK(store_->AddPendingEntry(&one));
+
+  // Until it is in the store, it is found here, and submitting it again
+  // returns the same SCT.
+  EntryHandle<LoggedEntry> handle;
+  EXPECT_OK(store_->GetPendingEntryForHash(one.Hash(), &handle));
+  EXPECT_EQ(one.sct().timestamp(), handle.Entry().sct().timestamp());
+  LoggedEntry again(one);
+  again.mutable_sct()->set_timestamp(one.sct().timestamp() + 1);
+  EXPECT_THAT(store_->AddPendingEntry(&again),
+              StatusIs(util::error::ALREADY_EXISTS));
+  EXPECT_EQ(one.sct().timestamp(), again.sct().timestamp());
+  EXPECT_EQ(1U, store_->NumUnreported());
+
+  peer_status_ = util::error::OK;
+  WaitForReports();
+  EXPECT_EQ(1, num_added_.load());
+}
+
+
+TEST_F(JournaledConsistentStoreTest, ReplaysJournalWhenOpened) {
+  peer_status_ = util::error::UNAVAILABLE;
+  LoggedEntry one(MakeEntry()), two(MakeEntry());
+  EXPECT_OK(store_->AddPendingEntry(&one));
+  EXPECT_OK(store_->AddPendingEntry(&two));
+
+  // One of them was sequenced meanwhile, by way of another node.
+  LoggedEntry sequenced(two);
+  sequenced.set_sequence_number(0);
+  ASSERT_EQ(Database::OK, db()->CreateSequencedEntry(sequenced));
+
+  peer_status_ = util::error::OK;
+  Open();
+  WaitForReports();
+  EXPECT_EQ(1, num_added_.load());
+
+  // Nothing is left to replay.
+  Open();
+  EXPECT_EQ(0U, store_->NumUnreported());
+}
+
+
+TEST_F(JournaledConsistentStoreTest, EntriesAlreadyInTheStoreAreDone) {
+  peer_status_ = util::error::ALREADY_EXISTS;
+  LoggedEntry one(MakeEntry());
+  EXPECT_OK(store_->AddPendingEntry(&one));
+  WaitForReports();
+
+  Open();
+  EXPECT_EQ(0U, store_->NumUnreported());
+}
+
+
+TEST_F(JournaledConsistentStoreTest, RejectsTooManyUnreportedEntries) {
+  FLAGS_pending_journal_max_unreported = 1;
+  peer_status_ = util::error::UNAVAILABLE;
+  LoggedEntry one(MakeEntry()), two(MakeEntry());
+  EXPECT_OK(store_->AddPendingEntry(&one));
+  EXPECT_THAT(store_->AddPendingEntry(&two),
+              StatusIs(util::error::RESOURCE_EXHAUSTED));
+
+  peer_status_ = util::error::OK;
+  WaitForReports();
+  EXPECT_OK(store_->AddPendingEntry(&two));
+  WaitForReports();
+  EXPECT_EQ(2, num_added_.load());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  ConfigureSerializerForV1CT();
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,260 @@
+#include "log/leaf_hash_db.h"
+
+#include <glog/logging.h>
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "proto/ct.pb.h"
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::unique_lock;
+using std::unique_ptr;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+// Of SHA-256.
+const size_t kLeafHashSize = 32;
+
+
+class EmptyIterator : public Database::Iterator {
+ public:
+  bool GetNextEntry(LoggedEntry*) override {
+    return false;
+  }
+};
+
+
+}  // namespace
+
+
+class LeafHashDB::LeafHashIterator : public Database::LeafHashIterator {
+ public:
+  LeafHashIterator(const LeafHashDB* db, int64_t start_index)
+      : db_(CHECK_NOTNULL(db)), next_index_(start_index) {
+    CHECK_GE(next_index_, 0);
+  }
+
+  bool GetNextLeafHash(int64_t* sequence_number, string* leaf_hash) override {
+    if (!db_->NextLeafHash(next_index_, sequence_number, leaf_hash)) {
+      return false;
+    }
+    next_index_ = *sequence_number + 1;
+    return true;
+  }
+
+ private:
+  const LeafHashDB* const db_;
+  int64_t next_index_;
+};
+
+
+LeafHashDB::LeafHashDB() {
+}
+
+
+LeafHashDB::~LeafHashDB() {
+}
+
+
+Database::WriteResult LeafHashDB::CreateSequencedEntry_(
+    const LoggedEntry& logged) {
+  const string leaf_hash(logged.MerkleLeafHash());
+  unique_lock<mutex> lock(lock_);
+  return InsertLeafHash(lock, logged.sequence_number(), leaf_hash);
+}
+
+
+Database::WriteResult LeafHashDB::CreateSequencedEntries_(
+    const vector<LoggedEntry>& logged, size_t* num_created) {
+  // Hash them all before taking the lock, which lookups need.
+  vector<string> leaf_hashes;
+  leaf_hashes.reserve(logged.size());
+  for (const LoggedEntry& entry : logged) {
+    leaf_hashes.emplace_back(entry.MerkleLeafHash());
+  }
+
+  unique_lock<mutex> lock(lock_);
+  for (*num_created = 0; *num_created < logged.size(); ++*num_created) {
+    const size_t i(*num_created);
+    const WriteResult result(
+        InsertLeafHash(lock, logged[i].sequence_number(), leaf_hashes[i]));
+    if (result != this->OK) {
+      return result;
+    }
+  }
+  return this->OK;
+}
+
+
+Database::LookupResult LeafHashDB::LookupByHash(const string&,
+                                                LoggedEntry*) const {
+  return this->NOT_FOUND;
+}
+
+
+Database::LookupResult LeafHashDB::LookupByIndex(int64_t,
+                                                 LoggedEntry*) const {
+  return this->NOT_FOUND;
+}
+
+
+unique_ptr<Database::Iterator> LeafHashDB::ScanEntries(int64_t) const {
+  return unique_ptr<Iterator>(new EmptyIterator);
+}
+
+
+unique_ptr<Database::LeafHashIterator> LeafHashDB::ScanLeafHashes(
+    int64_t start_index) const {
+  return unique_ptr<Database::LeafHashIterator>(
+      new LeafHashIterator(this, start_index));
+}
+
+
+Database::WriteResult LeafHashDB::WriteTreeHead_(
+    const ct::SignedTreeHead& sth) {
+  CHECK_GE(sth.tree_size(), 0);
+  lock_guard<mutex> write_lock(write_lock_);
+  {
+    lock_guard<mutex> lock(lock_);
+    if (latest_tree_head_ &&
+        latest_tree_head_->timestamp() == sth.timestamp()) {
+      return latest_tree_head_->SerializeAsString() == sth.SerializeAsString()
+                 ? this->OK
+                 : this->DUPLICATE_TREE_HEAD_TIMESTAMP;
+    }
+    if (latest_tree_head_ &&
+        latest_tree_head_->timestamp() > sth.timestamp()) {
+      return this->OK;
+    }
+    latest_tree_head_.reset(new ct::SignedTreeHead(sth));
+  }
+
+  callbacks_.Call(sth);
+  return this->OK;
+}
+
+
+Database::LookupResult LeafHashDB::LatestTreeHead(
+    ct::SignedTreeHead* result) const {
+  lock_guard<mutex> lock(lock_);
+  if (!latest_tree_head_) {
+    return this->NOT_FOUND;
+  }
+  result->CopyFrom(*latest_tree_head_);
+  return this->LOOKUP_OK;
+}
+
+
+int64_t LeafHashDB::TreeSize() const {
+  lock_guard<mutex> lock(lock_);
+  return leaf_hashes_.size() / kLeafHashSize;
+}
+
+
+void LeafHashDB::AddNotifySTHCallback(
+    const Database::NotifySTHCallback* callback) {
+  lock_guard<mutex> write_lock(write_lock_);
+  callbacks_.Add(callback);
+
+  ct::SignedTreeHead sth;
+  if (LatestTreeHead(&sth) == this->LOOKUP_OK) {
+    (*callback)(sth);
+  }
+}
+
+
+void LeafHashDB::RemoveNotifySTHCallback(
+    const Database::NotifySTHCallback* callback) {
+  lock_guard<mutex> write_lock(write_lock_);
+  callbacks_.Remove(callback);
+}
+
+
+void LeafHashDB::InitializeNode(const string& node_id) {
+  CHECK(!node_id.empty());
+  lock_guard<mutex> lock(lock_);
+  CHECK(node_id_.empty())
+      << "Attempting to initialize DB belonging to node with node_id: "
+      << node_id_;
+  node_id_ = node_id;
+}
+
+
+Database::LookupResult LeafHashDB::NodeId(string* node_id) {
+  CHECK_NOTNULL(node_id);
+  lock_guard<mutex> lock(lock_);
+  if (node_id_.empty()) {
+    return this->NOT_FOUND;
+  }
+  *node_id = node_id_;
+  return this->LOOKUP_OK;
+}
+
+
+Database::WriteResult LeafHashDB::InsertLeafHash(
+    const unique_lock<mutex>& lock, int64_t sequence_number,
+    const string& leaf_hash) {
+  CHECK(lock.owns_lock());
+  CHECK_EQ(kLeafHashSize, leaf_hash.size());
+  int64_t contiguous_size(leaf_hashes_.size() / kLeafHashSize);
+
+  string existing;
+  if (sequence_number < contiguous_size) {
+    existing = leaf_hashes_.substr(sequence_number * kLeafHashSize,
+                                   kLeafHashSize);
+  } else {
+    const auto it(sparse_leaf_hashes_.find(sequence_number));
+    if (it != sparse_leaf_hashes_.end()) {
+      existing = it->second;
+    }
+  }
+  if (!existing.empty()) {
+    // The same entry can be written again, as by a retried fetch.
+    return existing == leaf_hash ? this->OK
+                                 : this->SEQUENCE_NUMBER_ALREADY_IN_USE;
+  }
+
+  if (sequence_number > contiguous_size) {
+    sparse_leaf_hashes_.emplace(sequence_number, leaf_hash);
+    return this->OK;
+  }
+
+  leaf_hashes_.append(leaf_hash);
+  ++contiguous_size;
+  for (auto it = sparse_leaf_hashes_.begin();
+       it != sparse_leaf_hashes_.end() && it->first == contiguous_size;
+       it = sparse_leaf_hashes_.erase(it)) {
+    leaf_hashes_.append(it->second);
+    ++contiguous_size;
+  }
+  return this->OK;
+}
+
+
+bool LeafHashDB::NextLeafHash(int64_t start, int64_t* sequence_number,
+                              string* leaf_hash) const {
+  lock_guard<mutex> lock(lock_);
+  if (start < static_cast<int64_t>(leaf_hashes_.size() / kLeafHashSize)) {
+    *sequence_number = start;
+    leaf_hash->assign(leaf_hashes_, start * kLeafHashSize, kLeafHashSize);
+    return true;
+  }
+
+  const auto it(sparse_leaf_hashes_.lower_bound(start));
+  if (it == sparse_leaf_hashes_.end()) {
+    return false;
+  }
+  *sequence_number = it->first;
+  *leaf_hash = it->second;
+  return true;
+}
+
+
+}  // namespace cert_trans
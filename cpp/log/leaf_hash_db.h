@@ -0,0 +1,105 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef CERT_TRANS_LOG_LEAF_HASH_DB_H_
+#define CERT_TRANS_LOG_LEAF_HASH_DB_H_
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/database.h"
+#include "proto/ct.pb.h"
+
+namespace cert_trans {
+
+
+// Database that keeps only the Merkle leaf hashes of the entries and the
+// latest tree head, in memory, for nodes that serve proofs from a
+// LogLookup (which only needs ScanLeafHashes()) while following a log
+// with a ContinuousFetcher. That costs 32 bytes per entry, rather than
+// the whole of its certificate chain.
+//
+// The entries themselves are dropped once hashed, so LookupByHash(),
+// LookupByIndex() and ScanEntries() never find any. Nothing is
+// persisted: a new instance starts empty, and fetches the log again.
+class LeafHashDB : public Database {
+ public:
+  LeafHashDB();
+  ~LeafHashDB();
+
+  // Implement abstract functions, see database.h for comments.
+  Database::WriteResult CreateSequencedEntry_(
+      const LoggedEntry& logged) override;
+
+  Database::WriteResult CreateSequencedEntries_(
+      const std::vector<LoggedEntry>& logged, size_t* num_created) override;
+
+  Database::LookupResult LookupByHash(const std::string& hash,
+                                      LoggedEntry* result) const override;
+
+  Database::LookupResult LookupByIndex(int64_t sequence_number,
+                                       LoggedEntry* result) const override;
+
+  std::unique_ptr<Database::Iterator> ScanEntries(
+      int64_t start_index) const override;
+
+  std::unique_ptr<Database::LeafHashIterator> ScanLeafHashes(
+      int64_t start_index) const override;
+
+  // Only the latest tree head is kept, so a tree head with the timestamp
+  // of an older one is not detected as a duplicate. Writing the latest
+  // one again is allowed, and does nothing.
+  Database::WriteResult WriteTreeHead_(const ct::SignedTreeHead& sth) override;
+
+  Database::LookupResult LatestTreeHead(
+      ct::SignedTreeHead* result) const override;
+
+  int64_t TreeSize() const override;
+
+  void AddNotifySTHCallback(
+      const Database::NotifySTHCallback* callback) override;
+
+  void RemoveNotifySTHCallback(
+      const Database::NotifySTHCallback* callback) override;
+
+  void InitializeNode(const std::string& node_id) override;
+
+  Database::LookupResult NodeId(std::string* node_id) override;
+
+ private:
+  class LeafHashIterator;
+
+  Database::WriteResult InsertLeafHash(
+      const std::unique_lock<std::mutex>& lock, int64_t sequence_number,
+      const std::string& leaf_hash);
+  // Sets |*sequence_number| and |*leaf_hash| to those of the first entry
+  // at or after |start|, returning false if there is none.
+  bool NextLeafHash(int64_t start, int64_t* sequence_number,
+                    std::string* leaf_hash) const;
+
+  // Serializes the writes of tree heads, and guards callbacks_. Acquired
+  // before lock_, which is not held while running the callbacks, so that
+  // they can read from the database.
+  std::mutex write_lock_;
+  // Guards all of the state below.
+  mutable std::mutex lock_;
+
+  // The leaf hashes of the contiguous entries, concatenated.
+  std::string leaf_hashes_;
+  // Those of the entries after the first gap (which can happen while the
+  // log is being fetched), until they become contiguous.
+  std::map<int64_t, std::string> sparse_leaf_hashes_;
+  std::unique_ptr<ct::SignedTreeHead> latest_tree_head_;
+  std::string node_id_;
+  DatabaseNotifierHelper callbacks_;
+
+  DISALLOW_COPY_AND_ASSIGN(LeafHashDB);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_LEAF_HASH_DB_H_
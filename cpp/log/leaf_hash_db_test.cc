@@ -0,0 +1,195 @@
+#include "log/leaf_hash_db.h"
+
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "log/log_lookup.h"
+#include "log/logged_entry.h"
+#include "log/test_signer.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "proto/cert_serializer.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using ct::MerkleAuditProof;
+using ct::SignedTreeHead;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+
+class LeafHashDBTest : public ::testing::Test {
+ protected:
+  LoggedEntry Entry(int64_t sequence_number) {
+    LoggedEntry logged;
+    test_signer_.CreateUnique(&logged);
+    logged.set_sequence_number(sequence_number);
+    return logged;
+  }
+
+  TestSigner test_signer_;
+  LeafHashDB db_;
+};
+
+
+TEST_F(LeafHashDBTest, KeepsOnlyLeafHashes) {
+  const LoggedEntry logged(Entry(0));
+  ASSERT_EQ(Database::OK, db_.CreateSequencedEntry(logged));
+  EXPECT_EQ(1, db_.TreeSize());
+
+  LoggedEntry lookup;
+  EXPECT_EQ(Database::NOT_FOUND, db_.LookupByIndex(0, &lookup));
+  EXPECT_EQ(Database::NOT_FOUND, db_.LookupByHash(logged.Hash(), &lookup));
+  EXPECT_FALSE(db_.ScanEntries(0)->GetNextEntry(&lookup));
+
+  unique_ptr<Database::LeafHashIterator> it(db_.ScanLeafHashes(0));
+  int64_t seq;
+  string leaf_hash;
+  ASSERT_TRUE(it->GetNextLeafHash(&seq, &leaf_hash));
+  EXPECT_EQ(0, seq);
+  EXPECT_EQ(logged.MerkleLeafHash(), leaf_hash);
+  EXPECT_FALSE(it->GetNextLeafHash(&seq, &leaf_hash));
+}
+
+
+TEST_F(LeafHashDBTest, OutOfOrderEntries) {
+  vector<LoggedEntry> entries;
+  for (int64_t i = 0; i < 4; ++i) {
+    entries.push_back(Entry(i));
+  }
+
+  size_t num_created;
+  ASSERT_EQ(Database::OK,
+            db_.CreateSequencedEntries({entries[3], entries[1]},
+                                       &num_created));
+  EXPECT_EQ(2U, num_created);
+  EXPECT_EQ(0, db_.TreeSize());
+
+  // The sparse ones are scanned too, like in the other databases.
+  unique_ptr<Database::LeafHashIterator> it(db_.ScanLeafHashes(0));
+  int64_t seq;
+  string leaf_hash;
+  ASSERT_TRUE(it->GetNextLeafHash(&seq, &leaf_hash));
+  EXPECT_EQ(1, seq);
+  EXPECT_EQ(entries[1].MerkleLeafHash(), leaf_hash);
+
+  ASSERT_EQ(Database::OK, db_.CreateSequencedEntry(entries[0]));
+  EXPECT_EQ(2, db_.TreeSize());
+  ASSERT_EQ(Database::OK, db_.CreateSequencedEntry(entries[2]));
+  EXPECT_EQ(4, db_.TreeSize());
+
+  it = db_.ScanLeafHashes(0);
+  for (int64_t i = 0; i < 4; ++i) {
+    ASSERT_TRUE(it->GetNextLeafHash(&seq, &leaf_hash));
+    EXPECT_EQ(i, seq);
+    EXPECT_EQ(entries[i].MerkleLeafHash(), leaf_hash);
+  }
+  EXPECT_FALSE(it->GetNextLeafHash(&seq, &leaf_hash));
+}
+
+
+TEST_F(LeafHashDBTest, RewritingEntries) {
+  const LoggedEntry logged(Entry(0));
+  ASSERT_EQ(Database::OK, db_.CreateSequencedEntry(logged));
+  // Writing the same entry again is fine.
+  EXPECT_EQ(Database::OK, db_.CreateSequencedEntry(logged));
+  EXPECT_EQ(1, db_.TreeSize());
+
+  const LoggedEntry sparse(Entry(2));
+  ASSERT_EQ(Database::OK, db_.CreateSequencedEntry(sparse));
+  EXPECT_EQ(Database::OK, db_.CreateSequencedEntry(sparse));
+
+  size_t num_created;
+  EXPECT_EQ(Database::SEQUENCE_NUMBER_ALREADY_IN_USE,
+            db_.CreateSequencedEntries({Entry(1), Entry(0)}, &num_created));
+  EXPECT_EQ(1U, num_created);
+  EXPECT_EQ(3, db_.TreeSize());
+  EXPECT_EQ(Database::SEQUENCE_NUMBER_ALREADY_IN_USE,
+            db_.CreateSequencedEntry(Entry(2)));
+}
+
+
+TEST_F(LeafHashDBTest, TreeHeads) {
+  SignedTreeHead sth;
+  EXPECT_EQ(Database::NOT_FOUND, db_.LatestTreeHead(&sth));
+
+  int num_notified(0);
+  SignedTreeHead notified;
+  const Database::NotifySTHCallback callback(
+      [&num_notified, &notified](const SignedTreeHead& sth) {
+        ++num_notified;
+        notified.CopyFrom(sth);
+      });
+  db_.AddNotifySTHCallback(&callback);
+
+  test_signer_.CreateUnique(&sth);
+  ASSERT_EQ(Database::OK, db_.WriteTreeHead(sth));
+  EXPECT_EQ(1, num_notified);
+  TestSigner::TestEqualTreeHeads(sth, notified);
+
+  // The same tree head again does nothing, another one with its
+  // timestamp is refused, and older ones are ignored.
+  EXPECT_EQ(Database::OK, db_.WriteTreeHead(sth));
+  SignedTreeHead other(sth);
+  other.set_tree_size(sth.tree_size() + 1);
+  EXPECT_EQ(Database::DUPLICATE_TREE_HEAD_TIMESTAMP, db_.WriteTreeHead(other));
+  other.set_timestamp(sth.timestamp() - 1);
+  EXPECT_EQ(Database::OK, db_.WriteTreeHead(other));
+  EXPECT_EQ(1, num_notified);
+
+  SignedTreeHead latest;
+  ASSERT_EQ(Database::LOOKUP_OK, db_.LatestTreeHead(&latest));
+  TestSigner::TestEqualTreeHeads(sth, latest);
+
+  db_.RemoveNotifySTHCallback(&callback);
+}
+
+
+TEST_F(LeafHashDBTest, ServesLogLookup) {
+  MerkleTree tree(new Sha256Hasher);
+  vector<LoggedEntry> entries;
+  for (int64_t i = 0; i < 5; ++i) {
+    entries.push_back(Entry(i));
+    tree.AddLeafHash(entries.back().MerkleLeafHash());
+  }
+  size_t num_created;
+  ASSERT_EQ(Database::OK, db_.CreateSequencedEntries(entries, &num_created));
+
+  SignedTreeHead sth;
+  test_signer_.CreateUnique(&sth);
+  sth.set_tree_size(entries.size());
+  sth.set_sha256_root_hash(tree.CurrentRoot());
+  ASSERT_EQ(Database::OK, db_.WriteTreeHead(sth));
+
+  LogLookup lookup(&db_);
+  EXPECT_EQ(sth.tree_size(), lookup.GetSTH().tree_size());
+  int64_t index;
+  ASSERT_EQ(LogLookup::OK,
+            lookup.GetIndex(entries[3].MerkleLeafHash(), &index));
+  EXPECT_EQ(3, index);
+
+  MerkleAuditProof proof;
+  ASSERT_EQ(LogLookup::OK,
+            lookup.AuditProof(entries[3].MerkleLeafHash(), &proof));
+  const vector<string> path(tree.PathToCurrentRoot(4));
+  ASSERT_EQ(path.size(), static_cast<size_t>(proof.path_node_size()));
+  for (size_t i = 0; i < path.size(); ++i) {
+    EXPECT_EQ(path[i], proof.path_node(i));
+  }
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  ConfigureSerializerForV1CT();
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,115 @@
+#include "log/leaf_index.h"
+
+#include <glog/logging.h>
+#include <string>
+
+#include "merkletree/merkle_tree_interface.h"
+
+using std::string;
+
+namespace cert_trans {
+
+namespace {
+
+
+// Enough for 2^40 - 1 leaves, leaving 24 bits for the tag.
+const int kIndexBits = 40;
+const uint64_t kIndexMask = (static_cast<uint64_t>(1) << kIndexBits) - 1;
+// The hash needs 8 bytes for the slot position and 3 for the tag.
+const size_t kMinHashSize = 11;
+const size_t kInitialSlots = 1024;
+
+
+// The leaf hashes are uniformly distributed, so their bytes can be used
+// as is.
+uint64_t Position(const string& leaf_hash) {
+  uint64_t position(0);
+  for (size_t i = 0; i < 8; ++i)
+    position = (position << 8) | static_cast<unsigned char>(leaf_hash[i]);
+  return position;
+}
+
+
+uint64_t Tag(const string& leaf_hash) {
+  uint64_t tag(0);
+  for (size_t i = 8; i < kMinHashSize; ++i)
+    tag = (tag << 8) | static_cast<unsigned char>(leaf_hash[i]);
+  return tag << kIndexBits;
+}
+
+
+}  // namespace
+
+
+LeafIndex::LeafIndex(const AuditableMerkleTreeInterface* tree)
+    : tree_(CHECK_NOTNULL(tree)), slots_(kInitialSlots), size_(0) {
+  CHECK_GE(tree_->NodeSize(), kMinHashSize);
+}
+
+
+bool LeafIndex::Insert(const string& leaf_hash, int64_t index) {
+  CHECK_EQ(tree_->NodeSize(), leaf_hash.size());
+  CHECK_GE(index, 0);
+  CHECK_LT(static_cast<uint64_t>(index), kIndexMask);
+
+  // Keep the load under 3/4, where linear probing stays short.
+  if ((size_ + 1) * 4 > slots_.size() * 3)
+    Grow();
+
+  const size_t slot(FindSlot(leaf_hash));
+  if (slots_[slot] != 0)
+    return false;
+  slots_[slot] = Tag(leaf_hash) | (index + 1);
+  ++size_;
+  return true;
+}
+
+
+int64_t LeafIndex::Find(const string& leaf_hash) const {
+  if (leaf_hash.size() != tree_->NodeSize())
+    return -1;
+  const uint64_t slot(slots_[FindSlot(leaf_hash)]);
+  return slot == 0 ? -1 : static_cast<int64_t>((slot & kIndexMask) - 1);
+}
+
+
+void LeafIndex::Clear() {
+  slots_.assign(kInitialSlots, 0);
+  size_ = 0;
+}
+
+
+size_t LeafIndex::FindSlot(const string& leaf_hash) const {
+  const size_t mask(slots_.size() - 1);
+  const uint64_t tag(Tag(leaf_hash));
+  for (size_t slot = Position(leaf_hash) & mask;; slot = (slot + 1) & mask) {
+    const uint64_t value(slots_[slot]);
+    if (value == 0)
+      return slot;
+    // Only read the tree if the tags match.
+    if ((value & ~kIndexMask) == tag &&
+        tree_->LeafHash(value & kIndexMask) == leaf_hash)
+      return slot;
+  }
+}
+
+
+void LeafIndex::Grow() {
+  std::vector<uint64_t> old_slots(slots_.size() * 2);
+  old_slots.swap(slots_);
+  const size_t mask(slots_.size() - 1);
+  for (const uint64_t value : old_slots) {
+    if (value == 0)
+      continue;
+    // Slots only hold distinct hashes, so there's no need to compare
+    // them.
+    const string leaf_hash(tree_->LeafHash(value & kIndexMask));
+    size_t slot(Position(leaf_hash) & mask);
+    while (slots_[slot] != 0)
+      slot = (slot + 1) & mask;
+    slots_[slot] = value;
+  }
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,72 @@
+#ifndef CERT_TRANS_LOG_LEAF_INDEX_H_
+#define CERT_TRANS_LOG_LEAF_INDEX_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+class AuditableMerkleTreeInterface;
+
+
+// An index from the leaf hashes of a Merkle tree to their positions in
+// the tree, which must be cryptographic hashes.
+//
+// The leaf hashes are already in the tree, so the index does not keep a
+// copy of them: it is an open-addressing hash table of 8-byte slots,
+// each holding a leaf index and a few more bits of its hash, which rule
+// out almost all of the non-matching slots without reading the tree.
+// That is 11 to 21 bytes per leaf, depending on the table load, against
+// well over 100 bytes for a std::map<std::string, int64_t>.
+//
+// This class is thread-compatible, but not thread-safe.
+class LeafIndex {
+ public:
+  // Does not take ownership of |tree|, which must outlive this object.
+  explicit LeafIndex(const AuditableMerkleTreeInterface* tree);
+
+  // Records that |leaf_hash| is the hash of the leaf at |index|,
+  // counting from 0, which must already be in the tree. If |leaf_hash|
+  // is already in the index, keeps its first index and returns false.
+  bool Insert(const std::string& leaf_hash, int64_t index);
+
+  // Returns the first index of |leaf_hash|, or -1 if it is not in the
+  // index.
+  int64_t Find(const std::string& leaf_hash) const;
+
+  // Removes all of the leaf hashes, e.g. after those of the tree have
+  // been replaced.
+  void Clear();
+
+  size_t size() const {
+    return size_;
+  }
+
+  // Number of bytes of memory used by the table.
+  size_t AllocatedBytes() const {
+    return slots_.size() * sizeof(slots_[0]);
+  }
+
+ private:
+  // Returns the slot holding |leaf_hash|, or the empty slot where it
+  // would go.
+  size_t FindSlot(const std::string& leaf_hash) const;
+  void Grow();
+
+  const AuditableMerkleTreeInterface* const tree_;
+  // Each slot is 0 if empty, or holds an index plus 1 in the lower
+  // kIndexBits bits and a tag taken from the hash in the others.
+  std::vector<uint64_t> slots_;
+  size_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(LeafIndex);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_LEAF_INDEX_H_
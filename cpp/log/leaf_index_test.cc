@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string>
+
+#include "log/leaf_index.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+
+
+class LeafIndexTest : public ::testing::Test {
+ protected:
+  LeafIndexTest() : tree_(new Sha256Hasher), index_(&tree_) {
+  }
+
+  // Adds a leaf to the tree, and its hash to the index.
+  string AddLeaf(const string& data) {
+    const string hash(tree_.LeafHash(data));
+    tree_.AddLeafHash(hash);
+    EXPECT_TRUE(index_.Insert(hash, tree_.LeafCount() - 1));
+    return hash;
+  }
+
+  MerkleTree tree_;
+  LeafIndex index_;
+};
+
+
+TEST_F(LeafIndexTest, Empty) {
+  EXPECT_EQ(0U, index_.size());
+  EXPECT_EQ(-1, index_.Find(tree_.LeafHash("data")));
+  EXPECT_EQ(-1, index_.Find(""));
+}
+
+
+TEST_F(LeafIndexTest, FindsAllLeaves) {
+  // Enough leaves for the table to grow a few times.
+  const int kLeafCount = 10000;
+  for (int i = 0; i < kLeafCount; ++i)
+    AddLeaf(std::to_string(i));
+
+  EXPECT_EQ(static_cast<size_t>(kLeafCount), index_.size());
+  for (int i = 0; i < kLeafCount; ++i)
+    EXPECT_EQ(i, index_.Find(tree_.LeafHash(std::to_string(i))));
+  EXPECT_EQ(-1, index_.Find(tree_.LeafHash("not a leaf")));
+  // Far less than a std::map would use.
+  EXPECT_LE(index_.AllocatedBytes(), kLeafCount * 24U);
+}
+
+
+TEST_F(LeafIndexTest, Clear) {
+  for (int i = 0; i < 2000; ++i)
+    AddLeaf(std::to_string(i));
+  const string hash(tree_.LeafHash("0"));
+  index_.Clear();
+  EXPECT_EQ(0U, index_.size());
+  EXPECT_EQ(-1, index_.Find(hash));
+  EXPECT_TRUE(index_.Insert(hash, 0));
+  EXPECT_EQ(0, index_.Find(hash));
+}
+
+
+TEST_F(LeafIndexTest, KeepsFirstIndex) {
+  const string hash(AddLeaf("duplicate"));
+  AddLeaf("other");
+  tree_.AddLeafHash(hash);
+  EXPECT_FALSE(index_.Insert(hash, 2));
+  EXPECT_EQ(2U, index_.size());
+  EXPECT_EQ(0, index_.Find(hash));
+}
+
+
+TEST_F(LeafIndexTest, SameTagDifferentLeaf) {
+  // Hashes with the same slot position and tag can only be told apart
+  // by reading the tree.
+  const string hash(AddLeaf("leaf"));
+  string other(hash);
+  other[other.size() - 1] ^= 1;
+  EXPECT_EQ(-1, index_.Find(other));
+  tree_.AddLeafHash(other);
+  EXPECT_TRUE(index_.Insert(other, 1));
+  EXPECT_EQ(0, index_.Find(hash));
+  EXPECT_EQ(1, index_.Find(other));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
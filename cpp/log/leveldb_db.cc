@@ -2,29 +2,77 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <leveldb/write_batch.h>
 #include <stdint.h>
+#include <algorithm>
 #include <map>
+#include <memory>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
+#include "log/frozen_hash_index.h"
+#include "merkletree/serial_hasher.h"
 #include "monitoring/latency.h"
 #include "monitoring/monitoring.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
+#include "util/memory_budget.h"
 #include "util/util.h"
 
 using std::chrono::milliseconds;
 using std::lock_guard;
 using std::make_pair;
+using std::map;
+using std::max;
 using std::min;
 using std::mutex;
+using std::shared_ptr;
 using std::string;
 using std::unique_lock;
 using std::unique_ptr;
+using std::vector;
+using std::weak_ptr;
 
 DEFINE_int32(leveldb_max_open_files, 0,
              "number of open files that can be used by leveldb");
 DEFINE_int32(leveldb_bloom_filter_bits_per_key, 0,
-             "number of open files that can be used by leveldb");
+             "number of bits per key of the bloom filter of leveldb tables, "
+             "or 0 for none");
+DEFINE_int32(leveldb_block_cache_mb, 0,
+             "size in MiB of the cache of uncompressed leveldb blocks, shared "
+             "by all the leveldb databases of the process, or 0 for the "
+             "default of leveldb (8 MiB for each database)");
+DEFINE_int32(leveldb_write_buffer_mb, 0,
+             "size in MiB of the leveldb memtable, up to which writes are "
+             "buffered before being written to a table, or 0 for the "
+             "default of leveldb (4 MiB)");
+DEFINE_string(leveldb_compression, "snappy",
+              "compression of leveldb blocks: \"snappy\" or \"none\"");
+DEFINE_bool(leveldb_hash_index_on_disk, false,
+            "keep the index of entries by hash in the leveldb database, "
+            "rather than in memory, which saves memory and startup time "
+            "for large logs");
+DEFINE_int32(leveldb_hash_index_cache_size, 1 << 20,
+             "number of entries of the on-disk hash index to cache in "
+             "memory, when --leveldb_hash_index_on_disk is set");
+DEFINE_int32(leveldb_frozen_hash_index_entries, 0,
+             "with the hash index in memory, replace the index of each run "
+             "of this many first entries of the log by a minimal perfect "
+             "hash kept in a file of its own at startup, which takes about "
+             "7 bytes per entry rather than 50 or more, or 0 not to");
+DEFINE_int32(leveldb_build_index_threads, 4,
+             "number of threads reading and hashing the entries when "
+             "building the index of the database at startup");
+DEFINE_bool(leveldb_dedup_chains, false,
+            "store each certificate of the chains of new entries only once, "
+            "with the entries referring to it by digest, which saves the "
+            "space of the intermediates repeated in most entries");
+DEFINE_int32(leveldb_chain_cache_size, 10000,
+             "number of chain certificates to cache in memory, when reading "
+             "entries stored with --leveldb_dedup_chains");
 
 namespace cert_trans {
 namespace {
@@ -35,10 +83,44 @@ static Latency<milliseconds, string> latency_by_op_ms(
     "Database latency in ms broken out by operation.");
 
 
+// The keys are partitioned by prefix, and within each partition sort in
+// the order they are scanned in:
+//   entry-<index>       the entry with sequence number <index>
+//   leaf-<index>        its Merkle leaf hash
+//   hash-<entry hash>   the lowest <index> of the entries with that hash,
+//                       with --leveldb_hash_index_on_disk
+//   chain-<digest>      a chain certificate, with --leveldb_dedup_chains
+//   sth-<timestamp>     the tree head signed at <timestamp>
+//   meta-<name>         the metadata below
+// where <index> is 8 bytes and <timestamp> kTimestampBytesIndexed bytes,
+// both big-endian, so that numeric order is that of the keys. <index> is
+// written in hex, as it always has been, in both keys and values.
 const char kMetaNodeIdKey[] = "metadata";
 const char kEntryPrefix[] = "entry-";
+const char kLeafHashPrefix[] = "leaf-";
+// Number of missing leaf hashes to write at once when upgrading a
+// database.
+const int64_t kLeafHashWriteBatchSize = 10000;
+// Number of sequence numbers that each thread building the index reads
+// at a time, which bounds the memory that their results take.
+const int64_t kBuildIndexRangeSize = 100000;
+// Ranges of at least this many entries are scanned like ScanEntries(),
+// without filling the block cache.
+const int64_t kBulkScanEntries = 10000;
 const char kTreeHeadPrefix[] = "sth-";
 const char kMetaPrefix[] = "meta-";
+const char kHashPrefix[] = "hash-";
+// Present when every entry is in the on-disk hash index.
+const char kMetaHashIndexKey[] = "hash_index";
+// An <index> below which every entry is present, along with its leaf
+// hash and its place in the on-disk hash index. Written after the
+// entries, so it may lag behind TreeSize(), but never gets ahead of it.
+const char kMetaContiguousSizeKey[] = "contiguous_size";
+// Followed by the SHA-256 of a chain certificate, with --leveldb_dedup_chains.
+const char kChainCertificatePrefix[] = "chain-";
+// The files of the frozen hash indices in the database directory, each
+// followed by the first sequence number that it covers, in decimal.
+const char kFrozenHashIndexFile[] = "frozen_hash_index-";
 
 
 #ifdef HAVE_LEVELDB_FILTER_POLICY_H
@@ -55,9 +137,42 @@ unique_ptr<const leveldb::FilterPolicy> BuildFilterPolicy() {
 #endif
 
 
+// The block cache of every LevelDB of the process, so that many of them
+// (e.g. the shards of a ShardedDatabase) share one budget rather than
+// each having its own. It is created with the first of them that is
+// opened, and freed with the last one. LevelDB cannot resize it, so it
+// is reserved in the MemoryBudget, if any, for as long as it exists.
+shared_ptr<leveldb::Cache> SharedBlockCache() {
+  if (FLAGS_leveldb_block_cache_mb <= 0) {
+    return nullptr;
+  }
+  static mutex* const cache_lock(new mutex);
+  static weak_ptr<leveldb::Cache>* const cache(new weak_ptr<leveldb::Cache>);
+  lock_guard<mutex> lock(*cache_lock);
+  shared_ptr<leveldb::Cache> retval(cache->lock());
+  if (!retval) {
+    const size_t bytes(static_cast<size_t>(FLAGS_leveldb_block_cache_mb)
+                       << 20);
+    MemoryBudget* const budget(MemoryBudget::Default());
+    if (budget) {
+      budget->Reserve("leveldb_block_cache", bytes);
+    }
+    retval.reset(leveldb::NewLRUCache(bytes),
+                 [budget, bytes](leveldb::Cache* cache) {
+                   delete cache;
+                   if (budget) {
+                     budget->Release("leveldb_block_cache", bytes);
+                   }
+                 });
+    *cache = retval;
+  }
+  return retval;
+}
+
+
 // WARNING: Do NOT change the type of "index" from int64_t, or you'll
 // break existing databases!
-string IndexToKey(int64_t index) {
+string IndexToKey(int64_t index, const char* prefix = kEntryPrefix) {
   const char nibble[] = "0123456789abcdef";
   string index_str(sizeof(index) * 2, nibble[0]);
   for (int i = sizeof(index) * 2; i > 0 && index > 0; --i) {
@@ -65,13 +180,13 @@ string IndexToKey(int64_t index) {
     index = index >> 4;
   }
 
-  return kEntryPrefix + index_str;
+  return prefix + index_str;
 }
 
 
-int64_t KeyToIndex(leveldb::Slice key) {
-  CHECK(key.starts_with(kEntryPrefix));
-  key.remove_prefix(strlen(kEntryPrefix));
+int64_t KeyToIndex(leveldb::Slice key, const char* prefix = kEntryPrefix) {
+  CHECK(key.starts_with(prefix));
+  key.remove_prefix(strlen(prefix));
   const string index_str(util::BinaryString(key.ToString()));
 
   int64_t index(0);
@@ -84,13 +199,63 @@ int64_t KeyToIndex(leveldb::Slice key) {
 }
 
 
+// The chain of |entry|, whichever type it is, or NULL if none.
+google::protobuf::RepeatedPtrField<string>* MutableChain(LoggedEntry* entry) {
+  switch (entry->entry().type()) {
+    case ct::X509_ENTRY:
+      return entry->mutable_entry()
+          ->mutable_x509_entry()
+          ->mutable_certificate_chain();
+    case ct::PRECERT_ENTRY:
+      return entry->mutable_entry()
+          ->mutable_precert_entry()
+          ->mutable_precertificate_chain();
+    default:
+      return nullptr;
+  }
+}
+
+
+// The first key after all those that start with |prefix|.
+string PrefixEnd(const string& prefix) {
+  CHECK(!prefix.empty());
+  string end(prefix);
+  CHECK_NE(static_cast<unsigned char>(end.back()), 0xff);
+  ++end.back();
+  return end;
+}
+
+
+string FrozenHashIndexPath(const string& dbfile, int64_t begin) {
+  return dbfile + "/" + kFrozenHashIndexFile + std::to_string(begin);
+}
+
+
+// Bulk scans read each block once, and so are kept from evicting the
+// blocks of lookups from the block cache.
+leveldb::ReadOptions ScanOptions() {
+  leveldb::ReadOptions options;
+  options.fill_cache = false;
+  return options;
+}
+
+
 }  // namespace
 
 
 class LevelDB::Iterator : public Database::Iterator {
  public:
-  Iterator(const LevelDB* db, int64_t start_index)
-      : it_(CHECK_NOTNULL(db)->db_->NewIterator(leveldb::ReadOptions())) {
+  // Stops after |end_index|, if it is not negative. Ranges are read to
+  // serve get-entries, and unlike bulk scans fill the block cache,
+  // unless they are longer than kBulkScanEntries (as those of snapshots
+  // and db_tool are).
+  Iterator(const LevelDB* db, int64_t start_index, int64_t end_index)
+      : db_(db),
+        end_index_(end_index),
+        it_(CHECK_NOTNULL(db)->db_->NewIterator(
+            end_index < 0 || end_index - start_index >= kBulkScanEntries
+                ? ScanOptions()
+                : leveldb::ReadOptions())) {
     CHECK(it_);
     it_->Seek(IndexToKey(start_index));
   }
@@ -101,8 +266,10 @@ class LevelDB::Iterator : public Database::Iterator {
     }
 
     const int64_t seq(KeyToIndex(it_->key()));
-    CHECK(entry->ParseFromArray(it_->value().data(), it_->value().size()))
-        << "failed to parse entry for key " << it_->key().ToString();
+    if (end_index_ >= 0 && seq > end_index_) {
+      return false;
+    }
+    db_->ParseEntry(it_->value(), fields(), entry);
     CHECK(entry->has_sequence_number())
         << "no sequence number for entry with expected sequence number "
         << seq;
@@ -113,12 +280,41 @@ class LevelDB::Iterator : public Database::Iterator {
     return true;
   }
 
+ private:
+  const LevelDB* const db_;
+  const int64_t end_index_;
+  const unique_ptr<leveldb::Iterator> it_;
+};
+
+
+class LevelDB::LeafHashIterator : public Database::LeafHashIterator {
+ public:
+  LeafHashIterator(const LevelDB* db, int64_t start_index)
+      : it_(CHECK_NOTNULL(db)->db_->NewIterator(ScanOptions())) {
+    CHECK(it_);
+    it_->Seek(IndexToKey(start_index, kLeafHashPrefix));
+  }
+
+  bool GetNextLeafHash(int64_t* sequence_number, string* leaf_hash) override {
+    if (!it_->Valid() || !it_->key().starts_with(kLeafHashPrefix)) {
+      return false;
+    }
+
+    *sequence_number = KeyToIndex(it_->key(), kLeafHashPrefix);
+    leaf_hash->assign(it_->value().data(), it_->value().size());
+
+    it_->Next();
+
+    return true;
+  }
+
  private:
   const unique_ptr<leveldb::Iterator> it_;
 };
 
 
 const size_t LevelDB::kTimestampBytesIndexed = 6;
+const size_t LevelDB::kHashIndexShards;
 
 
 LevelDB::LevelDB(const string& dbfile)
@@ -126,7 +322,14 @@ LevelDB::LevelDB(const string& dbfile)
 #ifdef HAVE_LEVELDB_FILTER_POLICY_H
       filter_policy_(BuildFilterPolicy()),
 #endif
+      block_cache_(SharedBlockCache()),
       contiguous_size_(0),
+      hash_index_on_disk_(FLAGS_leveldb_hash_index_on_disk),
+      hash_index_shard_size_(
+          max(FLAGS_leveldb_hash_index_cache_size, 0) /
+          kHashIndexShards),
+      chains_by_digest_(FLAGS_leveldb_dedup_chains),
+      chain_cache_size_(max(FLAGS_leveldb_chain_cache_size, 0)),
       latest_tree_timestamp_(0) {
   LOG(INFO) << "Opening " << dbfile;
   ScopedLatency latency(latency_by_op_ms.GetScopedLatency("open"));
@@ -135,6 +338,19 @@ LevelDB::LevelDB(const string& dbfile)
   if (FLAGS_leveldb_max_open_files > 0) {
     options.max_open_files = FLAGS_leveldb_max_open_files;
   }
+  CHECK_GE(FLAGS_leveldb_block_cache_mb, 0);
+  CHECK_GE(FLAGS_leveldb_write_buffer_mb, 0);
+  CHECK(FLAGS_leveldb_compression == "snappy" ||
+        FLAGS_leveldb_compression == "none")
+      << "unknown --leveldb_compression " << FLAGS_leveldb_compression;
+  options.block_cache = block_cache_.get();
+  if (FLAGS_leveldb_write_buffer_mb > 0) {
+    options.write_buffer_size =
+        static_cast<size_t>(FLAGS_leveldb_write_buffer_mb) << 20;
+  }
+  options.compression = FLAGS_leveldb_compression == "none"
+                            ? leveldb::kNoCompression
+                            : leveldb::kSnappyCompression;
 #ifdef HAVE_LEVELDB_FILTER_POLICY_H
   options.filter_policy = filter_policy_.get();
 #else
@@ -146,7 +362,11 @@ LevelDB::LevelDB(const string& dbfile)
   CHECK(status.ok()) << status.ToString();
   db_.reset(db);
 
-  BuildIndex();
+  BuildIndex(dbfile);
+}
+
+
+LevelDB::~LevelDB() {
 }
 
 
@@ -157,31 +377,123 @@ Database::WriteResult LevelDB::CreateSequencedEntry_(
   ScopedLatency latency(
       latency_by_op_ms.GetScopedLatency("create_sequenced_entry"));
 
-  unique_lock<mutex> lock(lock_);
+  size_t num_created;
+  return WriteSequencedEntries({&logged}, &num_created);
+}
 
-  string data;
-  CHECK(logged.SerializeToString(&data));
 
-  const string key(IndexToKey(logged.sequence_number()));
+Database::WriteResult LevelDB::CreateSequencedEntries_(
+    const vector<LoggedEntry>& logged, size_t* num_created) {
+  ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("create_sequenced_entries"));
 
-  string existing_data;
-  leveldb::Status status(
-      db_->Get(leveldb::ReadOptions(), key, &existing_data));
-  if (status.IsNotFound()) {
-    status = db_->Put(leveldb::WriteOptions(), key, data);
-    CHECK(status.ok()) << "Failed to write sequenced entry (seq: "
-                       << logged.sequence_number()
-                       << "): " << status.ToString();
-  } else {
-    if (existing_data == data) {
-      return this->OK;
+  vector<const LoggedEntry*> entries;
+  entries.reserve(logged.size());
+  for (const LoggedEntry& entry : logged) {
+    entries.push_back(&entry);
+  }
+  return WriteSequencedEntries(entries, num_created);
+}
+
+
+Database::WriteResult LevelDB::WriteSequencedEntries(
+    const vector<const LoggedEntry*>& entries, size_t* num_created) {
+  unique_lock<mutex> lock(lock_);
+
+  leveldb::WriteBatch batch;
+  // The entries in |batch|, by sequence number, and their hashes.
+  map<int64_t, string> batch_data;
+  vector<std::pair<int64_t, string>> batch_hashes;
+  // The lowest sequence number for each hash in |batch|, for the on-disk
+  // hash index.
+  std::unordered_map<string, int64_t> batch_seq_by_hash;
+  // The chain certificates in |batch|, by digest.
+  vector<std::pair<string, string>> batch_certificates;
+  WriteResult result(this->OK);
+  for (*num_created = 0; *num_created < entries.size(); ++*num_created) {
+    const LoggedEntry& logged(*entries[*num_created]);
+    const int64_t seq(logged.sequence_number());
+    const string data(SerializeEntry(logged, &batch, &batch_certificates));
+
+    const string key(IndexToKey(seq));
+    const auto batched(batch_data.find(seq));
+    string existing_data;
+    leveldb::Status status;
+    if (batched != batch_data.end()) {
+      existing_data = batched->second;
+    } else {
+      status = db_->Get(leveldb::ReadOptions(), key, &existing_data);
+      CHECK(status.ok() || status.IsNotFound()) << status.ToString();
+    }
+    if (batched != batch_data.end() || status.ok()) {
+      if (existing_data == data) {
+        continue;
+      }
+      // It may be the same entry stored the other way, with or without
+      // the chain by digest.
+      LoggedEntry existing;
+      ParseEntry(existing_data, LoggedEntry::PARSE_ALL, &existing);
+      if (existing == logged) {
+        continue;
+      }
+      result = this->SEQUENCE_NUMBER_ALREADY_IN_USE;
+      break;
+    }
+
+    batch.Put(key, data);
+    batch.Put(IndexToKey(seq, kLeafHashPrefix), logged.MerkleLeafHash());
+    batch_data.insert(make_pair(seq, data));
+    batch_hashes.emplace_back(seq, logged.Hash());
+    const string& hash(batch_hashes.back().second);
+    if (hash_index_on_disk_) {
+      // Keep track of the entry with the lowest sequence number.
+      auto lowest(batch_seq_by_hash.find(hash));
+      if (lowest == batch_seq_by_hash.end()) {
+        const string hash_key(kHashPrefix + hash);
+        string existing_seq;
+        status = db_->Get(leveldb::ReadOptions(), hash_key, &existing_seq);
+        CHECK(status.ok() || status.IsNotFound()) << status.ToString();
+        lowest = batch_seq_by_hash
+                     .insert(make_pair(hash, status.ok()
+                                                 ? KeyToIndex(existing_seq, "")
+                                                 : INT64_MAX))
+                     .first;
+      }
+      if (seq < lowest->second) {
+        lowest->second = seq;
+        batch.Put(kHashPrefix + hash, IndexToKey(seq, ""));
+      }
     }
-    return this->SEQUENCE_NUMBER_ALREADY_IN_USE;
   }
 
-  InsertEntryMapping(logged.sequence_number(), logged.Hash());
+  if (batch_hashes.empty()) {
+    return result;
+  }
 
-  return this->OK;
+  const leveldb::Status status(db_->Write(leveldb::WriteOptions(), &batch));
+  CHECK(status.ok()) << "Failed to write " << batch_hashes.size()
+                     << " sequenced entries (first seq: "
+                     << batch_hashes.front().first
+                     << "): " << status.ToString();
+
+  for (const auto& certificate : batch_certificates) {
+    CacheChainCertificate(certificate.first, certificate.second);
+  }
+  const int64_t previous_size(contiguous_size_);
+  for (const auto& entry : batch_hashes) {
+    if (hash_index_on_disk_) {
+      HashIndexShard* const shard(HashShard(entry.second));
+      lock_guard<mutex> shard_lock(shard->lock);
+      shard->seq_by_hash.erase(entry.second);
+      ++shard->generation;
+    }
+    InsertEntryMapping(entry.first, entry.second);
+  }
+  if (hash_index_on_disk_ && contiguous_size_ != previous_size) {
+    WriteContiguousSize();
+  }
+
+  return result;
 }
 
 
@@ -189,16 +501,38 @@ Database::LookupResult LevelDB::LookupByHash(const string& hash,
                                              LoggedEntry* result) const {
   ScopedLatency latency(latency_by_op_ms.GetScopedLatency("lookup_by_hash"));
 
-  unique_lock<mutex> lock(lock_);
-
-  auto i(id_by_hash_.find(hash));
-  if (i == id_by_hash_.end()) {
-    return this->NOT_FOUND;
+  int64_t sequence_number;
+  if (hash_index_on_disk_) {
+    if (!LookupHashIndex(hash, &sequence_number)) {
+      return this->NOT_FOUND;
+    }
+  } else {
+    for (const auto& frozen : frozen_hash_indices_) {
+      const int64_t candidate(frozen->Find(hash));
+      // The frozen indices only check a fingerprint of the hash, which
+      // other hashes match once in a while.
+      LoggedEntry logged;
+      if (candidate >= 0 &&
+          LookupByIndex(candidate, &logged) == this->LOOKUP_OK &&
+          logged.Hash() == hash) {
+        if (result) {
+          logged.Swap(result);
+        }
+        return this->LOOKUP_OK;
+      }
+    }
+    lock_guard<mutex> lock(id_by_hash_lock_);
+    auto i(id_by_hash_.find(hash));
+    if (i == id_by_hash_.end()) {
+      return this->NOT_FOUND;
+    }
+    sequence_number = i->second;
   }
 
   string cert_data;
-  const leveldb::Status status(
-      db_->Get(leveldb::ReadOptions(), IndexToKey(i->second), &cert_data));
+  const leveldb::Status status(db_->Get(leveldb::ReadOptions(),
+                                        IndexToKey(sequence_number),
+                                        &cert_data));
   if (status.IsNotFound()) {
     return this->NOT_FOUND;
   }
@@ -206,7 +540,7 @@ Database::LookupResult LevelDB::LookupByHash(const string& hash,
                      << "): " << status.ToString();
 
   LoggedEntry logged;
-  CHECK(logged.ParseFromString(cert_data));
+  ParseEntry(cert_data, LoggedEntry::PARSE_ALL, &logged);
   CHECK_EQ(logged.Hash(), hash);
 
   if (result) {
@@ -232,7 +566,7 @@ Database::LookupResult LevelDB::LookupByIndex(int64_t sequence_number,
                      << sequence_number;
 
   if (result) {
-    CHECK(result->ParseFromString(cert_data));
+    ParseEntry(cert_data, LoggedEntry::PARSE_ALL, result);
     CHECK_EQ(result->sequence_number(), sequence_number);
   }
 
@@ -242,7 +576,21 @@ Database::LookupResult LevelDB::LookupByIndex(int64_t sequence_number,
 
 unique_ptr<Database::Iterator> LevelDB::ScanEntries(
     int64_t start_index) const {
-  return unique_ptr<Iterator>(new Iterator(this, start_index));
+  return unique_ptr<Iterator>(new Iterator(this, start_index, -1));
+}
+
+
+unique_ptr<Database::Iterator> LevelDB::ScanRange(int64_t start,
+                                                  int64_t end) const {
+  CHECK_GE(end, 0);
+  return unique_ptr<Iterator>(new Iterator(this, start, end));
+}
+
+
+unique_ptr<Database::LeafHashIterator> LevelDB::ScanLeafHashes(
+    int64_t start_index) const {
+  return unique_ptr<LeafHashIterator>(
+      new LeafHashIterator(this, start_index));
 }
 
 
@@ -275,9 +623,12 @@ Database::WriteResult LevelDB::WriteTreeHead_(const ct::SignedTreeHead& sth) {
   CHECK(status.ok()) << "Failed to write tree head (" << timestamp_key
                      << "): " << status.ToString();
 
-  if (sth.timestamp() > latest_tree_timestamp_) {
-    latest_tree_timestamp_ = sth.timestamp();
-    latest_timestamp_key_ = timestamp_key;
+  {
+    lock_guard<mutex> tree_head_lock(tree_head_lock_);
+    if (sth.timestamp() > latest_tree_timestamp_) {
+      latest_tree_timestamp_ = sth.timestamp();
+      latest_timestamp_key_ = timestamp_key;
+    }
   }
 
   lock.unlock();
@@ -290,15 +641,31 @@ Database::WriteResult LevelDB::WriteTreeHead_(const ct::SignedTreeHead& sth) {
 Database::LookupResult LevelDB::LatestTreeHead(
     ct::SignedTreeHead* result) const {
   ScopedLatency latency(latency_by_op_ms.GetScopedLatency("latest_tree_head"));
-  lock_guard<mutex> lock(lock_);
 
-  return LatestTreeHeadNoLock(result);
+  return ReadLatestTreeHead(result);
+}
+
+
+vector<ct::SignedTreeHead> LevelDB::ScanTreeHeads() const {
+  ScopedLatency latency(latency_by_op_ms.GetScopedLatency("scan_tree_heads"));
+
+  // The keys end in big-endian timestamps, so they sort in that order.
+  vector<ct::SignedTreeHead> sths;
+  unique_ptr<leveldb::Iterator> it(db_->NewIterator(leveldb::ReadOptions()));
+  CHECK(it);
+  it->Seek(kTreeHeadPrefix);
+  for (; it->Valid() && it->key().starts_with(kTreeHeadPrefix); it->Next()) {
+    sths.emplace_back();
+    CHECK(sths.back().ParseFromArray(it->value().data(), it->value().size()));
+  }
+  CHECK(it->status().ok()) << "Failed to scan tree heads: "
+                           << it->status().ToString();
+  return sths;
 }
 
 
 int64_t LevelDB::TreeSize() const {
   ScopedLatency latency(latency_by_op_ms.GetScopedLatency("tree_size"));
-  lock_guard<mutex> lock(lock_);
 
   return contiguous_size_;
 }
@@ -311,7 +678,7 @@ void LevelDB::AddNotifySTHCallback(
   callbacks_.Add(callback);
 
   ct::SignedTreeHead sth;
-  if (LatestTreeHeadNoLock(&sth) == this->LOOKUP_OK) {
+  if (ReadLatestTreeHead(&sth) == this->LOOKUP_OK) {
     lock.unlock();
     (*callback)(sth);
   }
@@ -355,7 +722,7 @@ Database::LookupResult LevelDB::NodeId(string* node_id) {
 }
 
 
-void LevelDB::BuildIndex() {
+void LevelDB::BuildIndex(const string& dbfile) {
   ScopedLatency latency(latency_by_op_ms.GetScopedLatency("build_index"));
   // Technically, this should only be called from the constructor, so
   // this should not be necessarily, but just to be sure...
@@ -363,28 +730,271 @@ void LevelDB::BuildIndex() {
 
   leveldb::ReadOptions options;
   options.fill_cache = false;
+
+  const string hash_index_key(string(kMetaPrefix) + kMetaHashIndexKey);
+  string unused;
+  leveldb::Status status(db_->Get(options, hash_index_key, &unused));
+  CHECK(status.ok() || status.IsNotFound()) << status.ToString();
+  const bool hash_index_complete(status.ok());
+  if (!hash_index_on_disk_ && hash_index_complete) {
+    // The on-disk index will not be kept up to date from now on.
+    status = db_->Delete(leveldb::WriteOptions(), hash_index_key);
+    CHECK(status.ok()) << "Failed to delete " << hash_index_key << ": "
+                       << status.ToString();
+  }
+  // Whether the entries have to be read at all, rather than just their
+  // sequence numbers.
+  const bool parse_entries(!hash_index_on_disk_ || !hash_index_complete);
+  LOG_IF(INFO, hash_index_on_disk_ && !hash_index_complete)
+      << "Building on-disk hash index";
+
+  // Entries for the on-disk index, with the lowest sequence number for
+  // each hash.
+  std::unordered_map<string, int64_t> pending_hashes;
+  const auto write_pending_hashes([this, &pending_hashes]() {
+    leveldb::WriteBatch batch;
+    for (const auto& hash : pending_hashes) {
+      const string hash_key(kHashPrefix + hash.first);
+      string existing_seq;
+      const leveldb::Status status(
+          db_->Get(leveldb::ReadOptions(), hash_key, &existing_seq));
+      CHECK(status.ok() || status.IsNotFound()) << status.ToString();
+      if (status.IsNotFound() ||
+          KeyToIndex(existing_seq, "") > hash.second) {
+        batch.Put(hash_key, IndexToKey(hash.second, ""));
+      }
+    }
+    const leveldb::Status status(db_->Write(leveldb::WriteOptions(), &batch));
+    CHECK(status.ok()) << "Failed to write hash index: " << status.ToString();
+    pending_hashes.clear();
+  });
+
+  // With the hash index on disk, only the entries from the contiguous
+  // size on have to be read: those below have nothing more to add.
+  int64_t start_index(0);
+  if (hash_index_on_disk_ && hash_index_complete) {
+    string contiguous_size;
+    status = db_->Get(options, string(kMetaPrefix) + kMetaContiguousSizeKey,
+                      &contiguous_size);
+    CHECK(status.ok() || status.IsNotFound()) << status.ToString();
+    if (status.ok()) {
+      start_index = KeyToIndex(contiguous_size, "");
+      contiguous_size_ = start_index;
+      LOG(INFO) << "Reading the entries from " << start_index << " on";
+    }
+  }
+
+  // Likewise, with the hash index in memory, the entries in the frozen
+  // hash indices need not be read again. Those that are read are frozen
+  // in turn when there are enough of them.
+  const int64_t freeze_size(
+      hash_index_on_disk_ ? 0
+                          : max(FLAGS_leveldb_frozen_hash_index_entries, 0));
+  // The hashes from |start_index| on, in sequence number order.
+  vector<std::pair<string, int64_t>> unfrozen;
+  if (freeze_size > 0) {
+    while (true) {
+      unique_ptr<FrozenHashIndex> frozen(
+          FrozenHashIndex::Open(FrozenHashIndexPath(dbfile, start_index)));
+      if (!frozen || frozen->begin() != start_index) {
+        break;
+      }
+      start_index = frozen->end();
+      frozen_hash_indices_.emplace_back(std::move(frozen));
+    }
+    contiguous_size_ = start_index;
+    LOG_IF(INFO, start_index > 0) << "Reading the entries from "
+                                  << start_index << " on, the others are in "
+                                  << frozen_hash_indices_.size()
+                                  << " frozen hash indices";
+  }
+  const auto frozen_end([this]() {
+    return frozen_hash_indices_.empty() ? 0
+                                        : frozen_hash_indices_.back()->end();
+  });
+  const auto freeze_range([this, &dbfile, freeze_size, &unfrozen,
+                           &frozen_end]() {
+    const int64_t begin(frozen_end());
+    const int64_t end(begin + freeze_size);
+    const auto range_end(std::partition_point(
+        unfrozen.begin(), unfrozen.end(),
+        [end](const std::pair<string, int64_t>& entry) {
+          return entry.second < end;
+        }));
+    vector<std::pair<string, int64_t>> range(unfrozen.begin(), range_end);
+    unfrozen.erase(unfrozen.begin(), range_end);
+    {
+      // The lookups go through the frozen indices first, so the hashes
+      // whose lowest sequence number is in one are not needed here.
+      lock_guard<mutex> lock(id_by_hash_lock_);
+      for (const auto& entry : range) {
+        const auto it(id_by_hash_.find(entry.first));
+        if (it != id_by_hash_.end() && it->second < end) {
+          id_by_hash_.erase(it);
+        }
+      }
+    }
+    const string path(FrozenHashIndexPath(dbfile, begin));
+    FrozenHashIndex::Write(path, begin, end, std::move(range));
+    unique_ptr<FrozenHashIndex> frozen(FrozenHashIndex::Open(path));
+    CHECK(frozen) << "Failed to reopen " << path;
+    frozen_hash_indices_.emplace_back(std::move(frozen));
+  });
+
+  // The entries are read in rounds of consecutive ranges of sequence
+  // numbers, one for each thread, which parse and hash them (the bulk
+  // of the work) in parallel. Their results are then added to the index
+  // in sequence number order, as a single scan would have.
+  struct Range {
+    int64_t first;
+    int64_t end;
+    // The sequence numbers present, with their hashes if parse_entries.
+    vector<std::pair<int64_t, string>> entries;
+    int64_t num_missing_leaf_hashes;
+  };
+  const auto scan_range([this, &options, parse_entries](Range* range) {
+    unique_ptr<leveldb::Iterator> it(db_->NewIterator(options));
+    CHECK(it);
+    it->Seek(IndexToKey(range->first));
+    // Databases written before leaf hashes were stored lack some of
+    // them, so walk the leaf hashes alongside the entries to fill in the
+    // gaps.
+    unique_ptr<leveldb::Iterator> leaf_it(db_->NewIterator(options));
+    CHECK(leaf_it);
+    leaf_it->Seek(IndexToKey(range->first, kLeafHashPrefix));
+    leveldb::WriteBatch missing_leaf_hashes;
+    const auto write_missing_leaf_hashes([this, &missing_leaf_hashes]() {
+      const leveldb::Status status(
+          db_->Write(leveldb::WriteOptions(), &missing_leaf_hashes));
+      CHECK(status.ok()) << "Failed to write leaf hashes: "
+                         << status.ToString();
+      missing_leaf_hashes.Clear();
+    });
+
+    // Only the hashes of the entries are needed, which do not cover the
+    // chain, so that is not even parsed.
+    LoggedEntry logged;
+    const auto parse_entry([&it, &logged](int64_t seq) {
+      CHECK(logged.ParseFieldsFromArray(
+          it->value().data(), it->value().size(),
+          LoggedEntry::PARSE_SCT | LoggedEntry::PARSE_LEAF))
+          << "Failed to parse entry with sequence number " << seq;
+      CHECK(logged.has_sequence_number())
+          << "No sequence number for entry with sequence number " << seq;
+      CHECK_EQ(logged.sequence_number(), seq)
+          << "Entry has unexpected sequence_number: " << seq;
+    });
+
+    const string end_key(IndexToKey(range->end));
+    range->num_missing_leaf_hashes = 0;
+    for (; it->Valid() && it->key().starts_with(kEntryPrefix) &&
+           it->key().compare(end_key) < 0;
+         it->Next()) {
+      const int64_t seq(KeyToIndex(it->key()));
+      if (parse_entries) {
+        parse_entry(seq);
+      }
+      range->entries.emplace_back(seq,
+                                  parse_entries ? logged.Hash() : string());
+
+      while (leaf_it->Valid() &&
+             leaf_it->key().starts_with(kLeafHashPrefix) &&
+             KeyToIndex(leaf_it->key(), kLeafHashPrefix) < seq) {
+        leaf_it->Next();
+      }
+      if (!leaf_it->Valid() || !leaf_it->key().starts_with(kLeafHashPrefix) ||
+          KeyToIndex(leaf_it->key(), kLeafHashPrefix) != seq) {
+        if (!parse_entries) {
+          parse_entry(seq);
+        }
+        missing_leaf_hashes.Put(IndexToKey(seq, kLeafHashPrefix),
+                                logged.MerkleLeafHash());
+        if (++range->num_missing_leaf_hashes % kLeafHashWriteBatchSize ==
+            0) {
+          write_missing_leaf_hashes();
+        }
+      }
+    }
+    write_missing_leaf_hashes();
+  });
+
+  // The entries end with the last key of their partition.
   unique_ptr<leveldb::Iterator> it(db_->NewIterator(options));
   CHECK(it);
-  it->Seek(kEntryPrefix);
+  int64_t end_index(start_index);
+  it->Seek(PrefixEnd(kEntryPrefix));
+  if (it->Valid()) {
+    it->Prev();
+  } else {
+    it->SeekToLast();
+  }
+  if (it->Valid() && it->key().starts_with(kEntryPrefix)) {
+    end_index = max(start_index, KeyToIndex(it->key()) + 1);
+  }
 
-  for (; it->Valid() && it->key().starts_with(kEntryPrefix); it->Next()) {
-    const int64_t seq(KeyToIndex(it->key()));
-    LoggedEntry logged;
-    CHECK(logged.ParseFromString(it->value().ToString()))
-        << "Failed to parse entry with sequence number " << seq;
-    CHECK(logged.has_sequence_number())
-        << "No sequence number for entry with sequence number " << seq;
-    CHECK_EQ(logged.sequence_number(), seq)
-        << "Entry has unexpected sequence_number: " << seq;
+  const int64_t num_threads(max(FLAGS_leveldb_build_index_threads, 1));
+  int64_t num_missing_leaf_hashes(0);
+  for (int64_t first = start_index; first < end_index;) {
+    vector<Range> ranges;
+    for (int64_t i = 0; i < num_threads && first < end_index; ++i) {
+      const int64_t end(min(first + kBuildIndexRangeSize, end_index));
+      ranges.push_back(Range{first, end, {}, 0});
+      first = end;
+    }
+    vector<std::thread> threads;
+    for (size_t i = 1; i < ranges.size(); ++i) {
+      threads.emplace_back(scan_range, &ranges[i]);
+    }
+    scan_range(&ranges[0]);
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
 
-    InsertEntryMapping(logged.sequence_number(), logged.Hash());
+    for (const Range& range : ranges) {
+      for (const auto& entry : range.entries) {
+        if (parse_entries && hash_index_on_disk_) {
+          // Entries are in sequence number order, so the first one for
+          // each hash in a batch has the lowest sequence number.
+          pending_hashes.insert(make_pair(entry.second, entry.first));
+          if (static_cast<int64_t>(pending_hashes.size()) >=
+              kLeafHashWriteBatchSize) {
+            write_pending_hashes();
+          }
+        }
+        InsertEntryMapping(entry.first, entry.second);
+        if (freeze_size > 0) {
+          unfrozen.emplace_back(entry.second, entry.first);
+        }
+      }
+      num_missing_leaf_hashes += range.num_missing_leaf_hashes;
+    }
+    while (freeze_size > 0 && contiguous_size_ - frozen_end() >= freeze_size) {
+      freeze_range();
+    }
+  }
+  LOG_IF(INFO, num_missing_leaf_hashes > 0)
+      << "Stored " << num_missing_leaf_hashes << " missing leaf hashes";
+  if (hash_index_on_disk_ && !hash_index_complete) {
+    write_pending_hashes();
+    status = db_->Put(leveldb::WriteOptions(), hash_index_key, string());
+    CHECK(status.ok()) << "Failed to write " << hash_index_key << ": "
+                       << status.ToString();
+  }
+  if (hash_index_on_disk_) {
+    WriteContiguousSize();
   }
 
-  // Now read the STH entries.
-  it->Seek(kTreeHeadPrefix);
-  for (; it->Valid() && it->key().starts_with(kTreeHeadPrefix); it->Next()) {
+  // The latest tree head has the last key of its partition.
+  it->Seek(PrefixEnd(kTreeHeadPrefix));
+  if (it->Valid()) {
+    it->Prev();
+  } else {
+    it->SeekToLast();
+  }
+  if (it->Valid() && it->key().starts_with(kTreeHeadPrefix)) {
     leveldb::Slice key_slice(it->key());
     key_slice.remove_prefix(strlen(kTreeHeadPrefix));
+    lock_guard<mutex> tree_head_lock(tree_head_lock_);
     latest_timestamp_key_ = key_slice.ToString();
     CHECK_EQ(DeserializeResult::OK,
              Deserializer::DeserializeUint<uint64_t>(
@@ -394,46 +1004,199 @@ void LevelDB::BuildIndex() {
 }
 
 
-Database::LookupResult LevelDB::LatestTreeHeadNoLock(
+// This must be called with "lock_" held.
+void LevelDB::WriteContiguousSize() {
+  const leveldb::Status status(
+      db_->Put(leveldb::WriteOptions(),
+               string(kMetaPrefix) + kMetaContiguousSizeKey,
+               IndexToKey(contiguous_size_, "")));
+  CHECK(status.ok()) << "Failed to write the contiguous size: "
+                     << status.ToString();
+}
+
+
+Database::LookupResult LevelDB::ReadLatestTreeHead(
     ct::SignedTreeHead* result) const {
-  if (latest_tree_timestamp_ == 0) {
+  uint64_t timestamp;
+  string timestamp_key;
+  {
+    lock_guard<mutex> lock(tree_head_lock_);
+    timestamp = latest_tree_timestamp_;
+    timestamp_key = latest_timestamp_key_;
+  }
+  if (timestamp == 0) {
     return this->NOT_FOUND;
   }
 
+  // Tree heads are never overwritten, so this is safe to read without
+  // the lock.
   string tree_data;
   leveldb::Status status(db_->Get(leveldb::ReadOptions(),
-                                  kTreeHeadPrefix + latest_timestamp_key_,
+                                  kTreeHeadPrefix + timestamp_key,
                                   &tree_data));
   CHECK(status.ok()) << "Failed to read latest tree head: "
                      << status.ToString();
 
   CHECK(result->ParseFromString(tree_data));
-  CHECK_EQ(result->timestamp(), latest_tree_timestamp_);
+  CHECK_EQ(result->timestamp(), timestamp);
 
   return this->LOOKUP_OK;
 }
 
 
+bool LevelDB::LookupHashIndex(const string& hash,
+                              int64_t* sequence_number) const {
+  HashIndexShard* const shard(HashShard(hash));
+  uint64_t generation;
+  {
+    lock_guard<mutex> lock(shard->lock);
+    const auto i(shard->seq_by_hash.find(hash));
+    if (i != shard->seq_by_hash.end()) {
+      *sequence_number = i->second;
+      return true;
+    }
+    generation = shard->generation;
+  }
+
+  string seq;
+  const leveldb::Status status(
+      db_->Get(leveldb::ReadOptions(), kHashPrefix + hash, &seq));
+  if (status.IsNotFound()) {
+    return false;
+  }
+  CHECK(status.ok()) << "Failed to look up hash(" << util::HexString(hash)
+                     << "): " << status.ToString();
+  *sequence_number = KeyToIndex(seq, "");
+
+  lock_guard<mutex> lock(shard->lock);
+  if (shard->generation == generation && hash_index_shard_size_ > 0) {
+    // Make room by evicting an arbitrary entry.
+    if (shard->seq_by_hash.size() >= hash_index_shard_size_) {
+      shard->seq_by_hash.erase(shard->seq_by_hash.begin());
+    }
+    shard->seq_by_hash.insert(make_pair(hash, *sequence_number));
+  }
+  return true;
+}
+
+
+LevelDB::HashIndexShard* LevelDB::HashShard(const string& hash) const {
+  // Entry hashes are SHA-256 digests, so any of their bytes will do.
+  const size_t shard(
+      hash.empty() ? 0 : static_cast<unsigned char>(hash[0]) %
+                             kHashIndexShards);
+  return &hash_index_cache_[shard];
+}
+
+
 // This must be called with "lock_" held.
 void LevelDB::InsertEntryMapping(int64_t sequence_number, const string& hash) {
-  if (!id_by_hash_.insert(make_pair(hash, sequence_number)).second) {
-    // This is a duplicate hash under a new sequence number.
-    // Make sure we track the entry with the lowest sequence number:
-    id_by_hash_[hash] = min(id_by_hash_[hash], sequence_number);
+  if (!hash_index_on_disk_) {
+    lock_guard<mutex> lock(id_by_hash_lock_);
+    if (!id_by_hash_.insert(make_pair(hash, sequence_number)).second) {
+      // This is a duplicate hash under a new sequence number.
+      // Make sure we track the entry with the lowest sequence number:
+      id_by_hash_[hash] = min(id_by_hash_[hash], sequence_number);
+    }
   }
   if (sequence_number == contiguous_size_) {
-    ++contiguous_size_;
-    for (auto i = sparse_entries_.find(contiguous_size_);
-         i != sparse_entries_.end() && *i == contiguous_size_;) {
-      ++contiguous_size_;
-      i = sparse_entries_.erase(i);
-    }
+    contiguous_size_ = sparse_entries_.TakeRunFrom(sequence_number + 1);
   } else {
     // It's not contiguous, put it with the other sparse entries.
-    CHECK(sparse_entries_.insert(sequence_number).second)
+    CHECK(sparse_entries_.Insert(sequence_number))
         << "sequence number " << sequence_number << " already assigned.";
   }
 }
 
 
+string LevelDB::SerializeEntry(
+    const LoggedEntry& logged, leveldb::WriteBatch* batch,
+    vector<std::pair<string, string>>* new_certificates) const {
+  string data;
+  if (!chains_by_digest_) {
+    CHECK(logged.SerializeToString(&data));
+    return data;
+  }
+
+  LoggedEntry stored(logged);
+  google::protobuf::RepeatedPtrField<string>* const chain(
+      MutableChain(&stored));
+  if (chain == nullptr || chain->size() == 0) {
+    CHECK(logged.SerializeToString(&data));
+    return data;
+  }
+  for (string& certificate : *chain) {
+    string digest(Sha256Hasher::Sha256Digest(certificate));
+    bool cached;
+    {
+      lock_guard<mutex> lock(chain_cache_lock_);
+      cached = chain_cache_.find(digest) != chain_cache_.end();
+    }
+    if (!cached) {
+      batch->Put(kChainCertificatePrefix + digest, certificate);
+      new_certificates->emplace_back(digest, certificate);
+    }
+    certificate.swap(digest);
+  }
+  stored.set_chain_by_digest(true);
+  CHECK(stored.SerializeToString(&data));
+  return data;
+}
+
+
+void LevelDB::ParseEntry(const leveldb::Slice& data, int fields,
+                         LoggedEntry* entry) const {
+  CHECK(entry->ParseFieldsFromArray(data.data(), data.size(), fields))
+      << "failed to parse entry";
+  if (!entry->chain_by_digest()) {
+    return;
+  }
+  if (!(fields & LoggedEntry::PARSE_CHAIN)) {
+    entry->clear_chain_by_digest();
+    return;
+  }
+  google::protobuf::RepeatedPtrField<string>* const chain(
+      MutableChain(entry));
+  CHECK_NOTNULL(chain);
+  for (string& certificate : *chain) {
+    certificate = LookupChainCertificate(certificate);
+  }
+  entry->clear_chain_by_digest();
+}
+
+
+string LevelDB::LookupChainCertificate(const string& digest) const {
+  {
+    lock_guard<mutex> lock(chain_cache_lock_);
+    const auto it(chain_cache_.find(digest));
+    if (it != chain_cache_.end()) {
+      return it->second;
+    }
+  }
+
+  string certificate;
+  const leveldb::Status status(db_->Get(
+      leveldb::ReadOptions(), kChainCertificatePrefix + digest, &certificate));
+  CHECK(status.ok()) << "Failed to read chain certificate "
+                     << util::HexString(digest) << ": " << status.ToString();
+  CacheChainCertificate(digest, certificate);
+  return certificate;
+}
+
+
+void LevelDB::CacheChainCertificate(const string& digest,
+                                    const string& certificate) const {
+  lock_guard<mutex> lock(chain_cache_lock_);
+  if (chain_cache_size_ == 0) {
+    return;
+  }
+  if (chain_cache_.size() >= chain_cache_size_) {
+    // Chains are mostly made of the same few intermediates, so this
+    // only happens if the cache is far too small, whichever goes.
+    chain_cache_.erase(chain_cache_.begin());
+  }
+  chain_cache_.emplace(digest, certificate);
+}
+
+
 }  // namespace cert_trans
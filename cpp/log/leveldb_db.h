@@ -3,36 +3,45 @@
 
 #include "config.h"
 
+#include <leveldb/cache.h>
 #include <leveldb/db.h>
+#include <leveldb/write_batch.h>
 #ifdef HAVE_LEVELDB_FILTER_POLICY_H
 #include <leveldb/filter_policy.h>
 #endif
 #include <stdint.h>
+#include <array>
+#include <atomic>
 #include <map>
 #include <memory>
 #include <mutex>
-#include <set>
 #include <unordered_map>
 #include <vector>
 
 #include "base/macros.h"
 #include "log/database.h"
 #include "proto/ct.pb.h"
+#include "util/range_set.h"
 
 namespace cert_trans {
 
+class FrozenHashIndex;
+
 
 class LevelDB : public Database {
  public:
   static const size_t kTimestampBytesIndexed;
 
   explicit LevelDB(const std::string& dbfile);
-  ~LevelDB() = default;
+  ~LevelDB();
 
   // Implement abstract functions, see database.h for comments.
   Database::WriteResult CreateSequencedEntry_(
       const LoggedEntry& logged) override;
 
+  Database::WriteResult CreateSequencedEntries_(
+      const std::vector<LoggedEntry>& logged, size_t* num_created) override;
+
   Database::LookupResult LookupByHash(const std::string& hash,
                                       LoggedEntry* result) const override;
 
@@ -42,11 +51,19 @@ class LevelDB : public Database {
   std::unique_ptr<Database::Iterator> ScanEntries(
       int64_t start_index) const override;
 
+  std::unique_ptr<Database::Iterator> ScanRange(int64_t start,
+                                                int64_t end) const override;
+
+  std::unique_ptr<Database::LeafHashIterator> ScanLeafHashes(
+      int64_t start_index) const override;
+
   Database::WriteResult WriteTreeHead_(const ct::SignedTreeHead& sth) override;
 
   Database::LookupResult LatestTreeHead(
       ct::SignedTreeHead* result) const override;
 
+  std::vector<ct::SignedTreeHead> ScanTreeHeads() const override;
+
   int64_t TreeSize() const override;
 
   void AddNotifySTHCallback(
@@ -61,28 +78,105 @@ class LevelDB : public Database {
 
  private:
   class Iterator;
-
-  void BuildIndex();
-  Database::LookupResult LatestTreeHeadNoLock(
-      ct::SignedTreeHead* result) const;
+  class LeafHashIterator;
+
+  // A shard of the cache of the on-disk hash index.
+  struct HashIndexShard {
+    std::mutex lock;
+    std::unordered_map<std::string, int64_t> seq_by_hash;
+    // Bumped every time an entry is written, so that lookups racing with
+    // a write do not cache what they read before it.
+    uint64_t generation = 0;
+  };
+
+  static const size_t kHashIndexShards = 16;
+
+  // Writes |entries| in a single batch, see CreateSequencedEntries().
+  Database::WriteResult WriteSequencedEntries(
+      const std::vector<const LoggedEntry*>& entries, size_t* num_created);
+  // Reads the entries which are not yet in an index, the frozen hash
+  // indices of whose files are in |dbfile| first.
+  void BuildIndex(const std::string& dbfile);
+  // Looks up the lowest sequence number of the entry with |hash| in the
+  // on-disk index, going through its cache.
+  bool LookupHashIndex(const std::string& hash, int64_t* sequence_number) const;
+  HashIndexShard* HashShard(const std::string& hash) const;
+  // Does not need lock_.
+  Database::LookupResult ReadLatestTreeHead(ct::SignedTreeHead* result) const;
   void InsertEntryMapping(int64_t sequence_number, const std::string& hash);
-
+  // Records contiguous_size_ in db_, for BuildIndex() to resume from.
+  void WriteContiguousSize();
+  // Returns the serialization to store for |logged|, with its chain
+  // replaced by digests if chains_by_digest_ is set, in which case the
+  // certificates that may not be stored yet are added to |batch|, and
+  // to |new_certificates| by digest, to be cached once it is written.
+  std::string SerializeEntry(
+      const LoggedEntry& logged, leveldb::WriteBatch* batch,
+      std::vector<std::pair<std::string, std::string>>* new_certificates)
+      const;
+  // Parses |fields| (see LoggedEntry::ParseFields) of an entry read from
+  // db_, and puts back its chain if it was stored by digest and is
+  // among them.
+  void ParseEntry(const leveldb::Slice& data, int fields,
+                  LoggedEntry* entry) const;
+  // Looks up the chain certificate with |digest|, going through
+  // chain_cache_.
+  std::string LookupChainCertificate(const std::string& digest) const;
+  void CacheChainCertificate(const std::string& digest,
+                             const std::string& certificate) const;
+
+  // Serializes writes, and guards sparse_entries_ and callbacks_. Reads
+  // of entries do not take it, as leveldb::DB is safe for concurrent use.
   mutable std::mutex lock_;
 #ifdef HAVE_LEVELDB_FILTER_POLICY_H
   // filter_policy_ must be valid for at least as long as db_ is, so
   // keep this order.
   const std::unique_ptr<const leveldb::FilterPolicy> filter_policy_;
 #endif
+  // Likewise. Shared with the other instances, or null for the default
+  // cache of leveldb.
+  const std::shared_ptr<leveldb::Cache> block_cache_;
   std::unique_ptr<leveldb::DB> db_;
 
-  int64_t contiguous_size_;
+  // Only modified with lock_ held, but read without it.
+  std::atomic<int64_t> contiguous_size_;
+  // Whether the index of entries by hash is kept in db_, rather than in
+  // id_by_hash_. This saves having it all in memory, and building it at
+  // startup.
+  const bool hash_index_on_disk_;
+  // Guards id_by_hash_, which is only held for as long as it takes to
+  // look up or update a single entry.
+  mutable std::mutex id_by_hash_lock_;
   std::unordered_map<std::string, int64_t> id_by_hash_;
+  // With the hash index in memory, the indices of the hashes of the
+  // consecutive ranges of entries frozen by BuildIndex(), in order, which
+  // id_by_hash_ only holds the rest of. Not modified after BuildIndex().
+  std::vector<std::unique_ptr<const FrozenHashIndex>> frozen_hash_indices_;
+  // The recently used part of the on-disk index, sharded so that lookups
+  // neither contend with each other nor with writes, each shard holding up
+  // to hash_index_shard_size_ entries.
+  const size_t hash_index_shard_size_;
+  mutable std::array<HashIndexShard, kHashIndexShards> hash_index_cache_;
+
+  // Whether new entries are written with their chain replaced by
+  // digests. Entries stored either way can always be read.
+  const bool chains_by_digest_;
+  // Guards chain_cache_, the certificates of chains by their digest,
+  // which are mostly the same few intermediates, up to
+  // chain_cache_size_ of them.
+  mutable std::mutex chain_cache_lock_;
+  mutable std::unordered_map<std::string, std::string> chain_cache_;
+  const size_t chain_cache_size_;
 
   // This is a mapping of the non-contiguous entries of the log (which
   // can happen while it is being fetched). When entries here become
-  // contiguous with the beginning of the tree, they are removed.
-  std::set<int64_t> sparse_entries_;
+  // contiguous with the beginning of the tree, they are removed. They
+  // are kept as ranges, as they mostly arrive a fetched batch at a time.
+  RangeSet sparse_entries_;
 
+  // Guards latest_tree_timestamp_ and latest_timestamp_key_. Acquired
+  // after lock_, when both are needed.
+  mutable std::mutex tree_head_lock_;
   uint64_t latest_tree_timestamp_;
   std::string latest_timestamp_key_;
   cert_trans::DatabaseNotifierHelper callbacks_;
@@ -1,16 +1,22 @@
 #include "log/log_lookup.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <map>
+#include <unistd.h>
+#include <chrono>
+#include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
 #include "base/time_support.h"
 #include "merkletree/merkle_tree.h"
+#include "merkletree/node_store.h"
 #include "merkletree/serial_hasher.h"
+#include "merkletree/tiered_merkle_tree.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
 #include "util/util.h"
@@ -19,29 +25,145 @@ using ct::MerkleAuditProof;
 using ct::ShortMerkleAuditProof;
 using ct::SignedTreeHead;
 using std::bind;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
 using std::lock_guard;
-using std::make_pair;
-using std::map;
 using std::mutex;
 using std::placeholders::_1;
+using std::shared_ptr;
 using std::string;
 using std::unique_lock;
 using std::unique_ptr;
 using std::vector;
 using util::HexString;
 
+DEFINE_int32(log_lookup_frontier_cache_size, 16,
+             "Number of recently used tree sizes for which to cache the "
+             "right border of the Merkle tree, to serve proofs against "
+             "them without rehashing. 0 disables the cache.");
+DEFINE_bool(log_lookup_sth_history, true,
+            "Keep all the tree heads seen, with the frontiers of their "
+            "trees (about 1kB each), so that roots and proofs for their tree "
+            "sizes need no rehashing.");
+DEFINE_int32(log_lookup_audit_path_cache_size, 10000,
+             "Number of the newest leaves whose audit paths to each new "
+             "tree head are computed, all at once, as it is applied, so that "
+             "proofs for recently sequenced entries (the most requested) "
+             "are only a lookup. 0 disables the cache.");
+DEFINE_int32(log_lookup_read_only_tree_wait_ms, 30000,
+             "How long a lookup following the Merkle tree of another "
+             "process waits for it to be checkpointed at the size of a new "
+             "tree head, before giving up on that tree head.");
+DEFINE_int32(log_lookup_tile_levels, 0,
+             "If positive, a Merkle tree that is not persistent (see "
+             "--merkle_tree_dir) only keeps the nodes above the bottom "
+             "this many levels, and recomputes the others from the leaves "
+             "(see TieredMerkleTree). This divides the memory used for the "
+             "nodes above the leaves by 2^levels, at the cost of up to "
+             "2^levels leaf hashes per node of a proof.");
+DEFINE_string(log_lookup_tiered_leaves_dir, "",
+              "With --log_lookup_tile_levels, keep the leaf hashes in a "
+              "memory-mapped temporary file in this directory, which can be "
+              "paged out, rather than on the heap.");
+
 namespace cert_trans {
 
 
 static const int kCtimeBufSize = 26;
 
 
-LogLookup::LogLookup(ReadOnlyDatabase* db)
+namespace {
+
+
+// Where a TieredMerkleTree keeps its leaves, see
+// --log_lookup_tiered_leaves_dir.
+NodeStore NewLeafStore() {
+  if (FLAGS_log_lookup_tiered_leaves_dir.empty()) {
+    return NodeStore(Sha256Hasher().DigestSize());
+  }
+  string path(FLAGS_log_lookup_tiered_leaves_dir + "/leaves.XXXXXX");
+  const int fd(mkstemp(&path[0]));
+  PCHECK(fd >= 0) << path;
+  // The leaves are reloaded from the database on startup anyway.
+  PCHECK(unlink(path.c_str()) == 0) << path;
+  return NodeStore(Sha256Hasher().DigestSize(),
+                   PersistentMerkleTree::kNodesPerPage, fd, 0);
+}
+
+
+AuditableMerkleTreeInterface* NewInMemoryTree() {
+  if (FLAGS_log_lookup_tile_levels <= 0) {
+    return new MerkleTree(new Sha256Hasher);
+  }
+  return new TieredMerkleTree(NewLeafStore(), FLAGS_log_lookup_tile_levels,
+                              new Sha256Hasher);
+}
+
+
+}  // namespace
+
+
+LogLookup::LogLookup(ReadOnlyDatabase* db, util::Executor* executor)
     : db_(CHECK_NOTNULL(db)),
-      cert_tree_(new Sha256Hasher),
-      latest_tree_head_(),
+      persistent_tree_(nullptr),
+      cert_tree_(NewInMemoryTree()),
+      leaf_index_(cert_tree_.get()),
+      latest_tree_head_(std::make_shared<SignedTreeHead>()),
+      cached_paths_tree_size_(0),
+      cached_paths_first_leaf_(0),
       update_from_sth_cb_(bind(&LogLookup::UpdateFromSTH, this, _1)) {
-  db_->AddNotifySTHCallback(&update_from_sth_cb_);
+  StartUpdates(executor);
+}
+
+
+LogLookup::LogLookup(ReadOnlyDatabase* db, const string& tree_dir)
+    : LogLookup(db, tree_dir, PersistentMerkleTree::READ_WRITE) {
+}
+
+
+LogLookup::LogLookup(ReadOnlyDatabase* db, const string& tree_dir,
+                     PersistentMerkleTree::Access access,
+                     util::Executor* executor)
+    : db_(CHECK_NOTNULL(db)),
+      persistent_tree_(
+          new PersistentMerkleTree(tree_dir, new Sha256Hasher, access)),
+      cert_tree_(persistent_tree_),
+      leaf_index_(cert_tree_.get()),
+      latest_tree_head_(std::make_shared<SignedTreeHead>()),
+      cached_paths_tree_size_(0),
+      cached_paths_first_leaf_(0),
+      update_from_sth_cb_(bind(&LogLookup::UpdateFromSTH, this, _1)) {
+  SignedTreeHead db_sth;
+  const int64_t db_tree_size(
+      db_->LatestTreeHead(&db_sth) == Database::LOOKUP_OK ? db_sth.tree_size()
+                                                          : 0);
+  if (static_cast<uint64_t>(db_tree_size) < cert_tree_->LeafCount()) {
+    if (persistent_tree_->IsReadOnly()) {
+      // The other process is ahead of our database, which will catch up.
+      const util::Status status(persistent_tree_->Reload(db_tree_size));
+      CHECK(status.ok()) << "Failed to reload the tree in " << tree_dir
+                         << " at size " << db_tree_size << ": " << status;
+    } else {
+      LOG(WARNING) << "Persistent tree in " << tree_dir << " has "
+                   << cert_tree_->LeafCount() << " leaves but the database "
+                   << "tree only has " << db_tree_size << ", discarding it.";
+      persistent_tree_->Clear();
+    }
+  } else if (!persistent_tree_->IsReadOnly() && cert_tree_->LeafCount() > 0 &&
+             !TreeMatchesDatabase(db_sth)) {
+    // E.g. the database was restored from a backup, or is another one.
+    LOG(WARNING) << "Persistent tree in " << tree_dir << " with "
+                 << cert_tree_->LeafCount() << " leaves does not match the "
+                 << "database, discarding it.";
+    persistent_tree_->Clear();
+  }
+
+  // The leaf hashes are all in the tree, no need to go to the database.
+  for (size_t leaf = 1; leaf <= cert_tree_->LeafCount(); ++leaf) {
+    leaf_index_.Insert(cert_tree_->LeafHash(leaf), leaf - 1);
+  }
+
+  StartUpdates(executor);
 }
 
 
@@ -50,66 +172,199 @@ LogLookup::~LogLookup() {
 }
 
 
-void LogLookup::UpdateFromSTH(const SignedTreeHead& sth) {
+void LogLookup::StartUpdates(util::Executor* executor) {
+  // Later updates are run by whichever thread wrote the tree head, which
+  // could be one of |executor|, so they hash on their own.
+  cert_tree_->SetExecutor(executor);
+  db_->AddNotifySTHCallback(&update_from_sth_cb_);
   lock_guard<mutex> lock(lock_);
+  cert_tree_->SetExecutor(nullptr);
+}
+
+
+void LogLookup::UpdateFromSTH(const SignedTreeHead& sth) {
+  lock_guard<mutex> update_lock(update_lock_);
 
   CHECK_EQ(ct::V1, sth.version())
       << "Tree head signed with an unknown version";
 
-  if (sth.timestamp() == latest_tree_head_.timestamp())
+  // Only updates change the tree head and the tree size, so they can't
+  // change under us now.
+  const shared_ptr<const SignedTreeHead> old_sth(
+      std::atomic_load(&latest_tree_head_));
+  if (sth.timestamp() == old_sth->timestamp())
     return;
 
+  size_t leaf_count;
+  {
+    lock_guard<mutex> lock(lock_);
+    leaf_count = cert_tree_->LeafCount();
+  }
+
   CHECK_LE(0, sth.tree_size());
-  if (sth.timestamp() <= latest_tree_head_.timestamp() ||
-      static_cast<uint64_t>(sth.tree_size()) < cert_tree_.LeafCount()) {
+  const bool first_update(old_sth->timestamp() == 0);
+  if (sth.timestamp() <= old_sth->timestamp() ||
+      static_cast<uint64_t>(sth.tree_size()) < leaf_count) {
     LOG(WARNING) << "Database replied with an STH that is older than ours: "
-                 << "Our STH:\n" << latest_tree_head_.DebugString()
+                 << "Our STH:\n" << old_sth->DebugString()
                  << "Database STH:\n" << sth.DebugString();
     return;
   }
 
-  // Record the new hashes: append all of them, die on any error.
-  // TODO(ekasper): make tree signer write leaves out to the database,
-  // so that we don't have to read the entries in.
-  string leaf_hash;
-  auto it(db_->ScanEntries(cert_tree_.LeafCount()));
+  const bool read_only(persistent_tree_ && persistent_tree_->IsReadOnly());
   // LeafCount() is potentially unsigned here but as this is using memory
   // the count can never get close to overflow in 64 bits.
-  CHECK_LE(cert_tree_.LeafCount(), static_cast<uint64_t>(INT64_MAX));
+  CHECK_LE(leaf_count, static_cast<uint64_t>(INT64_MAX));
 
-  for (int64_t sequence_number = cert_tree_.LeafCount();
-       sequence_number < sth.tree_size(); ++sequence_number) {
-    LoggedEntry logged;
-    // TODO(ekasper): perhaps some of these errors can/should be
-    // handled more gracefully. E.g. we could retry a failed update
-    // a number of times -- but until we know under which conditions
-    // the database might fail (database busy?), just die.
-    CHECK(it->GetNextEntry(&logged))
-        << "Latest STH has " << sth.tree_size() << "entries but we failed to "
-        << "retrieve entry number " << sequence_number;
-    CHECK(logged.has_sequence_number())
-        << "Logged entry has no sequence number";
-    CHECK_EQ(sequence_number, logged.sequence_number());
-
-    leaf_hash = LeafHash(logged);
-    // TODO(ekasper): plug in the log public key so that we can verify the STH.
-    CHECK_EQ(static_cast<size_t>(sequence_number + 1),
-             cert_tree_.AddLeafHash(leaf_hash));
-    // Duplicate leaves shouldn't really happen but are not a problem either:
-    // we just return the Merkle proof of the first occurrence.
-    leaf_index_.insert(make_pair(leaf_hash, sequence_number));
-  }
-  CHECK_EQ(HexString(cert_tree_.CurrentRoot()),
+  // Read the new leaf hashes without blocking lookups. A read-only tree
+  // gets them from its writer.
+  vector<string> leaf_hashes;
+  if (!read_only) {
+    ReadLeafHashes(leaf_count, sth.tree_size(), &leaf_hashes);
+  }
+
+  unique_lock<mutex> lock(lock_);
+  if (read_only) {
+    if (static_cast<uint64_t>(sth.tree_size()) > leaf_count &&
+        !ReloadTree(&lock, sth.tree_size())) {
+      return;
+    }
+    for (size_t leaf = leaf_count; leaf < cert_tree_->LeafCount(); ++leaf) {
+      leaf_index_.Insert(cert_tree_->LeafHash(leaf + 1), leaf);
+    }
+  } else {
+    // TODO(ekasper): plug in the log public key so that we can verify the
+    // STH.
+    CHECK_EQ(static_cast<size_t>(sth.tree_size()),
+             cert_tree_->AddLeafHashes(leaf_hashes));
+    for (size_t i = 0; i < leaf_hashes.size(); ++i) {
+      // Duplicate leaves shouldn't really happen but are not a problem
+      // either: we just return the Merkle proof of the first occurrence.
+      leaf_index_.Insert(leaf_hashes[i], leaf_count + i);
+    }
+    if (persistent_tree_ && leaf_count > 0 &&
+        cert_tree_->CurrentRoot() != sth.sha256_root_hash()) {
+      // Some of the leaves loaded from disk are not those of the
+      // database, which the checks made when opening the tree missed.
+      LOG(WARNING) << "Persistent tree with " << leaf_count << " leaves "
+                   << "does not match the database at size "
+                   << sth.tree_size() << ", rebuilding it.";
+      RebuildTree(lock, sth.tree_size());
+    }
+  }
+  CHECK_EQ(HexString(cert_tree_->CurrentRoot()),
            HexString(sth.sha256_root_hash()))
       << "Computed root hash and stored STH root hash do not match";
-  LOG(INFO) << "Found " << sth.tree_size() - latest_tree_head_.tree_size()
+  LOG(INFO) << "Found " << sth.tree_size() - old_sth->tree_size()
             << " new log entries";
-  latest_tree_head_.CopyFrom(sth);
+  std::atomic_store(&latest_tree_head_,
+                    shared_ptr<const SignedTreeHead>(
+                        std::make_shared<SignedTreeHead>(sth)));
+
+  if (persistent_tree_ && !read_only) {
+    const util::Status status(persistent_tree_->Checkpoint());
+    LOG_IF(WARNING, !status.ok()) << "Failed to checkpoint the tree: "
+                                  << status;
+  }
+
+  // Clients will soon ask for proofs against the new tree head, mostly
+  // for the entries just added.
+  GetFrontier(lock, sth.tree_size());
+  AddToHistory(lock, sth);
+  CacheAuditPaths(lock, sth.tree_size());
 
-  const time_t last_update(static_cast<time_t>(latest_tree_head_.timestamp() /
-                                               kNumMillisPerSecond));
+  const time_t last_update(
+      static_cast<time_t>(sth.timestamp() / kNumMillisPerSecond));
   char buf[kCtimeBufSize];
   LOG(INFO) << "Tree successfully updated at " << ctime_r(&last_update, buf);
+
+  const vector<UpdateCallback> callbacks(update_callbacks_);
+  lock.unlock();
+  for (const auto& callback : callbacks) {
+    callback(sth);
+  }
+
+  if (first_update) {
+    LoadHistory(sth.tree_size());
+  }
+}
+
+
+void LogLookup::ReadLeafHashes(int64_t start, int64_t end,
+                               vector<string>* leaf_hashes) const {
+  auto it(db_->ScanLeafHashes(start));
+  for (int64_t sequence_number = start; sequence_number < end;
+       ++sequence_number) {
+    int64_t leaf_sequence_number;
+    string leaf_hash;
+    // TODO(ekasper): perhaps some of these errors can/should be
+    // handled more gracefully. E.g. we could retry a failed update
+    // a number of times -- but until we know under which conditions
+    // the database might fail (database busy?), just die.
+    CHECK(it->GetNextLeafHash(&leaf_sequence_number, &leaf_hash))
+        << "Latest STH has " << end << "entries but we failed "
+        << "to retrieve entry number " << sequence_number;
+    CHECK_EQ(sequence_number, leaf_sequence_number);
+
+    leaf_hashes->emplace_back(std::move(leaf_hash));
+  }
+}
+
+
+bool LogLookup::TreeMatchesDatabase(const SignedTreeHead& db_sth) {
+  const size_t leaf_count(cert_tree_->LeafCount());
+  if (static_cast<uint64_t>(db_sth.tree_size()) == leaf_count) {
+    return cert_tree_->CurrentRoot() == db_sth.sha256_root_hash();
+  }
+  int64_t sequence_number;
+  string leaf_hash;
+  return db_->ScanLeafHashes(leaf_count - 1)
+             ->GetNextLeafHash(&sequence_number, &leaf_hash) &&
+         static_cast<size_t>(sequence_number) == leaf_count - 1 &&
+         leaf_hash == cert_tree_->LeafHash(leaf_count);
+}
+
+
+void LogLookup::RebuildTree(const unique_lock<mutex>& lock, size_t tree_size) {
+  CHECK(lock.owns_lock());
+  persistent_tree_->Clear();
+  leaf_index_.Clear();
+  frontiers_.clear();
+  sth_history_.clear();
+  cached_paths_.clear();
+  cached_paths_tree_size_ = 0;
+  cached_paths_first_leaf_ = 0;
+
+  vector<string> leaf_hashes;
+  ReadLeafHashes(0, tree_size, &leaf_hashes);
+  CHECK_EQ(tree_size, cert_tree_->AddLeafHashes(leaf_hashes));
+  for (size_t i = 0; i < leaf_hashes.size(); ++i) {
+    leaf_index_.Insert(leaf_hashes[i], i);
+  }
+}
+
+
+bool LogLookup::ReloadTree(unique_lock<mutex>* lock, size_t tree_size) {
+  CHECK(lock->owns_lock());
+  const steady_clock::time_point deadline(
+      steady_clock::now() +
+      milliseconds(FLAGS_log_lookup_read_only_tree_wait_ms));
+  while (true) {
+    const util::Status status(persistent_tree_->Reload(tree_size));
+    if (status.ok()) {
+      return true;
+    }
+    if (status.CanonicalCode() != util::error::UNAVAILABLE ||
+        steady_clock::now() >= deadline) {
+      LOG(WARNING) << "Failed to reload the tree at size " << tree_size
+                   << ": " << status;
+      return false;
+    }
+    // Only updates modify the tree, so it is fine to let lookups in.
+    lock->unlock();
+    std::this_thread::sleep_for(milliseconds(50));
+    lock->lock();
+  }
 }
 
 
@@ -139,18 +394,19 @@ LogLookup::LookupResult LogLookup::AuditProof(const string& merkle_leaf_hash,
 
   CHECK_GE(leaf_index, 0);
   proof->set_version(ct::V1);
-  proof->set_tree_size(cert_tree_.LeafCount());
-  proof->set_timestamp(latest_tree_head_.timestamp());
+  proof->set_tree_size(cert_tree_->LeafCount());
+  const shared_ptr<const SignedTreeHead> sth(
+      std::atomic_load(&latest_tree_head_));
+  proof->set_timestamp(sth->timestamp());
   proof->set_leaf_index(leaf_index);
 
   proof->clear_path_node();
-  vector<string> audit_path = cert_tree_.PathToCurrentRoot(leaf_index + 1);
+  vector<string> audit_path = cert_tree_->PathToCurrentRoot(leaf_index + 1);
   for (size_t i = 0; i < audit_path.size(); ++i)
     proof->add_path_node(audit_path[i]);
 
-  proof->mutable_id()->CopyFrom(latest_tree_head_.id());
-  proof->mutable_tree_head_signature()->CopyFrom(
-      latest_tree_head_.signature());
+  proof->mutable_id()->CopyFrom(sth->id());
+  proof->mutable_tree_head_signature()->CopyFrom(sth->signature());
   return OK;
 }
 
@@ -158,20 +414,48 @@ LogLookup::LookupResult LogLookup::AuditProof(const string& merkle_leaf_hash,
 LogLookup::LookupResult LogLookup::AuditProof(int64_t leaf_index,
                                               size_t tree_size,
                                               ShortMerkleAuditProof* proof) {
-  lock_guard<mutex> lock(lock_);
-
-  proof->set_leaf_index(leaf_index);
+  unique_lock<mutex> lock(lock_);
+  AuditPaths(lock, {leaf_index}, tree_size, {proof});
+  return OK;
+}
 
-  proof->clear_path_node();
-  vector<string> audit_path =
-      cert_tree_.PathToRootAtSnapshot(leaf_index + 1, tree_size);
-  for (size_t i = 0; i < audit_path.size(); ++i)
-    proof->add_path_node(audit_path[i]);
 
+LogLookup::LookupResult LogLookup::AuditProofs(
+    const vector<int64_t>& indices, size_t tree_size,
+    vector<ShortMerkleAuditProof>* proofs) {
+  unique_lock<mutex> lock(lock_);
+  proofs->clear();
+  proofs->resize(indices.size());
+  vector<ShortMerkleAuditProof*> to_fill;
+  to_fill.reserve(indices.size());
+  for (ShortMerkleAuditProof& proof : *proofs) {
+    to_fill.push_back(&proof);
+  }
+  AuditPaths(lock, indices, tree_size, to_fill);
   return OK;
 }
 
 
+LogLookup::LookupResult LogLookup::AuditProofs(
+    const vector<string>& merkle_leaf_hashes, size_t tree_size,
+    vector<ShortMerkleAuditProof>* proofs) {
+  unique_lock<mutex> lock(lock_);
+  proofs->clear();
+  proofs->resize(merkle_leaf_hashes.size());
+  vector<int64_t> indices;
+  vector<ShortMerkleAuditProof*> to_fill;
+  for (size_t i = 0; i < merkle_leaf_hashes.size(); ++i) {
+    const int64_t leaf_index(GetIndexInternal(lock, merkle_leaf_hashes[i]));
+    if (leaf_index >= 0 && static_cast<size_t>(leaf_index) < tree_size) {
+      indices.push_back(leaf_index);
+      to_fill.push_back(&(*proofs)[i]);
+    }
+  }
+  AuditPaths(lock, indices, tree_size, to_fill);
+  return to_fill.empty() ? NOT_FOUND : OK;
+}
+
+
 // Look up by SHA256-hash of the certificate and tree size.
 LogLookup::LookupResult LogLookup::AuditProof(const string& merkle_leaf_hash,
                                               size_t tree_size,
@@ -185,9 +469,53 @@ LogLookup::LookupResult LogLookup::AuditProof(const string& merkle_leaf_hash,
 }
 
 
+vector<string> LogLookup::ConsistencyProof(size_t first, size_t second) {
+  unique_lock<mutex> lock(lock_);
+  const vector<string>* const frontier(GetFrontier(lock, second));
+  return frontier ? cert_tree_->SnapshotConsistency(first, second, *frontier)
+                  : cert_tree_->SnapshotConsistency(first, second);
+}
+
+
+LogLookup::LookupResult LogLookup::STHAtSize(size_t tree_size,
+                                             SignedTreeHead* sth) const {
+  lock_guard<mutex> lock(lock_);
+  const auto it(sth_history_.find(tree_size));
+  if (it == sth_history_.end()) {
+    return NOT_FOUND;
+  }
+  CHECK_NOTNULL(sth)->CopyFrom(it->second.sth);
+  return OK;
+}
+
+
 string LogLookup::RootAtSnapshot(size_t tree_size) {
+  unique_lock<mutex> lock(lock_);
+  const vector<string>* const frontier(GetFrontier(lock, tree_size));
+  return frontier ? frontier->back() : cert_tree_->RootAtSnapshot(tree_size);
+}
+
+
+LogLookup::LookupResult LogLookup::CompleteSubtreeRoots(size_t level,
+                                                        size_t first,
+                                                        size_t count,
+                                                        string* hashes) {
   lock_guard<mutex> lock(lock_);
-  return cert_tree_.RootAtSnapshot(tree_size);
+  string nodes;
+  for (size_t index = first; index < first + count; ++index) {
+    const string node(cert_tree_->CompleteSubtreeRoot(level, index));
+    if (node.empty())
+      return NOT_FOUND;
+    nodes.append(node);
+  }
+  hashes->append(nodes);
+  return OK;
+}
+
+
+void LogLookup::AddUpdateCallback(const UpdateCallback& callback) {
+  lock_guard<mutex> lock(lock_);
+  update_callbacks_.push_back(callback);
 }
 
 
@@ -197,15 +525,25 @@ string LogLookup::LeafHash(const LoggedEntry& logged) const {
   // We do not need to take the lock for this call into cert_tree_, as
   // this is merely a const forwarder (to another const, thread-safe
   // method).
-  return cert_tree_.LeafHash(serialized_leaf);
+  return cert_tree_->LeafHash(serialized_leaf);
 }
 
 
 unique_ptr<CompactMerkleTree> LogLookup::GetCompactMerkleTree(
     SerialHasher* hasher) {
   lock_guard<mutex> lock(lock_);
+  // The complete subtrees of the tree, from the largest to the smallest,
+  // one for each bit set in its size.
+  const size_t leaf_count(cert_tree_->LeafCount());
+  vector<string> subtree_roots;
+  for (size_t level = cert_tree_->LevelCount(); level > 0; --level) {
+    if (((leaf_count >> (level - 1)) & 1) != 0) {
+      subtree_roots.emplace_back(cert_tree_->CompleteSubtreeRoot(
+          level - 1, (leaf_count >> (level - 1)) - 1));
+    }
+  }
   return unique_ptr<CompactMerkleTree>(
-      new CompactMerkleTree(cert_tree_, hasher));
+      new CompactMerkleTree(leaf_count, subtree_roots, hasher));
 }
 
 
@@ -213,13 +551,178 @@ int64_t LogLookup::GetIndexInternal(const unique_lock<mutex>& lock,
                                     const string& merkle_leaf_hash) const {
   CHECK(lock.owns_lock());
 
-  const map<string, int64_t>::const_iterator it(
-      leaf_index_.find(merkle_leaf_hash));
-  if (it == leaf_index_.end())
-    return -1;
+  return leaf_index_.Find(merkle_leaf_hash);
+}
+
 
-  CHECK_GE(it->second, 0);
-  return it->second;
+void LogLookup::AuditPaths(const unique_lock<mutex>& lock,
+                           const vector<int64_t>& indices, size_t tree_size,
+                           const vector<ShortMerkleAuditProof*>& proofs) {
+  CHECK(lock.owns_lock());
+  CHECK_EQ(indices.size(), proofs.size());
+  const size_t node_size(cert_tree_->NodeSize());
+  vector<size_t> uncached;
+  for (size_t i = 0; i < indices.size(); ++i) {
+    ShortMerkleAuditProof* const proof(proofs[i]);
+    proof->set_leaf_index(indices[i]);
+    proof->clear_path_node();
+    const int64_t cached(static_cast<int64_t>(indices[i]) -
+                         static_cast<int64_t>(cached_paths_first_leaf_));
+    if (tree_size != cached_paths_tree_size_ || cached < 0 ||
+        cached >= static_cast<int64_t>(cached_paths_.size())) {
+      uncached.push_back(i);
+      continue;
+    }
+    const string& nodes(cached_paths_[cached]);
+    for (size_t offset = 0; offset < nodes.size(); offset += node_size) {
+      proof->add_path_node(nodes.substr(offset, node_size));
+    }
+  }
+  if (uncached.empty()) {
+    return;
+  }
+
+  // The nodes of the right border of the tree are the same in every
+  // path, and are only hashed once for all of them: if the frontier is
+  // not cached, it is computed for this batch.
+  const vector<string>* frontier(GetFrontier(lock, tree_size));
+  vector<string> batch_frontier;
+  if (!frontier && uncached.size() > 1 && tree_size > 0 &&
+      tree_size <= cert_tree_->LeafCount()) {
+    batch_frontier = cert_tree_->SnapshotFrontier(tree_size);
+    frontier = &batch_frontier;
+  }
+
+  for (const size_t i : uncached) {
+    ShortMerkleAuditProof* const proof(proofs[i]);
+    const vector<string> audit_path(
+        frontier
+            ? cert_tree_->PathToRootAtSnapshot(indices[i] + 1, tree_size,
+                                               *frontier)
+            : cert_tree_->PathToRootAtSnapshot(indices[i] + 1, tree_size));
+    for (const string& node : audit_path) {
+      proof->add_path_node(node);
+    }
+  }
+}
+
+
+const vector<string>* LogLookup::GetFrontier(const unique_lock<mutex>& lock,
+                                             size_t tree_size) {
+  CHECK(lock.owns_lock());
+  if (FLAGS_log_lookup_frontier_cache_size <= 0 || tree_size == 0 ||
+      tree_size > cert_tree_->LeafCount())
+    return nullptr;
+
+  for (auto it(frontiers_.begin()); it != frontiers_.end(); ++it) {
+    if (it->first == tree_size) {
+      frontiers_.splice(frontiers_.begin(), frontiers_, it);
+      return &frontiers_.front().second;
+    }
+  }
+
+  const auto published(sth_history_.find(tree_size));
+  if (published != sth_history_.end()) {
+    const string& nodes(published->second.frontier);
+    const size_t node_size(cert_tree_->NodeSize());
+    vector<string> frontier;
+    frontier.reserve(nodes.size() / node_size);
+    for (size_t offset = 0; offset < nodes.size(); offset += node_size) {
+      frontier.emplace_back(nodes, offset, node_size);
+    }
+    frontiers_.emplace_front(tree_size, std::move(frontier));
+  } else {
+    frontiers_.emplace_front(tree_size,
+                             cert_tree_->SnapshotFrontier(tree_size));
+  }
+  while (frontiers_.size() >
+         static_cast<size_t>(FLAGS_log_lookup_frontier_cache_size))
+    frontiers_.pop_back();
+  return &frontiers_.front().second;
+}
+
+
+void LogLookup::CacheAuditPaths(const unique_lock<mutex>& lock,
+                                size_t tree_size) {
+  CHECK(lock.owns_lock());
+  cached_paths_.clear();
+  cached_paths_tree_size_ = 0;
+  if (FLAGS_log_lookup_audit_path_cache_size <= 0 || tree_size == 0 ||
+      tree_size > cert_tree_->LeafCount()) {
+    return;
+  }
+
+  // All the paths end with the nodes of the right border, so they are
+  // computed from the frontier.
+  const vector<string>* frontier(GetFrontier(lock, tree_size));
+  vector<string> computed_frontier;
+  if (!frontier) {
+    computed_frontier = cert_tree_->SnapshotFrontier(tree_size);
+    frontier = &computed_frontier;
+  }
+  const size_t count(std::min(
+      tree_size,
+      static_cast<size_t>(FLAGS_log_lookup_audit_path_cache_size)));
+  cached_paths_first_leaf_ = tree_size - count;
+  cached_paths_.reserve(count);
+  for (size_t leaf = cached_paths_first_leaf_; leaf < tree_size; ++leaf) {
+    string nodes;
+    for (const string& node :
+         cert_tree_->PathToRootAtSnapshot(leaf + 1, tree_size, *frontier)) {
+      nodes.append(node);
+    }
+    cached_paths_.emplace_back(std::move(nodes));
+  }
+  cached_paths_tree_size_ = tree_size;
+}
+
+
+bool LogLookup::AddToHistory(const unique_lock<mutex>& lock,
+                             const SignedTreeHead& sth) {
+  CHECK(lock.owns_lock());
+  const size_t tree_size(sth.tree_size());
+  if (!FLAGS_log_lookup_sth_history || tree_size == 0 ||
+      sth_history_.count(tree_size) > 0) {
+    return true;
+  }
+  CHECK_LE(tree_size, cert_tree_->LeafCount());
+
+  // The frontier was usually just computed for the update.
+  const vector<string> frontier(
+      !frontiers_.empty() && frontiers_.front().first == tree_size
+          ? frontiers_.front().second
+          : cert_tree_->SnapshotFrontier(tree_size));
+  if (frontier.back() != sth.sha256_root_hash()) {
+    return false;
+  }
+  HistoricalSTH* const historical(&sth_history_[tree_size]);
+  historical->sth.CopyFrom(sth);
+  for (const string& node : frontier) {
+    historical->frontier.append(node);
+  }
+  return true;
+}
+
+
+void LogLookup::LoadHistory(size_t tree_size) {
+  if (!FLAGS_log_lookup_sth_history) {
+    return;
+  }
+  size_t loaded(0);
+  for (const SignedTreeHead& sth : db_->ScanTreeHeads()) {
+    if (static_cast<uint64_t>(sth.tree_size()) > tree_size) {
+      continue;
+    }
+    // Lets lookups in between tree heads, as there may be many.
+    unique_lock<mutex> lock(lock_);
+    if (AddToHistory(lock, sth)) {
+      ++loaded;
+    } else {
+      LOG(WARNING) << "Ignoring database tree head that does not match the "
+                   << "tree:\n" << sth.DebugString();
+    }
+  }
+  LOG(INFO) << "Loaded " << loaded << " tree heads from the database";
 }
 
 
@@ -3,25 +3,56 @@
 #define LOG_LOOKUP_H
 
 #include <stdint.h>
+#include <functional>
+#include <list>
 #include <map>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/database.h"
+#include "log/leaf_index.h"
 #include "merkletree/compact_merkle_tree.h"
-#include "merkletree/merkle_tree.h"
+#include "merkletree/merkle_tree_interface.h"
+#include "merkletree/persistent_merkle_tree.h"
 #include "proto/ct.pb.h"
 
 namespace cert_trans {
 
 
 // Lookups into the database. Read-only, so could also be a mirror.
-// Keeps the entire Merkle Tree in memory to serve audit proofs.
+// Keeps the entire Merkle Tree in memory to serve audit proofs, or only
+// its upper levels with --log_lookup_tile_levels.
+//
+// Updates to a new tree head read and hash the new entries without
+// blocking lookups, which only wait while the new leaves are appended
+// to the tree. The tree head itself is published atomically, and can be
+// read without any locking.
 class LogLookup {
  public:
-  // The constructor loads the content from the database.
-  explicit LogLookup(ReadOnlyDatabase* db);
+  // The constructor loads the content from the database. If |executor|
+  // is given, the tree loaded is hashed in parallel on it; it is not
+  // used afterwards, so it only has to outlive the constructor.
+  explicit LogLookup(ReadOnlyDatabase* db,
+                     util::Executor* executor = nullptr);
+  // As above, but keeps the Merkle Tree in memory-mapped files in
+  // |tree_dir|, so that only the entries added since the tree was last
+  // checkpointed need to be loaded from the database. A tree that does
+  // not match the database (e.g. one restored from a backup) is rebuilt
+  // from it.
+  LogLookup(ReadOnlyDatabase* db, const std::string& tree_dir);
+  // As above, with the given |access| to the tree. A READ_ONLY instance
+  // follows the tree that a writable one (typically in another process
+  // serving the same log) keeps in |tree_dir|, rather than building its
+  // own: it maps the same files, and its updates wait for that tree to
+  // be checkpointed at the new tree size instead of reading the
+  // database, which is only used for its tree heads.
+  LogLookup(ReadOnlyDatabase* db, const std::string& tree_dir,
+            PersistentMerkleTree::Access access,
+            util::Executor* executor = nullptr);
   ~LogLookup();
 
   enum LookupResult {
@@ -42,23 +73,55 @@ class LogLookup {
   LookupResult AuditProof(int64_t index, size_t tree_size,
                           ct::ShortMerkleAuditProof* proof);
 
+  // As above, for each of |indices|, all against the same tree at once.
+  // Sets |proofs| to one proof per index, in the same order.
+  LookupResult AuditProofs(const std::vector<int64_t>& indices,
+                           size_t tree_size,
+                           std::vector<ct::ShortMerkleAuditProof>* proofs);
+
+  // As above, by hash of the logged items. The proofs of the hashes not
+  // in the tree of |tree_size| have no leaf index; returns NOT_FOUND if
+  // none are.
+  LookupResult AuditProofs(const std::vector<std::string>& merkle_leaf_hashes,
+                           size_t tree_size,
+                           std::vector<ct::ShortMerkleAuditProof>* proofs);
+
   // Look up by hash of the logged item and tree_size.
   LookupResult AuditProof(const std::string& merkle_leaf_hash,
                           size_t tree_size, ct::ShortMerkleAuditProof* proof);
 
   // Get a consitency proof between two tree heads
-  std::vector<std::string> ConsistencyProof(size_t first, size_t second) {
-    std::lock_guard<std::mutex> lock(lock_);
-    return cert_tree_.SnapshotConsistency(first, second);
-  }
+  std::vector<std::string> ConsistencyProof(size_t first, size_t second);
 
-  const ct::SignedTreeHead& GetSTH() const {
-    std::lock_guard<std::mutex> lock(lock_);
-    return latest_tree_head_;
+  // The tree head of the latest update. Never blocks.
+  ct::SignedTreeHead GetSTH() const {
+    return *std::atomic_load(&latest_tree_head_);
   }
 
+  // Looks up the first tree head seen for |tree_size|, either by an
+  // update or, when the lookup starts, from the database (see
+  // ReadOnlyDatabase::ScanTreeHeads()). As their frontiers are kept,
+  // RootAtSnapshot(), proofs and consistency proofs against the tree
+  // sizes of these tree heads need no rehashing, however old they are.
+  LookupResult STHAtSize(size_t tree_size, ct::SignedTreeHead* sth) const;
+
   std::string RootAtSnapshot(size_t tree_size);
 
+  // Appends to |hashes| the nodes [first, first + count) of level |level|
+  // of the tree, i.e. the roots of consecutive complete subtrees of
+  // 2^level leaves, concatenated. Returns NOT_FOUND, leaving |hashes|
+  // untouched, if they are not all complete in the current tree.
+  LookupResult CompleteSubtreeRoots(size_t level, size_t first, size_t count,
+                                    std::string* hashes);
+
+  typedef std::function<void(const ct::SignedTreeHead&)> UpdateCallback;
+
+  // Registers |callback| to be run each time the tree has been updated
+  // to a new tree head, after which proofs and nodes for that tree size
+  // are available. The callback is run without any lock held, and may
+  // call back into this instance.
+  void AddUpdateCallback(const UpdateCallback& callback);
+
   std::string LeafHash(const LoggedEntry& logged) const;
 
   // Creates a CompactMerkleTree based on the current state of our MerkleTree.
@@ -68,19 +131,89 @@ class LogLookup {
 
  private:
   void UpdateFromSTH(const ct::SignedTreeHead& sth);
+  // Registers update_from_sth_cb_, which runs the first update at once
+  // if the database has a tree head, with the tree hashed on |executor|.
+  void StartUpdates(util::Executor* executor);
+  // For a read-only tree, waits for it to be checkpointed with at least
+  // |tree_size| leaves, dropping |lock| while waiting, and reloads it at
+  // that size. Returns false if it does not happen in time.
+  bool ReloadTree(std::unique_lock<std::mutex>* lock, size_t tree_size);
+  // Appends the leaf hashes [start, end) of the database to
+  // |leaf_hashes|, dying if any is missing.
+  void ReadLeafHashes(int64_t start, int64_t end,
+                      std::vector<std::string>* leaf_hashes) const;
+  // Checks the non-empty tree against the database, whose latest tree
+  // head |db_sth| is no smaller: its root if they have the same size,
+  // otherwise its last leaf hash.
+  bool TreeMatchesDatabase(const ct::SignedTreeHead& db_sth);
+  // Replaces the leaves of the writable persistent tree with the first
+  // |tree_size| leaf hashes of the database, dropping everything that
+  // was derived from the old ones.
+  void RebuildTree(const std::unique_lock<std::mutex>& lock,
+                   size_t tree_size);
   int64_t GetIndexInternal(const std::unique_lock<std::mutex>& lock,
                            const std::string& merkle_leaf_hash) const;
-
+  // Sets the leaf index and path of each of |proofs| to those of the
+  // corresponding element of |indices|, in the tree of |tree_size|.
+  void AuditPaths(const std::unique_lock<std::mutex>& lock,
+                  const std::vector<int64_t>& indices, size_t tree_size,
+                  const std::vector<ct::ShortMerkleAuditProof*>& proofs);
+  // Returns the frontier of the tree at |tree_size|, computing (unless
+  // it is in |sth_history_|) and caching it if needed, or NULL if there
+  // is no such tree or caching is disabled. The pointer is valid until
+  // the next call.
+  const std::vector<std::string>* GetFrontier(
+      const std::unique_lock<std::mutex>& lock, size_t tree_size);
+  // Replaces the audit paths of |cached_paths_| with those of the newest
+  // leaves (see --log_lookup_audit_path_cache_size) to |tree_size|.
+  void CacheAuditPaths(const std::unique_lock<std::mutex>& lock,
+                       size_t tree_size);
+  // Adds |sth|, no larger than the tree, to |sth_history_| unless its
+  // tree size is there already. Returns false if its root does not match
+  // the tree.
+  bool AddToHistory(const std::unique_lock<std::mutex>& lock,
+                    const ct::SignedTreeHead& sth);
+  // Adds the tree heads of the database up to |tree_size| to
+  // |sth_history_|.
+  void LoadHistory(size_t tree_size);
+
+  // Serialises updates, and is held for the whole of each update.
+  std::mutex update_lock_;
+  // Guards all of the state below, but is only held by updates while
+  // they modify the tree.
   mutable std::mutex lock_;
+  ReadOnlyDatabase* const db_;
+  // Set if |cert_tree_| is persistent, in which case it's the same object.
+  PersistentMerkleTree* const persistent_tree_;
+  const std::unique_ptr<AuditableMerkleTreeInterface> cert_tree_;
   // We keep a hash -> index mapping in memory so that we can quickly serve
   // Merkle proofs without having to query the database at all.
-  // Note that 32 bytes is an overkill and we can optimize this to use
-  // a shorter prefix (possibly with a multimap).
-  std::map<std::string, int64_t> leaf_index_;
-
-  ReadOnlyDatabase* const db_;
-  MerkleTree cert_tree_;
-  ct::SignedTreeHead latest_tree_head_;
+  LeafIndex leaf_index_;
+  // Replaced, never modified, so that GetSTH() can read it without
+  // locking. Only accessed through std::atomic_load/atomic_store.
+  std::shared_ptr<const ct::SignedTreeHead> latest_tree_head_;
+  // Frontiers (see MerkleTree::SnapshotFrontier()) of the tree sizes
+  // most recently used for proofs, most recent first. Proofs against
+  // these sizes need no rehashing. Since the tree is append-only, they
+  // never go stale.
+  std::list<std::pair<size_t, std::vector<std::string>>> frontiers_;
+  struct HistoricalSTH {
+    ct::SignedTreeHead sth;
+    // The nodes of the frontier, concatenated.
+    std::string frontier;
+  };
+  // One tree head per tree size, if --log_lookup_sth_history is set.
+  std::map<size_t, HistoricalSTH> sth_history_;
+  // The audit paths to the tree of |cached_paths_tree_size_| of its
+  // leaves from |cached_paths_first_leaf_| (0-based) on, the nodes of
+  // each concatenated. Proofs for recently sequenced entries are mostly
+  // requested against the latest tree head, which these are computed
+  // for as soon as it is applied, all at once: the paths of neighbouring
+  // leaves share most of their nodes, and all share the frontier.
+  size_t cached_paths_tree_size_;
+  size_t cached_paths_first_leaf_;
+  std::vector<std::string> cached_paths_;
+  std::vector<UpdateCallback> update_callbacks_;
 
   const Database::NotifySTHCallback update_from_sth_cb_;
 
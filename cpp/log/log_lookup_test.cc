@@ -1,7 +1,13 @@
 /* -*- indent-tabs-mode: nil -*- */
+#include <gflags/gflags.h>
 #include <gtest/gtest.h>
+#include <sys/stat.h>
+#include <atomic>
 #include <memory>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #include "log/etcd_consistent_store.h"
 #include "log/file_db.h"
@@ -13,34 +19,44 @@
 #include "log/sqlite_db.h"
 #include "log/test_db.h"
 #include "log/test_signer.h"
+#include "log/tiles.h"
 #include "log/tree_signer.h"
+#include "merkletree/merkle_tree.h"
 #include "merkletree/merkle_verifier.h"
 #include "merkletree/serial_hasher.h"
 #include "proto/cert_serializer.h"
 #include "util/fake_etcd.h"
 #include "util/mock_masterelection.h"
+#include "util/status_test_util.h"
 #include "util/sync_task.h"
 #include "util/testing.h"
 #include "util/thread_pool.h"
 #include "util/util.h"
 
+DECLARE_int32(log_lookup_audit_path_cache_size);
+DECLARE_int32(log_lookup_frontier_cache_size);
+DECLARE_int32(log_lookup_tile_levels);
+DECLARE_string(log_lookup_tiered_leaves_dir);
+
 namespace {
 
 namespace libevent = cert_trans::libevent;
 
 using cert_trans::Database;
 using cert_trans::EntryHandle;
-using cert_trans::EtcdClient;
 using cert_trans::FakeEtcdClient;
 using cert_trans::FileDB;
 using cert_trans::LogLookup;
 using cert_trans::LoggedEntry;
 using cert_trans::MockMasterElection;
+using cert_trans::PersistentMerkleTree;
 using cert_trans::SQLiteDB;
 using cert_trans::ThreadPool;
+using cert_trans::TileExporter;
 using cert_trans::TreeSigner;
 using ct::MerkleAuditProof;
 using ct::SequenceMapping;
+using ct::ShortMerkleAuditProof;
 using std::make_shared;
 using std::shared_ptr;
 using std::string;
@@ -70,13 +86,6 @@ class LogLookupTest : public ::testing::Test {
                   new MerkleVerifier(new Sha256Hasher())) {
     // Set some noddy STH so that we can call UpdateTree on the Tree Signer.
     store_.SetServingSTH(ct::SignedTreeHead());
-    // Force an empty sequence mapping file:
-    {
-      util::SyncTask task(&pool_);
-      EtcdClient::Response r;
-      etcd_client_.ForceSet("/root/sequence_mapping", "", &r, task.task());
-      task.Wait();
-    }
   }
 
 
@@ -87,12 +96,11 @@ class LogLookupTest : public ::testing::Test {
 
     CHECK(this->store_.AddPendingEntry(logged_cert).ok());
 
-    EntryHandle<SequenceMapping> mapping;
-    CHECK(this->store_.GetSequenceMapping(&mapping).ok());
-    SequenceMapping::Mapping* m(mapping.MutableEntry()->add_mapping());
+    SequenceMapping mapping;
+    SequenceMapping::Mapping* m(mapping.add_mapping());
     m->set_sequence_number(seq);
     m->set_entry_hash(logged_cert->Hash());
-    CHECK(this->store_.UpdateSequenceMapping(&mapping).ok());
+    CHECK(this->store_.AddSequenceMappings(mapping).ok());
   }
 
   void UpdateTree() {
@@ -120,6 +128,7 @@ class LogLookupTest : public ::testing::Test {
 
 
   TestDB<T> test_db_;
+  TmpStorage tree_tmp_;
   shared_ptr<libevent::Base> base_;
   libevent::EventPumpThread event_pump_;
   FakeEtcdClient etcd_client_;
@@ -153,6 +162,26 @@ TYPED_TEST(LogLookupTest, Lookup) {
 }
 
 
+TYPED_TEST(LogLookupTest, LookupLoadedOnExecutor) {
+  LoggedEntry logged_cert, new_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  this->CreateSequencedEntry(&logged_cert, 0);
+  this->UpdateTree();
+
+  LogLookup lookup(this->db(), &this->pool_);
+  MerkleAuditProof proof;
+  EXPECT_EQ(LogLookup::OK,
+            lookup.AuditProof(logged_cert.merkle_leaf_hash(), &proof));
+
+  // Later updates do not need it.
+  this->test_signer_.CreateUnique(&new_cert);
+  this->CreateSequencedEntry(&new_cert, 1);
+  this->UpdateTree();
+  EXPECT_EQ(LogLookup::OK,
+            lookup.AuditProof(new_cert.merkle_leaf_hash(), &proof));
+}
+
+
 TYPED_TEST(LogLookupTest, NotFound) {
   LoggedEntry logged_cert;
   this->test_signer_.CreateUnique(&logged_cert);
@@ -230,6 +259,506 @@ TYPED_TEST(LogLookupTest, VerifyWithPath) {
 }
 
 
+TYPED_TEST(LogLookupTest, VerifyBatch) {
+  LoggedEntry logged_certs[13];
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+
+  LogLookup lookup(this->db());
+  std::vector<ct::LogEntry> entries;
+  std::vector<ct::SignedCertificateTimestamp> scts;
+  std::vector<MerkleAuditProof> proofs;
+  for (int i = 0; i < 13; ++i) {
+    entries.push_back(logged_certs[i].entry());
+    scts.push_back(logged_certs[i].sct());
+    proofs.emplace_back();
+    EXPECT_EQ(LogLookup::OK, lookup.AuditProof(
+                                 logged_certs[i].merkle_leaf_hash(),
+                                 &proofs.back()));
+  }
+  // A tampered path, and a proof for the wrong entry.
+  proofs[3].set_path_node(0, proofs[4].path_node(0));
+  std::swap(entries[7], entries[8]);
+
+  std::vector<LogVerifier::LogVerifyResult> results;
+  this->verifier_.VerifyMerkleAuditProofs(entries, scts, proofs, &results);
+  ASSERT_EQ(13U, results.size());
+  for (int i = 0; i < 13; ++i)
+    EXPECT_EQ(this->verifier_.VerifyMerkleAuditProof(entries[i], scts[i],
+                                                     proofs[i]),
+              results[i])
+        << i;
+  EXPECT_NE(LogVerifier::VERIFY_OK, results[3]);
+  EXPECT_NE(LogVerifier::VERIFY_OK, results[7]);
+  EXPECT_EQ(LogVerifier::VERIFY_OK, results[12]);
+}
+
+
+TYPED_TEST(LogLookupTest, PersistentTreeResumes) {
+  const string tree_dir(this->tree_tmp_.TmpStorageDir() + "/merkle_tree");
+  LoggedEntry logged_certs[20];
+
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+
+  {
+    LogLookup lookup(this->db(), tree_dir);
+    EXPECT_EQ(13, lookup.GetSTH().tree_size());
+  }
+
+  for (int i = 13; i < 20; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+
+  // The second instance picks up the first 13 leaves from disk, and the
+  // rest from the database.
+  LogLookup lookup(this->db(), tree_dir);
+  EXPECT_EQ(20, lookup.GetSTH().tree_size());
+  MerkleAuditProof proof;
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_EQ(LogLookup::OK,
+              lookup.AuditProof(logged_certs[i].merkle_leaf_hash(), &proof));
+    EXPECT_EQ(LogVerifier::VERIFY_OK,
+              this->verifier_.VerifyMerkleAuditProof(logged_certs[i].entry(),
+                                                     logged_certs[i].sct(),
+                                                     proof));
+  }
+}
+
+
+// Leaves of a persistent tree that are not those of the database, as
+// if it had been written with another database.
+TYPED_TEST(LogLookupTest, PersistentTreeMismatchIsRebuilt) {
+  LoggedEntry logged_certs[13];
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+
+  std::vector<std::vector<string>> trees;
+  // Smaller than the database's, with another last leaf, and of the same
+  // size, with another root: both caught when the tree is opened.
+  for (const int leaf_count : {5, 13}) {
+    std::vector<string> leaf_hashes;
+    for (int i = 0; i < leaf_count; ++i) {
+      leaf_hashes.emplace_back(
+          Sha256Hasher::Sha256Digest("not a leaf " + std::to_string(i)));
+    }
+    trees.emplace_back(std::move(leaf_hashes));
+  }
+  // Only the last leaf matches, caught by the first update.
+  trees.push_back(trees[0]);
+  trees.back().back() = logged_certs[4].merkle_leaf_hash();
+
+  for (size_t t = 0; t < trees.size(); ++t) {
+    const string tree_dir(this->tree_tmp_.TmpStorageDir() + "/merkle_tree" +
+                          std::to_string(t));
+    {
+      PersistentMerkleTree tree(tree_dir, new Sha256Hasher);
+      tree.AddLeafHashes(trees[t]);
+      ASSERT_OK(tree.Checkpoint());
+    }
+
+    LogLookup lookup(this->db(), tree_dir);
+    EXPECT_EQ(13, lookup.GetSTH().tree_size());
+    MerkleAuditProof proof;
+    for (int i = 0; i < 13; ++i) {
+      ASSERT_EQ(LogLookup::OK,
+                lookup.AuditProof(logged_certs[i].merkle_leaf_hash(), &proof))
+          << t;
+      EXPECT_EQ(LogVerifier::VERIFY_OK,
+                this->verifier_.VerifyMerkleAuditProof(logged_certs[i].entry(),
+                                                       logged_certs[i].sct(),
+                                                       proof))
+          << t;
+    }
+    EXPECT_EQ(LogLookup::NOT_FOUND, lookup.AuditProof(trees[0][0], &proof));
+  }
+}
+
+
+// A read-only lookup only needs its database for the tree heads, and
+// gets the rest from the tree kept up to date by the writable one.
+TYPED_TEST(LogLookupTest, ReadOnlyTreeFollowsWriter) {
+  const string tree_dir(this->tree_tmp_.TmpStorageDir() + "/merkle_tree");
+  LoggedEntry logged_certs[20];
+
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+  LogLookup writer(this->db(), tree_dir);
+  EXPECT_EQ(13, writer.GetSTH().tree_size());
+
+  TestDB<TypeParam> reader_db;
+  LogLookup reader(reader_db.db(), tree_dir, PersistentMerkleTree::READ_ONLY);
+  EXPECT_EQ(0, reader.GetSTH().tree_size());
+  EXPECT_EQ(Database::OK,
+            reader_db.db()->WriteTreeHead(this->tree_signer_.LatestSTH()));
+  EXPECT_EQ(13, reader.GetSTH().tree_size());
+
+  for (int i = 13; i < 20; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+  EXPECT_EQ(20, writer.GetSTH().tree_size());
+  EXPECT_EQ(Database::OK,
+            reader_db.db()->WriteTreeHead(this->tree_signer_.LatestSTH()));
+  EXPECT_EQ(20, reader.GetSTH().tree_size());
+
+  MerkleAuditProof proof;
+  for (int i = 0; i < 20; ++i) {
+    EXPECT_EQ(LogLookup::OK,
+              reader.AuditProof(logged_certs[i].merkle_leaf_hash(), &proof));
+    EXPECT_EQ(LogVerifier::VERIFY_OK,
+              this->verifier_.VerifyMerkleAuditProof(logged_certs[i].entry(),
+                                                     logged_certs[i].sct(),
+                                                     proof));
+  }
+  EXPECT_EQ(writer.ConsistencyProof(13, 20), reader.ConsistencyProof(13, 20));
+}
+
+
+TYPED_TEST(LogLookupTest, KeepsSTHHistory) {
+  LogLookup lookup(this->db());
+  MerkleTree reference(new Sha256Hasher);
+  std::vector<ct::SignedTreeHead> sths;
+  LoggedEntry logged_cert;
+  for (int i = 0; i < 20; ++i) {
+    this->test_signer_.CreateUnique(&logged_cert);
+    this->CreateSequencedEntry(&logged_cert, i);
+    string serialized_leaf;
+    CHECK(logged_cert.SerializeForLeaf(&serialized_leaf));
+    reference.AddLeaf(serialized_leaf);
+    if (i % 6 == 2) {
+      this->UpdateTree();
+      sths.push_back(this->tree_signer_.LatestSTH());
+    }
+  }
+
+  ct::SignedTreeHead sth;
+  for (const ct::SignedTreeHead& expected : sths) {
+    ASSERT_EQ(LogLookup::OK, lookup.STHAtSize(expected.tree_size(), &sth));
+    EXPECT_EQ(expected.DebugString(), sth.DebugString());
+    EXPECT_EQ(expected.sha256_root_hash(),
+              lookup.RootAtSnapshot(expected.tree_size()));
+    EXPECT_EQ(reference.SnapshotConsistency(3, expected.tree_size()),
+              lookup.ConsistencyProof(3, expected.tree_size()));
+  }
+  EXPECT_EQ(LogLookup::NOT_FOUND, lookup.STHAtSize(5, &sth));
+  EXPECT_EQ(reference.RootAtSnapshot(5), lookup.RootAtSnapshot(5));
+}
+
+
+// Proofs against cached tree sizes match the ones computed from
+// scratch.
+TYPED_TEST(LogLookupTest, CachedFrontierProofs) {
+  LoggedEntry logged_certs[20];
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+
+  LogLookup lookup(this->db());
+  for (int i = 13; i < 20; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+  ASSERT_EQ(20, lookup.GetSTH().tree_size());
+
+  const int cache_size(FLAGS_log_lookup_frontier_cache_size);
+  for (size_t tree_size : {13, 20, 7}) {
+    for (size_t first = 1; first < tree_size; ++first) {
+      FLAGS_log_lookup_frontier_cache_size = cache_size;
+      const std::vector<string> proof(
+          lookup.ConsistencyProof(first, tree_size));
+      ShortMerkleAuditProof audit_proof;
+      EXPECT_EQ(LogLookup::OK,
+                lookup.AuditProof(first - 1, tree_size, &audit_proof));
+      const string root(lookup.RootAtSnapshot(tree_size));
+
+      FLAGS_log_lookup_frontier_cache_size = 0;
+      EXPECT_EQ(lookup.ConsistencyProof(first, tree_size), proof);
+      ShortMerkleAuditProof uncached_audit_proof;
+      EXPECT_EQ(LogLookup::OK, lookup.AuditProof(first - 1, tree_size,
+                                                 &uncached_audit_proof));
+      EXPECT_EQ(uncached_audit_proof.DebugString(),
+                audit_proof.DebugString());
+      EXPECT_EQ(lookup.RootAtSnapshot(tree_size), root);
+    }
+  }
+  FLAGS_log_lookup_frontier_cache_size = cache_size;
+}
+
+
+// The audit paths of the newest leaves, computed as the tree head is
+// applied, are those that would be computed on request.
+TYPED_TEST(LogLookupTest, CachedAuditPaths) {
+  const int cache_size(FLAGS_log_lookup_audit_path_cache_size);
+  FLAGS_log_lookup_audit_path_cache_size = 5;
+  LoggedEntry logged_certs[20];
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+
+  LogLookup lookup(this->db());
+  for (int i = 13; i < 20; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+  ASSERT_EQ(20, lookup.GetSTH().tree_size());
+
+  FLAGS_log_lookup_audit_path_cache_size = 0;
+  LogLookup uncached_lookup(this->db());
+  FLAGS_log_lookup_audit_path_cache_size = cache_size;
+  for (size_t tree_size : {20, 13}) {
+    for (int i = 0; i < static_cast<int>(tree_size); ++i) {
+      ShortMerkleAuditProof proof, uncached_proof;
+      EXPECT_EQ(LogLookup::OK,
+                lookup.AuditProof(logged_certs[i].merkle_leaf_hash(),
+                                  tree_size, &proof));
+      EXPECT_EQ(LogLookup::OK,
+                uncached_lookup.AuditProof(logged_certs[i].merkle_leaf_hash(),
+                                           tree_size, &uncached_proof));
+      EXPECT_EQ(uncached_proof.DebugString(), proof.DebugString())
+          << i << " " << tree_size;
+    }
+  }
+
+  // Batches mixing cached and uncached paths.
+  const std::vector<int64_t> indices{19, 2, 16, 14};
+  std::vector<ShortMerkleAuditProof> proofs, uncached_proofs;
+  ASSERT_EQ(LogLookup::OK, lookup.AuditProofs(indices, 20, &proofs));
+  ASSERT_EQ(LogLookup::OK,
+            uncached_lookup.AuditProofs(indices, 20, &uncached_proofs));
+  ASSERT_EQ(indices.size(), proofs.size());
+  for (size_t i = 0; i < indices.size(); ++i) {
+    EXPECT_EQ(uncached_proofs[i].DebugString(), proofs[i].DebugString());
+  }
+}
+
+
+// A lookup that only keeps the upper levels of the tree serves the same
+// proofs, and nodes.
+TYPED_TEST(LogLookupTest, TieredTree) {
+  LoggedEntry logged_certs[20];
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+
+  const string leaves_dir(this->tree_tmp_.TmpStorageDir());
+  FLAGS_log_lookup_tile_levels = 2;
+  LogLookup tiered(this->db());
+  FLAGS_log_lookup_tiered_leaves_dir = leaves_dir;
+  LogLookup tiered_on_disk(this->db());
+  FLAGS_log_lookup_tiered_leaves_dir = "";
+  FLAGS_log_lookup_tile_levels = 0;
+  LogLookup lookup(this->db());
+  for (int i = 13; i < 20; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+
+  for (LogLookup* other : {&tiered, &tiered_on_disk}) {
+    ASSERT_EQ(lookup.GetSTH().DebugString(), other->GetSTH().DebugString());
+    for (size_t tree_size : {20, 13, 7}) {
+      EXPECT_EQ(lookup.RootAtSnapshot(tree_size),
+                other->RootAtSnapshot(tree_size));
+      for (size_t first = 1; first < tree_size; ++first) {
+        EXPECT_EQ(lookup.ConsistencyProof(first, tree_size),
+                  other->ConsistencyProof(first, tree_size));
+        ShortMerkleAuditProof proof, other_proof;
+        EXPECT_EQ(LogLookup::OK,
+                  lookup.AuditProof(logged_certs[first].merkle_leaf_hash(),
+                                    tree_size, &proof));
+        EXPECT_EQ(LogLookup::OK,
+                  other->AuditProof(logged_certs[first].merkle_leaf_hash(),
+                                    tree_size, &other_proof));
+        EXPECT_EQ(proof.DebugString(), other_proof.DebugString())
+            << first << " " << tree_size;
+      }
+    }
+    for (size_t level = 0; level < 5; ++level) {
+      string nodes, other_nodes;
+      EXPECT_EQ(lookup.CompleteSubtreeRoots(level, 0, 20 >> level, &nodes),
+                other->CompleteSubtreeRoots(level, 0, 20 >> level,
+                                            &other_nodes));
+      EXPECT_EQ(nodes, other_nodes);
+    }
+    EXPECT_EQ(lookup.GetSTH().sha256_root_hash(),
+              other->GetCompactMerkleTree(new Sha256Hasher)->CurrentRoot());
+  }
+}
+
+
+TYPED_TEST(LogLookupTest, AuditProofs) {
+  LoggedEntry logged_certs[13];
+  for (int i = 0; i < 13; ++i) {
+    this->test_signer_.CreateUnique(&logged_certs[i]);
+    this->CreateSequencedEntry(&logged_certs[i], i);
+  }
+  this->UpdateTree();
+
+  LogLookup lookup(this->db());
+  const std::vector<int64_t> indices{5, 0, 11, 5};
+  std::vector<ShortMerkleAuditProof> proofs;
+  ASSERT_EQ(LogLookup::OK, lookup.AuditProofs(indices, 12, &proofs));
+  ASSERT_EQ(indices.size(), proofs.size());
+  for (size_t i = 0; i < indices.size(); ++i) {
+    ShortMerkleAuditProof proof;
+    EXPECT_EQ(LogLookup::OK, lookup.AuditProof(indices[i], 12, &proof));
+    EXPECT_EQ(proof.DebugString(), proofs[i].DebugString());
+  }
+  // Without the cache, the frontier is computed for the batch.
+  const int cache_size(FLAGS_log_lookup_frontier_cache_size);
+  FLAGS_log_lookup_frontier_cache_size = 0;
+  std::vector<ShortMerkleAuditProof> uncached_proofs;
+  ASSERT_EQ(LogLookup::OK, lookup.AuditProofs(indices, 12, &uncached_proofs));
+  FLAGS_log_lookup_frontier_cache_size = cache_size;
+  for (size_t i = 0; i < indices.size(); ++i) {
+    EXPECT_EQ(proofs[i].DebugString(), uncached_proofs[i].DebugString());
+  }
+
+  // By hash, of which those that are not in the tree get no proof.
+  LoggedEntry unknown;
+  this->test_signer_.CreateUnique(&unknown);
+  const std::vector<string> hashes{logged_certs[5].merkle_leaf_hash(),
+                                   unknown.merkle_leaf_hash(),
+                                   logged_certs[12].merkle_leaf_hash(),
+                                   logged_certs[11].merkle_leaf_hash()};
+  ASSERT_EQ(LogLookup::OK, lookup.AuditProofs(hashes, 12, &proofs));
+  ASSERT_EQ(hashes.size(), proofs.size());
+  EXPECT_EQ(5, proofs[0].leaf_index());
+  EXPECT_FALSE(proofs[1].has_leaf_index());
+  EXPECT_FALSE(proofs[2].has_leaf_index());
+  ShortMerkleAuditProof proof;
+  EXPECT_EQ(LogLookup::OK, lookup.AuditProof(11, 12, &proof));
+  EXPECT_EQ(proof.DebugString(), proofs[3].DebugString());
+
+  EXPECT_EQ(LogLookup::NOT_FOUND,
+            lookup.AuditProofs(std::vector<string>{unknown.merkle_leaf_hash()},
+                               12, &proofs));
+}
+
+
+TYPED_TEST(LogLookupTest, ReadsDuringUpdates) {
+  LogLookup lookup(this->db());
+  std::atomic<bool> done(false);
+  std::thread reader([&lookup, &done]() {
+    int64_t tree_size(0);
+    while (!done) {
+      // Tree heads only move forward, and proofs are available for them
+      // as soon as they are published.
+      const ct::SignedTreeHead sth(lookup.GetSTH());
+      EXPECT_LE(tree_size, sth.tree_size());
+      tree_size = sth.tree_size();
+      if (tree_size > 0) {
+        EXPECT_EQ(sth.sha256_root_hash(), lookup.RootAtSnapshot(tree_size));
+        ShortMerkleAuditProof proof;
+        EXPECT_EQ(LogLookup::OK,
+                  lookup.AuditProof(tree_size - 1, tree_size, &proof));
+      }
+    }
+  });
+
+  for (int i = 0; i < 50; ++i) {
+    LoggedEntry logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    this->CreateSequencedEntry(&logged_cert, i);
+    if (i % 10 == 9)
+      this->UpdateTree();
+  }
+  done = true;
+  reader.join();
+  EXPECT_EQ(50, lookup.GetSTH().tree_size());
+}
+
+
+TYPED_TEST(LogLookupTest, ExportsTiles) {
+  LogLookup lookup(this->db());
+  TileExporter exporter(&lookup, this->tree_tmp_.TmpStorageDir() + "/tiles");
+  std::vector<int64_t> exported_sizes;
+  lookup.AddUpdateCallback([&](const ct::SignedTreeHead& sth) {
+    EXPECT_TRUE(exporter.Export(sth.tree_size()).ok());
+    exported_sizes.push_back(sth.tree_size());
+  });
+
+  std::vector<string> leaf_hashes;
+  for (int i = 0; i < 300; ++i) {
+    LoggedEntry logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    this->CreateSequencedEntry(&logged_cert, i);
+    leaf_hashes.push_back(lookup.LeafHash(logged_cert));
+    if (i == 99)
+      this->UpdateTree();
+  }
+  this->UpdateTree();
+  EXPECT_EQ(std::vector<int64_t>({100, 300}), exported_sizes);
+
+  const string tile_dir(this->tree_tmp_.TmpStorageDir() + "/tiles/");
+  string tile;
+  ASSERT_TRUE(util::ReadBinaryFile(tile_dir + "tile/8/0/000", &tile));
+  string expected_tile;
+  for (int i = 0; i < 256; ++i)
+    expected_tile.append(leaf_hashes[i]);
+  EXPECT_EQ(expected_tile, tile);
+
+  // The partial tile of the first tree size was removed once the tile
+  // was full.
+  EXPECT_FALSE(util::ReadBinaryFile(tile_dir + "tile/8/0/000.p/100", &tile));
+  struct stat st;
+  EXPECT_NE(0, stat((tile_dir + "tile/8/0/000.p").c_str(), &st));
+  ASSERT_TRUE(util::ReadBinaryFile(tile_dir + "tile/8/0/001.p/44", &tile));
+  EXPECT_EQ(44U * 32, tile.size());
+  ASSERT_TRUE(util::ReadBinaryFile(tile_dir + "tile/8/1/000.p/1", &tile));
+  EXPECT_EQ(lookup.RootAtSnapshot(256), tile);
+
+  string read_tile;
+  EXPECT_EQ(LogLookup::OK,
+            cert_trans::ReadTile(&lookup, 0, 1, 44, &read_tile));
+  ASSERT_TRUE(util::ReadBinaryFile(tile_dir + "tile/8/0/001.p/44", &tile));
+  EXPECT_EQ(tile, read_tile);
+  EXPECT_EQ(LogLookup::NOT_FOUND,
+            cert_trans::ReadTile(&lookup, 0, 1, 45, &read_tile));
+  EXPECT_EQ(LogLookup::NOT_FOUND,
+            cert_trans::ReadTile(&lookup, 1, 0, 2, &read_tile));
+
+  // A wider partial tile supersedes the narrower one.
+  for (int i = 300; i < 310; ++i) {
+    LoggedEntry logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    this->CreateSequencedEntry(&logged_cert, i);
+  }
+  this->UpdateTree();
+  EXPECT_EQ(std::vector<int64_t>({100, 300, 310}), exported_sizes);
+  EXPECT_FALSE(util::ReadBinaryFile(tile_dir + "tile/8/0/001.p/44", &tile));
+  ASSERT_TRUE(util::ReadBinaryFile(tile_dir + "tile/8/0/001.p/54", &tile));
+  ASSERT_EQ(LogLookup::OK,
+            cert_trans::ReadTile(&lookup, 0, 1, 44, &read_tile));
+  EXPECT_EQ(read_tile, tile.substr(0, read_tile.size()));
+  EXPECT_TRUE(util::ReadBinaryFile(tile_dir + "tile/8/1/000.p/1", &tile));
+}
+
+
 }  // namespace
 
 
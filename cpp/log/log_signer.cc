@@ -5,19 +5,30 @@
 #include <openssl/evp.h>
 #include <openssl/opensslv.h>
 #include <stdint.h>
+#include <atomic>
+#include <chrono>
 
 #include "merkletree/serial_hasher.h"
+#include "monitoring/gauge.h"
+#include "monitoring/latency.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
+#include "util/task.h"
 #include "util/util.h"
 
+using cert_trans::Gauge;
+using cert_trans::Latency;
 using cert_trans::Verifier;
 using ct::DigitallySigned;
 using ct::LogEntry;
 using ct::LogEntryType;
 using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
 using std::string;
+using std::vector;
+using util::Task;
 
 #if OPENSSL_VERSION_NUMBER < 0x10000000
 #error "Need OpenSSL >= 1.0.0"
@@ -25,6 +36,20 @@ using std::string;
 
 namespace {
 
+Gauge<>* sct_signing_queue_depth =
+    Gauge<>::New("sct_signing_queue_depth",
+                 "Number of SCTs submitted for signing on the signing "
+                 "threads, and not signed yet.");
+
+Latency<milliseconds, string> sct_signing_latency_ms(
+    "sct_signing_latency_ms", "mode",
+    "Latency in ms of signing batches of SCTs, including the time spent "
+    "waiting for a signing thread, by whether they were signed on the "
+    "signing threads (\"async\") or by their caller (\"sync\").");
+
+// The SCTs counted by sct_signing_queue_depth.
+std::atomic<int64_t> num_queued_scts(0);
+
 LogSigVerifier::VerifyResult ConvertStatus(const Verifier::Status status) {
   switch (status) {
     case Verifier::OK:
@@ -119,6 +144,92 @@ LogSigner::SignResult LogSigner::SignCertificateTimestamp(
   return OK;
 }
 
+LogSigner::SignResult LogSigner::SignCertificateTimestamps(
+    const vector<const LogEntry*>& entries,
+    const vector<SignedCertificateTimestamp*>& scts) const {
+  vector<string> serialized_inputs;
+  const SignResult result(SerializeSCTInputs(entries, scts,
+                                             &serialized_inputs));
+  if (result != OK) {
+    return result;
+  }
+
+  cert_trans::ScopedLatency latency(
+      sct_signing_latency_ms.GetScopedLatency("sync"));
+  vector<DigitallySigned> signatures;
+  SignBatch(serialized_inputs, &signatures);
+  SetSCTSignatures(&signatures, scts);
+  return OK;
+}
+
+LogSigner::SignResult LogSigner::SignCertificateTimestampsAsync(
+    const vector<const LogEntry*>& entries,
+    const vector<SignedCertificateTimestamp*>& scts, Task* task) const {
+  struct Batch {
+    vector<string> serialized_inputs;
+    vector<DigitallySigned> signatures;
+  };
+  vector<string> serialized_inputs;
+  const SignResult result(SerializeSCTInputs(entries, scts,
+                                             &serialized_inputs));
+  if (result != OK) {
+    return result;
+  }
+
+  Batch* const batch(new Batch);
+  task->DeleteWhenDone(batch);
+  batch->serialized_inputs.swap(serialized_inputs);
+  const bool queued(HasExecutor());
+  const int64_t num_scts(scts.size());
+  if (queued) {
+    sct_signing_queue_depth->Set(num_queued_scts += num_scts);
+  }
+  const steady_clock::time_point start(steady_clock::now());
+  SignBatchAsync(&batch->serialized_inputs, &batch->signatures,
+                 task->AddChild([this, batch, scts, task, queued, num_scts,
+                                 start](Task* child) {
+                   if (queued) {
+                     sct_signing_queue_depth->Set(num_queued_scts -=
+                                                  num_scts);
+                   }
+                   sct_signing_latency_ms.RecordLatency(
+                       queued ? "async" : "sync",
+                       steady_clock::now() - start);
+                   SetSCTSignatures(&batch->signatures, scts);
+                   task->Return(child->status());
+                 }));
+  return OK;
+}
+
+// static
+LogSigner::SignResult LogSigner::SerializeSCTInputs(
+    const vector<const LogEntry*>& entries,
+    const vector<SignedCertificateTimestamp*>& scts, vector<string>* inputs) {
+  CHECK_EQ(entries.size(), scts.size());
+  inputs->resize(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    CHECK(scts[i]->has_timestamp())
+        << "Attempt to sign an SCT with a missing timestamp";
+    const SerializeResult res(
+        Serializer::SerializeSCTSignatureInput(*scts[i], *entries[i],
+                                               &(*inputs)[i]));
+    if (res != SerializeResult::OK)
+      return GetSerializeError(res);
+  }
+  return OK;
+}
+
+void LogSigner::SetSCTSignatures(
+    vector<DigitallySigned>* signatures,
+    const vector<SignedCertificateTimestamp*>& scts) const {
+  CHECK_EQ(signatures->size(), scts.size());
+  const string key_id(KeyID());
+  for (size_t i = 0; i < scts.size(); ++i) {
+    scts[i]->mutable_signature()->Swap(&(*signatures)[i]);
+    scts[i]->mutable_id()->set_key_id(key_id);
+  }
+}
+
 LogSigner::SignResult LogSigner::SignV1TreeHead(uint64_t timestamp,
                                                 int64_t tree_size,
                                                 const string& root_hash,
@@ -4,12 +4,18 @@
 #include <openssl/evp.h>
 #include <openssl/x509.h>  // for i2d_PUBKEY
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #include "log/signer.h"
 #include "log/verifier.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
 
+namespace util {
+class Task;
+}  // namespace util
+
 class LogSigner : public cert_trans::Signer {
  public:
   explicit LogSigner(EVP_PKEY* pkey);
@@ -46,6 +52,23 @@ class LogSigner : public cert_trans::Signer {
   SignResult SignCertificateTimestamp(
       const ct::LogEntry& entry, ct::SignedCertificateTimestamp* sct) const;
 
+  // Like SignCertificateTimestamp(), for each of |entries| and the
+  // corresponding element of |scts|, but serializing all of them first
+  // and then signing them in one batch. Nothing is signed if any of them
+  // cannot be serialized, in which case the first error is returned.
+  SignResult SignCertificateTimestamps(
+      const std::vector<const ct::LogEntry*>& entries,
+      const std::vector<ct::SignedCertificateTimestamp*>& scts) const;
+
+  // Like SignCertificateTimestamps(), but signs through SignBatchAsync(),
+  // returning |task| once |scts| are set. If any of |entries| cannot be
+  // serialized, returns the first error without using |task|. |scts|
+  // must remain valid until |task| is done, |entries| need not.
+  SignResult SignCertificateTimestampsAsync(
+      const std::vector<const ct::LogEntry*>& entries,
+      const std::vector<ct::SignedCertificateTimestamp*>& scts,
+      util::Task* task) const;
+
   SignResult SignV1TreeHead(uint64_t timestamp, int64_t tree_size,
                             const std::string& root_hash,
                             std::string* result) const;
@@ -54,6 +77,16 @@ class LogSigner : public cert_trans::Signer {
 
  private:
   static SignResult GetSerializeError(SerializeResult result);
+
+  // Serializes the signature inputs of the SCTs of |entries|.
+  static SignResult SerializeSCTInputs(
+      const std::vector<const ct::LogEntry*>& entries,
+      const std::vector<ct::SignedCertificateTimestamp*>& scts,
+      std::vector<std::string>* inputs);
+  // Moves |signatures| into the corresponding elements of |scts|.
+  void SetSCTSignatures(
+      std::vector<ct::DigitallySigned>* signatures,
+      const std::vector<ct::SignedCertificateTimestamp*>& scts) const;
 };
 
 class LogSigVerifier : public cert_trans::Verifier {
@@ -151,6 +151,42 @@ TEST_F(LogSignerTest, SignAndVerifyCertSCT) {
                 default_sct.extensions(), serialized_sig));
 }
 
+TEST_F(LogSignerTest, SignAndVerifyCertSCTBatch) {
+  LogEntry cert_entry, precert_entry;
+  TestSigner::SetDefaults(&cert_entry);
+  TestSigner::SetPrecertDefaults(&precert_entry);
+  SignedCertificateTimestamp cert_sct, precert_sct;
+  TestSigner::SetDefaults(&cert_sct);
+  TestSigner::SetPrecertDefaults(&precert_sct);
+  cert_sct.clear_signature();
+  precert_sct.clear_signature();
+
+  EXPECT_EQ(LogSigner::OK,
+            signer_->SignCertificateTimestamps({&cert_entry, &precert_entry},
+                                               {&cert_sct, &precert_sct}));
+  EXPECT_EQ(LogSigVerifier::OK,
+            verifier_->VerifySCTSignature(cert_entry, cert_sct));
+  EXPECT_EQ(LogSigVerifier::OK,
+            verifier_->VerifySCTSignature(precert_entry, precert_sct));
+}
+
+TEST_F(LogSignerTest, SignBatchEmptyCert) {
+  LogEntry good_entry, bad_entry;
+  TestSigner::SetDefaults(&good_entry);
+  TestSigner::SetDefaults(&bad_entry);
+  bad_entry.mutable_x509_entry()->clear_leaf_certificate();
+  SignedCertificateTimestamp good_sct, bad_sct;
+  TestSigner::SetDefaults(&good_sct);
+  TestSigner::SetDefaults(&bad_sct);
+  good_sct.clear_signature();
+  bad_sct.clear_signature();
+
+  EXPECT_EQ(LogSigner::EMPTY_CERTIFICATE,
+            signer_->SignCertificateTimestamps({&good_entry, &bad_entry},
+                                               {&good_sct, &bad_sct}));
+  EXPECT_FALSE(good_sct.has_signature());
+}
+
 TEST_F(LogSignerTest, SignAndVerifyPrecertSCT) {
   LogEntry default_entry;
   TestSigner::SetPrecertDefaults(&default_entry);
@@ -2,19 +2,66 @@
 
 #include <glog/logging.h>
 #include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <map>
+#include <vector>
 
+#include "base/notification.h"
 #include "log/cert_submission_handler.h"
 #include "log/log_signer.h"
 #include "merkletree/merkle_verifier.h"
 #include "proto/ct.pb.h"
 #include "proto/serializer.h"
+#include "util/executor.h"
 #include "util/util.h"
 
+using cert_trans::Notification;
+
 using ct::LogEntry;
 using ct::MerkleAuditProof;
 using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
+using std::function;
+using std::map;
+using std::min;
 using std::string;
+using std::vector;
+
+namespace {
+
+// Signatures are verified on the executor in chunks of this many, so
+// that each task is worth its overhead.
+const size_t kSignaturesPerTask = 64;
+
+// Calls |verify| with each index in [0, |count|), in chunks on
+// |executor| if it is not NULL, and returns once they are all done.
+void ForEachSignature(size_t count, util::Executor* executor,
+                      const function<void(size_t)>& verify) {
+  if (!executor || count <= kSignaturesPerTask) {
+    for (size_t i = 0; i < count; ++i)
+      verify(i);
+    return;
+  }
+
+  const size_t num_tasks((count + kSignaturesPerTask - 1) /
+                         kSignaturesPerTask);
+  std::atomic<size_t> pending(num_tasks);
+  Notification done;
+  for (size_t begin = 0; begin < count; begin += kSignaturesPerTask) {
+    const size_t end(min(count, begin + kSignaturesPerTask));
+    executor->Add([begin, end, &verify, &pending, &done]() {
+      for (size_t i = begin; i < end; ++i)
+        verify(i);
+      if (--pending == 0)
+        done.Notify();
+    });
+  }
+  done.WaitForNotification();
+}
+
+}  // namespace
 
 LogVerifier::LogVerifier(LogSigVerifier* sig_verifier,
                          MerkleVerifier* merkle_verifier)
@@ -55,6 +102,37 @@ LogVerifier::LogVerifyResult LogVerifier::VerifySignedCertificateTimestamp(
                                           merkle_leaf_hash);
 }
 
+void LogVerifier::VerifySignedCertificateTimestamps(
+    const vector<LogEntry>& entries,
+    const vector<SignedCertificateTimestamp>& scts, util::Executor* executor,
+    vector<LogVerifyResult>* results,
+    vector<string>* merkle_leaf_hashes) const {
+  CHECK_EQ(entries.size(), scts.size());
+  results->assign(scts.size(), VERIFY_OK);
+
+  // Allow a bit of slack, say 1 second into the future.
+  const uint64_t latest(util::TimeInMilliseconds() + 1000);
+  ForEachSignature(scts.size(), executor, [&](size_t i) {
+    (*results)[i] = VerifySignedCertificateTimestamp(entries[i], scts[i], 0,
+                                                     latest, NULL);
+  });
+
+  // The tree hasher serialises its callers, so this is not worth doing
+  // on the executor.
+  if (merkle_leaf_hashes != NULL) {
+    merkle_leaf_hashes->assign(scts.size(), string());
+    for (size_t i = 0; i < scts.size(); ++i) {
+      if ((*results)[i] != VERIFY_OK)
+        continue;
+      string serialized_leaf;
+      CHECK_EQ(SerializeResult::OK,
+               Serializer::SerializeSCTMerkleTreeLeaf(scts[i], entries[i],
+                                                      &serialized_leaf));
+      (*merkle_leaf_hashes)[i] = merkle_verifier_->LeafHash(serialized_leaf);
+    }
+  }
+}
+
 LogVerifier::LogVerifyResult LogVerifier::VerifySignedTreeHead(
     const SignedTreeHead& sth, uint64_t begin_range,
     uint64_t end_range) const {
@@ -72,6 +150,18 @@ LogVerifier::LogVerifyResult LogVerifier::VerifySignedTreeHead(
   return VerifySignedTreeHead(sth, 0, util::TimeInMilliseconds() + 1000);
 }
 
+void LogVerifier::VerifySignedTreeHeads(
+    const vector<SignedTreeHead>& sths, util::Executor* executor,
+    vector<LogVerifyResult>* results) const {
+  results->assign(sths.size(), VERIFY_OK);
+
+  // Allow a bit of slack, say 1 second into the future.
+  const uint64_t latest(util::TimeInMilliseconds() + 1000);
+  ForEachSignature(sths.size(), executor, [&](size_t i) {
+    (*results)[i] = VerifySignedTreeHead(sths[i], 0, latest);
+  });
+}
+
 LogVerifier::LogVerifyResult LogVerifier::VerifyMerkleAuditProof(
     const LogEntry& entry, const SignedCertificateTimestamp& sct,
     const MerkleAuditProof& merkle_proof) const {
@@ -112,6 +202,80 @@ LogVerifier::LogVerifyResult LogVerifier::VerifyMerkleAuditProof(
   return VERIFY_OK;
 }
 
+void LogVerifier::VerifyMerkleAuditProofs(
+    const vector<LogEntry>& entries,
+    const vector<SignedCertificateTimestamp>& scts,
+    const vector<MerkleAuditProof>& proofs,
+    vector<LogVerifyResult>* results) const {
+  CHECK_EQ(entries.size(), scts.size());
+  CHECK_EQ(entries.size(), proofs.size());
+  results->assign(proofs.size(), VERIFY_OK);
+
+  // Group the proofs by tree head, i.e. everything in the proof but the
+  // leaf index and path.
+  map<string, vector<size_t>> groups;
+  for (size_t i = 0; i < proofs.size(); ++i) {
+    MerkleAuditProof tree_head(proofs[i]);
+    tree_head.clear_leaf_index();
+    tree_head.clear_path_node();
+    groups[tree_head.SerializeAsString()].push_back(i);
+  }
+
+  const uint64_t latest(util::TimeInMilliseconds() + 1000);
+  for (const auto& group : groups) {
+    const uint64_t tree_size(proofs[group.second.front()].tree_size());
+    vector<size_t> indices;
+    vector<MerkleVerifier::AuditPath> paths;
+    string root_hash;
+    for (size_t i : group.second) {
+      if (!IsBetween(proofs[i].timestamp(), scts[i].timestamp(), latest)) {
+        (*results)[i] = INCONSISTENT_TIMESTAMPS;
+        continue;
+      }
+      string serialized_leaf;
+      if (Serializer::SerializeSCTMerkleTreeLeaf(scts[i], entries[i],
+                                                 &serialized_leaf) !=
+          SerializeResult::OK) {
+        (*results)[i] = INVALID_FORMAT;
+        continue;
+      }
+
+      // The tree head root is only known once a first proof verifies.
+      if (root_hash.empty()) {
+        (*results)[i] = VerifyMerkleAuditProof(entries[i], scts[i], proofs[i]);
+        if ((*results)[i] == VERIFY_OK) {
+          const vector<string> path(proofs[i].path_node().begin(),
+                                    proofs[i].path_node().end());
+          root_hash =
+              merkle_verifier_->RootFromPath(proofs[i].leaf_index() + 1,
+                                             tree_size, path, serialized_leaf);
+        }
+        continue;
+      }
+
+      indices.push_back(i);
+      paths.emplace_back();
+      // Leaf indexing in the MerkleTree starts from 1.
+      paths.back().leaf = proofs[i].leaf_index() + 1;
+      paths.back().leaf_hash = merkle_verifier_->LeafHash(serialized_leaf);
+      paths.back().path.assign(proofs[i].path_node().begin(),
+                               proofs[i].path_node().end());
+    }
+    if (paths.empty())
+      continue;
+
+    vector<bool> valid;
+    merkle_verifier_->VerifyPaths(tree_size, root_hash, paths, &valid);
+    for (size_t p = 0; p < paths.size(); ++p) {
+      // Verify the (rare) failures on their own, to tell why they failed.
+      const size_t i(indices[p]);
+      if (!valid[p])
+        (*results)[i] =
+            VerifyMerkleAuditProof(entries[i], scts[i], proofs[i]);
+    }
+  }
+}
+
 /* static */
 bool LogVerifier::IsBetween(uint64_t timestamp, uint64_t earliest,
                             uint64_t latest) {
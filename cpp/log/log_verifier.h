@@ -4,6 +4,8 @@
 
 #include <glog/logging.h>
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/log_signer.h"
@@ -11,6 +13,10 @@
 
 class MerkleVerifier;
 
+namespace util {
+class Executor;
+}  // namespace util
+
 // A verifier for verifying signed statements of the log.
 // TODO(ekasper): unit tests.
 class LogVerifier {
@@ -88,6 +94,17 @@ class LogVerifier {
     return VerifySignedCertificateTimestamp(entry, sct, NULL);
   }
 
+  // VerifySignedCertificateTimestamp() for each of |entries|[i] and
+  // |scts|[i], setting (*results)[i] and, if |merkle_leaf_hashes| is not
+  // NULL, (*merkle_leaf_hashes)[i] for those that verify. If |executor|
+  // is not NULL, the signatures are checked in chunks on it; this blocks
+  // until they are all done, so must not be called from its threads.
+  void VerifySignedCertificateTimestamps(
+      const std::vector<ct::LogEntry>& entries,
+      const std::vector<ct::SignedCertificateTimestamp>& scts,
+      util::Executor* executor, std::vector<LogVerifyResult>* results,
+      std::vector<std::string>* merkle_leaf_hashes) const;
+
   // Verify that the timestamp is in the given range,
   // and the signature is valid.
   // Timestamps are given in milliseconds, since January 1, 1970,
@@ -100,6 +117,12 @@ class LogVerifier {
   // valid.
   LogVerifyResult VerifySignedTreeHead(const ct::SignedTreeHead& sth) const;
 
+  // VerifySignedTreeHead() for each of |sths|, setting (*results)[i],
+  // spread over |executor| like VerifySignedCertificateTimestamps().
+  void VerifySignedTreeHeads(const std::vector<ct::SignedTreeHead>& sths,
+                             util::Executor* executor,
+                             std::vector<LogVerifyResult>* results) const;
+
   // Verify that
   // (1) The audit proof signature is valid
   // (2) sct timestamp <= audit proof timestamp <= now
@@ -108,6 +131,16 @@ class LogVerifier {
       const ct::LogEntry& entry, const ct::SignedCertificateTimestamp& sct,
       const ct::MerkleAuditProof& merkle_proof) const;
 
+  // VerifyMerkleAuditProof() for each of |entries|[i], |scts|[i] and
+  // |proofs|[i], setting (*results)[i]. Proofs for the same tree head are
+  // checked together, which verifies its signature once and hashes their
+  // paths in batches, so this is much faster for bulk audits.
+  void VerifyMerkleAuditProofs(
+      const std::vector<ct::LogEntry>& entries,
+      const std::vector<ct::SignedCertificateTimestamp>& scts,
+      const std::vector<ct::MerkleAuditProof>& proofs,
+      std::vector<LogVerifyResult>* results) const;
+
   bool VerifyConsistency(const ct::SignedTreeHead& sth1,
                          const ct::SignedTreeHead& sth2,
                          const std::vector<std::string>& proof) const;
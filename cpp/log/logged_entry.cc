@@ -1,11 +1,197 @@
 #include "log/logged_entry.h"
 
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl_lite.h>
+#include <google/protobuf/wire_format_lite.h>
+#include <string>
+
+#include "merkletree/tree_hasher.h"
+
 using ct::LogEntry;
+using ct::LoggedEntryPB;
 using ct::PreCert;
+using ct::PrecertChainEntry;
 using ct::CertInfo;
 using ct::SignedCertificateTimestamp;
+using ct::X509ChainEntry;
+using google::protobuf::io::CodedInputStream;
+using google::protobuf::io::CodedOutputStream;
+using google::protobuf::io::StringOutputStream;
+using google::protobuf::internal::WireFormatLite;
+using std::string;
 
 namespace cert_trans {
+namespace {
+
+
+// The messages which FilterFields() looks into.
+enum FilteredMessage {
+  LOGGED_ENTRY,
+  CONTENTS,
+  LOG_ENTRY,
+  X509_CHAIN_ENTRY,
+  PRECERT_CHAIN_ENTRY,
+};
+
+
+enum FieldAction {
+  DROP,
+  KEEP,
+  // Keep only some of the fields of the message it holds.
+  FILTER,
+};
+
+
+// What to do with the field |number| of |message| to parse only |fields|
+// of an entry. Sets |*nested| to the message of the field to FILTER.
+FieldAction ActionFor(FilteredMessage message, int number, int fields,
+                      FilteredMessage* nested) {
+  const bool leaf(fields & LoggedEntry::PARSE_LEAF);
+  const bool chain(fields & LoggedEntry::PARSE_CHAIN);
+  switch (message) {
+    case LOGGED_ENTRY:
+      if (number == LoggedEntryPB::kContentsFieldNumber) {
+        *nested = CONTENTS;
+        return FILTER;
+      }
+      return KEEP;
+    case CONTENTS:
+      if (number == LoggedEntryPB::Contents::kSctFieldNumber) {
+        return fields & LoggedEntry::PARSE_SCT ? KEEP : DROP;
+      }
+      if (number == LoggedEntryPB::Contents::kEntryFieldNumber) {
+        if (leaf == chain) {
+          return leaf ? KEEP : DROP;
+        }
+        *nested = LOG_ENTRY;
+        return FILTER;
+      }
+      return KEEP;
+    case LOG_ENTRY:
+      switch (number) {
+        case LogEntry::kX509EntryFieldNumber:
+          *nested = X509_CHAIN_ENTRY;
+          return FILTER;
+        case LogEntry::kPrecertEntryFieldNumber:
+          *nested = PRECERT_CHAIN_ENTRY;
+          return FILTER;
+        case LogEntry::kXJsonEntryFieldNumber:
+          return leaf ? KEEP : DROP;
+      }
+      return KEEP;
+    case X509_CHAIN_ENTRY:
+      if (number == X509ChainEntry::kCertificateChainFieldNumber) {
+        return chain ? KEEP : DROP;
+      }
+      return leaf ? KEEP : DROP;
+    case PRECERT_CHAIN_ENTRY:
+      if (number == PrecertChainEntry::kPreCertificateFieldNumber ||
+          number == PrecertChainEntry::kPrecertificateChainFieldNumber) {
+        return chain ? KEEP : DROP;
+      }
+      return leaf ? KEEP : DROP;
+  }
+  LOG(FATAL) << "Unknown message " << message;
+}
+
+
+// Copies to |out| the fields of |message| read from |in|, up to its
+// limit (which must be set), leaving out those that ActionFor() drops.
+bool FilterFields(FilteredMessage message, int fields, CodedInputStream* in,
+                  CodedOutputStream* out) {
+  while (true) {
+    const uint32_t tag(in->ReadTag());
+    if (tag == 0) {
+      // Either the end, or a zero tag, which is invalid.
+      return in->BytesUntilLimit() == 0;
+    }
+    FilteredMessage nested;
+    switch (ActionFor(message, WireFormatLite::GetTagFieldNumber(tag), fields,
+                      &nested)) {
+      case DROP:
+        if (!WireFormatLite::SkipField(in, tag)) {
+          return false;
+        }
+        break;
+      case KEEP:
+        if (!WireFormatLite::SkipField(in, tag, out)) {
+          return false;
+        }
+        break;
+      case FILTER: {
+        uint32_t length;
+        if (WireFormatLite::GetTagWireType(tag) !=
+                WireFormatLite::WIRETYPE_LENGTH_DELIMITED ||
+            !in->ReadVarint32(&length) ||
+            static_cast<int>(length) > in->BytesUntilLimit()) {
+          return false;
+        }
+        const CodedInputStream::Limit limit(in->PushLimit(length));
+        string filtered;
+        {
+          StringOutputStream stream(&filtered);
+          CodedOutputStream filtered_out(&stream);
+          if (!FilterFields(nested, fields, in, &filtered_out)) {
+            return false;
+          }
+        }
+        in->PopLimit(limit);
+        out->WriteTag(tag);
+        out->WriteVarint32(filtered.size());
+        out->WriteString(filtered);
+        break;
+      }
+    }
+  }
+}
+
+
+// Parses |fields| of the serialized |message| into |result|.
+bool ParseFiltered(FilteredMessage message, const void* data, int size,
+                   int fields, google::protobuf::Message* result) {
+  CodedInputStream in(static_cast<const uint8_t*>(data), size);
+  in.PushLimit(size);
+  string filtered;
+  {
+    StringOutputStream stream(&filtered);
+    CodedOutputStream out(&stream);
+    if (!FilterFields(message, fields, &in, &out)) {
+      return false;
+    }
+  }
+  return result->ParseFromString(filtered);
+}
+
+
+}  // namespace
+
+
+std::string LoggedEntry::MerkleLeafHash() const {
+  // TreeHasher is thread-safe.
+  static const TreeHasher* const hasher(new TreeHasher(new Sha256Hasher));
+  std::string serialized_leaf;
+  CHECK(SerializeForLeaf(&serialized_leaf));
+  return hasher->HashLeaf(serialized_leaf);
+}
+
+
+bool LoggedEntry::ParseFromDatabase(const string& src, int fields) {
+  if ((fields & PARSE_ALL) == PARSE_ALL) {
+    return ParseFromDatabase(src);
+  }
+  Clear();
+  return ParseFiltered(CONTENTS, src.data(), src.size(), fields,
+                       mutable_contents());
+}
+
+
+bool LoggedEntry::ParseFieldsFromArray(const void* data, int size,
+                                       int fields) {
+  if ((fields & PARSE_ALL) == PARSE_ALL) {
+    return ParseFromArray(data, size);
+  }
+  return ParseFiltered(LOGGED_ENTRY, data, size, fields, this);
+}
 
 
 bool LoggedEntry::CopyFromClientLogEntry(const AsyncLogClient::Entry& entry) {
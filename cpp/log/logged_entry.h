@@ -16,10 +16,27 @@ namespace cert_trans {
 
 class LoggedEntry : public ct::LoggedEntryPB {
  public:
+  // The parts of an entry which ParseFieldsFromArray() can be limited to,
+  // or-ed together. The fields of LoggedEntryPB itself, such as the
+  // sequence number, are always parsed.
+  enum ParseFields {
+    PARSE_SCT = 1 << 0,
+    // The type of the entry, and the leaf certificate, precertificate TBS
+    // or JSON it logs: what Hash() covers.
+    PARSE_LEAF = 1 << 1,
+    // The certificate chain, and the precertificate as submitted, which
+    // only the extra_data of get-entries needs.
+    PARSE_CHAIN = 1 << 2,
+    PARSE_ALL = PARSE_SCT | PARSE_LEAF | PARSE_CHAIN,
+  };
+
   std::string Hash() const {
     return Sha256Hasher::Sha256Digest(Serializer::LeafData(entry()));
   }
 
+  // The hash of this entry as a leaf of the (SHA-256) Merkle tree.
+  std::string MerkleLeafHash() const;
+
   uint64_t timestamp() const {
     return sct().timestamp();
   }
@@ -44,10 +61,23 @@ class LoggedEntry : public ct::LoggedEntryPB {
     return contents().SerializeToString(dst);
   }
 
+  // Replaces all of this entry, like ParseFromString(), so that what is
+  // parsed into a reused entry is not mixed up with what was there.
   bool ParseFromDatabase(const std::string& src) {
+    Clear();
     return mutable_contents()->ParseFromString(src);
   }
 
+  // Like ParseFromDatabase(), but only parses |fields| (a mask of
+  // ParseFields), skipping over the bytes of the others, which are left
+  // unset.
+  bool ParseFromDatabase(const std::string& src, int fields);
+
+  // Like ParseFromArray(), but only parses |fields| (a mask of
+  // ParseFields) of the serialized LoggedEntryPB, as above. Hash() needs
+  // PARSE_LEAF, and MerkleLeafHash() PARSE_SCT | PARSE_LEAF.
+  bool ParseFieldsFromArray(const void* data, int size, int fields);
+
   bool SerializeForLeaf(std::string* dst) const {
     return Serializer::SerializeSCTMerkleTreeLeaf(sct(), entry(), dst) ==
            SerializeResult::OK;
@@ -4,4 +4,88 @@
 
 typedef testing::Types<cert_trans::LoggedEntry> TestType;
 
+using cert_trans::LoggedEntry;
+using std::string;
+
+
+int ChainSize(const LoggedEntry& logged) {
+  return logged.entry().x509_entry().certificate_chain_size() +
+         logged.entry().precert_entry().precertificate_chain_size();
+}
+
+
+TEST(LoggedEntryTest, ParseFieldsFromArray) {
+  for (int i = 0; i < 20; ++i) {
+    LoggedEntry logged;
+    while (ChainSize(logged) == 0) {
+      logged.RandomForTest();
+    }
+    logged.set_sequence_number(i);
+    string data;
+    ASSERT_TRUE(logged.SerializeToString(&data));
+
+    LoggedEntry parsed;
+    ASSERT_TRUE(parsed.ParseFieldsFromArray(data.data(), data.size(),
+                                            LoggedEntry::PARSE_ALL));
+    EXPECT_EQ(logged.DebugString(), parsed.DebugString());
+
+    ASSERT_TRUE(parsed.ParseFieldsFromArray(data.data(), data.size(),
+                                            LoggedEntry::PARSE_SCT |
+                                                LoggedEntry::PARSE_LEAF));
+    EXPECT_EQ(i, parsed.sequence_number());
+    EXPECT_EQ(logged.Hash(), parsed.Hash());
+    EXPECT_EQ(logged.MerkleLeafHash(), parsed.MerkleLeafHash());
+    EXPECT_EQ(0, ChainSize(parsed));
+    EXPECT_FALSE(parsed.entry().precert_entry().has_pre_certificate());
+
+    ASSERT_TRUE(parsed.ParseFieldsFromArray(data.data(), data.size(),
+                                            LoggedEntry::PARSE_LEAF));
+    EXPECT_EQ(logged.Hash(), parsed.Hash());
+    EXPECT_FALSE(parsed.contents().has_sct());
+
+    ASSERT_TRUE(parsed.ParseFieldsFromArray(data.data(), data.size(),
+                                            LoggedEntry::PARSE_CHAIN));
+    EXPECT_EQ(ChainSize(logged), ChainSize(parsed));
+    EXPECT_FALSE(parsed.entry().x509_entry().has_leaf_certificate());
+    EXPECT_FALSE(parsed.entry().precert_entry().has_pre_cert());
+
+    ASSERT_TRUE(parsed.ParseFieldsFromArray(data.data(), data.size(), 0));
+    EXPECT_EQ(i, parsed.sequence_number());
+    EXPECT_FALSE(parsed.contents().has_entry());
+  }
+}
+
+
+TEST(LoggedEntryTest, ParseFromDatabaseWithFields) {
+  LoggedEntry logged;
+  while (ChainSize(logged) == 0) {
+    logged.RandomForTest();
+  }
+  string data;
+  ASSERT_TRUE(logged.SerializeForDatabase(&data));
+
+  LoggedEntry parsed;
+  ASSERT_TRUE(parsed.ParseFromDatabase(data, LoggedEntry::PARSE_LEAF));
+  EXPECT_EQ(logged.Hash(), parsed.Hash());
+  EXPECT_EQ(0, ChainSize(parsed));
+  ASSERT_TRUE(parsed.ParseFromDatabase(data, LoggedEntry::PARSE_ALL));
+  EXPECT_EQ(logged.DebugString(), parsed.DebugString());
+}
+
+
+TEST(LoggedEntryTest, ParseFieldsOfInvalidData) {
+  LoggedEntry logged;
+  logged.RandomForTest();
+  string data;
+  ASSERT_TRUE(logged.SerializeToString(&data));
+
+  LoggedEntry parsed;
+  EXPECT_FALSE(parsed.ParseFieldsFromArray(data.data(), data.size() - 1,
+                                           LoggedEntry::PARSE_LEAF));
+  const string garbage("\x1a\xff\xff\x01", 4);
+  EXPECT_FALSE(parsed.ParseFieldsFromArray(garbage.data(), garbage.size(),
+                                           LoggedEntry::PARSE_LEAF));
+}
+
+
 #include "log/logged_test-inl.h"
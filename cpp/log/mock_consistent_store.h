@@ -30,8 +30,8 @@ class MockConsistentStore : public ConsistentStore<Logged> {
       GetSequenceMapping,
       util::Status(EntryHandle<ct::SequenceMapping>* mapping));
 
-  MOCK_METHOD1_T(UpdateSequenceMapping,
-                 util::Status(EntryHandle<ct::SequenceMapping>* mapping));
+  MOCK_METHOD1_T(AddSequenceMappings,
+                 util::Status(const ct::SequenceMapping& mappings));
 
   MOCK_CONST_METHOD0_T(GetClusterNodeState,
                        util::StatusOr<ct::ClusterNodeState>());
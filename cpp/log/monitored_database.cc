@@ -0,0 +1,343 @@
+#include "log/monitored_database.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <chrono>
+#include <utility>
+
+#include "monitoring/counter.h"
+#include "monitoring/histogram.h"
+
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+DEFINE_int32(database_slow_operation_ms, 100,
+             "log database operations that take longer than this many "
+             "milliseconds, or none if 0");
+
+namespace cert_trans {
+namespace {
+
+
+static Histogram<string, string>* const latency_us(
+    Histogram<string, string>::New(
+        "database_latency_us", "backend", "operation",
+        "Latency of database operations in microseconds, by backend and "
+        "operation."));
+
+static Histogram<string, string>* const iterator_lifetime_ms(
+    Histogram<string, string>::New(
+        "database_iterator_lifetime_ms", "backend", "iterator",
+        "How long database iterators were open in milliseconds, by backend "
+        "and kind of iterator."));
+
+static Counter<string, string>* const bytes_read(
+    Counter<string, string>::New(
+        "database_bytes_read", "backend", "operation",
+        "Bytes of entries and tree heads read from the database, by backend "
+        "and operation."));
+
+static Counter<string, string>* const bytes_written(
+    Counter<string, string>::New(
+        "database_bytes_written", "backend", "operation",
+        "Bytes of entries and tree heads written to the database, by backend "
+        "and operation."));
+
+
+// Indexed by MonitoredDatabase::Operation.
+const char* const kOperationNames[] = {
+    "lookup_by_hash",
+    "lookup_by_index",
+    "latest_tree_head",
+    "scan_tree_heads",
+    "scan_entries",
+    "scan_leaf_hashes",
+    "next_entry",
+    "next_leaf_hash",
+    "lookup_json_entries",
+    "create_sequenced_entry",
+    "create_sequenced_entries",
+    "write_tree_head",
+    "initialize_node",
+    "node_id",
+};
+
+
+}  // namespace
+
+
+// Records the latency of an operation when it goes out of scope, and
+// logs it if it was slow.
+class MonitoredDatabase::ScopedOperation {
+ public:
+  ScopedOperation(const MonitoredDatabase* db, Operation op)
+      : db_(db), op_(op), start_(steady_clock::now()) {
+  }
+
+  ~ScopedOperation() {
+    const steady_clock::duration elapsed(steady_clock::now() - start_);
+    db_->latency_us_[op_]->Record(
+        duration_cast<microseconds>(elapsed).count());
+    if (FLAGS_database_slow_operation_ms > 0 &&
+        elapsed >= milliseconds(FLAGS_database_slow_operation_ms)) {
+      LOG(WARNING) << "slow " << db_->backend_ << " database operation "
+                   << kOperationNames[op_] << " took "
+                   << duration_cast<milliseconds>(elapsed).count() << "ms";
+    }
+  }
+
+ private:
+  const MonitoredDatabase* const db_;
+  const Operation op_;
+  const steady_clock::time_point start_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedOperation);
+};
+
+
+class MonitoredDatabase::Iterator : public Database::Iterator {
+ public:
+  Iterator(const MonitoredDatabase* db, unique_ptr<Database::Iterator> it)
+      : db_(db), it_(std::move(it)), created_at_(steady_clock::now()) {
+  }
+
+  ~Iterator() {
+    db_->entries_iterator_lifetime_ms_->Record(
+        duration_cast<milliseconds>(steady_clock::now() - created_at_)
+            .count());
+  }
+
+  bool GetNextEntry(LoggedEntry* entry) override {
+    ScopedOperation op(db_, NEXT_ENTRY);
+    if (!it_->GetNextEntry(entry)) {
+      return false;
+    }
+    db_->RecordBytesRead(SCAN_ENTRIES, entry->ByteSize());
+    return true;
+  }
+
+  void SetFields(int fields) override {
+    it_->SetFields(fields);
+  }
+
+ private:
+  const MonitoredDatabase* const db_;
+  const unique_ptr<Database::Iterator> it_;
+  const steady_clock::time_point created_at_;
+};
+
+
+class MonitoredDatabase::LeafHashIterator : public Database::LeafHashIterator {
+ public:
+  LeafHashIterator(const MonitoredDatabase* db,
+                   unique_ptr<Database::LeafHashIterator> it)
+      : db_(db), it_(std::move(it)), created_at_(steady_clock::now()) {
+  }
+
+  ~LeafHashIterator() {
+    db_->leaf_hash_iterator_lifetime_ms_->Record(
+        duration_cast<milliseconds>(steady_clock::now() - created_at_)
+            .count());
+  }
+
+  bool GetNextLeafHash(int64_t* sequence_number, string* leaf_hash) override {
+    ScopedOperation op(db_, NEXT_LEAF_HASH);
+    if (!it_->GetNextLeafHash(sequence_number, leaf_hash)) {
+      return false;
+    }
+    db_->RecordBytesRead(SCAN_LEAF_HASHES, leaf_hash->size());
+    return true;
+  }
+
+ private:
+  const MonitoredDatabase* const db_;
+  const unique_ptr<Database::LeafHashIterator> it_;
+  const steady_clock::time_point created_at_;
+};
+
+
+MonitoredDatabase::MonitoredDatabase(const string& backend,
+                                     unique_ptr<Database> db)
+    : backend_(backend),
+      db_(std::move(db)),
+      entries_iterator_lifetime_ms_(
+          iterator_lifetime_ms->Buckets(backend, "entries")),
+      leaf_hash_iterator_lifetime_ms_(
+          iterator_lifetime_ms->Buckets(backend, "leaf_hashes")) {
+  CHECK(db_);
+  static_assert(sizeof(kOperationNames) / sizeof(kOperationNames[0]) ==
+                    NUM_OPERATIONS,
+                "kOperationNames does not match Operation");
+  for (int op = 0; op < NUM_OPERATIONS; ++op) {
+    latency_us_[op] = latency_us->Buckets(backend, kOperationNames[op]);
+  }
+}
+
+
+Database::LookupResult MonitoredDatabase::LookupByHash(
+    const string& hash, LoggedEntry* result) const {
+  ScopedOperation op(this, LOOKUP_BY_HASH);
+  const LookupResult ret(db_->LookupByHash(hash, result));
+  if (ret == LOOKUP_OK && result) {
+    RecordBytesRead(LOOKUP_BY_HASH, result->ByteSize());
+  }
+  return ret;
+}
+
+
+Database::LookupResult MonitoredDatabase::LookupByIndex(
+    int64_t sequence_number, LoggedEntry* result) const {
+  ScopedOperation op(this, LOOKUP_BY_INDEX);
+  const LookupResult ret(db_->LookupByIndex(sequence_number, result));
+  if (ret == LOOKUP_OK && result) {
+    RecordBytesRead(LOOKUP_BY_INDEX, result->ByteSize());
+  }
+  return ret;
+}
+
+
+Database::LookupResult MonitoredDatabase::LatestTreeHead(
+    ct::SignedTreeHead* result) const {
+  ScopedOperation op(this, LATEST_TREE_HEAD);
+  const LookupResult ret(db_->LatestTreeHead(result));
+  if (ret == LOOKUP_OK) {
+    RecordBytesRead(LATEST_TREE_HEAD, result->ByteSize());
+  }
+  return ret;
+}
+
+
+vector<ct::SignedTreeHead> MonitoredDatabase::ScanTreeHeads() const {
+  ScopedOperation op(this, SCAN_TREE_HEADS);
+  vector<ct::SignedTreeHead> ret(db_->ScanTreeHeads());
+  int64_t bytes(0);
+  for (const ct::SignedTreeHead& sth : ret) {
+    bytes += sth.ByteSize();
+  }
+  RecordBytesRead(SCAN_TREE_HEADS, bytes);
+  return ret;
+}
+
+
+unique_ptr<Database::Iterator> MonitoredDatabase::ScanEntries(
+    int64_t start_index) const {
+  ScopedOperation op(this, SCAN_ENTRIES);
+  return unique_ptr<Database::Iterator>(
+      new Iterator(this, db_->ScanEntries(start_index)));
+}
+
+
+unique_ptr<Database::Iterator> MonitoredDatabase::ScanRange(int64_t start,
+                                                            int64_t end) const {
+  ScopedOperation op(this, SCAN_ENTRIES);
+  return unique_ptr<Database::Iterator>(
+      new Iterator(this, db_->ScanRange(start, end)));
+}
+
+
+unique_ptr<Database::LeafHashIterator> MonitoredDatabase::ScanLeafHashes(
+    int64_t start_index) const {
+  ScopedOperation op(this, SCAN_LEAF_HASHES);
+  return unique_ptr<Database::LeafHashIterator>(
+      new LeafHashIterator(this, db_->ScanLeafHashes(start_index)));
+}
+
+
+bool MonitoredDatabase::LookupJsonEntries(int64_t start, int64_t end,
+                                          vector<JsonEntry>* entries) const {
+  ScopedOperation op(this, LOOKUP_JSON_ENTRIES);
+  const size_t old_size(entries->size());
+  if (!db_->LookupJsonEntries(start, end, entries)) {
+    return false;
+  }
+  int64_t bytes(0);
+  for (size_t i = old_size; i < entries->size(); ++i) {
+    bytes += (*entries)[i].size;
+  }
+  RecordBytesRead(LOOKUP_JSON_ENTRIES, bytes);
+  return true;
+}
+
+
+int64_t MonitoredDatabase::TreeSize() const {
+  // Not timed, as it does not reach the storage.
+  return db_->TreeSize();
+}
+
+
+void MonitoredDatabase::AddNotifySTHCallback(
+    const Database::NotifySTHCallback* callback) {
+  db_->AddNotifySTHCallback(callback);
+}
+
+
+void MonitoredDatabase::RemoveNotifySTHCallback(
+    const Database::NotifySTHCallback* callback) {
+  db_->RemoveNotifySTHCallback(callback);
+}
+
+
+void MonitoredDatabase::InitializeNode(const string& node_id) {
+  ScopedOperation op(this, INITIALIZE_NODE);
+  db_->InitializeNode(node_id);
+}
+
+
+Database::LookupResult MonitoredDatabase::NodeId(string* node_id) {
+  ScopedOperation op(this, NODE_ID);
+  return db_->NodeId(node_id);
+}
+
+
+Database::WriteResult MonitoredDatabase::CreateSequencedEntry_(
+    const LoggedEntry& logged) {
+  ScopedOperation op(this, CREATE_SEQUENCED_ENTRY);
+  const WriteResult ret(db_->CreateSequencedEntry(logged));
+  if (ret == OK) {
+    RecordBytesWritten(CREATE_SEQUENCED_ENTRY, logged.ByteSize());
+  }
+  return ret;
+}
+
+
+Database::WriteResult MonitoredDatabase::CreateSequencedEntries_(
+    const vector<LoggedEntry>& logged, size_t* num_created) {
+  ScopedOperation op(this, CREATE_SEQUENCED_ENTRIES);
+  const WriteResult ret(db_->CreateSequencedEntries(logged, num_created));
+  int64_t bytes(0);
+  for (size_t i = 0; i < *num_created; ++i) {
+    bytes += logged[i].ByteSize();
+  }
+  RecordBytesWritten(CREATE_SEQUENCED_ENTRIES, bytes);
+  return ret;
+}
+
+
+Database::WriteResult MonitoredDatabase::WriteTreeHead_(
+    const ct::SignedTreeHead& sth) {
+  ScopedOperation op(this, WRITE_TREE_HEAD);
+  const WriteResult ret(db_->WriteTreeHead(sth));
+  if (ret == OK) {
+    RecordBytesWritten(WRITE_TREE_HEAD, sth.ByteSize());
+  }
+  return ret;
+}
+
+
+void MonitoredDatabase::RecordBytesRead(Operation op, int64_t bytes) const {
+  bytes_read->IncrementBy(backend_, kOperationNames[op], bytes);
+}
+
+
+void MonitoredDatabase::RecordBytesWritten(Operation op,
+                                           int64_t bytes) const {
+  bytes_written->IncrementBy(backend_, kOperationNames[op], bytes);
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,113 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef CERT_TRANS_LOG_MONITORED_DATABASE_H_
+#define CERT_TRANS_LOG_MONITORED_DATABASE_H_
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/database.h"
+
+namespace cert_trans {
+
+class HistogramBuckets;
+
+
+// A Database that forwards everything to another one, recording the
+// latency of every operation that reaches the storage, the bytes read
+// and written, and how long iterators are kept open, all labelled with
+// the name of the backend. Operations slower than
+// --database_slow_operation_ms are logged.
+class MonitoredDatabase : public Database {
+ public:
+  // |backend| names the kind of database in the metrics, e.g.
+  // "leveldb".
+  MonitoredDatabase(const std::string& backend, std::unique_ptr<Database> db);
+  ~MonitoredDatabase() = default;
+
+  Database::LookupResult LookupByHash(const std::string& hash,
+                                      LoggedEntry* result) const override;
+
+  Database::LookupResult LookupByIndex(int64_t sequence_number,
+                                       LoggedEntry* result) const override;
+
+  Database::LookupResult LatestTreeHead(
+      ct::SignedTreeHead* result) const override;
+
+  std::vector<ct::SignedTreeHead> ScanTreeHeads() const override;
+
+  std::unique_ptr<Database::Iterator> ScanEntries(
+      int64_t start_index) const override;
+
+  std::unique_ptr<Database::Iterator> ScanRange(int64_t start,
+                                                int64_t end) const override;
+
+  std::unique_ptr<Database::LeafHashIterator> ScanLeafHashes(
+      int64_t start_index) const override;
+
+  bool LookupJsonEntries(int64_t start, int64_t end,
+                         std::vector<JsonEntry>* entries) const override;
+
+  int64_t TreeSize() const override;
+
+  void AddNotifySTHCallback(
+      const Database::NotifySTHCallback* callback) override;
+
+  void RemoveNotifySTHCallback(
+      const Database::NotifySTHCallback* callback) override;
+
+  void InitializeNode(const std::string& node_id) override;
+
+  Database::LookupResult NodeId(std::string* node_id) override;
+
+ protected:
+  Database::WriteResult CreateSequencedEntry_(
+      const LoggedEntry& logged) override;
+
+  Database::WriteResult CreateSequencedEntries_(
+      const std::vector<LoggedEntry>& logged, size_t* num_created) override;
+
+  Database::WriteResult WriteTreeHead_(const ct::SignedTreeHead& sth) override;
+
+ private:
+  enum Operation {
+    LOOKUP_BY_HASH,
+    LOOKUP_BY_INDEX,
+    LATEST_TREE_HEAD,
+    SCAN_TREE_HEADS,
+    SCAN_ENTRIES,
+    SCAN_LEAF_HASHES,
+    NEXT_ENTRY,
+    NEXT_LEAF_HASH,
+    LOOKUP_JSON_ENTRIES,
+    CREATE_SEQUENCED_ENTRY,
+    CREATE_SEQUENCED_ENTRIES,
+    WRITE_TREE_HEAD,
+    INITIALIZE_NODE,
+    NODE_ID,
+    NUM_OPERATIONS,
+  };
+
+  class Iterator;
+  class LeafHashIterator;
+  class ScopedOperation;
+
+  void RecordBytesRead(Operation op, int64_t bytes) const;
+  void RecordBytesWritten(Operation op, int64_t bytes) const;
+
+  const std::string backend_;
+  const std::unique_ptr<Database> db_;
+  // The latency histograms of each operation, looked up once.
+  HistogramBuckets* latency_us_[NUM_OPERATIONS];
+  HistogramBuckets* entries_iterator_lifetime_ms_;
+  HistogramBuckets* leaf_hash_iterator_lifetime_ms_;
+
+  DISALLOW_COPY_AND_ASSIGN(MonitoredDatabase);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_MONITORED_DATABASE_H_
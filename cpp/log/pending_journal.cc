@@ -0,0 +1,319 @@
+#include "log/pending_journal.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+
+#include "util/util.h"
+
+using std::deque;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::unique_lock;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+const char kSegmentPrefix[] = "segment-";
+// Each record is preceded by its length and CRC-32, as 32-bit little
+// endian integers.
+const size_t kHeaderBytes = 8;
+
+
+void AppendUint32(uint32_t value, string* out) {
+  for (int i = 0; i < 4; ++i) {
+    out->push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+}
+
+
+uint32_t ReadUint32(const char* in) {
+  uint32_t value(0);
+  for (int i = 3; i >= 0; --i) {
+    value = (value << 8) | static_cast<unsigned char>(in[i]);
+  }
+  return value;
+}
+
+
+uint32_t Crc32(const char* data, size_t size) {
+  return crc32(crc32(0, Z_NULL, 0), reinterpret_cast<const Bytef*>(data),
+               size);
+}
+
+
+void SyncDirectory(const string& dir) {
+  const int fd(open(dir.c_str(), O_RDONLY | O_DIRECTORY));
+  PCHECK(fd >= 0) << "open " << dir;
+  PCHECK(fsync(fd) == 0) << "fsync " << dir;
+  PCHECK(close(fd) == 0) << "close " << dir;
+}
+
+
+}  // namespace
+
+
+PendingJournal::PendingJournal(const string& dir, size_t max_segment_bytes)
+    : dir_(dir),
+      max_segment_bytes_(max_segment_bytes),
+      current_segment_(-1),
+      fd_(-1),
+      current_bytes_(0),
+      roll_requested_(false),
+      stopping_(false) {
+  if (mkdir(dir_.c_str(), 0700) != 0) {
+    PCHECK(errno == EEXIST) << "mkdir " << dir_;
+  }
+  lock_guard<mutex> lock(lock_);
+  Recover();
+  StartSegment();
+  write_thread_.reset(new std::thread(&PendingJournal::WriteLoop, this));
+}
+
+
+PendingJournal::~PendingJournal() {
+  {
+    lock_guard<mutex> lock(lock_);
+    stopping_ = true;
+  }
+  cond_.notify_all();
+  write_thread_->join();
+
+  PCHECK(close(fd_) == 0) << "close " << SegmentPath(current_segment_);
+  if (num_records_[current_segment_] == 0) {
+    PCHECK(unlink(SegmentPath(current_segment_).c_str()) == 0)
+        << "unlink " << SegmentPath(current_segment_);
+  }
+}
+
+
+vector<PendingJournal::Record> PendingJournal::TakeRecovered() {
+  lock_guard<mutex> lock(lock_);
+  vector<Record> retval;
+  retval.swap(recovered_);
+  return retval;
+}
+
+
+void PendingJournal::Append(const vector<string>& records, int64_t* segment,
+                            util::Task* task) {
+  CHECK_NOTNULL(segment);
+  CHECK_NOTNULL(task);
+  if (records.empty()) {
+    task->Return();
+    return;
+  }
+
+  PendingAppend append{string(), records.size(), segment, task};
+  size_t size(0);
+  for (const string& record : records) {
+    size += kHeaderBytes + record.size();
+  }
+  append.data.reserve(size);
+  for (const string& record : records) {
+    CHECK_LE(record.size(), 0xffffffffU);
+    AppendUint32(record.size(), &append.data);
+    AppendUint32(Crc32(record.data(), record.size()), &append.data);
+    append.data.append(record);
+  }
+
+  {
+    lock_guard<mutex> lock(lock_);
+    CHECK(!stopping_);
+    pending_.emplace_back(std::move(append));
+  }
+  cond_.notify_all();
+}
+
+
+void PendingJournal::Release(int64_t segment, size_t count) {
+  bool roll(false);
+  {
+    lock_guard<mutex> lock(lock_);
+    const auto it(num_records_.find(segment));
+    CHECK(it != num_records_.end()) << "unknown segment " << segment;
+    CHECK_GE(it->second, count);
+    it->second -= count;
+    if (segment != current_segment_) {
+      MaybeRemoveSegment(segment);
+    } else if (it->second == 0 && !roll_requested_) {
+      // Everything in the current segment is released, so it can be
+      // replaced by an empty one rather than being replayed after a
+      // crash, but that is done by the write thread, which may be
+      // writing to it.
+      roll = roll_requested_ = true;
+    }
+  }
+  if (roll) {
+    cond_.notify_all();
+  }
+}
+
+
+size_t PendingJournal::NumRecords() const {
+  lock_guard<mutex> lock(lock_);
+  size_t retval(0);
+  for (const auto& segment : num_records_) {
+    retval += segment.second;
+  }
+  return retval;
+}
+
+
+string PendingJournal::SegmentPath(int64_t segment) const {
+  char name[64];
+  snprintf(name, sizeof(name), "%s%020lld", kSegmentPrefix,
+           static_cast<long long>(segment));
+  return dir_ + "/" + name;
+}
+
+
+void PendingJournal::Recover() {
+  vector<int64_t> segments;
+  DIR* const dir(opendir(dir_.c_str()));
+  PCHECK(dir != nullptr) << "opendir " << dir_;
+  while (const struct dirent* const entry = readdir(dir)) {
+    const string name(entry->d_name);
+    if (name.compare(0, strlen(kSegmentPrefix), kSegmentPrefix) == 0) {
+      segments.push_back(atoll(name.c_str() + strlen(kSegmentPrefix)));
+    }
+  }
+  PCHECK(closedir(dir) == 0) << "closedir " << dir_;
+  std::sort(segments.begin(), segments.end());
+
+  for (const int64_t segment : segments) {
+    const string path(SegmentPath(segment));
+    string data;
+    CHECK(util::ReadBinaryFile(path, &data)) << "could not read " << path;
+
+    size_t count(0);
+    size_t pos(0);
+    while (pos + kHeaderBytes <= data.size()) {
+      const size_t size(ReadUint32(data.data() + pos));
+      const uint32_t crc(ReadUint32(data.data() + pos + 4));
+      if (pos + kHeaderBytes + size > data.size() ||
+          Crc32(data.data() + pos + kHeaderBytes, size) != crc) {
+        break;
+      }
+      recovered_.push_back(
+          Record{segment, data.substr(pos + kHeaderBytes, size)});
+      ++count;
+      pos += kHeaderBytes + size;
+    }
+    // Whatever follows was being written when the journal stopped, and
+    // was never acknowledged.
+    LOG_IF(WARNING, pos < data.size())
+        << "dropping " << data.size() - pos << " bytes torn from the end of "
+        << path;
+
+    current_segment_ = segment;
+    if (count > 0) {
+      num_records_[segment] = count;
+    } else {
+      PCHECK(unlink(path.c_str()) == 0) << "unlink " << path;
+    }
+  }
+  LOG_IF(INFO, !recovered_.empty()) << "recovered " << recovered_.size()
+                                    << " records from " << dir_;
+}
+
+
+void PendingJournal::StartSegment() {
+  const int64_t previous(current_segment_);
+  if (fd_ >= 0) {
+    PCHECK(close(fd_) == 0) << "close " << SegmentPath(previous);
+  }
+
+  ++current_segment_;
+  const string path(SegmentPath(current_segment_));
+  fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_APPEND, 0600);
+  PCHECK(fd_ >= 0) << "open " << path;
+  current_bytes_ = 0;
+  num_records_[current_segment_] = 0;
+  SyncDirectory(dir_);
+
+  MaybeRemoveSegment(previous);
+}
+
+
+void PendingJournal::MaybeRemoveSegment(int64_t segment) {
+  if (segment == current_segment_) {
+    return;
+  }
+  const auto it(num_records_.find(segment));
+  if (it == num_records_.end() || it->second > 0) {
+    return;
+  }
+  const string path(SegmentPath(segment));
+  PCHECK(unlink(path.c_str()) == 0) << "unlink " << path;
+  num_records_.erase(it);
+}
+
+
+void PendingJournal::WriteLoop() {
+  unique_lock<mutex> lock(lock_);
+  while (true) {
+    cond_.wait(lock, [this]() {
+      return stopping_ || roll_requested_ || !pending_.empty();
+    });
+    if (roll_requested_) {
+      roll_requested_ = false;
+      if (num_records_[current_segment_] == 0 && current_bytes_ > 0) {
+        StartSegment();
+      }
+    }
+    if (pending_.empty()) {
+      if (stopping_) {
+        return;
+      }
+      continue;
+    }
+
+    deque<PendingAppend> appends;
+    appends.swap(pending_);
+    if (current_bytes_ >= max_segment_bytes_) {
+      StartSegment();
+    }
+    string data;
+    size_t count(0);
+    for (PendingAppend& append : appends) {
+      data.append(append.data);
+      count += append.count;
+      *append.segment = current_segment_;
+    }
+    num_records_[current_segment_] += count;
+    current_bytes_ += data.size();
+    const int fd(fd_);
+    const string path(SegmentPath(current_segment_));
+    lock.unlock();
+
+    for (size_t written = 0; written < data.size();) {
+      const ssize_t ret(
+          write(fd, data.data() + written, data.size() - written));
+      PCHECK(ret > 0 || (ret < 0 && errno == EINTR)) << "write " << path;
+      if (ret > 0) {
+        written += ret;
+      }
+    }
+    PCHECK(fdatasync(fd) == 0) << "fdatasync " << path;
+    for (PendingAppend& append : appends) {
+      append.task->Return();
+    }
+
+    lock.lock();
+  }
+}
+
+
+}  // namespace cert_trans
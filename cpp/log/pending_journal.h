@@ -0,0 +1,106 @@
+#ifndef CERT_TRANS_LOG_PENDING_JOURNAL_H_
+#define CERT_TRANS_LOG_PENDING_JOURNAL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/macros.h"
+#include "util/task.h"
+
+namespace cert_trans {
+
+
+// An append-only journal of records on the local disk, for the pending
+// entries of a frontend which were accepted but are not yet in etcd, so
+// that they survive a crash.
+//
+// The records are written to numbered segment files in a directory, and
+// synced to disk before Append() returns. All the records appended while
+// the journal is syncing are written and synced together afterwards
+// (group commit), so that a busy journal syncs once for many appends.
+//
+// Each record of a segment must be released once it is no longer needed
+// (i.e. it is in etcd), and the segment is deleted once they all are and
+// no more are being written to it. Whatever is left is read back when
+// the journal is opened again, to be replayed.
+//
+// This class is thread-safe.
+class PendingJournal {
+ public:
+  struct Record {
+    int64_t segment;
+    std::string data;
+  };
+
+  // Opens the journal in |dir|, creating it if needed. New segments are
+  // started once the current one holds |max_segment_bytes|.
+  PendingJournal(const std::string& dir, size_t max_segment_bytes);
+  ~PendingJournal();
+
+  // Returns the records left by a previous run, in order, which must be
+  // released like new ones.
+  std::vector<Record> TakeRecovered();
+
+  // Appends |records|, and returns |task| once they are on disk, with
+  // |*segment| set to the segment holding them. |segment| must remain
+  // valid until then, |records| need not.
+  void Append(const std::vector<std::string>& records, int64_t* segment,
+              util::Task* task);
+
+  // Releases |count| of the records of |segment|.
+  void Release(int64_t segment, size_t count);
+
+  // The number of records not released yet.
+  size_t NumRecords() const;
+
+ private:
+  struct PendingAppend {
+    std::string data;
+    size_t count;
+    int64_t* segment;
+    util::Task* task;
+  };
+
+  std::string SegmentPath(int64_t segment) const;
+  void Recover();
+  // Starts a new segment, removing the current one if it has no records
+  // left. |lock_| must be held.
+  void StartSegment();
+  // Removes |segment| if it has no records left and is not the current
+  // one. |lock_| must be held.
+  void MaybeRemoveSegment(int64_t segment);
+  void WriteLoop();
+
+  const std::string dir_;
+  const size_t max_segment_bytes_;
+
+  mutable std::mutex lock_;
+  std::condition_variable cond_;
+  std::vector<Record> recovered_;
+  // The number of records not released yet, of each segment.
+  std::map<int64_t, size_t> num_records_;
+  int64_t current_segment_;
+  int fd_;
+  size_t current_bytes_;
+  std::deque<PendingAppend> pending_;
+  // Whether the write thread should replace the current segment, once
+  // all its records were released.
+  bool roll_requested_;
+  bool stopping_;
+  std::unique_ptr<std::thread> write_thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(PendingJournal);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_PENDING_JOURNAL_H_
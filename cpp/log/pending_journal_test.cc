@@ -0,0 +1,204 @@
+#include "log/pending_journal.h"
+
+#include <dirent.h>
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "util/sync_task.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+using util::SyncTask;
+
+
+class PendingJournalTest : public ::testing::Test {
+ protected:
+  PendingJournalTest() : pool_(2), dir_(tmp_.TmpStorageDir() + "/journal") {
+  }
+
+  PendingJournal* Open(size_t max_segment_bytes = 1 << 20) {
+    return new PendingJournal(dir_, max_segment_bytes);
+  }
+
+  int64_t Append(PendingJournal* journal, const vector<string>& records) {
+    int64_t segment(-1);
+    SyncTask task(&pool_);
+    journal->Append(records, &segment, task.task());
+    task.Wait();
+    EXPECT_TRUE(task.status().ok()) << task.status();
+    return segment;
+  }
+
+  vector<string> Recovered(PendingJournal* journal) {
+    vector<string> retval;
+    for (const PendingJournal::Record& record : journal->TakeRecovered()) {
+      retval.push_back(record.data);
+    }
+    return retval;
+  }
+
+  int NumSegments() const {
+    int retval(0);
+    DIR* const dir(opendir(dir_.c_str()));
+    CHECK_NOTNULL(dir);
+    while (const struct dirent* const entry = readdir(dir)) {
+      if (string(entry->d_name).find("segment-") == 0) {
+        ++retval;
+      }
+    }
+    closedir(dir);
+    return retval;
+  }
+
+  ThreadPool pool_;
+  TmpStorage tmp_;
+  const string dir_;
+};
+
+
+TEST_F(PendingJournalTest, RecoversRecords) {
+  {
+    unique_ptr<PendingJournal> journal(Open());
+    EXPECT_TRUE(Recovered(journal.get()).empty());
+    Append(journal.get(), {"one", "two"});
+    Append(journal.get(), {"", "three"});
+    EXPECT_EQ(4U, journal->NumRecords());
+  }
+
+  unique_ptr<PendingJournal> journal(Open());
+  EXPECT_EQ((vector<string>{"one", "two", "", "three"}),
+            Recovered(journal.get()));
+  // They are only taken once.
+  EXPECT_TRUE(Recovered(journal.get()).empty());
+  EXPECT_EQ(4U, journal->NumRecords());
+}
+
+
+TEST_F(PendingJournalTest, ReleasedRecordsAreNotRecovered) {
+  {
+    unique_ptr<PendingJournal> journal(Open());
+    const int64_t segment(Append(journal.get(), {"one", "two"}));
+    Append(journal.get(), {"three"});
+    journal->Release(segment, 3);
+    EXPECT_EQ(0U, journal->NumRecords());
+  }
+  EXPECT_EQ(0, NumSegments());
+
+  unique_ptr<PendingJournal> journal(Open());
+  EXPECT_TRUE(Recovered(journal.get()).empty());
+}
+
+
+TEST_F(PendingJournalTest, RecoveredRecordsAreReleased) {
+  {
+    unique_ptr<PendingJournal> journal(Open());
+    Append(journal.get(), {"one", "two"});
+  }
+  {
+    unique_ptr<PendingJournal> journal(Open());
+    vector<PendingJournal::Record> recovered(journal->TakeRecovered());
+    ASSERT_EQ(2U, recovered.size());
+    journal->Release(recovered[0].segment, 1);
+  }
+  {
+    unique_ptr<PendingJournal> journal(Open());
+    vector<PendingJournal::Record> recovered(journal->TakeRecovered());
+    // Only what is released and in a segment of its own is gone.
+    ASSERT_EQ(2U, recovered.size());
+    journal->Release(recovered[0].segment, 2);
+  }
+  unique_ptr<PendingJournal> journal(Open());
+  EXPECT_TRUE(Recovered(journal.get()).empty());
+}
+
+
+TEST_F(PendingJournalTest, RemovesReleasedSegments) {
+  unique_ptr<PendingJournal> journal(Open(10));
+  const int64_t first(Append(journal.get(), {"0123456789"}));
+  const int64_t second(Append(journal.get(), {"0123456789"}));
+  const int64_t third(Append(journal.get(), {"0123456789"}));
+  EXPECT_LT(first, second);
+  EXPECT_LT(second, third);
+  EXPECT_EQ(3, NumSegments());
+
+  journal->Release(second, 1);
+  EXPECT_EQ(2, NumSegments());
+  journal->Release(first, 1);
+  EXPECT_EQ(1, NumSegments());
+  journal.reset();
+
+  journal.reset(Open(10));
+  EXPECT_EQ((vector<string>{"0123456789"}), Recovered(journal.get()));
+}
+
+
+TEST_F(PendingJournalTest, DropsTornRecords) {
+  {
+    unique_ptr<PendingJournal> journal(Open());
+    Append(journal.get(), {"one", "two"});
+  }
+  ASSERT_EQ(1, NumSegments());
+  DIR* const dir(opendir(dir_.c_str()));
+  string path;
+  while (const struct dirent* const entry = readdir(dir)) {
+    if (string(entry->d_name).find("segment-") == 0) {
+      path = dir_ + "/" + entry->d_name;
+    }
+  }
+  closedir(dir);
+
+  // A record which was being written when the journal stopped, whose
+  // checksum does not match.
+  FILE* const file(fopen(path.c_str(), "a"));
+  ASSERT_NE(nullptr, file);
+  const char kTorn[] = "\x03\x00\x00\x00\x00\x00\x00\x00ab";
+  fwrite(kTorn, 1, sizeof(kTorn) - 1, file);
+  fclose(file);
+
+  unique_ptr<PendingJournal> journal(Open());
+  EXPECT_EQ((vector<string>{"one", "two"}), Recovered(journal.get()));
+}
+
+
+TEST_F(PendingJournalTest, ConcurrentAppends) {
+  unique_ptr<PendingJournal> journal(Open(100));
+  vector<thread> threads;
+  for (int t = 0; t < 8; ++t) {
+    threads.emplace_back([this, &journal, t]() {
+      for (int i = 0; i < 50; ++i) {
+        const int64_t segment(
+            Append(journal.get(), {std::to_string(t * 1000 + i)}));
+        journal->Release(segment, 1);
+      }
+    });
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+  EXPECT_EQ(0U, journal->NumRecords());
+  journal.reset();
+
+  journal.reset(Open(100));
+  EXPECT_TRUE(Recovered(journal.get()).empty());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,109 @@
+#include "log/prefetching_iterator.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <utility>
+
+DEFINE_int32(database_scan_readahead, 0,
+             "if positive, the bulk scans of the database, such as those "
+             "of snapshots and db_tool, read and parse up to this many "
+             "entries ahead on a thread of their own");
+
+using std::lock_guard;
+using std::mutex;
+using std::unique_lock;
+using std::unique_ptr;
+
+namespace cert_trans {
+
+
+PrefetchingIterator::PrefetchingIterator(
+    unique_ptr<ReadOnlyDatabase::Iterator> it, int depth)
+    : it_(std::move(it)),
+      ring_(depth),
+      next_(0),
+      ready_(0),
+      done_(false),
+      stopping_(false) {
+  CHECK(it_);
+  CHECK_GT(depth, 0);
+}
+
+
+PrefetchingIterator::~PrefetchingIterator() {
+  {
+    lock_guard<mutex> lock(lock_);
+    stopping_ = true;
+  }
+  changed_.notify_all();
+  if (reader_) {
+    reader_->join();
+  }
+}
+
+
+bool PrefetchingIterator::GetNextEntry(LoggedEntry* entry) {
+  CHECK_NOTNULL(entry);
+  unique_lock<mutex> lock(lock_);
+  if (!reader_) {
+    reader_.reset(new std::thread(&PrefetchingIterator::ReadAhead, this));
+  }
+  changed_.wait(lock, [this]() { return ready_ > 0 || done_; });
+  if (ready_ == 0) {
+    return false;
+  }
+
+  // The slot gets the memory of |*entry|, for the reader to reuse.
+  entry->Swap(&ring_[next_]);
+  next_ = (next_ + 1) % ring_.size();
+  --ready_;
+  lock.unlock();
+  changed_.notify_all();
+  return true;
+}
+
+
+void PrefetchingIterator::SetFields(int fields) {
+  lock_guard<mutex> lock(lock_);
+  CHECK(!reader_) << "SetFields() called after GetNextEntry()";
+  it_->SetFields(fields);
+}
+
+
+void PrefetchingIterator::ReadAhead() {
+  LoggedEntry entry;
+  while (true) {
+    // The reads are the slow part, and happen without the lock.
+    const bool ok(it_->GetNextEntry(&entry));
+
+    unique_lock<mutex> lock(lock_);
+    if (!ok) {
+      done_ = true;
+      lock.unlock();
+      changed_.notify_all();
+      return;
+    }
+    changed_.wait(lock,
+                  [this]() { return ready_ < ring_.size() || stopping_; });
+    if (stopping_) {
+      return;
+    }
+    ring_[(next_ + ready_) % ring_.size()].Swap(&entry);
+    ++ready_;
+    lock.unlock();
+    changed_.notify_all();
+  }
+}
+
+
+unique_ptr<ReadOnlyDatabase::Iterator> MaybeReadAhead(
+    unique_ptr<ReadOnlyDatabase::Iterator> it) {
+  if (FLAGS_database_scan_readahead <= 0) {
+    return it;
+  }
+  return unique_ptr<ReadOnlyDatabase::Iterator>(
+      new PrefetchingIterator(std::move(it), FLAGS_database_scan_readahead));
+}
+
+
+}  // namespace cert_trans
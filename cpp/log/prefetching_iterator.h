@@ -0,0 +1,66 @@
+#ifndef CERT_TRANS_LOG_PREFETCHING_ITERATOR_H_
+#define CERT_TRANS_LOG_PREFETCHING_ITERATOR_H_
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/database.h"
+#include "log/logged_entry.h"
+
+namespace cert_trans {
+
+
+// An iterator which reads and parses the entries of another one ahead of
+// its caller, on a thread of its own, into a ring of up to |depth|
+// entries, so that long sequential scans wait on the disk while they do
+// their own work rather than in turn. The thread starts with the first
+// GetNextEntry(), and stops at the end of the scan or when the iterator
+// is destroyed.
+class PrefetchingIterator : public ReadOnlyDatabase::Iterator {
+ public:
+  PrefetchingIterator(std::unique_ptr<ReadOnlyDatabase::Iterator> it,
+                      int depth);
+  ~PrefetchingIterator() override;
+
+  bool GetNextEntry(LoggedEntry* entry) override;
+
+  // Must be called before the first GetNextEntry(), as the entries are
+  // parsed ahead of it.
+  void SetFields(int fields) override;
+
+ private:
+  // Runs on |reader_|.
+  void ReadAhead();
+
+  const std::unique_ptr<ReadOnlyDatabase::Iterator> it_;
+  std::mutex lock_;
+  std::condition_variable changed_;
+  // The entries read ahead are the |ready_| ones starting at |next_|,
+  // wrapping around. The others keep the memory of entries already
+  // handed out, which is reused for the following ones.
+  std::vector<LoggedEntry> ring_;
+  size_t next_;
+  size_t ready_;
+  // Whether |it_| has no more entries.
+  bool done_;
+  bool stopping_;
+  std::unique_ptr<std::thread> reader_;
+
+  DISALLOW_COPY_AND_ASSIGN(PrefetchingIterator);
+};
+
+
+// Wraps |it| in a PrefetchingIterator if --database_scan_readahead is
+// positive, and returns it as is otherwise. For the bulk scans, such as
+// those of snapshots and db_tool.
+std::unique_ptr<ReadOnlyDatabase::Iterator> MaybeReadAhead(
+    std::unique_ptr<ReadOnlyDatabase::Iterator> it);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_PREFETCHING_ITERATOR_H_
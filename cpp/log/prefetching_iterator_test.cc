@@ -0,0 +1,132 @@
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "log/database.h"
+#include "log/logged_entry.h"
+#include "log/prefetching_iterator.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::unique_ptr;
+
+
+// Returns the entries from 0 to |count| - 1, counting how many were read.
+class CountingIterator : public ReadOnlyDatabase::Iterator {
+ public:
+  CountingIterator(int64_t count, std::atomic<int64_t>* read,
+                   std::atomic<int>* fields)
+      : count_(count), read_(read), fields_(fields) {
+  }
+
+  bool GetNextEntry(LoggedEntry* entry) override {
+    const int64_t seq(*read_);
+    if (seq >= count_) {
+      return false;
+    }
+    entry->Clear();
+    entry->set_sequence_number(seq);
+    entry->mutable_contents()->mutable_sct()->set_extensions(
+        "entry " + std::to_string(seq));
+    ++*read_;
+    return true;
+  }
+
+  void SetFields(int fields) override {
+    *fields_ = fields;
+  }
+
+ private:
+  const int64_t count_;
+  std::atomic<int64_t>* const read_;
+  std::atomic<int>* const fields_;
+};
+
+
+class PrefetchingIteratorTest : public ::testing::Test {
+ protected:
+  PrefetchingIteratorTest() : read_(0), fields_(LoggedEntry::PARSE_ALL) {
+  }
+
+  unique_ptr<PrefetchingIterator> Scan(int64_t count, int depth) {
+    return unique_ptr<PrefetchingIterator>(new PrefetchingIterator(
+        unique_ptr<ReadOnlyDatabase::Iterator>(
+            new CountingIterator(count, &read_, &fields_)),
+        depth));
+  }
+
+  std::atomic<int64_t> read_;
+  std::atomic<int> fields_;
+};
+
+
+TEST_F(PrefetchingIteratorTest, ReturnsAllEntriesInOrder) {
+  const unique_ptr<PrefetchingIterator> it(Scan(1000, 7));
+  LoggedEntry entry;
+  for (int64_t seq = 0; seq < 1000; ++seq) {
+    ASSERT_TRUE(it->GetNextEntry(&entry));
+    EXPECT_EQ(seq, entry.sequence_number());
+    EXPECT_EQ("entry " + std::to_string(seq),
+              entry.contents().sct().extensions());
+  }
+  EXPECT_FALSE(it->GetNextEntry(&entry));
+  EXPECT_FALSE(it->GetNextEntry(&entry));
+}
+
+
+TEST_F(PrefetchingIteratorTest, Empty) {
+  const unique_ptr<PrefetchingIterator> it(Scan(0, 4));
+  LoggedEntry entry;
+  EXPECT_FALSE(it->GetNextEntry(&entry));
+}
+
+
+TEST_F(PrefetchingIteratorTest, ReadsAtMostDepthAhead) {
+  const unique_ptr<PrefetchingIterator> it(Scan(1000, 4));
+  // Nothing is read before the first entry is asked for.
+  EXPECT_EQ(0, read_);
+
+  LoggedEntry entry;
+  ASSERT_TRUE(it->GetNextEntry(&entry));
+  // The ring fills up, and the reader holds one more entry waiting for
+  // room in it.
+  while (read_ < 6) {
+    std::this_thread::yield();
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  EXPECT_EQ(6, read_);
+}
+
+
+TEST_F(PrefetchingIteratorTest, StopsWhenDestroyed) {
+  {
+    const unique_ptr<PrefetchingIterator> it(Scan(1000, 4));
+    LoggedEntry entry;
+    ASSERT_TRUE(it->GetNextEntry(&entry));
+  }
+  EXPECT_LT(read_, 1000);
+}
+
+
+TEST_F(PrefetchingIteratorTest, ForwardsFields) {
+  const unique_ptr<PrefetchingIterator> it(Scan(10, 4));
+  it->SetFields(LoggedEntry::PARSE_LEAF);
+  EXPECT_EQ(LoggedEntry::PARSE_LEAF, fields_);
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
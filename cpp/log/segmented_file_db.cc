@@ -0,0 +1,1375 @@
+#include "log/segmented_file_db.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "log/file_storage.h"
+#include "monitoring/latency.h"
+#include "monitoring/monitoring.h"
+#include "proto/ct.pb.h"
+#include "proto/serializer.h"
+#include "util/util.h"
+
+using std::chrono::milliseconds;
+using std::lock_guard;
+using std::make_pair;
+using std::max;
+using std::min;
+using std::move;
+using std::mutex;
+using std::pair;
+using std::set;
+using std::shared_ptr;
+using std::sort;
+using std::stoll;
+using std::string;
+using std::to_string;
+using std::unique_lock;
+using std::unique_ptr;
+using std::upper_bound;
+using std::vector;
+
+DEFINE_int32(segmented_file_db_entries_per_segment, 1 << 20,
+             "number of sequence numbers covered by each segment of new "
+             "segmented file databases; existing databases keep the number "
+             "they were created with");
+DEFINE_bool(segmented_file_db_json_entries, true,
+            "whether to also store the JSON objects of new entries in "
+            "get-entries responses, so that they can be served as they are");
+DEFINE_int32(segmented_file_db_hot_segments, 0,
+             "if positive, full segments at least that many segments behind "
+             "the tree size are compressed, when opening the database and "
+             "whenever CompactColdSegments() is called");
+DEFINE_int32(segmented_file_db_cold_block_bytes, 1 << 20,
+             "approximate number of bytes of entries in each of the blocks "
+             "that compressed segments are made of, which are decompressed "
+             "whole");
+
+namespace cert_trans {
+namespace {
+
+
+static Latency<milliseconds, string> latency_by_op_ms(
+    "segmentedfiledb_latency_by_operation_ms", "operation",
+    "Database latency in ms broken out by operation.");
+
+
+const char kMetaNodeIdKey[] = "node_id";
+const char kMetaEntriesPerSegmentKey[] = "entries_per_segment";
+
+const char kSegmentPrefix[] = "segment-";
+const char kDataSuffix[] = ".data";
+const char kIndexSuffix[] = ".index";
+const char kColdSuffix[] = ".cold";
+const char kTmpSuffix[] = ".tmp";
+// The first sequence number of a segment, in hex, in its file names.
+const size_t kSegmentNumberDigits = 16;
+
+// Each slot holds the offset of the entry in the data file plus 1 (so
+// that empty slots are all zeroes) on 8 bytes, its length on 4 bytes,
+// the length of its JSON object (0 if there is none), which follows it
+// in the data file, on 4 bytes and its Merkle leaf hash, all big-endian.
+const size_t kLeafHashSize = 32;
+const size_t kSlotSize = 8 + 4 + 4 + kLeafHashSize;
+
+// Each block of a compressed segment is described by its offset in the
+// data file on 8 bytes, and its compressed and uncompressed sizes on 4
+// bytes each.
+const size_t kBlockEntrySize = 8 + 4 + 4;
+
+// Scans read runs of up to that many entries at once...
+const size_t kScanChunkSize = 1024;
+// ...and up to that many bytes of them with each read.
+const size_t kMaxReadBytes = 1 << 20;
+
+
+void PutBigEndian(uint64_t value, size_t bytes, char* out) {
+  for (size_t i = bytes; i > 0; --i) {
+    *out++ = static_cast<char>((value >> ((i - 1) * 8)) & 0xff);
+  }
+}
+
+
+uint64_t GetBigEndian(const char* in, size_t bytes) {
+  uint64_t value(0);
+  for (size_t i = 0; i < bytes; ++i) {
+    value = (value << 8) | static_cast<unsigned char>(in[i]);
+  }
+  return value;
+}
+
+
+void ReadFully(int fd, char* buf, size_t size, off_t offset) {
+  while (size > 0) {
+    const ssize_t bytes(pread(fd, buf, size, offset));
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    PCHECK(bytes >= 0) << "pread";
+    CHECK_GT(bytes, 0) << "unexpected end of segment data file";
+    buf += bytes;
+    size -= bytes;
+    offset += bytes;
+  }
+}
+
+
+void WriteFully(int fd, const char* buf, size_t size, off_t offset) {
+  while (size > 0) {
+    const ssize_t bytes(pwrite(fd, buf, size, offset));
+    if (bytes < 0 && errno == EINTR) {
+      continue;
+    }
+    PCHECK(bytes > 0) << "pwrite";
+    buf += bytes;
+    size -= bytes;
+    offset += bytes;
+  }
+}
+
+
+string FormatSegmentNumber(int64_t first_sequence_number) {
+  char buf[kSegmentNumberDigits + 1];
+  CHECK_EQ(snprintf(buf, sizeof(buf), "%016llx",
+                    static_cast<unsigned long long>(first_sequence_number)),
+           static_cast<int>(kSegmentNumberDigits));
+  return buf;
+}
+
+
+// Returns the first sequence number of the segment with the index file
+// |name|, or -1 if it is not such a file.
+int64_t ParseIndexFileName(const string& name) {
+  const size_t prefix_size(strlen(kSegmentPrefix));
+  if (name.size() !=
+          prefix_size + kSegmentNumberDigits + strlen(kIndexSuffix) ||
+      name.compare(0, prefix_size, kSegmentPrefix) != 0 ||
+      name.compare(prefix_size + kSegmentNumberDigits, string::npos,
+                   kIndexSuffix) != 0) {
+    return -1;
+  }
+  const string digits(name.substr(prefix_size, kSegmentNumberDigits));
+  if (digits.find_first_not_of("0123456789abcdef") != string::npos) {
+    return -1;
+  }
+  return stoll(digits, nullptr, 16);
+}
+
+
+// Renders the JSON object of |logged| in get-entries responses, or
+// leaves |json| empty if it cannot be serialized.
+void RenderJsonEntry(const LoggedEntry& logged, string* json) {
+  string leaf_input;
+  string extra_data;
+  if (!logged.SerializeForLeaf(&leaf_input) ||
+      !logged.SerializeExtraData(&extra_data)) {
+    LOG(WARNING) << "Failed to serialize entry @ " << logged.sequence_number()
+                 << " for get-entries";
+    json->clear();
+    return;
+  }
+  // Base64 needs no escaping.
+  *json = "{\"leaf_input\":\"" + util::ToBase64(leaf_input) +
+          "\",\"extra_data\":\"" + util::ToBase64(extra_data) + "\"}";
+}
+
+
+// The data file of a segment that is not compressed.
+class DataFile {
+ public:
+  explicit DataFile(int fd) : fd_(fd) {
+  }
+
+  ~DataFile() {
+    PCHECK(close(fd_) == 0);
+  }
+
+  int fd() const {
+    return fd_;
+  }
+
+ private:
+  const int fd_;
+
+  DISALLOW_COPY_AND_ASSIGN(DataFile);
+};
+
+
+// A read-only mapping of part of a data file.
+class Mapping {
+ public:
+  Mapping(int fd, off_t begin, off_t end)
+      : offset_(begin - begin % sysconf(_SC_PAGESIZE)),
+        size_(end - offset_),
+        data_(mmap(NULL, size_, PROT_READ, MAP_SHARED, fd, offset_)) {
+    PCHECK(data_ != MAP_FAILED) << "mmap";
+  }
+
+  ~Mapping() {
+    PCHECK(munmap(data_, size_) == 0);
+  }
+
+  // Returns the address of |offset| in the file, which must be mapped.
+  const char* At(off_t offset) const {
+    CHECK_GE(offset, offset_);
+    CHECK_LT(offset, offset_ + static_cast<off_t>(size_));
+    return static_cast<const char*>(data_) + (offset - offset_);
+  }
+
+ private:
+  const off_t offset_;
+  const size_t size_;
+  void* const data_;
+
+  DISALLOW_COPY_AND_ASSIGN(Mapping);
+};
+
+
+}  // namespace
+
+
+const size_t SegmentedFileDB::kTimestampBytesIndexed = 6;
+
+
+struct SegmentedFileDB::Slot {
+  int64_t sequence_number;
+  uint64_t offset;
+  uint32_t length;
+  uint32_t json_length;
+  string leaf_hash;
+
+  // The offset of the JSON object of the entry, if any.
+  uint64_t json_offset() const {
+    return offset + length;
+  }
+
+  // The offset just after the entry and its JSON object.
+  uint64_t end() const {
+    return json_offset() + json_length;
+  }
+};
+
+
+// The contents of the data file of a compressed segment, in blocks that
+// each hold whole entries (with their JSON objects) and cover the data
+// file end to end, so that the offsets in the slots still apply.
+//
+// The file holds the zlib-compressed blocks one after the other,
+// followed by one kBlockEntrySize entry per block and the number of
+// blocks on 8 bytes, all big-endian.
+class SegmentedFileDB::ColdBlocks {
+ public:
+  explicit ColdBlocks(const string& path)
+      : fd_(open(path.c_str(), O_RDONLY)), size_(0) {
+    PCHECK(fd_ >= 0) << "open " << path;
+
+    struct stat st;
+    PCHECK(fstat(fd_, &st) == 0);
+    const uint64_t file_size(st.st_size);
+    CHECK_GE(file_size, 8U) << path << " is truncated";
+    char count[8];
+    ReadFully(fd_, count, sizeof(count), file_size - sizeof(count));
+    const uint64_t num_blocks(GetBigEndian(count, sizeof(count)));
+    CHECK_LE(num_blocks, (file_size - sizeof(count)) / kBlockEntrySize)
+        << path << " is truncated";
+    string table(num_blocks * kBlockEntrySize, 0);
+    const uint64_t table_offset(file_size - sizeof(count) - table.size());
+    ReadFully(fd_, &table[0], table.size(), table_offset);
+
+    uint64_t file_offset(0);
+    for (size_t i = 0; i < num_blocks; ++i) {
+      const char* const entry(table.data() + i * kBlockEntrySize);
+      Block block;
+      block.begin = GetBigEndian(entry, 8);
+      block.file_offset = file_offset;
+      block.compressed_size = GetBigEndian(entry + 8, 4);
+      block.size = GetBigEndian(entry + 12, 4);
+      CHECK_EQ(block.begin, size_) << path << " has a gap between blocks";
+      blocks_.push_back(block);
+      file_offset += block.compressed_size;
+      size_ += block.size;
+    }
+    CHECK_EQ(file_offset, table_offset) << path << " is corrupted";
+  }
+
+  ~ColdBlocks() {
+    PCHECK(close(fd_) == 0);
+  }
+
+  // Writes the |data_size| bytes of |data_fd| to |path|, compressed in
+  // blocks that start at the offsets of entries of |slots|, which must
+  // be sorted by offset and hold every entry of the data file.
+  //
+  // The file is synced to disk before being renamed into place, since
+  // it is about to be the only copy of the entries.
+  static void Write(int data_fd, uint64_t data_size,
+                    const vector<Slot>& slots, const string& path) {
+    CHECK(!slots.empty());
+    vector<uint64_t> begins(1, 0);
+    for (const Slot& slot : slots) {
+      if (slot.offset - begins.back() >=
+          static_cast<uint64_t>(FLAGS_segmented_file_db_cold_block_bytes)) {
+        begins.push_back(slot.offset);
+      }
+    }
+
+    const string tmp_path(path + kTmpSuffix);
+    const int fd(
+        open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600));
+    PCHECK(fd >= 0) << "open " << tmp_path;
+    string table;
+    string block;
+    string compressed;
+    off_t file_offset(0);
+    for (size_t i = 0; i < begins.size(); ++i) {
+      const uint64_t end(i + 1 < begins.size() ? begins[i + 1] : data_size);
+      CHECK_LE(end - begins[i], UINT32_MAX);
+      block.resize(end - begins[i]);
+      ReadFully(data_fd, &block[0], block.size(), begins[i]);
+
+      uLongf compressed_size(compressBound(block.size()));
+      compressed.resize(compressed_size);
+      CHECK_EQ(compress2(reinterpret_cast<Bytef*>(&compressed[0]),
+                         &compressed_size,
+                         reinterpret_cast<const Bytef*>(block.data()),
+                         block.size(), Z_BEST_COMPRESSION),
+               Z_OK);
+      CHECK_LE(compressed_size, UINT32_MAX);
+      WriteFully(fd, compressed.data(), compressed_size, file_offset);
+      file_offset += compressed_size;
+
+      char entry[kBlockEntrySize];
+      PutBigEndian(begins[i], 8, entry);
+      PutBigEndian(compressed_size, 4, entry + 8);
+      PutBigEndian(block.size(), 4, entry + 12);
+      table.append(entry, sizeof(entry));
+    }
+    char count[8];
+    PutBigEndian(begins.size(), sizeof(count), count);
+    table.append(count, sizeof(count));
+    WriteFully(fd, table.data(), table.size(), file_offset);
+
+    PCHECK(fdatasync(fd) == 0) << "fdatasync " << tmp_path;
+    PCHECK(close(fd) == 0);
+    PCHECK(rename(tmp_path.c_str(), path.c_str()) == 0) << "rename "
+                                                          << tmp_path;
+  }
+
+  // The size of the data file that this replaces.
+  uint64_t size() const {
+    return size_;
+  }
+
+  // Returns the index of the block holding |offset| in the data file.
+  size_t BlockAt(uint64_t offset) const {
+    CHECK_LT(offset, size_);
+    const auto it(upper_bound(blocks_.begin(), blocks_.end(), offset,
+                              [](uint64_t offset, const Block& block) {
+                                return offset < block.begin;
+                              }));
+    return it - blocks_.begin() - 1;
+  }
+
+  // The offset in the data file of the block |index|.
+  uint64_t block_begin(size_t index) const {
+    return blocks_.at(index).begin;
+  }
+
+  void ReadBlock(size_t index, string* result) const {
+    const Block& block(blocks_.at(index));
+    string compressed(block.compressed_size, 0);
+    ReadFully(fd_, &compressed[0], compressed.size(), block.file_offset);
+    result->resize(block.size);
+    uLongf size(block.size);
+    CHECK_EQ(uncompress(reinterpret_cast<Bytef*>(&(*result)[0]), &size,
+                        reinterpret_cast<const Bytef*>(compressed.data()),
+                        compressed.size()),
+             Z_OK)
+        << "corrupted block at offset " << block.begin;
+    CHECK_EQ(size, block.size);
+  }
+
+ private:
+  struct Block {
+    uint64_t begin;
+    uint64_t file_offset;
+    uint32_t compressed_size;
+    uint32_t size;
+  };
+
+  const int fd_;
+  vector<Block> blocks_;
+  uint64_t size_;
+
+  DISALLOW_COPY_AND_ASSIGN(ColdBlocks);
+};
+
+
+// The block that a reader last decompressed, which scans keep from one
+// run of entries to the next so that each block is decompressed once.
+struct SegmentedFileDB::BlockCache {
+  BlockCache() : index(0) {
+  }
+
+  // Makes |data| the block of |cold| holding |offset| in the data file,
+  // and returns the offset of that block.
+  uint64_t Load(const shared_ptr<const ColdBlocks>& cold, uint64_t offset) {
+    const size_t block(cold->BlockAt(offset));
+    if (cold != blocks || block != index || !data) {
+      shared_ptr<string> decompressed(new string);
+      cold->ReadBlock(block, decompressed.get());
+      blocks = cold;
+      index = block;
+      data = decompressed;
+    }
+    return blocks->block_begin(index);
+  }
+
+  shared_ptr<const ColdBlocks> blocks;
+  size_t index;
+  shared_ptr<const string> data;
+};
+
+
+// The files of a segment, with its index mapped in memory.
+class SegmentedFileDB::Segment {
+ public:
+  Segment(const string& path, int64_t first_sequence_number,
+          int64_t num_slots)
+      : path_(path),
+        first_sequence_number_(first_sequence_number),
+        num_slots_(num_slots),
+        index_fd_(
+            open((path + kIndexSuffix).c_str(), O_RDWR | O_CREAT, 0600)) {
+    PCHECK(index_fd_ >= 0) << "open " << path << kIndexSuffix;
+
+    // The index is a sparse file of its full size from the start, so
+    // that it never needs to be remapped.
+    const off_t index_size(num_slots_ * kSlotSize);
+    struct stat st;
+    PCHECK(fstat(index_fd_, &st) == 0);
+    CHECK_LE(st.st_size, index_size)
+        << path << kIndexSuffix << " has more slots than entries per "
+        << "segment";
+    if (st.st_size < index_size) {
+      PCHECK(ftruncate(index_fd_, index_size) == 0);
+    }
+    void* const slots(mmap(NULL, index_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, index_fd_, 0));
+    PCHECK(slots != MAP_FAILED) << "mmap " << path << kIndexSuffix;
+    slots_ = static_cast<char*>(slots);
+
+    const string cold_path(path + kColdSuffix);
+    if (unlink((cold_path + kTmpSuffix).c_str()) != 0) {
+      PCHECK(errno == ENOENT) << "unlink " << cold_path << kTmpSuffix;
+    }
+    if (access(cold_path.c_str(), F_OK) == 0) {
+      cold_.reset(new ColdBlocks(cold_path));
+      data_size_ = cold_->size();
+      // Left behind if compressing the segment was interrupted.
+      if (unlink((path + kDataSuffix).c_str()) != 0) {
+        PCHECK(errno == ENOENT) << "unlink " << path << kDataSuffix;
+      }
+    } else {
+      const int data_fd(
+          open((path + kDataSuffix).c_str(), O_RDWR | O_CREAT, 0600));
+      PCHECK(data_fd >= 0) << "open " << path << kDataSuffix;
+      data_.reset(new DataFile(data_fd));
+      PCHECK(fstat(data_fd, &st) == 0);
+      data_size_ = st.st_size;
+    }
+  }
+
+  ~Segment() {
+    PCHECK(munmap(slots_, num_slots_ * kSlotSize) == 0);
+    PCHECK(close(index_fd_) == 0);
+  }
+
+  int64_t first_sequence_number() const {
+    return first_sequence_number_;
+  }
+
+  int64_t end_sequence_number() const {
+    return first_sequence_number_ + num_slots_;
+  }
+
+  // The data file, which only segments that are not compressed have.
+  int data_fd() const {
+    lock_guard<mutex> lock(storage_lock_);
+    CHECK(data_) << "segment starting at " << first_sequence_number_
+                 << " is compressed";
+    return data_->fd();
+  }
+
+  bool compressed() const {
+    lock_guard<mutex> lock(storage_lock_);
+    return cold_ != nullptr;
+  }
+
+  // Sets either |*data| or |*cold|, depending on whether the segment is
+  // compressed, which keeps them open as long as they are used.
+  void GetStorage(shared_ptr<const DataFile>* data,
+                  shared_ptr<const ColdBlocks>* cold) const {
+    lock_guard<mutex> lock(storage_lock_);
+    *data = data_;
+    *cold = cold_;
+  }
+
+  // Replaces the data file with its compressed blocks. The segment must
+  // be full, so that nothing else writes to it.
+  void Compress() {
+    vector<Slot> slots(num_slots_);
+    for (int64_t i = 0; i < num_slots_; ++i) {
+      CHECK(GetSlot(first_sequence_number_ + i, &slots[i]));
+    }
+    sort(slots.begin(), slots.end(), [](const Slot& a, const Slot& b) {
+      return a.offset < b.offset;
+    });
+
+    const string cold_path(path_ + kColdSuffix);
+    ColdBlocks::Write(data_fd(), data_size_, slots, cold_path);
+    const shared_ptr<const ColdBlocks> cold(new ColdBlocks(cold_path));
+    CHECK_EQ(cold->size(), static_cast<uint64_t>(data_size_));
+    {
+      lock_guard<mutex> lock(storage_lock_);
+      cold_ = cold;
+      // Readers still using the data file keep it open.
+      data_.reset();
+    }
+    PCHECK(unlink((path_ + kDataSuffix).c_str()) == 0) << "unlink " << path_
+                                                        << kDataSuffix;
+  }
+
+  // Only changed with "lock_" held.
+  off_t data_size() const {
+    return data_size_;
+  }
+
+  void set_data_size(off_t data_size) {
+    data_size_ = data_size;
+  }
+
+  char* slot(int64_t sequence_number) const {
+    CHECK_GE(sequence_number, first_sequence_number_);
+    CHECK_LT(sequence_number, end_sequence_number());
+    return slots_ + (sequence_number - first_sequence_number_) * kSlotSize;
+  }
+
+  // Returns false if the slot of |sequence_number| is empty.
+  bool GetSlot(int64_t sequence_number, Slot* result) const {
+    const char* const slot(this->slot(sequence_number));
+    const uint64_t offset_plus_one(GetBigEndian(slot, 8));
+    if (offset_plus_one == 0) {
+      return false;
+    }
+    result->sequence_number = sequence_number;
+    result->offset = offset_plus_one - 1;
+    result->length = GetBigEndian(slot + 8, 4);
+    result->json_length = GetBigEndian(slot + 12, 4);
+    result->leaf_hash.assign(slot + 16, kLeafHashSize);
+    return true;
+  }
+
+  static void PutSlot(uint64_t offset, uint32_t length, uint32_t json_length,
+                      const string& leaf_hash, char* slot) {
+    CHECK_EQ(leaf_hash.size(), kLeafHashSize);
+    PutBigEndian(offset + 1, 8, slot);
+    PutBigEndian(length, 4, slot + 8);
+    PutBigEndian(json_length, 4, slot + 12);
+    memcpy(slot + 16, leaf_hash.data(), kLeafHashSize);
+  }
+
+ private:
+  const string path_;
+  const int64_t first_sequence_number_;
+  const int64_t num_slots_;
+  const int index_fd_;
+  char* slots_;
+  off_t data_size_;
+
+  // Only one of those is set. The data file is replaced by the
+  // compressed blocks, with this held, when the segment is compressed.
+  mutable mutex storage_lock_;
+  shared_ptr<const DataFile> data_;
+  shared_ptr<const ColdBlocks> cold_;
+
+  DISALLOW_COPY_AND_ASSIGN(Segment);
+};
+
+
+class SegmentedFileDB::LeafHashIterator : public Database::LeafHashIterator {
+ public:
+  LeafHashIterator(const SegmentedFileDB* db, int64_t start_index)
+      : db_(CHECK_NOTNULL(db)), next_index_(start_index), pos_(0) {
+    CHECK_GE(next_index_, 0);
+  }
+
+  bool GetNextLeafHash(int64_t* sequence_number, string* leaf_hash) override {
+    if (pos_ == slots_.size()) {
+      slots_.clear();
+      pos_ = 0;
+      if (!db_->ReadSlots(next_index_, kScanChunkSize, &slots_)) {
+        return false;
+      }
+      next_index_ = slots_.back().sequence_number + 1;
+    }
+
+    *sequence_number = slots_[pos_].sequence_number;
+    leaf_hash->swap(slots_[pos_].leaf_hash);
+    ++pos_;
+    return true;
+  }
+
+ private:
+  const SegmentedFileDB* const db_;
+  int64_t next_index_;
+  vector<Slot> slots_;
+  size_t pos_;
+};
+
+
+class SegmentedFileDB::Iterator : public Database::Iterator {
+ public:
+  Iterator(const SegmentedFileDB* db, int64_t start_index)
+      : db_(CHECK_NOTNULL(db)), next_index_(start_index), pos_(0) {
+    CHECK_GE(next_index_, 0);
+  }
+
+  bool GetNextEntry(LoggedEntry* entry) override {
+    CHECK_NOTNULL(entry);
+    if (pos_ == slots_.size()) {
+      slots_.clear();
+      data_.clear();
+      pos_ = 0;
+      const Segment* const segment(
+          db_->ReadSlots(next_index_, kScanChunkSize, &slots_));
+      if (!segment) {
+        return false;
+      }
+      db_->ReadEntries(*segment, slots_, &data_, &cache_);
+      next_index_ = slots_.back().sequence_number + 1;
+    }
+
+    CHECK(entry->ParseFieldsFromArray(data_[pos_].data(), data_[pos_].size(),
+                                      fields()));
+    CHECK_EQ(entry->sequence_number(), slots_[pos_].sequence_number);
+    ++pos_;
+    return true;
+  }
+
+ private:
+  const SegmentedFileDB* const db_;
+  int64_t next_index_;
+  vector<Slot> slots_;
+  vector<string> data_;
+  BlockCache cache_;
+  size_t pos_;
+};
+
+
+SegmentedFileDB::SegmentedFileDB(const string& segment_dir,
+                                 FileStorage* tree_storage,
+                                 FileStorage* meta_storage)
+    : segment_dir_(segment_dir),
+      tree_storage_(CHECK_NOTNULL(tree_storage)),
+      meta_storage_(CHECK_NOTNULL(meta_storage)),
+      entries_per_segment_(0),
+      contiguous_size_(0),
+      latest_tree_timestamp_(0) {
+  ScopedLatency latency(latency_by_op_ms.GetScopedLatency("open"));
+  BuildIndex();
+  CompactColdSegments();
+}
+
+
+SegmentedFileDB::~SegmentedFileDB() {
+}
+
+
+Database::WriteResult SegmentedFileDB::CreateSequencedEntry_(
+    const LoggedEntry& logged) {
+  CHECK(logged.has_sequence_number());
+  CHECK_GE(logged.sequence_number(), 0);
+  ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("create_sequenced_entry"));
+
+  vector<string> data(1);
+  CHECK(logged.SerializeToString(&data[0]));
+  vector<string> json(1);
+  if (FLAGS_segmented_file_db_json_entries) {
+    RenderJsonEntry(logged, &json[0]);
+  }
+
+  size_t num_created;
+  return WriteSequencedEntries({&logged}, data, json, &num_created);
+}
+
+
+Database::WriteResult SegmentedFileDB::CreateSequencedEntries_(
+    const vector<LoggedEntry>& logged, size_t* num_created) {
+  ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("create_sequenced_entries"));
+
+  // Serialize everything before taking the lock, which is then only
+  // taken once.
+  vector<const LoggedEntry*> entries;
+  entries.reserve(logged.size());
+  vector<string> data(logged.size());
+  vector<string> json(logged.size());
+  for (size_t i = 0; i < logged.size(); ++i) {
+    entries.push_back(&logged[i]);
+    CHECK(logged[i].SerializeToString(&data[i]));
+    if (FLAGS_segmented_file_db_json_entries) {
+      RenderJsonEntry(logged[i], &json[i]);
+    }
+  }
+
+  return WriteSequencedEntries(entries, data, json, num_created);
+}
+
+
+Database::WriteResult SegmentedFileDB::WriteSequencedEntries(
+    const vector<const LoggedEntry*>& logged, const vector<string>& data,
+    const vector<string>& json, size_t* num_created) {
+  CHECK_EQ(logged.size(), data.size());
+  CHECK_EQ(logged.size(), json.size());
+  unique_lock<mutex> lock(lock_);
+
+  *num_created = 0;
+  while (*num_created < logged.size()) {
+    const size_t begin(*num_created);
+    const int64_t sequence_number(logged[begin]->sequence_number());
+
+    if (IsPresent(sequence_number)) {
+      const Segment* const segment(
+          CHECK_NOTNULL(GetSegment(sequence_number)));
+      vector<Slot> slots(1);
+      CHECK(segment->GetSlot(sequence_number, &slots[0]));
+      vector<string> existing_data;
+      BlockCache cache;
+      ReadEntries(*segment, slots, &existing_data, &cache);
+      if (existing_data[0] != data[begin]) {
+        return this->SEQUENCE_NUMBER_ALREADY_IN_USE;
+      }
+      ++*num_created;
+      continue;
+    }
+
+    Segment* const segment(GetSegment(sequence_number, true));
+    size_t end(begin + 1);
+    while (end < logged.size() &&
+           logged[end]->sequence_number() ==
+               logged[end - 1]->sequence_number() + 1 &&
+           logged[end]->sequence_number() < segment->end_sequence_number() &&
+           !IsPresent(logged[end]->sequence_number())) {
+      ++end;
+    }
+    AppendRun(lock, segment, logged, data, json, begin, end);
+    *num_created = end;
+  }
+
+  return this->OK;
+}
+
+
+void SegmentedFileDB::AppendRun(const unique_lock<mutex>& lock,
+                                Segment* segment,
+                                const vector<const LoggedEntry*>& logged,
+                                const vector<string>& data,
+                                const vector<string>& json, size_t begin,
+                                size_t end) {
+  CHECK(lock.owns_lock());
+  CHECK_LT(begin, end);
+  const int64_t first_sequence_number(logged[begin]->sequence_number());
+  const off_t offset(segment->data_size());
+
+  string buffer;
+  string slots((end - begin) * kSlotSize, 0);
+  for (size_t i = begin; i < end; ++i) {
+    CHECK_LE(data[i].size(), UINT32_MAX);
+    CHECK_LE(json[i].size(), UINT32_MAX);
+    Segment::PutSlot(offset + buffer.size(), data[i].size(), json[i].size(),
+                     logged[i]->MerkleLeafHash(),
+                     &slots[(i - begin) * kSlotSize]);
+    buffer.append(data[i]);
+    buffer.append(json[i]);
+  }
+
+  // The data goes first, so that the slots never point past the end of
+  // the data file.
+  WriteFully(segment->data_fd(), buffer.data(), buffer.size(), offset);
+  memcpy(segment->slot(first_sequence_number), slots.data(), slots.size());
+  segment->set_data_size(offset + buffer.size());
+
+  for (size_t i = begin; i < end; ++i) {
+    InsertEntryMapping(logged[i]->sequence_number(), logged[i]->Hash());
+  }
+}
+
+
+const SegmentedFileDB::Segment* SegmentedFileDB::ReadSlots(
+    int64_t start_index, size_t max_count, vector<Slot>* slots) const {
+  CHECK_GT(max_count, 0U);
+  lock_guard<mutex> lock(lock_);
+
+  int64_t sequence_number(start_index);
+  if (sequence_number >= contiguous_size_ &&
+      !sparse_entries_.LowerBound(sequence_number, &sequence_number)) {
+    return NULL;
+  }
+
+  const Segment* const segment(CHECK_NOTNULL(GetSegment(sequence_number)));
+  const int64_t end(min<int64_t>(segment->end_sequence_number(),
+                                 sequence_number + max_count));
+  for (; sequence_number < end && IsPresent(sequence_number);
+       ++sequence_number) {
+    slots->resize(slots->size() + 1);
+    CHECK(segment->GetSlot(sequence_number, &slots->back()));
+  }
+  CHECK(!slots->empty());
+
+  return segment;
+}
+
+
+void SegmentedFileDB::ReadEntries(const Segment& segment,
+                                  const vector<Slot>& slots,
+                                  vector<string>* data,
+                                  BlockCache* cache) const {
+  shared_ptr<const DataFile> file;
+  shared_ptr<const ColdBlocks> cold;
+  segment.GetStorage(&file, &cold);
+  if (cold) {
+    for (const Slot& slot : slots) {
+      const uint64_t begin(cache->Load(cold, slot.offset));
+      CHECK_LE(slot.end() - begin, cache->data->size());
+      data->push_back(cache->data->substr(slot.offset - begin, slot.length));
+    }
+    return;
+  }
+
+  string buffer;
+  for (size_t begin = 0; begin < slots.size();) {
+    // Read all the following entries that are adjacent in the data file
+    // at once, along with the JSON objects between them.
+    size_t end(begin + 1);
+    uint64_t size(slots[begin].length);
+    while (end < slots.size() &&
+           slots[end].offset == slots[end - 1].end() &&
+           slots[end].end() - slots[begin].offset <= kMaxReadBytes) {
+      size = slots[end].offset + slots[end].length - slots[begin].offset;
+      ++end;
+    }
+
+    buffer.resize(size);
+    ReadFully(file->fd(), &buffer[0], size, slots[begin].offset);
+    for (size_t i = begin; i < end; ++i) {
+      data->push_back(buffer.substr(slots[i].offset - slots[begin].offset,
+                                    slots[i].length));
+    }
+    begin = end;
+  }
+}
+
+
+int64_t SegmentedFileDB::SegmentNumber(int64_t sequence_number) const {
+  return sequence_number / entries_per_segment_;
+}
+
+
+string SegmentedFileDB::SegmentPath(int64_t segment_number) const {
+  return segment_dir_ + "/" + kSegmentPrefix +
+         FormatSegmentNumber(segment_number * entries_per_segment_);
+}
+
+
+SegmentedFileDB::Segment* SegmentedFileDB::GetSegment(int64_t sequence_number,
+                                                      bool create) {
+  const int64_t segment_number(SegmentNumber(sequence_number));
+  auto it(segments_.find(segment_number));
+  if (it == segments_.end()) {
+    if (!create) {
+      return NULL;
+    }
+    it = segments_
+             .insert(make_pair(segment_number,
+                               unique_ptr<Segment>(new Segment(
+                                   SegmentPath(segment_number),
+                                   segment_number * entries_per_segment_,
+                                   entries_per_segment_))))
+             .first;
+  }
+  return it->second.get();
+}
+
+
+const SegmentedFileDB::Segment* SegmentedFileDB::GetSegment(
+    int64_t sequence_number) const {
+  const auto it(segments_.find(SegmentNumber(sequence_number)));
+  return it == segments_.end() ? NULL : it->second.get();
+}
+
+
+// This must be called with "lock_" held.
+bool SegmentedFileDB::IsPresent(int64_t sequence_number) const {
+  return sequence_number < contiguous_size_ ||
+         sparse_entries_.Contains(sequence_number);
+}
+
+
+Database::LookupResult SegmentedFileDB::LookupByHash(
+    const string& hash, LoggedEntry* result) const {
+  ScopedLatency latency(latency_by_op_ms.GetScopedLatency("lookup_by_hash"));
+
+  unique_lock<mutex> lock(lock_);
+
+  auto i(id_by_hash_.find(hash));
+  if (i == id_by_hash_.end()) {
+    return this->NOT_FOUND;
+  }
+  const int64_t sequence_number(i->second);
+
+  lock.unlock();
+
+  LoggedEntry logged;
+  // Gotta be there, or we're in trouble...
+  CHECK_EQ(LookupByIndex(sequence_number, &logged), this->LOOKUP_OK);
+  CHECK_EQ(logged.Hash(), hash);
+
+  if (result) {
+    logged.Swap(result);
+  }
+
+  return this->LOOKUP_OK;
+}
+
+
+Database::LookupResult SegmentedFileDB::LookupByIndex(
+    int64_t sequence_number, LoggedEntry* result) const {
+  CHECK_GE(sequence_number, 0);
+  ScopedLatency latency(latency_by_op_ms.GetScopedLatency("lookup_by_index"));
+
+  unique_lock<mutex> lock(lock_);
+  if (!IsPresent(sequence_number)) {
+    return this->NOT_FOUND;
+  }
+  const Segment* const segment(CHECK_NOTNULL(GetSegment(sequence_number)));
+  lock.unlock();
+
+  if (result) {
+    vector<Slot> slots(1);
+    CHECK(segment->GetSlot(sequence_number, &slots[0]));
+    vector<string> data;
+    BlockCache cache;
+    ReadEntries(*segment, slots, &data, &cache);
+    CHECK(result->ParseFromString(data[0]));
+    CHECK_EQ(result->sequence_number(), sequence_number);
+  }
+  return this->LOOKUP_OK;
+}
+
+
+bool SegmentedFileDB::LookupJsonEntries(int64_t start, int64_t end,
+                                        vector<JsonEntry>* entries) const {
+  CHECK_GE(start, 0);
+  ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("lookup_json_entries"));
+
+  // The slots of the entries of each segment.
+  vector<pair<const Segment*, vector<Slot>>> runs;
+  {
+    lock_guard<mutex> lock(lock_);
+    for (int64_t seq = start; seq <= end && IsPresent(seq); ++seq) {
+      if (runs.empty() ||
+          seq >= runs.back().first->end_sequence_number()) {
+        runs.emplace_back(CHECK_NOTNULL(GetSegment(seq)), vector<Slot>());
+      }
+      vector<Slot>* const slots(&runs.back().second);
+      slots->resize(slots->size() + 1);
+      CHECK(runs.back().first->GetSlot(seq, &slots->back()));
+      if (slots->back().json_length == 0) {
+        return false;
+      }
+    }
+  }
+
+  // Map the part of the data file of each segment that holds the JSON
+  // objects, which will usually be one contiguous range, or else
+  // decompress the blocks that hold them.
+  for (const auto& run : runs) {
+    shared_ptr<const DataFile> file;
+    shared_ptr<const ColdBlocks> cold;
+    run.first->GetStorage(&file, &cold);
+    if (cold) {
+      BlockCache cache;
+      for (const Slot& slot : run.second) {
+        const uint64_t begin(cache.Load(cold, slot.json_offset()));
+        entries->push_back(
+            JsonEntry{cache.data->data() + (slot.json_offset() - begin),
+                      slot.json_length, cache.data});
+      }
+      continue;
+    }
+
+    uint64_t begin(run.second.front().json_offset());
+    uint64_t end(run.second.front().end());
+    for (const Slot& slot : run.second) {
+      begin = min(begin, slot.json_offset());
+      end = max(end, slot.end());
+    }
+    const shared_ptr<const Mapping> mapping(
+        new Mapping(file->fd(), begin, end));
+    for (const Slot& slot : run.second) {
+      entries->push_back(
+          JsonEntry{mapping->At(slot.json_offset()), slot.json_length,
+                    mapping});
+    }
+  }
+  return true;
+}
+
+
+unique_ptr<Database::Iterator> SegmentedFileDB::ScanEntries(
+    int64_t start_index) const {
+  return unique_ptr<Iterator>(new Iterator(this, start_index));
+}
+
+
+unique_ptr<Database::LeafHashIterator> SegmentedFileDB::ScanLeafHashes(
+    int64_t start_index) const {
+  return unique_ptr<LeafHashIterator>(
+      new LeafHashIterator(this, start_index));
+}
+
+
+Database::WriteResult SegmentedFileDB::WriteTreeHead_(
+    const ct::SignedTreeHead& sth) {
+  CHECK_GE(sth.tree_size(), 0);
+  ScopedLatency latency(latency_by_op_ms.GetScopedLatency("write_tree_head"));
+
+  // 6 bytes are good enough for some 9000 years.
+  string timestamp_key =
+      Serializer::SerializeUint(sth.timestamp(),
+                                SegmentedFileDB::kTimestampBytesIndexed);
+  string data;
+  CHECK(sth.SerializeToString(&data));
+
+  unique_lock<mutex> lock(lock_);
+  util::Status status(tree_storage_->CreateEntry(timestamp_key, data));
+  if (status.CanonicalCode() == util::error::ALREADY_EXISTS) {
+    string existing_sth_data;
+    status = tree_storage_->LookupEntry(timestamp_key, &existing_sth_data);
+    CHECK_EQ(status, util::Status::OK);
+    if (existing_sth_data == data) {
+      LOG(WARNING) << "Attempted to store identical STH in DB.";
+      return this->OK;
+    }
+    return this->DUPLICATE_TREE_HEAD_TIMESTAMP;
+  }
+  CHECK_EQ(status, util::Status::OK);
+
+  if (sth.timestamp() > latest_tree_timestamp_) {
+    latest_tree_timestamp_ = sth.timestamp();
+    latest_timestamp_key_ = timestamp_key;
+  }
+
+  lock.unlock();
+  callbacks_.Call(sth);
+
+  return this->OK;
+}
+
+
+Database::LookupResult SegmentedFileDB::LatestTreeHead(
+    ct::SignedTreeHead* result) const {
+  ScopedLatency latency(latency_by_op_ms.GetScopedLatency("latest_tree_head"));
+  lock_guard<mutex> lock(lock_);
+
+  return LatestTreeHeadNoLock(result);
+}
+
+
+vector<ct::SignedTreeHead> SegmentedFileDB::ScanTreeHeads() const {
+  ScopedLatency latency(latency_by_op_ms.GetScopedLatency("scan_tree_heads"));
+  lock_guard<mutex> lock(lock_);
+
+  // The keys are big-endian timestamps, so they sort in that order.
+  vector<ct::SignedTreeHead> sths;
+  string tree_data;
+  for (const string& key : tree_storage_->Scan()) {
+    CHECK_EQ(tree_storage_->LookupEntry(key, &tree_data), util::Status::OK);
+    sths.emplace_back();
+    CHECK(sths.back().ParseFromString(tree_data));
+  }
+  return sths;
+}
+
+
+int64_t SegmentedFileDB::TreeSize() const {
+  ScopedLatency latency(latency_by_op_ms.GetScopedLatency("tree_size"));
+  lock_guard<mutex> lock(lock_);
+
+  return contiguous_size_;
+}
+
+
+void SegmentedFileDB::AddNotifySTHCallback(
+    const Database::NotifySTHCallback* callback) {
+  unique_lock<mutex> lock(lock_);
+
+  callbacks_.Add(callback);
+
+  ct::SignedTreeHead sth;
+  if (LatestTreeHeadNoLock(&sth) == this->LOOKUP_OK) {
+    lock.unlock();
+    (*callback)(sth);
+  }
+}
+
+
+void SegmentedFileDB::RemoveNotifySTHCallback(
+    const Database::NotifySTHCallback* callback) {
+  lock_guard<mutex> lock(lock_);
+
+  callbacks_.Remove(callback);
+}
+
+
+void SegmentedFileDB::InitializeNode(const string& node_id) {
+  CHECK(!node_id.empty());
+  ScopedLatency latency(latency_by_op_ms.GetScopedLatency("initialize_node"));
+  unique_lock<mutex> lock(lock_);
+  string existing_id;
+  if (NodeId(&existing_id) != this->NOT_FOUND) {
+    LOG(FATAL) << "Attempting to initialze DB belonging to node with node_id: "
+               << existing_id;
+  }
+  CHECK(meta_storage_->CreateEntry(kMetaNodeIdKey, node_id).ok());
+}
+
+
+Database::LookupResult SegmentedFileDB::NodeId(string* node_id) {
+  CHECK_NOTNULL(node_id);
+  if (!meta_storage_->LookupEntry(kMetaNodeIdKey, node_id).ok()) {
+    return this->NOT_FOUND;
+  }
+  return this->LOOKUP_OK;
+}
+
+
+void SegmentedFileDB::BuildIndex() {
+  ScopedLatency latency(latency_by_op_ms.GetScopedLatency("build_index"));
+  // Technically, this should only be called from the constructor, so
+  // this should not be necessarily, but just to be sure...
+  lock_guard<mutex> lock(lock_);
+
+  string entries_per_segment;
+  if (meta_storage_->LookupEntry(kMetaEntriesPerSegmentKey,
+                                 &entries_per_segment)
+          .ok()) {
+    entries_per_segment_ = stoll(entries_per_segment);
+    LOG_IF(WARNING, entries_per_segment_ !=
+                        FLAGS_segmented_file_db_entries_per_segment)
+        << "Ignoring --segmented_file_db_entries_per_segment, using the "
+        << entries_per_segment_ << " entries per segment of the existing "
+        << "database";
+  } else {
+    entries_per_segment_ = FLAGS_segmented_file_db_entries_per_segment;
+    CHECK(meta_storage_->CreateEntry(kMetaEntriesPerSegmentKey,
+                                     to_string(entries_per_segment_))
+              .ok());
+  }
+  CHECK_GT(entries_per_segment_, 0);
+
+  if (mkdir(segment_dir_.c_str(), 0700) != 0) {
+    PCHECK(errno == EEXIST) << "mkdir " << segment_dir_;
+  }
+  set<int64_t> first_sequence_numbers;
+  DIR* const dir(opendir(segment_dir_.c_str()));
+  PCHECK(dir != NULL) << "opendir " << segment_dir_;
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != NULL) {
+    const int64_t first_sequence_number(ParseIndexFileName(entry->d_name));
+    if (first_sequence_number >= 0) {
+      first_sequence_numbers.insert(first_sequence_number);
+    }
+  }
+  closedir(dir);
+
+  for (const int64_t first_sequence_number : first_sequence_numbers) {
+    CHECK_EQ(first_sequence_number % entries_per_segment_, 0)
+        << "Segment starting at " << first_sequence_number
+        << " does not match " << entries_per_segment_
+        << " entries per segment";
+    const int64_t segment_number(SegmentNumber(first_sequence_number));
+    LoadSegment(unique_ptr<Segment>(new Segment(SegmentPath(segment_number),
+                                                first_sequence_number,
+                                                entries_per_segment_)));
+  }
+
+  // Now read the STH entries.
+  set<string> sth_timestamps = tree_storage_->Scan();
+  if (!sth_timestamps.empty()) {
+    latest_timestamp_key_ = *sth_timestamps.rbegin();
+    CHECK_EQ(DeserializeResult::OK,
+             Deserializer::DeserializeUint<uint64_t>(
+                 latest_timestamp_key_,
+                 SegmentedFileDB::kTimestampBytesIndexed,
+                 &latest_tree_timestamp_));
+  }
+}
+
+
+// This must be called with "lock_" held.
+void SegmentedFileDB::LoadSegment(unique_ptr<Segment> segment) {
+  vector<Slot> slots;
+  for (int64_t seq = segment->first_sequence_number();
+       seq < segment->end_sequence_number(); ++seq) {
+    Slot slot;
+    if (!segment->GetSlot(seq, &slot)) {
+      continue;
+    }
+    if (slot.end() > static_cast<uint64_t>(segment->data_size())) {
+      // Only possible if the data file lost writes that the index did
+      // not, which we cannot do anything about.
+      LOG(WARNING) << "Dropping entry with sequence number " << seq
+                   << ", which is past the end of its data file";
+      memset(segment->slot(seq), 0, kSlotSize);
+      continue;
+    }
+    slots.push_back(slot);
+  }
+
+  // Read the entries in the order in which they were written, which
+  // makes this one sequential read of the data file.
+  sort(slots.begin(), slots.end(), [](const Slot& a, const Slot& b) {
+    return a.offset < b.offset;
+  });
+  uint64_t data_end(0);
+  BlockCache cache;
+  for (size_t begin = 0; begin < slots.size(); begin += kScanChunkSize) {
+    const vector<Slot> chunk(slots.begin() + begin,
+                             slots.begin() +
+                                 min(slots.size(), begin + kScanChunkSize));
+    vector<string> data;
+    ReadEntries(*segment, chunk, &data, &cache);
+    for (size_t i = 0; i < chunk.size(); ++i) {
+      const int64_t seq(chunk[i].sequence_number);
+      LoggedEntry logged;
+      CHECK(logged.ParseFieldsFromArray(data[i].data(), data[i].size(),
+                                        LoggedEntry::PARSE_LEAF))
+          << "Failed to parse entry with sequence number " << seq;
+      CHECK(logged.has_sequence_number())
+          << "sequence_number() is unset for for entry with sequence number "
+          << seq;
+      CHECK_EQ(logged.sequence_number(), seq)
+          << "Entry has an unexpected sequence_number(): " << seq;
+
+      InsertEntryMapping(seq, logged.Hash());
+      data_end = max<uint64_t>(data_end, chunk[i].end());
+    }
+  }
+
+  // Drop whatever was appended after the last entry that made it to the
+  // index.
+  if (data_end < static_cast<uint64_t>(segment->data_size())) {
+    LOG(WARNING) << "Truncating " << segment->data_size() - data_end
+                 << " unindexed bytes from the segment starting at "
+                 << segment->first_sequence_number();
+    PCHECK(ftruncate(segment->data_fd(), data_end) == 0);
+    segment->set_data_size(data_end);
+  }
+
+  const int64_t segment_number(
+      SegmentNumber(segment->first_sequence_number()));
+  CHECK(segments_.insert(make_pair(segment_number, move(segment))).second);
+}
+
+
+void SegmentedFileDB::CompactColdSegments() {
+  if (FLAGS_segmented_file_db_hot_segments <= 0) {
+    return;
+  }
+  lock_guard<mutex> compact_lock(compact_lock_);
+
+  // Segments that end before the tree size are full.
+  vector<Segment*> cold;
+  {
+    lock_guard<mutex> lock(lock_);
+    const int64_t end(contiguous_size_ -
+                      static_cast<int64_t>(
+                          FLAGS_segmented_file_db_hot_segments) *
+                          entries_per_segment_);
+    for (const auto& it : segments_) {
+      if (it.second->end_sequence_number() > end) {
+        break;
+      }
+      if (!it.second->compressed()) {
+        cold.push_back(it.second.get());
+      }
+    }
+  }
+
+  for (Segment* const segment : cold) {
+    ScopedLatency latency(
+        latency_by_op_ms.GetScopedLatency("compress_segment"));
+    segment->Compress();
+    LOG(INFO) << "Compressed the segment starting at "
+              << segment->first_sequence_number();
+  }
+}
+
+
+Database::LookupResult SegmentedFileDB::LatestTreeHeadNoLock(
+    ct::SignedTreeHead* result) const {
+  if (latest_tree_timestamp_ == 0) {
+    return this->NOT_FOUND;
+  }
+
+  string tree_data;
+  CHECK_EQ(tree_storage_->LookupEntry(latest_timestamp_key_, &tree_data),
+           util::Status::OK);
+
+  CHECK(result->ParseFromString(tree_data));
+  CHECK_EQ(result->timestamp(), latest_tree_timestamp_);
+
+  return this->LOOKUP_OK;
+}
+
+
+// This must be called with "lock_" held.
+void SegmentedFileDB::InsertEntryMapping(int64_t sequence_number,
+                                         const string& hash) {
+  if (!id_by_hash_.insert(make_pair(hash, sequence_number)).second) {
+    // This is a duplicate hash under a new sequence number.
+    // Make sure we track the entry with the lowest sequence number:
+    id_by_hash_[hash] = min(id_by_hash_[hash], sequence_number);
+  }
+
+  if (sequence_number == contiguous_size_) {
+    contiguous_size_ = sparse_entries_.TakeRunFrom(sequence_number + 1);
+  } else {
+    // It's not contiguous, put it with the other sparse entries.
+    CHECK(sparse_entries_.Insert(sequence_number))
+        << "sequence number " << sequence_number << " already assigned.";
+  }
+}
+
+
+}  // namespace cert_trans
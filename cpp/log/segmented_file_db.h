@@ -0,0 +1,204 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef CERT_TRANS_LOG_SEGMENTED_FILE_DB_H_
+#define CERT_TRANS_LOG_SEGMENTED_FILE_DB_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/database.h"
+#include "proto/ct.pb.h"
+#include "util/range_set.h"
+
+namespace cert_trans {
+
+class FileStorage;
+
+
+// Database interface that stores the sequenced entries in large
+// append-only segment files, and tree head signatures and meta info in
+// FileStorage, like FileDB.
+//
+// Each segment covers a fixed range of sequence numbers, and is made of
+// two files in |segment_dir|:
+//   - "segment-<first sequence number>.data", to which the serialized
+//     entries are appended in the order in which they are written, and
+//   - "segment-<first sequence number>.index", a memory-mapped array of
+//     fixed-size slots, one per sequence number of the segment, holding
+//     the offset and length of the entry in the data file and its Merkle
+//     leaf hash, or zeroes if there is no such entry yet.
+// Each entry is followed in the data file by its JSON object in
+// get-entries responses (see --segmented_file_db_json_entries), which
+// LookupJsonEntries() returns straight from a mapping of the data file.
+// So LookupByIndex() is a single pread(), ScanLeafHashes() only reads
+// the index, and ScanEntries() reads runs of consecutive entries at
+// once, which are usually also consecutive in the data file.
+//
+// An entry is appended to the data file before its slot is written, so
+// a crash can only leave entries at the end of the data file that are
+// not in the index, which are dropped when reopening the database. As
+// with FileDB, nothing is explicitly synced to disk.
+//
+// Like FileDB, the index by hash is kept in memory, and built on boot by
+// reading all the segments sequentially.
+//
+// Full segments far enough behind the tree size (see
+// --segmented_file_db_hot_segments) are rarely read but by bulk scans,
+// so CompactColdSegments() replaces their data file with
+// "segment-<first sequence number>.cold", which holds the data file
+// compressed in blocks of consecutive entries (see
+// --segmented_file_db_cold_block_bytes). Reads then decompress whole
+// blocks, and scans decompress each block once. The index is left as it
+// is, the offsets in it still being those in the uncompressed data. This
+// file is the only one that is synced to disk, before the data file it
+// replaces is removed.
+class SegmentedFileDB : public Database {
+ public:
+  // Takes ownership of |tree_storage| and |meta_storage|. The number of
+  // entries per segment is set by --segmented_file_db_entries_per_segment
+  // when the database is created, and recorded in |meta_storage|.
+  SegmentedFileDB(const std::string& segment_dir, FileStorage* tree_storage,
+                  FileStorage* meta_storage);
+  ~SegmentedFileDB();
+
+  static const size_t kTimestampBytesIndexed;
+
+  // Compresses the full segments that are at least
+  // --segmented_file_db_hot_segments segments behind the tree size, if
+  // that is positive. This is done when opening the database, and can be
+  // done periodically while it is in use, without holding up other
+  // operations.
+  void CompactColdSegments();
+
+  // Implement abstract functions, see database.h for comments.
+  Database::WriteResult CreateSequencedEntry_(
+      const LoggedEntry& logged) override;
+
+  Database::WriteResult CreateSequencedEntries_(
+      const std::vector<LoggedEntry>& logged, size_t* num_created) override;
+
+  Database::LookupResult LookupByHash(const std::string& hash,
+                                      LoggedEntry* result) const override;
+
+  Database::LookupResult LookupByIndex(int64_t sequence_number,
+                                       LoggedEntry* result) const override;
+
+  std::unique_ptr<Database::Iterator> ScanEntries(
+      int64_t start_index) const override;
+
+  std::unique_ptr<Database::LeafHashIterator> ScanLeafHashes(
+      int64_t start_index) const override;
+
+  bool LookupJsonEntries(int64_t start, int64_t end,
+                         std::vector<JsonEntry>* entries) const override;
+
+  Database::WriteResult WriteTreeHead_(const ct::SignedTreeHead& sth) override;
+
+  Database::LookupResult LatestTreeHead(
+      ct::SignedTreeHead* result) const override;
+
+  std::vector<ct::SignedTreeHead> ScanTreeHeads() const override;
+
+  int64_t TreeSize() const override;
+
+  void AddNotifySTHCallback(
+      const Database::NotifySTHCallback* callback) override;
+
+  void RemoveNotifySTHCallback(
+      const Database::NotifySTHCallback* callback) override;
+
+  void InitializeNode(const std::string& node_id) override;
+
+  Database::LookupResult NodeId(std::string* node_id) override;
+
+ private:
+  struct BlockCache;
+  class ColdBlocks;
+  class Iterator;
+  class LeafHashIterator;
+  class Segment;
+  struct Slot;
+
+  // Stores |logged|, serialized as |data|, along with their (possibly
+  // empty) get-entries |json|, appending each run of consecutive
+  // sequence numbers to its segment at once. Sets |*num_created| to the
+  // number of entries processed before any failure.
+  Database::WriteResult WriteSequencedEntries(
+      const std::vector<const LoggedEntry*>& logged,
+      const std::vector<std::string>& data,
+      const std::vector<std::string>& json, size_t* num_created);
+  // Appends the entries [begin, end) of |logged|, which must have
+  // consecutive sequence numbers that all fall in |segment| and are not
+  // present yet.
+  void AppendRun(const std::unique_lock<std::mutex>& lock, Segment* segment,
+                 const std::vector<const LoggedEntry*>& logged,
+                 const std::vector<std::string>& data,
+                 const std::vector<std::string>& json, size_t begin,
+                 size_t end);
+  // Reads up to |max_count| consecutive slots that are present, starting
+  // with the first present one at or after |start_index|, which all come
+  // from the same segment. Returns that segment, or NULL if there are no
+  // entries at or after |start_index|.
+  const Segment* ReadSlots(int64_t start_index, size_t max_count,
+                           std::vector<Slot>* slots) const;
+  // Reads the data of the (non-empty) |slots|, which must come from
+  // |segment|, into |data|, merging reads of adjacent entries. If the
+  // segment is compressed, the blocks are decompressed through |cache|.
+  void ReadEntries(const Segment& segment, const std::vector<Slot>& slots,
+                   std::vector<std::string>* data, BlockCache* cache) const;
+
+  int64_t SegmentNumber(int64_t sequence_number) const;
+  std::string SegmentPath(int64_t segment_number) const;
+  // Returns the segment holding |sequence_number|, or NULL if there is no
+  // such segment and |create| is false. Must be called with "lock_" held.
+  Segment* GetSegment(int64_t sequence_number, bool create);
+  const Segment* GetSegment(int64_t sequence_number) const;
+  bool IsPresent(int64_t sequence_number) const;
+
+  void BuildIndex();
+  void LoadSegment(std::unique_ptr<Segment> segment);
+  Database::LookupResult LatestTreeHeadNoLock(
+      ct::SignedTreeHead* result) const;
+  void InsertEntryMapping(int64_t sequence_number, const std::string& hash);
+
+  const std::string segment_dir_;
+  const std::unique_ptr<FileStorage> tree_storage_;
+  const std::unique_ptr<FileStorage> meta_storage_;
+  int64_t entries_per_segment_;
+
+  mutable std::mutex lock_;
+  // Held by CompactColdSegments(), so that it compresses each segment
+  // once.
+  std::mutex compact_lock_;
+
+  // Segments are never removed, so pointers to them can be used without
+  // holding "lock_".
+  std::map<int64_t, std::unique_ptr<Segment>> segments_;
+
+  int64_t contiguous_size_;
+  std::unordered_map<std::string, int64_t> id_by_hash_;
+
+  // This is a mapping of the non-contiguous entries of the log (which
+  // can happen while it is being fetched). When entries here become
+  // contiguous with the head of the tree they'll be removed. They are
+  // kept as ranges, as they mostly arrive a fetched batch at a time.
+  RangeSet sparse_entries_;
+
+  uint64_t latest_tree_timestamp_;
+  // The same as a string;
+  std::string latest_timestamp_key_;
+  DatabaseNotifierHelper callbacks_;
+
+  DISALLOW_COPY_AND_ASSIGN(SegmentedFileDB);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_SEGMENTED_FILE_DB_H_
@@ -0,0 +1,291 @@
+#include "log/sharded_database.h"
+
+#include <glog/logging.h>
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+using std::min;
+using std::numeric_limits;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace cert_trans {
+
+
+// Scans the entries from |start| to |end| inclusive, or to the end of the
+// log if |end| is negative, through each of the held shards in turn.
+class ShardedDatabase::Iterator : public ReadOnlyDatabase::Iterator {
+ public:
+  Iterator(const ShardedDatabase* db, int64_t start, int64_t end)
+      : db_(CHECK_NOTNULL(db)),
+        end_(end < 0 ? numeric_limits<int64_t>::max() : end),
+        shard_(db_->ShardFrom(start)),
+        next_(start),
+        first_(0) {
+  }
+
+  bool GetNextEntry(LoggedEntry* entry) override {
+    while (next_ <= end_) {
+      if (!it_) {
+        if (shard_ == db_->shards_.end()) {
+          return false;
+        }
+        first_ = db_->FirstSequenceNumber(shard_->first);
+        next_ = std::max(next_, first_);
+        if (next_ > end_) {
+          return false;
+        }
+        it_ = shard_->second->ScanRange(
+            next_ - first_,
+            min(end_, first_ + db_->entries_per_shard_ - 1) - first_);
+        it_->SetFields(fields());
+      }
+      if (it_->GetNextEntry(entry)) {
+        entry->set_sequence_number(entry->sequence_number() + first_);
+        next_ = entry->sequence_number() + 1;
+        return true;
+      }
+      it_.reset();
+      ++shard_;
+    }
+    return false;
+  }
+
+  void SetFields(int fields) override {
+    ReadOnlyDatabase::Iterator::SetFields(fields);
+    if (it_) {
+      it_->SetFields(fields);
+    }
+  }
+
+ private:
+  const ShardedDatabase* const db_;
+  const int64_t end_;
+  ShardMap::const_iterator shard_;
+  int64_t next_;
+  // The first sequence number of |shard_|, and the scan of it.
+  int64_t first_;
+  unique_ptr<ReadOnlyDatabase::Iterator> it_;
+
+  DISALLOW_COPY_AND_ASSIGN(Iterator);
+};
+
+
+class ShardedDatabase::LeafHashIterator
+    : public ReadOnlyDatabase::LeafHashIterator {
+ public:
+  LeafHashIterator(const ShardedDatabase* db, int64_t start)
+      : db_(CHECK_NOTNULL(db)),
+        shard_(db_->ShardFrom(start)),
+        next_(start),
+        first_(0) {
+  }
+
+  bool GetNextLeafHash(int64_t* sequence_number, string* leaf_hash) override {
+    while (true) {
+      if (!it_) {
+        if (shard_ == db_->shards_.end()) {
+          return false;
+        }
+        first_ = db_->FirstSequenceNumber(shard_->first);
+        next_ = std::max(next_, first_);
+        it_ = shard_->second->ScanLeafHashes(next_ - first_);
+      }
+      // A shard should not have entries past its range, but if it does,
+      // they belong to the next one.
+      if (it_->GetNextLeafHash(sequence_number, leaf_hash) &&
+          *sequence_number < db_->entries_per_shard_) {
+        *sequence_number += first_;
+        next_ = *sequence_number + 1;
+        return true;
+      }
+      it_.reset();
+      ++shard_;
+    }
+  }
+
+ private:
+  const ShardedDatabase* const db_;
+  ShardMap::const_iterator shard_;
+  int64_t next_;
+  int64_t first_;
+  unique_ptr<ReadOnlyDatabase::LeafHashIterator> it_;
+
+  DISALLOW_COPY_AND_ASSIGN(LeafHashIterator);
+};
+
+
+ShardedDatabase::ShardedDatabase(int64_t entries_per_shard, ShardMap shards,
+                                 unique_ptr<HashIndex> hash_index)
+    : entries_per_shard_(entries_per_shard),
+      shards_(std::move(shards)),
+      hash_index_(std::move(hash_index)) {
+  CHECK_GT(entries_per_shard_, 0);
+  CHECK(!shards_.empty());
+  for (const auto& shard : shards_) {
+    CHECK_GE(shard.first, 0);
+    CHECK(shard.second);
+  }
+}
+
+
+ReadOnlyDatabase::LookupResult ShardedDatabase::LookupByHash(
+    const string& hash, LoggedEntry* result) const {
+  if (hash_index_) {
+    const int64_t sequence_number(hash_index_->SequenceNumber(hash));
+    if (sequence_number < 0) {
+      return NOT_FOUND;
+    }
+    return LookupByIndex(sequence_number, result);
+  }
+
+  for (auto it(shards_.rbegin()); it != shards_.rend(); ++it) {
+    if (it->second->LookupByHash(hash, result) == LOOKUP_OK) {
+      result->set_sequence_number(result->sequence_number() +
+                                  FirstSequenceNumber(it->first));
+      return LOOKUP_OK;
+    }
+  }
+  return NOT_FOUND;
+}
+
+
+ReadOnlyDatabase::LookupResult ShardedDatabase::LookupByIndex(
+    int64_t sequence_number, LoggedEntry* result) const {
+  const ReadOnlyDatabase* const shard(ShardOf(sequence_number));
+  if (!shard) {
+    return NOT_FOUND;
+  }
+  const int64_t first(FirstSequenceNumber(ShardNumber(sequence_number)));
+  const LookupResult ret(shard->LookupByIndex(sequence_number - first,
+                                              result));
+  if (ret == LOOKUP_OK) {
+    result->set_sequence_number(result->sequence_number() + first);
+  }
+  return ret;
+}
+
+
+ReadOnlyDatabase::LookupResult ShardedDatabase::LatestTreeHead(
+    ct::SignedTreeHead* result) const {
+  return NewestShard()->LatestTreeHead(result);
+}
+
+
+vector<ct::SignedTreeHead> ShardedDatabase::ScanTreeHeads() const {
+  return NewestShard()->ScanTreeHeads();
+}
+
+
+unique_ptr<ReadOnlyDatabase::Iterator> ShardedDatabase::ScanEntries(
+    int64_t start_index) const {
+  CHECK_GE(start_index, 0);
+  return unique_ptr<Iterator>(new Iterator(this, start_index, -1));
+}
+
+
+unique_ptr<ReadOnlyDatabase::Iterator> ShardedDatabase::ScanRange(
+    int64_t start, int64_t end) const {
+  CHECK_GE(start, 0);
+  CHECK_GE(end, start);
+  return unique_ptr<Iterator>(new Iterator(this, start, end));
+}
+
+
+unique_ptr<ReadOnlyDatabase::LeafHashIterator>
+ShardedDatabase::ScanLeafHashes(int64_t start_index) const {
+  CHECK_GE(start_index, 0);
+  return unique_ptr<LeafHashIterator>(
+      new LeafHashIterator(this, start_index));
+}
+
+
+bool ShardedDatabase::LookupJsonEntries(int64_t start, int64_t end,
+                                        vector<JsonEntry>* entries) const {
+  CHECK_GE(start, 0);
+  // Collected apart, so that |entries| is left unchanged if some shard
+  // does not have them.
+  vector<JsonEntry> found;
+  for (int64_t next = start; next <= end;) {
+    const ReadOnlyDatabase* const shard(ShardOf(next));
+    if (!shard) {
+      break;
+    }
+    const int64_t first(FirstSequenceNumber(ShardNumber(next)));
+    const int64_t last(min(end, first + entries_per_shard_ - 1));
+    const size_t num_found(found.size());
+    if (!shard->LookupJsonEntries(next - first, last - first, &found)) {
+      return false;
+    }
+    if (static_cast<int64_t>(found.size() - num_found) < last - next + 1) {
+      // It stopped before an entry it does not have.
+      break;
+    }
+    next = last + 1;
+  }
+
+  entries->insert(entries->end(), found.begin(), found.end());
+  return true;
+}
+
+
+int64_t ShardedDatabase::TreeSize() const {
+  const auto newest(shards_.rbegin());
+  return FirstSequenceNumber(newest->first) + newest->second->TreeSize();
+}
+
+
+void ShardedDatabase::AddNotifySTHCallback(
+    const ReadOnlyDatabase::NotifySTHCallback* callback) {
+  NewestShard()->AddNotifySTHCallback(callback);
+}
+
+
+void ShardedDatabase::RemoveNotifySTHCallback(
+    const ReadOnlyDatabase::NotifySTHCallback* callback) {
+  NewestShard()->RemoveNotifySTHCallback(callback);
+}
+
+
+void ShardedDatabase::InitializeNode(const string& node_id) {
+  NewestShard()->InitializeNode(node_id);
+}
+
+
+ReadOnlyDatabase::LookupResult ShardedDatabase::NodeId(string* node_id) {
+  return NewestShard()->NodeId(node_id);
+}
+
+
+int64_t ShardedDatabase::ShardNumber(int64_t sequence_number) const {
+  CHECK_GE(sequence_number, 0);
+  return sequence_number / entries_per_shard_;
+}
+
+
+int64_t ShardedDatabase::FirstSequenceNumber(int64_t shard_number) const {
+  return shard_number * entries_per_shard_;
+}
+
+
+ShardedDatabase::ShardMap::const_iterator ShardedDatabase::ShardFrom(
+    int64_t sequence_number) const {
+  return shards_.lower_bound(ShardNumber(sequence_number));
+}
+
+
+const ReadOnlyDatabase* ShardedDatabase::ShardOf(
+    int64_t sequence_number) const {
+  const auto it(shards_.find(ShardNumber(sequence_number)));
+  return it == shards_.end() ? nullptr : it->second.get();
+}
+
+
+ReadOnlyDatabase* ShardedDatabase::NewestShard() const {
+  return shards_.rbegin()->second.get();
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,121 @@
+/* -*- mode: c++; indent-tabs-mode: nil -*- */
+#ifndef CERT_TRANS_LOG_SHARDED_DATABASE_H_
+#define CERT_TRANS_LOG_SHARDED_DATABASE_H_
+
+#include <stdint.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/database.h"
+
+namespace cert_trans {
+
+
+// A ReadOnlyDatabase made of shards, each of which holds a contiguous
+// range of |entries_per_shard| sequence numbers: shard k holds the
+// entries from k * entries_per_shard to (k + 1) * entries_per_shard - 1.
+// Each shard is an ordinary database of its own, in which these entries
+// are numbered from 0, so that the contiguity and tree size of every
+// backend work the same as for a whole log. Shards can be backed by local
+// storage, or by any other ReadOnlyDatabase implementation, such as one
+// reading from the node that stores them.
+//
+// Only some of the shards need to be held, e.g. the most recent ones on
+// read-only frontends. Lookups and scans are routed to the shard of each
+// sequence number, and find nothing in the shards that are not held.
+// Scans go through every held shard in turn, from the one they start in.
+//
+// The tree heads, the tree size and the node ID come from the newest
+// shard held, which is the one that the log is writing to; the shards
+// before it are assumed to be full.
+class ShardedDatabase : public ReadOnlyDatabase {
+ public:
+  // An index of the hashes of the entries of the whole log, including the
+  // shards that are not held.
+  class HashIndex {
+   public:
+    HashIndex() = default;
+    virtual ~HashIndex() = default;
+
+    // Returns the sequence number of the entry with |hash|, or -1 if
+    // there is none.
+    virtual int64_t SequenceNumber(const std::string& hash) const = 0;
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(HashIndex);
+  };
+
+  // |shards| maps shard numbers to the shards held, at least one. Without
+  // a |hash_index|, LookupByHash() asks each of the held shards in turn,
+  // the newest first.
+  ShardedDatabase(
+      int64_t entries_per_shard,
+      std::map<int64_t, std::unique_ptr<ReadOnlyDatabase>> shards,
+      std::unique_ptr<HashIndex> hash_index);
+  ~ShardedDatabase() = default;
+
+  ReadOnlyDatabase::LookupResult LookupByHash(
+      const std::string& hash, LoggedEntry* result) const override;
+
+  ReadOnlyDatabase::LookupResult LookupByIndex(
+      int64_t sequence_number, LoggedEntry* result) const override;
+
+  ReadOnlyDatabase::LookupResult LatestTreeHead(
+      ct::SignedTreeHead* result) const override;
+
+  std::vector<ct::SignedTreeHead> ScanTreeHeads() const override;
+
+  std::unique_ptr<ReadOnlyDatabase::Iterator> ScanEntries(
+      int64_t start_index) const override;
+
+  std::unique_ptr<ReadOnlyDatabase::Iterator> ScanRange(
+      int64_t start, int64_t end) const override;
+
+  std::unique_ptr<ReadOnlyDatabase::LeafHashIterator> ScanLeafHashes(
+      int64_t start_index) const override;
+
+  bool LookupJsonEntries(int64_t start, int64_t end,
+                         std::vector<JsonEntry>* entries) const override;
+
+  int64_t TreeSize() const override;
+
+  void AddNotifySTHCallback(
+      const ReadOnlyDatabase::NotifySTHCallback* callback) override;
+
+  void RemoveNotifySTHCallback(
+      const ReadOnlyDatabase::NotifySTHCallback* callback) override;
+
+  void InitializeNode(const std::string& node_id) override;
+
+  ReadOnlyDatabase::LookupResult NodeId(std::string* node_id) override;
+
+ private:
+  class Iterator;
+  class LeafHashIterator;
+
+  typedef std::map<int64_t, std::unique_ptr<ReadOnlyDatabase>> ShardMap;
+
+  int64_t ShardNumber(int64_t sequence_number) const;
+  int64_t FirstSequenceNumber(int64_t shard_number) const;
+  // Returns the first shard held at or after the one of
+  // |sequence_number|.
+  ShardMap::const_iterator ShardFrom(int64_t sequence_number) const;
+  // Returns the shard of |sequence_number|, or NULL if it is not held.
+  const ReadOnlyDatabase* ShardOf(int64_t sequence_number) const;
+  ReadOnlyDatabase* NewestShard() const;
+
+  const int64_t entries_per_shard_;
+  // Never modified once constructed, so that nothing needs locking.
+  const ShardMap shards_;
+  const std::unique_ptr<HashIndex> hash_index_;
+
+  DISALLOW_COPY_AND_ASSIGN(ShardedDatabase);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_SHARDED_DATABASE_H_
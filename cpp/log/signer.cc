@@ -5,9 +5,13 @@
 #include <openssl/evp.h>
 #include <openssl/opensslv.h>
 #include <stdint.h>
+#include <algorithm>
+#include <atomic>
 
 #include "log/verifier.h"
 #include "proto/ct.pb.h"
+#include "util/executor.h"
+#include "util/task.h"
 #include "util/util.h"
 
 #if OPENSSL_VERSION_NUMBER < 0x10000000
@@ -18,7 +22,8 @@ using cert_trans::Verifier;
 
 namespace cert_trans {
 
-Signer::Signer(EVP_PKEY* pkey) : pkey_(CHECK_NOTNULL(pkey)) {
+Signer::Signer(EVP_PKEY* pkey)
+    : pkey_(CHECK_NOTNULL(pkey)), executor_(nullptr), max_parallel_signs_(1) {
   switch (pkey_->type) {
     case EVP_PKEY_EC:
       hash_algo_ = ct::DigitallySigned::SHA256;
@@ -47,25 +52,85 @@ void Signer::Sign(const std::string& data,
 
 Signer::Signer()
     : hash_algo_(ct::DigitallySigned::NONE),
-      sig_algo_(ct::DigitallySigned::ANONYMOUS) {
+      sig_algo_(ct::DigitallySigned::ANONYMOUS),
+      executor_(nullptr),
+      max_parallel_signs_(1) {
+}
+
+void Signer::SignBatch(const std::vector<std::string>& data,
+                       std::vector<ct::DigitallySigned>* signatures) const {
+  signatures->resize(data.size());
+  SignRange(data, 0, data.size(), signatures);
+}
+
+void Signer::SetExecutor(util::Executor* executor, int max_parallel_signs) {
+  CHECK_GT(max_parallel_signs, 0);
+  executor_ = CHECK_NOTNULL(executor);
+  max_parallel_signs_ = max_parallel_signs;
+}
+
+void Signer::SignBatchAsync(const std::vector<std::string>* data,
+                            std::vector<ct::DigitallySigned>* signatures,
+                            util::Task* task) const {
+  if (!executor_ || data->empty()) {
+    SignBatch(*data, signatures);
+    task->Return();
+    return;
+  }
+
+  signatures->resize(data->size());
+  const size_t num_parts(std::min(data->size(), max_parallel_signs_));
+  std::atomic<size_t>* const remaining(new std::atomic<size_t>(num_parts));
+  task->DeleteWhenDone(remaining);
+  for (size_t part = 0; part < num_parts; ++part) {
+    const size_t begin(part * data->size() / num_parts);
+    const size_t end((part + 1) * data->size() / num_parts);
+    executor_->Add([this, data, begin, end, signatures, remaining, task]() {
+      SignRange(*data, begin, end, signatures);
+      if (--*remaining == 0) {
+        task->Return();
+      }
+    });
+  }
 }
 
 std::string Signer::RawSign(const std::string& data) const {
   EVP_MD_CTX ctx;
   EVP_MD_CTX_init(&ctx);
+  const std::string ret(RawSign(&ctx, data));
+  EVP_MD_CTX_cleanup(&ctx);
+  return ret;
+}
+
+std::string Signer::RawSign(EVP_MD_CTX* ctx, const std::string& data) const {
+  // Unlike EVP_SignInit, this keeps the digest state allocated by the
+  // previous use of |ctx|.
   // NOTE: this syntax for setting the hash function requires OpenSSL >= 1.0.0.
-  CHECK_EQ(1, EVP_SignInit(&ctx, EVP_sha256()));
-  CHECK_EQ(1, EVP_SignUpdate(&ctx, data.data(), data.size()));
+  CHECK_EQ(1, EVP_SignInit_ex(ctx, EVP_sha256(), nullptr));
+  CHECK_EQ(1, EVP_SignUpdate(ctx, data.data(), data.size()));
   unsigned int sig_size = EVP_PKEY_size(pkey_.get());
-  unsigned char* sig = new unsigned char[sig_size];
+  std::string ret(sig_size, '\0');
 
-  CHECK_EQ(1, EVP_SignFinal(&ctx, sig, &sig_size, pkey_.get()));
+  CHECK_EQ(1, EVP_SignFinal(ctx, reinterpret_cast<unsigned char*>(&ret[0]),
+                            &sig_size, pkey_.get()));
 
-  EVP_MD_CTX_cleanup(&ctx);
-  std::string ret(reinterpret_cast<char*>(sig), sig_size);
-
-  delete[] sig;
+  ret.resize(sig_size);
   return ret;
 }
 
+void Signer::SignRange(const std::vector<std::string>& data, size_t begin,
+                       size_t end,
+                       std::vector<ct::DigitallySigned>* signatures) const {
+  CHECK_LE(end, signatures->size());
+  EVP_MD_CTX ctx;
+  EVP_MD_CTX_init(&ctx);
+  for (size_t i = begin; i < end; ++i) {
+    ct::DigitallySigned* const signature(&(*signatures)[i]);
+    signature->set_hash_algorithm(hash_algo_);
+    signature->set_sig_algorithm(sig_algo_);
+    signature->set_signature(RawSign(&ctx, data[i]));
+  }
+  EVP_MD_CTX_cleanup(&ctx);
+}
+
 }  // namespace cert_trans
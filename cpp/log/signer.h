@@ -6,11 +6,18 @@
 #include <openssl/evp.h>
 #include <openssl/x509.h>  // for i2d_PUBKEY
 #include <stdint.h>
+#include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "proto/ct.pb.h"
 #include "util/openssl_scoped_types.h"
 
+namespace util {
+class Executor;
+class Task;
+}  // namespace util
+
 namespace cert_trans {
 
 class Signer {
@@ -23,17 +30,53 @@ class Signer {
   virtual void Sign(const std::string& data,
                     ct::DigitallySigned* signature) const;
 
+  // Signs each element of |data| into the corresponding element of
+  // |signatures|, like Sign(), but reusing the same digest context for
+  // all of them. Can be called from several threads at once.
+  virtual void SignBatch(const std::vector<std::string>& data,
+                         std::vector<ct::DigitallySigned>* signatures) const;
+
+  // Has SignBatchAsync() sign on |executor|, splitting each batch into
+  // up to |max_parallel_signs| parts signed at once. For keys of which
+  // every signature is a round trip, such as those in an HSM reached
+  // through an OpenSSL engine, this keeps that many of them outstanding.
+  // Does not take ownership of |executor|, which must outlive this.
+  void SetExecutor(util::Executor* executor, int max_parallel_signs);
+
+  // Whether SetExecutor() was called.
+  bool HasExecutor() const {
+    return executor_ != nullptr;
+  }
+
+  // Like SignBatch(), but returns |task| once done rather than blocking
+  // the caller, unless there is no executor, in which case it signs
+  // before returning. |data| and |signatures| must remain valid until
+  // then.
+  void SignBatchAsync(const std::vector<std::string>* data,
+                      std::vector<ct::DigitallySigned>* signatures,
+                      util::Task* task) const;
+
  protected:
   // A constructor for mocking.
   Signer();
 
  private:
   std::string RawSign(const std::string& data) const;
+  // Signs |data| using |ctx|, which must have been initialized, and can
+  // be reused for the next call.
+  std::string RawSign(EVP_MD_CTX* ctx, const std::string& data) const;
+  // Signs the elements of |data| from |begin| to |end| (exclusive) into
+  // |signatures|, which must be large enough already.
+  void SignRange(const std::vector<std::string>& data, size_t begin,
+                 size_t end,
+                 std::vector<ct::DigitallySigned>* signatures) const;
 
   ScopedEVP_PKEY pkey_;
   ct::DigitallySigned::HashAlgorithm hash_algo_;
   ct::DigitallySigned::SignatureAlgorithm sig_algo_;
   std::string key_id_;
+  util::Executor* executor_;
+  size_t max_parallel_signs_;
 
   DISALLOW_COPY_AND_ASSIGN(Signer);
 };
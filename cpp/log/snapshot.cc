@@ -0,0 +1,521 @@
+#include "log/snapshot.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "base/notification.h"
+#include "log/log_verifier.h"
+#include "log/logged_entry.h"
+#include "log/prefetching_iterator.h"
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "util/util.h"
+
+using ct::SignedTreeHead;
+using std::atomic;
+using std::ifstream;
+using std::ios;
+using std::lock_guard;
+using std::map;
+using std::min;
+using std::mutex;
+using std::ofstream;
+using std::string;
+using std::to_string;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+using util::StatusOr;
+
+namespace cert_trans {
+namespace {
+
+
+const char kSegmentPrefix[] = "entries-";
+const char kLeafHashesFile[] = "leaf_hashes";
+const char kSthFile[] = "sth";
+const char kTempSuffix[] = ".tmp";
+const size_t kLeafHashSize = 32;
+// Number of leaf hashes added to the tree at once when verifying.
+const size_t kLeafHashesPerChunk = 1 << 16;
+// Number of entries written to the database at once when importing.
+const size_t kEntriesPerWrite = 1000;
+
+
+string SegmentPath(const string& dir, int64_t first) {
+  char name[64];
+  snprintf(name, sizeof(name), "%s%020lld", kSegmentPrefix,
+           static_cast<long long>(first));
+  return dir + "/" + name;
+}
+
+
+bool FileExists(const string& path) {
+  return access(path.c_str(), F_OK) == 0;
+}
+
+
+Status ErrnoStatus(const string& what) {
+  return Status(util::error::INTERNAL, what + ": " + strerror(errno));
+}
+
+
+// Renames |path| + kTempSuffix, once |out| has been successfully
+// written to it, to |path|.
+Status CommitFile(ofstream* out, const string& path) {
+  out->close();
+  if (out->fail()) {
+    return Status(util::error::INTERNAL, "error writing " + path);
+  }
+  if (rename((path + kTempSuffix).c_str(), path.c_str()) != 0) {
+    return ErrnoStatus("renaming " + path);
+  }
+  return Status::OK;
+}
+
+
+void WriteRecord(const string& data, ofstream* out) {
+  CHECK_LE(data.size(), 0xffffffffULL);
+  const uint32_t size(data.size());
+  const char size_bytes[4] = {static_cast<char>(size >> 24),
+                              static_cast<char>(size >> 16),
+                              static_cast<char>(size >> 8),
+                              static_cast<char>(size)};
+  out->write(size_bytes, sizeof(size_bytes));
+  out->write(data.data(), data.size());
+}
+
+
+// Returns false at the end of |in|, or if the record is truncated.
+bool ReadRecord(ifstream* in, string* data) {
+  unsigned char size_bytes[4];
+  if (!in->read(reinterpret_cast<char*>(size_bytes), sizeof(size_bytes))) {
+    return false;
+  }
+  const uint32_t size((static_cast<uint32_t>(size_bytes[0]) << 24) |
+                      (static_cast<uint32_t>(size_bytes[1]) << 16) |
+                      (static_cast<uint32_t>(size_bytes[2]) << 8) |
+                      static_cast<uint32_t>(size_bytes[3]));
+  data->resize(size);
+  return size == 0 || in->read(&(*data)[0], size);
+}
+
+
+// Returns the segment files of the snapshot in |dir|, by first sequence
+// number.
+StatusOr<map<int64_t, string>> ListSegments(const string& dir) {
+  DIR* const d(opendir(dir.c_str()));
+  if (!d) {
+    return ErrnoStatus("opening " + dir);
+  }
+  map<int64_t, string> segments;
+  const size_t prefix_len(strlen(kSegmentPrefix));
+  struct dirent* entry;
+  while ((entry = readdir(d)) != NULL) {
+    const string name(entry->d_name);
+    if (name.compare(0, prefix_len, kSegmentPrefix) != 0 ||
+        name.find('.') != string::npos) {
+      continue;
+    }
+    const int64_t first(strtoll(name.c_str() + prefix_len, NULL, 10));
+    segments[first] = dir + "/" + name;
+  }
+  closedir(d);
+  return segments;
+}
+
+
+Status ExportSegment(const ReadOnlyDatabase& db, int64_t first, int64_t end,
+                     const string& path) {
+  ofstream out(path + kTempSuffix, ios::binary | ios::trunc);
+  const unique_ptr<ReadOnlyDatabase::Iterator> it(
+      MaybeReadAhead(db.ScanRange(first, end - 1)));
+  string data;
+  LoggedEntry entry;
+  for (int64_t seq(first); seq < end; ++seq) {
+    if (!it->GetNextEntry(&entry) || entry.sequence_number() != seq) {
+      return Status(util::error::FAILED_PRECONDITION,
+                    "database is missing entry " + to_string(seq));
+    }
+    CHECK(entry.SerializeToString(&data));
+    WriteRecord(data, &out);
+  }
+  return CommitFile(&out, path);
+}
+
+
+Status ExportLeafHashes(const ReadOnlyDatabase& db, int64_t tree_size,
+                        const string& path) {
+  ofstream out(path + kTempSuffix, ios::binary | ios::trunc);
+  const unique_ptr<Database::LeafHashIterator> it(db.ScanLeafHashes(0));
+  int64_t seq;
+  string leaf_hash;
+  for (int64_t expected(0); expected < tree_size; ++expected) {
+    if (!it->GetNextLeafHash(&seq, &leaf_hash) || seq != expected) {
+      return Status(util::error::FAILED_PRECONDITION,
+                    "database is missing entry " + to_string(expected));
+    }
+    CHECK_EQ(kLeafHashSize, leaf_hash.size());
+    out.write(leaf_hash.data(), leaf_hash.size());
+  }
+  return CommitFile(&out, path);
+}
+
+
+// Checks that the leaf hashes in |path| are those of the tree of |sth|.
+Status VerifyLeafHashes(const string& path, const SignedTreeHead& sth,
+                        util::Executor* executor) {
+  ifstream in(path, ios::binary);
+  if (!in) {
+    return Status(util::error::NOT_FOUND, "cannot open " + path);
+  }
+  CompactMerkleTree tree(new Sha256Hasher);
+  vector<string> chunk;
+  string leaf_hash(kLeafHashSize, '\0');
+  uint64_t remaining(sth.tree_size());
+  while (remaining > 0) {
+    chunk.clear();
+    while (remaining > 0 && chunk.size() < kLeafHashesPerChunk) {
+      if (!in.read(&leaf_hash[0], kLeafHashSize)) {
+        return Status(util::error::FAILED_PRECONDITION,
+                      "snapshot has fewer leaf hashes than its STH");
+      }
+      chunk.push_back(leaf_hash);
+      --remaining;
+    }
+    tree.AddLeafHashes(chunk, executor);
+  }
+  if (tree.CurrentRoot() != sth.sha256_root_hash()) {
+    return Status(util::error::FAILED_PRECONDITION,
+                  "snapshot leaf hashes do not match the root of its STH");
+  }
+  return Status::OK;
+}
+
+
+Status WriteEntries(vector<LoggedEntry>* entries, Database* db) {
+  size_t num_created(0);
+  if (db->CreateSequencedEntries(*entries, &num_created) != Database::OK) {
+    return Status(util::error::INTERNAL,
+                  "could not write entry " +
+                      to_string((*entries)[num_created].sequence_number()) +
+                      " to the database");
+  }
+  entries->clear();
+  return Status::OK;
+}
+
+
+// Checks that the first |sth.tree_size()| leaf hashes of |db| are those
+// of the tree of |sth|.
+Status VerifyDatabaseLeafHashes(const ReadOnlyDatabase& db,
+                                const SignedTreeHead& sth,
+                                util::Executor* executor) {
+  const unique_ptr<Database::LeafHashIterator> it(db.ScanLeafHashes(0));
+  CompactMerkleTree tree(new Sha256Hasher);
+  vector<string> chunk;
+  int64_t seq;
+  string leaf_hash;
+  int64_t next(0);
+  while (next < sth.tree_size()) {
+    chunk.clear();
+    while (next < sth.tree_size() && chunk.size() < kLeafHashesPerChunk) {
+      if (!it->GetNextLeafHash(&seq, &leaf_hash) || seq != next) {
+        return Status(util::error::FAILED_PRECONDITION,
+                      "database is missing entry " + to_string(next));
+      }
+      chunk.push_back(leaf_hash);
+      ++next;
+    }
+    tree.AddLeafHashes(chunk, executor);
+  }
+  if (tree.CurrentRoot() != sth.sha256_root_hash()) {
+    return Status(util::error::FAILED_PRECONDITION,
+                  "copied leaf hashes do not match the root of the STH");
+  }
+  return Status::OK;
+}
+
+
+// Copies the entries from |first| to |end| (exclusive) of |from| into
+// |to|.
+Status CopyShard(const ReadOnlyDatabase& from, int64_t first, int64_t end,
+                 Database* to) {
+  const unique_ptr<ReadOnlyDatabase::Iterator> it(
+      MaybeReadAhead(from.ScanRange(first, end - 1)));
+  vector<LoggedEntry> entries;
+  entries.reserve(min<int64_t>(end - first, kEntriesPerWrite));
+  for (int64_t seq(first); seq < end; ++seq) {
+    entries.emplace_back();
+    if (!it->GetNextEntry(&entries.back()) ||
+        entries.back().sequence_number() != seq) {
+      return Status(util::error::FAILED_PRECONDITION,
+                    "source database is missing entry " + to_string(seq));
+    }
+    if (entries.size() >= kEntriesPerWrite) {
+      const Status status(WriteEntries(&entries, to));
+      if (!status.ok()) {
+        return status;
+      }
+    }
+  }
+  return WriteEntries(&entries, to);
+}
+
+
+// The shared state of the workers of CopyEntries(), which each copy the
+// next shard not taken yet until there are none left, or one failed.
+struct CopyState {
+  CopyState(const ReadOnlyDatabase& from, int64_t start, int64_t end,
+            int64_t entries_per_shard, int num_workers, Database* to)
+      : from(from),
+        start(start),
+        end(end),
+        entries_per_shard(entries_per_shard),
+        to(to),
+        next_shard(0),
+        pending(num_workers) {
+  }
+
+  void Work() {
+    while (true) {
+      {
+        lock_guard<mutex> lock(status_lock);
+        if (!status.ok()) {
+          break;
+        }
+      }
+      const int64_t first(start + next_shard++ * entries_per_shard);
+      if (first >= end) {
+        break;
+      }
+      const int64_t shard_end(min(first + entries_per_shard, end));
+      VLOG(1) << "copying entries from " << first << " to " << shard_end;
+      const Status shard_status(CopyShard(from, first, shard_end, to));
+      if (!shard_status.ok()) {
+        lock_guard<mutex> lock(status_lock);
+        if (status.ok()) {
+          status = shard_status;
+        }
+        break;
+      }
+    }
+    if (--pending == 0) {
+      done.Notify();
+    }
+  }
+
+  const ReadOnlyDatabase& from;
+  const int64_t start;
+  const int64_t end;
+  const int64_t entries_per_shard;
+  Database* const to;
+  atomic<int64_t> next_shard;
+  atomic<int> pending;
+  Notification done;
+  mutex status_lock;
+  Status status;
+};
+
+
+}  // namespace
+
+
+Status ExportSnapshot(const ReadOnlyDatabase& db, const SignedTreeHead& sth,
+                      int64_t entries_per_segment, const string& dir) {
+  CHECK_GT(entries_per_segment, 0);
+  if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    return ErrnoStatus("creating " + dir);
+  }
+
+  const int64_t tree_size(sth.tree_size());
+  for (int64_t first(0); first < tree_size; first += entries_per_segment) {
+    const string path(SegmentPath(dir, first));
+    if (FileExists(path)) {
+      VLOG(1) << "keeping existing segment " << path;
+      continue;
+    }
+    LOG(INFO) << "exporting entries from " << first << " to " << path;
+    const Status status(ExportSegment(
+        db, first, min(first + entries_per_segment, tree_size), path));
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  Status status(ExportLeafHashes(db, tree_size, dir + "/" + kLeafHashesFile));
+  if (!status.ok()) {
+    return status;
+  }
+
+  const string sth_path(dir + "/" + kSthFile);
+  ofstream out(sth_path + kTempSuffix, ios::binary | ios::trunc);
+  string data;
+  CHECK(sth.SerializeToString(&data));
+  out.write(data.data(), data.size());
+  return CommitFile(&out, sth_path);
+}
+
+
+StatusOr<SignedTreeHead> VerifySnapshot(const string& dir,
+                                        const LogVerifier& verifier,
+                                        util::Executor* executor) {
+  string data;
+  SignedTreeHead sth;
+  if (!util::ReadBinaryFile(dir + "/" + kSthFile, &data) ||
+      !sth.ParseFromString(data)) {
+    return Status(util::error::NOT_FOUND, "no STH in snapshot " + dir);
+  }
+  const LogVerifier::LogVerifyResult verify_result(
+      verifier.VerifySignedTreeHead(sth));
+  if (verify_result != LogVerifier::VERIFY_OK) {
+    return Status(util::error::FAILED_PRECONDITION,
+                  "snapshot STH does not verify: " +
+                      LogVerifier::VerifyResultString(verify_result));
+  }
+
+  const Status status(
+      VerifyLeafHashes(dir + "/" + kLeafHashesFile, sth, executor));
+  if (!status.ok()) {
+    return status;
+  }
+  LOG(INFO) << "snapshot of " << sth.tree_size() << " entries verified";
+  return sth;
+}
+
+
+StatusOr<SignedTreeHead> ImportSnapshot(const string& dir,
+                                        const LogVerifier& verifier,
+                                        util::Executor* executor,
+                                        Database* db) {
+  CHECK_NOTNULL(db);
+  const StatusOr<SignedTreeHead> verified(
+      VerifySnapshot(dir, verifier, executor));
+  if (!verified.ok()) {
+    return verified.status();
+  }
+  const SignedTreeHead& sth(verified.ValueOrDie());
+  const string leaf_hashes_path(dir + "/" + kLeafHashesFile);
+  Status status;
+  string data;
+
+  const StatusOr<map<int64_t, string>> segments(ListSegments(dir));
+  if (!segments.ok()) {
+    return segments.status();
+  }
+
+  const int64_t tree_size(sth.tree_size());
+  const int64_t start(db->TreeSize());
+  ifstream leaf_hashes(leaf_hashes_path, ios::binary);
+  leaf_hashes.seekg(start * kLeafHashSize);
+  string leaf_hash(kLeafHashSize, '\0');
+  int64_t next(start);
+  vector<LoggedEntry> entries;
+  for (auto it(segments.ValueOrDie().begin());
+       it != segments.ValueOrDie().end() && next < tree_size; ++it) {
+    const auto following(std::next(it));
+    if (following != segments.ValueOrDie().end() &&
+        following->first <= start) {
+      // Already imported.
+      continue;
+    }
+    LOG(INFO) << "importing " << it->second;
+    ifstream in(it->second, ios::binary);
+    while (next < tree_size && ReadRecord(&in, &data)) {
+      entries.emplace_back();
+      LoggedEntry* const entry(&entries.back());
+      if (!entry->ParseFromString(data)) {
+        return Status(util::error::FAILED_PRECONDITION,
+                      "cannot parse entry in " + it->second);
+      }
+      if (entry->sequence_number() < next) {
+        entries.pop_back();
+        continue;
+      }
+      if (entry->sequence_number() != next) {
+        return Status(util::error::FAILED_PRECONDITION,
+                      "snapshot is missing entry " + to_string(next));
+      }
+      if (!leaf_hashes.read(&leaf_hash[0], kLeafHashSize) ||
+          entry->MerkleLeafHash() != leaf_hash) {
+        return Status(util::error::FAILED_PRECONDITION,
+                      "entry " + to_string(next) +
+                          " does not match its leaf hash");
+      }
+      ++next;
+      if (entries.size() >= kEntriesPerWrite) {
+        status = WriteEntries(&entries, db);
+        if (!status.ok()) {
+          return status;
+        }
+      }
+    }
+  }
+  status = WriteEntries(&entries, db);
+  if (!status.ok()) {
+    return status;
+  }
+
+  if (next < tree_size) {
+    return Status(util::error::FAILED_PRECONDITION,
+                  "snapshot is missing entry " + to_string(next));
+  }
+  LOG(INFO) << "imported " << next - start << " entries from snapshot";
+
+  return sth;
+}
+
+
+Status CopyEntries(const ReadOnlyDatabase& from, const SignedTreeHead& sth,
+                   int64_t entries_per_shard, int num_workers,
+                   util::Executor* executor, Database* to) {
+  CHECK_GT(entries_per_shard, 0);
+  CHECK_GT(num_workers, 0);
+  CHECK_NOTNULL(executor);
+  CHECK_NOTNULL(to);
+
+  const int64_t tree_size(sth.tree_size());
+  const int64_t start(min(to->TreeSize(), tree_size));
+  LOG(INFO) << "copying entries from " << start << " to " << tree_size;
+  if (start < tree_size) {
+    CopyState state(from, start, tree_size, entries_per_shard, num_workers,
+                    to);
+    for (int i = 0; i < num_workers; ++i) {
+      executor->Add([&state]() { state.Work(); });
+    }
+    state.done.WaitForNotification();
+    if (!state.status.ok()) {
+      return state.status;
+    }
+  }
+
+  const Status status(VerifyDatabaseLeafHashes(*to, sth, executor));
+  if (!status.ok()) {
+    return status;
+  }
+  LOG(INFO) << "copied " << tree_size - start << " entries, root verified";
+
+  const Database::WriteResult result(to->WriteTreeHead(sth));
+  // It is already there if an earlier copy finished.
+  if (result != Database::OK &&
+      result != Database::DUPLICATE_TREE_HEAD_TIMESTAMP) {
+    return Status(util::error::INTERNAL,
+                  "could not write the STH to the database");
+  }
+  return Status::OK;
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,75 @@
+#ifndef CERT_TRANS_LOG_SNAPSHOT_H_
+#define CERT_TRANS_LOG_SNAPSHOT_H_
+
+#include <stdint.h>
+#include <string>
+
+#include "log/database.h"
+#include "proto/ct.pb.h"
+#include "util/executor.h"
+#include "util/status.h"
+#include "util/statusor.h"
+
+class LogVerifier;
+
+namespace cert_trans {
+
+
+// A snapshot is a directory holding a prefix of a log, which can be
+// used to bootstrap a new node at disk speed rather than by fetching
+// the whole log through get-entries. It is made of:
+//   - "entries-<first sequence number>", segment files holding runs of
+//     consecutive entries, each one a serialized LoggedEntry preceded by
+//     its length as a 4-byte big-endian integer,
+//   - "leaf_hashes", the Merkle leaf hashes of all the entries, in order,
+//     32 bytes each, and
+//   - "sth", the serialized SignedTreeHead covering those entries.
+// The sequence numbers in the segment file names are zero-padded to 20
+// digits. Each file is written under a temporary name and renamed into
+// place once complete, and "sth" is written last.
+
+// Writes the first |sth.tree_size()| entries of |db| to a snapshot in
+// |dir|, which is created if needed, along with |sth|. Segment files
+// left complete by a previous run are kept, so an interrupted export can
+// be resumed.
+util::Status ExportSnapshot(const ReadOnlyDatabase& db,
+                            const ct::SignedTreeHead& sth,
+                            int64_t entries_per_segment,
+                            const std::string& dir);
+
+// Verifies the STH of the snapshot in |dir|, without reading its
+// entries: its signature is checked with |verifier|, and its root
+// against the leaf hashes, which are hashed into a tree in parallel on
+// |executor|. Returns the STH.
+util::StatusOr<ct::SignedTreeHead> VerifySnapshot(const std::string& dir,
+                                                  const LogVerifier& verifier,
+                                                  util::Executor* executor);
+
+// Verifies the snapshot in |dir| as VerifySnapshot() does, and imports
+// its entries into |db|. Every entry is checked against its leaf hash
+// before being written. Entries below |db->TreeSize()| are assumed to be there
+// already, so an interrupted import can be resumed. Returns the STH of
+// the snapshot, which |db| can now serve.
+util::StatusOr<ct::SignedTreeHead> ImportSnapshot(const std::string& dir,
+                                                  const LogVerifier& verifier,
+                                                  util::Executor* executor,
+                                                  Database* db);
+
+// Copies the first |sth.tree_size()| entries of |from| into |to|, which
+// can be any two kinds of database, without going through a snapshot.
+// The entries are split into shards of |entries_per_shard| consecutive
+// ones, each read with a single ScanRange() and written in batches, and
+// |num_workers| shards are copied at a time on |executor|. Entries below
+// |to->TreeSize()| are assumed to be there already, so an interrupted
+// copy can be resumed. Once all the entries are there, checks that the
+// leaf hashes of |to| are those of the tree of |sth|, and writes |sth|
+// to |to|.
+util::Status CopyEntries(const ReadOnlyDatabase& from,
+                         const ct::SignedTreeHead& sth,
+                         int64_t entries_per_shard, int num_workers,
+                         util::Executor* executor, Database* to);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_SNAPSHOT_H_
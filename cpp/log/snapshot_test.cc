@@ -0,0 +1,270 @@
+/* -*- indent-tabs-mode: nil -*- */
+#include "log/snapshot.h"
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+#include "log/leveldb_db.h"
+#include "log/log_signer.h"
+#include "log/log_verifier.h"
+#include "log/logged_entry.h"
+#include "log/sqlite_db.h"
+#include "log/test_db.h"
+#include "log/test_signer.h"
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
+#include "proto/cert_serializer.h"
+#include "util/status_test_util.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using ct::SignedTreeHead;
+using std::string;
+using std::unique_ptr;
+using util::StatusOr;
+
+const int kNumEntries = 25;
+const int kEntriesPerSegment = 10;
+
+
+class SnapshotTest : public ::testing::Test {
+ protected:
+  SnapshotTest()
+      : log_signer_(TestSigner::DefaultLogSigner()),
+        verifier_(TestSigner::DefaultLogSigVerifier(),
+                  new MerkleVerifier(new Sha256Hasher)),
+        snapshot_dir_(tmp_.TmpStorageDir() + "/snapshot") {
+  }
+
+  void SetUp() override {
+    CompactMerkleTree tree(new Sha256Hasher);
+    for (int i = 0; i < kNumEntries; ++i) {
+      LoggedEntry entry;
+      test_signer_.CreateUnique(&entry);
+      entry.set_sequence_number(i);
+      string serialized_leaf;
+      CHECK(entry.SerializeForLeaf(&serialized_leaf));
+      tree.AddLeaf(serialized_leaf);
+      CHECK_EQ(Database::OK, source_.db()->CreateSequencedEntry(entry));
+    }
+
+    sth_.set_version(ct::V1);
+    sth_.set_timestamp(util::TimeInMilliseconds());
+    sth_.set_tree_size(kNumEntries);
+    sth_.set_sha256_root_hash(tree.CurrentRoot());
+    CHECK_EQ(LogSigner::OK, log_signer_->SignTreeHead(&sth_));
+  }
+
+  bool ReadSnapshotFile(const string& name, string* data) const {
+    return util::ReadBinaryFile(snapshot_dir_ + "/" + name, data);
+  }
+
+  void WriteSnapshotFile(const string& name, const string& data) const {
+    FILE* const file(fopen((snapshot_dir_ + "/" + name).c_str(), "wb"));
+    CHECK_NOTNULL(file);
+    CHECK_EQ(data.size(), fwrite(data.data(), 1, data.size(), file));
+    CHECK_EQ(0, fclose(file));
+  }
+
+  void ExpectSameEntries(const Database* db, int64_t num_entries) const {
+    EXPECT_EQ(num_entries, db->TreeSize());
+    for (int64_t i = 0; i < num_entries; ++i) {
+      LoggedEntry expected, imported;
+      ASSERT_EQ(Database::LOOKUP_OK,
+                source_.db()->LookupByIndex(i, &expected));
+      ASSERT_EQ(Database::LOOKUP_OK, db->LookupByIndex(i, &imported));
+      TestSigner::TestEqualLoggedCerts(expected, imported);
+    }
+  }
+
+  TmpStorage tmp_;
+  TestDB<LevelDB> source_;
+  TestDB<SQLiteDB> dest_;
+  TestSigner test_signer_;
+  const unique_ptr<LogSigner> log_signer_;
+  const LogVerifier verifier_;
+  ThreadPool pool_;
+  const string snapshot_dir_;
+  SignedTreeHead sth_;
+};
+
+
+TEST_F(SnapshotTest, ExportAndImport) {
+  EXPECT_OK(ExportSnapshot(*source_.db(), sth_, kEntriesPerSegment,
+                           snapshot_dir_));
+
+  const StatusOr<SignedTreeHead> sth(
+      ImportSnapshot(snapshot_dir_, verifier_, &pool_, dest_.db()));
+  ASSERT_OK(sth);
+  EXPECT_EQ(sth_.DebugString(), sth.ValueOrDie().DebugString());
+  ExpectSameEntries(dest_.db(), kNumEntries);
+}
+
+
+TEST_F(SnapshotTest, ResumesImport) {
+  EXPECT_OK(ExportSnapshot(*source_.db(), sth_, kEntriesPerSegment,
+                           snapshot_dir_));
+
+  // Pretend a previous import got part of the way through the second
+  // segment.
+  const int64_t already_imported(kEntriesPerSegment + 3);
+  for (int64_t i = 0; i < already_imported; ++i) {
+    LoggedEntry entry;
+    ASSERT_EQ(Database::LOOKUP_OK, source_.db()->LookupByIndex(i, &entry));
+    ASSERT_EQ(Database::OK, dest_.db()->CreateSequencedEntry(entry));
+  }
+
+  EXPECT_OK(ImportSnapshot(snapshot_dir_, verifier_, &pool_, dest_.db()));
+  ExpectSameEntries(dest_.db(), kNumEntries);
+}
+
+
+TEST_F(SnapshotTest, ExportOnlyCoversSTH) {
+  SignedTreeHead sth(sth_);
+  sth.set_tree_size(kEntriesPerSegment);
+  EXPECT_OK(
+      ExportSnapshot(*source_.db(), sth, kEntriesPerSegment, snapshot_dir_));
+
+  string leaf_hashes;
+  ASSERT_TRUE(ReadSnapshotFile("leaf_hashes", &leaf_hashes));
+  EXPECT_EQ(kEntriesPerSegment * 32U, leaf_hashes.size());
+  string segment;
+  EXPECT_TRUE(ReadSnapshotFile("entries-00000000000000000000", &segment));
+  EXPECT_FALSE(ReadSnapshotFile("entries-00000000000000000010", &segment));
+}
+
+
+TEST_F(SnapshotTest, VerifiesWithoutImporting) {
+  EXPECT_OK(ExportSnapshot(*source_.db(), sth_, kEntriesPerSegment,
+                           snapshot_dir_));
+
+  const StatusOr<SignedTreeHead> sth(
+      VerifySnapshot(snapshot_dir_, verifier_, &pool_));
+  ASSERT_OK(sth);
+  EXPECT_EQ(sth_.DebugString(), sth.ValueOrDie().DebugString());
+
+  string leaf_hashes;
+  ASSERT_TRUE(ReadSnapshotFile("leaf_hashes", &leaf_hashes));
+  leaf_hashes[0] ^= 1;
+  WriteSnapshotFile("leaf_hashes", leaf_hashes);
+  EXPECT_FALSE(VerifySnapshot(snapshot_dir_, verifier_, &pool_).ok());
+}
+
+
+TEST_F(SnapshotTest, RejectsBadSignature) {
+  EXPECT_OK(ExportSnapshot(*source_.db(), sth_, kEntriesPerSegment,
+                           snapshot_dir_));
+  SignedTreeHead sth(sth_);
+  sth.set_timestamp(sth.timestamp() + 1);
+  string data;
+  ASSERT_TRUE(sth.SerializeToString(&data));
+  WriteSnapshotFile("sth", data);
+
+  EXPECT_FALSE(
+      ImportSnapshot(snapshot_dir_, verifier_, &pool_, dest_.db()).ok());
+  EXPECT_EQ(0, dest_.db()->TreeSize());
+}
+
+
+TEST_F(SnapshotTest, RejectsBadLeafHashes) {
+  EXPECT_OK(ExportSnapshot(*source_.db(), sth_, kEntriesPerSegment,
+                           snapshot_dir_));
+  string leaf_hashes;
+  ASSERT_TRUE(ReadSnapshotFile("leaf_hashes", &leaf_hashes));
+  leaf_hashes[0] ^= 1;
+  WriteSnapshotFile("leaf_hashes", leaf_hashes);
+
+  EXPECT_FALSE(
+      ImportSnapshot(snapshot_dir_, verifier_, &pool_, dest_.db()).ok());
+  EXPECT_EQ(0, dest_.db()->TreeSize());
+}
+
+
+TEST_F(SnapshotTest, RejectsEntryNotMatchingLeafHash) {
+  EXPECT_OK(ExportSnapshot(*source_.db(), sth_, kEntriesPerSegment,
+                           snapshot_dir_));
+  // Replace the second segment with different entries, keeping the
+  // (valid) leaf hashes.
+  TestDB<LevelDB> other;
+  for (int i = 0; i < kNumEntries; ++i) {
+    LoggedEntry entry;
+    test_signer_.CreateUnique(&entry);
+    entry.set_sequence_number(i);
+    ASSERT_EQ(Database::OK, other.db()->CreateSequencedEntry(entry));
+  }
+  const string other_dir(tmp_.TmpStorageDir() + "/other");
+  EXPECT_OK(ExportSnapshot(*other.db(), sth_, kEntriesPerSegment, other_dir));
+  string segment;
+  ASSERT_TRUE(util::ReadBinaryFile(other_dir + "/entries-00000000000000000010",
+                                   &segment));
+  WriteSnapshotFile("entries-00000000000000000010", segment);
+
+  EXPECT_FALSE(
+      ImportSnapshot(snapshot_dir_, verifier_, &pool_, dest_.db()).ok());
+  EXPECT_LE(dest_.db()->TreeSize(), kEntriesPerSegment);
+}
+
+
+TEST_F(SnapshotTest, CopiesEntries) {
+  // Shards that do not divide the entries evenly, on fewer threads
+  // than workers.
+  EXPECT_OK(CopyEntries(*source_.db(), sth_, 4, 8, &pool_, dest_.db()));
+  ExpectSameEntries(dest_.db(), kNumEntries);
+
+  SignedTreeHead sth;
+  ASSERT_EQ(Database::LOOKUP_OK, dest_.db()->LatestTreeHead(&sth));
+  EXPECT_EQ(sth_.DebugString(), sth.DebugString());
+
+  // Copying again has nothing left to do.
+  EXPECT_OK(CopyEntries(*source_.db(), sth_, 4, 8, &pool_, dest_.db()));
+}
+
+
+TEST_F(SnapshotTest, ResumesCopy) {
+  const int64_t already_copied(kEntriesPerSegment + 3);
+  for (int64_t i = 0; i < already_copied; ++i) {
+    LoggedEntry entry;
+    ASSERT_EQ(Database::LOOKUP_OK, source_.db()->LookupByIndex(i, &entry));
+    ASSERT_EQ(Database::OK, dest_.db()->CreateSequencedEntry(entry));
+  }
+
+  EXPECT_OK(CopyEntries(*source_.db(), sth_, kEntriesPerSegment, 2, &pool_,
+                        dest_.db()));
+  ExpectSameEntries(dest_.db(), kNumEntries);
+}
+
+
+TEST_F(SnapshotTest, CopyRejectsWrongRoot) {
+  SignedTreeHead sth(sth_);
+  sth.set_tree_size(kNumEntries - 1);
+  EXPECT_FALSE(
+      CopyEntries(*source_.db(), sth, 4, 2, &pool_, dest_.db()).ok());
+  SignedTreeHead dest_sth;
+  EXPECT_EQ(Database::NOT_FOUND, dest_.db()->LatestTreeHead(&dest_sth));
+}
+
+
+TEST_F(SnapshotTest, CopyRejectsMissingEntries) {
+  SignedTreeHead sth(sth_);
+  sth.set_tree_size(kNumEntries + 1);
+  EXPECT_FALSE(
+      CopyEntries(*source_.db(), sth, 4, 2, &pool_, dest_.db()).ok());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  ConfigureSerializerForV1CT();
+  return RUN_ALL_TESTS();
+}
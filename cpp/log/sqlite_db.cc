@@ -3,6 +3,11 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <sqlite3.h>
+#include <strings.h>
+#include <algorithm>
+#include <limits>
+#include <utility>
+#include <vector>
 
 #include "log/sqlite_statement.h"
 #include "monitoring/latency.h"
@@ -12,10 +17,12 @@
 using std::unique_ptr;
 using std::chrono::milliseconds;
 using std::lock_guard;
+using std::move;
 using std::mutex;
 using std::ostringstream;
 using std::string;
 using std::unique_lock;
+using std::vector;
 
 // Several of these flags pass their value directly through to SQLite PRAGMA
 // statements, see the SQLite documentation
@@ -42,6 +49,15 @@ DEFINE_bool(sqlite_batch_into_transactions, true,
             "scenes.");
 DEFINE_int32(sqlite_transaction_batch_size, 400,
              "Max number of operations to batch into one transaction.");
+DEFINE_int32(sqlite_read_connections, 4,
+             "Max number of read-only connections to run lookups on, "
+             "concurrently with each other and with writes, when "
+             "sqlite_journal_mode is WAL. With 0, lookups share the "
+             "read-write connection.");
+DEFINE_int32(sqlite_read_busy_timeout_ms, 1000,
+             "How long a lookup on a read-only connection waits for the "
+             "database to be unlocked, which in WAL mode only happens "
+             "during a checkpoint.");
 
 namespace cert_trans {
 namespace {
@@ -51,6 +67,14 @@ static Latency<milliseconds, string> latency_by_op_ms(
     "sqlitedb_latency_by_operation_ms", "operation",
     "Database latency in ms broken out by operation");
 
+const char kCreateLeafHashesTable[] =
+    "CREATE TABLE leaf_hashes(sequence INTEGER PRIMARY KEY, hash BLOB)";
+// Number of leaf hashes a LeafHashIterator reads at once.
+const int kLeafHashReadBatchSize = 1024;
+// Number of entries an Iterator reads at first, and at most, at once.
+const int kEntryReadFirstBatchSize = 16;
+const int kEntryReadBatchSize = 256;
+
 
 sqlite3* SQLiteOpen(const string& dbfile) {
   ScopedLatency scoped_latency(latency_by_op_ms.GetScopedLatency("open"));
@@ -81,6 +105,9 @@ sqlite3* SQLiteOpen(const string& dbfile) {
                                    "leaves(hash)",
                                    nullptr, nullptr, nullptr)) <<
       sqlite3_errmsg(retval);;
+  CHECK_EQ(SQLITE_OK, sqlite3_exec(retval, kCreateLeafHashesTable, nullptr,
+                                   nullptr, nullptr)) <<
+      sqlite3_errmsg(retval);
   CHECK_EQ(SQLITE_OK,
            sqlite3_exec(
                retval,
@@ -97,51 +124,220 @@ sqlite3* SQLiteOpen(const string& dbfile) {
 }
 
 
+sqlite3* SQLiteOpenReadOnly(const string& dbfile) {
+  ScopedLatency scoped_latency(
+      latency_by_op_ms.GetScopedLatency("open_read_only"));
+  sqlite3* retval;
+  CHECK_EQ(SQLITE_OK, sqlite3_open_v2(dbfile.c_str(), &retval,
+                                      SQLITE_OPEN_READONLY, nullptr))
+      << sqlite3_errmsg(retval);
+  CHECK_EQ(SQLITE_OK,
+           sqlite3_busy_timeout(retval, FLAGS_sqlite_read_busy_timeout_ms))
+      << sqlite3_errmsg(retval);
+  return retval;
+}
+
+
 }  // namespace
 
 
+// Where a lookup runs: on an idle read-only connection if there is one
+// and |db| has nothing uncommitted, and otherwise on |db|'s read-write
+// connection, holding its lock.
+class SQLiteDB::ReadScope {
+ public:
+  explicit ReadScope(const SQLiteDB* db)
+      : db_(CHECK_NOTNULL(db)), tree_size_(db_->tree_size_) {
+    // The tree size is read first: if it takes in entries being written,
+    // then either |uncommitted_| is set or they have been committed.
+    if (!db_->uncommitted_) {
+      reader_ = db_->GetReader();
+    }
+    if (!reader_) {
+      lock_ = unique_lock<mutex>(db_->lock_);
+      tree_size_ = db_->tree_size_;
+    }
+  }
+
+  ~ReadScope() {
+    if (reader_) {
+      db_->ReturnReader(move(reader_));
+    }
+  }
+
+  sqlite::Connection* connection() const {
+    return reader_ ? reader_.get() : db_->db_.get();
+  }
+
+  // The tree size as of the start of the lookup, all of which the
+  // connection can see.
+  int64_t tree_size() const {
+    return tree_size_;
+  }
+
+ private:
+  const SQLiteDB* const db_;
+  int64_t tree_size_;
+  unique_ptr<sqlite::Connection> reader_;
+  unique_lock<mutex> lock_;
+
+  DISALLOW_COPY_AND_ASSIGN(ReadScope);
+};
+
+
 class SQLiteDB::Iterator : public Database::Iterator {
  public:
-  Iterator(const SQLiteDB* db, int64_t start_index)
-      : db_(CHECK_NOTNULL(db)), next_index_(start_index) {
+  Iterator(const SQLiteDB* db, int64_t start_index, int64_t end_index)
+      : db_(CHECK_NOTNULL(db)),
+        next_index_(start_index),
+        end_index_(end_index),
+        batch_size_(kEntryReadFirstBatchSize),
+        num_rows_(0),
+        next_(0) {
     CHECK_GE(next_index_, 0);
   }
 
   bool GetNextEntry(LoggedEntry* entry) override {
     CHECK_NOTNULL(entry);
-    unique_lock<mutex> lock(db_->lock_);
-    if (next_index_ < db_->tree_size_) {
-      CHECK_EQ(db_->LookupByIndex(lock, next_index_, entry), db_->LOOKUP_OK);
-      ++next_index_;
-      return true;
+    if (next_ == num_rows_) {
+      ReadBatch();
+      if (num_rows_ == 0) {
+        return false;
+      }
     }
+    const Row& row(rows_[next_]);
+    ++next_;
+    CHECK(entry->ParseFromDatabase(row.entry, fields()));
+    CHECK(!(fields() & LoggedEntry::PARSE_LEAF) || entry->Hash() == row.hash)
+        << "unexpected hash for entry " << row.sequence;
+    entry->set_sequence_number(row.sequence);
+    return true;
+  }
 
-    const bool retval(db_->LookupNextIndex(lock, next_index_, entry) ==
-                      db_->LOOKUP_OK);
-    if (retval) {
-      next_index_ = entry->sequence_number() + 1;
+ private:
+  struct Row {
+    int64_t sequence;
+    string entry;
+    string hash;
+  };
+
+  // Reads the next rows of the range in one query, picking up after the
+  // last one read (so using the index rather than an offset). Batches
+  // start small, for the scans that only read a few entries past the
+  // end of the tree, and grow up to kEntryReadBatchSize.
+  void ReadBatch() {
+    num_rows_ = 0;
+    next_ = 0;
+    if (next_index_ > end_index_) {
+      return;
+    }
+    const ReadScope scope(db_);
+    sqlite::Statement statement(scope.connection(),
+                                "SELECT sequence, entry, hash FROM leaves "
+                                "WHERE sequence >= ? AND sequence <= ? "
+                                "ORDER BY sequence LIMIT ?");
+    statement.BindUInt64(0, next_index_);
+    statement.BindUInt64(1, end_index_);
+    statement.BindUInt64(2, batch_size_);
+    int ret;
+    while ((ret = statement.Step()) == SQLITE_ROW) {
+      // The rows are kept between batches, so that their strings keep
+      // their memory.
+      if (num_rows_ == rows_.size()) {
+        rows_.emplace_back();
+      }
+      Row* const row(&rows_[num_rows_]);
+      ++num_rows_;
+      row->sequence = statement.GetUInt64(0);
+      statement.GetBlob(1, &row->entry);
+      statement.GetBlob(2, &row->hash);
+      db_->MaybeAdvanceTreeSize(row->sequence);
+    }
+    CHECK_EQ(SQLITE_DONE, ret) << sqlite3_errmsg(scope.connection()->db());
+    if (num_rows_ > 0) {
+      next_index_ = rows_[num_rows_ - 1].sequence + 1;
     }
+    batch_size_ = std::min(2 * batch_size_, kEntryReadBatchSize);
+  }
 
-    return retval;
+  const SQLiteDB* const db_;
+  int64_t next_index_;
+  const int64_t end_index_;
+  int batch_size_;
+  vector<Row> rows_;
+  size_t num_rows_;
+  size_t next_;
+};
+
+
+class SQLiteDB::LeafHashIterator : public Database::LeafHashIterator {
+ public:
+  LeafHashIterator(const SQLiteDB* db, int64_t start_index)
+      : db_(CHECK_NOTNULL(db)), next_index_(start_index), next_(0) {
+    CHECK_GE(next_index_, 0);
+  }
+
+  bool GetNextLeafHash(int64_t* sequence_number, string* leaf_hash) override {
+    if (next_ == batch_.size()) {
+      ReadBatch();
+      if (batch_.empty()) {
+        return false;
+      }
+    }
+    *sequence_number = batch_[next_].first;
+    leaf_hash->swap(batch_[next_].second);
+    ++next_;
+    return true;
   }
 
  private:
+  // Reads the next few leaf hashes, so as not to take the database
+  // lock for each of them.
+  void ReadBatch() {
+    batch_.clear();
+    next_ = 0;
+    const ReadScope scope(db_);
+    sqlite::Statement statement(scope.connection(),
+                                "SELECT sequence, hash FROM leaf_hashes "
+                                "WHERE sequence >= ? ORDER BY sequence "
+                                "LIMIT ?");
+    statement.BindUInt64(0, next_index_);
+    statement.BindUInt64(1, kLeafHashReadBatchSize);
+    int ret;
+    while ((ret = statement.Step()) == SQLITE_ROW) {
+      batch_.emplace_back(statement.GetUInt64(0), string());
+      statement.GetBlob(1, &batch_.back().second);
+    }
+    CHECK_EQ(SQLITE_DONE, ret) << sqlite3_errmsg(scope.connection()->db());
+    if (!batch_.empty()) {
+      next_index_ = batch_.back().first + 1;
+    }
+  }
+
   const SQLiteDB* const db_;
   int64_t next_index_;
+  vector<std::pair<int64_t, string>> batch_;
+  size_t next_;
 };
 
 
 SQLiteDB::SQLiteDB(const string& dbfile)
-    : db_(SQLiteOpen(dbfile)),
+    : dbfile_(dbfile),
+      db_(new sqlite::Connection(SQLiteOpen(dbfile))),
       tree_size_(0),
       transaction_size_(0),
-      in_transaction_(false) {
+      in_transaction_(false),
+      uncommitted_(false),
+      max_readers_(strcasecmp(FLAGS_sqlite_journal_mode.c_str(), "WAL") == 0
+                       ? FLAGS_sqlite_read_connections
+                       : 0),
+      num_readers_(0) {
   unique_lock<mutex> lock(lock_);
   {
     ostringstream oss;
     oss << "PRAGMA synchronous = " << FLAGS_sqlite_synchronous_mode;
-    sqlite::Statement statement(db_, oss.str().c_str());
-    CHECK_EQ(SQLITE_DONE, statement.Step()) << sqlite3_errmsg(db_);
+    sqlite::Statement statement(db_->db(), oss.str().c_str());
+    CHECK_EQ(SQLITE_DONE, statement.Step()) << sqlite3_errmsg(db_->db());
     LOG(WARNING) << "SQLite \"synchronous\" pragma set to "
                  << FLAGS_sqlite_synchronous_mode;
     if (FLAGS_sqlite_batch_into_transactions) {
@@ -153,27 +349,29 @@ SQLiteDB::SQLiteDB(const string& dbfile)
   {
     ostringstream oss;
     oss << "PRAGMA journal_mode = " << FLAGS_sqlite_journal_mode;
-    sqlite::Statement statement(db_, oss.str().c_str());
-    CHECK_EQ(SQLITE_ROW, statement.Step()) << sqlite3_errmsg(db_);
+    sqlite::Statement statement(db_->db(), oss.str().c_str());
+    CHECK_EQ(SQLITE_ROW, statement.Step()) << sqlite3_errmsg(db_->db());
     string mode;
     statement.GetBlob(0, &mode);
     CHECK_STRCASEEQ(mode.c_str(), FLAGS_sqlite_journal_mode.c_str());
-    CHECK_EQ(SQLITE_DONE, statement.Step()) << sqlite3_errmsg(db_);
+    CHECK_EQ(SQLITE_DONE, statement.Step()) << sqlite3_errmsg(db_->db());
   }
 
   {
     ostringstream oss;
     oss << "PRAGMA cache_size = " << FLAGS_sqlite_cache_size;
-    sqlite::Statement statement(db_, oss.str().c_str());
-    CHECK_EQ(SQLITE_DONE, statement.Step()) << sqlite3_errmsg(db_);
+    sqlite::Statement statement(db_->db(), oss.str().c_str());
+    CHECK_EQ(SQLITE_DONE, statement.Step()) << sqlite3_errmsg(db_->db());
   }
 
   BeginTransaction(lock);
+  MaybeAddLeafHashes(lock);
 }
 
 
 SQLiteDB::~SQLiteDB() {
-  CHECK_EQ(SQLITE_OK, sqlite3_close(db_)) << sqlite3_errmsg(db_);
+  CHECK_EQ(static_cast<size_t>(num_readers_), idle_readers_.size())
+      << "read-only connections still in use";
 }
 
 
@@ -185,7 +383,51 @@ Database::WriteResult SQLiteDB::CreateSequencedEntry_(
 
   MaybeStartNewTransaction(lock);
 
-  sqlite::Statement statement(db_,
+  const WriteResult result(WriteSequencedEntry(lock, logged));
+  EndWrite(lock);
+  return result;
+}
+
+
+Database::WriteResult SQLiteDB::CreateSequencedEntries_(
+    const vector<LoggedEntry>& logged, size_t* num_created) {
+  ScopedLatency latency(
+      latency_by_op_ms.GetScopedLatency("create_sequenced_entries"));
+  unique_lock<mutex> lock(lock_);
+
+  // Write all the entries in one transaction, along with whatever is in
+  // the current one, if any.
+  if (!in_transaction_) {
+    sqlite::Statement s(db_.get(), "BEGIN TRANSACTION");
+    CHECK_EQ(SQLITE_DONE, s.Step()) << sqlite3_errmsg(db_->db());
+  }
+
+  WriteResult result(this->OK);
+  for (*num_created = 0; *num_created < logged.size(); ++*num_created) {
+    result = WriteSequencedEntry(lock, logged[*num_created]);
+    if (result != this->OK) {
+      break;
+    }
+  }
+
+  if (in_transaction_) {
+    EndTransaction(lock);
+    BeginTransaction(lock);
+  } else {
+    sqlite::Statement s(db_.get(), "END TRANSACTION");
+    CHECK_EQ(SQLITE_DONE, s.Step()) << sqlite3_errmsg(db_->db());
+  }
+  EndWrite(lock);
+
+  return result;
+}
+
+
+Database::WriteResult SQLiteDB::WriteSequencedEntry(
+    const unique_lock<mutex>& lock, const LoggedEntry& logged) {
+  CHECK(lock.owns_lock());
+  uncommitted_ = true;
+  sqlite::Statement statement(db_.get(),
                               "INSERT INTO leaves(hash, entry, sequence) "
                               "VALUES(?, ?, ?)");
   const string hash(logged.Hash());
@@ -203,15 +445,13 @@ Database::WriteResult SQLiteDB::CreateSequencedEntry_(
     // Check whether we're trying to store a hash/sequence pair which already
     // exists - if it's identical we'll return OK as it could be the fetcher.
     sqlite::Statement s2(
-        db_, "SELECT sequence, hash FROM leaves WHERE sequence = ?");
+        db_.get(), "SELECT sequence, hash FROM leaves WHERE sequence = ?");
     s2.BindUInt64(0, logged.sequence_number());
     if (s2.Step() == SQLITE_ROW) {
       string existing_hash;
       s2.GetBlob(1, &existing_hash);
 
-      if (logged.sequence_number() == tree_size_) {
-        ++tree_size_;
-      }
+      MaybeAdvanceTreeSize(logged.sequence_number());
 
       if (hash == existing_hash) {
         return this->OK;
@@ -219,11 +459,17 @@ Database::WriteResult SQLiteDB::CreateSequencedEntry_(
     }
     return this->SEQUENCE_NUMBER_ALREADY_IN_USE;
   }
-  CHECK_EQ(SQLITE_DONE, ret) << sqlite3_errmsg(db_);
+  CHECK_EQ(SQLITE_DONE, ret) << sqlite3_errmsg(db_->db());
 
-  if (logged.sequence_number() == tree_size_) {
-    ++tree_size_;
-  }
+  sqlite::Statement leaf_statement(db_.get(),
+                                   "INSERT INTO leaf_hashes(sequence, hash) "
+                                   "VALUES(?, ?)");
+  const string leaf_hash(logged.MerkleLeafHash());
+  leaf_statement.BindUInt64(0, logged.sequence_number());
+  leaf_statement.BindBlob(1, leaf_hash);
+  CHECK_EQ(SQLITE_DONE, leaf_statement.Step()) << sqlite3_errmsg(db_->db());
+
+  MaybeAdvanceTreeSize(logged.sequence_number());
 
   return this->OK;
 }
@@ -234,9 +480,9 @@ Database::LookupResult SQLiteDB::LookupByHash(const string& hash,
   CHECK_NOTNULL(result);
   ScopedLatency latency(latency_by_op_ms.GetScopedLatency("lookup_by_hash"));
 
-  lock_guard<mutex> lock(lock_);
+  const ReadScope scope(this);
 
-  sqlite::Statement statement(db_,
+  sqlite::Statement statement(scope.connection(),
                               "SELECT entry, sequence FROM leaves "
                               "WHERE hash = ? ORDER BY sequence LIMIT 1");
 
@@ -246,7 +492,7 @@ Database::LookupResult SQLiteDB::LookupByHash(const string& hash,
   if (ret == SQLITE_DONE) {
     return this->NOT_FOUND;
   }
-  CHECK_EQ(SQLITE_ROW, ret) << sqlite3_errmsg(db_);
+  CHECK_EQ(SQLITE_ROW, ret) << sqlite3_errmsg(scope.connection()->db());
 
   string data;
   statement.GetBlob(0, &data);
@@ -256,9 +502,7 @@ Database::LookupResult SQLiteDB::LookupByHash(const string& hash,
     result->clear_sequence_number();
   } else {
     result->set_sequence_number(statement.GetUInt64(1));
-    if (result->sequence_number() == tree_size_) {
-      ++tree_size_;
-    }
+    MaybeAdvanceTreeSize(result->sequence_number());
   }
 
   return this->LOOKUP_OK;
@@ -268,19 +512,18 @@ Database::LookupResult SQLiteDB::LookupByHash(const string& hash,
 Database::LookupResult SQLiteDB::LookupByIndex(int64_t sequence_number,
                                                LoggedEntry* result) const {
   ScopedLatency latency(latency_by_op_ms.GetScopedLatency("lookup_by_index"));
-  unique_lock<mutex> lock(lock_);
+  const ReadScope scope(this);
 
-  return LookupByIndex(lock, sequence_number, result);
+  return LookupByIndex(scope.connection(), sequence_number, result);
 }
 
 
-Database::LookupResult SQLiteDB::LookupByIndex(const unique_lock<mutex>& lock,
+Database::LookupResult SQLiteDB::LookupByIndex(sqlite::Connection* db,
                                                int64_t sequence_number,
                                                LoggedEntry* result) const {
-  CHECK(lock.owns_lock());
   CHECK_GE(sequence_number, 0);
   CHECK_NOTNULL(result);
-  sqlite::Statement statement(db_,
+  sqlite::Statement statement(db,
                               "SELECT entry, hash FROM leaves "
                               "WHERE sequence = ?");
   statement.BindUInt64(0, sequence_number);
@@ -299,49 +542,29 @@ Database::LookupResult SQLiteDB::LookupByIndex(const unique_lock<mutex>& lock,
   CHECK_EQ(result->Hash(), hash);
 
   result->set_sequence_number(sequence_number);
-  if (result->sequence_number() == tree_size_) {
-    ++tree_size_;
-  }
+  MaybeAdvanceTreeSize(sequence_number);
 
   return this->LOOKUP_OK;
 }
 
 
-Database::LookupResult SQLiteDB::LookupNextIndex(
-    const unique_lock<mutex>& lock, int64_t sequence_number,
-    LoggedEntry* result) const {
-  CHECK(lock.owns_lock());
-  CHECK_GE(sequence_number, 0);
-  CHECK_NOTNULL(result);
-  sqlite::Statement statement(db_,
-                              "SELECT entry, hash, sequence FROM leaves "
-                              "WHERE sequence >= ? ORDER BY sequence");
-  statement.BindUInt64(0, sequence_number);
-  if (statement.Step() == SQLITE_DONE) {
-    return this->NOT_FOUND;
-  }
-
-  string data;
-  statement.GetBlob(0, &data);
-  CHECK(result->ParseFromDatabase(data));
-
-  string hash;
-  statement.GetBlob(1, &hash);
-
-  CHECK_EQ(result->Hash(), hash);
+unique_ptr<Database::Iterator> SQLiteDB::ScanEntries(
+    int64_t start_index) const {
+  return unique_ptr<Iterator>(
+      new Iterator(this, start_index, std::numeric_limits<int64_t>::max()));
+}
 
-  result->set_sequence_number(statement.GetUInt64(2));
-  if (result->sequence_number() == tree_size_) {
-    ++tree_size_;
-  }
 
-  return this->LOOKUP_OK;
+unique_ptr<Database::Iterator> SQLiteDB::ScanRange(int64_t start,
+                                                   int64_t end) const {
+  return unique_ptr<Iterator>(new Iterator(this, start, end));
 }
 
 
-unique_ptr<Database::Iterator> SQLiteDB::ScanEntries(
+unique_ptr<Database::LeafHashIterator> SQLiteDB::ScanLeafHashes(
     int64_t start_index) const {
-  return unique_ptr<Iterator>(new Iterator(this, start_index));
+  return unique_ptr<LeafHashIterator>(
+      new LeafHashIterator(this, start_index));
 }
 
 
@@ -349,7 +572,7 @@ Database::WriteResult SQLiteDB::WriteTreeHead_(const ct::SignedTreeHead& sth) {
   ScopedLatency latency(latency_by_op_ms.GetScopedLatency("write_tree_head"));
   unique_lock<mutex> lock(lock_);
 
-  sqlite::Statement statement(db_,
+  sqlite::Statement statement(db_.get(),
                               "INSERT INTO trees(timestamp, sth) "
                               "VALUES(?, ?)");
   statement.BindUInt64(0, sth.timestamp());
@@ -360,11 +583,11 @@ Database::WriteResult SQLiteDB::WriteTreeHead_(const ct::SignedTreeHead& sth) {
 
   int r2 = statement.Step();
   if (r2 == SQLITE_CONSTRAINT) {
-    sqlite::Statement s2(db_,
+    sqlite::Statement s2(db_.get(),
                          "SELECT timestamp,sth FROM trees "
                          "WHERE timestamp = ?");
     s2.BindUInt64(0, sth.timestamp());
-    CHECK_EQ(SQLITE_ROW, s2.Step()) << sqlite3_errmsg(db_);
+    CHECK_EQ(SQLITE_ROW, s2.Step()) << sqlite3_errmsg(db_->db());
     string existing_sth_data;
     s2.GetBlob(1, &existing_sth_data);
     if (existing_sth_data == sth_data) {
@@ -373,7 +596,7 @@ Database::WriteResult SQLiteDB::WriteTreeHead_(const ct::SignedTreeHead& sth) {
     }
     return this->DUPLICATE_TREE_HEAD_TIMESTAMP;
   }
-  CHECK_EQ(SQLITE_DONE, r2) << sqlite3_errmsg(db_);
+  CHECK_EQ(SQLITE_DONE, r2) << sqlite3_errmsg(db_->db());
 
   EndTransaction(lock);
   BeginTransaction(lock);
@@ -390,34 +613,54 @@ Database::WriteResult SQLiteDB::WriteTreeHead_(const ct::SignedTreeHead& sth) {
 Database::LookupResult SQLiteDB::LatestTreeHead(
     ct::SignedTreeHead* result) const {
   ScopedLatency latency(latency_by_op_ms.GetScopedLatency("latest_tree_head"));
-  unique_lock<mutex> lock(lock_);
+  const ReadScope scope(this);
+
+  return LatestTreeHead(scope.connection(), result);
+}
+
 
-  return LatestTreeHeadNoLock(lock, result);
+vector<ct::SignedTreeHead> SQLiteDB::ScanTreeHeads() const {
+  ScopedLatency latency(latency_by_op_ms.GetScopedLatency("scan_tree_heads"));
+  const ReadScope scope(this);
+
+  sqlite::Statement statement(scope.connection(),
+                              "SELECT sth FROM trees ORDER BY timestamp");
+  vector<ct::SignedTreeHead> sths;
+  int ret;
+  string sth;
+  while ((ret = statement.Step()) == SQLITE_ROW) {
+    statement.GetBlob(0, &sth);
+    sths.emplace_back();
+    CHECK(sths.back().ParseFromString(sth));
+  }
+  CHECK_EQ(SQLITE_DONE, ret) << sqlite3_errmsg(scope.connection()->db());
+  return sths;
 }
 
 
 int64_t SQLiteDB::TreeSize() const {
   ScopedLatency latency(latency_by_op_ms.GetScopedLatency("tree_size"));
-  unique_lock<mutex> lock(lock_);
+  const ReadScope scope(this);
 
-  CHECK_GE(tree_size_, 0);
+  const int64_t start(scope.tree_size());
+  CHECK_GE(start, 0);
   sqlite::Statement statement(
-      db_,
+      scope.connection(),
       "SELECT sequence FROM leaves WHERE sequence >= ? ORDER BY sequence");
-  statement.BindUInt64(0, tree_size_);
+  statement.BindUInt64(0, start);
 
   int ret(statement.Step());
   while (ret == SQLITE_ROW) {
-    const sqlite3_uint64 sequence(statement.GetUInt64(0));
-
-    if (sequence != static_cast<uint64_t>(tree_size_)) {
+    const int64_t sequence(statement.GetUInt64(0));
+    MaybeAdvanceTreeSize(sequence);
+    // Another lookup may have advanced it further meanwhile.
+    if (tree_size_ <= sequence) {
       return tree_size_;
     }
 
-    ++tree_size_;
     ret = statement.Step();
   }
-  CHECK_EQ(SQLITE_DONE, ret) << sqlite3_errmsg(db_);
+  CHECK_EQ(SQLITE_DONE, ret) << sqlite3_errmsg(scope.connection()->db());
 
   return tree_size_;
 }
@@ -430,7 +673,7 @@ void SQLiteDB::AddNotifySTHCallback(
   callbacks_.Add(callback);
 
   ct::SignedTreeHead sth;
-  if (LatestTreeHeadNoLock(lock, &sth) == this->LOOKUP_OK) {
+  if (LatestTreeHead(db_.get(), &sth) == this->LOOKUP_OK) {
     // Do not call the callback while holding the lock, as they might
     // want to perform some lookups.
     lock.unlock();
@@ -456,11 +699,12 @@ void SQLiteDB::InitializeNode(const string& node_id) {
     LOG(FATAL) << "Attempting to initialize DB beloging to node with node_id: "
                << existing_id;
   }
-  sqlite::Statement statement(db_, "INSERT INTO node(node_id) VALUES(?)");
+  sqlite::Statement statement(db_.get(),
+                              "INSERT INTO node(node_id) VALUES(?)");
   statement.BindBlob(0, node_id);
 
   const int result(statement.Step());
-  CHECK_EQ(SQLITE_DONE, result) << sqlite3_errmsg(db_);
+  CHECK_EQ(SQLITE_DONE, result) << sqlite3_errmsg(db_->db());
 }
 
 
@@ -475,30 +719,71 @@ Database::LookupResult SQLiteDB::NodeId(const unique_lock<mutex>& lock,
   ScopedLatency latency(latency_by_op_ms.GetScopedLatency("set_node_id"));
   CHECK(lock.owns_lock());
   CHECK_NOTNULL(node_id);
-  sqlite::Statement statement(db_, "SELECT node_id FROM node");
+  sqlite::Statement statement(db_.get(), "SELECT node_id FROM node");
 
   int result(statement.Step());
   if (result == SQLITE_DONE) {
     return this->NOT_FOUND;
   }
-  CHECK_EQ(SQLITE_ROW, result) << sqlite3_errmsg(db_);
+  CHECK_EQ(SQLITE_ROW, result) << sqlite3_errmsg(db_->db());
 
   statement.GetBlob(0, node_id);
   result = statement.Step();
   // There can only be one!
-  CHECK_EQ(SQLITE_DONE, result) << sqlite3_errmsg(db_);
+  CHECK_EQ(SQLITE_DONE, result) << sqlite3_errmsg(db_->db());
   return this->LOOKUP_OK;
 }
 
 
+void SQLiteDB::MaybeAddLeafHashes(const unique_lock<mutex>& lock) {
+  CHECK(lock.owns_lock());
+  {
+    sqlite::Statement statement(db_.get(),
+                                "SELECT name FROM sqlite_master "
+                                "WHERE type = 'table' AND "
+                                "name = 'leaf_hashes'");
+    if (statement.Step() == SQLITE_ROW) {
+      return;
+    }
+  }
+
+  LOG(INFO) << "Storing the leaf hashes of existing entries";
+  // Until this is committed, only |db_| has the table.
+  uncommitted_ = true;
+  {
+    sqlite::Statement statement(db_.get(), kCreateLeafHashesTable);
+    CHECK_EQ(SQLITE_DONE, statement.Step()) << sqlite3_errmsg(db_->db());
+  }
+  sqlite::Statement select(db_.get(),
+                           "SELECT entry, sequence FROM leaves "
+                           "WHERE sequence IS NOT NULL");
+  int ret;
+  while ((ret = select.Step()) == SQLITE_ROW) {
+    string data;
+    select.GetBlob(0, &data);
+    LoggedEntry logged;
+    CHECK(logged.ParseFromDatabase(data));
+
+    sqlite::Statement insert(db_.get(),
+                             "INSERT INTO leaf_hashes(sequence, hash) "
+                             "VALUES(?, ?)");
+    const string leaf_hash(logged.MerkleLeafHash());
+    insert.BindUInt64(0, select.GetUInt64(1));
+    insert.BindBlob(1, leaf_hash);
+    CHECK_EQ(SQLITE_DONE, insert.Step()) << sqlite3_errmsg(db_->db());
+  }
+  CHECK_EQ(SQLITE_DONE, ret) << sqlite3_errmsg(db_->db());
+}
+
+
 void SQLiteDB::BeginTransaction(const unique_lock<mutex>& lock) {
   CHECK(lock.owns_lock());
   if (FLAGS_sqlite_batch_into_transactions) {
     CHECK_EQ(0, transaction_size_);
     CHECK(!in_transaction_);
     VLOG(1) << "Beginning new transaction.";
-    sqlite::Statement s(db_, "BEGIN TRANSACTION");
-    CHECK_EQ(SQLITE_DONE, s.Step()) << sqlite3_errmsg(db_);
+    sqlite::Statement s(db_.get(), "BEGIN TRANSACTION");
+    CHECK_EQ(SQLITE_DONE, s.Step()) << sqlite3_errmsg(db_->db());
     in_transaction_ = true;
   }
 }
@@ -510,13 +795,14 @@ void SQLiteDB::EndTransaction(const unique_lock<mutex>& lock) {
     CHECK(in_transaction_);
     VLOG(1) << "Committing transaction.";
     {
-      sqlite::Statement s(db_, "END TRANSACTION");
-      CHECK_EQ(SQLITE_DONE, s.Step()) << sqlite3_errmsg(db_);
+      sqlite::Statement s(db_.get(), "END TRANSACTION");
+      CHECK_EQ(SQLITE_DONE, s.Step()) << sqlite3_errmsg(db_->db());
     }
+    uncommitted_ = false;
     {
-      sqlite::Statement s(db_, "PRAGMA wal_checkpoint(TRUNCATE)");
-      CHECK_EQ(SQLITE_ROW, s.Step()) << sqlite3_errmsg(db_);
-      CHECK_EQ(SQLITE_DONE, s.Step()) << sqlite3_errmsg(db_);
+      sqlite::Statement s(db_.get(), "PRAGMA wal_checkpoint(TRUNCATE)");
+      CHECK_EQ(SQLITE_ROW, s.Step()) << sqlite3_errmsg(db_->db());
+      CHECK_EQ(SQLITE_DONE, s.Step()) << sqlite3_errmsg(db_->db());
     }
 
     transaction_size_ = 0;
@@ -542,7 +828,7 @@ void SQLiteDB::ForceNotifySTH() {
 
   ct::SignedTreeHead sth;
   const Database::LookupResult db_result =
-      this->LatestTreeHeadNoLock(lock, &sth);
+      this->LatestTreeHead(db_.get(), &sth);
   if (db_result == Database::NOT_FOUND) {
     return;
   }
@@ -556,10 +842,9 @@ void SQLiteDB::ForceNotifySTH() {
 }
 
 
-Database::LookupResult SQLiteDB::LatestTreeHeadNoLock(
-    const unique_lock<mutex>& lock, ct::SignedTreeHead* result) const {
-  CHECK(lock.owns_lock());
-  sqlite::Statement statement(db_,
+Database::LookupResult SQLiteDB::LatestTreeHead(
+    sqlite::Connection* db, ct::SignedTreeHead* result) const {
+  sqlite::Statement statement(db,
                               "SELECT sth FROM trees WHERE timestamp IN "
                               "(SELECT MAX(timestamp) FROM trees)");
 
@@ -567,7 +852,7 @@ Database::LookupResult SQLiteDB::LatestTreeHeadNoLock(
   if (ret == SQLITE_DONE) {
     return this->NOT_FOUND;
   }
-  CHECK_EQ(SQLITE_ROW, ret) << sqlite3_errmsg(db_);
+  CHECK_EQ(SQLITE_ROW, ret) << sqlite3_errmsg(db->db());
 
   string sth;
   statement.GetBlob(0, &sth);
@@ -577,4 +862,41 @@ Database::LookupResult SQLiteDB::LatestTreeHeadNoLock(
 }
 
 
+void SQLiteDB::EndWrite(const unique_lock<mutex>& lock) {
+  CHECK(lock.owns_lock());
+  // Otherwise, it will be committed with the transaction.
+  if (!in_transaction_) {
+    uncommitted_ = false;
+  }
+}
+
+
+void SQLiteDB::MaybeAdvanceTreeSize(int64_t sequence_number) const {
+  int64_t expected(sequence_number);
+  tree_size_.compare_exchange_strong(expected, sequence_number + 1);
+}
+
+
+unique_ptr<sqlite::Connection> SQLiteDB::GetReader() const {
+  lock_guard<mutex> lock(readers_lock_);
+  if (!idle_readers_.empty()) {
+    unique_ptr<sqlite::Connection> reader(move(idle_readers_.back()));
+    idle_readers_.pop_back();
+    return reader;
+  }
+  if (num_readers_ >= max_readers_) {
+    return nullptr;
+  }
+  ++num_readers_;
+  return unique_ptr<sqlite::Connection>(
+      new sqlite::Connection(SQLiteOpenReadOnly(dbfile_)));
+}
+
+
+void SQLiteDB::ReturnReader(unique_ptr<sqlite::Connection> reader) const {
+  lock_guard<mutex> lock(readers_lock_);
+  idle_readers_.emplace_back(move(reader));
+}
+
+
 }  // namespace cert_trans
@@ -2,18 +2,30 @@
 #ifndef SQLITE_DB_H
 #define SQLITE_DB_H
 
+#include <atomic>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/database.h"
 #include "log/logged_entry.h"
 
-struct sqlite3;
+namespace sqlite {
+class Connection;
+}  // namespace sqlite
 
 namespace cert_trans {
 
 
+// Writes go through one read-write connection, under a lock. In WAL
+// mode, lookups instead use a pool of read-only connections, so that
+// they run concurrently with each other and with writes, except while
+// the read-write connection has writes that are not committed yet,
+// which only it can see. Each connection keeps its prepared statements.
+
+
 class SQLiteDB : public Database {
  public:
   explicit SQLiteDB(const std::string& dbfile);
@@ -25,6 +37,9 @@ class SQLiteDB : public Database {
 
   WriteResult CreateSequencedEntry_(const LoggedEntry& logged) override;
 
+  WriteResult CreateSequencedEntries_(const std::vector<LoggedEntry>& logged,
+                                      size_t* num_created) override;
+
   LookupResult LookupByHash(const std::string& hash,
                             LoggedEntry* result) const override;
 
@@ -34,10 +49,18 @@ class SQLiteDB : public Database {
   std::unique_ptr<Database::Iterator> ScanEntries(
       int64_t start_index) const override;
 
+  std::unique_ptr<Database::Iterator> ScanRange(int64_t start,
+                                                int64_t end) const override;
+
+  std::unique_ptr<Database::LeafHashIterator> ScanLeafHashes(
+      int64_t start_index) const override;
+
   WriteResult WriteTreeHead_(const ct::SignedTreeHead& sth) override;
 
   LookupResult LatestTreeHead(ct::SignedTreeHead* result) const override;
 
+  std::vector<ct::SignedTreeHead> ScanTreeHeads() const override;
+
   int64_t TreeSize() const override;
 
   void AddNotifySTHCallback(
@@ -56,17 +79,23 @@ class SQLiteDB : public Database {
 
  private:
   class Iterator;
+  class LeafHashIterator;
+  class ReadScope;
+
+  // Creates and fills the leaf_hashes table if this database was
+  // written before leaf hashes were stored.
+  void MaybeAddLeafHashes(const std::unique_lock<std::mutex>& lock);
+
+  // Inserts |logged| in the current transaction.
+  WriteResult WriteSequencedEntry(const std::unique_lock<std::mutex>& lock,
+                                  const LoggedEntry& logged);
 
-  LookupResult LookupByIndex(const std::unique_lock<std::mutex>& lock,
-                             int64_t sequence_number,
+  // These look up on |db|, which is either a read-only connection, or
+  // |db_| with |lock_| held.
+  LookupResult LookupByIndex(sqlite::Connection* db, int64_t sequence_number,
                              LoggedEntry* result) const;
-  // This finds the next entry with a sequence number equal or greater
-  // to the one specified.
-  LookupResult LookupNextIndex(const std::unique_lock<std::mutex>& lock,
-                               int64_t sequence_number,
-                               LoggedEntry* result) const;
-  LookupResult LatestTreeHeadNoLock(const std::unique_lock<std::mutex>& lock,
-                                    ct::SignedTreeHead* result) const;
+  LookupResult LatestTreeHead(sqlite::Connection* db,
+                              ct::SignedTreeHead* result) const;
   LookupResult NodeId(const std::unique_lock<std::mutex>& lock,
                       std::string* node_id);
 
@@ -76,14 +105,36 @@ class SQLiteDB : public Database {
 
   void MaybeStartNewTransaction(const std::unique_lock<std::mutex>& lock);
 
+  // Called at the end of each write, which may have been committed.
+  void EndWrite(const std::unique_lock<std::mutex>& lock);
+
+  // Advances |tree_size_| if |sequence_number| is the entry at its end.
+  void MaybeAdvanceTreeSize(int64_t sequence_number) const;
+
+  // Returns an idle read-only connection, opening one if there are not
+  // too many yet, or null.
+  std::unique_ptr<sqlite::Connection> GetReader() const;
+  void ReturnReader(std::unique_ptr<sqlite::Connection> reader) const;
+
+  const std::string dbfile_;
   mutable std::mutex lock_;
-  sqlite3* const db_;
+  const std::unique_ptr<sqlite::Connection> db_;
   // This is marked mutable, as it is a lazily updated cache updated
-  // from some of the getters.
-  mutable int64_t tree_size_;
+  // from some of the getters, which may not be holding |lock_|.
+  mutable std::atomic<int64_t> tree_size_;
   DatabaseNotifierHelper callbacks_;
   int64_t transaction_size_;
   bool in_transaction_;
+  // Whether |db_| has written anything not committed yet, during which
+  // lookups must use it too. It is set before anything is written, and
+  // cleared after it is committed, so that readers can check it without
+  // |lock_|.
+  std::atomic<bool> uncommitted_;
+
+  const int max_readers_;
+  mutable std::mutex readers_lock_;
+  mutable std::vector<std::unique_ptr<sqlite::Connection>> idle_readers_;
+  mutable int num_readers_;
 
   DISALLOW_COPY_AND_ASSIGN(SQLiteDB);
 };
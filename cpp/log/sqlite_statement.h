@@ -5,26 +5,103 @@
 
 #include <glog/logging.h>
 #include <sqlite3.h>
+#include <string.h>
+#include <functional>
 #include <string>
+#include <unordered_map>
 
 #include "base/macros.h"
 
 namespace sqlite {
 
+
+inline sqlite3_stmt* Prepare(sqlite3* db, const char* sql) {
+  sqlite3_stmt* stmt(NULL);
+  int ret = sqlite3_prepare_v2(db, sql, -1, &stmt, NULL);
+  if (ret != SQLITE_OK)
+    LOG(ERROR) << "ret = " << ret << ", err = " << sqlite3_errmsg(db)
+               << ", sql = " << sql << std::endl;
+
+  CHECK_EQ(SQLITE_OK, ret);
+  return stmt;
+}
+
+
+// An open database, along with the statements that have been run on
+// it, which are prepared the first time and then kept for reuse.
+class Connection {
+ public:
+  // Takes ownership of |db|.
+  explicit Connection(sqlite3* db) : db_(CHECK_NOTNULL(db)) {
+  }
+
+  // The same, with the SQL of each statement passed through |rewrite|
+  // before it is prepared, such as to put in the names of the tables.
+  Connection(sqlite3* db,
+             const std::function<std::string(const char*)>& rewrite)
+      : db_(CHECK_NOTNULL(db)), rewrite_(rewrite) {
+  }
+
+  ~Connection() {
+    for (const auto& statement : statements_) {
+      sqlite3_finalize(statement.second);
+    }
+    CHECK_EQ(SQLITE_OK, sqlite3_close(db_)) << sqlite3_errmsg(db_);
+  }
+
+  sqlite3* db() const {
+    return db_;
+  }
+
+ private:
+  friend class Statement;
+
+  // The statements are looked up by the address of their SQL, which
+  // must therefore be a string literal.
+  sqlite3_stmt* GetStatement(const char* sql) {
+    sqlite3_stmt*& stmt(statements_[sql]);
+    if (!stmt) {
+      stmt = Prepare(db_, rewrite_ ? rewrite_(sql).c_str() : sql);
+    }
+    DCHECK_EQ(rewrite_ ? rewrite_(sql) : std::string(sql), sqlite3_sql(stmt))
+        << sql;
+    // A statement cannot be run again while it is still running.
+    CHECK(!sqlite3_stmt_busy(stmt)) << sql;
+    return stmt;
+  }
+
+  sqlite3* const db_;
+  const std::function<std::string(const char*)> rewrite_;
+  std::unordered_map<const char*, sqlite3_stmt*> statements_;
+
+  DISALLOW_COPY_AND_ASSIGN(Connection);
+};
+
+
 // Reduce the ugliness of the sqlite3 API.
 class Statement {
  public:
-  Statement(sqlite3* db, const char* sql) : stmt_(NULL) {
-    int ret = sqlite3_prepare_v2(db, sql, -1, &stmt_, NULL);
-    if (ret != SQLITE_OK)
-      LOG(ERROR) << "ret = " << ret << ", err = " << sqlite3_errmsg(db)
-                 << ", sql = " << sql << std::endl;
+  // A statement prepared just for this once, for SQL put together at
+  // run time.
+  Statement(sqlite3* db, const char* sql)
+      : stmt_(Prepare(db, sql)), cached_(false) {
+  }
 
-    CHECK_EQ(SQLITE_OK, ret);
+  // A statement of |db|'s, prepared the first time |sql| (a string
+  // literal) is run, and reset afterwards for the next time.
+  Statement(Connection* db, const char* sql)
+      : stmt_(CHECK_NOTNULL(db)->GetStatement(sql)), cached_(true) {
   }
 
   ~Statement() {
-    int ret = sqlite3_finalize(stmt_);
+    int ret;
+    if (cached_) {
+      ret = sqlite3_reset(stmt_);
+      // Let go of the bound values, which do not outlive us.
+      sqlite3_clear_bindings(stmt_);
+    } else {
+      ret = sqlite3_finalize(stmt_);
+    }
     // can get SQLITE_CONSTRAINT if an insert failed due to a duplicate key.
     CHECK(ret == SQLITE_OK || ret == SQLITE_CONSTRAINT);
   }
@@ -61,7 +138,8 @@ class Statement {
   }
 
  private:
-  sqlite3_stmt* stmt_;
+  sqlite3_stmt* const stmt_;
+  const bool cached_;
 
   DISALLOW_COPY_AND_ASSIGN(Statement);
 };
@@ -35,13 +35,13 @@ util::Status StrictConsistentStore<Logged>::SetServingSTH(
 
 
 template <class Logged>
-util::Status StrictConsistentStore<Logged>::UpdateSequenceMapping(
-    EntryHandle<ct::SequenceMapping>* entry) {
+util::Status StrictConsistentStore<Logged>::AddSequenceMappings(
+    const ct::SequenceMapping& mappings) {
   if (!election_->IsMaster()) {
     return util::Status(util::error::PERMISSION_DENIED,
                         "Not currently master.");
   }
-  return peer_->UpdateSequenceMapping(entry);
+  return peer_->AddSequenceMappings(mappings);
 }
 
 
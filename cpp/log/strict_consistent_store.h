@@ -29,8 +29,8 @@ class StrictConsistentStore : public ConsistentStore<Logged> {
 
   util::Status SetServingSTH(const ct::SignedTreeHead& new_sth) override;
 
-  util::Status UpdateSequenceMapping(
-      EntryHandle<ct::SequenceMapping>* entry) override;
+  util::Status AddSequenceMappings(
+      const ct::SequenceMapping& mappings) override;
 
   util::Status SetClusterConfig(const ct::ClusterConfig& config) override;
 
@@ -46,6 +46,17 @@ class StrictConsistentStore : public ConsistentStore<Logged> {
     return peer_->AddPendingEntry(entry);
   }
 
+  void AddPendingEntries(const std::vector<Logged*>& entries,
+                         std::vector<util::Status>* statuses) override {
+    peer_->AddPendingEntries(entries, statuses);
+  }
+
+  void AddPendingEntriesAsync(const std::vector<Logged*>& entries,
+                              std::vector<util::Status>* statuses,
+                              util::Task* task) override {
+    peer_->AddPendingEntriesAsync(entries, statuses, task);
+  }
+
   util::Status GetPendingEntryForHash(
       const std::string& hash, EntryHandle<Logged>* entry) const override {
     return peer_->GetPendingEntryForHash(hash, entry);
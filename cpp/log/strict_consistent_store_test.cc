@@ -83,16 +83,16 @@ TEST_P(StrictConsistentStoreTest, TestSetServingSTH) {
 }
 
 
-TEST_P(StrictConsistentStoreTest, TestUpdateSequenceMapping) {
+TEST_P(StrictConsistentStoreTest, TestAddSequenceMappings) {
   if (IsMaster()) {
-    EXPECT_CALL(*peer_, UpdateSequenceMapping(_))
+    EXPECT_CALL(*peer_, AddSequenceMappings(_))
         .WillOnce(Return(util::Status::OK));
   } else {
-    EXPECT_CALL(*peer_, UpdateSequenceMapping(_)).Times(0);
+    EXPECT_CALL(*peer_, AddSequenceMappings(_)).Times(0);
   }
 
-  EntryHandle<SequenceMapping> mapping;
-  util::Status status(strict_store_.UpdateSequenceMapping(&mapping));
+  SequenceMapping mapping;
+  util::Status status(strict_store_.AddSequenceMappings(mapping));
 
   if (IsMaster()) {
     EXPECT_TRUE(status.ok());
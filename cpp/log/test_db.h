@@ -7,8 +7,11 @@
 #include "log/database.h"
 #include "log/file_db.h"
 #include "log/file_storage.h"
+#include "log/hash_filtered_database.h"
 #include "log/leveldb_db.h"
 #include "log/logged_entry.h"
+#include "log/monitored_database.h"
+#include "log/segmented_file_db.h"
 #include "log/sqlite_db.h"
 #include "util/test_db.h"
 
@@ -41,6 +44,31 @@ cert_trans::FileDB* TestDB<cert_trans::FileDB>::SecondDB() {
       new cert_trans::FileStorage(meta_dir, 0));
 }
 
+template <>
+void TestDB<cert_trans::SegmentedFileDB>::Setup() {
+  std::string tree_dir = tmp_.TmpStorageDir() + "/tree";
+  std::string meta_dir = tmp_.TmpStorageDir() + "/meta";
+  CHECK_ERR(mkdir(tree_dir.c_str(), 0700));
+  CHECK_ERR(mkdir(meta_dir.c_str(), 0700));
+
+  db_.reset(new cert_trans::SegmentedFileDB(
+      tmp_.TmpStorageDir() + "/segments",
+      new cert_trans::FileStorage(tree_dir, kTreeStorageDepth),
+      new cert_trans::FileStorage(meta_dir, 0)));
+}
+
+template <>
+cert_trans::SegmentedFileDB* TestDB<cert_trans::SegmentedFileDB>::SecondDB() {
+  // Two databases appending to the same segments would corrupt them, so
+  // close the original.
+  db_.reset();
+  return new cert_trans::SegmentedFileDB(
+      tmp_.TmpStorageDir() + "/segments",
+      new cert_trans::FileStorage(tmp_.TmpStorageDir() + "/tree",
+                                  kTreeStorageDepth),
+      new cert_trans::FileStorage(tmp_.TmpStorageDir() + "/meta", 0));
+}
+
 template <>
 void TestDB<cert_trans::SQLiteDB>::Setup() {
   db_.reset(new cert_trans::SQLiteDB(tmp_.TmpStorageDir() + "/sqlite"));
@@ -64,6 +92,42 @@ cert_trans::LevelDB* TestDB<cert_trans::LevelDB>::SecondDB() {
   return new cert_trans::LevelDB(tmp_.TmpStorageDir() + "/leveldb");
 }
 
+template <>
+void TestDB<cert_trans::MonitoredDatabase>::Setup() {
+  db_.reset(new cert_trans::MonitoredDatabase(
+      "leveldb", std::unique_ptr<cert_trans::Database>(new cert_trans::LevelDB(
+                     tmp_.TmpStorageDir() + "/leveldb"))));
+}
+
+template <>
+cert_trans::MonitoredDatabase*
+TestDB<cert_trans::MonitoredDatabase>::SecondDB() {
+  // Wraps a LevelDB, so see above.
+  db_.reset();
+  return new cert_trans::MonitoredDatabase(
+      "leveldb", std::unique_ptr<cert_trans::Database>(new cert_trans::LevelDB(
+                     tmp_.TmpStorageDir() + "/leveldb")));
+}
+
+template <>
+void TestDB<cert_trans::HashFilteredDatabase>::Setup() {
+  db_.reset(new cert_trans::HashFilteredDatabase(
+      std::unique_ptr<cert_trans::Database>(
+          new cert_trans::LevelDB(tmp_.TmpStorageDir() + "/leveldb")),
+      1 << 20));
+}
+
+template <>
+cert_trans::HashFilteredDatabase*
+TestDB<cert_trans::HashFilteredDatabase>::SecondDB() {
+  // Wraps a LevelDB, so see above.
+  db_.reset();
+  return new cert_trans::HashFilteredDatabase(
+      std::unique_ptr<cert_trans::Database>(
+          new cert_trans::LevelDB(tmp_.TmpStorageDir() + "/leveldb")),
+      1 << 20);
+}
+
 // Not a Database; we just use the same template for setup.
 template <>
 void TestDB<cert_trans::FileStorage>::Setup() {
@@ -0,0 +1,186 @@
+#include "log/tiles.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::to_string;
+
+namespace cert_trans {
+
+namespace {
+
+
+// Creates |path| and any missing parent directories.
+bool MakeDirs(const string& path) {
+  for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+    const string dir(path.substr(0, slash));
+    if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+      PLOG(WARNING) << "mkdir " << dir;
+      return false;
+    }
+    if (slash == string::npos)
+      return true;
+  }
+}
+
+
+bool FileExists(const string& path) {
+  struct stat st;
+  return stat(path.c_str(), &st) == 0;
+}
+
+
+// Writes |contents| to |path| atomically, so that a file server never
+// sees a truncated tile.
+bool WriteFileAtomically(const string& path, const string& contents) {
+  const string tmp_path(path + ".tmp");
+  const int fd(open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+  if (fd < 0) {
+    PLOG(WARNING) << "open " << tmp_path;
+    return false;
+  }
+  const bool written(write(fd, contents.data(), contents.size()) ==
+                     static_cast<ssize_t>(contents.size()));
+  PCHECK(close(fd) == 0);
+  return written && rename(tmp_path.c_str(), path.c_str()) == 0;
+}
+
+
+}  // namespace
+
+
+string TilePath(size_t level, size_t index, size_t width) {
+  CHECK_GT(width, 0U);
+  CHECK_LE(width, kTileWidth);
+
+  // The index is split into groups of three digits, all but the last of
+  // which are prefixed with "x", so that no directory gets too large.
+  string index_path;
+  char group[8];
+  snprintf(group, sizeof(group), "%03zu", index % 1000);
+  index_path = group;
+  for (index /= 1000; index > 0; index /= 1000) {
+    snprintf(group, sizeof(group), "x%03zu/", index % 1000);
+    index_path = group + index_path;
+  }
+
+  string path("tile/" + to_string(kTileHeight) + "/" + to_string(level) +
+              "/" + index_path);
+  if (width < kTileWidth) {
+    path += ".p/" + to_string(width);
+  }
+  return path;
+}
+
+
+LogLookup::LookupResult ReadTile(LogLookup* lookup, size_t level,
+                                 size_t index, size_t width, string* tile) {
+  CHECK_NOTNULL(lookup);
+  if (width == 0 || width > kTileWidth) {
+    return LogLookup::NOT_FOUND;
+  }
+  tile->clear();
+  return lookup->CompleteSubtreeRoots(level * kTileHeight, index * kTileWidth,
+                                      width, tile);
+}
+
+
+TileExporter::TileExporter(LogLookup* lookup, const string& dir)
+    : lookup_(CHECK_NOTNULL(lookup)), dir_(dir) {
+  CHECK(MakeDirs(dir_)) << "Failed to create " << dir_;
+}
+
+
+util::Status TileExporter::Export(size_t tree_size) {
+  lock_guard<mutex> lock(lock_);
+  for (size_t level = 0; (tree_size >> (level * kTileHeight)) > 0; ++level) {
+    if (full_tiles_.size() <= level) {
+      full_tiles_.push_back(0);
+    }
+
+    const size_t nodes(tree_size >> (level * kTileHeight));
+    for (; full_tiles_[level] < nodes / kTileWidth; ++full_tiles_[level]) {
+      const util::Status status(
+          WriteTile(level, full_tiles_[level], kTileWidth));
+      if (!status.ok()) {
+        return status;
+      }
+    }
+
+    if (nodes % kTileWidth != 0) {
+      const util::Status status(
+          WriteTile(level, nodes / kTileWidth, nodes % kTileWidth));
+      if (!status.ok()) {
+        return status;
+      }
+    }
+  }
+  return util::Status::OK;
+}
+
+
+util::Status TileExporter::WriteTile(size_t level, size_t index,
+                                     size_t width) {
+  const string path(dir_ + "/" + TilePath(level, index, width));
+  // Tiles never change, so there is nothing to do if it was written
+  // before, e.g. by a previous run.
+  if (FileExists(path)) {
+    return util::Status::OK;
+  }
+
+  string tile;
+  if (ReadTile(lookup_, level, index, width, &tile) != LogLookup::OK) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "tree too small for tile " + path);
+  }
+  if (!MakeDirs(path.substr(0, path.rfind('/'))) ||
+      !WriteFileAtomically(path, tile)) {
+    return util::Status(util::error::INTERNAL, "failed to write " + path);
+  }
+  RemovePartialTiles(level, index, width);
+  return util::Status::OK;
+}
+
+
+void TileExporter::RemovePartialTiles(size_t level, size_t index,
+                                      size_t width) {
+  const string partial_path(dir_ + "/" + TilePath(level, index, 1));
+  const string partial_dir(partial_path.substr(0, partial_path.rfind('/')));
+  DIR* const dir(opendir(partial_dir.c_str()));
+  if (!dir) {
+    if (errno != ENOENT) {
+      PLOG(WARNING) << "opendir " << partial_dir;
+    }
+    return;
+  }
+  while (const struct dirent* const entry = readdir(dir)) {
+    // Leaves alone anything that is not a tile, such as "." and "..".
+    char* end;
+    const unsigned long tile_width(strtoul(entry->d_name, &end, 10));
+    if (end == entry->d_name || *end != '\0' || tile_width >= width) {
+      continue;
+    }
+    const string path(partial_dir + "/" + entry->d_name);
+    if (unlink(path.c_str()) != 0) {
+      PLOG(WARNING) << "unlink " << path;
+    }
+  }
+  PCHECK(closedir(dir) == 0);
+  // There are no partial tiles left once the tile is full.
+  if (width == kTileWidth && rmdir(partial_dir.c_str()) != 0) {
+    PLOG(WARNING) << "rmdir " << partial_dir;
+  }
+}
+
+
+}  // namespace cert_trans
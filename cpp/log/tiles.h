@@ -0,0 +1,83 @@
+#ifndef CERT_TRANS_LOG_TILES_H_
+#define CERT_TRANS_LOG_TILES_H_
+
+#include <stddef.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/log_lookup.h"
+#include "util/status.h"
+
+namespace cert_trans {
+
+
+// Tiles are static slices of the Merkle tree, which can be served from
+// a CDN or any plain file server. Clients fetch the tiles they need and
+// compute audit and consistency proofs themselves.
+//
+// The tile at tile level L and index N holds up to kTileWidth
+// consecutive nodes of tree level L * kTileHeight, starting at node
+// N * kTileWidth, where tree level 0 holds the leaf hashes. Its nodes
+// are the roots of complete subtrees, so the content of a tile of a
+// given width never changes once it exists. The rightmost tile of each
+// tile level is usually partial, with fewer than kTileWidth nodes.
+//
+// The layout is the same as the Go checksum database ("tlog") tiles.
+const size_t kTileHeight = 8;
+const size_t kTileWidth = 1 << kTileHeight;
+
+
+// The relative path of a tile of |width| nodes, e.g.
+// "tile/8/0/x001/x234/067" for the full tile at level 0, index 1234067,
+// and "tile/8/1/012.p/7" for a partial one with 7 nodes.
+std::string TilePath(size_t level, size_t index, size_t width);
+
+
+// Reads the concatenated nodes of a tile. Returns NOT_FOUND if the tree
+// is not large enough for the tile to exist with that |width|, which
+// must be between 1 and kTileWidth.
+LogLookup::LookupResult ReadTile(LogLookup* lookup, size_t level,
+                                 size_t index, size_t width,
+                                 std::string* tile);
+
+
+// Writes tiles to a directory as the tree grows, typically from a
+// LogLookup::UpdateCallback. Full tiles are only written once. Only the
+// widest partial tile of each tile index is kept, and none once the tile
+// is full: those written for older tree sizes are removed as they are
+// superseded. Clients holding an older tree head read the nodes they
+// need from the start of the wider tile, which are the same.
+//
+// This class is thread-safe.
+class TileExporter {
+ public:
+  // Does not take ownership of |lookup|, which must outlive this
+  // instance. |dir| is created if needed.
+  TileExporter(LogLookup* lookup, const std::string& dir);
+
+  // Writes all the tiles of the tree of |tree_size| leaves which are not
+  // already in the directory.
+  util::Status Export(size_t tree_size);
+
+ private:
+  util::Status WriteTile(size_t level, size_t index, size_t width);
+  // Removes the partial tiles at |level| and |index| narrower than
+  // |width|, along with their directory if |width| is a full tile.
+  void RemovePartialTiles(size_t level, size_t index, size_t width);
+
+  LogLookup* const lookup_;
+  const std::string dir_;
+
+  std::mutex lock_;
+  // Number of full tiles written so far for each tile level.
+  std::vector<size_t> full_tiles_;
+
+  DISALLOW_COPY_AND_ASSIGN(TileExporter);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_TILES_H_
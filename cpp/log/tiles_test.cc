@@ -0,0 +1,28 @@
+#include <gtest/gtest.h>
+#include <string>
+
+#include "log/tiles.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+
+TEST(TilesTest, TilePath) {
+  EXPECT_EQ("tile/8/0/000", TilePath(0, 0, kTileWidth));
+  EXPECT_EQ("tile/8/0/999", TilePath(0, 999, kTileWidth));
+  EXPECT_EQ("tile/8/1/x001/000", TilePath(1, 1000, kTileWidth));
+  EXPECT_EQ("tile/8/0/x001/x234/067", TilePath(0, 1234067, kTileWidth));
+  EXPECT_EQ("tile/8/1/012.p/7", TilePath(1, 12, 7));
+  EXPECT_EQ("tile/8/2/x005/000.p/255", TilePath(2, 5000, 255));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
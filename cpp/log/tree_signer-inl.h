@@ -4,32 +4,51 @@
 
 #include "log/tree_signer.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <stdint.h>
 #include <algorithm>
 #include <chrono>
+#include <iterator>
+#include <memory>
 #include <set>
 #include <unordered_map>
+#include <vector>
 
 #include "log/database.h"
 #include "log/log_signer.h"
+#include "monitoring/latency.h"
+#include "monitoring/monitoring.h"
 #include "proto/serializer.h"
 #include "util/status.h"
 #include "util/util.h"
 
+DECLARE_int32(sequence_batch_max_entries);
 
-namespace cert_trans {
+DECLARE_int32(sequence_batch_max_bytes);
+
+DECLARE_double(sequence_batch_target_seconds);
 
 
+namespace cert_trans {
 namespace {
 
 
-bool LessThanBySequence(const ct::SequenceMapping::Mapping& lhs,
-                        const ct::SequenceMapping::Mapping& rhs) {
-  CHECK(lhs.has_sequence_number());
-  CHECK(rhs.has_sequence_number());
-  return lhs.sequence_number() < rhs.sequence_number();
-}
+static Latency<std::chrono::milliseconds> entry_inclusion_latency_ms(
+    "entry_inclusion_latency_ms",
+    "Time from the SCT timestamp of an entry until it was first covered by "
+    "a locally signed tree head.");
+
+static Gauge<>* sequence_batch_size(Gauge<>::New(
+    "sequence_batch_size",
+    "Largest number of new entries sequenced in one round at the moment."));
+
+// Smallest batch size the writes of sequence mappings can bring it down
+// to.
+const int64_t kMinSequenceBatchSize = 100;
+// Bytes of a single mapping in a SequenceMapping, on top of its own: the
+// tag and the length of the field.
+const int64_t kSequenceMappingOverhead = 2;
 
 
 }  // namespace
@@ -68,7 +87,9 @@ TreeSigner<Logged>::TreeSigner(
       db_(db),
       consistent_store_(consistent_store),
       signer_(signer),
+      sequence_batch_size_(FLAGS_sequence_batch_max_entries),
       cert_tree_(std::move(merkle_tree)),
+      max_leaf_timestamp_(0),
       latest_tree_head_() {
   CHECK(cert_tree_);
   // Try to get any STH previously published by this node.
@@ -84,12 +105,66 @@ TreeSigner<Logged>::TreeSigner(
 }
 
 
+// static
+template <class Logged>
+std::unique_ptr<CompactMerkleTree> TreeSigner<Logged>::TreeOfLatestSTH(
+    const ReadOnlyDatabase* db, SerialHasher* hasher) {
+  std::unique_ptr<SerialHasher> owned_hasher(hasher);
+  ct::SignedTreeHead sth;
+  if (db->LatestTreeHead(&sth) != Database::LOOKUP_OK ||
+      sth.tree_size() > db->TreeSize()) {
+    return nullptr;
+  }
+
+  // There is one root for each bit set in the tree size.
+  int num_roots(0);
+  for (uint64_t bits = sth.tree_size(); bits != 0; bits >>= 1) {
+    num_roots += bits & 1;
+  }
+  if (sth.subtree_roots_size() != num_roots) {
+    return nullptr;
+  }
+  for (const std::string& root : sth.subtree_roots()) {
+    if (root.size() != owned_hasher->DigestSize()) {
+      return nullptr;
+    }
+  }
+
+  std::unique_ptr<CompactMerkleTree> tree(new CompactMerkleTree(
+      sth.tree_size(),
+      std::vector<std::string>(sth.subtree_roots().begin(),
+                               sth.subtree_roots().end()),
+      owned_hasher.release()));
+  if (tree->CurrentRoot() != sth.sha256_root_hash()) {
+    LOG(WARNING) << "Subtree roots of the tree head of size "
+                 << sth.tree_size() << " do not match its root hash";
+    return nullptr;
+  }
+  return tree;
+}
+
+
 template <class Logged>
 uint64_t TreeSigner<Logged>::LastUpdateTime() const {
+  std::lock_guard<std::mutex> lock(mutex_);
   return latest_tree_head_.timestamp();
 }
 
 
+template <class Logged>
+int64_t TreeSigner<Logged>::NumUnsignedEntries() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return unsigned_leaf_timestamps_.size();
+}
+
+
+template <class Logged>
+ct::SignedTreeHead TreeSigner<Logged>::LatestSTH() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return latest_tree_head_;
+}
+
+
 template <class Logged>
 util::Status TreeSigner<Logged>::SequenceNewEntries() {
   const std::chrono::system_clock::time_point now(
@@ -132,16 +207,19 @@ util::Status TreeSigner<Logged>::SequenceNewEntries() {
   VLOG(1) << "Sequencing " << pending_entries.size() << " entr"
           << (pending_entries.size() == 1 ? "y" : "ies");
 
-  // We're going to update the sequence mapping based on the following rules:
-  // 1) existing sequence mappings whose corresponding PendingEntry still
-  //    exists will remain in the mappings file.
-  // 2) PendingEntries which do not have a corresponding sequence mapping will
-  //    gain one.
-  // 3) mappings whose corresponding PendingEntry no longer exists will be
-  //    removed from the sequence mapping file.
-  google::protobuf::RepeatedPtrField<ct::SequenceMapping_Mapping> new_mapping;
-  std::map<int64_t, const Logged*> seq_to_entry;
+  // PendingEntries which do not have a corresponding sequence mapping will
+  // gain one, and only those new mappings get written. Existing mappings are
+  // left alone, and removed by the cleanup of the consistent store once
+  // their entries are in the serving tree.
+  //
+  // The pending entries come oldest first, so when there are more new ones
+  // than a round takes, the newest ones are left for the next round.
+  ct::SequenceMapping new_mapping;
+  std::map<int64_t, Logged*> seq_to_entry;
   int num_sequenced(0);
+  int num_deferred(0);
+  int64_t new_mapping_bytes(0);
+  bool batch_full(false);
   for (auto& pending_entry : pending_entries) {
     const std::string& pending_hash(pending_entry.Entry().Hash());
     const std::chrono::system_clock::time_point cert_time(
@@ -152,18 +230,38 @@ util::Status TreeSigner<Logged>::SequenceNewEntries() {
       continue;
     }
     const auto seq_it(sequenced_hashes.find(pending_hash));
-    ct::SequenceMapping::Mapping* const seq_mapping(new_mapping.Add());
 
     if (seq_it == sequenced_hashes.end()) {
+      if (batch_full) {
+        ++num_deferred;
+        continue;
+      }
+      // The list of pending entries can be slightly out of date, so check
+      // that this one has not been cleaned up since it was sequenced.
+      status = consistent_store_->GetPendingEntryForHash(pending_hash,
+                                                         &pending_entry);
+      if (status.CanonicalCode() == util::error::NOT_FOUND) {
+        VLOG(1) << "Entry gone: " << util::ToBase64(pending_hash);
+        continue;
+      }
+      if (!status.ok()) {
+        return status;
+      }
+
       // Need to sequence this one.
       VLOG(1) << util::ToBase64(pending_hash) << " = " << next_sequence_number;
 
       // Record the sequence -> hash mapping
+      ct::SequenceMapping::Mapping* const seq_mapping(
+          new_mapping.add_mapping());
       seq_mapping->set_sequence_number(next_sequence_number);
       seq_mapping->set_entry_hash(pending_entry.Entry().Hash());
       pending_entry.MutableEntry()->set_sequence_number(next_sequence_number);
       ++num_sequenced;
       ++next_sequence_number;
+      new_mapping_bytes += seq_mapping->ByteSize() + kSequenceMappingOverhead;
+      batch_full = num_sequenced >= sequence_batch_size_ ||
+                   new_mapping_bytes >= FLAGS_sequence_batch_max_bytes;
     } else {
       VLOG(1) << "Previously sequenced " << util::ToBase64(pending_hash)
               << " = " << seq_it->second.first;
@@ -172,8 +270,6 @@ util::Status TreeSigner<Logged>::SequenceNewEntries() {
       CHECK(!pending_entry.Entry().has_sequence_number());
       seq_it->second.second = true;  // present
 
-      seq_mapping->set_entry_hash(seq_it->first);
-      seq_mapping->set_sequence_number(seq_it->second.first);
       pending_entry.MutableEntry()->set_sequence_number(seq_it->second.first);
     }
     CHECK(
@@ -200,70 +296,148 @@ util::Status TreeSigner<Logged>::SequenceNewEntries() {
     }
   }
 
-  if (new_mapping.size() > 0) {
-    sort(new_mapping.begin(), new_mapping.end(), LessThanBySequence);
-    CHECK_LE(new_mapping.Get(0).sequence_number(), serving_tree_size);
-  }
-
-  // Update the mapping proto with our new mappings
-  mapping.MutableEntry()->mutable_mapping()->Swap(&new_mapping);
-
-  // Store updated sequence->hash mappings in the consistent store
-  status = consistent_store_->UpdateSequenceMapping(&mapping);
+  // Store the new sequence->hash mappings in the consistent store, which are
+  // already in order, since they were assigned incrementally.
+  const std::chrono::steady_clock::time_point write_start(
+      std::chrono::steady_clock::now());
+  status = consistent_store_->AddSequenceMappings(new_mapping);
+  AdjustSequenceBatchSize(status, num_deferred > 0,
+                          std::chrono::steady_clock::now() - write_start);
   if (!status.ok()) {
     return status;
   }
 
   // Now add the sequenced entries to our local DB so that the local signer can
   // incorporate them.
-  for (auto it(seq_to_entry.find(db_->TreeSize())); it != seq_to_entry.end();
-       ++it) {
+  // The pending entries are not needed after this, so they are swapped
+  // in rather than copied.
+  const auto first(seq_to_entry.find(db_->TreeSize()));
+  std::vector<LoggedEntry> new_entries(
+      std::distance(first, seq_to_entry.end()));
+  auto new_entry(new_entries.begin());
+  for (auto it(first); it != seq_to_entry.end(); ++it, ++new_entry) {
     VLOG(1) << "Adding to local DB: " << it->first;
     CHECK_EQ(it->first, it->second->sequence_number());
-    CHECK_EQ(Database::OK, db_->CreateSequencedEntry(*(it->second)));
+    new_entry->Swap(it->second);
   }
+  CHECK_EQ(Database::OK, db_->CreateSequencedEntries(new_entries, NULL));
 
   VLOG(1) << "Sequenced " << num_sequenced << " entries.";
+  if (num_deferred > 0) {
+    LOG(INFO) << "Left " << num_deferred << " new entries for the next "
+              << "round, which takes up to " << sequence_batch_size_;
+  }
 
   return util::Status::OK;
 }
 
 
-// DB_ERROR: the database is inconsistent with our inner self.
-// However, if the database itself is giving inconsistent answers, or failing
-// reads/writes, then we die.
 template <class Logged>
-typename TreeSigner<Logged>::UpdateResult TreeSigner<Logged>::UpdateTree() {
-  // Try to make local timestamps unique, but there's always a chance that
-  // multiple nodes in the cluster may make STHs with the same timestamp.
-  // That'll get handled by the Serving STH selection code.
-  uint64_t min_timestamp = LastUpdateTime() + 1;
+void TreeSigner<Logged>::AdjustSequenceBatchSize(
+    const util::Status& status, bool batch_full,
+    const std::chrono::duration<double>& elapsed) {
+  const std::chrono::duration<double> target(
+      FLAGS_sequence_batch_target_seconds);
+  // Retrying with the same batch would not get anywhere if it is too
+  // large for etcd.
+  if (!status.ok() || elapsed > target) {
+    sequence_batch_size_ =
+        std::max(std::min(kMinSequenceBatchSize,
+                          static_cast<int64_t>(
+                              FLAGS_sequence_batch_max_entries)),
+                 sequence_batch_size_ / 2);
+  } else if (batch_full && elapsed < target / 2) {
+    sequence_batch_size_ =
+        std::min(static_cast<int64_t>(FLAGS_sequence_batch_max_entries),
+                 sequence_batch_size_ * 2);
+  }
+  sequence_batch_size->Set(sequence_batch_size_);
+}
+
 
+template <class Logged>
+int64_t TreeSigner<Logged>::IntegrateNewEntries() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  return IntegrateNewEntries(lock);
+}
+
+
+template <class Logged>
+int64_t TreeSigner<Logged>::IntegrateNewEntries(
+    const std::unique_lock<std::mutex>& lock) {
+  CHECK(lock.owns_lock());
   // Add any newly sequenced entries from our local DB.
+  std::vector<std::string> leaf_hashes;
   auto it(db_->ScanEntries(cert_tree_->LeafCount()));
+  // Reused for every entry.
+  Logged logged;
+  std::string serialized_leaf;
   for (int64_t i(cert_tree_->LeafCount());; ++i) {
-    Logged logged;
     if (!it->GetNextEntry(&logged) || logged.sequence_number() != i) {
       break;
     }
     CHECK_EQ(logged.sequence_number(), i);
-    AppendToTree(logged);
-    min_timestamp = std::max(min_timestamp, logged.sct().timestamp());
+    CHECK(logged.SerializeForLeaf(&serialized_leaf));
+    leaf_hashes.emplace_back(cert_tree_->LeafHash(serialized_leaf));
+    max_leaf_timestamp_ =
+        std::max(max_leaf_timestamp_, logged.sct().timestamp());
+    unsigned_leaf_timestamps_.push_back(logged.sct().timestamp());
+  }
+  AppendToTree(leaf_hashes);
+  return leaf_hashes.size();
+}
+
+
+// DB_ERROR: the database is inconsistent with our inner self.
+// However, if the database itself is giving inconsistent answers, or failing
+// reads/writes, then we die.
+template <class Logged>
+typename TreeSigner<Logged>::UpdateResult TreeSigner<Logged>::UpdateTree() {
+  // Only one update signs at a time, so that their tree heads come out in
+  // order.
+  std::lock_guard<std::mutex> update_lock(update_mutex_);
+  std::unique_ptr<CompactMerkleTree> tree;
+  uint64_t min_timestamp;
+  std::vector<uint64_t> leaf_timestamps;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    // Pick up anything which was sequenced since the last
+    // IntegrateNewEntries() run.
+    IntegrateNewEntries(lock);
+    CHECK_LE(cert_tree_->LeafCount(), static_cast<uint64_t>(INT64_MAX));
+
+    // Try to make local timestamps unique, but there's always a chance
+    // that multiple nodes in the cluster may make STHs with the same
+    // timestamp. That'll get handled by the Serving STH selection code.
+    min_timestamp =
+        std::max(latest_tree_head_.timestamp() + 1, max_leaf_timestamp_);
+
+    // The tree head is computed and signed from a snapshot, so that new
+    // entries can be hashed into the tree in the meantime.
+    tree = cert_tree_->Snapshot();
+    leaf_timestamps = unsigned_leaf_timestamps_;
   }
-  int64_t next_seq(cert_tree_->LeafCount());
-  CHECK_GE(next_seq, 0);
 
   // Our tree is consistent with the database, i.e., each leaf in the tree has
   // a matching sequence number in the database (at least assuming overwriting
   // the sequence number is not allowed).
   ct::SignedTreeHead new_sth;
-  TimestampAndSign(min_timestamp, &new_sth);
+  TimestampAndSign(tree.get(), min_timestamp, &new_sth);
+  for (const uint64_t timestamp : leaf_timestamps) {
+    entry_inclusion_latency_ms.RecordLatency(
+        std::chrono::milliseconds(new_sth.timestamp() - timestamp));
+  }
 
   // We don't actually store this STH anywhere durable yet, but rather let the
   // caller decide what to do with it.  (In practice, this will mean that it's
   // pushed out to this node's ClusterNodeState so that it becomes a candidate
   // for the cluster-wide Serving STH.)
+  std::lock_guard<std::mutex> lock(mutex_);
   latest_tree_head_.CopyFrom(new_sth);
+  // Entries hashed in while signing are left for the next update.
+  unsigned_leaf_timestamps_.erase(
+      unsigned_leaf_timestamps_.begin(),
+      unsigned_leaf_timestamps_.begin() + leaf_timestamps.size());
   return OK;
 }
 
@@ -294,32 +468,35 @@ bool TreeSigner<Logged>::Append(const Logged& logged) {
 
 
 template <class Logged>
-void TreeSigner<Logged>::AppendToTree(const Logged& logged) {
-  // Serialize for inclusion in the tree.
-  std::string serialized_leaf;
-  CHECK(logged.SerializeForLeaf(&serialized_leaf));
-
+void TreeSigner<Logged>::AppendToTree(
+    const std::vector<std::string>& leaf_hashes) {
   // Update in-memory tree.
-  cert_tree_->AddLeaf(serialized_leaf);
+  cert_tree_->AddLeafHashes(leaf_hashes);
 }
 
 
 template <class Logged>
-void TreeSigner<Logged>::TimestampAndSign(uint64_t min_timestamp,
+void TreeSigner<Logged>::TimestampAndSign(CompactMerkleTree* tree,
+                                          uint64_t min_timestamp,
                                           ct::SignedTreeHead* sth) {
   sth->set_version(ct::V1);
-  sth->set_sha256_root_hash(cert_tree_->CurrentRoot());
+  sth->set_sha256_root_hash(tree->CurrentRoot());
   uint64_t timestamp = util::TimeInMilliseconds();
   if (timestamp < min_timestamp)
     // TODO(ekasper): shouldn't really happen if everyone's clocks are in sync;
     // log a warning if the skew is over some threshold?
     timestamp = min_timestamp;
   sth->set_timestamp(timestamp);
-  sth->set_tree_size(cert_tree_->LeafCount());
+  sth->set_tree_size(tree->LeafCount());
   LogSigner::SignResult ret = signer_->SignTreeHead(sth);
   if (ret != LogSigner::OK)
     // Make this one a hard fail. There is really no excuse for it.
     abort();
+  // Stored with the tree head, so that the next master can carry on from
+  // it (see TreeOfLatestSTH()).
+  for (const std::string& root : tree->SubtreeRoots()) {
+    sth->add_subtree_roots(root);
+  }
 }
 
 
@@ -3,6 +3,10 @@
 
 #include <stdint.h>
 #include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include "log/cluster_state_controller.h"
 #include "log/consistent_store.h"
@@ -20,6 +24,7 @@ class LogSigner;
 namespace cert_trans {
 
 class Database;
+class ReadOnlyDatabase;
 
 
 // Signer for appending new entries to the log.
@@ -46,11 +51,30 @@ class TreeSigner {
     INSUFFICIENT_DATA,
   };
 
+  // Returns the tree of the latest tree head of |db|, made from the
+  // subtree roots stored with it, or NULL if it has none (e.g. it was not
+  // signed by this log) or they do not match its root hash. Unlike a tree
+  // made from a LogLookup, this does not need the whole tree to be built,
+  // so that a new master can start signing right away.
+  // Takes ownership of |hasher|.
+  static std::unique_ptr<CompactMerkleTree> TreeOfLatestSTH(
+      const ReadOnlyDatabase* db, SerialHasher* hasher);
+
   // Latest Tree Head timestamp;
   uint64_t LastUpdateTime() const;
 
   util::Status SequenceNewEntries();
 
+  // Hashes any entries sequenced into the local database since the last
+  // call into the in-memory tree, without signing a new tree head. Returns
+  // the number of entries added. This can be run from its own thread, so
+  // that UpdateTree() only has to sign whatever has already been hashed.
+  int64_t IntegrateNewEntries();
+
+  // Number of entries which have been hashed into the tree but are not
+  // covered by LatestSTH() yet.
+  int64_t NumUnsignedEntries() const;
+
   // Simplest update mechanism: take all pending entries and append
   // (in random order) to the tree. Checks that the update it writes
   // to the database is consistent with the latest STH.
@@ -58,20 +82,39 @@ class TreeSigner {
 
   // Latest Tree Head (does not build a new tree, just retrieves the
   // result of the most recent build).
-  const ct::SignedTreeHead& LatestSTH() const {
-    return latest_tree_head_;
-  }
+  ct::SignedTreeHead LatestSTH() const;
 
  private:
+  // Halves or doubles |sequence_batch_size_| after a write of sequence
+  // mappings which returned |status| after |elapsed|, |batch_full| saying
+  // whether some new entries were left out of it.
+  void AdjustSequenceBatchSize(const util::Status& status, bool batch_full,
+                               const std::chrono::duration<double>& elapsed);
+  int64_t IntegrateNewEntries(const std::unique_lock<std::mutex>& lock);
   bool Append(const Logged& logged);
-  void AppendToTree(const Logged& logged_cert);
-  void TimestampAndSign(uint64_t min_timestamp, ct::SignedTreeHead* sth);
+  void AppendToTree(const std::vector<std::string>& leaf_hashes);
+  // Fills |sth| with the signed tree head of |tree|.
+  void TimestampAndSign(CompactMerkleTree* tree, uint64_t min_timestamp,
+                        ct::SignedTreeHead* sth);
 
   const std::chrono::duration<double> guard_window_;
   Database* const db_;
   cert_trans::ConsistentStore<Logged>* const consistent_store_;
   LogSigner* const signer_;
+  // Largest number of new entries sequenced in one round, only used by
+  // SequenceNewEntries().
+  int64_t sequence_batch_size_;
+
+  // Held by UpdateTree() throughout, while |mutex_| is only held while it
+  // takes a snapshot of the tree and records the new tree head.
+  std::mutex update_mutex_;
+  mutable std::mutex mutex_;
   const std::unique_ptr<CompactMerkleTree> cert_tree_;
+  // Largest SCT timestamp of the entries hashed into |cert_tree_| so far.
+  uint64_t max_leaf_timestamp_;
+  // SCT timestamps of the entries hashed into |cert_tree_| since the last
+  // signing, used to export the time it took to include them.
+  std::vector<uint64_t> unsigned_leaf_timestamps_;
   ct::SignedTreeHead latest_tree_head_;
 
   template <class T>
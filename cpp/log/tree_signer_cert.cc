@@ -1,6 +1,20 @@
+#include <gflags/gflags.h>
+
 #include "log/logged_entry.h"
 #include "log/tree_signer-inl.h"
 
+DEFINE_int32(sequence_batch_max_entries, 20000,
+             "Maximum number of new entries to sequence in each round, the "
+             "rest waiting for the next one.");
+DEFINE_int32(sequence_batch_max_bytes, 1 << 20,
+             "Maximum size in bytes of the sequence mappings written in each "
+             "round, which must stay within the request limits of etcd.");
+DEFINE_double(sequence_batch_target_seconds, 2,
+              "How long writing the sequence mappings of a round should take "
+              "at most. The batch size is halved after a slower (or failed) "
+              "write, and doubled, up to --sequence_batch_max_entries, after "
+              "a full batch written in less than half that.");
+
 namespace cert_trans {
 template class TreeSigner<cert_trans::LoggedEntry>;
 }  // namespace cert_trans
@@ -61,6 +61,8 @@ class TreeSignerTest : public ::testing::Test {
   }
 
   void SetUp() {
+    // The sequencing tests expect new entries to be seen right away.
+    FLAGS_etcd_cache_pending_entries = false;
     test_db_.reset(new TestDB<T>);
     verifier_.reset(new LogVerifier(TestSigner::DefaultLogSigVerifier(),
                                     new MerkleVerifier(new Sha256Hasher())));
@@ -73,13 +75,6 @@ class TreeSignerTest : public ::testing::Test {
                               store_.get(), log_signer_.get()));
     // Set a default empty STH so that we can call UpdateTree() on the signer.
     store_->SetServingSTH(SignedTreeHead());
-    // Force an empty sequence mapping file:
-    {
-      util::SyncTask task(&pool_);
-      EtcdClient::Response r;
-      etcd_client_.ForceSet("/root/sequence_mapping", "", &r, task.task());
-      task.Wait();
-    }
   }
 
   void AddPendingEntry(LoggedEntry* logged_cert) const {
@@ -100,12 +95,11 @@ class TreeSignerTest : public ::testing::Test {
 
     // This below would normally be done by TreeSigner::SequenceNewEntries()
     EntryHandle<LoggedEntry> entry;
-    EntryHandle<SequenceMapping> mapping;
-    CHECK(this->store_->GetSequenceMapping(&mapping).ok());
-    SequenceMapping::Mapping* m(mapping.MutableEntry()->add_mapping());
+    SequenceMapping mapping;
+    SequenceMapping::Mapping* m(mapping.add_mapping());
     m->set_sequence_number(seq);
     m->set_entry_hash(logged_cert->Hash());
-    CHECK(this->store_->UpdateSequenceMapping(&mapping).ok());
+    CHECK(this->store_->AddSequenceMappings(mapping).ok());
     logged_cert->set_sequence_number(seq);
     CHECK_EQ(Database::OK, this->db()->CreateSequencedEntry(*logged_cert));
   }
@@ -208,6 +202,37 @@ TYPED_TEST(TreeSignerTest, Timestamp) {
 }
 
 
+TYPED_TEST(TreeSignerTest, IntegrateThenSign) {
+  LoggedEntry logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  this->AddSequencedEntry(&logged_cert, 0);
+
+  EXPECT_EQ(1, this->tree_signer_->IntegrateNewEntries());
+  EXPECT_EQ(0, this->tree_signer_->IntegrateNewEntries());
+  // Hashing alone doesn't produce a new STH.
+  EXPECT_EQ(0U, this->tree_signer_->LatestSTH().tree_size());
+  EXPECT_EQ(1, this->tree_signer_->NumUnsignedEntries());
+
+  // Entries integrated before signing still count towards the timestamp.
+  uint64_t future = logged_cert.sct().timestamp() + 10000;
+  LoggedEntry logged_cert2;
+  this->test_signer_.CreateUnique(&logged_cert2);
+  logged_cert2.mutable_sct()->set_timestamp(future);
+  this->AddSequencedEntry(&logged_cert2, 1);
+  EXPECT_EQ(1, this->tree_signer_->IntegrateNewEntries());
+  EXPECT_EQ(2, this->tree_signer_->NumUnsignedEntries());
+
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  EXPECT_EQ(0, this->tree_signer_->NumUnsignedEntries());
+  const SignedTreeHead sth(this->tree_signer_->LatestSTH());
+  EXPECT_EQ(2U, sth.tree_size());
+  EXPECT_GE(sth.timestamp(), future);
+  // Its timestamp is in the future.
+  EXPECT_EQ(LogVerifier::VERIFY_OK,
+            this->verifier_->VerifySignedTreeHead(sth, 0, sth.timestamp()));
+}
+
+
 TYPED_TEST(TreeSignerTest, Verify) {
   LoggedEntry logged_cert;
   this->test_signer_.CreateUnique(&logged_cert);
@@ -275,6 +300,52 @@ TYPED_TEST(TreeSignerTest, ResumePartialSign) {
 }
 
 
+TYPED_TEST(TreeSignerTest, ResumeFromSubtreeRoots) {
+  // No tree head yet.
+  EXPECT_FALSE(TS::TreeOfLatestSTH(this->db(), new Sha256Hasher));
+
+  for (int64_t i = 0; i < 3; ++i) {
+    LoggedEntry logged_cert;
+    this->test_signer_.CreateUnique(&logged_cert);
+    this->AddSequencedEntry(&logged_cert, i);
+  }
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  const SignedTreeHead sth(this->tree_signer_->LatestSTH());
+  EXPECT_EQ(2, sth.subtree_roots_size());
+  EXPECT_EQ(LogVerifier::VERIFY_OK,
+            this->verifier_->VerifySignedTreeHead(sth));
+  CHECK_EQ(Database::OK, this->db()->WriteTreeHead(sth));
+
+  // One more entry, sequenced after that tree head.
+  LoggedEntry logged_cert;
+  this->test_signer_.CreateUnique(&logged_cert);
+  this->AddSequencedEntry(&logged_cert, 3);
+
+  unique_ptr<CompactMerkleTree> tree(
+      TS::TreeOfLatestSTH(this->db(), new Sha256Hasher));
+  ASSERT_TRUE(tree);
+  EXPECT_EQ(3U, tree->LeafCount());
+  EXPECT_EQ(sth.sha256_root_hash(), tree->CurrentRoot());
+
+  TS signer2(std::chrono::duration<double>(0), this->db(), std::move(tree),
+             this->store_.get(), this->log_signer_.get());
+  EXPECT_EQ(TS::OK, signer2.UpdateTree());
+  EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
+  const SignedTreeHead sth2(signer2.LatestSTH());
+  EXPECT_EQ(4U, sth2.tree_size());
+  EXPECT_EQ(this->tree_signer_->LatestSTH().sha256_root_hash(),
+            sth2.sha256_root_hash());
+
+  // Roots which do not match the root hash are not used.
+  SignedTreeHead bad_sth(sth2);
+  bad_sth.set_timestamp(sth2.timestamp() + 1);
+  ASSERT_EQ(1, bad_sth.subtree_roots_size());
+  bad_sth.set_subtree_roots(0, sth.subtree_roots(0));
+  CHECK_EQ(Database::OK, this->db()->WriteTreeHead(bad_sth));
+  EXPECT_FALSE(TS::TreeOfLatestSTH(this->db(), new Sha256Hasher));
+}
+
+
 TYPED_TEST(TreeSignerTest, SignEmpty) {
   EXPECT_EQ(TS::OK, this->tree_signer_->UpdateTree());
 
@@ -284,7 +355,7 @@ TYPED_TEST(TreeSignerTest, SignEmpty) {
 }
 
 
-TYPED_TEST(TreeSignerTest, SequenceNewEntriesCleansUpOldSequenceMappings) {
+TYPED_TEST(TreeSignerTest, SequenceNewEntriesOnlyAddsNewSequenceMappings) {
   LoggedEntry logged_cert;
   this->test_signer_.CreateUnique(&logged_cert);
   this->AddPendingEntry(&logged_cert);
@@ -313,19 +384,56 @@ TYPED_TEST(TreeSignerTest, SequenceNewEntriesCleansUpOldSequenceMappings) {
   EXPECT_OK(this->tree_signer_->SequenceNewEntries());
 
   {
+    // The mapping of the first entry stays until the store cleans it up.
     EntryHandle<SequenceMapping> mapping;
     CHECK_EQ(Status::OK, this->store_->GetSequenceMapping(&mapping));
-    CHECK_GE(mapping.Entry().mapping_size(), 0);
-    EXPECT_EQ(new_logged_certs.size(),
+    ASSERT_EQ(new_logged_certs.size() + 1,
               static_cast<size_t>(mapping.Entry().mapping_size()));
-    for (int i(0); i < mapping.Entry().mapping_size(); ++i) {
+    EXPECT_EQ(logged_cert.Hash(), mapping.Entry().mapping(0).entry_hash());
+    for (int i(1); i < mapping.Entry().mapping_size(); ++i) {
       const auto& m(mapping.Entry().mapping(i));
+      EXPECT_EQ(i, m.sequence_number());
       EXPECT_NE(new_logged_certs.end(), new_logged_certs.find(m.entry_hash()));
     }
   }
 }
 
 
+
+TYPED_TEST(TreeSignerTest, SequenceNewEntriesInBatches) {
+  const int32_t old_max_entries(FLAGS_sequence_batch_max_entries);
+  FLAGS_sequence_batch_max_entries = 2;
+  this->tree_signer_.reset(this->GetSimilar());
+
+  // Added newest first, but sequenced oldest first.
+  vector<string> hashes(5);
+  for (int i(hashes.size() - 1); i >= 0; --i) {
+    LoggedEntry c;
+    this->test_signer_.CreateUnique(&c);
+    c.mutable_sct()->set_timestamp(1000 + i);
+    this->AddPendingEntry(&c);
+    hashes[i] = c.Hash();
+  }
+
+  for (int64_t round(1); round <= 3; ++round) {
+    EXPECT_OK(this->tree_signer_->SequenceNewEntries());
+    EXPECT_EQ(std::min<int64_t>(2 * round, hashes.size()),
+              this->db()->TreeSize());
+  }
+
+  EntryHandle<SequenceMapping> mapping;
+  CHECK_EQ(Status::OK, this->store_->GetSequenceMapping(&mapping));
+  ASSERT_EQ(hashes.size(),
+            static_cast<size_t>(mapping.Entry().mapping_size()));
+  for (int i(0); i < mapping.Entry().mapping_size(); ++i) {
+    EXPECT_EQ(i, mapping.Entry().mapping(i).sequence_number());
+    EXPECT_EQ(hashes[i], mapping.Entry().mapping(i).entry_hash());
+  }
+
+  FLAGS_sequence_batch_max_entries = old_max_entries;
+}
+
+
 }  // namespace cert_trans
 
 
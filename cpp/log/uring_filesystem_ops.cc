@@ -0,0 +1,390 @@
+#include "config.h"
+#include "log/uring_filesystem_ops.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+
+#if HAVE_DECL_IORING_OP_RENAMEAT
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+#if HAVE_DECL_IORING_OP_RENAMEAT
+// Number of submission queue entries of the ring, four per file.
+const unsigned kRingEntries = 256;
+#endif
+
+
+// The operations of the chain of each file, in order, the sync being
+// left out when it is not asked for.
+enum ChainOp {
+  WRITE_OP,
+  SYNC_OP,
+  CLOSE_OP,
+  RENAME_OP,
+  NUM_CHAIN_OPS,
+};
+
+
+}  // namespace
+
+
+#if HAVE_DECL_IORING_OP_RENAMEAT
+
+// A minimal io_uring, used by one thread at a time: entries are queued
+// with NextSqe(), then all submitted and waited for by SubmitAndWait().
+class UringFilesystemOps::Ring {
+ public:
+  // Returns null if the kernel does not support io_uring, or any of the
+  // operations of the chains.
+  static unique_ptr<Ring> Create(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    const int fd(syscall(__NR_io_uring_setup, entries, &params));
+    if (fd < 0) {
+      PLOG(INFO) << "io_uring_setup";
+      return nullptr;
+    }
+    unique_ptr<Ring> ring(new Ring(fd, params));
+    if (!ring->sq_ring_ || !ring->cq_ring_ || !ring->sqes_ ||
+        !ring->Supports({IORING_OP_WRITE, IORING_OP_FSYNC, IORING_OP_CLOSE,
+                         IORING_OP_RENAMEAT})) {
+      return nullptr;
+    }
+    return ring;
+  }
+
+  ~Ring() {
+    if (sqes_) {
+      munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ && cq_ring_ != sq_ring_) {
+      munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_) {
+      munmap(sq_ring_, sq_ring_size_);
+    }
+    close(fd_);
+  }
+
+  unsigned capacity() const {
+    return params_.sq_entries;
+  }
+
+  // Returns a cleared entry to fill, of which there must be room for.
+  io_uring_sqe* NextSqe() {
+    CHECK_LT(queued_, capacity());
+    const unsigned tail(*sq_tail_ + queued_);
+    const unsigned index(tail & *sq_mask_);
+    io_uring_sqe* const sqe(&sqes_[index]);
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array_[index] = index;
+    ++queued_;
+    return sqe;
+  }
+
+  // Submits the queued entries, and waits for all of them to complete,
+  // calling |on_cqe| with each completion. Returns 0, or -1 with errno
+  // set if the submission failed, in which case nothing was submitted.
+  template <class OnCqe>
+  int SubmitAndWait(const OnCqe& on_cqe) {
+    __atomic_store_n(sq_tail_, *sq_tail_ + queued_, __ATOMIC_RELEASE);
+    unsigned to_submit(queued_);
+    unsigned to_complete(queued_);
+    queued_ = 0;
+    while (to_complete > 0) {
+      unsigned head(*cq_head_);
+      const unsigned tail(__atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE));
+      for (; head != tail; ++head) {
+        on_cqe(cqes_[head & *cq_mask_]);
+        --to_complete;
+      }
+      __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+      if (to_complete == 0) {
+        break;
+      }
+
+      const int ret(syscall(__NR_io_uring_enter, fd_, to_submit, 1,
+                            IORING_ENTER_GETEVENTS, nullptr, 0));
+      if (ret < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+          continue;
+        }
+        // Only possible before anything is submitted, as the following
+        // calls submit nothing.
+        CHECK_EQ(to_submit, to_complete);
+        __atomic_store_n(sq_tail_, *sq_tail_ - to_submit, __ATOMIC_RELEASE);
+        return -1;
+      }
+      to_submit -= std::min<unsigned>(ret, to_submit);
+    }
+    return 0;
+  }
+
+ private:
+  Ring(int fd, const io_uring_params& params)
+      : fd_(fd),
+        params_(params),
+        sq_ring_size_(params.sq_off.array +
+                      params.sq_entries * sizeof(uint32_t)),
+        cq_ring_size_(params.cq_off.cqes +
+                      params.cq_entries * sizeof(io_uring_cqe)),
+        sqes_size_(params.sq_entries * sizeof(io_uring_sqe)),
+        sq_ring_(nullptr),
+        cq_ring_(nullptr),
+        sqes_(nullptr),
+        queued_(0) {
+    const bool single_mmap(params.features & IORING_FEAT_SINGLE_MMAP);
+    if (single_mmap) {
+      sq_ring_size_ = cq_ring_size_ =
+          std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = Map(sq_ring_size_, IORING_OFF_SQ_RING);
+    cq_ring_ = single_mmap ? sq_ring_ : Map(cq_ring_size_, IORING_OFF_CQ_RING);
+    sqes_ = static_cast<io_uring_sqe*>(Map(sqes_size_, IORING_OFF_SQES));
+    if (!sq_ring_ || !cq_ring_ || !sqes_) {
+      return;
+    }
+
+    char* const sq(static_cast<char*>(sq_ring_));
+    sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    char* const cq(static_cast<char*>(cq_ring_));
+    cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+  }
+
+  void* Map(size_t size, off_t offset) const {
+    void* const ptr(mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, fd_, offset));
+    if (ptr == MAP_FAILED) {
+      PLOG(INFO) << "io_uring mmap";
+      return nullptr;
+    }
+    return ptr;
+  }
+
+  bool Supports(const vector<int>& ops) const {
+    const int kMaxOps = 256;
+    vector<char> buffer(sizeof(io_uring_probe) +
+                        kMaxOps * sizeof(io_uring_probe_op));
+    io_uring_probe* const probe(
+        reinterpret_cast<io_uring_probe*>(buffer.data()));
+    if (syscall(__NR_io_uring_register, fd_, IORING_REGISTER_PROBE, probe,
+                kMaxOps) < 0) {
+      PLOG(INFO) << "io_uring probe";
+      return false;
+    }
+    for (const int op : ops) {
+      if (op > probe->last_op ||
+          !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+        LOG(INFO) << "io_uring does not support operation " << op;
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const int fd_;
+  const io_uring_params params_;
+  size_t sq_ring_size_;
+  size_t cq_ring_size_;
+  const size_t sqes_size_;
+  void* sq_ring_;
+  void* cq_ring_;
+  io_uring_sqe* sqes_;
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  io_uring_cqe* cqes_;
+  // Entries filled since the last submission.
+  unsigned queued_;
+
+  DISALLOW_COPY_AND_ASSIGN(Ring);
+};
+
+
+UringFilesystemOps::UringFilesystemOps() : ring_(Ring::Create(kRingEntries)) {
+  LOG_IF(INFO, !ring_) << "io_uring not available, writing files with "
+                          "blocking system calls";
+}
+
+
+int UringFilesystemOps::AtomicWriteBatch(const string& tmp_template,
+                                         const vector<AtomicWrite>& writes,
+                                         bool sync) {
+  // The temporary files are made first, as the chains need their file
+  // descriptors.
+  vector<string> tmp_paths(writes.size());
+  vector<int> fds(writes.size(), -1);
+  for (size_t i = 0; i < writes.size(); ++i) {
+    vector<char> path(tmp_template.begin(), tmp_template.end());
+    path.push_back('\0');
+    fds[i] = mkstemp(path.data());
+    if (fds[i] < 0) {
+      const int saved_errno(errno);
+      for (size_t j = 0; j < i; ++j) {
+        close(fds[j]);
+        unlink(tmp_paths[j].c_str());
+      }
+      errno = saved_errno;
+      return -1;
+    }
+    tmp_paths[i] = path.data();
+  }
+
+  for (size_t i = 0; i < writes.size(); ++i) {
+    // Each operation only runs once the previous one of the chain has
+    // succeeded, a short write counting as a failure.
+    io_uring_sqe* sqe(ring_->NextSqe());
+    sqe->opcode = IORING_OP_WRITE;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->fd = fds[i];
+    sqe->addr = reinterpret_cast<uintptr_t>(writes[i].data->data());
+    sqe->len = writes[i].data->size();
+    sqe->off = 0;
+    sqe->user_data = i * NUM_CHAIN_OPS + WRITE_OP;
+
+    if (sync) {
+      sqe = ring_->NextSqe();
+      sqe->opcode = IORING_OP_FSYNC;
+      sqe->flags = IOSQE_IO_LINK;
+      sqe->fd = fds[i];
+      sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+      sqe->user_data = i * NUM_CHAIN_OPS + SYNC_OP;
+    }
+
+    sqe = ring_->NextSqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->fd = fds[i];
+    sqe->user_data = i * NUM_CHAIN_OPS + CLOSE_OP;
+
+    sqe = ring_->NextSqe();
+    sqe->opcode = IORING_OP_RENAMEAT;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = reinterpret_cast<uintptr_t>(tmp_paths[i].c_str());
+    sqe->len = AT_FDCWD;
+    sqe->addr2 = reinterpret_cast<uintptr_t>(writes[i].path.c_str());
+    sqe->user_data = i * NUM_CHAIN_OPS + RENAME_OP;
+  }
+
+  // The files whose descriptor, or temporary file, was left behind by a
+  // broken chain.
+  vector<bool> closed(writes.size(), false);
+  vector<bool> renamed(writes.size(), false);
+  int error(0);
+  const int ret(ring_->SubmitAndWait([&](const io_uring_cqe& cqe) {
+    const size_t i(cqe.user_data / NUM_CHAIN_OPS);
+    const int op(cqe.user_data % NUM_CHAIN_OPS);
+    if (op == CLOSE_OP && cqe.res != -ECANCELED) {
+      // Even when close() fails, the descriptor is gone.
+      closed[i] = true;
+    }
+    if (op == RENAME_OP && cqe.res == 0) {
+      renamed[i] = true;
+    }
+    if (!error && cqe.res != -ECANCELED &&
+        (cqe.res < 0 ||
+         (op == WRITE_OP &&
+          static_cast<size_t>(cqe.res) != writes[i].data->size()))) {
+      error = cqe.res < 0 ? -cqe.res : EIO;
+      LOG(WARNING) << "io_uring operation " << op << " failed for "
+                   << writes[i].path << ": " << strerror(error);
+    }
+  }));
+  if (ret != 0) {
+    error = errno;
+  }
+
+  for (size_t i = 0; i < writes.size(); ++i) {
+    if (!closed[i]) {
+      close(fds[i]);
+    }
+    if (!renamed[i]) {
+      unlink(tmp_paths[i].c_str());
+    }
+  }
+  if (error) {
+    errno = error;
+    return -1;
+  }
+  return 0;
+}
+
+#else  // HAVE_DECL_IORING_OP_RENAMEAT
+
+class UringFilesystemOps::Ring {};
+
+
+UringFilesystemOps::UringFilesystemOps() {
+  LOG(INFO) << "built without io_uring, writing files with blocking system "
+               "calls";
+}
+
+
+int UringFilesystemOps::AtomicWriteBatch(const string&,
+                                         const vector<AtomicWrite>&, bool) {
+  LOG(FATAL) << "no io_uring";
+  return -1;
+}
+
+#endif  // HAVE_DECL_IORING_OP_RENAMEAT
+
+
+UringFilesystemOps::~UringFilesystemOps() {
+}
+
+
+int UringFilesystemOps::AtomicWriteFiles(const string& tmp_template,
+                                         const vector<AtomicWrite>& writes,
+                                         bool sync) {
+  if (!ring_) {
+    return BasicFilesystemOps::AtomicWriteFiles(tmp_template, writes, sync);
+  }
+
+#if HAVE_DECL_IORING_OP_RENAMEAT
+  lock_guard<mutex> lock(lock_);
+  const size_t per_batch(ring_->capacity() / (sync ? 4 : 3));
+  for (size_t first = 0; first < writes.size(); first += per_batch) {
+    const vector<AtomicWrite> batch(
+        writes.begin() + first,
+        writes.begin() + std::min(first + per_batch, writes.size()));
+    if (AtomicWriteBatch(tmp_template, batch, sync) != 0) {
+      return -1;
+    }
+  }
+#endif
+  return 0;
+}
+
+
+bool UringFilesystemOps::BatchesWrites() const {
+  return ring_ != nullptr;
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,54 @@
+#ifndef CERT_TRANS_LOG_URING_FILESYSTEM_OPS_H_
+#define CERT_TRANS_LOG_URING_FILESYSTEM_OPS_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/filesystem_ops.h"
+
+namespace cert_trans {
+
+
+// FilesystemOps which writes files through io_uring. The new file of
+// each write is made with mkstemp(), then its write, sync (if asked),
+// close and rename are submitted as a chain of linked operations, so
+// that the rename only happens once the file is complete, and the
+// chains of as many files as fit in the ring are submitted at once.
+//
+// Falls back to BasicFilesystemOps where the kernel does not have
+// io_uring or these operations (renameat needs Linux 5.11), or the
+// build did not have <linux/io_uring.h>. The other operations are always
+// those of BasicFilesystemOps.
+class UringFilesystemOps : public BasicFilesystemOps {
+ public:
+  UringFilesystemOps();
+  ~UringFilesystemOps() override;
+
+  int AtomicWriteFiles(const std::string& tmp_template,
+                       const std::vector<AtomicWrite>& writes,
+                       bool sync) override;
+
+  bool BatchesWrites() const override;
+
+ private:
+  class Ring;
+
+  // Makes the files of |writes|, which must all fit in |ring_| at once.
+  int AtomicWriteBatch(const std::string& tmp_template,
+                       const std::vector<AtomicWrite>& writes, bool sync);
+
+  // Serializes the batches, which each use the whole ring.
+  std::mutex lock_;
+  // Null when falling back to BasicFilesystemOps.
+  const std::unique_ptr<Ring> ring_;
+
+  DISALLOW_COPY_AND_ASSIGN(UringFilesystemOps);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_LOG_URING_FILESYSTEM_OPS_H_
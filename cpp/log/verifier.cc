@@ -32,6 +32,11 @@ Verifier::Verifier(EVP_PKEY* pkey) : pkey_(CHECK_NOTNULL(pkey)) {
       LOG(FATAL) << "Unsupported key type " << pkey_->type;
   }
   key_id_ = ComputeKeyID(pkey_.get());
+
+  verify_ctx_.reset(EVP_PKEY_CTX_new(pkey_.get(), nullptr));
+  CHECK_NOTNULL(verify_ctx_.get());
+  CHECK_EQ(1, EVP_PKEY_verify_init(verify_ctx_.get()));
+  CHECK_GT(EVP_PKEY_CTX_set_signature_md(verify_ctx_.get(), EVP_sha256()), 0);
 }
 
 std::string Verifier::KeyID() const {
@@ -71,16 +76,17 @@ Verifier::Verifier()
 
 bool Verifier::RawVerify(const std::string& data,
                          const std::string& sig_string) const {
-  EVP_MD_CTX ctx;
-  EVP_MD_CTX_init(&ctx);
-  // NOTE: this syntax for setting the hash function requires OpenSSL >= 1.0.0.
-  CHECK_EQ(1, EVP_VerifyInit(&ctx, EVP_sha256()));
-  CHECK_EQ(1, EVP_VerifyUpdate(&ctx, data.data(), data.size()));
-  bool ret = (EVP_VerifyFinal(&ctx, reinterpret_cast<const unsigned char*>(
+  // This is what EVP_VerifyFinal does, but without creating and
+  // initializing a new EVP_PKEY_CTX. The copy keeps |verify_ctx_|
+  // unchanged, so that this can be called from several threads at once.
+  const std::string digest(Sha256Hasher::Sha256Digest(data));
+  const ScopedEVP_PKEY_CTX ctx(EVP_PKEY_CTX_dup(verify_ctx_.get()));
+  CHECK_NOTNULL(ctx.get());
+  return EVP_PKEY_verify(ctx.get(), reinterpret_cast<const unsigned char*>(
                                         sig_string.data()),
-                              sig_string.size(), pkey_.get()) == 1);
-  EVP_MD_CTX_cleanup(&ctx);
-  return ret;
+                         sig_string.size(),
+                         reinterpret_cast<const unsigned char*>(digest.data()),
+                         digest.size()) == 1;
 }
 
 }  // namespace cert_trans
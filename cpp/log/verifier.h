@@ -41,6 +41,9 @@ class Verifier {
   bool RawVerify(const std::string& data, const std::string& sig_string) const;
 
   ScopedEVP_PKEY pkey_;
+  // Initialized for verifying SHA-256 digests with |pkey_|, and copied
+  // for each signature rather than set up again every time.
+  ScopedEVP_PKEY_CTX verify_ctx_;
   ct::DigitallySigned::HashAlgorithm hash_algo_;
   ct::DigitallySigned::SignatureAlgorithm sig_algo_;
   std::string key_id_;
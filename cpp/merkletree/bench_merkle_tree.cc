@@ -0,0 +1,287 @@
+// Benchmarks of the Merkle trees, measuring throughput as well as the
+// allocations and memory they make per leaf. Typical use, saving a
+// baseline to compare a change against, with the compare.py tool of
+// Google Benchmark:
+//
+//   bench_merkle_tree --benchmark_out=before.json
+//   ... make the change ...
+//   bench_merkle_tree --benchmark_out=after.json
+//   compare.py benchmarks before.json after.json
+//
+// Trees of 1k leaves and up, by powers of ten, are benchmarked, up to
+// --max_leaves (set it to 100000000 for the largest logs, which takes
+// several GB of memory).
+#include <benchmark/benchmark.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <malloc.h>
+#include <stdint.h>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/sparse_merkle_tree.h"
+
+using std::atomic;
+using std::mt19937_64;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+DEFINE_int64(max_leaves, 1000000,
+             "largest tree to benchmark, in leaves; the smallest has 1000");
+DEFINE_int64(max_sparse_leaves, 100000,
+             "largest sparse Merkle tree to benchmark, in leaves, as "
+             "these are much bigger than the others for the same number "
+             "of leaves");
+
+namespace {
+
+
+// Counted by the operator new and delete below, which replace the
+// default ones for the whole binary.
+atomic<int64_t> num_allocs(0);
+atomic<int64_t> live_bytes(0);
+
+
+void* CountedAlloc(size_t size) {
+  void* const ptr(malloc(size ? size : 1));
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  num_allocs.fetch_add(1, std::memory_order_relaxed);
+  live_bytes.fetch_add(malloc_usable_size(ptr), std::memory_order_relaxed);
+  return ptr;
+}
+
+
+void CountedFree(void* ptr) {
+  if (ptr) {
+    live_bytes.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+    free(ptr);
+  }
+}
+
+
+}  // namespace
+
+
+void* operator new(size_t size) {
+  return CountedAlloc(size);
+}
+
+
+void operator delete(void* ptr) noexcept {
+  CountedFree(ptr);
+}
+
+
+void* operator new[](size_t size) {
+  return CountedAlloc(size);
+}
+
+
+void operator delete[](void* ptr) noexcept {
+  CountedFree(ptr);
+}
+
+
+namespace {
+
+
+// The number of distinct leaves, which are reused cyclically, so that
+// making them does not take more memory than the trees.
+const size_t kNumLeaves = 1 << 16;
+
+
+const vector<string>& LeafHashes() {
+  static const vector<string>* const hashes([]() {
+    vector<string>* const ret(new vector<string>);
+    for (size_t i = 0; i < kNumLeaves; ++i) {
+      ret->emplace_back(Sha256Hasher::Sha256Digest(std::to_string(i)));
+    }
+    return ret;
+  }());
+  return *hashes;
+}
+
+
+// Measures the allocations made between its construction and Report().
+class AllocationCounter {
+ public:
+  AllocationCounter()
+      : allocs_(num_allocs.load()), bytes_(live_bytes.load()) {
+  }
+
+  // Adds the allocations and bytes still allocated per leaf to the
+  // counters of |state|.
+  void Report(benchmark::State* state, int64_t num_leaves) const {
+    state->counters["allocs_per_leaf"] = benchmark::Counter(
+        static_cast<double>(num_allocs.load() - allocs_) / num_leaves);
+    state->counters["bytes_per_leaf"] = benchmark::Counter(
+        static_cast<double>(live_bytes.load() - bytes_) / num_leaves);
+  }
+
+ private:
+  const int64_t allocs_;
+  const int64_t bytes_;
+};
+
+
+// Returns a tree built with |num_leaves| leaves, which is only built
+// once for all the iterations of the benchmarks of that size.
+MerkleTree* GetTree(int64_t num_leaves) {
+  static unique_ptr<MerkleTree> tree;
+  static int64_t built_leaves(0);
+  if (!tree || built_leaves != num_leaves) {
+    built_leaves = num_leaves;
+    tree.reset();
+    tree.reset(new MerkleTree(new Sha256Hasher));
+    const vector<string>& hashes(LeafHashes());
+    for (int64_t i = 0; i < num_leaves; ++i) {
+      tree->AddLeafHash(hashes[i % hashes.size()]);
+    }
+    tree->CurrentRoot();
+  }
+  return tree.get();
+}
+
+
+void BM_MerkleTreeAddLeafHash(benchmark::State& state) {
+  const vector<string>& hashes(LeafHashes());
+  for (auto _ : state) {
+    AllocationCounter allocations;
+    MerkleTree tree(new Sha256Hasher);
+    for (int64_t i = 0; i < state.range(0); ++i) {
+      tree.AddLeafHash(hashes[i % hashes.size()]);
+    }
+    benchmark::DoNotOptimize(tree.CurrentRoot());
+    allocations.Report(&state, state.range(0));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+
+// Adds a leaf to a large tree, and gets its new root, as the log
+// signer does. The shared tree grows by a leaf every iteration, which
+// hardly changes its size.
+void BM_MerkleTreeCurrentRoot(benchmark::State& state) {
+  const vector<string>& hashes(LeafHashes());
+  MerkleTree* const tree(GetTree(state.range(0)));
+  for (auto _ : state) {
+    tree->AddLeafHash(hashes[tree->LeafCount() % hashes.size()]);
+    benchmark::DoNotOptimize(tree->CurrentRoot());
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+
+void BM_MerkleTreePathToCurrentRoot(benchmark::State& state) {
+  MerkleTree* const tree(GetTree(state.range(0)));
+  mt19937_64 rand(1234);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        tree->PathToCurrentRoot(1 + rand() % tree->LeafCount()));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+
+void BM_MerkleTreeSnapshotConsistency(benchmark::State& state) {
+  MerkleTree* const tree(GetTree(state.range(0)));
+  mt19937_64 rand(1234);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(tree->SnapshotConsistency(
+        1 + rand() % tree->LeafCount(), tree->LeafCount()));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+
+void BM_CompactMerkleTreeAddLeafHash(benchmark::State& state) {
+  const vector<string>& hashes(LeafHashes());
+  for (auto _ : state) {
+    AllocationCounter allocations;
+    CompactMerkleTree tree(new Sha256Hasher);
+    for (int64_t i = 0; i < state.range(0); ++i) {
+      tree.AddLeafHash(hashes[i % hashes.size()]);
+    }
+    benchmark::DoNotOptimize(tree.CurrentRoot());
+    allocations.Report(&state, state.range(0));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+
+void BM_SparseMerkleTreeSetLeaf(benchmark::State& state) {
+  for (auto _ : state) {
+    state.PauseTiming();
+    mt19937_64 rand(1234);
+    vector<SparseMerkleTree::Path> paths(state.range(0));
+    for (SparseMerkleTree::Path& path : paths) {
+      for (uint8_t& byte : path) {
+        byte = rand() & 0xff;
+      }
+    }
+    state.ResumeTiming();
+
+    AllocationCounter allocations;
+    SparseMerkleTree tree(new Sha256Hasher);
+    for (int64_t i = 0; i < state.range(0); ++i) {
+      tree.SetLeaf(paths[i], std::to_string(i));
+    }
+    benchmark::DoNotOptimize(tree.CurrentRoot());
+    allocations.Report(&state, state.range(0));
+  }
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+
+void RegisterSizes(benchmark::internal::Benchmark* benchmark,
+                   int64_t max_leaves) {
+  for (int64_t leaves = 1000; leaves <= max_leaves; leaves *= 10) {
+    benchmark->Arg(leaves);
+  }
+  benchmark->Unit(benchmark::kMicrosecond);
+}
+
+
+}  // namespace
+
+
+int main(int argc, char** argv) {
+  // Takes the --benchmark_* flags out first.
+  benchmark::Initialize(&argc, argv);
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  RegisterSizes(benchmark::RegisterBenchmark("BM_MerkleTreeAddLeafHash",
+                                             BM_MerkleTreeAddLeafHash),
+                FLAGS_max_leaves);
+  RegisterSizes(benchmark::RegisterBenchmark("BM_MerkleTreeCurrentRoot",
+                                             BM_MerkleTreeCurrentRoot),
+                FLAGS_max_leaves);
+  RegisterSizes(benchmark::RegisterBenchmark("BM_MerkleTreePathToCurrentRoot",
+                                             BM_MerkleTreePathToCurrentRoot),
+                FLAGS_max_leaves);
+  RegisterSizes(
+      benchmark::RegisterBenchmark("BM_MerkleTreeSnapshotConsistency",
+                                   BM_MerkleTreeSnapshotConsistency),
+      FLAGS_max_leaves);
+  RegisterSizes(benchmark::RegisterBenchmark("BM_CompactMerkleTreeAddLeafHash",
+                                             BM_CompactMerkleTreeAddLeafHash),
+                FLAGS_max_leaves);
+  RegisterSizes(benchmark::RegisterBenchmark("BM_SparseMerkleTreeSetLeaf",
+                                             BM_SparseMerkleTreeSetLeaf),
+                FLAGS_max_sparse_leaves);
+
+  benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
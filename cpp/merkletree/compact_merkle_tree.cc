@@ -2,13 +2,52 @@
 
 #include <assert.h>
 #include <stddef.h>
+#include <atomic>
 #include <string>
 #include <vector>
 
+#include "base/notification.h"
 #include "merkletree/merkle_tree_math.h"
+#include "util/executor.h"
 
 using cert_trans::MerkleTreeInterface;
+using cert_trans::Notification;
 using std::string;
+using std::vector;
+
+namespace {
+
+// Complete subtrees with at least this many levels are hashed on the
+// executor, smaller ones are not worth the overhead.
+const size_t kMinParallelSubtreeLevel = 10;
+
+// A complete subtree covering 2^|level| leaf hashes of a run, starting
+// at |offset|.
+struct Subtree {
+  size_t offset;
+  size_t level;
+  string root;
+};
+
+// Computes the root of the complete subtree |subtree| of |hashes|,
+// level-by-level.
+void HashSubtree(const TreeHasher& treehasher, const vector<string>& hashes,
+                 Subtree* subtree) {
+  const size_t digest_size(treehasher.DigestSize());
+  size_t count(static_cast<size_t>(1) << subtree->level);
+  string nodes;
+  nodes.reserve(count * digest_size);
+  for (size_t i = 0; i < count; ++i) {
+    assert(hashes[subtree->offset + i].size() == digest_size);
+    nodes.append(hashes[subtree->offset + i]);
+  }
+  // Each level overwrites the first half of the one below it.
+  for (; count > 1; count >>= 1)
+    treehasher.HashChildren(nodes.data(), count / 2, &nodes[0]);
+  subtree->root.assign(nodes, 0, digest_size);
+}
+
+}  // namespace
 
 CompactMerkleTree::CompactMerkleTree(SerialHasher* hasher)
     : MerkleTreeInterface(),
@@ -75,7 +114,7 @@ CompactMerkleTree::CompactMerkleTree(MerkleTree& model, SerialHasher* hasher)
         // if the level'th bit in the previous tree size is set, then we have
         // a proof path entry for this level (because proof entries cover the
         // maximum possible sub-tree.)
-        tree_[level] = *i;
+        tree_[level] = std::make_shared<const string>(*i);
         i++;
       }
       level++;
@@ -94,6 +133,31 @@ CompactMerkleTree::CompactMerkleTree(MerkleTree& model, SerialHasher* hasher)
 }
 
 
+CompactMerkleTree::CompactMerkleTree(size_t leaf_count,
+                                     const vector<string>& subtree_roots,
+                                     SerialHasher* hasher)
+    : MerkleTreeInterface(),
+      treehasher_(hasher),
+      leaf_count_(leaf_count),
+      leaves_processed_(0),
+      level_count_(MerkleTreeMath::LevelCount(leaf_count)),
+      root_(treehasher_.HashEmpty()) {
+  size_t levels(0);
+  while ((leaf_count >> levels) != 0)
+    ++levels;
+  tree_.resize(levels);
+  vector<string>::const_iterator root(subtree_roots.begin());
+  for (size_t level = levels; level > 0; --level) {
+    if (((leaf_count >> (level - 1)) & 1) != 0) {
+      assert(root != subtree_roots.end());
+      assert(root->size() == treehasher_.DigestSize());
+      tree_[level - 1] = std::make_shared<const string>(*root++);
+    }
+  }
+  assert(root == subtree_roots.end());
+}
+
+
 CompactMerkleTree::CompactMerkleTree(const CompactMerkleTree& other,
                                      SerialHasher* hasher)
     : tree_(other.tree_),
@@ -108,6 +172,12 @@ CompactMerkleTree::~CompactMerkleTree() {
 }
 
 
+std::unique_ptr<CompactMerkleTree> CompactMerkleTree::Snapshot() const {
+  return std::unique_ptr<CompactMerkleTree>(
+      new CompactMerkleTree(*this, treehasher_.CreateSerialHasher()));
+}
+
+
 size_t CompactMerkleTree::AddLeaf(const string& data) {
   return AddLeafHash(treehasher_.HashLeaf(data));
 }
@@ -122,23 +192,88 @@ size_t CompactMerkleTree::AddLeafHash(const string& hash) {
   return leaf_count_;
 }
 
+size_t CompactMerkleTree::AddLeafHashes(const vector<string>& hashes) {
+  return AddLeafHashes(hashes, nullptr);
+}
+
+size_t CompactMerkleTree::AddLeafHashes(const vector<string>& hashes,
+                                        util::Executor* executor) {
+  // Split the run into complete subtrees. A subtree of 2^k leaves can be
+  // merged in as a single node at level k as long as the tree size at
+  // that point is a multiple of 2^k.
+  vector<Subtree> subtrees;
+  size_t tree_size(leaf_count_);
+  for (size_t offset = 0; offset < hashes.size();) {
+    const size_t remaining(hashes.size() - offset);
+    size_t level(0);
+    while ((tree_size & ((static_cast<size_t>(2) << level) - 1)) == 0 &&
+           (static_cast<size_t>(2) << level) <= remaining)
+      ++level;
+    subtrees.push_back(Subtree{offset, level, string()});
+    offset += static_cast<size_t>(1) << level;
+    tree_size += static_cast<size_t>(1) << level;
+  }
+
+  size_t num_tasks(0);
+  for (const Subtree& subtree : subtrees) {
+    if (executor && subtree.level >= kMinParallelSubtreeLevel)
+      ++num_tasks;
+  }
+  std::atomic<size_t> pending(num_tasks);
+  Notification done;
+  for (Subtree& subtree : subtrees) {
+    if (executor && subtree.level >= kMinParallelSubtreeLevel) {
+      executor->Add([this, &hashes, &subtree, &pending, &done]() {
+        // TreeHasher serialises its callers, so use our own.
+        const TreeHasher treehasher(treehasher_.CreateSerialHasher());
+        HashSubtree(treehasher, hashes, &subtree);
+        if (--pending == 0)
+          done.Notify();
+      });
+    } else {
+      HashSubtree(treehasher_, hashes, &subtree);
+    }
+  }
+  if (num_tasks > 0)
+    done.WaitForNotification();
+
+  for (const Subtree& subtree : subtrees) {
+    PushBack(subtree.level, subtree.root);
+  }
+  leaf_count_ = tree_size;
+  level_count_ = MerkleTreeMath::LevelCount(leaf_count_);
+  return leaf_count_;
+}
+
 string CompactMerkleTree::CurrentRoot() {
   UpdateRoot();
   return root_;
 }
 
+vector<string> CompactMerkleTree::SubtreeRoots() const {
+  vector<string> roots;
+  for (size_t level = tree_.size(); level > 0; --level) {
+    if (tree_[level - 1])
+      roots.push_back(*tree_[level - 1]);
+  }
+  return roots;
+}
+
 void CompactMerkleTree::PushBack(size_t level, string node) {
   assert(node.size() == treehasher_.DigestSize());
   if (tree_.size() <= level) {
-    // First node at a new level.
-    tree_.push_back(node);
-  } else if (tree_[level].empty()) {
+    // First node at a new level. When merging in a complete subtree,
+    // there may be no lower levels yet.
+    tree_.resize(level);
+    tree_.push_back(std::make_shared<const string>(std::move(node)));
+  } else if (!tree_[level]) {
     // Lone left sibling.
-    tree_[level] = node;
+    tree_[level] = std::make_shared<const string>(std::move(node));
   } else {
     // Left sibling waiting: hash together and propagate up.
-    PushBack(level + 1, treehasher_.HashChildren(tree_[level], node));
-    tree_[level].clear();
+    treehasher_.HashChildren(tree_[level]->data(), node.data(), &node[0]);
+    PushBack(level + 1, std::move(node));
+    tree_[level].reset();
   }
 }
 
@@ -149,12 +284,13 @@ void CompactMerkleTree::UpdateRoot() {
   string right_sibling;
 
   for (size_t level = 0; level < tree_.size(); ++level) {
-    if (!tree_[level].empty()) {
+    if (tree_[level]) {
       // A lonely left sibling gets pulled up as a right sibling.
       if (right_sibling.empty())
-        right_sibling = tree_[level];
+        right_sibling = *tree_[level];
       else
-        right_sibling = treehasher_.HashChildren(tree_[level], right_sibling);
+        treehasher_.HashChildren(tree_[level]->data(), right_sibling.data(),
+                                 &right_sibling[0]);
     }
   }
 
@@ -2,6 +2,7 @@
 #define COMPACT_MERKLETREE_H
 
 #include <stddef.h>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -11,6 +12,10 @@
 
 class SerialHasher;
 
+namespace util {
+class Executor;
+}  // namespace util
+
 // A memory-efficient version of Merkle Trees; like MerkleTree
 // (see merkletree/merkle_tree.h) but can only add new leaves and report
 // its current root (i.e., it cannot do paths, snapshots or consistency).
@@ -22,6 +27,8 @@ class CompactMerkleTree : public cert_trans::MerkleTreeInterface {
   // instantiation of the SerialHasher abstract class.
   // Takes ownership of the hasher.
   explicit CompactMerkleTree(SerialHasher* hasher);
+  // Copies |other|, sharing its nodes, which are never modified: this
+  // only copies a pointer per level.
   CompactMerkleTree(const CompactMerkleTree& other, SerialHasher* hasher);
 
   explicit CompactMerkleTree(CompactMerkleTree&& other) = default;
@@ -31,6 +38,13 @@ class CompactMerkleTree : public cert_trans::MerkleTreeInterface {
   // Takes ownership of |hasher|.
   CompactMerkleTree(MerkleTree& model, SerialHasher* hasher);
 
+  // Creates the tree of |leaf_count| leaves whose SubtreeRoots() are
+  // |subtree_roots|, so that it can be carried on with.
+  // Takes ownership of |hasher|.
+  CompactMerkleTree(size_t leaf_count,
+                    const std::vector<std::string>& subtree_roots,
+                    SerialHasher* hasher);
+
   virtual ~CompactMerkleTree();
 
   // Length of a node (i.e., a hash), in bytes.
@@ -78,6 +92,24 @@ class CompactMerkleTree : public cert_trans::MerkleTreeInterface {
   // @param hash leaf hash
   virtual size_t AddLeafHash(const std::string& hash);
 
+  // Add a run of new leaves to the hash tree, in order. It is the
+  // caller's responsibility to ensure that the hashes are correct.
+  //
+  // The run is split into the largest complete subtrees that fit at the
+  // current position in the tree. The root of each is computed
+  // level-by-level, and then merged into the tree in a single step.
+  //
+  // Returns the position of the last leaf in the tree, i.e. the number
+  // of leaves in the tree after this update.
+  //
+  // @param hashes leaf hashes
+  virtual size_t AddLeafHashes(const std::vector<std::string>& hashes);
+
+  // As above, but the roots of large complete subtrees are computed in
+  // parallel on |executor|. Blocks until all of them are done.
+  size_t AddLeafHashes(const std::vector<std::string>& hashes,
+                       util::Executor* executor);
+
   // Get the current root of the tree.
   // Update the root to reflect the current shape of the tree,
   // and return the tree digest.
@@ -86,7 +118,21 @@ class CompactMerkleTree : public cert_trans::MerkleTreeInterface {
   // (and hence, no root).
   virtual std::string CurrentRoot();
 
+  // The roots of the complete subtrees that the tree is made of, from the
+  // largest to the smallest, one for each bit set in LeafCount(). This is
+  // all the state of the tree, see the constructor above.
+  std::vector<std::string> SubtreeRoots() const;
+
+  // Returns a copy of the tree as it is now, with a hasher of its own,
+  // which is cheap to take (see the copy constructor). Since the two
+  // share nothing that is modified, the copy can be used (e.g., to
+  // compute its root) on another thread while this tree keeps growing.
+  std::unique_ptr<CompactMerkleTree> Snapshot() const;
+
  private:
+  // An immutable node, shared by the copies of the tree.
+  typedef std::shared_ptr<const std::string> Node;
+
   // Append a node to the level.
   void PushBack(size_t level, std::string node);
 
@@ -94,7 +140,7 @@ class CompactMerkleTree : public cert_trans::MerkleTreeInterface {
   // Since the tree is append-only to the right, at any given point in time,
   // at each level, all nodes that have a right sibling are fixed and will
   // no longer change. Thus we store, for each level i, only the last lone
-  // left node (if one exists) or an empty string otherwise (tree_[i]).
+  // left node (if one exists) or NULL otherwise (tree_[i]).
   //
   //        ___hash___
   //       |          |
@@ -134,7 +180,7 @@ class CompactMerkleTree : public cert_trans::MerkleTreeInterface {
   // |      |      tree_[0]
   // --------
 
-  std::vector<std::string> tree_;
+  std::vector<Node> tree_;
   TreeHasher treehasher_;
   // True number of leaves in the tree.
   size_t leaf_count_;
@@ -0,0 +1,121 @@
+#include "merkletree/leveldb_sparse_merkle_tree_store.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <leveldb/write_batch.h>
+#include <string>
+#include <tuple>
+
+using std::get;
+using std::string;
+using std::unique_ptr;
+
+// Most node lookups made while updating a sparse tree are for nodes that
+// do not exist, which is what bloom filters are good at, so they are on by
+// default.
+DEFINE_int32(sparse_merkle_tree_bloom_filter_bits_per_key, 10,
+             "number of bits per key of the leveldb bloom filter of sparse "
+             "Merkle tree stores, or 0 for no bloom filter");
+
+namespace cert_trans {
+namespace {
+
+
+const char kNodePrefix[] = "node-";
+const char kValuePrefix[] = "value-";
+
+
+#ifdef HAVE_LEVELDB_FILTER_POLICY_H
+unique_ptr<const leveldb::FilterPolicy> BuildFilterPolicy() {
+  unique_ptr<const leveldb::FilterPolicy> retval;
+
+  if (FLAGS_sparse_merkle_tree_bloom_filter_bits_per_key > 0) {
+    retval.reset(CHECK_NOTNULL(leveldb::NewBloomFilterPolicy(
+        FLAGS_sparse_merkle_tree_bloom_filter_bits_per_key)));
+  }
+
+  return retval;
+}
+#endif
+
+
+void AppendBigEndian(uint64_t value, size_t bytes, string* out) {
+  for (size_t i = bytes; i > 0; --i) {
+    out->push_back(static_cast<char>((value >> ((i - 1) * 8)) & 0xff));
+  }
+}
+
+
+string NodeKey(size_t depth, uint64_t index) {
+  string key(kNodePrefix);
+  AppendBigEndian(depth, 2, &key);
+  AppendBigEndian(index, sizeof(index), &key);
+  return key;
+}
+
+
+string ValueKey(const string& path) {
+  return kValuePrefix + path;
+}
+
+
+}  // namespace
+
+
+LevelDBSparseMerkleTreeStore::LevelDBSparseMerkleTreeStore(
+    const string& dbfile)
+#ifdef HAVE_LEVELDB_FILTER_POLICY_H
+    : filter_policy_(BuildFilterPolicy())
+#endif
+{
+  LOG(INFO) << "Opening " << dbfile;
+  leveldb::Options options;
+  options.create_if_missing = true;
+#ifdef HAVE_LEVELDB_FILTER_POLICY_H
+  options.filter_policy = filter_policy_.get();
+#endif
+  leveldb::DB* db;
+  leveldb::Status status(leveldb::DB::Open(options, dbfile, &db));
+  CHECK(status.ok()) << status.ToString();
+  db_.reset(db);
+}
+
+
+bool LevelDBSparseMerkleTreeStore::GetNode(size_t depth, uint64_t index,
+                                           string* node) const {
+  const leveldb::Status status(
+      db_->Get(leveldb::ReadOptions(), NodeKey(depth, index), node));
+  CHECK(status.ok() || status.IsNotFound()) << status.ToString();
+  return status.ok();
+}
+
+
+bool LevelDBSparseMerkleTreeStore::GetValue(const string& path,
+                                            string* value) const {
+  const leveldb::Status status(
+      db_->Get(leveldb::ReadOptions(), ValueKey(path), value));
+  CHECK(status.ok() || status.IsNotFound()) << status.ToString();
+  return status.ok();
+}
+
+
+util::Status LevelDBSparseMerkleTreeStore::Write(const WriteBatch& batch) {
+  leveldb::WriteBatch leveldb_batch;
+  for (const auto& node : batch.nodes()) {
+    leveldb_batch.Put(NodeKey(get<0>(node), get<1>(node)), get<2>(node));
+  }
+  for (const auto& value : batch.values()) {
+    leveldb_batch.Put(ValueKey(value.first), value.second);
+  }
+
+  const leveldb::Status status(
+      db_->Write(leveldb::WriteOptions(), &leveldb_batch));
+  if (!status.ok()) {
+    return util::Status(util::error::INTERNAL,
+                        "leveldb write failed: " + status.ToString());
+  }
+  return util::Status::OK;
+}
+
+
+}  // namespace cert_trans
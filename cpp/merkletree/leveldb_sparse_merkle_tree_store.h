@@ -0,0 +1,49 @@
+#ifndef CERT_TRANS_MERKLETREE_LEVELDB_SPARSE_MERKLE_TREE_STORE_H_
+#define CERT_TRANS_MERKLETREE_LEVELDB_SPARSE_MERKLE_TREE_STORE_H_
+
+#include "config.h"
+
+#include <leveldb/db.h>
+#ifdef HAVE_LEVELDB_FILTER_POLICY_H
+#include <leveldb/filter_policy.h>
+#endif
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+#include "base/macros.h"
+#include "merkletree/sparse_merkle_tree_store.h"
+
+namespace cert_trans {
+
+
+// A SparseMerkleTreeStore kept in a LevelDB database of its own.
+//
+// Nodes are keyed by their depth and index, both big-endian, so that the
+// nodes of each level are stored together and in path order.
+class LevelDBSparseMerkleTreeStore : public SparseMerkleTreeStore {
+ public:
+  // Opens the database in |dbfile|, creating it if needed.
+  explicit LevelDBSparseMerkleTreeStore(const std::string& dbfile);
+  ~LevelDBSparseMerkleTreeStore() override = default;
+
+  bool GetNode(size_t depth, uint64_t index,
+               std::string* node) const override;
+  bool GetValue(const std::string& path, std::string* value) const override;
+  util::Status Write(const WriteBatch& batch) override;
+
+ private:
+#ifdef HAVE_LEVELDB_FILTER_POLICY_H
+  // filter_policy_ must be valid for the lifetime of db_.
+  const std::unique_ptr<const leveldb::FilterPolicy> filter_policy_;
+#endif
+  std::unique_ptr<leveldb::DB> db_;
+
+  DISALLOW_COPY_AND_ASSIGN(LevelDBSparseMerkleTreeStore);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MERKLETREE_LEVELDB_SPARSE_MERKLE_TREE_STORE_H_
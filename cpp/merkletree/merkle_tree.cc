@@ -2,19 +2,57 @@
 
 #include <assert.h>
 #include <stddef.h>
+#include <string.h>
+#include <algorithm>
 #include <string>
 #include <vector>
 
 #include "merkletree/merkle_tree_math.h"
+#include "util/executor.h"
+#include "util/sync_task.h"
 
-using cert_trans::MerkleTreeInterface;
+using cert_trans::AuditableMerkleTreeInterface;
 using std::string;
 
+namespace {
+
+// Number of sibling pairs hashed in one batch when evaluating the tree.
+const size_t kHashBatchSize = 512;
+
+// When hashing in parallel, each task computes the parents of this many
+// pairs, and the parents of up to kParallelChunks chunks are collected
+// before they are appended to the tree.
+const size_t kParallelChunkSize = 1 << 14;
+const size_t kParallelChunks = 64;
+
+// Computes the parents of the |count| pairs of siblings in |children|
+// starting at node |first|, and writes them back to back to |parents|.
+void HashPairs(const TreeHasher& treehasher,
+               const cert_trans::NodeStore& children, size_t first,
+               size_t count, char* parents) {
+  const size_t digest_size(treehasher.DigestSize());
+  string nodes;
+  for (size_t done = 0; done < count;) {
+    const size_t batch(std::min(kHashBatchSize, count - done));
+    nodes.resize(2 * batch * digest_size);
+    for (size_t i = 0; i < 2 * batch; ++i) {
+      memcpy(&nodes[i * digest_size], children.at(first + 2 * done + i),
+             digest_size);
+    }
+    treehasher.HashChildren(nodes.data(), batch,
+                            parents + done * digest_size);
+    done += batch;
+  }
+}
+
+}  // namespace
+
 MerkleTree::MerkleTree(SerialHasher* hasher)
-    : MerkleTreeInterface(),
+    : AuditableMerkleTreeInterface(),
       treehasher_(hasher),
       leaves_processed_(0),
-      level_count_(0) {
+      level_count_(0),
+      executor_(nullptr) {
 }
 
 MerkleTree::~MerkleTree() {
@@ -41,6 +79,20 @@ size_t MerkleTree::AddLeafHash(const string& hash) {
   return leaf_count;
 }
 
+size_t MerkleTree::AddLeafHashes(const std::vector<string>& hashes) {
+  if (hashes.empty())
+    return LeafCount();
+  if (LazyLevelCount() == 0) {
+    AddLevel();
+    // The first leaf hash is also the first root.
+    leaves_processed_ = 1;
+  }
+  for (const string& hash : hashes)
+    PushBack(0, hash);
+  level_count_ = MerkleTreeMath::LevelCount(LeafCount());
+  return LeafCount();
+}
+
 string MerkleTree::CurrentRoot() {
   return RootAtSnapshot(LeafCount());
 }
@@ -67,11 +119,78 @@ std::vector<string> MerkleTree::PathToRootAtSnapshot(size_t leaf,
   size_t leaf_count = LeafCount();
   if (leaf > snapshot || snapshot > leaf_count || leaf == 0)
     return path;
-  return PathFromNodeToRootAtSnapshot(leaf - 1, 0, snapshot);
+  return PathFromNodeToRootAtSnapshot(leaf - 1, 0, snapshot, NULL);
+}
+
+std::vector<string> MerkleTree::PathToRootAtSnapshot(
+    size_t leaf, size_t snapshot, const std::vector<string>& frontier) {
+  std::vector<string> path;
+  size_t leaf_count = LeafCount();
+  if (leaf > snapshot || snapshot > leaf_count || leaf == 0)
+    return path;
+  assert(frontier.size() == MerkleTreeMath::LevelCount(snapshot));
+  return PathFromNodeToRootAtSnapshot(leaf - 1, 0, snapshot, &frontier);
 }
 
 std::vector<string> MerkleTree::SnapshotConsistency(size_t snapshot1,
                                                     size_t snapshot2) {
+  return SnapshotConsistencyInternal(snapshot1, snapshot2, NULL);
+}
+
+std::vector<string> MerkleTree::SnapshotConsistency(
+    size_t snapshot1, size_t snapshot2, const std::vector<string>& frontier2) {
+  return SnapshotConsistencyInternal(snapshot1, snapshot2, &frontier2);
+}
+
+std::vector<string> MerkleTree::SnapshotFrontier(size_t snapshot) {
+  std::vector<string> frontier;
+  if (snapshot == 0 || snapshot > LeafCount())
+    return frontier;
+  if (snapshot > leaves_processed_) {
+    // Bring the tree sufficiently up to date.
+    UpdateToSnapshot(snapshot);
+  }
+
+  size_t level = 0;
+  // Index of the rightmost node at the current level for this snapshot.
+  size_t last_node = snapshot - 1;
+  // Right children on the path of the last leaf are roots of complete
+  // subtrees, and are equal to those in the tree.
+  while (MerkleTreeMath::IsRightChild(last_node)) {
+    frontier.push_back(Node(level, last_node));
+    last_node = MerkleTreeMath::Parent(last_node);
+    ++level;
+  }
+
+  // Then so is the first left child. Above it, recompute the border.
+  string subtree_root = Node(level, last_node);
+  frontier.push_back(subtree_root);
+  while (last_node) {
+    if (MerkleTreeMath::IsRightChild(last_node)) {
+      treehasher_.HashChildren(tree_[level].at(last_node - 1),
+                               subtree_root.data(), &subtree_root[0]);
+    }
+    // Else the parent is a dummy copy of the current node.
+    last_node = MerkleTreeMath::Parent(last_node);
+    ++level;
+    frontier.push_back(subtree_root);
+  }
+  assert(frontier.size() == MerkleTreeMath::LevelCount(snapshot));
+  return frontier;
+}
+
+string MerkleTree::CompleteSubtreeRoot(size_t level, size_t index) {
+  if (level >= level_count_ || index >= (LeafCount() >> level))
+    return string();
+  if (((index + 1) << level) > leaves_processed_) {
+    // Bring the tree sufficiently up to date.
+    UpdateToSnapshot(LeafCount());
+  }
+  return Node(level, index);
+}
+
+std::vector<string> MerkleTree::SnapshotConsistencyInternal(
+    size_t snapshot1, size_t snapshot2, const std::vector<string>* frontier2) {
   std::vector<string> proof;
   size_t leaf_count = LeafCount();
   if (snapshot1 == 0 || snapshot1 >= snapshot2 || snapshot2 > leaf_count)
@@ -97,12 +216,43 @@ std::vector<string> MerkleTree::SnapshotConsistency(size_t snapshot1,
     proof.push_back(Node(level, node));
 
   // Now record the path from this node to the root of snapshot2.
+  assert(!frontier2 ||
+         frontier2->size() == MerkleTreeMath::LevelCount(snapshot2));
   std::vector<string> path =
-      PathFromNodeToRootAtSnapshot(node, level, snapshot2);
+      PathFromNodeToRootAtSnapshot(node, level, snapshot2, frontier2);
   proof.insert(proof.end(), path.begin(), path.end());
   return proof;
 }
 
+cert_trans::NodeStore MerkleTree::NewLevel(size_t) {
+  return cert_trans::NodeStore(treehasher_.DigestSize());
+}
+
+string MerkleTree::RestoreLevels(std::vector<cert_trans::NodeStore> levels,
+                                 size_t leaf_count) {
+  tree_ = std::move(levels);
+  leaves_processed_ = leaf_count;
+  level_count_ = MerkleTreeMath::LevelCount(leaf_count);
+  assert(LazyLevelCount() == level_count_);
+  if (leaf_count == 0)
+    return treehasher_.HashEmpty();
+
+  // Index of the last node at the current level.
+  size_t last_node = leaf_count - 1;
+  for (size_t level = 0; level + 1 < LazyLevelCount(); ++level) {
+    assert(NodeCount(level) == last_node + 1);
+    string parent(Node(level, last_node));
+    if (MerkleTreeMath::IsRightChild(last_node)) {
+      treehasher_.HashChildren(tree_[level].at(last_node - 1), parent.data(),
+                               &parent[0]);
+    }
+    last_node = MerkleTreeMath::Parent(last_node);
+    PopBack(level + 1);
+    PushBack(level + 1, parent);
+  }
+  return Root();
+}
+
 string MerkleTree::UpdateToSnapshot(size_t snapshot) {
   if (snapshot == 0)
     return treehasher_.HashEmpty();
@@ -134,10 +284,7 @@ string MerkleTree::UpdateToSnapshot(size_t snapshot) {
 
     // Compute the parents of new nodes at the current level.
     // Start with a left sibling and parse an even number of nodes.
-    for (size_t j = first_node & ~1; j < last_node; j += 2) {
-      PushBack(level + 1,
-               treehasher_.HashChildren(Node(level, j), Node(level, j + 1)));
-    }
+    PushParents(level, first_node & ~1, last_node);
     // If the last node at the current level is a left sibling,
     // dummy-propagate it one level up.
     if (!MerkleTreeMath::IsRightChild(last_node))
@@ -152,6 +299,50 @@ string MerkleTree::UpdateToSnapshot(size_t snapshot) {
   return Root();
 }
 
+void MerkleTree::PushParents(size_t level, size_t first, size_t last) {
+  assert(!MerkleTreeMath::IsRightChild(first));
+  assert(first <= last);
+  const size_t digest_size(treehasher_.DigestSize());
+  const cert_trans::NodeStore& children(tree_[level]);
+  const size_t count((last - first + 1) / 2);
+  // Below two chunks, parallel hashing is not worth the overhead.
+  const bool parallel(executor_ && count >= 2 * kParallelChunkSize);
+  const size_t round_size(parallel ? kParallelChunks * kParallelChunkSize
+                                   : kHashBatchSize);
+
+  string parents;
+  for (size_t done = 0; done < count;) {
+    const size_t round(std::min(round_size, count - done));
+    const size_t round_first(first + 2 * done);
+    parents.resize(round * digest_size);
+    if (parallel) {
+      // The chunks are disjoint complete subtrees of the next level up,
+      // so they can be hashed independently.
+      util::SyncTask sync(executor_);
+      for (size_t offset = 0; offset < round; offset += kParallelChunkSize) {
+        const size_t chunk(std::min(kParallelChunkSize, round - offset));
+        char* const out(&parents[offset * digest_size]);
+        sync.task()->AddHold();
+        executor_->Add([this, &children, &sync, round_first, offset, chunk,
+                        out]() {
+          // TreeHasher serialises its callers, so use our own.
+          const TreeHasher treehasher(treehasher_.CreateSerialHasher());
+          HashPairs(treehasher, children, round_first + 2 * offset, chunk,
+                    out);
+          sync.task()->RemoveHold();
+        });
+      }
+      sync.task()->Return();
+      sync.Wait();
+    } else {
+      HashPairs(treehasher_, children, round_first, round, &parents[0]);
+    }
+    for (size_t i = 0; i < round; ++i)
+      tree_[level + 1].PushBack(parents.data() + i * digest_size);
+    done += round;
+  }
+}
+
 string MerkleTree::RecomputePastSnapshot(size_t snapshot, size_t node_level,
                                          string* node) {
   size_t level = 0;
@@ -193,8 +384,8 @@ string MerkleTree::RecomputePastSnapshot(size_t snapshot, size_t node_level,
   while (last_node) {
     if (MerkleTreeMath::IsRightChild(last_node)) {
       // Recompute the parent of tree_[level][last_node].
-      subtree_root =
-          treehasher_.HashChildren(Node(level, last_node - 1), subtree_root);
+      treehasher_.HashChildren(tree_[level].at(last_node - 1),
+                               subtree_root.data(), &subtree_root[0]);
     }
     // Else the parent is a dummy copy of the current node; do nothing.
 
@@ -207,9 +398,9 @@ string MerkleTree::RecomputePastSnapshot(size_t snapshot, size_t node_level,
   return subtree_root;
 }
 
-std::vector<string> MerkleTree::PathFromNodeToRootAtSnapshot(size_t node,
-                                                             size_t level,
-                                                             size_t snapshot) {
+std::vector<string> MerkleTree::PathFromNodeToRootAtSnapshot(
+    size_t node, size_t level, size_t snapshot,
+    const std::vector<string>* frontier) {
   std::vector<string> path;
   if (snapshot == 0)
     return path;
@@ -233,9 +424,13 @@ std::vector<string> MerkleTree::PathFromNodeToRootAtSnapshot(size_t node,
     } else if (sibling == last_node) {
       // The sibling is the last node of the level in the snapshot tree,
       // so we get its value for the snapshot. Get the root in the same pass.
-      string recompute_node;
-      RecomputePastSnapshot(snapshot, level, &recompute_node);
-      path.push_back(recompute_node);
+      if (frontier) {
+        path.push_back((*frontier)[level]);
+      } else {
+        string recompute_node;
+        RecomputePastSnapshot(snapshot, level, &recompute_node);
+        path.push_back(recompute_node);
+      }
     }
     // Else sibling > last_node so the sibling does not exist. Do nothing.
     // Continue moving up in the tree, ignoring dummy copies.
@@ -250,38 +445,37 @@ std::vector<string> MerkleTree::PathFromNodeToRootAtSnapshot(size_t node,
 
 string MerkleTree::Node(size_t level, size_t index) const {
   assert(NodeCount(level) > index);
-  return tree_[level].substr(index * treehasher_.DigestSize(),
-                             treehasher_.DigestSize());
+  return tree_[level].Get(index);
 }
 
 string MerkleTree::Root() const {
-  assert(tree_.back().size() == treehasher_.DigestSize());
-  return tree_.back();
+  assert(tree_.back().size() == 1U);
+  return tree_.back().Get(0);
 }
 
 size_t MerkleTree::NodeCount(size_t level) const {
   assert(LazyLevelCount() > level);
-  return tree_[level].size() / treehasher_.DigestSize();
+  return tree_[level].size();
 }
 
 string MerkleTree::LastNode(size_t level) const {
   assert(NodeCount(level) >= 1U);
-  return tree_[level].substr(tree_[level].size() - treehasher_.DigestSize());
+  return tree_[level].Back();
 }
 
 void MerkleTree::PopBack(size_t level) {
   assert(NodeCount(level) >= 1U);
-  tree_[level].erase(tree_[level].size() - treehasher_.DigestSize());
+  tree_[level].PopBack();
 }
 
 void MerkleTree::PushBack(size_t level, string node) {
   assert(node.size() == treehasher_.DigestSize());
   assert(LazyLevelCount() > level);
-  tree_[level].append(node);
+  tree_[level].PushBack(node);
 }
 
 void MerkleTree::AddLevel() {
-  tree_.push_back(string());
+  tree_.push_back(NewLevel(tree_.size()));
 }
 
 size_t MerkleTree::LazyLevelCount() const {
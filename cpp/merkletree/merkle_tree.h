@@ -7,6 +7,7 @@
 #include <vector>
 
 #include "merkletree/merkle_tree_interface.h"
+#include "merkletree/node_store.h"
 #include "merkletree/tree_hasher.h"
 
 class SerialHasher;
@@ -20,7 +21,7 @@ class SerialHasher;
 // resistance.
 //
 // This class is thread-compatible, but not thread-safe.
-class MerkleTree : public cert_trans::MerkleTreeInterface {
+class MerkleTree : public cert_trans::AuditableMerkleTreeInterface {
  public:
   // The constructor takes a pointer to some concrete hash function
   // instantiation of the SerialHasher abstract class.
@@ -28,6 +29,14 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   explicit MerkleTree(SerialHasher* hasher);
   virtual ~MerkleTree();
 
+  // From now on, evaluate large levels of the tree in parallel on
+  // |executor|, or on the calling thread only if |executor| is NULL.
+  // Queries block until the parallel work is done, so they must not be
+  // made from |executor| itself. Does not take ownership.
+  virtual void SetExecutor(util::Executor* executor) {
+    executor_ = executor;
+  }
+
   // Length of a node (i.e., a hash), in bytes.
   virtual size_t NodeSize() const {
     return treehasher_.DigestSize();
@@ -39,7 +48,7 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   }
 
   // The |leaf|th leaf hash in the tree. Indexing starts from 1.
-  std::string LeafHash(size_t leaf) const {
+  virtual std::string LeafHash(size_t leaf) const {
     if (leaf == 0 || leaf > LeafCount())
       return std::string();
     return Node(0, leaf - 1);
@@ -80,6 +89,18 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // @param hash leaf hash
   virtual size_t AddLeafHash(const std::string& hash);
 
+  // Add a run of new leaves to the hash tree. Stores the provided hashes
+  // in the tree structure. It is the caller's responsibility to ensure
+  // that the hashes are correct.
+  //
+  // (We will evaluate the tree lazily, and not update the root here.)
+  //
+  // Returns the position of the last leaf in the tree, i.e. the number
+  // of leaves in the tree after this update.
+  //
+  // @param hashes leaf hashes
+  virtual size_t AddLeafHashes(const std::vector<std::string>& hashes);
+
   // Get the current root of the tree.
   // Update the root to reflect the current shape of the tree,
   // and return the tree digest.
@@ -96,7 +117,7 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // (i.e., the tree is not large enough).
   //
   // @param snapshot point in time (= number of leaves at that point).
-  std::string RootAtSnapshot(size_t snapshot);
+  virtual std::string RootAtSnapshot(size_t snapshot);
 
   // Get the Merkle path from leaf to root.
   //
@@ -107,7 +128,7 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // or the leaf index is 0.
   //
   // @param leaf the index of the leaf the path is for.
-  std::vector<std::string> PathToCurrentRoot(size_t leaf);
+  virtual std::vector<std::string> PathToCurrentRoot(size_t leaf);
 
   // Get the Merkle path from leaf to the root of a previous snapshot.
   //
@@ -119,7 +140,14 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   //
   // @param leaf the index of the leaf the path is for.
   // @param snapshot point in time (= number of leaves at that point)
-  std::vector<std::string> PathToRootAtSnapshot(size_t leaf, size_t snapshot);
+  virtual std::vector<std::string> PathToRootAtSnapshot(size_t leaf,
+                                                        size_t snapshot);
+
+  // As above, but uses |frontier|, which must be
+  // SnapshotFrontier(snapshot), rather than recomputing the right border
+  // of the snapshot tree.
+  virtual std::vector<std::string> PathToRootAtSnapshot(
+      size_t leaf, size_t snapshot, const std::vector<std::string>& frontier);
 
   // Get the Merkle consistency proof between two snapshots.
   // Returns a vector of node hashes, ordered according to levels.
@@ -128,22 +156,77 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   //
   // @param snapshot1 the first point in time
   // @param snapshot2 the second point in time
-  std::vector<std::string> SnapshotConsistency(size_t snapshot1,
-                                               size_t snapshot2);
+  virtual std::vector<std::string> SnapshotConsistency(size_t snapshot1,
+                                                       size_t snapshot2);
+
+  // As above, but uses |frontier2|, which must be
+  // SnapshotFrontier(snapshot2), rather than recomputing the right
+  // border of the second snapshot tree.
+  virtual std::vector<std::string> SnapshotConsistency(
+      size_t snapshot1, size_t snapshot2,
+      const std::vector<std::string>& frontier2);
+
+  // Get the right border of the tree at a snapshot: the value, in the
+  // snapshot tree, of the last node at each level, ordered from the last
+  // leaf up to the root. Past snapshots have to be recomputed along this
+  // border, so callers that repeatedly ask for proofs against the same
+  // snapshot can keep its frontier and pass it to the methods above.
+  //
+  // Returns an empty vector if the snapshot is 0 or in the future.
+  //
+  // @param snapshot point in time (= number of leaves at that point)
+  virtual std::vector<std::string> SnapshotFrontier(size_t snapshot);
+
+  // Get the root of the |index|-th complete subtree of 2^|level|
+  // leaves, i.e. the |index|-th node at level |level|, counting from 0,
+  // in any tree of at least (|index| + 1) * 2^|level| leaves. Such nodes
+  // never change once the tree is large enough.
+  //
+  // Returns an empty string if the tree is not large enough.
+  virtual std::string CompleteSubtreeRoot(size_t level, size_t index);
+
+ protected:
+  // Returns a new, empty store for the nodes of level |level|.
+  // Subclasses can override this to change where the nodes are kept.
+  virtual cert_trans::NodeStore NewLevel(size_t level);
+
+  // Replaces the contents of the tree with |levels|, which must hold the
+  // nodes of a fully evaluated tree with |leaf_count| leaves, i.e.
+  // ceil(leaf_count / 2^i) nodes at level i. Only the nodes that are
+  // fixed are trusted: the last node of every level above the leaves is
+  // recomputed, as it may be stale.
+  // Returns the root of the restored tree.
+  std::string RestoreLevels(std::vector<cert_trans::NodeStore> levels,
+                            size_t leaf_count);
+
+  // The node stores making up the tree, bottom-up.
+  std::vector<cert_trans::NodeStore>* mutable_levels() {
+    return &tree_;
+  }
 
  private:
   // Update to a given snapshot, return the root.
   std::string UpdateToSnapshot(size_t snapshot);
+  // Append to level |level| + 1 the parents of the pairs of siblings at
+  // level |level| from node |first|, a left child, up to node |last|.
+  // If |last| is a left child, it is left out.
+  void PushParents(size_t level, size_t first, size_t last);
   // Return the root of a past snapshot.
   // If node is not NULL, additionally record the rightmost node
   // for the given snapshot and node_level.
   std::string RecomputePastSnapshot(size_t snapshot, size_t node_level,
                                     std::string* node);
+  // Consistency proof between two snapshots, using the frontier of the
+  // second one if |frontier2| is not NULL.
+  std::vector<std::string> SnapshotConsistencyInternal(
+      size_t snapshot1, size_t snapshot2,
+      const std::vector<std::string>* frontier2);
   // Path from a node at a given level (both indexed starting with 0)
-  // to the root at a given snapshot.
-  std::vector<std::string> PathFromNodeToRootAtSnapshot(size_t node_index,
-                                                        size_t level,
-                                                        size_t snapshot);
+  // to the root at a given snapshot. If |frontier| is not NULL, it is
+  // the frontier of the snapshot.
+  std::vector<std::string> PathFromNodeToRootAtSnapshot(
+      size_t node_index, size_t level, size_t snapshot,
+      const std::vector<std::string>* frontier);
   // Get the |index|-th node at level |level|. Indexing starts at 0;
   // caller is responsible for ensuring tree is sufficiently up to date.
   std::string Node(size_t level, size_t index) const;
@@ -201,12 +284,18 @@ class MerkleTree : public cert_trans::MerkleTreeInterface {
   // Since the tree is append-only from the right, at any given point in time,
   // at each level, all nodes computed so far, except possibly the last node,
   // are fixed and will no longer change.
-  std::vector<std::string> tree_;
+  //
+  // Each level is a NodeStore holding fixed-width nodes in pages that are
+  // never reallocated, so growing a level does not copy the nodes already
+  // in it.
+  std::vector<cert_trans::NodeStore> tree_;
   TreeHasher treehasher_;
   // Number of leaves propagated up to the root,
   // to keep track of lazy evaluation.
   size_t leaves_processed_;
   // The "true" level count for a fully evaluated tree.
   size_t level_count_;
+  // If set, large levels are hashed in parallel on this executor.
+  util::Executor* executor_;
 };
 #endif
@@ -6,9 +6,14 @@
 
 #include <stddef.h>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 
+namespace util {
+class Executor;
+}  // namespace util
+
 namespace cert_trans {
 
 // An interface for Merkle trees.  See specializations in
@@ -49,6 +54,15 @@ class MerkleTreeInterface {
   // @param hash leaf hash
   virtual size_t AddLeafHash(const std::string& hash) = 0;
 
+  // Add a run of new leaves to the hash tree, in order. Equivalent to
+  // calling AddLeafHash() for each of |hashes|, but cheaper.
+  //
+  // Returns the position of the last leaf in the tree, i.e. the number
+  // of leaves in the tree after this update.
+  //
+  // @param hashes leaf hashes
+  virtual size_t AddLeafHashes(const std::vector<std::string>& hashes) = 0;
+
   // Get the current root of the tree.
   // Update the root to reflect the current shape of the tree,
   // and return the tree digest.
@@ -61,6 +75,37 @@ class MerkleTreeInterface {
   DISALLOW_COPY_AND_ASSIGN(MerkleTreeInterface);
 };
 
+// An interface for the Merkle trees that keep all of their leaves, and
+// can serve proofs for any of their snapshots. See merkletree/merkle_tree.h
+// for the documentation of the methods, and
+// merkletree/tiered_merkle_tree.h for another implementation.
+class AuditableMerkleTreeInterface : public MerkleTreeInterface {
+ public:
+  using MerkleTreeInterface::LeafHash;
+
+  // The |leaf|th leaf hash in the tree. Indexing starts from 1.
+  virtual std::string LeafHash(size_t leaf) const = 0;
+
+  // Evaluate the tree in parallel on |executor|, if the implementation
+  // can. Does not take ownership.
+  virtual void SetExecutor(util::Executor* executor) = 0;
+
+  virtual std::string RootAtSnapshot(size_t snapshot) = 0;
+  virtual std::vector<std::string> PathToCurrentRoot(size_t leaf) = 0;
+  virtual std::vector<std::string> PathToRootAtSnapshot(size_t leaf,
+                                                        size_t snapshot) = 0;
+  virtual std::vector<std::string> PathToRootAtSnapshot(
+      size_t leaf, size_t snapshot,
+      const std::vector<std::string>& frontier) = 0;
+  virtual std::vector<std::string> SnapshotConsistency(size_t snapshot1,
+                                                       size_t snapshot2) = 0;
+  virtual std::vector<std::string> SnapshotConsistency(
+      size_t snapshot1, size_t snapshot2,
+      const std::vector<std::string>& frontier2) = 0;
+  virtual std::vector<std::string> SnapshotFrontier(size_t snapshot) = 0;
+  virtual std::string CompleteSubtreeRoot(size_t level, size_t index) = 0;
+};
+
 }  // namespace cert_trans
 
 #endif  // SRC_MERKLETREE_MERKLE_TREE_INTERFACE_H_
@@ -13,6 +13,17 @@ bool MerkleTreeMath::IsPowerOfTwoPlusOne(size_t leaf_count) {
   return (((leaf_count - 1) & (leaf_count - 2)) == 0);
 }
 
+// static
+size_t MerkleTreeMath::LevelCount(size_t leaf_count) {
+  if (leaf_count == 0)
+    return 0;
+  // A k-level tree can hold 2^{k-1} leaves.
+  size_t level_count(1);
+  while (leaf_count > (static_cast<size_t>(1) << (level_count - 1)))
+    ++level_count;
+  return level_count;
+}
+
 // Index of the parent node in the parent level of the tree.
 size_t MerkleTreeMath::Parent(size_t leaf) {
   return leaf >> 1;
@@ -6,6 +6,10 @@ class MerkleTreeMath {
  public:
   static bool IsPowerOfTwoPlusOne(size_t leaf_count);
 
+  // Number of levels of a tree with |leaf_count| leaves: 0 for an empty
+  // tree, and ceil(log2(leaf_count)) + 1 otherwise.
+  static size_t LevelCount(size_t leaf_count);
+
   // Index of the parent node in the parent level of the tree.
   static size_t Parent(size_t leaf);
 
@@ -4,6 +4,8 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <time.h>
+#include <algorithm>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -13,6 +15,7 @@
 #include "merkletree/serial_hasher.h"
 #include "merkletree/tree_hasher.h"
 #include "util/testing.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 
 namespace {
@@ -387,6 +390,28 @@ TEST_F(CompactMerkleTreeTest, TestCopyCtorWithRootTestVectors) {
   EXPECT_EQ(tree1.CurrentRoot(), ctree1.CurrentRoot());
 }
 
+TEST_F(CompactMerkleTreeTest, SnapshotIsUnaffectedByGrowth) {
+  CompactMerkleTree tree(new Sha256Hasher());
+  for (size_t i = 0; i < 5; ++i) {
+    tree.AddLeaf(S(kInputs[i]));
+  }
+  const std::unique_ptr<CompactMerkleTree> snapshot(tree.Snapshot());
+
+  // Growing the tree replaces the nodes that the snapshot shares with
+  // it, and vice versa.
+  for (size_t i = 5; i < 8; ++i) {
+    tree.AddLeaf(S(kInputs[i]));
+  }
+  EXPECT_STREQ(H(tree.CurrentRoot()).c_str(), kSHA256Roots[7].str);
+  EXPECT_EQ(5U, snapshot->LeafCount());
+  EXPECT_EQ(kLevelCounts[4], snapshot->LevelCount());
+  EXPECT_STREQ(H(snapshot->CurrentRoot()).c_str(), kSHA256Roots[4].str);
+
+  snapshot->AddLeaf(S(kInputs[5]));
+  EXPECT_STREQ(H(snapshot->CurrentRoot()).c_str(), kSHA256Roots[5].str);
+  EXPECT_STREQ(H(tree.CurrentRoot()).c_str(), kSHA256Roots[7].str);
+}
+
 TEST_F(CompactMerkleTreeTest, TestCopyCtorThenAddLeafWithRootTestVectors) {
   MerkleTree tree(new Sha256Hasher());
   EXPECT_EQ(tree.LeafCount(), 0U);
@@ -569,6 +594,65 @@ TEST_F(MerkleTreeTest, ConsistencyTestVectors) {
   }
 }
 
+// Check that proofs against cached frontiers match the ones computed
+// from scratch.
+TEST_F(MerkleTreeFuzzTest, FrontierFuzz) {
+  for (size_t tree_size = 1; tree_size <= data_.size(); ++tree_size) {
+    MerkleTree tree(new Sha256Hasher());
+    for (size_t j = 0; j < tree_size; ++j)
+      tree.AddLeaf(data_[j]);
+    for (size_t j = 0; j < 8; ++j) {
+      const size_t snapshot2 = rand() % tree_size + 1;
+      const size_t snapshot1 = rand() % snapshot2 + 1;
+      const size_t leaf = rand() % snapshot2 + 1;
+      const std::vector<string> frontier(tree.SnapshotFrontier(snapshot2));
+      EXPECT_EQ(tree.RootAtSnapshot(snapshot2), frontier.back());
+      EXPECT_EQ(tree.PathToRootAtSnapshot(leaf, snapshot2),
+                tree.PathToRootAtSnapshot(leaf, snapshot2, frontier));
+      EXPECT_EQ(tree.SnapshotConsistency(snapshot1, snapshot2),
+                tree.SnapshotConsistency(snapshot1, snapshot2, frontier));
+    }
+  }
+}
+
+TEST_F(MerkleTreeTest, SnapshotFrontier) {
+  MerkleTree tree(new Sha256Hasher());
+  EXPECT_TRUE(tree.SnapshotFrontier(0).empty());
+  EXPECT_TRUE(tree.SnapshotFrontier(1).empty());
+  for (int i = 0; i < 5; ++i)
+    tree.AddLeaf(data_[i]);
+
+  // The right border of the 5-leaf tree is the fifth leaf, copied up
+  // to the root.
+  const std::vector<string> frontier(tree.SnapshotFrontier(5));
+  ASSERT_EQ(4U, frontier.size());
+  EXPECT_EQ(tree.LeafHash(5), frontier[0]);
+  EXPECT_EQ(tree.LeafHash(5), frontier[1]);
+  EXPECT_EQ(tree.LeafHash(5), frontier[2]);
+  EXPECT_EQ(tree.CurrentRoot(), frontier[3]);
+  EXPECT_TRUE(tree.SnapshotFrontier(6).empty());
+}
+
+TEST_F(MerkleTreeTest, CompleteSubtreeRoot) {
+  MerkleTree tree(new Sha256Hasher());
+  EXPECT_EQ("", tree.CompleteSubtreeRoot(0, 0));
+  for (int i = 0; i < 7; ++i)
+    tree.AddLeaf(data_[i]);
+
+  EXPECT_EQ(tree.LeafHash(7), tree.CompleteSubtreeRoot(0, 6));
+  EXPECT_EQ(tree.RootAtSnapshot(4), tree.CompleteSubtreeRoot(2, 0));
+  EXPECT_EQ(ReferenceMerkleTreeHash(&data_[4], 2, &tree_hasher_),
+            tree.CompleteSubtreeRoot(1, 2));
+  // The subtrees over leaves 7-8 and 5-8 are not complete yet.
+  EXPECT_EQ("", tree.CompleteSubtreeRoot(1, 3));
+  EXPECT_EQ("", tree.CompleteSubtreeRoot(2, 1));
+  EXPECT_EQ("", tree.CompleteSubtreeRoot(3, 0));
+  EXPECT_EQ("", tree.CompleteSubtreeRoot(0, 7));
+
+  tree.AddLeaf(data_[7]);
+  EXPECT_EQ(tree.CurrentRoot(), tree.CompleteSubtreeRoot(3, 0));
+}
+
 TEST_F(MerkleTreeTest, AddLeafHash) {
   const char* kHashValue = "0123456789abcdef0123456789abcdef";
   MerkleTree tree(new Sha256Hasher());
@@ -577,6 +661,130 @@ TEST_F(MerkleTreeTest, AddLeafHash) {
   EXPECT_EQ(kHashValue, tree.LeafHash(index));
 }
 
+TEST_F(MerkleTreeFuzzTest, AddLeafHashes) {
+  for (size_t start = 0; start <= 64; ++start) {
+    const size_t count(rand() % 200);
+    MerkleTree tree(new Sha256Hasher());
+    MerkleTree batch_tree(new Sha256Hasher());
+    std::vector<string> hashes;
+    for (size_t i = 0; i < start + count; ++i) {
+      const string hash(tree_hasher_.HashLeaf(data_[i % data_.size()]));
+      tree.AddLeafHash(hash);
+      if (i < start) {
+        batch_tree.AddLeafHash(hash);
+      } else {
+        hashes.push_back(hash);
+      }
+    }
+    // Evaluate part of the tree before the batch is added.
+    batch_tree.RootAtSnapshot(rand() % (start + 1));
+    EXPECT_EQ(start + count, batch_tree.AddLeafHashes(hashes));
+    EXPECT_EQ(tree.LeafCount(), batch_tree.LeafCount());
+    EXPECT_EQ(tree.LevelCount(), batch_tree.LevelCount());
+    EXPECT_EQ(tree.CurrentRoot(), batch_tree.CurrentRoot());
+    const size_t snapshot(rand() % (start + count + 1));
+    EXPECT_EQ(tree.RootAtSnapshot(snapshot), batch_tree.RootAtSnapshot(snapshot));
+  }
+}
+
+TEST_F(CompactMerkleTreeFuzzTest, AddLeafHashes) {
+  for (size_t start = 0; start <= 64; ++start) {
+    const size_t count(rand() % 200);
+    MerkleTree tree(new Sha256Hasher());
+    CompactMerkleTree ctree(new Sha256Hasher());
+    std::vector<string> hashes;
+    for (size_t i = 0; i < start + count; ++i) {
+      const string hash(tree_hasher_.HashLeaf(data_[i % data_.size()]));
+      tree.AddLeafHash(hash);
+      if (i < start) {
+        ctree.AddLeafHash(hash);
+      } else {
+        hashes.push_back(hash);
+      }
+    }
+    EXPECT_EQ(start + count, ctree.AddLeafHashes(hashes));
+    EXPECT_EQ(tree.LeafCount(), ctree.LeafCount());
+    EXPECT_EQ(tree.LevelCount(), ctree.LevelCount());
+    EXPECT_EQ(tree.CurrentRoot(), ctree.CurrentRoot());
+  }
+}
+
+TEST_F(CompactMerkleTreeFuzzTest, SubtreeRoots) {
+  for (size_t tree_size = 0; tree_size <= 70; ++tree_size) {
+    CompactMerkleTree ctree(new Sha256Hasher());
+    for (size_t i = 0; i < tree_size; ++i)
+      ctree.AddLeaf(data_[i % data_.size()]);
+    const std::vector<string> roots(ctree.SubtreeRoots());
+    size_t bits(0);
+    for (size_t i = tree_size; i != 0; i >>= 1)
+      bits += i & 1;
+    EXPECT_EQ(bits, roots.size());
+
+    CompactMerkleTree restored(tree_size, roots, new Sha256Hasher());
+    EXPECT_EQ(ctree.LeafCount(), restored.LeafCount());
+    EXPECT_EQ(ctree.LevelCount(), restored.LevelCount());
+    EXPECT_EQ(ctree.CurrentRoot(), restored.CurrentRoot());
+    EXPECT_EQ(roots, restored.SubtreeRoots());
+
+    // And both carry on the same.
+    const size_t count(rand() % 40);
+    for (size_t i = 0; i < count; ++i) {
+      const string leaf(RandomLeaf(16));
+      ctree.AddLeaf(leaf);
+      restored.AddLeaf(leaf);
+      EXPECT_EQ(ctree.CurrentRoot(), restored.CurrentRoot());
+    }
+  }
+}
+
+TEST_F(MerkleTreeTest, ParallelEvaluation) {
+  cert_trans::ThreadPool pool(4);
+  MerkleTree tree(new Sha256Hasher());
+  MerkleTree parallel_tree(new Sha256Hasher());
+  parallel_tree.SetExecutor(&pool);
+
+  // Large enough for the first few levels to be hashed in parallel.
+  std::vector<string> hashes;
+  for (size_t i = 0; i < 300000; ++i)
+    hashes.push_back(tree_hasher_.HashLeaf(std::to_string(i)));
+
+  tree.AddLeafHashes(hashes);
+  parallel_tree.AddLeafHashes(
+      std::vector<string>(hashes.begin(), hashes.begin() + 100001));
+  EXPECT_EQ(tree.RootAtSnapshot(100001), parallel_tree.CurrentRoot());
+
+  // Evaluate the rest of the tree on top of the partially evaluated one.
+  parallel_tree.AddLeafHashes(
+      std::vector<string>(hashes.begin() + 100001, hashes.end()));
+  EXPECT_EQ(tree.CurrentRoot(), parallel_tree.CurrentRoot());
+  EXPECT_EQ(tree.PathToCurrentRoot(123457),
+            parallel_tree.PathToCurrentRoot(123457));
+  EXPECT_EQ(tree.SnapshotConsistency(100001, 300000),
+            parallel_tree.SnapshotConsistency(100001, 300000));
+}
+
+TEST_F(CompactMerkleTreeFuzzTest, AddLeafHashesWithExecutor) {
+  cert_trans::ThreadPool pool(4);
+  for (size_t start : {0, 1, 3, 1024, 1500}) {
+    const size_t count(4096 + rand() % 4096);
+    MerkleTree tree(new Sha256Hasher());
+    CompactMerkleTree ctree(new Sha256Hasher());
+    std::vector<string> hashes;
+    for (size_t i = 0; i < start + count; ++i) {
+      const string hash(tree_hasher_.HashLeaf(RandomLeaf(8)));
+      tree.AddLeafHash(hash);
+      if (i < start) {
+        ctree.AddLeafHash(hash);
+      } else {
+        hashes.push_back(hash);
+      }
+    }
+    EXPECT_EQ(start + count, ctree.AddLeafHashes(hashes, &pool));
+    EXPECT_EQ(tree.LevelCount(), ctree.LevelCount());
+    EXPECT_EQ(tree.CurrentRoot(), ctree.CurrentRoot());
+  }
+}
+
 TEST_F(CompactMerkleTreeTest, TestCloneEmptyTreeProducesWorkingTree) {
   MerkleTree tree(new Sha256Hasher);
   CompactMerkleTree compact(tree, new Sha256Hasher);
@@ -779,6 +987,62 @@ TEST_F(MerkleVerifierTest, VerifyPath) {
   }
 }
 
+TEST_F(MerkleVerifierTest, VerifyPaths) {
+  for (size_t tree_size = 1; tree_size <= data_.size() / 2; ++tree_size) {
+    const string root(
+        ReferenceMerkleTreeHash(data_.data(), tree_size, &tree_hasher_));
+    std::vector<MerkleVerifier::AuditPath> paths;
+    std::vector<bool> expected;
+    for (size_t leaf = 1; leaf <= tree_size; ++leaf) {
+      MerkleVerifier::AuditPath path;
+      path.leaf = leaf;
+      path.leaf_hash = verifier_.LeafHash(data_[leaf - 1]);
+      path.path =
+          ReferenceMerklePath(data_.data(), tree_size, leaf, &tree_hasher_);
+      paths.push_back(path);
+      expected.push_back(true);
+
+      // A wrong leaf.
+      paths.push_back(path);
+      paths.back().leaf_hash = verifier_.LeafHash(data_[leaf]);
+      expected.push_back(false);
+
+      // A wrong leaf index, which may still happen to be valid.
+      paths.push_back(path);
+      paths.back().leaf = leaf + 1;
+      expected.push_back(verifier_.VerifyPath(leaf + 1, tree_size, path.path,
+                                              root, data_[leaf - 1]));
+
+      if (path.path.empty())
+        continue;
+
+      // A tampered node.
+      paths.push_back(path);
+      paths.back().path.back()[0] ^= 1;
+      expected.push_back(false);
+
+      // Missing and extra nodes.
+      paths.push_back(path);
+      paths.back().path.pop_back();
+      expected.push_back(false);
+      paths.push_back(path);
+      paths.back().path.push_back(path.path.back());
+      expected.push_back(false);
+    }
+
+    std::vector<bool> valid;
+    EXPECT_EQ(static_cast<size_t>(std::count(expected.begin(),
+                                             expected.end(), true)),
+              verifier_.VerifyPaths(tree_size, root, paths, &valid));
+    EXPECT_EQ(expected, valid) << tree_size;
+
+    // A wrong root invalidates all the paths.
+    string wrong_root(root);
+    wrong_root[0] ^= 1;
+    EXPECT_EQ(0U, verifier_.VerifyPaths(tree_size, wrong_root, paths, &valid));
+  }
+}
+
 TEST_F(MerkleVerifierTest, VerifyConsistencyProof) {
   std::vector<string> proof;
   string root1, root2;
@@ -1,9 +1,20 @@
 #include "merkletree/merkle_verifier.h"
 
 #include <stddef.h>
+#include <string.h>
+#include <algorithm>
 #include <vector>
 
 using std::string;
+using std::vector;
+
+namespace {
+
+// Number of paths to hash together in VerifyPaths(), which keeps the
+// buffers small enough to stay in cache.
+const size_t kPathBatchSize = 256;
+
+}  // namespace
 
 MerkleVerifier::MerkleVerifier(SerialHasher* hasher) : treehasher_(hasher) {
 }
@@ -19,6 +30,13 @@ static inline bool IsRightChild(size_t leaf) {
   return leaf & 1;
 }
 
+bool MerkleVerifier::AllDigestSize(const std::vector<string>& nodes) const {
+  for (const string& node : nodes)
+    if (node.size() != treehasher_.DigestSize())
+      return false;
+  return true;
+}
+
 bool MerkleVerifier::VerifyPath(size_t leaf, size_t tree_size,
                                 const std::vector<string>& path,
                                 const string& root, const string& data) {
@@ -35,6 +53,10 @@ string MerkleVerifier::RootFromPath(size_t leaf, size_t tree_size,
     // No valid path exists.
     return string();
 
+  // Nodes are hashed in place, which needs them to be digest sized.
+  if (!AllDigestSize(path))
+    return string();
+
   size_t node = leaf - 1;
   size_t last_node = tree_size - 1;
 
@@ -46,9 +68,11 @@ string MerkleVerifier::RootFromPath(size_t leaf, size_t tree_size,
       // We've reached the end but we're not done yet.
       return string();
     if (IsRightChild(node))
-      node_hash = treehasher_.HashChildren(*it++, node_hash);
+      treehasher_.HashChildren((it++)->data(), node_hash.data(),
+                               &node_hash[0]);
     else if (node < last_node)
-      node_hash = treehasher_.HashChildren(node_hash, *it++);
+      treehasher_.HashChildren(node_hash.data(), (it++)->data(),
+                               &node_hash[0]);
     // Else the sibling does not exist and the parent is a dummy copy.
     // Do nothing.
 
@@ -62,6 +86,85 @@ string MerkleVerifier::RootFromPath(size_t leaf, size_t tree_size,
   return node_hash;
 }
 
+size_t MerkleVerifier::VerifyPaths(size_t tree_size, const string& root,
+                                   const vector<AuditPath>& paths,
+                                   vector<bool>* valid) {
+  valid->assign(paths.size(), false);
+  for (size_t begin = 0; begin < paths.size(); begin += kPathBatchSize)
+    VerifyPathBatch(tree_size, root, paths, begin,
+                    std::min(paths.size(), begin + kPathBatchSize), valid);
+  return std::count(valid->begin(), valid->end(), true);
+}
+
+void MerkleVerifier::VerifyPathBatch(size_t tree_size, const string& root,
+                                     const vector<AuditPath>& paths,
+                                     size_t begin, size_t end,
+                                     vector<bool>* valid) {
+  const size_t digest_size(treehasher_.DigestSize());
+  if (root.size() != digest_size)
+    return;
+
+  // The paths which are well formed, with their current nodes back to
+  // back in |nodes|.
+  vector<size_t> active;
+  string nodes;
+  for (size_t i = begin; i < end; ++i) {
+    const AuditPath& path(paths[i]);
+    if (path.leaf == 0 || path.leaf > tree_size ||
+        path.leaf_hash.size() != digest_size || !AllDigestSize(path.path))
+      continue;
+    // The path has one node for each level at which its node has a
+    // sibling.
+    size_t length = 0;
+    for (size_t node = path.leaf - 1, last_node = tree_size - 1; last_node;
+         node = Parent(node), last_node = Parent(last_node))
+      if (IsRightChild(node) || node < last_node)
+        ++length;
+    if (path.path.size() != length)
+      continue;
+    active.push_back(i);
+    nodes.append(path.leaf_hash);
+  }
+
+  // At each level, gather the nodes which have a sibling together with
+  // it, hash them all at once, and put the parents back in place. The
+  // other nodes are their own parents.
+  string children;
+  vector<size_t> hashed;
+  vector<size_t> next(active.size(), 0);
+  size_t last_node = tree_size - 1;
+  for (size_t level = 0; last_node; ++level, last_node = Parent(last_node)) {
+    children.clear();
+    hashed.clear();
+    for (size_t a = 0; a < active.size(); ++a) {
+      const AuditPath& path(paths[active[a]]);
+      const size_t node((path.leaf - 1) >> level);
+      const char* const node_hash(&nodes[a * digest_size]);
+      if (IsRightChild(node)) {
+        children.append(path.path[next[a]++]);
+        children.append(node_hash, digest_size);
+      } else if (node < last_node) {
+        children.append(node_hash, digest_size);
+        children.append(path.path[next[a]++]);
+      } else {
+        continue;
+      }
+      hashed.push_back(a);
+    }
+    if (hashed.empty())
+      continue;
+    // The parents overwrite the first half of |children|.
+    treehasher_.HashChildren(children.data(), hashed.size(), &children[0]);
+    for (size_t h = 0; h < hashed.size(); ++h)
+      memcpy(&nodes[hashed[h] * digest_size], &children[h * digest_size],
+             digest_size);
+  }
+
+  for (size_t a = 0; a < active.size(); ++a)
+    (*valid)[active[a]] =
+        memcmp(&nodes[a * digest_size], root.data(), digest_size) == 0;
+}
+
 bool MerkleVerifier::VerifyConsistency(size_t snapshot1, size_t snapshot2,
                                        const string& root1,
                                        const string& root2,
@@ -78,7 +181,9 @@ bool MerkleVerifier::VerifyConsistency(size_t snapshot1, size_t snapshot2,
   // Verify the roots.
   size_t node = snapshot1 - 1;
   size_t last_node = snapshot2 - 1;
-  if (proof.empty())
+  // Nodes are hashed in place, which needs them to be digest sized.
+  if (proof.empty() || !AllDigestSize(proof) ||
+      root1.size() != treehasher_.DigestSize())
     return false;
   std::vector<string>::const_iterator it = proof.begin();
   // Move up until the first mutable node.
@@ -99,13 +204,14 @@ bool MerkleVerifier::VerifyConsistency(size_t snapshot1, size_t snapshot2,
       return false;
 
     if (IsRightChild(node)) {
-      node1_hash = treehasher_.HashChildren(*it, node1_hash);
-      node2_hash = treehasher_.HashChildren(*it, node2_hash);
+      treehasher_.HashChildren(it->data(), node1_hash.data(), &node1_hash[0]);
+      treehasher_.HashChildren(it->data(), node2_hash.data(), &node2_hash[0]);
       ++it;
     } else if (node < last_node)
       // The sibling only exists in the later tree. The parent in the
       // snapshot1 tree is a dummy copy.
-      node2_hash = treehasher_.HashChildren(node2_hash, *it++);
+      treehasher_.HashChildren(node2_hash.data(), (it++)->data(),
+                               &node2_hash[0]);
     // Else the sibling does not exist in either tree. Do nothing.
 
     node = Parent(node);
@@ -122,7 +228,8 @@ bool MerkleVerifier::VerifyConsistency(size_t snapshot1, size_t snapshot2,
       // We've reached the end but we're not done yet.
       return false;
 
-    node2_hash = treehasher_.HashChildren(node2_hash, *it++);
+    treehasher_.HashChildren(node2_hash.data(), (it++)->data(),
+                             &node2_hash[0]);
     last_node = Parent(last_node);
   }
 
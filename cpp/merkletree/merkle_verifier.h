@@ -2,6 +2,7 @@
 #define MERKLEVERIFIER_H
 
 #include <stddef.h>
+#include <string>
 #include <vector>
 
 #include "merkletree/tree_hasher.h"
@@ -13,6 +14,17 @@ class SerialHasher;
 
 class MerkleVerifier {
  public:
+  // An audit path to check with VerifyPaths().
+  struct AuditPath {
+    // Index of the leaf, starting from 1.
+    size_t leaf;
+    // The hash of the leaf, as returned by LeafHash().
+    std::string leaf_hash;
+    // Node hashes ordered according to levels from leaf to root, as for
+    // VerifyPath().
+    std::vector<std::string> path;
+  };
+
   // Takes ownership of the SerialHasher.
   MerkleVerifier(SerialHasher* hasher);
   ~MerkleVerifier();
@@ -43,6 +55,18 @@ class MerkleVerifier {
                            const std::vector<std::string>& path,
                            const std::string& data);
 
+  // Verify many Merkle paths in the same tree at once. This is much
+  // cheaper than calling VerifyPath() for each of them, as the paths are
+  // hashed level by level, in batches, and without allocating a string for
+  // each node.
+  //
+  // Sets (*valid)[i] to whether |paths|[i] is a valid proof for its leaf in
+  // the tree of |tree_size| leaves with root |root|, and returns the number
+  // of valid paths.
+  size_t VerifyPaths(size_t tree_size, const std::string& root,
+                     const std::vector<AuditPath>& paths,
+                     std::vector<bool>* valid);
+
   bool VerifyConsistency(size_t snapshot1, size_t snapshot2,
                          const std::string& root1, const std::string& root2,
                          const std::vector<std::string>& proof);
@@ -51,6 +75,14 @@ class MerkleVerifier {
   std::string LeafHash(const std::string& data);
 
  private:
+  // VerifyPaths() for the paths [|begin|, |end|).
+  void VerifyPathBatch(size_t tree_size, const std::string& root,
+                       const std::vector<AuditPath>& paths, size_t begin,
+                       size_t end, std::vector<bool>* valid);
+
+  // Whether all the |nodes| are the size of a digest.
+  bool AllDigestSize(const std::vector<std::string>& nodes) const;
+
   TreeHasher treehasher_;
 };
 
@@ -0,0 +1,190 @@
+#include "merkletree/node_store.h"
+
+#include <assert.h>
+#include <glog/logging.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+
+namespace cert_trans {
+
+// 1024 SHA-256 nodes make a 32kB page.
+const size_t NodeStore::kDefaultNodesPerPage = 1024;
+
+
+NodeStore::NodeStore(size_t node_size)
+    : NodeStore(node_size, kDefaultNodesPerPage) {
+}
+
+
+NodeStore::NodeStore(size_t node_size, size_t nodes_per_page)
+    : node_size_(node_size),
+      page_shift_(0),
+      page_mask_(nodes_per_page - 1),
+      page_bytes_(nodes_per_page * node_size),
+      size_(0),
+      fd_(-1),
+      mapping_(SHARED_MAPPING),
+      file_pages_(0),
+      first_dirty_page_(0) {
+  assert(node_size_ > 0);
+  assert(nodes_per_page > 0);
+  assert((nodes_per_page & page_mask_) == 0);
+  while ((static_cast<size_t>(1) << page_shift_) < nodes_per_page)
+    ++page_shift_;
+}
+
+
+NodeStore::NodeStore(size_t node_size, size_t nodes_per_page, int fd,
+                     size_t size)
+    : NodeStore(node_size, nodes_per_page, fd, size, SHARED_MAPPING) {
+}
+
+
+NodeStore::NodeStore(size_t node_size, size_t nodes_per_page, int fd,
+                     size_t size, FileMapping mapping)
+    : NodeStore(node_size, nodes_per_page) {
+  CHECK_GE(fd, 0);
+  CHECK_EQ(page_bytes_ % sysconf(_SC_PAGESIZE), 0U)
+      << "page size must be a multiple of the system page size";
+  fd_ = fd;
+  mapping_ = mapping;
+
+  struct stat st;
+  PCHECK(fstat(fd_, &st) == 0);
+  file_pages_ = st.st_size / page_bytes_;
+
+  const size_t num_pages((size + page_mask_) >> page_shift_);
+  CHECK_LE(num_pages, file_pages_) << "file too small for " << size
+                                   << " nodes";
+  for (size_t page = 0; page < num_pages; ++page)
+    Page(page);
+  size_ = size;
+  first_dirty_page_ = pages_.size();
+}
+
+
+NodeStore::NodeStore(NodeStore&& other)
+    : node_size_(other.node_size_),
+      page_shift_(other.page_shift_),
+      page_mask_(other.page_mask_),
+      page_bytes_(other.page_bytes_),
+      size_(other.size_),
+      pages_(std::move(other.pages_)),
+      fd_(other.fd_),
+      mapping_(other.mapping_),
+      file_pages_(other.file_pages_),
+      first_dirty_page_(other.first_dirty_page_) {
+  other.pages_.clear();
+  other.size_ = 0;
+  other.fd_ = -1;
+}
+
+
+NodeStore& NodeStore::operator=(NodeStore&& other) {
+  if (this != &other) {
+    Release();
+    node_size_ = other.node_size_;
+    page_shift_ = other.page_shift_;
+    page_mask_ = other.page_mask_;
+    page_bytes_ = other.page_bytes_;
+    size_ = other.size_;
+    pages_ = std::move(other.pages_);
+    fd_ = other.fd_;
+    mapping_ = other.mapping_;
+    file_pages_ = other.file_pages_;
+    first_dirty_page_ = other.first_dirty_page_;
+    other.pages_.clear();
+    other.size_ = 0;
+    other.fd_ = -1;
+  }
+  return *this;
+}
+
+
+NodeStore::~NodeStore() {
+  Release();
+}
+
+
+const char* NodeStore::at(size_t index) const {
+  assert(index < size_);
+  return pages_[index >> page_shift_] + (index & page_mask_) * node_size_;
+}
+
+
+void NodeStore::PushBack(const char* node) {
+  const size_t page(size_ >> page_shift_);
+  memcpy(Page(page) + (size_ & page_mask_) * node_size_, node, node_size_);
+  if (page < first_dirty_page_)
+    first_dirty_page_ = page;
+  ++size_;
+}
+
+
+void NodeStore::PopBack() {
+  assert(size_ > 0);
+  --size_;
+}
+
+
+bool NodeStore::Sync() {
+  if (!IsFileBacked() || mapping_ == PRIVATE_MAPPING)
+    return true;
+
+  for (size_t page = first_dirty_page_; page < pages_.size(); ++page) {
+    if (msync(pages_[page], page_bytes_, MS_SYNC) != 0) {
+      PLOG(ERROR) << "msync";
+      return false;
+    }
+  }
+  first_dirty_page_ = pages_.size();
+  return true;
+}
+
+
+char* NodeStore::Page(size_t page) {
+  if (page < pages_.size())
+    return pages_[page];
+  CHECK_EQ(page, pages_.size());
+
+  if (!IsFileBacked()) {
+    pages_.push_back(new char[page_bytes_]);
+    return pages_.back();
+  }
+
+  if (page >= file_pages_) {
+    CHECK_EQ(mapping_, SHARED_MAPPING)
+        << "privately mapped store grown past the end of its file";
+    PCHECK(ftruncate(fd_, (page + 1) * page_bytes_) == 0);
+    file_pages_ = page + 1;
+  }
+  void* const addr(mmap(NULL, page_bytes_, PROT_READ | PROT_WRITE,
+                        mapping_ == SHARED_MAPPING ? MAP_SHARED : MAP_PRIVATE,
+                        fd_, page * page_bytes_));
+  PCHECK(addr != MAP_FAILED);
+  pages_.push_back(static_cast<char*>(addr));
+  return pages_.back();
+}
+
+
+void NodeStore::Release() {
+  for (char* page : pages_) {
+    if (IsFileBacked()) {
+      PCHECK(munmap(page, page_bytes_) == 0);
+    } else {
+      delete[] page;
+    }
+  }
+  pages_.clear();
+  if (IsFileBacked()) {
+    PCHECK(close(fd_) == 0);
+    fd_ = -1;
+  }
+}
+
+
+}  // namespace cert_trans
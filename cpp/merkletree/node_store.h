@@ -0,0 +1,139 @@
+#ifndef CERT_TRANS_MERKLETREE_NODE_STORE_H_
+#define CERT_TRANS_MERKLETREE_NODE_STORE_H_
+
+#include <assert.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// An append-only array of fixed-width nodes (i.e., hashes) making up one
+// level of a Merkle tree.
+//
+// Nodes are stored back to back in fixed-size pages. Once allocated, a
+// page is never moved, resized or copied, so growing the store never
+// reallocates the nodes already written, and peak memory during growth
+// is bounded by a single page rather than by the size of the whole level.
+//
+// Pages are either allocated on the heap, or memory-mapped from a file
+// (see the file-backed constructor below), in which case the nodes
+// survive the process.
+//
+// This class is thread-compatible, but not thread-safe.
+class NodeStore {
+ public:
+  // Number of nodes held by a single page. Must be a power of two.
+  static const size_t kDefaultNodesPerPage;
+
+  // How the pages of a file-backed store are mapped.
+  enum FileMapping {
+    // Changes are written to the file, which is grown as needed.
+    SHARED_MAPPING,
+    // Copy-on-write: the file may be opened read-only, changes only
+    // affect the pages of this store, and it cannot grow past the end
+    // of the file. The nodes not changed remain shared with the other
+    // processes mapping the file.
+    PRIVATE_MAPPING,
+  };
+
+  // |node_size| is the width of a node, in bytes.
+  explicit NodeStore(size_t node_size);
+  NodeStore(size_t node_size, size_t nodes_per_page);
+
+  // Creates a NodeStore whose pages are memory-mapped (shared) from the
+  // file |fd|, the first |size| nodes of which are taken to be valid
+  // content. The file is grown one page at a time as needed.
+  // |nodes_per_page| * |node_size| must be a multiple of the system page
+  // size. Takes ownership of |fd|.
+  NodeStore(size_t node_size, size_t nodes_per_page, int fd, size_t size);
+  // As above, but mapped as specified by |mapping|.
+  NodeStore(size_t node_size, size_t nodes_per_page, int fd, size_t size,
+            FileMapping mapping);
+
+  NodeStore(NodeStore&& other);
+  NodeStore& operator=(NodeStore&& other);
+
+  ~NodeStore();
+
+  size_t NodeSize() const {
+    return node_size_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  // Returns a pointer to the NodeSize() bytes of the |index|-th node.
+  // The pointer stays valid until the node is removed with PopBack().
+  const char* at(size_t index) const;
+
+  // Returns a copy of the |index|-th node.
+  std::string Get(size_t index) const {
+    return std::string(at(index), node_size_);
+  }
+
+  // Returns a copy of the last node.
+  std::string Back() const {
+    return Get(size_ - 1);
+  }
+
+  // Appends a node, which must be exactly NodeSize() bytes long.
+  void PushBack(const std::string& node) {
+    assert(node.size() == node_size_);
+    PushBack(node.data());
+  }
+
+  // Appends the node in the NodeSize() bytes at |node|.
+  void PushBack(const char* node);
+
+  // Removes the last node. Its page is kept around, since the slot is
+  // usually reused by the next PushBack().
+  void PopBack();
+
+  // Number of bytes allocated for node storage.
+  size_t AllocatedBytes() const {
+    return pages_.size() * page_bytes_;
+  }
+
+  bool IsFileBacked() const {
+    return fd_ >= 0;
+  }
+
+  // For a file-backed store, flushes the pages modified since the
+  // last call to disk. Returns false on error. Always succeeds for
+  // heap-allocated and privately mapped stores.
+  bool Sync();
+
+ private:
+  char* Page(size_t page);
+  void Release();
+
+  size_t node_size_;
+  size_t page_shift_;
+  size_t page_mask_;
+  size_t page_bytes_;
+  size_t size_;
+  std::vector<char*> pages_;
+  // The backing file, or -1 if pages live on the heap.
+  int fd_;
+  FileMapping mapping_;
+  // Number of pages the backing file is large enough to hold.
+  size_t file_pages_;
+  // Index of the first page modified since the last Sync().
+  size_t first_dirty_page_;
+
+  DISALLOW_COPY_AND_ASSIGN(NodeStore);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MERKLETREE_NODE_STORE_H_
@@ -0,0 +1,98 @@
+#include <gtest/gtest.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/node_store.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::vector;
+
+const size_t kNodeSize = 32;
+
+
+string MakeNode(size_t i) {
+  string node(kNodeSize, 0);
+  for (size_t j = 0; j < sizeof(i); ++j)
+    node[j] = static_cast<char>(i >> (8 * j));
+  return node;
+}
+
+
+TEST(NodeStoreTest, Empty) {
+  NodeStore store(kNodeSize);
+  EXPECT_TRUE(store.empty());
+  EXPECT_EQ(0U, store.size());
+  EXPECT_EQ(kNodeSize, store.NodeSize());
+  EXPECT_EQ(0U, store.AllocatedBytes());
+}
+
+
+TEST(NodeStoreTest, PushBackAndGet) {
+  NodeStore store(kNodeSize, 4);
+  for (size_t i = 0; i < 17; ++i) {
+    store.PushBack(MakeNode(i));
+    EXPECT_EQ(i + 1, store.size());
+    EXPECT_EQ(MakeNode(i), store.Back());
+  }
+  for (size_t i = 0; i < 17; ++i)
+    EXPECT_EQ(MakeNode(i), store.Get(i));
+  // 17 nodes need 5 pages of 4 nodes each.
+  EXPECT_EQ(5 * 4 * kNodeSize, store.AllocatedBytes());
+}
+
+
+TEST(NodeStoreTest, PopBack) {
+  NodeStore store(kNodeSize, 4);
+  for (size_t i = 0; i < 5; ++i)
+    store.PushBack(MakeNode(i));
+
+  store.PopBack();
+  EXPECT_EQ(4U, store.size());
+  EXPECT_EQ(MakeNode(3), store.Back());
+
+  // Replacing the last node reuses the existing page.
+  store.PushBack(MakeNode(42));
+  EXPECT_EQ(5U, store.size());
+  EXPECT_EQ(MakeNode(42), store.Back());
+  EXPECT_EQ(2 * 4 * kNodeSize, store.AllocatedBytes());
+}
+
+
+TEST(NodeStoreTest, PagesDoNotMove) {
+  NodeStore store(kNodeSize, 4);
+  store.PushBack(MakeNode(0));
+  const char* const first(store.at(0));
+  for (size_t i = 1; i < 1000; ++i)
+    store.PushBack(MakeNode(i));
+  EXPECT_EQ(first, store.at(0));
+  EXPECT_EQ(MakeNode(0), string(first, kNodeSize));
+}
+
+
+TEST(NodeStoreTest, Move) {
+  NodeStore store(kNodeSize, 4);
+  for (size_t i = 0; i < 10; ++i)
+    store.PushBack(MakeNode(i));
+  const char* const first(store.at(0));
+
+  vector<NodeStore> levels;
+  levels.emplace_back(std::move(store));
+  EXPECT_EQ(10U, levels[0].size());
+  EXPECT_EQ(first, levels[0].at(0));
+  EXPECT_EQ(MakeNode(9), levels[0].Back());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,257 @@
+#include "merkletree/persistent_merkle_tree.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glog/logging.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/serial_hasher.h"
+#include "util/util.h"
+
+using std::string;
+using std::vector;
+
+namespace cert_trans {
+
+// 32MB per mapping for SHA-256 trees, which keeps the number of
+// mappings small even for very large trees.
+const size_t PersistentMerkleTree::kNodesPerPage = 1 << 20;
+
+namespace {
+
+
+const char kHeaderMagic[] = "CTMTREE1";
+const size_t kHeaderMagicSize = sizeof(kHeaderMagic) - 1;
+
+
+void AppendUint64(uint64_t value, string* out) {
+  for (int shift = 56; shift >= 0; shift -= 8)
+    out->push_back(static_cast<char>((value >> shift) & 0xff));
+}
+
+
+uint64_t ReadUint64(const string& in, size_t offset) {
+  uint64_t value(0);
+  for (size_t i = 0; i < 8; ++i)
+    value = (value << 8) | static_cast<unsigned char>(in[offset + i]);
+  return value;
+}
+
+
+// Node counts of each level of a fully evaluated tree, bottom-up.
+vector<size_t> LevelSizes(size_t leaf_count) {
+  vector<size_t> sizes;
+  if (leaf_count == 0)
+    return sizes;
+  sizes.push_back(leaf_count);
+  while (sizes.back() > 1)
+    sizes.push_back((sizes.back() + 1) / 2);
+  return sizes;
+}
+
+
+}  // namespace
+
+
+PersistentMerkleTree::PersistentMerkleTree(const string& dir,
+                                           SerialHasher* hasher)
+    : PersistentMerkleTree(dir, hasher, READ_WRITE) {
+}
+
+
+PersistentMerkleTree::PersistentMerkleTree(const string& dir,
+                                           SerialHasher* hasher,
+                                           Access access)
+    : MerkleTree(hasher), dir_(dir), access_(access) {
+  if (!IsReadOnly() && mkdir(dir_.c_str(), 0700) != 0) {
+    PCHECK(errno == EEXIST) << "mkdir " << dir_;
+  }
+  if (!Restore()) {
+    if (IsReadOnly()) {
+      RestoreLevels(vector<NodeStore>(), 0);
+    } else {
+      Clear();
+    }
+  }
+  LOG(INFO) << "Opened persistent Merkle tree in " << dir_ << " with "
+            << LeafCount() << " leaves" << (IsReadOnly() ? ", read-only" : "");
+}
+
+
+PersistentMerkleTree::~PersistentMerkleTree() {
+}
+
+
+util::Status PersistentMerkleTree::Checkpoint() {
+  CHECK(!IsReadOnly());
+  const string root(CurrentRoot());
+  for (NodeStore& level : *mutable_levels()) {
+    if (!level.Sync()) {
+      return util::Status(util::error::INTERNAL,
+                          "failed to sync tree nodes in " + dir_);
+    }
+  }
+
+  const string header(EncodeHeader(LeafCount(), root));
+  const string tmp_path(HeaderPath() + ".tmp");
+  const int fd(open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600));
+  if (fd < 0) {
+    return util::Status(util::error::INTERNAL, "failed to open " + tmp_path);
+  }
+  const bool written(write(fd, header.data(), header.size()) ==
+                         static_cast<ssize_t>(header.size()) &&
+                     fsync(fd) == 0);
+  PCHECK(close(fd) == 0);
+  if (!written || rename(tmp_path.c_str(), HeaderPath().c_str()) != 0) {
+    return util::Status(util::error::INTERNAL,
+                        "failed to write " + HeaderPath());
+  }
+  return util::Status::OK;
+}
+
+
+void PersistentMerkleTree::Clear() {
+  CHECK(!IsReadOnly());
+  if (unlink(HeaderPath().c_str()) != 0) {
+    PCHECK(errno == ENOENT) << "unlink " << HeaderPath();
+  }
+  RestoreLevels(vector<NodeStore>(), 0);
+}
+
+
+util::Status PersistentMerkleTree::Reload(size_t leaf_count) {
+  CHECK(IsReadOnly());
+  size_t checkpoint_leaf_count;
+  string root;
+  if (!ReadHeader(&checkpoint_leaf_count, &root)) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "no usable checkpoint in " + dir_);
+  }
+  if (checkpoint_leaf_count < leaf_count) {
+    return util::Status(util::error::UNAVAILABLE,
+                        "checkpoint in " + dir_ + " only has " +
+                            std::to_string(checkpoint_leaf_count) +
+                            " leaves");
+  }
+
+  // The nodes of a smaller tree than the checkpointed one are all there
+  // too, and only the last one of each level needs to be recomputed.
+  vector<NodeStore> levels;
+  if (!OpenLevels(leaf_count, &levels)) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "missing or truncated tree levels in " + dir_);
+  }
+  RestoreLevels(std::move(levels), leaf_count);
+  return util::Status::OK;
+}
+
+
+NodeStore PersistentMerkleTree::NewLevel(size_t level) {
+  // The levels of a read-only tree are only ever replaced by Reload().
+  CHECK(!IsReadOnly()) << "read-only tree in " << dir_ << " modified";
+  // Any previous content of the file is stale.
+  const string path(LevelPath(level));
+  const int fd(open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600));
+  PCHECK(fd >= 0) << "open " << path;
+  return NodeStore(NodeSize(), kNodesPerPage, fd, 0);
+}
+
+
+bool PersistentMerkleTree::Restore() {
+  size_t leaf_count;
+  string root;
+  vector<NodeStore> levels;
+  if (!ReadHeader(&leaf_count, &root) || !OpenLevels(leaf_count, &levels)) {
+    return false;
+  }
+
+  if (RestoreLevels(std::move(levels), leaf_count) != root) {
+    LOG(WARNING) << "Tree levels in " << dir_ << " do not match the "
+                 << "checkpointed root " << util::HexString(root);
+    return false;
+  }
+  return true;
+}
+
+
+bool PersistentMerkleTree::ReadHeader(size_t* leaf_count, string* root) const {
+  string header;
+  if (!util::ReadBinaryFile(HeaderPath(), &header)) {
+    return false;
+  }
+
+  const size_t checksum_size(Sha256Hasher::Sha256Digest("").size());
+  const size_t expected_size(kHeaderMagicSize + 8 + 8 + NodeSize() +
+                             checksum_size);
+  if (header.size() != expected_size ||
+      header.compare(0, kHeaderMagicSize, kHeaderMagic) != 0) {
+    LOG(WARNING) << "Ignoring malformed tree header " << HeaderPath();
+    return false;
+  }
+  const size_t node_size(ReadUint64(header, kHeaderMagicSize));
+  *leaf_count = ReadUint64(header, kHeaderMagicSize + 8);
+  *root = header.substr(kHeaderMagicSize + 16, NodeSize());
+  if (node_size != NodeSize() ||
+      header != EncodeHeader(*leaf_count, *root)) {
+    LOG(WARNING) << "Ignoring corrupt tree header " << HeaderPath();
+    return false;
+  }
+  return true;
+}
+
+
+bool PersistentMerkleTree::OpenLevels(size_t leaf_count,
+                                      vector<NodeStore>* levels) const {
+  const vector<size_t> sizes(LevelSizes(leaf_count));
+  levels->clear();
+  for (size_t level = 0; level < sizes.size(); ++level) {
+    const string path(LevelPath(level));
+    const int fd(open(path.c_str(), IsReadOnly() ? O_RDONLY : O_RDWR));
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 ||
+        static_cast<size_t>(st.st_size) < sizes[level] * NodeSize()) {
+      LOG(WARNING) << "Missing or truncated tree level " << path;
+      if (fd >= 0)
+        close(fd);
+      return false;
+    }
+    levels->emplace_back(NodeSize(), kNodesPerPage, fd, sizes[level],
+                         IsReadOnly() ? NodeStore::PRIVATE_MAPPING
+                                      : NodeStore::SHARED_MAPPING);
+  }
+  return true;
+}
+
+
+string PersistentMerkleTree::HeaderPath() const {
+  return dir_ + "/header";
+}
+
+
+string PersistentMerkleTree::LevelPath(size_t level) const {
+  char name[16];
+  snprintf(name, sizeof(name), "/level-%02zu", level);
+  return dir_ + name;
+}
+
+
+// The header is the magic string, the node size and leaf count as
+// 64-bit big-endian integers, the root, and the SHA-256 of all of the
+// above.
+string PersistentMerkleTree::EncodeHeader(size_t leaf_count,
+                                          const string& root) const {
+  string header(kHeaderMagic, kHeaderMagicSize);
+  AppendUint64(NodeSize(), &header);
+  AppendUint64(leaf_count, &header);
+  header.append(root);
+  header.append(Sha256Hasher::Sha256Digest(header));
+  return header;
+}
+
+
+}  // namespace cert_trans
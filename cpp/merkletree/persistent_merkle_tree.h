@@ -0,0 +1,107 @@
+#ifndef CERT_TRANS_MERKLETREE_PERSISTENT_MERKLE_TREE_H_
+#define CERT_TRANS_MERKLETREE_PERSISTENT_MERKLE_TREE_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/node_store.h"
+#include "util/status.h"
+
+class SerialHasher;
+
+namespace cert_trans {
+
+
+// A MerkleTree whose levels are kept in memory-mapped files in a
+// directory, so that its contents survive restarts.
+//
+// The directory holds one file per level, plus a small header file
+// recording the leaf count and root of the last checkpoint, protected
+// by a checksum. When the tree is opened, the header is validated and
+// the tree is restored to the checkpointed size; nodes written after
+// the checkpoint are ignored. If the header is missing or invalid, or
+// the level files do not reproduce the checkpointed root, the tree
+// starts out empty.
+//
+// Only one instance may modify a given directory at any time, but any
+// number of read-only instances, typically in other processes, may
+// follow its checkpoints. They map the level files copy-on-write, so
+// that the nodes are shared by all the processes through the page
+// cache, and only the few pages holding the last node of each level are
+// copied, since these are recomputed. A read-only instance must be
+// reopened if the writer discards the tree (see Clear()), which
+// truncates the files under it.
+//
+// This class is thread-compatible, but not thread-safe.
+class PersistentMerkleTree : public MerkleTree {
+ public:
+  // Number of nodes in one memory-mapped page of a level file.
+  static const size_t kNodesPerPage;
+
+  enum Access {
+    READ_WRITE,
+    // The tree cannot be modified, only moved to another checkpointed
+    // size with Reload().
+    READ_ONLY,
+  };
+
+  // Opens the tree stored in |dir|, creating the directory if needed.
+  // Takes ownership of |hasher|.
+  PersistentMerkleTree(const std::string& dir, SerialHasher* hasher);
+  // As above, with the given |access|. A read-only tree leaves the
+  // directory untouched, and starts out empty if it has no usable
+  // checkpoint.
+  PersistentMerkleTree(const std::string& dir, SerialHasher* hasher,
+                       Access access);
+  ~PersistentMerkleTree() override;
+
+  bool IsReadOnly() const {
+    return access_ == READ_ONLY;
+  }
+
+  // Brings the tree up to date, flushes its nodes to disk and then
+  // atomically records its current leaf count and root, so that a
+  // subsequent open resumes from this point.
+  util::Status Checkpoint();
+
+  // Discards all the leaves, both in memory and on disk.
+  void Clear();
+
+  // For a read-only tree, replaces its contents with the first
+  // |leaf_count| leaves of the latest checkpoint of the directory.
+  // Returns UNAVAILABLE if that checkpoint has fewer leaves, or another
+  // error if there is no usable checkpoint, leaving the tree unchanged
+  // either way. Since the levels are not checked against a root, the
+  // caller should compare CurrentRoot() with its own.
+  util::Status Reload(size_t leaf_count);
+
+ protected:
+  NodeStore NewLevel(size_t level) override;
+
+ private:
+  // Loads the checkpoint from the directory, returns false if there is
+  // no usable checkpoint.
+  bool Restore();
+  // Reads the leaf count and root of the checkpoint into |*leaf_count|
+  // and |*root|, returns false if there is no usable checkpoint.
+  bool ReadHeader(size_t* leaf_count, std::string* root) const;
+  // Maps the levels of a tree of |leaf_count| leaves into |*levels|,
+  // returns false if the files are missing or too short.
+  bool OpenLevels(size_t leaf_count, std::vector<NodeStore>* levels) const;
+  std::string HeaderPath() const;
+  std::string LevelPath(size_t level) const;
+  std::string EncodeHeader(size_t leaf_count, const std::string& root) const;
+
+  const std::string dir_;
+  const Access access_;
+
+  DISALLOW_COPY_AND_ASSIGN(PersistentMerkleTree);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MERKLETREE_PERSISTENT_MERKLE_TREE_H_
@@ -0,0 +1,197 @@
+#include <gtest/gtest.h>
+#include <stddef.h>
+#include <string>
+
+#include "merkletree/merkle_tree.h"
+#include "merkletree/persistent_merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "util/status_test_util.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+
+
+class PersistentMerkleTreeTest : public ::testing::Test {
+ protected:
+  PersistentMerkleTreeTest()
+      : dir_(tmp_.TmpStorageDir() + "/tree"), reference_(new Sha256Hasher) {
+  }
+
+  PersistentMerkleTree* Open() {
+    return new PersistentMerkleTree(dir_, new Sha256Hasher);
+  }
+
+  void AddLeaves(size_t count, MerkleTree* tree) {
+    for (size_t i = 0; i < count; ++i) {
+      const string data("leaf " + std::to_string(tree->LeafCount()));
+      tree->AddLeaf(data);
+    }
+  }
+
+  TmpStorage tmp_;
+  const string dir_;
+  MerkleTree reference_;
+};
+
+
+TEST_F(PersistentMerkleTreeTest, StartsEmpty) {
+  std::unique_ptr<PersistentMerkleTree> tree(Open());
+  EXPECT_EQ(0U, tree->LeafCount());
+  EXPECT_EQ(reference_.CurrentRoot(), tree->CurrentRoot());
+}
+
+
+TEST_F(PersistentMerkleTreeTest, MatchesInMemoryTree) {
+  std::unique_ptr<PersistentMerkleTree> tree(Open());
+  for (size_t i = 0; i < 70; ++i) {
+    AddLeaves(1, &reference_);
+    AddLeaves(1, tree.get());
+    EXPECT_EQ(reference_.CurrentRoot(), tree->CurrentRoot());
+  }
+  for (size_t snapshot = 1; snapshot <= 70; snapshot += 7) {
+    EXPECT_EQ(reference_.RootAtSnapshot(snapshot),
+              tree->RootAtSnapshot(snapshot));
+    EXPECT_EQ(reference_.PathToRootAtSnapshot(3, snapshot),
+              tree->PathToRootAtSnapshot(3, snapshot));
+  }
+}
+
+
+TEST_F(PersistentMerkleTreeTest, ReopensAtCheckpoint) {
+  for (size_t size = 1; size < 40; size += 5) {
+    AddLeaves(size, &reference_);
+    {
+      std::unique_ptr<PersistentMerkleTree> tree(Open());
+      AddLeaves(size, tree.get());
+      EXPECT_EQ(reference_.LeafCount(), tree->LeafCount());
+      EXPECT_OK(tree->Checkpoint());
+    }
+    std::unique_ptr<PersistentMerkleTree> tree(Open());
+    ASSERT_EQ(reference_.LeafCount(), tree->LeafCount());
+    EXPECT_EQ(reference_.CurrentRoot(), tree->CurrentRoot());
+    for (size_t leaf = 1; leaf <= tree->LeafCount(); ++leaf)
+      EXPECT_EQ(reference_.LeafHash(leaf), tree->LeafHash(leaf));
+  }
+}
+
+
+TEST_F(PersistentMerkleTreeTest, IgnoresLeavesAfterCheckpoint) {
+  {
+    std::unique_ptr<PersistentMerkleTree> tree(Open());
+    AddLeaves(13, tree.get());
+    EXPECT_OK(tree->Checkpoint());
+    // These leaves overwrite the last node of several levels, but are
+    // never checkpointed.
+    AddLeaves(6, tree.get());
+    tree->CurrentRoot();
+  }
+  AddLeaves(13, &reference_);
+  std::unique_ptr<PersistentMerkleTree> tree(Open());
+  ASSERT_EQ(13U, tree->LeafCount());
+  EXPECT_EQ(reference_.CurrentRoot(), tree->CurrentRoot());
+
+  // The tree keeps growing correctly from the checkpoint.
+  AddLeaves(30, &reference_);
+  AddLeaves(30, tree.get());
+  EXPECT_EQ(reference_.CurrentRoot(), tree->CurrentRoot());
+  EXPECT_EQ(reference_.SnapshotConsistency(13, 43),
+            tree->SnapshotConsistency(13, 43));
+}
+
+
+TEST_F(PersistentMerkleTreeTest, DiscardsCorruptHeader) {
+  {
+    std::unique_ptr<PersistentMerkleTree> tree(Open());
+    AddLeaves(10, tree.get());
+    EXPECT_OK(tree->Checkpoint());
+  }
+  string header;
+  ASSERT_TRUE(util::ReadBinaryFile(dir_ + "/header", &header));
+  header[header.size() / 2] ^= 1;
+  FILE* out(fopen((dir_ + "/header").c_str(), "wb"));
+  ASSERT_TRUE(out != NULL);
+  ASSERT_EQ(header.size(), fwrite(header.data(), 1, header.size(), out));
+  fclose(out);
+
+  std::unique_ptr<PersistentMerkleTree> tree(Open());
+  EXPECT_EQ(0U, tree->LeafCount());
+}
+
+
+TEST_F(PersistentMerkleTreeTest, Clear) {
+  {
+    std::unique_ptr<PersistentMerkleTree> tree(Open());
+    AddLeaves(10, tree.get());
+    EXPECT_OK(tree->Checkpoint());
+    tree->Clear();
+    EXPECT_EQ(0U, tree->LeafCount());
+    AddLeaves(3, tree.get());
+    AddLeaves(3, &reference_);
+    EXPECT_EQ(reference_.CurrentRoot(), tree->CurrentRoot());
+  }
+  std::unique_ptr<PersistentMerkleTree> tree(Open());
+  EXPECT_EQ(0U, tree->LeafCount());
+}
+
+
+TEST_F(PersistentMerkleTreeTest, ReadOnlyFollowsCheckpoints) {
+  std::unique_ptr<PersistentMerkleTree> tree(Open());
+  AddLeaves(21, tree.get());
+  AddLeaves(21, &reference_);
+  EXPECT_OK(tree->Checkpoint());
+
+  PersistentMerkleTree reader(dir_, new Sha256Hasher,
+                              PersistentMerkleTree::READ_ONLY);
+  ASSERT_EQ(21U, reader.LeafCount());
+  EXPECT_EQ(reference_.CurrentRoot(), reader.CurrentRoot());
+
+  // Leaves that are not checkpointed yet are not visible.
+  AddLeaves(20, tree.get());
+  AddLeaves(20, &reference_);
+  tree->CurrentRoot();
+  EXPECT_EQ(util::error::UNAVAILABLE, reader.Reload(41).CanonicalCode());
+  EXPECT_EQ(21U, reader.LeafCount());
+  EXPECT_EQ(reference_.RootAtSnapshot(21), reader.CurrentRoot());
+
+  // Any size up to the checkpoint can be reloaded, without disturbing
+  // the writer.
+  EXPECT_OK(tree->Checkpoint());
+  for (size_t size = 1; size <= 41; size += 4) {
+    ASSERT_OK(reader.Reload(size));
+    ASSERT_EQ(size, reader.LeafCount());
+    EXPECT_EQ(reference_.RootAtSnapshot(size), reader.CurrentRoot());
+    EXPECT_EQ(reference_.PathToRootAtSnapshot(1, size),
+              reader.PathToRootAtSnapshot(1, size));
+  }
+  EXPECT_EQ(reference_.CurrentRoot(), tree->CurrentRoot());
+  AddLeaves(5, tree.get());
+  AddLeaves(5, &reference_);
+  EXPECT_EQ(reference_.CurrentRoot(), tree->CurrentRoot());
+  EXPECT_OK(tree->Checkpoint());
+  ASSERT_OK(reader.Reload(46));
+  EXPECT_EQ(reference_.CurrentRoot(), reader.CurrentRoot());
+}
+
+
+TEST_F(PersistentMerkleTreeTest, ReadOnlyStartsEmptyWithoutCheckpoint) {
+  PersistentMerkleTree reader(dir_, new Sha256Hasher,
+                              PersistentMerkleTree::READ_ONLY);
+  EXPECT_EQ(0U, reader.LeafCount());
+  EXPECT_EQ(util::error::FAILED_PRECONDITION,
+            reader.Reload(0).CanonicalCode());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -2,9 +2,29 @@
 
 #include <openssl/sha.h>
 #include <stddef.h>
+#include <string.h>
 
 using std::string;
 
+void SerialHasher::Update(const char* data, size_t size) {
+  Update(string(data, size));
+}
+
+void SerialHasher::Final(char* digest) {
+  const string result(Final());
+  memcpy(digest, result.data(), result.size());
+}
+
+void SerialHasher::DigestMany(const char* data, size_t size, size_t count,
+                              char* digests) {
+  for (size_t i = 0; i < count; ++i) {
+    Reset();
+    Update(string(data + i * size, size));
+    const string digest(Final());
+    memcpy(digests + i * digest.size(), digest.data(), digest.size());
+  }
+}
+
 const size_t Sha256Hasher::kDigestSize = SHA256_DIGEST_LENGTH;
 
 Sha256Hasher::Sha256Hasher() : initialized_(false) {
@@ -16,20 +36,39 @@ void Sha256Hasher::Reset() {
 }
 
 void Sha256Hasher::Update(const std::string& data) {
+  Update(data.data(), data.size());
+}
+
+void Sha256Hasher::Update(const char* data, size_t size) {
   if (!initialized_)
     Reset();
 
-  SHA256_Update(&ctx_, data.data(), data.size());
+  SHA256_Update(&ctx_, data, size);
 }
 
 string Sha256Hasher::Final() {
+  string digest(SHA256_DIGEST_LENGTH, 0);
+  Final(&digest[0]);
+  return digest;
+}
+
+void Sha256Hasher::Final(char* digest) {
   if (!initialized_)
     Reset();
 
-  unsigned char hash[SHA256_DIGEST_LENGTH];
-  SHA256_Final(hash, &ctx_);
+  SHA256_Final(reinterpret_cast<unsigned char*>(digest), &ctx_);
+  initialized_ = false;
+}
+
+void Sha256Hasher::DigestMany(const char* data, size_t size, size_t count,
+                              char* digests) {
+  // The one-shot function skips the context bookkeeping, and picks the
+  // fastest block function for this CPU (SHA extensions, AVX2, ...).
+  const unsigned char* in(reinterpret_cast<const unsigned char*>(data));
+  unsigned char* out(reinterpret_cast<unsigned char*>(digests));
+  for (size_t i = 0; i < count; ++i)
+    SHA256(in + i * size, size, out + i * SHA256_DIGEST_LENGTH);
   initialized_ = false;
-  return string(reinterpret_cast<char*>(hash), SHA256_DIGEST_LENGTH);
 }
 
 SerialHasher* Sha256Hasher::Create() const {
@@ -23,9 +23,27 @@ class SerialHasher {
   // Update the hash context with (binary) data.
   virtual void Update(const std::string& data) = 0;
 
+  // As above, with the |size| bytes at |data|. The default implementation
+  // copies them into a string.
+  virtual void Update(const char* data, size_t size);
+
   // Finalize the hash context and return the binary digest blob.
   virtual std::string Final() = 0;
 
+  // As above, but writes the DigestSize() byte digest to |digest| instead.
+  // Implementations should override this to avoid allocating a string,
+  // since hashing tree nodes relies on it.
+  virtual void Final(char* digest);
+
+  // Hash |count| messages of |size| bytes each, stored back to back in
+  // |data|, and write their digests back to back to |digests|, which
+  // must have room for |count| * DigestSize() bytes. The result is the
+  // same as a Reset(), Update(), Final() sequence for each message, but
+  // implementations may hash several messages at once. Resets the
+  // context.
+  virtual void DigestMany(const char* data, size_t size, size_t count,
+                          char* digests);
+
   // A virtual constructor.  The caller gets ownership of the returned object.
   virtual SerialHasher* Create() const = 0;
 
@@ -43,7 +61,11 @@ class Sha256Hasher : public SerialHasher {
 
   void Reset();
   void Update(const std::string& data);
+  void Update(const char* data, size_t size);
   std::string Final();
+  void Final(char* digest);
+  void DigestMany(const char* data, size_t size, size_t count,
+                  char* digests);
   SerialHasher* Create() const;
 
   // Create a new hasher and call Reset(), Update(), and Final().
@@ -93,6 +93,21 @@ TYPED_TEST(SerialHasherTest, Update) {
   EXPECT_EQ(H(digest), H(output));
 }
 
+TYPED_TEST(SerialHasherTest, BufferUpdateAndFinal) {
+  const string input(kTestString, kTestStringLength);
+  this->hasher_->Reset();
+  this->hasher_->Update(input);
+  const string digest(this->hasher_->Final());
+
+  this->hasher_->Reset();
+  this->hasher_->Update(input.data(), kTestStringLength / 2);
+  this->hasher_->Update(input.data() + kTestStringLength / 2,
+                        kTestStringLength - kTestStringLength / 2);
+  string output(this->hasher_->DigestSize(), 0);
+  this->hasher_->Final(&output[0]);
+  EXPECT_EQ(H(digest), H(output));
+}
+
 TYPED_TEST(SerialHasherTest, Create) {
   string input, output, digest;
 
@@ -107,6 +122,25 @@ TYPED_TEST(SerialHasherTest, Create) {
   }
 }
 
+TYPED_TEST(SerialHasherTest, DigestMany) {
+  const size_t kMessageSize = 65;
+  const size_t kCount = 10;
+  const size_t digest_size(this->hasher_->DigestSize());
+  string messages;
+  for (size_t i = 0; i < kCount * kMessageSize; ++i)
+    messages.push_back(static_cast<char>(i));
+
+  string digests(kCount * digest_size, 0);
+  this->hasher_->DigestMany(messages.data(), kMessageSize, kCount,
+                            &digests[0]);
+  for (size_t i = 0; i < kCount; ++i) {
+    this->hasher_->Reset();
+    this->hasher_->Update(messages.substr(i * kMessageSize, kMessageSize));
+    EXPECT_EQ(H(this->hasher_->Final()),
+              H(digests.substr(i * digest_size, digest_size)));
+  }
+}
+
 TEST(Sha256Test, StaticDigest) {
   string input, output, digest;
 
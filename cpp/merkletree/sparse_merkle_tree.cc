@@ -1,46 +1,77 @@
 #include "cpp/merkletree/sparse_merkle_tree.h"
 
 #include <stddef.h>
+#include <string.h>
 #include <algorithm>
 #include <vector>
 
 #include "merkletree/merkle_tree_math.h"
 #include "util/util.h"
 
+using cert_trans::SparseMerkleTreeStore;
 using std::make_pair;
 using std::ostream;
 using std::ostringstream;
 using std::reverse;
 using std::string;
-using std::unique_ptr;
 using std::unordered_map;
 using std::vector;
 
+namespace {
+
+
+// Node encodings in a SparseMerkleTreeStore: a tag, followed by the hash
+// for internal nodes, or by the path, the leaf hash and possibly the
+// subtree hash for leaves.
+const char kInternalNodeTag = 'I';
+const char kLeafNodeTag = 'L';
+
+
+}  // namespace
+
 
 const vector<string>* GetNullHashes(const TreeHasher& hasher) {
-  static unique_ptr<const vector<string>> null_hashes;
-  if (!null_hashes) {
+  // Initialised exactly once, even with concurrent callers.
+  static const vector<string>* const null_hashes([&hasher]() {
     vector<string> r{hasher.HashLeaf("")};
     for (int i(1); i < hasher.DigestSize() * 8; ++i) {
       r.emplace_back(hasher.HashChildren(r.back(), r.back()));
     }
     reverse(r.begin(), r.end());
-    null_hashes.reset(new vector<string>(std::move(r)));
-  }
-  return null_hashes.get();
+    return new vector<string>(std::move(r));
+  }());
+  return null_hashes;
 }
 
 
+const int SparseMerkleTree::kDigestSizeBits;
+
+
 SparseMerkleTree::SparseMerkleTree(SerialHasher* hasher)
+    : SparseMerkleTree(hasher, nullptr, 0) {
+}
+
+
+SparseMerkleTree::SparseMerkleTree(SerialHasher* hasher,
+                                   SparseMerkleTreeStore* store,
+                                   size_t max_cached_nodes)
     : serial_hasher_(CHECK_NOTNULL(hasher)->Create()),
       treehasher_(hasher),
-      null_hashes_(GetNullHashes(treehasher_)) {
+      null_hashes_(GetNullHashes(treehasher_)),
+      store_(store),
+      max_cached_nodes_(max_cached_nodes) {
+  CHECK_EQ(sizeof(Digest), treehasher_.DigestSize());
+  // Levels are never reallocated, so that nodes stay put while other
+  // levels are added.
+  tree_.reserve(kDigestSizeBits + 1);
+  dirty_.reserve(kDigestSizeBits + 1);
 }
 
 
 void SparseMerkleTree::EnsureHaveLevel(size_t level) {
   if (tree_.size() < (level + 1)) {
     tree_.resize(level + 1);
+    dirty_.resize(level + 1);
   }
 }
 
@@ -49,25 +80,30 @@ void SparseMerkleTree::SetLeaf(const Path& path, const string& data) {
   CHECK_EQ(treehasher_.DigestSize(), path.size());
   // Mark the tree dirty:
   root_hash_.clear();
-  string leaf_hash(treehasher_.HashLeaf(data));
+  Digest leaf_hash;
+  treehasher_.HashLeaf(data.data(), data.size(), leaf_hash.data());
 
   IndexType node_index(0);
   for (int depth(0); depth <= kDigestSizeBits; ++depth) {
     node_index += PathBit(path, depth);
     EnsureHaveLevel(depth);
-    auto it(tree_[depth].find(node_index));
-    if (it == tree_[depth].end()) {
-      CHECK(tree_[depth]
-                .emplace(make_pair(node_index, TreeNode(path, leaf_hash)))
-                .second);
+    TreeNode* const node(FindNode(depth, node_index));
+    if (node == nullptr) {
+      AddNode(depth, node_index, TreeNode(path, leaf_hash));
       return;
-    } else if (it->second.type_ == TreeNode::INTERNAL) {
-      // Mark the internal node hash dirty
-      it->second.hash_.clear();
-    } else if (*it->second.path_ == path) {
+    } else if (node->type_ == TreeNode::INTERNAL) {
+      // Mark the internal node hash dirty, unless it already is.
+      if (node->has_hash_) {
+        node->has_hash_ = false;
+        dirty_[depth].push_back(node_index);
+        MarkModified(depth, node_index);
+      }
+    } else if (node->path_ == path) {
       // replacement
-      CHECK_EQ(TreeNode::LEAF, it->second.type_);
-      it->second.hash_ = std::move(leaf_hash);
+      CHECK_EQ(TreeNode::LEAF, node->type_);
+      node->hash_ = leaf_hash;
+      node->has_subtree_hash_ = false;
+      MarkModified(depth, node_index);
       return;
     } else {
       // restructure: push the existing node down a level and replace this one
@@ -75,12 +111,15 @@ void SparseMerkleTree::SetLeaf(const Path& path, const string& data) {
       CHECK_LT(depth, kDigestSizeBits);
       EnsureHaveLevel(depth + 1);
       IndexType child_index((node_index << 1) +
-                            PathBit(*it->second.path_, depth + 1));
-      CHECK(tree_[depth + 1]
-                .emplace(make_pair(child_index, std::move(it->second)))
-                .second);
-      it->second.type_ = TreeNode::INTERNAL;
-      it->second.hash_.clear();
+                            PathBit(node->path_, depth + 1));
+      TreeNode* const moved(AddNode(depth + 1, child_index, *node));
+      // The pushed down leaf roots a smaller subtree now.
+      moved->has_subtree_hash_ = false;
+      node->type_ = TreeNode::INTERNAL;
+      node->has_hash_ = false;
+      node->has_subtree_hash_ = false;
+      dirty_[depth].push_back(node_index);
+      MarkModified(depth, node_index);
     }
     node_index <<= 1;
   }
@@ -114,58 +153,361 @@ string SparseMerkleTree::Dump() const {
 }
 
 
-string SparseMerkleTree::CalculateSubtreeHash(size_t depth, IndexType index) {
-  if (tree_.size() <= depth) {
-    return null_hashes_->at(depth);
-  }
-
-  auto it(tree_[depth].find(index));
-  if (it != tree_[depth].end()) {
-    switch (it->second.type_) {
-      case TreeNode::INTERNAL: {
-        if (!it->second.hash_.empty()) {
-          return it->second.hash_;
-        }
-        IndexType left_child_index(index << 1);
-        const string left(CalculateSubtreeHash(depth + 1, left_child_index));
-        const string right(
-            CalculateSubtreeHash(depth + 1, left_child_index + 1));
-        it->second.hash_.assign(treehasher_.HashChildren(left, right));
-        return it->second.hash_;
+SparseMerkleTree::TreeNode* SparseMerkleTree::FindNode(size_t depth,
+                                                       IndexType index) {
+  if (depth < tree_.size()) {
+    auto it(tree_[depth].find(index));
+    if (it != tree_[depth].end()) {
+      return &it->second;
+    }
+  }
+
+  string data;
+  if (store_ == nullptr || !store_->GetNode(depth, index, &data)) {
+    return nullptr;
+  }
+  EnsureHaveLevel(depth);
+  auto inserted(tree_[depth].emplace(make_pair(index, DecodeNode(data))));
+  CHECK(inserted.second);
+  return &inserted.first->second;
+}
+
+
+SparseMerkleTree::TreeNode* SparseMerkleTree::AddNode(size_t depth,
+                                                      IndexType index,
+                                                      TreeNode node) {
+  auto inserted(tree_[depth].emplace(make_pair(index, std::move(node))));
+  CHECK(inserted.second);
+  MarkModified(depth, index);
+  return &inserted.first->second;
+}
+
+
+void SparseMerkleTree::MarkModified(size_t depth, IndexType index) {
+  if (store_ != nullptr) {
+    modified_.insert(make_pair(depth, index));
+  }
+}
+
+
+string SparseMerkleTree::EncodeNode(const TreeNode& node) const {
+  string ret;
+  switch (node.type_) {
+    case TreeNode::INTERNAL:
+      CHECK(node.has_hash_);
+      ret.push_back(kInternalNodeTag);
+      ret.append(node.hash_.data(), node.hash_.size());
+      return ret;
+
+    case TreeNode::LEAF:
+      ret.push_back(kLeafNodeTag);
+      ret.append(reinterpret_cast<const char*>(node.path_.data()),
+                 node.path_.size());
+      ret.append(node.hash_.data(), node.hash_.size());
+      if (node.has_subtree_hash_) {
+        ret.append(node.subtree_hash_.data(), node.subtree_hash_.size());
       }
+      return ret;
+  }
+  LOG(FATAL) << "Unknown node type " << node.type_ << " !";
+}
+
+
+SparseMerkleTree::TreeNode SparseMerkleTree::DecodeNode(
+    const string& data) const {
+  Digest hash;
+  if (!data.empty() && data[0] == kInternalNodeTag) {
+    CHECK_EQ(1 + hash.size(), data.size()) << "Corrupt internal node";
+    data.copy(hash.data(), hash.size(), 1);
+    return TreeNode(hash);
+  }
+
+  const size_t leaf_size(1 + sizeof(Path) + hash.size());
+  CHECK(!data.empty() && data[0] == kLeafNodeTag) << "Unknown node type";
+  CHECK(data.size() == leaf_size || data.size() == leaf_size + hash.size())
+      << "Corrupt leaf node";
+  Path path;
+  std::copy(data.begin() + 1, data.begin() + 1 + path.size(), path.begin());
+  data.copy(hash.data(), hash.size(), 1 + path.size());
+  TreeNode node(path, hash);
+  if (data.size() > leaf_size) {
+    data.copy(node.subtree_hash_.data(), hash.size(), leaf_size);
+    node.has_subtree_hash_ = true;
+  }
+  return node;
+}
+
+
+void SparseMerkleTree::EvictNodes() {
+  CHECK(modified_.empty());
+  size_t cached(0);
+  for (const auto& level : tree_) {
+    cached += level.size();
+  }
+  for (size_t depth(tree_.size()); depth > 0 && cached > max_cached_nodes_;
+       --depth) {
+    cached -= tree_[depth - 1].size();
+    // Swap rather than clear(), to release the buckets too.
+    unordered_map<IndexType, TreeNode>().swap(tree_[depth - 1]);
+  }
+}
+
+
+const char* SparseMerkleTree::SubtreeHash(size_t depth, IndexType index) {
+  TreeNode* const node(FindNode(depth, index));
+  if (node == nullptr) {
+    return null_hashes_->at(depth).data();
+  }
 
-      case TreeNode::LEAF: {
-        string ret(it->second.hash_);
-        for (int i(kDigestSizeBits - 1); i > depth; --i) {
-          if (PathBit(*(it->second.path_), i) == 0) {
-            ret = treehasher_.HashChildren(ret, null_hashes_->at(i));
-          } else {
-            ret = treehasher_.HashChildren(null_hashes_->at(i), ret);
-          }
-        }
-        // TODO(alcutter): maybe cache this?
-        return ret;
+  switch (node->type_) {
+    case TreeNode::INTERNAL:
+      CHECK(node->has_hash_) << "Dirty node at depth " << depth;
+      return node->hash_.data();
+
+    case TreeNode::LEAF:
+      if (!node->has_subtree_hash_) {
+        LeafSubtreeHash(depth, *node, node->subtree_hash_.data());
+        node->has_subtree_hash_ = true;
       }
+      return node->subtree_hash_.data();
+  }
+  LOG(FATAL) << "Unknown node type " << node->type_ << " !";
+}
+
+
+void SparseMerkleTree::LeafSubtreeHash(size_t depth, const TreeNode& node,
+                                       char* hash) const {
+  memcpy(hash, node.hash_.data(), node.hash_.size());
+  for (int i(kDigestSizeBits - 1); i > depth; --i) {
+    const char* const null_hash(null_hashes_->at(i).data());
+    if (PathBit(node.path_, i) == 0) {
+      treehasher_.HashChildren(hash, null_hash, hash);
+    } else {
+      treehasher_.HashChildren(null_hash, hash, hash);
     }
-    LOG(FATAL) << "Unknown node type " << it->second.type_ << " !";
   }
+}
 
-  return null_hashes_->at(depth);
+
+void SparseMerkleTree::RehashDirtyNodes() {
+  // Rehash the dirty nodes bottom up, so that the children of the nodes
+  // of each level are up to date by the time the level is hashed.
+  const size_t digest_size(treehasher_.DigestSize());
+  string nodes;
+  for (size_t depth(dirty_.size()); depth > 0; --depth) {
+    vector<IndexType>* const dirty(&dirty_[depth - 1]);
+    if (dirty->empty()) {
+      continue;
+    }
+    nodes.clear();
+    nodes.reserve(dirty->size() * 2 * digest_size);
+    for (const IndexType index : *dirty) {
+      nodes.append(SubtreeHash(depth, index << 1), digest_size);
+      nodes.append(SubtreeHash(depth, (index << 1) + 1), digest_size);
+    }
+    // The parents overwrite the first half of |nodes|.
+    treehasher_.HashChildren(nodes.data(), dirty->size(), &nodes[0]);
+    for (size_t i(0); i < dirty->size(); ++i) {
+      auto it(tree_[depth - 1].find((*dirty)[i]));
+      CHECK(it != tree_[depth - 1].end());
+      memcpy(it->second.hash_.data(), nodes.data() + i * digest_size,
+             digest_size);
+      it->second.has_hash_ = true;
+    }
+    dirty->clear();
+  }
 }
 
 
 string SparseMerkleTree::CurrentRoot() {
-  if (root_hash_.empty()) {
-    root_hash_ = treehasher_.HashChildren(CalculateSubtreeHash(0, 0),
-                                          CalculateSubtreeHash(0, 1));
+  if (!root_hash_.empty()) {
+    return root_hash_;
   }
+
+  RehashDirtyNodes();
+  root_hash_.resize(treehasher_.DigestSize());
+  treehasher_.HashChildren(SubtreeHash(0, 0), SubtreeHash(0, 1),
+                           &root_hash_[0]);
   return root_hash_;
 }
 
 
+string SparseMerkleTree::SubtreeRoot(size_t depth, const Path& path) {
+  RehashDirtyNodes();
+  return ProofNodeHash(ProofNodeAt(depth, path));
+}
+
+
+util::Status SparseMerkleTree::Flush(SparseMerkleTreeStore::WriteBatch* batch) {
+  if (store_ == nullptr) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "tree has no store");
+  }
+
+  // Make sure no dirty hashes get written.
+  CurrentRoot();
+  for (const auto& modified : modified_) {
+    const auto it(tree_[modified.first].find(modified.second));
+    CHECK(it != tree_[modified.first].end());
+    batch->PutNode(modified.first, modified.second, EncodeNode(it->second));
+  }
+  const util::Status status(store_->Write(*batch));
+  if (!status.ok()) {
+    return status;
+  }
+  modified_.clear();
+  EvictNodes();
+  return util::Status::OK;
+}
+
+
+util::Status SparseMerkleTree::Flush() {
+  SparseMerkleTreeStore::WriteBatch batch;
+  return Flush(&batch);
+}
+
+
+SparseMerkleTree::ProofNode SparseMerkleTree::ProofChild(
+    const ProofNode& parent, int side) {
+  const int depth(parent.depth + 1);
+  const IndexType index(parent.depth < 0 ? side : (parent.index << 1) + side);
+  if (parent.depth < 0 ||
+      (parent.node != nullptr && parent.node->type_ == TreeNode::INTERNAL)) {
+    return ProofNode{depth, index, FindNode(depth, index), true};
+  }
+  // Below a leaf, or in an empty subtree.
+  if (parent.node != nullptr && PathBit(parent.node->path_, depth) == side) {
+    return ProofNode{depth, index, parent.node, false};
+  }
+  return ProofNode{depth, index, nullptr, false};
+}
+
+
+SparseMerkleTree::ProofNode SparseMerkleTree::ProofNodeAt(size_t depth,
+                                                         const Path& path) {
+  CHECK_LT(depth, kDigestSizeBits);
+  ProofNode node{-1, 0, nullptr, false};
+  for (size_t d(0); d <= depth; ++d) {
+    node = ProofChild(node, PathBit(path, d));
+  }
+  return node;
+}
+
+
+string SparseMerkleTree::ProofNodeHash(const ProofNode& node) {
+  CHECK_GE(node.depth, 0);
+  if (node.node == nullptr) {
+    return null_hashes_->at(node.depth);
+  }
+  if (node.at_node) {
+    return string(SubtreeHash(node.depth, node.index),
+                  treehasher_.DigestSize());
+  }
+  string hash(treehasher_.DigestSize(), '\0');
+  LeafSubtreeHash(node.depth, *node.node, &hash[0]);
+  return hash;
+}
+
+
 std::vector<string> SparseMerkleTree::InclusionProof(const Path& path) {
-  // TODO(alcutter): implement
-  LOG(FATAL) << "Not implemented.";
+  CHECK_EQ(treehasher_.DigestSize(), path.size());
+  // Make sure all the hashes are up to date.
+  CurrentRoot();
+
+  vector<string> proof;
+  proof.reserve(kDigestSizeBits);
+  ProofNode node{-1, 0, nullptr, false};
+  for (int depth(0); depth < kDigestSizeBits; ++depth) {
+    const int bit(PathBit(path, depth));
+    proof.emplace_back(ProofNodeHash(ProofChild(node, 1 - bit)));
+    node = ProofChild(node, bit);
+  }
+  reverse(proof.begin(), proof.end());
+  return proof;
+}
+
+
+SparseMerkleTree::CompressedProof SparseMerkleTree::CompressedInclusionProof(
+    const Path& path) {
+  return CompressProof(InclusionProof(path));
+}
+
+
+SparseMerkleTree::CompressedProof SparseMerkleTree::CompressProof(
+    const vector<string>& proof) const {
+  CompressedProof compressed;
+  compressed.bitmap.assign(kDigestSizeBits / 8, 0);
+  for (size_t i(0); i < proof.size(); ++i) {
+    // proof[i] is the sibling at depth kDigestSizeBits - 1 - i.
+    if (proof[i] != null_hashes_->at(proof.size() - 1 - i)) {
+      compressed.bitmap[i / 8] |= 1 << (7 - i % 8);
+      compressed.hashes.emplace_back(proof[i]);
+    }
+  }
+  return compressed;
+}
+
+
+SparseMerkleTree::BatchProof SparseMerkleTree::BatchInclusionProof(
+    const vector<Path>& paths) {
+  // Make sure all the hashes are up to date.
+  CurrentRoot();
+
+  vector<Path> sorted(paths);
+  std::sort(sorted.begin(), sorted.end());
+  sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+  BatchProof proof;
+  if (!sorted.empty()) {
+    AddToBatchProof(ProofNode{-1, 0, nullptr, false}, sorted.begin(),
+                    sorted.end(), &proof);
+  }
+  return proof;
+}
+
+
+void SparseMerkleTree::AddToBatchInclusionProof(size_t depth,
+                                                const vector<Path>& paths,
+                                                BatchProof* proof) {
+  if (paths.empty()) {
+    return;
+  }
+  RehashDirtyNodes();
+  AddToBatchProof(ProofNodeAt(depth, paths.front()), paths.begin(),
+                  paths.end(), proof);
+}
+
+
+void SparseMerkleTree::AddToBatchProof(const ProofNode& node,
+                                       vector<Path>::const_iterator begin,
+                                       vector<Path>::const_iterator end,
+                                       BatchProof* proof) {
+  const int depth(node.depth + 1);
+  if (depth == kDigestSizeBits) {
+    // This is the leaf itself.
+    return;
+  }
+  // The paths share their first |depth| bits, so the ones going left come
+  // first.
+  const vector<Path>::const_iterator middle(
+      std::partition_point(begin, end, [depth](const Path& path) {
+        return PathBit(path, depth) == 0;
+      }));
+  for (int side(0); side < 2; ++side) {
+    const ProofNode child(ProofChild(node, side));
+    const vector<Path>::const_iterator child_begin(side == 0 ? begin : middle);
+    const vector<Path>::const_iterator child_end(side == 0 ? middle : end);
+    if (child_begin != child_end) {
+      AddToBatchProof(child, child_begin, child_end, proof);
+      continue;
+    }
+    const string hash(ProofNodeHash(child));
+    const bool non_null(hash != null_hashes_->at(depth));
+    proof->non_null.push_back(non_null);
+    if (non_null) {
+      proof->hashes.emplace_back(hash);
+    }
+  }
 }
 
 
@@ -182,15 +524,15 @@ string SparseMerkleTree::TreeNode::DebugString() const {
   }
 
   os << " hash: ";
-  if (!hash_.empty()) {
-    os << util::ToBase64(hash_);
+  if (has_hash_) {
+    os << util::ToBase64(string(hash_.data(), hash_.size()));
   } else {
     os << "(unset)";
   }
 
-  if (path_) {
+  if (type_ == LEAF) {
     os << " path: ";
-    os << *path_;
+    os << path_;
   }
   os << "]";
   return os.str();
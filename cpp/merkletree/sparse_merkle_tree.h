@@ -3,19 +3,29 @@
 
 #include <glog/logging.h>
 #include <stddef.h>
+#include <string.h>
 #include <array>
+#include <set>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 #include "merkletree/merkle_tree_interface.h"
+#include "merkletree/sparse_merkle_tree_store.h"
 #include "merkletree/tree_hasher.h"
+#include "util/status.h"
 
 class SerialHasher;
 
 
 // Calculates the set of "null" hashes:
 // ...H(H(H("")||H(""))||H("")||(H(""))||...)...
+// i.e. the hash of an empty subtree at each depth, with the root's
+// children at depth 0.
+//
+// The table is computed once, on first use, and shared by all the trees,
+// which must therefore use the same hash function. This is thread-safe.
 //
 // Visible out here because it's useful for testing too.
 const std::vector<std::string>* GetNullHashes(const TreeHasher& hasher);
@@ -106,6 +116,31 @@ const std::vector<std::string>* GetNullHashes(const TreeHasher& hasher);
 // optimised by cribbing the value of "missing" nodes from a simple cache. This
 // removes the need to calculate the vast majority of nodes from scratch.
 //
+// The root is also maintained incrementally: SetLeaf() marks the internal
+// nodes along the path of the leaf as dirty, and CurrentRoot() only
+// rehashes those, one level at a time from the bottom up, hashing all the
+// dirty nodes of a level in a single batch. Updating k leaves of a tree
+// of n leaves therefore costs O(k log n) hashes, rather than rehashing
+// the whole tree. The hash of the subtree of each leaf is cached too, so
+// that it is only recomputed when the leaf changes or is pushed down.
+//
+// * Persistence
+// The tree can optionally be backed by a SparseMerkleTreeStore, in which
+// case the nodes held in memory are a write-back cache of the store: nodes
+// are read from the store when they are first needed, and Flush() writes
+// the nodes changed since the previous Flush() back to the store, then
+// evicts the deepest levels of the tree from memory until at most
+// |max_cached_nodes| nodes are left. Since the upper levels are part of
+// every path, they are the last to go. A tree reopened on the same store
+// picks up where the last Flush() left off, without reading anything but
+// the nodes it needs.
+//
+// * Subtrees
+// SubtreeRoot() and AddToBatchInclusionProof() work on the subtree rooted
+// at some depth only, so that a tree holding only the leaves whose paths
+// start with a given prefix can serve as one shard of a larger tree, see
+// VerifiableMap.
+//
 // TODO(alcutter): LOTS!
 //
 // This class is thread-compatible, but not thread-safe.
@@ -132,11 +167,45 @@ class SparseMerkleTree {
   //  that the paths are lexographically sortable.
   typedef std::array<uint8_t, kDigestSizeBits / 8> Path;
 
+  // An inclusion proof without its null hashes, as returned by
+  // CompressedInclusionProof(). A tree with n leaves only has about
+  // log2(n) non-null hashes in each of its 256 hash long proofs.
+  struct CompressedProof {
+    // kDigestSizeBits / 8 bytes, with bits numbered as in PathBit(). Bit
+    // i is set iff the i-th hash of the full proof is not a null hash.
+    std::string bitmap;
+    // The non-null hashes, from the leaf up to the root.
+    std::vector<std::string> hashes;
+  };
+
+  // A proof of the values of a set of leaves, as returned by
+  // BatchInclusionProof().
+  //
+  // Instead of one path per leaf, the proof holds each sibling needed to
+  // recompute the root from the leaves once, leaving out the siblings
+  // that can be computed from the other leaves, and the ones that are
+  // empty subtrees, whose hashes are given by GetNullHashes(). The
+  // siblings are listed in the order in which a depth-first,
+  // left-to-right walk of the paths to the leaves reaches them.
+  struct BatchProof {
+    // One entry per sibling, true if its hash is the next one in
+    // |hashes|, false if it is an empty subtree.
+    std::vector<bool> non_null;
+    std::vector<std::string> hashes;
+  };
+
   // The constructor takes a pointer to some concrete hash function
   // instantiation of the SerialHasher abstract class.
   // Takes ownership of the hasher.
   explicit SparseMerkleTree(SerialHasher* hasher);
 
+  // As above, but with the nodes kept in |store|, which must outlive the
+  // tree, and at most about |max_cached_nodes| of them kept in memory
+  // after each Flush().
+  SparseMerkleTree(SerialHasher* hasher,
+                   cert_trans::SparseMerkleTreeStore* store,
+                   size_t max_cached_nodes);
+
   // Length of a node (i.e., a hash), in bytes.
   virtual size_t NodeSize() const {
     return treehasher_.DigestSize();
@@ -173,6 +242,34 @@ class SparseMerkleTree {
   // @param path the path of the leaf whose inclusion proof to return.
   std::vector<std::string> InclusionProof(const Path& path);
 
+  // Like InclusionProof(), but with the null hashes, which make up most of
+  // a proof, left out. See CompressedProof.
+  CompressedProof CompressedInclusionProof(const Path& path);
+
+  // Compresses a |proof| as returned by InclusionProof().
+  CompressedProof CompressProof(const std::vector<std::string>& proof) const;
+
+  // Returns a proof of the values of all the leaves in |paths|, see
+  // BatchProof. Leaves which were never set are proven to be empty.
+  BatchProof BatchInclusionProof(const std::vector<Path>& paths);
+
+  // Returns the hash of the subtree rooted at the node at |depth| along
+  // |path|, bringing the dirty nodes up to date first.
+  std::string SubtreeRoot(size_t depth, const Path& path);
+
+  // Adds to |proof| the siblings below the node at |depth| needed for the
+  // sorted, unique |paths|, which must all go through that node, in the
+  // order BatchInclusionProof() would list them.
+  void AddToBatchInclusionProof(size_t depth, const std::vector<Path>& paths,
+                                BatchProof* proof);
+
+  // Brings the root up to date and atomically writes the nodes that
+  // changed since the last Flush() to the store, along with the writes
+  // already in |batch|. Then evicts nodes from memory, if needed.
+  // Returns FAILED_PRECONDITION if the tree has no store.
+  util::Status Flush(cert_trans::SparseMerkleTreeStore::WriteBatch* batch);
+  util::Status Flush();
+
   std::string Dump() const;
 
  private:
@@ -181,23 +278,103 @@ class SparseMerkleTree {
   // WARNING WARNING WARNING
   // TODO(alcutter): BIGNUM probably.
   typedef uint64_t IndexType;
+  // A hash of the tree's hasher, which must be kDigestSizeBits long.
+  typedef std::array<char, kDigestSizeBits / 8> Digest;
 
+  // The path and hashes are kept inline rather than on the heap, as there
+  // are as many nodes as there are leaves.
   struct TreeNode {
-    TreeNode(const std::string& hash) : type_(INTERNAL), hash_(hash) {
+    TreeNode(const Digest& hash)
+        : type_(INTERNAL),
+          has_hash_(true),
+          has_subtree_hash_(false),
+          hash_(hash) {
     }
 
-    TreeNode(const Path& path, const std::string& leaf_hash)
-        : type_(LEAF), path_(new Path(path)), hash_(leaf_hash) {
+    TreeNode(const Path& path, const Digest& leaf_hash)
+        : type_(LEAF),
+          has_hash_(true),
+          has_subtree_hash_(false),
+          path_(path),
+          hash_(leaf_hash) {
     }
 
     std::string DebugString() const;
 
-    enum { INTERNAL, LEAF } type_;
-    std::unique_ptr<Path> path_;
-    std::string hash_;
+    enum : uint8_t { INTERNAL, LEAF } type_;
+    // Whether |hash_| and |subtree_hash_| are set.
+    bool has_hash_;
+    bool has_subtree_hash_;
+    // For LEAF nodes only.
+    Path path_;
+    // For INTERNAL nodes, the hash of the node, unset if it is dirty. For
+    // LEAF nodes, the hash of the leaf value.
+    Digest hash_;
+    // For LEAF nodes, the cached hash of the subtree rooted at the node,
+    // unset if it needs recomputing.
+    Digest subtree_hash_;
+  };
+
+  // A node of the tree, as walked down when building proofs. Unlike
+  // TreeNodes, these also exist below leaves and where the tree is empty.
+  struct ProofNode {
+    // -1 for the root.
+    int depth;
+    IndexType index;
+    // The INTERNAL node at this position, or the only LEAF node in the
+    // subtree, or NULL if the subtree is empty.
+    TreeNode* node;
+    // Whether |node| is at this position, rather than further down.
+    bool at_node;
   };
 
-  std::string CalculateSubtreeHash(size_t depth, IndexType index);
+  // Returns the left (|side| 0) or right (|side| 1) child of |parent|.
+  ProofNode ProofChild(const ProofNode& parent, int side);
+
+  // Returns the hash of the subtree rooted at |node|.
+  std::string ProofNodeHash(const ProofNode& node);
+
+  // Returns the node at |depth| along |path|.
+  ProofNode ProofNodeAt(size_t depth, const Path& path);
+
+  // Adds to |proof| the siblings needed for the sorted paths in
+  // [|begin|, |end|), all of which go through |node|.
+  void AddToBatchProof(const ProofNode& node,
+                       std::vector<Path>::const_iterator begin,
+                       std::vector<Path>::const_iterator end,
+                       BatchProof* proof);
+
+  // Returns the |index|-th node at |depth|, reading it from the store if
+  // it is not in memory, or NULL if there is no such node.
+  TreeNode* FindNode(size_t depth, IndexType index);
+
+  // Adds |node| as the |index|-th node at |depth|, which must not exist.
+  TreeNode* AddNode(size_t depth, IndexType index, TreeNode node);
+
+  // Records that the |index|-th node at |depth| must be written back to
+  // the store.
+  void MarkModified(size_t depth, IndexType index);
+
+  std::string EncodeNode(const TreeNode& node) const;
+  TreeNode DecodeNode(const std::string& data) const;
+
+  // Rehashes the dirty nodes, bottom up.
+  void RehashDirtyNodes();
+
+  // Drops the deepest levels from memory until at most max_cached_nodes_
+  // are left. All the nodes must have been written back.
+  void EvictNodes();
+
+  // Returns the hash of the subtree rooted at the |index|-th node at
+  // |depth|. Only valid once the dirty nodes below |depth| have been
+  // rehashed. The DigestSize() bytes returned stay valid until the tree
+  // next changes.
+  const char* SubtreeHash(size_t depth, IndexType index);
+
+  // Computes the hash of the subtree rooted at the leaf |node| at |depth|,
+  // i.e. the hash of its value combined with the null hashes along the rest
+  // of its path, into the DigestSize() bytes at |hash|.
+  void LeafSubtreeHash(size_t depth, const TreeNode& node, char* hash) const;
 
   void DumpTree(std::ostream* os, size_t depth, IndexType index) const;
 
@@ -213,6 +390,14 @@ class SparseMerkleTree {
   const std::vector<std::string>* const null_hashes_;
   // TODO(alcutter): investigate other structures
   std::vector<std::unordered_map<IndexType, TreeNode>> tree_;
+  // dirty_[depth] holds the indices of the INTERNAL nodes at |depth|
+  // which need rehashing, i.e. those without a hash_.
+  std::vector<std::vector<IndexType>> dirty_;
+  cert_trans::SparseMerkleTreeStore* const store_;
+  const size_t max_cached_nodes_;
+  // The (depth, index) of the nodes which have not been written back to
+  // store_ yet. Always empty if there is no store.
+  std::set<std::pair<size_t, IndexType>> modified_;
   std::string root_hash_;
 };
 
@@ -240,10 +425,20 @@ inline int PathBit(const SparseMerkleTree::Path& path, size_t bit) {
 }
 
 
+// Hashes the bytes of a Path in place, a word at a time, rather than
+// those of a copy of it as a string.
 struct PathHasher {
   size_t operator()(const SparseMerkleTree::Path& p) const {
-    return std::hash<std::string>()(
-        std::string(reinterpret_cast<const char*>(p.data()), p.size()));
+    static_assert(sizeof(SparseMerkleTree::Path) % sizeof(uint64_t) == 0,
+                  "Path is not a whole number of words");
+    uint64_t hash(0);
+    for (size_t i(0); i < p.size(); i += sizeof(uint64_t)) {
+      uint64_t word;
+      memcpy(&word, p.data() + i, sizeof(word));
+      // As boost::hash_combine().
+      hash ^= word + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    }
+    return static_cast<size_t>(hash);
   }
 };
 
@@ -0,0 +1,85 @@
+#ifndef CERT_TRANS_MERKLETREE_SPARSE_MERKLE_TREE_STORE_H_
+#define CERT_TRANS_MERKLETREE_SPARSE_MERKLE_TREE_STORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+#include "util/status.h"
+
+namespace cert_trans {
+
+
+// Persistent storage for the nodes of a SparseMerkleTree, and for the
+// values of a VerifiableMap built on top of it.
+//
+// Nodes are addressed by their depth in the tree and their index at that
+// depth, i.e. the prefix of the paths below them, and are opaque to the
+// store. Values are addressed by the path of their leaf.
+//
+// Implementations must be thread-safe.
+class SparseMerkleTreeStore {
+ public:
+  // A set of nodes and values to write at once.
+  class WriteBatch {
+   public:
+    WriteBatch() = default;
+
+    void PutNode(size_t depth, uint64_t index, const std::string& node) {
+      nodes_.emplace_back(depth, index, node);
+    }
+
+    void PutValue(const std::string& path, const std::string& value) {
+      values_.emplace_back(path, value);
+    }
+
+    bool empty() const {
+      return nodes_.empty() && values_.empty();
+    }
+
+    const std::vector<std::tuple<size_t, uint64_t, std::string>>& nodes()
+        const {
+      return nodes_;
+    }
+
+    const std::vector<std::pair<std::string, std::string>>& values() const {
+      return values_;
+    }
+
+   private:
+    std::vector<std::tuple<size_t, uint64_t, std::string>> nodes_;
+    std::vector<std::pair<std::string, std::string>> values_;
+
+    DISALLOW_COPY_AND_ASSIGN(WriteBatch);
+  };
+
+  virtual ~SparseMerkleTreeStore() = default;
+
+  // Looks up the node at |depth| and |index|. Returns false if there is
+  // no such node.
+  virtual bool GetNode(size_t depth, uint64_t index,
+                       std::string* node) const = 0;
+
+  // Looks up the value of the leaf at |path|. Returns false if there is
+  // no such value.
+  virtual bool GetValue(const std::string& path, std::string* value) const = 0;
+
+  // Atomically writes all the nodes and values in |batch|, replacing any
+  // previous ones at the same addresses.
+  virtual util::Status Write(const WriteBatch& batch) = 0;
+
+ protected:
+  SparseMerkleTreeStore() = default;
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(SparseMerkleTreeStore);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MERKLETREE_SPARSE_MERKLE_TREE_STORE_H_
@@ -8,7 +8,9 @@
 #include <string>
 
 #include "merkletree/sparse_merkle_tree.h"
+#include "merkletree/sparse_merkle_verifier.h"
 #include "util/openssl_scoped_types.h"
+#include "util/status_test_util.h"
 #include "util/testing.h"
 #include "util/util.h"
 
@@ -16,7 +18,9 @@ namespace {
 
 using cert_trans::ScopedBIGNUM;
 using std::fill;
+using std::get;
 using std::lower_bound;
+using std::make_pair;
 using std::map;
 using std::mt19937;
 using std::ostringstream;
@@ -27,6 +31,7 @@ using std::string;
 using std::to_string;
 using std::unique_ptr;
 using std::vector;
+using util::testing::StatusIs;
 using util::ToBase64;
 
 
@@ -153,6 +158,71 @@ class Reference {
 };
 
 
+// A SparseMerkleTreeStore which keeps everything in memory, and counts
+// the writes.
+class MemoryStore : public cert_trans::SparseMerkleTreeStore {
+ public:
+  MemoryStore() : nodes_written_(0) {
+  }
+
+  bool GetNode(size_t depth, uint64_t index, string* node) const override {
+    const auto it(nodes_.find(make_pair(depth, index)));
+    if (it == nodes_.end()) {
+      return false;
+    }
+    *node = it->second;
+    return true;
+  }
+
+  bool GetValue(const string& path, string* value) const override {
+    return false;
+  }
+
+  util::Status Write(const WriteBatch& batch) override {
+    for (const auto& node : batch.nodes()) {
+      nodes_[make_pair(get<0>(node), get<1>(node))] = get<2>(node);
+    }
+    nodes_written_ += batch.nodes().size();
+    return util::Status::OK;
+  }
+
+  size_t nodes_written() const {
+    return nodes_written_;
+  }
+
+ private:
+  map<pair<size_t, uint64_t>, string> nodes_;
+  size_t nodes_written_;
+};
+
+
+// A Sha256Hasher which counts the digests it computes.
+class CountingHasher : public Sha256Hasher {
+ public:
+  explicit CountingHasher(size_t* count) : count_(count) {
+  }
+
+  // Final() also ends up here.
+  void Final(char* digest) override {
+    ++*count_;
+    Sha256Hasher::Final(digest);
+  }
+
+  void DigestMany(const char* data, size_t size, size_t count,
+                  char* digests) override {
+    *count_ += count;
+    Sha256Hasher::DigestMany(data, size, count, digests);
+  }
+
+  SerialHasher* Create() const override {
+    return new CountingHasher(count_);
+  }
+
+ private:
+  size_t* const count_;
+};
+
+
 class SparseMerkleTreeTest : public testing::Test {
  public:
   SparseMerkleTreeTest()
@@ -341,6 +411,208 @@ TEST_F(SparseMerkleTreeTest, TestSetLeaf) {
 }
 
 
+TEST_F(SparseMerkleTreeTest, IncrementalUpdatesMatchFreshTree) {
+  map<uint64_t, string> values;
+  vector<uint64_t> keys;
+  for (int round(0); round < 5; ++round) {
+    // Overwrite some of the existing leaves and add some new ones.
+    for (int i(0); i < 200; ++i) {
+      if (i % 2 == 0 && !keys.empty()) {
+        const uint64_t r(keys[rand_() % keys.size()]);
+        values[r] = to_string(round) + "-" + to_string(i);
+        tree_.SetLeaf(PathLow(r), values[r]);
+      } else {
+        const uint64_t r(rand_() + keys.size());
+        keys.push_back(r);
+        values[r] = to_string(r);
+        tree_.SetLeaf(PathLow(r), values[r]);
+      }
+    }
+
+    SparseMerkleTree fresh(new Sha256Hasher);
+    for (const auto& v : values) {
+      fresh.SetLeaf(PathLow(v.first), v.second);
+    }
+    EXPECT_EQ(ToBase64(fresh.CurrentRoot()), ToBase64(tree_.CurrentRoot()))
+        << "round " << round;
+  }
+}
+
+
+TEST_F(SparseMerkleTreeTest, UpdatesOnlyRehashDirtyNodes) {
+  size_t hashes(0);
+  SparseMerkleTree tree(new CountingHasher(&hashes));
+  vector<uint64_t> keys;
+  for (int i(0); i < 10000; ++i) {
+    keys.push_back(rand_() + i);
+    tree.SetLeaf(PathLow(keys.back()), to_string(keys.back()));
+  }
+  tree.CurrentRoot();
+
+  hashes = 0;
+  const int kUpdates(10);
+  for (int i(0); i < kUpdates; ++i) {
+    tree.SetLeaf(PathLow(keys[i * 997]), "updated");
+  }
+  tree.CurrentRoot();
+  // Each update hashes its leaf value, the subtree of the leaf, and the
+  // dirty nodes along its path, of which there are about log2(10000).
+  // Sibling leaves are not rehashed.
+  EXPECT_LT(hashes, kUpdates * (SparseMerkleTree::kDigestSizeBits + 32));
+}
+
+
+TEST_F(SparseMerkleTreeTest, StoreBackedTreeMatchesInMemoryTree) {
+  MemoryStore store;
+  const size_t kMaxCachedNodes(100);
+  vector<SparseMerkleTree::Path> paths;
+  {
+    SparseMerkleTree tree(new Sha256Hasher, &store, kMaxCachedNodes);
+    for (int round(0); round < 3; ++round) {
+      for (int i(0); i < 500; ++i) {
+        paths.push_back(RandomPath());
+        tree.SetLeaf(paths.back(), to_string(paths.size()));
+        tree_.SetLeaf(paths.back(), to_string(paths.size()));
+      }
+      // Overwrite some leaves which may have been evicted.
+      for (int i(0); i < 50; ++i) {
+        const SparseMerkleTree::Path& path(paths[rand_() % paths.size()]);
+        tree.SetLeaf(path, "updated " + to_string(round));
+        tree_.SetLeaf(path, "updated " + to_string(round));
+      }
+      EXPECT_OK(tree.Flush());
+      EXPECT_EQ(ToBase64(tree_.CurrentRoot()), ToBase64(tree.CurrentRoot()))
+          << "round " << round;
+    }
+  }
+
+  // A reopened tree resumes from the store.
+  const size_t nodes_written(store.nodes_written());
+  SparseMerkleTree reopened(new Sha256Hasher, &store, kMaxCachedNodes);
+  EXPECT_EQ(ToBase64(tree_.CurrentRoot()), ToBase64(reopened.CurrentRoot()));
+  reopened.SetLeaf(paths[0], "reopened");
+  tree_.SetLeaf(paths[0], "reopened");
+  EXPECT_EQ(ToBase64(tree_.CurrentRoot()), ToBase64(reopened.CurrentRoot()));
+  EXPECT_OK(reopened.Flush());
+  // Only the path to the updated leaf, about log2(1500) nodes, was
+  // rewritten.
+  EXPECT_GT(store.nodes_written(), nodes_written);
+  EXPECT_LT(store.nodes_written() - nodes_written, 32U);
+}
+
+
+TEST_F(SparseMerkleTreeTest, InclusionProof) {
+  SparseMerkleVerifier verifier(new Sha256Hasher);
+  vector<SparseMerkleTree::Path> paths;
+  for (int i(0); i < 100; ++i) {
+    paths.push_back(RandomPath());
+    tree_.SetLeaf(paths.back(), to_string(i));
+  }
+  const string root(tree_.CurrentRoot());
+
+  for (int i(0); i < 100; i += 7) {
+    const vector<string> proof(tree_.InclusionProof(paths[i]));
+    EXPECT_EQ(SparseMerkleTree::kDigestSizeBits, proof.size());
+    EXPECT_EQ(ToBase64(root),
+              ToBase64(verifier.RootFromPath(paths[i], proof, to_string(i))));
+    EXPECT_NE(root, verifier.RootFromPath(paths[i], proof, "wrong"));
+  }
+
+  // Leaves which were never set are empty.
+  const SparseMerkleTree::Path unset(RandomPath());
+  EXPECT_EQ(root, verifier.RootFromPath(unset, tree_.InclusionProof(unset),
+                                        ""));
+}
+
+
+TEST_F(SparseMerkleTreeTest, CompressedInclusionProof) {
+  SparseMerkleVerifier verifier(new Sha256Hasher);
+  vector<SparseMerkleTree::Path> paths;
+  for (int i(0); i < 1000; ++i) {
+    paths.push_back(RandomPath());
+    tree_.SetLeaf(paths.back(), to_string(i));
+  }
+  const string root(tree_.CurrentRoot());
+
+  for (int i(0); i < 1000; i += 99) {
+    const SparseMerkleTree::CompressedProof proof(
+        tree_.CompressedInclusionProof(paths[i]));
+    EXPECT_EQ(SparseMerkleTree::kDigestSizeBits / 8, proof.bitmap.size());
+    // Only about log2(1000) levels are not empty.
+    EXPECT_LT(proof.hashes.size(), 20U);
+    EXPECT_EQ(tree_.InclusionProof(paths[i]), verifier.ExpandProof(proof));
+    EXPECT_EQ(root, verifier.RootFromCompressedPath(paths[i], proof,
+                                                    to_string(i)));
+  }
+
+  SparseMerkleTree::CompressedProof bad(
+      tree_.CompressedInclusionProof(paths[0]));
+  bad.hashes.pop_back();
+  EXPECT_TRUE(verifier.ExpandProof(bad).empty());
+  EXPECT_EQ("", verifier.RootFromCompressedPath(paths[0], bad, "0"));
+}
+
+
+TEST_F(SparseMerkleTreeTest, BatchInclusionProof) {
+  SparseMerkleVerifier verifier(new Sha256Hasher);
+  vector<SparseMerkleTree::Path> paths;
+  for (int i(0); i < 1000; ++i) {
+    paths.push_back(RandomPath());
+    tree_.SetLeaf(paths.back(), to_string(i));
+  }
+  const string root(tree_.CurrentRoot());
+
+  SparseMerkleVerifier::ValueMap values;
+  vector<SparseMerkleTree::Path> proven;
+  size_t separate_hashes(0);
+  for (int i(0); i < 1000; i += 20) {
+    values[paths[i]] = to_string(i);
+    proven.push_back(paths[i]);
+  }
+  for (int i(0); i < 10; ++i) {
+    proven.push_back(RandomPath());
+    values[proven.back()] = "";
+  }
+  const vector<string>* const null_hashes(GetNullHashes(tree_hasher_));
+  for (const auto& path : proven) {
+    const vector<string> path_proof(tree_.InclusionProof(path));
+    for (size_t i(0); i < path_proof.size(); ++i) {
+      if (path_proof[i] != null_hashes->at(path_proof.size() - 1 - i)) {
+        ++separate_hashes;
+      }
+    }
+  }
+  // Duplicates are fine.
+  proven.push_back(paths[0]);
+
+  const SparseMerkleTree::BatchProof proof(tree_.BatchInclusionProof(proven));
+  EXPECT_TRUE(verifier.VerifyBatchProof(values, proof, root));
+  // Each of the 60 paths needs about log2(1000) non-null siblings, and
+  // the upper ones are shared.
+  EXPECT_LT(proof.hashes.size(), 60U * 10);
+  EXPECT_LT(proof.hashes.size(), separate_hashes);
+
+  // Wrong values, or a subset of the values, do not verify.
+  SparseMerkleVerifier::ValueMap wrong(values);
+  wrong[paths[0]] = "wrong";
+  EXPECT_FALSE(verifier.VerifyBatchProof(wrong, proof, root));
+  wrong = values;
+  wrong.erase(paths[20]);
+  EXPECT_FALSE(verifier.VerifyBatchProof(wrong, proof, root));
+
+  // Nor do truncated proofs.
+  SparseMerkleTree::BatchProof truncated(proof);
+  truncated.hashes.pop_back();
+  EXPECT_EQ("", verifier.RootFromBatchProof(values, truncated));
+}
+
+
+TEST_F(SparseMerkleTreeTest, FlushWithoutStore) {
+  tree_.SetLeaf(PathLow(1), "one");
+  EXPECT_THAT(tree_.Flush(), StatusIs(util::error::FAILED_PRECONDITION));
+}
+
+
 // TODO(alcutter): Lots and lots more tests.
 
 
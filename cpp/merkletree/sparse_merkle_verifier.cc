@@ -0,0 +1,142 @@
+#include "merkletree/sparse_merkle_verifier.h"
+
+#include <glog/logging.h>
+#include <algorithm>
+
+using std::string;
+using std::vector;
+
+
+SparseMerkleVerifier::SparseMerkleVerifier(SerialHasher* hasher)
+    : treehasher_(CHECK_NOTNULL(hasher)),
+      null_hashes_(GetNullHashes(treehasher_)) {
+}
+
+
+bool SparseMerkleVerifier::VerifyBatchProof(
+    const ValueMap& values, const SparseMerkleTree::BatchProof& proof,
+    const string& root) const {
+  const string proof_root(RootFromBatchProof(values, proof));
+  if (proof_root.empty()) {
+    return false;
+  }
+  return proof_root == root;
+}
+
+
+string SparseMerkleVerifier::RootFromBatchProof(
+    const ValueMap& values, const SparseMerkleTree::BatchProof& proof) const {
+  if (values.empty()) {
+    return string();
+  }
+  ProofCursor cursor{&proof, 0, 0};
+  const string root(SubtreeHash(-1, values.begin(), values.end(), &cursor));
+  // Leftover siblings make the proof invalid too.
+  if (cursor.next_sibling != proof.non_null.size() ||
+      cursor.next_hash != proof.hashes.size()) {
+    return string();
+  }
+  return root;
+}
+
+
+string SparseMerkleVerifier::RootFromPath(const SparseMerkleTree::Path& path,
+                                          const vector<string>& proof,
+                                          const string& data) const {
+  if (path.size() != treehasher_.DigestSize() ||
+      proof.size() != SparseMerkleTree::kDigestSizeBits) {
+    return string();
+  }
+  // The proof runs from the sibling of the leaf, at the deepest level, up
+  // to the sibling one below the root.
+  string node(treehasher_.HashLeaf(data));
+  for (size_t i(0); i < proof.size(); ++i) {
+    if (proof[i].size() != node.size()) {
+      return string();
+    }
+    const int depth(SparseMerkleTree::kDigestSizeBits - 1 - i);
+    if (PathBit(path, depth) == 0) {
+      treehasher_.HashChildren(node.data(), proof[i].data(), &node[0]);
+    } else {
+      treehasher_.HashChildren(proof[i].data(), node.data(), &node[0]);
+    }
+  }
+  return node;
+}
+
+
+vector<string> SparseMerkleVerifier::ExpandProof(
+    const SparseMerkleTree::CompressedProof& proof) const {
+  const size_t levels(SparseMerkleTree::kDigestSizeBits);
+  vector<string> expanded;
+  if (proof.bitmap.size() != levels / 8) {
+    return expanded;
+  }
+  expanded.reserve(levels);
+  size_t next_hash(0);
+  for (size_t i(0); i < levels; ++i) {
+    if ((proof.bitmap[i / 8] & (1 << (7 - i % 8))) == 0) {
+      expanded.emplace_back(null_hashes_->at(levels - 1 - i));
+    } else if (next_hash < proof.hashes.size()) {
+      expanded.emplace_back(proof.hashes[next_hash++]);
+    } else {
+      return vector<string>();
+    }
+  }
+  if (next_hash != proof.hashes.size()) {
+    return vector<string>();
+  }
+  return expanded;
+}
+
+
+string SparseMerkleVerifier::RootFromCompressedPath(
+    const SparseMerkleTree::Path& path,
+    const SparseMerkleTree::CompressedProof& proof, const string& data) const {
+  return RootFromPath(path, ExpandProof(proof), data);
+}
+
+
+string SparseMerkleVerifier::SubtreeHash(int depth,
+                                         ValueMap::const_iterator begin,
+                                         ValueMap::const_iterator end,
+                                         ProofCursor* cursor) const {
+  if (depth == SparseMerkleTree::kDigestSizeBits - 1) {
+    // Paths are unique, so there is exactly one leaf here.
+    return treehasher_.HashLeaf(begin->second);
+  }
+
+  // The leaves share their first |depth| + 1 bits, so the ones on the left
+  // come first. This must match SparseMerkleTree::AddToBatchProof().
+  const int child_depth(depth + 1);
+  const ValueMap::const_iterator middle(
+      std::find_if(begin, end, [child_depth](const ValueMap::value_type& v) {
+        return PathBit(v.first, child_depth) == 1;
+      }));
+  string children[2];
+  for (int side(0); side < 2; ++side) {
+    const ValueMap::const_iterator child_begin(side == 0 ? begin : middle);
+    const ValueMap::const_iterator child_end(side == 0 ? middle : end);
+    if (child_begin != child_end) {
+      children[side] =
+          SubtreeHash(child_depth, child_begin, child_end, cursor);
+      if (children[side].empty()) {
+        return string();
+      }
+      continue;
+    }
+
+    const SparseMerkleTree::BatchProof& proof(*cursor->proof);
+    if (cursor->next_sibling >= proof.non_null.size()) {
+      return string();
+    }
+    if (!proof.non_null[cursor->next_sibling++]) {
+      children[side] = null_hashes_->at(child_depth);
+    } else if (cursor->next_hash < proof.hashes.size()) {
+      children[side] = proof.hashes[cursor->next_hash++];
+    } else {
+      return string();
+    }
+  }
+  return treehasher_.HashChildren(children[0], children[1]);
+}
@@ -0,0 +1,82 @@
+#ifndef CERT_TRANS_MERKLETREE_SPARSE_MERKLE_VERIFIER_H_
+#define CERT_TRANS_MERKLETREE_SPARSE_MERKLE_VERIFIER_H_
+
+#include <stddef.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "merkletree/sparse_merkle_tree.h"
+#include "merkletree/tree_hasher.h"
+
+class SerialHasher;
+
+
+// Class for verifying proofs emitted by SparseMerkleTrees.
+//
+// Leaf values are given as the data passed to SparseMerkleTree::SetLeaf();
+// an empty value stands for a leaf which was never set, the two being
+// indistinguishable in the tree.
+class SparseMerkleVerifier {
+ public:
+  typedef std::map<SparseMerkleTree::Path, std::string> ValueMap;
+
+  // Takes ownership of the SerialHasher.
+  explicit SparseMerkleVerifier(SerialHasher* hasher);
+
+  // Returns true iff |proof| shows that the leaves at the paths in
+  // |values| hold those values in the tree with the given |root|.
+  bool VerifyBatchProof(const ValueMap& values,
+                        const SparseMerkleTree::BatchProof& proof,
+                        const std::string& root) const;
+
+  // Computes the root corresponding to a batch proof for |values|.
+  // Returns an empty string if the proof is malformed, e.g. if it does not
+  // have exactly as many siblings as the paths in |values| require.
+  std::string RootFromBatchProof(const ValueMap& values,
+                                 const SparseMerkleTree::BatchProof& proof)
+      const;
+
+  // Computes the root corresponding to an inclusion proof, as returned by
+  // SparseMerkleTree::InclusionProof(), for the leaf at |path| holding
+  // |data|. Returns an empty string if the proof is malformed.
+  std::string RootFromPath(const SparseMerkleTree::Path& path,
+                           const std::vector<std::string>& proof,
+                           const std::string& data) const;
+
+  // Expands a proof returned by SparseMerkleTree::CompressedInclusionProof()
+  // back into the full proof returned by SparseMerkleTree::InclusionProof().
+  // Returns an empty vector if the proof is malformed.
+  std::vector<std::string> ExpandProof(
+      const SparseMerkleTree::CompressedProof& proof) const;
+
+  // As RootFromPath(), for a compressed proof.
+  std::string RootFromCompressedPath(
+      const SparseMerkleTree::Path& path,
+      const SparseMerkleTree::CompressedProof& proof,
+      const std::string& data) const;
+
+ private:
+  // Progress through a BatchProof.
+  struct ProofCursor {
+    const SparseMerkleTree::BatchProof* proof;
+    size_t next_sibling;
+    size_t next_hash;
+  };
+
+  // Returns the hash of the node at |depth| (-1 for the root) above the
+  // sorted leaves in [|begin|, |end|), consuming the siblings it needs
+  // from |cursor|. Returns an empty string if the proof runs out.
+  std::string SubtreeHash(int depth, ValueMap::const_iterator begin,
+                          ValueMap::const_iterator end,
+                          ProofCursor* cursor) const;
+
+  TreeHasher treehasher_;
+  const std::vector<std::string>* const null_hashes_;
+
+  DISALLOW_COPY_AND_ASSIGN(SparseMerkleVerifier);
+};
+
+
+#endif  // CERT_TRANS_MERKLETREE_SPARSE_MERKLE_VERIFIER_H_
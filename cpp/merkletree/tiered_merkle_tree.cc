@@ -0,0 +1,284 @@
+#include "merkletree/tiered_merkle_tree.h"
+
+#include <assert.h>
+#include <glog/logging.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/merkle_tree_math.h"
+#include "merkletree/serial_hasher.h"
+
+using std::string;
+using std::vector;
+
+namespace cert_trans {
+
+namespace {
+
+
+// The largest power of two smaller than |n|, which must be at least 2.
+size_t Split(size_t n) {
+  assert(n >= 2);
+  size_t split(1);
+  while ((split << 1) < n)
+    split <<= 1;
+  return split;
+}
+
+
+bool IsPowerOfTwo(size_t n) {
+  return n != 0 && (n & (n - 1)) == 0;
+}
+
+
+// log2(n), for a power of two |n|.
+size_t Log2(size_t n) {
+  size_t log(0);
+  while ((static_cast<size_t>(1) << log) < n)
+    ++log;
+  return log;
+}
+
+
+}  // namespace
+
+
+TieredMerkleTree::TieredMerkleTree(NodeStore leaves, size_t tile_levels,
+                                   SerialHasher* hasher)
+    : treehasher_(hasher),
+      tile_levels_(tile_levels),
+      tile_size_(static_cast<size_t>(1) << tile_levels),
+      leaves_(std::move(leaves)) {
+  CHECK_EQ(leaves_.NodeSize(), treehasher_.DigestSize());
+  for (size_t begin = 0; begin + tile_size_ <= LeafCount();
+       begin += tile_size_) {
+    AddTileRoot(HashLeaves(begin, tile_size_));
+  }
+}
+
+
+TieredMerkleTree::~TieredMerkleTree() {
+}
+
+
+size_t TieredMerkleTree::LevelCount() const {
+  return MerkleTreeMath::LevelCount(LeafCount());
+}
+
+
+size_t TieredMerkleTree::AddLeaf(const string& data) {
+  return AddLeafHash(treehasher_.HashLeaf(data));
+}
+
+
+size_t TieredMerkleTree::AddLeafHash(const string& hash) {
+  leaves_.PushBack(hash);
+  if (LeafCount() % tile_size_ == 0)
+    AddTileRoot(HashLeaves(LeafCount() - tile_size_, tile_size_));
+  return LeafCount();
+}
+
+
+size_t TieredMerkleTree::AddLeafHashes(const vector<string>& hashes) {
+  for (const string& hash : hashes)
+    AddLeafHash(hash);
+  return LeafCount();
+}
+
+
+string TieredMerkleTree::CurrentRoot() {
+  return RootAtSnapshot(LeafCount());
+}
+
+
+string TieredMerkleTree::RootAtSnapshot(size_t snapshot) {
+  if (snapshot == 0)
+    return treehasher_.HashEmpty();
+  if (snapshot > LeafCount())
+    return string();
+  return SubtreeHash(0, snapshot);
+}
+
+
+vector<string> TieredMerkleTree::PathToCurrentRoot(size_t leaf) {
+  return PathToRootAtSnapshot(leaf, LeafCount());
+}
+
+
+vector<string> TieredMerkleTree::PathToRootAtSnapshot(size_t leaf,
+                                                      size_t snapshot) {
+  vector<string> path;
+  if (leaf > snapshot || snapshot > LeafCount() || leaf == 0)
+    return path;
+  Path(leaf - 1, 0, snapshot, nullptr, &path);
+  return path;
+}
+
+
+vector<string> TieredMerkleTree::PathToRootAtSnapshot(
+    size_t leaf, size_t snapshot, const vector<string>& frontier) {
+  vector<string> path;
+  if (leaf > snapshot || snapshot > LeafCount() || leaf == 0)
+    return path;
+  CHECK_EQ(MerkleTreeMath::LevelCount(snapshot), frontier.size());
+  Path(leaf - 1, 0, snapshot, &frontier, &path);
+  return path;
+}
+
+
+vector<string> TieredMerkleTree::SnapshotConsistency(size_t snapshot1,
+                                                     size_t snapshot2) {
+  vector<string> proof;
+  if (snapshot1 == 0 || snapshot1 >= snapshot2 || snapshot2 > LeafCount())
+    return proof;
+  SubProof(snapshot1, 0, snapshot2, true, nullptr, &proof);
+  return proof;
+}
+
+
+vector<string> TieredMerkleTree::SnapshotConsistency(
+    size_t snapshot1, size_t snapshot2, const vector<string>& frontier2) {
+  vector<string> proof;
+  if (snapshot1 == 0 || snapshot1 >= snapshot2 || snapshot2 > LeafCount())
+    return proof;
+  CHECK_EQ(MerkleTreeMath::LevelCount(snapshot2), frontier2.size());
+  SubProof(snapshot1, 0, snapshot2, true, &frontier2, &proof);
+  return proof;
+}
+
+
+vector<string> TieredMerkleTree::SnapshotFrontier(size_t snapshot) {
+  vector<string> frontier;
+  if (snapshot == 0 || snapshot > LeafCount())
+    return frontier;
+  // The last node of each level covers the leaves from the last multiple
+  // of its width up to the end of the snapshot.
+  const size_t levels(MerkleTreeMath::LevelCount(snapshot));
+  for (size_t level = 0; level < levels; ++level) {
+    const size_t begin(((snapshot - 1) >> level) << level);
+    frontier.push_back(SubtreeHash(begin, snapshot));
+  }
+  return frontier;
+}
+
+
+string TieredMerkleTree::CompleteSubtreeRoot(size_t level, size_t index) {
+  if (level >= LevelCount() || index >= (LeafCount() >> level))
+    return string();
+  return SubtreeHash(index << level, (index + 1) << level);
+}
+
+
+size_t TieredMerkleTree::UpperLevelBytes() const {
+  size_t bytes(0);
+  for (const NodeStore& level : upper_)
+    bytes += level.AllocatedBytes();
+  return bytes;
+}
+
+
+string TieredMerkleTree::SubtreeHash(size_t begin, size_t end) const {
+  assert(begin < end);
+  const size_t size(end - begin);
+  if (size == 1)
+    return leaves_.Get(begin);
+
+  if (IsPowerOfTwo(size) && begin % size == 0) {
+    if (size < tile_size_)
+      return HashLeaves(begin, size);
+    // Complete subtrees of whole tiles are all in memory.
+    const size_t level(Log2(size) - tile_levels_);
+    assert(level < upper_.size() && begin / size < upper_[level].size());
+    return upper_[level].Get(begin / size);
+  }
+
+  const size_t split(Split(size));
+  return treehasher_.HashChildren(SubtreeHash(begin, begin + split),
+                                  SubtreeHash(begin + split, end));
+}
+
+
+string TieredMerkleTree::SubtreeHash(size_t begin, size_t end,
+                                     const vector<string>* frontier) const {
+  if (!frontier)
+    return SubtreeHash(begin, end);
+  // The node is on the right border, at the lowest level that is wide
+  // enough for it.
+  const size_t level(MerkleTreeMath::LevelCount(end - begin) - 1);
+  assert(level < frontier->size());
+  return (*frontier)[level];
+}
+
+
+string TieredMerkleTree::HashLeaves(size_t begin, size_t count) const {
+  assert(IsPowerOfTwo(count));
+  const size_t digest_size(NodeSize());
+  string nodes(count * digest_size, 0);
+  for (size_t i = 0; i < count; ++i)
+    memcpy(&nodes[i * digest_size], leaves_.at(begin + i), digest_size);
+  // Each level overwrites the first half of the one below it.
+  for (; count > 1; count >>= 1)
+    treehasher_.HashChildren(nodes.data(), count / 2, &nodes[0]);
+  nodes.resize(digest_size);
+  return nodes;
+}
+
+
+void TieredMerkleTree::Path(size_t leaf, size_t begin, size_t end,
+                            const vector<string>* frontier,
+                            vector<string>* path) const {
+  if (end - begin <= 1)
+    return;
+  const size_t split(Split(end - begin));
+  // Only the right subtree ends with |end|, on the right border.
+  if (leaf < begin + split) {
+    Path(leaf, begin, begin + split, nullptr, path);
+    path->push_back(SubtreeHash(begin + split, end, frontier));
+  } else {
+    Path(leaf, begin + split, end, frontier, path);
+    path->push_back(SubtreeHash(begin, begin + split));
+  }
+}
+
+
+void TieredMerkleTree::SubProof(size_t snapshot, size_t begin, size_t end,
+                                bool complete, const vector<string>* frontier,
+                                vector<string>* proof) const {
+  const size_t size(end - begin);
+  if (snapshot == size) {
+    // Record the root of this subtree, unless it is the root for which
+    // the proof was originally requested.
+    if (!complete)
+      proof->push_back(SubtreeHash(begin, end, frontier));
+    return;
+  }
+
+  const size_t split(Split(size));
+  if (snapshot <= split) {
+    SubProof(snapshot, begin, begin + split, complete, nullptr, proof);
+    proof->push_back(SubtreeHash(begin + split, end, frontier));
+  } else {
+    SubProof(snapshot - split, begin + split, end, false, frontier, proof);
+    proof->push_back(SubtreeHash(begin, begin + split));
+  }
+}
+
+
+void TieredMerkleTree::AddTileRoot(const string& root) {
+  string node(root);
+  for (size_t level = 0;; ++level) {
+    if (upper_.size() <= level)
+      upper_.emplace_back(NodeSize());
+    upper_[level].PushBack(node);
+    // Merge complete pairs into the next level up.
+    const size_t count(upper_[level].size());
+    if (count % 2 != 0)
+      break;
+    treehasher_.HashChildren(upper_[level].at(count - 2),
+                             upper_[level].at(count - 1), &node[0]);
+  }
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,142 @@
+#ifndef CERT_TRANS_MERKLETREE_TIERED_MERKLE_TREE_H_
+#define CERT_TRANS_MERKLETREE_TIERED_MERKLE_TREE_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "merkletree/merkle_tree_interface.h"
+#include "merkletree/node_store.h"
+#include "merkletree/tree_hasher.h"
+
+class SerialHasher;
+
+namespace cert_trans {
+
+
+// A Merkle tree that only keeps its upper levels in memory.
+//
+// The leaf hashes are kept in a NodeStore, typically a file-backed one,
+// so that they are paged in from disk on demand. Above the leaves, only
+// the roots of complete subtrees of at least 2^tile_levels leaves
+// ("tiles") are kept in memory, which takes 2 / 2^tile_levels nodes per
+// leaf. The nodes of the bottom |tile_levels| levels are recomputed from
+// the leaves when they are needed, which costs at most 2^tile_levels
+// leaf reads and hashes per query.
+//
+// For example, with 8 tile levels, a tree of one billion SHA-256 leaves
+// keeps about 250MB of nodes in memory, and its 32GB of leaf hashes on
+// disk.
+//
+// This class is thread-compatible, but not thread-safe.
+class TieredMerkleTree : public AuditableMerkleTreeInterface {
+ public:
+  // |leaves| may already hold leaf hashes, in which case the upper levels
+  // are rebuilt from them. Takes ownership of |hasher|.
+  TieredMerkleTree(NodeStore leaves, size_t tile_levels,
+                   SerialHasher* hasher);
+  ~TieredMerkleTree() override;
+
+  size_t NodeSize() const override {
+    return treehasher_.DigestSize();
+  }
+
+  size_t LeafCount() const override {
+    return leaves_.size();
+  }
+
+  std::string LeafHash(size_t leaf) const override {
+    if (leaf == 0 || leaf > LeafCount())
+      return std::string();
+    return leaves_.Get(leaf - 1);
+  }
+
+  std::string LeafHash(const std::string& data) const override {
+    return treehasher_.HashLeaf(data);
+  }
+
+  size_t LevelCount() const override;
+
+  size_t AddLeaf(const std::string& data) override;
+  size_t AddLeafHash(const std::string& hash) override;
+  size_t AddLeafHashes(const std::vector<std::string>& hashes) override;
+
+  std::string CurrentRoot() override;
+
+  // The tiles are hashed as they are completed, there is nothing to
+  // evaluate in parallel.
+  void SetExecutor(util::Executor* executor) override {
+  }
+
+  // The methods below behave like their MerkleTree counterparts. Those
+  // given a frontier take the nodes of the right border of the snapshot
+  // tree from it, rather than hashing them from the tiles and leaves.
+  std::string RootAtSnapshot(size_t snapshot) override;
+  std::vector<std::string> PathToCurrentRoot(size_t leaf) override;
+  std::vector<std::string> PathToRootAtSnapshot(size_t leaf,
+                                                size_t snapshot) override;
+  std::vector<std::string> PathToRootAtSnapshot(
+      size_t leaf, size_t snapshot,
+      const std::vector<std::string>& frontier) override;
+  std::vector<std::string> SnapshotConsistency(size_t snapshot1,
+                                               size_t snapshot2) override;
+  std::vector<std::string> SnapshotConsistency(
+      size_t snapshot1, size_t snapshot2,
+      const std::vector<std::string>& frontier2) override;
+  std::vector<std::string> SnapshotFrontier(size_t snapshot) override;
+  std::string CompleteSubtreeRoot(size_t level, size_t index) override;
+
+  // Number of bytes of memory used for the nodes above the leaves.
+  size_t UpperLevelBytes() const;
+
+  // The leaf hashes, e.g. to Sync() them if they are file-backed.
+  NodeStore* mutable_leaves() {
+    return &leaves_;
+  }
+
+ private:
+  // The hash of the (possibly incomplete) subtree over the leaves
+  // [begin, end), where |begin| is a multiple of the largest power of
+  // two smaller than end - begin, as for all the subtrees of an RFC 6962
+  // tree.
+  std::string SubtreeHash(size_t begin, size_t end) const;
+  // As above, but taken from |frontier| if it is not NULL, in which case
+  // it must be the frontier of the snapshot of |end| leaves.
+  std::string SubtreeHash(size_t begin, size_t end,
+                          const std::vector<std::string>* frontier) const;
+  // The hash of the complete subtree of |count| leaves (a power of two)
+  // starting at leaf |begin|, computed from the leaves.
+  std::string HashLeaves(size_t begin, size_t count) const;
+  // Appends to |path| the audit path of |leaf| in the subtree over the
+  // leaves [begin, end). |frontier|, if not NULL, is the frontier of the
+  // snapshot of |end| leaves.
+  void Path(size_t leaf, size_t begin, size_t end,
+            const std::vector<std::string>* frontier,
+            std::vector<std::string>* path) const;
+  // Appends to |proof| the consistency proof between the first
+  // |snapshot| leaves of the subtree over the leaves [begin, end) and the
+  // whole subtree. |complete| is true if the proof is for the root that
+  // was originally requested, as in SUBPROOF() of RFC 6962. |frontier|
+  // is as for Path().
+  void SubProof(size_t snapshot, size_t begin, size_t end, bool complete,
+                const std::vector<std::string>* frontier,
+                std::vector<std::string>* proof) const;
+  // Records the root of the tile that was just completed.
+  void AddTileRoot(const std::string& root);
+
+  TreeHasher treehasher_;
+  const size_t tile_levels_;
+  const size_t tile_size_;
+  NodeStore leaves_;
+  // upper_[i] holds the roots of all the complete subtrees of
+  // 2^(tile_levels_ + i) leaves, left to right.
+  std::vector<NodeStore> upper_;
+
+  DISALLOW_COPY_AND_ASSIGN(TieredMerkleTree);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MERKLETREE_TIERED_MERKLE_TREE_H_
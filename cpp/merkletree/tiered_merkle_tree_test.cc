@@ -0,0 +1,166 @@
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+#include "merkletree/merkle_tree.h"
+#include "merkletree/node_store.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tiered_merkle_tree.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+
+const size_t kNodeSize = 32;
+const size_t kTileLevels = 3;
+
+
+class TieredMerkleTreeTest : public ::testing::Test {
+ protected:
+  TieredMerkleTreeTest()
+      : reference_(new Sha256Hasher),
+        tree_(NodeStore(kNodeSize), kTileLevels, new Sha256Hasher) {
+  }
+
+  void AddLeaves(size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+      const string data("leaf " + std::to_string(reference_.LeafCount()));
+      reference_.AddLeaf(data);
+      tree_.AddLeaf(data);
+    }
+  }
+
+  // Checks every root, path and consistency proof against the reference.
+  void ExpectSameProofs() {
+    ASSERT_EQ(reference_.LeafCount(), tree_.LeafCount());
+    EXPECT_EQ(reference_.LevelCount(), tree_.LevelCount());
+    EXPECT_EQ(reference_.CurrentRoot(), tree_.CurrentRoot());
+    const size_t size(tree_.LeafCount());
+    for (size_t snapshot = 0; snapshot <= size + 1; ++snapshot) {
+      EXPECT_EQ(reference_.RootAtSnapshot(snapshot),
+                tree_.RootAtSnapshot(snapshot));
+      for (size_t leaf = 0; leaf <= snapshot + 1; ++leaf) {
+        EXPECT_EQ(reference_.PathToRootAtSnapshot(leaf, snapshot),
+                  tree_.PathToRootAtSnapshot(leaf, snapshot))
+            << leaf << " " << snapshot;
+        EXPECT_EQ(reference_.SnapshotConsistency(leaf, snapshot),
+                  tree_.SnapshotConsistency(leaf, snapshot))
+            << leaf << " " << snapshot;
+      }
+    }
+  }
+
+  MerkleTree reference_;
+  TieredMerkleTree tree_;
+};
+
+
+TEST_F(TieredMerkleTreeTest, Empty) {
+  EXPECT_EQ(0U, tree_.LeafCount());
+  EXPECT_EQ(0U, tree_.LevelCount());
+  EXPECT_EQ(reference_.CurrentRoot(), tree_.CurrentRoot());
+  EXPECT_TRUE(tree_.PathToCurrentRoot(1).empty());
+  EXPECT_EQ(0U, tree_.UpperLevelBytes());
+}
+
+
+TEST_F(TieredMerkleTreeTest, MatchesMerkleTree) {
+  for (size_t i = 0; i < 40; ++i) {
+    AddLeaves(1);
+    ExpectSameProofs();
+  }
+  EXPECT_EQ(reference_.LeafHash(17), tree_.LeafHash(17));
+}
+
+
+TEST_F(TieredMerkleTreeTest, FrontiersAndCompleteSubtrees) {
+  AddLeaves(37);
+  for (size_t snapshot = 0; snapshot <= 38; ++snapshot) {
+    const std::vector<string> frontier(reference_.SnapshotFrontier(snapshot));
+    EXPECT_EQ(frontier, tree_.SnapshotFrontier(snapshot)) << snapshot;
+    if (frontier.empty())
+      continue;
+    for (size_t leaf = 1; leaf <= snapshot; ++leaf) {
+      EXPECT_EQ(reference_.PathToRootAtSnapshot(leaf, snapshot),
+                tree_.PathToRootAtSnapshot(leaf, snapshot, frontier))
+          << leaf << " " << snapshot;
+      EXPECT_EQ(reference_.SnapshotConsistency(leaf, snapshot),
+                tree_.SnapshotConsistency(leaf, snapshot, frontier))
+          << leaf << " " << snapshot;
+    }
+  }
+  for (size_t level = 0; level <= tree_.LevelCount(); ++level) {
+    for (size_t index = 0; index <= (37U >> level) + 1; ++index) {
+      EXPECT_EQ(reference_.CompleteSubtreeRoot(level, index),
+                tree_.CompleteSubtreeRoot(level, index))
+          << level << " " << index;
+    }
+  }
+}
+
+
+TEST_F(TieredMerkleTreeTest, AddLeafHashes) {
+  std::vector<string> hashes;
+  for (size_t i = 0; i < 100; ++i) {
+    hashes.push_back(reference_.LeafHash(std::to_string(i)));
+    reference_.AddLeafHash(hashes.back());
+  }
+  EXPECT_EQ(100U, tree_.AddLeafHashes(hashes));
+  ExpectSameProofs();
+}
+
+
+TEST_F(TieredMerkleTreeTest, OnlyUpperLevelsInMemory) {
+  AddLeaves(1024);
+  EXPECT_EQ(reference_.CurrentRoot(), tree_.CurrentRoot());
+  EXPECT_EQ(reference_.PathToCurrentRoot(1000),
+            tree_.PathToCurrentRoot(1000));
+  // 128 tiles of 8 leaves make 8 upper levels (128 nodes, 64 nodes, ...,
+  // 1 node), each of which fits in a single page.
+  EXPECT_EQ(8 * NodeStore::kDefaultNodesPerPage * kNodeSize,
+            tree_.UpperLevelBytes());
+}
+
+
+TEST_F(TieredMerkleTreeTest, FileBackedLeaves) {
+  TmpStorage tmp;
+  const string path(tmp.TmpStorageDir() + "/leaves");
+  const size_t kNodesPerPage = 1024;
+  {
+    const int fd(open(path.c_str(), O_RDWR | O_CREAT, 0600));
+    ASSERT_GE(fd, 0);
+    TieredMerkleTree tree(NodeStore(kNodeSize, kNodesPerPage, fd, 0),
+                          kTileLevels, new Sha256Hasher);
+    for (size_t i = 0; i < 30; ++i)
+      tree.AddLeaf("leaf " + std::to_string(i));
+    EXPECT_TRUE(tree.mutable_leaves()->Sync());
+  }
+
+  // Reopening the leaves rebuilds the upper levels.
+  const int fd(open(path.c_str(), O_RDWR));
+  ASSERT_GE(fd, 0);
+  TieredMerkleTree tree(NodeStore(kNodeSize, kNodesPerPage, fd, 30),
+                        kTileLevels, new Sha256Hasher);
+  AddLeaves(30);
+  EXPECT_EQ(reference_.CurrentRoot(), tree.CurrentRoot());
+  EXPECT_EQ(reference_.PathToRootAtSnapshot(3, 27),
+            tree.PathToRootAtSnapshot(3, 27));
+  EXPECT_EQ(reference_.SnapshotConsistency(9, 30),
+            tree.SnapshotConsistency(9, 30));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
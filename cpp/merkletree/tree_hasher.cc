@@ -1,6 +1,7 @@
 #include "merkletree/tree_hasher.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include "merkletree/serial_hasher.h"
 
@@ -26,19 +27,51 @@ TreeHasher::TreeHasher(SerialHasher* hasher)
 }
 
 string TreeHasher::HashLeaf(const string& data) const {
+  string digest(DigestSize(), 0);
+  HashLeaf(data.data(), data.size(), &digest[0]);
+  return digest;
+}
+
+void TreeHasher::HashLeaf(const char* data, size_t size, char* digest) const {
   lock_guard<mutex> lock(lock_);
   hasher_->Reset();
-  hasher_->Update(string(1, kLeafPrefix));
-  hasher_->Update(data);
-  return hasher_->Final();
+  hasher_->Update(&kLeafPrefix, 1);
+  hasher_->Update(data, size);
+  hasher_->Final(digest);
 }
 
 string TreeHasher::HashChildren(const string& left_child,
                                 const string& right_child) const {
   lock_guard<mutex> lock(lock_);
   hasher_->Reset();
-  hasher_->Update(string(1, kNodePrefix));
-  hasher_->Update(left_child);
-  hasher_->Update(right_child);
+  hasher_->Update(&kNodePrefix, 1);
+  hasher_->Update(left_child.data(), left_child.size());
+  hasher_->Update(right_child.data(), right_child.size());
   return hasher_->Final();
 }
+
+void TreeHasher::HashChildren(const char* left_child, const char* right_child,
+                              char* parent) const {
+  const size_t digest_size(DigestSize());
+  lock_guard<mutex> lock(lock_);
+  hasher_->Reset();
+  hasher_->Update(&kNodePrefix, 1);
+  hasher_->Update(left_child, digest_size);
+  hasher_->Update(right_child, digest_size);
+  // Only written once both children have been read.
+  hasher_->Final(parent);
+}
+
+void TreeHasher::HashChildren(const char* children, size_t count,
+                              char* parents) const {
+  const size_t digest_size(DigestSize());
+  const size_t message_size(1 + 2 * digest_size);
+  string messages(count * message_size, kNodePrefix);
+  for (size_t i = 0; i < count; ++i) {
+    memcpy(&messages[i * message_size + 1], children + 2 * i * digest_size,
+           2 * digest_size);
+  }
+
+  lock_guard<mutex> lock(lock_);
+  hasher_->DigestMany(messages.data(), message_size, count, parents);
+}
@@ -24,12 +24,38 @@ class TreeHasher {
 
   std::string HashLeaf(const std::string& data) const;
 
+  // As above, for the |size| bytes at |data|, but writes the DigestSize()
+  // byte hash to |digest| instead of allocating a string.
+  void HashLeaf(const char* data, size_t size, char* digest) const;
+
   // Accepts arbitrary strings as children. When hashing digests, it
   // is the responsibility of the caller to ensure the inputs are of
   // correct size.
   std::string HashChildren(const std::string& left_child,
                            const std::string& right_child) const;
 
+  // As above, for children of DigestSize() bytes each, but writes the
+  // DigestSize() byte parent to |parent| instead of allocating a string.
+  // |parent| may be the same buffer as either child, e.g. to hash a node
+  // up the tree in place.
+  void HashChildren(const char* left_child, const char* right_child,
+                    char* parent) const;
+
+  // Computes the parents of |count| pairs of sibling nodes in one go.
+  // |children| holds the 2 * |count| children, DigestSize() bytes each,
+  // back to back with each left child before its right sibling. The
+  // parents are written back to back to |parents|, which may be the
+  // same buffer as |children|. This is considerably cheaper than calling
+  // HashChildren() for each pair.
+  void HashChildren(const char* children, size_t count, char* parents) const;
+
+  // Returns a new instance of the underlying hash function, e.g. to build
+  // another TreeHasher for hashing in parallel. The caller gets ownership
+  // of the returned object.
+  SerialHasher* CreateSerialHasher() const {
+    return hasher_->Create();
+  }
+
  private:
   mutable std::mutex lock_;
   const std::unique_ptr<SerialHasher> hasher_;
@@ -147,6 +147,44 @@ TYPED_TEST(TreeHasherTest, TestVectors) {
   }
 }
 
+TYPED_TEST(TreeHasherTest, BatchHashChildren) {
+  const size_t digest_size(this->tree_hasher_.DigestSize());
+  string children;
+  for (int i = 0; i < 16; ++i)
+    children.append(this->tree_hasher_.HashLeaf(string(1, i)));
+
+  string parents(8 * digest_size, 0);
+  this->tree_hasher_.HashChildren(children.data(), 8, &parents[0]);
+  for (size_t i = 0; i < 8; ++i) {
+    EXPECT_EQ(H(this->tree_hasher_.HashChildren(
+                  children.substr(2 * i * digest_size, digest_size),
+                  children.substr((2 * i + 1) * digest_size, digest_size))),
+              H(parents.substr(i * digest_size, digest_size)));
+  }
+
+  // Parents may overwrite their children.
+  this->tree_hasher_.HashChildren(children.data(), 8, &children[0]);
+  EXPECT_EQ(H(parents), H(children.substr(0, 8 * digest_size)));
+}
+
+TYPED_TEST(TreeHasherTest, BufferHashes) {
+  const size_t digest_size(this->tree_hasher_.DigestSize());
+  const string data("leaf data");
+  string leaf(digest_size, 0);
+  this->tree_hasher_.HashLeaf(data.data(), data.size(), &leaf[0]);
+  EXPECT_EQ(H(this->tree_hasher_.HashLeaf(data)), H(leaf));
+
+  const string sibling(this->tree_hasher_.HashLeaf("sibling"));
+  const string expected(this->tree_hasher_.HashChildren(sibling, leaf));
+  string parent(digest_size, 0);
+  this->tree_hasher_.HashChildren(sibling.data(), leaf.data(), &parent[0]);
+  EXPECT_EQ(H(expected), H(parent));
+
+  // The parent may overwrite a child.
+  this->tree_hasher_.HashChildren(sibling.data(), leaf.data(), &leaf[0]);
+  EXPECT_EQ(H(expected), H(leaf));
+}
+
 #undef S
 #undef H
 
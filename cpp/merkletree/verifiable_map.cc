@@ -1,10 +1,19 @@
+#include <algorithm>
 #include <array>
+#include <condition_variable>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 
 #include "merkletree/verifiable_map.h"
+#include "util/thread_pool.h"
 
 
+using std::condition_variable;
+using std::lock_guard;
+using std::mutex;
 using std::string;
+using std::unique_lock;
 using std::unique_ptr;
 using std::vector;
 using util::Status;
@@ -12,32 +21,179 @@ using util::StatusOr;
 
 
 namespace cert_trans {
+namespace {
+
+
+// Enough to keep the shards busy on any machine, few enough that their
+// roots are not a noticeable cost of CurrentRoot().
+const int kMaxShardBits = 12;
+
+
+}  // namespace
+
+
+struct VerifiableMap::Shard {
+  Shard(SerialHasher* hasher, SparseMerkleTreeStore* store,
+        size_t max_cached_nodes)
+      : tree(hasher, store, max_cached_nodes) {
+  }
+
+  // Guards the other members.
+  mutex lock;
+  SparseMerkleTree tree;
+  // All the values of the shard if there is no store, otherwise the
+  // values which have not been flushed yet.
+  std::unordered_map<SparseMerkleTree::Path, string, PathHasher> values;
+};
 
 
 VerifiableMap::VerifiableMap(SerialHasher* hasher)
-    : hasher_model_(CHECK_NOTNULL(hasher)->Create()), merkle_tree_(hasher) {
+    : VerifiableMap(hasher, 0, nullptr) {
+}
+
+
+VerifiableMap::VerifiableMap(SerialHasher* hasher,
+                             SparseMerkleTreeStore* store,
+                             size_t max_cached_nodes)
+    : hasher_model_(CHECK_NOTNULL(hasher)->Create()),
+      store_(CHECK_NOTNULL(store)),
+      shard_bits_(0),
+      pool_(nullptr),
+      treehasher_(hasher_model_->Create()),
+      null_hashes_(GetNullHashes(treehasher_)) {
+  shards_.emplace_back(new Shard(hasher, store, max_cached_nodes));
+}
+
+
+VerifiableMap::VerifiableMap(SerialHasher* hasher, int shard_bits,
+                             ThreadPool* pool)
+    : hasher_model_(CHECK_NOTNULL(hasher)->Create()),
+      store_(nullptr),
+      shard_bits_(shard_bits),
+      pool_(pool),
+      treehasher_(hasher_model_->Create()),
+      null_hashes_(GetNullHashes(treehasher_)) {
+  CHECK_GE(shard_bits_, 0);
+  CHECK_LE(shard_bits_, kMaxShardBits);
+  const size_t num_shards(static_cast<size_t>(1) << shard_bits_);
+  shards_.reserve(num_shards);
+  shards_.emplace_back(new Shard(hasher, nullptr, 0));
+  while (shards_.size() < num_shards) {
+    shards_.emplace_back(new Shard(hasher_model_->Create(), nullptr, 0));
+  }
+}
+
+
+VerifiableMap::~VerifiableMap() {
+}
+
+
+string VerifiableMap::CurrentRoot() {
+  if (shard_bits_ == 0) {
+    lock_guard<mutex> lock(shards_[0]->lock);
+    return shards_[0]->tree.CurrentRoot();
+  }
+  const TopLevels top(ComputeTopLevels());
+  return treehasher_.HashChildren(top[0][0], top[0][1]);
 }
 
 
 void VerifiableMap::Set(const string& key, const string& value) {
   const SparseMerkleTree::Path path(PathFromKey(key));
-  merkle_tree_.SetLeaf(path, value);
-  values_[path] = value;
+  Shard* const shard(ShardOf(path));
+  lock_guard<mutex> lock(shard->lock);
+  shard->tree.SetLeaf(path, value);
+  shard->values[path] = value;
 }
 
 
 StatusOr<string> VerifiableMap::Get(const string& key) const {
   const SparseMerkleTree::Path path(PathFromKey(key));
-  const auto it(values_.find(path));
-  if (it == values_.end()) {
-    return Status(util::error::NOT_FOUND, "No such entry.");
+  Shard* const shard(ShardOf(path));
+  {
+    lock_guard<mutex> lock(shard->lock);
+    const auto it(shard->values.find(path));
+    if (it != shard->values.end()) {
+      return it->second;
+    }
   }
-  return it->second;
+  string value;
+  if (store_ != nullptr &&
+      store_->GetValue(string(path.begin(), path.end()), &value)) {
+    return value;
+  }
+  return Status(util::error::NOT_FOUND, "No such entry.");
 }
 
 
 vector<string> VerifiableMap::InclusionProof(const string& key) {
-  return merkle_tree_.InclusionProof(PathFromKey(key));
+  const SparseMerkleTree::Path path(PathFromKey(key));
+  // Computed first, as it takes the locks of all the shards in turn.
+  const TopLevels top(shard_bits_ > 0 ? ComputeTopLevels() : TopLevels());
+  Shard* const shard(ShardOf(path));
+  vector<string> proof;
+  {
+    lock_guard<mutex> lock(shard->lock);
+    proof = shard->tree.InclusionProof(path);
+  }
+
+  // The shard knows nothing of the other shards, so its siblings in the
+  // top levels are those of empty subtrees. proof[i] is the sibling at
+  // depth kDigestSizeBits - 1 - i.
+  size_t index(0);
+  for (int depth(0); depth < shard_bits_; ++depth) {
+    index = (index << 1) + PathBit(path, depth);
+    proof[proof.size() - 1 - depth] = top[depth][index ^ 1];
+  }
+  return proof;
+}
+
+
+SparseMerkleTree::CompressedProof VerifiableMap::CompressedInclusionProof(
+    const string& key) {
+  const vector<string> proof(InclusionProof(key));
+  // Compressing the proof only needs the null hashes, which all the trees
+  // have.
+  return shards_[0]->tree.CompressProof(proof);
+}
+
+
+SparseMerkleTree::BatchProof VerifiableMap::BatchInclusionProof(
+    const vector<string>& keys) {
+  vector<SparseMerkleTree::Path> paths;
+  paths.reserve(keys.size());
+  for (const string& key : keys) {
+    paths.emplace_back(PathFromKey(key));
+  }
+  if (shard_bits_ == 0) {
+    lock_guard<mutex> lock(shards_[0]->lock);
+    return shards_[0]->tree.BatchInclusionProof(paths);
+  }
+
+  std::sort(paths.begin(), paths.end());
+  paths.erase(std::unique(paths.begin(), paths.end()), paths.end());
+  SparseMerkleTree::BatchProof proof;
+  if (!paths.empty()) {
+    AddToBatchProof(0, 0, ComputeTopLevels(), paths.begin(), paths.end(),
+                    &proof);
+  }
+  return proof;
+}
+
+
+Status VerifiableMap::Flush() {
+  Shard* const shard(shards_[0].get());
+  lock_guard<mutex> lock(shard->lock);
+  SparseMerkleTreeStore::WriteBatch batch;
+  for (const auto& value : shard->values) {
+    batch.PutValue(string(value.first.begin(), value.first.end()),
+                   value.second);
+  }
+  const Status status(shard->tree.Flush(&batch));
+  if (status.ok()) {
+    shard->values.clear();
+  }
+  return status;
 }
 
 
@@ -47,4 +203,106 @@ SparseMerkleTree::Path VerifiableMap::PathFromKey(const string& key) const {
   return PathFromBytes(h->Final());
 }
 
+
+VerifiableMap::Shard* VerifiableMap::ShardOf(
+    const SparseMerkleTree::Path& path) const {
+  size_t index(0);
+  for (int depth(0); depth < shard_bits_; ++depth) {
+    index = (index << 1) + PathBit(path, depth);
+  }
+  return shards_[index].get();
+}
+
+
+SparseMerkleTree::Path VerifiableMap::ShardPath(size_t index) const {
+  SparseMerkleTree::Path path;
+  path.fill(0);
+  for (int depth(0); depth < shard_bits_; ++depth) {
+    if ((index >> (shard_bits_ - 1 - depth)) & 1) {
+      path[depth / 8] |= 1 << (7 - depth % 8);
+    }
+  }
+  return path;
+}
+
+
+VerifiableMap::TopLevels VerifiableMap::ComputeTopLevels() {
+  CHECK_GT(shard_bits_, 0);
+  TopLevels top(shard_bits_);
+  vector<string>* const roots(&top.back());
+  roots->resize(shards_.size());
+  const auto shard_root([this, roots](size_t index) {
+    Shard* const shard(shards_[index].get());
+    lock_guard<mutex> lock(shard->lock);
+    (*roots)[index] =
+        shard->tree.SubtreeRoot(shard_bits_ - 1, ShardPath(index));
+  });
+
+  if (pool_ == nullptr) {
+    for (size_t i(0); i < shards_.size(); ++i) {
+      shard_root(i);
+    }
+  } else {
+    mutex done_lock;
+    condition_variable done_cv;
+    size_t pending(shards_.size());
+    for (size_t i(0); i < shards_.size(); ++i) {
+      pool_->Add([&, i]() {
+        shard_root(i);
+        lock_guard<mutex> lock(done_lock);
+        if (--pending == 0) {
+          done_cv.notify_all();
+        }
+      });
+    }
+    unique_lock<mutex> lock(done_lock);
+    done_cv.wait(lock, [&pending]() { return pending == 0; });
+  }
+
+  for (int depth(shard_bits_ - 2); depth >= 0; --depth) {
+    const vector<string>& children(top[depth + 1]);
+    top[depth].reserve(children.size() / 2);
+    for (size_t i(0); i < children.size(); i += 2) {
+      top[depth].emplace_back(
+          treehasher_.HashChildren(children[i], children[i + 1]));
+    }
+  }
+  return top;
+}
+
+
+void VerifiableMap::AddToBatchProof(int depth, size_t index,
+                                    const TopLevels& top, PathIterator begin,
+                                    PathIterator end,
+                                    SparseMerkleTree::BatchProof* proof) {
+  // The paths share their first |depth| bits, so the ones going left come
+  // first.
+  const PathIterator middle(std::partition_point(
+      begin, end, [depth](const SparseMerkleTree::Path& path) {
+        return PathBit(path, depth) == 0;
+      }));
+  for (int side(0); side < 2; ++side) {
+    const size_t child((index << 1) + side);
+    const PathIterator child_begin(side == 0 ? begin : middle);
+    const PathIterator child_end(side == 0 ? middle : end);
+    if (child_begin == child_end) {
+      const string& hash(top[depth][child]);
+      const bool non_null(hash != null_hashes_->at(depth));
+      proof->non_null.push_back(non_null);
+      if (non_null) {
+        proof->hashes.emplace_back(hash);
+      }
+    } else if (depth + 1 < shard_bits_) {
+      AddToBatchProof(depth + 1, child, top, child_begin, child_end, proof);
+    } else {
+      Shard* const shard(shards_[child].get());
+      lock_guard<mutex> lock(shard->lock);
+      shard->tree.AddToBatchInclusionProof(
+          depth, vector<SparseMerkleTree::Path>(child_begin, child_end),
+          proof);
+    }
+  }
+}
+
+
 }  // namespace cert_trans
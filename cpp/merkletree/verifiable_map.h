@@ -1,25 +1,55 @@
 #ifndef CERT_TRANS_MERKLETREE_VERIFIABLE_MAP_H_
 #define CERT_TRANS_MERKLETREE_VERIFIABLE_MAP_H_
 
+#include <memory>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
 #include "base/macros.h"
 #include "merkletree/sparse_merkle_tree.h"
+#include "merkletree/sparse_merkle_tree_store.h"
+#include "merkletree/tree_hasher.h"
 #include "util/statusor.h"
 
 namespace cert_trans {
 
+class ThreadPool;
+
 
 // Implements a Verifiable Map using a SparseMerkleTree and hashmap.
+//
+// The map can optionally be kept in a SparseMerkleTreeStore, in which case
+// the hashmap only holds the values set since the last Flush(), and the
+// map can grow larger than memory.
+//
+// The map can also be split into 2^shard_bits shards by the first
+// |shard_bits| bits of the paths of the keys, each with a tree and lock of
+// its own, so that keys of different shards can be set concurrently and
+// the roots of the shards computed in parallel. The top |shard_bits|
+// levels of the tree are then only computed when needed, from the roots
+// of the shards, and the roots and proofs are the same as those of a map
+// with a single tree.
+//
+// This class is thread-safe, but the roots and proofs only reflect a
+// consistent state of the map if no Set() runs concurrently with them.
 class VerifiableMap {
  public:
   VerifiableMap(SerialHasher* hasher);
 
-  std::string CurrentRoot() {
-    return merkle_tree_.CurrentRoot();
-  }
+  // As above, but with the values and tree nodes kept in |store|, which
+  // must outlive the map. See SparseMerkleTree for |max_cached_nodes|.
+  VerifiableMap(SerialHasher* hasher, SparseMerkleTreeStore* store,
+                size_t max_cached_nodes);
+
+  // As the first constructor, but with 2^|shard_bits| shards, whose roots
+  // CurrentRoot() computes on |pool|, if not NULL, and otherwise in turn.
+  // |pool| must outlive the map, and CurrentRoot() must not be called
+  // from its threads.
+  VerifiableMap(SerialHasher* hasher, int shard_bits, ThreadPool* pool);
+
+  ~VerifiableMap();
+
+  std::string CurrentRoot();
 
   void Set(const std::string& key, const std::string& value);
 
@@ -27,14 +57,50 @@ class VerifiableMap {
 
   std::vector<std::string> InclusionProof(const std::string& key);
 
+  SparseMerkleTree::CompressedProof CompressedInclusionProof(
+      const std::string& key);
+
+  // Returns a proof of the values of all the |keys| at once, which is
+  // much smaller than their separate inclusion proofs. See
+  // SparseMerkleTree::BatchProof.
+  SparseMerkleTree::BatchProof BatchInclusionProof(
+      const std::vector<std::string>& keys);
+
+  // Atomically writes the values and tree nodes changed since the last
+  // call to the store. Returns FAILED_PRECONDITION if there is no store.
+  util::Status Flush();
+
  private:
+  struct Shard;
+  // The hashes of the top |shard_bits_| levels of the tree, those of the
+  // 2^(d + 1) nodes at depth d in the d-th entry, the last of which holds
+  // the roots of the shards.
+  typedef std::vector<std::vector<std::string>> TopLevels;
+  typedef std::vector<SparseMerkleTree::Path>::const_iterator PathIterator;
+
   SparseMerkleTree::Path PathFromKey(const std::string& key) const;
 
-  std::unique_ptr<SerialHasher> hasher_model_;
-  SparseMerkleTree merkle_tree_;
+  // The shard holding |path|, and the path of the root of shard |index|.
+  Shard* ShardOf(const SparseMerkleTree::Path& path) const;
+  SparseMerkleTree::Path ShardPath(size_t index) const;
 
-  // TODO(alcutter): allow arbitrary stores here.
-  std::unordered_map<SparseMerkleTree::Path, std::string, PathHasher> values_;
+  TopLevels ComputeTopLevels();
+
+  // Adds to |proof| the siblings needed for the sorted paths in
+  // [|begin|, |end|), all of which go through the node at |depth| - 1
+  // with |index|, as SparseMerkleTree::BatchInclusionProof() would.
+  void AddToBatchProof(int depth, size_t index, const TopLevels& top,
+                       PathIterator begin, PathIterator end,
+                       SparseMerkleTree::BatchProof* proof);
+
+  std::unique_ptr<SerialHasher> hasher_model_;
+  SparseMerkleTreeStore* const store_;
+  const int shard_bits_;
+  ThreadPool* const pool_;
+  // Combines the roots of the shards.
+  TreeHasher treehasher_;
+  const std::vector<std::string>* const null_hashes_;
+  std::vector<std::unique_ptr<Shard>> shards_;
 
   DISALLOW_COPY_AND_ASSIGN(VerifiableMap);
 };
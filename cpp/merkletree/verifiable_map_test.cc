@@ -1,10 +1,15 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <string>
+#include <thread>
 
+#include "merkletree/leveldb_sparse_merkle_tree_store.h"
+#include "merkletree/sparse_merkle_verifier.h"
 #include "merkletree/verifiable_map.h"
 #include "util/status_test_util.h"
+#include "util/test_db.h"
 #include "util/testing.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 
 
@@ -13,7 +18,9 @@ namespace {
 
 using std::array;
 using std::string;
+using std::thread;
 using std::unique_ptr;
+using std::vector;
 using util::StatusOr;
 using util::testing::StatusIs;
 using util::ToBase64;
@@ -47,6 +54,121 @@ TEST_F(VerifiableMapTest, TestSetGet) {
 }
 
 
+TEST_F(VerifiableMapTest, TestBatchInclusionProof) {
+  SparseMerkleVerifier::ValueMap values;
+  vector<string> keys;
+  for (int i = 0; i < 20; ++i) {
+    keys.push_back("key" + std::to_string(i));
+    map_.Set(keys.back(), "value" + std::to_string(i));
+    values[PathFromBytes(Sha256Hasher::Sha256Digest(keys.back()))] =
+        "value" + std::to_string(i);
+  }
+  keys.push_back("unset");
+  values[PathFromBytes(Sha256Hasher::Sha256Digest("unset"))] = "";
+
+  SparseMerkleVerifier verifier(new Sha256Hasher);
+  EXPECT_TRUE(verifier.VerifyBatchProof(values,
+                                        map_.BatchInclusionProof(keys),
+                                        map_.CurrentRoot()));
+}
+
+
+TEST_F(VerifiableMapTest, TestFlushWithoutStore) {
+  map_.Set("key", "value");
+  EXPECT_THAT(map_.Flush(), StatusIs(util::error::FAILED_PRECONDITION));
+  EXPECT_EQ("value", map_.Get("key").ValueOrDie());
+}
+
+
+TEST_F(VerifiableMapTest, TestReopenStore) {
+  TmpStorage tmp;
+  const string dbfile(tmp.TmpStorageDir() + "/map");
+  string root;
+  {
+    LevelDBSparseMerkleTreeStore store(dbfile);
+    VerifiableMap map(new Sha256Hasher, &store, 10);
+    for (int i = 0; i < 100; ++i) {
+      map.Set("key" + std::to_string(i), "value" + std::to_string(i));
+      map_.Set("key" + std::to_string(i), "value" + std::to_string(i));
+    }
+    EXPECT_OK(map.Flush());
+    EXPECT_EQ("value7", map.Get("key7").ValueOrDie());
+    root = map.CurrentRoot();
+    EXPECT_EQ(map_.CurrentRoot(), root);
+
+    // Not flushed, so lost when the map is reopened.
+    map.Set("key0", "unflushed");
+    EXPECT_EQ("unflushed", map.Get("key0").ValueOrDie());
+  }
+
+  LevelDBSparseMerkleTreeStore store(dbfile);
+  VerifiableMap map(new Sha256Hasher, &store, 10);
+  EXPECT_EQ(root, map.CurrentRoot());
+  EXPECT_EQ("value0", map.Get("key0").ValueOrDie());
+  EXPECT_THAT(map.Get("key100").status(), StatusIs(util::error::NOT_FOUND));
+
+  map.Set("key100", "value100");
+  map_.Set("key100", "value100");
+  EXPECT_EQ(map_.CurrentRoot(), map.CurrentRoot());
+}
+
+
+TEST_F(VerifiableMapTest, TestShardedMatchesSingleTree) {
+  ThreadPool pool(4);
+  VerifiableMap sharded(new Sha256Hasher, 3, &pool);
+  EXPECT_EQ(map_.CurrentRoot(), sharded.CurrentRoot());
+
+  // A single key, then enough for all the shards to have some.
+  vector<string> keys{"key0"};
+  for (int round = 0; round < 2; ++round) {
+    for (const string& key : keys) {
+      map_.Set(key, "value of " + key);
+      sharded.Set(key, "value of " + key);
+    }
+    EXPECT_EQ(map_.CurrentRoot(), sharded.CurrentRoot());
+    keys.push_back("unset");
+    for (const string& key : keys) {
+      EXPECT_EQ(map_.InclusionProof(key), sharded.InclusionProof(key)) << key;
+      const SparseMerkleTree::CompressedProof compressed(
+          sharded.CompressedInclusionProof(key));
+      EXPECT_EQ(map_.CompressedInclusionProof(key).bitmap, compressed.bitmap);
+      EXPECT_EQ(map_.CompressedInclusionProof(key).hashes, compressed.hashes);
+    }
+    const SparseMerkleTree::BatchProof batch(sharded.BatchInclusionProof(keys));
+    EXPECT_EQ(map_.BatchInclusionProof(keys).non_null, batch.non_null);
+    EXPECT_EQ(map_.BatchInclusionProof(keys).hashes, batch.hashes);
+
+    keys.clear();
+    for (int i = 1; i < 100; ++i) {
+      keys.push_back("key" + std::to_string(i));
+    }
+  }
+  EXPECT_EQ("value of key7", sharded.Get("key7").ValueOrDie());
+  EXPECT_THAT(sharded.Get("unset").status(),
+              StatusIs(util::error::NOT_FOUND));
+}
+
+
+TEST_F(VerifiableMapTest, TestShardedConcurrentSets) {
+  VerifiableMap sharded(new Sha256Hasher, 2, nullptr);
+  vector<thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&sharded, t]() {
+      for (int i = t; i < 200; i += 4) {
+        sharded.Set("key" + std::to_string(i), "value" + std::to_string(i));
+      }
+    });
+  }
+  for (int i = 0; i < 200; ++i) {
+    map_.Set("key" + std::to_string(i), "value" + std::to_string(i));
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+  EXPECT_EQ(map_.CurrentRoot(), sharded.CurrentRoot());
+}
+
+
 // TODO(alcutter): Lots and lots more tests.
 
 
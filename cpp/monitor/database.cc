@@ -1,26 +1,81 @@
 #include "monitor/database.h"
 
+#include <utility>
+
 #include "merkletree/tree_hasher.h"
 #include "proto/serializer.h"
 
 namespace monitor {
 
+namespace {
+
+// What CreateEntry_() writes of an entry.
+struct Row {
+  std::string leaf;
+  std::string leaf_hash;
+  std::string cert;
+  std::string cert_chain;
+};
+
+// The preprocessing of an entry, independent from the database
+// implementation.
+bool SerializeEntry(const TreeHasher& hasher,
+                    const cert_trans::LoggedEntry& logged, Row* row) {
+  if (!logged.SerializeForLeaf(&row->leaf))
+    return false;
+
+  row->leaf_hash = hasher.HashLeaf(row->leaf);
+  row->cert = Serializer::LeafData(logged.entry());
+
+  return logged.SerializeExtraData(&row->cert_chain);
+}
+
+
+}  // namespace
+
 Database::WriteResult Database::CreateEntry(
     const cert_trans::LoggedEntry& logged) {
-  std::string leaf;
-  if (!logged.SerializeForLeaf(&leaf))
-    return this->SERIALIZE_FAILED;
+  std::string leaf_hash;
+  return CreateEntry(logged, &leaf_hash);
+}
 
+Database::WriteResult Database::CreateEntry(
+    const cert_trans::LoggedEntry& logged, std::string* leaf_hash) {
   TreeHasher hasher(new Sha256Hasher);
-  std::string leaf_hash = hasher.HashLeaf(leaf);
+  Row row;
+  if (!SerializeEntry(hasher, logged, &row))
+    return this->SERIALIZE_FAILED;
+  *leaf_hash = row.leaf_hash;
 
-  std::string cert = Serializer::LeafData(logged.entry());
+  return CreateEntry_(row.leaf, row.leaf_hash, row.cert, row.cert_chain);
+}
 
-  std::string cert_chain;
-  if (!logged.SerializeExtraData(&cert_chain))
-    return this->SERIALIZE_FAILED;
+Database::WriteResult Database::CreateEntries(
+    const std::vector<cert_trans::LoggedEntry>& entries,
+    std::vector<std::string>* leaf_hashes) {
+  // Nothing is written unless all of them can be.
+  TreeHasher hasher(new Sha256Hasher);
+  std::vector<Row> rows(entries.size());
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (!SerializeEntry(hasher, entries[i], &rows[i]))
+      return this->SERIALIZE_FAILED;
+  }
+
+  BeginBatch();
+  for (const Row& row : rows) {
+    const WriteResult ret(
+        CreateEntry_(row.leaf, row.leaf_hash, row.cert, row.cert_chain));
+    if (ret != this->WRITE_OK) {
+      EndBatch(false);
+      return ret;
+    }
+  }
+  EndBatch(true);
 
-  return CreateEntry_(leaf, leaf_hash, cert, cert_chain);
+  leaf_hashes->clear();
+  for (Row& row : rows)
+    leaf_hashes->emplace_back(std::move(row.leaf_hash));
+  return this->WRITE_OK;
 }
 
 Database::WriteResult Database::WriteSTH(const ct::SignedTreeHead& sth) {
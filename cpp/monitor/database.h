@@ -3,6 +3,9 @@
 
 #include <glog/logging.h>
 #include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/logged_entry.h"
@@ -73,6 +76,15 @@ class Database {
   // GetEntries().  The latter two contain all information from the
   // RFC compliant get-entries response from the log server.
   WriteResult CreateEntry(const cert_trans::LoggedEntry& logged);
+  // The same, also setting |*leaf_hash| to the Merkle leaf hash of the
+  // entry if it is written.
+  WriteResult CreateEntry(const cert_trans::LoggedEntry& logged,
+                          std::string* leaf_hash);
+  // Creates |entries| in order, all of them or none, in one transaction
+  // (or savepoint, inside that of BeginTransaction()), and sets
+  // |*leaf_hashes| to their Merkle leaf hashes if they are written.
+  WriteResult CreateEntries(const std::vector<cert_trans::LoggedEntry>& entries,
+                            std::vector<std::string>* leaf_hashes);
 
   virtual WriteResult WriteSTH(const ct::SignedTreeHead& sth);
 
@@ -83,6 +95,12 @@ class Database {
   virtual LookupResult LookupHashByIndex(int64_t sequence_number,
                                          std::string* result) const = 0;
 
+  // Sets |*result| to the hashes of the entries from |first| to |last|
+  // (inclusive) that there are, in order, with one lookup rather than
+  // one for each.
+  virtual LookupResult LookupHashesByIndex(
+      int64_t first, int64_t last, std::vector<std::string>* result) const = 0;
+
   virtual WriteResult SetVerificationLevel(const ct::SignedTreeHead& sth,
                                            VerificationLevel verify_level);
 
@@ -92,7 +110,37 @@ class Database {
   virtual LookupResult LookupVerificationLevel(
       const ct::SignedTreeHead& sth, VerificationLevel* result) const = 0;
 
+  // The state of the tree of the first |tree_size| entries, as the
+  // CompactMerkleTree::SubtreeRoots() of it, which replaces any state
+  // written before.
+  virtual WriteResult WriteTreeState(
+      int64_t tree_size, const std::vector<std::string>& subtree_roots) = 0;
+
+  virtual LookupResult LookupTreeState(
+      int64_t* tree_size, std::vector<std::string>* subtree_roots) const = 0;
+
+  // Indexes the entry |sequence_number| under each of |reversed_names|,
+  // the DNS names of its certificate after cert_trans::ReverseDnsName().
+  virtual WriteResult WriteNames(
+      int64_t sequence_number,
+      const std::vector<std::string>& reversed_names) = 0;
+
+  // Sets |*result| to the indexed names which start with |prefix|, each
+  // with the sequence number of an entry indexed under it, in order.
+  virtual LookupResult LookupNamesByPrefix(
+      const std::string& prefix,
+      std::vector<std::pair<std::string, int64_t>>* result) const = 0;
+
  private:
+  // Called by CreateEntries() before and after creating the entries,
+  // with |commit| false to undo them if one of them failed.
+  virtual void BeginBatch() {
+  }
+
+  virtual void EndBatch(bool commit) {
+    LOG_IF(FATAL, !commit) << "Batches cannot be undone";
+  }
+
   virtual WriteResult CreateEntry_(const std::string& leaf,
                                    const std::string& leaf_hash,
                                    const std::string& cert,
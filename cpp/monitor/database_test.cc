@@ -1,7 +1,9 @@
 #include "monitor/database.h"
 
 #include <gtest/gtest.h>
+#include <memory>
 #include <set>
+#include <vector>
 
 #include "log/test_signer.h"
 #include "monitor/test_db.h"
@@ -108,6 +110,56 @@ TYPED_TEST(DBTest, WriteEntryAndLookupHash) {
   EXPECT_EQ(leaf_hash, res);
 }
 
+TYPED_TEST(DBTest, WriteEntriesAndLookupHashes) {
+  std::vector<LoggedEntry> entries(3);
+  for (LoggedEntry& logged : entries) {
+    this->test_signer_.CreateUnique(&logged);
+  }
+
+  std::vector<string> leaf_hashes;
+  EXPECT_EQ(DB::WRITE_OK, this->db()->CreateEntries(entries, &leaf_hashes));
+  ASSERT_EQ(3U, leaf_hashes.size());
+  string res;
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupHashByIndex(3, &res));
+  EXPECT_EQ(leaf_hashes[2], res);
+
+  // Also inside a transaction.
+  this->db()->BeginTransaction();
+  std::vector<string> more_hashes;
+  EXPECT_EQ(DB::WRITE_OK, this->db()->CreateEntries(entries, &more_hashes));
+  this->db()->EndTransaction();
+  EXPECT_EQ(leaf_hashes, more_hashes);
+
+  std::vector<string> hashes;
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupHashesByIndex(1, 3, &hashes));
+  EXPECT_EQ(leaf_hashes, hashes);
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupHashesByIndex(5, 10, &hashes));
+  EXPECT_EQ(std::vector<string>({leaf_hashes[1], leaf_hashes[2]}), hashes);
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupHashesByIndex(7, 10, &hashes));
+  EXPECT_TRUE(hashes.empty());
+}
+
+TYPED_TEST(DBTest, WriteAndLookupNames) {
+  std::vector<std::pair<string, int64_t>> found;
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupNamesByPrefix("com.", &found));
+
+  EXPECT_EQ(DB::WRITE_OK,
+            this->db()->WriteNames(1, {"com.example", "com.example.www"}));
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteNames(2, {"com.example.mail"}));
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteNames(3, {"org.example"}));
+  // Writing the names of an entry again is harmless.
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteNames(2, {"com.example.mail"}));
+
+  EXPECT_EQ(DB::LOOKUP_OK,
+            this->db()->LookupNamesByPrefix("com.example", &found));
+  const std::vector<std::pair<string, int64_t>> expected{
+      {"com.example", 1}, {"com.example.mail", 2}, {"com.example.www", 1}};
+  EXPECT_EQ(expected, found);
+
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupNamesByPrefix("net.", &found));
+  EXPECT_TRUE(found.empty());
+}
+
 TYPED_TEST(DBTest, ModifyVerificationLevels) {
   SignedTreeHead sth;
   this->test_signer_.CreateUnique(&sth);
@@ -141,6 +193,68 @@ TYPED_TEST(DBTest, DenyUndefinedVerificationLevel) {
             this->db()->SetVerificationLevel(sth, DB::UNDEFINED));
 }
 
+TYPED_TEST(DBTest, WriteAndLookupTreeState) {
+  int64_t tree_size;
+  std::vector<string> roots;
+  EXPECT_EQ(DB::NOT_FOUND, this->db()->LookupTreeState(&tree_size, &roots));
+
+  // 5 leaves: a subtree of 4 and one of 1.
+  const std::vector<string> roots5{string(32, 'a'), string(32, 'b')};
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteTreeState(5, roots5));
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupTreeState(&tree_size, &roots));
+  EXPECT_EQ(5, tree_size);
+  EXPECT_EQ(roots5, roots);
+
+  // Replaces the previous state, and is still there when reopening.
+  const std::vector<string> roots7{string(32, 'c'), string(32, 'd'),
+                                   string(32, 'e')};
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteTreeState(7, roots7));
+  std::unique_ptr<TypeParam> second(this->test_db_.SecondDB());
+  EXPECT_EQ(DB::LOOKUP_OK, second->LookupTreeState(&tree_size, &roots));
+  EXPECT_EQ(7, tree_size);
+  EXPECT_EQ(roots7, roots);
+
+  EXPECT_EQ(DB::WRITE_OK, this->db()->WriteTreeState(0, {}));
+  EXPECT_EQ(DB::LOOKUP_OK, this->db()->LookupTreeState(&tree_size, &roots));
+  EXPECT_EQ(0, tree_size);
+  EXPECT_TRUE(roots.empty());
+}
+
+TEST(SQLiteDBTest, LogsSharingTheFileKeepTheirOwnState) {
+  TmpStorage tmp;
+  const string dbfile(tmp.TmpStorageDir() + "/sqlite");
+  TestSigner test_signer;
+  SignedTreeHead sth, sth2, lookup_sth;
+  test_signer.CreateUnique(&sth);
+  test_signer.CreateUnique(&sth2);
+  LoggedEntry logged;
+  test_signer.CreateUnique(&logged);
+
+  monitor::SQLiteDB single(dbfile);
+  monitor::SQLiteDB one(dbfile, "one");
+  monitor::SQLiteDB two(dbfile, "two");
+  EXPECT_EQ(DB::WRITE_OK, one.WriteSTH(sth));
+  EXPECT_EQ(DB::WRITE_OK, one.CreateEntry(logged));
+  // The same timestamp is not a duplicate in another log.
+  sth2.set_timestamp(sth.timestamp());
+  EXPECT_EQ(DB::WRITE_OK, two.WriteSTH(sth2));
+
+  EXPECT_EQ(DB::LOOKUP_OK, one.LookupLatestWrittenSTH(&lookup_sth));
+  TestSigner::TestEqualTreeHeads(sth, lookup_sth);
+  EXPECT_EQ(DB::LOOKUP_OK, two.LookupLatestWrittenSTH(&lookup_sth));
+  TestSigner::TestEqualTreeHeads(sth2, lookup_sth);
+  EXPECT_EQ(DB::NOT_FOUND, single.LookupLatestWrittenSTH(&lookup_sth));
+
+  string hash;
+  EXPECT_EQ(DB::LOOKUP_OK, one.LookupHashByIndex(1, &hash));
+  EXPECT_EQ(DB::NOT_FOUND, two.LookupHashByIndex(1, &hash));
+
+  // And it is all still there when reopening.
+  monitor::SQLiteDB reopened(dbfile, "two");
+  EXPECT_EQ(DB::LOOKUP_OK, reopened.LookupLatestWrittenSTH(&lookup_sth));
+  TestSigner::TestEqualTreeHeads(sth2, lookup_sth);
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -1,13 +1,45 @@
 #include "monitor/monitor.h"
 
+#include <ctype.h>
+#include <gflags/gflags.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+
 #include "client/http_log_client.h"
+#include "log/cert_names.h"
 #include "log/log_verifier.h"
-#include "merkletree/merkle_tree.h"
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
 #include "monitor/database.h"
 
 using cert_trans::AsyncLogClient;
 using cert_trans::HTTPLogClient;
+using cert_trans::ReverseDnsName;
+using std::pair;
 using std::string;
+using std::vector;
+
+DEFINE_int32(monitor_concurrent_fetches, 4,
+             "number of get-entries requests that the monitor keeps in "
+             "flight");
+DEFINE_int32(monitor_entries_per_transaction, 10000,
+             "number of entries that the monitor writes to its database in "
+             "each transaction");
+DEFINE_bool(monitor_index_names, false,
+            "whether the monitor indexes the entries it gets by the DNS "
+            "names of their certificates, for the find_names action. Only "
+            "the entries added to the database meanwhile are indexed.");
+
+namespace {
+
+// The number of leaf hashes that the trees are built from with each
+// lookup in the database.
+const int64_t kHashesPerLookup = 10000;
+
+
+}  // namespace
 
 namespace monitor {
 
@@ -16,7 +48,11 @@ Monitor::Monitor(Database* database, LogVerifier* log_verifier,
     : db_(CHECK_NOTNULL(database)),
       verifier_(CHECK_NOTNULL(log_verifier)),
       client_(CHECK_NOTNULL(client)),
-      sleep_time_(sleep_time_sec) {
+      sleep_time_(sleep_time_sec),
+      tree_(new CompactMerkleTree(new Sha256Hasher)) {
+}
+
+Monitor::~Monitor() {
 }
 
 Monitor::GetResult Monitor::GetSTH() {
@@ -147,38 +183,54 @@ Monitor::VerifyResult Monitor::VerifySTHInternal(
   return result;
 }
 
-Monitor::GetResult Monitor::GetEntries(int get_first, int get_last) {
+Monitor::GetResult Monitor::GetEntries(int64_t get_first, int64_t get_last) {
   CHECK(get_first >= 0);
   CHECK(get_last >= get_first);
 
-  std::vector<AsyncLogClient::Entry> entries;
-  int dload_count = 0;
-  do {
-    // If the server does not impose a limit, all entries from get_first to
-    // get_last will be downloaded at once (could exceed memory).
-    AsyncLogClient::Status error =
-        client_->GetEntries(get_first + dload_count, get_last, &entries);
-
-    if (error != AsyncLogClient::OK) {
-      LOG(ERROR) << "HTTPLogClient returned with error " << error
-                 << ". No entries have been written to the database.";
-      return NETWORK_PROBLEM;
-    }
-
-    LOG(INFO) << "Writing entries from " << get_first + dload_count << " to "
-              << get_first + dload_count + entries.size();
-    dload_count += entries.size();
-
-    db_->BeginTransaction();
-    for (size_t i = 0; i < entries.size(); i++) {
-      cert_trans::LoggedEntry logged;
-      CHECK(logged.CopyFromClientLogEntry(entries.at(i)));
-      CHECK_EQ(db_->CreateEntry(logged), Database::WRITE_OK);
-    }
-    entries.clear();
+  // The new entries are added to the tree as they are written after the
+  // ones already in the database.
+  UpdateTree();
+
+  int num_uncommitted(0);
+  const AsyncLogClient::Status error(client_->GetEntriesPipelined(
+      get_first, get_last, FLAGS_monitor_concurrent_fetches,
+      0 /* max_retries */,
+      [this, &num_uncommitted](int64_t first,
+                               vector<AsyncLogClient::Entry>* entries) {
+        LOG(INFO) << "Writing entries from " << first << " to "
+                  << first + entries->size();
+        if (num_uncommitted == 0) {
+          db_->BeginTransaction();
+        }
+        vector<cert_trans::LoggedEntry> logged(entries->size());
+        for (size_t i = 0; i < entries->size(); ++i) {
+          CHECK(logged[i].CopyFromClientLogEntry((*entries)[i]));
+        }
+        vector<string> leaf_hashes;
+        CHECK_EQ(db_->CreateEntries(logged, &leaf_hashes),
+                 Database::WRITE_OK);
+        for (const string& leaf_hash : leaf_hashes) {
+          tree_->AddLeafHash(leaf_hash);
+        }
+        if (FLAGS_monitor_index_names) {
+          IndexNames(first, logged);
+        }
+        num_uncommitted += entries->size();
+        if (num_uncommitted >= FLAGS_monitor_entries_per_transaction) {
+          db_->EndTransaction();
+          num_uncommitted = 0;
+        }
+      }));
+  if (num_uncommitted > 0) {
     db_->EndTransaction();
+  }
 
-  } while (dload_count + get_first <= get_last);
+  if (error != AsyncLogClient::OK) {
+    LOG(ERROR) << "HTTPLogClient returned with error " << error
+               << ". No entries after the last ones written have been "
+               << "written to the database.";
+    return NETWORK_PROBLEM;
+  }
   return OK;
 }
 
@@ -193,35 +245,86 @@ Monitor::ConfirmResult Monitor::ConfirmTree(uint64_t timestamp) {
   return ConfirmTreeInternal(sth);
 }
 
+void Monitor::FindNames(const string& domain,
+                        vector<pair<string, int64_t>>* found) {
+  string name(domain);
+  for (char& c : name)
+    c = tolower(c);
+  const string reversed(ReverseDnsName(name));
+
+  found->clear();
+  vector<pair<string, int64_t>> names;
+  if (db_->LookupNamesByPrefix(reversed, &names) != Database::LOOKUP_OK)
+    return;
+  for (const pair<string, int64_t>& indexed : names) {
+    // Not "com.example-foo" for "com.example".
+    if (indexed.first.size() > reversed.size() &&
+        indexed.first[reversed.size()] != '.')
+      continue;
+    // The sequence numbers in the database start at 1.
+    found->emplace_back(ReverseDnsName(indexed.first), indexed.second - 1);
+  }
+}
+
+void Monitor::IndexNames(int64_t first,
+                         const vector<cert_trans::LoggedEntry>& entries) {
+  vector<string> names;
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (!cert_trans::ExtractDnsNames(entries[i].entry(), &names)) {
+      LOG(WARNING) << "Could not read the DNS names of entry " << first + i;
+      continue;
+    }
+    for (string& name : names)
+      name = ReverseDnsName(name);
+    // The sequence numbers in the database start at 1.
+    CHECK_EQ(db_->WriteNames(first + i + 1, names), Database::WRITE_OK);
+  }
+}
+
 Monitor::ConfirmResult Monitor::ConfirmTreeInternal() {
   return ConfirmTree(0);
 }
 
 Monitor::ConfirmResult Monitor::ConfirmTreeInternal(
     const ct::SignedTreeHead& sth) {
-  MerkleTree mt(new Sha256Hasher);
-
   Database::VerificationLevel lvl;
   CHECK_EQ(db_->LookupVerificationLevel(sth, &lvl), Database::LOOKUP_OK);
   CHECK_EQ(lvl, Database::SIGNATURE_VERIFIED);
 
-  std::string hash;
-
-  LOG(INFO) << "Building tree...";
-
-  for (int64_t current = 1; current <= sth.tree_size(); current++) {
-    CHECK_EQ(db_->LookupHashByIndex(current, &hash), Database::LOOKUP_OK);
-    mt.AddLeafHash(hash);
+  UpdateTree();
+  int64_t tree_size(tree_->LeafCount());
+  string root_hash;
+  if (sth.tree_size() == tree_size) {
+    root_hash = tree_->CurrentRoot();
+  } else {
+    // Not the tree of all the entries in the database.
+    LOG(INFO) << "Building tree...";
+
+    CompactMerkleTree mt(new Sha256Hasher);
+    vector<string> hashes;
+    for (int64_t first = 1; first <= sth.tree_size();
+         first += kHashesPerLookup) {
+      const int64_t last(
+          std::min<int64_t>(first + kHashesPerLookup - 1, sth.tree_size()));
+      CHECK_EQ(db_->LookupHashesByIndex(first, last, &hashes),
+               Database::LOOKUP_OK);
+      CHECK_EQ(last - first + 1, static_cast<int64_t>(hashes.size()));
+      for (const string& hash : hashes) {
+        mt.AddLeafHash(hash);
+      }
+    }
+    tree_size = mt.LeafCount();
+    root_hash = mt.CurrentRoot();
   }
 
   LOG(INFO) << "merkle tree_size and root_hash:";
-  LOG(INFO) << mt.LeafCount();
-  LOG(INFO) << util::ToBase64(mt.CurrentRoot());
+  LOG(INFO) << tree_size;
+  LOG(INFO) << util::ToBase64(root_hash);
   LOG(INFO) << "STH tree_size and root_hash:";
   LOG(INFO) << sth.tree_size();
   LOG(INFO) << util::ToBase64(sth.sha256_root_hash());
 
-  if (mt.CurrentRoot() != sth.sha256_root_hash()) {
+  if (root_hash != sth.sha256_root_hash()) {
     LOG(ERROR) << "Tree confirmation failed - hashes mismatch.";
     CHECK_EQ(db_->SetVerificationLevel(sth,
                                        Database::TREE_CONFIRMATION_FAILED),
@@ -232,10 +335,69 @@ Monitor::ConfirmResult Monitor::ConfirmTreeInternal(
 
   CHECK_EQ(db_->SetVerificationLevel(sth, Database::TREE_CONFIRMED),
            Database::WRITE_OK);
+  if (sth.tree_size() == static_cast<int64_t>(tree_->LeafCount())) {
+    CHECK_EQ(db_->WriteTreeState(tree_->LeafCount(), tree_->SubtreeRoots()),
+             Database::WRITE_OK);
+  }
   LOG(INFO) << "Tree confirmed.";
   return TREE_CONFIRMED;
 }
 
+void Monitor::UpdateTree() {
+  string hash;
+  if (tree_->LeafCount() == 0) {
+    int64_t tree_size;
+    vector<string> roots;
+    // As long as the database still has the entries of that tree.
+    if (db_->LookupTreeState(&tree_size, &roots) == Database::LOOKUP_OK &&
+        tree_size > 0 &&
+        db_->LookupHashByIndex(tree_size, &hash) == Database::LOOKUP_OK &&
+        roots.front().size() == tree_->NodeSize()) {
+      tree_.reset(new CompactMerkleTree(tree_size, roots, new Sha256Hasher));
+      LOG(INFO) << "Starting from the tree of the first " << tree_size
+                << " entries";
+    }
+  }
+
+  // The sequence numbers in the database start at 1.
+  vector<string> hashes;
+  do {
+    const int64_t first(tree_->LeafCount() + 1);
+    if (db_->LookupHashesByIndex(first, first + kHashesPerLookup - 1,
+                                 &hashes) != Database::LOOKUP_OK) {
+      break;
+    }
+    for (const string& hash : hashes) {
+      tree_->AddLeafHash(hash);
+    }
+  } while (static_cast<int64_t>(hashes.size()) == kHashesPerLookup);
+}
+
+bool Monitor::VerifyConsistency(const ct::SignedTreeHead& old_sth,
+                                const ct::SignedTreeHead& new_sth) {
+  // Anything is consistent with the empty tree.
+  if (old_sth.tree_size() == 0)
+    return true;
+
+  vector<string> proof;
+  if (client_->GetSTHConsistency(old_sth.tree_size(), new_sth.tree_size(),
+                                 &proof) != AsyncLogClient::OK) {
+    LOG(WARNING) << "network problem";
+    return false;
+  }
+
+  MerkleVerifier verifier(new Sha256Hasher);
+  if (!verifier.VerifyConsistency(old_sth.tree_size(), new_sth.tree_size(),
+                                  old_sth.sha256_root_hash(),
+                                  new_sth.sha256_root_hash(), proof)) {
+    LOG(ERROR) << "Consistency proof verification failed.";
+    CHECK_EQ(db_->SetVerificationLevel(new_sth, Database::INCONSISTENT),
+             Database::WRITE_OK);
+    return false;
+  }
+  return true;
+}
+
 Monitor::CheckResult Monitor::CheckSTHSanity(
     const ct::SignedTreeHead& old_sth, const ct::SignedTreeHead& new_sth) {
   // This serializing returns an empty String on failure which will lead to
@@ -278,9 +440,35 @@ void Monitor::Init() {
   ConfirmTreeInternal();
 }
 
+void Monitor::Poll(ct::SignedTreeHead* last_sth) {
+  ct::SignedTreeHead new_sth;
+
+  if (VerifySTHInternal() != SIGNATURE_VALID)
+    return;
+
+  CHECK_EQ(db_->LookupLatestWrittenSTH(&new_sth), Database::LOOKUP_OK);
+
+  const CheckResult sanity(CheckSTHSanity(*last_sth, new_sth));
+  if (sanity == SANE) {
+    // The new tree must extend the one that was confirmed last.
+    if (!VerifyConsistency(*last_sth, new_sth)) {
+      return;
+    }
+    if (GetEntries(last_sth->tree_size(), new_sth.tree_size() - 1) != OK) {
+      return;
+    }
+  }
+  if (sanity == REFRESHED || sanity == SANE) {
+    // Go on even the confirmation fails to continue to monitor the log.
+    // Nevertheless the failure is logged and written to the database.
+    ConfirmTreeInternal();
+
+    *last_sth = new_sth;
+  }
+}
+
 void Monitor::Loop() {
   ct::SignedTreeHead old_sth;
-  ct::SignedTreeHead new_sth;
 
   if (db_->LookupLatestWrittenSTH(&old_sth), Database::LOOKUP_OK)
     LOG(FATAL) << "Run init_monitor first.";
@@ -290,24 +478,7 @@ void Monitor::Loop() {
     // TODO(weidner): Better only sleep sleep_time - time_used_in_loop.
     sleep(sleep_time_);
 
-    if (VerifySTHInternal() != SIGNATURE_VALID)
-      continue;
-
-    CHECK_EQ(db_->LookupLatestWrittenSTH(&new_sth), Database::LOOKUP_OK);
-
-    const CheckResult sanity(CheckSTHSanity(old_sth, new_sth));
-    if (sanity == SANE) {
-      if (GetEntries(old_sth.tree_size(), new_sth.tree_size() - 1) != OK) {
-        continue;
-      }
-    }
-    if (sanity == REFRESHED || sanity == SANE) {
-      // Go on even the confirmation fails to continue to monitor the log.
-      // Nevertheless the failure is logged and written to the database.
-      ConfirmTreeInternal();
-
-      old_sth = new_sth;
-    }
+    Poll(&old_sth);
   }
 }
 
@@ -2,11 +2,20 @@
 #define MONITOR_H
 
 #include <stdint.h>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "base/macros.h"
 
+class CompactMerkleTree;
 class LogVerifier;
 
+namespace cert_trans {
+class LoggedEntry;
+}
+
 namespace ct {
 class SignedTreeHead;
 }
@@ -41,17 +50,31 @@ class Monitor {
 
   Monitor(Database* database, LogVerifier* verifier,
           cert_trans::HTTPLogClient* client, uint64_t sleep_time_sec);
+  ~Monitor();
 
   GetResult GetSTH();
 
   VerifyResult VerifySTH(uint64_t timestamp);
 
-  GetResult GetEntries(int get_first, int get_last);
+  // Retrieves the entries with --monitor_concurrent_fetches requests in
+  // flight, writing them as they come in.
+  GetResult GetEntries(int64_t get_first, int64_t get_last);
 
   ConfirmResult ConfirmTree(uint64_t timestamp);
 
+  // Sets |*found| to the DNS names of the entries indexed with
+  // --monitor_index_names which are |domain|, or within it, each with
+  // the index in the log of an entry for it.
+  void FindNames(const std::string& domain,
+                 std::vector<std::pair<std::string, int64_t>>* found);
+
   void Init();
 
+  // Does one round of Loop(): gets and verifies the latest STH of the
+  // log and, if it sanely follows |*last_sth|, the entries it adds and
+  // its tree, then sets |*last_sth| to it.
+  void Poll(ct::SignedTreeHead* last_sth);
+
   void Loop();
 
  private:
@@ -66,6 +89,26 @@ class Monitor {
   LogVerifier* const verifier_;
   cert_trans::HTTPLogClient* const client_;
   const uint64_t sleep_time_;
+  // The tree of the first entries of the database, which GetEntries()
+  // extends as it writes entries, so that confirming the tree of the
+  // latest STH does not read them all again. Its state is written to the
+  // database whenever it is confirmed, and picked up from there.
+  std::unique_ptr<CompactMerkleTree> tree_;
+
+  // Indexes the entries from |first| in the log by the DNS names of
+  // their certificates.
+  void IndexNames(int64_t first,
+                  const std::vector<cert_trans::LoggedEntry>& entries);
+
+  // Adds the entries of the database that |tree_| does not have yet,
+  // starting from the tree state in the database if it is empty.
+  void UpdateTree();
+
+  // Checks the consistency proof between the trees of |old_sth| and
+  // |new_sth|, marking |new_sth| as INCONSISTENT if it is not valid.
+  // Returns false if it is not, or if it could not be retrieved.
+  bool VerifyConsistency(const ct::SignedTreeHead& old_sth,
+                         const ct::SignedTreeHead& new_sth);
 
   VerifyResult VerifySTHInternal();
   VerifyResult VerifySTHInternal(const ct::SignedTreeHead& sth);
@@ -0,0 +1,167 @@
+#include "monitor/multi_monitor.h"
+
+#include <glog/logging.h>
+#include <chrono>
+#include <functional>
+
+#include "client/http_log_client.h"
+#include "log/log_verifier.h"
+#include "monitor/monitor.h"
+#include "monitor/sqlite_db.h"
+#include "proto/ct.pb.h"
+#include "util/thread_pool.h"
+
+namespace libevent = cert_trans::libevent;
+
+using cert_trans::HTTPLogClient;
+using cert_trans::ThreadPool;
+using cert_trans::UrlFetcher;
+using std::bind;
+using std::chrono::duration_cast;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::mutex;
+using std::string;
+using std::unique_lock;
+using std::unique_ptr;
+
+namespace monitor {
+
+
+struct MultiMonitor::Log {
+  Log(const string& name, const string& dbfile, libevent::Base* base,
+      UrlFetcher* fetcher, const string& server, LogVerifier* verifier,
+      uint64_t sleep_time_sec)
+      : name(name),
+        db(dbfile, name),
+        verifier(CHECK_NOTNULL(verifier)),
+        client(base, fetcher, server),
+        monitor(&db, verifier, &client, sleep_time_sec),
+        busy(false) {
+  }
+
+  const string name;
+  SQLiteDB db;
+  const unique_ptr<LogVerifier> verifier;
+  HTTPLogClient client;
+  Monitor monitor;
+  // The STH that the polls of the log start from, only used by them.
+  ct::SignedTreeHead last_sth;
+
+  // Guarded by |mutex_| of the MultiMonitor.
+  bool busy;
+  steady_clock::time_point next_poll;
+};
+
+
+MultiMonitor::MultiMonitor(const string& dbfile, libevent::Base* base,
+                           UrlFetcher* fetcher, ThreadPool* pool,
+                           uint64_t sleep_time_sec)
+    : dbfile_(dbfile),
+      base_(CHECK_NOTNULL(base)),
+      fetcher_(CHECK_NOTNULL(fetcher)),
+      pool_(CHECK_NOTNULL(pool)),
+      sleep_time_(sleep_time_sec) {
+}
+
+
+MultiMonitor::~MultiMonitor() {
+}
+
+
+void MultiMonitor::AddLog(const string& name, const string& server,
+                          LogVerifier* verifier) {
+  CHECK(!name.empty());
+  for (const auto& log : logs_) {
+    CHECK_NE(log->name, name) << "log added twice";
+  }
+  logs_.emplace_back(new Log(name, dbfile_, base_, fetcher_, server,
+                             verifier, sleep_time_));
+}
+
+
+void MultiMonitor::Init() {
+  unique_lock<mutex> lock(mutex_);
+  for (const auto& log : logs_) {
+    Log* const l(log.get());
+    l->busy = true;
+    pool_->Add([this, l]() {
+      LOG(INFO) << "Initializing the monitor of log " << l->name;
+      l->monitor.Init();
+      lock_guard<mutex> lock(mutex_);
+      l->busy = false;
+      done_cv_.notify_all();
+    });
+  }
+
+  done_cv_.wait(lock, [this]() {
+    for (const auto& log : logs_) {
+      if (log->busy) {
+        return false;
+      }
+    }
+    return true;
+  });
+}
+
+
+void MultiMonitor::Loop() {
+  CHECK(!logs_.empty());
+  const steady_clock::duration interval(
+      duration_cast<steady_clock::duration>(seconds(sleep_time_)));
+  const steady_clock::time_point start(steady_clock::now());
+
+  unique_lock<mutex> lock(mutex_);
+  for (size_t i = 0; i < logs_.size(); ++i) {
+    Log* const log(logs_[i].get());
+    CHECK_EQ(log->db.LookupLatestWrittenSTH(&log->last_sth),
+             Database::LOOKUP_OK)
+        << "Run the init monitor action first for log " << log->name;
+    // As with Monitor::Loop(), the first poll of each log is after a
+    // sleep, the last one of them the whole interval.
+    log->next_poll = start + interval * (i + 1) / logs_.size();
+  }
+
+  while (true) {
+    Log* next(nullptr);
+    for (const auto& log : logs_) {
+      if (!log->busy && (!next || log->next_poll < next->next_poll)) {
+        next = log.get();
+      }
+    }
+
+    if (!next) {
+      done_cv_.wait(lock);
+      continue;
+    }
+    if (steady_clock::now() < next->next_poll) {
+      // Another log can become due first, if its poll ends meanwhile.
+      done_cv_.wait_until(lock, next->next_poll);
+      continue;
+    }
+
+    next->busy = true;
+    next->next_poll += interval;
+    pool_->Add(bind(&MultiMonitor::Poll, this, next));
+  }
+}
+
+
+void MultiMonitor::Poll(Log* log) {
+  VLOG(1) << "Polling log " << log->name;
+  log->monitor.Poll(&log->last_sth);
+
+  lock_guard<mutex> lock(mutex_);
+  // A poll which took longer than the interval is followed by the next
+  // one at once, but not by those it missed.
+  const steady_clock::time_point now(steady_clock::now());
+  if (log->next_poll < now) {
+    log->next_poll = now;
+  }
+  log->busy = false;
+  done_cv_.notify_all();
+}
+
+
+}  // namespace monitor
@@ -0,0 +1,81 @@
+#ifndef MONITOR_MULTI_MONITOR_H
+#define MONITOR_MULTI_MONITOR_H
+
+#include <stdint.h>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+
+class LogVerifier;
+
+namespace cert_trans {
+class ThreadPool;
+class UrlFetcher;
+namespace libevent {
+class Base;
+}
+}
+
+namespace monitor {
+
+
+// Monitors several logs in the one process. Their clients share the
+// event loop of |base| and the connections of |fetcher|, their monitors
+// take turns on the threads of |pool| to verify STHs, write entries and
+// confirm trees, and their state is in tables of their own of the one
+// database file.
+//
+// |pool| must not be the pool of |fetcher|, whose requests could
+// otherwise wait for the threads of the monitors waiting for them.
+class MultiMonitor {
+ public:
+  // Something else must be running the event loop of |base|, see the
+  // HTTPLogClient constructor that shares it.
+  MultiMonitor(const std::string& dbfile, cert_trans::libevent::Base* base,
+               cert_trans::UrlFetcher* fetcher, cert_trans::ThreadPool* pool,
+               uint64_t sleep_time_sec);
+  ~MultiMonitor();
+
+  // Adds the log named |name| at |server|, whose STHs |verifier| (which
+  // this takes ownership of) verifies. The name is that of its tables,
+  // see SQLiteDB.
+  void AddLog(const std::string& name, const std::string& server,
+              LogVerifier* verifier);
+
+  // Runs Monitor::Init() for each log, several at once on |pool|.
+  void Init();
+
+  // Polls each log every |sleep_time_sec| seconds, as Monitor::Loop()
+  // does, with the polls of the logs spread evenly over that time rather
+  // than all at once. A log whose poll takes longer than that is polled
+  // again as soon as it is done. Never returns.
+  void Loop();
+
+ private:
+  struct Log;
+
+  // Runs |log|'s poll, then marks it as done.
+  void Poll(Log* log);
+
+  const std::string dbfile_;
+  cert_trans::libevent::Base* const base_;
+  cert_trans::UrlFetcher* const fetcher_;
+  cert_trans::ThreadPool* const pool_;
+  const uint64_t sleep_time_;
+  std::vector<std::unique_ptr<Log>> logs_;
+
+  std::mutex mutex_;
+  // Notified whenever a log is done with its poll or initialization.
+  std::condition_variable done_cv_;
+
+  DISALLOW_COPY_AND_ASSIGN(MultiMonitor);
+};
+
+
+}  // namespace monitor
+
+#endif  // MONITOR_MULTI_MONITOR_H
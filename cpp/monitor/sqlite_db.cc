@@ -1,75 +1,150 @@
 #include "monitor/sqlite_db.h"
 
+#include <ctype.h>
 #include <glog/logging.h>
 #include <sqlite3.h>
 
 #include "log/sqlite_statement.h"
 
 using sqlite::Statement;
+using std::pair;
 using std::string;
+using std::vector;
 
 namespace monitor {
 
-SQLiteDB::SQLiteDB(const string& dbfile) : db_(NULL) {
-  int ret = sqlite3_open_v2(dbfile.c_str(), &db_, SQLITE_OPEN_READWRITE, NULL);
-  if (ret == SQLITE_OK)
-    return;
-  CHECK_EQ(SQLITE_CANTOPEN, ret) << sqlite3_errmsg(db_);
+namespace {
 
-  // We have to close and reopen to avoid memory leaks.
-  CHECK_EQ(SQLITE_OK, sqlite3_close(db_)) << sqlite3_errmsg(db_);
-  db_ = NULL;
+// How long a statement waits for the monitors of the other logs of the
+// database to be done writing to it, before failing with SQLITE_BUSY.
+const int kBusyTimeoutMs = 60 * 1000;
 
-  CHECK_EQ(SQLITE_OK,
-           sqlite3_open_v2(dbfile.c_str(), &db_,
-                           SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL)) <<
-      sqlite3_errmsg(db_);
 
-  // HINT: AUTOINCREMENT starts at 1
+sqlite3* Open(const string& dbfile) {
+  sqlite3* db(NULL);
+  int ret = sqlite3_open_v2(dbfile.c_str(), &db, SQLITE_OPEN_READWRITE, NULL);
+  if (ret != SQLITE_OK) {
+    CHECK_EQ(SQLITE_CANTOPEN, ret) << sqlite3_errmsg(db);
 
-  CHECK_EQ(SQLITE_OK,
-           sqlite3_exec(db_,
-                        "CREATE TABLE leaves("
-                        "sequence INTEGER PRIMARY KEY ASC AUTOINCREMENT, "
-                        "cert BLOB, "
-                        "cert_chain BLOB, "
-                        "leaf_hash BLOB, "  // hash of MerkleTreeLeaf
-                        "leaf BLOB"         // MerkleTreeLeaf
-                        ")",
-                        NULL, NULL, NULL)) << sqlite3_errmsg(db_);
-
-  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_,
-                                   "CREATE TABLE trees("
-                                   "id INTEGER PRIMARY KEY ASC AUTOINCREMENT, "
-                                   "valid INTEGER, "
-                                   "timestamp INTEGER UNIQUE, "
-                                   "tree_size INTEGER, "
-                                   "sth BLOB)",
-                                   NULL, NULL, NULL)) << sqlite3_errmsg(db_);
-
-  LOG(INFO) << "New SQLite database created in " << dbfile;
+    // We have to close and reopen to avoid memory leaks.
+    CHECK_EQ(SQLITE_OK, sqlite3_close(db)) << sqlite3_errmsg(db);
+    db = NULL;
+
+    CHECK_EQ(SQLITE_OK,
+             sqlite3_open_v2(dbfile.c_str(), &db,
+                             SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                             NULL)) << sqlite3_errmsg(db);
+    LOG(INFO) << "New SQLite database created in " << dbfile;
+  }
+  CHECK_EQ(SQLITE_OK, sqlite3_busy_timeout(db, kBusyTimeoutMs));
+  return db;
+}
+
+
+}  // namespace
+
+SQLiteDB::SQLiteDB(const string& dbfile) : SQLiteDB(dbfile, "") {
+}
+
+SQLiteDB::SQLiteDB(const string& dbfile, const string& log_name)
+    : prefix_(log_name.empty() ? "" : log_name + "_"),
+      db_(new sqlite::Connection(Open(dbfile), [this](const char* sql) {
+        return Sql(sql);
+      })) {
+  for (const char c : log_name)
+    CHECK(isalnum(c) || c == '_') << "invalid log name: " << log_name;
+
+  CreateTables();
 }
 
 SQLiteDB::~SQLiteDB() {
-  CHECK_EQ(SQLITE_OK, sqlite3_close(db_)) << sqlite3_errmsg(db_);
+}
+
+void SQLiteDB::CreateTables() {
+  // HINT: AUTOINCREMENT starts at 1
+  Exec("CREATE TABLE IF NOT EXISTS $leaves("
+       "sequence INTEGER PRIMARY KEY ASC AUTOINCREMENT, "
+       "cert BLOB, "
+       "cert_chain BLOB, "
+       "leaf_hash BLOB, "  // hash of MerkleTreeLeaf
+       "leaf BLOB"         // MerkleTreeLeaf
+       ")");
+
+  Exec("CREATE TABLE IF NOT EXISTS $trees("
+       "id INTEGER PRIMARY KEY ASC AUTOINCREMENT, "
+       "valid INTEGER, "
+       "timestamp INTEGER UNIQUE, "
+       "tree_size INTEGER, "
+       "sth BLOB)");
+
+  // There is only ever the one row, with id 0.
+  Exec("CREATE TABLE IF NOT EXISTS $tree_state("
+       "id INTEGER PRIMARY KEY CHECK (id = 0), "
+       "tree_size INTEGER, "
+       "subtree_roots BLOB)");
+
+  // The reversed DNS names of the certificates of the entries, when
+  // they are indexed, so that those within a domain are a range.
+  Exec("CREATE TABLE IF NOT EXISTS $names("
+       "name BLOB, "
+       "sequence INTEGER, "
+       "PRIMARY KEY (name, sequence)) WITHOUT ROWID");
+
+  // The leaf hashes come after the certificates in the rows of the
+  // leaves, which usually take more than a page: the lookups of the
+  // hashes read them from this index instead, a page for many of them.
+  // Likewise for the STHs, the statements using them say INDEXED BY, as
+  // SQLite would go for the primary key or the UNIQUE constraint.
+  Exec("CREATE INDEX IF NOT EXISTS $leaves_hash "
+       "ON $leaves(sequence, leaf_hash)");
+  Exec("CREATE INDEX IF NOT EXISTS $trees_sth "
+       "ON $trees(timestamp, sth, valid)");
+}
+
+string SQLiteDB::Sql(const string& sql) const {
+  string retval;
+  for (const char c : sql) {
+    if (c == '$') {
+      retval.append(prefix_);
+    } else {
+      retval.push_back(c);
+    }
+  }
+  return retval;
+}
+
+void SQLiteDB::Exec(const char* sql) {
+  CHECK_EQ(SQLITE_OK,
+           sqlite3_exec(db_->db(), Sql(sql).c_str(), NULL, NULL, NULL))
+      << sqlite3_errmsg(db_->db()) << ", sql = " << sql;
 }
 
 void SQLiteDB::BeginTransaction() {
-  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "BEGIN;", NULL, NULL, NULL)) <<
-      sqlite3_errmsg(db_);
+  Exec("BEGIN;");
 }
 
 void SQLiteDB::EndTransaction() {
-  CHECK_EQ(SQLITE_OK, sqlite3_exec(db_, "COMMIT;", NULL, NULL, NULL)) <<
-      sqlite3_errmsg(db_);
+  Exec("COMMIT;");
+}
+
+void SQLiteDB::BeginBatch() {
+  // Unlike BEGIN, a savepoint can be inside a transaction.
+  Exec("SAVEPOINT batch;");
+}
+
+void SQLiteDB::EndBatch(bool commit) {
+  if (!commit) {
+    Exec("ROLLBACK TO batch;");
+  }
+  Exec("RELEASE batch;");
 }
 
 SQLiteDB::WriteResult SQLiteDB::CreateEntry_(const std::string& leaf,
                                              const std::string& leaf_hash,
                                              const std::string& cert,
                                              const std::string& cert_chain) {
-  Statement statement(db_,
-                      "INSERT INTO leaves(leaf, leaf_hash, cert, cert_chain) "
+  Statement statement(db_.get(),
+                      "INSERT INTO $leaves(leaf, leaf_hash, cert, cert_chain) "
                       "VALUES(?, ?, ?, ?)");
 
   statement.BindBlob(0, leaf);
@@ -87,8 +162,8 @@ SQLiteDB::WriteResult SQLiteDB::WriteSTH_(uint64_t timestamp,
                                           int64_t tree_size,
                                           const std::string& sth) {
   CHECK_GE(tree_size, 0);
-  Statement statement(db_,
-                      "INSERT INTO trees(timestamp, tree_size, sth) "
+  Statement statement(db_.get(),
+                      "INSERT INTO $trees(timestamp, tree_size, sth) "
                       "VALUES(?, ?, ?)");
 
   statement.BindUInt64(0, timestamp);
@@ -97,7 +172,8 @@ SQLiteDB::WriteResult SQLiteDB::WriteSTH_(uint64_t timestamp,
 
   int ret = statement.Step();
   if (ret == SQLITE_CONSTRAINT) {
-    Statement s2(db_, "SELECT timestamp FROM trees WHERE timestamp = ?");
+    Statement s2(
+        db_.get(), "SELECT timestamp FROM $trees WHERE timestamp = ?");
     s2.BindUInt64(0, timestamp);
     if (s2.Step() != SQLITE_ROW)
       return this->WRITE_FAILED;
@@ -111,14 +187,14 @@ SQLiteDB::WriteResult SQLiteDB::WriteSTH_(uint64_t timestamp,
 
 SQLiteDB::LookupResult SQLiteDB::LookupLatestWrittenSTH(
     ct::SignedTreeHead* result) const {
-  Statement statement(db_,
-                      "SELECT sth FROM trees WHERE id IN "
-                      "(SELECT MAX(id) FROM trees)");
+  Statement statement(db_.get(),
+                      "SELECT sth FROM $trees WHERE id IN "
+                      "(SELECT MAX(id) FROM $trees)");
 
   int ret = statement.Step();
   if (ret == SQLITE_DONE)
     return this->NOT_FOUND;
-  CHECK_EQ(SQLITE_ROW, ret) << sqlite3_errmsg(db_);
+  CHECK_EQ(SQLITE_ROW, ret) << sqlite3_errmsg(db_->db());
 
   string sth;
   statement.GetBlob(0, &sth);
@@ -129,7 +205,9 @@ SQLiteDB::LookupResult SQLiteDB::LookupLatestWrittenSTH(
 
 SQLiteDB::LookupResult SQLiteDB::LookupHashByIndex(int64_t sequence_number,
                                                    std::string* result) const {
-  Statement statement(db_, "SELECT leaf_hash FROM leaves WHERE sequence = ?");
+  Statement statement(db_.get(),
+                      "SELECT leaf_hash FROM $leaves INDEXED BY $leaves_hash "
+                      "WHERE sequence = ?");
 
   statement.BindUInt64(0, sequence_number);
   int ret = statement.Step();
@@ -141,22 +219,44 @@ SQLiteDB::LookupResult SQLiteDB::LookupHashByIndex(int64_t sequence_number,
   return this->LOOKUP_OK;
 }
 
+SQLiteDB::LookupResult SQLiteDB::LookupHashesByIndex(
+    int64_t first, int64_t last, vector<string>* result) const {
+  Statement statement(db_.get(),
+                      "SELECT leaf_hash FROM $leaves INDEXED BY $leaves_hash "
+                      "WHERE sequence BETWEEN ? AND ? ORDER BY sequence");
+  statement.BindUInt64(0, first);
+  statement.BindUInt64(1, last);
+
+  result->clear();
+  int ret;
+  while ((ret = statement.Step()) == SQLITE_ROW) {
+    result->emplace_back();
+    statement.GetBlob(0, &result->back());
+  }
+  CHECK_EQ(SQLITE_DONE, ret) << sqlite3_errmsg(db_->db());
+
+  return result->empty() ? this->NOT_FOUND : this->LOOKUP_OK;
+}
+
 SQLiteDB::WriteResult SQLiteDB::SetVerificationLevel_(
     const ct::SignedTreeHead& sth, SQLiteDB::VerificationLevel verify_level) {
-  Statement statement(db_, "UPDATE trees SET valid = ? WHERE timestamp = ?");
+  Statement statement(
+      db_.get(), "UPDATE $trees SET valid = ? WHERE timestamp = ?");
   statement.BindUInt64(0, verify_level);
   statement.BindUInt64(1, sth.timestamp());
 
   if (statement.Step() != SQLITE_DONE)
     return this->WRITE_FAILED;
-  CHECK_EQ(sqlite3_changes(db_), 1);
+  CHECK_EQ(sqlite3_changes(db_->db()), 1);
 
   return this->WRITE_OK;
 }
 
 SQLiteDB::LookupResult SQLiteDB::LookupSTHByTimestamp(
     uint64_t timestamp, ct::SignedTreeHead* result) const {
-  Statement statement(db_, "SELECT sth FROM trees WHERE timestamp = ?");
+  Statement statement(db_.get(),
+                      "SELECT sth FROM $trees INDEXED BY $trees_sth "
+                      "WHERE timestamp = ?");
 
   statement.BindUInt64(0, timestamp);
 
@@ -164,7 +264,7 @@ SQLiteDB::LookupResult SQLiteDB::LookupSTHByTimestamp(
   if (ret == SQLITE_DONE)
     return this->NOT_FOUND;
 
-  CHECK_EQ(SQLITE_ROW, ret) << sqlite3_errmsg(db_);
+  CHECK_EQ(SQLITE_ROW, ret) << sqlite3_errmsg(db_->db());
 
   string sth;
   statement.GetBlob(0, &sth);
@@ -175,8 +275,9 @@ SQLiteDB::LookupResult SQLiteDB::LookupSTHByTimestamp(
 
 SQLiteDB::LookupResult SQLiteDB::LookupVerificationLevel(
     const ct::SignedTreeHead& sth, SQLiteDB::VerificationLevel* result) const {
-  Statement statement(
-      db_, "SELECT IFNULL(valid, ?) FROM trees WHERE timestamp = ?");
+  Statement statement(db_.get(),
+                      "SELECT IFNULL(valid, ?) FROM $trees "
+                      "INDEXED BY $trees_sth WHERE timestamp = ?");
   statement.BindUInt64(0, this->UNDEFINED);
   statement.BindUInt64(1, sth.timestamp());
 
@@ -184,11 +285,102 @@ SQLiteDB::LookupResult SQLiteDB::LookupVerificationLevel(
   if (ret == SQLITE_DONE)
     return this->NOT_FOUND;
 
-  CHECK_EQ(SQLITE_ROW, ret) << sqlite3_errmsg(db_);
+  CHECK_EQ(SQLITE_ROW, ret) << sqlite3_errmsg(db_->db());
   *result = SQLiteDB::VerificationLevel(statement.GetUInt64(0));
 
-  CHECK_EQ(SQLITE_DONE, statement.Step()) << sqlite3_errmsg(db_);
+  CHECK_EQ(SQLITE_DONE, statement.Step()) << sqlite3_errmsg(db_->db());
+  return this->LOOKUP_OK;
+}
+
+SQLiteDB::WriteResult SQLiteDB::WriteTreeState(
+    int64_t tree_size, const std::vector<string>& subtree_roots) {
+  CHECK_GE(tree_size, 0);
+  string roots;
+  for (const string& root : subtree_roots) {
+    roots.append(root);
+  }
+
+  Statement statement(db_.get(),
+                      "INSERT OR REPLACE INTO "
+                      "$tree_state(id, tree_size, subtree_roots) "
+                      "VALUES(0, ?, ?)");
+  statement.BindUInt64(0, tree_size);
+  statement.BindBlob(1, roots);
+
+  if (statement.Step() != SQLITE_DONE)
+    return this->WRITE_FAILED;
+
+  return this->WRITE_OK;
+}
+
+SQLiteDB::LookupResult SQLiteDB::LookupTreeState(
+    int64_t* tree_size, std::vector<string>* subtree_roots) const {
+  Statement statement(db_.get(),
+                      "SELECT tree_size, subtree_roots FROM $tree_state "
+                      "WHERE id = 0");
+
+  int ret = statement.Step();
+  if (ret == SQLITE_DONE)
+    return this->NOT_FOUND;
+  CHECK_EQ(SQLITE_ROW, ret) << sqlite3_errmsg(db_->db());
+
+  *tree_size = statement.GetUInt64(0);
+
+  // The roots all have the same size, and there is one for each bit set
+  // in the tree size.
+  size_t num_roots(0);
+  for (uint64_t bits = *tree_size; bits != 0; bits >>= 1)
+    num_roots += bits & 1;
+  subtree_roots->clear();
+  if (num_roots == 0)
+    return this->LOOKUP_OK;
+  string roots;
+  statement.GetBlob(1, &roots);
+  CHECK_EQ(roots.size() % num_roots, 0U) << "corrupted tree state";
+  const size_t root_size(roots.size() / num_roots);
+  for (size_t i = 0; i < num_roots; ++i)
+    subtree_roots->push_back(roots.substr(i * root_size, root_size));
+
   return this->LOOKUP_OK;
 }
 
+SQLiteDB::WriteResult SQLiteDB::WriteNames(
+    int64_t sequence_number, const vector<string>& reversed_names) {
+  for (const string& name : reversed_names) {
+    Statement statement(db_.get(),
+                        "INSERT OR IGNORE INTO $names(name, sequence) "
+                        "VALUES(?, ?)");
+    statement.BindBlob(0, name);
+    statement.BindUInt64(1, sequence_number);
+
+    if (statement.Step() != SQLITE_DONE)
+      return this->WRITE_FAILED;
+  }
+
+  return this->WRITE_OK;
+}
+
+SQLiteDB::LookupResult SQLiteDB::LookupNamesByPrefix(
+    const string& prefix, vector<pair<string, int64_t>>* result) const {
+  // The names are ASCII, so those with the prefix sort below it followed
+  // by 0xff.
+  const string end(prefix + '\xff');
+  Statement statement(db_.get(),
+                      "SELECT name, sequence FROM $names "
+                      "WHERE name >= ? AND name < ? ORDER BY name, sequence");
+  statement.BindBlob(0, prefix);
+  statement.BindBlob(1, end);
+
+  result->clear();
+  int ret;
+  while ((ret = statement.Step()) == SQLITE_ROW) {
+    result->emplace_back();
+    statement.GetBlob(0, &result->back().first);
+    result->back().second = statement.GetUInt64(1);
+  }
+  CHECK_EQ(SQLITE_DONE, ret) << sqlite3_errmsg(db_->db());
+
+  return result->empty() ? this->NOT_FOUND : this->LOOKUP_OK;
+}
+
 }  // namespace monitor
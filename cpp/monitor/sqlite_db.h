@@ -2,12 +2,16 @@
 #define MONITOR_SQLITE_DB_H
 
 #include <stdint.h>
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "monitor/database.h"
 
-struct sqlite3;
+namespace sqlite {
+class Connection;
+}
 
 namespace monitor {
 
@@ -15,6 +19,14 @@ class SQLiteDB : public Database {
  public:
   explicit SQLiteDB(const std::string& dbfile);
 
+  // Keeps the state of the log named |log_name| in tables of their own,
+  // so that the monitors of several logs can share |dbfile|. Each should
+  // have its own SQLiteDB: the transactions of the others wait for that
+  // of one to be committed. An empty name is that of the tables of the
+  // single log of the constructor above. |log_name| can only have
+  // letters, digits and underscores.
+  SQLiteDB(const std::string& dbfile, const std::string& log_name);
+
   ~SQLiteDB();
 
   typedef Database::WriteResult WriteResult;
@@ -31,13 +43,34 @@ class SQLiteDB : public Database {
   virtual LookupResult LookupHashByIndex(int64_t sequence_number,
                                          std::string* result) const;
 
+  virtual LookupResult LookupHashesByIndex(
+      int64_t first, int64_t last, std::vector<std::string>* result) const;
+
   virtual LookupResult LookupSTHByTimestamp(uint64_t timestamp,
                                             ct::SignedTreeHead* result) const;
 
   virtual LookupResult LookupVerificationLevel(
       const ct::SignedTreeHead& sth, VerificationLevel* result) const;
 
+  virtual WriteResult WriteTreeState(
+      int64_t tree_size, const std::vector<std::string>& subtree_roots);
+
+  virtual LookupResult LookupTreeState(
+      int64_t* tree_size, std::vector<std::string>* subtree_roots) const;
+
+  virtual WriteResult WriteNames(
+      int64_t sequence_number,
+      const std::vector<std::string>& reversed_names);
+
+  virtual LookupResult LookupNamesByPrefix(
+      const std::string& prefix,
+      std::vector<std::pair<std::string, int64_t>>* result) const;
+
  private:
+  virtual void BeginBatch();
+
+  virtual void EndBatch(bool commit);
+
   virtual WriteResult CreateEntry_(const std::string& leaf,
                                    const std::string& leaf_hash,
                                    const std::string& cert,
@@ -49,7 +82,22 @@ class SQLiteDB : public Database {
   virtual WriteResult SetVerificationLevel_(const ct::SignedTreeHead& sth,
                                             VerificationLevel verify_level);
 
-  sqlite3* db_;
+  // Creates the tables of the log that are not in the database yet: all
+  // of them for a new log, or that of the tree state for a database
+  // created before it was written.
+  void CreateTables();
+
+  // Returns |sql| with the table name prefix of the log in place of each
+  // '$'.
+  std::string Sql(const std::string& sql) const;
+
+  // Runs |sql|, after Sql(), which must succeed.
+  void Exec(const char* sql);
+
+  const std::string prefix_;
+  // The statements of which are prepared once, with their SQL after
+  // Sql().
+  const std::unique_ptr<sqlite::Connection> db_;
 
   DISALLOW_COPY_AND_ASSIGN(SQLiteDB);
 };
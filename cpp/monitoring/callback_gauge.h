@@ -0,0 +1,61 @@
+#ifndef CERT_TRANS_MONITORING_CALLBACK_GAUGE_H_
+#define CERT_TRANS_MONITORING_CALLBACK_GAUGE_H_
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "monitoring/metric.h"
+
+namespace cert_trans {
+
+
+// A gauge whose values are only worked out when exported, by calling a
+// function, for values that are kept elsewhere anyway (e.g. the length
+// of a queue), and would be wasteful to also keep up to date in a
+// Gauge<> every time they change.
+class CallbackGauge : public Metric {
+ public:
+  // Returns the current value for each set of label values.
+  typedef std::function<std::map<std::vector<std::string>, double>()>
+      Callback;
+
+  // |callback| can be called from any thread, for as long as the
+  // CallbackGauge exists.
+  static CallbackGauge* New(const std::string& name,
+                            const std::vector<std::string>& label_names,
+                            const std::string& help,
+                            const Callback& callback) {
+    return new CallbackGauge(name, label_names, help, callback);
+  }
+
+  std::map<std::vector<std::string>, Metric::TimestampedValue> CurrentValues()
+      const override {
+    const std::chrono::system_clock::time_point now(
+        std::chrono::system_clock::now());
+    std::map<std::vector<std::string>, Metric::TimestampedValue> ret;
+    for (const auto& it : callback_()) {
+      ret.emplace(it.first, std::make_pair(now, it.second));
+    }
+    return ret;
+  }
+
+ private:
+  CallbackGauge(const std::string& name,
+                const std::vector<std::string>& label_names,
+                const std::string& help, const Callback& callback)
+      : Metric(GAUGE, name, label_names, help), callback_(callback) {
+  }
+
+  const Callback callback_;
+
+  DISALLOW_COPY_AND_ASSIGN(CallbackGauge);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MONITORING_CALLBACK_GAUGE_H_
@@ -31,6 +31,8 @@ class Counter : public Metric {
   std::map<std::vector<std::string>, Metric::TimestampedValue> CurrentValues()
       const override;
 
+  void ForEachValue(const ValueCallback& callback) const override;
+
  private:
   Counter(const std::string& name,
           const typename NameType<LabelTypes>::name&... label_names,
@@ -88,6 +90,12 @@ Counter<LabelTypes...>::CurrentValues() const {
 }
 
 
+template <class... LabelTypes>
+void Counter<LabelTypes...>::ForEachValue(const ValueCallback& callback) const {
+  values_.ForEachValue(callback);
+}
+
+
 }  // namespace cert_trans
 
 #endif  // CERT_TRANS_MONITORING_COUNTER_H_
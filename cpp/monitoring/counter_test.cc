@@ -4,6 +4,9 @@
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 #include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 
 #include "util/testing.h"
 
@@ -91,6 +94,31 @@ TEST_F(CounterTest, TestCounterWithLabelsMultiValues) {
 }
 
 
+TEST_F(CounterTest, TestCounterConcurrentIncrements) {
+  std::unique_ptr<Counter<std::string>> counter(
+      Counter<std::string>::New("name", "a string", "help"));
+  const int kNumThreads(8);
+  const int kNumIncrements(10000);
+  vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([&counter, i]() {
+      for (int j = 0; j < kNumIncrements; ++j) {
+        counter->Increment("shared");
+        counter->Increment("mine " + std::to_string(i));
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  EXPECT_EQ(kNumThreads * kNumIncrements, counter->Get("shared"));
+  EXPECT_EQ(kNumIncrements, counter->Get("mine 3"));
+  EXPECT_EQ(static_cast<size_t>(kNumThreads + 1),
+            counter->CurrentValues().size());
+}
+
+
 }  // namespace cert_trans
 
 
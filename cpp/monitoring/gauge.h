@@ -29,6 +29,8 @@ class Gauge : public Metric {
   std::map<std::vector<std::string>, Metric::TimestampedValue> CurrentValues()
       const override;
 
+  void ForEachValue(const ValueCallback& callback) const override;
+
  private:
   Gauge(const std::string& name,
         const typename NameType<LabelTypes>::name&... label_names,
@@ -79,6 +81,12 @@ Gauge<LabelTypes...>::CurrentValues() const {
 }
 
 
+template <class... LabelTypes>
+void Gauge<LabelTypes...>::ForEachValue(const ValueCallback& callback) const {
+  values_.ForEachValue(callback);
+}
+
+
 }  // namespace cert_trans
 
 
@@ -2,8 +2,13 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <string.h>
+#include <zlib.h>
 #include <sstream>
+#include <utility>
+#include <vector>
 
+#include "monitoring/histogram.h"
 #include "monitoring/monitoring.h"
 #include "monitoring/registry.h"
 #include "net/url.h"
@@ -24,6 +29,14 @@ DEFINE_int32(google_compute_monitoring_credentials_refresh_interval_minutes,
              "GCM.");
 DEFINE_int32(google_compute_monitoring_retry_delay_seconds, 5,
              "Seconds between retrying failed GCM requests.");
+DEFINE_int32(google_compute_monitoring_resend_interval_seconds, 300,
+             "Seconds after which the series whose values have not changed "
+             "are pushed to GCM again.");
+DEFINE_int32(google_compute_monitoring_max_series_per_request, 200,
+             "Maximum number of series pushed to GCM in one request. Larger "
+             "pushes are split into several requests, sent concurrently.");
+DEFINE_bool(google_compute_monitoring_gzip, true,
+            "Whether to compress the requests pushing metric values to GCM.");
 
 
 namespace cert_trans {
@@ -32,14 +45,20 @@ using std::bind;
 using std::chrono::minutes;
 using std::chrono::seconds;
 using std::chrono::system_clock;
+using std::lock_guard;
 using std::make_pair;
+using std::make_shared;
+using std::map;
 using std::mutex;
+using std::pair;
 using std::ostringstream;
 using std::placeholders::_1;
+using std::shared_ptr;
 using std::string;
 using std::thread;
 using std::unique_lock;
 using std::unique_ptr;
+using std::vector;
 using util::Executor;
 using util::SyncTask;
 using util::Task;
@@ -63,6 +82,44 @@ namespace {
 const char kCloudPrefix[] = "custom.cloudmonitoring.googleapis.com/ct/";
 
 
+// Custom GCM metrics can only be gauges of doubles, so histograms are
+// sent as a few series derived from their distributions.
+struct HistogramSeries {
+  const char* suffix;
+  const char* help;
+  double (*value)(const Metric::Distribution& distribution);
+};
+
+
+const HistogramSeries kHistogramSeries[] = {
+    {"_count", " (count)",
+     [](const Metric::Distribution& d) -> double { return d.count; }},
+    {"_overall_sum", " (sum)",
+     [](const Metric::Distribution& d) { return d.sum; }},
+    {"_p50", " (50th percentile)",
+     [](const Metric::Distribution& d) { return EstimateQuantile(d, 0.5); }},
+    {"_p90", " (90th percentile)",
+     [](const Metric::Distribution& d) { return EstimateQuantile(d, 0.9); }},
+    {"_p99", " (99th percentile)",
+     [](const Metric::Distribution& d) { return EstimateQuantile(d, 0.99); }},
+};
+
+
+// The names and descriptions of the GCM metrics for |metric|.
+vector<pair<string, string>> SeriesDescriptions(const Metric& metric) {
+  vector<pair<string, string>> ret;
+  if (metric.Type() != Metric::HISTOGRAM) {
+    ret.emplace_back(metric.Name(), metric.Help());
+    return ret;
+  }
+  for (const auto& series : kHistogramSeries) {
+    ret.emplace_back(metric.Name() + series.suffix,
+                     metric.Help() + series.help);
+  }
+  return ret;
+}
+
+
 inline std::string RFC3339Time(const system_clock::time_point& when) {
   const std::time_t now_c(system_clock::to_time_t(when));
   char buf[256];
@@ -71,9 +128,44 @@ inline std::string RFC3339Time(const system_clock::time_point& when) {
 }
 
 
+// Compresses |data| into the gzip format.
+string Gzip(const string& data) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // 16 more window bits ask for a gzip header and trailer.
+  CHECK_EQ(Z_OK, deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                              15 + 16, 8, Z_DEFAULT_STRATEGY));
+  string out(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+  stream.avail_out = out.size();
+  CHECK_EQ(Z_STREAM_END, deflate(&stream, Z_FINISH));
+  out.resize(stream.total_out);
+  CHECK_EQ(Z_OK, deflateEnd(&stream));
+  return out;
+}
+
+
 }  // namespace
 
 
+// The requests of a push, and how many of them are still waiting for GCM.
+struct GCMExporter::Push {
+  struct Batch {
+    JsonArray timeseries;
+    // The values sent by |timeseries|, which are recorded as pushed once
+    // GCM has them.
+    map<SeriesKey, double> values;
+  };
+
+  system_clock::time_point time;
+  vector<unique_ptr<Batch>> batches;
+  // Guarded by GCMExporter::lock_.
+  size_t remaining;
+};
+
+
 GCMExporter::GCMExporter(const string& instance_name, UrlFetcher* fetcher,
                          Executor* executor)
     : instance_name_(instance_name),
@@ -165,6 +257,7 @@ void GCMExporter::CreateMetrics() {
     JsonObject desc;
     switch (m->Type()) {
       case Metric::COUNTER:
+      case Metric::HISTOGRAM:
         // only gauge type metrics are supported for custom metrics currently:
         // https://cloud.google.com/monitoring/api/metrics#metric-types
         desc.Add("metricType", "gauge");
@@ -177,40 +270,43 @@ void GCMExporter::CreateMetrics() {
     }
     desc.Add("valueType", "double");
 
-    JsonObject metric;
-    metric.Add("name", kCloudPrefix + m->Name());
-    metric.Add("description", m->Help());
-    metric.Add("labels", labels);
-    metric.Add("typeDescriptor", desc);
-
-    do {
-      UrlFetcher::Request req((URL(FLAGS_google_compute_monitoring_base_url +
-                                   "/metricDescriptors")));
-      req.verb = UrlFetcher::Verb::POST;
-      req.headers.insert(make_pair("Content-Type", "application/json"));
-      req.headers.insert(
-          make_pair("Authorization", "Bearer " + bearer_token_));
-      req.body = metric.ToString();
-
-      UrlFetcher::Response resp;
-      SyncTask task(executor_);
-      VLOG(1) << "Creating metric m.Name()...";
-      VLOG(2) << req.body;
-      fetcher_->Fetch(req, &resp, task.task());
-      task.Wait();
-      if (!task.status().ok() || resp.status_code != 200) {
-        LOG(WARNING) << "Failed to create/update metric metadata; status: "
-                     << task.status()
-                     << ", response_code: " << resp.status_code;
-        num_gcm_create_metric_failures->Increment();
-        // TODO(alcutter): consider breaking this up into separate child tasks.
-        sleep(FLAGS_google_compute_monitoring_retry_delay_seconds);
-        continue;
-      }
-      VLOG(1) << "Metrics Created.";
-      VLOG(2) << resp.body;
-      break;
-    } while (true);
+    for (const auto& series : SeriesDescriptions(*m)) {
+      JsonObject metric;
+      metric.Add("name", kCloudPrefix + series.first);
+      metric.Add("description", series.second);
+      metric.Add("labels", labels);
+      metric.Add("typeDescriptor", desc);
+
+      do {
+        UrlFetcher::Request req((URL(FLAGS_google_compute_monitoring_base_url +
+                                     "/metricDescriptors")));
+        req.verb = UrlFetcher::Verb::POST;
+        req.headers.insert(make_pair("Content-Type", "application/json"));
+        req.headers.insert(
+            make_pair("Authorization", "Bearer " + bearer_token_));
+        req.body = metric.ToString();
+
+        UrlFetcher::Response resp;
+        SyncTask task(executor_);
+        VLOG(1) << "Creating metric " << series.first << "...";
+        VLOG(2) << req.body;
+        fetcher_->Fetch(req, &resp, task.task());
+        task.Wait();
+        if (!task.status().ok() || resp.status_code != 200) {
+          LOG(WARNING) << "Failed to create/update metric metadata; status: "
+                       << task.status()
+                       << ", response_code: " << resp.status_code;
+          num_gcm_create_metric_failures->Increment();
+          // TODO(alcutter): consider breaking this up into separate child
+          // tasks.
+          sleep(FLAGS_google_compute_monitoring_retry_delay_seconds);
+          continue;
+        }
+        VLOG(1) << "Metrics Created.";
+        VLOG(2) << resp.body;
+        break;
+      } while (true);
+    }
   }
   metrics_created_ = true;
 }
@@ -224,6 +320,38 @@ void AddLabel(const string& key, const string& value, JsonObject* labels) {
 }
 
 
+void AddTimeseries(const Metric& m, const string& name,
+                   const vector<string>& label_values, double value,
+                   const system_clock::time_point& now,
+                   JsonArray* timeseries) {
+  JsonObject labels;
+  for (size_t i(0); i < label_values.size(); ++i) {
+    AddLabel(m.LabelName(i), label_values[i], &labels);
+  }
+
+  JsonObject desc;
+  desc.Add("labels", labels);
+  desc.Add("metric", kCloudPrefix + name);
+
+  JsonObject ts;
+  ts.Add("timeseriesDesc", desc);
+
+  JsonObject point;
+  // According to
+  // https://cloud.google.com/monitoring/v2beta2/timeseries/write
+  // GAUGE types should have a zero size timerange here
+  // Which implies we need to use the current time rather than the time the
+  // value was set because there's a [short ~5m] horizon over which GCM
+  // won't accept samples.
+  point.Add("start", RFC3339Time(now));
+  point.Add("end", RFC3339Time(now));
+  point.Add("doubleValue", value);
+  ts.Add("point", point);
+
+  CHECK_NOTNULL(timeseries)->Add(&ts);
+}
+
+
 }  // namespace
 
 
@@ -246,76 +374,117 @@ void GCMExporter::PushMetrics() {
     CreateMetrics();
   }
 
-  // Build up the JSON write request into this object:
-  JsonObject metric_write;
-  metric_write.Add("kind", "cloudmonitoring#writeTimeseriesRequest");
-
-  JsonObject common_labels;
-  AddLabel("instance", instance_name_, &common_labels);
-  metric_write.Add("commonLabels", common_labels);
+  const shared_ptr<Push> push(make_shared<Push>());
+  push->time = system_clock::now();
+  const seconds resend_after(
+      FLAGS_google_compute_monitoring_resend_interval_seconds);
+  const size_t max_batch_size(
+      FLAGS_google_compute_monitoring_max_series_per_request);
+  // Adds the series to the last batch, unless GCM has its value already.
+  const auto add_series = [this, &push, resend_after, max_batch_size](
+      const Metric& m, const string& name, const vector<string>& label_values,
+      double value) {
+    SeriesKey key(name, label_values);
+    const auto it(pushed_.find(key));
+    if (it != pushed_.end() && it->second.value == value &&
+        push->time - it->second.pushed_at < resend_after) {
+      return;
+    }
+    if (push->batches.empty() ||
+        push->batches.back()->values.size() >= max_batch_size) {
+      push->batches.emplace_back(new Push::Batch);
+    }
+    Push::Batch* const batch(push->batches.back().get());
+    AddTimeseries(m, name, label_values, value, push->time,
+                  &batch->timeseries);
+    batch->values.emplace(std::move(key), value);
+  };
 
   const std::set<const Metric*> metrics(Registry::Instance()->GetMetrics());
-  JsonArray timeseries;
-  for (auto& m : metrics) {
-    CHECK_NOTNULL(m);
-    for (auto& p : m->CurrentValues()) {
-      JsonObject labels;
-      for (size_t i(0); i < p.first.size(); ++i) {
-        AddLabel(m->LabelName(i), p.first[i], &labels);
+  {
+    lock_guard<mutex> lock(lock_);
+    for (auto& m : metrics) {
+      CHECK_NOTNULL(m);
+      if (m->Type() == Metric::HISTOGRAM) {
+        for (auto& p : m->CurrentDistributions()) {
+          for (const auto& series : kHistogramSeries) {
+            add_series(*m, m->Name() + series.suffix, p.first,
+                       series.value(p.second));
+          }
+        }
+        continue;
+      }
+      for (auto& p : m->CurrentValues()) {
+        add_series(*m, m->Name(), p.first, p.second.second);
       }
-
-      JsonObject desc;
-      desc.Add("labels", labels);
-      desc.Add("metric", kCloudPrefix + m->Name());
-
-      JsonObject ts;
-      ts.Add("timeseriesDesc", desc);
-
-      JsonObject point;
-      // According to
-      // https://cloud.google.com/monitoring/v2beta2/timeseries/write
-      // GAUGE types should have a zero size timerange here
-      // Which implies we need to use the current time rather than the time the
-      // value was set because there's a [short ~5m] horizon over which GCM
-      // won't accept samples.
-      const auto now(system_clock::now());
-      point.Add("start", RFC3339Time(now));
-      point.Add("end", RFC3339Time(now));
-      point.Add("doubleValue", p.second.second);
-      ts.Add("point", point);
-
-      timeseries.Add(&ts);
     }
+    push->remaining = push->batches.size();
   }
-  metric_write.Add("timeseries", timeseries);
 
-  UrlFetcher::Request req(
-      (URL(FLAGS_google_compute_monitoring_base_url + "/timeseries:write")));
-  req.verb = UrlFetcher::Verb::POST;
-  req.headers.insert(make_pair("Content-Type", "application/json"));
-  req.headers.insert(make_pair("Authorization", "Bearer " + bearer_token_));
-  req.body = metric_write.ToString();
-
-  UrlFetcher::Response* resp(new UrlFetcher::Response);
-  VLOG(1) << "Pushing metrics...";
-  VLOG(2) << req.body;
-  fetcher_->Fetch(req, resp,
-                  task_.task()->AddChild(
-                      bind(&GCMExporter::PushMetricsDone, this, resp, _1)));
+  if (push->batches.empty()) {
+    VLOG(1) << "No metric values to push.";
+    executor_->Delay(
+        seconds(FLAGS_google_compute_monitoring_push_interval_seconds),
+        task_.task()->AddChild(bind(&GCMExporter::PushMetrics, this)));
+    return;
+  }
+
+  JsonObject common_labels;
+  AddLabel("instance", instance_name_, &common_labels);
+
+  VLOG(1) << "Pushing metrics in " << push->batches.size() << " requests...";
+  for (size_t i = 0; i < push->batches.size(); ++i) {
+    JsonObject metric_write;
+    metric_write.Add("kind", "cloudmonitoring#writeTimeseriesRequest");
+    metric_write.Add("commonLabels", common_labels);
+    metric_write.Add("timeseries", push->batches[i]->timeseries);
+
+    UrlFetcher::Request req(
+        (URL(FLAGS_google_compute_monitoring_base_url + "/timeseries:write")));
+    req.verb = UrlFetcher::Verb::POST;
+    req.headers.insert(make_pair("Content-Type", "application/json"));
+    req.headers.insert(make_pair("Authorization", "Bearer " + bearer_token_));
+    req.body = metric_write.ToString();
+    VLOG(2) << req.body;
+    if (FLAGS_google_compute_monitoring_gzip) {
+      req.headers.insert(make_pair("Content-Encoding", "gzip"));
+      req.body = Gzip(req.body);
+    }
+
+    UrlFetcher::Response* resp(new UrlFetcher::Response);
+    fetcher_->Fetch(req, resp,
+                    task_.task()->AddChild(bind(&GCMExporter::PushMetricsDone,
+                                                this, push, i, resp, _1)));
+  }
 }
 
 
-void GCMExporter::PushMetricsDone(UrlFetcher::Response* resp, Task* task) {
+void GCMExporter::PushMetricsDone(const shared_ptr<Push>& push, size_t batch,
+                                  UrlFetcher::Response* resp, Task* task) {
   unique_ptr<UrlFetcher::Response> resp_deleter(resp);
-  if (!task->status().ok() || resp->status_code != 200) {
+  const bool ok(task->status().ok() && resp->status_code == 200);
+  if (!ok) {
     num_gcm_push_failures->Increment();
     LOG(WARNING) << "Failed to push metrics to GCM, status: " << task->status()
                  << ", reponse code: " << resp->status_code;
   } else {
-    VLOG(1) << "Metrics pushed.";
     VLOG(2) << resp->body;
   }
 
+  {
+    lock_guard<mutex> lock(lock_);
+    // The values of failed requests are sent again with the next push.
+    if (ok) {
+      for (const auto& it : push->batches[batch]->values) {
+        pushed_[it.first] = PushedValue{it.second, push->time};
+      }
+    }
+    if (--push->remaining > 0) {
+      return;
+    }
+  }
+  VLOG(1) << "Done pushing metrics.";
+
   executor_->Delay(
       seconds(FLAGS_google_compute_monitoring_push_interval_seconds),
       task_.task()->AddChild(bind(&GCMExporter::PushMetrics, this)));
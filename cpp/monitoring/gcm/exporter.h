@@ -3,8 +3,13 @@
 
 #include <chrono>
 #include <condition_variable>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <thread>
+#include <utility>
+#include <vector>
 
 #include "net/url_fetcher.h"
 #include "util/executor.h"
@@ -13,6 +18,20 @@
 namespace cert_trans {
 
 
+// Pushes the values of the metrics of the registry to GCM, every
+// --google_compute_monitoring_push_interval_seconds.
+//
+// Only the series whose values changed since they were last pushed are
+// sent, but for those left unchanged for
+// --google_compute_monitoring_resend_interval_seconds, which are sent
+// again so that GCM does not think them gone. Large pushes are split
+// into requests of up to --google_compute_monitoring_max_series_per_request
+// series, sent all at once, and compressed unless
+// --google_compute_monitoring_gzip is false.
+//
+// All the work is done on |executor|, which had better not be one that
+// serves requests. It must have more than one thread, as creating the
+// metrics blocks one while waiting for GCM.
 class GCMExporter {
  public:
   GCMExporter(const std::string& instance_name, UrlFetcher* fetcher,
@@ -25,8 +44,18 @@ class GCMExporter {
 
   void CreateMetrics();
 
+  // The value last pushed for a series, and when.
+  struct PushedValue {
+    double value;
+    std::chrono::system_clock::time_point pushed_at;
+  };
+  // Series are keyed by their GCM metric name and label values.
+  typedef std::pair<std::string, std::vector<std::string>> SeriesKey;
+  struct Push;
+
   void PushMetrics();
-  void PushMetricsDone(UrlFetcher::Response* resp, util::Task* task);
+  void PushMetricsDone(const std::shared_ptr<Push>& push, size_t batch,
+                       UrlFetcher::Response* resp, util::Task* task);
 
   const std::string instance_name_;
   UrlFetcher* const fetcher_;
@@ -36,6 +65,9 @@ class GCMExporter {
   std::chrono::system_clock::time_point token_refreshed_at_;
   std::string bearer_token_;
 
+  std::mutex lock_;
+  std::map<SeriesKey, PushedValue> pushed_;
+
   friend class GCMExporterTest;
 };
 
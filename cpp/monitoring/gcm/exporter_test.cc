@@ -3,7 +3,10 @@
 #include <glog/logging.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
+#include <string.h>
+#include <zlib.h>
 #include <memory>
+#include <mutex>
 
 #include "monitoring/monitoring.h"
 #include "net/mock_url_fetcher.h"
@@ -13,7 +16,10 @@
 
 DECLARE_string(google_compute_metadata_url);
 DECLARE_string(google_compute_monitoring_base_url);
+DECLARE_bool(google_compute_monitoring_gzip);
+DECLARE_int32(google_compute_monitoring_max_series_per_request);
 DECLARE_int32(google_compute_monitoring_push_interval_seconds);
+DECLARE_int32(google_compute_monitoring_resend_interval_seconds);
 DECLARE_string(google_compute_monitoring_service_account);
 DECLARE_int32(google_compute_monitoring_retry_delay_seconds);
 
@@ -49,6 +55,7 @@ using testing::InSequence;
 using testing::Invoke;
 using testing::InvokeWithoutArgs;
 using testing::IsEmpty;
+using testing::Not;
 using util::Status;
 using util::SyncTask;
 using util::Task;
@@ -72,6 +79,28 @@ void HandleFetch(Status status, int status_code,
 }
 
 
+// Decompresses |data| from the gzip format.
+string Gunzip(const string& data) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  CHECK_EQ(Z_OK, inflateInit2(&stream, 15 + 16));
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  string out;
+  int ret;
+  do {
+    char buf[4096];
+    stream.next_out = reinterpret_cast<Bytef*>(buf);
+    stream.avail_out = sizeof(buf);
+    ret = inflate(&stream, Z_NO_FLUSH);
+    CHECK(ret == Z_OK || ret == Z_STREAM_END) << ret;
+    out.append(buf, sizeof(buf) - stream.avail_out);
+  } while (ret != Z_STREAM_END);
+  CHECK_EQ(Z_OK, inflateEnd(&stream));
+  return out;
+}
+
+
 }  // namespace
 
 
@@ -85,6 +114,11 @@ class GCMExporterTest : public ::testing::Test {
     FLAGS_google_compute_monitoring_push_interval_seconds = kPushInterval;
     FLAGS_google_compute_metadata_url = kMetadataUrl;
     FLAGS_google_compute_monitoring_service_account = kServiceAccount;
+    // Unless the tests say otherwise, every push sends all the series in
+    // one readable request.
+    FLAGS_google_compute_monitoring_resend_interval_seconds = 0;
+    FLAGS_google_compute_monitoring_max_series_per_request = 1000000;
+    FLAGS_google_compute_monitoring_gzip = false;
 
     ON_CALL(fetcher_, Fetch(_, _, _))
         .WillByDefault(Invoke(bind(&HandleFetch, util::Status::OK, 200,
@@ -100,6 +134,31 @@ class GCMExporterTest : public ::testing::Test {
     return e.token_refreshed_at_.time_since_epoch() > seconds(0);
   }
 
+  // Replies to the requests for the token and to create the metrics.
+  void ExpectSetup() {
+    EXPECT_CALL(
+        fetcher_,
+        Fetch(IsUrlFetchRequest(
+                  UrlFetcher::Verb::GET,
+                  URL(string(kMetadataUrl) + "/" + kServiceAccount + "/token"),
+                  UrlFetcher::Headers{make_pair("Metadata-Flavor", "Google")},
+                  ""),
+              _, _))
+        .WillRepeatedly(
+            Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                        UrlFetcher::Headers{}, kCredentialsJson, _1, _2, _3)));
+    EXPECT_CALL(fetcher_,
+                Fetch(IsUrlFetchRequest(
+                          UrlFetcher::Verb::POST, URL(string(metrics_url_)),
+                          UrlFetcher::Headers{
+                              make_pair("Content-Type", "application/json"),
+                              make_pair("Authorization", "Bearer token")},
+                          _),
+                      _, _))
+        .WillRepeatedly(Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                                    UrlFetcher::Headers{}, "", _1, _2, _3)));
+  }
+
   const string metrics_url_;
   const string push_url_;
   ThreadPool pool_;
@@ -378,6 +437,91 @@ TEST_F(GCMExporterTest, TestRetriesWhenPushingMetricsFails) {
 }
 
 
+TEST_F(GCMExporterTest, TestPushesOnlyChangedValues) {
+  FLAGS_google_compute_monitoring_resend_interval_seconds = 3600;
+  std::unique_ptr<Gauge<>> changing(Gauge<>::New("changing", "help1"));
+  changing->Set(1);
+  std::unique_ptr<Gauge<>> steady(Gauge<>::New("steady", "help2"));
+  steady->Set(2);
+
+  SyncTask sync(&pool_);
+
+  ExpectSetup();
+  {
+    InSequence s;
+    EXPECT_CALL(fetcher_,
+                Fetch(IsUrlFetchRequest(
+                          UrlFetcher::Verb::POST, URL(push_url_), _,
+                          AllOf(HasSubstr("ct\\/changing"),
+                                HasSubstr("ct\\/steady"))),
+                      _, _))
+        .WillOnce(DoAll(InvokeWithoutArgs([&changing] { changing->Set(3); }),
+                        Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                                    UrlFetcher::Headers{}, "", _1, _2, _3))));
+    EXPECT_CALL(fetcher_,
+                Fetch(IsUrlFetchRequest(
+                          UrlFetcher::Verb::POST, URL(push_url_), _,
+                          AllOf(HasSubstr("ct\\/changing"),
+                                Not(HasSubstr("ct\\/steady")))),
+                      _, _))
+        .WillOnce(DoAll(InvokeWithoutArgs([&sync] { sync.task()->Return(); }),
+                        Invoke(bind(&HandleFetch, util::Status::OK, 200,
+                                    UrlFetcher::Headers{}, "", _1, _2, _3))))
+        .RetiresOnSaturation();
+  }
+  GCMExporter exporter("instance", &fetcher_, &pool_);
+  sync.Wait();
+}
+
+
+TEST_F(GCMExporterTest, TestSplitsAndCompressesPushes) {
+  FLAGS_google_compute_monitoring_max_series_per_request = 1;
+  FLAGS_google_compute_monitoring_gzip = true;
+  std::unique_ptr<Counter<>> one(Counter<>::New("one", "help1"));
+  one->Increment();
+  std::unique_ptr<Gauge<>> two(Gauge<>::New("two", "help2"));
+  two->Set(2);
+
+  SyncTask sync(&pool_);
+  std::mutex lock;
+  bool seen_one(false);
+  bool seen_two(false);
+
+  ExpectSetup();
+  EXPECT_CALL(fetcher_,
+              Fetch(IsUrlFetchRequest(
+                        UrlFetcher::Verb::POST, URL(push_url_),
+                        UrlFetcher::Headers{
+                            make_pair("Content-Encoding", "gzip"),
+                            make_pair("Content-Type", "application/json"),
+                            make_pair("Authorization", "Bearer token")},
+                        _),
+                    _, _))
+      .WillRepeatedly(Invoke([&](const UrlFetcher::Request& req,
+                                 UrlFetcher::Response* resp, Task* task) {
+        const string body(Gunzip(req.body));
+        const JsonObject request(body);
+        ASSERT_TRUE(request.Ok());
+        const JsonArray timeseries(request, "timeseries");
+        ASSERT_TRUE(timeseries.Ok());
+        EXPECT_EQ(1, timeseries.Length());
+        {
+          std::lock_guard<std::mutex> guard(lock);
+          const bool done(seen_one && seen_two);
+          seen_one |= body.find("ct\\/one") != string::npos;
+          seen_two |= body.find("ct\\/two") != string::npos;
+          if (!done && seen_one && seen_two) {
+            sync.task()->Return();
+          }
+        }
+        resp->status_code = 200;
+        task->Return();
+      }));
+  GCMExporter exporter("instance", &fetcher_, &pool_);
+  sync.Wait();
+}
+
+
 }  // namespace cert_trans
 
 
@@ -0,0 +1,134 @@
+#include "monitoring/histogram.h"
+
+#include <glog/logging.h>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+using std::chrono::system_clock;
+using std::memory_order_relaxed;
+
+namespace cert_trans {
+namespace {
+
+const int kSubBuckets(4);
+// The upper bound of the last bucket before the one for everything
+// else is 2^kMaxExponent.
+const int kMaxExponent(31);
+
+
+}  // namespace
+
+
+const int HistogramBuckets::kNumBuckets;
+
+
+HistogramBuckets::HistogramBuckets() : sum_(0) {
+  static_assert(kNumBuckets == kMaxExponent * kSubBuckets + 2,
+                "kNumBuckets does not match the bucket layout");
+  for (auto& count : counts_) {
+    count.store(0, memory_order_relaxed);
+  }
+}
+
+
+// static
+double HistogramBuckets::UpperBound(int bucket) {
+  CHECK_GE(bucket, 0);
+  CHECK_LT(bucket, kNumBuckets);
+  if (bucket == kNumBuckets - 1) {
+    return std::numeric_limits<double>::infinity();
+  }
+  if (bucket == 0) {
+    return 1;
+  }
+  const int exponent((bucket - 1) / kSubBuckets);
+  const int sub_bucket((bucket - 1) % kSubBuckets);
+  return std::ldexp(1 + static_cast<double>(sub_bucket + 1) / kSubBuckets,
+                    exponent);
+}
+
+
+// static
+int HistogramBuckets::BucketFor(double value) {
+  // Also catches NaN.
+  if (!(value > 1)) {
+    return 0;
+  }
+  if (value > std::ldexp(1, kMaxExponent)) {
+    return kNumBuckets - 1;
+  }
+
+  // value == mantissa * 2^(exponent + 1), with mantissa in [0.5, 1).
+  int exponent;
+  const double mantissa(std::frexp(value, &exponent) * 2);
+  --exponent;
+  if (mantissa == 1) {
+    // Exact powers of two are the upper bound of the bucket below.
+    return exponent * kSubBuckets;
+  }
+  const int sub_bucket(
+      static_cast<int>(std::ceil((mantissa - 1) * kSubBuckets)) - 1);
+  return 1 + exponent * kSubBuckets + sub_bucket;
+}
+
+
+void HistogramBuckets::Record(double value) {
+  counts_[BucketFor(value)].fetch_add(1, memory_order_relaxed);
+  double sum(sum_.load(memory_order_relaxed));
+  while (!sum_.compare_exchange_weak(sum, sum + value, memory_order_relaxed)) {
+  }
+}
+
+
+Metric::Distribution HistogramBuckets::Get() const {
+  Metric::Distribution ret;
+  Get(&ret);
+  return ret;
+}
+
+
+void HistogramBuckets::Get(Metric::Distribution* distribution) const {
+  CHECK_NOTNULL(distribution);
+  distribution->timestamp = system_clock::now();
+  distribution->count = 0;
+  distribution->sum = sum_.load(memory_order_relaxed);
+  distribution->buckets.resize(kNumBuckets);
+  for (int i = 0; i < kNumBuckets; ++i) {
+    distribution->count += counts_[i].load(memory_order_relaxed);
+    distribution->buckets[i] =
+        std::make_pair(UpperBound(i), distribution->count);
+  }
+}
+
+
+double EstimateQuantile(const Metric::Distribution& distribution,
+                        double quantile) {
+  if (distribution.count == 0) {
+    return 0;
+  }
+
+  const double rank(std::min(std::max(quantile, 0.0), 1.0) *
+                    distribution.count);
+  double lower_bound(0);
+  uint64_t lower_count(0);
+  for (const auto& bucket : distribution.buckets) {
+    if (bucket.second >= rank && bucket.second > lower_count) {
+      if (std::isinf(bucket.first)) {
+        // Nothing to interpolate with, this is as good as it gets.
+        return lower_bound;
+      }
+      return lower_bound +
+             (bucket.first - lower_bound) * (rank - lower_count) /
+                 (bucket.second - lower_count);
+    }
+    lower_bound = bucket.first;
+    lower_count = bucket.second;
+  }
+
+  LOG(DFATAL) << "Buckets do not add up to the count of samples.";
+  return lower_bound;
+}
+
+
+}  // namespace cert_trans
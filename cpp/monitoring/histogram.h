@@ -0,0 +1,195 @@
+#ifndef CERT_TRANS_MONITORING_HISTOGRAM_H_
+#define CERT_TRANS_MONITORING_HISTOGRAM_H_
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "monitoring/labelled_values.h"
+#include "monitoring/metric.h"
+
+namespace cert_trans {
+
+
+// The counts of the samples of one set of labels of a Histogram<>,
+// in fixed log-linear buckets: the first bucket holds the samples up
+// to 1, then each power of two is split in 4 buckets of equal width,
+// up to 2^31, and the last bucket holds everything above that.
+//
+// Record() does not take any lock, so that it can be called on hot
+// paths.
+class HistogramBuckets {
+ public:
+  static const int kNumBuckets = 126;
+
+  HistogramBuckets();
+
+  // The inclusive upper bound of |bucket|, which is infinity for the
+  // last one.
+  static double UpperBound(int bucket);
+
+  // The bucket that |value| goes in.
+  static int BucketFor(double value);
+
+  void Record(double value);
+
+  Metric::Distribution Get() const;
+
+  // As Get(), but reusing the storage of |distribution|.
+  void Get(Metric::Distribution* distribution) const;
+
+ private:
+  std::atomic<uint64_t> counts_[kNumBuckets];
+  std::atomic<double> sum_;
+
+  DISALLOW_COPY_AND_ASSIGN(HistogramBuckets);
+};
+
+
+// Estimates the |quantile| (between 0 and 1) of |distribution| by
+// interpolating within the bucket it falls in. Returns 0 if there are
+// no samples.
+double EstimateQuantile(const Metric::Distribution& distribution,
+                        double quantile);
+
+
+// A metric recording the distribution of the values of samples (e.g.
+// request latencies), so that their quantiles can be worked out.
+template <class... LabelTypes>
+class Histogram : public Metric {
+ public:
+  static Histogram<LabelTypes...>* New(
+      const std::string& name,
+      const typename NameType<LabelTypes>::name&... label_names,
+      const std::string& help);
+
+  void Record(const LabelTypes&... labels, double value);
+
+  // The buckets for |labels|, which stay valid for as long as this
+  // Histogram. Holding on to them saves looking up |labels| for every
+  // sample.
+  HistogramBuckets* Buckets(const LabelTypes&... labels);
+
+  Metric::Distribution Get(const LabelTypes&... labels) const;
+
+  // The number of samples for each set of labels.
+  std::map<std::vector<std::string>, Metric::TimestampedValue> CurrentValues()
+      const override;
+
+  std::map<std::vector<std::string>, Metric::Distribution>
+  CurrentDistributions() const override;
+
+  void ForEachValue(const ValueCallback& callback) const override;
+
+  void ForEachDistribution(
+      const DistributionCallback& callback) const override;
+
+ private:
+  Histogram(const std::string& name,
+            const typename NameType<LabelTypes>::name&... label_names,
+            const std::string& help);
+
+  LabelIndex<HistogramBuckets, LabelTypes...> buckets_;
+
+  DISALLOW_COPY_AND_ASSIGN(Histogram);
+};
+
+
+// static
+template <class... LabelTypes>
+Histogram<LabelTypes...>* Histogram<LabelTypes...>::New(
+    const std::string& name,
+    const typename NameType<LabelTypes>::name&... label_names,
+    const std::string& help) {
+  return new Histogram(name, label_names..., help);
+}
+
+
+template <class... LabelTypes>
+Histogram<LabelTypes...>::Histogram(
+    const std::string& name,
+    const typename NameType<LabelTypes>::name&... label_names,
+    const std::string& help)
+    : Metric(HISTOGRAM, name, {label_names...}, help) {
+}
+
+
+template <class... LabelTypes>
+void Histogram<LabelTypes...>::Record(const LabelTypes&... labels,
+                                      double value) {
+  Buckets(labels...)->Record(value);
+}
+
+
+template <class... LabelTypes>
+HistogramBuckets* Histogram<LabelTypes...>::Buckets(
+    const LabelTypes&... labels) {
+  return buckets_.FindOrAdd(labels...);
+}
+
+
+template <class... LabelTypes>
+Metric::Distribution Histogram<LabelTypes...>::Get(
+    const LabelTypes&... labels) const {
+  const HistogramBuckets* const buckets(buckets_.Find(labels...));
+  return buckets ? buckets->Get() : HistogramBuckets().Get();
+}
+
+
+template <class... LabelTypes>
+std::map<std::vector<std::string>, Metric::TimestampedValue>
+Histogram<LabelTypes...>::CurrentValues() const {
+  std::map<std::vector<std::string>, Metric::TimestampedValue> ret;
+  ForEachValue([&ret](const std::vector<std::string>& label_values,
+                      const Metric::TimestampedValue& value) {
+    ret[label_values] = value;
+  });
+  return ret;
+}
+
+
+template <class... LabelTypes>
+std::map<std::vector<std::string>, Metric::Distribution>
+Histogram<LabelTypes...>::CurrentDistributions() const {
+  std::map<std::vector<std::string>, Metric::Distribution> ret;
+  ForEachDistribution([&ret](const std::vector<std::string>& label_values,
+                             const Metric::Distribution& distribution) {
+    ret[label_values] = distribution;
+  });
+  return ret;
+}
+
+
+template <class... LabelTypes>
+void Histogram<LabelTypes...>::ForEachValue(
+    const ValueCallback& callback) const {
+  ForEachDistribution([&callback](
+      const std::vector<std::string>& label_values,
+      const Metric::Distribution& distribution) {
+    callback(label_values,
+             std::make_pair(distribution.timestamp, distribution.count));
+  });
+}
+
+
+template <class... LabelTypes>
+void Histogram<LabelTypes...>::ForEachDistribution(
+    const DistributionCallback& callback) const {
+  // Shared by all the labels, to save allocating the buckets each time.
+  Metric::Distribution distribution;
+  buckets_.ForEach([&callback, &distribution](
+      const std::vector<std::string>& label_values,
+      const HistogramBuckets& buckets) {
+    buckets.Get(&distribution);
+    callback(label_values, distribution);
+  });
+}
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MONITORING_HISTOGRAM_H_
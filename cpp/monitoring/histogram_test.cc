@@ -0,0 +1,143 @@
+#include "monitoring/histogram.h"
+
+#include <glog/logging.h>
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <set>
+
+#include "monitoring/latency.h"
+#include "monitoring/registry.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+
+using std::chrono::milliseconds;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using testing::ElementsAre;
+
+
+class HistogramTest : public ::testing::Test {
+ public:
+  void TearDown() {
+    Registry::Instance()->ResetForTestingOnly();
+  }
+};
+
+
+TEST_F(HistogramTest, TestBucketBounds) {
+  EXPECT_EQ(0, HistogramBuckets::BucketFor(-1));
+  EXPECT_EQ(0, HistogramBuckets::BucketFor(0));
+  EXPECT_EQ(0, HistogramBuckets::BucketFor(1));
+  EXPECT_EQ(1, HistogramBuckets::BucketFor(1.1));
+  EXPECT_EQ(1.25, HistogramBuckets::UpperBound(1));
+  EXPECT_EQ(2, HistogramBuckets::UpperBound(4));
+  EXPECT_EQ(2.5, HistogramBuckets::UpperBound(5));
+  EXPECT_TRUE(std::isinf(
+      HistogramBuckets::UpperBound(HistogramBuckets::kNumBuckets - 1)));
+
+  for (int i = 0; i < HistogramBuckets::kNumBuckets - 1; ++i) {
+    const double bound(HistogramBuckets::UpperBound(i));
+    EXPECT_LT(bound, HistogramBuckets::UpperBound(i + 1));
+    // The upper bounds are inclusive.
+    EXPECT_EQ(i, HistogramBuckets::BucketFor(bound));
+    EXPECT_EQ(i + 1, HistogramBuckets::BucketFor(std::nextafter(
+                         bound, std::numeric_limits<double>::infinity())));
+  }
+  EXPECT_EQ(HistogramBuckets::kNumBuckets - 1,
+            HistogramBuckets::BucketFor(
+                std::numeric_limits<double>::infinity()));
+}
+
+
+TEST_F(HistogramTest, TestRecord) {
+  unique_ptr<Histogram<string>> histogram(
+      Histogram<string>::New("name", "label", "help"));
+  EXPECT_EQ(Metric::HISTOGRAM, histogram->Type());
+  histogram->Record("one", 1);
+  histogram->Record("one", 3);
+  histogram->Record("one", 3);
+  histogram->Record("two", 1000);
+
+  const Metric::Distribution one(histogram->Get("one"));
+  EXPECT_EQ(static_cast<uint64_t>(3), one.count);
+  EXPECT_EQ(7, one.sum);
+  ASSERT_EQ(static_cast<size_t>(HistogramBuckets::kNumBuckets),
+            one.buckets.size());
+  EXPECT_EQ(std::make_pair(1.0, static_cast<uint64_t>(1)), one.buckets[0]);
+  EXPECT_EQ(static_cast<uint64_t>(1),
+            one.buckets[HistogramBuckets::BucketFor(3) - 1].second);
+  EXPECT_EQ(static_cast<uint64_t>(3),
+            one.buckets[HistogramBuckets::BucketFor(3)].second);
+  EXPECT_EQ(static_cast<uint64_t>(3), one.buckets.back().second);
+
+  EXPECT_EQ(static_cast<uint64_t>(0), histogram->Get("three").count);
+
+  const auto values(histogram->CurrentValues());
+  ASSERT_EQ(static_cast<size_t>(2), values.size());
+  EXPECT_EQ(3, values.at(vector<string>{"one"}).second);
+  EXPECT_EQ(1, values.at(vector<string>{"two"}).second);
+  EXPECT_EQ(static_cast<size_t>(2), histogram->CurrentDistributions().size());
+}
+
+
+TEST_F(HistogramTest, TestEstimateQuantile) {
+  unique_ptr<Histogram<>> histogram(Histogram<>::New("name", "help"));
+  EXPECT_EQ(0, EstimateQuantile(histogram->Get(), 0.5));
+
+  for (int i = 1; i <= 1000; ++i) {
+    histogram->Record(i);
+  }
+  const Metric::Distribution distribution(histogram->Get());
+  // Within the width of the buckets, which is an eighth of their
+  // upper bound at most.
+  EXPECT_NEAR(500, EstimateQuantile(distribution, 0.5), 500 / 8);
+  EXPECT_NEAR(990, EstimateQuantile(distribution, 0.99), 990 / 8);
+  EXPECT_LE(1000, EstimateQuantile(distribution, 1));
+  EXPECT_GE(1024, EstimateQuantile(distribution, 1));
+}
+
+
+TEST_F(HistogramTest, TestEstimateQuantileOverflow) {
+  unique_ptr<Histogram<>> histogram(Histogram<>::New("name", "help"));
+  histogram->Record(std::ldexp(1, 40));
+  EXPECT_EQ(std::ldexp(1, 31), EstimateQuantile(histogram->Get(), 0.99));
+}
+
+
+TEST_F(HistogramTest, TestLatency) {
+  Latency<milliseconds, string> latency("latency", "op", "help");
+  latency.RecordLatency("one", milliseconds(10));
+  {
+    ScopedLatency scoped(latency.GetScopedLatency("two"));
+    ScopedLatency moved(std::move(scoped));
+  }
+
+  const std::set<const Metric*> metrics(Registry::Instance()->GetMetrics());
+  ASSERT_EQ(static_cast<size_t>(1), metrics.size());
+  const Metric* const metric(*metrics.begin());
+  EXPECT_EQ("latency", metric->Name());
+  EXPECT_THAT(metric->LabelNames(), ElementsAre("op"));
+
+  const auto distributions(metric->CurrentDistributions());
+  ASSERT_EQ(static_cast<size_t>(2), distributions.size());
+  const Metric::Distribution& one(distributions.at(vector<string>{"one"}));
+  EXPECT_EQ(static_cast<uint64_t>(1), one.count);
+  EXPECT_EQ(10, one.sum);
+  // Only recorded once, even though it was moved.
+  EXPECT_EQ(static_cast<uint64_t>(1),
+            distributions.at(vector<string>{"two"}).count);
+}
+
+
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,99 @@
+#include "config.h"
+#include "monitoring/labelled_values.h"
+
+#include <algorithm>
+
+using std::atomic;
+using std::chrono::system_clock;
+using std::make_pair;
+using std::memory_order_relaxed;
+
+namespace cert_trans {
+namespace {
+
+// The shard of the calling thread, plus one, or zero if it has not
+// been picked yet.
+#ifdef HAVE_THREAD_LOCAL
+thread_local int thread_shard = 0;
+#elif HAVE___THREAD
+__thread int thread_shard = 0;
+#else
+#error No suitable thread local storage available
+#endif
+
+atomic<int> next_shard(0);
+
+
+int64_t Now() {
+  return system_clock::now().time_since_epoch().count();
+}
+
+
+}  // namespace
+
+
+const int ShardedValue::kNumShards;
+const int ShardedValue::kCacheLineSize;
+
+
+ShardedValue::ShardedValue() {
+  static_assert(sizeof(Shard) == kCacheLineSize,
+                "shards should take a cache line each");
+  for (auto& shard : shards_) {
+    shard.value.store(0, memory_order_relaxed);
+    shard.updated.store(0, memory_order_relaxed);
+  }
+}
+
+
+double ShardedValue::Get() const {
+  double ret(0);
+  for (const auto& shard : shards_) {
+    ret += shard.value.load(memory_order_relaxed);
+  }
+  return ret;
+}
+
+
+Metric::TimestampedValue ShardedValue::GetTimestamped() const {
+  int64_t updated(0);
+  for (const auto& shard : shards_) {
+    updated = std::max(updated, shard.updated.load(memory_order_relaxed));
+  }
+  return make_pair(system_clock::time_point(system_clock::duration(updated)),
+                   Get());
+}
+
+
+void ShardedValue::Set(double value) {
+  for (int i = 1; i < kNumShards; ++i) {
+    shards_[i].value.store(0, memory_order_relaxed);
+  }
+  shards_[0].value.store(value, memory_order_relaxed);
+  shards_[0].updated.store(Now(), memory_order_relaxed);
+}
+
+
+void ShardedValue::IncrementBy(double amount) {
+  Shard* const shard(&shards_[ThreadShard()]);
+  double value(shard->value.load(memory_order_relaxed));
+  while (!shard->value.compare_exchange_weak(value, value + amount,
+                                             memory_order_relaxed)) {
+  }
+  shard->updated.store(Now(), memory_order_relaxed);
+}
+
+
+// static
+int ShardedValue::ThreadShard() {
+  if (thread_shard == 0) {
+    // Threads are spread evenly over the shards, in the order they
+    // first update a value.
+    thread_shard = next_shard.fetch_add(1, memory_order_relaxed) % kNumShards +
+                   1;
+  }
+  return thread_shard - 1;
+}
+
+
+}  // namespace cert_trans
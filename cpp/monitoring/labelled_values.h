@@ -2,15 +2,162 @@
 #define CERT_TRANS_MONITORING_LABELLED_VALUES_H_
 
 #include <glog/logging.h>
+#include <stdint.h>
+#include <atomic>
 #include <chrono>
+#include <functional>
 #include <map>
+#include <memory>
 #include <mutex>
+#include <sstream>
+#include <tuple>
+#include <vector>
 
 #include "monitoring/metric.h"
 
 namespace cert_trans {
 
 
+namespace {
+
+
+template <std::size_t>
+struct i__ {};
+
+
+template <class Tuple>
+void label_values(const Tuple&, std::vector<std::string>*, i__<0>) {
+}
+
+
+template <class Tuple, size_t Pos>
+void label_values(const Tuple& t, std::vector<std::string>* values, i__<Pos>) {
+  std::ostringstream oss;
+  oss << std::get<std::tuple_size<Tuple>::value - Pos>(t);
+  CHECK_NOTNULL(values)->push_back(oss.str());
+  label_values(t, values, i__<Pos - 1>());
+}
+
+
+template <class... Types>
+std::vector<std::string> label_values(const std::tuple<Types...>& t) {
+  std::vector<std::string> ret;
+  label_values(t, &ret, i__<sizeof...(Types)>());
+  return ret;
+}
+
+
+inline size_t hash_labels() {
+  return 0;
+}
+
+
+template <class T, class... Rest>
+size_t hash_labels(const T& label, const Rest&... rest) {
+  const size_t hash(hash_labels(rest...));
+  // As boost::hash_combine does.
+  return hash ^ (std::hash<T>()(label) + 0x9e3779b9 + (hash << 6) +
+                 (hash >> 2));
+}
+
+
+}  // namespace
+
+
+// An append-only index of values of type |T| by labels. Looking up
+// labels that were already added does not take a lock, nor does it
+// copy the labels; the values stay where they are for as long as the
+// index exists. The labels are also kept as strings, made once when
+// they are added, for exporting.
+template <class T, class... LabelTypes>
+class LabelIndex {
+ public:
+  LabelIndex();
+
+  // Returns nullptr if |labels| have not been added.
+  T* Find(const LabelTypes&... labels) const;
+
+  // Adds a default constructed value for |labels| if there is none.
+  T* FindOrAdd(const LabelTypes&... labels);
+
+  // Calls |f| with the label values, as strings, and value of each
+  // entry, in no particular order. This does not take a lock either,
+  // and misses entries added meanwhile.
+  template <class F>
+  void ForEach(const F& f) const;
+
+ private:
+  struct Node {
+    Node(const LabelTypes&... labels, size_t hash, Node* next)
+        : labels_(labels...),
+          label_values_(label_values(labels_)),
+          hash_(hash),
+          next_(next) {
+    }
+
+    const std::tuple<LabelTypes...> labels_;
+    const std::vector<std::string> label_values_;
+    const size_t hash_;
+    Node* const next_;
+    T value_;
+  };
+
+  static const size_t kNumBuckets = 64;
+
+  Node* FindNode(size_t hash, const LabelTypes&... labels) const;
+
+  // Held when adding nodes.
+  mutable std::mutex mutex_;
+  // Chains of nodes, which are only ever added at the head.
+  std::atomic<Node*> buckets_[kNumBuckets];
+  std::vector<std::unique_ptr<Node>> nodes_;
+
+  DISALLOW_COPY_AND_ASSIGN(LabelIndex);
+};
+
+
+// A value accumulated in shards, so that threads updating it at the
+// same time do not contend on the same cache line. The shards are only
+// added up when the value is read.
+class ShardedValue {
+ public:
+  ShardedValue();
+
+  // Returns the sum of the shards.
+  double Get() const;
+
+  // Returns the sum of the shards, along with the latest time any of
+  // them was updated.
+  Metric::TimestampedValue GetTimestamped() const;
+
+  // This is not atomic with respect to concurrent calls to
+  // IncrementBy(), which might or might not be included in the new
+  // value.
+  void Set(double value);
+
+  void IncrementBy(double amount);
+
+ private:
+  static const int kNumShards = 16;
+  static const int kCacheLineSize = 64;
+
+  struct Shard {
+    std::atomic<double> value;
+    // In system_clock::duration units since the system_clock epoch.
+    std::atomic<int64_t> updated;
+    char padding[kCacheLineSize - sizeof(std::atomic<double>) -
+                 sizeof(std::atomic<int64_t>)];
+  };
+
+  // The shard the calling thread updates.
+  static int ThreadShard();
+
+  Shard shards_[kNumShards];
+
+  DISALLOW_COPY_AND_ASSIGN(ShardedValue);
+};
+
+
 template <class... LabelTypes>
 class LabelledValues {
  public:
@@ -28,47 +175,79 @@ class LabelledValues {
   std::map<std::vector<std::string>, Metric::TimestampedValue> CurrentValues()
       const;
 
+  void ForEachValue(const Metric::ValueCallback& callback) const;
+
  private:
   const std::string name_;
   const std::vector<std::string> label_names_;
-  mutable std::mutex mutex_;
-  std::map<std::tuple<LabelTypes...>,
-           std::pair<std::chrono::system_clock::time_point, double>> values_;
+  LabelIndex<ShardedValue, LabelTypes...> values_;
 
   DISALLOW_COPY_AND_ASSIGN(LabelledValues);
 };
 
 
-namespace {
-
-
-template <std::size_t>
-struct i__ {};
+template <class T, class... LabelTypes>
+LabelIndex<T, LabelTypes...>::LabelIndex() {
+  for (auto& bucket : buckets_) {
+    bucket.store(nullptr, std::memory_order_relaxed);
+  }
+}
 
 
-template <class Tuple>
-void label_values(const Tuple&, std::vector<std::string>*, i__<0>) {
+template <class T, class... LabelTypes>
+T* LabelIndex<T, LabelTypes...>::Find(const LabelTypes&... labels) const {
+  Node* const node(FindNode(hash_labels(labels...), labels...));
+  return node ? &node->value_ : nullptr;
 }
 
 
-template <class Tuple, size_t Pos>
-void label_values(const Tuple& t, std::vector<std::string>* values, i__<Pos>) {
-  std::ostringstream oss;
-  oss << std::get<std::tuple_size<Tuple>::value - Pos>(t);
-  CHECK_NOTNULL(values)->push_back(oss.str());
-  label_values(t, values, i__<Pos - 1>());
+template <class T, class... LabelTypes>
+T* LabelIndex<T, LabelTypes...>::FindOrAdd(const LabelTypes&... labels) {
+  const size_t hash(hash_labels(labels...));
+  Node* node(FindNode(hash, labels...));
+  if (node) {
+    return &node->value_;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Someone else might have added it in the meantime.
+  node = FindNode(hash, labels...);
+  if (!node) {
+    std::atomic<Node*>& bucket(buckets_[hash % kNumBuckets]);
+    nodes_.emplace_back(
+        new Node(labels..., hash, bucket.load(std::memory_order_relaxed)));
+    node = nodes_.back().get();
+    bucket.store(node, std::memory_order_release);
+  }
+  return &node->value_;
 }
 
 
-template <class... Types>
-std::vector<std::string> label_values(const std::tuple<Types...>& t) {
-  std::vector<std::string> ret;
-  label_values(t, &ret, i__<sizeof...(Types)>());
-  return ret;
+template <class T, class... LabelTypes>
+template <class F>
+void LabelIndex<T, LabelTypes...>::ForEach(const F& f) const {
+  for (const auto& bucket : buckets_) {
+    for (const Node* node = bucket.load(std::memory_order_acquire); node;
+         node = node->next_) {
+      f(node->label_values_, node->value_);
+    }
+  }
 }
 
 
-}  // namespace
+template <class T, class... LabelTypes>
+typename LabelIndex<T, LabelTypes...>::Node*
+LabelIndex<T, LabelTypes...>::FindNode(size_t hash,
+                                       const LabelTypes&... labels) const {
+  for (Node* node = buckets_[hash % kNumBuckets].load(
+           std::memory_order_acquire);
+       node; node = node->next_) {
+    if (node->hash_ == hash && node->labels_ == std::tie(labels...)) {
+      return node;
+    }
+  }
+  return nullptr;
+}
 
 
 template <class... LabelTypes>
@@ -81,22 +260,15 @@ LabelledValues<LabelTypes...>::LabelledValues(
 
 template <class... LabelTypes>
 double LabelledValues<LabelTypes...>::Get(const LabelTypes&... labels) const {
-  std::lock_guard<std::mutex> lock(mutex_);
-  const std::tuple<LabelTypes...> key(labels...);
-  const auto it(values_.find(key));
-  if (it == values_.end()) {
-    return 0;
-  }
-  return it->second.second;
+  const ShardedValue* const value(values_.Find(labels...));
+  return value ? value->Get() : 0;
 }
 
 
 template <class... LabelTypes>
 void LabelledValues<LabelTypes...>::Set(const LabelTypes&... labels,
                                         double value) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  values_[std::tuple<LabelTypes...>(labels...)] =
-      make_pair(std::chrono::system_clock::now(), value);
+  values_.FindOrAdd(labels...)->Set(value);
 }
 
 
@@ -109,31 +281,32 @@ void LabelledValues<LabelTypes...>::Increment(const LabelTypes&... labels) {
 template <class... LabelTypes>
 void LabelledValues<LabelTypes...>::IncrementBy(const LabelTypes&... labels,
                                                 double amount) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  const std::tuple<LabelTypes...> key(labels...);
-  const auto it(values_.find(key));
-  if (it == values_.end()) {
-    values_[key] = make_pair(std::chrono::system_clock::now(), amount);
-    return;
-  }
-  values_[key] = make_pair(std::chrono::system_clock::now(),
-                           values_[key].second + amount);
+  values_.FindOrAdd(labels...)->IncrementBy(amount);
 }
 
 
 template <class... LabelTypes>
 std::map<std::vector<std::string>, Metric::TimestampedValue>
 LabelledValues<LabelTypes...>::CurrentValues() const {
-  std::lock_guard<std::mutex> lock(mutex_);
   std::map<std::vector<std::string>, Metric::TimestampedValue> ret;
-
-  for (const auto& v : values_) {
-    ret[label_values(v.first)] = v.second;
-  }
+  ForEachValue([&ret](const std::vector<std::string>& label_values,
+                      const Metric::TimestampedValue& value) {
+    ret[label_values] = value;
+  });
   return ret;
 }
 
 
+template <class... LabelTypes>
+void LabelledValues<LabelTypes...>::ForEachValue(
+    const Metric::ValueCallback& callback) const {
+  values_.ForEach([&callback](const std::vector<std::string>& label_values,
+                              const ShardedValue& value) {
+    callback(label_values, value.GetTimestamped());
+  });
+}
+
+
 }  // namespace cert_trans
 
 #endif  // CERT_TRANS_MONITORING_LABELLED_VALUES_H_
@@ -1,11 +1,12 @@
 #ifndef CERT_TRANS_MONITORING_LATENCY_H_
 #define CERT_TRANS_MONITORING_LATENCY_H_
 
+#include <chrono>
+#include <memory>
 #include <string>
 
 #include "base/macros.h"
-#include "monitoring/counter.h"
-#include "monitoring/event_metric.h"
+#include "monitoring/histogram.h"
 #include "monitoring/monitoring.h"
 
 namespace cert_trans {
@@ -14,10 +15,9 @@ class ScopedLatency;
 
 
 // A helper class for monitoring latency.
-// This class creates two Counter metrics, one called "|base_name|_overall_sum"
-// which contains the sum of all latencies broken down by labels, and another
-// called "|base_name|_count" which contains the number of latency measurements
-// taken, also broken down by labels.
+// This class creates a Histogram metric called |base_name|, which contains
+// the distribution of the latencies broken down by labels (and, with it, their
+// sum and the number of latency measurements taken).
 //
 // To actually measure latency, you can either call RecordLatency() directly
 // with a latency sample, or use the ScopedLatency() method to return an object
@@ -26,7 +26,7 @@ class ScopedLatency;
 // returned object.
 //
 // The |TimeUnit| template parameter is used to specify the unit of the values
-// added to the counter, e.g. specifying std::chrono::milliseconds will
+// added to the histogram, e.g. specifying std::chrono::milliseconds will
 // duration_cast all recorded latencies to milliseconds before adding to the
 // total count.
 //
@@ -66,7 +66,9 @@ class Latency {
   ScopedLatency GetScopedLatency(const LabelTypes&... labels);
 
  private:
-  EventMetric<LabelTypes...> metric_;
+  static double ToTimeUnit(std::chrono::duration<double> latency);
+
+  const std::unique_ptr<Histogram<LabelTypes...>> histogram_;
 
   DISALLOW_COPY_AND_ASSIGN(Latency);
 };
@@ -75,22 +77,34 @@ class Latency {
 // Helper class to automatically calculate and record latency.
 // Measures the duration between its construction and destruction times, and
 // automatically registers that with the Latency<> class which created it.
+// The labels are looked up on construction, so that recording the latency
+// only takes a few atomic operations.
 class ScopedLatency {
  public:
-  ScopedLatency(ScopedLatency&& other) = default;
+  ScopedLatency(ScopedLatency&& other)
+      : buckets_(other.buckets_),
+        to_time_unit_(other.to_time_unit_),
+        start_(other.start_) {
+    other.buckets_ = nullptr;
+  }
 
   ~ScopedLatency() {
-    record_latency_(std::chrono::steady_clock::now() - start_);
+    if (buckets_) {
+      buckets_->Record(
+          to_time_unit_(std::chrono::steady_clock::now() - start_));
+    }
   }
 
  private:
-  ScopedLatency(
-      const std::function<void(std::chrono::duration<double>)>& record_latency)
-      : record_latency_(record_latency),
+  ScopedLatency(HistogramBuckets* buckets,
+                double (*to_time_unit)(std::chrono::duration<double>))
+      : buckets_(buckets),
+        to_time_unit_(to_time_unit),
         start_(std::chrono::steady_clock::now()) {
   }
 
-  const std::function<void(std::chrono::duration<double>)> record_latency_;
+  HistogramBuckets* buckets_;
+  double (*const to_time_unit_)(std::chrono::duration<double>);
   const std::chrono::steady_clock::time_point start_;
 
   template <class TimeUnit, class... LabelTypes>
@@ -105,15 +119,23 @@ Latency<TimeUnit, LabelTypes...>::Latency(
     const std::string& base_name,
     const typename NameType<LabelTypes>::name&... label_names,
     const std::string& help)
-    : metric_(base_name, label_names..., help) {
+    : histogram_(Histogram<LabelTypes...>::New(base_name, label_names...,
+                                               help)) {
+}
+
+
+// static
+template <class TimeUnit, class... LabelTypes>
+double Latency<TimeUnit, LabelTypes...>::ToTimeUnit(
+    std::chrono::duration<double> latency) {
+  return std::chrono::duration_cast<TimeUnit>(latency).count();
 }
 
 
 template <class TimeUnit, class... LabelTypes>
 void Latency<TimeUnit, LabelTypes...>::RecordLatency(
     const LabelTypes&... labels, std::chrono::duration<double> latency) {
-  metric_.RecordEvent(labels...,
-                      std::chrono::duration_cast<TimeUnit>(latency).count());
+  histogram_->Record(labels..., ToTimeUnit(latency));
 }
 
 
@@ -121,8 +143,8 @@ template <class TimeUnit, class... LabelTypes>
 ScopedLatency Latency<TimeUnit, LabelTypes...>::GetScopedLatency(
     const LabelTypes&... labels) {
   return cert_trans::ScopedLatency(
-      std::bind(&Latency<TimeUnit, LabelTypes...>::RecordLatency, this,
-                labels..., std::placeholders::_1));
+      histogram_->Buckets(labels...),
+      &Latency<TimeUnit, LabelTypes...>::ToTimeUnit);
 }
 
 
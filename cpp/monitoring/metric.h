@@ -1,6 +1,9 @@
 #ifndef CERT_TRANS_MONITORING_METRIC_H_
 #define CERT_TRANS_MONITORING_METRIC_H_
 
+#include <stdint.h>
+#include <chrono>
+#include <functional>
 #include <map>
 #include <ostream>
 #include <set>
@@ -27,9 +30,26 @@ class Metric {
   typedef std::pair<std::chrono::system_clock::time_point, double>
       TimestampedValue;
 
+  // The samples of a HISTOGRAM, as of |timestamp|.
+  struct Distribution {
+    std::chrono::system_clock::time_point timestamp;
+    uint64_t count;
+    double sum;
+    // Pairs of inclusive upper bound and cumulative count, in
+    // increasing order of upper bound, the last one being infinity.
+    std::vector<std::pair<double, uint64_t>> buckets;
+  };
+
+  typedef std::function<void(const std::vector<std::string>& label_values,
+                             const TimestampedValue& value)> ValueCallback;
+  typedef std::function<void(const std::vector<std::string>& label_values,
+                             const Distribution& distribution)>
+      DistributionCallback;
+
   enum Type {
     COUNTER,
     GAUGE,
+    HISTOGRAM,
   };
 
   Type Type() const {
@@ -66,6 +86,31 @@ class Metric {
   virtual std::map<std::vector<std::string>, TimestampedValue> CurrentValues()
       const = 0;
 
+  // Only HISTOGRAM metrics have distributions, CurrentValues() returns
+  // their number of samples.
+  virtual std::map<std::vector<std::string>, Distribution>
+  CurrentDistributions() const {
+    return std::map<std::vector<std::string>, Distribution>();
+  }
+
+  // Calls |callback| with what CurrentValues() and
+  // CurrentDistributions() would return, one set of labels at a time,
+  // in no particular order. The arguments are only valid for the
+  // duration of the call. Exporters should prefer these, which do not
+  // copy everything first.
+  virtual void ForEachValue(const ValueCallback& callback) const {
+    for (const auto& it : CurrentValues()) {
+      callback(it.first, it.second);
+    }
+  }
+
+  virtual void ForEachDistribution(
+      const DistributionCallback& callback) const {
+    for (const auto& it : CurrentDistributions()) {
+      callback(it.first, it.second);
+    }
+  }
+
  protected:
   Metric(enum Type type, const std::string& name,
          const std::vector<std::string>& label_names, const std::string& help)
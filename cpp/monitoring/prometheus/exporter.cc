@@ -1,11 +1,18 @@
 #include "monitoring/prometheus/exporter.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
 #include "monitoring/metric.h"
 #include "monitoring/prometheus/metrics.pb.h"
 #include "monitoring/registry.h"
 
+using std::atomic;
 using std::chrono::duration_cast;
 using std::chrono::milliseconds;
-using std::map;
+using std::chrono::system_clock;
 using std::set;
 using std::string;
 using std::vector;
@@ -13,6 +20,12 @@ using std::vector;
 namespace cert_trans {
 namespace {
 
+
+// The size of the last text rendering, to allocate the next one in one
+// go.
+atomic<size_t> last_text_size(0);
+
+
 void AddLabelTypes(::io::prometheus::client::Metric* metric,
                    const std::vector<std::string>& names,
                    const std::vector<std::string>& values) {
@@ -26,43 +39,225 @@ void AddLabelTypes(::io::prometheus::client::Metric* metric,
 }
 
 
-::io::prometheus::client::MetricFamily PopulateMetricFamily(
-    const Metric& metric) {
-  ::io::prometheus::client::MetricFamily family;
-  family.set_name(metric.Name());
-  family.set_help(metric.Help());
+int64_t TimestampMs(const system_clock::time_point& timestamp) {
+  return duration_cast<milliseconds>(timestamp.time_since_epoch()).count();
+}
+
+
+void PopulateHistograms(const Metric& metric,
+                        ::io::prometheus::client::MetricFamily* family) {
+  CHECK_NOTNULL(family);
+  const vector<string>& label_names(metric.LabelNames());
+  metric.ForEachDistribution([family, &label_names](
+      const vector<string>& label_values,
+      const Metric::Distribution& distribution) {
+    io::prometheus::client::Metric* m(family->add_metric());
+    AddLabelTypes(m, label_names, label_values);
+    m->set_timestamp_ms(TimestampMs(distribution.timestamp));
+    io::prometheus::client::Histogram* histogram(m->mutable_histogram());
+    histogram->set_sample_count(distribution.count);
+    histogram->set_sample_sum(distribution.sum);
+    for (const auto& bucket : distribution.buckets) {
+      io::prometheus::client::Bucket* b(histogram->add_bucket());
+      b->set_upper_bound(bucket.first);
+      b->set_cumulative_count(bucket.second);
+    }
+  });
+}
+
+
+// Fills in |family|, which should be empty, but can be one that was
+// used before and cleared, to reuse its storage.
+void PopulateMetricFamily(const Metric& metric,
+                          ::io::prometheus::client::MetricFamily* family) {
+  CHECK_NOTNULL(family);
+  family->set_name(metric.Name());
+  family->set_help(metric.Help());
   switch (metric.Type()) {
     case Metric::COUNTER:
-      family.set_type(io::prometheus::client::MetricType::COUNTER);
+      family->set_type(io::prometheus::client::MetricType::COUNTER);
       break;
     case Metric::GAUGE:
-      family.set_type(io::prometheus::client::MetricType::GAUGE);
+      family->set_type(io::prometheus::client::MetricType::GAUGE);
       break;
+    case Metric::HISTOGRAM:
+      family->set_type(io::prometheus::client::MetricType::HISTOGRAM);
+      PopulateHistograms(metric, family);
+      return;
     default:
       LOG(FATAL) << "Unknown metric type: " << metric.Type();
   }
-  const map<vector<string>, Metric::TimestampedValue> values(
-      metric.CurrentValues());
-  const vector<string> label_names(metric.LabelNames());
-  for (auto it(values.begin()); it != values.end(); ++it) {
-    io::prometheus::client::Metric* m(family.add_metric());
-    AddLabelTypes(m, label_names, it->first);
-    m->set_timestamp_ms(
-        duration_cast<milliseconds>(it->second.first.time_since_epoch())
-            .count());
-    switch (metric.Type()) {
-      case Metric::COUNTER:
-        m->mutable_counter()->set_value(it->second.second);
+  const vector<string>& label_names(metric.LabelNames());
+  const bool counter(metric.Type() == Metric::COUNTER);
+  metric.ForEachValue([family, &label_names, counter](
+      const vector<string>& label_values,
+      const Metric::TimestampedValue& value) {
+    io::prometheus::client::Metric* m(family->add_metric());
+    AddLabelTypes(m, label_names, label_values);
+    m->set_timestamp_ms(TimestampMs(value.first));
+    if (counter) {
+      m->mutable_counter()->set_value(value.second);
+    } else {
+      m->mutable_gauge()->set_value(value.second);
+    }
+  });
+}
+
+
+// Appends |value|, escaped as the text format wants help strings, or
+// label values if |quote| is true.
+void AppendEscaped(const string& value, bool quote, string* out) {
+  for (const char c : value) {
+    switch (c) {
+      case '\\':
+        out->append("\\\\");
         break;
-      case Metric::GAUGE:
-        m->mutable_gauge()->set_value(it->second.second);
+      case '\n':
+        out->append("\\n");
         break;
+      case '"':
+        if (quote) {
+          out->append("\\\"");
+          break;
+        }
+      // Fall through.
       default:
-        LOG(FATAL) << "Unknown metric type: " << metric.Type();
+        out->push_back(c);
+    }
+  }
+}
+
+
+void AppendDouble(double value, string* out) {
+  if (std::isnan(value)) {
+    out->append("NaN");
+    return;
+  }
+  if (std::isinf(value)) {
+    out->append(value > 0 ? "+Inf" : "-Inf");
+    return;
+  }
+  char buf[32];
+  // The shortest of these that reads back as the same value.
+  int len(std::snprintf(buf, sizeof(buf), "%.15g", value));
+  if (std::strtod(buf, nullptr) != value) {
+    len = std::snprintf(buf, sizeof(buf), "%.17g", value);
+  }
+  out->append(buf, len);
+}
+
+
+void AppendInt(int64_t value, string* out) {
+  char buf[24];
+  const int len(std::snprintf(buf, sizeof(buf), "%lld",
+                              static_cast<long long>(value)));
+  out->append(buf, len);
+}
+
+
+// Appends a sample line, with the label pairs of |label_names| and
+// |label_values|, followed by |extra_label|, if not null, which must
+// already be rendered as name="value".
+void AppendSample(const string& name, const char* suffix,
+                  const vector<string>& label_names,
+                  const vector<string>& label_values,
+                  const string* extra_label, double value,
+                  const system_clock::time_point& timestamp, string* out) {
+  CHECK_EQ(label_names.size(), label_values.size());
+  out->append(name).append(suffix);
+  if (!label_names.empty() || extra_label) {
+    out->push_back('{');
+    for (size_t i = 0; i < label_names.size(); ++i) {
+      if (i > 0) {
+        out->push_back(',');
+      }
+      out->append(label_names[i]).append("=\"");
+      AppendEscaped(label_values[i], true /* quote */, out);
+      out->push_back('"');
+    }
+    if (extra_label) {
+      if (!label_names.empty()) {
+        out->push_back(',');
+      }
+      out->append(*extra_label);
+    }
+    out->push_back('}');
+  }
+  out->push_back(' ');
+  AppendDouble(value, out);
+  out->push_back(' ');
+  AppendInt(TimestampMs(timestamp), out);
+  out->push_back('\n');
+}
+
+
+void AppendHistogramText(const Metric& metric, string* out) {
+  const vector<string>& label_names(metric.LabelNames());
+  // The rendered le="..." labels, which all the distributions of a
+  // metric normally share.
+  vector<double> bounds;
+  vector<string> le_labels;
+  metric.ForEachDistribution([&](const vector<string>& label_values,
+                                 const Metric::Distribution& distribution) {
+    bool same_bounds(bounds.size() == distribution.buckets.size());
+    for (size_t i = 0; same_bounds && i < bounds.size(); ++i) {
+      same_bounds = bounds[i] == distribution.buckets[i].first;
+    }
+    if (!same_bounds) {
+      bounds.clear();
+      le_labels.clear();
+      for (const auto& bucket : distribution.buckets) {
+        bounds.push_back(bucket.first);
+        le_labels.emplace_back("le=\"");
+        AppendDouble(bucket.first, &le_labels.back());
+        le_labels.back().push_back('"');
+      }
     }
+
+    for (size_t i = 0; i < distribution.buckets.size(); ++i) {
+      AppendSample(metric.Name(), "_bucket", label_names, label_values,
+                   &le_labels[i], distribution.buckets[i].second,
+                   distribution.timestamp, out);
+    }
+    AppendSample(metric.Name(), "_sum", label_names, label_values, nullptr,
+                 distribution.sum, distribution.timestamp, out);
+    AppendSample(metric.Name(), "_count", label_names, label_values, nullptr,
+                 distribution.count, distribution.timestamp, out);
+  });
+}
+
+
+void AppendMetricText(const Metric& metric, string* out) {
+  const char* type(nullptr);
+  switch (metric.Type()) {
+    case Metric::COUNTER:
+      type = "counter";
+      break;
+    case Metric::GAUGE:
+      type = "gauge";
+      break;
+    case Metric::HISTOGRAM:
+      type = "histogram";
+      break;
+    default:
+      LOG(FATAL) << "Unknown metric type: " << metric.Type();
   }
+  out->append("# HELP ").append(metric.Name()).push_back(' ');
+  AppendEscaped(metric.Help(), false /* quote */, out);
+  out->append("\n# TYPE ").append(metric.Name()).push_back(' ');
+  out->append(type).push_back('\n');
 
-  return family;
+  if (metric.Type() == Metric::HISTOGRAM) {
+    AppendHistogramText(metric, out);
+    return;
+  }
+  const vector<string>& label_names(metric.LabelNames());
+  metric.ForEachValue([&metric, &label_names, out](
+      const vector<string>& label_values,
+      const Metric::TimestampedValue& value) {
+    AppendSample(metric.Name(), "", label_names, label_values, nullptr,
+                 value.second, value.first, out);
+  });
 }
 
 
@@ -71,14 +266,31 @@ void AddLabelTypes(::io::prometheus::client::Metric* metric,
 void ExportMetricsToPrometheus(std::ostream* os) {
   const set<const Metric*> metrics(Registry::Instance()->GetMetrics());
 
-  for (auto it(metrics.begin()); it != metrics.end(); ++it) {
-    const ::io::prometheus::client::MetricFamily family(
-        PopulateMetricFamily(**it));
+  // Reused for every metric, which saves reallocating its messages.
+  ::io::prometheus::client::MetricFamily family;
+  for (const Metric* metric : metrics) {
+    family.Clear();
+    PopulateMetricFamily(*metric, &family);
     CHECK(WriteDelimitedToOstream(family, os));
   }
 }
 
 
+void ExportMetricsToPrometheusText(std::string* out) {
+  CHECK_NOTNULL(out);
+  const set<const Metric*> metrics(Registry::Instance()->GetMetrics());
+
+  const size_t start(out->size());
+  // With some room for metrics that grew since.
+  const size_t size_hint(last_text_size.load(std::memory_order_relaxed));
+  out->reserve(start + size_hint + size_hint / 8);
+  for (const Metric* metric : metrics) {
+    AppendMetricText(*metric, out);
+  }
+  last_text_size.store(out->size() - start, std::memory_order_relaxed);
+}
+
+
 void ExportMetricsToHtml(std::ostream* os) {
   const set<const Metric*> metrics(Registry::Instance()->GetMetrics());
   *os << "<html>\n"
@@ -87,13 +299,14 @@ void ExportMetricsToHtml(std::ostream* os) {
 
   *os << "<table>\n";
   bool bg_flip(false);
+  ::io::prometheus::client::MetricFamily family;
   for (const auto* m : metrics) {
     *os << "<tr><td style='background-color:#"
         << (bg_flip ? "bbffbb" : "eeffee") << "'><code>\n";
     bg_flip = !bg_flip;
 
-    const ::io::prometheus::client::MetricFamily family(
-        PopulateMetricFamily(*m));
+    family.Clear();
+    PopulateMetricFamily(*m, &family);
     *os << family.DebugString();
 
     *os << "\n</code></td></tr>\n";
@@ -2,14 +2,23 @@
 #define CERT_TRANS_MONITORING_PROMETHEUS_H_
 
 #include <glog/logging.h>
+#include <ostream>
+#include <string>
 
 #include "util/protobuf_util.h"
 
 namespace cert_trans {
 
+// Writes the metrics of the Registry as delimited MetricFamily
+// protobufs.
 void ExportMetricsToPrometheus(std::ostream* os);
 
 
+// Appends the metrics of the Registry to |out| in the Prometheus text
+// exposition format (version 0.0.4).
+void ExportMetricsToPrometheusText(std::string* out);
+
+
 void ExportMetricsToHtml(std::ostream* os);
 
 
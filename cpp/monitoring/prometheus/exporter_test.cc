@@ -0,0 +1,138 @@
+#include "monitoring/prometheus/exporter.h"
+
+#include <glog/logging.h>
+#include <gmock/gmock.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "monitoring/counter.h"
+#include "monitoring/gauge.h"
+#include "monitoring/histogram.h"
+#include "monitoring/prometheus/metrics.pb.h"
+#include "monitoring/registry.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+
+using google::protobuf::io::CodedInputStream;
+using std::ostringstream;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using testing::HasSubstr;
+using testing::Not;
+
+
+class PrometheusExporterTest : public ::testing::Test {
+ public:
+  void TearDown() {
+    Registry::Instance()->ResetForTestingOnly();
+  }
+
+ protected:
+  static vector<::io::prometheus::client::MetricFamily> ParseDelimited(
+      const string& data) {
+    vector<::io::prometheus::client::MetricFamily> ret;
+    CodedInputStream input(reinterpret_cast<const uint8_t*>(data.data()),
+                           data.size());
+    uint32_t size;
+    while (input.ReadVarint32(&size)) {
+      const CodedInputStream::Limit limit(input.PushLimit(size));
+      ret.emplace_back();
+      CHECK(ret.back().ParseFromCodedStream(&input));
+      input.PopLimit(limit);
+    }
+    return ret;
+  }
+};
+
+
+TEST_F(PrometheusExporterTest, TestText) {
+  unique_ptr<Counter<string>> counter(
+      Counter<string>::New("requests", "path", "Number of\nrequests"));
+  counter->IncrementBy("/a\"b\\", 3);
+  unique_ptr<Gauge<>> gauge(Gauge<>::New("temperature", "help"));
+  gauge->Set(0.25);
+
+  string text("unchanged\n");
+  ExportMetricsToPrometheusText(&text);
+
+  EXPECT_EQ(static_cast<size_t>(0), text.find("unchanged\n"));
+  EXPECT_THAT(text, HasSubstr("# HELP requests Number of\\nrequests\n"
+                              "# TYPE requests counter\n"
+                              "requests{path=\"/a\\\"b\\\\\"} 3 "));
+  EXPECT_THAT(text, HasSubstr("# HELP temperature help\n"
+                              "# TYPE temperature gauge\n"
+                              "temperature 0.25 "));
+}
+
+
+TEST_F(PrometheusExporterTest, TestTextHistogram) {
+  unique_ptr<Histogram<string>> histogram(
+      Histogram<string>::New("latency", "op", "help"));
+  histogram->Record("get", 3);
+  histogram->Record("put", 1);
+
+  string text;
+  ExportMetricsToPrometheusText(&text);
+
+  EXPECT_THAT(text, HasSubstr("# TYPE latency histogram\n"));
+  EXPECT_THAT(text, HasSubstr("latency_bucket{op=\"get\",le=\"1\"} 0 "));
+  EXPECT_THAT(text, HasSubstr("latency_bucket{op=\"get\",le=\"3\"} 1 "));
+  EXPECT_THAT(text, HasSubstr("latency_bucket{op=\"get\",le=\"+Inf\"} 1 "));
+  EXPECT_THAT(text, HasSubstr("latency_sum{op=\"get\"} 3 "));
+  EXPECT_THAT(text, HasSubstr("latency_count{op=\"get\"} 1 "));
+  EXPECT_THAT(text, HasSubstr("latency_bucket{op=\"put\",le=\"1\"} 1 "));
+  EXPECT_THAT(text, HasSubstr("latency_bucket{op=\"put\",le=\"1.25\"} 1 "));
+  EXPECT_THAT(text, Not(HasSubstr("le=\"3\"} 0 ")));
+}
+
+
+TEST_F(PrometheusExporterTest, TestProto) {
+  unique_ptr<Counter<string>> counter(
+      Counter<string>::New("requests", "path", "help"));
+  counter->Increment("/a");
+  counter->Increment("/b");
+  unique_ptr<Histogram<>> histogram(Histogram<>::New("latency", "help"));
+  histogram->Record(2);
+
+  ostringstream oss;
+  ExportMetricsToPrometheus(&oss);
+  vector<::io::prometheus::client::MetricFamily> families(
+      ParseDelimited(oss.str()));
+
+  ASSERT_EQ(static_cast<size_t>(2), families.size());
+  for (const auto& family : families) {
+    if (family.name() == "requests") {
+      EXPECT_EQ(io::prometheus::client::MetricType::COUNTER, family.type());
+      ASSERT_EQ(2, family.metric_size());
+      for (const auto& metric : family.metric()) {
+        ASSERT_EQ(1, metric.label_size());
+        EXPECT_EQ("path", metric.label(0).name());
+        EXPECT_EQ(1, metric.counter().value());
+      }
+    } else {
+      EXPECT_EQ("latency", family.name());
+      EXPECT_EQ(io::prometheus::client::MetricType::HISTOGRAM, family.type());
+      ASSERT_EQ(1, family.metric_size());
+      EXPECT_EQ(static_cast<uint64_t>(1),
+                family.metric(0).histogram().sample_count());
+      EXPECT_EQ(2, family.metric(0).histogram().sample_sum());
+      EXPECT_EQ(HistogramBuckets::kNumBuckets,
+                family.metric(0).histogram().bucket_size());
+    }
+  }
+}
+
+
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,187 @@
+#include "config.h"
+#include "monitoring/trace.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <ctime>
+#include <deque>
+#include <sstream>
+
+#include "monitoring/latency.h"
+
+DEFINE_double(trace_sample_rate, 0.001,
+              "Proportion of the traced requests whose spans are kept, to be "
+              "looked at on the /traces page.");
+DEFINE_int32(trace_max_sampled, 100,
+             "How many of the latest sampled traces to keep.");
+
+using std::atomic;
+using std::chrono::duration_cast;
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+using std::chrono::system_clock;
+using std::deque;
+using std::lock_guard;
+using std::mutex;
+using std::ostream;
+using std::ostringstream;
+using std::shared_ptr;
+using std::string;
+
+namespace cert_trans {
+namespace {
+
+
+static Latency<microseconds, string, string> trace_stage_latency_us(
+    "trace_stage_latency_us", "request", "stage",
+    "Time spent in each stage of the traced requests, in microseconds.");
+
+
+#ifdef HAVE_THREAD_LOCAL
+thread_local Trace* current_trace = nullptr;
+#elif HAVE___THREAD
+__thread Trace* current_trace = nullptr;
+#else
+#error No suitable thread local storage available
+#endif
+
+
+atomic<uint64_t> num_traces(0);
+
+mutex sampled_traces_lock;
+// Most recent first.
+deque<string> sampled_traces;
+
+
+bool ShouldSample() {
+  if (FLAGS_trace_sample_rate <= 0) {
+    return false;
+  }
+  // Every n-th trace, rather than at random, which is good enough and
+  // cheaper.
+  const uint64_t period(std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::llround(1 / FLAGS_trace_sample_rate))));
+  return num_traces.fetch_add(1, std::memory_order_relaxed) % period == 0;
+}
+
+
+string FormatTime(const system_clock::time_point& when) {
+  const std::time_t secs(system_clock::to_time_t(when));
+  std::tm tm;
+  gmtime_r(&secs, &tm);
+  char buf[64];
+  CHECK_GT(std::strftime(buf, sizeof(buf), "%FT%T", &tm),
+           static_cast<size_t>(0));
+  ostringstream oss;
+  oss << buf << "." << (duration_cast<milliseconds>(when.time_since_epoch())
+                            .count() %
+                        1000)
+      << "Z";
+  return oss.str();
+}
+
+
+}  // namespace
+
+
+// static
+shared_ptr<Trace> Trace::Start(const string& request) {
+  return shared_ptr<Trace>(new Trace(request, ShouldSample()));
+}
+
+
+// static
+Trace* Trace::Current() {
+  return current_trace;
+}
+
+
+Trace::Trace(const string& request, bool sampled)
+    : request_(request),
+      sampled_(sampled),
+      started_at_(Clock::now()),
+      started_wall_(system_clock::now()) {
+}
+
+
+Trace::~Trace() {
+  const Clock::time_point finished_at(Clock::now());
+  trace_stage_latency_us.RecordLatency(request_, "total",
+                                       finished_at - started_at_);
+  if (!sampled_) {
+    return;
+  }
+
+  std::sort(spans_.begin(), spans_.end(), [](const Span& a, const Span& b) {
+    return a.start < b.start;
+  });
+  ostringstream oss;
+  oss << FormatTime(started_wall_) << " " << request_ << " "
+      << duration_cast<microseconds>(finished_at - started_at_).count()
+      << "us\n";
+  for (const auto& span : spans_) {
+    oss << "  +" << duration_cast<microseconds>(span.start - started_at_)
+                        .count()
+        << "us " << span.stage << " "
+        << duration_cast<microseconds>(span.end - span.start).count()
+        << "us\n";
+  }
+
+  lock_guard<mutex> lock(sampled_traces_lock);
+  sampled_traces.emplace_front(oss.str());
+  while (sampled_traces.size() >
+         static_cast<size_t>(std::max(FLAGS_trace_max_sampled, 0))) {
+    sampled_traces.pop_back();
+  }
+}
+
+
+void Trace::AddSpan(const string& stage, const Clock::time_point& start,
+                    const Clock::time_point& end) {
+  trace_stage_latency_us.RecordLatency(request_, stage, end - start);
+  if (sampled_) {
+    lock_guard<mutex> lock(mutex_);
+    spans_.push_back(Span{stage, start, end});
+  }
+}
+
+
+ScopedTrace::ScopedTrace(const shared_ptr<Trace>& trace)
+    : trace_(trace), previous_(current_trace) {
+  if (trace_) {
+    current_trace = trace_.get();
+  }
+}
+
+
+ScopedTrace::~ScopedTrace() {
+  current_trace = previous_;
+}
+
+
+ScopedSpan::ScopedSpan(const char* stage)
+    : stage_(CHECK_NOTNULL(stage)),
+      trace_(Trace::Current()),
+      start_(trace_ ? Trace::Clock::now() : Trace::Clock::time_point()) {
+}
+
+
+ScopedSpan::~ScopedSpan() {
+  if (trace_) {
+    trace_->AddSpan(stage_, start_, Trace::Clock::now());
+  }
+}
+
+
+void ExportSampledTraces(ostream* os) {
+  lock_guard<mutex> lock(sampled_traces_lock);
+  for (const auto& trace : sampled_traces) {
+    *CHECK_NOTNULL(os) << trace << "\n";
+  }
+}
+
+
+}  // namespace cert_trans
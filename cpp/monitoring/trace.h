@@ -0,0 +1,111 @@
+#ifndef CERT_TRANS_MONITORING_TRACE_H_
+#define CERT_TRANS_MONITORING_TRACE_H_
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// Times the stages of a request (e.g. an add-chain) as it goes through
+// the different parts of the server, which add spans to it.
+//
+// Whatever the sampling, the duration of every span goes to the
+// "trace_stage_latency_us" histogram, by request and stage, as well as
+// the total duration of the request, as stage "total". The spans of
+// the sampled traces (see --trace_sample_rate) are also kept, and the
+// latest ones can be looked at with ExportSampledTraces().
+//
+// A trace lasts for as long as there are references to it, which the
+// stages of the request keep as they go; its total duration is
+// recorded when the last of them goes away. Parts of the server that
+// are not handed the trace explicitly get it from Current(), which is
+// set for the duration of a ScopedTrace, and should take a reference
+// with shared_from_this() if they carry on asynchronously.
+class Trace : public std::enable_shared_from_this<Trace> {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  static std::shared_ptr<Trace> Start(const std::string& request);
+
+  // The trace of the ScopedTrace innermost on this thread, or nullptr.
+  static Trace* Current();
+
+  ~Trace();
+
+  const std::string& request() const {
+    return request_;
+  }
+
+  bool sampled() const {
+    return sampled_;
+  }
+
+  void AddSpan(const std::string& stage, const Clock::time_point& start,
+               const Clock::time_point& end);
+
+ private:
+  struct Span {
+    std::string stage;
+    Clock::time_point start;
+    Clock::time_point end;
+  };
+
+  Trace(const std::string& request, bool sampled);
+
+  const std::string request_;
+  const bool sampled_;
+  const Clock::time_point started_at_;
+  const std::chrono::system_clock::time_point started_wall_;
+
+  std::mutex mutex_;
+  std::vector<Span> spans_;
+
+  DISALLOW_COPY_AND_ASSIGN(Trace);
+};
+
+
+// Makes |trace| the Current() one on this thread, until destroyed. A
+// null |trace| is allowed, and does nothing.
+class ScopedTrace {
+ public:
+  explicit ScopedTrace(const std::shared_ptr<Trace>& trace);
+  ~ScopedTrace();
+
+ private:
+  const std::shared_ptr<Trace> trace_;
+  Trace* const previous_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedTrace);
+};
+
+
+// Adds a span for |stage| to the Current() trace, if any, from its
+// construction to its destruction.
+class ScopedSpan {
+ public:
+  explicit ScopedSpan(const char* stage);
+  ~ScopedSpan();
+
+ private:
+  const char* const stage_;
+  Trace* const trace_;
+  const Trace::Clock::time_point start_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedSpan);
+};
+
+
+// Writes the latest sampled traces, most recent first, as text.
+void ExportSampledTraces(std::ostream* os);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_MONITORING_TRACE_H_
@@ -0,0 +1,134 @@
+#include "monitoring/trace.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "monitoring/metric.h"
+#include "monitoring/registry.h"
+#include "util/testing.h"
+
+DECLARE_double(trace_sample_rate);
+
+namespace cert_trans {
+
+using std::ostringstream;
+using std::shared_ptr;
+using std::string;
+using std::vector;
+
+
+class TraceTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    FLAGS_trace_sample_rate = 1;
+  }
+
+ protected:
+  // The number of samples of the stage latency histogram for
+  // |request| and |stage|.
+  uint64_t StageCount(const string& request, const string& stage) const {
+    for (const Metric* metric : Registry::Instance()->GetMetrics()) {
+      if (metric->Name() != "trace_stage_latency_us") {
+        continue;
+      }
+      const auto distributions(metric->CurrentDistributions());
+      const auto it(distributions.find(vector<string>{request, stage}));
+      return it == distributions.end() ? 0 : it->second.count;
+    }
+    ADD_FAILURE() << "no trace_stage_latency_us metric";
+    return 0;
+  }
+
+  string SampledTraces() const {
+    ostringstream oss;
+    ExportSampledTraces(&oss);
+    return oss.str();
+  }
+};
+
+
+TEST_F(TraceTest, TestSpansAndTotal) {
+  {
+    const shared_ptr<Trace> trace(Trace::Start("spans"));
+    EXPECT_TRUE(trace->sampled());
+    EXPECT_EQ("spans", trace->request());
+    ScopedTrace scoped(trace);
+    EXPECT_EQ(trace.get(), Trace::Current());
+    {
+      ScopedSpan span("one");
+    }
+    {
+      ScopedSpan span("one");
+    }
+    EXPECT_EQ(static_cast<uint64_t>(2), StageCount("spans", "one"));
+    // Only once the trace is done.
+    EXPECT_EQ(static_cast<uint64_t>(0), StageCount("spans", "total"));
+  }
+  EXPECT_EQ(nullptr, Trace::Current());
+  EXPECT_EQ(static_cast<uint64_t>(1), StageCount("spans", "total"));
+
+  const string sampled(SampledTraces());
+  EXPECT_NE(string::npos, sampled.find(" spans ")) << sampled;
+  EXPECT_NE(string::npos, sampled.find("us one ")) << sampled;
+}
+
+
+TEST_F(TraceTest, TestAsyncSpan) {
+  const Trace::Clock::time_point start(Trace::Clock::now());
+  {
+    const shared_ptr<Trace> trace(Trace::Start("async"));
+    trace->AddSpan("queue", start, start + std::chrono::milliseconds(3));
+  }
+  EXPECT_EQ(static_cast<uint64_t>(1), StageCount("async", "queue"));
+  EXPECT_NE(string::npos, SampledTraces().find("us queue 3000us"));
+}
+
+
+TEST_F(TraceTest, TestNesting) {
+  const shared_ptr<Trace> outer(Trace::Start("outer"));
+  const shared_ptr<Trace> inner(Trace::Start("inner"));
+  ScopedTrace scoped_outer(outer);
+  {
+    ScopedTrace scoped_inner(inner);
+    EXPECT_EQ(inner.get(), Trace::Current());
+    ScopedTrace scoped_null(nullptr);
+    EXPECT_EQ(inner.get(), Trace::Current());
+  }
+  EXPECT_EQ(outer.get(), Trace::Current());
+}
+
+
+TEST_F(TraceTest, TestNoCurrentTrace) {
+  ASSERT_EQ(nullptr, Trace::Current());
+  // Does nothing.
+  ScopedSpan span("none");
+}
+
+
+TEST_F(TraceTest, TestNotSampled) {
+  FLAGS_trace_sample_rate = 0;
+  {
+    const shared_ptr<Trace> trace(Trace::Start("unsampled"));
+    EXPECT_FALSE(trace->sampled());
+    ScopedTrace scoped(trace);
+    ScopedSpan span("stage");
+  }
+  // Still in the histogram, but not in the sampled traces.
+  EXPECT_EQ(static_cast<uint64_t>(1), StageCount("unsampled", "stage"));
+  EXPECT_EQ(static_cast<uint64_t>(1), StageCount("unsampled", "total"));
+  EXPECT_EQ(string::npos, SampledTraces().find("unsampled"));
+}
+
+
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
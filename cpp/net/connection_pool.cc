@@ -3,6 +3,7 @@
 #include <event2/event.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <algorithm>
 #include <chrono>
 
 #include "monitoring/monitoring.h"
@@ -18,7 +19,9 @@ using std::bind;
 using std::chrono::duration_cast;
 using std::chrono::seconds;
 using std::chrono::system_clock;
+using std::hash;
 using std::lock_guard;
+using std::max;
 using std::make_pair;
 using std::map;
 using std::move;
@@ -31,6 +34,7 @@ using std::to_string;
 using std::unique_lock;
 using std::unique_ptr;
 using std::shared_ptr;
+using std::vector;
 using util::ClearOpenSSLErrors;
 using util::DumpOpenSSLErrorStack;
 
@@ -49,7 +53,13 @@ DEFINE_string(trusted_root_certs, "",
               "Location of trusted CA root certs for outgoing SSL "
               "connections.");
 DEFINE_int32(url_fetcher_max_conn_per_host_port, 4,
-             "maximum number of URL fetcher connections per host:port");
+             "minimum number of idle URL fetcher connections kept per "
+             "host:port, more are kept for as long as recent bursts of "
+             "requests needed them");
+DEFINE_int32(url_fetcher_max_active_conn_per_host_port, 64,
+             "maximum number of URL fetcher connections in use at once per "
+             "host:port, beyond which requests wait for one to be returned, "
+             "or 0 for no limit");
 
 DEFINE_string(tls_client_minimum_protocol, "tlsv12",
               "Minimum acceptable TLS "
@@ -76,10 +86,15 @@ namespace internal {
 
 const int kZeroMillis = 0;
 
+const size_t kNumShards = 16;
+
 
 static Gauge<string>* connections_per_host_port(
     Gauge<string>::New("connections_per_host_port", "host_port",
                        "Number of cached connections port host:port"));
+static Gauge<string>* connections_in_use_per_host_port(
+    Gauge<string>::New("connections_in_use_per_host_port", "host_port",
+                       "Number of connections in use per host:port"));
 
 
 namespace {
@@ -92,11 +107,28 @@ int GetSSLConnectionIndex() {
 }
 
 
+int GetSSLCTXPoolIndex() {
+  static const int ssl_ctx_pool_index(
+      SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr));
+  return ssl_ctx_pool_index;
+}
+
+
 string HostPortString(const HostPortPair& pair) {
   return pair.first + ":" + to_string(pair.second);
 }
 
 
+template <class T>
+vector<shared_ptr<T>> MakeShards(size_t num_shards) {
+  vector<shared_ptr<T>> shards;
+  for (size_t i = 0; i < num_shards; ++i) {
+    shards.emplace_back(std::make_shared<T>());
+  }
+  return shards;
+}
+
+
 }  // namespace
 
 
@@ -115,14 +147,24 @@ class EvConnection {
   // delete it.
   static evhtp_res ConnectionFinishedHook(evhtp_connection_t* conn, void* arg);
 
-  EvConnection(evhtp_connection_t* conn, HostPortPair&& other_end)
+  // If |session| is not null, the TLS handshake will try to resume it.
+  EvConnection(evhtp_connection_t* conn, HostPortPair&& other_end,
+               SSL_SESSION* session,
+               const shared_ptr<ConnectionPool::Shard>& shard)
       : ev_conn_(CHECK_NOTNULL(conn)),
         other_end_(move(other_end)),
+        shard_(shard),
+        idle_(false),
         errored_(false) {
     if (ev_conn_->ssl) {
       SSL_set_ex_data(ev_conn_->ssl, GetSSLConnectionIndex(),
                       static_cast<void*>(this));
       SSL_set_tlsext_host_name(ev_conn_->ssl, other_end_.first.c_str());
+      if (session && SSL_set_session(ev_conn_->ssl, session) != 1) {
+        LOG(WARNING) << "Could not resume TLS session: "
+                     << DumpOpenSSLErrorStack();
+        ClearOpenSSLErrors();
+      }
     }
   }
 
@@ -149,8 +191,16 @@ class EvConnection {
   evhtp_connection_t* ev_conn_;
   const HostPortPair other_end_;
 
+  // The shard of the pool holding this connection whilst it is idle,
+  // and its place there, guarded by the lock of the shard.
+  const std::weak_ptr<ConnectionPool::Shard> shard_;
+  bool idle_;
+  ConnectionPool::IdleList::iterator idle_pos_;
+
   mutable std::mutex lock_;
   bool errored_;
+
+  friend class ConnectionPool;
 };
 
 
@@ -279,7 +329,7 @@ SSL_CTX* CreateSSLCTXFromFlags() {
 
 ConnectionPool::ConnectionPool(libevent::Base* base)
     : base_(CHECK_NOTNULL(base)),
-      cleanup_scheduled_(false),
+      shards_(MakeShards<Shard>(kNumShards)),
       ssl_ctx_(CreateSSLCTXFromFlags(), SSL_CTX_free) {
   CHECK(ssl_ctx_) << "could not build SSL context: "
                   << DumpOpenSSLErrorStack();
@@ -305,6 +355,45 @@ ConnectionPool::ConnectionPool(libevent::Base* base)
 
   SSL_CTX_set_verify(ssl_ctx_.get(), SSL_VERIFY_PEER,
                      EvConnection::SSLVerifyCallback);
+
+  // OpenSSL does not look up client sessions by itself, we keep them in
+  // |sessions_| and hand them to new connections.
+  SSL_CTX_set_ex_data(ssl_ctx_.get(), GetSSLCTXPoolIndex(),
+                      static_cast<void*>(this));
+  SSL_CTX_set_session_cache_mode(ssl_ctx_.get(),
+                                 SSL_SESS_CACHE_CLIENT |
+                                     SSL_SESS_CACHE_NO_INTERNAL_STORE);
+  SSL_CTX_sess_set_new_cb(ssl_ctx_.get(),
+                          &ConnectionPool::NewSessionCallback);
+}
+
+
+ConnectionPool::~ConnectionPool() {
+  for (const auto& entry : sessions_) {
+    SSL_SESSION_free(entry.second);
+  }
+}
+
+
+// static
+int ConnectionPool::NewSessionCallback(SSL* ssl, SSL_SESSION* session) {
+  ConnectionPool* const pool(static_cast<ConnectionPool*>(CHECK_NOTNULL(
+      SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), GetSSLCTXPoolIndex()))));
+  const EvConnection* const connection(
+      static_cast<const EvConnection*>(
+          SSL_get_ex_data(ssl, GetSSLConnectionIndex())));
+  if (!connection) {
+    return 0;
+  }
+
+  lock_guard<mutex> lock(pool->sessions_lock_);
+  SSL_SESSION*& stored(pool->sessions_[connection->other_end()]);
+  if (stored) {
+    SSL_SESSION_free(stored);
+  }
+  // Returning 1 means that we keep the reference to |session|.
+  stored = session;
+  return 1;
 }
 
 
@@ -386,6 +475,12 @@ evhtp_res EvConnection::ConnectionFinishedHook(evhtp_connection_t* conn,
       static_cast<shared_ptr<EvConnection>*>(arg));
   VLOG(1) << "Finished connection to " << (*c)->other_end_.first << ":"
           << (*c)->other_end_.second;
+  // Do not leave it for Get() to find amongst the idle connections.
+  const shared_ptr<ConnectionPool::Shard> shard((*c)->shard_.lock());
+  if (shard) {
+    unique_lock<mutex> lock(shard->lock);
+    ConnectionPool::RemoveIdle(lock, c->get(), shard.get());
+  }
   // The underlying evhtp_connection_t is about to be freed, make sure nobody
   // can hurt themselves via a dangling pointer.
   (*c)->ev_conn_ = nullptr;
@@ -393,42 +488,80 @@ evhtp_res EvConnection::ConnectionFinishedHook(evhtp_connection_t* conn,
 }
 
 
+const shared_ptr<ConnectionPool::Shard>& ConnectionPool::GetShard(
+    const HostPortPair& key) const {
+  const size_t h(hash<string>()(key.first) * 31 + key.second);
+  return shards_[h % shards_.size()];
+}
+
+
 // static
-void ConnectionPool::RemoveDeadConnectionsFromDeque(
-    const unique_lock<mutex>& lock,
-    std::deque<ConnectionPool::TimestampedConnection>* deque) {
+void ConnectionPool::RemoveIdle(const unique_lock<mutex>& lock,
+                                EvConnection* evc, Shard* shard) {
   CHECK(lock.owns_lock());
-  CHECK(deque);
-
-  // Do a sweep and remove any dead connections
-  for (auto deque_it(deque->begin()); deque_it != deque->end();) {
-    CHECK(deque_it->second);
-    if (!deque_it->second->connection()) {
-      VLOG(1) << "Removing dead connection to "
-              << deque_it->second->other_end().first << ":"
-              << deque_it->second->other_end().second;
-      deque_it = deque->erase(deque_it);
-      continue;
-    }
-    ++deque_it;
+  if (!evc->idle_) {
+    return;
   }
+  VLOG(1) << "Removing idle connection to " << evc->other_end_.first << ":"
+          << evc->other_end_.second;
+  evc->idle_ = false;
+  IdleList* const idle(&shard->conns[evc->other_end_].idle);
+  // This may well release the last reference to |evc| but that of the
+  // caller.
+  idle->erase(evc->idle_pos_);
+  connections_per_host_port->Set(HostPortString(evc->other_end_),
+                                 idle->size());
+}
+
+
+// static
+size_t ConnectionPool::MaxIdle(const unique_lock<mutex>& lock,
+                               const HostConnections& conns) {
+  CHECK(lock.owns_lock());
+  CHECK_GE(FLAGS_url_fetcher_max_conn_per_host_port, 0);
+  return max(FLAGS_url_fetcher_max_conn_per_host_port, conns.peak_in_use);
 }
 
 
 unique_ptr<ConnectionPool::Connection> ConnectionPool::Get(const URL& url) {
+  CHECK(!libevent::Base::OnEventThread());
   CHECK(url.Protocol() == "http" || url.Protocol() == "https");
+  CHECK_GE(FLAGS_url_fetcher_max_active_conn_per_host_port, 0);
   const uint16_t default_port(url.Protocol() == "https" ? 443 : 80);
   HostPortPair key(url.Host(), url.Port() != 0 ? url.Port() : default_port);
-  unique_lock<mutex> lock(lock_);
-
-  auto it(conns_.find(key));
-
-  if (it != conns_.end() && !it->second.empty()) {
-    RemoveDeadConnectionsFromDeque(lock, &it->second);
+  const shared_ptr<Shard>& shard(GetShard(key));
+  unique_lock<mutex> lock(shard->lock);
+
+  HostConnections* const conns(&shard->conns[key]);
+  // Wait for a connection to be returned, rather than opening ever more
+  // of them during a burst.
+  shard->released.wait(lock, [conns]() {
+    return FLAGS_url_fetcher_max_active_conn_per_host_port == 0 ||
+           conns->in_use < FLAGS_url_fetcher_max_active_conn_per_host_port;
+  });
+  ++conns->in_use;
+  if (conns->in_use >= conns->peak_in_use) {
+    conns->peak_in_use = conns->in_use;
+    conns->peak_time = system_clock::now();
   }
+  const string hostport(HostPortString(key));
+  connections_in_use_per_host_port->Set(hostport, conns->in_use);
 
-  if (it == conns_.end() || it->second.empty()) {
+  if (conns->idle.empty()) {
+    // Creating the connection can block on name resolution, and it is
+    // already counted as in use.
+    lock.unlock();
     VLOG(1) << "new evhtp_connection for " << key.first << ":" << key.second;
+    SSL_SESSION* session(nullptr);
+    if (url.Protocol() == "https") {
+      lock_guard<mutex> sessions_lock(sessions_lock_);
+      const auto session_it(sessions_.find(key));
+      if (session_it != sessions_.end()) {
+        session = session_it->second;
+        // Keep it alive until the connection took its own reference.
+        SSL_SESSION_up_ref(session);
+      }
+    }
     // This EvConnection has a slightly complicated lifetime; it needs to hang
     // around until libevhtp/libevent have entirely finished with the
     // evhtp_connection_t it references, and for at least as long as the life
@@ -442,7 +575,10 @@ unique_ptr<ConnectionPool::Connection> ConnectionPool::Get(const URL& url) {
         url.Protocol() == "https"
             ? base_->HttpsConnectionNew(key.first, key.second, ssl_ctx_.get())
             : base_->HttpConnectionNew(key.first, key.second),
-        move(key)));
+        move(key), session, shard));
+    if (session) {
+      SSL_SESSION_free(session);
+    }
     unique_ptr<ConnectionPool::Connection> handle(new Connection(conn));
     struct timeval read_timeout = {FLAGS_connection_read_timeout_seconds,
                                    kZeroMillis};
@@ -465,20 +601,41 @@ unique_ptr<ConnectionPool::Connection> ConnectionPool::Get(const URL& url) {
 
   VLOG(1) << "cached evhtp_connection for " << key.first << ":" << key.second;
   unique_ptr<ConnectionPool::Connection> retval(
-      move(it->second.back().second));
-  it->second.pop_back();
+      move(conns->idle.back().second));
+  conns->idle.pop_back();
+  retval->connection_->idle_ = false;
+  connections_per_host_port->Set(hostport, conns->idle.size());
+  // Dead connections remove themselves from |conns->idle|.
   CHECK_NOTNULL(retval->connection());
 
   return retval;
 }
 
 
+// static
+void ConnectionPool::Release(const unique_lock<mutex>& lock,
+                             const HostPortPair& key, Shard* shard) {
+  CHECK(lock.owns_lock());
+  HostConnections* const conns(&shard->conns[key]);
+  CHECK_GT(conns->in_use, 0);
+  --conns->in_use;
+  connections_in_use_per_host_port->Set(HostPortString(key), conns->in_use);
+  shard->released.notify_all();
+}
+
+
 void ConnectionPool::Put(unique_ptr<ConnectionPool::Connection> handle) {
   if (!handle) {
     VLOG(1) << "returned null Connection";
     return;
   }
 
+  // Copied, as |handle| may well be gone before we are done with it.
+  const HostPortPair key(handle->other_end());
+  Shard* const shard(GetShard(key).get());
+  unique_lock<mutex> lock(shard->lock);
+  Release(lock, key, shard);
+
   if (!handle->connection()) {
     VLOG(1) << "returned dead Connection";
     handle.reset();
@@ -491,44 +648,50 @@ void ConnectionPool::Put(unique_ptr<ConnectionPool::Connection> handle) {
     return;
   }
 
-  const HostPortPair& key(handle->other_end());
   VLOG(1) << "returned Connection for " << key.first << ":" << key.second;
-  lock_guard<mutex> lock(lock_);
-  auto& entry(conns_[key]);
-
-  CHECK_GE(FLAGS_url_fetcher_max_conn_per_host_port, 0);
-  entry.emplace_back(make_pair(system_clock::now(), move(handle)));
+  HostConnections* const conns(&shard->conns[key]);
+  EvConnection* const evc(handle->connection_.get());
+  conns->idle.emplace_back(make_pair(system_clock::now(), move(handle)));
+  evc->idle_ = true;
+  evc->idle_pos_ = std::prev(conns->idle.end());
   const string hostport(HostPortString(key));
-  VLOG(1) << "ConnectionPool for " << hostport << " size : " << entry.size();
-  connections_per_host_port->Set(hostport, entry.size());
-  if (!cleanup_scheduled_ &&
-      entry.size() >
+  VLOG(1) << "ConnectionPool for " << hostport
+          << " size : " << conns->idle.size();
+  connections_per_host_port->Set(hostport, conns->idle.size());
+  if (!shard->cleanup_scheduled &&
+      conns->idle.size() >
           static_cast<uint>(FLAGS_url_fetcher_max_conn_per_host_port)) {
-    cleanup_scheduled_ = true;
-    base_->Add(bind(&ConnectionPool::Cleanup, this));
+    shard->cleanup_scheduled = true;
+    base_->Add(bind(&ConnectionPool::Cleanup, this, shard));
   }
 }
 
 
-void ConnectionPool::Cleanup() {
-  unique_lock<mutex> lock(lock_);
-  cleanup_scheduled_ = false;
+void ConnectionPool::Cleanup(Shard* shard) {
+  unique_lock<mutex> lock(shard->lock);
+  shard->cleanup_scheduled = false;
   const system_clock::time_point cutoff(
       system_clock::now() -
       seconds(FLAGS_connection_pool_max_unused_age_seconds));
 
-  // conns_ is a std::map<HostPortPair, std::deque<TimestampedConnection>>
-  for (auto& entry : conns_) {
-    RemoveDeadConnectionsFromDeque(lock, &entry.second);
-    while (entry.second.front().first < cutoff &&
-           entry.second.size() >
-               static_cast<uint>(FLAGS_url_fetcher_max_conn_per_host_port)) {
-      entry.second.pop_front();
+  // shard->conns is a std::map<HostPortPair, HostConnections>
+  for (auto& entry : shard->conns) {
+    IdleList* const idle(&entry.second.idle);
+    // Forget about bursts that are past, so that their extra connections
+    // eventually go.
+    if (entry.second.peak_time < cutoff) {
+      entry.second.peak_in_use = entry.second.in_use;
+    }
+    const size_t max_idle(MaxIdle(lock, entry.second));
+    while (!idle->empty() && idle->front().first < cutoff &&
+           idle->size() > max_idle) {
+      idle->front().second->connection_->idle_ = false;
+      idle->pop_front();
     }
     const string hostport(HostPortString(entry.first));
     VLOG(1) << "ConnectionPool for " << hostport
-            << " size : " << entry.second.size();
-    connections_per_host_port->Set(hostport, entry.second.size());
+            << " size : " << idle->size();
+    connections_per_host_port->Set(hostport, idle->size());
   }
 }
 
@@ -3,11 +3,14 @@
 
 #include <openssl/ssl.h>
 #include <stdint.h>
-#include <deque>
+#include <chrono>
+#include <condition_variable>
+#include <list>
 #include <map>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <vector>
 
 #include "base/macros.h"
 #include "net/url.h"
@@ -60,30 +63,91 @@ class ConnectionPool {
   };
 
   ConnectionPool(libevent::Base* base);
+  ~ConnectionPool();
 
+  // Returns an idle connection to the host:port of |url|, or a new one.
+  // If --url_fetcher_max_active_conn_per_host_port connections to it
+  // are already in use, blocks until one is returned, so this must not
+  // be called on the event thread.
   std::unique_ptr<Connection> Get(const URL& url);
+  // Every connection returned by Get() must be given back here, even if
+  // it failed.
   void Put(std::unique_ptr<Connection> conn);
 
+  // The TLS context of our connections, with the trusted roots.
+  SSL_CTX* ssl_ctx() const {
+    return ssl_ctx_.get();
+  }
+
  private:
   typedef std::pair<std::chrono::system_clock::time_point,
                     std::unique_ptr<Connection>> TimestampedConnection;
+  typedef std::list<TimestampedConnection> IdleList;
+
+  struct HostConnections {
+    HostConnections() : in_use(0), peak_in_use(0) {
+    }
+
+    // We get and put connections from the back of the list, and when
+    // there are too many, we prune them from the front (LIFO). Each
+    // EvConnection knows its place in there, so that it can remove
+    // itself as soon as it dies.
+    IdleList idle;
+    int in_use;
+    // The most connections in use at once, last reached at |peak_time|.
+    // Up to that many idle connections are kept around until
+    // --connection_pool_max_unused_age_seconds after it, so that bursts
+    // of requests find them ready.
+    int peak_in_use;
+    std::chrono::system_clock::time_point peak_time;
+  };
+
+  // The connections of the host:port pairs that hash to it. Shared
+  // with the EvConnections, which can outlive the pool.
+  struct Shard {
+    Shard() : cleanup_scheduled(false) {
+    }
+
+    std::mutex lock;
+    std::condition_variable released;
+    std::map<HostPortPair, HostConnections> conns;
+    bool cleanup_scheduled;
+  };
 
-  static void RemoveDeadConnectionsFromDeque(
-      const std::unique_lock<std::mutex>& lock,
-      std::deque<TimestampedConnection>* deque);
+  const std::shared_ptr<Shard>& GetShard(const HostPortPair& key) const;
 
-  void Cleanup();
+  // The number of idle connections to keep for |conns|.
+  static size_t MaxIdle(const std::unique_lock<std::mutex>& lock,
+                        const HostConnections& conns);
+
+  static void Release(const std::unique_lock<std::mutex>& lock,
+                      const HostPortPair& key, Shard* shard);
+
+  // Removes |evc| from the idle connections of |shard|, if it is there.
+  static void RemoveIdle(const std::unique_lock<std::mutex>& lock,
+                         EvConnection* evc, Shard* shard);
+
+  void Cleanup(Shard* shard);
+
+  // Keeps the TLS sessions negotiated by our connections, so that new
+  // connections to the same host:port can resume them rather than do a
+  // full handshake.
+  static int NewSessionCallback(SSL* ssl, SSL_SESSION* session);
 
   libevent::Base* const base_;
 
-  std::mutex lock_;
-  // We get and put connections from the back of the deque, and when
-  // there are too many, we prune them from the front (LIFO).
-  std::map<HostPortPair, std::deque<TimestampedConnection>> conns_;
-  bool cleanup_scheduled_;
+  // Only contended by requests to the same few host:port pairs.
+  const std::vector<std::shared_ptr<Shard>> shards_;
 
   std::unique_ptr<evhtp_ssl_ctx_t, void (*)(evhtp_ssl_ctx_t*)> ssl_ctx_;
 
+  // The TLS session of the last connection to each host:port, which we
+  // own a reference to.
+  std::mutex sessions_lock_;
+  std::map<HostPortPair, SSL_SESSION*> sessions_;
+
+  friend class EvConnection;
+
   DISALLOW_COPY_AND_ASSIGN(ConnectionPool);
 };
 
@@ -0,0 +1,754 @@
+#include "net/http2_transport.h"
+
+#ifdef HAVE_NGHTTP2
+
+#include <event2/buffer.h>
+#include <event2/bufferevent.h>
+#include <event2/bufferevent_ssl.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <nghttp2/nghttp2.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <deque>
+#include <sstream>
+
+#include "util/openssl_util.h"
+
+extern "C" {
+#include "third_party/curl/hostcheck.h"
+#include "third_party/isec_partners/openssl_hostname_validation.h"
+}  // extern "C"
+
+using std::atomic;
+using std::deque;
+using std::function;
+using std::lock_guard;
+using std::make_pair;
+using std::make_shared;
+using std::map;
+using std::move;
+using std::mutex;
+using std::pair;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+using util::Task;
+
+DEFINE_string(url_fetcher_http2_schemes, "",
+              "comma-separated URL schemes fetched over HTTP/2 rather than "
+              "HTTP/1.1: for \"https\", HTTP/2 is negotiated with ALPN, "
+              "falling back to HTTP/1.1 with servers that do not support "
+              "it, for \"http\", the servers must support it in clear");
+DEFINE_int32(url_fetcher_http2_conn_per_host_port, 2,
+             "maximum number of HTTP/2 connections per host:port, each "
+             "carrying many requests at once");
+DEFINE_int32(url_fetcher_http2_streams_per_conn, 100,
+             "number of requests in progress on each HTTP/2 connection to "
+             "a host:port beyond which another one is opened, up to "
+             "--url_fetcher_http2_conn_per_host_port");
+
+DECLARE_int32(connection_read_timeout_seconds);
+
+namespace cert_trans {
+namespace internal {
+namespace {
+
+
+const unsigned char kAlpnH2[] = {2, 'h', '2'};
+// The flow control window of our connections and streams, large enough
+// for whole get-entries responses.
+const int32_t kWindowSize = 16 << 20;
+
+
+int GetSSLHostIndex() {
+  static const int ssl_host_index(
+      SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr));
+  return ssl_host_index;
+}
+
+
+// Checks the hostname in the certificate of the peer, like
+// EvConnection::SSLVerifyCallback() does for HTTP/1.1 connections.
+int VerifyCallback(const int preverify_ok, X509_STORE_CTX* x509_ctx) {
+  CHECK_NOTNULL(x509_ctx);
+  // Only do extra checks (i.e. hostname matching) for the end-entity cert.
+  if (preverify_ok == 0 || X509_STORE_CTX_get_error_depth(x509_ctx) > 0) {
+    return preverify_ok;
+  }
+
+  const SSL* const ssl(static_cast<SSL*>(CHECK_NOTNULL(
+      X509_STORE_CTX_get_ex_data(x509_ctx,
+                                 SSL_get_ex_data_X509_STORE_CTX_idx()))));
+  const string* const host(static_cast<const string*>(
+      CHECK_NOTNULL(SSL_get_ex_data(ssl, GetSSLHostIndex()))));
+  if (validate_hostname(host->c_str(),
+                        X509_STORE_CTX_get_current_cert(x509_ctx)) !=
+      MatchFound) {
+    LOG_EVERY_N(WARNING, 100) << "Failed to validate SSL certificate for "
+                              << *host << " : "
+                              << util::DumpOpenSSLErrorStack();
+    util::ClearOpenSSLErrors();
+    return 0;
+  }
+  return 1;
+}
+
+
+bool SchemeWanted(const string& scheme) {
+  std::istringstream schemes(FLAGS_url_fetcher_http2_schemes);
+  string wanted;
+  while (std::getline(schemes, wanted, ',')) {
+    if (wanted == scheme) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+pair<string, uint16_t> HostPort(const URL& url) {
+  const uint16_t default_port(url.Protocol() == "https" ? 443 : 80);
+  return make_pair(url.Host(), url.Port() != 0 ? url.Port() : default_port);
+}
+
+
+string VerbName(UrlFetcher::Verb verb) {
+  std::ostringstream name;
+  name << verb;
+  return name.str();
+}
+
+
+string ToLower(string s) {
+  std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+  return s;
+}
+
+
+// Headers which only apply to HTTP/1.1 connections, and must not be
+// sent over HTTP/2.
+bool IsConnectionHeader(const string& name) {
+  return name == "connection" || name == "keep-alive" ||
+         name == "proxy-connection" || name == "transfer-encoding" ||
+         name == "upgrade" || name == "host";
+}
+
+
+nghttp2_nv MakeNv(const string& name, const string& value) {
+  return nghttp2_nv{
+      reinterpret_cast<uint8_t*>(const_cast<char*>(name.data())),
+      reinterpret_cast<uint8_t*>(const_cast<char*>(value.data())),
+      name.size(), value.size(), NGHTTP2_NV_FLAG_NONE};
+}
+
+
+}  // namespace
+
+
+// One HTTP/2 connection. Apart from num_streams() and dead(), it is
+// only used on the event thread, once connecting. It keeps itself alive
+// for as long as its connection is open.
+class Http2Transport::Session
+    : public std::enable_shared_from_this<Http2Transport::Session> {
+ public:
+  Session(Http2Transport* transport, libevent::Base* base,
+          const HostPortPair& key, bool tls)
+      : transport_(transport),
+        base_(base),
+        key_(key),
+        tls_(tls),
+        bev_(nullptr),
+        session_(nullptr),
+        connected_(false),
+        http1_(false),
+        dead_(false),
+        num_streams_(0) {
+  }
+
+  ~Session() {
+    CHECK(!bev_);
+    CHECK(!session_);
+  }
+
+  // Starts connecting, resolving the host first.
+  void Connect(SSL_CTX* ssl_ctx);
+
+  // Queues a request, see Http2Transport::Fetch().
+  void Add(const UrlFetcher::Request* request, UrlFetcher::Response* response,
+           Task* task, const function<void()>& fallback);
+
+  // Makes sure that the transport is not used anymore, as it is going
+  // away.
+  void Detach() {
+    lock_guard<mutex> lock(transport_lock_);
+    transport_ = nullptr;
+  }
+
+  int num_streams() const {
+    return num_streams_.load();
+  }
+
+  bool dead() const {
+    return dead_.load();
+  }
+
+ private:
+  struct Stream {
+    const UrlFetcher::Request* request;
+    UrlFetcher::Response* response;
+    Task* task;
+    function<void()> fallback;
+    // How much of the request body has been sent.
+    size_t body_sent;
+    // Whether Response::on_headers has been called, if set.
+    bool headers_delivered;
+  };
+
+  // Calls Response::on_headers of |stream| if needed, once.
+  static void DeliverHeaders(Stream* stream);
+
+  static void ReadCallback(bufferevent* bev, void* arg);
+  static void EventCallback(bufferevent* bev, short events, void* arg);
+
+  // The nghttp2 callbacks, with the Session as |user_data|.
+  static ssize_t SendCallback(nghttp2_session* session, const uint8_t* data,
+                              size_t length, int flags, void* user_data);
+  static int OnHeaderCallback(nghttp2_session* session,
+                              const nghttp2_frame* frame,
+                              const uint8_t* name, size_t namelen,
+                              const uint8_t* value, size_t valuelen,
+                              uint8_t flags, void* user_data);
+  static int OnDataChunkRecvCallback(nghttp2_session* session, uint8_t flags,
+                                     int32_t stream_id, const uint8_t* data,
+                                     size_t len, void* user_data);
+  static int OnStreamCloseCallback(nghttp2_session* session,
+                                   int32_t stream_id, uint32_t error_code,
+                                   void* user_data);
+  static ssize_t ReadBodyCallback(nghttp2_session* session, int32_t stream_id,
+                                  uint8_t* buf, size_t length,
+                                  uint32_t* data_flags,
+                                  nghttp2_data_source* source,
+                                  void* user_data);
+
+  void Submit(unique_ptr<Stream> stream);
+  void SubmitNow(unique_ptr<Stream> stream);
+  void OnConnected();
+  // Sends whatever nghttp2 has for the peer, and closes the connection
+  // if neither side has anything more to say.
+  void Flush();
+  void UpdateTimeout();
+  void Finish(Stream* stream, const Status& status);
+  // Closes the connection, failing the requests still on it with
+  // |status|, or handing them to their fallback if the server turned
+  // out not to speak HTTP/2.
+  void Close(const Status& status);
+
+  mutex transport_lock_;
+  Http2Transport* transport_;
+  libevent::Base* const base_;
+  const HostPortPair key_;
+  const bool tls_;
+
+  // Set whilst the connection is open.
+  shared_ptr<Session> self_;
+  bufferevent* bev_;
+  nghttp2_session* session_;
+  bool connected_;
+  bool http1_;
+  // The requests waiting for the connection to be established.
+  deque<unique_ptr<Stream>> pending_;
+  map<int32_t, unique_ptr<Stream>> streams_;
+
+  atomic<bool> dead_;
+  atomic<int> num_streams_;
+
+  DISALLOW_COPY_AND_ASSIGN(Session);
+};
+
+
+void Http2Transport::Session::Connect(SSL_CTX* ssl_ctx) {
+  SSL* ssl(nullptr);
+  if (tls_) {
+    ssl = CHECK_NOTNULL(SSL_new(ssl_ctx));
+    SSL_set_tlsext_host_name(ssl, key_.first.c_str());
+    SSL_set_ex_data(ssl, GetSSLHostIndex(),
+                    const_cast<string*>(&key_.first));
+    SSL_set_verify(ssl, SSL_VERIFY_PEER, &VerifyCallback);
+    CHECK_EQ(SSL_set_alpn_protos(ssl, kAlpnH2, sizeof(kAlpnH2)), 0);
+  }
+
+  self_ = shared_from_this();
+  if (!base_->BufferEventConnect(key_.first, key_.second, ssl,
+                                 &Session::ReadCallback,
+                                 &Session::EventCallback, this)) {
+    const shared_ptr<Session> self(self_);
+    base_->Add([self]() {
+      self->Close(Status(util::error::UNAVAILABLE, "connection failed"));
+    });
+  }
+}
+
+
+void Http2Transport::Session::Add(const UrlFetcher::Request* request,
+                                  UrlFetcher::Response* response, Task* task,
+                                  const function<void()>& fallback) {
+  ++num_streams_;
+  const shared_ptr<Session> self(shared_from_this());
+  Stream* const stream(new Stream{request, response, task, fallback, 0, false});
+  base_->Add([self, stream]() { self->Submit(unique_ptr<Stream>(stream)); });
+}
+
+
+void Http2Transport::Session::Submit(unique_ptr<Stream> stream) {
+  CHECK(libevent::Base::OnEventThread());
+  if (http1_) {
+    --num_streams_;
+    return stream->fallback();
+  }
+  if (dead_) {
+    return Finish(stream.get(),
+                  Status(util::error::UNAVAILABLE, "connection failed"));
+  }
+  if (!connected_) {
+    pending_.emplace_back(move(stream));
+    return;
+  }
+  SubmitNow(move(stream));
+  Flush();
+}
+
+
+void Http2Transport::Session::SubmitNow(unique_ptr<Stream> stream) {
+  const UrlFetcher::Request& request(*stream->request);
+  stream->response->status_code = 0;
+  stream->response->headers.clear();
+  stream->response->body.clear();
+
+  // nghttp2 copies the names and values.
+  vector<pair<string, string>> headers;
+  headers.emplace_back(":method", VerbName(request.verb));
+  headers.emplace_back(":scheme", tls_ ? "https" : "http");
+  const auto host(request.headers.find("Host"));
+  headers.emplace_back(":authority", host != request.headers.end()
+                                         ? host->second
+                                         : request.url.Host());
+  headers.emplace_back(":path", request.url.PathQuery());
+  for (const auto& header : request.headers) {
+    const string name(ToLower(header.first));
+    if (!IsConnectionHeader(name)) {
+      headers.emplace_back(name, header.second);
+    }
+  }
+  vector<nghttp2_nv> nva;
+  for (const auto& header : headers) {
+    nva.push_back(MakeNv(header.first, header.second));
+  }
+
+  nghttp2_data_provider body;
+  body.source.ptr = stream.get();
+  body.read_callback = &Session::ReadBodyCallback;
+  const int32_t stream_id(nghttp2_submit_request(
+      session_, nullptr, nva.data(), nva.size(),
+      request.body.empty() ? nullptr : &body, stream.get()));
+  if (stream_id < 0) {
+    LOG(WARNING) << "nghttp2_submit_request failed: "
+                 << nghttp2_strerror(stream_id);
+    return Finish(stream.get(), Status(util::error::INTERNAL,
+                                       "could not submit HTTP/2 request"));
+  }
+  VLOG(1) << "HTTP/2 stream " << stream_id << " to " << key_.first << ":"
+          << key_.second << " for " << request.url.PathQuery();
+  streams_[stream_id] = move(stream);
+  UpdateTimeout();
+}
+
+
+// static
+void Http2Transport::Session::ReadCallback(bufferevent* bev, void* arg) {
+  Session* const session(static_cast<Session*>(CHECK_NOTNULL(arg)));
+  const shared_ptr<Session> self(session->self_);
+  session->bev_ = bev;
+  if (!session->session_) {
+    return;
+  }
+
+  evbuffer* const input(bufferevent_get_input(bev));
+  const size_t length(evbuffer_get_length(input));
+  const ssize_t read(nghttp2_session_mem_recv(
+      session->session_, evbuffer_pullup(input, -1), length));
+  if (read < 0) {
+    LOG(WARNING) << "HTTP/2 error from " << session->key_.first << ":"
+                 << session->key_.second << ": "
+                 << nghttp2_strerror(static_cast<int>(read));
+    return session->Close(
+        Status(util::error::UNAVAILABLE, "HTTP/2 protocol error"));
+  }
+  evbuffer_drain(input, length);
+  session->Flush();
+}
+
+
+// static
+void Http2Transport::Session::EventCallback(bufferevent* bev, short events,
+                                            void* arg) {
+  Session* const session(static_cast<Session*>(CHECK_NOTNULL(arg)));
+  const shared_ptr<Session> self(session->self_);
+  session->bev_ = bev;
+  if (events & BEV_EVENT_CONNECTED) {
+    return session->OnConnected();
+  }
+  if (events & BEV_EVENT_TIMEOUT) {
+    return session->Close(
+        Status(util::error::DEADLINE_EXCEEDED, "connection timed out"));
+  }
+  if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
+    VLOG(1) << "HTTP/2 connection to " << session->key_.first << ":"
+            << session->key_.second << " closed";
+    return session->Close(
+        Status(util::error::UNAVAILABLE, "connection failed"));
+  }
+}
+
+
+void Http2Transport::Session::OnConnected() {
+  if (tls_) {
+    const unsigned char* protocol(nullptr);
+    unsigned int length(0);
+    SSL_get0_alpn_selected(bufferevent_openssl_get_ssl(bev_), &protocol,
+                           &length);
+    if (length != 2 || memcmp(protocol, "h2", 2) != 0) {
+      LOG(INFO) << key_.first << ":" << key_.second
+                << " does not support HTTP/2, using HTTP/1.1";
+      {
+        lock_guard<mutex> lock(transport_lock_);
+        if (transport_) {
+          transport_->SetHttp1Only(key_);
+        }
+      }
+      http1_ = true;
+      return Close(Status::OK);
+    }
+  }
+
+  nghttp2_session_callbacks* callbacks;
+  CHECK_EQ(nghttp2_session_callbacks_new(&callbacks), 0);
+  nghttp2_session_callbacks_set_send_callback(callbacks,
+                                              &Session::SendCallback);
+  nghttp2_session_callbacks_set_on_header_callback(
+      callbacks, &Session::OnHeaderCallback);
+  nghttp2_session_callbacks_set_on_data_chunk_recv_callback(
+      callbacks, &Session::OnDataChunkRecvCallback);
+  nghttp2_session_callbacks_set_on_stream_close_callback(
+      callbacks, &Session::OnStreamCloseCallback);
+  CHECK_EQ(nghttp2_session_client_new(&session_, callbacks, this), 0);
+  nghttp2_session_callbacks_del(callbacks);
+
+  const nghttp2_settings_entry settings[] = {
+      {NGHTTP2_SETTINGS_ENABLE_PUSH, 0},
+      {NGHTTP2_SETTINGS_INITIAL_WINDOW_SIZE, kWindowSize},
+  };
+  CHECK_EQ(nghttp2_submit_settings(session_, NGHTTP2_FLAG_NONE, settings,
+                                   sizeof(settings) / sizeof(settings[0])),
+           0);
+  CHECK_EQ(nghttp2_session_set_local_window_size(session_, NGHTTP2_FLAG_NONE,
+                                                 0, kWindowSize),
+           0);
+  connected_ = true;
+  VLOG(1) << "HTTP/2 connection to " << key_.first << ":" << key_.second
+          << " established";
+
+  while (!pending_.empty()) {
+    unique_ptr<Stream> stream(move(pending_.front()));
+    pending_.pop_front();
+    SubmitNow(move(stream));
+  }
+  Flush();
+}
+
+
+void Http2Transport::Session::Flush() {
+  if (!session_) {
+    return;
+  }
+  const int ret(nghttp2_session_send(session_));
+  if (ret != 0) {
+    LOG(WARNING) << "HTTP/2 send error to " << key_.first << ":"
+                 << key_.second << ": " << nghttp2_strerror(ret);
+    return Close(Status(util::error::UNAVAILABLE, "HTTP/2 send error"));
+  }
+  if (!nghttp2_session_want_read(session_) &&
+      !nghttp2_session_want_write(session_)) {
+    // The peer sent a GOAWAY, and all the streams are done.
+    Close(Status(util::error::UNAVAILABLE, "connection closed by peer"));
+  }
+}
+
+
+void Http2Transport::Session::UpdateTimeout() {
+  if (!bev_) {
+    return;
+  }
+  // Idle connections are left open, but requests must make progress.
+  if (streams_.empty()) {
+    bufferevent_set_timeouts(bev_, nullptr, nullptr);
+  } else {
+    const struct timeval read_timeout = {
+        FLAGS_connection_read_timeout_seconds, 0};
+    bufferevent_set_timeouts(bev_, &read_timeout, nullptr);
+  }
+}
+
+
+void Http2Transport::Session::Finish(Stream* stream, const Status& status) {
+  --num_streams_;
+  if (status.ok() && stream->response->status_code >= 100) {
+    // For responses without a body.
+    DeliverHeaders(stream);
+  }
+  if (status.ok() && stream->response->status_code < 100) {
+    stream->task->Return(Status(util::error::UNAVAILABLE,
+                                "HTTP/2 response without a status"));
+  } else {
+    stream->task->Return(status);
+  }
+}
+
+
+void Http2Transport::Session::Close(const Status& status) {
+  CHECK(libevent::Base::OnEventThread());
+  if (dead_) {
+    return;
+  }
+  dead_ = true;
+  // Released when returning, we might be all that keeps us alive.
+  const shared_ptr<Session> self(move(self_));
+
+  if (session_) {
+    nghttp2_session_del(session_);
+    session_ = nullptr;
+  }
+  if (bev_) {
+    bufferevent_free(bev_);
+    bev_ = nullptr;
+  }
+
+  for (const auto& stream : streams_) {
+    Finish(stream.second.get(), status);
+  }
+  streams_.clear();
+  while (!pending_.empty()) {
+    unique_ptr<Stream> stream(move(pending_.front()));
+    pending_.pop_front();
+    if (http1_) {
+      --num_streams_;
+      stream->fallback();
+    } else {
+      Finish(stream.get(), status);
+    }
+  }
+}
+
+
+// static
+ssize_t Http2Transport::Session::SendCallback(nghttp2_session*,
+                                              const uint8_t* data,
+                                              size_t length, int,
+                                              void* user_data) {
+  Session* const session(static_cast<Session*>(user_data));
+  if (bufferevent_write(session->bev_, data, length) != 0) {
+    return NGHTTP2_ERR_CALLBACK_FAILURE;
+  }
+  return length;
+}
+
+
+// static
+int Http2Transport::Session::OnHeaderCallback(
+    nghttp2_session* session, const nghttp2_frame* frame, const uint8_t* name,
+    size_t namelen, const uint8_t* value, size_t valuelen, uint8_t,
+    void*) {
+  if (frame->hd.type != NGHTTP2_HEADERS) {
+    return 0;
+  }
+  Stream* const stream(static_cast<Stream*>(
+      nghttp2_session_get_stream_user_data(session, frame->hd.stream_id)));
+  if (!stream) {
+    return 0;
+  }
+  const string header_name(reinterpret_cast<const char*>(name), namelen);
+  const string header_value(reinterpret_cast<const char*>(value), valuelen);
+  if (header_name == ":status") {
+    stream->response->status_code = atoi(header_value.c_str());
+  } else if (header_name[0] != ':') {
+    stream->response->headers.insert(make_pair(header_name, header_value));
+  }
+  return 0;
+}
+
+
+// static
+int Http2Transport::Session::OnDataChunkRecvCallback(nghttp2_session* session,
+                                                     uint8_t,
+                                                     int32_t stream_id,
+                                                     const uint8_t* data,
+                                                     size_t len, void*) {
+  Stream* const stream(static_cast<Stream*>(
+      nghttp2_session_get_stream_user_data(session, stream_id)));
+  if (!stream) {
+    return 0;
+  }
+  // The headers are complete by the time the body comes.
+  DeliverHeaders(stream);
+  UrlFetcher::Response* const response(stream->response);
+  if (!response->on_body) {
+    response->body.append(reinterpret_cast<const char*>(data), len);
+    return 0;
+  }
+  const unique_ptr<evbuffer, void (*)(evbuffer*)> buffer(
+      CHECK_NOTNULL(evbuffer_new()), &evbuffer_free);
+  CHECK_EQ(evbuffer_add(buffer.get(), data, len), 0);
+  response->on_body(buffer.get());
+  // Whatever is left goes to the body, as with HTTP/1.1.
+  const size_t left(evbuffer_get_length(buffer.get()));
+  response->body.append(
+      reinterpret_cast<const char*>(evbuffer_pullup(buffer.get(), -1)), left);
+  return 0;
+}
+
+
+// static
+void Http2Transport::Session::DeliverHeaders(Stream* stream) {
+  if (stream->headers_delivered) {
+    return;
+  }
+  stream->headers_delivered = true;
+  if (stream->response->on_headers) {
+    stream->response->on_headers();
+  }
+}
+
+
+// static
+int Http2Transport::Session::OnStreamCloseCallback(nghttp2_session*,
+                                                   int32_t stream_id,
+                                                   uint32_t error_code,
+                                                   void* user_data) {
+  Session* const session(static_cast<Session*>(user_data));
+  const auto it(session->streams_.find(stream_id));
+  if (it == session->streams_.end()) {
+    return 0;
+  }
+  if (error_code == NGHTTP2_NO_ERROR) {
+    VLOG(2) << *it->second->response;
+    session->Finish(it->second.get(), Status::OK);
+  } else {
+    session->Finish(it->second.get(),
+                    Status(util::error::UNAVAILABLE,
+                           string("HTTP/2 stream reset: ") +
+                               nghttp2_http2_strerror(error_code)));
+  }
+  session->streams_.erase(it);
+  session->UpdateTimeout();
+  return 0;
+}
+
+
+// static
+ssize_t Http2Transport::Session::ReadBodyCallback(
+    nghttp2_session*, int32_t, uint8_t* buf, size_t length,
+    uint32_t* data_flags, nghttp2_data_source* source, void*) {
+  Stream* const stream(static_cast<Stream*>(source->ptr));
+  const string& body(stream->request->body);
+  const size_t size(std::min(length, body.size() - stream->body_sent));
+  memcpy(buf, body.data() + stream->body_sent, size);
+  stream->body_sent += size;
+  if (stream->body_sent == body.size()) {
+    *data_flags |= NGHTTP2_DATA_FLAG_EOF;
+  }
+  return size;
+}
+
+
+Http2Transport::Http2Transport(libevent::Base* base, SSL_CTX* ssl_ctx)
+    : base_(CHECK_NOTNULL(base)), ssl_ctx_(CHECK_NOTNULL(ssl_ctx)) {
+  CHECK_GT(FLAGS_url_fetcher_http2_conn_per_host_port, 0);
+  CHECK_GT(FLAGS_url_fetcher_http2_streams_per_conn, 0);
+}
+
+
+Http2Transport::~Http2Transport() {
+  for (const auto& entry : sessions_) {
+    for (const auto& session : entry.second) {
+      session->Detach();
+    }
+  }
+}
+
+
+bool Http2Transport::ShouldTry(const URL& url) const {
+  if (!SchemeWanted(url.Protocol())) {
+    return false;
+  }
+  lock_guard<mutex> lock(lock_);
+  return http1_only_.count(HostPort(url)) == 0;
+}
+
+
+void Http2Transport::SetHttp1Only(const HostPortPair& key) {
+  lock_guard<mutex> lock(lock_);
+  http1_only_.insert(key);
+}
+
+
+shared_ptr<Http2Transport::Session> Http2Transport::GetSession(
+    const HostPortPair& key, bool tls) {
+  shared_ptr<Session> session;
+  {
+    lock_guard<mutex> lock(lock_);
+    vector<shared_ptr<Session>>* const sessions(&sessions_[key]);
+    sessions->erase(std::remove_if(sessions->begin(), sessions->end(),
+                                   [](const shared_ptr<Session>& s) {
+                                     return s->dead();
+                                   }),
+                    sessions->end());
+    for (const auto& s : *sessions) {
+      if (!session || s->num_streams() < session->num_streams()) {
+        session = s;
+      }
+    }
+    if (session &&
+        (session->num_streams() < FLAGS_url_fetcher_http2_streams_per_conn ||
+         sessions->size() >=
+             static_cast<size_t>(FLAGS_url_fetcher_http2_conn_per_host_port))) {
+      return session;
+    }
+    session = make_shared<Session>(this, base_, key, tls);
+    sessions->push_back(session);
+  }
+  // Other requests can already be queued on it whilst it resolves the
+  // host.
+  VLOG(1) << "new HTTP/2 connection for " << key.first << ":" << key.second;
+  session->Connect(ssl_ctx_);
+  return session;
+}
+
+
+void Http2Transport::Fetch(const UrlFetcher::Request* request,
+                           UrlFetcher::Response* response, Task* task,
+                           const function<void()>& fallback) {
+  CHECK(!libevent::Base::OnEventThread());
+  GetSession(HostPort(request->url), request->url.Protocol() == "https")
+      ->Add(request, response, task, fallback);
+}
+
+
+}  // namespace internal
+}  // namespace cert_trans
+
+#endif  // HAVE_NGHTTP2
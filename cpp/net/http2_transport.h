@@ -0,0 +1,78 @@
+#ifndef CERT_TRANS_NET_HTTP2_TRANSPORT_H_
+#define CERT_TRANS_NET_HTTP2_TRANSPORT_H_
+
+#include "config.h"
+
+#ifdef HAVE_NGHTTP2
+
+#include <openssl/ssl.h>
+#include <stdint.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "net/url.h"
+#include "net/url_fetcher.h"
+#include "util/libevent_wrapper.h"
+#include "util/task.h"
+
+namespace cert_trans {
+namespace internal {
+
+
+// Sends the requests of a UrlFetcher over HTTP/2, multiplexing them
+// over up to --url_fetcher_http2_conn_per_host_port connections per
+// host:port, rather than using a connection for each request at once.
+class Http2Transport {
+ public:
+  // Uses |ssl_ctx|, which must outlive this, for https URLs, with its
+  // trusted roots. The hostname of the peer is checked here.
+  Http2Transport(libevent::Base* base, SSL_CTX* ssl_ctx);
+  ~Http2Transport();
+
+  // Whether requests to |url| should be sent here, which depends on its
+  // scheme (see --url_fetcher_http2_schemes) and on whether its server
+  // is known not to speak HTTP/2.
+  bool ShouldTry(const URL& url) const;
+
+  // Like UrlFetcher::Fetch(), with a normalised |request|, which must
+  // stay valid until |task| is done. If the server does not agree to
+  // speak HTTP/2 (with ALPN), |fallback| is called instead, on the
+  // event thread, and later requests to it are not sent here anymore.
+  // May block to resolve the host, so must not be called on the event
+  // thread.
+  void Fetch(const UrlFetcher::Request* request,
+             UrlFetcher::Response* response, util::Task* task,
+             const std::function<void()>& fallback);
+
+ private:
+  class Session;
+  typedef std::pair<std::string, uint16_t> HostPortPair;
+
+  // Returns the session to send the next request to |key| on, creating
+  // it if needed.
+  std::shared_ptr<Session> GetSession(const HostPortPair& key, bool tls);
+  void SetHttp1Only(const HostPortPair& key);
+
+  libevent::Base* const base_;
+  SSL_CTX* const ssl_ctx_;
+
+  mutable std::mutex lock_;
+  std::map<HostPortPair, std::vector<std::shared_ptr<Session>>> sessions_;
+  std::set<HostPortPair> http1_only_;
+
+  DISALLOW_COPY_AND_ASSIGN(Http2Transport);
+};
+
+
+}  // namespace internal
+}  // namespace cert_trans
+
+#endif  // HAVE_NGHTTP2
+
+#endif  // CERT_TRANS_NET_HTTP2_TRANSPORT_H_
@@ -6,15 +6,20 @@
 #include <glog/logging.h>
 #include <htparse.h>
 
+#include "monitoring/monitoring.h"
 #include "net/connection_pool.h"
+#include "net/http2_transport.h"
 #include "util/thread_pool.h"
 
 using cert_trans::internal::ConnectionPool;
 using std::bind;
+using std::chrono::steady_clock;
 using std::endl;
 using std::make_pair;
+using std::make_shared;
 using std::move;
 using std::ostream;
+using std::shared_ptr;
 using std::string;
 using std::to_string;
 using std::unique_ptr;
@@ -29,18 +34,34 @@ struct UrlFetcher::Impl {
   Impl(libevent::Base* base, ThreadPool* thread_pool)
       : base_(CHECK_NOTNULL(base)),
         thread_pool_(CHECK_NOTNULL(thread_pool)),
-        pool_(base_) {
+        pool_(base_)
+#ifdef HAVE_NGHTTP2
+        ,
+        http2_(base_, pool_.ssl_ctx())
+#endif
+  {
   }
 
   libevent::Base* const base_;
   ThreadPool* const thread_pool_;
   internal::ConnectionPool pool_;
+#ifdef HAVE_NGHTTP2
+  internal::Http2Transport http2_;
+#endif
 };
 
 
 namespace {
 
 
+static Counter<string>* total_abandoned_fetches(
+    Counter<string>::New("total_abandoned_fetches", "reason",
+                         "Number of fetches given up on before their "
+                         "response came, because they were cancelled "
+                         "(\"cancelled\") or past their deadline "
+                         "(\"deadline\")."));
+
+
 htp_method VerbToCmdType(UrlFetcher::Verb verb) {
   switch (verb) {
     case UrlFetcher::Verb::GET:
@@ -60,7 +81,7 @@ htp_method VerbToCmdType(UrlFetcher::Verb verb) {
 }
 
 
-struct State {
+struct State : public std::enable_shared_from_this<State> {
   State(libevent::Base* base, ConnectionPool* pool,
         const UrlFetcher::Request& request, UrlFetcher::Response* response,
         Task* task);
@@ -69,20 +90,41 @@ struct State {
     CHECK(!conn_) << "request state object still had a connection at cleanup?";
   }
 
+  // Whether the fetch was cancelled or is past its deadline, and so
+  // not worth sending.
+  bool Unwanted() const;
+  // Returns |task_| with CANCELLED, or DEADLINE_EXCEEDED if it was not
+  // cancelled.
+  void ReturnAbandoned();
+  // Has Abandon() run on the libevent dispatch thread, holding |task_|
+  // until then.
+  void ScheduleAbandon();
+
   void MakeRequest();
 
   // The following methods must only be called on the libevent
   // dispatch thread.
   void RunRequest();
   void RequestDone(evhtp_request_t* req);
+  // Gives up on the request in flight, if there is one.
+  void Abandon();
 
   libevent::Base* const base_;
   ConnectionPool* const pool_;
   const UrlFetcher::Request request_;
   UrlFetcher::Response* const response_;
   Task* const task_;
+  // Whether ResponseHeadersCallback() got the status code.
+  bool headers_received_;
 
   unique_ptr<ConnectionPool::Connection> conn_;
+  // The request evhtp has in flight, if any, and a reference to this
+  // object until it is done, as it can outlive |task_| once abandoned.
+  evhtp_request_t* http_req_;
+  shared_ptr<State> in_flight_;
+  // Whether |task_| was returned while the request was in flight, |task_|
+  // and |response_| not to be used anymore.
+  bool abandoned_;
 };
 
 
@@ -91,6 +133,41 @@ void RequestCallback(evhtp_request_t* req, void* userdata) {
 }
 
 
+void CopyHeaders(evhtp_headers_t* in, UrlFetcher::Headers* out) {
+  out->clear();
+  for (evhtp_kv_s* ptr = in->tqh_first; ptr; ptr = ptr->next.tqe_next) {
+    out->insert(make_pair(ptr->key, ptr->val));
+  }
+}
+
+
+evhtp_res ResponseHeadersCallback(evhtp_request_t* req,
+                                  evhtp_headers_t* headers,
+                                  void* userdata) {
+  State* const state(static_cast<State*>(CHECK_NOTNULL(userdata)));
+  UrlFetcher::Response* const response(state->response_);
+  // |req->status| is not set yet, and gets the return value of this
+  // hook.
+  response->status_code = htparser_get_status(req->conn->parser);
+  state->headers_received_ = true;
+  CopyHeaders(headers, &response->headers);
+  if (response->on_headers) {
+    response->on_headers();
+  }
+  return EVHTP_RES_OK;
+}
+
+
+evhtp_res ResponseBodyCallback(evhtp_request_t*, evbuf_t* buf,
+                               void* userdata) {
+  UrlFetcher::Response* const response(
+      static_cast<State*>(CHECK_NOTNULL(userdata))->response_);
+  // Whatever is left in |buf| goes to the body of the request.
+  response->on_body(buf);
+  return EVHTP_RES_OK;
+}
+
+
 UrlFetcher::Request NormaliseRequest(UrlFetcher::Request req) {
   if (req.url.Path().empty()) {
     req.url.SetPath("/");
@@ -111,7 +188,10 @@ State::State(libevent::Base* base, ConnectionPool* pool,
       pool_(CHECK_NOTNULL(pool)),
       request_(NormaliseRequest(request)),
       response_(CHECK_NOTNULL(response)),
-      task_(CHECK_NOTNULL(task)) {
+      task_(CHECK_NOTNULL(task)),
+      headers_received_(false),
+      http_req_(nullptr),
+      abandoned_(false) {
   if (request_.url.Protocol() != "http" &&
       request_.url.Protocol() != "https") {
     VLOG(1) << "unsupported protocol: " << request_.url.Protocol();
@@ -123,8 +203,38 @@ State::State(libevent::Base* base, ConnectionPool* pool,
 }
 
 
+bool State::Unwanted() const {
+  return task_->CancelRequested() || steady_clock::now() >= request_.deadline;
+}
+
+
+void State::ReturnAbandoned() {
+  const bool cancelled(task_->CancelRequested());
+  if (task_->Return(cancelled ? Status::CANCELLED
+                              : Status(util::error::DEADLINE_EXCEEDED,
+                                       "UrlFetcher: deadline exceeded"))) {
+    total_abandoned_fetches->Increment(cancelled ? "cancelled" : "deadline");
+  }
+}
+
+
+void State::ScheduleAbandon() {
+  task_->AddHold();
+  base_->Add([this]() {
+    Task* const task(task_);
+    Abandon();
+    task->RemoveHold();
+  });
+}
+
+
 void State::MakeRequest() {
   CHECK(!libevent::Base::OnEventThread());
+  // Do not wait for a connection only to drop it.
+  if (Unwanted()) {
+    ReturnAbandoned();
+    return;
+  }
   conn_ = pool_->Get(request_.url);
   base_->Add(bind(&State::RunRequest, this));
 }
@@ -132,8 +242,23 @@ void State::MakeRequest() {
 
 void State::RunRequest() {
   CHECK(libevent::Base::OnEventThread());
+  if (Unwanted()) {
+    pool_->Put(move(conn_));
+    ReturnAbandoned();
+    return;
+  }
+
   evhtp_request_t* const http_req(
       CHECK_NOTNULL(evhtp_request_new(&RequestCallback, this)));
+  if (response_->on_headers || response_->on_body) {
+    evhtp_set_hook(&http_req->hooks, evhtp_hook_on_headers,
+                   reinterpret_cast<evhtp_hook>(&ResponseHeadersCallback),
+                   this);
+  }
+  if (response_->on_body) {
+    evhtp_set_hook(&http_req->hooks, evhtp_hook_on_read,
+                   reinterpret_cast<evhtp_hook>(&ResponseBodyCallback), this);
+  }
   if (!request_.body.empty() &&
       request_.headers.find("Content-Length") == request_.headers.end()) {
     evhtp_headers_add_header(
@@ -148,7 +273,7 @@ void State::RunRequest() {
   }
 
   if (!conn_->connection() || conn_->GetErrored()) {
-    conn_.reset();
+    pool_->Put(move(conn_));
     task_->Return(Status(util::error::UNAVAILABLE, "connection failed."));
     return;
   }
@@ -167,6 +292,8 @@ void State::RunRequest() {
     task_->Return(Status(util::error::INTERNAL, "evhtp_make_request error"));
     return;
   }
+  http_req_ = http_req;
+  in_flight_ = shared_from_this();
 
   // evhtp_make_request doesn't know anything about the body, so we send it
   // outselves here:
@@ -194,8 +321,14 @@ struct evhtp_request_deleter {
 void State::RequestDone(evhtp_request_t* req) {
   CHECK(libevent::Base::OnEventThread());
   CHECK(conn_);
+  // Released last, as it might be the last reference to this object.
+  const shared_ptr<State> self(move(in_flight_));
+  http_req_ = nullptr;
   this->pool_->Put(move(conn_));
   unique_ptr<evhtp_request_t, evhtp_request_deleter> req_deleter(req);
+  if (abandoned_) {
+    return;
+  }
 
   if (!req) {
     // TODO(pphaneuf): The dreaded null request... These are fairly
@@ -209,7 +342,10 @@ void State::RequestDone(evhtp_request_t* req) {
     return;
   }
 
-  response_->status_code = req->status;
+  // Errors are still reported through |req->status|.
+  if (!headers_received_ || req->status < 100) {
+    response_->status_code = req->status;
+  }
   if (response_->status_code < 100) {
     util::Status status;
     switch (response_->status_code) {
@@ -234,11 +370,7 @@ void State::RequestDone(evhtp_request_t* req) {
     return;
   }
 
-  response_->headers.clear();
-  for (evhtp_kv_s* ptr = req->headers_in->tqh_first; ptr;
-       ptr = ptr->next.tqe_next) {
-    response_->headers.insert(make_pair(ptr->key, ptr->val));
-  }
+  CopyHeaders(req->headers_in, &response_->headers);
 
   const size_t body_length(evbuffer_get_length(req->buffer_in));
   string body(reinterpret_cast<const char*>(
@@ -252,6 +384,23 @@ void State::RequestDone(evhtp_request_t* req) {
 }
 
 
+void State::Abandon() {
+  CHECK(libevent::Base::OnEventThread());
+  // A request not sent yet is dropped by RunRequest() instead.
+  if (!http_req_ || abandoned_) {
+    return;
+  }
+  VLOG(1) << "abandoning request to " << request_.url.Host() << ":"
+          << request_.url.Port() << request_.url.PathQuery();
+  // The rest of the response goes to the request's own buffer, which
+  // RequestDone() drops.
+  evhtp_unset_hook(&http_req_->hooks, evhtp_hook_on_headers);
+  evhtp_unset_hook(&http_req_->hooks, evhtp_hook_on_read);
+  abandoned_ = true;
+  ReturnAbandoned();
+}
+
+
 }  // namespace
 
 
@@ -273,8 +422,44 @@ UrlFetcher::~UrlFetcher() {
 void UrlFetcher::Fetch(const Request& req, Response* resp, Task* task) {
   TaskHold hold(task);
 
-  State* const state(new State(impl_->base_, &impl_->pool_, req, resp, task));
-  task->DeleteWhenDone(state);
+  const shared_ptr<State> owner(
+      make_shared<State>(impl_->base_, &impl_->pool_, req, resp, task));
+  task->DeleteWhenDone(new shared_ptr<State>(owner));
+  State* const state(owner.get());
+  if (!task->IsActive()) {
+    return;
+  }
+  if (state->Unwanted()) {
+    return state->ReturnAbandoned();
+  }
+
+  task->WhenCancelled(bind(&State::ScheduleAbandon, state));
+  if (req.deadline != steady_clock::time_point::max()) {
+    impl_->base_->Delay(req.deadline - steady_clock::now(),
+                        task->AddChild([state](Task* timer) {
+                          // The timer is cancelled if the fetch is done
+                          // first.
+                          if (timer->status().ok()) {
+                            state->ScheduleAbandon();
+                          }
+                        }));
+  }
+
+#ifdef HAVE_NGHTTP2
+  if (impl_->http2_.ShouldTry(state->request_.url)) {
+    Impl* const impl(impl_.get());
+    // Falls back to HTTP/1.1 for servers that turn out not to speak
+    // HTTP/2.
+    const std::function<void()> fallback([impl, state]() {
+      impl->thread_pool_->Add(bind(&State::MakeRequest, state));
+    });
+    impl_->thread_pool_->Add([impl, state, fallback]() {
+      impl->http2_.Fetch(&state->request_, state->response_, state->task_,
+                         fallback);
+    });
+    return;
+  }
+#endif
 
   // Run State::MakeRequest() on the task's executor because it may
   // block doing DNS resolution etc.
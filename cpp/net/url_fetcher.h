@@ -2,6 +2,7 @@
 #define CERT_TRANS_NET_URL_FETCHER_H_
 
 #include <chrono>
+#include <functional>
 #include <map>
 #include <memory>
 #include <ostream>
@@ -12,6 +13,8 @@
 #include "util/compare.h"
 #include "util/task.h"
 
+struct evbuffer;
+
 namespace cert_trans {
 
 namespace libevent {
@@ -34,15 +37,24 @@ class UrlFetcher {
   };
 
   struct Request {
-    Request() : verb(Verb::GET) {
+    Request()
+        : verb(Verb::GET),
+          deadline(std::chrono::steady_clock::time_point::max()) {
     }
-    Request(const URL& input_url) : verb(Verb::GET), url(input_url) {
+    Request(const URL& input_url)
+        : verb(Verb::GET),
+          url(input_url),
+          deadline(std::chrono::steady_clock::time_point::max()) {
     }
 
     Verb verb;
     URL url;
     Headers headers;
     std::string body;
+    // The fetch fails with DEADLINE_EXCEEDED if the response is not in
+    // by then, the default being to wait as long as the connection
+    // timeouts allow.
+    std::chrono::steady_clock::time_point deadline;
   };
 
   struct Response {
@@ -52,6 +64,14 @@ class UrlFetcher {
     int status_code;
     Headers headers;
     std::string body;
+
+    // Optional, to handle the response as it arrives rather than once it
+    // is complete. |on_headers| is called once |status_code| and
+    // |headers| are set, then |on_body| with each part of the body,
+    // which it can take out of the evbuffer to avoid copying it into
+    // |body|. Both are called on the event thread of the fetcher.
+    std::function<void()> on_headers;
+    std::function<void(evbuffer*)> on_body;
   };
 
   UrlFetcher(libevent::Base* base, ThreadPool* thread_pool);
@@ -61,6 +81,10 @@ class UrlFetcher {
   // undefined state. If it is OK, it only means that the transaction
   // with the remote server went correctly, you should still check
   // Response::status_code.
+  //
+  // Cancelling |task| abandons the request, which returns CANCELLED
+  // without waiting for the remote server. The rest of its response is
+  // then read and dropped, and only after that is the connection reused.
   virtual void Fetch(const Request& req, Response* resp, util::Task* task);
 
  protected:
@@ -8,6 +8,7 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
+#include <chrono>
 #include <csignal>
 #ifdef HAVE_NETDB_H
 #include <netdb.h>
@@ -290,6 +291,41 @@ TEST_F(UrlFetcherTest, TestTimeout) {
 }
 
 
+TEST_F(UrlFetcherTest, TestDeadline) {
+  UrlFetcher::Request req(URL("http://localhost:" + to_string(kHangPort)));
+  req.deadline = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+  UrlFetcher::Response resp;
+
+  FLAGS_connection_read_timeout_seconds = 60;
+  FLAGS_connection_write_timeout_seconds = 60;
+
+  SyncTask task(&pool_);
+  fetcher_->Fetch(req, &resp, task.task());
+  task.Wait();
+
+  // Given up on before the connection timed out.
+  EXPECT_THAT(task.status(), StatusIs(util::error::DEADLINE_EXCEEDED));
+  EXPECT_EQ(0, resp.status_code);
+}
+
+
+TEST_F(UrlFetcherTest, TestCancel) {
+  UrlFetcher::Request req(URL("http://localhost:" + to_string(kHangPort)));
+  UrlFetcher::Response resp;
+
+  FLAGS_connection_read_timeout_seconds = 60;
+  FLAGS_connection_write_timeout_seconds = 60;
+
+  SyncTask task(&pool_);
+  fetcher_->Fetch(req, &resp, task.task());
+  task.Cancel();
+  task.Wait();
+
+  EXPECT_THAT(task.status(), StatusIs(util::error::CANCELLED));
+  EXPECT_EQ(0, resp.status_code);
+}
+
+
 }  // namespace cert_trans
 
 
@@ -40,6 +40,24 @@ SerializeResult CheckCertificateFormat(const string& cert) {
 }
 
 
+// The size of the V1 signature inputs and Merkle tree leaves: the version,
+// signature or leaf type, timestamp and entry type, followed by the issuer
+// key hash of precertificates, the certificate and the extensions.
+size_t V1EntrySize(size_t issuer_key_hash_size, const string& certificate,
+                   const string& extensions) {
+  static_assert(Serializer::kSignatureTypeLengthInBytes ==
+                    Serializer::kMerkleLeafTypeLengthInBytes,
+                "signature types and leaf types differ in size");
+  return Serializer::kVersionLengthInBytes +
+         Serializer::kSignatureTypeLengthInBytes +
+         Serializer::kTimestampLengthInBytes +
+         Serializer::kLogEntryTypeLengthInBytes + issuer_key_hash_size +
+         TLSSerializer::VarBytesSize<kMaxCertificateLength>(certificate) +
+         TLSSerializer::VarBytesSize<Serializer::kMaxExtensionsLength>(
+             extensions);
+}
+
+
 string CertV1LeafData(const LogEntry& entry) {
   switch (entry.type()) {
     // TODO(mhs): Because there is no X509_ENTRY_V2 we have to assume that
@@ -77,15 +95,14 @@ SerializeResult SerializeV1CertSCTSignatureInput(uint64_t timestamp,
   if (res != SerializeResult::OK) {
     return res;
   }
-  TLSSerializer serializer;
-  serializer.WriteUint(ct::V1, Serializer::kVersionLengthInBytes);
-  serializer.WriteUint(ct::CERTIFICATE_TIMESTAMP,
-                       Serializer::kSignatureTypeLengthInBytes);
-  serializer.WriteUint(timestamp, Serializer::kTimestampLengthInBytes);
-  serializer.WriteUint(ct::X509_ENTRY, Serializer::kLogEntryTypeLengthInBytes);
-  serializer.WriteVarBytes(certificate, kMaxCertificateLength);
-  serializer.WriteVarBytes(extensions, Serializer::kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  TLSSerializer serializer(result, V1EntrySize(0, certificate, extensions));
+  serializer.WriteUint<Serializer::kVersionLengthInBytes>(ct::V1);
+  serializer.WriteUint<Serializer::kSignatureTypeLengthInBytes>(
+      ct::CERTIFICATE_TIMESTAMP);
+  serializer.WriteUint<Serializer::kTimestampLengthInBytes>(timestamp);
+  serializer.WriteUint<Serializer::kLogEntryTypeLengthInBytes>(ct::X509_ENTRY);
+  serializer.WriteVarBytes<kMaxCertificateLength>(certificate);
+  serializer.WriteVarBytes<Serializer::kMaxExtensionsLength>(extensions);
   return SerializeResult::OK;
 }
 
@@ -105,17 +122,17 @@ SerializeResult SerializeV1PrecertSCTSignatureInput(
   if (res != SerializeResult::OK) {
     return res;
   }
-  TLSSerializer serializer;
-  serializer.WriteUint(ct::V1, Serializer::kVersionLengthInBytes);
-  serializer.WriteUint(ct::CERTIFICATE_TIMESTAMP,
-                       Serializer::kSignatureTypeLengthInBytes);
-  serializer.WriteUint(timestamp, Serializer::kTimestampLengthInBytes);
-  serializer.WriteUint(ct::PRECERT_ENTRY,
-                       Serializer::kLogEntryTypeLengthInBytes);
+  TLSSerializer serializer(
+      result, V1EntrySize(issuer_key_hash.size(), tbs_certificate, extensions));
+  serializer.WriteUint<Serializer::kVersionLengthInBytes>(ct::V1);
+  serializer.WriteUint<Serializer::kSignatureTypeLengthInBytes>(
+      ct::CERTIFICATE_TIMESTAMP);
+  serializer.WriteUint<Serializer::kTimestampLengthInBytes>(timestamp);
+  serializer.WriteUint<Serializer::kLogEntryTypeLengthInBytes>(
+      ct::PRECERT_ENTRY);
   serializer.WriteFixedBytes(issuer_key_hash);
-  serializer.WriteVarBytes(tbs_certificate, kMaxCertificateLength);
-  serializer.WriteVarBytes(extensions, Serializer::kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  serializer.WriteVarBytes<kMaxCertificateLength>(tbs_certificate);
+  serializer.WriteVarBytes<Serializer::kMaxExtensionsLength>(extensions);
   return SerializeResult::OK;
 }
 
@@ -154,15 +171,14 @@ SerializeResult SerializeV1CertSCTMerkleTreeLeaf(uint64_t timestamp,
   if (res != SerializeResult::OK) {
     return res;
   }
-  TLSSerializer serializer;
-  serializer.WriteUint(ct::V1, Serializer::kVersionLengthInBytes);
-  serializer.WriteUint(ct::TIMESTAMPED_ENTRY,
-                       Serializer::kMerkleLeafTypeLengthInBytes);
-  serializer.WriteUint(timestamp, Serializer::kTimestampLengthInBytes);
-  serializer.WriteUint(ct::X509_ENTRY, Serializer::kLogEntryTypeLengthInBytes);
-  serializer.WriteVarBytes(certificate, kMaxCertificateLength);
-  serializer.WriteVarBytes(extensions, Serializer::kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  TLSSerializer serializer(result, V1EntrySize(0, certificate, extensions));
+  serializer.WriteUint<Serializer::kVersionLengthInBytes>(ct::V1);
+  serializer.WriteUint<Serializer::kMerkleLeafTypeLengthInBytes>(
+      ct::TIMESTAMPED_ENTRY);
+  serializer.WriteUint<Serializer::kTimestampLengthInBytes>(timestamp);
+  serializer.WriteUint<Serializer::kLogEntryTypeLengthInBytes>(ct::X509_ENTRY);
+  serializer.WriteVarBytes<kMaxCertificateLength>(certificate);
+  serializer.WriteVarBytes<Serializer::kMaxExtensionsLength>(extensions);
   return SerializeResult::OK;
 }
 
@@ -182,17 +198,17 @@ SerializeResult SerializeV1PrecertSCTMerkleTreeLeaf(
   if (res != SerializeResult::OK) {
     return res;
   }
-  TLSSerializer serializer;
-  serializer.WriteUint(ct::V1, Serializer::kVersionLengthInBytes);
-  serializer.WriteUint(ct::TIMESTAMPED_ENTRY,
-                       Serializer::kMerkleLeafTypeLengthInBytes);
-  serializer.WriteUint(timestamp, Serializer::kTimestampLengthInBytes);
-  serializer.WriteUint(ct::PRECERT_ENTRY,
-                       Serializer::kLogEntryTypeLengthInBytes);
+  TLSSerializer serializer(
+      result, V1EntrySize(issuer_key_hash.size(), tbs_certificate, extensions));
+  serializer.WriteUint<Serializer::kVersionLengthInBytes>(ct::V1);
+  serializer.WriteUint<Serializer::kMerkleLeafTypeLengthInBytes>(
+      ct::TIMESTAMPED_ENTRY);
+  serializer.WriteUint<Serializer::kTimestampLengthInBytes>(timestamp);
+  serializer.WriteUint<Serializer::kLogEntryTypeLengthInBytes>(
+      ct::PRECERT_ENTRY);
   serializer.WriteFixedBytes(issuer_key_hash);
-  serializer.WriteVarBytes(tbs_certificate, kMaxCertificateLength);
-  serializer.WriteVarBytes(extensions, Serializer::kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  serializer.WriteVarBytes<kMaxCertificateLength>(tbs_certificate);
+  serializer.WriteVarBytes<Serializer::kMaxExtensionsLength>(extensions);
   return SerializeResult::OK;
 }
 
@@ -262,27 +278,23 @@ DeserializeResult DeserializeV1SCTMerkleTreeLeaf(TLSDeserializer* des,
 
   switch (entry_type) {
     case ct::X509_ENTRY: {
-      string x509;
-      if (!des->ReadVarBytes(kMaxCertificateLength, &x509)) {
+      if (!des->ReadVarBytes(kMaxCertificateLength,
+                             entry->mutable_signed_entry()->mutable_x509())) {
         return DeserializeResult::INPUT_TOO_SHORT;
       }
-      entry->mutable_signed_entry()->set_x509(x509);
       return des->ReadExtensions(entry);
     }
 
     case ct::PRECERT_ENTRY: {
-      string issuer_key_hash;
-      if (!des->ReadFixedBytes(32, &issuer_key_hash)) {
+      ct::PreCert* const precert =
+          entry->mutable_signed_entry()->mutable_precert();
+      if (!des->ReadFixedBytes(32, precert->mutable_issuer_key_hash())) {
         return DeserializeResult::INPUT_TOO_SHORT;
       }
-      entry->mutable_signed_entry()->mutable_precert()->set_issuer_key_hash(
-          issuer_key_hash);
-      string tbs_certificate;
-      if (!des->ReadVarBytes(kMaxCertificateLength, &tbs_certificate)) {
+      if (!des->ReadVarBytes(kMaxCertificateLength,
+                             precert->mutable_tbs_certificate())) {
         return DeserializeResult::INPUT_TOO_SHORT;
       }
-      entry->mutable_signed_entry()->mutable_precert()->set_tbs_certificate(
-          tbs_certificate);
       return des->ReadExtensions(entry);
     }
   }
@@ -522,18 +534,15 @@ DeserializeResult DeserializeV2SCTMerkleTreeLeaf(TLSDeserializer* des,
     // In V2 both X509 and Precert entries use CertInfo
     case ct::X509_ENTRY:
     case ct::PRECERT_ENTRY_V2: {
-      string issuer_key_hash;
-      if (!des->ReadFixedBytes(32, &issuer_key_hash)) {
+      ct::CertInfo* const cert_info =
+          entry->mutable_signed_entry()->mutable_cert_info();
+      if (!des->ReadFixedBytes(32, cert_info->mutable_issuer_key_hash())) {
         return DeserializeResult::INPUT_TOO_SHORT;
       }
-      entry->mutable_signed_entry()->mutable_cert_info()->set_issuer_key_hash(
-          issuer_key_hash);
-      string tbs_certificate;
-      if (!des->ReadVarBytes(kMaxCertificateLength, &tbs_certificate)) {
+      if (!des->ReadVarBytes(kMaxCertificateLength,
+                             cert_info->mutable_tbs_certificate())) {
         return DeserializeResult::INPUT_TOO_SHORT;
       }
-      entry->mutable_signed_entry()->mutable_cert_info()->set_tbs_certificate(
-          tbs_certificate);
       return des->ReadExtensions(entry);
     }
 
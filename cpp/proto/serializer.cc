@@ -25,22 +25,22 @@ using google::protobuf::RepeatedPtrField;
 using std::function;
 using std::string;
 
-const size_t Serializer::kMaxSignatureLength = (1 << 16) - 1;
-const size_t Serializer::kMaxV2ExtensionType = (1 << 16) - 1;
-const size_t Serializer::kMaxV2ExtensionsCount = (1 << 16) - 2;
-const size_t Serializer::kMaxExtensionsLength = (1 << 16) - 1;
-const size_t Serializer::kMaxSerializedSCTLength = (1 << 16) - 1;
-const size_t Serializer::kMaxSCTListLength = (1 << 16) - 1;
-
-const size_t Serializer::kLogEntryTypeLengthInBytes = 2;
-const size_t Serializer::kSignatureTypeLengthInBytes = 1;
-const size_t Serializer::kHashAlgorithmLengthInBytes = 1;
-const size_t Serializer::kSigAlgorithmLengthInBytes = 1;
-const size_t Serializer::kVersionLengthInBytes = 1;
-const size_t Serializer::kKeyIDLengthInBytes = 32;
-const size_t Serializer::kMerkleLeafTypeLengthInBytes = 1;
-const size_t Serializer::kKeyHashLengthInBytes = 32;
-const size_t Serializer::kTimestampLengthInBytes = 8;
+const size_t Serializer::kMaxSignatureLength;
+const size_t Serializer::kMaxV2ExtensionType;
+const size_t Serializer::kMaxV2ExtensionsCount;
+const size_t Serializer::kMaxExtensionsLength;
+const size_t Serializer::kMaxSerializedSCTLength;
+const size_t Serializer::kMaxSCTListLength;
+
+const size_t Serializer::kLogEntryTypeLengthInBytes;
+const size_t Serializer::kSignatureTypeLengthInBytes;
+const size_t Serializer::kHashAlgorithmLengthInBytes;
+const size_t Serializer::kSigAlgorithmLengthInBytes;
+const size_t Serializer::kVersionLengthInBytes;
+const size_t Serializer::kKeyIDLengthInBytes;
+const size_t Serializer::kMerkleLeafTypeLengthInBytes;
+const size_t Serializer::kKeyHashLengthInBytes;
+const size_t Serializer::kTimestampLengthInBytes;
 
 DEFINE_bool(allow_reconfigure_serializer_test_only, false,
             "Allow tests to reconfigure the serializer multiple times.");
@@ -188,13 +188,15 @@ static SerializeResult SerializeV1STHSignatureInput(uint64_t timestamp,
   CHECK_GE(tree_size, 0);
   if (root_hash.size() != 32)
     return SerializeResult::INVALID_HASH_LENGTH;
-  TLSSerializer serializer;
-  serializer.WriteUint(ct::V1, Serializer::kVersionLengthInBytes);
-  serializer.WriteUint(ct::TREE_HEAD, Serializer::kSignatureTypeLengthInBytes);
-  serializer.WriteUint(timestamp, Serializer::kTimestampLengthInBytes);
-  serializer.WriteUint(tree_size, 8);
+  TLSSerializer serializer(result, Serializer::kVersionLengthInBytes +
+                                       Serializer::kSignatureTypeLengthInBytes +
+                                       Serializer::kTimestampLengthInBytes + 8 +
+                                       root_hash.size());
+  serializer.WriteUint<Serializer::kVersionLengthInBytes>(ct::V1);
+  serializer.WriteUint<Serializer::kSignatureTypeLengthInBytes>(ct::TREE_HEAD);
+  serializer.WriteUint<Serializer::kTimestampLengthInBytes>(timestamp);
+  serializer.WriteUint<8>(tree_size);
   serializer.WriteFixedBytes(root_hash);
-  result->assign(serializer.SerializedString());
   return SerializeResult::OK;
 }
 
@@ -371,7 +373,7 @@ SerializeResult Serializer::SerializeDigitallySigned(
 }
 
 void TLSSerializer::WriteFixedBytes(const string& in) {
-  output_.append(in);
+  output_->append(in);
 }
 
 void TLSSerializer::WriteVarBytes(const string& in, size_t max_length) {
@@ -555,8 +557,8 @@ const size_t TLSDeserializer::kV2ExtensionCountLengthInBytes = 2;
 const size_t TLSDeserializer::kV2ExtensionTypeLengthInBytes = 2;
 
 
-TLSDeserializer::TLSDeserializer(const string& input)
-    : current_pos_(input.data()), bytes_remaining_(input.size()) {
+TLSDeserializer::TLSDeserializer(const char* data, size_t size)
+    : current_pos_(data), bytes_remaining_(size) {
 }
 
 
@@ -572,8 +574,10 @@ DeserializeResult TLSDeserializer::ReadSCTV1(SignedCertificateTimestamp* sct) {
     return DeserializeResult::INPUT_TOO_SHORT;
   }
   sct->set_timestamp(timestamp);
-  string extensions;
-  if (!ReadVarBytes(Serializer::kMaxExtensionsLength, &extensions)) {
+  const char* extensions;
+  size_t extensions_size;
+  if (!ReadVarBytes(Serializer::kMaxExtensionsLength, &extensions,
+                    &extensions_size)) {
     // In theory, could also be an invalid length prefix, but not if
     // length limits follow byte boundaries.
     return DeserializeResult::INPUT_TOO_SHORT;
@@ -670,16 +674,25 @@ DeserializeResult Deserializer::DeserializeDigitallySigned(
 }
 
 
-bool TLSDeserializer::ReadFixedBytes(size_t bytes, string* result) {
+bool TLSDeserializer::ReadFixedBytes(size_t bytes, const char** data) {
   if (bytes_remaining_ < bytes)
     return false;
-  result->assign(current_pos_, bytes);
+  *data = current_pos_;
   current_pos_ += bytes;
   bytes_remaining_ -= bytes;
   return true;
 }
 
 
+bool TLSDeserializer::ReadFixedBytes(size_t bytes, string* result) {
+  const char* data;
+  if (!ReadFixedBytes(bytes, &data))
+    return false;
+  result->assign(data, bytes);
+  return true;
+}
+
+
 bool TLSDeserializer::ReadLengthPrefix(size_t max_length, size_t* result) {
   size_t prefix_length = PrefixLength(max_length);
   size_t length;
@@ -690,11 +703,23 @@ bool TLSDeserializer::ReadLengthPrefix(size_t max_length, size_t* result) {
 }
 
 
-bool TLSDeserializer::ReadVarBytes(size_t max_length, string* result) {
+bool TLSDeserializer::ReadVarBytes(size_t max_length, const char** data,
+                                   size_t* size) {
   size_t length;
-  if (!ReadLengthPrefix(max_length, &length))
+  if (!ReadLengthPrefix(max_length, &length) || !ReadFixedBytes(length, data))
+    return false;
+  *size = length;
+  return true;
+}
+
+
+bool TLSDeserializer::ReadVarBytes(size_t max_length, string* result) {
+  const char* data;
+  size_t size;
+  if (!ReadVarBytes(max_length, &data, &size))
     return false;
-  return ReadFixedBytes(length, result);
+  result->assign(data, size);
+  return true;
 }
 
 
@@ -717,22 +742,25 @@ DeserializeResult Deserializer::DeserializeList(const string& in,
 DeserializeResult TLSDeserializer::ReadList(size_t max_total_length,
                                             size_t max_elem_length,
                                             repeated_string* out) {
-  string serialized_list;
-  if (!ReadVarBytes(max_total_length, &serialized_list))
+  const char* serialized_list;
+  size_t serialized_list_size;
+  if (!ReadVarBytes(max_total_length, &serialized_list,
+                    &serialized_list_size))
     // TODO(ekasper): could also be a length that's too large, if
     // length limits don't follow byte boundaries.
     return DeserializeResult::INPUT_TOO_SHORT;
   if (!ReachedEnd())
     return DeserializeResult::INPUT_TOO_LONG;
 
-  TLSDeserializer list_reader(serialized_list);
+  TLSDeserializer list_reader(serialized_list, serialized_list_size);
   while (!list_reader.ReachedEnd()) {
-    string elem;
-    if (!list_reader.ReadVarBytes(max_elem_length, &elem))
+    const char* elem;
+    size_t elem_size;
+    if (!list_reader.ReadVarBytes(max_elem_length, &elem, &elem_size))
       return DeserializeResult::INVALID_LIST_ENCODING;
-    if (elem.empty())
+    if (elem_size == 0)
       return DeserializeResult::EMPTY_ELEM_IN_LIST;
-    *(out->Add()) = elem;
+    out->Add()->assign(elem, elem_size);
   }
   return DeserializeResult::OK;
 }
@@ -755,14 +783,16 @@ DeserializeResult TLSDeserializer::ReadSctExtension(
       return DeserializeResult::INPUT_TOO_SHORT;
     }
 
-    string ext_data;
-    if (!ReadVarBytes(Serializer::kMaxExtensionsLength, &ext_data)) {
+    const char* ext_data;
+    size_t ext_data_size;
+    if (!ReadVarBytes(Serializer::kMaxExtensionsLength, &ext_data,
+                      &ext_data_size)) {
       return DeserializeResult::INPUT_TOO_SHORT;
     }
 
     SctExtension* new_ext = extension->Add();
     new_ext->set_sct_extension_type(ext_type);
-    new_ext->set_sct_extension_data(ext_data);
+    new_ext->set_sct_extension_data(ext_data, ext_data_size);
   }
 
   // This makes sure they're correctly ordered (See RFC section 5.3)
@@ -783,25 +813,25 @@ DeserializeResult TLSDeserializer::ReadDigitallySigned(DigitallySigned* sig) {
   if (!DigitallySigned_SignatureAlgorithm_IsValid(sig_algo))
     return DeserializeResult::INVALID_SIGNATURE_ALGORITHM;
 
-  string sig_string;
-  if (!ReadVarBytes(Serializer::kMaxSignatureLength, &sig_string))
+  const char* sig_data;
+  size_t sig_size;
+  if (!ReadVarBytes(Serializer::kMaxSignatureLength, &sig_data, &sig_size))
     return DeserializeResult::INPUT_TOO_SHORT;
   sig->set_hash_algorithm(
       static_cast<DigitallySigned::HashAlgorithm>(hash_algo));
   sig->set_sig_algorithm(
       static_cast<DigitallySigned::SignatureAlgorithm>(sig_algo));
-  sig->set_signature(sig_string);
+  sig->set_signature(sig_data, sig_size);
   return DeserializeResult::OK;
 }
 
 
 DeserializeResult TLSDeserializer::ReadExtensions(
     ct::TimestampedEntry* entry) {
-  string extensions;
-  if (!ReadVarBytes(Serializer::kMaxExtensionsLength, &extensions)) {
+  if (!ReadVarBytes(Serializer::kMaxExtensionsLength,
+                    CHECK_NOTNULL(entry)->mutable_extensions())) {
     return DeserializeResult::INPUT_TOO_SHORT;
   }
-  CHECK_NOTNULL(entry)->set_extensions(extensions);
   return DeserializeResult::OK;
 }
 
@@ -71,9 +71,20 @@ SerializeResult CheckSctExtensionsFormat(
 // TODO(pphaneuf): Make this into normal functions in a namespace.
 class TLSSerializer {
  public:
+  TLSSerializer() : output_(&own_output_) {
+  }
+
+  // Writes straight into |*output|, which is cleared first, with room for
+  // |size| bytes, so that the encodings whose size is known up front are
+  // written without reallocating or copying the result.
+  TLSSerializer(std::string* output, size_t size) : output_(output) {
+    output_->clear();
+    output_->reserve(size);
+  }
+
   // returns binary data
   std::string SerializedString() const {
-    return output_;
+    return *output_;
   }
 
   SerializeResult WriteSCTV1(const ct::SignedCertificateTimestamp& sct);
@@ -90,9 +101,31 @@ class TLSSerializer {
   void WriteUint(T in, size_t bytes) {
     CHECK_LE(bytes, sizeof(in));
     CHECK(bytes == sizeof(in) || in >> (bytes * 8) == 0);
-    for (; bytes > 0; --bytes)
-      output_.push_back(((in & (static_cast<T>(0xff) << ((bytes - 1) * 8))) >>
-                         ((bytes - 1) * 8)));
+    // Converted first, as |T| may be an enum.
+    uint64_t value = static_cast<uint64_t>(in);
+    char buf[sizeof(T)];
+    for (size_t i = bytes; i > 0; --i) {
+      buf[i - 1] = static_cast<char>(value & 0xff);
+      value >>= 8;
+    }
+    output_->append(buf, bytes);
+  }
+
+  // The same, for a width known at compile time, for which the loop is
+  // unrolled and the checks mostly go away.
+  template <size_t bytes, class T>
+  void WriteUint(T in) {
+    static_assert(bytes > 0 && bytes <= sizeof(uint64_t),
+                  "unsupported integer width");
+    uint64_t value = static_cast<uint64_t>(in);
+    // Shifted in two steps, as shifting by the full width is undefined.
+    DCHECK(bytes >= sizeof(in) || value >> (bytes * 4) >> (bytes * 4) == 0);
+    char buf[bytes];
+    for (size_t i = bytes; i > 0; --i) {
+      buf[i - 1] = static_cast<char>(value & 0xff);
+      value >>= 8;
+    }
+    output_->append(buf, bytes);
   }
 
   // Fixed-length byte array.
@@ -103,20 +136,44 @@ class TLSSerializer {
   // TODO(ekasper): could return a bool instead.
   void WriteVarBytes(const std::string& in, size_t max_length);
 
+  // The same, for a |max_length| known at compile time.
+  template <size_t max_length>
+  void WriteVarBytes(const std::string& in) {
+    CHECK_LE(in.size(), max_length);
+    WriteUint<LengthPrefixBytes(max_length)>(in.size());
+    WriteFixedBytes(in);
+  }
+
+  // The number of bytes WriteVarBytes<max_length>() writes for |in|.
+  template <size_t max_length>
+  static size_t VarBytesSize(const std::string& in) {
+    return LengthPrefixBytes(max_length) + in.size();
+  }
+
   void WriteSctExtension(const repeated_sct_extension& extension);
 
  private:
-  std::string output_;
+  // The number of bytes needed to store a length up to |max_length|.
+  static constexpr size_t LengthPrefixBytes(size_t max_length) {
+    return max_length <= 0xff ? 1 : 1 + LengthPrefixBytes(max_length >> 8);
+  }
+
+  std::string own_output_;
+  std::string* const output_;
+
+  DISALLOW_COPY_AND_ASSIGN(TLSSerializer);
 };
 
 
 class TLSDeserializer {
  public:
   // We do not make a copy, so input must remain valid.
-  // TODO(pphaneuf): And so we should take a string *, not a string &
-  // (which could be to a temporary, and not valid once the
-  // constructor returns).
-  explicit TLSDeserializer(const std::string& input);
+  TLSDeserializer(const char* data, size_t size);
+  explicit TLSDeserializer(const std::string& input)
+      : TLSDeserializer(input.data(), input.size()) {
+  }
+  // The input would not outlive the deserializer.
+  explicit TLSDeserializer(std::string&& input) = delete;
 
   bool ReachedEnd() const {
     return bytes_remaining_ == 0;
@@ -130,6 +187,11 @@ class TLSDeserializer {
   DeserializeResult ReadDigitallySigned(ct::DigitallySigned* sig);
 
   DeserializeResult ReadMerkleTreeLeaf(ct::MerkleTreeLeaf* leaf);
+
+  // Variable-length byte array, pointed to in place in the input:
+  // |*data| stays valid as long as the input does.
+  bool ReadVarBytes(size_t max_length, const char** data, size_t* size);
+  // The same, copied into |*result|.
   bool ReadVarBytes(size_t max_length, std::string* result);
 
   template <class T>
@@ -148,6 +210,9 @@ class TLSDeserializer {
   }
 
   DeserializeResult ReadExtensions(ct::TimestampedEntry* entry);
+
+  // Fixed-length byte array, in place or copied, like ReadVarBytes().
+  bool ReadFixedBytes(size_t bytes, const char** data);
   bool ReadFixedBytes(size_t bytes, std::string* result);
 
  private:
@@ -170,24 +235,24 @@ class TLSDeserializer {
 // A utility class for writing protocol buffer fields in canonical TLS style.
 class Serializer {
  public:
-  static const size_t kMaxSignatureLength;
-  static const size_t kMaxV2ExtensionType;
-  static const size_t kMaxV2ExtensionsCount;
-  static const size_t kMaxExtensionsLength;
-  static const size_t kMaxSerializedSCTLength;
-  static const size_t kMaxSCTListLength;
-
-  static const size_t kLogEntryTypeLengthInBytes;
-  static const size_t kSignatureTypeLengthInBytes;
-  static const size_t kHashAlgorithmLengthInBytes;
-  static const size_t kSigAlgorithmLengthInBytes;
-  static const size_t kVersionLengthInBytes;
+  static const size_t kMaxSignatureLength = (1 << 16) - 1;
+  static const size_t kMaxV2ExtensionType = (1 << 16) - 1;
+  static const size_t kMaxV2ExtensionsCount = (1 << 16) - 2;
+  static const size_t kMaxExtensionsLength = (1 << 16) - 1;
+  static const size_t kMaxSerializedSCTLength = (1 << 16) - 1;
+  static const size_t kMaxSCTListLength = (1 << 16) - 1;
+
+  static const size_t kLogEntryTypeLengthInBytes = 2;
+  static const size_t kSignatureTypeLengthInBytes = 1;
+  static const size_t kHashAlgorithmLengthInBytes = 1;
+  static const size_t kSigAlgorithmLengthInBytes = 1;
+  static const size_t kVersionLengthInBytes = 1;
   // Log Key ID
-  static const size_t kKeyIDLengthInBytes;
-  static const size_t kMerkleLeafTypeLengthInBytes;
+  static const size_t kKeyIDLengthInBytes = 32;
+  static const size_t kMerkleLeafTypeLengthInBytes = 1;
   // Public key hash from cert
-  static const size_t kKeyHashLengthInBytes;
-  static const size_t kTimestampLengthInBytes;
+  static const size_t kKeyHashLengthInBytes = 32;
+  static const size_t kTimestampLengthInBytes = 8;
 
   // API
   // TODO(alcutter): typedef these function<> bits
@@ -846,6 +846,39 @@ TEST_F(SerializerTestV1, SerializeSCTMerkleTreeLeafKatTestV1) {
   EXPECT_EQ(string(kDefaultPrecertSCTLeafHexString), H(precert_result));
 }
 
+// The encodings written straight into the result replace what it held.
+TEST_F(SerializerTestV1, SerializeSCTMerkleTreeLeafRoundTripV1) {
+  string cert_result("previous contents");
+  EXPECT_EQ(SerializeResult::OK,
+            Serializer::SerializeSCTMerkleTreeLeaf(DefaultSCT(),
+                                                   DefaultCertEntry(),
+                                                   &cert_result));
+  EXPECT_EQ(string(kDefaultCertSCTLeafHexString), H(cert_result));
+  MerkleTreeLeaf leaf;
+  EXPECT_EQ(DeserializeResult::OK,
+            Deserializer::DeserializeMerkleTreeLeaf(cert_result, &leaf));
+  EXPECT_EQ(DefaultSCTTimestamp(), leaf.timestamped_entry().timestamp());
+  EXPECT_EQ(DefaultCertEntry().x509_entry().leaf_certificate(),
+            leaf.timestamped_entry().signed_entry().x509());
+
+  string precert_result("previous contents");
+  EXPECT_EQ(SerializeResult::OK,
+            Serializer::SerializeSCTMerkleTreeLeaf(DefaultSCT(),
+                                                   DefaultPrecertEntry(),
+                                                   &precert_result));
+  EXPECT_EQ(string(kDefaultPrecertSCTLeafHexString), H(precert_result));
+  EXPECT_EQ(DeserializeResult::OK,
+            Deserializer::DeserializeMerkleTreeLeaf(precert_result, &leaf));
+  const ct::PreCert& precert(leaf.timestamped_entry().signed_entry().precert());
+  EXPECT_EQ(DefaultIssuerKeyHash(), precert.issuer_key_hash());
+  EXPECT_EQ(DefaultTbsCertificate(), precert.tbs_certificate());
+
+  string sth_result("previous contents");
+  EXPECT_EQ(SerializeResult::OK,
+            Serializer::SerializeSTHSignatureInput(DefaultSTH(), &sth_result));
+  EXPECT_EQ(string(kDefaultSTHSignedHexString), H(sth_result));
+}
+
 TEST_F(SerializerTestV2, SerializeSCTMerkleTreeLeafKatTestV2) {
   string cert_result, precert_result;
   EXPECT_EQ(SerializeResult::OK,
@@ -1562,6 +1595,69 @@ TEST_F(SerializerTest, SerializeSCTSignedEntryWithType_BadIssuerKeyHash) {
                                                   &result));
 }
 
+TEST(TLSSerializerTest, WriteUint) {
+  EXPECT_EQ("0102", H(Serializer::SerializeUint(0x0102, 2)));
+  EXPECT_EQ("000000", H(Serializer::SerializeUint(0, 3)));
+  EXPECT_EQ("ffffffff", H(Serializer::SerializeUint(-1, 4)));
+  EXPECT_EQ("0102030405060708",
+            H(Serializer::SerializeUint(UINT64_C(0x0102030405060708))));
+  EXPECT_EQ("01", H(Serializer::SerializeUint(ct::V2, 1)));
+}
+
+TEST(TLSSerializerTest, WriteUintOfFixedWidth) {
+  TLSSerializer serializer;
+  serializer.WriteUint<2>(0x0102);
+  serializer.WriteUint<3>(0);
+  serializer.WriteUint<4>(UINT32_C(0xffffffff));
+  serializer.WriteUint<8>(UINT64_C(0x0102030405060708));
+  serializer.WriteUint<1>(ct::V2);
+  EXPECT_EQ(Serializer::SerializeUint(0x0102, 2) +
+                Serializer::SerializeUint(0, 3) +
+                Serializer::SerializeUint(-1, 4) +
+                Serializer::SerializeUint(UINT64_C(0x0102030405060708)) +
+                Serializer::SerializeUint(ct::V2, 1),
+            serializer.SerializedString());
+}
+
+TEST(TLSSerializerTest, WriteVarBytesOfFixedMaxLength) {
+  const string bytes("abc");
+  TLSSerializer expected;
+  expected.WriteVarBytes(bytes, 0xff);
+  expected.WriteVarBytes(bytes, 0xffff);
+  expected.WriteVarBytes(bytes, 0xffffff);
+  expected.WriteVarBytes(string(), 0xffff);
+
+  const size_t size(TLSSerializer::VarBytesSize<0xff>(bytes) +
+                    TLSSerializer::VarBytesSize<0xffff>(bytes) +
+                    TLSSerializer::VarBytesSize<0xffffff>(bytes) +
+                    TLSSerializer::VarBytesSize<0xffff>(string()));
+  EXPECT_EQ(expected.SerializedString().size(), size);
+
+  string result("previous contents");
+  TLSSerializer serializer(&result, size);
+  serializer.WriteVarBytes<0xff>(bytes);
+  serializer.WriteVarBytes<0xffff>(bytes);
+  serializer.WriteVarBytes<0xffffff>(bytes);
+  serializer.WriteVarBytes<0xffff>(string());
+  EXPECT_EQ(expected.SerializedString(), result);
+  EXPECT_EQ(result, serializer.SerializedString());
+}
+
+TEST(TLSDeserializerTest, ReadsBytesInPlace) {
+  const string input(B("0003616263" "6465"));
+  TLSDeserializer deserializer(input);
+  const char* data;
+  size_t size;
+  ASSERT_TRUE(deserializer.ReadVarBytes(0xffff, &data, &size));
+  EXPECT_EQ(input.data() + 2, data);
+  EXPECT_EQ(3U, size);
+  ASSERT_TRUE(deserializer.ReadFixedBytes(2, &data));
+  EXPECT_EQ(input.data() + 5, data);
+  EXPECT_TRUE(deserializer.ReachedEnd());
+  EXPECT_FALSE(deserializer.ReadFixedBytes(1, &data));
+  EXPECT_FALSE(deserializer.ReadVarBytes(0xff, &data, &size));
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -39,6 +39,23 @@ SerializeResult CheckJsonFormat(const string& json) {
 }
 
 
+// The size of the V1 signature inputs and Merkle tree leaves: the version,
+// signature or leaf type, timestamp and entry type, followed by the JSON
+// and the extensions.
+size_t V1EntrySize(const string& json, const string& extensions) {
+  static_assert(Serializer::kSignatureTypeLengthInBytes ==
+                    Serializer::kMerkleLeafTypeLengthInBytes,
+                "signature types and leaf types differ in size");
+  return Serializer::kVersionLengthInBytes +
+         Serializer::kSignatureTypeLengthInBytes +
+         Serializer::kTimestampLengthInBytes +
+         Serializer::kLogEntryTypeLengthInBytes +
+         TLSSerializer::VarBytesSize<kMaxJsonLength>(json) +
+         TLSSerializer::VarBytesSize<Serializer::kMaxExtensionsLength>(
+             extensions);
+}
+
+
 string V1LeafData(const LogEntry& entry) {
   CHECK(entry.has_x_json_entry());
   return entry.x_json_entry().json();
@@ -52,26 +69,25 @@ SerializeResult SerializeV1SCTSignatureInput(
   if (sct.version() != ct::V1) {
     return SerializeResult::UNSUPPORTED_VERSION;
   }
-  const string json(entry.x_json_entry().json());
+  const string& json(entry.x_json_entry().json());
   SerializeResult res = CheckJsonFormat(json);
   if (res != SerializeResult::OK) {
     return res;
   }
-  const string extensions(sct.extensions());
+  const string& extensions(sct.extensions());
   res = CheckExtensionsFormat(extensions);
   if (res != SerializeResult::OK) {
     return res;
   }
-  TLSSerializer serializer;
-  serializer.WriteUint(ct::V1, Serializer::kVersionLengthInBytes);
-  serializer.WriteUint(ct::CERTIFICATE_TIMESTAMP,
-                       Serializer::kSignatureTypeLengthInBytes);
-  serializer.WriteUint(sct.timestamp(), Serializer::kTimestampLengthInBytes);
-  serializer.WriteUint(ct::X_JSON_ENTRY,
-                       Serializer::kLogEntryTypeLengthInBytes);
-  serializer.WriteVarBytes(json, kMaxJsonLength);
-  serializer.WriteVarBytes(extensions, Serializer::kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  TLSSerializer serializer(result, V1EntrySize(json, extensions));
+  serializer.WriteUint<Serializer::kVersionLengthInBytes>(ct::V1);
+  serializer.WriteUint<Serializer::kSignatureTypeLengthInBytes>(
+      ct::CERTIFICATE_TIMESTAMP);
+  serializer.WriteUint<Serializer::kTimestampLengthInBytes>(sct.timestamp());
+  serializer.WriteUint<Serializer::kLogEntryTypeLengthInBytes>(
+      ct::X_JSON_ENTRY);
+  serializer.WriteVarBytes<kMaxJsonLength>(json);
+  serializer.WriteVarBytes<Serializer::kMaxExtensionsLength>(extensions);
   return SerializeResult::OK;
 }
 
@@ -83,26 +99,25 @@ SerializeResult SerializeV1SCTMerkleTreeLeaf(
   if (sct.version() != ct::V1) {
     return SerializeResult::UNSUPPORTED_VERSION;
   }
-  const string json(entry.x_json_entry().json());
+  const string& json(entry.x_json_entry().json());
   SerializeResult res = CheckJsonFormat(json);
   if (res != SerializeResult::OK) {
     return res;
   }
-  const string extensions(sct.extensions());
+  const string& extensions(sct.extensions());
   res = CheckExtensionsFormat(extensions);
   if (res != SerializeResult::OK) {
     return res;
   }
-  TLSSerializer serializer;
-  serializer.WriteUint(ct::V1, Serializer::kVersionLengthInBytes);
-  serializer.WriteUint(ct::TIMESTAMPED_ENTRY,
-                       Serializer::kMerkleLeafTypeLengthInBytes);
-  serializer.WriteUint(sct.timestamp(), Serializer::kTimestampLengthInBytes);
-  serializer.WriteUint(ct::X_JSON_ENTRY,
-                       Serializer::kLogEntryTypeLengthInBytes);
-  serializer.WriteVarBytes(json, kMaxJsonLength);
-  serializer.WriteVarBytes(extensions, Serializer::kMaxExtensionsLength);
-  result->assign(serializer.SerializedString());
+  TLSSerializer serializer(result, V1EntrySize(json, extensions));
+  serializer.WriteUint<Serializer::kVersionLengthInBytes>(ct::V1);
+  serializer.WriteUint<Serializer::kMerkleLeafTypeLengthInBytes>(
+      ct::TIMESTAMPED_ENTRY);
+  serializer.WriteUint<Serializer::kTimestampLengthInBytes>(sct.timestamp());
+  serializer.WriteUint<Serializer::kLogEntryTypeLengthInBytes>(
+      ct::X_JSON_ENTRY);
+  serializer.WriteVarBytes<kMaxJsonLength>(json);
+  serializer.WriteVarBytes<Serializer::kMaxExtensionsLength>(extensions);
   return SerializeResult::OK;
 }
 
@@ -149,11 +164,10 @@ DeserializeResult DeserializeV1SCTMerkleTreeLeaf(TLSDeserializer* des,
 
   switch (entry_type) {
     case ct::X_JSON_ENTRY: {
-      string json;
-      if (!des->ReadVarBytes(kMaxJsonLength, &json)) {
+      if (!des->ReadVarBytes(kMaxJsonLength,
+                             entry->mutable_signed_entry()->mutable_json())) {
         return DeserializeResult::INPUT_TOO_SHORT;
       }
-      entry->mutable_signed_entry()->set_json(json);
       return des->ReadExtensions(entry);
     }
 
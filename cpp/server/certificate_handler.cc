@@ -1,77 +1,191 @@
+#include <event2/buffer.h>
+#include <gflags/gflags.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <vector>
 
+#include "log/cert_pool.h"
 #include "log/frontend.h"
+#include "monitoring/counter.h"
+#include "monitoring/latency.h"
+#include "monitoring/trace.h"
 #include "server/certificate_handler.h"
 #include "server/json_output.h"
-#include "util/json_wrapper.h"
+#include "util/json_reader.h"
+#include "util/json_writer.h"
 #include "util/status.h"
+#include "util/task.h"
 #include "util/thread_pool.h"
 
+DEFINE_int32(max_chains_per_add_chains, 1000,
+             "maximum number of chains accepted in one add-chains request");
+DEFINE_int32(add_chains_parallelism, 8,
+             "maximum number of chains of an add-chains request verified "
+             "and queued at once");
+DEFINE_int32(verification_threads, 0,
+             "number of threads verifying submitted chains, per HTTP event "
+             "loop, or 0 for one per core");
+DEFINE_int32(max_queued_verifications, 1000,
+             "maximum number of submissions waiting for a verification "
+             "thread, beyond which they are turned away with a 503");
+DEFINE_int32(intermediate_cert_pool_size, 10000,
+             "maximum number of parsed intermediate certificates of "
+             "submitted chains kept in memory, to be reused by later "
+             "submissions of the same chain");
+
 namespace cert_trans {
 
 using ct::LogEntry;
 using ct::SignedCertificateTimestamp;
+using std::atomic;
 using std::bind;
+using std::chrono::milliseconds;
+using std::function;
 using std::make_shared;
+using std::max;
+using std::min;
 using std::multimap;
 using std::placeholders::_1;
 using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
+using std::vector;
 using util::Status;
+using util::Task;
 
 
 namespace {
 
 
-bool ExtractChain(libevent::Base* base, evhttp_request* req,
-                  CertChain* chain) {
-  if (evhttp_request_get_command(req) != EVHTTP_REQ_POST) {
-    SendJsonError(base, req, HTTP_BADMETHOD, "Method not allowed.");
-    return false;
-  }
+static Latency<milliseconds, string> submission_verification_latency_ms(
+    "submission_verification_latency_ms", "type",
+    "Time spent parsing and verifying submitted chains, in ms, by type "
+    "of submission");
 
-  // TODO(pphaneuf): Should we check that Content-Type says
-  // "application/json", as recommended by RFC4627?
-  JsonObject json_body(evhttp_request_get_input_buffer(req));
-  if (!json_body.Ok() || !json_body.IsType(json_type_object)) {
-    SendJsonError(base, req, HTTP_BADREQUEST,
-                  "Unable to parse provided JSON.");
-    return false;
+static Counter<string>* submissions_shed(Counter<string>::New(
+    "submissions_shed", "type",
+    "Number of submissions turned away because too many were waiting to "
+    "be verified, by type of submission"));
+
+
+const char kX509Type[] = "x509";
+const char kPreCertType[] = "precert";
+const char kBatchType[] = "batch";
+
+
+const char kBadJson[] = "Unable to parse provided JSON.";
+
+
+// Decodes the next value of |json|, an array of base64 DER
+// certificates, into |der_certs|. Base64 that is not valid leaves its
+// certificate empty, so that it fails to load.
+Status ReadChain(JsonReader* json, vector<string>* der_certs) {
+  if (!json->StartArray()) {
+    return Status(util::error::INVALID_ARGUMENT, kBadJson);
   }
 
-  JsonArray json_chain(json_body, "chain");
-  if (!json_chain.Ok()) {
-    SendJsonError(base, req, HTTP_BADREQUEST,
-                  "Unable to parse provided JSON.");
-    return false;
+  Status status(Status::OK);
+  while (json->NextElement()) {
+    if (json->Peek() != JsonReader::STRING) {
+      status = Status(util::error::INVALID_ARGUMENT, kBadJson);
+      json->Skip();
+      continue;
+    }
+    der_certs->emplace_back();
+    json->ReadBase64(&der_certs->back());
   }
+  VLOG(2) << "ReadChain: " << der_certs->size() << " certificates";
 
-  VLOG(2) << "ExtractChain chain:\n" << json_chain.DebugString();
+  return json->ok() ? status : Status(util::error::INVALID_ARGUMENT, kBadJson);
+}
 
-  for (int i = 0; i < json_chain.Length(); ++i) {
-    JsonString json_cert(json_chain, i);
-    if (!json_cert.Ok()) {
-      SendJsonError(base, req, HTTP_BADREQUEST,
-                    "Unable to parse provided JSON.");
-      return false;
-    }
 
-    unique_ptr<Cert> cert(new Cert);
-    cert->LoadFromDerString(json_cert.FromBase64());
+// The intermediates of submitted chains, shared by all the handlers of
+// the process.
+CertPool* IntermediatePool() {
+  static CertPool* const pool(
+      new CertPool(max(FLAGS_intermediate_cert_pool_size, 0)));
+  return pool;
+}
+
+
+// Parses the DER certificates of |der_certs| into |chain|. Only the
+// first one is specific to the submission, the others come from
+// IntermediatePool().
+Status LoadChain(const vector<string>& der_certs, CertChain* chain) {
+  for (size_t i = 0; i < der_certs.size(); ++i) {
+    unique_ptr<Cert> cert;
+    if (i == 0) {
+      cert.reset(new Cert);
+      cert->LoadFromDerString(der_certs[i]);
+    } else {
+      cert = IntermediatePool()->Load(der_certs[i]);
+    }
     if (!cert->IsLoaded()) {
-      SendJsonError(base, req, HTTP_BADREQUEST,
+      return Status(util::error::INVALID_ARGUMENT,
                     "Unable to parse provided chain.");
-      return false;
     }
 
     chain->AddCert(cert.release());
   }
 
+  return Status::OK;
+}
+
+
+// Reads the JSON object in the body of the POST request |req| in place,
+// passing the value of its member |name| to |read_value|, or replies
+// with an error and returns false, with the error message of
+// |read_value| if it fails. Other members are ignored.
+bool ReadJsonBody(libevent::Base* base, evhttp_request* req,
+                  const char* name,
+                  const function<Status(JsonReader*)>& read_value) {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_POST) {
+    SendJsonError(base, req, HTTP_BADMETHOD, "Method not allowed.");
+    return false;
+  }
+
+  // TODO(pphaneuf): Should we check that Content-Type says
+  // "application/json", as recommended by RFC4627?
+  evbuffer* const body(evhttp_request_get_input_buffer(req));
+  const size_t size(evbuffer_get_length(body));
+  JsonReader json(reinterpret_cast<const char*>(evbuffer_pullup(body, -1)),
+                  size);
+  bool found(false);
+  string member;
+  if (json.StartObject()) {
+    while (json.NextMember(&member)) {
+      if (found || member != name) {
+        json.Skip();
+        continue;
+      }
+      found = true;
+      const Status status(read_value(&json));
+      if (!status.ok()) {
+        SendJsonError(base, req, HTTP_BADREQUEST, status.error_message());
+        return false;
+      }
+    }
+  }
+  if (!json.ok() || !found) {
+    SendJsonError(base, req, HTTP_BADREQUEST, kBadJson);
+    return false;
+  }
+
   return true;
 }
 
 
+bool ExtractChain(libevent::Base* base, evhttp_request* req,
+                  vector<string>* der_certs) {
+  return ReadJsonBody(base, req, "chain", [der_certs](JsonReader* json) {
+    return ReadChain(json, der_certs);
+  });
+}
+
+
 CertSubmissionHandler* MaybeCreateSubmissionHandler(
     const CertChecker* checker) {
   if (checker != nullptr) {
@@ -81,9 +195,65 @@ CertSubmissionHandler* MaybeCreateSubmissionHandler(
 }
 
 
+ThreadPool* MaybeCreateVerificationPool(const Frontend* frontend) {
+  if (frontend == nullptr) {
+    return nullptr;
+  }
+  return FLAGS_verification_threads > 0
+             ? new ThreadPool("verification", FLAGS_verification_threads)
+             : new ThreadPool("verification");
+}
+
+
+// The number of tasks running each stage of an add-chains batch of
+// |size| chains.
+size_t NumAddChainsTasks(size_t size) {
+  return min(size, static_cast<size_t>(max(FLAGS_add_chains_parallelism, 1)));
+}
+
+
+// The chains of an add-chains batch being queued together.
+struct ChainsSlice {
+  vector<size_t> indices;
+  vector<const LogEntry*> entries;
+  vector<SignedCertificateTimestamp*> scts;
+  vector<Status> statuses;
+};
+
+
 }  // namespace
 
 
+struct CertificateHttpHandler::AddChainsBatch {
+  AddChainsBatch(evhttp_request* r, size_t size,
+                 const shared_ptr<Trace>& t)
+      : req(r),
+        trace(t),
+        der_certs(size),
+        statuses(size),
+        entries(size),
+        scts(size),
+        next(0),
+        running(0) {
+  }
+
+  evhttp_request* const req;
+  const shared_ptr<Trace> trace;
+  vector<vector<string>> der_certs;
+  // Only the chains whose status is still OK go on to the next stage.
+  // Each element of these is only written by the task that took its
+  // chain, and only read by the next stage, once all the tasks of this
+  // one are done.
+  vector<Status> statuses;
+  vector<LogEntry> entries;
+  vector<SignedCertificateTimestamp> scts;
+  // The index of the next chain to be taken in the current stage.
+  atomic<size_t> next;
+  // The number of tasks of the current stage that have not finished.
+  atomic<int> running;
+};
+
+
 CertificateHttpHandler::CertificateHttpHandler(
     LogLookup* log_lookup, const ReadOnlyDatabase* db,
     const ClusterStateController<LoggedEntry>* controller,
@@ -93,7 +263,8 @@ CertificateHttpHandler::CertificateHttpHandler(
                   staleness_tracker),
       cert_checker_(cert_checker),
       submission_handler_(MaybeCreateSubmissionHandler(cert_checker_)),
-      frontend_(frontend) {
+      frontend_(frontend),
+      verification_pool_(MaybeCreateVerificationPool(frontend_)) {
 }
 
 
@@ -114,6 +285,9 @@ void CertificateHttpHandler::AddHandlers(libevent::HttpServer* server) {
     AddProxyWrappedHandler(server, "/ct/v1/add-pre-chain",
                            bind(&CertificateHttpHandler::AddPreChain, this,
                                 _1));
+    AddProxyWrappedHandler(server, "/ct/v1/add-chains",
+                           bind(&CertificateHttpHandler::AddChains, this, _1),
+                           ThreadPool::Priority::BULK);
   }
 }
 
@@ -124,71 +298,275 @@ void CertificateHttpHandler::GetRoots(evhttp_request* req) const {
                          "Method not allowed.");
   }
 
-  JsonArray roots;
-  multimap<string, const Cert*>::const_iterator it;
-  for (it = cert_checker_->GetTrustedCertificates().begin();
-       it != cert_checker_->GetTrustedCertificates().end(); ++it) {
+  const unique_ptr<evbuffer, void (*)(evbuffer*)> body(
+      CHECK_NOTNULL(evbuffer_new()), &evbuffer_free);
+  JsonWriter json(body.get());
+  json.StartObject();
+  json.Key("certificates");
+  json.StartArray();
+  const shared_ptr<const multimap<string, const Cert*>> roots(
+      cert_checker_->GetTrustedCertificates());
+  for (const auto& root : *roots) {
     string cert;
-    if (it->second->DerEncoding(&cert) != util::Status::OK) {
+    if (root.second->DerEncoding(&cert) != util::Status::OK) {
       LOG(ERROR) << "Cert encoding failed";
       return SendJsonError(event_base_, req, HTTP_INTERNAL,
                            "Serialisation failed.");
     }
-    roots.AddBase64(cert);
+    json.Base64(cert);
   }
+  json.EndArray();
+  json.EndObject();
 
-  JsonObject json_reply;
-  json_reply.Add("certificates", roots);
-
-  SendJsonReply(event_base_, req, HTTP_OK, json_reply);
+  SendJsonReply(event_base_, req, HTTP_OK, body.get());
 }
 
 
 void CertificateHttpHandler::AddChain(evhttp_request* req) {
-  const shared_ptr<CertChain> chain(make_shared<CertChain>());
-  if (!ExtractChain(event_base_, req, chain.get())) {
+  AddSubmission(req, false /* pre_cert */);
+}
+
+
+void CertificateHttpHandler::AddPreChain(evhttp_request* req) {
+  AddSubmission(req, true /* pre_cert */);
+}
+
+
+// Only the JSON is decoded here, the certificates are parsed and
+// verified on |verification_pool_|, and the entry is then queued on
+// |pool_|, as it waits on the ConsistentStore.
+void CertificateHttpHandler::AddSubmission(evhttp_request* req,
+                                           bool pre_cert) {
+  if (ShedLoad(req, ThreadPool::Priority::NORMAL) ||
+      ShedVerification(req, pre_cert ? kPreCertType : kX509Type)) {
     return;
   }
 
-  pool_->Add(
-      bind(&CertificateHttpHandler::BlockingAddChain, this, req, chain));
+  const shared_ptr<Trace> trace(
+      Trace::Start(pre_cert ? "add-pre-chain" : "add-chain"));
+  ScopedTrace scoped_trace(trace);
+  const shared_ptr<vector<string>> der_certs(make_shared<vector<string>>());
+  {
+    ScopedSpan span("parse");
+    if (!ExtractChain(event_base_, req, der_certs.get())) {
+      return;
+    }
+  }
+
+  verification_pool_->Add(bind(&CertificateHttpHandler::VerifySubmission,
+                               this, req, der_certs, pre_cert, trace,
+                               Trace::Clock::now()));
 }
 
 
-void CertificateHttpHandler::AddPreChain(evhttp_request* req) {
-  const shared_ptr<PreCertChain> chain(make_shared<PreCertChain>());
-  if (!ExtractChain(event_base_, req, chain.get())) {
+// The chains are verified by a few tasks on |verification_pool_| at
+// once, then queued by a few tasks on |pool_|, each of which writes its
+// own pending entries to the ConsistentStore, since etcd has no way of
+// writing several keys in one request.
+void CertificateHttpHandler::AddChains(evhttp_request* req) {
+  if (ShedLoad(req, ThreadPool::Priority::BULK) ||
+      ShedVerification(req, kBatchType)) {
     return;
   }
 
-  pool_->Add(
-      bind(&CertificateHttpHandler::BlockingAddPreChain, this, req, chain));
+  const shared_ptr<Trace> trace(Trace::Start("add-chains"));
+  ScopedTrace scoped_trace(trace);
+  vector<vector<string>> der_certs;
+  vector<Status> statuses;
+  {
+    ScopedSpan span("parse");
+    const auto read_chains([&der_certs,
+                            &statuses](JsonReader* json) -> Status {
+      if (!json->StartArray()) {
+        return Status(util::error::INVALID_ARGUMENT, kBadJson);
+      }
+      while (json->NextElement()) {
+        if (der_certs.size() >=
+            static_cast<size_t>(max(FLAGS_max_chains_per_add_chains, 0))) {
+          return Status(util::error::INVALID_ARGUMENT, "Too many chains.");
+        }
+        if (json->Peek() != JsonReader::ARRAY) {
+          return Status(util::error::INVALID_ARGUMENT, kBadJson);
+        }
+        der_certs.emplace_back();
+        statuses.emplace_back(ReadChain(json, &der_certs.back()));
+      }
+      return Status::OK;
+    });
+    if (!ReadJsonBody(event_base_, req, "chains", read_chains)) {
+      return;
+    }
+  }
+
+  const shared_ptr<AddChainsBatch> batch(
+      make_shared<AddChainsBatch>(req, der_certs.size(), trace));
+  batch->der_certs.swap(der_certs);
+  batch->statuses.swap(statuses);
+
+  if (batch->statuses.empty()) {
+    return AddEntriesReply(req, batch->statuses, batch->scts);
+  }
+
+  StartAddChainsStage(batch, verification_pool_.get(),
+                      ThreadPool::Priority::NORMAL,
+                      &CertificateHttpHandler::VerifyChains);
+}
+
+
+bool CertificateHttpHandler::ShedVerification(evhttp_request* req,
+                                              const char* type) const {
+  const size_t max_queued(
+      static_cast<size_t>(FLAGS_max_queued_verifications));
+  if (verification_pool_->QueueLength(ThreadPool::Priority::NORMAL) <
+      max_queued) {
+    return false;
+  }
+  VLOG(1) << "shedding submission, " << max_queued
+          << " already waiting for verification";
+  submissions_shed->Increment(type);
+  SendJsonError(event_base_, req, HTTP_SERVUNAVAIL,
+                "Too many submissions queued.");
+  return true;
+}
+
+
+void CertificateHttpHandler::VerifySubmission(
+    evhttp_request* req, const shared_ptr<vector<string>>& der_certs,
+    bool pre_cert, const shared_ptr<Trace>& trace,
+    const Trace::Clock::time_point& queued_at) const {
+  trace->AddSpan("verification_queue", queued_at, Trace::Clock::now());
+  ScopedTrace scoped_trace(trace);
+  const shared_ptr<LogEntry> entry(make_shared<LogEntry>());
+  Status status;
+  {
+    ScopedSpan span("verify");
+    ScopedLatency latency(submission_verification_latency_ms.GetScopedLatency(
+        pre_cert ? kPreCertType : kX509Type));
+    if (pre_cert) {
+      PreCertChain chain;
+      status = LoadChain(*der_certs, &chain);
+      if (status.ok()) {
+        status =
+            submission_handler_->ProcessPreCertSubmission(&chain, entry.get());
+      }
+    } else {
+      CertChain chain;
+      status = LoadChain(*der_certs, &chain);
+      if (status.ok()) {
+        status =
+            submission_handler_->ProcessX509Submission(&chain, entry.get());
+      }
+    }
+  }
+
+  pool_->Add(bind(&CertificateHttpHandler::QueueSubmission, this, req,
+                  status, entry, trace));
 }
 
 
-void CertificateHttpHandler::BlockingAddChain(
-    evhttp_request* req, const shared_ptr<CertChain>& chain) const {
-  SignedCertificateTimestamp sct;
+void CertificateHttpHandler::QueueSubmission(
+    evhttp_request* req, const Status& verify_status,
+    const shared_ptr<LogEntry>& entry, const shared_ptr<Trace>& trace) const {
+  ScopedTrace scoped_trace(trace);
+  const shared_ptr<SignedCertificateTimestamp> sct(
+      make_shared<SignedCertificateTimestamp>());
+  const shared_ptr<vector<Status>> statuses(
+      make_shared<vector<Status>>(1, verify_status));
+  frontend_->QueueProcessedEntries(
+      {entry.get()}, {sct.get()}, statuses.get(),
+      new Task(
+          [this, req, entry, sct, statuses, trace](Task* task) {
+            {
+              ScopedTrace scoped_trace(trace);
+              AddEntryReply(req, (*statuses)[0], *sct);
+            }
+            delete task;
+          },
+          pool_));
+}
 
-  LogEntry entry;
-  const Status status(frontend_->QueueProcessedEntry(
-      submission_handler_->ProcessX509Submission(chain.get(), &entry), entry,
-      &sct));
 
-  AddEntryReply(req, status, sct);
+void CertificateHttpHandler::StartAddChainsStage(
+    const shared_ptr<AddChainsBatch>& batch, ThreadPool* pool,
+    ThreadPool::Priority priority, AddChainsStage stage) const {
+  const int num_tasks(NumAddChainsTasks(batch->statuses.size()));
+  batch->next = 0;
+  batch->running = num_tasks;
+  for (int i = 0; i < num_tasks; ++i) {
+    pool->Add(bind(stage, this, batch), priority);
+  }
 }
 
 
-void CertificateHttpHandler::BlockingAddPreChain(
-    evhttp_request* req, const shared_ptr<PreCertChain>& chain) const {
-  SignedCertificateTimestamp sct;
+void CertificateHttpHandler::VerifyChains(
+    const shared_ptr<AddChainsBatch>& batch) const {
+  ScopedTrace scoped_trace(batch->trace);
+  for (size_t i = batch->next++; i < batch->statuses.size();
+       i = batch->next++) {
+    if (!batch->statuses[i].ok()) {
+      continue;
+    }
 
-  LogEntry entry;
-  const Status status(frontend_->QueueProcessedEntry(
-      submission_handler_->ProcessPreCertSubmission(chain.get(), &entry),
-      entry, &sct));
+    ScopedLatency latency(
+        submission_verification_latency_ms.GetScopedLatency(kBatchType));
+    CertChain chain;
+    batch->statuses[i] = LoadChain(batch->der_certs[i], &chain);
+    if (batch->statuses[i].ok()) {
+      batch->statuses[i] = submission_handler_->ProcessX509Submission(
+          &chain, &batch->entries[i]);
+    }
+  }
+
+  if (--batch->running == 0) {
+    StartAddChainsStage(batch, pool_, ThreadPool::Priority::BULK,
+                        &CertificateHttpHandler::QueueChains);
+  }
+}
+
+
+void CertificateHttpHandler::QueueChains(
+    const shared_ptr<AddChainsBatch>& batch) const {
+  ScopedTrace scoped_trace(batch->trace);
+  // Each task takes an equal share of the chains, so that their SCTs
+  // get signed in as few batches as possible.
+  const size_t size(batch->statuses.size());
+  const size_t num_tasks(NumAddChainsTasks(size));
+  const size_t slice_size((size + num_tasks - 1) / num_tasks);
+  for (size_t begin = batch->next.fetch_add(slice_size); begin < size;
+       begin = batch->next.fetch_add(slice_size)) {
+    const size_t end(min(begin + slice_size, size));
+    const shared_ptr<ChainsSlice> slice(make_shared<ChainsSlice>());
+    for (size_t i = begin; i < end; ++i) {
+      if (batch->statuses[i].ok()) {
+        slice->indices.push_back(i);
+        slice->entries.push_back(&batch->entries[i]);
+        slice->scts.push_back(&batch->scts[i]);
+      }
+    }
+    if (slice->indices.empty()) {
+      continue;
+    }
+
+    // Carries on with the next slice once this one is in the store,
+    // without holding the thread meanwhile.
+    slice->statuses.assign(slice->indices.size(), Status::OK);
+    frontend_->QueueProcessedEntries(
+        slice->entries, slice->scts, &slice->statuses,
+        new Task(
+            [this, batch, slice](Task* task) {
+              for (size_t j = 0; j < slice->indices.size(); ++j) {
+                batch->statuses[slice->indices[j]] = slice->statuses[j];
+              }
+              delete task;
+              QueueChains(batch);
+            },
+            pool_));
+    return;
+  }
 
-  AddEntryReply(req, status, sct);
+  if (--batch->running == 0) {
+    AddEntriesReply(batch->req, batch->statuses, batch->scts);
+  }
 }
 
 
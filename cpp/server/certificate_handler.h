@@ -1,9 +1,14 @@
 #ifndef CERT_TRANS_SERVER_CERTIFICATE_HANDLER_H_
 #define CERT_TRANS_SERVER_CERTIFICATE_HANDLER_H_
 
+#include <memory>
+#include <string>
+#include <vector>
+
 #include "log/cert_submission_handler.h"
 #include "log/database.h"
 #include "log/logged_entry.h"
+#include "monitoring/trace.h"
 #include "server/handler.h"
 #include "server/staleness_tracker.h"
 
@@ -28,18 +33,56 @@ class CertificateHttpHandler : public HttpHandler {
   void AddHandlers(libevent::HttpServer* server) override;
 
  private:
+  struct AddChainsBatch;
+  typedef void (CertificateHttpHandler::*AddChainsStage)(
+      const std::shared_ptr<AddChainsBatch>& batch) const;
+
   const CertChecker* const cert_checker_;
   const std::unique_ptr<CertSubmissionHandler> submission_handler_;
   Frontend* const frontend_;
+  // Submitted chains are parsed and verified here, so that bursts of
+  // submissions can use every core without delaying other requests on
+  // |pool_|. NULL if |frontend_| is.
+  const std::unique_ptr<ThreadPool> verification_pool_;
 
   void GetRoots(evhttp_request* req) const;
   void AddChain(evhttp_request* req);
   void AddPreChain(evhttp_request* req);
+  // Serves the NON-standard /ct/v1/add-chains, which takes
+  // {"chains":[[cert, ...], ...]}, with chains encoded as in add-chain,
+  // and replies with {"results":[...]}, where each result is either the
+  // add-chain response for the corresponding chain, or an object with
+  // "success" set to false and an "error_message".
+  void AddChains(evhttp_request* req);
+
+  void AddSubmission(evhttp_request* req, bool pre_cert);
+  // Sends a 503 to |req| if too many submissions are already waiting
+  // for |verification_pool_| (see --max_queued_verifications). Returns
+  // whether it did.
+  bool ShedVerification(evhttp_request* req, const char* type) const;
+  // Runs on |verification_pool_|, where it was queued at |queued_at|.
+  void VerifySubmission(
+      evhttp_request* req,
+      const std::shared_ptr<std::vector<std::string>>& der_certs,
+      bool pre_cert, const std::shared_ptr<Trace>& trace,
+      const Trace::Clock::time_point& queued_at) const;
+  // Runs on |pool_|, and replies once the entry is in the store.
+  void QueueSubmission(evhttp_request* req, const util::Status& verify_status,
+                       const std::shared_ptr<ct::LogEntry>& entry,
+                       const std::shared_ptr<Trace>& trace) const;
 
-  void BlockingAddChain(evhttp_request* req,
-                        const std::shared_ptr<CertChain>& chain) const;
-  void BlockingAddPreChain(evhttp_request* req,
-                           const std::shared_ptr<PreCertChain>& chain) const;
+  // Runs |stage| for |batch| in up to --add_chains_parallelism tasks on
+  // |pool|, each taking chains until there are none left. The last one
+  // to finish moves on to the next stage.
+  void StartAddChainsStage(const std::shared_ptr<AddChainsBatch>& batch,
+                           ThreadPool* pool, ThreadPool::Priority priority,
+                           AddChainsStage stage) const;
+  // Runs on |verification_pool_|, then starts QueueChains().
+  void VerifyChains(const std::shared_ptr<AddChainsBatch>& batch) const;
+  // Runs on |pool_|, queueing one slice of the chains at a time, without
+  // holding the thread while the store writes it. The last task to run
+  // out of slices sends the reply.
+  void QueueChains(const std::shared_ptr<AddChainsBatch>& batch) const;
 
   DISALLOW_COPY_AND_ASSIGN(CertificateHttpHandler);
 };
@@ -1,29 +1,126 @@
+#include <errno.h>
 #include <gflags/gflags.h>
 #include <ldns/ldns.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <string>
-
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "fetcher/continuous_fetcher.h"
+#include "log/cluster_state_controller.h"
+#include "log/etcd_consistent_store.h"
+#include "log/file_storage.h"
+#include "log/leaf_hash_db.h"
+#include "log/leveldb_db.h"
 #include "log/log_lookup.h"
+#include "log/log_signer.h"
+#include "log/log_verifier.h"
 #include "log/logged_entry.h"
+#include "log/segmented_file_db.h"
 #include "log/sqlite_db.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
+#include "net/url_fetcher.h"
 #include "proto/cert_serializer.h"
 #include "proto/ct.pb.h"
 #include "server/event.h"
+#include "util/etcd.h"
+#include "util/etcd_v3.h"
 #include "util/init.h"
+#include "util/libevent_wrapper.h"
+#include "util/masterelection.h"
+#include "util/read_key.h"
+#include "util/statusor.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
-
+#include "util/uuid.h"
+
+namespace libevent = cert_trans::libevent;
+
+using cert_trans::ClusterStateController;
+using cert_trans::ContinuousFetcher;
+using cert_trans::Database;
+using cert_trans::EtcdClient;
+using cert_trans::EtcdConsistentStore;
+using cert_trans::EtcdV3Client;
+using cert_trans::FileStorage;
+using cert_trans::LeafHashDB;
+using cert_trans::LevelDB;
 using cert_trans::LogLookup;
 using cert_trans::LoggedEntry;
+using cert_trans::MasterElection;
+using cert_trans::ReadOnlyDatabase;
+using cert_trans::ReadPublicKey;
 using cert_trans::SQLiteDB;
+using cert_trans::SegmentedFileDB;
+using cert_trans::SplitHosts;
+using cert_trans::ThreadPool;
+using cert_trans::UrlFetcher;
 using ct::SignedTreeHead;
 using google::RegisterFlagValidator;
+using std::atomic;
+using std::condition_variable;
+using std::list;
+using std::lock_guard;
+using std::make_shared;
+using std::mutex;
+using std::shared_ptr;
 using std::string;
 using std::stringstream;
+using std::unique_lock;
+using std::unique_ptr;
+using std::unordered_map;
+using std::vector;
 
 DEFINE_int32(port, 0, "Server port");
 DEFINE_string(domain, "", "Domain");
-DEFINE_string(db, "", "Database for certificate and tree storage");
+DEFINE_string(db, "",
+              "SQLite database for certificate and tree storage, which a "
+              "ct-server can keep adding to while this serves from it");
+DEFINE_string(leveldb_db, "",
+              "LevelDB database to serve from, instead of --db. It must "
+              "not be in use by another process.");
+DEFINE_string(segment_dir, "",
+              "Directory of the segment files of a SegmentedFileDB to serve "
+              "from, instead of --db, along with --tree_dir and --meta_dir. "
+              "It must not be written to by another process.");
+DEFINE_string(tree_dir, "", "Tree storage directory for --segment_dir");
+DEFINE_string(meta_dir, "", "Meta info storage directory for --segment_dir");
+DEFINE_int32(tree_storage_depth, 0,
+             "Subdirectory depth of --tree_dir; if the directory is not "
+             "empty, must match the existing depth");
+DEFINE_int32(receive_threads, 0,
+             "If positive, number of threads answering queries, each on "
+             "its own SO_REUSEPORT socket and in batches of packets, "
+             "rather than the main event loop");
+DEFINE_int32(answer_cache_size, 100000,
+             "Number of encoded answers to recent queries to keep, to "
+             "answer the same queries again without any lookups");
+DEFINE_int32(sth_cache_seconds, 1,
+             "For how long a cached answer with the STH is used");
+DEFINE_string(etcd_servers, "",
+              "Comma separated list of 'hostname:port' of the etcd servers "
+              "of a log cluster to follow, instead of serving from a "
+              "database: the entries are fetched from the cluster nodes, "
+              "and only their leaf hashes kept, in memory");
+DEFINE_string(etcd_root, "/root", "Root of cluster entries in etcd.");
+DEFINE_bool(etcd_v3, false,
+            "Talk to the --etcd_servers through the etcd v3 API");
+DEFINE_string(log_public_key, "",
+              "Public key of the log followed with --etcd_servers, to "
+              "verify its tree heads");
 
 // Basic sanity checks on flag values.
 static bool ValidatePort(const char*, int32_t port) {
@@ -40,32 +137,113 @@ static bool NonEmptyString(const char*, const string& str) {
 static const bool domain_dummy =
     RegisterFlagValidator(&FLAGS_domain, &NonEmptyString);
 
-class CTUDPDNSServer : public UDPServer {
+// The most recently used answers to queries, keyed by the queries
+// without their ID.
+class AnswerCache {
  public:
-  CTUDPDNSServer(const string& domain, SQLiteDB* db, EventLoop* loop, int fd)
-      : UDPServer(loop, fd), domain_(domain), lookup_(db), db_(db) {
+  explicit AnswerCache(size_t max_size) : max_size_(max_size) {
   }
 
-  virtual void PacketRead(const sockaddr_in& from, const char* buf,
-                          size_t len) {
+  // Sets |*answer| to the cached answer for |key|, unless there is none,
+  // or it expired.
+  bool Lookup(const string& key, string* answer) {
+    lock_guard<mutex> lock(lock_);
+    const auto it(index_.find(key));
+    if (it == index_.end())
+      return false;
+    if (it->second->expires != 0 && it->second->expires <= time(NULL)) {
+      items_.erase(it->second);
+      index_.erase(it);
+      return false;
+    }
+    items_.splice(items_.begin(), items_, it->second);
+    *answer = it->second->answer;
+    return true;
+  }
+
+  // Caches |answer| until |expires|, or for good if it is 0.
+  void Insert(const string& key, const string& answer, time_t expires) {
+    if (max_size_ == 0)
+      return;
+    lock_guard<mutex> lock(lock_);
+    const auto it(index_.find(key));
+    if (it != index_.end()) {
+      items_.erase(it->second);
+      index_.erase(it);
+    }
+    items_.push_front(Item{key, answer, expires});
+    index_.emplace(key, items_.begin());
+    if (items_.size() > max_size_) {
+      index_.erase(items_.back().key);
+      items_.pop_back();
+    }
+  }
+
+ private:
+  struct Item {
+    string key;
+    string answer;
+    time_t expires;
+  };
+
+  const size_t max_size_;
+  mutex lock_;
+  // Most recently used first.
+  list<Item> items_;
+  unordered_map<string, list<Item>::iterator> index_;
+
+  DISALLOW_COPY_AND_ASSIGN(AnswerCache);
+};
+
+// Answers the queries for |domain|. Can be used from several threads at
+// once.
+class CTDNSResponder {
+ public:
+  // |sqlite_db| is |db| if it is an SQLiteDB, whose STH is then read
+  // again for each STH lookup, as another process adds to it, or NULL.
+  CTDNSResponder(const string& domain, ReadOnlyDatabase* db,
+                 SQLiteDB* sqlite_db)
+      : domain_(domain),
+        lookup_(db),
+        db_(db),
+        sqlite_db_(sqlite_db),
+        cache_(FLAGS_answer_cache_size) {
+  }
+
+  // Sets |*wire_answer| to the answer to the packet at |buf|, if it is a
+  // query to answer.
+  bool Answer(const char* buf, size_t len, string* wire_answer) {
+    // A query (QR 0, opcode 0) is answered the same as another one of
+    // the same questions, apart from the ID in its first two bytes.
+    const size_t kHeaderSize = 12;
+    const bool is_query(len >= kHeaderSize && (buf[2] & 0xf8) == 0);
+    const string cache_key(is_query ? string(buf + 2, len - 2) : string());
+    if (is_query && cache_.Lookup(cache_key, wire_answer)) {
+      (*wire_answer)[0] = buf[0];
+      (*wire_answer)[1] = buf[1];
+      return true;
+    }
+
     ldns_pkt* packet = NULL;
 
     ldns_status ret = ldns_wire2pkt(&packet, (const uint8_t*)buf, len);
     if (ret != LDNS_STATUS_OK) {
       LOG(INFO) << "Bad DNS packet";
-      return;
+      return false;
     }
 
     // ldns_pkt_print(stdout, packet);
 
     if (ldns_pkt_qr(packet) != 0) {
       LOG(INFO) << "Packet is not a query";
-      return;
+      ldns_pkt_free(packet);
+      return false;
     }
 
     if (ldns_pkt_get_opcode(packet) != LDNS_PACKET_QUERY) {
       LOG(INFO) << "Packet has bad opcode";
-      return;
+      ldns_pkt_free(packet);
+      return false;
     }
 
     ldns_pkt* answers = ldns_pkt_new();
@@ -77,24 +255,29 @@ class CTUDPDNSServer : public UDPServer {
     ldns_pkt_safe_push_rr_list(answers, LDNS_SECTION_QUESTION,
                                ldns_rr_list_clone(questions));
 
+    // The answer can be cached until |expires| (for good if it is 0),
+    // unless one of the lookups failed.
+    bool cacheable(true);
+    time_t expires(0);
     for (size_t n = 0; n < ldns_rr_list_rr_count(questions); ++n) {
       ldns_rr* question = ldns_rr_list_rr(questions, n);
 
       if (ldns_rr_get_type(question) != LDNS_RR_TYPE_TXT) {
-        LOG(INFO) << "Question is not TXT";
+        VLOG(1) << "Question is not TXT";
         // FIXME(benl): set error response?
         continue;
       }
 
       ldns_rdf* owner = ldns_rr_owner(question);
       if (ldns_rdf_get_type(owner) != LDNS_RDF_TYPE_DNAME) {
-        LOG(INFO) << "Owner is not a dname";
+        VLOG(1) << "Owner is not a dname";
         continue;
       }
 
       ldns_buffer* dname = ldns_buffer_new(512);
       if (ldns_rdf2buffer_str_dname(dname, owner) != LDNS_STATUS_OK) {
-        LOG(INFO) << "Can't decode owner";
+        VLOG(1) << "Can't decode owner";
+        ldns_buffer_free(dname);
         continue;
       }
 
@@ -105,17 +288,20 @@ class CTUDPDNSServer : public UDPServer {
       ldns_buffer_free(dname);
       dname = NULL;
 
-      LOG(INFO) << "Question is TXT of " << owner_name;
+      VLOG(1) << "Question is TXT of " << owner_name;
 
       if (owner_name.length() <= domain_.length() ||
           owner_name.compare(owner_name.length() - domain_.length(),
                              domain_.length(), domain_) != 0) {
-        LOG(INFO) << "Question is not for our domain";
+        VLOG(1) << "Question is not for our domain";
         continue;
       }
 
+      bool found(false);
       std::string response = Response(
-          owner_name.substr(0, owner_name.length() - domain_.length() - 1));
+          owner_name.substr(0, owner_name.length() - domain_.length() - 1),
+          &found, &expires);
+      cacheable = cacheable && found;
 
       ldns_rr* answer = ldns_rr_new();
       ldns_rr_set_owner(answer, ldns_rdf_new_frm_str(LDNS_RDF_TYPE_DNAME,
@@ -128,25 +314,40 @@ class CTUDPDNSServer : public UDPServer {
     }
     ldns_pkt_free(packet);
 
-    char* answer_str = ldns_pkt2str(answers);
-    LOG(INFO) << "Answer is " << answer_str;
-    free(answer_str);
+    if (VLOG_IS_ON(1)) {
+      char* answer_str = ldns_pkt2str(answers);
+      VLOG(1) << "Answer is " << answer_str;
+      free(answer_str);
+    }
 
-    uint8_t* wire_answer;
+    uint8_t* wire;
     size_t answer_size;
-    if (ldns_pkt2wire(&wire_answer, answers, &answer_size) != LDNS_STATUS_OK) {
+    if (ldns_pkt2wire(&wire, answers, &answer_size) != LDNS_STATUS_OK) {
       LOG(ERROR) << "Can't make wire answer";
-      return;
+      ldns_pkt_free(answers);
+      return false;
     }
-    QueuePacket(from, wire_answer, answer_size);
-    free(wire_answer);
+    wire_answer->assign(reinterpret_cast<const char*>(wire), answer_size);
+    free(wire);
     ldns_pkt_free(answers);
+
+    if (is_query && cacheable)
+      cache_.Insert(cache_key, *wire_answer, expires);
+    return true;
   }
 
  private:
-  string Response(string question) {
-    if (question == "sth")
+  // Sets |*found| to whether the answer is there to stay, and if it
+  // only is for a while, lowers |*expires| (unless it is 0, for never)
+  // to when that ends.
+  string Response(string question, bool* found, time_t* expires) {
+    if (question == "sth") {
+      *found = true;
+      const time_t sth_expires(time(NULL) + FLAGS_sth_cache_seconds);
+      if (*expires == 0 || sth_expires < *expires)
+        *expires = sth_expires;
       return STH();
+    }
 
     size_t dot = question.find_last_of('.');
     if (dot == string::npos)
@@ -154,39 +355,49 @@ class CTUDPDNSServer : public UDPServer {
 
     string head = question.substr(0, dot);
     string tail = question.substr(dot + 1);
-    LOG(INFO) << "head = " << head << ", tail = " << tail;
+    VLOG(1) << "head = " << head << ", tail = " << tail;
     if (tail == "tree")
-      return Tree(head);
+      return Tree(head, found);
     else if (tail == "hash")
-      return Hash(head);
+      return Hash(head, found);
     else if (tail == "leafhash")
-      return LeafHash(head);
+      return LeafHash(head, found);
 
     return question + " is the question.";
   }
 
-  string LeafHash(const string& index_str) const {
-    int index = atoi(index_str.c_str());
-    LoggedEntry cert;
-    if (db_->LookupByIndex(index, &cert) != db_->LOOKUP_OK)
+  string LeafHash(const string& index_str, bool* found) const {
+    int64_t index = atoll(index_str.c_str());
+    if (index < 0)
       return "No such index";
-    return util::ToBase64(lookup_.LeafHash(cert));
+    // The leaf hashes are stored along with the entries (or instead of
+    // them, in a LeafHashDB), so this does not need to read the entry.
+    int64_t sequence_number;
+    string leaf_hash;
+    if (!db_->ScanLeafHashes(index)->GetNextLeafHash(&sequence_number,
+                                                     &leaf_hash) ||
+        sequence_number != index)
+      return "No such index";
+    *found = true;
+    return util::ToBase64(leaf_hash);
   }
 
-  string Hash(const string& hash) {
-    db_->ForceNotifySTH();
+  string Hash(const string& hash, bool* found) {
+    if (sqlite_db_)
+      sqlite_db_->ForceNotifySTH();
 
     // FIXME: decode hash!
     int64_t index;
     if (lookup_.GetIndex(hash, &index) != lookup_.OK)
       return "No such hash";
+    *found = true;
 
     stringstream ss;
     ss << index;
     return ss.str();
   }
 
-  string Tree(const string& question) {
+  string Tree(const string& question, bool* found) {
     size_t dot = question.find_first_of('.');
     if (dot == string::npos)
       return question + " not understood";
@@ -199,26 +410,31 @@ class CTUDPDNSServer : public UDPServer {
     string index = question.substr(dot + 1, dot2 - dot - 1);
     string size = question.substr(dot2 + 1);
 
-    LOG(INFO) << "level = " << level << ", index = " << index
-              << ", size = " << size;
+    VLOG(1) << "level = " << level << ", index = " << index
+            << ", size = " << size;
 
     ct::ShortMerkleAuditProof proof;
-    if (lookup_.AuditProof(atoi(index.c_str()), atoi(size.c_str()), &proof) !=
-        lookup_.OK)
+    if (lookup_.AuditProof(atoll(index.c_str()), atoll(size.c_str()),
+                           &proof) != lookup_.OK)
       return "Lookup of node " + index + "." + size + " failed";
 
     int l = atoi(level.c_str());
     if (l < 0 || l >= proof.path_node_size())
       return "Level " + level + " is out of range";
 
+    *found = true;
     string b64 = util::ToBase64(proof.path_node(l));
     return b64;
   }
 
   string STH() {
-    db_->ForceNotifySTH();
+    if (sqlite_db_)
+      sqlite_db_->ForceNotifySTH();
 
     const SignedTreeHead& sth = lookup_.GetSTH();
+    // While following a cluster that has not been caught up with yet.
+    if (!sth.has_signature())
+      return "No tree head yet";
 
     std::string signature;
     CHECK_EQ(Serializer::SerializeDigitallySigned(sth.signature(), &signature),
@@ -232,11 +448,122 @@ class CTUDPDNSServer : public UDPServer {
     return ss.str();
   }
 
-  string domain_;
+  const string domain_;
   LogLookup lookup_;
-  SQLiteDB* const db_;
+  ReadOnlyDatabase* const db_;
+  SQLiteDB* const sqlite_db_;
+  AnswerCache cache_;
+
+  DISALLOW_COPY_AND_ASSIGN(CTDNSResponder);
 };
 
+// Answers the queries on the main event loop.
+class CTUDPDNSServer : public UDPServer {
+ public:
+  CTUDPDNSServer(CTDNSResponder* responder, EventLoop* loop, int fd)
+      : UDPServer(loop, fd), responder_(responder) {
+  }
+
+  virtual void PacketRead(const sockaddr_in& from, const char* buf,
+                          size_t len) {
+    string answer;
+    if (responder_->Answer(buf, len, &answer))
+      QueuePacket(from, answer.data(), answer.size());
+  }
+
+ private:
+  CTDNSResponder* const responder_;
+};
+
+// Returns a UDP socket bound to |port| along with the others of the
+// receive threads, so that the kernel spreads the queries over them.
+static int BindReusePortSocket(int port) {
+  const int fd(socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP));
+  PCHECK(fd >= 0) << "socket";
+  const int one(1);
+  PCHECK(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == 0)
+      << "SO_REUSEPORT";
+  // Wake up every now and then, to notice when to stop.
+  const timeval timeout{1, 0};
+  PCHECK(setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+                    sizeof(timeout)) == 0)
+      << "SO_RCVTIMEO";
+
+  sockaddr_in address;
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_port = htons(static_cast<uint16_t>(port));
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  PCHECK(bind(fd, reinterpret_cast<const sockaddr*>(&address),
+              sizeof(address)) == 0)
+      << "bind";
+  return fd;
+}
+
+// Answers the queries received on |fd| until |*stop| is set, receiving
+// and sending them in batches.
+static void ServeQueries(CTDNSResponder* responder, int fd,
+                         const atomic<bool>* stop) {
+  const int kBatchSize = 32;
+  const size_t kMaxPacketSize = 2048;
+  vector<char> buffers(kBatchSize * kMaxPacketSize);
+  vector<sockaddr_in> senders(kBatchSize);
+  vector<iovec> in_iovs(kBatchSize);
+  vector<mmsghdr> in_msgs(kBatchSize);
+  vector<string> answers(kBatchSize);
+  vector<iovec> out_iovs(kBatchSize);
+  vector<mmsghdr> out_msgs(kBatchSize);
+
+  while (!stop->load()) {
+    for (int i = 0; i < kBatchSize; ++i) {
+      in_iovs[i].iov_base = &buffers[i * kMaxPacketSize];
+      in_iovs[i].iov_len = kMaxPacketSize;
+      memset(&in_msgs[i], 0, sizeof(in_msgs[i]));
+      in_msgs[i].msg_hdr.msg_name = &senders[i];
+      in_msgs[i].msg_hdr.msg_namelen = sizeof(senders[i]);
+      in_msgs[i].msg_hdr.msg_iov = &in_iovs[i];
+      in_msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    // Waits for the first packet only, and takes whichever others are
+    // already there.
+    const int received(
+        recvmmsg(fd, in_msgs.data(), kBatchSize, MSG_WAITFORONE, NULL));
+    if (received < 0) {
+      PCHECK(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+          << "recvmmsg";
+      continue;
+    }
+
+    int num_answers(0);
+    for (int i = 0; i < received; ++i) {
+      if (in_msgs[i].msg_hdr.msg_namelen != sizeof(sockaddr_in) ||
+          !responder->Answer(&buffers[i * kMaxPacketSize], in_msgs[i].msg_len,
+                             &answers[num_answers]))
+        continue;
+      out_iovs[num_answers].iov_base = &answers[num_answers][0];
+      out_iovs[num_answers].iov_len = answers[num_answers].size();
+      memset(&out_msgs[num_answers], 0, sizeof(out_msgs[num_answers]));
+      out_msgs[num_answers].msg_hdr.msg_name = &senders[i];
+      out_msgs[num_answers].msg_hdr.msg_namelen = sizeof(senders[i]);
+      out_msgs[num_answers].msg_hdr.msg_iov = &out_iovs[num_answers];
+      out_msgs[num_answers].msg_hdr.msg_iovlen = 1;
+      ++num_answers;
+    }
+
+    for (int sent = 0; sent < num_answers;) {
+      const int ret(
+          sendmmsg(fd, out_msgs.data() + sent, num_answers - sent, 0));
+      if (ret < 0 && errno == EINTR)
+        continue;
+      if (ret < 0) {
+        PLOG(WARNING) << "sendmmsg";
+        break;
+      }
+      sent += ret;
+    }
+  }
+}
+
 class Keyboard : public Server {
  public:
   Keyboard(EventLoop* loop) : Server(loop, 0) {
@@ -266,24 +593,189 @@ class Keyboard : public Server {
   }
 };
 
+// Follows the log cluster of --etcd_servers: fetches the entries from
+// its nodes into |db|, and writes the serving STH to it once it has all
+// of the entries of that STH. It only watches the state of the cluster,
+// and never publishes any of its own, so the nodes do not know about it.
+class ClusterFollower {
+ public:
+  ClusterFollower(Database* db, const LogVerifier* log_verifier)
+      : db_(CHECK_NOTNULL(db)),
+        log_verifier_(CHECK_NOTNULL(log_verifier)),
+        event_base_(make_shared<libevent::Base>()),
+        event_pump_(new libevent::EventPumpThread(event_base_)),
+        pool_("follower", 8),
+        url_fetcher_(event_base_.get(), &pool_),
+        etcd_client_(
+            FLAGS_etcd_v3
+                ? new EtcdV3Client(&pool_, &url_fetcher_,
+                                   SplitHosts(FLAGS_etcd_servers))
+                : new EtcdClient(&pool_, &url_fetcher_,
+                                 SplitHosts(FLAGS_etcd_servers))),
+        node_id_(cert_trans::UUID4()),
+        // Never started, so that this never becomes the master.
+        election_(event_base_, etcd_client_.get(),
+                  FLAGS_etcd_root + "/election", node_id_),
+        store_(event_base_.get(), &pool_, etcd_client_.get(), &election_,
+               FLAGS_etcd_root, node_id_),
+        fetcher_(ContinuousFetcher::New(event_base_.get(), &pool_, db_,
+                                        log_verifier_,
+                                        false /* fetch_scts */)),
+        controller_(&pool_, event_base_, &url_fetcher_, db_, &store_,
+                    &election_, fetcher_.get()),
+        stop_(false),
+        catch_up_thread_(&ClusterFollower::CatchUp, this) {
+  }
+
+  ~ClusterFollower() {
+    {
+      lock_guard<mutex> lock(stop_lock_);
+      stop_ = true;
+    }
+    stop_cv_.notify_all();
+    catch_up_thread_.join();
+  }
+
+ private:
+  // The ClusterStateController only writes the serving STH when it
+  // changes, or when this node publishes a tree head of its own, which
+  // it never does, so check every now and then whether the fetcher has
+  // caught up with it since.
+  void CatchUp() {
+    unique_lock<mutex> lock(stop_lock_);
+    while (!stop_cv_.wait_for(lock, std::chrono::seconds(1),
+                              [this]() { return stop_; })) {
+      lock.unlock();
+      WriteServingSTH();
+      lock.lock();
+    }
+  }
+
+  void WriteServingSTH() {
+    const util::StatusOr<SignedTreeHead> serving_sth(store_.GetServingSTH());
+    if (!serving_sth.ok())
+      return;
+    const SignedTreeHead& sth(serving_sth.ValueOrDie());
+    SignedTreeHead db_sth;
+    if (db_->TreeSize() < sth.tree_size() ||
+        (db_->LatestTreeHead(&db_sth) == Database::LOOKUP_OK &&
+         db_sth.timestamp() >= sth.timestamp()))
+      return;
+
+    const LogVerifier::LogVerifyResult result(
+        log_verifier_->VerifySignedTreeHead(sth));
+    if (result != LogVerifier::VERIFY_OK) {
+      LOG(WARNING) << "Serving STH did not verify: "
+                   << LogVerifier::VerifyResultString(result);
+      return;
+    }
+    // The controller may have just written it too, which is fine.
+    CHECK_EQ(Database::OK, db_->WriteTreeHead(sth));
+    LOG(INFO) << "Caught up with serving STH of size " << sth.tree_size();
+  }
+
+  Database* const db_;
+  const LogVerifier* const log_verifier_;
+  const shared_ptr<libevent::Base> event_base_;
+  const unique_ptr<libevent::EventPumpThread> event_pump_;
+  ThreadPool pool_;
+  UrlFetcher url_fetcher_;
+  const unique_ptr<EtcdClient> etcd_client_;
+  const string node_id_;
+  MasterElection election_;
+  EtcdConsistentStore<LoggedEntry> store_;
+  const unique_ptr<ContinuousFetcher> fetcher_;
+  ClusterStateController<LoggedEntry> controller_;
+
+  mutex stop_lock_;
+  condition_variable stop_cv_;
+  bool stop_;
+  std::thread catch_up_thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(ClusterFollower);
+};
+
+// Opens the database chosen by the flags, setting |*sqlite_db| to it
+// if it is an SQLiteDB, and to NULL otherwise.
+static unique_ptr<Database> OpenDatabase(SQLiteDB** sqlite_db) {
+  CHECK_EQ(!FLAGS_db.empty() + !FLAGS_leveldb_db.empty() +
+               !FLAGS_segment_dir.empty() + !FLAGS_etcd_servers.empty(),
+           1)
+      << "Must specify exactly one of --db, --leveldb_db, --segment_dir "
+      << "and --etcd_servers";
+  *sqlite_db = NULL;
+  // Filled in by a ClusterFollower.
+  if (!FLAGS_etcd_servers.empty())
+    return unique_ptr<Database>(new LeafHashDB);
+  if (!FLAGS_leveldb_db.empty())
+    return unique_ptr<Database>(new LevelDB(FLAGS_leveldb_db));
+  if (!FLAGS_segment_dir.empty())
+    return unique_ptr<Database>(new SegmentedFileDB(
+        FLAGS_segment_dir,
+        new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth),
+        new FileStorage(FLAGS_meta_dir, 0)));
+
+  // This is the only one that can be shared with a ct-server that
+  // populates it (which the others do not support).
+  *sqlite_db = new SQLiteDB(FLAGS_db);
+  return unique_ptr<Database>(*sqlite_db);
+}
+
 int main(int argc, char* argv[]) {
   util::InitCT(&argc, &argv);
   ConfigureSerializerForV1CT();
 
-  // TODO(pphaneuf): This current *has* to be SQLite, because it
-  // depends on sharing the database with a ct-server that will
-  // populate it (which FileDB does not support).
-  SQLiteDB db(FLAGS_db);
+  SQLiteDB* sqlite_db;
+  const unique_ptr<Database> db(OpenDatabase(&sqlite_db));
+
+  unique_ptr<LogVerifier> log_verifier;
+  unique_ptr<ClusterFollower> follower;
+  if (!FLAGS_etcd_servers.empty()) {
+    CHECK(!FLAGS_log_public_key.empty())
+        << "--etcd_servers needs --log_public_key";
+    const util::StatusOr<EVP_PKEY*> pubkey(
+        ReadPublicKey(FLAGS_log_public_key));
+    CHECK(pubkey.ok()) << "Failed to read the log's public key file: "
+                       << pubkey.status();
+    log_verifier.reset(
+        new LogVerifier(new LogSigVerifier(pubkey.ValueOrDie()),
+                        new MerkleVerifier(new Sha256Hasher)));
+    follower.reset(new ClusterFollower(db.get(), log_verifier.get()));
+    LOG(INFO) << "Following the log cluster at " << FLAGS_etcd_servers;
+  }
+
+  CTDNSResponder responder(FLAGS_domain, db.get(), sqlite_db);
 
   EventLoop loop;
 
   // Mostly so we can have a clean exit for valgrind etc.
   Keyboard keyboard(&loop);
 
-  int dns_fd;
-  CHECK(Services::InitServer(&dns_fd, FLAGS_port, NULL, SOCK_DGRAM));
-  CTUDPDNSServer dns(FLAGS_domain, &db, &loop, dns_fd);
+  if (FLAGS_receive_threads <= 0) {
+    int dns_fd;
+    CHECK(Services::InitServer(&dns_fd, FLAGS_port, NULL, SOCK_DGRAM));
+    CTUDPDNSServer dns(&responder, &loop, dns_fd);
+
+    LOG(INFO) << "Server listening on port " << FLAGS_port;
+    loop.Forever();
+    return 0;
+  }
+
+  atomic<bool> stop(false);
+  vector<int> fds;
+  vector<std::thread> threads;
+  for (int i = 0; i < FLAGS_receive_threads; ++i) {
+    fds.push_back(BindReusePortSocket(FLAGS_port));
+    threads.emplace_back(&ServeQueries, &responder, fds.back(), &stop);
+  }
 
-  LOG(INFO) << "Server listening on port " << FLAGS_port;
+  LOG(INFO) << "Server listening on port " << FLAGS_port << " with "
+            << FLAGS_receive_threads << " threads";
   loop.Forever();
+
+  stop.store(true);
+  for (size_t i = 0; i < threads.size(); ++i) {
+    threads[i].join();
+    PCHECK(close(fds[i]) == 0) << "close";
+  }
 }
@@ -0,0 +1,120 @@
+/* -*- indent-tabs-mode: nil -*- */
+
+// Serves a remote log close to its clients, from an EdgeCache, without
+// holding a database of its own: the tree heads are those of the log,
+// and the entries and proofs that clients ask for are fetched from it,
+// checked against them, and kept in a bounded cache on local disk.
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <signal.h>
+#include <chrono>
+#include <csignal>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "client/async_log_client.h"
+#include "log/log_signer.h"
+#include "log/log_verifier.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
+#include "net/url_fetcher.h"
+#include "proto/cert_serializer.h"
+#include "server/edge_cache.h"
+#include "server/edge_handler.h"
+#include "server/metrics.h"
+#include "util/init.h"
+#include "util/libevent_wrapper.h"
+#include "util/read_key.h"
+#include "util/status.h"
+#include "util/thread_pool.h"
+
+DEFINE_int32(port, 9999, "Port to serve on.");
+DEFINE_string(target_log_uri, "", "URI of the log to serve.");
+DEFINE_string(target_public_key, "",
+              "PEM-encoded public key file of the log to serve.");
+DEFINE_int32(target_poll_frequency_seconds, 10,
+             "How often to fetch the tree head of the log.");
+DEFINE_string(edge_cache_dir, "",
+              "Existing directory in which to keep the entries and proofs "
+              "fetched from the log.");
+DEFINE_int32(edge_cache_mb, 1024,
+             "Most megabytes of files in --edge_cache_dir, the least "
+             "recently used being removed first.");
+DEFINE_int32(num_http_server_threads, 16,
+             "Number of threads answering the requests, which can wait for "
+             "the log.");
+
+namespace libevent = cert_trans::libevent;
+
+using cert_trans::AsyncLogClient;
+using cert_trans::DiskLruCache;
+using cert_trans::EdgeCache;
+using cert_trans::EdgeHttpHandler;
+using cert_trans::ReadPublicKey;
+using cert_trans::ThreadPool;
+using cert_trans::UrlFetcher;
+using std::make_shared;
+using std::shared_ptr;
+using std::thread;
+using util::Status;
+using util::StatusOr;
+
+
+int main(int argc, char* argv[]) {
+  // Ignore various signals whilst we start up.
+  signal(SIGHUP, SIG_IGN);
+  signal(SIGINT, SIG_IGN);
+  signal(SIGTERM, SIG_IGN);
+
+  util::InitCT(&argc, &argv);
+  ConfigureSerializerForV1CT();
+
+  CHECK(!FLAGS_target_log_uri.empty()) << "--target_log_uri is required";
+  CHECK(!FLAGS_edge_cache_dir.empty()) << "--edge_cache_dir is required";
+  CHECK_GT(FLAGS_edge_cache_mb, 0);
+  CHECK(!FLAGS_target_public_key.empty());
+  const StatusOr<EVP_PKEY*> pubkey(ReadPublicKey(FLAGS_target_public_key));
+  CHECK(pubkey.ok()) << "Failed to read target log's public key file: "
+                     << pubkey.status();
+  const LogVerifier log_verifier(new LogSigVerifier(pubkey.ValueOrDie()),
+                                 new MerkleVerifier(new Sha256Hasher));
+
+  const shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
+  // Runs the callbacks of the requests to the log, which the threads of
+  // |http_pool| wait for.
+  ThreadPool internal_pool("internal", 8);
+  UrlFetcher url_fetcher(event_base.get(), &internal_pool);
+  AsyncLogClient client(&internal_pool, &url_fetcher, FLAGS_target_log_uri);
+
+  DiskLruCache disk_cache(FLAGS_edge_cache_dir,
+                          static_cast<int64_t>(FLAGS_edge_cache_mb) << 20);
+  EdgeCache cache(&client, &log_verifier, &disk_cache);
+
+  ThreadPool http_pool("http", FLAGS_num_http_server_threads);
+  EdgeHttpHandler handler(&cache, &http_pool, event_base.get());
+  libevent::HttpServer http_server(*event_base);
+  handler.Add(&http_server);
+  http_server.AddHandler("/metrics", cert_trans::ExportPrometheusMetrics);
+  http_server.Bind(nullptr, FLAGS_port);
+
+  thread sth_updater([&cache]() {
+    while (true) {
+      const Status status(cache.UpdateSTH());
+      if (!status.ok()) {
+        LOG(WARNING) << "Could not update the tree head: " << status;
+      }
+      std::this_thread::sleep_for(
+          std::chrono::seconds(FLAGS_target_poll_frequency_seconds));
+    }
+  });
+  sth_updater.detach();
+
+  signal(SIGHUP, SIG_DFL);
+  signal(SIGINT, SIG_DFL);
+  signal(SIGTERM, SIG_DFL);
+  event_base->Dispatch();
+
+  return 0;
+}
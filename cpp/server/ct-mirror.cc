@@ -16,6 +16,7 @@
 #include <mutex>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "client/async_log_client.h"
 #include "config.h"
@@ -27,6 +28,7 @@
 #include "log/database.h"
 #include "log/etcd_consistent_store.h"
 #include "log/log_lookup.h"
+#include "log/snapshot.h"
 #include "log/strict_consistent_store.h"
 #include "merkletree/compact_merkle_tree.h"
 #include "merkletree/merkle_verifier.h"
@@ -51,6 +53,8 @@
 #include "util/util.h"
 #include "util/uuid.h"
 
+DECLARE_string(path_prefix);
+
 DEFINE_int32(log_stats_frequency_seconds, 3600,
              "Interval for logging summary statistics. Approximate: the "
              "server will log statistics if in the beginning of its select "
@@ -67,6 +71,11 @@ DEFINE_string(
     "PEM-encoded server public key file of the log we're mirroring.");
 DEFINE_int32(local_sth_update_frequency_seconds, 30,
              "Number of seconds between local checks for updated tree data.");
+DEFINE_string(snapshot_dir, "",
+              "If set, import the snapshot of the target log in this "
+              "directory (see db_tool export_snapshot) into the database "
+              "before starting to fetch. An interrupted import is resumed "
+              "from where it stopped.");
 
 namespace libevent = cert_trans::libevent;
 
@@ -116,6 +125,7 @@ using std::shared_ptr;
 using std::string;
 using std::thread;
 using std::unique_ptr;
+using std::vector;
 using util::HexString;
 using util::StatusOr;
 using util::SyncTask;
@@ -172,6 +182,14 @@ void STHUpdater(Database* db,
   CHECK_NOTNULL(task);
   CHECK_NOTNULL(log_lookup);
 
+  // log_lookup doesn't yet have the data for the new STHs integrated (that
+  // happens via a callback when the WriteTreeHead() method is called on the
+  // DB), so we'll used a compact tree to pre-validate the STH roots.
+  //
+  // It is kept from one round to the next, so that the entries hashed into
+  // it are not hashed again while the serving tree catches up with it.
+  unique_ptr<CompactMerkleTree> new_tree;
+
   while (true) {
     if (task->CancelRequested()) {
       task->Return(util::Status::CANCELLED);
@@ -180,51 +198,61 @@ void STHUpdater(Database* db,
     const int64_t local_size(db->TreeSize());
     latest_local_tree_size_gauge->Set(local_size);
 
-    // log_lookup doesn't yet have the data for the new STHs integrated (that
-    // happens via a callback when the WriteTreeHead() method is called on the
-    // DB), so we'll used a compact tree to pre-validate the STH roots.
-    //
-    // We'll start with one based on the current state of our serving tree and
-    // update it to the STH sizes we're checking.
-    unique_ptr<CompactMerkleTree> new_tree(
-        log_lookup->GetCompactMerkleTree(new Sha256Hasher));
-
     {
       lock_guard<mutex> lock(*queue_mutex);
-      unique_ptr<Database::Iterator> entries(
-          db->ScanEntries(new_tree->LeafCount()));
+      unique_ptr<Database::LeafHashIterator> leaf_hashes;
+      // Only the newest of the STHs that check out is handed over, the
+      // older ones would be replaced by it right away.
+      unique_ptr<SignedTreeHead> newest_sth;
       while (!queue->empty() &&
              queue->begin()->second.tree_size() <= local_size) {
         const SignedTreeHead next_sth(queue->begin()->second);
         queue->erase(queue->begin());
+        CHECK_LE(next_sth.tree_size(), local_size);
+        CHECK_GE(next_sth.tree_size(), 0);
+        const uint64_t next_sth_tree_size(
+            static_cast<uint64_t>(next_sth.tree_size()));
+        const int64_t serving_tree_size(log_lookup->GetSTH().tree_size());
+
+        // Start from the current state of our serving tree, unless the
+        // compact tree is between it and the candidate STH size.
+        if (!new_tree ||
+            new_tree->LeafCount() <
+                static_cast<uint64_t>(serving_tree_size) ||
+            (next_sth.tree_size() > serving_tree_size &&
+             new_tree->LeafCount() > next_sth_tree_size)) {
+          new_tree = log_lookup->GetCompactMerkleTree(new Sha256Hasher);
+          leaf_hashes.reset();
+        }
 
-        // First, if necessary, catch our local compact tree up to the
-        // candidate STH size:
-        {
-          LoggedEntry entry;
-          CHECK_LE(next_sth.tree_size(), local_size);
-          CHECK_GE(next_sth.tree_size(), 0);
-          const uint64_t next_sth_tree_size(
-              static_cast<uint64_t>(next_sth.tree_size()));
-          while (new_tree->LeafCount() < next_sth_tree_size) {
-            CHECK(entries->GetNextEntry(&entry));
-            CHECK(entry.has_sequence_number());
-            CHECK_GE(entry.sequence_number(), 0);
-            const uint64_t entry_sequence_number(
-                static_cast<uint64_t>(entry.sequence_number()));
-            CHECK_EQ(new_tree->LeafCount(), entry_sequence_number);
-            string serialized_leaf;
-            CHECK(entry.SerializeForLeaf(&serialized_leaf));
-            CHECK_EQ(entry_sequence_number + 1,
-                     new_tree->AddLeaf(serialized_leaf));
+        // Then, if necessary, catch our local compact tree up to the
+        // candidate STH size. The leaf hashes are stored with the entries,
+        // and the large complete subtrees they make up are hashed in
+        // parallel.
+        if (new_tree->LeafCount() < next_sth_tree_size) {
+          if (!leaf_hashes) {
+            leaf_hashes = db->ScanLeafHashes(new_tree->LeafCount());
+          }
+          vector<string> hashes;
+          hashes.reserve(next_sth_tree_size - new_tree->LeafCount());
+          int64_t sequence_number;
+          string leaf_hash;
+          while (new_tree->LeafCount() + hashes.size() < next_sth_tree_size) {
+            CHECK(leaf_hashes->GetNextLeafHash(&sequence_number, &leaf_hash));
+            CHECK_GE(sequence_number, 0);
+            CHECK_EQ(new_tree->LeafCount() + hashes.size(),
+                     static_cast<uint64_t>(sequence_number));
+            hashes.emplace_back(std::move(leaf_hash));
           }
+          CHECK_EQ(next_sth_tree_size,
+                   new_tree->AddLeafHashes(hashes, task->executor()));
         }
 
         // If the candidate STH is historical, use the RootAtSnapshot() from
         // our serving tree, otherwise use the root we just calculated with our
         // compact tree.
         const string local_root_at_snapshot(
-            next_sth.tree_size() > log_lookup->GetSTH().tree_size()
+            next_sth.tree_size() > serving_tree_size
                 ? new_tree->CurrentRoot()
                 : log_lookup->RootAtSnapshot(next_sth.tree_size()));
 
@@ -240,9 +268,14 @@ void STHUpdater(Database* db,
           // separate DB table for later analysis.
           continue;
         }
-        LOG(INFO) << "Can serve new STH of size " << next_sth.tree_size()
+        if (!newest_sth || next_sth.timestamp() > newest_sth->timestamp()) {
+          newest_sth.reset(new SignedTreeHead(next_sth));
+        }
+      }
+      if (newest_sth) {
+        LOG(INFO) << "Can serve new STH of size " << newest_sth->tree_size()
                   << " locally";
-        cluster_state_controller->NewTreeHead(next_sth);
+        cluster_state_controller->NewTreeHead(*newest_sth);
       }
     }
 
@@ -258,6 +291,10 @@ int main(int argc, char* argv[]) {
   signal(SIGINT, SIG_IGN);
   signal(SIGTERM, SIG_IGN);
 
+  // Many clients tailing a mirror ask for the same new entries right
+  // after each tree head, so keep the newest windows ready by default.
+  google::SetCommandLineOptionWithMode("get_entries_cached_windows", "8",
+                                       google::SET_FLAGS_DEFAULT);
   util::InitCT(&argc, &argv);
   ConfigureSerializerForV1CT();
 
@@ -269,7 +306,7 @@ int main(int argc, char* argv[]) {
 
   const bool stand_alone_mode(cert_trans::IsStandalone(false));
   const shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
-  ThreadPool internal_pool(8);
+  ThreadPool internal_pool("internal", 8);
   UrlFetcher url_fetcher(event_base.get(), &internal_pool);
 
   const unique_ptr<EtcdClient> etcd_client(
@@ -284,7 +321,17 @@ int main(int argc, char* argv[]) {
   const LogVerifier log_verifier(new LogSigVerifier(pubkey.ValueOrDie()),
                                  new MerkleVerifier(new Sha256Hasher));
 
-  ThreadPool http_pool(FLAGS_num_http_server_threads);
+  // Import the snapshot before anything reads the database, the fetcher
+  // then only has to catch up from the snapshot STH.
+  unique_ptr<SignedTreeHead> snapshot_sth;
+  if (!FLAGS_snapshot_dir.empty()) {
+    const StatusOr<SignedTreeHead> sth(cert_trans::ImportSnapshot(
+        FLAGS_snapshot_dir, log_verifier, &internal_pool, db.get()));
+    CHECK(sth.ok()) << "Failed to import snapshot: " << sth.status();
+    snapshot_sth.reset(new SignedTreeHead(sth.ValueOrDie()));
+  }
+
+  ThreadPool http_pool("http", FLAGS_num_http_server_threads);
 
   Server server(event_base, &internal_pool, &http_pool, db.get(),
                 etcd_client.get(), &url_fetcher, &log_verifier);
@@ -294,15 +341,18 @@ int main(int argc, char* argv[]) {
       new StalenessTracker(server.cluster_state_controller(), &internal_pool,
                            event_base.get()));
 
-  CertificateHttpHandler handler(server.log_lookup(), db.get(),
-                                 server.cluster_state_controller(),
-                                 nullptr /* checker */, nullptr /* Frontend */,
-                                 &internal_pool, event_base.get(),
-                                 staleness_tracker.get());
-
-  // Connect the handler, proxy and server together
-  handler.SetProxy(server.proxy());
-  handler.Add(server.http_server());
+  // One handler per HTTP event loop, each replying on its own loop.
+  vector<unique_ptr<CertificateHttpHandler>> handlers;
+  for (size_t i = 0; i < server.num_http_event_loops(); ++i) {
+    handlers.emplace_back(new CertificateHttpHandler(
+        server.log_lookup(), db.get(), server.cluster_state_controller(),
+        nullptr /* checker */, nullptr /* Frontend */, &internal_pool,
+        server.http_event_base(i), staleness_tracker.get()));
+
+    // Connect the handler, proxy and server together
+    handlers.back()->SetProxy(server.proxy(i));
+    handlers.back()->Add(server.http_server(i), FLAGS_path_prefix);
+  }
 
   if (stand_alone_mode) {
     // Set up a simple single-node mirror environment for testing.
@@ -331,11 +381,16 @@ int main(int argc, char* argv[]) {
 
   CHECK(!FLAGS_target_log_uri.empty());
 
-  ThreadPool pool(16);
+  ThreadPool pool("fetcher", 16);
   SyncTask fetcher_task(&pool);
 
   mutex queue_mutex;
   map<int64_t, ct::SignedTreeHead> queue;
+  if (snapshot_sth) {
+    // Have the STHUpdater check and announce the snapshot STH like any
+    // other from the target log.
+    queue.insert(make_pair(snapshot_sth->tree_size(), *snapshot_sth));
+  }
 
   const function<void(const ct::SignedTreeHead&)> new_sth(
       [&queue_mutex, &queue](const ct::SignedTreeHead& sth) {
@@ -6,6 +6,7 @@
 #include <iostream>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "client/async_log_client.h"
 #include "config.h"
@@ -41,6 +42,8 @@
 #include "util/util.h"
 #include "util/uuid.h"
 
+DECLARE_string(path_prefix);
+
 DEFINE_int32(log_stats_frequency_seconds, 3600,
              "Interval for logging summary statistics. Approximate: the "
              "server will log statistics if in the beginning of its select "
@@ -109,6 +112,7 @@ using std::shared_ptr;
 using std::string;
 using std::thread;
 using std::unique_ptr;
+using std::vector;
 using util::HexString;
 using util::StatusOr;
 using util::SyncTask;
@@ -165,6 +169,14 @@ void STHUpdater(Database* db,
   CHECK_NOTNULL(task);
   CHECK_NOTNULL(log_lookup);
 
+  // log_lookup doesn't yet have the data for the new STHs integrated (that
+  // happens via a callback when the WriteTreeHead() method is called on the
+  // DB), so we'll used a compact tree to pre-validate the STH roots.
+  //
+  // It is kept from one round to the next, so that the entries hashed into
+  // it are not hashed again while the serving tree catches up with it.
+  unique_ptr<CompactMerkleTree> new_tree;
+
   while (true) {
     if (task->CancelRequested()) {
       task->Return(util::Status::CANCELLED);
@@ -173,51 +185,61 @@ void STHUpdater(Database* db,
     const int64_t local_size(db->TreeSize());
     latest_local_tree_size_gauge->Set(local_size);
 
-    // log_lookup doesn't yet have the data for the new STHs integrated (that
-    // happens via a callback when the WriteTreeHead() method is called on the
-    // DB), so we'll used a compact tree to pre-validate the STH roots.
-    //
-    // We'll start with one based on the current state of our serving tree and
-    // update it to the STH sizes we're checking.
-    unique_ptr<CompactMerkleTree> new_tree(
-        log_lookup->GetCompactMerkleTree(new Sha256Hasher));
-
     {
       lock_guard<mutex> lock(*queue_mutex);
-      unique_ptr<Database::Iterator> entries(
-          db->ScanEntries(new_tree->LeafCount()));
+      unique_ptr<Database::LeafHashIterator> leaf_hashes;
+      // Only the newest of the STHs that check out is handed over, the
+      // older ones would be replaced by it right away.
+      unique_ptr<SignedTreeHead> newest_sth;
       while (!queue->empty() &&
              queue->begin()->second.tree_size() <= local_size) {
         const SignedTreeHead next_sth(queue->begin()->second);
         queue->erase(queue->begin());
+        CHECK_LE(next_sth.tree_size(), local_size);
+        CHECK_GE(next_sth.tree_size(), 0);
+        const uint64_t next_sth_tree_size(
+            static_cast<uint64_t>(next_sth.tree_size()));
+        const int64_t serving_tree_size(log_lookup->GetSTH().tree_size());
+
+        // Start from the current state of our serving tree, unless the
+        // compact tree is between it and the candidate STH size.
+        if (!new_tree ||
+            new_tree->LeafCount() <
+                static_cast<uint64_t>(serving_tree_size) ||
+            (next_sth.tree_size() > serving_tree_size &&
+             new_tree->LeafCount() > next_sth_tree_size)) {
+          new_tree = log_lookup->GetCompactMerkleTree(new Sha256Hasher);
+          leaf_hashes.reset();
+        }
 
-        // First, if necessary, catch our local compact tree up to the
-        // candidate STH size:
-        {
-          LoggedEntry entry;
-          CHECK_LE(next_sth.tree_size(), local_size);
-          CHECK_GE(next_sth.tree_size(), 0);
-          const uint64_t next_sth_tree_size(
-              static_cast<uint64_t>(next_sth.tree_size()));
-          while (new_tree->LeafCount() < next_sth_tree_size) {
-            CHECK(entries->GetNextEntry(&entry));
-            CHECK(entry.has_sequence_number());
-            CHECK_GE(entry.sequence_number(), 0);
-            const uint64_t entry_sequence_number(
-                static_cast<uint64_t>(entry.sequence_number()));
-            CHECK_EQ(new_tree->LeafCount(), entry_sequence_number);
-            string serialized_leaf;
-            CHECK(entry.SerializeForLeaf(&serialized_leaf));
-            CHECK_EQ(entry_sequence_number + 1,
-                     new_tree->AddLeaf(serialized_leaf));
+        // Then, if necessary, catch our local compact tree up to the
+        // candidate STH size. The leaf hashes are stored with the entries,
+        // and the large complete subtrees they make up are hashed in
+        // parallel.
+        if (new_tree->LeafCount() < next_sth_tree_size) {
+          if (!leaf_hashes) {
+            leaf_hashes = db->ScanLeafHashes(new_tree->LeafCount());
           }
+          vector<string> hashes;
+          hashes.reserve(next_sth_tree_size - new_tree->LeafCount());
+          int64_t sequence_number;
+          string leaf_hash;
+          while (new_tree->LeafCount() + hashes.size() < next_sth_tree_size) {
+            CHECK(leaf_hashes->GetNextLeafHash(&sequence_number, &leaf_hash));
+            CHECK_GE(sequence_number, 0);
+            CHECK_EQ(new_tree->LeafCount() + hashes.size(),
+                     static_cast<uint64_t>(sequence_number));
+            hashes.emplace_back(std::move(leaf_hash));
+          }
+          CHECK_EQ(next_sth_tree_size,
+                   new_tree->AddLeafHashes(hashes, task->executor()));
         }
 
         // If the candidate STH is historical, use the RootAtSnapshot() from
         // our serving tree, otherwise use the root we just calculated with our
         // compact tree.
         const string local_root_at_snapshot(
-            next_sth.tree_size() > log_lookup->GetSTH().tree_size()
+            next_sth.tree_size() > serving_tree_size
                 ? new_tree->CurrentRoot()
                 : log_lookup->RootAtSnapshot(next_sth.tree_size()));
 
@@ -233,9 +255,14 @@ void STHUpdater(Database* db,
           // separate DB table for later analysis.
           continue;
         }
-        LOG(INFO) << "Can serve new STH of size " << next_sth.tree_size()
+        if (!newest_sth || next_sth.timestamp() > newest_sth->timestamp()) {
+          newest_sth.reset(new SignedTreeHead(next_sth));
+        }
+      }
+      if (newest_sth) {
+        LOG(INFO) << "Can serve new STH of size " << newest_sth->tree_size()
                   << " locally";
-        cluster_state_controller->NewTreeHead(next_sth);
+        cluster_state_controller->NewTreeHead(*newest_sth);
       }
     }
 
@@ -267,7 +294,7 @@ int main(int argc, char* argv[]) {
 
   const bool stand_alone_mode(cert_trans::IsStandalone(false));
   const shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
-  ThreadPool internal_pool(8);
+  ThreadPool internal_pool("internal", 8);
   UrlFetcher url_fetcher(event_base.get(), &internal_pool);
 
   const unique_ptr<EtcdClient> etcd_client(
@@ -282,7 +309,7 @@ int main(int argc, char* argv[]) {
   const LogVerifier log_verifier(new LogSigVerifier(pubkey.ValueOrDie()),
                                  new MerkleVerifier(new Sha256Hasher));
 
-  ThreadPool http_pool(FLAGS_num_http_server_threads);
+  ThreadPool http_pool("http", FLAGS_num_http_server_threads);
 
   Server server(event_base, &internal_pool, &http_pool, db.get(),
                 etcd_client.get(), &url_fetcher, &log_verifier);
@@ -292,15 +319,18 @@ int main(int argc, char* argv[]) {
       new StalenessTracker(server.cluster_state_controller(), &internal_pool,
                            event_base.get()));
 
-  CertificateHttpHandlerV2 handler(server.log_lookup(), db.get(),
-                                   server.cluster_state_controller(),
-                                   nullptr /* checker */,
-                                   nullptr /* Frontend */, &internal_pool,
-                                   event_base.get(), staleness_tracker.get());
-
-  // Connect the handler, proxy and server together
-  handler.SetProxy(server.proxy());
-  handler.Add(server.http_server());
+  // One handler per HTTP event loop, each replying on its own loop.
+  vector<unique_ptr<CertificateHttpHandlerV2>> handlers;
+  for (size_t i = 0; i < server.num_http_event_loops(); ++i) {
+    handlers.emplace_back(new CertificateHttpHandlerV2(
+        server.log_lookup(), db.get(), server.cluster_state_controller(),
+        nullptr /* checker */, nullptr /* Frontend */, &internal_pool,
+        server.http_event_base(i), staleness_tracker.get()));
+
+    // Connect the handler, proxy and server together
+    handlers.back()->SetProxy(server.proxy(i));
+    handlers.back()->Add(server.http_server(i), FLAGS_path_prefix);
+  }
 
   if (stand_alone_mode) {
     // Set up a simple single-node mirror environment for testing.
@@ -329,7 +359,7 @@ int main(int argc, char* argv[]) {
 
   CHECK(!FLAGS_target_log_uri.empty());
 
-  ThreadPool pool(16);
+  ThreadPool pool("fetcher", 16);
   SyncTask fetcher_task(&pool);
 
   mutex queue_mutex;
@@ -5,8 +5,12 @@
 #include <signal.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <chrono>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "config.h"
 #include "log/cert_checker.h"
@@ -15,9 +19,11 @@
 #include "log/etcd_consistent_store.h"
 #include "log/frontend.h"
 #include "log/frontend_signer.h"
+#include "log/journaled_consistent_store.h"
 #include "log/log_lookup.h"
 #include "log/log_signer.h"
 #include "log/log_verifier.h"
+#include "log/pending_journal.h"
 #include "log/strict_consistent_store.h"
 #include "log/tree_signer.h"
 #include "merkletree/merkle_verifier.h"
@@ -30,18 +36,48 @@
 #include "util/etcd.h"
 #include "util/init.h"
 #include "util/libevent_wrapper.h"
+#include "util/numa.h"
 #include "util/read_key.h"
 #include "util/status.h"
 #include "util/uuid.h"
 
+DECLARE_string(path_prefix);
+
 DEFINE_string(key, "", "PEM-encoded server private key file");
+DEFINE_string(key_engine, "",
+              "If set, the OpenSSL engine holding the server private key, "
+              "such as \"pkcs11\" for an HSM, in place of --key");
+DEFINE_string(key_engine_id, "",
+              "The ID of the server private key in --key_engine, such as a "
+              "PKCS#11 URI");
+DEFINE_int32(num_signing_threads, 0,
+             "If set, the number of threads signing the SCTs of new entries, "
+             "each batch of them being split across those threads, and the "
+             "threads handling the submissions moving on meanwhile. Worth "
+             "it when each signature is slow, as with --key_engine.");
 DEFINE_string(trusted_cert_file, "",
               "File for trusted CA certificates, in concatenated PEM format");
+DEFINE_int64(not_after_start, 0,
+             "With --not_after_limit, the start of the range of expiry "
+             "times, in seconds since the epoch, of the certificates that "
+             "this log accepts");
+DEFINE_int64(not_after_limit, 0,
+             "If set, the end (exclusive) of the range of expiry times, in "
+             "seconds since the epoch, of the certificates that this log "
+             "accepts, making it one of the temporal shards of a log. It is "
+             "frozen once they have all expired.");
 DEFINE_double(guard_window_seconds, 60,
               "Unsequenced entries newer than this "
               "number of seconds will not be sequenced.");
 DEFINE_int32(num_http_server_threads, 16,
              "Number of threads for servicing the incoming HTTP requests.");
+DEFINE_string(pending_journal_dir, "",
+              "If set, new entries are added to a journal in this directory, "
+              "and their SCTs returned once it is synced to disk, rather "
+              "than once they are in etcd, where they are only added "
+              "afterwards, in batches.");
+DEFINE_int32(pending_journal_segment_mb, 16,
+             "Size in MiB of the files of --pending_journal_dir.");
 
 namespace libevent = cert_trans::libevent;
 
@@ -53,7 +89,12 @@ using cert_trans::ConsistentStore;
 using cert_trans::Database;
 using cert_trans::EtcdClient;
 using cert_trans::EtcdConsistentStore;
+using cert_trans::IntegrateEntries;
+using cert_trans::JournaledConsistentStore;
 using cert_trans::LoggedEntry;
+using cert_trans::PendingJournal;
+using cert_trans::ReadEnginePrivateKey;
+using cert_trans::ReadOnlyDatabase;
 using cert_trans::ReadPrivateKey;
 using cert_trans::SequenceEntries;
 using cert_trans::Server;
@@ -72,6 +113,7 @@ using std::shared_ptr;
 using std::string;
 using std::thread;
 using std::unique_ptr;
+using std::vector;
 
 
 namespace {
@@ -85,11 +127,35 @@ static bool ValidateRead(const char* flagname, const string& path) {
   return true;
 }
 
-static const bool key_dummy = RegisterFlagValidator(&FLAGS_key, &ValidateRead);
+// With --key_engine, --key is not needed.
+static bool ValidateKey(const char* flagname, const string& path) {
+  return path.empty() || ValidateRead(flagname, path);
+}
+
+static bool ValidateIsNonNegative(const char* flagname, int value) {
+  if (value < 0) {
+    std::cout << flagname << " must not be negative" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+static const bool key_dummy = RegisterFlagValidator(&FLAGS_key, &ValidateKey);
+static const bool signing_threads_dummy =
+    RegisterFlagValidator(&FLAGS_num_signing_threads, &ValidateIsNonNegative);
 
 static const bool cert_dummy =
     RegisterFlagValidator(&FLAGS_trusted_cert_file, &ValidateRead);
 
+
+// Replaces the trusted CA certificates with the current content of
+// --trusted_cert_file, on SIGUSR1.
+void ReloadTrustedCertificates(CertChecker* checker) {
+  LOG_IF(ERROR, !checker->ReloadTrustedCertificates(FLAGS_trusted_cert_file))
+      << "Could not reload CA certs from " << FLAGS_trusted_cert_file
+      << ", keeping the current ones";
+}
+
 }  // namespace
 
 
@@ -104,20 +170,38 @@ int main(int argc, char* argv[]) {
 
   Server::StaticInit();
 
-  util::StatusOr<EVP_PKEY*> pkey(ReadPrivateKey(FLAGS_key));
+  CHECK(FLAGS_key.empty() != FLAGS_key_engine.empty())
+      << "Exactly one of --key and --key_engine is needed";
+  util::StatusOr<EVP_PKEY*> pkey(
+      FLAGS_key_engine.empty()
+          ? ReadPrivateKey(FLAGS_key)
+          : ReadEnginePrivateKey(FLAGS_key_engine, FLAGS_key_engine_id));
   CHECK_EQ(pkey.status(), util::Status::OK);
   LogSigner log_signer(pkey.ValueOrDie());
+  unique_ptr<ThreadPool> signing_pool;
+  if (FLAGS_num_signing_threads > 0) {
+    signing_pool.reset(new ThreadPool("signing", FLAGS_num_signing_threads));
+    log_signer.SetExecutor(signing_pool.get(), FLAGS_num_signing_threads);
+  }
 
   CertChecker checker;
   CHECK(checker.LoadTrustedCertificates(FLAGS_trusted_cert_file))
       << "Could not load CA certs from " << FLAGS_trusted_cert_file;
+  if (FLAGS_not_after_limit > 0) {
+    CHECK_LT(FLAGS_not_after_start, FLAGS_not_after_limit)
+        << "--not_after_start must be before --not_after_limit";
+    checker.SetNotAfterRange(FLAGS_not_after_start, FLAGS_not_after_limit);
+  }
 
   cert_trans::EnsureValidatorsRegistered();
   const unique_ptr<Database> db(cert_trans::ProvideDatabase());
   CHECK(db) << "No database instance created, check flag settings";
+  // The entries served may come from shards of the log instead.
+  const unique_ptr<ReadOnlyDatabase> sharded_db(
+      cert_trans::ProvideShardedDatabase());
 
   shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
-  ThreadPool internal_pool(8);
+  ThreadPool internal_pool("internal", 8);
   UrlFetcher url_fetcher(event_base.get(), &internal_pool);
 
   const bool stand_alone_mode(cert_trans::IsStandalone(true));
@@ -131,30 +215,65 @@ int main(int argc, char* argv[]) {
   const LogVerifier log_verifier(new LogSigVerifier(pkey.ValueOrDie()),
                                  new MerkleVerifier(new Sha256Hasher));
 
-  ThreadPool http_pool(FLAGS_num_http_server_threads);
+  ThreadPool http_pool("http", FLAGS_num_http_server_threads);
+
+  // Rotating the roots only takes a SIGUSR1, rather than a restart. They
+  // are loaded on the pool, so as not to hold up the event loop.
+  evutil_socket_t reload_signal(SIGUSR1);
+  const libevent::Event reload_roots(
+      *event_base, reload_signal, EV_SIGNAL | EV_PERSIST,
+      [&checker, &internal_pool](evutil_socket_t, short) {
+        internal_pool.Add(bind(&ReloadTrustedCertificates, &checker));
+      });
+  reload_roots.Add(std::chrono::seconds::zero());
 
   Server server(event_base, &internal_pool, &http_pool, db.get(),
                 etcd_client.get(), &url_fetcher, &log_verifier);
   server.Initialise(false /* is_mirror */);
 
-  Frontend frontend(
-      new FrontendSigner(db.get(), server.consistent_store(), &log_signer));
+  unique_ptr<JournaledConsistentStore<LoggedEntry>> journaled_store;
+  if (!FLAGS_pending_journal_dir.empty()) {
+    CHECK_GT(FLAGS_pending_journal_segment_mb, 0);
+    journaled_store.reset(new JournaledConsistentStore<LoggedEntry>(
+        new PendingJournal(
+            FLAGS_pending_journal_dir,
+            static_cast<size_t>(FLAGS_pending_journal_segment_mb) << 20),
+        db.get(), &internal_pool, server.consistent_store()));
+  }
+  Frontend frontend(new FrontendSigner(
+      db.get(), journaled_store ? journaled_store.get()
+                                : server.consistent_store(),
+      &log_signer));
   unique_ptr<StalenessTracker> staleness_tracker(
       new StalenessTracker(server.cluster_state_controller(), &internal_pool,
                            event_base.get()));
-  CertificateHttpHandler handler(server.log_lookup(), db.get(),
-                                 server.cluster_state_controller(), &checker,
-                                 &frontend, &internal_pool, event_base.get(),
-                                 staleness_tracker.get());
-
-  // Connect the handler, proxy and server together
-  handler.SetProxy(server.proxy());
-  handler.Add(server.http_server());
+  // One handler per HTTP event loop, each replying on its own loop. With
+  // --numa, each is created on the node of its loop, as are the threads
+  // of its pools, so that its caches are local to it.
+  vector<unique_ptr<CertificateHttpHandler>> handlers;
+  for (size_t i = 0; i < server.num_http_event_loops(); ++i) {
+    const cert_trans::ScopedNumaNode numa_node(server.http_numa_node(i));
+    handlers.emplace_back(new CertificateHttpHandler(
+        server.log_lookup(), sharded_db ? sharded_db.get() : db.get(),
+        server.cluster_state_controller(),
+        &checker, &frontend, server.handler_pool(i),
+        server.http_event_base(i), staleness_tracker.get()));
+
+    // Connect the handler, proxy and server together
+    handlers.back()->SetProxy(server.proxy(i));
+    handlers.back()->Add(server.http_server(i), FLAGS_path_prefix);
+  }
 
+  // Carry on from the tree of the latest tree head signed, if it has the
+  // subtree roots, rather than from the whole tree.
+  unique_ptr<CompactMerkleTree> signer_tree(
+      TreeSigner<LoggedEntry>::TreeOfLatestSTH(db.get(), new Sha256Hasher));
+  if (!signer_tree) {
+    signer_tree = server.log_lookup()->GetCompactMerkleTree(new Sha256Hasher);
+  }
   TreeSigner<LoggedEntry> tree_signer(
       std::chrono::duration<double>(FLAGS_guard_window_seconds), db.get(),
-      server.log_lookup()->GetCompactMerkleTree(new Sha256Hasher),
-      server.consistent_store(), &log_signer);
+      std::move(signer_tree), server.consistent_store(), &log_signer);
 
   if (stand_alone_mode) {
     // Set up a simple single-node environment.
@@ -180,14 +299,6 @@ int main(int argc, char* argv[]) {
     server.election()->StartElection();
     server.election()->WaitToBecomeMaster();
 
-    {
-      EtcdClient::Response resp;
-      util::SyncTask task(event_base.get());
-      etcd_client->Create("/root/sequence_mapping", "", &resp, task.task());
-      task.Wait();
-      CHECK_EQ(util::Status::OK, task.status());
-    }
-
     // Do an initial signing run to get the initial STH, again this is
     // temporary until we re-populate FakeEtcd from the DB.
     CHECK_EQ(tree_signer.UpdateTree(), TreeSigner<LoggedEntry>::OK);
@@ -205,6 +316,7 @@ int main(int argc, char* argv[]) {
   // server error) until we have an STH to serve.
   const function<bool()> is_master(bind(&Server::IsMaster, &server));
   thread sequencer(&SequenceEntries, &tree_signer, is_master);
+  thread integrator(&IntegrateEntries, &tree_signer);
   thread cleanup(&CleanUpEntries, server.consistent_store(), is_master);
   thread signer(&SignMerkleTree, &tree_signer, server.consistent_store(),
                 server.cluster_state_controller());
@@ -5,6 +5,8 @@
 #include <unistd.h>
 #include <iostream>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "config.h"
 #include "log/cert_checker.h"
@@ -32,6 +34,8 @@
 #include "util/status.h"
 #include "util/uuid.h"
 
+DECLARE_string(path_prefix);
+
 DEFINE_string(key, "", "PEM-encoded server private key file");
 DEFINE_string(trusted_cert_file, "",
               "File for trusted CA certificates, in concatenated PEM format");
@@ -55,6 +59,7 @@ using cert_trans::ConsistentStore;
 using cert_trans::Database;
 using cert_trans::EtcdClient;
 using cert_trans::EtcdConsistentStore;
+using cert_trans::IntegrateEntries;
 using cert_trans::LoggedEntry;
 using cert_trans::ReadPrivateKey;
 using cert_trans::SequenceEntries;
@@ -74,6 +79,7 @@ using std::shared_ptr;
 using std::string;
 using std::thread;
 using std::unique_ptr;
+using std::vector;
 
 
 namespace {
@@ -124,7 +130,7 @@ int main(int argc, char* argv[]) {
   CHECK(db) << "No database instance created, check flag settings";
 
   shared_ptr<libevent::Base> event_base(make_shared<libevent::Base>());
-  ThreadPool internal_pool(8);
+  ThreadPool internal_pool("internal", 8);
   UrlFetcher url_fetcher(event_base.get(), &internal_pool);
 
   const bool stand_alone_mode(cert_trans::IsStandalone(true));
@@ -138,7 +144,7 @@ int main(int argc, char* argv[]) {
   const LogVerifier log_verifier(new LogSigVerifier(pkey.ValueOrDie()),
                                  new MerkleVerifier(new Sha256Hasher));
 
-  ThreadPool http_pool(FLAGS_num_http_server_threads);
+  ThreadPool http_pool("http", FLAGS_num_http_server_threads);
 
   Server server(event_base, &internal_pool, &http_pool, db.get(),
                 etcd_client.get(), &url_fetcher, &log_verifier);
@@ -149,19 +155,29 @@ int main(int argc, char* argv[]) {
   unique_ptr<StalenessTracker> staleness_tracker(
       new StalenessTracker(server.cluster_state_controller(), &internal_pool,
                            event_base.get()));
-  CertificateHttpHandlerV2 handler(server.log_lookup(), db.get(),
-                                   server.cluster_state_controller(), &checker,
-                                   &frontend, &internal_pool, event_base.get(),
-                                   staleness_tracker.get());
-
-  // Connect the handler, proxy and server together
-  handler.SetProxy(server.proxy());
-  handler.Add(server.http_server());
+  // One handler per HTTP event loop, each replying on its own loop.
+  vector<unique_ptr<CertificateHttpHandlerV2>> handlers;
+  for (size_t i = 0; i < server.num_http_event_loops(); ++i) {
+    handlers.emplace_back(new CertificateHttpHandlerV2(
+        server.log_lookup(), db.get(), server.cluster_state_controller(),
+        &checker, &frontend, &internal_pool, server.http_event_base(i),
+        staleness_tracker.get()));
+
+    // Connect the handler, proxy and server together
+    handlers.back()->SetProxy(server.proxy(i));
+    handlers.back()->Add(server.http_server(i), FLAGS_path_prefix);
+  }
 
+  // Carry on from the tree of the latest tree head signed, if it has the
+  // subtree roots, rather than from the whole tree.
+  unique_ptr<CompactMerkleTree> signer_tree(
+      TreeSigner<LoggedEntry>::TreeOfLatestSTH(db.get(), new Sha256Hasher));
+  if (!signer_tree) {
+    signer_tree = server.log_lookup()->GetCompactMerkleTree(new Sha256Hasher);
+  }
   TreeSigner<LoggedEntry> tree_signer(
       std::chrono::duration<double>(FLAGS_guard_window_seconds), db.get(),
-      server.log_lookup()->GetCompactMerkleTree(new Sha256Hasher),
-      server.consistent_store(), &log_signer);
+      std::move(signer_tree), server.consistent_store(), &log_signer);
 
   if (stand_alone_mode) {
     // Set up a simple single-node environment.
@@ -187,14 +203,6 @@ int main(int argc, char* argv[]) {
     server.election()->StartElection();
     server.election()->WaitToBecomeMaster();
 
-    {
-      EtcdClient::Response resp;
-      util::SyncTask task(event_base.get());
-      etcd_client->Create("/root/sequence_mapping", "", &resp, task.task());
-      task.Wait();
-      CHECK_EQ(util::Status::OK, task.status());
-    }
-
     // Do an initial signing run to get the initial STH, again this is
     // temporary until we re-populate FakeEtcd from the DB.
     CHECK_EQ(tree_signer.UpdateTree(), TreeSigner<LoggedEntry>::OK);
@@ -212,6 +220,7 @@ int main(int argc, char* argv[]) {
   // server error) until we have an STH to serve.
   const function<bool()> is_master(bind(&Server::IsMaster, &server));
   thread sequencer(&SequenceEntries, &tree_signer, is_master);
+  thread integrator(&IntegrateEntries, &tree_signer);
   thread cleanup(&CleanUpEntries, server.consistent_store(), is_master);
   thread signer(&SignMerkleTree, &tree_signer, server.consistent_store(),
                 server.cluster_state_controller());
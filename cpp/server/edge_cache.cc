@@ -0,0 +1,663 @@
+#include "server/edge_cache.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <openssl/sha.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+#include <tuple>
+
+#include "base/notification.h"
+#include "client/async_log_client.h"
+#include "log/log_verifier.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "monitoring/monitoring.h"
+#include "util/util.h"
+
+DEFINE_int32(edge_entries_window, 256,
+             "Number of entries of the windows in which the edge cache "
+             "fetches, checks and keeps the entries of the log. Must be a "
+             "power of two.");
+DEFINE_int32(edge_sth_history, 64,
+             "Number of the last tree heads of the log kept by the edge "
+             "cache, at the tree sizes of which it serves proofs.");
+
+using ct::MerkleAuditProof;
+using ct::ShortMerkleAuditProof;
+using ct::SignedTreeHead;
+using std::function;
+using std::lock_guard;
+using std::make_pair;
+using std::min;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::vector;
+using util::Status;
+using util::StatusOr;
+
+namespace cert_trans {
+namespace {
+
+
+static Counter<string, string>* const lookups(Counter<string, string>::New(
+    "edge_cache_lookups", "kind", "result",
+    "Lookups in the edge cache, by kind (entries, proof or consistency) "
+    "and result (hit or miss)."));
+
+static Counter<string>* const verification_failures(Counter<string>::New(
+    "edge_cache_verification_failures", "kind",
+    "Responses of the log which did not check out against its tree heads, "
+    "by kind (sth, entries, proof or consistency)."));
+
+
+const char kTmpSuffix[] = ".tmp";
+
+
+bool ValidateWindow(const char* flagname, int32_t value) {
+  if (value <= 0 || (value & (value - 1)) != 0) {
+    LOG(ERROR) << "--" << flagname << " must be a power of two";
+    return false;
+  }
+  return true;
+}
+
+static const bool window_dummy =
+    google::RegisterFlagValidator(&FLAGS_edge_entries_window,
+                                  &ValidateWindow);
+
+
+// Calls |call| with a callback, and waits for it to be called.
+Status Wait(const function<void(const AsyncLogClient::Callback&)>& call) {
+  Notification done;
+  AsyncLogClient::Status result(AsyncLogClient::UNKNOWN_ERROR);
+  call([&done, &result](AsyncLogClient::Status status) {
+    result = status;
+    done.Notify();
+  });
+  done.WaitForNotification();
+  if (result != AsyncLogClient::OK) {
+    return Status(util::error::UNAVAILABLE, "The log request failed.");
+  }
+  return Status::OK;
+}
+
+
+bool WriteFile(const string& path, const string& data) {
+  const int fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600));
+  if (fd < 0) {
+    PLOG(WARNING) << "open " << path;
+    return false;
+  }
+  for (size_t pos(0); pos < data.size();) {
+    const ssize_t written(write(fd, data.data() + pos, data.size() - pos));
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      PLOG(WARNING) << "write " << path;
+      close(fd);
+      return false;
+    }
+    pos += written;
+  }
+  if (close(fd) != 0) {
+    PLOG(WARNING) << "close " << path;
+    return false;
+  }
+  return true;
+}
+
+
+// Values are framed by their length, as a 32-bit big-endian integer.
+void AppendFrame(const string& data, string* out) {
+  const uint32_t size(data.size());
+  for (int shift(24); shift >= 0; shift -= 8) {
+    out->push_back(static_cast<char>((size >> shift) & 0xff));
+  }
+  out->append(data);
+}
+
+
+bool ReadFrames(const string& in, vector<string>* frames) {
+  frames->clear();
+  for (size_t pos(0); pos < in.size();) {
+    if (in.size() - pos < 4) {
+      return false;
+    }
+    uint32_t size(0);
+    for (int i(0); i < 4; ++i) {
+      size = (size << 8) | static_cast<unsigned char>(in[pos++]);
+    }
+    if (in.size() - pos < size) {
+      return false;
+    }
+    frames->emplace_back(in, pos, size);
+    pos += size;
+  }
+  return true;
+}
+
+
+string WindowKey(int64_t start) {
+  return "entries-" + to_string(start);
+}
+
+
+string ProofKey(int64_t tree_size, const string& leaf_hash) {
+  return "proof-" + to_string(tree_size) + "-" + util::HexString(leaf_hash);
+}
+
+
+string ConsistencyKey(int64_t first, int64_t second) {
+  return "consistency-" + to_string(first) + "-" + to_string(second);
+}
+
+
+}  // namespace
+
+
+DiskLruCache::DiskLruCache(const string& dir, int64_t max_bytes)
+    : dir_(dir), max_bytes_(max_bytes), size_bytes_(0), next_tmp_id_(0) {
+  CHECK_GE(max_bytes_, 0);
+  DIR* const d(opendir(dir_.c_str()));
+  PCHECK(d != nullptr) << "opendir " << dir_;
+  // By modification time, name and size.
+  vector<std::tuple<time_t, string, int64_t>> files;
+  while (const struct dirent* const entry = readdir(d)) {
+    const string name(entry->d_name);
+    if (name == "." || name == "..") {
+      continue;
+    }
+    const string path(PathOf(name));
+    if (name.size() > strlen(kTmpSuffix) &&
+        name.compare(name.size() - strlen(kTmpSuffix), string::npos,
+                     kTmpSuffix) == 0) {
+      // Left over by an interrupted Put().
+      unlink(path.c_str());
+      continue;
+    }
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      files.emplace_back(st.st_mtime, name, st.st_size);
+    }
+  }
+  PCHECK(closedir(d) == 0) << "closedir " << dir_;
+
+  std::sort(files.begin(), files.end());
+  lock_guard<mutex> lock(lock_);
+  for (const auto& file : files) {
+    InsertLocked(std::get<1>(file), std::get<2>(file));
+  }
+  EvictLocked();
+  LOG(INFO) << "Disk cache in " << dir_ << " has " << items_.size()
+            << " files, " << size_bytes_ << " bytes";
+}
+
+
+bool DiskLruCache::Get(const string& key, string* value) {
+  {
+    lock_guard<mutex> lock(lock_);
+    const auto it(items_.find(key));
+    if (it == items_.end()) {
+      return false;
+    }
+    lru_.splice(lru_.begin(), lru_, it->second.lru_pos);
+  }
+
+  // Files are only ever replaced by renaming another over them, so they
+  // can be read without the lock. Each ends with the SHA-256 of the
+  // value, against files torn by a crash, as they are not synced.
+  string contents;
+  const size_t digest_size(SHA256_DIGEST_LENGTH);
+  if (util::ReadBinaryFile(PathOf(key), &contents) &&
+      contents.size() >= digest_size) {
+    value->assign(contents, 0, contents.size() - digest_size);
+    if (Sha256Hasher::Sha256Digest(*value) ==
+        contents.substr(contents.size() - digest_size)) {
+      return true;
+    }
+  }
+  LOG(WARNING) << "Dropping unreadable " << PathOf(key);
+  lock_guard<mutex> lock(lock_);
+  EraseLocked(key);
+  return false;
+}
+
+
+void DiskLruCache::Put(const string& key, const string& value) {
+  const string contents(value + Sha256Hasher::Sha256Digest(value));
+  if (static_cast<int64_t>(contents.size()) > max_bytes_) {
+    return;
+  }
+  const string path(PathOf(key));
+  string tmp_path;
+  {
+    lock_guard<mutex> lock(lock_);
+    tmp_path = path + "." + to_string(next_tmp_id_++) + kTmpSuffix;
+  }
+  if (!WriteFile(tmp_path, contents)) {
+    unlink(tmp_path.c_str());
+    return;
+  }
+
+  lock_guard<mutex> lock(lock_);
+  if (rename(tmp_path.c_str(), path.c_str()) != 0) {
+    PLOG(WARNING) << "rename " << tmp_path;
+    unlink(tmp_path.c_str());
+    return;
+  }
+  const auto it(items_.find(key));
+  if (it != items_.end()) {
+    size_bytes_ -= it->second.size;
+    lru_.erase(it->second.lru_pos);
+    items_.erase(it);
+  }
+  InsertLocked(key, contents.size());
+  EvictLocked();
+}
+
+
+void DiskLruCache::Erase(const string& key) {
+  lock_guard<mutex> lock(lock_);
+  EraseLocked(key);
+}
+
+
+int64_t DiskLruCache::SizeBytes() const {
+  lock_guard<mutex> lock(lock_);
+  return size_bytes_;
+}
+
+
+string DiskLruCache::PathOf(const string& key) const {
+  return dir_ + "/" + key;
+}
+
+
+void DiskLruCache::InsertLocked(const string& key, int64_t size) {
+  lru_.push_front(key);
+  items_[key] = Item{size, lru_.begin()};
+  size_bytes_ += size;
+}
+
+
+void DiskLruCache::EraseLocked(const string& key) {
+  const auto it(items_.find(key));
+  if (it == items_.end()) {
+    return;
+  }
+  if (unlink(PathOf(key).c_str()) != 0 && errno != ENOENT) {
+    PLOG(WARNING) << "unlink " << PathOf(key);
+  }
+  size_bytes_ -= it->second.size;
+  lru_.erase(it->second.lru_pos);
+  items_.erase(it);
+}
+
+
+void DiskLruCache::EvictLocked() {
+  while (size_bytes_ > max_bytes_ && !lru_.empty()) {
+    const string key(lru_.back());
+    EraseLocked(key);
+  }
+}
+
+
+EdgeCache::EdgeCache(AsyncLogClient* client, const LogVerifier* verifier,
+                     DiskLruCache* disk_cache)
+    : client_(CHECK_NOTNULL(client)),
+      verifier_(CHECK_NOTNULL(verifier)),
+      disk_cache_(CHECK_NOTNULL(disk_cache)),
+      merkle_verifier_(new Sha256Hasher) {
+  CHECK_GT(FLAGS_edge_sth_history, 0);
+}
+
+
+Status EdgeCache::UpdateSTH() {
+  SignedTreeHead sth;
+  Status status(Wait([this, &sth](const AsyncLogClient::Callback& done) {
+    client_->GetSTH(&sth, done);
+  }));
+  if (!status.ok()) {
+    return status;
+  }
+  if (verifier_->VerifySignedTreeHead(sth) != LogVerifier::VERIFY_OK) {
+    verification_failures->Increment("sth");
+    return Status(util::error::DATA_LOSS, "Invalid tree head signature.");
+  }
+
+  const StatusOr<SignedTreeHead> current(CurrentSTH());
+  if (current.ok()) {
+    if (sth.timestamp() <= current.ValueOrDie().timestamp()) {
+      return Status::OK;
+    }
+    vector<string> proof;
+    status = FetchConsistency(current.ValueOrDie(), sth, &proof);
+    if (!status.ok()) {
+      return status;
+    }
+  }
+
+  VLOG(1) << "New tree head of size " << sth.tree_size();
+  lock_guard<mutex> lock(lock_);
+  if (!sths_.empty() &&
+      sths_.rbegin()->second.timestamp() >= sth.timestamp()) {
+    // Another call got a newer one meanwhile.
+    return Status::OK;
+  }
+  sths_[sth.tree_size()] = sth;
+  while (sths_.size() > static_cast<size_t>(FLAGS_edge_sth_history)) {
+    sths_.erase(sths_.begin());
+  }
+  return Status::OK;
+}
+
+
+StatusOr<SignedTreeHead> EdgeCache::CurrentSTH() const {
+  lock_guard<mutex> lock(lock_);
+  if (sths_.empty()) {
+    return Status(util::error::UNAVAILABLE, "No tree head yet.");
+  }
+  return sths_.rbegin()->second;
+}
+
+
+Status EdgeCache::GetEntries(int64_t first, int64_t last,
+                             vector<LoggedEntry>* entries) {
+  entries->clear();
+  if (first < 0 || last < first) {
+    return Status(util::error::INVALID_ARGUMENT, "Invalid range.");
+  }
+  const StatusOr<SignedTreeHead> sth(CurrentSTH());
+  if (!sth.ok()) {
+    return sth.status();
+  }
+  const int64_t tree_size(sth.ValueOrDie().tree_size());
+  if (first >= tree_size) {
+    return Status(util::error::OUT_OF_RANGE, "Entries beyond the tree.");
+  }
+
+  const int64_t start(first - first % FLAGS_edge_entries_window);
+  last = min(last, min(start + FLAGS_edge_entries_window, tree_size) - 1);
+  const WindowOrStatus window(
+      GetWindow(start, last - start + 1, sth.ValueOrDie()));
+  if (!window.ok()) {
+    return window.status();
+  }
+  const Window& window_entries(*window.ValueOrDie());
+  entries->assign(window_entries.begin() + (first - start),
+                  window_entries.begin() + (last - start + 1));
+  return Status::OK;
+}
+
+
+Status EdgeCache::GetProof(const string& leaf_hash, int64_t tree_size,
+                           ShortMerkleAuditProof* proof) {
+  const StatusOr<SignedTreeHead> sth(STHAt(tree_size));
+  if (!sth.ok()) {
+    return sth.status();
+  }
+  return ProofAt(sth.ValueOrDie(), leaf_hash, proof);
+}
+
+
+Status EdgeCache::GetConsistency(int64_t first, int64_t second,
+                                 vector<string>* proof) {
+  proof->clear();
+  if (first < 0 || second < first) {
+    return Status(util::error::INVALID_ARGUMENT, "Invalid tree sizes.");
+  }
+  const StatusOr<SignedTreeHead> sth2(STHAt(second));
+  if (!sth2.ok()) {
+    return sth2.status();
+  }
+  if (first == 0) {
+    return Status::OK;
+  }
+  const StatusOr<SignedTreeHead> sth1(STHAt(first));
+  if (!sth1.ok()) {
+    return sth1.status();
+  }
+  return FetchConsistency(sth1.ValueOrDie(), sth2.ValueOrDie(), proof);
+}
+
+
+StatusOr<SignedTreeHead> EdgeCache::STHAt(int64_t tree_size) const {
+  lock_guard<mutex> lock(lock_);
+  const auto it(sths_.find(tree_size));
+  if (it == sths_.end()) {
+    return Status(util::error::FAILED_PRECONDITION,
+                  "No recent tree head of that size.");
+  }
+  return it->second;
+}
+
+
+EdgeCache::WindowOrStatus EdgeCache::GetWindow(int64_t start,
+                                               size_t min_size,
+                                               const SignedTreeHead& sth) {
+  const shared_ptr<const Window> cached(ReadCachedWindow(start));
+  if (cached && cached->size() >= min_size) {
+    lookups->Increment("entries", "hit");
+    return cached;
+  }
+  lookups->Increment("entries", "miss");
+
+  const int64_t end(min(start + FLAGS_edge_entries_window,
+                        static_cast<int64_t>(sth.tree_size())));
+  WindowOrStatus result;
+  Notification done;
+  window_fetches_.Do(make_pair(start, end),
+                     [this, start, &cached, &sth]() {
+                       return FetchWindow(start, cached, sth);
+                     },
+                     [&result, &done](const WindowOrStatus& window) {
+                       result = window;
+                       done.Notify();
+                     });
+  done.WaitForNotification();
+  return result;
+}
+
+
+EdgeCache::WindowOrStatus EdgeCache::FetchWindow(
+    int64_t start, const shared_ptr<const Window>& cached,
+    const SignedTreeHead& sth) {
+  const int64_t end(min(start + FLAGS_edge_entries_window,
+                        static_cast<int64_t>(sth.tree_size())));
+  const shared_ptr<Window> window(cached ? new Window(*cached)
+                                         : new Window);
+  // The log can send fewer entries than asked for.
+  while (start + static_cast<int64_t>(window->size()) < end) {
+    const int64_t next(start + window->size());
+    vector<AsyncLogClient::Entry> fetched;
+    const Status status(
+        Wait([this, next, end, &fetched](
+            const AsyncLogClient::Callback& done) {
+          client_->GetEntries(next, end - 1, &fetched, done);
+        }));
+    if (!status.ok()) {
+      return status;
+    }
+    if (fetched.empty()) {
+      return Status(util::error::UNAVAILABLE, "The log sent no entries.");
+    }
+    for (const AsyncLogClient::Entry& entry : fetched) {
+      if (start + static_cast<int64_t>(window->size()) == end) {
+        break;
+      }
+      window->emplace_back();
+      if (!window->back().CopyFromClientLogEntry(entry)) {
+        return Status(util::error::DATA_LOSS, "Unsupported entry.");
+      }
+    }
+  }
+
+  const Status status(VerifyWindow(start, *window, sth));
+  if (!status.ok()) {
+    return status;
+  }
+  string contents;
+  for (const LoggedEntry& entry : *window) {
+    string serialized;
+    CHECK(entry.SerializeForDatabase(&serialized));
+    AppendFrame(serialized, &contents);
+  }
+  disk_cache_->Put(WindowKey(start), contents);
+  return shared_ptr<const Window>(window);
+}
+
+
+Status EdgeCache::VerifyWindow(int64_t start, const Window& window,
+                               const SignedTreeHead& sth) {
+  CHECK(!window.empty());
+  MerkleTree tree(new Sha256Hasher);
+  for (const LoggedEntry& entry : window) {
+    string leaf;
+    if (!entry.SerializeForLeaf(&leaf)) {
+      return Status(util::error::DATA_LOSS, "Invalid entry.");
+    }
+    tree.AddLeaf(leaf);
+  }
+
+  // The window is a subtree of the tree of |sth|, so the audit path of
+  // its first entry starts with that in the tree of the window.
+  ShortMerkleAuditProof proof;
+  const Status status(ProofAt(sth, tree.LeafHash(1), &proof));
+  if (!status.ok()) {
+    return status;
+  }
+  const vector<string> window_path(tree.PathToCurrentRoot(1));
+  if (proof.leaf_index() != start ||
+      static_cast<size_t>(proof.path_node_size()) < window_path.size() ||
+      !std::equal(window_path.begin(), window_path.end(),
+                  proof.path_node().begin())) {
+    verification_failures->Increment("entries");
+    return Status(util::error::DATA_LOSS,
+                  "Entries not in the tree of the tree head.");
+  }
+  return Status::OK;
+}
+
+
+shared_ptr<const EdgeCache::Window> EdgeCache::ReadCachedWindow(
+    int64_t start) {
+  string contents;
+  vector<string> frames;
+  if (!disk_cache_->Get(WindowKey(start), &contents) ||
+      !ReadFrames(contents, &frames)) {
+    return nullptr;
+  }
+  const shared_ptr<Window> window(new Window(frames.size()));
+  for (size_t i(0); i < frames.size(); ++i) {
+    if (!(*window)[i].ParseFromDatabase(frames[i])) {
+      LOG(WARNING) << "Invalid cached window at " << start;
+      disk_cache_->Erase(WindowKey(start));
+      return nullptr;
+    }
+  }
+  return window;
+}
+
+
+Status EdgeCache::ProofAt(const SignedTreeHead& sth, const string& leaf_hash,
+                          ShortMerkleAuditProof* proof) {
+  const string key(ProofKey(sth.tree_size(), leaf_hash));
+  string cached;
+  // Checking the path again is cheap.
+  if (disk_cache_->Get(key, &cached) && proof->ParseFromString(cached) &&
+      VerifyProof(sth, leaf_hash, *proof)) {
+    lookups->Increment("proof", "hit");
+    return Status::OK;
+  }
+  lookups->Increment("proof", "miss");
+
+  MerkleAuditProof audit_proof;
+  const Status status(Wait([this, &sth, &leaf_hash, &audit_proof](
+      const AsyncLogClient::Callback& done) {
+    client_->QueryInclusionProof(sth, leaf_hash, &audit_proof, done);
+  }));
+  if (!status.ok()) {
+    return status;
+  }
+  proof->Clear();
+  proof->set_leaf_index(audit_proof.leaf_index());
+  proof->mutable_path_node()->CopyFrom(audit_proof.path_node());
+  if (!VerifyProof(sth, leaf_hash, *proof)) {
+    verification_failures->Increment("proof");
+    return Status(util::error::DATA_LOSS, "Invalid audit proof.");
+  }
+  disk_cache_->Put(key, proof->SerializeAsString());
+  return Status::OK;
+}
+
+
+bool EdgeCache::VerifyProof(const SignedTreeHead& sth,
+                            const string& leaf_hash,
+                            const ShortMerkleAuditProof& proof) {
+  if (proof.leaf_index() < 0) {
+    return false;
+  }
+  const vector<MerkleVerifier::AuditPath> paths{MerkleVerifier::AuditPath{
+      static_cast<size_t>(proof.leaf_index()) + 1, leaf_hash,
+      vector<string>(proof.path_node().begin(), proof.path_node().end())}};
+  vector<bool> valid;
+  return merkle_verifier_.VerifyPaths(sth.tree_size(), sth.sha256_root_hash(),
+                                      paths, &valid) == 1;
+}
+
+
+Status EdgeCache::FetchConsistency(const SignedTreeHead& sth1,
+                                   const SignedTreeHead& sth2,
+                                   vector<string>* proof) {
+  proof->clear();
+  const int64_t first(sth1.tree_size());
+  const int64_t second(sth2.tree_size());
+  // Otherwise, the proof is empty.
+  const bool needs_proof(first > 0 && first < second);
+  const string key(ConsistencyKey(first, second));
+  string cached;
+  if (needs_proof && disk_cache_->Get(key, &cached) &&
+      ReadFrames(cached, proof) &&
+      verifier_->VerifyConsistency(sth1, sth2, *proof)) {
+    lookups->Increment("consistency", "hit");
+    return Status::OK;
+  }
+
+  if (needs_proof) {
+    lookups->Increment("consistency", "miss");
+    proof->clear();
+    const Status status(Wait([this, first, second, proof](
+        const AsyncLogClient::Callback& done) {
+      client_->GetSTHConsistency(first, second, proof, done);
+    }));
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  if (!verifier_->VerifyConsistency(sth1, sth2, *proof)) {
+    verification_failures->Increment("consistency");
+    return Status(util::error::DATA_LOSS, "Inconsistent tree heads.");
+  }
+  if (needs_proof) {
+    string contents;
+    for (const string& node : *proof) {
+      AppendFrame(node, &contents);
+    }
+    disk_cache_->Put(key, contents);
+  }
+  return Status::OK;
+}
+
+
+}  // namespace cert_trans
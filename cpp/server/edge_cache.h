@@ -0,0 +1,187 @@
+#ifndef CERT_TRANS_SERVER_EDGE_CACHE_H_
+#define CERT_TRANS_SERVER_EDGE_CACHE_H_
+
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+#include "log/logged_entry.h"
+#include "merkletree/merkle_verifier.h"
+#include "proto/ct.pb.h"
+#include "util/single_flight.h"
+#include "util/status.h"
+#include "util/statusor.h"
+
+class LogVerifier;
+
+namespace cert_trans {
+
+class AsyncLogClient;
+
+
+// A cache of values in the files of a directory, which holds at most a
+// given number of bytes of them, dropping the least recently used files
+// first. The files already in the directory when it is created are kept,
+// the most recently modified ones being taken as the most recently used.
+//
+// This class is thread-safe.
+class DiskLruCache {
+ public:
+  // |dir| must exist.
+  DiskLruCache(const std::string& dir, int64_t max_bytes);
+
+  // Sets |value| to that of |key|, and returns whether it was found.
+  bool Get(const std::string& key, std::string* value);
+
+  // Sets the value of |key|, which must be usable as a file name. Values
+  // that could not be written are dropped with a warning, as are those
+  // bigger than the cache.
+  void Put(const std::string& key, const std::string& value);
+
+  void Erase(const std::string& key);
+
+  // The total size of the values in the cache.
+  int64_t SizeBytes() const;
+
+ private:
+  struct Item {
+    int64_t size;
+    std::list<std::string>::iterator lru_pos;
+  };
+
+  std::string PathOf(const std::string& key) const;
+  // Adds |key| as the most recently used file, of |size| bytes.
+  void InsertLocked(const std::string& key, int64_t size);
+  void EraseLocked(const std::string& key);
+  void EvictLocked();
+
+  const std::string dir_;
+  const int64_t max_bytes_;
+
+  mutable std::mutex lock_;
+  // The keys, the most recently used first.
+  std::list<std::string> lru_;
+  std::unordered_map<std::string, Item> items_;
+  int64_t size_bytes_;
+  // For unique names of the files being written.
+  uint64_t next_tmp_id_;
+
+  DISALLOW_COPY_AND_ASSIGN(DiskLruCache);
+};
+
+
+// A read-through cache of a remote log, for serving it close to its
+// clients without holding all of it (see ct-edge). All that it serves of
+// the remote log is checked against its signed tree heads:
+//
+//  - a new tree head must be signed by the log, and consistent with the
+//    previous one;
+//  - the entries are fetched by windows of --edge_entries_window entries,
+//    aligned on its size, which are subtrees of the log: the audit path
+//    of the first entry of a window must lead to the root of the tree
+//    head, and match the subtrees of the other entries of the window
+//    along the way, which proves all of them;
+//  - audit and consistency proofs must lead to the roots of their tree
+//    heads. They are therefore only served for the tree sizes of the last
+//    --edge_sth_history tree heads, those that the clients of the cache
+//    are likely to have.
+//
+// The extra data of the entries (their chains) is not covered by the
+// tree, and is served as the log sent it.
+//
+// What was checked is kept on disk in a DiskLruCache, since it never
+// changes: the windows, which are only fetched again to extend them as
+// the tree grows past their end, and the proofs at their tree sizes.
+//
+// The methods block on the remote log, they must not be called on the
+// executor of the AsyncLogClient. Errors from the remote log are
+// UNAVAILABLE, and responses which do not verify DATA_LOSS.
+//
+// This class is thread-safe.
+class EdgeCache {
+ public:
+  // Does not take ownership of |client|, |verifier| and |disk_cache|,
+  // which must outlive this instance.
+  EdgeCache(AsyncLogClient* client, const LogVerifier* verifier,
+            DiskLruCache* disk_cache);
+
+  // Fetches the tree head of the remote log, and makes it current if it
+  // is newer than the current one, and checks out.
+  util::Status UpdateSTH();
+
+  // The latest tree head, or UNAVAILABLE if there is none yet.
+  util::StatusOr<ct::SignedTreeHead> CurrentSTH() const;
+
+  // Sets |entries| to the entries of the current tree from |first| to
+  // |last| inclusive, stopping at the end of its window or of the tree.
+  util::Status GetEntries(int64_t first, int64_t last,
+                          std::vector<LoggedEntry>* entries);
+
+  // Sets |proof| to the audit proof of the leaf of |leaf_hash| in the
+  // tree of |tree_size|.
+  util::Status GetProof(const std::string& leaf_hash, int64_t tree_size,
+                        ct::ShortMerkleAuditProof* proof);
+
+  // Sets |proof| to the consistency proof between the trees of |first|
+  // and |second|.
+  util::Status GetConsistency(int64_t first, int64_t second,
+                              std::vector<std::string>* proof);
+
+ private:
+  typedef std::vector<LoggedEntry> Window;
+  typedef util::StatusOr<std::shared_ptr<const Window>> WindowOrStatus;
+
+  // The tree head of |tree_size| in |sths_|.
+  util::StatusOr<ct::SignedTreeHead> STHAt(int64_t tree_size) const;
+  // Returns the window at |start| (which must be aligned) with at least
+  // |min_size| entries, from the disk cache or else the remote log, in
+  // the tree of |sth|. Identical fetches in progress are coalesced.
+  WindowOrStatus GetWindow(int64_t start, size_t min_size,
+                           const ct::SignedTreeHead& sth);
+  // Fetches the rest of |*cached| up to the end of its window in the
+  // tree of |sth|, checks it, and caches it.
+  WindowOrStatus FetchWindow(int64_t start,
+                             const std::shared_ptr<const Window>& cached,
+                             const ct::SignedTreeHead& sth);
+  // Checks the entries of |window| as a subtree of the tree of |sth|.
+  util::Status VerifyWindow(int64_t start, const Window& window,
+                            const ct::SignedTreeHead& sth);
+  std::shared_ptr<const Window> ReadCachedWindow(int64_t start);
+  // Sets |proof| to the checked audit proof of |leaf_hash| in the tree of
+  // |sth|, from the disk cache or else the remote log.
+  util::Status ProofAt(const ct::SignedTreeHead& sth,
+                       const std::string& leaf_hash,
+                       ct::ShortMerkleAuditProof* proof);
+  bool VerifyProof(const ct::SignedTreeHead& sth, const std::string& leaf_hash,
+                   const ct::ShortMerkleAuditProof& proof);
+  // Sets |proof| to the checked consistency proof between |sth1| and
+  // |sth2|, from the disk cache or else the remote log.
+  util::Status FetchConsistency(const ct::SignedTreeHead& sth1,
+                                const ct::SignedTreeHead& sth2,
+                                std::vector<std::string>* proof);
+
+  AsyncLogClient* const client_;
+  const LogVerifier* const verifier_;
+  DiskLruCache* const disk_cache_;
+  MerkleVerifier merkle_verifier_;
+  // By start and end of the windows.
+  SingleFlight<std::pair<int64_t, int64_t>, WindowOrStatus> window_fetches_;
+
+  mutable std::mutex lock_;
+  // The last tree heads, by tree size, the current one last.
+  std::map<int64_t, ct::SignedTreeHead> sths_;
+
+  DISALLOW_COPY_AND_ASSIGN(EdgeCache);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_EDGE_CACHE_H_
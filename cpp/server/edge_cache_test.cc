@@ -0,0 +1,460 @@
+#include "server/edge_cache.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "client/async_log_client.h"
+#include "log/log_verifier.h"
+#include "log/logged_entry.h"
+#include "log/test_signer.h"
+#include "merkletree/merkle_tree.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
+#include "net/url_fetcher.h"
+#include "proto/cert_serializer.h"
+#include "proto/serializer.h"
+#include "util/json_writer.h"
+#include "util/status_test_util.h"
+#include "util/test_db.h"
+#include "util/testing.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+DECLARE_int32(edge_entries_window);
+
+namespace cert_trans {
+namespace {
+
+using ct::ShortMerkleAuditProof;
+using ct::SignedTreeHead;
+using std::map;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+
+const char kLogUrl[] = "https://example.com";
+const int kWindow = 8;
+// Smaller than the windows, so that they take several requests.
+const int kMaxEntriesPerResponse = 3;
+
+
+// Decodes the %XX escapes of |value|.
+string UriDecode(const string& value) {
+  string decoded;
+  for (size_t i = 0; i < value.size(); ++i) {
+    if (value[i] == '%' && i + 2 < value.size()) {
+      decoded.push_back(
+          static_cast<char>(std::stoi(value.substr(i + 1, 2), nullptr, 16)));
+      i += 2;
+    } else {
+      decoded.push_back(value[i]);
+    }
+  }
+  return decoded;
+}
+
+
+// The |name| parameter of |query|, or "" if it has none.
+string QueryParam(const string& query, const string& name) {
+  for (const string& param : util::split(query, '&')) {
+    const size_t equal(param.find('='));
+    if (equal != string::npos && param.substr(0, equal) == name) {
+      return UriDecode(param.substr(equal + 1));
+    }
+  }
+  return "";
+}
+
+
+// A log served through UrlFetcher, which answers the requests of
+// AsyncLogClient right away from a MerkleTree, and counts them.
+class FakeLog : public UrlFetcher {
+ public:
+  FakeLog()
+      : signer_(TestSigner::DefaultLogSigner()),
+        timestamp_(util::TimeInMilliseconds() - 1000000),
+        tamper_with_(-1) {
+    Reset();
+  }
+
+  void AddEntries(int count) {
+    for (int i = 0; i < count; ++i) {
+      LoggedEntry entry;
+      test_signer_.CreateUnique(&entry);
+      string leaf_input;
+      string extra_data;
+      CHECK(entry.SerializeForLeaf(&leaf_input));
+      CHECK(entry.SerializeExtraData(&extra_data));
+      index_by_hash_.emplace(tree_->LeafHash(leaf_input), entries_.size());
+      entries_.push_back(entry);
+      leaf_inputs_.push_back(leaf_input);
+      extra_datas_.push_back(extra_data);
+      tree_->AddLeaf(leaf_input);
+    }
+  }
+
+  // Starts again from scratch, with other entries.
+  void Reset() {
+    tree_.reset(new MerkleTree(new Sha256Hasher));
+    entries_.clear();
+    leaf_inputs_.clear();
+    extra_datas_.clear();
+    index_by_hash_.clear();
+  }
+
+  // The entry of |index| is changed in the get-entries responses.
+  void TamperWith(int64_t index) {
+    tamper_with_ = index;
+  }
+
+  const LoggedEntry& entry(int64_t index) const {
+    return entries_[index];
+  }
+
+  MerkleTree* tree() {
+    return tree_.get();
+  }
+
+  int Requests(const string& method) const {
+    const auto it(requests_.find(method));
+    return it == requests_.end() ? 0 : it->second;
+  }
+
+  // The first entries of the get-entries requests.
+  const vector<int64_t>& entries_starts() const {
+    return entries_starts_;
+  }
+
+  void Fetch(const Request& req, Response* resp, util::Task* task) override {
+    const string& path(req.url.Path());
+    const string method(path.substr(path.rfind('/') + 1));
+    const string& query(req.url.Query());
+    ++requests_[method];
+    resp->status_code = 200;
+    JsonWriter json(&resp->body);
+    json.StartObject();
+    if (method == "get-sth") {
+      WriteSTH(&json);
+    } else if (method == "get-entries") {
+      WriteEntries(std::stoll(QueryParam(query, "start")),
+                   std::stoll(QueryParam(query, "end")), &json);
+    } else if (method == "get-proof-by-hash") {
+      const auto it(
+          index_by_hash_.find(util::FromBase64(
+              QueryParam(query, "hash").c_str())));
+      const int64_t tree_size(std::stoll(QueryParam(query, "tree_size")));
+      if (it == index_by_hash_.end() ||
+          static_cast<int64_t>(it->second) >= tree_size) {
+        resp->status_code = 400;
+      } else {
+        json.Add("leaf_index", static_cast<int64_t>(it->second));
+        WriteNodes("audit_path",
+                   tree_->PathToRootAtSnapshot(it->second + 1, tree_size),
+                   &json);
+      }
+    } else if (method == "get-sth-consistency") {
+      WriteNodes("consistency",
+                 tree_->SnapshotConsistency(
+                     std::stoll(QueryParam(query, "first")),
+                     std::stoll(QueryParam(query, "second"))),
+                 &json);
+    } else {
+      resp->status_code = 404;
+    }
+    json.EndObject();
+    task->Return();
+  }
+
+ private:
+  void WriteSTH(JsonWriter* json) {
+    SignedTreeHead sth;
+    sth.set_version(ct::V1);
+    sth.set_timestamp(++timestamp_);
+    sth.set_tree_size(tree_->LeafCount());
+    sth.set_sha256_root_hash(tree_->CurrentRoot());
+    CHECK_EQ(LogSigner::OK, signer_->SignTreeHead(&sth));
+    string signature;
+    CHECK_EQ(SerializeResult::OK,
+             Serializer::SerializeDigitallySigned(sth.signature(),
+                                                  &signature));
+    json->Add("tree_size", sth.tree_size());
+    json->Add("timestamp", sth.timestamp());
+    json->AddBase64("sha256_root_hash", sth.sha256_root_hash());
+    json->AddBase64("tree_head_signature", signature);
+  }
+
+  void WriteEntries(int64_t start, int64_t end, JsonWriter* json) {
+    entries_starts_.push_back(start);
+    end = std::min(end, start + kMaxEntriesPerResponse - 1);
+    json->Key("entries");
+    json->StartArray();
+    for (int64_t i = start;
+         i <= end && i < static_cast<int64_t>(entries_.size()); ++i) {
+      string leaf_input(leaf_inputs_[i]);
+      if (i == tamper_with_) {
+        // A byte of the timestamp, which still parses.
+        leaf_input[5] ^= 1;
+      }
+      json->StartObject();
+      json->AddBase64("leaf_input", leaf_input);
+      json->AddBase64("extra_data", extra_datas_[i]);
+      json->EndObject();
+    }
+    json->EndArray();
+  }
+
+  static void WriteNodes(const char* name, const vector<string>& nodes,
+                         JsonWriter* json) {
+    json->Key(name);
+    json->StartArray();
+    for (const string& node : nodes) {
+      json->Base64(node);
+    }
+    json->EndArray();
+  }
+
+  TestSigner test_signer_;
+  const unique_ptr<LogSigner> signer_;
+  uint64_t timestamp_;
+  unique_ptr<MerkleTree> tree_;
+  vector<LoggedEntry> entries_;
+  vector<string> leaf_inputs_;
+  vector<string> extra_datas_;
+  map<string, size_t> index_by_hash_;
+  int64_t tamper_with_;
+  map<string, int> requests_;
+  vector<int64_t> entries_starts_;
+};
+
+
+class EdgeCacheTest : public ::testing::Test {
+ protected:
+  EdgeCacheTest()
+      : client_(&pool_, &log_, kLogUrl),
+        verifier_(TestSigner::DefaultLogSigVerifier(),
+                  new MerkleVerifier(new Sha256Hasher)),
+        disk_cache_(new DiskLruCache(tmp_.TmpStorageDir(), 1 << 20)),
+        cache_(new EdgeCache(&client_, &verifier_, disk_cache_.get())) {
+    FLAGS_edge_entries_window = kWindow;
+  }
+
+  // Checks that |entries| are those of the log from |first|.
+  void ExpectEntries(int64_t first, const vector<LoggedEntry>& entries) {
+    for (size_t i = 0; i < entries.size(); ++i) {
+      EXPECT_EQ(log_.entry(first + i).MerkleLeafHash(),
+                entries[i].MerkleLeafHash())
+          << first + i;
+      string expected_extra_data;
+      string extra_data;
+      ASSERT_TRUE(log_.entry(first + i).SerializeExtraData(
+          &expected_extra_data));
+      ASSERT_TRUE(entries[i].SerializeExtraData(&extra_data));
+      EXPECT_EQ(expected_extra_data, extra_data) << first + i;
+    }
+  }
+
+  ThreadPool pool_;
+  FakeLog log_;
+  AsyncLogClient client_;
+  LogVerifier verifier_;
+  TmpStorage tmp_;
+  unique_ptr<DiskLruCache> disk_cache_;
+  unique_ptr<EdgeCache> cache_;
+};
+
+
+TEST_F(EdgeCacheTest, NoTreeHeadYet) {
+  vector<LoggedEntry> entries;
+  EXPECT_EQ(util::error::UNAVAILABLE,
+            cache_->CurrentSTH().status().CanonicalCode());
+  EXPECT_EQ(util::error::UNAVAILABLE,
+            cache_->GetEntries(0, 0, &entries).CanonicalCode());
+}
+
+
+TEST_F(EdgeCacheTest, ServesCheckedEntries) {
+  log_.AddEntries(20);
+  ASSERT_OK(cache_->UpdateSTH());
+  ASSERT_EQ(20, cache_->CurrentSTH().ValueOrDie().tree_size());
+
+  // Responses stop at the end of the window, or of the tree.
+  vector<LoggedEntry> entries;
+  ASSERT_OK(cache_->GetEntries(2, 100, &entries));
+  ASSERT_EQ(6U, entries.size());
+  ExpectEntries(2, entries);
+  ASSERT_OK(cache_->GetEntries(17, 100, &entries));
+  ASSERT_EQ(3U, entries.size());
+  ExpectEntries(17, entries);
+  EXPECT_EQ(util::error::OUT_OF_RANGE,
+            cache_->GetEntries(20, 21, &entries).CanonicalCode());
+
+  // Read again from the disk.
+  const int get_entries(log_.Requests("get-entries"));
+  const int get_proof(log_.Requests("get-proof-by-hash"));
+  ASSERT_OK(cache_->GetEntries(0, 7, &entries));
+  ASSERT_EQ(8U, entries.size());
+  ExpectEntries(0, entries);
+  EXPECT_EQ(get_entries, log_.Requests("get-entries"));
+  EXPECT_EQ(get_proof, log_.Requests("get-proof-by-hash"));
+
+  // From another instance too.
+  disk_cache_.reset(new DiskLruCache(tmp_.TmpStorageDir(), 1 << 20));
+  cache_.reset(new EdgeCache(&client_, &verifier_, disk_cache_.get()));
+  ASSERT_OK(cache_->UpdateSTH());
+  ASSERT_OK(cache_->GetEntries(16, 19, &entries));
+  ExpectEntries(16, entries);
+  EXPECT_EQ(get_entries, log_.Requests("get-entries"));
+}
+
+
+TEST_F(EdgeCacheTest, ExtendsPartialWindows) {
+  log_.AddEntries(18);
+  ASSERT_OK(cache_->UpdateSTH());
+  vector<LoggedEntry> entries;
+  ASSERT_OK(cache_->GetEntries(16, 23, &entries));
+  ASSERT_EQ(2U, entries.size());
+
+  log_.AddEntries(6);
+  ASSERT_OK(cache_->UpdateSTH());
+  EXPECT_EQ(1, log_.Requests("get-sth-consistency"));
+  const size_t num_requests(log_.entries_starts().size());
+  ASSERT_OK(cache_->GetEntries(16, 23, &entries));
+  ASSERT_EQ(8U, entries.size());
+  ExpectEntries(16, entries);
+  // Only the new entries were fetched.
+  EXPECT_EQ(vector<int64_t>({18, 21}),
+            vector<int64_t>(log_.entries_starts().begin() + num_requests,
+                            log_.entries_starts().end()));
+}
+
+
+TEST_F(EdgeCacheTest, RejectsTamperedEntries) {
+  log_.AddEntries(16);
+  ASSERT_OK(cache_->UpdateSTH());
+  log_.TamperWith(11);
+  vector<LoggedEntry> entries;
+  ASSERT_OK(cache_->GetEntries(0, 7, &entries));
+  EXPECT_EQ(util::error::DATA_LOSS,
+            cache_->GetEntries(8, 15, &entries).CanonicalCode());
+  EXPECT_TRUE(entries.empty());
+
+  // Nothing was cached.
+  log_.TamperWith(-1);
+  ASSERT_OK(cache_->GetEntries(8, 15, &entries));
+  ExpectEntries(8, entries);
+}
+
+
+TEST_F(EdgeCacheTest, RejectsInconsistentTreeHeads) {
+  log_.AddEntries(10);
+  ASSERT_OK(cache_->UpdateSTH());
+  const SignedTreeHead sth(cache_->CurrentSTH().ValueOrDie());
+
+  log_.Reset();
+  log_.AddEntries(12);
+  EXPECT_EQ(util::error::DATA_LOSS, cache_->UpdateSTH().CanonicalCode());
+  EXPECT_EQ(sth.timestamp(), cache_->CurrentSTH().ValueOrDie().timestamp());
+}
+
+
+TEST_F(EdgeCacheTest, ServesCheckedProofs) {
+  log_.AddEntries(10);
+  ASSERT_OK(cache_->UpdateSTH());
+  log_.AddEntries(7);
+  ASSERT_OK(cache_->UpdateSTH());
+
+  const string hash(log_.entry(4).MerkleLeafHash());
+  ShortMerkleAuditProof proof;
+  ASSERT_OK(cache_->GetProof(hash, 10, &proof));
+  EXPECT_EQ(4, proof.leaf_index());
+  const vector<string> path(log_.tree()->PathToRootAtSnapshot(5, 10));
+  EXPECT_EQ(path, vector<string>(proof.path_node().begin(),
+                                 proof.path_node().end()));
+  const int get_proof(log_.Requests("get-proof-by-hash"));
+  ASSERT_OK(cache_->GetProof(hash, 10, &proof));
+  EXPECT_EQ(get_proof, log_.Requests("get-proof-by-hash"));
+  ASSERT_OK(cache_->GetProof(hash, 17, &proof));
+
+  // Only at the sizes of the tree heads.
+  EXPECT_EQ(util::error::FAILED_PRECONDITION,
+            cache_->GetProof(hash, 12, &proof).CanonicalCode());
+  EXPECT_EQ(util::error::UNAVAILABLE,
+            cache_->GetProof(string(32, 'x'), 17, &proof).CanonicalCode());
+
+  // Fetched to check the second tree head.
+  vector<string> consistency;
+  ASSERT_OK(cache_->GetConsistency(10, 17, &consistency));
+  EXPECT_EQ(log_.tree()->SnapshotConsistency(10, 17), consistency);
+  EXPECT_EQ(1, log_.Requests("get-sth-consistency"));
+  ASSERT_OK(cache_->GetConsistency(0, 17, &consistency));
+  EXPECT_TRUE(consistency.empty());
+  EXPECT_EQ(util::error::FAILED_PRECONDITION,
+            cache_->GetConsistency(9, 17, &consistency).CanonicalCode());
+}
+
+
+class DiskLruCacheTest : public ::testing::Test {
+ protected:
+  TmpStorage tmp_;
+};
+
+
+TEST_F(DiskLruCacheTest, EvictsLeastRecentlyUsed) {
+  // Each value is stored with its SHA-256.
+  const string value(68, 'v');
+  DiskLruCache cache(tmp_.TmpStorageDir(), 300);
+  cache.Put("a", value);
+  cache.Put("b", value);
+  cache.Put("c", value);
+  string got;
+  ASSERT_TRUE(cache.Get("a", &got));
+  EXPECT_EQ(value, got);
+  cache.Put("d", value);
+  EXPECT_EQ(300, cache.SizeBytes());
+  EXPECT_FALSE(cache.Get("b", &got));
+  EXPECT_TRUE(cache.Get("c", &got));
+  cache.Put("e", value);
+  EXPECT_FALSE(cache.Get("a", &got));
+  EXPECT_TRUE(cache.Get("d", &got));
+
+  // Too big for the cache.
+  cache.Put("f", string(300, 'v'));
+  EXPECT_FALSE(cache.Get("f", &got));
+
+  // The files are kept.
+  DiskLruCache reopened(tmp_.TmpStorageDir(), 300);
+  EXPECT_EQ(cache.SizeBytes(), reopened.SizeBytes());
+  EXPECT_TRUE(reopened.Get("e", &got));
+  EXPECT_EQ(value, got);
+}
+
+
+TEST_F(DiskLruCacheTest, DropsCorruptFiles) {
+  DiskLruCache cache(tmp_.TmpStorageDir(), 1000);
+  cache.Put("a", "value");
+  std::ofstream(tmp_.TmpStorageDir() + "/a",
+                std::ios::binary | std::ios::trunc)
+      << "torn";
+  string got;
+  EXPECT_FALSE(cache.Get("a", &got));
+  EXPECT_EQ(0, cache.SizeBytes());
+  EXPECT_NE(0, access((tmp_.TmpStorageDir() + "/a").c_str(), F_OK));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  ConfigureSerializerForV1CT();
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,236 @@
+#include "server/edge_handler.h"
+
+#include <event2/buffer.h>
+#include <event2/http.h>
+#include <glog/logging.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "log/logged_entry.h"
+#include "proto/serializer.h"
+#include "server/edge_cache.h"
+#include "server/json_output.h"
+#include "util/json_writer.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+using ct::ShortMerkleAuditProof;
+using ct::SignedTreeHead;
+using std::bind;
+using std::placeholders::_1;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+using util::StatusOr;
+
+namespace cert_trans {
+namespace {
+
+
+typedef unique_ptr<evbuffer, void (*)(evbuffer*)> ScopedEvbuffer;
+
+
+ScopedEvbuffer NewEvbuffer() {
+  return ScopedEvbuffer(CHECK_NOTNULL(evbuffer_new()), &evbuffer_free);
+}
+
+
+}  // namespace
+
+
+EdgeHttpHandler::EdgeHttpHandler(EdgeCache* cache, ThreadPool* pool,
+                                 libevent::Base* event_base)
+    : cache_(CHECK_NOTNULL(cache)),
+      pool_(CHECK_NOTNULL(pool)),
+      event_base_(CHECK_NOTNULL(event_base)) {
+}
+
+
+void EdgeHttpHandler::Add(libevent::HttpServer* server) {
+  CHECK_NOTNULL(server);
+  CHECK(server->AddHandler(
+      "/ct/v1/get-sth", bind(&EdgeHttpHandler::Queue, this,
+                             &EdgeHttpHandler::GetSTH, _1)));
+  CHECK(server->AddHandler(
+      "/ct/v1/get-entries", bind(&EdgeHttpHandler::Queue, this,
+                                 &EdgeHttpHandler::GetEntries, _1)));
+  CHECK(server->AddHandler(
+      "/ct/v1/get-proof-by-hash", bind(&EdgeHttpHandler::Queue, this,
+                                       &EdgeHttpHandler::GetProof, _1)));
+  CHECK(server->AddHandler(
+      "/ct/v1/get-sth-consistency",
+      bind(&EdgeHttpHandler::Queue, this, &EdgeHttpHandler::GetConsistency,
+           _1)));
+}
+
+
+void EdgeHttpHandler::Queue(void (EdgeHttpHandler::*handler)(evhttp_request*),
+                            evhttp_request* req) {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    return SendJsonError(event_base_, req, HTTP_BADMETHOD,
+                         "Method not allowed.");
+  }
+  pool_->Add(bind(handler, this, req));
+}
+
+
+void EdgeHttpHandler::GetSTH(evhttp_request* req) {
+  const StatusOr<SignedTreeHead> sth(cache_->CurrentSTH());
+  if (!sth.ok()) {
+    return SendError(req, sth.status());
+  }
+
+  string signature;
+  CHECK_EQ(Serializer::SerializeDigitallySigned(sth.ValueOrDie().signature(),
+                                                &signature),
+           SerializeResult::OK);
+  const ScopedEvbuffer body(NewEvbuffer());
+  JsonWriter json(body.get());
+  json.StartObject();
+  json.Add("tree_size", sth.ValueOrDie().tree_size());
+  json.Add("timestamp", sth.ValueOrDie().timestamp());
+  json.AddBase64("sha256_root_hash", sth.ValueOrDie().sha256_root_hash());
+  json.AddBase64("tree_head_signature", signature);
+  json.EndObject();
+  SendJsonReply(event_base_, req, HTTP_OK, body.get());
+}
+
+
+void EdgeHttpHandler::GetEntries(evhttp_request* req) {
+  const libevent::QueryParams query(libevent::ParseQuery(req));
+  const int64_t start(libevent::GetIntParam(query, "start"));
+  if (start < 0) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Missing or invalid \"start\" parameter.");
+  }
+  const int64_t end(libevent::GetIntParam(query, "end"));
+  if (end < start) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Missing or invalid \"end\" parameter.");
+  }
+
+  vector<LoggedEntry> entries;
+  const Status status(cache_->GetEntries(start, end, &entries));
+  if (!status.ok()) {
+    return SendError(req, status);
+  }
+
+  const ScopedEvbuffer body(NewEvbuffer());
+  JsonWriter json(body.get());
+  json.StartObject();
+  json.Key("entries");
+  json.StartArray();
+  string leaf_input;
+  string extra_data;
+  for (const LoggedEntry& entry : entries) {
+    if (!entry.SerializeForLeaf(&leaf_input) ||
+        !entry.SerializeExtraData(&extra_data)) {
+      return SendJsonError(event_base_, req, HTTP_INTERNAL,
+                           "Serialization failed.");
+    }
+    json.StartObject();
+    json.AddBase64("leaf_input", leaf_input);
+    json.AddBase64("extra_data", extra_data);
+    json.EndObject();
+  }
+  json.EndArray();
+  json.EndObject();
+  SendJsonReply(event_base_, req, HTTP_OK, body.get());
+}
+
+
+void EdgeHttpHandler::GetProof(evhttp_request* req) {
+  const libevent::QueryParams query(libevent::ParseQuery(req));
+  string b64_hash;
+  if (!libevent::GetParam(query, "hash", &b64_hash)) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Missing or invalid \"hash\" parameter.");
+  }
+  const string hash(util::FromBase64(b64_hash.c_str()));
+  if (hash.empty()) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Invalid \"hash\" parameter.");
+  }
+  const int64_t tree_size(libevent::GetIntParam(query, "tree_size"));
+  if (tree_size < 0) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Missing or invalid \"tree_size\" parameter.");
+  }
+
+  ShortMerkleAuditProof proof;
+  const Status status(cache_->GetProof(hash, tree_size, &proof));
+  if (!status.ok()) {
+    return SendError(req, status);
+  }
+
+  const ScopedEvbuffer body(NewEvbuffer());
+  JsonWriter json(body.get());
+  json.StartObject();
+  json.Add("leaf_index", proof.leaf_index());
+  json.Key("audit_path");
+  json.StartArray();
+  for (int i = 0; i < proof.path_node_size(); ++i) {
+    json.Base64(proof.path_node(i));
+  }
+  json.EndArray();
+  json.EndObject();
+  SendJsonReply(event_base_, req, HTTP_OK, body.get());
+}
+
+
+void EdgeHttpHandler::GetConsistency(evhttp_request* req) {
+  const libevent::QueryParams query(libevent::ParseQuery(req));
+  const int64_t first(libevent::GetIntParam(query, "first"));
+  if (first < 0) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Missing or invalid \"first\" parameter.");
+  }
+  const int64_t second(libevent::GetIntParam(query, "second"));
+  if (second < first) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Missing or invalid \"second\" parameter.");
+  }
+
+  vector<string> proof;
+  const Status status(cache_->GetConsistency(first, second, &proof));
+  if (!status.ok()) {
+    return SendError(req, status);
+  }
+
+  const ScopedEvbuffer body(NewEvbuffer());
+  JsonWriter json(body.get());
+  json.StartObject();
+  json.Key("consistency");
+  json.StartArray();
+  for (const string& node : proof) {
+    json.Base64(node);
+  }
+  json.EndArray();
+  json.EndObject();
+  SendJsonReply(event_base_, req, HTTP_OK, body.get());
+}
+
+
+void EdgeHttpHandler::SendError(evhttp_request* req, const Status& status) {
+  switch (status.CanonicalCode()) {
+    case util::error::INVALID_ARGUMENT:
+    case util::error::OUT_OF_RANGE:
+    case util::error::FAILED_PRECONDITION:
+      return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                           status.error_message());
+    case util::error::DATA_LOSS:
+      LOG(WARNING) << "The log sent a response which did not verify: "
+                   << status;
+      // Bad Gateway.
+      return SendJsonError(event_base_, req, 502, status.error_message());
+    default:
+      return SendJsonError(event_base_, req, HTTP_SERVUNAVAIL,
+                           status.error_message());
+  }
+}
+
+
+}  // namespace cert_trans
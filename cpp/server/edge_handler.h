@@ -0,0 +1,57 @@
+#ifndef CERT_TRANS_SERVER_EDGE_HANDLER_H_
+#define CERT_TRANS_SERVER_EDGE_HANDLER_H_
+
+#include <string>
+
+#include "base/macros.h"
+#include "util/libevent_wrapper.h"
+#include "util/status.h"
+
+namespace cert_trans {
+
+class EdgeCache;
+class ThreadPool;
+
+
+// Serves the read-only endpoints of RFC 6962 from an EdgeCache:
+// get-sth, get-entries, get-proof-by-hash and get-sth-consistency. The
+// requests are answered on |pool|, as they can wait for the remote log.
+//
+// Proofs are only served at the tree sizes of the recent tree heads of
+// the cache, and a hash that the remote log does not have gets a 503,
+// like any other failed request to it, rather than the 400 of the log.
+class EdgeHttpHandler {
+ public:
+  // Does not take ownership of its parameters, which must outlive this
+  // instance.
+  EdgeHttpHandler(EdgeCache* cache, ThreadPool* pool,
+                  libevent::Base* event_base);
+
+  void Add(libevent::HttpServer* server);
+
+ private:
+  // Runs |handler| with |req| on |pool_|, if it is a GET.
+  void Queue(void (EdgeHttpHandler::*handler)(evhttp_request*),
+             evhttp_request* req);
+
+  void GetSTH(evhttp_request* req);
+  void GetEntries(evhttp_request* req);
+  void GetProof(evhttp_request* req);
+  void GetConsistency(evhttp_request* req);
+
+  // Replies to |req| with the error of |status|: 400 for bad requests,
+  // 502 for responses of the remote log that did not verify, and 503
+  // otherwise.
+  void SendError(evhttp_request* req, const util::Status& status);
+
+  EdgeCache* const cache_;
+  ThreadPool* const pool_;
+  libevent::Base* const event_base_;
+
+  DISALLOW_COPY_AND_ASSIGN(EdgeHttpHandler);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_EDGE_HANDLER_H_
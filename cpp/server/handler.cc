@@ -1,15 +1,21 @@
 #include "server/handler.h"
 
+#include <errno.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <algorithm>
+#include <string.h>
+#include <zlib.h>
 #include <algorithm>
 #include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <set>
 #include <string>
+#include <tuple>
+#include <utility>
 #include <vector>
 
 #include "log/cert.h"
@@ -17,21 +23,31 @@
 #include "log/cluster_state_controller.h"
 #include "log/log_lookup.h"
 #include "log/logged_entry.h"
+#include "log/tiles.h"
 #include "monitoring/latency.h"
 #include "monitoring/monitoring.h"
+#include "monitoring/trace.h"
 #include "server/json_output.h"
+#include "proto/serializer.h"
 #include "server/proxy.h"
-#include "util/json_wrapper.h"
+#include "server/rate_limiter.h"
+#include "util/json_writer.h"
+#include "util/memory_budget.h"
+#include "util/single_flight.h"
 #include "util/thread_pool.h"
+#include "util/util.h"
 
 namespace libevent = cert_trans::libevent;
 
 using cert_trans::Counter;
 using cert_trans::HttpHandler;
+using cert_trans::JsonWriter;
 using cert_trans::Latency;
 using cert_trans::LoggedEntry;
 using cert_trans::Proxy;
+using cert_trans::ReadOnlyDatabase;
 using cert_trans::ScopedLatency;
+using ct::DigitallySigned;
 using ct::ShortMerkleAuditProof;
 using ct::SignedCertificateTimestamp;
 using ct::SignedTreeHead;
@@ -44,13 +60,58 @@ using std::multimap;
 using std::min;
 using std::mutex;
 using std::placeholders::_1;
+using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
 using std::vector;
+using util::Task;
 
 DEFINE_int32(max_leaf_entries_per_response, 1000,
              "maximum number of entries to put in the response of a "
              "get-entries request");
+DEFINE_int32(get_entries_threads, 4,
+             "number of threads reading entries for get-entries requests, "
+             "per HTTP event loop");
+DEFINE_int32(max_get_entries_in_progress, 64,
+             "maximum number of get-entries requests being served at once "
+             "by each HTTP event loop, beyond which they are turned away "
+             "with a 503");
+DEFINE_int32(get_entries_chunk_size, 100,
+             "number of entries read at once and sent in each chunk of "
+             "get-entries responses");
+DEFINE_bool(enable_stream_entries, false,
+            "serve the non-standard /ct/v1/stream-entries, which streams "
+            "any range of entries in a single response, one entry per line "
+            "of JSON or in a binary framing");
+DEFINE_int32(max_queued_requests, 1000,
+             "maximum number of requests waiting for a thread of the "
+             "pool, such as submissions and proxied requests, beyond "
+             "which they are turned away with a 503");
+DEFINE_int32(max_queued_bulk_requests, 100,
+             "like --max_queued_requests, for proxied requests to bulk "
+             "endpoints such as get-entries, which only run once no other "
+             "requests are waiting");
+DEFINE_int32(get_entries_cache_mb, 128,
+             "megabytes of JSON objects of entries to keep in memory for "
+             "get-entries responses, when the database does not store them, "
+             "per HTTP event loop; with --memory_budget_mb, this is only "
+             "their weight in the budget");
+DEFINE_int32(get_entries_cached_windows, 0,
+             "if positive, get-entries requests are cut at the end of the "
+             "window of --max_leaf_entries_per_response entries that they "
+             "start in, and the complete responses for this many of the "
+             "newest full windows are rendered as soon as they are in the "
+             "tree and kept in memory, per HTTP event loop");
+DEFINE_bool(get_entries_gzip_windows, true,
+            "whether to also keep a gzip-compressed copy of each of the "
+            "--get_entries_cached_windows, which is sent to the clients "
+            "accepting it");
+DEFINE_int32(max_entries_and_proofs_per_response, 100,
+             "maximum number of leaf indices a get-entry-and-proof request "
+             "can ask for at once");
+DEFINE_int32(max_proofs_per_response, 1000,
+             "maximum number of hashes a get-proof-by-hash request can ask "
+             "for at once");
 
 namespace {
 
@@ -60,9 +121,190 @@ static Latency<milliseconds, string> http_server_request_latency_ms(
     "Total request latency in ms broken down by path");
 
 
+static Counter<string>* coalesced_requests(Counter<string>::New(
+    "http_server_coalesced_requests", "request",
+    "Number of requests answered with the result of an identical request "
+    "in progress, rather than computed again, broken down by request"));
+
+
+// The chunk of entries read for a get-entries or stream-entries request
+// (see HttpHandler::ReadEntries()), and whether they could all be
+// serialized.
+typedef std::pair<bool, shared_ptr<const vector<ReadOnlyDatabase::JsonEntry>>>
+    EntriesChunk;
+
+// The chunks being read, by database, first and last entry, whether they
+// include the SCTs and format (an HttpHandler::EntriesFormat), so that
+// identical concurrent requests only read them once. Shared by the
+// handlers of all the HTTP event loops.
+cert_trans::SingleFlight<std::tuple<const ReadOnlyDatabase*, int64_t,
+                                    int64_t, bool, int>,
+                         EntriesChunk>
+    entries_in_flight;
+
+// Likewise for the get-sth-consistency responses, by tree, tree sizes
+// and whether they are in the binary form.
+cert_trans::SingleFlight<std::tuple<const cert_trans::LogLookup*, int64_t,
+                                    int64_t, bool>,
+                         shared_ptr<const string>>
+    consistency_in_flight;
+
+
+const char kEntriesPrefix[] = "{\"entries\":[";
+const char kEntriesSuffix[] = "]}";
+
+
+void ReleaseJsonEntry(const void*, size_t, void* holder) {
+  delete static_cast<shared_ptr<const void>*>(holder);
+}
+
+
+void AppendUint32(uint32_t value, string* out) {
+  for (int shift = 24; shift >= 0; shift -= 8) {
+    out->push_back(static_cast<char>((value >> shift) & 0xff));
+  }
+}
+
+
+void AppendUint64(uint64_t value, string* out) {
+  AppendUint32(value >> 32, out);
+  AppendUint32(value & 0xffffffff, out);
+}
+
+
+// Appends |field| preceded by its length as a 32-bit big-endian integer,
+// as are all the variable-length fields of the binary replies.
+void AppendField(const string& field, string* out) {
+  AppendUint32(field.size(), out);
+  out->append(field);
+}
+
+
+// The frame of an entry in the "binary" format of stream-entries: the
+// leaf input, extra data and, if requested, SCT of the entry, each
+// preceded by its length.
+string BinaryFrame(const string& leaf_input, const string& extra_data,
+                   bool include_sct, const string& sct) {
+  string frame;
+  AppendField(leaf_input, &frame);
+  AppendField(extra_data, &frame);
+  if (include_sct) {
+    AppendField(sct, &frame);
+  }
+  return frame;
+}
+
+
+void AddSignature(const char* name, const DigitallySigned& ds,
+                  JsonWriter* json) {
+  string signature;
+  CHECK_EQ(Serializer::SerializeDigitallySigned(ds, &signature),
+           SerializeResult::OK);
+  json->AddBase64(name, signature);
+}
+
+
+// Parses the comma-separated list of non-negative integers of
+// get-entry-and-proof, returning false if any is invalid.
+bool ParseLeafIndices(const string& value, vector<int64_t>* indices) {
+  for (const string& index : util::split(value)) {
+    char* end;
+    errno = 0;
+    const long long num(strtoll(index.c_str(), &end, 10));
+    if (index.empty() || *end != '\0' || errno || num < 0) {
+      return false;
+    }
+    indices->push_back(num);
+  }
+  return !indices->empty();
+}
+
+
+// Adds a reference to |json_entry| to |buffer|, rather than a copy. Also
+// used for other JSON objects kept in memory, such as get-sth responses.
+void AddJsonEntry(const ReadOnlyDatabase::JsonEntry& json_entry,
+                  evbuffer* buffer) {
+  CHECK_EQ(evbuffer_add_reference(buffer, json_entry.data, json_entry.size,
+                                  &ReleaseJsonEntry,
+                                  new shared_ptr<const void>(
+                                      json_entry.holder)),
+           0);
+}
+
+
+// Compresses |data| into the gzip format.
+string Gzip(const string& data) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // 16 more window bits ask for a gzip header and trailer.
+  CHECK_EQ(Z_OK, deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                              15 + 16, 8, Z_DEFAULT_STRATEGY));
+  string out(deflateBound(&stream, data.size()), '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+  stream.avail_out = out.size();
+  CHECK_EQ(Z_STREAM_END, deflate(&stream, Z_FINISH));
+  out.resize(stream.total_out);
+  CHECK_EQ(Z_OK, deflateEnd(&stream));
+  return out;
+}
+
+
 }  // namespace
 
 
+struct HttpHandler::GetEntriesStream {
+  const HttpHandler* const handler;
+  evhttp_request* const req;
+  const int64_t start;
+  const int64_t end;
+  const bool include_scts;
+  const EntriesFormat format;
+  // The next entry to read. Only changed on the event thread.
+  int64_t next;
+  // The iterator of the last chunk read from ScanRange(), if any, and
+  // the sequence number of its next entry. Only used by ReadEntries().
+  unique_ptr<ReadOnlyDatabase::Iterator> scan;
+  int64_t scan_next;
+  // Whether the reply has been started.
+  bool started;
+  // Whether the client went away.
+  bool closed;
+  // Whether a chunk is being sent, rather than read.
+  bool sending;
+};
+
+
+struct HttpHandler::WindowCache {
+  // The get-entries response for a window, as is, and compressed with
+  // gzip unless --get_entries_gzip_windows is false.
+  struct Window {
+    string body;
+    string gzip_body;
+  };
+
+  mutex lock;
+  // Cleared by the destructor of the handler, as the update callback of
+  // the LogLookup can outlive it.
+  const HttpHandler* handler;
+  // The get-entries responses for windows, by the first entry of each.
+  std::map<int64_t, shared_ptr<const Window>> windows;
+  // The windows being rendered.
+  std::set<int64_t> pending;
+};
+
+
+struct HttpHandler::STHReply {
+  uint64_t timestamp;
+  string json;
+  string binary;
+  // Identify the tree head, whose timestamp is unique, in each form.
+  string etag;
+  string binary_etag;
+};
+
+
 HttpHandler::HttpHandler(LogLookup* log_lookup, const ReadOnlyDatabase* db,
                          const ClusterStateController<LoggedEntry>* controller,
                          ThreadPool* pool, libevent::Base* event_base,
@@ -73,11 +315,155 @@ HttpHandler::HttpHandler(LogLookup* log_lookup, const ReadOnlyDatabase* db,
       proxy_(nullptr),
       pool_(CHECK_NOTNULL(pool)),
       event_base_(CHECK_NOTNULL(event_base)),
-      staleness_tracker_(CHECK_NOTNULL(staleness_tracker)) {
+      staleness_tracker_(CHECK_NOTNULL(staleness_tracker)),
+      json_entry_cache_(static_cast<size_t>(FLAGS_get_entries_cache_mb)
+                            << 20,
+                        MemoryBudget::Default()),
+      entries_pool_(
+          new ThreadPool("get_entries", FLAGS_get_entries_threads)),
+      get_entries_in_progress_(0),
+      sth_reply_(make_shared<shared_ptr<const STHReply>>()),
+      window_cache_(make_shared<WindowCache>()) {
+  CHECK_GE(FLAGS_get_entries_cache_mb, 0);
+  CHECK_GT(FLAGS_get_entries_chunk_size, 0);
+  CHECK_GE(FLAGS_get_entries_cached_windows, 0);
+  window_cache_->handler = this;
+  // Register before getting the current tree head, so that none is
+  // missed.
+  const shared_ptr<shared_ptr<const STHReply>> sth_reply(sth_reply_);
+  const shared_ptr<WindowCache> window_cache(window_cache_);
+  log_lookup_->AddUpdateCallback(
+      [sth_reply, window_cache](const SignedTreeHead& sth) {
+        UpdateSTHReply(sth_reply, sth);
+        lock_guard<mutex> lock(window_cache->lock);
+        if (window_cache->handler) {
+          window_cache->handler->PrefetchWindows(sth.tree_size());
+        }
+      });
+  const SignedTreeHead sth(log_lookup_->GetSTH());
+  UpdateSTHReply(sth_reply_, sth);
+  lock_guard<mutex> lock(window_cache_->lock);
+  PrefetchWindows(sth.tree_size());
+}
+
+
+// static
+void HttpHandler::UpdateSTHReply(
+    const shared_ptr<shared_ptr<const STHReply>>& sth_reply,
+    const SignedTreeHead& sth) {
+  VLOG(2) << "SignedTreeHead:\n" << sth.DebugString();
+
+  string json_reply;
+  JsonWriter json(&json_reply);
+  json.StartObject();
+  json.Add("tree_size", sth.tree_size());
+  json.Add("timestamp", sth.timestamp());
+  json.AddBase64("sha256_root_hash", sth.sha256_root_hash());
+  AddSignature("tree_head_signature", sth.signature(), &json);
+  json.EndObject();
+
+  VLOG(2) << "GetSTH:\n" << json_reply;
+
+  string binary_reply;
+  AppendUint64(sth.tree_size(), &binary_reply);
+  AppendUint64(sth.timestamp(), &binary_reply);
+  AppendField(sth.sha256_root_hash(), &binary_reply);
+  string signature;
+  CHECK_EQ(Serializer::SerializeDigitallySigned(sth.signature(), &signature),
+           SerializeResult::OK);
+  AppendField(signature, &binary_reply);
+
+  const string etag(std::to_string(sth.tree_size()) + "-" +
+                    std::to_string(sth.timestamp()));
+  const shared_ptr<const STHReply> reply(
+      new STHReply{sth.timestamp(), json_reply, binary_reply,
+                   "\"" + etag + "\"", "\"" + etag + "-binary\""});
+  shared_ptr<const STHReply> current(std::atomic_load(sth_reply.get()));
+  do {
+    if (current && current->timestamp >= reply->timestamp) {
+      return;
+    }
+  } while (
+      !std::atomic_compare_exchange_weak(sth_reply.get(), &current, reply));
 }
 
 
 HttpHandler::~HttpHandler() {
+  // Windows still being rendered are finished by |entries_pool_|, which
+  // drains its queue before going away.
+  lock_guard<mutex> lock(window_cache_->lock);
+  window_cache_->handler = nullptr;
+}
+
+
+// static
+int64_t HttpHandler::WindowSize() {
+  return FLAGS_max_leaf_entries_per_response;
+}
+
+
+void HttpHandler::PrefetchWindows(int64_t tree_size) const {
+  if (FLAGS_get_entries_cached_windows <= 0) {
+    return;
+  }
+  const int64_t window_size(WindowSize());
+  const int64_t num_full_windows(tree_size / window_size);
+  const int64_t first(std::max<int64_t>(
+      0, num_full_windows - FLAGS_get_entries_cached_windows));
+
+  window_cache_->windows.erase(window_cache_->windows.begin(),
+                               window_cache_->windows.lower_bound(
+                                   first * window_size));
+  for (int64_t n = first; n < num_full_windows; ++n) {
+    const int64_t start(n * window_size);
+    if (window_cache_->windows.count(start) > 0 ||
+        !window_cache_->pending.insert(start).second) {
+      continue;
+    }
+    entries_pool_->Add(bind(&HttpHandler::RenderWindow, this, start),
+                       ThreadPool::Priority::BULK);
+  }
+}
+
+
+// Runs on |entries_pool_|.
+void HttpHandler::RenderWindow(int64_t start) const {
+  const int64_t end(start + WindowSize() - 1);
+  GetEntriesStream stream{this, nullptr, start, end, false,
+                          EntriesFormat::GET_ENTRIES, start};
+  vector<ReadOnlyDatabase::JsonEntry> entries;
+  shared_ptr<WindowCache::Window> window;
+  if (RenderEntries(&stream, end, &entries) &&
+      static_cast<int64_t>(entries.size()) == end - start + 1) {
+    window = make_shared<WindowCache::Window>();
+    string* const body(&window->body);
+    body->assign(kEntriesPrefix);
+    for (const ReadOnlyDatabase::JsonEntry& entry : entries) {
+      if (body->size() > strlen(kEntriesPrefix)) {
+        body->push_back(',');
+      }
+      body->append(entry.data, entry.size);
+    }
+    body->append(kEntriesSuffix);
+    // Compressed once here, rather than for each response.
+    if (FLAGS_get_entries_gzip_windows) {
+      window->gzip_body = Gzip(*body);
+    }
+  } else {
+    LOG(WARNING) << "Could not render the get-entries response for the "
+                 << "window starting at " << start;
+  }
+
+  lock_guard<mutex> lock(window_cache_->lock);
+  window_cache_->pending.erase(start);
+  if (window) {
+    window_cache_->windows[start] = window;
+    // Newer windows may have come in whilst this one was rendered.
+    while (static_cast<int64_t>(window_cache_->windows.size()) >
+           FLAGS_get_entries_cached_windows) {
+      window_cache_->windows.erase(window_cache_->windows.begin());
+    }
+  }
 }
 
 
@@ -94,6 +480,7 @@ void StatsHandlerInterceptor(const string& path,
 void HttpHandler::AddEntryReply(evhttp_request* req,
                                 const util::Status& add_status,
                                 const SignedCertificateTimestamp& sct) const {
+  ScopedSpan span("reply");
   if (!add_status.ok() &&
       add_status.CanonicalCode() != util::error::ALREADY_EXISTS) {
     VLOG(1) << "error adding chain: " << add_status;
@@ -105,27 +492,75 @@ void HttpHandler::AddEntryReply(evhttp_request* req,
                          add_status.error_message());
   }
 
-  JsonObject json_reply;
-  json_reply.Add("sct_version", static_cast<int64_t>(0));
-  json_reply.AddBase64("id", sct.id().key_id());
-  json_reply.Add("timestamp", sct.timestamp());
-  json_reply.Add("extensions", "");
-  json_reply.Add("signature", sct.signature());
+  const unique_ptr<evbuffer, void (*)(evbuffer*)> body(
+      CHECK_NOTNULL(evbuffer_new()), &evbuffer_free);
+  JsonWriter json(body.get());
+  json.StartObject();
+  AddSCTFields(sct, &json);
+  json.EndObject();
 
-  SendJsonReply(event_base_, req, HTTP_OK, json_reply);
+  SendJsonReply(event_base_, req, HTTP_OK, body.get());
+}
+
+
+void HttpHandler::AddEntriesReply(
+    evhttp_request* req, const vector<util::Status>& add_statuses,
+    const vector<SignedCertificateTimestamp>& scts) const {
+  CHECK_EQ(add_statuses.size(), scts.size());
+  ScopedSpan span("reply");
+  const unique_ptr<evbuffer, void (*)(evbuffer*)> body(
+      CHECK_NOTNULL(evbuffer_new()), &evbuffer_free);
+  JsonWriter json(body.get());
+  json.StartObject();
+  json.Key("results");
+  json.StartArray();
+  for (size_t i = 0; i < add_statuses.size(); ++i) {
+    const util::Status& status(add_statuses[i]);
+    json.StartObject();
+    if (status.ok() || status.CanonicalCode() == util::error::ALREADY_EXISTS) {
+      AddSCTFields(scts[i], &json);
+    } else {
+      VLOG(1) << "error adding entry " << i << ": " << status;
+      json.AddBoolean("success", false);
+      json.Add("error_message", status.error_message());
+    }
+    json.EndObject();
+  }
+  json.EndArray();
+  json.EndObject();
+
+  SendJsonReply(event_base_, req, HTTP_OK, body.get());
+}
+
+
+// static
+void HttpHandler::AddSCTFields(const SignedCertificateTimestamp& sct,
+                               JsonWriter* json) {
+  json->Add("sct_version", static_cast<int64_t>(0));
+  json->AddBase64("id", sct.id().key_id());
+  json->Add("timestamp", sct.timestamp());
+  json->Add("extensions", "");
+  AddSignature("signature", sct.signature(), json);
 }
 
 void HttpHandler::ProxyInterceptor(
     const libevent::HttpServer::HandlerCallback& local_handler,
+    ThreadPool::Priority priority, const LocalCheck& can_serve_locally,
     evhttp_request* request) {
   VLOG(2) << "Running proxy interceptor...";
-  // TODO(alcutter): We can be a bit smarter about when to proxy off
-  // the request - being stale wrt to the current serving STH doesn't
-  // automatically mean we're unable to answer this request.
-  if (staleness_tracker_->IsNodeStale()) {
+  if (RateLimiter::Default()->ShedRequest(event_base_, request)) {
+    return;
+  }
+  // Being stale with respect to the serving STH doesn't mean we can't
+  // answer this particular request.
+  if (staleness_tracker_->IsNodeStale() &&
+      !(can_serve_locally && can_serve_locally(request))) {
     // Can't do this on the libevent thread since it can block on the lock in
     // ClusterStatusController::GetFreshNodes().
-    pool_->Add(bind(&Proxy::ProxyRequest, proxy_, request));
+    if (ShedLoad(request, priority)) {
+      return;
+    }
+    pool_->Add(bind(&Proxy::ProxyRequest, proxy_, request), priority);
   } else {
     local_handler(request);
   }
@@ -135,26 +570,93 @@ void HttpHandler::ProxyInterceptor(
 void HttpHandler::AddProxyWrappedHandler(
     libevent::HttpServer* server, const string& path,
     const libevent::HttpServer::HandlerCallback& local_handler) {
+  AddProxyWrappedHandler(server, path, local_handler,
+                         ThreadPool::Priority::NORMAL);
+}
+
+
+void HttpHandler::AddProxyWrappedHandler(
+    libevent::HttpServer* server, const string& path,
+    const libevent::HttpServer::HandlerCallback& local_handler,
+    ThreadPool::Priority priority) {
+  AddProxyWrappedHandler(server, path, local_handler, priority, LocalCheck());
+}
+
+
+void HttpHandler::AddProxyWrappedHandler(
+    libevent::HttpServer* server, const string& path,
+    const libevent::HttpServer::HandlerCallback& local_handler,
+    ThreadPool::Priority priority, const LocalCheck& can_serve_locally) {
   const libevent::HttpServer::HandlerCallback stats_handler(
-      bind(&StatsHandlerInterceptor, path, local_handler, _1));
-  CHECK(server->AddHandler(path, bind(&HttpHandler::ProxyInterceptor, this,
-                                      stats_handler, _1)));
+      bind(&StatsHandlerInterceptor, path_prefix_ + path, local_handler,
+           _1));
+  CHECK(server->AddHandler(path_prefix_ + path,
+                           bind(&HttpHandler::ProxyInterceptor, this,
+                                stats_handler, priority, can_serve_locally,
+                                _1)));
+}
+
+
+bool HttpHandler::ShedLoad(evhttp_request* req,
+                           ThreadPool::Priority priority) const {
+  const size_t max_queued(static_cast<size_t>(
+      priority == ThreadPool::Priority::BULK ? FLAGS_max_queued_bulk_requests
+                                             : FLAGS_max_queued_requests));
+  if (pool_->QueueLength(priority) < max_queued) {
+    return false;
+  }
+  VLOG(1) << "shedding request, " << max_queued << " already queued";
+  SendJsonError(event_base_, req, HTTP_SERVUNAVAIL,
+                "Too many requests queued.");
+  return true;
 }
 
 
 void HttpHandler::Add(libevent::HttpServer* server) {
+  Add(server, "");
+}
+
+
+void HttpHandler::Add(libevent::HttpServer* server,
+                  const string& path_prefix) {
   CHECK_NOTNULL(server);
-  // TODO(pphaneuf): An optional prefix might be nice?
+  CHECK(path_prefix.empty() ||
+        (path_prefix.front() == '/' && path_prefix.back() != '/'))
+      << "bad path prefix: " << path_prefix;
+  path_prefix_ = path_prefix;
   // TODO(pphaneuf): Find out which methods are CPU intensive enough
   // that they should be spun off to the thread pool.
   AddProxyWrappedHandler(server, "/ct/v1/get-entries",
-                         bind(&HttpHandler::GetEntries, this, _1));
+                         bind(&HttpHandler::GetEntries, this, _1),
+                         ThreadPool::Priority::BULK,
+                         bind(&HttpHandler::HasEntries, this, true, _1));
   AddProxyWrappedHandler(server, "/ct/v1/get-proof-by-hash",
-                         bind(&HttpHandler::GetProof, this, _1));
+                         bind(&HttpHandler::GetProof, this, _1),
+                         ThreadPool::Priority::NORMAL,
+                         bind(&HttpHandler::HasProofTree, this, _1));
+  AddProxyWrappedHandler(server, "/ct/v1/get-entry-and-proof",
+                         bind(&HttpHandler::GetEntryAndProof, this, _1),
+                         ThreadPool::Priority::NORMAL,
+                         bind(&HttpHandler::HasProofTree, this, _1));
+  // The serving STH is exactly what a stale node doesn't have.
   AddProxyWrappedHandler(server, "/ct/v1/get-sth",
                          bind(&HttpHandler::GetSTH, this, _1));
   AddProxyWrappedHandler(server, "/ct/v1/get-sth-consistency",
-                         bind(&HttpHandler::GetConsistency, this, _1));
+                         bind(&HttpHandler::GetConsistency, this, _1),
+                         ThreadPool::Priority::NORMAL,
+                         bind(&HttpHandler::HasConsistencyTrees, this, _1));
+  // Non-standard, serves the same tiles as a TileExporter.
+  AddProxyWrappedHandler(server, "/ct/v1/get-tile",
+                         bind(&HttpHandler::GetTile, this, _1),
+                         ThreadPool::Priority::NORMAL,
+                         bind(&HttpHandler::HasTile, this, _1));
+  if (FLAGS_enable_stream_entries) {
+    // Non-standard, streams any number of entries in a single response.
+    AddProxyWrappedHandler(server, "/ct/v1/stream-entries",
+                           bind(&HttpHandler::StreamEntries, this, _1),
+                           ThreadPool::Priority::BULK,
+                           bind(&HttpHandler::HasEntries, this, false, _1));
+  }
 
   // Now add any sub-class handlers.
   AddHandlers(server);
@@ -167,6 +669,54 @@ void HttpHandler::SetProxy(Proxy* proxy) {
 }
 
 
+bool HttpHandler::HasEntries(bool capped, evhttp_request* req) const {
+  const libevent::QueryParams query(libevent::ParseQuery(req));
+  const int64_t start(libevent::GetIntParam(query, "start"));
+  int64_t end(libevent::GetIntParam(query, "end"));
+  if (start < 0 || end < start) {
+    // Invalid either way, we might as well say so ourselves.
+    return true;
+  }
+  if (capped) {
+    end = min(end, start + FLAGS_max_leaf_entries_per_response);
+  }
+  return end < db_->TreeSize();
+}
+
+
+bool HttpHandler::HasProofTree(evhttp_request* req) const {
+  const libevent::QueryParams query(libevent::ParseQuery(req));
+  const int64_t tree_size(libevent::GetIntParam(query, "tree_size"));
+  return tree_size >= 0 && tree_size <= log_lookup_->GetSTH().tree_size();
+}
+
+
+bool HttpHandler::HasConsistencyTrees(evhttp_request* req) const {
+  const libevent::QueryParams query(libevent::ParseQuery(req));
+  const int64_t second(libevent::GetIntParam(query, "second"));
+  return second >= 0 && second <= log_lookup_->GetSTH().tree_size();
+}
+
+
+bool HttpHandler::HasTile(evhttp_request* req) const {
+  const libevent::QueryParams query(libevent::ParseQuery(req));
+  const int64_t level(libevent::GetIntParam(query, "level"));
+  const int64_t index(libevent::GetIntParam(query, "index"));
+  string width_param;
+  const int64_t width(libevent::GetParam(query, "width", &width_param)
+                          ? libevent::GetIntParam(query, "width")
+                          : cert_trans::kTileWidth);
+  const int64_t tree_size(log_lookup_->GetSTH().tree_size());
+  if (level < 0 || index < 0 || width <= 0 || index > tree_size ||
+      level * cert_trans::kTileHeight >= 63) {
+    return false;
+  }
+  // The nodes of the tile are at tree level |level| * kTileHeight.
+  return (tree_size >> (level * cert_trans::kTileHeight)) >=
+         index * static_cast<int64_t>(cert_trans::kTileWidth) + width;
+}
+
+
 void HttpHandler::GetEntries(evhttp_request* req) const {
   if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
     return SendJsonError(event_base_, req, HTTP_BADMETHOD,
@@ -194,8 +744,115 @@ void HttpHandler::GetEntries(evhttp_request* req) const {
   // This is non-standard, and is only used internally by other log nodes when
   // "following" nodes with more data.
   const bool include_scts(libevent::GetBoolParam(query, "include_scts"));
+  const bool binary(WantsBinaryReply(req));
+
+  if (FLAGS_get_entries_cached_windows > 0) {
+    // Stop at the end of the window, so that clients walking the log
+    // only ever ask for whole windows, which are likely to be cached.
+    const int64_t window_start(start - start % WindowSize());
+    end = std::min(end, window_start + WindowSize() - 1);
+    if (!include_scts && !binary && start == window_start &&
+        end == window_start + WindowSize() - 1 &&
+        SendCachedWindow(req, start)) {
+      return;
+    }
+  }
+
+  StartGetEntries(req, start, end, include_scts,
+                  binary ? EntriesFormat::BINARY : EntriesFormat::GET_ENTRIES);
+}
+
+
+bool HttpHandler::SendCachedWindow(evhttp_request* req, int64_t start) const {
+  shared_ptr<const WindowCache::Window> window;
+  {
+    lock_guard<mutex> lock(window_cache_->lock);
+    const auto it(window_cache_->windows.find(start));
+    if (it == window_cache_->windows.end()) {
+      return false;
+    }
+    window = it->second;
+  }
+
+  const bool gzip(!window->gzip_body.empty() &&
+                  AcceptsEncoding(req, "gzip"));
+  // Cached windows are all in the tree.
+  if (SetImmutableReply(event_base_, req, gzip ? "gzip" : "")) {
+    return true;
+  }
+  const string& body(gzip ? window->gzip_body : window->body);
+  const unique_ptr<evbuffer, void (*)(evbuffer*)> buffer(
+      CHECK_NOTNULL(evbuffer_new()), &evbuffer_free);
+  AddJsonEntry(ReadOnlyDatabase::JsonEntry{body.data(), body.size(), window},
+               buffer.get());
+  SendJsonReply(event_base_, req, HTTP_OK, buffer.get());
+  return true;
+}
+
+
+void HttpHandler::StreamEntries(evhttp_request* req) const {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    return SendJsonError(event_base_, req, HTTP_BADMETHOD,
+                         "Method not allowed.");
+  }
+
+  const libevent::QueryParams query(libevent::ParseQuery(req));
+
+  const int64_t start(libevent::GetIntParam(query, "start"));
+  if (start < 0) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Missing or invalid \"start\" parameter.");
+  }
+
+  // Unlike get-entries, there is no limit on the number of entries, the
+  // response only stops early at the first missing entry.
+  const int64_t end(libevent::GetIntParam(query, "end"));
+  if (end < start) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Missing or invalid \"end\" parameter.");
+  }
+
+  string format_name("json");
+  libevent::GetParam(query, "format", &format_name);
+  EntriesFormat format;
+  if (format_name == "json") {
+    format = EntriesFormat::JSON_LINES;
+  } else if (format_name == "binary") {
+    format = EntriesFormat::BINARY;
+  } else {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Invalid \"format\" parameter.");
+  }
+
+  StartGetEntries(req, start, end,
+                  libevent::GetBoolParam(query, "include_scts"), format);
+}
+
+
+void HttpHandler::StartGetEntries(evhttp_request* req, int64_t start,
+                                  int64_t end, bool include_scts,
+                                  EntriesFormat format) const {
+  // Entries that are all in the tree never change, and are all there.
+  if (end < log_lookup_->GetSTH().tree_size() &&
+      (format == EntriesFormat::BINARY
+           ? SetImmutableBinaryReply(event_base_, req)
+           : SetImmutableReply(event_base_, req))) {
+    return;
+  }
+
+  if (++get_entries_in_progress_ > FLAGS_max_get_entries_in_progress) {
+    --get_entries_in_progress_;
+    return SendJsonError(event_base_, req, HTTP_SERVUNAVAIL,
+                         "Too many get-entries requests in progress.");
+  }
 
-  BlockingGetEntries(req, start, end, include_scts);
+  // The entries are read on |entries_pool_| and sent from here, one
+  // chunk at a time.
+  GetEntriesStream* const stream(new GetEntriesStream{
+      this, req, start, end, include_scts, format, start});
+  evhttp_connection_set_closecb(evhttp_request_get_connection(req),
+                                &OnEntriesConnectionClosed, stream);
+  entries_pool_->Add(bind(&HttpHandler::ReadEntries, this, stream));
 }
 
 
@@ -207,17 +864,28 @@ void HttpHandler::GetProof(evhttp_request* req) const {
 
   const libevent::QueryParams query(libevent::ParseQuery(req));
 
-  string b64_hash;
-  if (!libevent::GetParam(query, "hash", &b64_hash)) {
+  string hash_param;
+  if (!libevent::GetParam(query, "hash", &hash_param)) {
     return SendJsonError(event_base_, req, HTTP_BADREQUEST,
                          "Missing or invalid \"hash\" parameter.");
   }
 
-  const string hash(util::FromBase64(b64_hash.c_str()));
-  if (hash.empty()) {
+  vector<string> hashes;
+  for (const string& b64_hash : util::split(hash_param)) {
+    hashes.emplace_back(util::FromBase64(b64_hash.c_str()));
+    if (hashes.back().empty()) {
+      return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                           "Invalid \"hash\" parameter.");
+    }
+  }
+  if (hashes.empty()) {
     return SendJsonError(event_base_, req, HTTP_BADREQUEST,
                          "Invalid \"hash\" parameter.");
   }
+  if (hashes.size() > static_cast<size_t>(FLAGS_max_proofs_per_response)) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Too many hashes.");
+  }
 
   const int64_t tree_size(libevent::GetIntParam(query, "tree_size"));
   if (tree_size < 0 ||
@@ -226,44 +894,204 @@ void HttpHandler::GetProof(evhttp_request* req) const {
                          "Missing or invalid \"tree_size\" parameter.");
   }
 
-  ShortMerkleAuditProof proof;
-  if (log_lookup_->AuditProof(hash, tree_size, &proof) != LogLookup::OK) {
+  // Only single proofs have a binary form.
+  const bool batch(hashes.size() > 1);
+  const bool binary(WantsBinaryReply(req) && !batch);
+
+  // Proofs at a tree size that exists never change. (Only requests for
+  // hashes that were found before can match the ETag.)
+  if (binary ? SetImmutableBinaryReply(event_base_, req)
+             : SetImmutableReply(event_base_, req)) {
+    return;
+  }
+
+  vector<ShortMerkleAuditProof> proofs;
+  if (log_lookup_->AuditProofs(hashes, tree_size, &proofs) != LogLookup::OK ||
+      (binary && !proofs[0].has_leaf_index())) {
     return SendJsonError(event_base_, req, HTTP_BADREQUEST,
                          "Couldn't find hash.");
   }
 
-  JsonArray json_audit;
-  for (int i = 0; i < proof.path_node_size(); ++i) {
-    json_audit.AddBase64(proof.path_node(i));
+  if (binary) {
+    string reply;
+    AppendUint64(proofs[0].leaf_index(), &reply);
+    for (int i = 0; i < proofs[0].path_node_size(); ++i) {
+      AppendField(proofs[0].path_node(i), &reply);
+    }
+    return SendBinaryReply(event_base_, req, HTTP_OK, reply);
   }
 
-  JsonObject json_reply;
-  json_reply.Add("leaf_index", proof.leaf_index());
-  json_reply.Add("audit_path", json_audit);
+  const unique_ptr<evbuffer, void (*)(evbuffer*)> body(
+      CHECK_NOTNULL(evbuffer_new()), &evbuffer_free);
+  JsonWriter json(body.get());
+  // A single hash gets the response of RFC 6962, several get an array of
+  // those, with an empty object for each hash that is not in the tree.
+  if (batch) {
+    json.StartObject();
+    json.Key("proofs");
+    json.StartArray();
+  }
+  for (const ShortMerkleAuditProof& proof : proofs) {
+    json.StartObject();
+    if (proof.has_leaf_index()) {
+      json.Add("leaf_index", proof.leaf_index());
+      json.Key("audit_path");
+      json.StartArray();
+      for (int i = 0; i < proof.path_node_size(); ++i) {
+        json.Base64(proof.path_node(i));
+      }
+      json.EndArray();
+    }
+    json.EndObject();
+  }
+  if (batch) {
+    json.EndArray();
+    json.EndObject();
+  }
 
-  SendJsonReply(event_base_, req, HTTP_OK, json_reply);
+  SendJsonReply(event_base_, req, HTTP_OK, body.get());
 }
 
 
-void HttpHandler::GetSTH(evhttp_request* req) const {
+void HttpHandler::GetEntryAndProof(evhttp_request* req) const {
   if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
     return SendJsonError(event_base_, req, HTTP_BADMETHOD,
                          "Method not allowed.");
   }
 
-  const SignedTreeHead& sth(log_lookup_->GetSTH());
+  const libevent::QueryParams query(libevent::ParseQuery(req));
 
-  VLOG(2) << "SignedTreeHead:\n" << sth.DebugString();
+  const int64_t tree_size(libevent::GetIntParam(query, "tree_size"));
+  if (tree_size <= 0 || tree_size > log_lookup_->GetSTH().tree_size()) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Missing or invalid \"tree_size\" parameter.");
+  }
 
-  JsonObject json_reply;
-  json_reply.Add("tree_size", sth.tree_size());
-  json_reply.Add("timestamp", sth.timestamp());
-  json_reply.AddBase64("sha256_root_hash", sth.sha256_root_hash());
-  json_reply.Add("tree_head_signature", sth.signature());
+  string leaf_index_param;
+  vector<int64_t> indices;
+  if (!libevent::GetParam(query, "leaf_index", &leaf_index_param) ||
+      !ParseLeafIndices(leaf_index_param, &indices)) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Missing or invalid \"leaf_index\" parameter.");
+  }
+  if (indices.size() >
+      static_cast<size_t>(FLAGS_max_entries_and_proofs_per_response)) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Too many leaf indices.");
+  }
+  for (const int64_t index : indices) {
+    if (index >= tree_size) {
+      return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                           "Leaf index beyond \"tree_size\".");
+    }
+  }
 
-  VLOG(2) << "GetSTH:\n" << json_reply.DebugString();
+  // The entries and their proofs at a tree size that exists never
+  // change.
+  if (SetImmutableReply(event_base_, req)) {
+    return;
+  }
 
-  SendJsonReply(event_base_, req, HTTP_OK, json_reply);
+  const shared_ptr<vector<ShortMerkleAuditProof>> proofs(
+      make_shared<vector<ShortMerkleAuditProof>>());
+  CHECK_EQ(LogLookup::OK,
+           log_lookup_->AuditProofs(indices, tree_size, proofs.get()));
+
+  const shared_ptr<vector<LoggedEntry>> entries(
+      make_shared<vector<LoggedEntry>>());
+  db_->LookupByIndexAsync(
+      indices, entries.get(),
+      new Task(
+          [this, req, indices, proofs, entries](Task* task) {
+            if (task->status().ok()) {
+              SendEntriesAndProofs(req, indices, *proofs, *entries);
+            } else {
+              // Only a node which is still fetching the log can lack an
+              // entry in its tree.
+              SendJsonError(event_base_, req, HTTP_SERVUNAVAIL,
+                            "Entry not available yet.");
+            }
+            delete task;
+          },
+          pool_));
+}
+
+
+void HttpHandler::SendEntriesAndProofs(
+    evhttp_request* req, const vector<int64_t>& indices,
+    const vector<ShortMerkleAuditProof>& proofs,
+    const vector<LoggedEntry>& entries) const {
+  const unique_ptr<evbuffer, void (*)(evbuffer*)> body(
+      CHECK_NOTNULL(evbuffer_new()), &evbuffer_free);
+  JsonWriter json(body.get());
+  // A single index gets the response of RFC 6962, several get an array
+  // of those, with the index of each.
+  const bool batch(indices.size() > 1);
+  if (batch) {
+    json.StartObject();
+    json.Key("entries");
+    json.StartArray();
+  }
+  string leaf_input;
+  string extra_data;
+  for (size_t i = 0; i < indices.size(); ++i) {
+    const LoggedEntry& entry(entries[i]);
+    if (!entry.SerializeForLeaf(&leaf_input) ||
+        !entry.SerializeExtraData(&extra_data)) {
+      LOG(WARNING) << "Failed to serialize entry @ " << indices[i] << ":\n"
+                   << entry.DebugString();
+      return SendJsonError(event_base_, req, HTTP_INTERNAL,
+                           "Serialization failed.");
+    }
+
+    json.StartObject();
+    if (batch) {
+      json.Add("leaf_index", indices[i]);
+    }
+    json.AddBase64("leaf_input", leaf_input);
+    json.AddBase64("extra_data", extra_data);
+    json.Key("audit_path");
+    json.StartArray();
+    for (int j = 0; j < proofs[i].path_node_size(); ++j) {
+      json.Base64(proofs[i].path_node(j));
+    }
+    json.EndArray();
+    json.EndObject();
+  }
+  if (batch) {
+    json.EndArray();
+    json.EndObject();
+  }
+
+  SendJsonReply(event_base_, req, HTTP_OK, body.get());
+}
+
+
+void HttpHandler::GetSTH(evhttp_request* req) const {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    return SendJsonError(event_base_, req, HTTP_BADMETHOD,
+                         "Method not allowed.");
+  }
+
+  // The response is rendered once per tree head, see UpdateSTHReply().
+  const shared_ptr<const STHReply> reply(std::atomic_load(sth_reply_.get()));
+  const bool binary(WantsBinaryReply(req));
+  if (SendNotModifiedIfMatch(event_base_, req,
+                             binary ? reply->binary_etag : reply->etag)) {
+    return;
+  }
+
+  const string& rendered(binary ? reply->binary : reply->json);
+  const unique_ptr<evbuffer, void (*)(evbuffer*)> body(
+      CHECK_NOTNULL(evbuffer_new()), &evbuffer_free);
+  AddJsonEntry(ReadOnlyDatabase::JsonEntry{rendered.data(), rendered.size(),
+                                           reply},
+               body.get());
+  if (binary) {
+    SendBinaryReply(event_base_, req, HTTP_OK, body.get());
+  } else {
+    SendJsonReply(event_base_, req, HTTP_OK, body.get());
+  }
 }
 
 
@@ -287,66 +1115,333 @@ void HttpHandler::GetConsistency(evhttp_request* req) const {
                          "Missing or invalid \"second\" parameter.");
   }
 
-  const vector<string> consistency(
-      log_lookup_->ConsistencyProof(first, second));
-  JsonArray json_cons;
-  for (vector<string>::const_iterator it = consistency.begin();
-       it != consistency.end(); ++it) {
-    json_cons.AddBase64(*it);
+  const bool binary(WantsBinaryReply(req));
+
+  // Proofs between tree sizes that exist never change.
+  if (second <= log_lookup_->GetSTH().tree_size() &&
+      (binary ? SetImmutableBinaryReply(event_base_, req)
+              : SetImmutableReply(event_base_, req))) {
+    return;
+  }
+
+  // Identical requests on the other event loops wait for this one, and
+  // are sent the same response from their own loop.
+  libevent::Base* const event_base(event_base_);
+  const bool computed(consistency_in_flight.Do(
+      std::make_tuple(log_lookup_, first, second, binary),
+      [this, first, second, binary]() {
+        const vector<string> consistency(
+            log_lookup_->ConsistencyProof(first, second));
+        const shared_ptr<string> reply(make_shared<string>());
+        if (binary) {
+          for (const string& node : consistency) {
+            AppendField(node, reply.get());
+          }
+          return shared_ptr<const string>(reply);
+        }
+        JsonWriter json(reply.get());
+        json.StartObject();
+        json.Key("consistency");
+        json.StartArray();
+        for (const string& node : consistency) {
+          json.Base64(node);
+        }
+        json.EndArray();
+        json.EndObject();
+        return shared_ptr<const string>(reply);
+      },
+      [event_base, req, binary](const shared_ptr<const string>& reply) {
+        event_base->Add([event_base, req, binary, reply]() {
+          const unique_ptr<evbuffer, void (*)(evbuffer*)> body(
+              CHECK_NOTNULL(evbuffer_new()), &evbuffer_free);
+          AddJsonEntry(ReadOnlyDatabase::JsonEntry{reply->data(),
+                                                   reply->size(), reply},
+                       body.get());
+          if (binary) {
+            SendBinaryReply(event_base, req, HTTP_OK, body.get());
+          } else {
+            SendJsonReply(event_base, req, HTTP_OK, body.get());
+          }
+        });
+      }));
+  if (!computed) {
+    coalesced_requests->Increment("get-sth-consistency");
+  }
+}
+
+
+void HttpHandler::GetTile(evhttp_request* req) const {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    return SendJsonError(event_base_, req, HTTP_BADMETHOD,
+                         "Method not allowed.");
   }
 
-  JsonObject json_reply;
-  json_reply.Add("consistency", json_cons);
+  const libevent::QueryParams query(libevent::ParseQuery(req));
+
+  const int64_t level(libevent::GetIntParam(query, "level"));
+  if (level < 0) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Missing or invalid \"level\" parameter.");
+  }
 
-  SendJsonReply(event_base_, req, HTTP_OK, json_reply);
+  const int64_t index(libevent::GetIntParam(query, "index"));
+  if (index < 0) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Missing or invalid \"index\" parameter.");
+  }
+
+  // Full tiles are requested without a width.
+  string width_param;
+  const int64_t width(libevent::GetParam(query, "width", &width_param)
+                          ? libevent::GetIntParam(query, "width")
+                          : cert_trans::kTileWidth);
+  if (width <= 0 || width > static_cast<int64_t>(cert_trans::kTileWidth)) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Invalid \"width\" parameter.");
+  }
+
+  string tile;
+  if (cert_trans::ReadTile(log_lookup_, level, index, width, &tile) !=
+      LogLookup::OK) {
+    return SendJsonError(event_base_, req, HTTP_NOTFOUND,
+                         "Tile not in the current tree.");
+  }
+
+  // The content of a tile never changes once it exists.
+  if (SetImmutableReply(event_base_, req)) {
+    return;
+  }
+  SendBinaryReply(event_base_, req, HTTP_OK, tile);
 }
 
 
-void HttpHandler::BlockingGetEntries(evhttp_request* req, int64_t start,
-                                     int64_t end, bool include_scts) const {
-  JsonArray json_entries;
-  auto it(db_->ScanEntries(start));
-  for (int64_t i = start; i <= end; ++i) {
-    LoggedEntry entry;
+bool HttpHandler::RenderEntries(
+    GetEntriesStream* stream, int64_t end,
+    vector<ReadOnlyDatabase::JsonEntry>* entries) const {
+  int64_t i(stream->next);
+  const bool json(stream->format != EntriesFormat::BINARY);
+  if (json && !stream->include_scts) {
+    // Use the JSON objects the database kept when sequencing the
+    // entries, if any, so that it takes no work at all per entry, or
+    // else the ones in the cache.
+    if (db_->LookupJsonEntries(i, end, entries)) {
+      return true;
+    }
+    for (; i <= end; ++i) {
+      const shared_ptr<const string> json_entry(json_entry_cache_.Get(i));
+      if (!json_entry) {
+        break;
+      }
+      entries->push_back(ReadOnlyDatabase::JsonEntry{json_entry->data(),
+                                                     json_entry->size(),
+                                                     json_entry});
+    }
+    if (i > end) {
+      return true;
+    }
+  }
 
-    if (!it->GetNextEntry(&entry) || entry.sequence_number() != i) {
+  // Keep scanning with the iterator of the previous chunk, if it is
+  // where we want it.
+  if (!stream->scan || stream->scan_next != i) {
+    stream->scan = db_->ScanRange(i, stream->end);
+  }
+  stream->scan_next = -1;
+  // Reused for every entry, so that their memory is too.
+  LoggedEntry entry;
+  string leaf_input;
+  string extra_data;
+  string sct_data;
+  for (; i <= end; ++i) {
+    if (!stream->scan->GetNextEntry(&entry) || entry.sequence_number() != i) {
       break;
     }
 
-    string leaf_input;
-    string extra_data;
-    string sct_data;
     if (!entry.SerializeForLeaf(&leaf_input) ||
         !entry.SerializeExtraData(&extra_data) ||
-        (include_scts &&
+        (stream->include_scts &&
          Serializer::SerializeSCT(entry.sct(), &sct_data) !=
              SerializeResult::OK)) {
       LOG(WARNING) << "Failed to serialize entry @ " << i << ":\n"
                    << entry.DebugString();
-      return SendJsonError(event_base_, req, HTTP_INTERNAL,
-                           "Serialization failed.");
+      return false;
+    }
+    stream->scan_next = i + 1;
+
+    if (!json) {
+      const shared_ptr<const string> frame(make_shared<const string>(
+          BinaryFrame(leaf_input, extra_data, stream->include_scts, sct_data)));
+      entries->push_back(
+          ReadOnlyDatabase::JsonEntry{frame->data(), frame->size(), frame});
+      continue;
     }
 
-    JsonObject json_entry;
-    json_entry.AddBase64("leaf_input", leaf_input);
-    json_entry.AddBase64("extra_data", extra_data);
-
-    if (include_scts) {
+    // Written straight into the string that is kept, with room for the
+    // base64 of the fields and their names.
+    const shared_ptr<string> json_entry(make_shared<string>());
+    json_entry->reserve(
+        (leaf_input.size() + extra_data.size() + sct_data.size()) / 3 * 4 +
+        64);
+    JsonWriter json(json_entry.get());
+    json.StartObject();
+    json.AddBase64("leaf_input", leaf_input);
+    json.AddBase64("extra_data", extra_data);
+
+    if (stream->include_scts) {
       // This is non-standard, and currently only used by other SuperDuper log
       // nodes when "following" to fetch data from each other:
-      json_entry.AddBase64("sct", sct_data);
+      json.AddBase64("sct", sct_data);
     }
+    json.EndObject();
 
-    json_entries.Add(&json_entry);
+    if (!stream->include_scts) {
+      json_entry_cache_.Put(i, json_entry);
+    }
+    entries->push_back(ReadOnlyDatabase::JsonEntry{json_entry->data(),
+                                                   json_entry->size(),
+                                                   json_entry});
   }
+  return true;
+}
 
-  if (json_entries.Length() < 1) {
-    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
-                         "Entry not found.");
+
+// Runs on |entries_pool_|.
+void HttpHandler::ReadEntries(GetEntriesStream* stream) const {
+  const int64_t next(stream->next);
+  const int64_t chunk_end(
+      min(stream->end, next + FLAGS_get_entries_chunk_size - 1));
+  // The streams reading the same chunk at the same time share the
+  // entries read by the first of them, each from its own event loop.
+  const bool computed(entries_in_flight.Do(
+      std::make_tuple(db_, next, chunk_end, stream->include_scts,
+                      static_cast<int>(stream->format)),
+      [this, stream, chunk_end]() {
+        const shared_ptr<vector<ReadOnlyDatabase::JsonEntry>> entries(
+            make_shared<vector<ReadOnlyDatabase::JsonEntry>>());
+        const bool ok(RenderEntries(stream, chunk_end, entries.get()));
+        return EntriesChunk(ok, entries);
+      },
+      [this, stream, next, chunk_end](const EntriesChunk& chunk) {
+        const bool ok(chunk.first);
+        const shared_ptr<const vector<ReadOnlyDatabase::JsonEntry>> entries(
+            chunk.second);
+        const bool complete(
+            ok && next + static_cast<int64_t>(entries->size()) > chunk_end);
+        event_base_->Add([this, stream, ok, complete, entries]() {
+          SendEntries(stream, ok, complete, *entries);
+        });
+      }));
+  if (!computed) {
+    coalesced_requests->Increment("entries");
+  }
+}
+
+
+// Runs on the event thread.
+void HttpHandler::SendEntries(
+    GetEntriesStream* stream, bool ok, bool complete,
+    const vector<ReadOnlyDatabase::JsonEntry>& entries) const {
+  if (stream->closed) {
+    return FinishGetEntries(stream);
   }
 
-  JsonObject json_reply;
-  json_reply.Add("entries", json_entries);
+  evhttp_request* const req(stream->req);
+  if (!stream->started) {
+    if (!ok || entries.empty()) {
+      ReleaseGetEntries(stream);
+      return ok ? SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                                "Entry not found.")
+                : SendJsonError(event_base_, req, HTTP_INTERNAL,
+                                "Serialization failed.");
+    }
+    const char* content_type("application/json; charset=utf-8");
+    if (stream->format == EntriesFormat::JSON_LINES) {
+      content_type = "application/x-ndjson";
+    } else if (stream->format == EntriesFormat::BINARY) {
+      content_type = "application/octet-stream";
+    }
+    CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(req),
+                               "Content-Type", content_type),
+             0);
+    evhttp_send_reply_start(req, HTTP_OK, /*reason*/ NULL);
+    stream->started = true;
+  }
 
-  SendJsonReply(event_base_, req, HTTP_OK, json_reply);
+  const bool get_entries(stream->format == EntriesFormat::GET_ENTRIES);
+  // Once the reply is started, failing to get more entries just makes
+  // for a shorter (but still valid) response.
+  const unique_ptr<evbuffer, void (*)(evbuffer*)> chunk(
+      CHECK_NOTNULL(evbuffer_new()), &evbuffer_free);
+  if (get_entries && stream->next == stream->start) {
+    CHECK_EQ(evbuffer_add(chunk.get(), kEntriesPrefix, strlen(kEntriesPrefix)),
+             0);
+  }
+  for (const ReadOnlyDatabase::JsonEntry& entry : entries) {
+    if (get_entries && stream->next > stream->start) {
+      CHECK_EQ(evbuffer_add(chunk.get(), ",", 1), 0);
+    }
+    AddJsonEntry(entry, chunk.get());
+    if (stream->format == EntriesFormat::JSON_LINES) {
+      CHECK_EQ(evbuffer_add(chunk.get(), "\n", 1), 0);
+    }
+    ++stream->next;
+  }
+
+  if (!complete || stream->next > stream->end) {
+    if (get_entries) {
+      CHECK_EQ(evbuffer_add(chunk.get(), kEntriesSuffix,
+                            strlen(kEntriesSuffix)),
+               0);
+    }
+    evhttp_send_reply_chunk(req, chunk.get());
+    return FinishGetEntries(stream);
+  }
+
+  // Only read the next chunk once this one is out, so that slow clients
+  // do not make us buffer their whole response.
+  stream->sending = true;
+  evhttp_send_reply_chunk_with_cb(req, chunk.get(), &OnEntriesChunkSent,
+                                  stream);
+}
+
+
+// static
+void HttpHandler::OnEntriesChunkSent(evhttp_connection*, void* arg) {
+  GetEntriesStream* const stream(static_cast<GetEntriesStream*>(arg));
+  CHECK(stream->sending);
+  stream->sending = false;
+  stream->handler->entries_pool_->Add(
+      bind(&HttpHandler::ReadEntries, stream->handler, stream));
+}
+
+
+// static
+void HttpHandler::OnEntriesConnectionClosed(evhttp_connection*, void* arg) {
+  GetEntriesStream* const stream(static_cast<GetEntriesStream*>(arg));
+  stream->closed = true;
+  // Otherwise, the chunk being read will find out.
+  if (stream->sending) {
+    stream->handler->FinishGetEntries(stream);
+  }
+}
+
+
+void HttpHandler::FinishGetEntries(GetEntriesStream* stream) const {
+  evhttp_request* const req(stream->req);
+  const bool started(stream->started || stream->closed);
+  ReleaseGetEntries(stream);
+  // With the connection closed, this only frees the request.
+  if (started) {
+    evhttp_send_reply_end(req);
+  }
+}
+
+
+void HttpHandler::ReleaseGetEntries(GetEntriesStream* stream) const {
+  if (!stream->closed) {
+    evhttp_connection_set_closecb(evhttp_request_get_connection(stream->req),
+                                  NULL, NULL);
+  }
+  --get_entries_in_progress_;
+  delete stream;
 }
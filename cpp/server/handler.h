@@ -2,15 +2,20 @@
 #define CERT_TRANS_SERVER_HANDLER_H_
 
 #include <stdint.h>
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <vector>
 
+#include "log/database.h"
 #include "proto/ct.pb.h"
+#include "server/json_entry_cache.h"
 #include "server/staleness_tracker.h"
 #include "util/libevent_wrapper.h"
 #include "util/sync_task.h"
 #include "util/task.h"
+#include "util/thread_pool.h"
 
 class Frontend;
 
@@ -20,12 +25,11 @@ class CertChain;
 class CertChecker;
 template <class T>
 class ClusterStateController;
+class JsonWriter;
 class LogLookup;
 class LoggedEntry;
 class PreCertChain;
 class Proxy;
-class ReadOnlyDatabase;
-class ThreadPool;
 
 
 class HttpHandler {
@@ -39,6 +43,10 @@ class HttpHandler {
   virtual ~HttpHandler();
 
   void Add(libevent::HttpServer* server);
+  // Serves the log under |path_prefix| (e.g. "/logs/2024h1"), which must
+  // start but not end with a slash, so that several logs can share
+  // |server|.
+  void Add(libevent::HttpServer* server, const std::string& path_prefix);
 
   void SetProxy(Proxy* proxy);
 
@@ -48,30 +56,186 @@ class HttpHandler {
 
   void AddEntryReply(evhttp_request* req, const util::Status& add_status,
                      const ct::SignedCertificateTimestamp& sct) const;
+  // Replies to a batch of submissions with their results, in the same
+  // order: the SCT of each that was added (or already there), or why it
+  // was not.
+  void AddEntriesReply(
+      evhttp_request* req, const std::vector<util::Status>& add_statuses,
+      const std::vector<ct::SignedCertificateTimestamp>& scts) const;
+  // Adds the fields of the add-chain response for |sct| to |json|.
+  static void AddSCTFields(const ct::SignedCertificateTimestamp& sct,
+                           JsonWriter* json);
+
+  // Whether a request can be answered from the local database and
+  // LogLookup, even though the node is stale.
+  typedef std::function<bool(evhttp_request*)> LocalCheck;
 
   void ProxyInterceptor(
       const libevent::HttpServer::HandlerCallback& local_handler,
+      ThreadPool::Priority priority, const LocalCheck& can_serve_locally,
       evhttp_request* request);
 
+  // Requests proxied to other nodes are queued on |pool_| with
+  // |priority|, BULK being for endpoints that return a lot of data.
+  // Requests are only proxied while the node is stale, and then not
+  // those for which |can_serve_locally| (if set) returns true.
   void AddProxyWrappedHandler(
       libevent::HttpServer* server, const std::string& path,
       const libevent::HttpServer::HandlerCallback& local_handler);
-
+  void AddProxyWrappedHandler(
+      libevent::HttpServer* server, const std::string& path,
+      const libevent::HttpServer::HandlerCallback& local_handler,
+      ThreadPool::Priority priority);
+  void AddProxyWrappedHandler(
+      libevent::HttpServer* server, const std::string& path,
+      const libevent::HttpServer::HandlerCallback& local_handler,
+      ThreadPool::Priority priority, const LocalCheck& can_serve_locally);
+
+  // Sends a 503 to |req| if too many closures of |priority| are already
+  // queued on |pool_| (see --max_queued_requests), to be called before
+  // queueing work for |req| there. Returns whether it did.
+  bool ShedLoad(evhttp_request* req, ThreadPool::Priority priority) const;
+
+  // The LocalCheck of the handlers below: whether the local database
+  // has all of the entries, or the local tree all of the nodes, that
+  // the request is for. Those only depend on a prefix of the log, which
+  // a stale node has as well as any other. |capped| is whether the
+  // request is cut at --max_leaf_entries_per_response, as get-entries
+  // is but stream-entries is not.
+  bool HasEntries(bool capped, evhttp_request* req) const;
+  bool HasProofTree(evhttp_request* req) const;
+  bool HasConsistencyTrees(evhttp_request* req) const;
+  bool HasTile(evhttp_request* req) const;
+
+  // get-entries, get-sth, get-proof-by-hash (for a single hash) and
+  // get-sth-consistency send the binary form of their reply to requests
+  // which ask for it (see WantsBinaryReply()), which saves the JSON and
+  // base64 on both ends. Variable-length fields are preceded by their
+  // length as a 32-bit big-endian integer, and integers are 64-bit
+  // big-endian:
+  //   - get-entries: the entries as in the binary format of
+  //     stream-entries.
+  //   - get-sth: the tree size, the timestamp, the root hash, then the
+  //     TLS encoding of the signature.
+  //   - get-proof-by-hash: the leaf index, then each audit path node.
+  //   - get-sth-consistency: each node of the proof.
+  // Errors are still sent as JSON.
   void GetEntries(evhttp_request* req) const;
+  // Serves /ct/v1/get-proof-by-hash?hash=&tree_size=, as in RFC 6962.
+  // |hash| can also be a comma-separated list of up to
+  // --max_proofs_per_response hashes, all proven against one snapshot of
+  // the tree, in which case the response is {"proofs": [...]}, with the
+  // object of each hash as it would be returned alone, or an empty one
+  // if it is not in the tree, in the same order.
   void GetProof(evhttp_request* req) const;
+  // Serves /ct/v1/get-entry-and-proof?leaf_index=&tree_size=, as in RFC
+  // 6962, from the database and one snapshot of the tree. |leaf_index|
+  // can also be a comma-separated list of up to
+  // --max_entries_and_proofs_per_response indices, in which case the
+  // response is {"entries": [...]}, with the object of each index as it
+  // would be returned alone, plus its "leaf_index", in the same order.
+  // The entries are read with ReadOnlyDatabase::LookupByIndexAsync(), so
+  // that a worker does not wait on the disk.
+  void GetEntryAndProof(evhttp_request* req) const;
+  // Sends the response of GetEntryAndProof() once it has the |entries|.
+  void SendEntriesAndProofs(
+      evhttp_request* req, const std::vector<int64_t>& indices,
+      const std::vector<ct::ShortMerkleAuditProof>& proofs,
+      const std::vector<LoggedEntry>& entries) const;
   void GetSTH(evhttp_request* req) const;
   void GetConsistency(evhttp_request* req) const;
-
-  void BlockingGetEntries(evhttp_request* req, int64_t start, int64_t end,
-                          bool include_scts) const;
+  void GetTile(evhttp_request* req) const;
+  // Serves /ct/v1/stream-entries?start=&end=[&format=json|binary], which
+  // sends the entries from |start| to |end| inclusive, with no limit on
+  // their number, as a chunked response. With format=json (the default),
+  // each line is the JSON object of an entry, as in get-entries. With
+  // format=binary, each entry is framed as its leaf input then its extra
+  // data, each preceded by its length as a 32-bit big-endian integer.
+  // include_scts=true adds the SCT of each entry, in either format.
+  void StreamEntries(evhttp_request* req) const;
+
+  enum class EntriesFormat {
+    // The JSON document of get-entries.
+    GET_ENTRIES,
+    // Newline-delimited JSON objects.
+    JSON_LINES,
+    // Length-prefixed binary frames.
+    BINARY,
+  };
+
+  // The get-sth response for a tree head, rendered once per tree head.
+  struct STHReply;
+
+  // Stores the get-sth response for |sth| in |*sth_reply|, unless it
+  // already has one for a newer tree head.
+  static void UpdateSTHReply(
+      const std::shared_ptr<std::shared_ptr<const STHReply>>& sth_reply,
+      const ct::SignedTreeHead& sth);
+
+  // State of a get-entries request being streamed to its client.
+  struct GetEntriesStream;
+
+  // The get-entries responses for the newest windows, see
+  // --get_entries_cached_windows. Window n holds the entries from
+  // n * WindowSize() to (n + 1) * WindowSize() - 1.
+  struct WindowCache;
+
+  static int64_t WindowSize();
+  // Starts rendering the newest windows that are in a tree of
+  // |tree_size| entries and not cached yet, and drops the older ones.
+  // Must be called with |window_cache_->lock| held.
+  void PrefetchWindows(int64_t tree_size) const;
+  // Renders the whole get-entries response for the window starting at
+  // |start| into |window_cache_|.
+  void RenderWindow(int64_t start) const;
+  // Sends the cached response for the window starting at |start| to
+  // |req|, if there is one. Returns whether it did.
+  bool SendCachedWindow(evhttp_request* req, int64_t start) const;
+
+  // Starts streaming the entries from |start| to |end| inclusive to
+  // |req| in |format|, unless too many requests are already in progress.
+  void StartGetEntries(evhttp_request* req, int64_t start, int64_t end,
+                       bool include_scts, EntriesFormat format) const;
+  // Gets the consecutive entries of |stream| from its next one to |end|
+  // inclusive, rendered in its format (JSON objects come from the
+  // database or the cache when possible), stopping at the first missing
+  // entry. Returns false if an entry cannot be serialized.
+  bool RenderEntries(GetEntriesStream* stream, int64_t end,
+                     std::vector<ReadOnlyDatabase::JsonEntry>* entries) const;
+  // Reads the next chunk of entries of |stream|, on |entries_pool_|, and
+  // hands them to SendEntries() on the event thread. |complete| is false
+  // if there were fewer entries than asked for.
+  void ReadEntries(GetEntriesStream* stream) const;
+  void SendEntries(
+      GetEntriesStream* stream, bool ok, bool complete,
+      const std::vector<ReadOnlyDatabase::JsonEntry>& entries) const;
+  static void OnEntriesChunkSent(evhttp_connection* conn, void* arg);
+  static void OnEntriesConnectionClosed(evhttp_connection* conn, void* arg);
+  // Ends the response to |stream| and releases it.
+  void FinishGetEntries(GetEntriesStream* stream) const;
+  void ReleaseGetEntries(GetEntriesStream* stream) const;
 
   LogLookup* const log_lookup_;
   const ReadOnlyDatabase* const db_;
   const ClusterStateController<LoggedEntry>* const controller_;
   Proxy* proxy_;
+  // Set by Add(), prepended to the paths of AddProxyWrappedHandler().
+  std::string path_prefix_;
   ThreadPool* const pool_;
   libevent::Base* const event_base_;
   StalenessTracker* const staleness_tracker_;
+  mutable JsonEntryCache json_entry_cache_;
+  // get-entries requests are read from the database on their own
+  // threads, so they neither block the event thread nor hold up the
+  // other requests on |pool_|.
+  const std::unique_ptr<ThreadPool> entries_pool_;
+  mutable std::atomic<int> get_entries_in_progress_;
+  // Only accessed through std::atomic_load/atomic_compare_exchange. It
+  // is shared with the update callback of |log_lookup_|, which cannot be
+  // removed, so that it does not depend on the lifetime of this instance.
+  const std::shared_ptr<std::shared_ptr<const STHReply>> sth_reply_;
+  // Also shared with the update callback of |log_lookup_|.
+  const std::shared_ptr<WindowCache> window_cache_;
 
   DISALLOW_COPY_AND_ASSIGN(HttpHandler);
 };
@@ -15,7 +15,7 @@
 #include "monitoring/monitoring.h"
 #include "server/json_output.h"
 #include "server/proxy.h"
-#include "util/json_wrapper.h"
+#include "server/rate_limiter.h"
 #include "util/thread_pool.h"
 
 namespace libevent = cert_trans::libevent;
@@ -96,6 +96,9 @@ void HttpHandlerV2::ProxyInterceptor(
     const libevent::HttpServer::HandlerCallback& local_handler,
     evhttp_request* request) {
   VLOG(2) << "Running proxy interceptor...";
+  if (RateLimiter::Default()->ShedRequest(event_base_, request)) {
+    return;
+  }
   // TODO(alcutter): We can be a bit smarter about when to proxy off
   // the request - being stale wrt to the current serving STH doesn't
   // automatically mean we're unable to answer this request.
@@ -113,21 +116,34 @@ void HttpHandlerV2::AddProxyWrappedHandler(
     libevent::HttpServer* server, const string& path,
     const libevent::HttpServer::HandlerCallback& local_handler) {
   const libevent::HttpServer::HandlerCallback stats_handler(
-      bind(&StatsHandlerInterceptor, path, local_handler, _1));
-  CHECK(server->AddHandler(path, bind(&HttpHandlerV2::ProxyInterceptor, this,
-                                      stats_handler, _1)));
+      bind(&StatsHandlerInterceptor, path_prefix_ + path, local_handler,
+           _1));
+  CHECK(server->AddHandler(path_prefix_ + path,
+                           bind(&HttpHandlerV2::ProxyInterceptor, this,
+                                stats_handler, _1)));
 }
 
 
 void HttpHandlerV2::Add(libevent::HttpServer* server) {
+  Add(server, "");
+}
+
+
+void HttpHandlerV2::Add(libevent::HttpServer* server,
+                    const string& path_prefix) {
   CHECK_NOTNULL(server);
-  // TODO(pphaneuf): An optional prefix might be nice?
+  CHECK(path_prefix.empty() ||
+        (path_prefix.front() == '/' && path_prefix.back() != '/'))
+      << "bad path prefix: " << path_prefix;
+  path_prefix_ = path_prefix;
   // TODO(pphaneuf): Find out which methods are CPU intensive enough
   // that they should be spun off to the thread pool.
   AddProxyWrappedHandler(server, "/ct/v2/get-entries",
                          bind(&HttpHandlerV2::GetEntries, this, _1));
   AddProxyWrappedHandler(server, "/ct/v2/get-proof-by-hash",
                          bind(&HttpHandlerV2::GetProof, this, _1));
+  AddProxyWrappedHandler(server, "/ct/v2/get-entry-and-proof",
+                         bind(&HttpHandlerV2::GetEntryAndProof, this, _1));
   AddProxyWrappedHandler(server, "/ct/v2/get-sth",
                          bind(&HttpHandlerV2::GetSTH, this, _1));
   AddProxyWrappedHandler(server, "/ct/v2/get-sth-consistency",
@@ -156,6 +172,12 @@ void HttpHandlerV2::GetProof(evhttp_request* req) const {
 }
 
 
+void HttpHandlerV2::GetEntryAndProof(evhttp_request* req) const {
+  return SendJsonError(event_base_, req, HTTP_NOTIMPLEMENTED,
+                       "Not yet implemented.");
+}
+
+
 void HttpHandlerV2::GetSTH(evhttp_request* req) const {
   return SendJsonError(event_base_, req, HTTP_NOTIMPLEMENTED,
                        "Not yet implemented.");
@@ -39,6 +39,10 @@ class HttpHandlerV2 {
   virtual ~HttpHandlerV2();
 
   void Add(libevent::HttpServer* server);
+  // Serves the log under |path_prefix| (e.g. "/logs/2024h1"), which must
+  // start but not end with a slash, so that several logs can share
+  // |server|.
+  void Add(libevent::HttpServer* server, const std::string& path_prefix);
 
   void SetProxy(Proxy* proxy);
 
@@ -59,6 +63,7 @@ class HttpHandlerV2 {
 
   void GetEntries(evhttp_request* req) const;
   void GetProof(evhttp_request* req) const;
+  void GetEntryAndProof(evhttp_request* req) const;
   void GetSTH(evhttp_request* req) const;
   void GetConsistency(evhttp_request* req) const;
 
@@ -69,6 +74,8 @@ class HttpHandlerV2 {
   const ReadOnlyDatabase* const db_;
   const ClusterStateController<LoggedEntry>* const controller_;
   Proxy* proxy_;
+  // Set by Add(), prepended to the paths of AddProxyWrappedHandler().
+  std::string path_prefix_;
   ThreadPool* const pool_;
   libevent::Base* const event_base_;
   StalenessTracker* const staleness_tracker_;
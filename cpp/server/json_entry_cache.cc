@@ -0,0 +1,105 @@
+#include "server/json_entry_cache.h"
+
+#include <glog/logging.h>
+#include <utility>
+
+using std::lock_guard;
+using std::make_pair;
+using std::mutex;
+using std::shared_ptr;
+using std::string;
+
+namespace cert_trans {
+
+
+const size_t JsonEntryCache::kNumShards;
+
+
+JsonEntryCache::JsonEntryCache(size_t max_bytes, MemoryBudget* budget)
+    : budget_(max_bytes > 0 ? budget : nullptr),
+      shard_max_bytes_(max_bytes / kNumShards),
+      hits_(0),
+      misses_(0) {
+  if (budget_) {
+    budget_->AddConsumer("get_entries_json", max_bytes, this);
+  }
+}
+
+
+JsonEntryCache::~JsonEntryCache() {
+  if (budget_) {
+    budget_->RemoveConsumer(this);
+  }
+}
+
+
+shared_ptr<const string> JsonEntryCache::Get(int64_t sequence_number) const {
+  CHECK_GE(sequence_number, 0);
+  Shard& shard(shards_[sequence_number % kNumShards]);
+  lock_guard<mutex> lock(shard.lock);
+
+  const auto it(shard.json.find(sequence_number));
+  if (it == shard.json.end()) {
+    ++misses_;
+    return nullptr;
+  }
+  ++hits_;
+  return it->second;
+}
+
+
+void JsonEntryCache::Put(int64_t sequence_number,
+                         const shared_ptr<const string>& json) {
+  CHECK_GE(sequence_number, 0);
+  CHECK_NOTNULL(json.get());
+  const size_t max_bytes(shard_max_bytes_.load());
+  if (json->size() > max_bytes) {
+    return;
+  }
+
+  Shard& shard(shards_[sequence_number % kNumShards]);
+  lock_guard<mutex> lock(shard.lock);
+
+  const auto inserted(shard.json.insert(make_pair(sequence_number, json)));
+  if (!inserted.second) {
+    // Someone else got there first, and the objects are the same anyway.
+    return;
+  }
+  shard.bytes += json->size();
+  Evict(&shard, max_bytes, sequence_number);
+}
+
+
+size_t JsonEntryCache::Bytes() const {
+  size_t bytes(0);
+  for (Shard& shard : shards_) {
+    lock_guard<mutex> lock(shard.lock);
+    bytes += shard.bytes;
+  }
+  return bytes;
+}
+
+
+void JsonEntryCache::SetMaxBytes(size_t max_bytes) {
+  shard_max_bytes_.store(max_bytes / kNumShards);
+  for (Shard& shard : shards_) {
+    lock_guard<mutex> lock(shard.lock);
+    Evict(&shard, max_bytes / kNumShards);
+  }
+}
+
+
+// static
+void JsonEntryCache::Evict(Shard* shard, size_t max_bytes, int64_t keep) {
+  while (shard->bytes > max_bytes) {
+    auto victim(shard->json.begin());
+    if (victim->first == keep) {
+      ++victim;
+    }
+    shard->bytes -= victim->second->size();
+    shard->json.erase(victim);
+  }
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,82 @@
+#ifndef CERT_TRANS_SERVER_JSON_ENTRY_CACHE_H_
+#define CERT_TRANS_SERVER_JSON_ENTRY_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "base/macros.h"
+#include "util/memory_budget.h"
+
+namespace cert_trans {
+
+
+// A bounded cache of the JSON objects of log entries in get-entries
+// responses, by sequence number. Entries never change once they are
+// sequenced, so the objects never need to be invalidated.
+//
+// The cache is split into shards by sequence number, each with its own
+// lock, so that concurrent requests rarely wait for each other. When a
+// shard is full, arbitrary objects are evicted from it.
+//
+// If it is given a MemoryBudget, it is sized by its share of it instead,
+// with |max_bytes| for weight.
+//
+// This class is thread-safe.
+class JsonEntryCache : public MemoryBudget::Consumer {
+ public:
+  // Keeps up to about |max_bytes| of objects, or none at all if it is 0.
+  explicit JsonEntryCache(size_t max_bytes, MemoryBudget* budget = nullptr);
+  ~JsonEntryCache() override;
+
+  // Returns the object of the entry with |sequence_number|, or NULL if
+  // it is not in the cache.
+  std::shared_ptr<const std::string> Get(int64_t sequence_number) const;
+
+  void Put(int64_t sequence_number,
+           const std::shared_ptr<const std::string>& json);
+
+  // The total size of the objects in the cache.
+  size_t Bytes() const override;
+
+  void SetMaxBytes(size_t max_bytes) override;
+
+  uint64_t Hits() const override {
+    return hits_.load();
+  }
+  uint64_t Misses() const override {
+    return misses_.load();
+  }
+
+ private:
+  struct Shard {
+    std::mutex lock;
+    std::unordered_map<int64_t, std::shared_ptr<const std::string>> json;
+    size_t bytes = 0;
+  };
+
+  static const size_t kNumShards = 16;
+
+  // Evicts arbitrary objects from |shard|, which must be locked, other
+  // than that of the entry with sequence number |keep|, until it holds
+  // no more than |max_bytes|.
+  static void Evict(Shard* shard, size_t max_bytes, int64_t keep = -1);
+
+  MemoryBudget* const budget_;
+  std::atomic<size_t> shard_max_bytes_;
+  mutable std::array<Shard, kNumShards> shards_;
+  mutable std::atomic<uint64_t> hits_;
+  mutable std::atomic<uint64_t> misses_;
+
+  DISALLOW_COPY_AND_ASSIGN(JsonEntryCache);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_JSON_ENTRY_CACHE_H_
@@ -0,0 +1,122 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "server/json_entry_cache.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+
+
+shared_ptr<const string> Json(int64_t sequence_number) {
+  return make_shared<const string>("{\"entry\":" + to_string(sequence_number) +
+                                   "}");
+}
+
+
+TEST(JsonEntryCacheTest, GetAndPut) {
+  JsonEntryCache cache(1 << 20);
+  EXPECT_EQ(nullptr, cache.Get(3));
+
+  cache.Put(3, Json(3));
+  cache.Put(4, Json(4));
+  ASSERT_NE(nullptr, cache.Get(3));
+  EXPECT_EQ(*Json(3), *cache.Get(3));
+  EXPECT_EQ(*Json(4), *cache.Get(4));
+  EXPECT_EQ(nullptr, cache.Get(5));
+  EXPECT_EQ(Json(3)->size() + Json(4)->size(), cache.Bytes());
+
+  // Putting the same entry again changes nothing.
+  cache.Put(3, Json(3));
+  EXPECT_EQ(Json(3)->size() + Json(4)->size(), cache.Bytes());
+}
+
+
+TEST(JsonEntryCacheTest, Bounded) {
+  const size_t kMaxBytes(16 * 100);
+  JsonEntryCache cache(kMaxBytes);
+  for (int64_t i = 0; i < 10000; ++i) {
+    cache.Put(i, Json(i));
+    // The last one is always kept.
+    ASSERT_NE(nullptr, cache.Get(i));
+    EXPECT_LE(cache.Bytes(), kMaxBytes);
+  }
+  EXPECT_LT(kMaxBytes / 2, cache.Bytes());
+}
+
+
+TEST(JsonEntryCacheTest, Disabled) {
+  JsonEntryCache cache(0);
+  cache.Put(1, Json(1));
+  EXPECT_EQ(nullptr, cache.Get(1));
+  EXPECT_EQ(0U, cache.Bytes());
+}
+
+
+TEST(JsonEntryCacheTest, SizedByBudget) {
+  MemoryBudget budget(16 * 100);
+  {
+    // The share of the budget matters, not the size it was given.
+    JsonEntryCache cache(1 << 20, &budget);
+    EXPECT_EQ((std::map<string, size_t>{{"get_entries_json", 16 * 100}}),
+              budget.MaxBytesByName());
+    for (int64_t i = 0; i < 1000; ++i) {
+      cache.Put(i, Json(i));
+    }
+    EXPECT_LE(cache.Bytes(), 16U * 100);
+    EXPECT_EQ(cache.Bytes(), budget.BytesByName()["get_entries_json"]);
+
+    EXPECT_NE(nullptr, cache.Get(999));
+    EXPECT_EQ(nullptr, cache.Get(1000));
+    EXPECT_EQ(1U, budget.HitsByName()["get_entries_json"]);
+    EXPECT_EQ(1U, budget.MissesByName()["get_entries_json"]);
+
+    // It shrinks with the budget.
+    budget.SetMaxBytes(16 * 20);
+    EXPECT_LE(cache.Bytes(), 16U * 20);
+  }
+  EXPECT_TRUE(budget.MaxBytesByName().empty());
+}
+
+
+TEST(JsonEntryCacheTest, Concurrent) {
+  JsonEntryCache cache(1 << 20);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&cache]() {
+      for (int64_t i = 0; i < 1000; ++i) {
+        const shared_ptr<const string> json(cache.Get(i));
+        if (json) {
+          EXPECT_EQ(*Json(i), *json);
+        } else {
+          cache.Put(i, Json(i));
+        }
+      }
+    });
+  }
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+  for (int64_t i = 0; i < 1000; ++i) {
+    ASSERT_NE(nullptr, cache.Get(i));
+  }
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -1,15 +1,27 @@
 #include "server/json_output.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 #include <string>
 
 #include "monitoring/latency.h"
 #include "monitoring/monitoring.h"
-#include "util/json_wrapper.h"
+#include "util/json_writer.h"
 #include "util/libevent_wrapper.h"
 
 using std::string;
 
+DEFINE_int32(immutable_reply_max_age_seconds, 365 * 24 * 60 * 60,
+             "max-age of the Cache-Control header of replies that never "
+             "change, such as entries, proofs at a fixed tree size, and "
+             "tiles. This can be as long as caches allow.");
+
 namespace cert_trans {
 namespace {
 
@@ -25,6 +37,7 @@ static Counter<string, int>* total_http_server_response_codes(
                               "HTTP response code for a given path."));
 
 static const char kJsonContentType[] = "application/json; charset=utf-8";
+static const char kBinaryContentType[] = "application/octet-stream";
 
 
 string LogRequest(evhttp_request* req, int http_status, int resp_body_length) {
@@ -65,34 +78,33 @@ string LogRequest(evhttp_request* req, int http_status, int resp_body_length) {
 }
 
 
-}  // namespace
-
-
-void SendJsonReply(libevent::Base* base, evhttp_request* req, int http_status,
-                   const JsonObject& json) {
-  CHECK_NOTNULL(base);
-  CHECK_NOTNULL(req);
-  CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(req),
-                             "Content-Type", kJsonContentType),
+// Sends the reply, the body of which must already be in the output
+// buffer of |req|.
+void SendReply(libevent::Base* base, evhttp_request* req, int http_status,
+               const char* content_type) {
+  evkeyvalq* const output_headers(evhttp_request_get_output_headers(req));
+  CHECK_EQ(evhttp_add_header(output_headers, "Content-Type", content_type),
            0);
   if (http_status == HTTP_SERVUNAVAIL) {
-    CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(req),
-                               "Retry-After", "10"),
-             0);
+    CHECK_EQ(evhttp_add_header(output_headers, "Retry-After", "10"), 0);
+  }
+  // Errors must not be cached like the reply they replace.
+  if (http_status >= 400) {
+    evhttp_remove_header(output_headers, "Cache-Control");
+    evhttp_remove_header(output_headers, "ETag");
+    evhttp_remove_header(output_headers, "Content-Encoding");
   }
-  const string resp_body(json.ToString());
-  CHECK_GT(evbuffer_add_printf(evhttp_request_get_output_buffer(req), "%s",
-                               resp_body.c_str()),
-           0);
 
-  const string logstr(LogRequest(req, http_status, resp_body.size()));
+  const string logstr(LogRequest(
+      req, http_status,
+      evbuffer_get_length(evhttp_request_get_output_buffer(req))));
   const auto send_reply([req, http_status, logstr]() {
     evhttp_send_reply(req, http_status, /*reason*/ NULL, /*databuf*/ NULL);
 
     VLOG(1) << logstr;
   });
 
-  if (!libevent::Base::OnEventThread()) {
+  if (!base->IsEventThread()) {
     base->Add(send_reply);
   } else {
     send_reply();
@@ -100,13 +112,200 @@ void SendJsonReply(libevent::Base* base, evhttp_request* req, int http_status,
 }
 
 
+void SendReply(libevent::Base* base, evhttp_request* req, int http_status,
+               const char* content_type, const string& resp_body) {
+  CHECK_EQ(evbuffer_add(evhttp_request_get_output_buffer(req),
+                        resp_body.data(), resp_body.size()),
+           0);
+  SendReply(base, req, http_status, content_type);
+}
+
+
+void AddImmutableCacheControl(evhttp_request* req) {
+  CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(req),
+                             "Cache-Control",
+                             ("public, max-age=" +
+                              std::to_string(
+                                  FLAGS_immutable_reply_max_age_seconds) +
+                              ", immutable").c_str()),
+           0);
+}
+
+
+// The FNV-1a hash of the URI of |req|, in hex. The reply to a given URI
+// never changes, so it identifies it: this is enough for that, and is
+// stable across nodes and builds.
+string UriHash(evhttp_request* req) {
+  uint64_t hash(14695981039346656037ULL);
+  for (const char* c = evhttp_request_get_uri(req); *c; ++c) {
+    hash = (hash ^ static_cast<unsigned char>(*c)) * 1099511628211ULL;
+  }
+  char hex[17];
+  snprintf(hex, sizeof(hex), "%016llx", static_cast<unsigned long long>(hash));
+  return hex;
+}
+
+
+string Trim(const string& s) {
+  const size_t first(s.find_first_not_of(" \t"));
+  if (first == string::npos) {
+    return "";
+  }
+  return s.substr(first, s.find_last_not_of(" \t") - first + 1);
+}
+
+
+// Whether the |header| of a request, a list of values with an optional
+// weight each, where a zero weight means that the value is not
+// acceptable (e.g. "gzip;q=0.5, br"), allows |value|. |wildcard| (e.g.
+// "*") counts as any value, unless it is null.
+bool HeaderAllows(const char* header, const string& value,
+                  const char* wildcard) {
+  if (!header) {
+    return false;
+  }
+
+  const string list(header);
+  size_t start(0);
+  while (start < list.size()) {
+    size_t end(list.find(',', start));
+    if (end == string::npos) {
+      end = list.size();
+    }
+    const string element(list.substr(start, end - start));
+    start = end + 1;
+
+    const size_t params(element.find(';'));
+    const string name(Trim(element.substr(0, params)));
+    if (strcasecmp(name.c_str(), value.c_str()) != 0 &&
+        (!wildcard || name != wildcard)) {
+      continue;
+    }
+    if (params == string::npos) {
+      return true;
+    }
+    const string param(Trim(element.substr(params + 1)));
+    if (param.size() < 2 || tolower(param[0]) != 'q' || param[1] != '=') {
+      return true;
+    }
+    return strtod(param.c_str() + 2, nullptr) > 0;
+  }
+  return false;
+}
+
+
+}  // namespace
+
+
+void SendJsonReply(libevent::Base* base, evhttp_request* req, int http_status,
+                   evbuffer* body) {
+  CHECK_NOTNULL(base);
+  CHECK_NOTNULL(req);
+  CHECK_EQ(evbuffer_add_buffer(evhttp_request_get_output_buffer(req),
+                               CHECK_NOTNULL(body)),
+           0);
+  SendReply(base, req, http_status, kJsonContentType);
+}
+
+
 void SendJsonError(libevent::Base* base, evhttp_request* req, int http_status,
                    const string& error_msg) {
-  JsonObject json_reply;
-  json_reply.Add("error_message", error_msg);
-  json_reply.AddBoolean("success", false);
+  CHECK_NOTNULL(base);
+  CHECK_NOTNULL(req);
+  JsonWriter json(evhttp_request_get_output_buffer(req));
+  json.StartObject();
+  json.Add("error_message", error_msg);
+  json.AddBoolean("success", false);
+  json.EndObject();
+
+  SendReply(base, req, http_status, kJsonContentType);
+}
+
+
+bool SendNotModifiedIfMatch(libevent::Base* base, evhttp_request* req,
+                            const string& etag) {
+  CHECK_NOTNULL(base);
+  CHECK_NOTNULL(req);
+  CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(req), "ETag",
+                             etag.c_str()),
+           0);
+
+  // The header may hold a list of ETags.
+  const char* const if_none_match(evhttp_find_header(
+      evhttp_request_get_input_headers(req), "If-None-Match"));
+  if (!if_none_match || !strstr(if_none_match, etag.c_str())) {
+    return false;
+  }
+  SendReply(base, req, HTTP_NOTMODIFIED, kJsonContentType);
+  return true;
+}
+
+
+bool SetImmutableReply(libevent::Base* base, evhttp_request* req) {
+  AddImmutableCacheControl(req);
+  return SendNotModifiedIfMatch(base, req, "\"" + UriHash(req) + "\"");
+}
+
+
+bool SetImmutableReply(libevent::Base* base, evhttp_request* req,
+                       const string& content_encoding) {
+  AddImmutableCacheControl(req);
+  evkeyvalq* const output_headers(evhttp_request_get_output_headers(req));
+  CHECK_EQ(evhttp_add_header(output_headers, "Vary", "Accept-Encoding"), 0);
+  if (content_encoding.empty()) {
+    return SendNotModifiedIfMatch(base, req, "\"" + UriHash(req) + "\"");
+  }
+
+  CHECK_EQ(evhttp_add_header(output_headers, "Content-Encoding",
+                             content_encoding.c_str()),
+           0);
+  // Each encoding of the reply is a representation of its own.
+  return SendNotModifiedIfMatch(
+      base, req, "\"" + UriHash(req) + "-" + content_encoding + "\"");
+}
+
+
+bool AcceptsEncoding(evhttp_request* req, const string& content_encoding) {
+  return HeaderAllows(evhttp_find_header(evhttp_request_get_input_headers(req),
+                                         "Accept-Encoding"),
+                      content_encoding, "*");
+}
+
 
-  SendJsonReply(base, req, http_status, json_reply);
+bool WantsBinaryReply(evhttp_request* req) {
+  CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(req), "Vary",
+                             "Accept"),
+           0);
+  // Not "*/*", which most clients send whatever they expect.
+  return HeaderAllows(evhttp_find_header(evhttp_request_get_input_headers(req),
+                                         "Accept"),
+                      kBinaryContentType, nullptr);
+}
+
+
+bool SetImmutableBinaryReply(libevent::Base* base, evhttp_request* req) {
+  AddImmutableCacheControl(req);
+  return SendNotModifiedIfMatch(base, req,
+                                "\"" + UriHash(req) + "-binary\"");
+}
+
+
+void SendBinaryReply(libevent::Base* base, evhttp_request* req,
+                     int http_status, evbuffer* body) {
+  CHECK_NOTNULL(base);
+  CHECK_NOTNULL(req);
+  CHECK_EQ(evbuffer_add_buffer(evhttp_request_get_output_buffer(req),
+                               CHECK_NOTNULL(body)),
+           0);
+  SendReply(base, req, http_status, kBinaryContentType);
+}
+
+
+void SendBinaryReply(libevent::Base* base, evhttp_request* req,
+                     int http_status, const string& body) {
+  CHECK_NOTNULL(base);
+  CHECK_NOTNULL(req);
+  SendReply(base, req, http_status, kBinaryContentType, body);
 }
 
 
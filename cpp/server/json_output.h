@@ -3,8 +3,8 @@
 
 #include <string>
 
+struct evbuffer;
 struct evhttp_request;
-class JsonObject;
 
 namespace cert_trans {
 namespace libevent {
@@ -12,14 +12,64 @@ class Base;
 }  // namespace libevent
 
 
+// Sends the JSON in |body|, as written by a JsonWriter for example, the
+// contents of which are moved to the reply without being copied, so
+// that they may be references to memory owned by someone else (see
+// evbuffer_add_reference()).
 void SendJsonReply(libevent::Base* base, evhttp_request* req, int http_status,
-                   const JsonObject& json);
+                   evbuffer* body);
 
 
 void SendJsonError(libevent::Base* base, evhttp_request* req, int http_status,
                    const std::string& error_msg);
 
 
+// Sets the ETag of the reply to |req| to |etag| (including its quotes),
+// and sends an empty 304 (Not Modified) reply if the If-None-Match header
+// of |req| shows that the client already has it. Returns whether it did,
+// in which case no other reply must be sent.
+bool SendNotModifiedIfMatch(libevent::Base* base, evhttp_request* req,
+                            const std::string& etag);
+
+
+// For replies that never change: lets them be cached for
+// --immutable_reply_max_age_seconds, with an ETag derived from the
+// request URI, and sends a 304 like SendNotModifiedIfMatch() when the
+// client already has the reply. The caching headers are dropped again
+// if an error reply is sent instead.
+bool SetImmutableReply(libevent::Base* base, evhttp_request* req);
+
+// As above, for a reply which is sent in |content_encoding| (e.g. "gzip"),
+// or without any if it is empty, depending on the Accept-Encoding of the
+// request. Sets the Content-Encoding and Vary headers, and an ETag of its
+// own for each encoding.
+bool SetImmutableReply(libevent::Base* base, evhttp_request* req,
+                       const std::string& content_encoding);
+
+// Whether the Accept-Encoding header of |req| allows replies in
+// |content_encoding| (e.g. "gzip").
+bool AcceptsEncoding(evhttp_request* req, const std::string& content_encoding);
+
+// Whether |req| asks for the binary form of the reply of its endpoint
+// rather than JSON, by listing "application/octet-stream" in its Accept
+// header (wildcards do not count). Sets the Vary header of the reply,
+// which depends on it either way.
+bool WantsBinaryReply(evhttp_request* req);
+
+// Like SetImmutableReply(), for the binary form of a reply (see
+// WantsBinaryReply()), which has an ETag of its own.
+bool SetImmutableBinaryReply(libevent::Base* base, evhttp_request* req);
+
+
+// Sends |body| as is, with an "application/octet-stream" content type.
+void SendBinaryReply(libevent::Base* base, evhttp_request* req,
+                     int http_status, const std::string& body);
+// As above, moving the contents of |body| to the reply like
+// SendJsonReply().
+void SendBinaryReply(libevent::Base* base, evhttp_request* req,
+                     int http_status, evbuffer* body);
+
+
 }  // namespace cert_trans
 
 
@@ -12,10 +12,30 @@ DEFINE_int32(tree_signing_frequency_seconds, 600,
              "the signer process will kick off if in the beginning of the "
              "server select loop, at least this period has elapsed since the "
              "last signing. Set this well below the MMD to ensure we sign in "
-             "a timely manner. Must be greater than 0.");
+             "a timely manner. Must be greater than 0. The signer will sign "
+             "at least this often, even if the tree has not grown.");
+DEFINE_int32(tree_signing_batch_size, 0,
+             "If greater than 0, sign a new tree head as soon as at least "
+             "this many entries have been added to the tree since the last "
+             "one, rather than waiting for --tree_signing_frequency_seconds.");
+DEFINE_int32(tree_signing_max_delay_ms, 0,
+             "If greater than 0, sign a new tree head once an entry has "
+             "been waiting in the tree for this long without being covered "
+             "by one, rather than waiting for "
+             "--tree_signing_frequency_seconds.");
+DEFINE_int32(tree_signing_check_interval_ms, 100,
+             "How often the signer checks whether --tree_signing_batch_size "
+             "or --tree_signing_max_delay_ms call for a new tree head. "
+             "Entries added in between are coalesced into a single tree "
+             "head. Must be greater than 0.");
 DEFINE_int32(sequencing_frequency_seconds, 10,
              "How often should new entries be sequenced. The sequencing runs "
              "in parallel with the tree signing and cleanup.");
+DEFINE_int32(tree_integration_frequency_seconds, 1,
+             "How often should newly sequenced entries in the local database "
+             "be hashed into the in-memory tree. This runs in parallel with "
+             "the sequencing and tree signing, so that the signer only has "
+             "to sign the tree heads.");
 DEFINE_int32(cleanup_frequency_seconds, 10,
              "How often should new entries be cleanedup. The cleanup runs in "
              "in parallel with the tree signing and sequencing.");
@@ -44,6 +64,10 @@ Latency<milliseconds> sequencer_sequence_latency_ms(
     "sequencer_sequence_latency_ms",
     "Total time spent sequencing entries by sequencer");
 
+Latency<milliseconds> integrator_run_latency_ms(
+    "integrator_run_latency_ms",
+    "Total time spent hashing new entries into the tree");
+
 Counter<bool>* signer_total_runs =
     Counter<bool>::New("signer_total_runs", "successful",
                        "Total number of signer runs broken out by success.");
@@ -62,6 +86,29 @@ static bool ValidateIsPositive(const char* flagname, int value) {
 static const bool sign_dummy =
     RegisterFlagValidator(&FLAGS_tree_signing_frequency_seconds,
                           &ValidateIsPositive);
+
+static const bool check_dummy =
+    RegisterFlagValidator(&FLAGS_tree_signing_check_interval_ms,
+                          &ValidateIsPositive);
+
+
+// Whether the signer should sign a new tree head before the regular
+// --tree_signing_frequency_seconds period is up, given how many entries have
+// been added to the tree since the last one, and since when.
+bool ShouldSignEarly(int64_t num_unsigned,
+                     const steady_clock::time_point& unsigned_since) {
+  if (num_unsigned == 0) {
+    return false;
+  }
+  if (FLAGS_tree_signing_batch_size > 0 &&
+      num_unsigned >= FLAGS_tree_signing_batch_size) {
+    return true;
+  }
+  return FLAGS_tree_signing_max_delay_ms > 0 &&
+         steady_clock::now() - unsigned_since >=
+             milliseconds(FLAGS_tree_signing_max_delay_ms);
+}
+
 }
 
 namespace cert_trans {
@@ -74,10 +121,30 @@ void SignMerkleTree(TreeSigner<LoggedEntry>* tree_signer,
   CHECK_NOTNULL(controller);
   const steady_clock::duration period(
       (seconds(FLAGS_tree_signing_frequency_seconds)));
+  const bool adaptive(FLAGS_tree_signing_batch_size > 0 ||
+                      FLAGS_tree_signing_max_delay_ms > 0);
+  const steady_clock::duration check_interval(
+      adaptive ? steady_clock::duration(
+                     milliseconds(FLAGS_tree_signing_check_interval_ms))
+               : period);
   steady_clock::time_point target_run_time(steady_clock::now());
+  // When the oldest entry not covered by the latest tree head was noticed.
+  steady_clock::time_point unsigned_since;
+  bool have_unsigned(false);
 
   while (true) {
-    {
+    int64_t num_unsigned(0);
+    if (adaptive) {
+      tree_signer->IntegrateNewEntries();
+      num_unsigned = tree_signer->NumUnsignedEntries();
+      if (num_unsigned > 0 && !have_unsigned) {
+        unsigned_since = steady_clock::now();
+        have_unsigned = true;
+      }
+    }
+
+    if (steady_clock::now() >= target_run_time ||
+        ShouldSignEarly(num_unsigned, unsigned_since)) {
       ScopedLatency signer_run_latency(
           signer_run_latency_ms.GetScopedLatency());
       const TreeSigner<LoggedEntry>::UpdateResult result(
@@ -88,6 +155,7 @@ void SignMerkleTree(TreeSigner<LoggedEntry>* tree_signer,
           latest_local_tree_size_gauge->Set(latest_sth.tree_size());
           controller->NewTreeHead(latest_sth);
           signer_total_runs->Increment(true /* successful */);
+          have_unsigned = false;
           break;
         }
         case TreeSigner<LoggedEntry>::INSUFFICIENT_DATA:
@@ -98,12 +166,36 @@ void SignMerkleTree(TreeSigner<LoggedEntry>* tree_signer,
         default:
           LOG(FATAL) << "Error updating tree: " << result;
       }
+
+      // The regular signing period restarts from the latest signing.
+      target_run_time = steady_clock::now() + period;
+    }
+
+    const steady_clock::time_point now(steady_clock::now());
+    std::this_thread::sleep_for(
+        std::min(target_run_time - now, check_interval));
+  }
+}
+
+void IntegrateEntries(TreeSigner<LoggedEntry>* tree_signer) {
+  CHECK_NOTNULL(tree_signer);
+  const steady_clock::duration period(
+      (seconds(FLAGS_tree_integration_frequency_seconds)));
+  steady_clock::time_point target_run_time(steady_clock::now());
+
+  while (true) {
+    {
+      const ScopedLatency integrator_run_latency(
+          integrator_run_latency_ms.GetScopedLatency());
+      const int64_t num_integrated(tree_signer->IntegrateNewEntries());
+      VLOG(1) << "Hashed " << num_integrated << " new entries into the tree.";
     }
 
     const steady_clock::time_point now(steady_clock::now());
     while (target_run_time <= now) {
       target_run_time += period;
     }
+
     std::this_thread::sleep_for(target_run_time - now);
   }
 }
@@ -18,6 +18,10 @@ void CleanUpEntries(ConsistentStore<LoggedEntry>* store,
 void SequenceEntries(TreeSigner<LoggedEntry>* tree_signer,
                      const std::function<bool()>& is_master);
 
+// Hashes newly sequenced entries from the local database into the tree, so
+// that SignMerkleTree() has as little work as possible left to do.
+void IntegrateEntries(TreeSigner<LoggedEntry>* tree_signer);
+
 void SignMerkleTree(TreeSigner<LoggedEntry>* tree_signer,
                     ConsistentStore<LoggedEntry>* store,
                     ClusterStateController<LoggedEntry>* controller);
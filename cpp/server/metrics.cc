@@ -3,12 +3,16 @@
 #include <event2/buffer.h>
 #include <event2/http.h>
 #include <cstring>
+#include <memory>
 #include <sstream>
 
 #include "monitoring/prometheus/exporter.h"
+#include "monitoring/trace.h"
 
 using std::ostringstream;
+using std::string;
 using std::strncmp;
+using std::unique_ptr;
 
 namespace cert_trans {
 namespace {
@@ -18,6 +22,12 @@ const char kPrometheusProtoContentType[] =
     "proto=io.prometheus.client.MetricFamily;encoding=delimited";
 const size_t kPrometheusProtoContentTypeLen =
     std::strlen(kPrometheusProtoContentType);
+const char kPrometheusTextContentType[] = "text/plain; version=0.0.4";
+
+
+void DeleteString(const void* /*data*/, size_t /*len*/, void* str) {
+  delete static_cast<string*>(str);
+}
 
 }  // namespace
 
@@ -28,9 +38,27 @@ void ExportPrometheusMetrics(evhttp_request* req) {
                       /*databuf*/ nullptr);
     return;
   }
-  ostringstream oss;
   const char* req_accept(
       evhttp_find_header(evhttp_request_get_input_headers(req), "Accept"));
+  // Prometheus asks for the text format among others, browsers do not.
+  if (req_accept && std::strstr(req_accept, "text/plain") &&
+      std::strncmp(req_accept, kPrometheusProtoContentType,
+                   kPrometheusProtoContentTypeLen) != 0) {
+    evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
+                      kPrometheusTextContentType);
+    // Handed over to the output buffer as is, rather than copied.
+    unique_ptr<string> text(new string);
+    ExportMetricsToPrometheusText(text.get());
+    if (evbuffer_add_reference(evhttp_request_get_output_buffer(req),
+                               text->data(), text->size(), DeleteString,
+                               text.get()) == 0) {
+      text.release();
+    }
+    evhttp_send_reply(req, HTTP_OK, /*reason*/ nullptr, /*databuf*/ nullptr);
+    return;
+  }
+
+  ostringstream oss;
   if (req_accept &&
       std::strncmp(req_accept, kPrometheusProtoContentType,
                    kPrometheusProtoContentTypeLen) == 0) {
@@ -49,4 +77,21 @@ void ExportPrometheusMetrics(evhttp_request* req) {
 }
 
 
+void ExportTraces(evhttp_request* req) {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    evhttp_send_reply(req, HTTP_BADMETHOD, /*reason*/ nullptr,
+                      /*databuf*/ nullptr);
+    return;
+  }
+  ostringstream oss;
+  ExportSampledTraces(&oss);
+
+  evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
+                    "text/plain");
+  evbuffer_add(evhttp_request_get_output_buffer(req), oss.str().data(),
+               oss.str().size());
+  evhttp_send_reply(req, HTTP_OK, /*reason*/ nullptr, /*databuf*/ nullptr);
+}
+
+
 }  // namespace cert_trans
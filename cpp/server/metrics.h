@@ -8,6 +8,9 @@ namespace cert_trans {
 
 void ExportPrometheusMetrics(evhttp_request* req);
 
+// Replies with the latest sampled traces of requests, as text.
+void ExportTraces(evhttp_request* req);
+
 
 }  // namespace cert_trans
 
@@ -0,0 +1,193 @@
+#include "config.h"
+
+#include "server/profile_handler.h"
+
+#include <event2/buffer.h>
+#include <event2/http.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <openssl/crypto.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <sstream>
+#include <string>
+
+#ifdef HAVE_GPERFTOOLS_PROFILER_H
+#include <gperftools/profiler.h>
+#endif
+#ifdef HAVE_GPERFTOOLS_MALLOC_EXTENSION_H
+#include <gperftools/malloc_extension.h>
+#endif
+
+#include "util/libevent_wrapper.h"
+#include "util/task.h"
+
+using std::atomic;
+using std::bind;
+using std::chrono::seconds;
+using std::ifstream;
+using std::ostringstream;
+using std::placeholders::_1;
+using std::string;
+
+DEFINE_string(debug_profile_token, "",
+              "if set, serve CPU profiles and heap samples under "
+              "/debug/pprof/ to requests with this secret, as in "
+              "\"Authorization: Bearer <token>\"");
+DEFINE_int32(debug_profile_max_seconds, 300,
+             "longest CPU profile that can be asked for, in seconds");
+
+namespace cert_trans {
+namespace {
+
+
+const char kBearerPrefix[] = "Bearer ";
+const int kDefaultProfileSeconds = 30;
+
+// The CPU profiler is for the whole process, so only one profile can
+// be taken at a time.
+atomic<bool> profiling(false);
+
+
+void SendText(evhttp_request* req, int code, const string& text) {
+  evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
+                    "text/plain");
+  evbuffer_add(evhttp_request_get_output_buffer(req), text.data(),
+               text.size());
+  evhttp_send_reply(req, code, /*reason*/ nullptr, /*databuf*/ nullptr);
+}
+
+
+void SendProfile(evhttp_request* req, const string& profile) {
+  evhttp_add_header(evhttp_request_get_output_headers(req), "Content-Type",
+                    "application/octet-stream");
+  evbuffer_add(evhttp_request_get_output_buffer(req), profile.data(),
+               profile.size());
+  evhttp_send_reply(req, HTTP_OK, /*reason*/ nullptr, /*databuf*/ nullptr);
+}
+
+
+// Whether |req| is a GET with the right token, replying to it with an
+// error if not.
+bool CheckRequest(evhttp_request* req) {
+  if (evhttp_request_get_command(req) != EVHTTP_REQ_GET) {
+    evhttp_send_reply(req, HTTP_BADMETHOD, /*reason*/ nullptr,
+                      /*databuf*/ nullptr);
+    return false;
+  }
+  const char* const authorization(evhttp_find_header(
+      evhttp_request_get_input_headers(req), "Authorization"));
+  const size_t prefix_len(sizeof(kBearerPrefix) - 1);
+  const string& token(FLAGS_debug_profile_token);
+  // Compared in constant time, so as not to give the token away.
+  if (!authorization ||
+      strncmp(authorization, kBearerPrefix, prefix_len) != 0 ||
+      strlen(authorization + prefix_len) != token.size() ||
+      CRYPTO_memcmp(authorization + prefix_len, token.data(),
+                    token.size()) != 0) {
+    LOG(WARNING) << "unauthorized request for a profile";
+    SendText(req, 403, "Forbidden\n");
+    return false;
+  }
+  return true;
+}
+
+
+#ifdef HAVE_GPERFTOOLS_PROFILER_H
+void FinishCpuProfile(evhttp_request* req, const string& path,
+                      util::Task* task) {
+  ProfilerStop();
+  profiling.store(false);
+  delete task;
+
+  ostringstream profile;
+  {
+    ifstream in(path.c_str(), std::ios::binary);
+    profile << in.rdbuf();
+  }
+  PCHECK(unlink(path.c_str()) == 0) << "unlink " << path;
+  LOG(INFO) << "finished CPU profile of " << profile.str().size()
+            << " bytes";
+  SendProfile(req, profile.str());
+}
+#endif
+
+
+void ServeCpuProfile(libevent::Base* base, evhttp_request* req) {
+  if (!CheckRequest(req)) {
+    return;
+  }
+#ifdef HAVE_GPERFTOOLS_PROFILER_H
+  const libevent::QueryParams query(libevent::ParseQuery(req));
+  int64_t secs(kDefaultProfileSeconds);
+  string secs_param;
+  if (libevent::GetParam(query, "seconds", &secs_param)) {
+    secs = libevent::GetIntParam(query, "seconds");
+  }
+  if (secs <= 0 || secs > FLAGS_debug_profile_max_seconds) {
+    SendText(req, HTTP_BADREQUEST, "Missing or invalid \"seconds\".\n");
+    return;
+  }
+
+  if (profiling.exchange(true)) {
+    SendText(req, HTTP_SERVUNAVAIL, "Already profiling.\n");
+    return;
+  }
+  char path[] = "/tmp/ct-cpu-profile-XXXXXX";
+  const int fd(mkstemp(path));
+  PCHECK(fd >= 0) << "mkstemp";
+  PCHECK(close(fd) == 0);
+  if (!ProfilerStart(path)) {
+    profiling.store(false);
+    PCHECK(unlink(path) == 0) << "unlink " << path;
+    SendText(req, HTTP_INTERNAL, "The profiler failed to start.\n");
+    return;
+  }
+  LOG(INFO) << "starting a CPU profile for " << secs << " seconds";
+
+  // The done callback runs on |base|, where |req| can be replied to.
+  base->Delay(seconds(secs),
+              new util::Task(bind(FinishCpuProfile, req, string(path), _1),
+                             base));
+#else
+  SendText(req, HTTP_NOTIMPLEMENTED,
+           "Built without the gperftools CPU profiler.\n");
+#endif
+}
+
+
+void ServeHeapProfile(evhttp_request* req) {
+  if (!CheckRequest(req)) {
+    return;
+  }
+#ifdef HAVE_GPERFTOOLS_MALLOC_EXTENSION_H
+  string sample;
+  MallocExtension::instance()->GetHeapSample(&sample);
+  SendProfile(req, sample);
+#else
+  SendText(req, HTTP_NOTIMPLEMENTED, "Built without tcmalloc.\n");
+#endif
+}
+
+
+}  // namespace
+
+
+void AddProfileHandlers(libevent::Base* base, libevent::HttpServer* server) {
+  CHECK_NOTNULL(base);
+  CHECK_NOTNULL(server);
+  if (FLAGS_debug_profile_token.empty()) {
+    return;
+  }
+  CHECK(server->AddHandler("/debug/pprof/profile",
+                           bind(ServeCpuProfile, base, _1)));
+  CHECK(server->AddHandler("/debug/pprof/heap", ServeHeapProfile));
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,31 @@
+#ifndef CERT_TRANS_SERVER_PROFILE_HANDLER_H_
+#define CERT_TRANS_SERVER_PROFILE_HANDLER_H_
+
+namespace libevent {
+class Base;
+class HttpServer;
+}  // namespace libevent
+
+namespace cert_trans {
+
+
+// Adds handlers to |server|, whose requests are answered on |base|,
+// serving profiles of the running process in the format of gperftools'
+// pprof:
+//
+//   /debug/pprof/profile?seconds=N  profiles the CPU for N seconds (30
+//                                   by default), then replies with it.
+//   /debug/pprof/heap               replies with a sample of the heap,
+//                                   if tcmalloc runs with
+//                                   TCMALLOC_SAMPLE_PARAMETER set.
+//
+// Requests must carry the secret of --debug_profile_token, as in
+// "Authorization: Bearer <token>". Nothing is added if the flag is not
+// set, nor are profiles supported in binaries built without gperftools,
+// which reply with 501 instead.
+void AddProfileHandlers(libevent::Base* base, libevent::HttpServer* server);
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_PROFILE_HANDLER_H_
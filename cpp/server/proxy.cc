@@ -4,8 +4,13 @@
 #include <event2/http.h>
 #include <event2/http_compat.h>
 #include <event2/keyvalq_struct.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
 #include <unordered_set>
 #include <vector>
@@ -13,24 +18,56 @@
 #include "monitoring/monitoring.h"
 #include "proto/ct.pb.h"
 #include "server/json_output.h"
+#include "util/hedging.h"
 #include "util/libevent_wrapper.h"
+#include "util/task.h"
 
 
 using ct::ClusterNodeState;
 using std::bind;
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::function;
 using std::getline;
+using std::lock_guard;
 using std::make_pair;
+using std::map;
+using std::max;
+using std::milli;
+using std::mutex;
 using std::pair;
 using std::placeholders::_1;
 using std::rand;
+using std::shared_ptr;
 using std::string;
 using std::stringstream;
+using std::unique_lock;
 using std::unique_ptr;
 using std::unordered_set;
 using std::vector;
 using util::Executor;
+using util::Status;
 using util::Task;
 
+DEFINE_bool(proxy_stream_responses, true,
+            "pass the body of proxied responses on as it arrives, rather "
+            "than once it is complete");
+DEFINE_bool(proxy_pick_least_loaded, true,
+            "send each proxied request to the less loaded of two fresh "
+            "nodes picked at random, rather than to any fresh node");
+DEFINE_double(proxy_hedge_fraction, 0.05,
+              "largest fraction of the proxied GET requests which are also "
+              "sent to a second node, when the first one has not answered "
+              "in the time 95% of its latest requests took, the first "
+              "response to come being passed on; only with "
+              "--proxy_stream_responses, 0 disables hedging");
+DEFINE_int32(proxy_request_deadline_seconds, 30,
+             "number of seconds after which to give up on a proxied "
+             "request, whose client has likely given up on it too; 0 for "
+             "no deadline");
+
 namespace cert_trans {
 namespace {
 
@@ -42,14 +79,43 @@ static Counter<string, int>* total_proxied_responses(
     Counter<string, int>::New("total_proxied_responses", "path", "status_code",
                               "Number of proxied API requests by path "
                               "and status code."));
+static Counter<string>* total_hedged_proxied_requests(
+    Counter<string>::New("total_hedged_proxied_requests", "outcome",
+                         "Number of proxied requests also sent to a "
+                         "second node because the first one was slow "
+                         "(\"sent\"), and of those which the second "
+                         "node answered first (\"won\")."));
+static Counter<string>* total_cancelled_proxied_requests(
+    Counter<string>::New("total_cancelled_proxied_requests", "reason",
+                         "Number of proxied requests cancelled before "
+                         "their response was complete, because the client "
+                         "went away (\"client_closed\") or the other "
+                         "node of a hedged request answered first "
+                         "(\"hedge_lost\")."));
+
+// Weight of each new sample in the moving average of the latency of a
+// node.
+const double kLatencyWeight = 0.2;
+// Latency counted for a failed request, at least, so that a node
+// failing quickly does not draw more requests.
+const double kFailedLatencyMs = 1000;
+// Number of latest requests to each node whose latencies are kept, and
+// how many are needed to decide when to hedge.
+const size_t kLatencyWindowSize = 100;
+const size_t kMinHedgeSamples = 20;
+const double kHedgeQuantile = 0.95;
+// Largest number of requests hedged in a row.
+const double kHedgeBurst = 5;
 
 
 void ProxyRequestDone(libevent::Base* base, evhttp_request* request,
-                      const string& path, UrlFetcher::Response* response,
-                      Task* task) {
+                      const string& path,
+                      const function<void(const Status&)>& done,
+                      UrlFetcher::Response* response, Task* task) {
   CHECK_NOTNULL(request);
   CHECK_NOTNULL(task);
   unique_ptr<UrlFetcher::Response> response_deleter(CHECK_NOTNULL(response));
+  done(task->status());
 
   total_proxied_requests->Increment(path);
   total_proxied_responses->Increment(path, response->status_code);
@@ -80,9 +146,390 @@ void ProxyRequestDone(libevent::Base* base, evhttp_request* request,
 }
 
 
+// State of a proxied response being streamed back to its client, only
+// used on the event thread of the server.
+struct ProxyStream {
+  libevent::Base* const base;
+  evhttp_request* const req;
+  const string path;
+  // The parent of the upstream fetches, cancelled if the client goes
+  // away, and returned once the reply is finished.
+  Task* const fetches;
+  // The upstream response, of which only the status code and headers
+  // are filled in.
+  UrlFetcher::Response response;
+  // Whether the reply has been started.
+  bool started;
+  // Whether the client went away.
+  bool closed;
+};
+
+
+ProxyStream* NewProxyStream(libevent::Base* base, evhttp_request* req,
+                            const string& path, Executor* executor) {
+  return new ProxyStream{base, req, path,
+                         new Task([](Task* task) { delete task; }, executor),
+                         UrlFetcher::Response(), false, false};
+}
+
+
+void OnProxyConnectionClosed(evhttp_connection*, void* arg) {
+  ProxyStream* const stream(static_cast<ProxyStream*>(arg));
+  stream->closed = true;
+  // Nobody is left to take the rest of the response.
+  total_cancelled_proxied_requests->Increment("client_closed");
+  stream->fetches->Cancel();
+}
+
+
+void StartProxyReply(ProxyStream* stream, int status_code,
+                     UrlFetcher::Headers headers) {
+  if (stream->closed) {
+    return;
+  }
+  FilterHeaders(&headers);
+  // The body is sent in chunks, whatever its original framing was.
+  headers.erase("Content-Length");
+  headers.erase("Transfer-Encoding");
+  for (const auto& header : headers) {
+    CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(stream->req),
+                               header.first.c_str(), header.second.c_str()),
+             0);
+  }
+  evhttp_send_reply_start(stream->req, status_code, /*reason*/ NULL);
+  stream->started = true;
+}
+
+
+void SendProxyChunk(ProxyStream* stream, const shared_ptr<evbuffer>& chunk) {
+  if (stream->started && !stream->closed) {
+    evhttp_send_reply_chunk(stream->req, chunk.get());
+  }
+}
+
+
+void FinishProxyReply(ProxyStream* stream, bool ok) {
+  unique_ptr<ProxyStream> stream_deleter(stream);
+  // Cancels what is left of a hedged request.
+  stream->fetches->Return();
+  total_proxied_requests->Increment(stream->path);
+  total_proxied_responses->Increment(stream->path,
+                                     stream->response.status_code);
+  evhttp_request* const req(stream->req);
+  if (!stream->closed) {
+    evhttp_connection_set_closecb(evhttp_request_get_connection(req), NULL,
+                                  NULL);
+  }
+
+  if (stream->started || stream->closed) {
+    // A failure half way through just makes for a truncated response.
+    // With the connection closed, this only frees the request.
+    evhttp_send_reply_end(req);
+  } else if (!ok) {
+    SendJsonError(stream->base, req, HTTP_INTERNAL, "Proxied request failed.");
+  } else {
+    // No body came, and so no chunk to start the reply.
+    StartProxyReply(stream, stream->response.status_code,
+                    stream->response.headers);
+    evhttp_send_reply_end(req);
+  }
+}
+
+
+void ProxyStreamDone(ProxyStream* stream,
+                     const function<void(const Status&)>& done, Task* task) {
+  done(task->status());
+  stream->base->Add(bind(&FinishProxyReply, stream, task->status().ok()));
+}
+
+
+// A streamed proxied request, which can be sent to a second node if the
+// first one is slow. The first upstream response to have its headers,
+// or to complete, is passed on, and the other one is cancelled.
+struct HedgedProxyStream {
+  explicit HedgedProxyStream(ProxyStream* stream)
+      : stream(CHECK_NOTNULL(stream)), winner(-1) {
+    in_flight[0] = in_flight[1] = false;
+    fetches[0] = fetches[1] = nullptr;
+  }
+
+  // Deleted on the event thread of the server once the winner is done,
+  // and not to be used after that.
+  ProxyStream* const stream;
+  mutex lock;
+  // The index of the response passed on, or -1 until there is one.
+  int winner;
+  UrlFetcher::Response responses[2];
+  bool in_flight[2];
+  // The fetch of each response while it is in flight, which is only
+  // deleted after that.
+  Task* fetches[2];
+};
+
+
+// Picks the response with |index| of |hedged| to be passed on, unless
+// another one was picked already. Returns whether it is the one.
+bool PickHedgedResponse(const unique_lock<mutex>& lock,
+                        HedgedProxyStream* hedged, int index) {
+  CHECK(lock.owns_lock());
+  if (hedged->winner < 0) {
+    hedged->winner = index;
+    if (index > 0) {
+      total_hedged_proxied_requests->Increment("won");
+    }
+    // Cancelling only schedules the abandonment of the fetch, whose done
+    // callback then waits for the lock.
+    if (hedged->in_flight[1 - index]) {
+      total_cancelled_proxied_requests->Increment("hedge_lost");
+      hedged->fetches[1 - index]->Cancel();
+    }
+  }
+  return hedged->winner == index;
+}
+
+
+void HedgedProxyStreamDone(const shared_ptr<HedgedProxyStream>& hedged,
+                           int index,
+                           const function<void(const Status&)>& done,
+                           Task* task) {
+  const bool ok(task->status().ok());
+  done(task->status());
+
+  ProxyStream* stream(nullptr);
+  {
+    unique_lock<mutex> lock(hedged->lock);
+    hedged->in_flight[index] = false;
+    hedged->fetches[index] = nullptr;
+    // A failure before the headers is only passed on if the other request
+    // cannot do better.
+    if (hedged->winner == index ||
+        ((ok || !hedged->in_flight[1 - index]) &&
+         PickHedgedResponse(lock, hedged.get(), index))) {
+      stream = hedged->stream;
+      stream->response.status_code = hedged->responses[index].status_code;
+      stream->response.headers = hedged->responses[index].headers;
+    }
+  }
+  if (stream) {
+    stream->base->Add(bind(&FinishProxyReply, stream, ok));
+  }
+}
+
+
+// Sends |fetcher_req| for the response with |index| of |hedged|.
+void SendHedgedProxyStream(const shared_ptr<HedgedProxyStream>& hedged,
+                           int index, const UrlFetcher::Request& fetcher_req,
+                           UrlFetcher* fetcher,
+                           const function<void(const Status&)>& done) {
+  // The callbacks of the response do not hold on to |hedged|, which
+  // holds them, but the done callback of the request does.
+  HedgedProxyStream* const raw(hedged.get());
+  UrlFetcher::Response* const resp(&raw->responses[index]);
+  resp->on_headers = [raw, index, resp]() {
+    unique_lock<mutex> lock(raw->lock);
+    if (PickHedgedResponse(lock, raw, index)) {
+      raw->stream->base->Add(bind(&StartProxyReply, raw->stream,
+                                  resp->status_code, resp->headers));
+    }
+  };
+  resp->on_body = [raw, index](evbuffer* data) {
+    const shared_ptr<evbuffer> chunk(CHECK_NOTNULL(evbuffer_new()),
+                                     &evbuffer_free);
+    CHECK_EQ(evbuffer_add_buffer(chunk.get(), data), 0);
+    lock_guard<mutex> lock(raw->lock);
+    if (raw->winner == index) {
+      raw->stream->base->Add(bind(&SendProxyChunk, raw->stream, chunk));
+    }
+  };
+  Task* fetch;
+  {
+    // Until there is a winner, the reply is not finished, and so
+    // |stream->fetches| can still take children.
+    lock_guard<mutex> lock(raw->lock);
+    if (raw->winner >= 0) {
+      done(Status::CANCELLED);
+      return;
+    }
+    raw->in_flight[index] = true;
+    fetch = raw->stream->fetches->AddChild(
+        bind(&HedgedProxyStreamDone, hedged, index, done, _1));
+    raw->fetches[index] = fetch;
+  }
+  fetcher->Fetch(fetcher_req, resp, fetch);
+}
+
+
 }  // namespace
 
 
+// Keeps track of the requests a Proxy sends to each node, and of how
+// quickly they come back, to pick where the next one should go.
+class Proxy::NodeLoads {
+ public:
+  NodeLoads() : hedge_budget_(FLAGS_proxy_hedge_fraction, kHedgeBurst) {
+  }
+
+  // Returns the index in |nodes|, which must not be empty, of the node
+  // to send the next request to. That request counts as outstanding on
+  // it until Done() is called.
+  size_t Pick(const vector<ClusterNodeState>& nodes);
+
+  // Records that the request sent to |node_id| at |start| is done with
+  // |status|. A cancelled one says nothing of how the node is doing.
+  void Done(const string& node_id, steady_clock::time_point start,
+            const Status& status);
+
+  // Counts a request to |node_id| which could be hedged, and sets
+  // |*delay| to how long to wait for it before doing so. Returns false
+  // if it is not to be hedged.
+  bool HedgeDelay(const string& node_id, duration<double>* delay);
+
+  // Returns the index in |nodes| of a node other than the one with index
+  // |excluded| to send a hedged request to, which counts as outstanding
+  // on it until Done() is called, or -1 if the budget does not allow it.
+  int PickHedge(const vector<ClusterNodeState>& nodes, size_t excluded);
+
+ private:
+  struct Load {
+    Load()
+        : outstanding(0), latency_ms(0), latencies(kLatencyWindowSize) {
+    }
+
+    int outstanding;
+    // Moving average of the time its requests took, zero until one is
+    // done.
+    double latency_ms;
+    // The latest ones which succeeded, to tell when to hedge.
+    LatencyWindow latencies;
+  };
+
+  // Whether |a| looks like a better node to send a request to than |b|.
+  bool Better(const unique_lock<mutex>& lock, const ClusterNodeState& a,
+              const ClusterNodeState& b);
+
+  mutex lock_;
+  map<string, Load> loads_;
+  HedgeBudget hedge_budget_;
+
+  DISALLOW_COPY_AND_ASSIGN(NodeLoads);
+};
+
+
+size_t Proxy::NodeLoads::Pick(const vector<ClusterNodeState>& nodes) {
+  CHECK(!nodes.empty());
+  unique_lock<mutex> lock(lock_);
+  size_t pick(rand() % nodes.size());
+  if (FLAGS_proxy_pick_least_loaded && nodes.size() > 1) {
+    // Comparing just two random nodes ("power of two choices") avoids
+    // the busiest ones, without every proxy piling onto whichever node
+    // looked the least loaded last.
+    size_t other(rand() % (nodes.size() - 1));
+    if (other >= pick) {
+      ++other;
+    }
+    if (Better(lock, nodes[other], nodes[pick])) {
+      pick = other;
+    }
+  }
+  ++loads_[nodes[pick].node_id()].outstanding;
+  return pick;
+}
+
+
+void Proxy::NodeLoads::Done(const string& node_id,
+                            steady_clock::time_point start,
+                            const Status& status) {
+  const bool ok(status.ok());
+  const double elapsed_ms(
+      duration_cast<duration<double, milli>>(steady_clock::now() - start)
+          .count());
+  const double sample(ok ? elapsed_ms : max(elapsed_ms, kFailedLatencyMs));
+  lock_guard<mutex> lock(lock_);
+  Load* const load(&loads_[node_id]);
+  CHECK_GT(load->outstanding, 0);
+  --load->outstanding;
+  if (status.CanonicalCode() == util::error::CANCELLED) {
+    return;
+  }
+  load->latency_ms =
+      load->latency_ms > 0
+          ? (1 - kLatencyWeight) * load->latency_ms + kLatencyWeight * sample
+          : sample;
+  if (ok) {
+    load->latencies.Add(duration<double, milli>(elapsed_ms));
+  }
+}
+
+
+bool Proxy::NodeLoads::HedgeDelay(const string& node_id,
+                                  duration<double>* delay) {
+  if (FLAGS_proxy_hedge_fraction <= 0) {
+    return false;
+  }
+  lock_guard<mutex> lock(lock_);
+  hedge_budget_.AddRequest();
+  return loads_[node_id].latencies.Quantile(kHedgeQuantile, kMinHedgeSamples,
+                                            delay);
+}
+
+
+int Proxy::NodeLoads::PickHedge(const vector<ClusterNodeState>& nodes,
+                                size_t excluded) {
+  CHECK_GT(nodes.size(), 1U);
+  CHECK_LT(excluded, nodes.size());
+  unique_lock<mutex> lock(lock_);
+  if (!hedge_budget_.TryHedge()) {
+    return -1;
+  }
+  // The better of two of the other nodes, if there are that many, as in
+  // Pick().
+  size_t pick(rand() % (nodes.size() - 1));
+  if (pick >= excluded) {
+    ++pick;
+  }
+  if (nodes.size() > 2) {
+    size_t other(rand() % (nodes.size() - 1));
+    if (other >= excluded) {
+      ++other;
+    }
+    if (other != pick && Better(lock, nodes[other], nodes[pick])) {
+      pick = other;
+    }
+  }
+  ++loads_[nodes[pick].node_id()].outstanding;
+  return pick;
+}
+
+
+bool Proxy::NodeLoads::Better(const unique_lock<mutex>& lock,
+                              const ClusterNodeState& a,
+                              const ClusterNodeState& b) {
+  CHECK(lock.owns_lock());
+  const Load& load_a(loads_[a.node_id()]);
+  const Load& load_b(loads_[b.node_id()]);
+  // A node nothing came back from yet is assumed to be as quick as the
+  // other one.
+  const double latency_a(
+      max(load_a.latency_ms > 0 ? load_a.latency_ms : load_b.latency_ms, 1.0));
+  const double latency_b(
+      max(load_b.latency_ms > 0 ? load_b.latency_ms : load_a.latency_ms, 1.0));
+  // The requests this proxy has in flight only tell part of the story,
+  // the published request rates account for the other nodes' traffic.
+  const double total_rate(a.requests_per_second() + b.requests_per_second() +
+                          1);
+  const double cost_a((load_a.outstanding + 1) * latency_a *
+                      (1 + a.requests_per_second() / total_rate));
+  const double cost_b((load_b.outstanding + 1) * latency_b *
+                      (1 + b.requests_per_second() / total_rate));
+  if (cost_a != cost_b) {
+    return cost_a < cost_b;
+  }
+  // The node furthest ahead of the serving STH is the one which will
+  // stay fresh the longest.
+  return a.newest_sth().tree_size() > b.newest_sth().tree_size();
+}
+
+
 // Filters out any headers which should not be proxied on.
 // See http://www.w3.org/Protocols/rfc2616/rfc2616-sec14.html#sec14.10
 void FilterHeaders(UrlFetcher::Headers* headers) {
@@ -117,7 +564,8 @@ Proxy::Proxy(libevent::Base* base,
     : base_(CHECK_NOTNULL(base)),
       get_fresh_nodes_(get_fresh_nodes),
       fetcher_(CHECK_NOTNULL(fetcher)),
-      executor_(CHECK_NOTNULL(executor)) {
+      executor_(CHECK_NOTNULL(executor)),
+      loads_(std::make_shared<NodeLoads>()) {
   CHECK(get_fresh_nodes_);
 }
 
@@ -125,17 +573,15 @@ Proxy::Proxy(libevent::Base* base,
 void Proxy::ProxyRequest(evhttp_request* req) const {
   CHECK_NOTNULL(req);
 
-  const vector<ClusterNodeState> fresh_nodes(get_fresh_nodes_());
-  if (fresh_nodes.empty()) {
+  const shared_ptr<const vector<ClusterNodeState>> fresh_nodes(
+      get_fresh_nodes_());
+  if (fresh_nodes->empty()) {
     return SendJsonError(base_, req, HTTP_SERVUNAVAIL,
                          "No node able to serve request.");
   }
-  const ClusterNodeState& target(fresh_nodes[rand() % fresh_nodes.size()]);
 
   URL url(evhttp_request_uri(req));
   url.SetProtocol("http");
-  url.SetHost(target.hostname());
-  url.SetPort(target.log_port());
 
   UrlFetcher::Request fetcher_req(url);
 
@@ -174,12 +620,130 @@ void Proxy::ProxyRequest(evhttp_request* req) const {
                                body_length));
     fetcher_req.body.swap(body);
   }
-  VLOG(1) << "Proxying request to " << url.Host() << ":" << url.Port()
-          << url.PathQuery();
+
+  const size_t target_index(loads_->Pick(*fresh_nodes));
+  const ClusterNodeState& target((*fresh_nodes)[target_index]);
+  fetcher_req.url.SetHost(target.hostname());
+  fetcher_req.url.SetPort(target.log_port());
+  if (FLAGS_proxy_request_deadline_seconds > 0) {
+    fetcher_req.deadline =
+        steady_clock::now() + seconds(FLAGS_proxy_request_deadline_seconds);
+  }
+  const shared_ptr<NodeLoads> loads(loads_);
+  const string node_id(target.node_id());
+  const steady_clock::time_point start(steady_clock::now());
+  const function<void(const Status&)> done(
+      [loads, node_id, start](const Status& status) {
+        loads->Done(node_id, start, status);
+      });
+
+  VLOG(1) << "Proxying request to " << fetcher_req.url.Host() << ":"
+          << fetcher_req.url.Port() << url.PathQuery();
+  if (FLAGS_proxy_stream_responses) {
+    // Only requests which can be sent twice without harm are hedged.
+    duration<double> hedge_delay;
+    if (fetcher_req.verb == UrlFetcher::Verb::GET &&
+        fresh_nodes->size() > 1 &&
+        loads_->HedgeDelay(node_id, &hedge_delay)) {
+      return HedgedStreamRequest(req, fetcher_req, done, fresh_nodes,
+                                 target_index, hedge_delay);
+    }
+    return StreamRequest(req, fetcher_req, done);
+  }
   UrlFetcher::Response* resp(new UrlFetcher::Response);
-  fetcher_->Fetch(fetcher_req, resp, new Task(bind(&ProxyRequestDone, base_,
-                                                   req, url.Path(), resp, _1),
-                                              executor_));
+  fetcher_->Fetch(fetcher_req, resp,
+                  new Task(bind(&ProxyRequestDone, base_, req, url.Path(),
+                                done, resp, _1),
+                           executor_));
+}
+
+
+// The events of the upstream connection come on the event thread of
+// |fetcher_|, where the response goes, and are passed on to that of the
+// server in order. The evbuffer chains of the body are moved from one to
+// the other, rather than copied.
+void Proxy::StreamRequest(evhttp_request* req,
+                          const UrlFetcher::Request& fetcher_req,
+                          const function<void(const Status&)>& done) const {
+  ProxyStream* const stream(
+      NewProxyStream(base_, req, fetcher_req.url.Path(), executor_));
+  base_->Add([stream]() {
+    evhttp_connection_set_closecb(evhttp_request_get_connection(stream->req),
+                                  &OnProxyConnectionClosed, stream);
+  });
+
+  libevent::Base* const base(base_);
+  UrlFetcher::Response* const resp(&stream->response);
+  resp->on_headers = [base, stream, resp]() {
+    base->Add(
+        bind(&StartProxyReply, stream, resp->status_code, resp->headers));
+  };
+  resp->on_body = [base, stream](evbuffer* data) {
+    const shared_ptr<evbuffer> chunk(CHECK_NOTNULL(evbuffer_new()),
+                                     &evbuffer_free);
+    CHECK_EQ(evbuffer_add_buffer(chunk.get(), data), 0);
+    base->Add(bind(&SendProxyChunk, stream, chunk));
+  };
+  // |stream| is deleted on the event thread of the server, its fetches
+  // task with it.
+  fetcher_->Fetch(fetcher_req, resp,
+                  stream->fetches->AddChild(
+                      bind(&ProxyStreamDone, stream, done, _1)));
+}
+
+
+void Proxy::HedgedStreamRequest(
+    evhttp_request* req, const UrlFetcher::Request& fetcher_req,
+    const function<void(const Status&)>& done,
+    const shared_ptr<const vector<ClusterNodeState>>& nodes, size_t target,
+    const duration<double>& hedge_delay) const {
+  ProxyStream* const stream(
+      NewProxyStream(base_, req, fetcher_req.url.Path(), executor_));
+  base_->Add([stream]() {
+    evhttp_connection_set_closecb(evhttp_request_get_connection(stream->req),
+                                  &OnProxyConnectionClosed, stream);
+  });
+
+  const shared_ptr<HedgedProxyStream> hedged(
+      std::make_shared<HedgedProxyStream>(stream));
+  SendHedgedProxyStream(hedged, 0, fetcher_req, fetcher_, done);
+
+  // Nothing is left to cancel once the timer fires, it only holds on to
+  // |hedged| until then.
+  UrlFetcher* const fetcher(fetcher_);
+  const shared_ptr<NodeLoads> loads(loads_);
+  executor_->Delay(
+      hedge_delay,
+      new Task(
+          [hedged, fetcher_req, fetcher, loads, nodes, target](Task* timer) {
+            delete timer;
+            {
+              lock_guard<mutex> lock(hedged->lock);
+              if (hedged->winner >= 0) {
+                return;
+              }
+            }
+            const int pick(loads->PickHedge(*nodes, target));
+            if (pick < 0) {
+              return;
+            }
+            const ClusterNodeState& node((*nodes)[pick]);
+            UrlFetcher::Request hedge_req(fetcher_req);
+            hedge_req.url.SetHost(node.hostname());
+            hedge_req.url.SetPort(node.log_port());
+            const string node_id(node.node_id());
+            const steady_clock::time_point start(steady_clock::now());
+            VLOG(1) << "Hedging proxied request to " << hedge_req.url.Host()
+                    << ":" << hedge_req.url.Port()
+                    << hedge_req.url.PathQuery();
+            total_hedged_proxied_requests->Increment("sent");
+            SendHedgedProxyStream(hedged, 1, hedge_req, fetcher,
+                                  [loads, node_id, start](
+                                      const Status& status) {
+                                    loads->Done(node_id, start, status);
+                                  });
+          },
+          executor_));
 }
 
 
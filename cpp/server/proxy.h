@@ -1,7 +1,9 @@
 #ifndef CERT_TRANS_SERVER_PROXY_H_
 #define CERT_TRANS_SERVER_PROXY_H_
 
+#include <chrono>
 #include <functional>
+#include <memory>
 #include <vector>
 
 #include "base/macros.h"
@@ -33,7 +35,8 @@ void FilterHeaders(UrlFetcher::Headers* headers);
 
 class Proxy {
  public:
-  typedef std::function<std::vector<ct::ClusterNodeState>()>
+  typedef std::function<
+      std::shared_ptr<const std::vector<ct::ClusterNodeState>>()>
       GetFreshNodesFunction;
   Proxy(libevent::Base* base, const GetFreshNodesFunction& get_fresh_nodes,
         UrlFetcher* fetcher, util::Executor* executor);
@@ -43,10 +46,28 @@ class Proxy {
   virtual void ProxyRequest(evhttp_request* req) const;
 
  private:
+  class NodeLoads;
+
+  // Sends |fetcher_req| upstream and passes its response on to |req| as
+  // it arrives, see --proxy_stream_responses.
+  void StreamRequest(
+      evhttp_request* req, const UrlFetcher::Request& fetcher_req,
+      const std::function<void(const util::Status&)>& done) const;
+  // Like StreamRequest(), but also sends |fetcher_req| to another of
+  // |nodes| than the one with index |target| if no response came after
+  // |hedge_delay|, passing on whichever response comes first.
+  void HedgedStreamRequest(
+      evhttp_request* req, const UrlFetcher::Request& fetcher_req,
+      const std::function<void(const util::Status&)>& done,
+      const std::shared_ptr<const std::vector<ct::ClusterNodeState>>& nodes,
+      size_t target, const std::chrono::duration<double>& hedge_delay) const;
+
   libevent::Base* const base_;
   const GetFreshNodesFunction get_fresh_nodes_;
   UrlFetcher* const fetcher_;
   util::Executor* const executor_;
+  // Shared with the callbacks of the requests in flight.
+  const std::shared_ptr<NodeLoads> loads_;
 
   DISALLOW_COPY_AND_ASSIGN(Proxy);
 };
@@ -0,0 +1,256 @@
+#include "server/rate_limiter.h"
+
+#include <arpa/inet.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <sstream>
+
+#include "monitoring/monitoring.h"
+#include "server/json_output.h"
+
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::lock_guard;
+using std::min;
+using std::mutex;
+using std::string;
+using std::vector;
+
+DEFINE_double(http_rate_limit_per_second, 0,
+              "if positive, the number of requests per second that each "
+              "client address can make to each endpoint, beyond which it "
+              "gets 429 responses");
+DEFINE_double(http_rate_limit_burst, 20,
+              "the number of requests that each client address can make "
+              "to each endpoint at once, before "
+              "--http_rate_limit_per_second applies");
+DEFINE_string(http_rate_limit_allowlist, "",
+              "comma-separated list of client addresses or networks (such "
+              "as 192.0.2.0/24), e.g. of bulk readers, which get "
+              "--http_rate_limit_allowlist_factor times the limits");
+DEFINE_double(http_rate_limit_allowlist_factor, 10,
+              "how many times the rate and burst of "
+              "--http_rate_limit_per_second the clients in "
+              "--http_rate_limit_allowlist get");
+
+namespace cert_trans {
+namespace {
+
+
+static Counter<string>* http_server_rate_limited_requests(
+    Counter<string>::New("http_server_rate_limited_requests", "path",
+                         "Number of requests refused with a 429 because "
+                         "their client made too many to their path."));
+
+
+const int kTooManyRequests = 429;
+
+
+// Parses the IPv4 or IPv6 |address| into |*family| and |*parsed|, the
+// former in the first 4 bytes of the latter.
+bool ParseAddress(const string& address, int* family, in6_addr* parsed) {
+  memset(parsed, 0, sizeof(*parsed));
+  if (inet_pton(AF_INET, address.c_str(), parsed) == 1) {
+    *family = AF_INET;
+    return true;
+  }
+  if (inet_pton(AF_INET6, address.c_str(), parsed) == 1) {
+    *family = AF_INET6;
+    return true;
+  }
+  return false;
+}
+
+
+}  // namespace
+
+
+const size_t RateLimiter::kNumShards;
+const size_t RateLimiter::kMaxBucketsPerShard;
+
+
+RateLimiter::RateLimiter(double rate, double burst,
+                         const vector<string>& allowlist,
+                         double allowlist_factor)
+    : rate_(rate), burst_(burst), allowlist_factor_(allowlist_factor) {
+  CHECK_GE(burst_, 1);
+  CHECK_GE(allowlist_factor_, 1);
+  for (const string& entry : allowlist) {
+    const size_t slash(entry.find('/'));
+    Network network;
+    CHECK(ParseAddress(entry.substr(0, slash), &network.family,
+                       &network.address))
+        << "bad address in the allowlist: " << entry;
+    const int max_length(network.family == AF_INET ? 32 : 128);
+    network.prefix_length =
+        slash == string::npos ? max_length : atoi(entry.c_str() + slash + 1);
+    CHECK(network.prefix_length >= 0 && network.prefix_length <= max_length)
+        << "bad prefix length in the allowlist: " << entry;
+    allowlist_.push_back(network);
+  }
+}
+
+
+// static
+RateLimiter* RateLimiter::Default() {
+  static RateLimiter* const limiter([]() {
+    vector<string> allowlist;
+    std::istringstream entries(FLAGS_http_rate_limit_allowlist);
+    string entry;
+    while (getline(entries, entry, ',')) {
+      if (!entry.empty()) {
+        allowlist.push_back(entry);
+      }
+    }
+    return new RateLimiter(FLAGS_http_rate_limit_per_second,
+                           FLAGS_http_rate_limit_burst, allowlist,
+                           FLAGS_http_rate_limit_allowlist_factor);
+  }());
+  return limiter;
+}
+
+
+bool RateLimiter::Allow(const string& client, const string& endpoint,
+                        const Clock::time_point& now,
+                        Clock::duration* retry_after) {
+  if (rate_ <= 0) {
+    return true;
+  }
+
+  const string key(client + '\0' + endpoint);
+  Shard& shard(shards_[std::hash<string>()(key) % kNumShards]);
+  lock_guard<mutex> lock(shard.lock);
+
+  auto it(shard.buckets.find(key));
+  if (it == shard.buckets.end()) {
+    if (shard.buckets.size() >= kMaxBucketsPerShard) {
+      PurgeShard(&shard, now);
+    }
+    const bool allowlisted(IsAllowlisted(client));
+    it = shard.buckets
+             .emplace(key, Bucket{allowlisted,
+                                  burst_ *
+                                      (allowlisted ? allowlist_factor_ : 1),
+                                  now})
+             .first;
+  }
+
+  Bucket* const bucket(&it->second);
+  const double tokens(Refill(bucket, now));
+  if (tokens >= 1) {
+    bucket->tokens = tokens - 1;
+    return true;
+  }
+  const double rate(rate_ * (bucket->allowlisted ? allowlist_factor_ : 1));
+  *CHECK_NOTNULL(retry_after) = duration_cast<Clock::duration>(
+      duration<double>((1 - tokens) / rate));
+  return false;
+}
+
+
+bool RateLimiter::ShedRequest(libevent::Base* base, evhttp_request* req) {
+  if (rate_ <= 0) {
+    return false;
+  }
+
+  char* peer_addr;
+  ev_uint16_t peer_port;
+  evhttp_connection_get_peer(evhttp_request_get_connection(req), &peer_addr,
+                             &peer_port);
+  const string path(evhttp_uri_get_path(evhttp_request_get_evhttp_uri(req)));
+  Clock::duration retry_after;
+  if (Allow(peer_addr, path, Clock::now(), &retry_after)) {
+    return false;
+  }
+
+  VLOG(1) << "rate limiting " << peer_addr << " on " << path;
+  http_server_rate_limited_requests->Increment(path);
+  const int64_t retry_after_seconds(static_cast<int64_t>(
+      std::ceil(duration_cast<duration<double>>(retry_after).count())));
+  CHECK_EQ(evhttp_add_header(evhttp_request_get_output_headers(req),
+                             "Retry-After",
+                             std::to_string(retry_after_seconds).c_str()),
+           0);
+  SendJsonError(base, req, kTooManyRequests, "Too many requests.");
+  return true;
+}
+
+
+size_t RateLimiter::NumBuckets() const {
+  size_t num_buckets(0);
+  for (Shard& shard : shards_) {
+    lock_guard<mutex> lock(shard.lock);
+    num_buckets += shard.buckets.size();
+  }
+  return num_buckets;
+}
+
+
+bool RateLimiter::IsAllowlisted(const string& client) const {
+  int family;
+  in6_addr address;
+  if (allowlist_.empty() || !ParseAddress(client, &family, &address)) {
+    return false;
+  }
+
+  const unsigned char* const bytes(
+      reinterpret_cast<const unsigned char*>(&address));
+  for (const Network& network : allowlist_) {
+    if (network.family != family) {
+      continue;
+    }
+    const unsigned char* const network_bytes(
+        reinterpret_cast<const unsigned char*>(&network.address));
+    const int whole_bytes(network.prefix_length / 8);
+    const int rest_bits(network.prefix_length % 8);
+    if (memcmp(bytes, network_bytes, whole_bytes) != 0) {
+      continue;
+    }
+    const unsigned char mask(0xff << (8 - rest_bits));
+    if (rest_bits == 0 ||
+        (bytes[whole_bytes] & mask) == (network_bytes[whole_bytes] & mask)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+
+double RateLimiter::Refill(Bucket* bucket, const Clock::time_point& now) const {
+  const double factor(bucket->allowlisted ? allowlist_factor_ : 1);
+  // Another thread may have gone by with a later |now|.
+  if (now > bucket->updated) {
+    const double elapsed(
+        duration_cast<duration<double>>(now - bucket->updated).count());
+    bucket->tokens =
+        min(burst_ * factor, bucket->tokens + elapsed * rate_ * factor);
+    bucket->updated = now;
+  }
+  return bucket->tokens;
+}
+
+
+void RateLimiter::PurgeShard(Shard* shard, const Clock::time_point& now) const {
+  for (auto it(shard->buckets.begin()); it != shard->buckets.end();) {
+    const double factor(it->second.allowlisted ? allowlist_factor_ : 1);
+    if (Refill(&it->second, now) >= burst_ * factor) {
+      it = shard->buckets.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  // Dropping a bucket lets its client start again with a full one, which
+  // is better than growing without bounds. Enough are dropped for the
+  // next purge to be a while away.
+  while (shard->buckets.size() > kMaxBucketsPerShard * 3 / 4) {
+    shard->buckets.erase(shard->buckets.begin());
+  }
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,102 @@
+#ifndef CERT_TRANS_SERVER_RATE_LIMITER_H_
+#define CERT_TRANS_SERVER_RATE_LIMITER_H_
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "base/macros.h"
+#include "util/libevent_wrapper.h"
+
+namespace cert_trans {
+
+
+// Token buckets of requests, one per client address and endpoint: each
+// request takes a token from its bucket, which holds up to |burst| of
+// them, and is refilled at |rate| tokens per second. The clients in the
+// allowlist, e.g. known bulk readers, get |allowlist_factor| times as
+// much of both.
+//
+// The buckets are split into shards, each with its own lock, so that
+// concurrent requests rarely wait for each other. Full buckets are
+// dropped when a shard has too many, as they would be the same anew.
+//
+// This class is thread-safe.
+class RateLimiter {
+ public:
+  typedef std::chrono::steady_clock Clock;
+
+  // Does not limit anything if |rate| is not positive. |allowlist| holds
+  // IPv4 or IPv6 addresses, each optionally followed by the length of a
+  // network prefix, such as "192.0.2.0/24".
+  RateLimiter(double rate, double burst,
+              const std::vector<std::string>& allowlist,
+              double allowlist_factor);
+
+  // The instance configured by the --http_rate_limit_* flags, shared by
+  // all of the HTTP handlers of the process.
+  static RateLimiter* Default();
+
+  // Takes a token from the bucket of |client| for |endpoint| at |now|.
+  // Returns whether there was one. If not, sets |*retry_after| to how
+  // long it will be until there is.
+  bool Allow(const std::string& client, const std::string& endpoint,
+             const Clock::time_point& now, Clock::duration* retry_after);
+
+  // Sends a 429 to |req| if its client has made too many requests to its
+  // path, to be called before doing anything else with |req|. Returns
+  // whether it did.
+  bool ShedRequest(libevent::Base* base, evhttp_request* req);
+
+  // The number of buckets kept.
+  size_t NumBuckets() const;
+
+ private:
+  struct Bucket {
+    // Whether the client is allowlisted, as of when this was created.
+    bool allowlisted;
+    double tokens;
+    Clock::time_point updated;
+  };
+
+  struct Shard {
+    std::mutex lock;
+    std::unordered_map<std::string, Bucket> buckets;
+  };
+
+  // An allowlisted network.
+  struct Network {
+    int family;
+    in6_addr address;
+    int prefix_length;
+  };
+
+  static const size_t kNumShards = 64;
+  static const size_t kMaxBucketsPerShard = 4096;
+
+  bool IsAllowlisted(const std::string& client) const;
+  // The tokens in |*bucket| at |now|, which it is updated to.
+  double Refill(Bucket* bucket, const Clock::time_point& now) const;
+  // Drops the buckets of |shard| which are full at |now|, and then
+  // arbitrary ones if it still has more than three quarters of
+  // kMaxBucketsPerShard. Must be called with the lock of |shard| held.
+  void PurgeShard(Shard* shard, const Clock::time_point& now) const;
+
+  const double rate_;
+  const double burst_;
+  const double allowlist_factor_;
+  std::vector<Network> allowlist_;
+  mutable std::array<Shard, kNumShards> shards_;
+
+  DISALLOW_COPY_AND_ASSIGN(RateLimiter);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_SERVER_RATE_LIMITER_H_
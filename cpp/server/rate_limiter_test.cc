@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "server/rate_limiter.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+using std::string;
+using std::vector;
+
+
+// Makes |count| requests from |client| to |endpoint| at |now|, and
+// returns how many were allowed.
+int AllowedOf(RateLimiter* limiter, const string& client,
+              const string& endpoint, const RateLimiter::Clock::time_point& now,
+              int count) {
+  int allowed(0);
+  for (int i = 0; i < count; ++i) {
+    RateLimiter::Clock::duration retry_after;
+    if (limiter->Allow(client, endpoint, now, &retry_after)) {
+      ++allowed;
+    }
+  }
+  return allowed;
+}
+
+
+TEST(RateLimiterTest, AllowsEverythingWithoutRate) {
+  RateLimiter limiter(0, 1, vector<string>(), 1);
+  EXPECT_EQ(100, AllowedOf(&limiter, "192.0.2.1", "/ct/v1/get-entries",
+                           RateLimiter::Clock::now(), 100));
+  EXPECT_EQ(0U, limiter.NumBuckets());
+}
+
+
+TEST(RateLimiterTest, RefillsAtRate) {
+  RateLimiter limiter(2, 4, vector<string>(), 1);
+  const RateLimiter::Clock::time_point start(RateLimiter::Clock::now());
+  EXPECT_EQ(4, AllowedOf(&limiter, "192.0.2.1", "/ct/v1/get-entries", start,
+                         10));
+
+  RateLimiter::Clock::duration retry_after;
+  EXPECT_FALSE(
+      limiter.Allow("192.0.2.1", "/ct/v1/get-entries", start, &retry_after));
+  EXPECT_EQ(milliseconds(500), retry_after);
+
+  // Two more tokens after a second, and never more than the burst.
+  EXPECT_EQ(2, AllowedOf(&limiter, "192.0.2.1", "/ct/v1/get-entries",
+                         start + seconds(1), 10));
+  EXPECT_EQ(4, AllowedOf(&limiter, "192.0.2.1", "/ct/v1/get-entries",
+                         start + seconds(100), 10));
+}
+
+
+TEST(RateLimiterTest, SeparatesClientsAndEndpoints) {
+  RateLimiter limiter(1, 2, vector<string>(), 1);
+  const RateLimiter::Clock::time_point now(RateLimiter::Clock::now());
+  EXPECT_EQ(2, AllowedOf(&limiter, "192.0.2.1", "/ct/v1/get-entries", now,
+                         10));
+  EXPECT_EQ(2, AllowedOf(&limiter, "192.0.2.1", "/ct/v1/get-sth", now, 10));
+  EXPECT_EQ(2, AllowedOf(&limiter, "192.0.2.2", "/ct/v1/get-entries", now,
+                         10));
+  EXPECT_EQ(3U, limiter.NumBuckets());
+}
+
+
+TEST(RateLimiterTest, AllowlistGetsMore) {
+  RateLimiter limiter(1, 2, {"192.0.2.128/25", "2001:db8::1"}, 10);
+  const RateLimiter::Clock::time_point now(RateLimiter::Clock::now());
+  EXPECT_EQ(20, AllowedOf(&limiter, "192.0.2.200", "/ct/v1/get-entries", now,
+                          100));
+  EXPECT_EQ(2, AllowedOf(&limiter, "192.0.2.100", "/ct/v1/get-entries", now,
+                         100));
+  EXPECT_EQ(20, AllowedOf(&limiter, "2001:db8::1", "/ct/v1/get-entries", now,
+                          100));
+  EXPECT_EQ(2, AllowedOf(&limiter, "2001:db8::2", "/ct/v1/get-entries", now,
+                         100));
+
+  RateLimiter::Clock::duration retry_after;
+  EXPECT_FALSE(limiter.Allow("192.0.2.200", "/ct/v1/get-entries", now,
+                             &retry_after));
+  EXPECT_EQ(milliseconds(100), retry_after);
+}
+
+
+TEST(RateLimiterTest, BoundsBuckets) {
+  RateLimiter limiter(1, 1, vector<string>(), 1);
+  const RateLimiter::Clock::time_point now(RateLimiter::Clock::now());
+  for (int i = 0; i < 300000; ++i) {
+    AllowedOf(&limiter, "client" + std::to_string(i), "/ct/v1/get-sth", now,
+              1);
+  }
+  // There are too many for all to be kept.
+  EXPECT_LT(limiter.NumBuckets(), 300000U);
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -4,20 +4,28 @@
 #include <chrono>
 #include <csignal>
 #include <functional>
+#include <string>
+#include <vector>
 
 #include "log/cluster_state_controller.h"
 #include "log/etcd_consistent_store.h"
+#include "log/file_storage.h"
 #include "log/frontend.h"
 #include "log/log_lookup.h"
 #include "log/log_verifier.h"
+#include "log/tiles.h"
 #include "monitoring/gcm/exporter.h"
 #include "monitoring/monitoring.h"
 #include "server/metrics.h"
+#include "server/profile_handler.h"
 #include "server/proxy.h"
+#include "util/numa.h"
 #include "util/thread_pool.h"
 #include "util/uuid.h"
 
 using std::bind;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
 using std::chrono::seconds;
 using std::chrono::steady_clock;
 using std::placeholders::_1;
@@ -26,12 +34,20 @@ using std::signal;
 using std::string;
 using std::this_thread::sleep_for;
 using std::thread;
+using std::unique_ptr;
+using std::vector;
 
 // These flags are DEFINEd in server_helper to keep the validation logic
 // related to server startup options in one place.
 DECLARE_string(server);
 DECLARE_int32(port);
+DECLARE_string(path_prefix);
 DECLARE_string(etcd_root);
+DECLARE_string(merkle_tree_dir);
+DECLARE_bool(merkle_tree_read_only);
+DECLARE_string(tile_export_dir);
+DECLARE_string(etcd_entry_blob_dir);
+DECLARE_int32(etcd_entry_blob_storage_depth);
 
 DEFINE_int32(node_state_refresh_seconds, 10,
              "How often to refresh the ClusterNodeState entry for this node.");
@@ -40,6 +56,18 @@ DEFINE_int32(watchdog_seconds, 120,
              "before firing the watchdog timer.");
 DEFINE_bool(watchdog_timeout_is_fatal, true,
             "Exit if the watchdog timer fires.");
+DEFINE_int32(num_http_event_threads, 1,
+             "number of event loops accepting and answering HTTP requests, "
+             "each on its own thread and with its own handlers, sharing the "
+             "port with SO_REUSEPORT");
+DEFINE_bool(numa, false,
+            "place the HTTP event loops on the NUMA nodes of the host in "
+            "turn, each running its handlers on a thread pool of its node, "
+            "and interleave the rest of the memory (such as the Merkle "
+            "tree, the leaf index and the database caches) across all the "
+            "nodes");
+DEFINE_int32(numa_pool_threads, 8,
+             "number of threads of the pool of each NUMA node, with --numa");
 
 namespace cert_trans {
 
@@ -62,6 +90,8 @@ void RefreshNodeState(ClusterStateController<LoggedEntry>* controller,
   const steady_clock::duration period(
       (seconds(FLAGS_node_state_refresh_seconds)));
   steady_clock::time_point target_run_time(steady_clock::now());
+  steady_clock::time_point last_run_time(target_run_time);
+  int64_t last_num_requests(libevent::HttpServer::NumRequestsHandled());
 
   while (true) {
     if (task->CancelRequested()) {
@@ -72,6 +102,17 @@ void RefreshNodeState(ClusterStateController<LoggedEntry>* controller,
     // then send us a SIGALRM:
     alarm(FLAGS_watchdog_seconds);
 
+    const steady_clock::time_point run_time(steady_clock::now());
+    const int64_t num_requests(libevent::HttpServer::NumRequestsHandled());
+    const int64_t elapsed_ms(
+        duration_cast<milliseconds>(run_time - last_run_time).count());
+    if (elapsed_ms > 0) {
+      controller->SetNodeLoad((num_requests - last_num_requests) * 1000 /
+                              elapsed_ms);
+    }
+    last_run_time = run_time;
+    last_num_requests = num_requests;
+
     controller->RefreshNodeState();
 
     const steady_clock::time_point now(steady_clock::now());
@@ -105,21 +146,75 @@ string GetNodeId(Database* db) {
 }
 
 
+// The nodes the HTTP event loops are placed on, or none unless --numa
+// is set and the host has more than one.
+vector<int> ProvideNumaNodes() {
+  if (!FLAGS_numa) {
+    return vector<int>();
+  }
+  const vector<int> nodes(NumaNodes());
+  if (nodes.size() < 2) {
+    LOG(WARNING) << "--numa is set, but the host has fewer than two NUMA "
+                 << "nodes";
+    return vector<int>();
+  }
+  return nodes;
+}
+
+
+// Starts the pump of |event_base| on |numa_node|, if not negative.
+libevent::EventPumpThread* StartEventPump(
+    const shared_ptr<libevent::Base>& event_base, int numa_node) {
+  const ScopedNumaNode node(numa_node);
+  return new libevent::EventPumpThread(event_base);
+}
+
+
+// Returns null unless --etcd_entry_blob_dir is set.
+FileStorage* ProvideEntryBlobStore() {
+  if (FLAGS_etcd_entry_blob_dir.empty()) {
+    return nullptr;
+  }
+  return new FileStorage(FLAGS_etcd_entry_blob_dir,
+                         FLAGS_etcd_entry_blob_storage_depth);
+}
+
+
 }  // namespace
 
 
 // static
 void Server::StaticInit() {
   CHECK_NE(SIG_ERR, signal(SIGALRM, &WatchdogTimeout));
+  // Before anything big is allocated, and any thread created, as they
+  // inherit it.
+  if (FLAGS_numa && !InterleaveMemory()) {
+    LOG(WARNING) << "cannot interleave memory across NUMA nodes";
+  }
 }
 
 
+struct Server::HttpEventLoop {
+  HttpEventLoop()
+      : event_base(std::make_shared<libevent::Base>()),
+        http_server(*event_base) {
+  }
+
+  const shared_ptr<libevent::Base> event_base;
+  libevent::HttpServer http_server;
+  unique_ptr<Proxy> proxy;
+  // Stops the loop before the rest is destroyed.
+  unique_ptr<libevent::EventPumpThread> event_pump;
+};
+
+
 Server::Server(const shared_ptr<libevent::Base>& event_base,
                ThreadPool* internal_pool, ThreadPool* http_pool, Database* db,
                EtcdClient* etcd_client, UrlFetcher* url_fetcher,
                const LogVerifier* log_verifier)
     : event_base_(event_base),
-      event_pump_(new libevent::EventPumpThread(event_base_)),
+      numa_nodes_(ProvideNumaNodes()),
+      event_pump_(StartEventPump(event_base_, http_numa_node(0))),
       http_server_(*event_base_),
       db_(CHECK_NOTNULL(db)),
       log_verifier_(CHECK_NOTNULL(log_verifier)),
@@ -133,20 +228,53 @@ Server::Server(const shared_ptr<libevent::Base>& event_base,
       consistent_store_(&election_,
                         new EtcdConsistentStore<LoggedEntry>(
                             event_base_.get(), internal_pool_, etcd_client_,
-                            &election_, FLAGS_etcd_root, node_id_)),
+                            &election_, FLAGS_etcd_root, node_id_,
+                            ProvideEntryBlobStore())),
       http_pool_(CHECK_NOTNULL(http_pool)) {
   CHECK_LT(0, FLAGS_port);
+  CHECK_LT(0, FLAGS_num_http_event_threads);
+  CHECK_LT(0, FLAGS_numa_pool_threads);
+
+  for (int i = 1; i < FLAGS_num_http_event_threads; ++i) {
+    extra_http_loops_.emplace_back(new HttpEventLoop);
+  }
+  for (const int node : numa_nodes_) {
+    const ScopedNumaNode numa_node(node);
+    numa_pools_.emplace_back(new ThreadPool(
+        "numa_node_" + std::to_string(node), FLAGS_numa_pool_threads));
+  }
 
   if (FLAGS_monitoring == kPrometheus) {
     http_server_.AddHandler("/metrics", ExportPrometheusMetrics);
+    for (const auto& loop : extra_http_loops_) {
+      loop->http_server.AddHandler("/metrics", ExportPrometheusMetrics);
+    }
   } else if (FLAGS_monitoring == kGcm) {
+    // Two threads, as the exporter blocks one while creating its metrics.
+    gcm_pool_.reset(new ThreadPool("gcm_exporter", 2));
     gcm_exporter_.reset(
-        new GCMExporter(FLAGS_server, url_fetcher_, internal_pool_));
+        new GCMExporter(FLAGS_server, url_fetcher_, gcm_pool_.get()));
   } else {
     LOG(FATAL) << "Please set --monitoring to one of the supported values.";
   }
+  http_server_.AddHandler("/traces", ExportTraces);
+  AddProfileHandlers(event_base_.get(), &http_server_);
+  for (const auto& loop : extra_http_loops_) {
+    loop->http_server.AddHandler("/traces", ExportTraces);
+    AddProfileHandlers(loop->event_base.get(), &loop->http_server);
+  }
 
-  http_server_.Bind(nullptr, FLAGS_port);
+  if (extra_http_loops_.empty()) {
+    http_server_.Bind(nullptr, FLAGS_port);
+  } else {
+    http_server_.BindReusePort(nullptr, FLAGS_port);
+    for (size_t i = 1; i < num_http_event_loops(); ++i) {
+      HttpEventLoop* const loop(ExtraHttpLoop(i));
+      loop->http_server.BindReusePort(nullptr, FLAGS_port);
+      loop->event_pump.reset(
+          StartEventPump(loop->event_base, http_numa_node(i)));
+    }
+  }
   election_.StartElection();
 }
 
@@ -198,18 +326,59 @@ libevent::HttpServer* Server::http_server() {
 }
 
 
+size_t Server::num_http_event_loops() const {
+  return extra_http_loops_.size() + 1;
+}
+
+
+libevent::Base* Server::http_event_base(size_t i) {
+  return i == 0 ? event_base_.get() : ExtraHttpLoop(i)->event_base.get();
+}
+
+
+libevent::HttpServer* Server::http_server(size_t i) {
+  return i == 0 ? &http_server_ : &ExtraHttpLoop(i)->http_server;
+}
+
+
+Proxy* Server::proxy(size_t i) {
+  return i == 0 ? proxy_.get() : ExtraHttpLoop(i)->proxy.get();
+}
+
+
+int Server::http_numa_node(size_t i) const {
+  return numa_nodes_.empty() ? -1 : numa_nodes_[i % numa_nodes_.size()];
+}
+
+
+ThreadPool* Server::handler_pool(size_t i) {
+  return numa_pools_.empty() ? internal_pool_
+                             : numa_pools_[i % numa_pools_.size()].get();
+}
+
+
+Server::HttpEventLoop* Server::ExtraHttpLoop(size_t i) const {
+  CHECK_GT(i, static_cast<size_t>(0));
+  CHECK_LE(i, extra_http_loops_.size());
+  return extra_http_loops_[i - 1].get();
+}
+
+
 void Server::WaitForReplication() const {
   // If we're joining an existing cluster, this node needs to get its database
   // up-to-date with the serving_sth before we can do anything, so we'll wait
   // here for that:
+  CHECK(fetcher_) << "Initialise() must be called first";
   util::StatusOr<ct::SignedTreeHead> serving_sth(
       consistent_store_.GetServingSTH());
   if (serving_sth.ok()) {
-    while (db_->TreeSize() < serving_sth.ValueOrDie().tree_size()) {
+    const int64_t tree_size(serving_sth.ValueOrDie().tree_size());
+    while (db_->TreeSize() < tree_size) {
       LOG(WARNING) << "Waiting for local database to catch up to serving_sth ("
-                   << db_->TreeSize() << " of "
-                   << serving_sth.ValueOrDie().tree_size() << ")";
-      sleep(1);
+                   << db_->TreeSize() << " of " << tree_size << ")";
+      if (fetcher_->WaitForTreeSize(tree_size, seconds(10))) {
+        break;
+      }
     }
   }
 }
@@ -220,14 +389,49 @@ void Server::Initialise(bool is_mirror) {
                                         log_verifier_, !is_mirror)
                      .release());
 
-  log_lookup_.reset(new LogLookup(db_));
+  CHECK(!FLAGS_merkle_tree_read_only || !FLAGS_merkle_tree_dir.empty())
+      << "--merkle_tree_read_only needs --merkle_tree_dir";
+  const PersistentMerkleTree::Access tree_access(
+      FLAGS_merkle_tree_read_only ? PersistentMerkleTree::READ_ONLY
+                                  : PersistentMerkleTree::READ_WRITE);
+  {
+    // Hashing the whole tree at startup uses all the cores, on threads
+    // of its own rather than the internal pool, which they would hog.
+    ThreadPool startup_pool("startup");
+    log_lookup_.reset(
+        FLAGS_merkle_tree_dir.empty()
+            ? new LogLookup(db_, &startup_pool)
+            : new LogLookup(db_, FLAGS_merkle_tree_dir, tree_access,
+                            &startup_pool));
+  }
+  if (!FLAGS_tile_export_dir.empty()) {
+    tile_exporter_.reset(
+        new TileExporter(log_lookup_.get(), FLAGS_tile_export_dir));
+    TileExporter* const exporter(tile_exporter_.get());
+    log_lookup_->AddUpdateCallback([exporter](const ct::SignedTreeHead& sth) {
+      const util::Status status(exporter->Export(sth.tree_size()));
+      LOG_IF(WARNING, !status.ok()) << "Failed to export tiles: " << status;
+    });
+    // The lookup may already have loaded a tree head from the database.
+    // Its tiles are exported in the background, as there may be many of
+    // them (e.g. the first time), so as not to hold up the start.
+    const size_t tree_size(log_lookup_->GetSTH().tree_size());
+    util::Task* const task(server_task_.task());
+    task->AddHold();
+    internal_pool_->Add([exporter, task, tree_size]() {
+      const util::Status status(exporter->Export(tree_size));
+      LOG_IF(WARNING, !status.ok()) << "Failed to export tiles: " << status;
+      task->RemoveHold();
+    });
+  }
 
   cluster_controller_.reset(new ClusterStateController<LoggedEntry>(
       internal_pool_, event_base_, url_fetcher_, db_, &consistent_store_,
       &election_, fetcher_.get()));
 
   // Publish this node's hostname:port info
-  cluster_controller_->SetNodeHostPort(FLAGS_server, FLAGS_port);
+  cluster_controller_->SetNodeHostPort(FLAGS_server, FLAGS_port,
+                                       FLAGS_path_prefix);
   {
     ct::SignedTreeHead db_sth;
     if (db_->LatestTreeHead(&db_sth) == Database::LOOKUP_OK) {
@@ -245,11 +449,16 @@ void Server::Initialise(bool is_mirror) {
                                         cluster_controller_.get(),
                                         server_task_.task()));
 
+  const Proxy::GetFreshNodesFunction get_fresh_nodes(
+      bind(&ClusterStateController<LoggedEntry>::GetFreshNodes,
+           cluster_controller_.get()));
   proxy_.reset(
-      new Proxy(event_base_.get(),
-                bind(&ClusterStateController<LoggedEntry>::GetFreshNodes,
-                     cluster_controller_.get()),
-                url_fetcher_, http_pool_));
+      new Proxy(event_base_.get(), get_fresh_nodes, url_fetcher_, http_pool_));
+  // Proxied requests must be answered on the loop they came from.
+  for (const auto& loop : extra_http_loops_) {
+    loop->proxy.reset(new Proxy(loop->event_base.get(), get_fresh_nodes,
+                                url_fetcher_, http_pool_));
+  }
 }
 
 
@@ -5,6 +5,7 @@
 #include <memory>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include "base/macros.h"
 #include "log/strict_consistent_store.h"
@@ -32,6 +33,7 @@ class LogSigner;
 class LoggedEntry;
 class Proxy;
 class ThreadPool;
+class TileExporter;
 class UrlFetcher;
 
 // Size of latest locally generated STH.
@@ -58,12 +60,33 @@ class Server {
   Proxy* proxy();
   libevent::HttpServer* http_server();
 
+  // The event loops answering HTTP requests (see --num_http_event_threads),
+  // the first of which is the main one, that of http_server() and
+  // proxy(). Each needs handlers of its own, added to its http_server(i),
+  // replying on its http_event_base(i) and proxying with its proxy(i).
+  size_t num_http_event_loops() const;
+  libevent::Base* http_event_base(size_t i);
+  libevent::HttpServer* http_server(size_t i);
+  Proxy* proxy(size_t i);
+  // With --numa, the NUMA node that event loop |i| runs on, and on which
+  // its handlers should be created (see ScopedNumaNode), or else -1.
+  int http_numa_node(size_t i) const;
+  // The pool for the handlers of event loop |i| to run requests on: that
+  // of its NUMA node with --numa, or else the internal pool.
+  ThreadPool* handler_pool(size_t i);
+
   void Initialise(bool is_mirror);
   void WaitForReplication() const;
   void Run();
 
  private:
+  struct HttpEventLoop;
+
+  HttpEventLoop* ExtraHttpLoop(size_t i) const;
+
   const std::shared_ptr<libevent::Base> event_base_;
+  // Those of the host with --numa, if it has more than one.
+  const std::vector<int> numa_nodes_;
   std::unique_ptr<libevent::EventPumpThread> event_pump_;
   libevent::HttpServer http_server_;
   Database* const db_;
@@ -76,13 +99,23 @@ class Server {
   util::SyncTask server_task_;
   StrictConsistentStore<LoggedEntry> consistent_store_;
   const std::unique_ptr<Frontend> frontend_;
+  // Outlives |log_lookup_|, which calls it back.
+  std::unique_ptr<TileExporter> tile_exporter_;
   std::unique_ptr<LogLookup> log_lookup_;
   std::unique_ptr<ClusterStateController<LoggedEntry>> cluster_controller_;
   std::unique_ptr<ContinuousFetcher> fetcher_;
   ThreadPool* const http_pool_;
   std::unique_ptr<Proxy> proxy_;
   std::unique_ptr<std::thread> node_refresh_thread_;
+  // Runs |gcm_exporter_|, away from the pools which serve requests.
+  std::unique_ptr<ThreadPool> gcm_pool_;
   std::unique_ptr<GCMExporter> gcm_exporter_;
+  // The event loops other than the main one. Destroyed before the rest
+  // (but for the pools below), so that they no longer use it.
+  std::vector<std::unique_ptr<HttpEventLoop>> extra_http_loops_;
+  // One per element of |numa_nodes_|, whose threads run there. Destroyed
+  // before the event loops, which they reply on.
+  std::vector<std::unique_ptr<ThreadPool>> numa_pools_;
 
   DISALLOW_COPY_AND_ASSIGN(Server);
 };
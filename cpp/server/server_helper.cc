@@ -1,7 +1,9 @@
 #include "log/strict_consistent_store.h"
 #include "server/server.h"
 #include "server/server_helper.h"
+#include "util/etcd_v3.h"
 #include "util/fake_etcd.h"
+#include "util/util.h"
 
 using cert_trans::Server;
 using google::RegisterFlagValidator;
@@ -11,9 +13,16 @@ using std::unique_ptr;
 // Main server configuration flags
 DEFINE_string(server, "localhost", "Server host");
 DEFINE_int32(port, 9999, "Server port");
+DEFINE_string(path_prefix, "",
+              "If set, the path under which the log is served, e.g. "
+              "\"/logs/2024h1\" for \"/logs/2024h1/ct/v1/get-sth\", so that "
+              "several logs can share a host name and port");
 DEFINE_string(etcd_root, "/root", "Root of cluster entries in etcd.");
 DEFINE_string(etcd_servers, "",
               "Comma separated list of 'hostname:port' of the etcd server(s)");
+DEFINE_bool(etcd_v3, false,
+            "Use the etcd v3 API (through the JSON gateway of the etcd "
+            "servers) rather than the v2 one.");
 DEFINE_bool(i_know_stand_alone_mode_can_lose_data, false,
             "Set this to allow stand-alone mode, even though it will lose "
             "submissions in the case of a crash.");
@@ -21,12 +30,28 @@ DEFINE_bool(i_know_stand_alone_mode_can_lose_data, false,
 // Storage related flags
 // TODO(alcutter): Just specify a root dir with a single flag.
 DEFINE_string(cert_dir, "", "Storage directory for certificates");
+DEFINE_string(segment_dir, "",
+              "Storage directory for certificates kept in append-only "
+              "segment files, instead of one file per certificate in "
+              "--cert_dir");
 DEFINE_string(tree_dir, "", "Storage directory for trees");
 DEFINE_string(meta_dir, "", "Storage directory for meta info");
 DEFINE_string(sqlite_db, "",
               "SQLite database for certificate and tree storage");
 DEFINE_string(leveldb_db, "",
               "LevelDB database for certificate and tree storage");
+DEFINE_string(merkle_tree_dir, "",
+              "If set, directory in which to keep the in-memory Merkle tree "
+              "in memory-mapped files, so that restarts only need to load "
+              "the entries added since the last tree update.");
+DEFINE_bool(merkle_tree_read_only, false,
+            "If set, follow the Merkle tree that another server on this "
+            "host keeps in --merkle_tree_dir, sharing its memory, instead "
+            "of building one.");
+DEFINE_string(tile_export_dir, "",
+              "If set, directory in which to write the tiles of the Merkle "
+              "tree as it grows, to be served by a static file server or "
+              "CDN.");
 // TODO(ekasper): sanity-check these against the directory structure.
 DEFINE_int32(cert_storage_depth, 0,
              "Subdirectory depth for certificates; if the directory is not "
@@ -34,6 +59,27 @@ DEFINE_int32(cert_storage_depth, 0,
 DEFINE_int32(tree_storage_depth, 0,
              "Subdirectory depth for tree signatures; if the directory is not "
              "empty, must match the existing depth");
+DEFINE_string(etcd_entry_blob_dir, "",
+              "If set, storage directory shared by all the nodes of the "
+              "cluster, for the pending entries, so that etcd only holds "
+              "small stubs pointing to them.");
+DEFINE_int32(etcd_entry_blob_storage_depth, 3,
+             "Subdirectory depth for the pending entries in "
+             "--etcd_entry_blob_dir; if the directory is not empty, must "
+             "match the existing depth.");
+DEFINE_int32(entry_hash_filter_mb, 0,
+             "If set, megabytes of memory for a Bloom filter of the hashes "
+             "of the entries in the database, which spares it the lookups "
+             "of most new submissions. Loaded from the database at "
+             "startup; 1MB holds about 800,000 entries.");
+DEFINE_int64(db_shard_entries, 0,
+             "If positive, the HTTP handlers read the entries of the log "
+             "from the shards in --db_shards, of this many entries each, "
+             "rather than from the database.");
+DEFINE_string(db_shards, "",
+              "Comma-separated list of the shards held by this node, as "
+              "<shard number>:<LevelDB directory>. Shard k holds the "
+              "entries from k * --db_shard_entries on, numbered from 0.");
 
 // Basic sanity checks on flag values.
 static bool ValidateWrite(const char* flagname, const string& path) {
@@ -75,10 +121,22 @@ static const bool c_st_dummy =
 static const bool t_st_dummy =
     RegisterFlagValidator(&FLAGS_tree_storage_depth, &ValidateIsNonNegative);
 
+static const bool entry_blob_dir_dummy =
+    RegisterFlagValidator(&FLAGS_etcd_entry_blob_dir, &ValidateWrite);
+
+static const bool e_st_dummy =
+    RegisterFlagValidator(&FLAGS_etcd_entry_blob_storage_depth,
+                          &ValidateIsNonNegative);
+
+static const bool hash_filter_dummy =
+    RegisterFlagValidator(&FLAGS_entry_hash_filter_mb,
+                          &ValidateIsNonNegative);
+
 namespace cert_trans {
 
 void EnsureValidatorsRegistered() {
   CHECK(cert_dir_dummy && tree_dir_dummy && c_st_dummy && t_st_dummy &&
+        entry_blob_dir_dummy && e_st_dummy && hash_filter_dummy &&
         port_dummy);
 }
 
@@ -102,28 +160,71 @@ bool IsStandalone(bool warn_data_loss) {
 
 unique_ptr<Database> ProvideDatabase() {
   if (!FLAGS_sqlite_db.empty() + !FLAGS_leveldb_db.empty() +
-          (!FLAGS_cert_dir.empty() | !FLAGS_tree_dir.empty()) !=
+          (!FLAGS_cert_dir.empty() | !FLAGS_segment_dir.empty() |
+           !FLAGS_tree_dir.empty()) !=
       1) {
     LOG(FATAL) << "Must specify exactly one database type. Check flags.";
   }
 
   if (FLAGS_sqlite_db.empty() && FLAGS_leveldb_db.empty()) {
-    CHECK_NE(FLAGS_cert_dir, FLAGS_tree_dir)
+    CHECK(FLAGS_cert_dir.empty() || FLAGS_segment_dir.empty())
+        << "Must specify only one of --cert_dir and --segment_dir";
+    CHECK_NE(FLAGS_cert_dir + FLAGS_segment_dir, FLAGS_tree_dir)
         << "Certificate directory and tree directory must differ";
   }
 
+  unique_ptr<Database> db;
   if (!FLAGS_sqlite_db.empty()) {
-    return unique_ptr<Database>(new SQLiteDB(FLAGS_sqlite_db));
+    db.reset(new MonitoredDatabase(
+        "sqlite", unique_ptr<Database>(new SQLiteDB(FLAGS_sqlite_db))));
   } else if (!FLAGS_leveldb_db.empty()) {
-    return unique_ptr<Database>(new LevelDB(FLAGS_leveldb_db));
+    db.reset(new MonitoredDatabase(
+        "leveldb", unique_ptr<Database>(new LevelDB(FLAGS_leveldb_db))));
+  } else if (!FLAGS_segment_dir.empty()) {
+    db.reset(new MonitoredDatabase(
+        "segmented_file",
+        unique_ptr<Database>(new SegmentedFileDB(
+            FLAGS_segment_dir,
+            new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth),
+            new FileStorage(FLAGS_meta_dir, 0)))));
   } else {
-    return unique_ptr<Database>(
-        new FileDB(new FileStorage(FLAGS_cert_dir, FLAGS_cert_storage_depth),
-                   new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth),
-                   new FileStorage(FLAGS_meta_dir, 0)));
+    db.reset(new MonitoredDatabase(
+        "file", unique_ptr<Database>(new FileDB(
+                    new FileStorage(FLAGS_cert_dir, FLAGS_cert_storage_depth),
+                    new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth),
+                    new FileStorage(FLAGS_meta_dir, 0)))));
+  }
+
+  if (FLAGS_entry_hash_filter_mb > 0) {
+    // Outside of the monitoring, so that the lookups it answers are not
+    // counted as reaching the storage.
+    db.reset(new HashFilteredDatabase(
+        std::move(db), int64_t(FLAGS_entry_hash_filter_mb) << 20));
+  }
+  return db;
+}
+
+
+unique_ptr<ReadOnlyDatabase> ProvideShardedDatabase() {
+  if (FLAGS_db_shard_entries <= 0) {
+    CHECK(FLAGS_db_shards.empty()) << "--db_shards needs --db_shard_entries";
+    return nullptr;
   }
 
-  LOG(FATAL) << "No usable database is configured by flags";
+  std::map<int64_t, unique_ptr<ReadOnlyDatabase>> shards;
+  for (const string& shard : util::split(FLAGS_db_shards)) {
+    const size_t colon(shard.find(':'));
+    CHECK_NE(colon, string::npos) << "Invalid shard in --db_shards: "
+                                  << shard;
+    const int64_t number(std::stoll(shard.substr(0, colon)));
+    CHECK_GE(number, 0) << "Invalid shard in --db_shards: " << shard;
+    unique_ptr<ReadOnlyDatabase> db(new LevelDB(shard.substr(colon + 1)));
+    CHECK(shards.emplace(number, std::move(db)).second)
+        << "Shard " << number << " appears twice in --db_shards";
+  }
+  CHECK(!shards.empty()) << "--db_shard_entries needs --db_shards";
+  return unique_ptr<ReadOnlyDatabase>(new ShardedDatabase(
+      FLAGS_db_shard_entries, std::move(shards), nullptr));
 }
 
 
@@ -132,9 +233,14 @@ unique_ptr<EtcdClient> ProvideEtcdClient(libevent::Base* event_base,
                                          UrlFetcher* fetcher) {
   // No need to enforce --warn-data-loss here as it will already have been
   // done if required
+  if (IsStandalone(false)) {
+    return unique_ptr<EtcdClient>(new FakeEtcdClient(event_base));
+  }
+  if (FLAGS_etcd_v3) {
+    return unique_ptr<EtcdClient>(
+        new EtcdV3Client(pool, fetcher, SplitHosts(FLAGS_etcd_servers)));
+  }
   return unique_ptr<EtcdClient>(
-      IsStandalone(false)
-          ? new FakeEtcdClient(event_base)
-          : new EtcdClient(pool, fetcher, SplitHosts(FLAGS_etcd_servers)));
+      new EtcdClient(pool, fetcher, SplitHosts(FLAGS_etcd_servers)));
 }
 }  // namespace cert_trans
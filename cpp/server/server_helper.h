@@ -15,7 +15,11 @@
 #include "log/database.h"
 #include "log/file_db.h"
 #include "log/file_storage.h"
+#include "log/hash_filtered_database.h"
 #include "log/leveldb_db.h"
+#include "log/monitored_database.h"
+#include "log/segmented_file_db.h"
+#include "log/sharded_database.h"
 #include "log/sqlite_db.h"
 #include "util/etcd.h"
 #include "util/executor.h"
@@ -48,6 +52,10 @@ bool IsStandalone(bool warn_data_loss);
 // Create one of the supported database types based on flags settings
 std::unique_ptr<Database> ProvideDatabase();
 
+// Create the ShardedDatabase of the shards held by this node, from
+// --db_shard_entries and --db_shards, or return NULL if they are not set.
+std::unique_ptr<ReadOnlyDatabase> ProvideShardedDatabase();
+
 // Create an EtcdClient implementation, either fake or real based on flags
 std::unique_ptr<EtcdClient> ProvideEtcdClient(libevent::Base* event_base,
                                               ThreadPool* pool,
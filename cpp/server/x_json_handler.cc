@@ -1,12 +1,19 @@
 #include "server/x_json_handler.h"
 
+#include <gflags/gflags.h>
 #include <functional>
 
 #include "log/frontend.h"
 #include "server/json_output.h"
+#include "util/status.h"
 #include "util/statusor.h"
+#include "util/task.h"
 #include "util/thread_pool.h"
 
+DEFINE_int32(max_jsons_per_add_jsons, 1000,
+             "maximum number of JSON objects accepted in one add-jsons "
+             "request");
+
 namespace cert_trans {
 
 using ct::LogEntry;
@@ -19,7 +26,9 @@ using std::multimap;
 using std::placeholders::_1;
 using std::shared_ptr;
 using std::string;
+using std::vector;
 using util::Status;
+using util::Task;
 
 
 namespace {
@@ -48,9 +57,28 @@ shared_ptr<JsonObject> ExtractJson(libevent::Base* base, evhttp_request* req) {
 }
 
 
+// Sets |entry| to the entry logging |json|, in the form json-c writes it
+// out, which is what makes it canonical.
+void MakeEntry(const JsonObject& json, LogEntry* entry) {
+  entry->set_type(X_JSON_ENTRY);
+  entry->mutable_x_json_entry()->set_json(json.ToString());
+}
+
+
 }  // namespace
 
 
+struct XJsonHttpHandler::JsonBatch {
+  explicit JsonBatch(size_t size) : entries(size), scts(size), statuses(size) {
+  }
+
+  vector<LogEntry> entries;
+  vector<SignedCertificateTimestamp> scts;
+  // Only the entries whose status is OK are queued.
+  vector<Status> statuses;
+};
+
+
 XJsonHttpHandler::XJsonHttpHandler(
     LogLookup* log_lookup, const ReadOnlyDatabase* db,
     const ClusterStateController<LoggedEntry>* controller, Frontend* frontend,
@@ -69,32 +97,90 @@ void XJsonHttpHandler::AddHandlers(libevent::HttpServer* server) {
     // correctly, rather than bloating the tree.
     AddProxyWrappedHandler(server, "/ct/v1/add-json",
                            bind(&XJsonHttpHandler::AddJson, this, _1));
+    AddProxyWrappedHandler(server, "/ct/v1/add-jsons",
+                           bind(&XJsonHttpHandler::AddJsons, this, _1),
+                           ThreadPool::Priority::BULK);
   }
 }
 
 
 void XJsonHttpHandler::AddJson(evhttp_request* req) {
+  if (ShedLoad(req, ThreadPool::Priority::NORMAL)) {
+    return;
+  }
+
   shared_ptr<JsonObject> json(ExtractJson(event_base_, req));
   if (!json) {
     return;
   }
 
-  pool_->Add(bind(&XJsonHttpHandler::BlockingAddJson, this, req, json));
+  const shared_ptr<JsonBatch> batch(make_shared<JsonBatch>(1));
+  MakeEntry(*json, &batch->entries[0]);
+  pool_->Add(bind(&XJsonHttpHandler::QueueJsons, this, req, batch, false));
 }
 
 
-void XJsonHttpHandler::BlockingAddJson(evhttp_request* req,
-                                       shared_ptr<JsonObject> json) const {
-  SignedCertificateTimestamp sct;
+void XJsonHttpHandler::AddJsons(evhttp_request* req) {
+  if (ShedLoad(req, ThreadPool::Priority::BULK)) {
+    return;
+  }
+
+  shared_ptr<JsonObject> json(ExtractJson(event_base_, req));
+  if (!json) {
+    return;
+  }
+  const JsonArray jsons(*json, "jsons");
+  if (!jsons.Ok()) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Missing or malformed \"jsons\" array.");
+  }
+  if (jsons.Length() > FLAGS_max_jsons_per_add_jsons) {
+    return SendJsonError(event_base_, req, HTTP_BADREQUEST,
+                         "Too many JSON objects.");
+  }
+
+  // The objects are written out from the request as parsed, with no
+  // further round trip.
+  const shared_ptr<JsonBatch> batch(make_shared<JsonBatch>(jsons.Length()));
+  for (int i = 0; i < jsons.Length(); ++i) {
+    const JsonObject element(jsons, i);
+    if (element.Ok()) {
+      MakeEntry(element, &batch->entries[i]);
+    } else {
+      batch->statuses[i] =
+          Status(util::error::INVALID_ARGUMENT, "Not a JSON object.");
+    }
+  }
+  if (batch->entries.empty()) {
+    return AddEntriesReply(req, batch->statuses, batch->scts);
+  }
+
+  pool_->Add(bind(&XJsonHttpHandler::QueueJsons, this, req, batch, true),
+             ThreadPool::Priority::BULK);
+}
 
-  LogEntry entry;
-  // do this here for now
-  entry.set_type(X_JSON_ENTRY);
-  entry.mutable_x_json_entry()->set_json(json->ToString());
 
-  AddEntryReply(req, CHECK_NOTNULL(frontend_)
-                         ->QueueProcessedEntry(Status::OK, entry, &sct),
-                sct);
+void XJsonHttpHandler::QueueJsons(evhttp_request* req,
+                                  const shared_ptr<JsonBatch>& batch,
+                                  bool batched) const {
+  vector<const LogEntry*> entries;
+  vector<SignedCertificateTimestamp*> scts;
+  for (size_t i = 0; i < batch->entries.size(); ++i) {
+    entries.push_back(&batch->entries[i]);
+    scts.push_back(&batch->scts[i]);
+  }
+  CHECK_NOTNULL(frontend_)->QueueProcessedEntries(
+      entries, scts, &batch->statuses,
+      new Task(
+          [this, req, batch, batched](Task* task) {
+            if (batched) {
+              AddEntriesReply(req, batch->statuses, batch->scts);
+            } else {
+              AddEntryReply(req, batch->statuses[0], batch->scts[0]);
+            }
+            delete task;
+          },
+          pool_));
 }
 
 
@@ -2,6 +2,7 @@
 #define CERT_TRANS_SERVER_X_JSON_HANDLER_H_
 
 #include <memory>
+#include <vector>
 
 #include "log/logged_entry.h"
 #include "server/handler.h"
@@ -15,7 +16,7 @@ class XJsonHttpHandler : public HttpHandler {
  public:
   // Does not take ownership of its parameters, which must outlive this
   // instance.  The |frontend| parameters can be NULL, in which case this
-  // server will not accept "add-json" requests.
+  // server will not accept "add-json" and "add-jsons" requests.
   XJsonHttpHandler(LogLookup* log_lookup, const ReadOnlyDatabase* db,
                    const ClusterStateController<LoggedEntry>* controller,
                    Frontend* frontend, ThreadPool* pool,
@@ -27,12 +28,21 @@ class XJsonHttpHandler : public HttpHandler {
   void AddHandlers(libevent::HttpServer* server) override;
 
  private:
+  struct JsonBatch;
+
   Frontend* const frontend_;
 
   void AddJson(evhttp_request* req);
-
-  void BlockingAddJson(evhttp_request* req,
-                       std::shared_ptr<JsonObject> json) const;
+  // Like AddJson(), for each of the objects of the "jsons" array of the
+  // request, which get their SCTs signed and are written to the store
+  // together.
+  void AddJsons(evhttp_request* req);
+
+  // Runs on |pool_|, queueing the entries of |batch| without holding the
+  // thread while the store writes them, and then replies with a single
+  // result, or with all of them if |batched|.
+  void QueueJsons(evhttp_request* req, const std::shared_ptr<JsonBatch>& batch,
+                  bool batched) const;
 
   DISALLOW_COPY_AND_ASSIGN(XJsonHttpHandler);
 };
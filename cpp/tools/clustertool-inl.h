@@ -7,6 +7,7 @@
 #include <memory>
 #include <string>
 
+#include "base/notification.h"
 #include "log/etcd_consistent_store.h"
 #include "log/log_signer.h"
 #include "log/logged_entry.h"
@@ -16,6 +17,7 @@
 #include "proto/ct.pb.h"
 #include "tools/clustertool.h"
 #include "util/etcd.h"
+#include "util/executor.h"
 #include "util/masterelection.h"
 #include "util/read_key.h"
 #include "util/status.h"
@@ -43,6 +45,63 @@ util::Status InitLog(const ct::ClusterConfig& cluster_config,
 }
 
 
+template <class Logged>
+util::Status RestoreLog(const ct::ClusterConfig& cluster_config,
+                        const ct::SignedTreeHead& sth,
+                        util::Executor* executor,
+                        ConsistentStore<Logged>* consistent_store) {
+  const util::StatusOr<ct::SignedTreeHead> existing(
+      consistent_store->GetServingSTH());
+  const bool already_serving(existing.ok() &&
+                             existing.ValueOrDie().SerializeAsString() ==
+                                 sth.SerializeAsString());
+
+  // Each write waits for etcd to confirm it, so send them both at once.
+  util::Status sth_status;
+  Notification sth_written;
+  executor->Add([consistent_store, &sth, already_serving, &sth_status,
+                 &sth_written]() {
+    if (!already_serving) {
+      sth_status = consistent_store->SetServingSTH(sth);
+    }
+    sth_written.Notify();
+  });
+  const util::Status config_status(
+      SetClusterConfig(cluster_config, consistent_store));
+  sth_written.WaitForNotification();
+  if (!sth_status.ok()) {
+    return sth_status;
+  }
+  if (!config_status.ok()) {
+    return config_status;
+  }
+
+  const util::StatusOr<ct::SignedTreeHead> serving(
+      consistent_store->GetServingSTH());
+  if (!serving.ok()) {
+    return serving.status();
+  }
+  if (serving.ValueOrDie().SerializeAsString() != sth.SerializeAsString()) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "Cluster serves another STH than the restored one");
+  }
+  const util::StatusOr<int64_t> next_sequence_number(
+      consistent_store->NextAvailableSequenceNumber());
+  if (!next_sequence_number.ok()) {
+    return next_sequence_number.status();
+  }
+  if (next_sequence_number.ValueOrDie() != sth.tree_size()) {
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "Cluster would sequence new entries from " +
+                            std::to_string(next_sequence_number.ValueOrDie()) +
+                            " rather than after the restored STH, at " +
+                            std::to_string(sth.tree_size()));
+  }
+  LOG(INFO) << "Restored cluster serving " << sth.tree_size() << " entries";
+  return util::Status::OK;
+}
+
+
 template <class Logged>
 util::Status SetClusterConfig(const ct::ClusterConfig& cluster_config,
                               ConsistentStore<Logged>* consistent_store) {
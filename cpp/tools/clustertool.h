@@ -3,9 +3,11 @@
 
 namespace ct {
 class ClusterConfig;
+class SignedTreeHead;
 }  // namespace ct
 
 namespace util {
+class Executor;
 class Status;
 }  // namespace util
 
@@ -20,6 +22,20 @@ util::Status InitLog(const ct::ClusterConfig& cluster_config,
                      TreeSigner<Logged>* tree_signer,
                      ConsistentStore<Logged>* consistent_store);
 
+// Restore a log cluster from a backup of its entries, which the nodes
+// have (e.g. from a snapshot), up to the verified |sth|:
+//  - Creates /serving_sth containing |sth| (or advances it to |sth|),
+//    while creating the /cluster_config entry, on |executor|.
+//  - Checks that the cluster now serves |sth|, and that it has mapped
+//    exactly the entries |sth| covers, so that new entries are
+//    sequenced right after them.
+// Running it again with the same |sth| only checks the cluster state.
+template <class Logged>
+util::Status RestoreLog(const ct::ClusterConfig& cluster_config,
+                        const ct::SignedTreeHead& sth,
+                        util::Executor* executor,
+                        ConsistentStore<Logged>* consistent_store);
+
 // Sets the cluster config
 template <class Logged>
 util::Status SetClusterConfig(const ct::ClusterConfig& cluster_config,
@@ -9,10 +9,13 @@
 
 #include "log/etcd_consistent_store.h"
 #include "log/log_signer.h"
+#include "log/log_verifier.h"
 #include "log/logged_entry.h"
+#include "log/snapshot.h"
 #include "log/sqlite_db.h"
 #include "log/strict_consistent_store.h"
 #include "log/tree_signer.h"
+#include "merkletree/merkle_verifier.h"
 #include "proto/cert_serializer.h"
 #include "proto/ct.pb.h"
 #include "tools/clustertool-inl.h"
@@ -32,6 +35,7 @@ using cert_trans::EtcdConsistentStore;
 using cert_trans::LoggedEntry;
 using cert_trans::MasterElection;
 using cert_trans::ReadPrivateKey;
+using cert_trans::ReadPublicKey;
 using cert_trans::SQLiteDB;
 using cert_trans::SplitHosts;
 using cert_trans::StrictConsistentStore;
@@ -49,6 +53,7 @@ using std::shared_ptr;
 using std::string;
 using std::unique_ptr;
 using util::Status;
+using util::StatusOr;
 
 DEFINE_string(cluster_config, "",
               "Path of file containing the cluster config (in ASCII proto "
@@ -56,6 +61,9 @@ DEFINE_string(cluster_config, "",
 DEFINE_string(etcd_servers, "",
               "Comma separated list of 'hostname:port' of the etcd server(s)");
 DEFINE_string(key, "", "PEM-encoded server private key file");
+DEFINE_string(snapshot_public_key, "",
+              "PEM-encoded public key of the log, used by restore to verify "
+              "the snapshot STH.");
 
 
 namespace {
@@ -72,7 +80,10 @@ void Usage() {
             << "\n"
             << "Commands:\n"
             << "  initlog     Initialise a new log.\n"
-            << "  set_config  Set/Change a cluster's config.\n";
+            << "  set_config  Set/Change a cluster's config.\n"
+            << "  restore <snapshot dir>\n"
+            << "              Restore a log whose nodes have the entries of "
+            << "the snapshot.\n";
 }
 
 
@@ -106,6 +117,18 @@ unique_ptr<MasterElection> BuildAndJoinMasterElection(
 }
 
 
+StatusOr<SignedTreeHead> ReadSnapshotSTH(const string& dir,
+                                         util::Executor* executor) {
+  CHECK(!FLAGS_snapshot_public_key.empty())
+      << "--snapshot_public_key is required to restore a snapshot";
+  const StatusOr<EVP_PKEY*> pubkey(ReadPublicKey(FLAGS_snapshot_public_key));
+  CHECK(pubkey.ok()) << "Failed to read public key file: " << pubkey.status();
+  const LogVerifier verifier(new LogSigVerifier(pubkey.ValueOrDie()),
+                             new MerkleVerifier(new Sha256Hasher));
+  return cert_trans::VerifySnapshot(dir, verifier, executor);
+}
+
+
 ClusterConfig LoadConfig() {
   ClusterConfig cluster_config;
   string cluster_config_str;
@@ -156,7 +179,7 @@ int main(int argc, char* argv[]) {
   const string node_id("clustertool");
   unique_ptr<MasterElection> election(
       BuildAndJoinMasterElection(node_id, event_base, &etcd_client));
-  ThreadPool internal_pool(4);
+  ThreadPool internal_pool("internal", 4);
   StrictConsistentStore<LoggedEntry> consistent_store(
       election.get(),
       new EtcdConsistentStore<LoggedEntry>(event_base.get(), &internal_pool,
@@ -175,6 +198,13 @@ int main(int argc, char* argv[]) {
   } else if (command == "set_config") {
     CHECK(!FLAGS_cluster_config.empty());
     status = SetClusterConfig(LoadConfig(), &consistent_store);
+  } else if (command == "restore" && argc == 3) {
+    ThreadPool restore_pool("restore");
+    const StatusOr<SignedTreeHead> sth(
+        ReadSnapshotSTH(argv[2], &restore_pool));
+    status = sth.ok() ? RestoreLog(LoadConfig(), sth.ValueOrDie(),
+                                   &restore_pool, &consistent_store)
+                      : sth.status();
   } else {
     Usage();
   }
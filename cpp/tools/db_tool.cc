@@ -9,13 +9,24 @@
 #include "log/file_db.h"
 #include "log/file_storage.h"
 #include "log/leveldb_db.h"
+#include "log/log_verifier.h"
 #include "log/logged_entry.h"
+#include "log/prefetching_iterator.h"
+#include "log/segmented_file_db.h"
+#include "log/snapshot.h"
 #include "log/sqlite_db.h"
+#include "merkletree/merkle_verifier.h"
+#include "merkletree/serial_hasher.h"
 #include "proto/serializer.h"
 #include "util/init.h"
+#include "util/read_key.h"
+#include "util/thread_pool.h"
 #include "util/util.h"
 
 DEFINE_string(cert_dir, "", "Storage directory for certificates");
+DEFINE_string(segment_dir, "",
+              "Storage directory for certificates kept in append-only "
+              "segment files");
 DEFINE_string(tree_dir, "", "Storage directory for trees");
 DEFINE_string(meta_dir, "", "Storage directory for meta info");
 DEFINE_int32(cert_storage_depth, 0,
@@ -32,37 +43,74 @@ DEFINE_string(leveldb_db, "",
 DEFINE_int64(start, 0, "Starting sequence number (inclusive).");
 DEFINE_int64(end, std::numeric_limits<int64_t>::max(),
              "Ending sequence number (inclusive).");
+DEFINE_int64(snapshot_entries_per_segment, 1000000,
+             "Number of entries per segment file written by export_snapshot.");
+DEFINE_string(snapshot_public_key, "",
+              "PEM-encoded public key of the log, used by import_snapshot to "
+              "verify the snapshot STH.");
+DEFINE_string(dest_cert_dir, "",
+              "Storage directory for certificates of the database that "
+              "copy_entries writes to");
+DEFINE_string(dest_segment_dir, "",
+              "Storage directory for certificates kept in append-only "
+              "segment files, of the database that copy_entries writes to");
+DEFINE_string(dest_tree_dir, "",
+              "Storage directory for trees of the database that "
+              "copy_entries writes to");
+DEFINE_string(dest_meta_dir, "",
+              "Storage directory for meta info of the database that "
+              "copy_entries writes to");
+DEFINE_int32(dest_cert_storage_depth, 0,
+             "Subdirectory depth for certificates in --dest_cert_dir");
+DEFINE_int32(dest_tree_storage_depth, 0,
+             "Subdirectory depth for tree signatures in --dest_tree_dir");
+DEFINE_string(dest_sqlite_db, "",
+              "SQLite database that copy_entries writes to");
+DEFINE_string(dest_leveldb_db, "",
+              "LevelDB database that copy_entries writes to");
+DEFINE_int32(copy_workers, 8,
+             "Number of ranges of entries that copy_entries copies at once, "
+             "each on its own thread.");
+DEFINE_int64(copy_entries_per_shard, 100000,
+             "Number of consecutive entries in each of the ranges that "
+             "copy_entries splits the log into.");
 
 using cert_trans::FileDB;
 using cert_trans::FileStorage;
+using cert_trans::Database;
 using cert_trans::LevelDB;
 using cert_trans::LoggedEntry;
 using cert_trans::ReadOnlyDatabase;
+using cert_trans::ReadPublicKey;
 using cert_trans::SQLiteDB;
+using cert_trans::SegmentedFileDB;
+using cert_trans::ThreadPool;
 using std::cerr;
 using std::cout;
 using std::function;
 using std::string;
 using std::unique_ptr;
 using util::InitCT;
+using util::StatusOr;
 using util::ToBase64;
 
 
 void Usage() {
   cerr << "Usage: db_tool [flags] <command>\n"
        << "Where <command> is one of:\n"
-       << "  dump_leaf_inputs\n";
+       << "  dump_leaf_inputs\n"
+       << "  export_snapshot <dir>\n"
+       << "  import_snapshot <dir>\n"
+       << "  copy_entries (to the database of the --dest_* flags)\n";
 }
 
 
 void ForEachLeaf(const ReadOnlyDatabase* db,
                  const function<void(const LoggedEntry& cert)>& f) {
-  unique_ptr<ReadOnlyDatabase::Iterator> it(db->ScanEntries(FLAGS_start));
+  unique_ptr<ReadOnlyDatabase::Iterator> it(
+      cert_trans::MaybeReadAhead(db->ScanRange(FLAGS_start, FLAGS_end)));
   LoggedEntry cert;
   while (it->GetNextEntry(&cert)) {
-    if (cert.sequence_number() > FLAGS_end) {
-      break;
-    }
     f(cert);
   }
 }
@@ -85,44 +133,140 @@ int DumpLeafInputs(const ReadOnlyDatabase* db) {
 }
 
 
-int main(int argc, char* argv[]) {
-  InitCT(&argc, &argv);
+int ExportSnapshot(const ReadOnlyDatabase* db, const string& dir) {
+  CHECK_NOTNULL(db);
+  ct::SignedTreeHead sth;
+  if (db->LatestTreeHead(&sth) != Database::LOOKUP_OK) {
+    LOG(ERROR) << "The database does not have an STH to export.";
+    return 1;
+  }
+  const util::Status status(cert_trans::ExportSnapshot(
+      *db, sth, FLAGS_snapshot_entries_per_segment, dir));
+  if (!status.ok()) {
+    LOG(ERROR) << "Failed to export snapshot: " << status;
+    return 1;
+  }
+  return 0;
+}
 
-  if (argc != 2) {
-    Usage();
+
+int ImportSnapshot(Database* db, const string& dir) {
+  CHECK_NOTNULL(db);
+  CHECK(!FLAGS_snapshot_public_key.empty())
+      << "--snapshot_public_key is required to import a snapshot";
+  const StatusOr<EVP_PKEY*> pubkey(ReadPublicKey(FLAGS_snapshot_public_key));
+  CHECK(pubkey.ok()) << "Failed to read public key file: " << pubkey.status();
+  const LogVerifier verifier(new LogSigVerifier(pubkey.ValueOrDie()),
+                             new MerkleVerifier(new Sha256Hasher));
+  ThreadPool pool;
+
+  const StatusOr<ct::SignedTreeHead> sth(
+      cert_trans::ImportSnapshot(dir, verifier, &pool, db));
+  if (!sth.ok()) {
+    LOG(ERROR) << "Failed to import snapshot: " << sth.status();
+    return 1;
+  }
+  if (db->WriteTreeHead(sth.ValueOrDie()) != Database::OK) {
+    LOG(WARNING) << "Could not write the snapshot STH to the database";
+  }
+  return 0;
+}
+
+
+int CopyEntries(const ReadOnlyDatabase* from, Database* to) {
+  CHECK_NOTNULL(from);
+  CHECK_NOTNULL(to);
+  ct::SignedTreeHead sth;
+  if (from->LatestTreeHead(&sth) != Database::LOOKUP_OK) {
+    LOG(ERROR) << "The database does not have an STH to copy.";
+    return 1;
+  }
+  ThreadPool pool("copy", FLAGS_copy_workers);
+
+  const util::Status status(
+      cert_trans::CopyEntries(*from, sth, FLAGS_copy_entries_per_shard,
+                              FLAGS_copy_workers, &pool, to));
+  if (!status.ok()) {
+    LOG(ERROR) << "Failed to copy entries: " << status;
     return 1;
   }
+  return 0;
+}
+
 
-  // ------8<----------8<---------8<-----------
-  // TODO(alcutter): Refactor this out into a common CreateDatabase() call
-  // somewhere.
-  if (!FLAGS_sqlite_db.empty() + !FLAGS_leveldb_db.empty() +
-          (!FLAGS_cert_dir.empty() | !FLAGS_tree_dir.empty()) !=
-      1) {
+// Opens the database described by the given flag values, of which only
+// |sqlite_db|, |leveldb_db|, or the directories can be set. Returns
+// NULL if none are.
+unique_ptr<Database> OpenDatabase(const string& sqlite_db,
+                                  const string& leveldb_db,
+                                  const string& cert_dir,
+                                  const string& segment_dir,
+                                  const string& tree_dir,
+                                  const string& meta_dir,
+                                  int cert_storage_depth,
+                                  int tree_storage_depth) {
+  const int num_types(!sqlite_db.empty() + !leveldb_db.empty() +
+                      (!cert_dir.empty() | !segment_dir.empty() |
+                       !tree_dir.empty()));
+  if (num_types == 0) {
+    return nullptr;
+  }
+  if (num_types != 1) {
     LOG(FATAL) << "Must only specify one database type.";
   }
 
-  if (FLAGS_sqlite_db.empty() && FLAGS_leveldb_db.empty()) {
-    CHECK_NE(FLAGS_cert_dir, FLAGS_tree_dir)
+  if (sqlite_db.empty() && leveldb_db.empty()) {
+    CHECK(cert_dir.empty() || segment_dir.empty())
+        << "Must specify only one of --cert_dir and --segment_dir";
+    CHECK_NE(cert_dir + segment_dir, tree_dir)
         << "Certificate directory and tree directory must differ";
   }
 
-  unique_ptr<ReadOnlyDatabase> db;
+  if (!sqlite_db.empty()) {
+    return unique_ptr<Database>(new SQLiteDB(sqlite_db));
+  } else if (!leveldb_db.empty()) {
+    return unique_ptr<Database>(new LevelDB(leveldb_db));
+  } else if (!segment_dir.empty()) {
+    return unique_ptr<Database>(
+        new SegmentedFileDB(segment_dir,
+                            new FileStorage(tree_dir, tree_storage_depth),
+                            new FileStorage(meta_dir, 0)));
+  }
+  return unique_ptr<Database>(
+      new FileDB(new FileStorage(cert_dir, cert_storage_depth),
+                 new FileStorage(tree_dir, tree_storage_depth),
+                 new FileStorage(meta_dir, 0)));
+}
 
-  if (!FLAGS_sqlite_db.empty()) {
-    db.reset(new SQLiteDB(FLAGS_sqlite_db));
-  } else if (!FLAGS_leveldb_db.empty()) {
-    db.reset(new LevelDB(FLAGS_leveldb_db));
-  } else {
-    db.reset(
-        new FileDB(new FileStorage(FLAGS_cert_dir, FLAGS_cert_storage_depth),
-                   new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth),
-                   new FileStorage(FLAGS_meta_dir, 0)));
+
+int main(int argc, char* argv[]) {
+  InitCT(&argc, &argv);
+
+  if (argc < 2) {
+    Usage();
+    return 1;
   }
-  // ------8<----------8<---------8<-----------
 
-  if (strcmp(argv[1], "dump_leaf_inputs") == 0) {
+  const unique_ptr<Database> db(OpenDatabase(
+      FLAGS_sqlite_db, FLAGS_leveldb_db, FLAGS_cert_dir, FLAGS_segment_dir,
+      FLAGS_tree_dir, FLAGS_meta_dir, FLAGS_cert_storage_depth,
+      FLAGS_tree_storage_depth));
+  CHECK(db) << "Must specify a database.";
+
+  if (argc == 2 && strcmp(argv[1], "dump_leaf_inputs") == 0) {
     return DumpLeafInputs(db.get());
+  } else if (argc == 3 && strcmp(argv[1], "export_snapshot") == 0) {
+    return ExportSnapshot(db.get(), argv[2]);
+  } else if (argc == 3 && strcmp(argv[1], "import_snapshot") == 0) {
+    return ImportSnapshot(db.get(), argv[2]);
+  } else if (argc == 2 && strcmp(argv[1], "copy_entries") == 0) {
+    const unique_ptr<Database> dest(OpenDatabase(
+        FLAGS_dest_sqlite_db, FLAGS_dest_leveldb_db, FLAGS_dest_cert_dir,
+        FLAGS_dest_segment_dir, FLAGS_dest_tree_dir, FLAGS_dest_meta_dir,
+        FLAGS_dest_cert_storage_depth, FLAGS_dest_tree_storage_depth));
+    CHECK(dest) << "copy_entries needs a database set with the --dest_* "
+                << "flags.";
+    return CopyEntries(db.get(), dest.get());
   } else {
     Usage();
     return 1;
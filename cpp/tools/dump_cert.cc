@@ -2,7 +2,10 @@
 #include <glog/logging.h>
 #include <fstream>
 #include <iostream>
+#include <string>
+#include <vector>
 
+#include "log/cert_names.h"
 #include "proto/ct.pb.h"
 #include "util/init.h"
 #include "util/util.h"
@@ -10,6 +13,8 @@
 using std::cout;
 using std::endl;
 using std::ifstream;
+using std::string;
+using std::vector;
 
 namespace {
 
@@ -33,6 +38,13 @@ void DumpLoggedCert(const char* filename) {
   if (pb.contents().has_entry())
     cout << "--- begin entry" << endl
          << pb.contents().entry().DebugString() << "--- end entry" << endl;
+
+  // Read straight from the DER, without having OpenSSL parse the cert.
+  vector<string> names;
+  if (pb.contents().has_entry() &&
+      cert_trans::ExtractDnsNames(pb.contents().entry(), &names))
+    for (const string& name : names)
+      cout << "dns name: " << name << endl;
 }
 
 
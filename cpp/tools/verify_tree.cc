@@ -0,0 +1,331 @@
+// Recomputes the root hash of every tree head stored in a database from
+// the leaf hashes of its entries, and reports those that do not match.
+//
+// The log is read in chunks of --chunk_bits (a power of two) leaves, by
+// --threads readers at once; each reader hashes its chunk into a single
+// subtree root, which the root of any tree head that covers whole chunks
+// is then made of. Only the partial chunk at the end of each tree head
+// has its own root computed, as the reader goes past it, so the log is
+// read only once however many tree heads there are.
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "base/notification.h"
+#include "log/database.h"
+#include "log/file_db.h"
+#include "log/file_storage.h"
+#include "log/leveldb_db.h"
+#include "log/segmented_file_db.h"
+#include "log/sqlite_db.h"
+#include "merkletree/compact_merkle_tree.h"
+#include "merkletree/serial_hasher.h"
+#include "merkletree/tree_hasher.h"
+#include "proto/ct.pb.h"
+#include "util/init.h"
+#include "util/thread_pool.h"
+#include "util/util.h"
+
+DEFINE_string(cert_dir, "", "Storage directory for certificates");
+DEFINE_string(segment_dir, "",
+              "Storage directory for certificates kept in append-only "
+              "segment files");
+DEFINE_string(tree_dir, "", "Storage directory for trees");
+DEFINE_string(meta_dir, "", "Storage directory for meta info");
+DEFINE_int32(cert_storage_depth, 0,
+             "Subdirectory depth for certificates; if the directory is not "
+             "empty, must match the existing depth.");
+DEFINE_int32(tree_storage_depth, 0,
+             "Subdirectory depth for tree signatures; if the directory is not "
+             "empty, must match the existing depth");
+DEFINE_string(sqlite_db, "",
+              "SQLite database for certificate and tree storage");
+DEFINE_string(leveldb_db, "",
+              "LevelDB database for certificate and tree storage");
+DEFINE_int32(threads, 8,
+             "Number of chunks of the log that are read and hashed at once, "
+             "each on its own thread.");
+DEFINE_int32(chunk_bits, 16,
+             "Each chunk of the log is 2^chunk_bits consecutive entries.");
+
+using cert_trans::Database;
+using cert_trans::FileDB;
+using cert_trans::FileStorage;
+using cert_trans::LevelDB;
+using cert_trans::Notification;
+using cert_trans::ReadOnlyDatabase;
+using cert_trans::SQLiteDB;
+using cert_trans::SegmentedFileDB;
+using cert_trans::ThreadPool;
+using ct::SignedTreeHead;
+using std::atomic;
+using std::cout;
+using std::lock_guard;
+using std::map;
+using std::min;
+using std::mutex;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using util::InitCT;
+using util::ToBase64;
+
+namespace {
+
+
+// What the readers share. The partial roots to compute are all set up
+// before they start, so that each reader only writes to those of its own
+// chunk.
+struct VerifyState {
+  VerifyState(const ReadOnlyDatabase* db, int64_t tree_size,
+              int64_t chunk_size)
+      : db_(CHECK_NOTNULL(db)),
+        tree_size_(tree_size),
+        chunk_size_(chunk_size),
+        num_chunks_((tree_size + chunk_size - 1) / chunk_size),
+        chunk_roots_(tree_size / chunk_size),
+        partial_roots_(num_chunks_),
+        next_chunk_(0),
+        num_running_(0),
+        first_missing_(tree_size) {
+  }
+
+  // Hashes chunks until there are none left.
+  void Run();
+  void HashChunk(int64_t chunk);
+  void RecordMissing(int64_t sequence_number);
+
+  const ReadOnlyDatabase* const db_;
+  const int64_t tree_size_;
+  const int64_t chunk_size_;
+  const int64_t num_chunks_;
+  // The root of each complete chunk.
+  vector<string> chunk_roots_;
+  // For each chunk, the roots of its first leaves, by their number, for
+  // the tree heads that end inside it.
+  vector<map<int64_t, string>> partial_roots_;
+  atomic<int64_t> next_chunk_;
+  atomic<int> num_running_;
+  Notification done_;
+
+  mutex lock_;
+  // The first sequence number lacking a leaf hash, or |tree_size_|.
+  int64_t first_missing_;
+};
+
+
+void VerifyState::Run() {
+  for (int64_t chunk = next_chunk_++; chunk < num_chunks_;
+       chunk = next_chunk_++) {
+    HashChunk(chunk);
+  }
+  if (--num_running_ == 0) {
+    done_.Notify();
+  }
+}
+
+
+void VerifyState::HashChunk(int64_t chunk) {
+  const int64_t start(chunk * chunk_size_);
+  const int64_t end(min(start + chunk_size_, tree_size_));
+  map<int64_t, string>& partial_roots(partial_roots_[chunk]);
+  auto next_partial(partial_roots.begin());
+
+  CompactMerkleTree tree(new Sha256Hasher);
+  unique_ptr<ReadOnlyDatabase::LeafHashIterator> it(
+      db_->ScanLeafHashes(start));
+  int64_t sequence_number;
+  string leaf_hash;
+  vector<string> leaf_hashes;
+  for (int64_t index = start; index < end;) {
+    // Hash up to the end of the next partial root, or of the chunk.
+    const int64_t batch_end(next_partial == partial_roots.end()
+                                ? end
+                                : start + next_partial->first);
+    leaf_hashes.clear();
+    for (; index < batch_end; ++index) {
+      if (!it->GetNextLeafHash(&sequence_number, &leaf_hash) ||
+          sequence_number != index) {
+        RecordMissing(index);
+        return;
+      }
+      leaf_hashes.push_back(leaf_hash);
+    }
+    tree.AddLeafHashes(leaf_hashes);
+
+    if (next_partial != partial_roots.end()) {
+      next_partial->second = tree.CurrentRoot();
+      ++next_partial;
+    }
+  }
+
+  if (end - start == chunk_size_) {
+    chunk_roots_[chunk] = tree.CurrentRoot();
+  }
+}
+
+
+void VerifyState::RecordMissing(int64_t sequence_number) {
+  lock_guard<mutex> lock(lock_);
+  first_missing_ = min(first_missing_, sequence_number);
+}
+
+
+// Computes the root of the first |tree_size| leaves, from the roots of
+// the complete chunks and that of the partial chunk they end with.
+class RootBuilder {
+ public:
+  RootBuilder(const VerifyState& state)
+      : state_(state), hasher_(new Sha256Hasher) {
+    levels_.push_back(state.chunk_roots_);
+    while (levels_.back().size() > 1) {
+      const vector<string>& below(levels_.back());
+      vector<string> level;
+      for (size_t i = 0; i + 1 < below.size(); i += 2) {
+        level.push_back(hasher_.HashChildren(below[i], below[i + 1]));
+      }
+      levels_.push_back(level);
+    }
+  }
+
+  string Root(int64_t tree_size) const {
+    if (tree_size == 0) {
+      return hasher_.HashEmpty();
+    }
+    const int64_t num_chunks(tree_size / state_.chunk_size_);
+    const int64_t remainder(tree_size % state_.chunk_size_);
+
+    // The complete subtrees that the tree is made of, left to right: one
+    // from each level of chunks with its bit set in |num_chunks|, then
+    // the partial chunk.
+    vector<const string*> subtrees;
+    int64_t offset(0);
+    for (int level = levels_.size() - 1; level >= 0; --level) {
+      if (num_chunks & (int64_t(1) << level)) {
+        subtrees.push_back(&levels_[level][offset >> level]);
+        offset += int64_t(1) << level;
+      }
+    }
+    if (remainder > 0) {
+      subtrees.push_back(&state_.partial_roots_[num_chunks].at(remainder));
+    }
+
+    string root(*subtrees.back());
+    for (int i = subtrees.size() - 2; i >= 0; --i) {
+      root = hasher_.HashChildren(*subtrees[i], root);
+    }
+    return root;
+  }
+
+ private:
+  const VerifyState& state_;
+  TreeHasher hasher_;
+  // The roots of the complete subtrees of 2^i chunks, for each level i.
+  vector<vector<string>> levels_;
+};
+
+
+// Opens the database described by the flags, of which only --sqlite_db,
+// --leveldb_db, or the directories can be set.
+unique_ptr<Database> OpenDatabase() {
+  const int num_types(!FLAGS_sqlite_db.empty() + !FLAGS_leveldb_db.empty() +
+                      (!FLAGS_cert_dir.empty() | !FLAGS_segment_dir.empty() |
+                       !FLAGS_tree_dir.empty()));
+  CHECK_EQ(1, num_types) << "Must specify exactly one database type.";
+
+  if (!FLAGS_sqlite_db.empty()) {
+    return unique_ptr<Database>(new SQLiteDB(FLAGS_sqlite_db));
+  } else if (!FLAGS_leveldb_db.empty()) {
+    return unique_ptr<Database>(new LevelDB(FLAGS_leveldb_db));
+  }
+
+  CHECK(FLAGS_cert_dir.empty() || FLAGS_segment_dir.empty())
+      << "Must specify only one of --cert_dir and --segment_dir";
+  CHECK_NE(FLAGS_cert_dir + FLAGS_segment_dir, FLAGS_tree_dir)
+      << "Certificate directory and tree directory must differ";
+  if (!FLAGS_segment_dir.empty()) {
+    return unique_ptr<Database>(new SegmentedFileDB(
+        FLAGS_segment_dir,
+        new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth),
+        new FileStorage(FLAGS_meta_dir, 0)));
+  }
+  return unique_ptr<Database>(
+      new FileDB(new FileStorage(FLAGS_cert_dir, FLAGS_cert_storage_depth),
+                 new FileStorage(FLAGS_tree_dir, FLAGS_tree_storage_depth),
+                 new FileStorage(FLAGS_meta_dir, 0)));
+}
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  InitCT(&argc, &argv);
+  CHECK_GT(FLAGS_threads, 0);
+  CHECK(FLAGS_chunk_bits >= 0 && FLAGS_chunk_bits < 40)
+      << "--chunk_bits is out of range";
+
+  const unique_ptr<Database> db(OpenDatabase());
+  const vector<SignedTreeHead> sths(db->ScanTreeHeads());
+  if (sths.empty()) {
+    LOG(ERROR) << "The database has no tree heads to verify.";
+    return 1;
+  }
+
+  int64_t tree_size(0);
+  for (const SignedTreeHead& sth : sths) {
+    CHECK_GE(sth.tree_size(), 0);
+    tree_size = std::max(tree_size, sth.tree_size());
+  }
+  VerifyState state(db.get(), tree_size, int64_t(1) << FLAGS_chunk_bits);
+  for (const SignedTreeHead& sth : sths) {
+    const int64_t remainder(sth.tree_size() % state.chunk_size_);
+    if (remainder > 0) {
+      state.partial_roots_[sth.tree_size() / state.chunk_size_][remainder];
+    }
+  }
+
+  LOG(INFO) << "Verifying " << sths.size() << " tree heads of up to "
+            << tree_size << " entries";
+  if (state.num_chunks_ > 0) {
+    ThreadPool pool("verify", FLAGS_threads);
+    const int num_readers(min<int64_t>(FLAGS_threads, state.num_chunks_));
+    state.num_running_ = num_readers;
+    for (int i = 0; i < num_readers; ++i) {
+      pool.Add([&state]() { state.Run(); });
+    }
+    state.done_.WaitForNotification();
+  }
+
+  const RootBuilder roots(state);
+  int num_bad(0);
+  for (const SignedTreeHead& sth : sths) {
+    if (sth.tree_size() > state.first_missing_) {
+      LOG(ERROR) << "Cannot verify tree head at " << sth.timestamp()
+                 << " of size " << sth.tree_size()
+                 << ": the database lacks entry " << state.first_missing_;
+      ++num_bad;
+      continue;
+    }
+    const string root(roots.Root(sth.tree_size()));
+    if (root != sth.sha256_root_hash()) {
+      LOG(ERROR) << "Tree head at " << sth.timestamp() << " of size "
+                 << sth.tree_size() << " has root "
+                 << ToBase64(sth.sha256_root_hash()) << ", but the entries "
+                 << "have root " << ToBase64(root);
+      ++num_bad;
+    }
+  }
+
+  cout << "Verified " << sths.size() - num_bad << " of " << sths.size()
+       << " tree heads\n";
+  return num_bad == 0 ? 0 : 1;
+}
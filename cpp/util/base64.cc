@@ -0,0 +1,430 @@
+#include "util/base64.h"
+
+#include <glog/logging.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define CT_BASE64_X86 1
+#include <immintrin.h>
+#endif
+
+namespace util {
+namespace {
+
+using internal::Base64Impl;
+
+
+const char kChars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+const uint8_t kInvalid = 0x80;
+
+
+// The value of each base64 character, or kInvalid.
+struct ValueTable {
+  ValueTable() {
+    memset(values, kInvalid, sizeof(values));
+    for (int i = 0; i < 64; ++i) {
+      values[static_cast<uint8_t>(kChars[i])] = i;
+    }
+  }
+
+  uint8_t values[256];
+};
+
+
+const uint8_t* Values() {
+  static const ValueTable* const table(new ValueTable);
+  return table->values;
+}
+
+
+size_t EncodeScalar(const uint8_t* in, size_t size, char* out) {
+  char* o(out);
+  size_t i(0);
+  for (; i + 3 <= size; i += 3) {
+    const uint32_t n((in[i] << 16) | (in[i + 1] << 8) | in[i + 2]);
+    *o++ = kChars[n >> 18];
+    *o++ = kChars[(n >> 12) & 0x3f];
+    *o++ = kChars[(n >> 6) & 0x3f];
+    *o++ = kChars[n & 0x3f];
+  }
+  if (i < size) {
+    const uint32_t n((in[i] << 16) | (i + 1 < size ? in[i + 1] << 8 : 0));
+    *o++ = kChars[n >> 18];
+    *o++ = kChars[(n >> 12) & 0x3f];
+    *o++ = i + 1 < size ? kChars[(n >> 6) & 0x3f] : '=';
+    *o++ = '=';
+  }
+  return o - out;
+}
+
+
+// Decodes |size| characters, a multiple of four, the last four of which
+// may be padded.
+bool DecodeScalar(const uint8_t* in, size_t size, char* out,
+                  size_t* out_size) {
+  *out_size = 0;
+  if (size == 0) {
+    return true;
+  }
+  size_t padding(0);
+  if (in[size - 1] == '=') {
+    padding = in[size - 2] == '=' ? 2 : 1;
+  }
+
+  const uint8_t* const values(Values());
+  char* o(out);
+  // The last group of four is done separately.
+  const size_t full(size - 4);
+  for (size_t i = 0; i < full; i += 4) {
+    const uint8_t a(values[in[i]]);
+    const uint8_t b(values[in[i + 1]]);
+    const uint8_t c(values[in[i + 2]]);
+    const uint8_t d(values[in[i + 3]]);
+    if ((a | b | c | d) & kInvalid) {
+      return false;
+    }
+    *o++ = static_cast<char>((a << 2) | (b >> 4));
+    *o++ = static_cast<char>((b << 4) | (c >> 2));
+    *o++ = static_cast<char>((c << 6) | d);
+  }
+
+  const uint8_t a(values[in[full]]);
+  const uint8_t b(values[in[full + 1]]);
+  const uint8_t c(padding > 1 ? 0 : values[in[full + 2]]);
+  const uint8_t d(padding > 0 ? 0 : values[in[full + 3]]);
+  if ((a | b | c | d) & kInvalid) {
+    return false;
+  }
+  // Like b64_pton(), insist that the bits the padding leaves over are
+  // zero, so that each string of bytes has just the one encoding.
+  if ((padding == 2 && (b & 0x0f) != 0) || (padding == 1 && (c & 0x03) != 0)) {
+    return false;
+  }
+  *o++ = static_cast<char>((a << 2) | (b >> 4));
+  if (padding < 2) {
+    *o++ = static_cast<char>((b << 4) | (c >> 2));
+  }
+  if (padding < 1) {
+    *o++ = static_cast<char>((c << 6) | d);
+  }
+  *out_size = o - out;
+  return true;
+}
+
+
+#ifdef CT_BASE64_X86
+
+// The vector codecs below follow Wojciech Muła's and Alfred Klomp's
+// descriptions of SIMD base64. Each 16 characters of base64 stand for
+// 12 bytes; encoding spreads each 3 bytes over 4 byte lanes, shifted so
+// that each lane holds one 6-bit index, which is then translated into
+// its character by adding an offset that depends on which range the
+// index falls in. Decoding classifies each character by its nibbles to
+// both validate it and find the offset back to its value, then packs
+// the values together again. Whatever is left over, and any block with
+// an invalid character, is done by the scalar code.
+
+
+__attribute__((target("ssse3"))) __m128i EncodeIndicesSsse3(__m128i in) {
+  // Bytes 0..11 into the lanes of indices, each four from three bytes
+  // in big-endian order: [b1 b0 b2 b1] for bytes b0 b1 b2.
+  in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3,
+                                         4, 1, 2, 0, 1));
+  const __m128i t0(_mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00)));
+  const __m128i t1(_mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040)));
+  const __m128i t2(_mm_and_si128(in, _mm_set1_epi32(0x003f03f0)));
+  const __m128i t3(_mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010)));
+  return _mm_or_si128(t1, t3);
+}
+
+
+__attribute__((target("ssse3"))) __m128i TranslateSsse3(__m128i indices) {
+  // 0 for A-Z, 1 for a-z, 2..11 for 0-9, 12 for '+' and 13 for '/'...
+  __m128i range(_mm_subs_epu8(indices, _mm_set1_epi8(51)));
+  // ...except that A-Z is moved to 13.
+  const __m128i upper(_mm_cmpgt_epi8(_mm_set1_epi8(26), indices));
+  range = _mm_or_si128(range, _mm_and_si128(upper, _mm_set1_epi8(13)));
+  const __m128i shift(_mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52,
+                                    '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                                    '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+                                    '/' - 63, 'A', 0, 0));
+  return _mm_add_epi8(indices, _mm_shuffle_epi8(shift, range));
+}
+
+
+__attribute__((target("ssse3"))) size_t EncodeSsse3(const uint8_t* in,
+                                                    size_t size, char* out) {
+  char* o(out);
+  size_t i(0);
+  // Each load reads 16 bytes to use 12 of them.
+  for (; size - i >= 16; i += 12, o += 16) {
+    const __m128i block(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(o),
+                     TranslateSsse3(EncodeIndicesSsse3(block)));
+  }
+  return (o - out) + EncodeScalar(in + i, size - i, o);
+}
+
+
+// Turns 16 characters into 12 bytes, in the low twelve bytes of
+// |*bytes|, or returns false if any of them is not base64.
+__attribute__((target("ssse3"))) bool DecodeBlockSsse3(__m128i chars,
+                                                       __m128i* bytes) {
+  const __m128i lut_lo(_mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                     0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b,
+                                     0x1b, 0x1a));
+  const __m128i lut_hi(_mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04,
+                                     0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                     0x10, 0x10));
+  const __m128i lut_roll(_mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0,
+                                       0, 0, 0, 0, 0, 0));
+  const __m128i mask_2f(_mm_set1_epi8(0x2f));
+
+  const __m128i hi_nibbles(
+      _mm_and_si128(_mm_srli_epi32(chars, 4), mask_2f));
+  const __m128i lo_nibbles(_mm_and_si128(chars, mask_2f));
+  const __m128i lo(_mm_shuffle_epi8(lut_lo, lo_nibbles));
+  const __m128i hi(_mm_shuffle_epi8(lut_hi, hi_nibbles));
+  if (_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi),
+                                       _mm_setzero_si128())) != 0) {
+    return false;
+  }
+
+  // '/' shares its high nibble with '+', but needs a different offset.
+  const __m128i eq_2f(_mm_cmpeq_epi8(chars, mask_2f));
+  const __m128i roll(
+      _mm_shuffle_epi8(lut_roll, _mm_add_epi8(eq_2f, hi_nibbles)));
+  const __m128i values(_mm_add_epi8(chars, roll));
+
+  const __m128i merged(
+      _mm_maddubs_epi16(values, _mm_set1_epi32(0x01400140)));
+  const __m128i packed(_mm_madd_epi16(merged, _mm_set1_epi32(0x00011000)));
+  *bytes = _mm_shuffle_epi8(packed, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8,
+                                                  14, 13, 12, -1, -1, -1,
+                                                  -1));
+  return true;
+}
+
+
+__attribute__((target("ssse3"))) bool DecodeSsse3(const uint8_t* in,
+                                                  size_t size, char* out,
+                                                  size_t* out_size) {
+  char* o(out);
+  size_t i(0);
+  // Each store writes 16 bytes to keep 12 of them, so eight characters
+  // (six bytes) must be left for the extra four. That also keeps the
+  // padding away from the vector code.
+  for (; size - i >= 16 + 8; i += 16, o += 12) {
+    __m128i bytes;
+    if (!DecodeBlockSsse3(_mm_loadu_si128(
+                              reinterpret_cast<const __m128i*>(in + i)),
+                          &bytes)) {
+      // Leave it to the scalar code to fail.
+      break;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(o), bytes);
+  }
+  size_t rest;
+  const bool ret(DecodeScalar(in + i, size - i, o, &rest));
+  *out_size = (o - out) + rest;
+  return ret;
+}
+
+
+// The same, but 32 characters at a time, as two lanes of 16.
+__attribute__((target("avx2"))) __m256i Duplicate(__m128i x) {
+  return _mm256_inserti128_si256(_mm256_castsi128_si256(x), x, 1);
+}
+
+
+__attribute__((target("avx2"))) size_t EncodeAvx2(const uint8_t* in,
+                                                  size_t size, char* out) {
+  const __m256i shuffle(Duplicate(_mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4,
+                                               5, 3, 4, 1, 2, 0, 1)));
+  const __m256i shift(Duplicate(
+      _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                    '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+                    '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0)));
+  char* o(out);
+  size_t i(0);
+  // The second lane is loaded from 12 bytes on, and reads 16.
+  for (; size - i >= 12 + 16; i += 24, o += 32) {
+    const __m128i lo(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)));
+    const __m128i hi(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12)));
+    __m256i block(
+        _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1));
+    block = _mm256_shuffle_epi8(block, shuffle);
+    const __m256i t0(_mm256_and_si256(block, _mm256_set1_epi32(0x0fc0fc00)));
+    const __m256i t1(_mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040)));
+    const __m256i t2(_mm256_and_si256(block, _mm256_set1_epi32(0x003f03f0)));
+    const __m256i t3(_mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010)));
+    const __m256i indices(_mm256_or_si256(t1, t3));
+
+    __m256i range(_mm256_subs_epu8(indices, _mm256_set1_epi8(51)));
+    const __m256i upper(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices));
+    range = _mm256_or_si256(range,
+                            _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(o),
+                        _mm256_add_epi8(indices,
+                                        _mm256_shuffle_epi8(shift, range)));
+  }
+  return (o - out) + EncodeSsse3(in + i, size - i, o);
+}
+
+
+__attribute__((target("avx2"))) bool DecodeAvx2(const uint8_t* in,
+                                                size_t size, char* out,
+                                                size_t* out_size) {
+  const __m256i lut_lo(Duplicate(
+      _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                    0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a)));
+  const __m256i lut_hi(Duplicate(
+      _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10,
+                    0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10)));
+  const __m256i lut_roll(Duplicate(_mm_setr_epi8(
+      0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0)));
+  const __m256i mask_2f(_mm256_set1_epi8(0x2f));
+  const __m256i pack(Duplicate(_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14,
+                                             13, 12, -1, -1, -1, -1)));
+  // Moves the twelve bytes of the second lane down next to the first's.
+  const __m256i compact(_mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1));
+
+  char* o(out);
+  size_t i(0);
+  // Each store writes 32 bytes to keep 24, so 12 characters (nine
+  // bytes) must be left for the extra eight.
+  for (; size - i >= 32 + 12; i += 32, o += 24) {
+    const __m256i chars(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i)));
+    const __m256i hi_nibbles(
+        _mm256_and_si256(_mm256_srli_epi32(chars, 4), mask_2f));
+    const __m256i lo_nibbles(_mm256_and_si256(chars, mask_2f));
+    const __m256i lo(_mm256_shuffle_epi8(lut_lo, lo_nibbles));
+    const __m256i hi(_mm256_shuffle_epi8(lut_hi, hi_nibbles));
+    if (_mm256_movemask_epi8(_mm256_cmpgt_epi8(
+            _mm256_and_si256(lo, hi), _mm256_setzero_si256())) != 0) {
+      break;
+    }
+
+    const __m256i eq_2f(_mm256_cmpeq_epi8(chars, mask_2f));
+    const __m256i roll(
+        _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles)));
+    const __m256i values(_mm256_add_epi8(chars, roll));
+    const __m256i merged(
+        _mm256_maddubs_epi16(values, _mm256_set1_epi32(0x01400140)));
+    const __m256i packed(
+        _mm256_madd_epi16(merged, _mm256_set1_epi32(0x00011000)));
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(o),
+        _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(packed, pack),
+                                    compact));
+  }
+  size_t rest;
+  const bool ret(DecodeSsse3(in + i, size - i, o, &rest));
+  *out_size = (o - out) + rest;
+  return ret;
+}
+
+#endif  // CT_BASE64_X86
+
+
+Base64Impl BestImpl() {
+  if (internal::Base64ImplSupported(Base64Impl::AVX2)) {
+    return Base64Impl::AVX2;
+  }
+  if (internal::Base64ImplSupported(Base64Impl::SSSE3)) {
+    return Base64Impl::SSSE3;
+  }
+  return Base64Impl::SCALAR;
+}
+
+
+Base64Impl ChosenImpl() {
+  static const Base64Impl impl(BestImpl());
+  return impl;
+}
+
+
+}  // namespace
+
+
+size_t Base64Encode(const char* in, size_t size, char* out) {
+  return internal::Base64Encode(ChosenImpl(), in, size, out);
+}
+
+
+bool Base64Decode(const char* in, size_t size, char* out, size_t* out_size) {
+  return internal::Base64Decode(ChosenImpl(), in, size, out, out_size);
+}
+
+
+namespace internal {
+
+
+bool Base64ImplSupported(Base64Impl impl) {
+  switch (impl) {
+    case Base64Impl::SCALAR:
+      return true;
+#ifdef CT_BASE64_X86
+    case Base64Impl::SSSE3:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("ssse3");
+    case Base64Impl::AVX2:
+      __builtin_cpu_init();
+      return __builtin_cpu_supports("avx2");
+#else
+    case Base64Impl::SSSE3:
+    case Base64Impl::AVX2:
+      return false;
+#endif
+  }
+  return false;
+}
+
+
+size_t Base64Encode(Base64Impl impl, const char* in, size_t size,
+                    char* out) {
+  DCHECK(Base64ImplSupported(impl));
+  const uint8_t* const src(reinterpret_cast<const uint8_t*>(in));
+  switch (impl) {
+#ifdef CT_BASE64_X86
+    case Base64Impl::AVX2:
+      return EncodeAvx2(src, size, out);
+    case Base64Impl::SSSE3:
+      return EncodeSsse3(src, size, out);
+#endif
+    default:
+      return EncodeScalar(src, size, out);
+  }
+}
+
+
+bool Base64Decode(Base64Impl impl, const char* in, size_t size, char* out,
+                  size_t* out_size) {
+  DCHECK(Base64ImplSupported(impl));
+  if (size % 4 != 0) {
+    *out_size = 0;
+    return false;
+  }
+  const uint8_t* const src(reinterpret_cast<const uint8_t*>(in));
+  switch (impl) {
+#ifdef CT_BASE64_X86
+    case Base64Impl::AVX2:
+      return DecodeAvx2(src, size, out, out_size);
+    case Base64Impl::SSSE3:
+      return DecodeSsse3(src, size, out, out_size);
+#endif
+    default:
+      return DecodeScalar(src, size, out, out_size);
+  }
+}
+
+
+}  // namespace internal
+}  // namespace util
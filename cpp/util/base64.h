@@ -0,0 +1,60 @@
+#ifndef CERT_TRANS_UTIL_BASE64_H_
+#define CERT_TRANS_UTIL_BASE64_H_
+
+#include <stddef.h>
+
+namespace util {
+
+
+// The number of characters of the (padded) base64 of |size| bytes.
+inline size_t Base64EncodedSize(size_t size) {
+  return (size + 2) / 3 * 4;
+}
+
+
+// The most bytes that |size| characters of base64 can decode to.
+inline size_t Base64DecodedMaxSize(size_t size) {
+  return size / 4 * 3;
+}
+
+
+// Encodes the |size| bytes at |in| into the Base64EncodedSize(size)
+// characters at |out|, with padding, and returns that number.
+//
+// This, and Base64Decode(), use SSSE3 or AVX2 instructions where the CPU
+// has them, deciding at run time.
+size_t Base64Encode(const char* in, size_t size, char* out);
+
+
+// Decodes the |size| characters of padded base64 at |in| into the
+// bytes at |out|, which must have room for Base64DecodedMaxSize(size)
+// of them, setting |*out_size| to how many there are. Returns false if
+// |in| is not valid base64 (with no whitespace), in which case the
+// contents of |out| are unspecified.
+bool Base64Decode(const char* in, size_t size, char* out, size_t* out_size);
+
+
+namespace internal {
+
+
+// The implementations that Base64Encode() and Base64Decode() choose
+// from, to test them all.
+enum class Base64Impl {
+  SCALAR,
+  SSSE3,
+  AVX2,
+};
+
+
+// Whether |impl| was built in and can run on this CPU.
+bool Base64ImplSupported(Base64Impl impl);
+
+size_t Base64Encode(Base64Impl impl, const char* in, size_t size, char* out);
+bool Base64Decode(Base64Impl impl, const char* in, size_t size, char* out,
+                  size_t* out_size);
+
+
+}  // namespace internal
+}  // namespace util
+
+#endif  // CERT_TRANS_UTIL_BASE64_H_
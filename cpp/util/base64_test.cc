@@ -0,0 +1,150 @@
+#include "util/base64.h"
+
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace util {
+namespace {
+
+using internal::Base64Impl;
+using std::string;
+using std::vector;
+
+
+const char kChars[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+vector<Base64Impl> SupportedImpls() {
+  vector<Base64Impl> impls;
+  for (Base64Impl impl :
+       {Base64Impl::SCALAR, Base64Impl::SSSE3, Base64Impl::AVX2}) {
+    if (internal::Base64ImplSupported(impl)) {
+      impls.push_back(impl);
+    }
+  }
+  return impls;
+}
+
+
+string Encode(Base64Impl impl, const string& data) {
+  string out(Base64EncodedSize(data.size()), '\0');
+  const size_t size(
+      internal::Base64Encode(impl, data.data(), data.size(), &out[0]));
+  EXPECT_EQ(out.size(), size);
+  return out;
+}
+
+
+bool Decode(Base64Impl impl, const string& in, string* out) {
+  out->assign(Base64DecodedMaxSize(in.size()), '\0');
+  size_t size;
+  const bool ret(
+      internal::Base64Decode(impl, in.data(), in.size(), &(*out)[0], &size));
+  if (ret) {
+    out->resize(size);
+  }
+  return ret;
+}
+
+
+// A string of |size| bytes in which every index turns up.
+string TestData(size_t size) {
+  string data;
+  for (size_t i = 0; i < size; ++i) {
+    data.push_back(static_cast<char>(i * 37 + (i >> 8)));
+  }
+  return data;
+}
+
+
+TEST(Base64Test, KnownValues) {
+  for (Base64Impl impl : SupportedImpls()) {
+    EXPECT_EQ("", Encode(impl, ""));
+    EXPECT_EQ("Zg==", Encode(impl, "f"));
+    EXPECT_EQ("Zm8=", Encode(impl, "fo"));
+    EXPECT_EQ("Zm9v", Encode(impl, "foo"));
+    EXPECT_EQ("Zm9vYg==", Encode(impl, "foob"));
+    EXPECT_EQ("Zm9vYmE=", Encode(impl, "fooba"));
+    EXPECT_EQ("Zm9vYmFy", Encode(impl, "foobar"));
+  }
+}
+
+
+TEST(Base64Test, MatchesScalar) {
+  const vector<Base64Impl> impls(SupportedImpls());
+  // Long enough to go through the vector loops several times, and every
+  // length of the remainder after them.
+  for (size_t size = 0; size < 300; ++size) {
+    const string data(TestData(size));
+    const string expected(Encode(Base64Impl::SCALAR, data));
+    for (Base64Impl impl : impls) {
+      const string encoded(Encode(impl, data));
+      EXPECT_EQ(expected, encoded) << static_cast<int>(impl) << " " << size;
+      string decoded;
+      EXPECT_TRUE(Decode(impl, encoded, &decoded))
+          << static_cast<int>(impl) << " " << size;
+      EXPECT_EQ(data, decoded) << static_cast<int>(impl) << " " << size;
+    }
+  }
+}
+
+
+TEST(Base64Test, AllCharacters) {
+  string encoded;
+  for (int i = 0; i < 10; ++i) {
+    encoded += kChars;
+  }
+  for (Base64Impl impl : SupportedImpls()) {
+    string decoded;
+    ASSERT_TRUE(Decode(impl, encoded, &decoded));
+    EXPECT_EQ(encoded, Encode(impl, decoded));
+  }
+}
+
+
+TEST(Base64Test, RejectsInvalid) {
+  const string valid(Encode(Base64Impl::SCALAR, TestData(150)));
+  for (Base64Impl impl : SupportedImpls()) {
+    string decoded;
+    // In every position, so both in the vector blocks and after them.
+    for (size_t i = 0; i < valid.size(); ++i) {
+      for (char c : {'\0', ' ', '\n', '-', '_', '.', ':', '@', '[', '`', '{',
+                     '\x7f', '\x80', '\xff', '='}) {
+        string invalid(valid);
+        invalid[i] = c;
+        EXPECT_FALSE(Decode(impl, invalid, &decoded))
+            << static_cast<int>(impl) << " " << i << " " << c;
+      }
+    }
+    EXPECT_FALSE(Decode(impl, "Zm9", &decoded));
+    EXPECT_FALSE(Decode(impl, "Zm9vY", &decoded));
+    EXPECT_FALSE(Decode(impl, "Z===", &decoded));
+    EXPECT_FALSE(Decode(impl, "====", &decoded));
+    EXPECT_FALSE(Decode(impl, "Zm=v", &decoded));
+    // The bits left over by the padding must be zero.
+    EXPECT_FALSE(Decode(impl, "Zh==", &decoded));
+    EXPECT_FALSE(Decode(impl, "Zm9=", &decoded));
+  }
+}
+
+
+TEST(Base64Test, FromBase64StillAcceptsWhitespace) {
+  EXPECT_EQ("foobar", FromBase64("Zm9v\nYmFy"));
+  EXPECT_EQ("foobar", FromBase64(ToBase64("foobar").c_str()));
+  EXPECT_EQ("", FromBase64("Zm9v!"));
+}
+
+
+}  // namespace
+}  // namespace util
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,78 @@
+#include "util/bench_results.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <cmath>
+#include <fstream>
+
+#include "util/json_writer.h"
+
+DEFINE_string(bench_results_out, "",
+              "file to write the results of the benchmark to, in JSON, for "
+              "test/perf_check.py");
+
+using std::string;
+
+namespace cert_trans {
+
+
+BenchResults::BenchResults(const string& benchmark) : benchmark_(benchmark) {
+}
+
+
+void BenchResults::Add(const string& name, double value, const string& unit,
+                       Better better) {
+  metrics_.push_back(Metric{name, value, unit, better});
+}
+
+
+void BenchResults::Write() {
+  if (FLAGS_bench_results_out.empty()) {
+    return;
+  }
+
+  struct rusage usage;
+  PCHECK(getrusage(RUSAGE_SELF, &usage) == 0);
+  // ru_maxrss is in kilobytes on Linux.
+  Add("peak_rss_bytes", usage.ru_maxrss * 1024.0, "bytes", LOWER_IS_BETTER);
+
+  string out;
+  JsonWriter json(&out);
+  json.StartObject();
+  json.Add("benchmark", benchmark_);
+  json.Key("metrics");
+  json.StartArray();
+  for (const Metric& metric : metrics_) {
+    json.StartObject();
+    json.Add("name", metric.name);
+    json.Key("value");
+    // JSON has no infinities, e.g. for the rate of something too quick
+    // to time.
+    char value[32];
+    const int size(std::isfinite(metric.value)
+                       ? snprintf(value, sizeof(value), "%.17g",
+                                  metric.value)
+                       : snprintf(value, sizeof(value), "null"));
+    json.Raw(value, size);
+    json.Add("unit", metric.unit);
+    json.Add("better", string(metric.better == HIGHER_IS_BETTER ? "higher"
+                                                                 : "lower"));
+    json.EndObject();
+  }
+  json.EndArray();
+  json.EndObject();
+  out.push_back('\n');
+
+  std::ofstream file(FLAGS_bench_results_out.c_str(),
+                     std::ios::out | std::ios::trunc);
+  file << out;
+  file.close();
+  PCHECK(!file.fail()) << "writing " << FLAGS_bench_results_out;
+  LOG(INFO) << "wrote " << metrics_.size() << " results to "
+            << FLAGS_bench_results_out;
+}
+
+
+}  // namespace cert_trans
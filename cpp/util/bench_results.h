@@ -0,0 +1,66 @@
+#ifndef CERT_TRANS_UTIL_BENCH_RESULTS_H_
+#define CERT_TRANS_UTIL_BENCH_RESULTS_H_
+
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// The measurements of a benchmark, written to --bench_results_out in
+// JSON for test/perf_check.py to compare against a baseline, as
+//
+//   {"benchmark":"bench_database","metrics":[
+//     {"name":"leveldb/lookup_by_index/ops_per_second","value":123456.7,
+//      "unit":"ops/s","better":"higher"}, ...]}
+//
+// with the peak RSS of the process added when they are written. Nothing
+// is written without --bench_results_out, so benchmarks can record their
+// results unconditionally.
+class BenchResults {
+ public:
+  enum Better {
+    HIGHER_IS_BETTER,
+    LOWER_IS_BETTER,
+  };
+
+  explicit BenchResults(const std::string& benchmark);
+
+  // Names are made unique by the benchmark, e.g. "<backend>/<workload>/
+  // <measure>".
+  void Add(const std::string& name, double value, const std::string& unit,
+           Better better);
+
+  void AddThroughput(const std::string& name, double value,
+                     const std::string& unit) {
+    Add(name, value, unit, HIGHER_IS_BETTER);
+  }
+
+  // |seconds| is recorded in microseconds, which suits most latencies.
+  void AddLatency(const std::string& name, double seconds) {
+    Add(name, seconds * 1e6, "us", LOWER_IS_BETTER);
+  }
+
+  // Adds "peak_rss_bytes", and writes everything out, if asked to.
+  void Write();
+
+ private:
+  struct Metric {
+    std::string name;
+    double value;
+    std::string unit;
+    Better better;
+  };
+
+  const std::string benchmark_;
+  std::vector<Metric> metrics_;
+
+  DISALLOW_COPY_AND_ASSIGN(BenchResults);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_BENCH_RESULTS_H_
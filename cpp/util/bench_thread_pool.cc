@@ -0,0 +1,123 @@
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/notification.h"
+#include "util/bench_results.h"
+#include "util/thread_pool.h"
+
+DECLARE_bool(thread_pool_work_stealing);
+
+using cert_trans::BenchResults;
+using cert_trans::Notification;
+using cert_trans::ThreadPool;
+using std::atomic;
+using std::bind;
+using std::chrono::duration;
+using std::chrono::steady_clock;
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+
+DEFINE_int32(num_producers, 4,
+             "number of threads adding closures from outside of the pool");
+DEFINE_int32(closures_per_producer, 100000,
+             "number of closures added by each producer");
+DEFINE_int32(fanout, 0,
+             "number of closures each closure added by a producer adds in "
+             "turn, from a thread of the pool");
+DEFINE_int32(pool_threads, 0,
+             "number of threads in the pool, 0 for one per core");
+
+namespace {
+
+
+BenchResults results("bench_thread_pool");
+
+
+struct State {
+  State(ThreadPool* pool, int64_t total)
+      : pool_(CHECK_NOTNULL(pool)), num_left_(total) {
+  }
+
+  void Done() {
+    if (--num_left_ == 0) {
+      done_.Notify();
+    }
+  }
+
+  void Work() {
+    for (int i = 0; i < FLAGS_fanout; ++i) {
+      pool_->Add(bind(&State::Done, this));
+    }
+    Done();
+  }
+
+  ThreadPool* const pool_;
+  atomic<int64_t> num_left_;
+  Notification done_;
+};
+
+
+void Produce(State* state) {
+  for (int i = 0; i < FLAGS_closures_per_producer; ++i) {
+    state->pool_->Add(bind(&State::Work, state));
+  }
+}
+
+
+void RunBenchmark(bool work_stealing) {
+  FLAGS_thread_pool_work_stealing = work_stealing;
+  unique_ptr<ThreadPool> pool(FLAGS_pool_threads > 0
+                                  ? new ThreadPool(FLAGS_pool_threads)
+                                  : new ThreadPool);
+  const int64_t total(static_cast<int64_t>(FLAGS_num_producers) *
+                      FLAGS_closures_per_producer * (1 + FLAGS_fanout));
+  State state(pool.get(), total);
+
+  const steady_clock::time_point start(steady_clock::now());
+  vector<thread> producers;
+  for (int i = 0; i < FLAGS_num_producers; ++i) {
+    producers.emplace_back(bind(Produce, &state));
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  state.done_.WaitForNotification();
+  const duration<double> elapsed(steady_clock::now() - start);
+
+  LOG(INFO) << (work_stealing ? "work stealing" : "shared queue") << ": "
+            << total << " closures in " << elapsed.count() << "s ("
+            << total / elapsed.count() << " closures/s)";
+  results.AddThroughput(string(work_stealing ? "work_stealing"
+                                             : "shared_queue") +
+                            "/closures_per_second",
+                        total / elapsed.count(), "closures/s");
+}
+
+
+}  // namespace
+
+
+int main(int argc, char* argv[]) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+
+  CHECK_GT(FLAGS_num_producers, 0);
+  CHECK_GT(FLAGS_closures_per_producer, 0);
+  CHECK_GE(FLAGS_fanout, 0);
+  CHECK_GE(FLAGS_pool_threads, 0);
+
+  RunBenchmark(false);
+  RunBenchmark(true);
+
+  results.Write();
+  return 0;
+}
@@ -0,0 +1,142 @@
+#include "util/cached_resolver.h"
+
+#include <glog/logging.h>
+#include <algorithm>
+#include <functional>
+#include <utility>
+
+using std::chrono::duration;
+using std::chrono::duration_cast;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::move;
+using std::mutex;
+using std::string;
+using std::unique_lock;
+using std::unique_ptr;
+
+namespace cert_trans {
+
+
+const size_t CachedResolver::kNumShards;
+
+
+CachedResolver::CachedResolver(unique_ptr<libevent::Base::Resolver> resolver,
+                               const duration<double>& ttl,
+                               const duration<double>& negative_ttl)
+    : resolver_(move(resolver)),
+      ttl_(duration_cast<steady_clock::duration>(ttl)),
+      negative_ttl_(duration_cast<steady_clock::duration>(negative_ttl)),
+      stopping_(false),
+      refresh_thread_(&CachedResolver::Refresh, this) {
+  CHECK(resolver_);
+  CHECK_GT(ttl_.count(), 0);
+  CHECK_GE(negative_ttl_.count(), 0);
+}
+
+
+CachedResolver::~CachedResolver() {
+  {
+    lock_guard<mutex> lock(queue_lock_);
+    stopping_ = true;
+  }
+  queue_cond_.notify_all();
+  refresh_thread_.join();
+}
+
+
+string CachedResolver::Resolve(const string& host) {
+  string address;
+  if (Lookup(host, false, &address)) {
+    return address;
+  }
+  return Update(host);
+}
+
+
+bool CachedResolver::ResolveCached(const string& host, string* address) {
+  return Lookup(host, true, CHECK_NOTNULL(address)) && !address->empty();
+}
+
+
+bool CachedResolver::Lookup(const string& host, bool queue_missing,
+                            string* address) {
+  const steady_clock::time_point now(steady_clock::now());
+  Shard* const shard(&shards_[std::hash<string>()(host) % kNumShards]);
+  bool found(false);
+  bool refresh(false);
+  {
+    lock_guard<mutex> lock(shard->lock);
+    auto it(shard->entries.find(host));
+    if (it == shard->entries.end() && queue_missing) {
+      // Expired from the start, only here so that it is queued once.
+      it = shard->entries
+               .emplace(host, Entry{string(), now, now, false})
+               .first;
+    }
+    if (it != shard->entries.end()) {
+      Entry* const entry(&it->second);
+      found = now < entry->expires;
+      if (found) {
+        *address = entry->address;
+      }
+      if ((found ? now >= entry->refresh_at : queue_missing) &&
+          !entry->refreshing) {
+        entry->refreshing = true;
+        refresh = true;
+      }
+    }
+  }
+
+  if (refresh) {
+    {
+      lock_guard<mutex> lock(queue_lock_);
+      queue_.push_back(host);
+    }
+    queue_cond_.notify_one();
+  }
+  return found;
+}
+
+
+string CachedResolver::Update(const string& host) {
+  const string address(resolver_->Resolve(host));
+  const steady_clock::time_point now(steady_clock::now());
+  Shard* const shard(&shards_[std::hash<string>()(host) % kNumShards]);
+  lock_guard<mutex> lock(shard->lock);
+  Entry* const entry(&shard->entries[host]);
+  entry->refreshing = false;
+  if (address.empty() && !entry->address.empty() && now < entry->expires) {
+    // Better to keep on using the address that worked until it expires,
+    // trying again no sooner than after a failed lookup otherwise.
+    LOG(WARNING) << "Could not refresh the address of " << host;
+    entry->refresh_at = std::min(entry->expires, now + negative_ttl_);
+    return entry->address;
+  }
+  entry->address = address;
+  const steady_clock::duration ttl(address.empty() ? negative_ttl_ : ttl_);
+  entry->refresh_at = now + ttl * 3 / 4;
+  entry->expires = now + ttl;
+  return address;
+}
+
+
+void CachedResolver::Refresh() {
+  while (true) {
+    string host;
+    {
+      unique_lock<mutex> lock(queue_lock_);
+      queue_cond_.wait(lock, [this]() { return stopping_ || !queue_.empty(); });
+      if (stopping_) {
+        return;
+      }
+      host = move(queue_.front());
+      queue_.pop_front();
+    }
+    VLOG(1) << "Refreshing the address of " << host;
+    Update(host);
+  }
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,90 @@
+#ifndef CERT_TRANS_UTIL_CACHED_RESOLVER_H_
+#define CERT_TRANS_UTIL_CACHED_RESOLVER_H_
+
+#include <stddef.h>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "base/macros.h"
+#include "util/libevent_wrapper.h"
+
+namespace cert_trans {
+
+
+// Keeps the addresses that another resolver finds, so that reconnecting
+// to the same hosts over and over does not mean as many lookups. Host
+// names which cannot be resolved are kept too, for a shorter time.
+//
+// An address is refreshed on a thread of its own once it is three
+// quarters of the way to expiring, while the cached one is still handed
+// out, and kept until it expires if the refresh fails. Lookups only
+// lock the shard of their host name, and only resolve on the calling
+// thread when they have nothing to return.
+//
+// This class is thread-safe.
+class CachedResolver : public libevent::Base::Resolver {
+ public:
+  // Keeps addresses for |ttl|, and failures for |negative_ttl|.
+  CachedResolver(std::unique_ptr<libevent::Base::Resolver> resolver,
+                 const std::chrono::duration<double>& ttl,
+                 const std::chrono::duration<double>& negative_ttl);
+  ~CachedResolver() override;
+
+  std::string Resolve(const std::string& host) override;
+
+  // Does not block: on a miss, |host| is resolved in the background, for
+  // later calls.
+  bool ResolveCached(const std::string& host, std::string* address) override;
+
+ private:
+  struct Entry {
+    // Empty if |host| could not be resolved.
+    std::string address;
+    std::chrono::steady_clock::time_point refresh_at;
+    std::chrono::steady_clock::time_point expires;
+    // Whether it is queued for the refresh thread.
+    bool refreshing;
+  };
+
+  struct Shard {
+    std::mutex lock;
+    std::unordered_map<std::string, Entry> entries;
+  };
+
+  static const size_t kNumShards = 16;
+
+  // Looks |host| up in the cache, and queues it for a refresh if it is
+  // due, or missing and |queue_missing|. Returns whether it has an
+  // entry, and sets |*address| to it.
+  bool Lookup(const std::string& host, bool queue_missing,
+              std::string* address);
+  // Resolves |host| with |resolver_| and stores the result.
+  std::string Update(const std::string& host);
+  void Refresh();
+
+  const std::unique_ptr<libevent::Base::Resolver> resolver_;
+  const std::chrono::steady_clock::duration ttl_;
+  const std::chrono::steady_clock::duration negative_ttl_;
+  std::array<Shard, kNumShards> shards_;
+
+  std::mutex queue_lock_;
+  std::condition_variable queue_cond_;
+  // The host names for the refresh thread to resolve.
+  std::deque<std::string> queue_;
+  bool stopping_;
+  std::thread refresh_thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(CachedResolver);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_CACHED_RESOLVER_H_
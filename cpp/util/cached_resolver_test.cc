@@ -0,0 +1,160 @@
+#include "util/cached_resolver.h"
+
+#include <gtest/gtest.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::atomic;
+using std::chrono::milliseconds;
+using std::chrono::seconds;
+using std::string;
+using std::unique_ptr;
+
+
+const char kHost[] = "example.com";
+const char kAddress[] = "192.0.2.1";
+const char kOtherAddress[] = "192.0.2.2";
+
+
+// Resolves every host name to |*address|, or fails if it is empty.
+class FakeResolver : public libevent::Base::Resolver {
+ public:
+  FakeResolver(atomic<int>* lookups, const string* address)
+      : lookups_(lookups), address_(address) {
+  }
+
+  string Resolve(const string& host) override {
+    ++*lookups_;
+    return *address_;
+  }
+
+ private:
+  atomic<int>* const lookups_;
+  const string* const address_;
+};
+
+
+class CachedResolverTest : public ::testing::Test {
+ protected:
+  CachedResolverTest() : lookups_(0), address_(kAddress) {
+  }
+
+  unique_ptr<CachedResolver> NewResolver(milliseconds ttl,
+                                         milliseconds negative_ttl) {
+    return unique_ptr<CachedResolver>(new CachedResolver(
+        unique_ptr<libevent::Base::Resolver>(
+            new FakeResolver(&lookups_, &address_)),
+        ttl, negative_ttl));
+  }
+
+  // Waits for the background lookups to get to |lookups|.
+  void WaitForLookups(int lookups) {
+    for (int i = 0; i < 1000 && lookups_ < lookups; ++i) {
+      std::this_thread::sleep_for(milliseconds(1));
+    }
+    // Leaves the refresh thread time to store its result.
+    std::this_thread::sleep_for(milliseconds(10));
+    EXPECT_EQ(lookups, lookups_);
+  }
+
+  atomic<int> lookups_;
+  string address_;
+};
+
+
+TEST_F(CachedResolverTest, CachesAddresses) {
+  const unique_ptr<CachedResolver> resolver(
+      NewResolver(seconds(60), seconds(60)));
+  EXPECT_EQ(kAddress, resolver->Resolve(kHost));
+  EXPECT_EQ(kAddress, resolver->Resolve(kHost));
+  EXPECT_EQ(1, lookups_);
+
+  string address;
+  EXPECT_TRUE(resolver->ResolveCached(kHost, &address));
+  EXPECT_EQ(kAddress, address);
+  EXPECT_EQ(1, lookups_);
+
+  EXPECT_EQ(kAddress, resolver->Resolve("example.org"));
+  EXPECT_EQ(2, lookups_);
+}
+
+
+TEST_F(CachedResolverTest, CachesFailures) {
+  address_.clear();
+  const unique_ptr<CachedResolver> resolver(
+      NewResolver(seconds(60), milliseconds(50)));
+  EXPECT_EQ("", resolver->Resolve(kHost));
+  EXPECT_EQ("", resolver->Resolve(kHost));
+  string address;
+  EXPECT_FALSE(resolver->ResolveCached(kHost, &address));
+  EXPECT_EQ(1, lookups_);
+
+  address_ = kAddress;
+  std::this_thread::sleep_for(milliseconds(60));
+  EXPECT_EQ(kAddress, resolver->Resolve(kHost));
+  EXPECT_EQ(2, lookups_);
+}
+
+
+TEST_F(CachedResolverTest, ResolvesMissesInBackground) {
+  const unique_ptr<CachedResolver> resolver(
+      NewResolver(seconds(60), seconds(60)));
+  string address;
+  EXPECT_FALSE(resolver->ResolveCached(kHost, &address));
+  EXPECT_FALSE(resolver->ResolveCached(kHost, &address));
+  WaitForLookups(1);
+
+  EXPECT_TRUE(resolver->ResolveCached(kHost, &address));
+  EXPECT_EQ(kAddress, address);
+  EXPECT_EQ(kAddress, resolver->Resolve(kHost));
+  EXPECT_EQ(1, lookups_);
+}
+
+
+TEST_F(CachedResolverTest, RefreshesBeforeExpiring) {
+  const unique_ptr<CachedResolver> resolver(
+      NewResolver(milliseconds(200), seconds(60)));
+  EXPECT_EQ(kAddress, resolver->Resolve(kHost));
+
+  // Past three quarters of the TTL, the old address is still handed out
+  // while the new one is looked up.
+  address_ = kOtherAddress;
+  std::this_thread::sleep_for(milliseconds(160));
+  EXPECT_EQ(kAddress, resolver->Resolve(kHost));
+  WaitForLookups(2);
+  EXPECT_EQ(kOtherAddress, resolver->Resolve(kHost));
+  EXPECT_EQ(2, lookups_);
+}
+
+
+TEST_F(CachedResolverTest, KeepsAddressIfRefreshFails) {
+  const unique_ptr<CachedResolver> resolver(
+      NewResolver(milliseconds(200), seconds(60)));
+  EXPECT_EQ(kAddress, resolver->Resolve(kHost));
+
+  address_.clear();
+  std::this_thread::sleep_for(milliseconds(160));
+  EXPECT_EQ(kAddress, resolver->Resolve(kHost));
+  WaitForLookups(2);
+  EXPECT_EQ(kAddress, resolver->Resolve(kHost));
+
+  // Once it expires, the failure is what is left.
+  std::this_thread::sleep_for(milliseconds(50));
+  EXPECT_EQ("", resolver->Resolve(kHost));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
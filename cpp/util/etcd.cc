@@ -3,9 +3,11 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <ctime>
+#include <deque>
 #include <utility>
 #include <event2/http.h>
 
+#include "monitoring/trace.h"
 #include "util/json_wrapper.h"
 #include "util/libevent_wrapper.h"
 #include "util/statusor.h"
@@ -15,14 +17,17 @@ namespace libevent = cert_trans::libevent;
 using std::atoll;
 using std::bind;
 using std::chrono::seconds;
+using std::chrono::steady_clock;
 using std::chrono::system_clock;
 using std::ctime;
+using std::deque;
 using std::list;
 using std::lock_guard;
 using std::make_pair;
 using std::make_shared;
 using std::map;
 using std::max;
+using std::min;
 using std::move;
 using std::mutex;
 using std::ostringstream;
@@ -32,6 +37,7 @@ using std::stoi;
 using std::string;
 using std::time_t;
 using std::to_string;
+using std::unique_lock;
 using std::unique_ptr;
 using std::vector;
 using util::Executor;
@@ -50,6 +56,12 @@ DEFINE_bool(etcd_quorum, true,
             "unless you *know* what you're doing.");
 DEFINE_int32(etcd_connection_timeout_seconds, 10,
              "Number of seconds after which to timeout etcd connections.");
+DEFINE_int32(etcd_request_deadline_seconds, 30,
+             "Number of seconds after which to give up on an etcd request "
+             "other than a watch, including its retries; 0 for no deadline.");
+DEFINE_bool(etcd_watch_multiplex, true,
+            "Share a single hanging etcd request between all the watches of "
+            "a client, rather than having one for each of them.");
 
 namespace cert_trans {
 
@@ -400,6 +412,43 @@ string UrlEscapeAndJoinParams(const map<string, string>& params) {
 static const EtcdClient::Node kInvalidNode(-1, -1, "", false, "", {}, true);
 
 
+// Removes the trailing slash of |key|, if any, as watching "/a/" is
+// the same as watching "/a".
+string WatchPath(const string& key) {
+  if (key.size() > 1 && key.back() == '/') {
+    return key.substr(0, key.size() - 1);
+  }
+  return key;
+}
+
+
+// Whether a watch of |path| (as returned by WatchPath()) receives the
+// changes to |key|.
+bool IsWatchedBy(const string& path, const string& key) {
+  if (path == "/") {
+    return true;
+  }
+  return key.compare(0, path.size(), path) == 0 &&
+         (key.size() == path.size() || key[path.size()] == '/');
+}
+
+
+// Returns the deepest path watching all of both |a| and |b|.
+string CommonWatchPath(const string& a, const string& b) {
+  size_t len(0);
+  while (len < a.size() && len < b.size() && a[len] == b[len]) {
+    ++len;
+  }
+  if ((len == a.size() || a[len] == '/') &&
+      (len == b.size() || b[len] == '/')) {
+    return a.substr(0, len);
+  }
+  const size_t slash(a.rfind('/', len - 1));
+  CHECK_NE(slash, string::npos);
+  return slash == 0 ? "/" : a.substr(0, slash);
+}
+
+
 }  // namespace
 
 
@@ -415,6 +464,12 @@ struct EtcdClient::RequestState {
 
     req_.verb = verb;
     SetHostPort(host_port);
+    // Watches hang until there is a change to report.
+    if (FLAGS_etcd_request_deadline_seconds > 0 &&
+        params.find("wait") == params.end()) {
+      req_.deadline = steady_clock::now() +
+                      seconds(FLAGS_etcd_request_deadline_seconds);
+    }
 
     if (FLAGS_etcd_consistent) {
       params.insert(make_pair("consistent", "true"));
@@ -458,12 +513,41 @@ struct EtcdClient::RequestState {
 };
 
 
+struct EtcdClient::WatchHub {
+  WatchHub()
+      : index_(-1), generation_(0), polling_(false), num_sending_(0) {
+  }
+
+  mutex lock_;
+  // The watches, in the order they started.
+  list<WatchState*> watches_;
+  // What the poll asks for, which covers all of |watches_|, or empty if
+  // there are none.
+  string path_;
+  // The highest index seen by the poll, which the next one starts
+  // after, or -1 until a watch has done its initial get.
+  int64_t index_;
+  // Incremented whenever the poll in progress must be ignored, rather
+  // than waited for.
+  int generation_;
+  bool polling_;
+  // The number of watches with updates being sent to their callback.
+  int num_sending_;
+};
+
+
 struct EtcdClient::WatchState {
-  WatchState(const string& key, const WatchCallback& cb, Task* task)
+  WatchState(const string& key, const WatchCallback& cb, Task* task,
+             bool multiplexed)
       : key_(key),
         cb_(cb),
         task_(CHECK_NOTNULL(task)),
-        highest_index_seen_(-1) {
+        multiplexed_(multiplexed),
+        highest_index_seen_(-1),
+        initial_updates_sent_(false),
+        initializing_(true),
+        buffered_since_(-1),
+        sending_(false) {
   }
 
   ~WatchState() {
@@ -473,9 +557,28 @@ struct EtcdClient::WatchState {
   const string key_;
   const WatchCallback cb_;
   Task* const task_;
+  // Whether this is part of the WatchHub of the client.
+  const bool multiplexed_;
 
   int64_t highest_index_seen_;
+  // Whether the callback was called with the result of the initial get,
+  // which happens even if it has no nodes, so that watchers of an empty
+  // directory know when they are up to date.
+  bool initial_updates_sent_;
   map<string, int64_t> known_keys_;
+
+  // The rest is only used when |multiplexed_|, with the lock of the
+  // WatchHub held.
+  //
+  // Whether an initial get is needed or in progress, in which case the
+  // changes seen by the poll in the meantime are kept in |buffered_|,
+  // starting after index |buffered_since_| (-1 if the poll has none
+  // yet).
+  bool initializing_;
+  vector<Node> buffered_;
+  int64_t buffered_since_;
+  deque<vector<Node>> queued_;
+  bool sending_;
 };
 
 
@@ -483,7 +586,7 @@ void EtcdClient::WatchInitialGetDone(WatchState* state, GetResponse* resp,
                                      Task* task) {
   unique_ptr<GetResponse> resp_deleter(resp);
   if (state->task_->CancelRequested()) {
-    state->task_->Return(Status::CANCELLED);
+    StopWatch(state);
     return;
   }
 
@@ -550,6 +653,11 @@ void EtcdClient::WatchInitialGetDone(WatchState* state, GetResponse* resp,
 
   state->known_keys_.swap(new_known_keys);
 
+  if (state->multiplexed_) {
+    MultiplexedWatchReady(state, move(updates));
+    return;
+  }
+
   SendWatchUpdates(state, move(updates));
 }
 
@@ -562,7 +670,7 @@ void EtcdClient::WatchRequestDone(WatchState* state, GetResponse* get_resp,
   unique_ptr<GetResponse> get_resp_deleter(get_resp);
 
   if (state->task_->CancelRequested()) {
-    state->task_->Return(Status::CANCELLED);
+    StopWatch(state);
     return;
   }
 
@@ -613,7 +721,8 @@ void EtcdClient::WatchRequestDone(WatchState* state, GetResponse* get_resp,
 // state->task_.
 void EtcdClient::SendWatchUpdates(WatchState* state,
                                   const vector<Node>& updates) {
-  if (!updates.empty() || state->highest_index_seen_ == -1) {
+  if (!updates.empty() || !state->initial_updates_sent_) {
+    state->initial_updates_sent_ = true;
     state->cb_(updates);
   }
 
@@ -625,7 +734,7 @@ void EtcdClient::SendWatchUpdates(WatchState* state,
 
 void EtcdClient::StartWatchRequest(WatchState* state) {
   if (state->task_->CancelRequested()) {
-    state->task_->Return(Status::CANCELLED);
+    StopWatch(state);
     return;
   }
 
@@ -639,6 +748,255 @@ void EtcdClient::StartWatchRequest(WatchState* state) {
 }
 
 
+void EtcdClient::StopWatch(WatchState* state) {
+  if (state->multiplexed_) {
+    unique_lock<mutex> lock(watch_hub_->lock_);
+    RemoveMultiplexedWatch(lock, state);
+  }
+  state->task_->Return(Status::CANCELLED);
+}
+
+
+void EtcdClient::StartMultiplexedWatch(WatchState* state) {
+  {
+    lock_guard<mutex> lock(watch_hub_->lock_);
+    const string path(WatchPath(state->key_));
+    state->buffered_since_ = watch_hub_->index_;
+    watch_hub_->watches_.push_back(state);
+    if (watch_hub_->path_.empty()) {
+      watch_hub_->path_ = path;
+    } else if (!IsWatchedBy(watch_hub_->path_, path)) {
+      // The poll in progress does not cover the new key, start another
+      // one from the same index on a wider path.
+      watch_hub_->path_ = CommonWatchPath(watch_hub_->path_, path);
+      ++watch_hub_->generation_;
+      watch_hub_->polling_ = false;
+    }
+    VLOG(1) << "EtcdClient::Watch: polling " << watch_hub_->path_ << " for "
+            << watch_hub_->watches_.size() << " watch(es)";
+  }
+
+  // The changes seen by the poll are buffered until the initial get is
+  // done, the poll being restarted (if needed) once its result is sent.
+  WatchRequestDone(state, nullptr, nullptr);
+}
+
+
+// Called on the executor of state->task_, once the initial get of
+// |state| is done, with the updates it produced.
+void EtcdClient::MultiplexedWatchReady(WatchState* state,
+                                       vector<Node>&& updates) {
+  unique_lock<mutex> lock(watch_hub_->lock_);
+  CHECK(state->initializing_);
+  state->initializing_ = false;
+
+  const int64_t index(state->highest_index_seen_);
+  if (watch_hub_->index_ < 0) {
+    // The first poll starts after this initial get.
+    watch_hub_->index_ = index;
+    for (const auto& other : watch_hub_->watches_) {
+      if (other->initializing_ && other->buffered_since_ < 0) {
+        other->buffered_since_ = index;
+      }
+    }
+  } else if (index < state->buffered_since_) {
+    // Another initial get finished first with a higher index, the poll
+    // has to go back for the changes in between.
+    watch_hub_->index_ = min(watch_hub_->index_, index);
+    ++watch_hub_->generation_;
+    watch_hub_->polling_ = false;
+  }
+
+  QueueWatchUpdates(lock, state, move(updates));
+  for (Node& node : state->buffered_) {
+    if (node.modified_index_ <= state->highest_index_seen_) {
+      continue;
+    }
+    state->highest_index_seen_ = node.modified_index_;
+    if (!node.deleted_) {
+      state->known_keys_[node.key_] = node.modified_index_;
+    } else {
+      state->known_keys_.erase(node.key_);
+    }
+    QueueWatchUpdates(lock, state, vector<Node>{move(node)});
+  }
+  state->buffered_.clear();
+
+  MaybeStartWatchPoll(&lock);
+}
+
+
+void EtcdClient::RemoveMultiplexedWatch(const unique_lock<mutex>& lock,
+                                        WatchState* state) {
+  CHECK(lock.owns_lock());
+  watch_hub_->watches_.remove(state);
+  if (watch_hub_->watches_.empty()) {
+    // Start over with the next watch, rather than polling from an index
+    // that etcd might have forgotten by then.
+    watch_hub_->path_.clear();
+    watch_hub_->index_ = -1;
+    ++watch_hub_->generation_;
+    watch_hub_->polling_ = false;
+  }
+}
+
+
+void EtcdClient::QueueWatchUpdates(const unique_lock<mutex>& lock,
+                                   WatchState* state, vector<Node>&& updates) {
+  CHECK(lock.owns_lock());
+  state->queued_.emplace_back(move(updates));
+  if (!state->sending_) {
+    state->sending_ = true;
+    ++watch_hub_->num_sending_;
+    // The child task keeps |state| alive until the updates are sent.
+    state->task_->executor()->Add(
+        bind(&EtcdClient::SendQueuedWatchUpdates, this, state,
+             state->task_->AddChild([](Task*) {})));
+  }
+}
+
+
+void EtcdClient::SendQueuedWatchUpdates(WatchState* state, Task* hold) {
+  while (true) {
+    vector<Node> updates;
+    {
+      unique_lock<mutex> lock(watch_hub_->lock_);
+      if (state->queued_.empty()) {
+        state->sending_ = false;
+        --watch_hub_->num_sending_;
+        MaybeStartWatchPoll(&lock);
+        break;
+      }
+      updates = move(state->queued_.front());
+      state->queued_.pop_front();
+    }
+
+    if (!updates.empty() || !state->initial_updates_sent_) {
+      state->initial_updates_sent_ = true;
+      state->cb_(updates);
+    }
+  }
+  hold->Return();
+}
+
+
+void EtcdClient::MaybeStartWatchPoll(unique_lock<mutex>* lock) {
+  CHECK(lock->owns_lock());
+  vector<WatchState*> cancelled;
+  for (auto it = watch_hub_->watches_.begin();
+       it != watch_hub_->watches_.end();) {
+    WatchState* const state(*it);
+    ++it;
+    if (!state->initializing_ && !state->sending_ &&
+        state->task_->CancelRequested()) {
+      RemoveMultiplexedWatch(*lock, state);
+      cancelled.push_back(state);
+    }
+  }
+
+  // The poll is a child of one of the watches, so that all of them
+  // being done means that it is too.
+  Task* owner(nullptr);
+  for (const auto& state : watch_hub_->watches_) {
+    if (!state->task_->CancelRequested()) {
+      owner = state->task_;
+      break;
+    }
+  }
+
+  // Only one poll at a time, and only once all the callbacks have
+  // returned, so that each watch gets its updates in order.
+  const bool start(owner && !watch_hub_->polling_ &&
+                   watch_hub_->num_sending_ == 0 && watch_hub_->index_ >= 0);
+  Request req(watch_hub_->path_);
+  req.recursive = true;
+  req.wait_index = watch_hub_->index_ + 1;
+  const int generation(watch_hub_->generation_);
+  if (start) {
+    watch_hub_->polling_ = true;
+  }
+  lock->unlock();
+
+  for (const auto& state : cancelled) {
+    state->task_->Return(Status::CANCELLED);
+  }
+
+  if (start) {
+    VLOG(1) << "Watch poll of " << req.key << " @ " << req.wait_index;
+    GetResponse* const get_resp(new GetResponse);
+    Get(req, get_resp,
+        owner->AddChild(bind(&EtcdClient::WatchPollDone, this, generation,
+                             req.wait_index, get_resp, _1)));
+  }
+}
+
+
+void EtcdClient::WatchPollDone(int generation, int64_t wait_index,
+                               GetResponse* get_resp, Task* child_task) {
+  unique_ptr<GetResponse> get_resp_deleter(get_resp);
+  unique_lock<mutex> lock(watch_hub_->lock_);
+  if (generation != watch_hub_->generation_) {
+    VLOG(1) << "Ignoring stale watch poll: " << child_task->status();
+    return;
+  }
+  watch_hub_->polling_ = false;
+
+  vector<WatchState*> to_get;
+  if (child_task->status().CanonicalCode() == util::error::ABORTED &&
+      get_resp->etcd_index >= 0) {
+    // Etcd no longer has the changes since our index, all the watches
+    // have to start over with an initial get.
+    VLOG(1) << "etcd index: " << get_resp->etcd_index;
+    watch_hub_->index_ = max(watch_hub_->index_, get_resp->etcd_index);
+    for (const auto& state : watch_hub_->watches_) {
+      if (!state->initializing_) {
+        state->initializing_ = true;
+        state->buffered_since_ = watch_hub_->index_;
+        state->highest_index_seen_ =
+            max(state->highest_index_seen_, get_resp->etcd_index);
+        to_get.push_back(state);
+      }
+    }
+  } else if (!child_task->status().ok()) {
+    // Resumes from the same index.
+    VLOG(1) << "Watch request errored: " << child_task->status();
+  } else {
+    const Node& node(get_resp->node);
+    watch_hub_->index_ = max(watch_hub_->index_, node.modified_index_);
+    for (const auto& state : watch_hub_->watches_) {
+      if (!IsWatchedBy(WatchPath(state->key_), node.key_)) {
+        continue;
+      }
+      if (state->initializing_) {
+        state->buffered_.push_back(node);
+        continue;
+      }
+      // The initial get of |state| may have finished after this poll
+      // started, in which case it already had this change.
+      if (wait_index <= state->highest_index_seen_ &&
+          node.modified_index_ <= state->highest_index_seen_) {
+        continue;
+      }
+      state->highest_index_seen_ =
+          max(state->highest_index_seen_, node.modified_index_);
+      if (!node.deleted_) {
+        state->known_keys_[node.key_] = node.modified_index_;
+      } else {
+        VLOG(1) << "erased key: " << node.key_;
+        state->known_keys_.erase(node.key_);
+      }
+      QueueWatchUpdates(lock, state, vector<Node>{node});
+    }
+  }
+
+  MaybeStartWatchPoll(&lock);
+
+  for (const auto& state : to_get) {
+    WatchRequestDone(state, nullptr, nullptr);
+  }
+}
+
+
 EtcdClient::Node::Node(int64_t created_index, int64_t modified_index,
                        const string& key, bool is_dir, const string& value,
                        vector<Node>&& nodes, bool deleted)
@@ -695,7 +1053,8 @@ EtcdClient::EtcdClient(Executor* executor, UrlFetcher* fetcher,
       log_version_task_(new SyncTask(executor_)),
       fetcher_(CHECK_NOTNULL(fetcher)),
       etcds_(etcds),
-      logged_version_(false) {
+      logged_version_(false),
+      watch_hub_(new WatchHub) {
   CHECK(!etcds_.empty()) << "No etcd hosts provided.";
   VLOG(1) << "EtcdClient: " << this;
 
@@ -835,6 +1194,9 @@ void EtcdClient::Get(const Request& req, GetResponse* resp, Task* task) {
   if (req.recursive) {
     params["recursive"] = "true";
   }
+  if (!req.quorum) {
+    params["quorum"] = "false";
+  }
   if (req.wait_index > 0) {
     params["wait"] = "true";
     params["waitIndex"] = to_string(req.wait_index);
@@ -906,6 +1268,21 @@ void EtcdClient::UpdateWithTTL(const string& key, const string& value,
 }
 
 
+void EtcdClient::RefreshTTL(const string& key, const seconds& ttl,
+                            const int64_t previous_index, Response* resp,
+                            Task* task) {
+  map<string, string> params;
+  params["refresh"] = "true";
+  params["prevExist"] = "true";
+  params["prevIndex"] = to_string(previous_index);
+  params["ttl"] = to_string(ttl.count());
+  GenericResponse* const gen_resp(new GenericResponse);
+  task->DeleteWhenDone(gen_resp);
+  Generic(key, kKeysSpace, params, UrlFetcher::Verb::PUT, gen_resp,
+          task->AddChild(bind(&UpdateRequestDone, resp, task, gen_resp, _1)));
+}
+
+
 void EtcdClient::ForceSet(const string& key, const string& value,
                           Response* resp, Task* task) {
   map<string, string> params;
@@ -967,9 +1344,15 @@ void EtcdClient::Watch(const string& key, const WatchCallback& cb,
                        Task* task) {
   VLOG(1) << "EtcdClient::Watch: " << key;
 
-  WatchState* const state(new WatchState(key, cb, task));
+  WatchState* const state(
+      new WatchState(key, cb, task, FLAGS_etcd_watch_multiplex));
   task->DeleteWhenDone(state);
 
+  if (state->multiplexed_) {
+    StartMultiplexedWatch(state);
+    return;
+  }
+
   // This will kick off the watch logic, with an initial get request.
   WatchRequestDone(state, nullptr, nullptr);
 }
@@ -984,6 +1367,19 @@ void EtcdClient::Generic(const string& key, const string& key_space,
                                                 GetEndpoint(), resp, task));
   task->DeleteWhenDone(etcd_req);
 
+  // Adds a span to the trace of the request on whose behalf this is
+  // made, if any, for as long as it takes, retries included.
+  if (Trace::Current()) {
+    const shared_ptr<Trace> trace(Trace::Current()->shared_from_this());
+    ostringstream oss;
+    oss << "etcd_" << verb;
+    const string stage(oss.str());
+    const Trace::Clock::time_point start(Trace::Clock::now());
+    task->CleanupWhenDone([trace, stage, start]() {
+      trace->AddSpan(stage, start, Trace::Clock::now());
+    });
+  }
+
   fetcher_->Fetch(etcd_req->req_, &etcd_req->resp_,
                   etcd_req->parent_task_->AddChild(
                       bind(&EtcdClient::FetchDone, this, etcd_req, _1)));
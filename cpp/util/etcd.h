@@ -53,12 +53,17 @@ class EtcdClient {
 
   struct Request {
     Request(const std::string& thekey)
-        : key(thekey), recursive(false), wait_index(0) {
+        : key(thekey), recursive(false), wait_index(0), quorum(true) {
     }
 
     std::string key;
     bool recursive;
     int64_t wait_index;
+    // If false, the read can be answered by any etcd server on its own
+    // (so possibly with a stale value), rather than going through the
+    // consensus of the cluster (if --etcd_quorum). This is only a
+    // hint, which implementations can ignore.
+    bool quorum;
   };
 
   struct Response {
@@ -108,6 +113,15 @@ class EtcdClient {
                              const int64_t previous_index, Response* resp,
                              util::Task* task);
 
+  // Pushes back the expiry of |key|, which must be at |previous_index|,
+  // to |ttl| from now, without changing its value nor notifying the
+  // watches (needs etcd 2.3 or later). |resp->etcd_index| is its new
+  // index.
+  virtual void RefreshTTL(const std::string& key,
+                          const std::chrono::seconds& ttl,
+                          const int64_t previous_index, Response* resp,
+                          util::Task* task);
+
   virtual void ForceSet(const std::string& key, const std::string& value,
                         Response* resp, util::Task* task);
 
@@ -127,6 +141,12 @@ class EtcdClient {
   // will be sent to the executor at a time (for a given call to this
   // method, not for all of them), to make sure they are received in
   // order.
+  //
+  // With --etcd_watch_multiplex, all the watches of this client share
+  // a single hanging request, on the deepest directory containing all
+  // their keys, which resumes from the last index seen when it is
+  // restarted. It only moves on once the callbacks of all the watches
+  // have returned, so a slow callback delays the others.
   virtual void Watch(const std::string& key, const WatchCallback& cb,
                      util::Task* task);
 
@@ -136,6 +156,7 @@ class EtcdClient {
 
  private:
   struct RequestState;
+  struct WatchHub;
   struct WatchState;
 
   HostPortPair ChooseNextServer();
@@ -152,6 +173,21 @@ class EtcdClient {
   void StartWatchRequest(WatchState* state);
   void WatchRequestDone(WatchState* state, GetResponse* gen_resp,
                         util::Task* child_task);
+  void StopWatch(WatchState* state);
+
+  // Used with --etcd_watch_multiplex. Calling the methods taking a
+  // |lock| requires holding the lock of |watch_hub_|.
+  void StartMultiplexedWatch(WatchState* state);
+  void MultiplexedWatchReady(WatchState* state, std::vector<Node>&& updates);
+  void RemoveMultiplexedWatch(const std::unique_lock<std::mutex>& lock,
+                              WatchState* state);
+  void QueueWatchUpdates(const std::unique_lock<std::mutex>& lock,
+                         WatchState* state, std::vector<Node>&& updates);
+  void SendQueuedWatchUpdates(WatchState* state, util::Task* hold);
+  // Releases |lock| before returning.
+  void MaybeStartWatchPoll(std::unique_lock<std::mutex>* lock);
+  void WatchPollDone(int generation, int64_t wait_index,
+                     GetResponse* get_resp, util::Task* child_task);
 
   void MaybeLogEtcdVersion();
 
@@ -163,6 +199,8 @@ class EtcdClient {
   std::list<HostPortPair> etcds_;
   bool logged_version_;
 
+  const std::unique_ptr<WatchHub> watch_hub_;
+
   DISALLOW_COPY_AND_ASSIGN(EtcdClient);
 };
 
@@ -2,10 +2,15 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <algorithm>
+#include <chrono>
 #include <functional>
 #include <mutex>
 
 using std::bind;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+using std::max;
 using std::move;
 using std::mutex;
 using std::placeholders::_1;
@@ -18,6 +23,11 @@ using util::TaskHold;
 
 DEFINE_int32(etcd_delete_concurrency, 4,
              "number of etcd keys to delete at a time");
+DEFINE_int32(etcd_delete_target_latency_ms, 100,
+             "while etcd deletes take longer than this, fewer are sent at a "
+             "time (down to one), and more (up to --etcd_delete_concurrency) "
+             "once they are faster again. Zero always sends "
+             "--etcd_delete_concurrency at a time.");
 
 namespace cert_trans {
 namespace {
@@ -29,6 +39,8 @@ class DeleteState {
       : client_(CHECK_NOTNULL(client)),
         task_(CHECK_NOTNULL(task)),
         outstanding_(0),
+        concurrency_(FLAGS_etcd_delete_concurrency),
+        num_fast_(0),
         keys_(move(keys)),
         it_(keys_.begin()) {
     CHECK_GT(FLAGS_etcd_delete_concurrency, 0);
@@ -46,19 +58,30 @@ class DeleteState {
   }
 
  private:
-  void RequestDone(Task* child_task);
+  void RequestDone(const steady_clock::time_point& started_at,
+                   Task* child_task);
+  // Adjusts |concurrency_| for a request that took from |started_at|
+  // to |now|, halving it if that was too slow, and otherwise adding one
+  // after as many fast requests as can be outstanding.
+  void AdjustConcurrency(const unique_lock<mutex>& lock,
+                         const steady_clock::time_point& started_at,
+                         const steady_clock::time_point& now);
   void StartNextRequest(unique_lock<mutex>&& lock);
 
   EtcdClient* const client_;
   Task* const task_;
   mutex mutex_;
   int outstanding_;
+  int concurrency_;
+  int num_fast_;
+  steady_clock::time_point last_decrease_;
   const vector<string> keys_;
   vector<string>::const_iterator it_;
 };
 
 
-void DeleteState::RequestDone(Task* child_task) {
+void DeleteState::RequestDone(const steady_clock::time_point& started_at,
+                              Task* child_task) {
   unique_lock<mutex> lock(mutex_);
   --outstanding_;
 
@@ -72,6 +95,8 @@ void DeleteState::RequestDone(Task* child_task) {
     return;
   }
 
+  AdjustConcurrency(lock, started_at, steady_clock::now());
+
   if (it_ != keys_.end()) {
     StartNextRequest(move(lock));
   } else {
@@ -84,6 +109,32 @@ void DeleteState::RequestDone(Task* child_task) {
 }
 
 
+void DeleteState::AdjustConcurrency(const unique_lock<mutex>& lock,
+                                    const steady_clock::time_point& started_at,
+                                    const steady_clock::time_point& now) {
+  CHECK(lock.owns_lock());
+  if (FLAGS_etcd_delete_target_latency_ms <= 0) {
+    return;
+  }
+
+  if (now - started_at > milliseconds(FLAGS_etcd_delete_target_latency_ms)) {
+    // The requests started before the last decrease are not counted
+    // again, they were as slow for the same reason.
+    if (started_at >= last_decrease_) {
+      concurrency_ = max(1, concurrency_ / 2);
+      num_fast_ = 0;
+      last_decrease_ = now;
+      VLOG(1) << "etcd deletes are slow, sending " << concurrency_
+              << " at a time";
+    }
+  } else if (concurrency_ < FLAGS_etcd_delete_concurrency &&
+             ++num_fast_ >= concurrency_) {
+    ++concurrency_;
+    num_fast_ = 0;
+  }
+}
+
+
 void DeleteState::StartNextRequest(unique_lock<mutex>&& lock) {
   CHECK(lock.owns_lock());
 
@@ -94,7 +145,7 @@ void DeleteState::StartNextRequest(unique_lock<mutex>&& lock) {
     return;
   }
 
-  while (outstanding_ < FLAGS_etcd_delete_concurrency && it_ != keys_.end() &&
+  while (outstanding_ < concurrency_ && it_ != keys_.end() &&
          task_->IsActive()) {
     CHECK(lock.owns_lock());
     const string& key(*it_);
@@ -104,8 +155,9 @@ void DeleteState::StartNextRequest(unique_lock<mutex>&& lock) {
     // In case the task uses an inline executor.
     lock.unlock();
 
-    client_->ForceDelete(key, task_->AddChild(
-                                  bind(&DeleteState::RequestDone, this, _1)));
+    client_->ForceDelete(key,
+                         task_->AddChild(bind(&DeleteState::RequestDone, this,
+                                              steady_clock::now(), _1)));
 
     // We must be holding the lock to evaluate the loop condition.
     lock.lock();
@@ -12,6 +12,8 @@ namespace cert_trans {
 
 // Force delete keys in batches (implemented using concurrent
 // requests). The "keys" argument are pairs of key and modified index.
+// Fewer requests are sent at a time while etcd is slow to answer them
+// (see --etcd_delete_target_latency_ms).
 void EtcdForceDeleteKeys(EtcdClient* client, std::vector<std::string>&& keys,
                          util::Task* task);
 
@@ -1,5 +1,6 @@
 #include <gflags/gflags.h>
 #include <gtest/gtest.h>
+#include <thread>
 
 #include "util/etcd_delete.h"
 #include "util/mock_etcd.h"
@@ -9,6 +10,7 @@
 #include "util/thread_pool.h"
 
 using std::bind;
+using std::chrono::milliseconds;
 using std::chrono::seconds;
 using std::move;
 using std::placeholders::_2;
@@ -32,6 +34,7 @@ using util::Task;
 using util::testing::StatusIs;
 
 DECLARE_int32(etcd_delete_concurrency);
+DECLARE_int32(etcd_delete_target_latency_ms);
 
 namespace cert_trans {
 namespace {
@@ -41,6 +44,7 @@ class EtcdDeleteTest : public ::testing::Test {
  protected:
   EtcdDeleteTest() : pool_(1) {
     FLAGS_etcd_delete_concurrency = 2;
+    FLAGS_etcd_delete_target_latency_ms = 0;
   }
 
   ThreadPool pool_;
@@ -179,6 +183,59 @@ TEST_F(EtcdDeleteTest, WithinConcurrency) {
 }
 
 
+TEST_F(EtcdDeleteTest, SlowDeletesReduceConcurrency) {
+  FLAGS_etcd_delete_target_latency_ms = 10;
+  vector<string> keys{"/one", "/two", "/three"};
+  ASSERT_LT(static_cast<size_t>(FLAGS_etcd_delete_concurrency), keys.size());
+  SyncTask sync(&pool_);
+
+  Task* first_task(nullptr);
+  Notification first;
+  Task* second_task(nullptr);
+  Notification second;
+  EXPECT_CALL(client_, ForceDelete("/one", _))
+      .WillOnce(DoAll(SaveArg<1>(&first_task),
+                      InvokeWithoutArgs(&first, &Notification::Notify)));
+  EXPECT_CALL(client_, ForceDelete("/two", _))
+      .WillOnce(DoAll(SaveArg<1>(&second_task),
+                      InvokeWithoutArgs(&second, &Notification::Notify)));
+  EtcdForceDeleteKeys(&client_, move(keys), sync.task());
+
+  ASSERT_TRUE(first.WaitForNotificationWithTimeout(seconds(1)));
+  ASSERT_TRUE(first_task);
+  ASSERT_TRUE(second.WaitForNotificationWithTimeout(seconds(1)));
+  ASSERT_TRUE(second_task);
+
+  // Make sure all the expected calls were called.
+  Mock::VerifyAndClearExpectations(&client_);
+
+  // Once the second request completes too slowly, only one request
+  // should be outstanding at a time, so the third one has to wait for
+  // the first.
+  MockFunction<void()> cleanup;
+  first_task->CleanupWhenDone(bind(&MockFunction<void()>::Call, &cleanup));
+  Expectation first_done(EXPECT_CALL(cleanup, Call()).Times(Exactly(1)));
+
+  Task* third_task(nullptr);
+  Notification third;
+  EXPECT_CALL(client_, ForceDelete("/three", _))
+      .After(first_done)
+      .WillOnce(DoAll(SaveArg<1>(&third_task),
+                      InvokeWithoutArgs(&third, &Notification::Notify)));
+
+  std::this_thread::sleep_for(milliseconds(20));
+  second_task->Return();
+  first_task->Return();
+
+  ASSERT_TRUE(third.WaitForNotificationWithTimeout(seconds(1)));
+  ASSERT_TRUE(third_task);
+  third_task->Return();
+
+  sync.Wait();
+  EXPECT_OK(sync.status());
+}
+
+
 TEST_F(EtcdDeleteTest, ErrorHandling) {
   vector<string> keys{"/one", "/two", "/three"};
   ASSERT_LT(static_cast<size_t>(FLAGS_etcd_delete_concurrency), keys.size());
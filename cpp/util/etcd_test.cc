@@ -545,6 +545,29 @@ TEST_F(EtcdTest, UpdateWithTTLFails) {
 }
 
 
+TEST_F(EtcdTest, RefreshTTL) {
+  EXPECT_CALL(
+      url_fetcher_,
+      Fetch(IsUrlFetchRequest(
+                UrlFetcher::Verb::PUT, URL(GetEtcdUrl(kEntryKey)),
+                ElementsAre(Pair(StrCaseEq("content-type"),
+                                 "application/x-www-form-urlencoded")),
+                "consistent=true&prevExist=true&prevIndex=5&quorum=true&"
+                "refresh=true&ttl=100"),
+            _, _))
+      .WillOnce(
+          Invoke(bind(HandleFetch, Status::OK, 200,
+                      UrlFetcher::Headers{make_pair("x-etcd-index", "1")},
+                      kUpdateJson, _1, _2, _3)));
+  SyncTask task(base_.get());
+  EtcdClient::Response resp;
+  client_.RefreshTTL(kEntryKey, seconds(100), 5, &resp, task.task());
+  task.Wait();
+  EXPECT_OK(task);
+  EXPECT_EQ(6, resp.etcd_index);
+}
+
+
 TEST_F(EtcdTest, ForceSetForPreexistingKey) {
   EXPECT_CALL(url_fetcher_,
               Fetch(IsUrlFetchRequest(
@@ -826,6 +849,103 @@ TEST_F(EtcdTest, WatchHangingGetTimeoutCausesRetry) {
 }
 
 
+TEST_F(EtcdTest, WatchesShareOnePoll) {
+  const string other_key(string(kDirKey) + "/key2");
+  const string other_get_json(
+      "{"
+      "  \"action\": \"get\","
+      "  \"node\": {"
+      "    \"createdIndex\": 7,"
+      "    \"key\": \"/some/key2\","
+      "    \"modifiedIndex\": 7,"
+      "    \"value\": \"456\""
+      "  }"
+      "}");
+  const string other_set_json(
+      "{"
+      "  \"action\": \"set\","
+      "  \"node\": {"
+      "    \"createdIndex\": 7,"
+      "    \"key\": \"/some/key2\","
+      "    \"modifiedIndex\": 10,"
+      "    \"value\": \"789\""
+      "  }"
+      "}");
+
+  {
+    InSequence s;
+    EXPECT_CALL(url_fetcher_,
+                Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                        URL(GetEtcdUrl(kEntryKey) +
+                                            "?consistent=true&quorum=true"),
+                                        IsEmpty(), ""),
+                      _, _))
+        .WillOnce(
+            Invoke(bind(HandleFetch, Status::OK, 200,
+                        UrlFetcher::Headers{make_pair("x-etcd-index", "9")},
+                        kGetJson, _1, _2, _3)));
+    EXPECT_CALL(url_fetcher_,
+                Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                        URL(GetEtcdUrl(other_key) +
+                                            "?consistent=true&quorum=true"),
+                                        IsEmpty(), ""),
+                      _, _))
+        .WillOnce(
+            Invoke(bind(HandleFetch, Status::OK, 200,
+                        UrlFetcher::Headers{make_pair("x-etcd-index", "9")},
+                        other_get_json, _1, _2, _3)));
+    // A single hanging get, on the directory of both keys, which only
+    // sends the change to the watch of the second one.
+    EXPECT_CALL(url_fetcher_,
+                Fetch(IsUrlFetchRequest(UrlFetcher::Verb::GET,
+                                        URL(GetEtcdUrl(kDirKey) +
+                                            "?consistent=true&quorum=false" +
+                                            "&recursive=true&wait=true" +
+                                            "&waitIndex=10"),
+                                        IsEmpty(), ""),
+                      _, _))
+        .WillOnce(
+            Invoke(bind(HandleFetch, Status::OK, 200,
+                        UrlFetcher::Headers{make_pair("x-etcd-index", "10")},
+                        other_set_json, _1, _2, _3)));
+  }
+
+  SyncTask task(base_.get());
+  SyncTask other_task(base_.get());
+  int num_updates(0);
+  int num_other_updates(0);
+  const EtcdClient::WatchCallback other_cb(
+      [&task, &other_task,
+       &num_other_updates](const vector<EtcdClient::Node>& updates) {
+        ASSERT_EQ(static_cast<size_t>(1), updates.size());
+        if (num_other_updates == 0) {
+          EXPECT_EQ("456", updates[0].value_);
+        } else {
+          EXPECT_EQ(10, updates[0].modified_index_);
+          EXPECT_EQ("789", updates[0].value_);
+          task.Cancel();
+          other_task.Cancel();
+        }
+        ++num_other_updates;
+      });
+  // The second watch starts once the first one is up to date, so that
+  // its key is added to the hanging get.
+  client_.Watch(kEntryKey,
+                [this, &other_key, &other_cb, &other_task,
+                 &num_updates](const vector<EtcdClient::Node>& updates) {
+                  EXPECT_EQ(static_cast<size_t>(1), updates.size());
+                  EXPECT_EQ("123", updates[0].value_);
+                  ++num_updates;
+                  client_.Watch(other_key, other_cb, other_task.task());
+                },
+                task.task());
+  task.Wait();
+  other_task.Wait();
+  EXPECT_EQ(1, num_updates);
+  EXPECT_EQ(2, num_other_updates);
+}
+
+
 TEST_F(EtcdTest, UnavailableEtcdRetriesOnNewServer) {
   EtcdClient multi_client(base_.get(), &url_fetcher_,
                           {EtcdClient::HostPortPair(kEtcdHost, kEtcdPort),
@@ -0,0 +1,949 @@
+#include "util/etcd_v3.h"
+
+#include <event2/buffer.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <algorithm>
+#include <deque>
+#include <utility>
+
+#include "util/json_wrapper.h"
+#include "util/statusor.h"
+#include "util/util.h"
+
+using std::bind;
+using std::chrono::seconds;
+using std::chrono::steady_clock;
+using std::function;
+using std::list;
+using std::lock_guard;
+using std::make_pair;
+using std::make_shared;
+using std::map;
+using std::max;
+using std::move;
+using std::mutex;
+using std::placeholders::_1;
+using std::shared_ptr;
+using std::string;
+using std::unique_ptr;
+using std::vector;
+using util::Executor;
+using util::Status;
+using util::StatusOr;
+using util::Task;
+
+DECLARE_int32(etcd_watch_error_retry_delay_seconds);
+
+namespace cert_trans {
+
+namespace {
+
+
+const char kRangePath[] = "/v3/kv/range";
+const char kTxnPath[] = "/v3/kv/txn";
+const char kLeaseGrantPath[] = "/v3/lease/grant";
+const char kLeaseKeepAlivePath[] = "/v3/lease/keepalive";
+const char kWatchPath[] = "/v3/watch";
+
+
+// The gateway renders the int64 fields as strings, and leaves out any
+// field at its default value.
+int64_t Int64Field(const JsonObject& json, const char* field) {
+  const JsonString value(json, field);
+  return value.Ok() ? atoll(value.Value()) : 0;
+}
+
+
+string BytesField(const JsonObject& json, const char* field) {
+  JsonString value(json, field);
+  return value.Ok() ? value.FromBase64() : "";
+}
+
+
+int64_t Revision(const JsonObject& reply) {
+  const JsonObject header(reply, "header");
+  return header.Ok() ? Int64Field(header, "revision") : -1;
+}
+
+
+// Returns the end of the range of the keys starting with |prefix|.
+string PrefixEnd(const string& prefix) {
+  string end(prefix);
+  while (!end.empty()) {
+    if (static_cast<unsigned char>(end.back()) < 0xff) {
+      ++end.back();
+      return end;
+    }
+    end.pop_back();
+  }
+  // All the keys.
+  return string(1, '\0');
+}
+
+
+// Returns the prefix of the keys in the "directory" |key|.
+string DirPrefix(const string& key) {
+  return !key.empty() && key.back() == '/' ? key : key + "/";
+}
+
+
+bool IsUnder(const string& key, const string& watched) {
+  const string prefix(DirPrefix(watched));
+  return key == watched || key.compare(0, prefix.size(), prefix) == 0;
+}
+
+
+StatusOr<EtcdClient::Node> ParseKeyValue(const JsonObject& kv) {
+  const string key(BytesField(kv, "key"));
+  if (key.empty()) {
+    return Status(util::error::FAILED_PRECONDITION,
+                  "Invalid JSON: Couldn't find 'key'");
+  }
+  return EtcdClient::Node(Int64Field(kv, "create_revision"),
+                          Int64Field(kv, "mod_revision"), key, false,
+                          BytesField(kv, "value"), {}, false);
+}
+
+
+// Parses the key-values of the "response_range" in |response| into
+// |nodes|.
+Status ParseRangeResponse(const JsonObject& response,
+                          vector<EtcdClient::Node>* nodes) {
+  const JsonObject range(response, "response_range");
+  if (!range.Ok()) {
+    return Status(util::error::FAILED_PRECONDITION,
+                  "Invalid JSON: Couldn't find 'response_range'");
+  }
+  const JsonArray kvs(range, "kvs");
+  if (!kvs.Ok()) {
+    return Status::OK;
+  }
+  for (int i = 0; i < kvs.Length(); ++i) {
+    const JsonObject kv(kvs, i);
+    if (!kv.Ok()) {
+      return Status(util::error::FAILED_PRECONDITION,
+                    "Invalid JSON: Couldn't get 'kvs' index " +
+                        std::to_string(i));
+    }
+    StatusOr<EtcdClient::Node> node(ParseKeyValue(kv));
+    if (!node.ok()) {
+      return node.status();
+    }
+    nodes->emplace_back(node.ValueOrDie());
+  }
+  return Status::OK;
+}
+
+
+// Returns the responses of a transaction, which has one for each of
+// its requests.
+StatusOr<vector<vector<EtcdClient::Node>>> ParseTxnResponses(
+    const JsonObject& reply, size_t num_requests) {
+  const JsonArray responses(reply, "responses");
+  if (!responses.Ok() ||
+      static_cast<size_t>(responses.Length()) != num_requests) {
+    return Status(util::error::FAILED_PRECONDITION,
+                  "Invalid JSON: wrong number of 'responses'");
+  }
+  vector<vector<EtcdClient::Node>> ret(num_requests);
+  for (size_t i = 0; i < num_requests; ++i) {
+    const JsonObject response(responses, i);
+    if (!response.Ok()) {
+      return Status(util::error::FAILED_PRECONDITION,
+                    "Invalid JSON: Couldn't get 'responses' index " +
+                        std::to_string(i));
+    }
+    const Status status(ParseRangeResponse(response, &ret[i]));
+    if (!status.ok()) {
+      return status;
+    }
+  }
+  return ret;
+}
+
+
+void AddRangeRequest(const string& key, const string& range_end,
+                     JsonArray* requests) {
+  JsonObject range;
+  range.AddBase64("key", key);
+  if (!range_end.empty()) {
+    range.AddBase64("range_end", range_end);
+  }
+  JsonObject request;
+  request.Add("request_range", range);
+  requests->Add(&request);
+}
+
+
+// Returns the status for an error |reply| from the gateway, which
+// carries a gRPC status code, the same as ours.
+Status StatusFromReply(int status_code, const JsonObject& reply) {
+  if (reply.Ok()) {
+    const JsonInt code(reply, "code");
+    const JsonString message(reply, "message");
+    if (code.Ok() && code.Value() > util::error::OK &&
+        code.Value() <= util::error::DATA_LOSS) {
+      return Status(static_cast<util::error::Code>(code.Value()),
+                    "Etcd message: " +
+                        string(message.Ok() ? message.Value() : ""));
+    }
+  }
+  if (status_code == 200) {
+    return reply.Ok()
+               ? Status::OK
+               : Status(util::error::FAILED_PRECONDITION, "Invalid JSON");
+  }
+  return Status(status_code == 503 ? util::error::UNAVAILABLE
+                                   : util::error::UNKNOWN,
+                "etcd returned HTTP status " + std::to_string(status_code) +
+                    (reply.Ok() ? ": " + reply.DebugString() : ""));
+}
+
+
+void GetDone(const string& key, EtcdClient::GetResponse* resp,
+             Task* parent_task, shared_ptr<JsonObject>* reply, Task* task) {
+  *resp = EtcdClient::GetResponse();
+  if (!task->status().ok()) {
+    parent_task->Return(
+        Status(task->status().CanonicalCode(),
+               task->status().error_message() + " (" + key + ")"));
+    return;
+  }
+  resp->etcd_index = Revision(**reply);
+
+  // The first response is for the key itself, the second for the keys
+  // under it.
+  StatusOr<vector<vector<EtcdClient::Node>>> responses(
+      ParseTxnResponses(**reply, 2));
+  if (!responses.ok()) {
+    parent_task->Return(responses.status());
+    return;
+  }
+  const vector<EtcdClient::Node>& file(responses.ValueOrDie()[0]);
+  vector<EtcdClient::Node> dir(responses.ValueOrDie()[1]);
+  if (!file.empty()) {
+    resp->node = file.front();
+  } else if (!dir.empty()) {
+    resp->node = EtcdClient::Node(resp->etcd_index, resp->etcd_index, key,
+                                  true, "", move(dir), false);
+  } else {
+    parent_task->Return(
+        Status(util::error::NOT_FOUND, "Key not found (" + key + ")"));
+    return;
+  }
+  parent_task->Return();
+}
+
+
+void TxnDone(const vector<EtcdV3Client::TxnOp>& ops,
+             EtcdClient::Response* resp, Task* parent_task,
+             shared_ptr<JsonObject>* reply, Task* task) {
+  *resp = EtcdClient::Response();
+  if (!task->status().ok()) {
+    parent_task->Return(task->status());
+    return;
+  }
+  resp->etcd_index = Revision(**reply);
+
+  const JsonBoolean succeeded(**reply, "succeeded");
+  if (succeeded.Ok() && succeeded.Value()) {
+    parent_task->Return();
+    return;
+  }
+
+  // The failure branch looked up every key, to tell the missing ones.
+  StatusOr<vector<vector<EtcdClient::Node>>> responses(
+      ParseTxnResponses(**reply, ops.size()));
+  if (!responses.ok()) {
+    parent_task->Return(responses.status());
+    return;
+  }
+  for (size_t i = 0; i < ops.size(); ++i) {
+    if (responses.ValueOrDie()[i].empty() &&
+        (ops[i].deleted || ops[i].previous_index > 0)) {
+      parent_task->Return(
+          Status(util::error::NOT_FOUND, "Key not found (" + ops[i].key + ")"));
+      return;
+    }
+  }
+  parent_task->Return(
+      Status(util::error::FAILED_PRECONDITION, "Compare failed"));
+}
+
+
+}  // namespace
+
+
+const int64_t EtcdV3Client::kAnyIndex;
+
+
+struct EtcdV3Client::CallState {
+  CallState(const string& path, const string& body,
+            shared_ptr<JsonObject>* reply, Task* task)
+      : reply_(CHECK_NOTNULL(reply)), task_(CHECK_NOTNULL(task)) {
+    req_.verb = UrlFetcher::Verb::POST;
+    req_.url.SetPath(path);
+    req_.headers.insert(make_pair("Content-Type", "application/json"));
+    req_.body = body;
+  }
+
+  void SetHostPort(const HostPortPair& host_port) {
+    CHECK(!host_port.first.empty());
+    CHECK_GT(host_port.second, 0);
+    req_.url.SetProtocol("http");
+    req_.url.SetHost(host_port.first);
+    req_.url.SetPort(host_port.second);
+  }
+
+  shared_ptr<JsonObject>* const reply_;
+  Task* const task_;
+
+  UrlFetcher::Request req_;
+  UrlFetcher::Response resp_;
+};
+
+
+struct EtcdV3Client::WatchState {
+  WatchState(const string& key, const WatchCallback& cb, Task* task)
+      : key_(key),
+        cb_(cb),
+        task_(CHECK_NOTNULL(task)),
+        pending_(CHECK_NOTNULL(evbuffer_new())),
+        revision_(-1),
+        initial_updates_sent_(false),
+        get_needed_(false),
+        work_running_(false) {
+  }
+
+  ~WatchState() {
+    evbuffer_free(pending_);
+    VLOG(1) << "EtcdV3Client::Watch: no longer watching " << key_;
+  }
+
+  const string key_;
+  const WatchCallback cb_;
+  Task* const task_;
+
+  // The members below are only used by the watch work, one at a time.
+
+  // Data received from the watch stream, not yet parsed.
+  evbuffer* const pending_;
+  // The revision the watcher is up to date with.
+  int64_t revision_;
+  bool initial_updates_sent_;
+  map<string, int64_t> known_keys_;
+  // Whether the revisions the watch was at have been compacted, so that
+  // it has to start over with a get.
+  bool get_needed_;
+  steady_clock::time_point stream_start_;
+  UrlFetcher::Request req_;
+  UrlFetcher::Response resp_;
+
+  mutex lock_;  // covers the members below:
+  std::deque<function<void()>> work_;
+  bool work_running_;
+};
+
+
+EtcdV3Client::EtcdV3Client(Executor* executor, UrlFetcher* fetcher,
+                           const list<HostPortPair>& etcds)
+    : executor_(CHECK_NOTNULL(executor)),
+      fetcher_(CHECK_NOTNULL(fetcher)),
+      etcds_(etcds) {
+  CHECK(!etcds_.empty()) << "No etcd hosts provided.";
+  for (const auto& e : etcds_) {
+    CHECK(!e.first.empty()) << "Empty host specified";
+    CHECK_GT(e.second, 0) << "Invalid port specified";
+  }
+}
+
+
+EtcdV3Client::~EtcdV3Client() {
+  VLOG(1) << "~EtcdV3Client: " << this;
+}
+
+
+EtcdClient::HostPortPair EtcdV3Client::GetEndpoint() const {
+  lock_guard<mutex> lock(lock_);
+  return etcds_.front();
+}
+
+
+EtcdClient::HostPortPair EtcdV3Client::ChooseNextServer() {
+  lock_guard<mutex> lock(lock_);
+
+  etcds_.emplace_back(etcds_.front());
+  etcds_.pop_front();
+
+  LOG(INFO) << "Selected new etcd server: " << etcds_.front().first << ":"
+            << etcds_.front().second;
+  return etcds_.front();
+}
+
+
+void EtcdV3Client::Call(const string& path, const JsonObject& body,
+                        shared_ptr<JsonObject>* reply, Task* task) {
+  CallState* const state(new CallState(path, body.ToJson(), reply, task));
+  task->DeleteWhenDone(state);
+  state->SetHostPort(GetEndpoint());
+  VLOG(2) << "EtcdV3Client::Call: " << path << " " << state->req_.body;
+
+  fetcher_->Fetch(state->req_, &state->resp_,
+                  task->AddChild(bind(&EtcdV3Client::CallDone, this, state,
+                                      _1)));
+}
+
+
+void EtcdV3Client::CallDone(CallState* state, Task* task) {
+  if (!task->status().ok()) {
+    if (task->status().error_code() == util::error::UNAVAILABLE) {
+      // Any member of the cluster can serve a request, try the next one.
+      LOG(WARNING) << "Etcd fetch failed: " << task->status() << ", retrying "
+                   << "on next etcd server.";
+      state->SetHostPort(ChooseNextServer());
+      fetcher_->Fetch(state->req_, &state->resp_,
+                      state->task_->AddChild(
+                          bind(&EtcdV3Client::CallDone, this, state, _1)));
+      return;
+    }
+    state->task_->Return(task->status());
+    return;
+  }
+
+  VLOG(2) << "response:\n" << state->resp_;
+  *state->reply_ = make_shared<JsonObject>(state->resp_.body);
+  state->task_->Return(
+      StatusFromReply(state->resp_.status_code, **state->reply_));
+}
+
+
+void EtcdV3Client::Txn(const vector<TxnOp>& ops, Response* resp, Task* task) {
+  InternalTxn(ops, 0, resp, task);
+}
+
+
+void EtcdV3Client::InternalTxn(const vector<TxnOp>& ops, int64_t lease,
+                               Response* resp, Task* task) {
+  CHECK(!ops.empty());
+  JsonArray compares;
+  JsonArray success;
+  JsonArray failure;
+  for (const auto& op : ops) {
+    CHECK(!op.key.empty());
+    if (op.previous_index != kAnyIndex || op.deleted) {
+      JsonObject compare;
+      compare.AddBase64("key", op.key);
+      if (op.previous_index > 0) {
+        compare.Add("target", string("MOD"));
+        compare.Add("result", string("EQUAL"));
+        compare.Add("mod_revision", op.previous_index);
+      } else {
+        compare.Add("target", string("CREATE"));
+        compare.Add("result", string(op.previous_index == 0 ? "EQUAL"
+                                                            : "GREATER"));
+        compare.Add("create_revision", static_cast<int64_t>(0));
+      }
+      compares.Add(&compare);
+    }
+
+    JsonObject change;
+    change.AddBase64("key", op.key);
+    JsonObject request;
+    if (op.deleted) {
+      request.Add("request_delete_range", change);
+    } else {
+      change.AddBase64("value", op.value);
+      if (lease != 0) {
+        change.Add("lease", lease);
+      }
+      request.Add("request_put", change);
+    }
+    success.Add(&request);
+
+    AddRangeRequest(op.key, "", &failure);
+  }
+
+  JsonObject body;
+  body.Add("compare", compares);
+  body.Add("success", success);
+  body.Add("failure", failure);
+
+  shared_ptr<JsonObject>* const reply(new shared_ptr<JsonObject>);
+  task->DeleteWhenDone(reply);
+  Call(kTxnPath, body, reply,
+       task->AddChild(bind(&TxnDone, ops, resp, task, reply, _1)));
+}
+
+
+void EtcdV3Client::TxnWithTTL(const vector<TxnOp>& ops, const seconds& ttl,
+                              Response* resp, Task* task) {
+  // Each write gets its own lease, so that the key expires |ttl| after
+  // it was last written, as with v2.
+  JsonObject body;
+  body.Add("TTL", static_cast<int64_t>(ttl.count()));
+  shared_ptr<JsonObject>* const reply(new shared_ptr<JsonObject>);
+  task->DeleteWhenDone(reply);
+  Call(kLeaseGrantPath, body, reply,
+       task->AddChild([this, ops, resp, task, reply](Task* child_task) {
+         if (!child_task->status().ok()) {
+           task->Return(child_task->status());
+           return;
+         }
+         const int64_t lease(Int64Field(**reply, "ID"));
+         if (lease == 0) {
+           task->Return(Status(util::error::FAILED_PRECONDITION,
+                               "Invalid JSON: Couldn't find 'ID'"));
+           return;
+         }
+         InternalTxn(ops, lease, resp, task);
+       }));
+}
+
+
+void EtcdV3Client::Get(const Request& req, GetResponse* resp, Task* task) {
+  if (req.wait_index > 0) {
+    task->Return(Status(util::error::UNIMPLEMENTED,
+                        "waiting gets are not supported, use Watch()"));
+    return;
+  }
+
+  // Looks up both the key and the keys under it, at the same revision.
+  const string prefix(DirPrefix(req.key));
+  JsonArray success;
+  AddRangeRequest(req.key, "", &success);
+  AddRangeRequest(prefix, PrefixEnd(prefix), &success);
+  JsonObject body;
+  body.Add("success", success);
+
+  shared_ptr<JsonObject>* const reply(new shared_ptr<JsonObject>);
+  task->DeleteWhenDone(reply);
+  Call(kTxnPath, body, reply,
+       task->AddChild(bind(&GetDone, req.key, resp, task, reply, _1)));
+}
+
+
+void EtcdV3Client::Create(const string& key, const string& value,
+                          Response* resp, Task* task) {
+  Txn({TxnOp(key, value, 0, false)}, resp, task);
+}
+
+
+void EtcdV3Client::CreateWithTTL(const string& key, const string& value,
+                                 const seconds& ttl, Response* resp,
+                                 Task* task) {
+  TxnWithTTL({TxnOp(key, value, 0, false)}, ttl, resp, task);
+}
+
+
+void EtcdV3Client::Update(const string& key, const string& value,
+                          const int64_t previous_index, Response* resp,
+                          Task* task) {
+  CHECK_GT(previous_index, 0);
+  Txn({TxnOp(key, value, previous_index, false)}, resp, task);
+}
+
+
+void EtcdV3Client::UpdateWithTTL(const string& key, const string& value,
+                                 const seconds& ttl,
+                                 const int64_t previous_index, Response* resp,
+                                 Task* task) {
+  CHECK_GT(previous_index, 0);
+  TxnWithTTL({TxnOp(key, value, previous_index, false)}, ttl, resp, task);
+}
+
+
+void EtcdV3Client::RefreshTTL(const string& key, const seconds& ttl,
+                              const int64_t previous_index, Response* resp,
+                              Task* task) {
+  CHECK_GT(previous_index, 0);
+  // Renewing the lease is no write, so the key stays at the same
+  // revision and the watches hear nothing of it, but the lease has to be
+  // looked up first.
+  JsonObject body;
+  body.AddBase64("key", key);
+  shared_ptr<JsonObject>* const reply(new shared_ptr<JsonObject>);
+  task->DeleteWhenDone(reply);
+  Call(kRangePath, body, reply, task->AddChild([this, key, previous_index,
+                                                resp, task,
+                                                reply](Task* child_task) {
+    *resp = Response();
+    if (!child_task->status().ok()) {
+      task->Return(child_task->status());
+      return;
+    }
+    const JsonArray kvs(**reply, "kvs");
+    if (!kvs.Ok() || kvs.Length() < 1) {
+      task->Return(
+          Status(util::error::NOT_FOUND, "Key not found (" + key + ")"));
+      return;
+    }
+    const JsonObject kv(kvs, 0);
+    const int64_t lease(Int64Field(kv, "lease"));
+    if (Int64Field(kv, "mod_revision") != previous_index || lease == 0) {
+      task->Return(
+          Status(util::error::FAILED_PRECONDITION, "Compare failed"));
+      return;
+    }
+
+    JsonObject keepalive;
+    keepalive.Add("ID", lease);
+    Call(kLeaseKeepAlivePath, keepalive, reply,
+         task->AddChild([key, previous_index, resp, task,
+                         reply](Task* keepalive_task) {
+           if (!keepalive_task->status().ok()) {
+             task->Return(keepalive_task->status());
+             return;
+           }
+           // The reply of the stream is wrapped, and an expired lease
+           // comes back without a TTL.
+           const JsonObject result(**reply, "result");
+           if (!result.Ok() || Int64Field(result, "TTL") <= 0) {
+             task->Return(
+                 Status(util::error::NOT_FOUND, "Key expired (" + key + ")"));
+             return;
+           }
+           resp->etcd_index = previous_index;
+           task->Return();
+         }));
+  }));
+}
+
+
+void EtcdV3Client::ForceSet(const string& key, const string& value,
+                            Response* resp, Task* task) {
+  Txn({TxnOp(key, value, kAnyIndex, false)}, resp, task);
+}
+
+
+void EtcdV3Client::ForceSetWithTTL(const string& key, const string& value,
+                                   const seconds& ttl, Response* resp,
+                                   Task* task) {
+  TxnWithTTL({TxnOp(key, value, kAnyIndex, false)}, ttl, resp, task);
+}
+
+
+void EtcdV3Client::Delete(const string& key, const int64_t current_index,
+                          Task* task) {
+  CHECK_GT(current_index, 0);
+  Response* const resp(new Response);
+  task->DeleteWhenDone(resp);
+  Txn({TxnOp(key, "", current_index, true)}, resp, task);
+}
+
+
+void EtcdV3Client::ForceDelete(const string& key, Task* task) {
+  Response* const resp(new Response);
+  task->DeleteWhenDone(resp);
+  Txn({TxnOp(key, "", kAnyIndex, true)}, resp, task);
+}
+
+
+void EtcdV3Client::GetStoreStats(StatsResponse* resp, Task* task) {
+  JsonObject body;
+  body.AddBase64("key", string(1, '\0'));
+  body.AddBase64("range_end", string(1, '\0'));
+  body.AddBoolean("count_only", true);
+
+  shared_ptr<JsonObject>* const reply(new shared_ptr<JsonObject>);
+  task->DeleteWhenDone(reply);
+  Call(kRangePath, body, reply,
+       task->AddChild([resp, task, reply](Task* child_task) {
+         *resp = StatsResponse();
+         if (!child_task->status().ok()) {
+           task->Return(child_task->status());
+           return;
+         }
+         resp->etcd_index = Revision(**reply);
+         resp->stats["createSuccess"] = Int64Field(**reply, "count");
+         resp->stats["deleteSuccess"] = 0;
+         resp->stats["compareAndDeleteSuccess"] = 0;
+         resp->stats["expireCount"] = 0;
+         task->Return();
+       }));
+}
+
+
+void EtcdV3Client::Watch(const string& key, const WatchCallback& cb,
+                         Task* task) {
+  VLOG(1) << "EtcdV3Client::Watch: " << key;
+
+  WatchState* const state(new WatchState(key, cb, task));
+  task->DeleteWhenDone(state);
+
+  ScheduleWatchWork(state, bind(&EtcdV3Client::StartWatchGet, this, state));
+}
+
+
+void EtcdV3Client::ScheduleWatchWork(WatchState* state,
+                                     const function<void()>& work) {
+  lock_guard<mutex> lock(state->lock_);
+  state->work_.push_back(work);
+  if (!state->work_running_) {
+    state->work_running_ = true;
+    // The child task keeps |state| alive until the work is done.
+    state->task_->executor()->Add(
+        bind(&EtcdV3Client::RunWatchWork, this, state,
+             state->task_->AddChild([](Task*) {})));
+  }
+}
+
+
+void EtcdV3Client::RunWatchWork(WatchState* state, Task* hold) {
+  while (true) {
+    function<void()> work;
+    {
+      lock_guard<mutex> lock(state->lock_);
+      if (state->work_.empty()) {
+        state->work_running_ = false;
+        break;
+      }
+      work = move(state->work_.front());
+      state->work_.pop_front();
+    }
+    work();
+  }
+  hold->Return();
+}
+
+
+void EtcdV3Client::StartWatchGet(WatchState* state) {
+  if (state->task_->CancelRequested()) {
+    state->task_->Return(Status::CANCELLED);
+    return;
+  }
+  state->get_needed_ = false;
+  GetResponse* const resp(new GetResponse);
+  Get(state->key_, resp,
+      state->task_->AddChild([this, state, resp](Task* child_task) {
+        ScheduleWatchWork(state, bind(&EtcdV3Client::WatchGetDone, this,
+                                      state, resp, child_task->status()));
+      }));
+}
+
+
+void EtcdV3Client::WatchGetDone(WatchState* state, GetResponse* resp,
+                                const Status& status) {
+  unique_ptr<GetResponse> resp_deleter(resp);
+  if (state->task_->CancelRequested()) {
+    state->task_->Return(Status::CANCELLED);
+    return;
+  }
+
+  // A missing key is just one with nothing in it yet.
+  const bool not_found(status.CanonicalCode() == util::error::NOT_FOUND &&
+                       resp->etcd_index >= 0);
+  if (!status.ok() && !not_found) {
+    LOG(WARNING) << "Initial get error: " << status << ", will retry "
+                 << "in " << FLAGS_etcd_watch_error_retry_delay_seconds
+                 << " second(s)";
+    state->task_->executor()->Delay(
+        seconds(FLAGS_etcd_watch_error_retry_delay_seconds),
+        state->task_->AddChild([this, state](Task*) {
+          ScheduleWatchWork(state,
+                            bind(&EtcdV3Client::StartWatchGet, this, state));
+        }));
+    return;
+  }
+
+  vector<Node> nodes;
+  if (status.ok()) {
+    if (resp->node.is_dir_) {
+      nodes = move(resp->node.nodes_);
+    } else {
+      nodes.push_back(resp->node);
+    }
+  }
+
+  vector<Node> updates;
+  map<string, int64_t> new_known_keys;
+  for (const auto& node : nodes) {
+    const auto it(state->known_keys_.find(node.key_));
+    if (it == state->known_keys_.end() || it->second < node.modified_index_) {
+      updates.emplace_back(node);
+    }
+    new_known_keys[node.key_] = node.modified_index_;
+    if (it != state->known_keys_.end()) {
+      state->known_keys_.erase(it);
+    }
+  }
+  // The keys still in known_keys_ at this point have been deleted.
+  for (const auto& key : state->known_keys_) {
+    updates.emplace_back(Node(-1, -1, key.first, false, "", {}, true));
+  }
+  state->known_keys_.swap(new_known_keys);
+  state->revision_ = resp->etcd_index;
+
+  if (!updates.empty() || !state->initial_updates_sent_) {
+    state->initial_updates_sent_ = true;
+    state->cb_(updates);
+  }
+
+  StartWatchStream(state);
+}
+
+
+void EtcdV3Client::StartWatchStream(WatchState* state) {
+  if (state->task_->CancelRequested()) {
+    state->task_->Return(Status::CANCELLED);
+    return;
+  }
+
+  // The range also covers the keys which merely start with the same
+  // characters, these are filtered out.
+  JsonObject create;
+  create.AddBase64("key", state->key_);
+  create.AddBase64("range_end", PrefixEnd(state->key_));
+  create.Add("start_revision", state->revision_ + 1);
+  JsonObject body;
+  body.Add("create_request", create);
+
+  const HostPortPair endpoint(GetEndpoint());
+  state->req_ = UrlFetcher::Request();
+  state->req_.verb = UrlFetcher::Verb::POST;
+  state->req_.url.SetProtocol("http");
+  state->req_.url.SetHost(endpoint.first);
+  state->req_.url.SetPort(endpoint.second);
+  state->req_.url.SetPath(kWatchPath);
+  state->req_.headers.insert(make_pair("Content-Type", "application/json"));
+  state->req_.body = body.ToJson();
+
+  state->resp_ = UrlFetcher::Response();
+  state->resp_.on_body = [this, state](evbuffer* data) {
+    const size_t length(evbuffer_get_length(data));
+    if (length == 0) {
+      return;
+    }
+    string chunk(length, '\0');
+    CHECK_EQ(evbuffer_remove(data, &chunk[0], length),
+             static_cast<int>(length));
+    ScheduleWatchWork(state,
+                      bind(&EtcdV3Client::WatchData, this, state, chunk));
+  };
+  evbuffer_drain(state->pending_, evbuffer_get_length(state->pending_));
+  state->stream_start_ = steady_clock::now();
+
+  VLOG(1) << "EtcdV3Client::Watch: " << state->key_ << " from revision "
+          << state->revision_ + 1;
+  fetcher_->Fetch(state->req_, &state->resp_,
+                  state->task_->AddChild([this, state](Task* child_task) {
+                    ScheduleWatchWork(state,
+                                      bind(&EtcdV3Client::WatchStreamDone,
+                                           this, state, child_task->status()));
+                  }));
+}
+
+
+void EtcdV3Client::WatchData(WatchState* state, const string& data) {
+  CHECK_EQ(evbuffer_add(state->pending_, data.data(), data.size()), 0);
+  // The stream is made of one JSON object per message.
+  while (true) {
+    const JsonObject message(state->pending_);
+    if (!message.Ok()) {
+      break;
+    }
+    HandleWatchMessage(state, message);
+  }
+}
+
+
+void EtcdV3Client::HandleWatchMessage(WatchState* state,
+                                      const JsonObject& message) {
+  const JsonObject result(message, "result");
+  if (!result.Ok()) {
+    LOG(WARNING) << "Watch error: " << message.DebugString();
+    return;
+  }
+  if (Int64Field(result, "compact_revision") > 0) {
+    VLOG(1) << "Watch revision compacted: " << result.DebugString();
+    state->get_needed_ = true;
+    return;
+  }
+
+  const JsonArray events(result, "events");
+  if (!events.Ok()) {
+    return;
+  }
+  vector<Node> updates;
+  for (int i = 0; i < events.Length(); ++i) {
+    const JsonObject event(events, i);
+    const JsonObject kv(event, "kv");
+    if (!kv.Ok()) {
+      LOG(WARNING) << "Watch event without a key: " << result.DebugString();
+      continue;
+    }
+    const StatusOr<Node> node(ParseKeyValue(kv));
+    if (!node.ok()) {
+      LOG(WARNING) << "Bad watch event: " << node.status();
+      continue;
+    }
+    const Node& kv_node(node.ValueOrDie());
+    state->revision_ = max(state->revision_, kv_node.modified_index_);
+    if (!IsUnder(kv_node.key_, state->key_)) {
+      continue;
+    }
+    const JsonString type(event, "type");
+    if (type.Ok() && string(type.Value()) == "DELETE") {
+      VLOG(1) << "erased key: " << kv_node.key_;
+      state->known_keys_.erase(kv_node.key_);
+      updates.emplace_back(Node(kv_node.created_index_,
+                                kv_node.modified_index_, kv_node.key_, false,
+                                "", {}, true));
+    } else {
+      state->known_keys_[kv_node.key_] = kv_node.modified_index_;
+      updates.emplace_back(kv_node);
+    }
+  }
+
+  if (!updates.empty()) {
+    state->cb_(updates);
+  }
+}
+
+
+void EtcdV3Client::WatchStreamDone(WatchState* state, const Status& status) {
+  // Whatever did not go through |on_body|.
+  if (!state->resp_.body.empty()) {
+    WatchData(state, state->resp_.body);
+    state->resp_.body.clear();
+  }
+
+  if (state->task_->CancelRequested()) {
+    state->task_->Return(Status::CANCELLED);
+    return;
+  }
+  if (state->get_needed_) {
+    StartWatchGet(state);
+    return;
+  }
+
+  const Status stream_status(
+      status.ok() ? StatusFromReply(state->resp_.status_code, JsonObject())
+                  : status);
+  if (!stream_status.ok()) {
+    if (stream_status.CanonicalCode() == util::error::UNAVAILABLE) {
+      ChooseNextServer();
+    }
+    if (steady_clock::now() - state->stream_start_ <
+        seconds(FLAGS_etcd_watch_error_retry_delay_seconds)) {
+      LOG(WARNING) << "Watch request error: " << stream_status
+                   << ", will retry in "
+                   << FLAGS_etcd_watch_error_retry_delay_seconds
+                   << " second(s)";
+      state->task_->executor()->Delay(
+          seconds(FLAGS_etcd_watch_error_retry_delay_seconds),
+          state->task_->AddChild([this, state](Task*) {
+            ScheduleWatchWork(state, bind(&EtcdV3Client::StartWatchStream,
+                                          this, state));
+          }));
+      return;
+    }
+    // Most likely the connection timing out after a quiet while.
+    VLOG(1) << "Watch request ended: " << stream_status;
+  }
+
+  StartWatchStream(state);
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,164 @@
+#ifndef CERT_TRANS_UTIL_ETCD_V3_H_
+#define CERT_TRANS_UTIL_ETCD_V3_H_
+
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+#include "net/url_fetcher.h"
+#include "util/etcd.h"
+#include "util/status.h"
+#include "util/task.h"
+
+class JsonObject;
+
+namespace cert_trans {
+
+
+// An EtcdClient speaking the etcd v3 API, through the JSON gateway of
+// the etcd servers (so over the UrlFetcher, like the v2 one). Every
+// write is a transaction, several of which can be combined with Txn(),
+// keys with a TTL are attached to a lease, and a Watch() is a single
+// streaming request rather than a series of long polls.
+//
+// The v2 data model is emulated: indices are revisions, and a
+// "directory" is all the keys starting with its name and a '/', so its
+// nodes are all the keys under it, however deep.
+class EtcdV3Client : public EtcdClient {
+ public:
+  // Value of |TxnOp::previous_index| for no condition on the key.
+  static const int64_t kAnyIndex = -1;
+
+  // One of the changes applied by Txn().
+  struct TxnOp {
+    // Sets |key| to |value|, or deletes it if |deleted|. If
+    // |previous_index| is zero, the key must not exist yet, otherwise
+    // unless it is kAnyIndex, it must be at that index. A key being
+    // deleted must exist.
+    TxnOp(const std::string& key, const std::string& value,
+          int64_t previous_index, bool deleted)
+        : key(key),
+          value(value),
+          previous_index(previous_index),
+          deleted(deleted) {
+    }
+
+    std::string key;
+    std::string value;
+    int64_t previous_index;
+    bool deleted;
+  };
+
+  EtcdV3Client(util::Executor* executor, UrlFetcher* fetcher,
+               const std::list<HostPortPair>& etcds);
+
+  ~EtcdV3Client() override;
+
+  // Applies all of |ops| at once, or none of them if any of their
+  // conditions does not hold, in which case the status is NOT_FOUND if
+  // a key expected to exist is missing, FAILED_PRECONDITION otherwise.
+  // |resp->etcd_index| is set to the index of the change.
+  void Txn(const std::vector<TxnOp>& ops, Response* resp, util::Task* task);
+
+  // A |req.wait_index| is not supported, Watch() should be used
+  // instead.
+  void Get(const Request& req, GetResponse* resp, util::Task* task) override;
+
+  void Create(const std::string& key, const std::string& value, Response* resp,
+              util::Task* task) override;
+
+  void CreateWithTTL(const std::string& key, const std::string& value,
+                     const std::chrono::seconds& ttl, Response* resp,
+                     util::Task* task) override;
+
+  void Update(const std::string& key, const std::string& value,
+              const int64_t previous_index, Response* resp,
+              util::Task* task) override;
+
+  void UpdateWithTTL(const std::string& key, const std::string& value,
+                     const std::chrono::seconds& ttl,
+                     const int64_t previous_index, Response* resp,
+                     util::Task* task) override;
+
+  // Renews the lease of |key|, which keeps the TTL that it was granted
+  // with rather than |ttl|, and leaves |key| at |previous_index|.
+  void RefreshTTL(const std::string& key, const std::chrono::seconds& ttl,
+                  const int64_t previous_index, Response* resp,
+                  util::Task* task) override;
+
+  void ForceSet(const std::string& key, const std::string& value,
+                Response* resp, util::Task* task) override;
+
+  void ForceSetWithTTL(const std::string& key, const std::string& value,
+                       const std::chrono::seconds& ttl, Response* resp,
+                       util::Task* task) override;
+
+  void Delete(const std::string& key, const int64_t current_index,
+              util::Task* task) override;
+
+  void ForceDelete(const std::string& key, util::Task* task) override;
+
+  // etcd v3 keeps no operation counters, the number of keys is reported
+  // as "createSuccess" (all the other counters being zero), so that the
+  // number of entries can be worked out as with v2.
+  void GetStoreStats(StatsResponse* resp, util::Task* task) override;
+
+  // Cancelling |task| takes effect once the current watch request ends,
+  // which it does at the latest after the read timeout of the
+  // connection (see --connection_read_timeout_seconds).
+  void Watch(const std::string& key, const WatchCallback& cb,
+             util::Task* task) override;
+
+ private:
+  struct CallState;
+  struct WatchState;
+
+  HostPortPair GetEndpoint() const;
+  HostPortPair ChooseNextServer();
+
+  // Posts |body| to |path| (say, "/v3/kv/range") on the current etcd
+  // server, moving on to the next one if it is unavailable, and parses
+  // the reply into |*reply|.
+  void Call(const std::string& path, const JsonObject& body,
+            std::shared_ptr<JsonObject>* reply, util::Task* task);
+  void CallDone(CallState* state, util::Task* task);
+
+  // Like Txn(), with the keys set attached to |lease| if not zero.
+  void InternalTxn(const std::vector<TxnOp>& ops, int64_t lease,
+                   Response* resp, util::Task* task);
+  // Like Txn(), with the keys set expiring after |ttl|.
+  void TxnWithTTL(const std::vector<TxnOp>& ops,
+                  const std::chrono::seconds& ttl, Response* resp,
+                  util::Task* task);
+
+  // Runs |work| on the executor of the task of |state|, after whatever
+  // was scheduled before it, to keep the watch callbacks in order.
+  void ScheduleWatchWork(WatchState* state, const std::function<void()>& work);
+  void RunWatchWork(WatchState* state, util::Task* hold);
+  void StartWatchGet(WatchState* state);
+  void WatchGetDone(WatchState* state, GetResponse* resp,
+                    const util::Status& status);
+  void StartWatchStream(WatchState* state);
+  void WatchData(WatchState* state, const std::string& data);
+  void HandleWatchMessage(WatchState* state, const JsonObject& message);
+  void WatchStreamDone(WatchState* state, const util::Status& status);
+
+  util::Executor* const executor_;
+  UrlFetcher* const fetcher_;
+
+  mutable std::mutex lock_;
+  std::list<HostPortPair> etcds_;
+
+  DISALLOW_COPY_AND_ASSIGN(EtcdV3Client);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_ETCD_V3_H_
@@ -0,0 +1,362 @@
+#include "util/etcd_v3.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+#include "net/mock_url_fetcher.h"
+#include "util/json_wrapper.h"
+#include "util/libevent_wrapper.h"
+#include "util/status_test_util.h"
+#include "util/sync_task.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+
+using std::chrono::seconds;
+using std::make_shared;
+using std::shared_ptr;
+using std::string;
+using std::to_string;
+using std::vector;
+using testing::HasSubstr;
+using testing::InSequence;
+using testing::Invoke;
+using testing::_;
+using util::SyncTask;
+using util::Task;
+using util::testing::StatusIs;
+
+namespace {
+
+const char kEntryKey[] = "/some/key";
+const char kDirKey[] = "/some";
+
+const char kEtcdHost[] = "etcd.example.net";
+const int kEtcdPort = 4242;
+
+
+string EtcdUrl(const string& path) {
+  return "http://" + string(kEtcdHost) + ":" + to_string(kEtcdPort) + path;
+}
+
+
+string KeyValue(const string& key, const string& value, int64_t create,
+                int64_t mod) {
+  return "{\"key\": \"" + util::ToBase64(key) + "\", \"value\": \"" +
+         util::ToBase64(value) + "\", \"create_revision\": \"" +
+         to_string(create) + "\", \"mod_revision\": \"" + to_string(mod) +
+         "\"}";
+}
+
+
+string Header(int64_t revision) {
+  return "\"header\": {\"revision\": \"" + to_string(revision) + "\"}";
+}
+
+
+string RangeResponse(const string& kvs) {
+  return "{\"response_range\": {" +
+         (kvs.empty() ? "" : "\"kvs\": [" + kvs + "]") + "}}";
+}
+
+
+// Answers a fetch with |body|, after checking that the request went to
+// |path| and that its body has every one of |expected|.
+void HandleFetch(const string& path, const vector<string>& expected,
+                 int status_code, const string& body,
+                 const UrlFetcher::Request& req, UrlFetcher::Response* resp,
+                 Task* task) {
+  EXPECT_EQ(UrlFetcher::Verb::POST, req.verb);
+  EXPECT_EQ(URL(EtcdUrl(path)), req.url);
+  for (const auto& e : expected) {
+    EXPECT_THAT(req.body, HasSubstr(e));
+  }
+  resp->status_code = status_code;
+  resp->body = body;
+  task->Return();
+}
+
+
+class EtcdV3Test : public ::testing::Test {
+ public:
+  EtcdV3Test()
+      : base_(make_shared<libevent::Base>()),
+        pump_(base_),
+        client_(base_.get(), &url_fetcher_,
+                {EtcdClient::HostPortPair(kEtcdHost, kEtcdPort)}) {
+  }
+
+ protected:
+  void ExpectFetch(const string& path, const vector<string>& expected,
+                   const string& body) {
+    EXPECT_CALL(url_fetcher_, Fetch(_, _, _))
+        .WillOnce(Invoke(std::bind(HandleFetch, path, expected, 200, body,
+                                   std::placeholders::_1,
+                                   std::placeholders::_2,
+                                   std::placeholders::_3)));
+  }
+
+  const shared_ptr<libevent::Base> base_;
+  MockUrlFetcher url_fetcher_;
+  libevent::EventPumpThread pump_;
+  EtcdV3Client client_;
+};
+
+
+TEST_F(EtcdV3Test, Get) {
+  ExpectFetch("/v3/kv/txn",
+              {util::ToBase64(kEntryKey), util::ToBase64("/some/key/")},
+              "{" + Header(11) + ", \"succeeded\": true, \"responses\": [" +
+                  RangeResponse(KeyValue(kEntryKey, "123", 6, 9)) + ", " +
+                  RangeResponse("") + "]}");
+
+  SyncTask task(base_.get());
+  EtcdClient::GetResponse resp;
+  client_.Get(string(kEntryKey), &resp, task.task());
+  task.Wait();
+  EXPECT_OK(task);
+  EXPECT_EQ(11, resp.etcd_index);
+  EXPECT_FALSE(resp.node.is_dir_);
+  EXPECT_EQ(kEntryKey, resp.node.key_);
+  EXPECT_EQ(6, resp.node.created_index_);
+  EXPECT_EQ(9, resp.node.modified_index_);
+  EXPECT_EQ("123", resp.node.value_);
+}
+
+
+TEST_F(EtcdV3Test, GetDirectory) {
+  ExpectFetch("/v3/kv/txn", {util::ToBase64("/some/")},
+              "{" + Header(11) + ", \"succeeded\": true, \"responses\": [" +
+                  RangeResponse("") + ", " +
+                  RangeResponse(KeyValue("/some/key1", "123", 6, 9) + ", " +
+                                KeyValue("/some/key2", "456", 7, 7)) +
+                  "]}");
+
+  SyncTask task(base_.get());
+  EtcdClient::GetResponse resp;
+  client_.Get(string(kDirKey), &resp, task.task());
+  task.Wait();
+  EXPECT_OK(task);
+  EXPECT_TRUE(resp.node.is_dir_);
+  ASSERT_EQ(2U, resp.node.nodes_.size());
+  EXPECT_EQ("/some/key1", resp.node.nodes_[0].key_);
+  EXPECT_EQ("123", resp.node.nodes_[0].value_);
+  EXPECT_EQ("/some/key2", resp.node.nodes_[1].key_);
+  EXPECT_EQ(7, resp.node.nodes_[1].modified_index_);
+}
+
+
+TEST_F(EtcdV3Test, GetNotFound) {
+  ExpectFetch("/v3/kv/txn", {},
+              "{" + Header(11) + ", \"succeeded\": true, \"responses\": [" +
+                  RangeResponse("") + ", " + RangeResponse("") + "]}");
+
+  SyncTask task(base_.get());
+  EtcdClient::GetResponse resp;
+  client_.Get(string(kEntryKey), &resp, task.task());
+  task.Wait();
+  EXPECT_THAT(task.status(), StatusIs(util::error::NOT_FOUND,
+                                      HasSubstr(string(kEntryKey))));
+}
+
+
+TEST_F(EtcdV3Test, GetError) {
+  EXPECT_CALL(url_fetcher_, Fetch(_, _, _))
+      .WillOnce(Invoke(std::bind(
+          HandleFetch, "/v3/kv/txn", vector<string>(), 400,
+          "{\"error\": \"bad\", \"code\": 3, \"message\": \"bad\"}",
+          std::placeholders::_1, std::placeholders::_2,
+          std::placeholders::_3)));
+
+  SyncTask task(base_.get());
+  EtcdClient::GetResponse resp;
+  client_.Get(string(kEntryKey), &resp, task.task());
+  task.Wait();
+  EXPECT_THAT(task.status(), StatusIs(util::error::INVALID_ARGUMENT));
+}
+
+
+TEST_F(EtcdV3Test, Create) {
+  ExpectFetch("/v3/kv/txn", {"\"CREATE\"", "\"request_put\"",
+                             util::ToBase64(kEntryKey), util::ToBase64("123")},
+              "{" + Header(7) + ", \"succeeded\": true, \"responses\": [{}]}");
+
+  SyncTask task(base_.get());
+  EtcdClient::Response resp;
+  client_.Create(kEntryKey, "123", &resp, task.task());
+  task.Wait();
+  EXPECT_OK(task);
+  EXPECT_EQ(7, resp.etcd_index);
+}
+
+
+TEST_F(EtcdV3Test, CreateExisting) {
+  ExpectFetch("/v3/kv/txn", {},
+              "{" + Header(7) + ", \"responses\": [" +
+                  RangeResponse(KeyValue(kEntryKey, "old", 5, 5)) + "]}");
+
+  SyncTask task(base_.get());
+  EtcdClient::Response resp;
+  client_.Create(kEntryKey, "123", &resp, task.task());
+  task.Wait();
+  EXPECT_THAT(task.status(), StatusIs(util::error::FAILED_PRECONDITION));
+}
+
+
+TEST_F(EtcdV3Test, UpdateMissing) {
+  ExpectFetch("/v3/kv/txn", {"\"MOD\"", "\"mod_revision\": 5"},
+              "{" + Header(7) + ", \"responses\": [" + RangeResponse("") +
+                  "]}");
+
+  SyncTask task(base_.get());
+  EtcdClient::Response resp;
+  client_.Update(kEntryKey, "123", 5, &resp, task.task());
+  task.Wait();
+  EXPECT_THAT(task.status(), StatusIs(util::error::NOT_FOUND,
+                                      HasSubstr(string(kEntryKey))));
+}
+
+
+TEST_F(EtcdV3Test, CreateWithTTLAttachesLease) {
+  {
+    InSequence s;
+    ExpectFetch("/v3/lease/grant", {"\"TTL\": 30"},
+                "{" + Header(6) + ", \"ID\": \"4242\", \"TTL\": \"30\"}");
+    ExpectFetch("/v3/kv/txn", {"\"lease\": 4242"},
+                "{" + Header(7) +
+                    ", \"succeeded\": true, \"responses\": [{}]}");
+  }
+
+  SyncTask task(base_.get());
+  EtcdClient::Response resp;
+  client_.CreateWithTTL(kEntryKey, "123", seconds(30), &resp, task.task());
+  task.Wait();
+  EXPECT_OK(task);
+  EXPECT_EQ(7, resp.etcd_index);
+}
+
+
+TEST_F(EtcdV3Test, RefreshTTLRenewsLease) {
+  {
+    InSequence s;
+    ExpectFetch("/v3/kv/range", {util::ToBase64(kEntryKey)},
+                "{" + Header(9) + ", \"kvs\": [{\"key\": \"" +
+                    util::ToBase64(kEntryKey) +
+                    "\", \"mod_revision\": \"7\", \"lease\": \"4242\"}]}");
+    ExpectFetch("/v3/lease/keepalive", {"\"ID\": 4242"},
+                "{\"result\": {" + Header(9) +
+                    ", \"ID\": \"4242\", \"TTL\": \"30\"}}");
+  }
+
+  SyncTask task(base_.get());
+  EtcdClient::Response resp;
+  client_.RefreshTTL(kEntryKey, seconds(30), 7, &resp, task.task());
+  task.Wait();
+  EXPECT_OK(task);
+  EXPECT_EQ(7, resp.etcd_index);
+}
+
+
+TEST_F(EtcdV3Test, RefreshTTLChecksIndex) {
+  ExpectFetch("/v3/kv/range", {util::ToBase64(kEntryKey)},
+              "{" + Header(9) + ", \"kvs\": [{\"key\": \"" +
+                  util::ToBase64(kEntryKey) +
+                  "\", \"mod_revision\": \"8\", \"lease\": \"4242\"}]}");
+
+  SyncTask task(base_.get());
+  EtcdClient::Response resp;
+  client_.RefreshTTL(kEntryKey, seconds(30), 7, &resp, task.task());
+  task.Wait();
+  EXPECT_THAT(task.status(), StatusIs(util::error::FAILED_PRECONDITION));
+}
+
+
+TEST_F(EtcdV3Test, TxnAppliesAllOps) {
+  ExpectFetch("/v3/kv/txn",
+              {util::ToBase64("/a"), util::ToBase64("/b"),
+               "\"request_delete_range\""},
+              "{" + Header(8) +
+                  ", \"succeeded\": true, \"responses\": [{}, {}]}");
+
+  SyncTask task(base_.get());
+  EtcdClient::Response resp;
+  client_.Txn({EtcdV3Client::TxnOp("/a", "1", 3, false),
+               EtcdV3Client::TxnOp("/b", "", EtcdV3Client::kAnyIndex, true)},
+              &resp, task.task());
+  task.Wait();
+  EXPECT_OK(task);
+  EXPECT_EQ(8, resp.etcd_index);
+}
+
+
+TEST_F(EtcdV3Test, GetStoreStats) {
+  ExpectFetch("/v3/kv/range", {"\"count_only\": true"},
+              "{" + Header(8) + ", \"count\": \"12\"}");
+
+  SyncTask task(base_.get());
+  EtcdClient::StatsResponse resp;
+  client_.GetStoreStats(&resp, task.task());
+  task.Wait();
+  EXPECT_OK(task);
+  EXPECT_EQ(12, resp.stats["createSuccess"]);
+  EXPECT_EQ(0, resp.stats["deleteSuccess"]);
+}
+
+
+TEST_F(EtcdV3Test, Watch) {
+  {
+    InSequence s;
+    ExpectFetch("/v3/kv/txn", {},
+                "{" + Header(5) + ", \"succeeded\": true, \"responses\": [" +
+                    RangeResponse("") + ", " +
+                    RangeResponse(KeyValue("/some/key1", "123", 4, 4)) +
+                    "]}");
+    // The messages of the stream, of which the second one has an event
+    // for a key which is not under the watched one.
+    ExpectFetch("/v3/watch", {"\"start_revision\": 6"},
+                "{\"result\": {" + Header(5) + ", \"created\": true}}\n" +
+                    "{\"result\": {" + Header(7) + ", \"events\": [" +
+                    "{\"kv\": " + KeyValue("/some/key2", "456", 6, 6) +
+                    "}, {\"kv\": " + KeyValue("/something", "x", 6, 6) +
+                    "}, {\"type\": \"DELETE\", \"kv\": {\"key\": \"" +
+                    util::ToBase64("/some/key1") +
+                    "\", \"mod_revision\": \"7\"}}]}}\n");
+  }
+
+  SyncTask task(base_.get());
+  int num_calls(0);
+  client_.Watch(kDirKey,
+                [&task, &num_calls](const vector<EtcdClient::Node>& updates) {
+                  if (++num_calls == 1) {
+                    ASSERT_EQ(1U, updates.size());
+                    EXPECT_EQ("/some/key1", updates[0].key_);
+                    EXPECT_EQ("123", updates[0].value_);
+                    return;
+                  }
+                  ASSERT_EQ(2U, updates.size());
+                  EXPECT_EQ("/some/key2", updates[0].key_);
+                  EXPECT_EQ("456", updates[0].value_);
+                  EXPECT_FALSE(updates[0].deleted_);
+                  EXPECT_EQ("/some/key1", updates[1].key_);
+                  EXPECT_TRUE(updates[1].deleted_);
+                  EXPECT_EQ(7, updates[1].modified_index_);
+                  task.Cancel();
+                },
+                task.task());
+  task.Wait();
+  EXPECT_EQ(2, num_calls);
+  EXPECT_THAT(task.status(), StatusIs(util::error::CANCELLED));
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
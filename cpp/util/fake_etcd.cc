@@ -5,6 +5,7 @@
 #include "util/json_wrapper.h"
 
 using std::bind;
+using std::chrono::milliseconds;
 using std::chrono::seconds;
 using std::chrono::system_clock;
 using std::function;
@@ -67,18 +68,32 @@ string NormalizeKey(const string& input) {
 }
 
 
-bool WatchMatchesKey(const string& watch_key, const string& notify_key,
-                     bool recursive) {
-  if (watch_key == notify_key) {
-    return true;
-  }
+// The keys of the descendants of |key| all start with this prefix, and
+// are before the same prefix with its last '/' turned into a '0', which
+// is the next character.
+string DescendantsPrefix(const string& key) {
+  return key == "/" ? key : key + "/";
+}
 
-  if (!recursive) {
-    return false;
-  }
 
-  const string dir(watch_key + "/");
-  return watch_key == "/" || notify_key.compare(0, dir.size(), dir) == 0;
+string DescendantsEnd(const string& key) {
+  string retval(DescendantsPrefix(key));
+  retval.back() = '0';
+  return retval;
+}
+
+
+// |key| and the keys of its parents, from the root down.
+vector<string> KeyAndParents(const string& key) {
+  vector<string> retval{"/"};
+  for (string::size_type slash = key.find('/', 1); slash != string::npos;
+       slash = key.find('/', slash + 1)) {
+    retval.emplace_back(key.substr(0, slash));
+  }
+  if (key != "/") {
+    retval.emplace_back(key);
+  }
+  return retval;
 }
 
 
@@ -121,6 +136,9 @@ FakeEtcdClient::~FakeEtcdClient() {
 
 void FakeEtcdClient::DumpEntries(const unique_lock<mutex>& lock) const {
   CHECK(lock.owns_lock());
+  if (!VLOG_IS_ON(1)) {
+    return;
+  }
   for (const auto& pair : entries_) {
     VLOG(1) << pair.second.ToString();
   }
@@ -132,15 +150,15 @@ void FakeEtcdClient::Watch(const string& rawkey, const WatchCallback& cb,
   const string key(NormalizeKey(rawkey));
   unique_lock<mutex> lock(mutex_);
   vector<Node> initial_updates;
-  map<string, Node>::const_iterator it(entries_.find(key));
+  const map<string, Node>::const_iterator it(entries_.find(key));
   if (it != entries_.end()) {
     if (it->second.is_dir_) {
-      const string key_prefix(key + "/");
-      for (++it; it != entries_.end() &&
-                 it->first.compare(0, key_prefix.size(), key_prefix) == 0;
-           ++it) {
-        CHECK(!it->second.deleted_);
-        initial_updates.emplace_back(it->second);
+      const map<string, Node>::const_iterator end(
+          entries_.lower_bound(DescendantsEnd(key)));
+      for (auto child = entries_.lower_bound(DescendantsPrefix(key));
+           child != end; ++child) {
+        CHECK(!child->second.deleted_);
+        initial_updates.emplace_back(child->second);
       }
     } else {
       CHECK(!it->second.deleted_);
@@ -149,6 +167,7 @@ void FakeEtcdClient::Watch(const string& rawkey, const WatchCallback& cb,
   }
   ScheduleWatchCallback(lock, task, bind(cb, move(initial_updates)));
   watches_[key].push_back(make_pair(cb, task));
+  CHECK(watch_keys_.emplace(task, key).second);
   task->WhenCancelled(bind(&FakeEtcdClient::CancelWatch, this, task));
   ++stats_["watchers"];
 }
@@ -157,16 +176,17 @@ void FakeEtcdClient::Watch(const string& rawkey, const WatchCallback& cb,
 void FakeEtcdClient::PurgeExpiredEntriesWithLock(
     const unique_lock<mutex>& lock) {
   CHECK(lock.owns_lock());
-  for (auto it = entries_.begin(); it != entries_.end();) {
-    if (it->second.expires_ < system_clock::now()) {
-      VLOG(1) << "Deleting expired entry " << it->first;
-      it->second.deleted_ = true;
-      NotifyForPath(lock, it->first);
-      it = entries_.erase(it);
-      ++stats_["expireCount"];
-    } else {
-      ++it;
-    }
+  const system_clock::time_point now(system_clock::now());
+  while (!expiries_.empty() && expiries_.begin()->first < now) {
+    const string key(expiries_.begin()->second);
+    expiries_.erase(expiries_.begin());
+    const map<string, Node>::iterator it(entries_.find(key));
+    CHECK(it != entries_.end());
+    VLOG(1) << "Deleting expired entry " << key;
+    it->second.deleted_ = true;
+    NotifyForPath(lock, key);
+    entries_.erase(it);
+    ++stats_["expireCount"];
   }
 }
 
@@ -177,6 +197,16 @@ void FakeEtcdClient::PurgeExpiredEntries() {
 }
 
 
+void FakeEtcdClient::SchedulePurge(const system_clock::time_point& expires) {
+  // The timers are not on the system clock, and may go off a little
+  // before it reaches |expires|, so the purge would find nothing expired.
+  const std::chrono::duration<double> delay(expires - system_clock::now() +
+                                            milliseconds(10));
+  base_->Delay(delay, parent_task_.task()->AddChild(
+                          bind(&FakeEtcdClient::PurgeExpiredEntries, this)));
+}
+
+
 void FakeEtcdClient::NotifyForPath(const unique_lock<mutex>& lock,
                                    const string& path) {
   CHECK(lock.owns_lock());
@@ -185,25 +215,59 @@ void FakeEtcdClient::NotifyForPath(const unique_lock<mutex>& lock,
   CHECK(node_it != entries_.end());
   const Node& node(node_it->second);
 
-  const multimap<string, tuple<bool, GetResponse*, Task*>>::iterator last(
-      waiting_gets_.upper_bound(path));
-  multimap<string, tuple<bool, GetResponse*, Task*>>::iterator it;
-  for (it = waiting_gets_.begin(); it != last;) {
-    if (WatchMatchesKey(it->first, node.key_, get<0>(it->second))) {
-      get<1>(it->second)->node = node;
-      get<2>(it->second)->Return();
-      it = waiting_gets_.erase(it);
-    } else {
-      ++it;
+  // Only the waits and watches on the path and its parents can match,
+  // so they are looked up rather than all checked.
+  const vector<string> keys(KeyAndParents(path));
+  for (const string& key : keys) {
+    const auto range(waiting_gets_.equal_range(key));
+    for (auto it = range.first; it != range.second;) {
+      // Waits on the parents only match if they are recursive.
+      if (key == path || get<0>(it->second)) {
+        get<1>(it->second)->node = node;
+        get<2>(it->second)->Return();
+        it = waiting_gets_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+
+  for (const string& key : keys) {
+    const auto it(watches_.find(key));
+    if (it == watches_.end()) {
+      continue;
+    }
+    for (const auto& cb_cookie : it->second) {
+      ScheduleWatchCallback(lock, cb_cookie.second,
+                            bind(cb_cookie.first, vector<Node>{node}));
     }
   }
+}
+
 
-  for (const auto& pair : watches_) {
-    if (path.find(pair.first) == 0) {
-      for (const auto& cb_cookie : pair.second) {
-        ScheduleWatchCallback(lock, cb_cookie.second,
-                              bind(cb_cookie.first, vector<Node>{node}));
+void FakeEtcdClient::AddChildren(const unique_lock<mutex>& lock,
+                                 const string& key, bool recursive,
+                                 Node* node) const {
+  CHECK(lock.owns_lock());
+  const string prefix(DescendantsPrefix(key));
+  const map<string, Node>::const_iterator end(
+      entries_.lower_bound(DescendantsEnd(key)));
+  for (auto it = entries_.lower_bound(prefix); it != end;) {
+    // The child this key is under, which might not exist if the key was
+    // set without creating its parents.
+    const string child(
+        it->first.substr(0, it->first.find_first_of('/', prefix.size())));
+    if (it->first == child) {
+      node->nodes_.emplace_back(it->second);
+      if (recursive && it->second.is_dir_) {
+        AddChildren(lock, child, recursive, &node->nodes_.back());
       }
+      // Its siblings which start with its key, if any, come next, and
+      // are before its descendants.
+      ++it;
+    } else {
+      // Skip over the descendants of the child.
+      it = entries_.lower_bound(DescendantsEnd(child));
     }
   }
 }
@@ -244,30 +308,8 @@ void FakeEtcdClient::Get(const Request& req, GetResponse* resp, Task* task) {
     return;
   }
   resp->node = it->second;
-  ++it;
-
-  vector<Node*> parent_nodes{&resp->node};
-  while (!parent_nodes.empty() && it != entries_.end()) {
-    const string key_prefix(parent_nodes.back()->key_ + "/");
-    if (it->first.compare(0, key_prefix.size(), key_prefix) > 0) {
-      parent_nodes.pop_back();
-      continue;
-    }
-
-    if (req.recursive) {
-      parent_nodes.back()->nodes_.emplace_back(it->second);
-
-      if (it->second.is_dir_) {
-        // The node we just added is now the current parent node.
-        parent_nodes.push_back(&parent_nodes.back()->nodes_.back());
-      }
-    } else {
-      if (it->first.find_first_of('/', key_prefix.size()) == string::npos) {
-        resp->node.nodes_.emplace_back(it->second);
-      }
-    }
-
-    ++it;
+  if (it->second.is_dir_) {
+    AddChildren(lock, key, req.recursive, &resp->node);
   }
   task->Return();
 }
@@ -342,6 +384,12 @@ void FakeEtcdClient::InternalPut(const string& rawkey, const string& value,
     node.created_index_ = entry->second.created_index_;
   }
 
+  if (entry != entries_.end() && entry->second.HasExpiry()) {
+    expiries_.erase(make_pair(entry->second.expires_, key));
+  }
+  if (node.HasExpiry()) {
+    expiries_.emplace(node.expires_, key);
+  }
   entries_[key] = node;
   resp->etcd_index = new_index;
   index_ = new_index;
@@ -349,9 +397,7 @@ void FakeEtcdClient::InternalPut(const string& rawkey, const string& value,
   NotifyForPath(lock, key);
   DumpEntries(lock);
   if (expires < system_clock::time_point::max()) {
-    const std::chrono::duration<double> delay(expires - system_clock::now());
-    base_->Delay(delay, parent_task_.task()->AddChild(
-                            bind(&FakeEtcdClient::PurgeExpiredEntries, this)));
+    SchedulePurge(expires);
   }
 }
 
@@ -382,6 +428,9 @@ void FakeEtcdClient::InternalDelete(const string& key,
                             to_string(entry->second.modified_index_)));
     return;
   }
+  if (entry->second.HasExpiry()) {
+    expiries_.erase(make_pair(entry->second.expires_, key));
+  }
   entry->second.modified_index_ = ++index_;
   entry->second.value_.clear();
   entry->second.deleted_ = true;
@@ -440,6 +489,45 @@ void FakeEtcdClient::UpdateWithTTL(const string& key, const string& value,
 }
 
 
+void FakeEtcdClient::RefreshTTL(const string& rawkey, const seconds& ttl,
+                                const int64_t previous_index, Response* resp,
+                                Task* task) {
+  task->CleanupWhenDone(bind(&FakeEtcdClient::UpdateOperationStats, this,
+                             "compareAndSwap", task));
+  const string key(NormalizeKey(rawkey));
+  VLOG(1) << "REFRESH " << key;
+
+  *resp = EtcdClient::Response();
+  unique_lock<mutex> lock(mutex_);
+  PurgeExpiredEntriesWithLock(lock);
+  const map<string, Node>::iterator entry(entries_.find(key));
+  if (entry == entries_.end()) {
+    task->Return(Status(util::error::FAILED_PRECONDITION,
+                        "node doesn't exist: " + key));
+    return;
+  }
+  if (previous_index != entry->second.modified_index_) {
+    task->Return(Status(util::error::FAILED_PRECONDITION,
+                        "incorrect index:  prevIndex=" +
+                            to_string(previous_index) +
+                            " but modified_index_=" +
+                            to_string(entry->second.modified_index_)));
+    return;
+  }
+
+  // Like a write, this moves the index on, but no watch hears of it.
+  if (entry->second.HasExpiry()) {
+    expiries_.erase(make_pair(entry->second.expires_, key));
+  }
+  entry->second.modified_index_ = ++index_;
+  entry->second.expires_ = system_clock::now() + ttl;
+  expiries_.emplace(entry->second.expires_, key);
+  resp->etcd_index = index_;
+  task->Return();
+  SchedulePurge(entry->second.expires_);
+}
+
+
 void FakeEtcdClient::ForceSet(const string& key, const string& value,
                               Response* resp, Task* task) {
   task->CleanupWhenDone(
@@ -481,24 +569,28 @@ void FakeEtcdClient::GetStoreStats(StatsResponse* resp, Task* task) {
 
 void FakeEtcdClient::CancelWatch(Task* task) {
   lock_guard<mutex> lock(mutex_);
-  bool found(false);
-  for (auto& pair : watches_) {
-    for (auto it(pair.second.begin()); it != pair.second.end();) {
-      if (it->second == task) {
-        CHECK(!found);
-        found = true;
-        VLOG(1) << "Removing watcher " << it->second << " on " << pair.first;
-        --stats_["watchers"];
-        // Outstanding notifications have a hold on this task, so they
-        // will all go through before the task actually completes. But
-        // we won't be sending new notifications.
-        task->Return(Status::CANCELLED);
-        it = pair.second.erase(it);
-      } else {
-        ++it;
-      }
+  const map<Task*, string>::iterator key(watch_keys_.find(task));
+  if (key == watch_keys_.end()) {
+    return;
+  }
+  const auto watches(watches_.find(key->second));
+  CHECK(watches != watches_.end());
+  for (auto it(watches->second.begin()); it != watches->second.end(); ++it) {
+    if (it->second == task) {
+      VLOG(1) << "Removing watcher " << it->second << " on " << key->second;
+      --stats_["watchers"];
+      // Outstanding notifications have a hold on this task, so they
+      // will all go through before the task actually completes. But
+      // we won't be sending new notifications.
+      task->Return(Status::CANCELLED);
+      watches->second.erase(it);
+      break;
     }
   }
+  if (watches->second.empty()) {
+    watches_.erase(watches);
+  }
+  watch_keys_.erase(key);
 }
 
 
@@ -4,8 +4,10 @@
 #include <deque>
 #include <map>
 #include <queue>
+#include <set>
 #include <string>
 #include <tuple>
+#include <utility>
 
 #include "util/etcd.h"
 #include "util/libevent_wrapper.h"
@@ -40,6 +42,10 @@ class FakeEtcdClient : public EtcdClient {
                      const int64_t previous_index, Response* resp,
                      util::Task* task) override;
 
+  void RefreshTTL(const std::string& key, const std::chrono::seconds& ttl,
+                  const int64_t previous_index, Response* resp,
+                  util::Task* task) override;
+
   void ForceSet(const std::string& key, const std::string& value,
                 Response* resp, util::Task* task) override;
 
@@ -65,10 +71,16 @@ class FakeEtcdClient : public EtcdClient {
 
   void PurgeExpiredEntriesWithLock(const std::unique_lock<std::mutex>& lock);
   void PurgeExpiredEntries();
+  // Runs PurgeExpiredEntries() once |expires| has passed.
+  void SchedulePurge(const std::chrono::system_clock::time_point& expires);
 
   void NotifyForPath(const std::unique_lock<std::mutex>& lock,
                      const std::string& path);
 
+  // Adds the children of |key| to |node|, and theirs if |recursive|.
+  void AddChildren(const std::unique_lock<std::mutex>& lock,
+                   const std::string& key, bool recursive, Node* node) const;
+
   void InternalPut(const std::string& rawkey, const std::string& value,
                    const std::chrono::system_clock::time_point& expires,
                    bool create, int64_t prev_index, Response* resp,
@@ -93,11 +105,20 @@ class FakeEtcdClient : public EtcdClient {
   util::SyncTask parent_task_;
   std::mutex mutex_;
   int64_t index_;
+  // The entries by key, so that the descendants of a key (from key + "/"
+  // to key + "0") are next to each other, and a directory is listed with
+  // a lookup per child rather than a walk of the whole store.
   std::map<std::string, Node> entries_;
+  // The keys of the entries with a TTL, by expiry time.
+  std::set<std::pair<std::chrono::system_clock::time_point, std::string>>
+      expiries_;
+  // The waits and watches by key, so that a change only looks up those on
+  // its key and its parents.
   std::multimap<std::string, std::tuple<bool, GetResponse*, util::Task*>>
       waiting_gets_;
   std::map<std::string, std::vector<std::pair<WatchCallback, util::Task*>>>
       watches_;
+  std::map<util::Task*, std::string> watch_keys_;
   std::deque<std::pair<util::Task*, std::function<void()>>> watches_callbacks_;
   std::map<std::string, int64_t> stats_;
 
@@ -131,6 +131,16 @@ class FakeEtcdTest : public ::testing::Test {
     return task.status();
   }
 
+  Status BlockingRefreshTTL(const string& key, const seconds& ttl,
+                            int64_t previous_index, int64_t* modified_index) {
+    SyncTask task(base_.get());
+    EtcdClient::Response resp;
+    client_->RefreshTTL(key, ttl, previous_index, &resp, task.task());
+    task.Wait();
+    *modified_index = resp.etcd_index;
+    return task.status();
+  }
+
   Status BlockingForceSet(const string& key, const string& value,
                           int64_t* modified_index) {
     SyncTask task(base_.get());
@@ -615,6 +625,40 @@ TEST_F(FakeEtcdTest, WatcherForCreate) {
 }
 
 
+TEST_F(FakeEtcdTest, WatcherIgnoresSiblingKeys) {
+  const string kDir(key_prefix_ + "/dir");
+  int64_t created_index;
+
+  StrictMock<MockFunction<void(const vector<EtcdClient::Node>&)>> watcher;
+  Notification initial;
+  EXPECT_CALL(watcher, Call(ElementsAre()))
+      .WillOnce(InvokeWithoutArgs(&initial, &Notification::Notify));
+
+  util::SyncTask watch_task(base_.get());
+  client_->Watch(
+      kDir, bind(&MockFunction<void(const vector<EtcdClient::Node>&)>::Call,
+                 &watcher, _1),
+      watch_task.task());
+  ASSERT_TRUE(initial.WaitForNotificationWithTimeout(seconds(1)));
+  Mock::VerifyAndClearExpectations(&watcher);
+
+  // Keys which only start with the same characters are not in it.
+  EXPECT_OK(BlockingCreate(kDir + "-1", kValue, &created_index));
+  EXPECT_OK(BlockingCreate(kDir + "x/1", kValue, &created_index));
+
+  Notification update;
+  EXPECT_CALL(watcher,
+              Call(ElementsAre(EtcdClientNodeIs(kDir + "/1", kValue, false))))
+      .WillOnce(InvokeWithoutArgs(&update, &Notification::Notify));
+  EXPECT_OK(BlockingCreate(kDir + "/1", kValue, &created_index));
+  EXPECT_TRUE(update.WaitForNotificationWithTimeout(seconds(1)));
+
+  watch_task.Cancel();
+  watch_task.Wait();
+  EXPECT_THAT(watch_task.status(), StatusIs(util::error::CANCELLED));
+}
+
+
 TEST_F(FakeEtcdTest, WatcherForDelete) {
   const string kDir(key_prefix_);
   const string kPath(kDir + "/subkey");
@@ -684,6 +728,57 @@ TEST_F(FakeEtcdTest, WatcherWithTTLExpires) {
 }
 
 
+TEST_F(FakeEtcdTest, RefreshTTLNotifiesNoWatch) {
+  const string kDir(key_prefix_);
+  const string kPath(kDir + "/subkey");
+  const seconds kTtl(2);
+  const seconds kRefreshedTtl(4);
+  int64_t created_index;
+  EXPECT_OK(BlockingCreateWithTTL(kPath, kValue, kTtl, &created_index));
+
+  StrictMock<MockFunction<void(const vector<EtcdClient::Node>&)>> watcher;
+  Notification initial;
+  EXPECT_CALL(watcher,
+              Call(ElementsAre(EtcdClientNodeIs(kPath, "value", false))))
+      .WillOnce(InvokeWithoutArgs(&initial, &Notification::Notify));
+
+  util::SyncTask watch_task(base_.get());
+  client_->Watch(
+      kDir, bind(&MockFunction<void(const vector<EtcdClient::Node>&)>::Call,
+                 &watcher, _1),
+      watch_task.task());
+
+  ASSERT_TRUE(initial.WaitForNotificationWithTimeout(seconds(1)));
+  Mock::VerifyAndClearExpectations(&watcher);
+
+  int64_t modified_index;
+  EXPECT_THAT(BlockingRefreshTTL(kPath, kRefreshedTtl, created_index + 1,
+                                 &modified_index),
+              StatusIs(util::error::FAILED_PRECONDITION));
+  EXPECT_OK(BlockingRefreshTTL(kPath, kRefreshedTtl, created_index,
+                               &modified_index));
+  EXPECT_LT(created_index, modified_index);
+
+  // Still there past its first TTL, as it was.
+  sleep_for(kTtl + seconds(1));
+  EtcdClient::Node node;
+  EXPECT_OK(BlockingGet(kPath, &node));
+  EXPECT_EQ(kValue, node.value_);
+  EXPECT_EQ(created_index, node.created_index_);
+  EXPECT_EQ(modified_index, node.modified_index_);
+
+  // The watch only hears of it expiring.
+  Notification expired;
+  EXPECT_CALL(watcher, Call(ElementsAre(EtcdClientNodeIs(kPath, _, true))))
+      .WillOnce(InvokeWithoutArgs(&expired, &Notification::Notify));
+  EXPECT_TRUE(expired.WaitForNotificationWithTimeout(kRefreshedTtl));
+
+  watch_task.Cancel();
+  watch_task.Wait();
+  EXPECT_THAT(watch_task.status(), StatusIs(util::error::CANCELLED));
+}
+
+
 TEST_F(FakeEtcdTest, PutUnderNonDir) {
   const string kPath1(key_prefix_);
   const string kPath2(kPath1 + "/subkey");
@@ -755,6 +850,38 @@ TEST_F(FakeEtcdTest, GetDirRecursive) {
 }
 
 
+TEST_F(FakeEtcdTest, GetDirIgnoresSiblingKeys) {
+  const string kDir(key_prefix_ + "/dir");
+  const string kPath1(kDir + "/sub/key");
+  const string kPath2(kDir + "/sub-key");
+
+  int64_t created_index;
+  EXPECT_OK(BlockingCreate(kPath1, kValue, &created_index));
+  EXPECT_OK(BlockingCreate(kPath2, kValue, &created_index));
+  EXPECT_OK(BlockingCreate(kDir + "-x/key", kValue, &created_index));
+
+  SyncTask task(base_.get());
+  EtcdClient::Request req(kDir + "/sub");
+  req.recursive = true;
+  EtcdClient::GetResponse resp;
+  client_->Get(req, &resp, task.task());
+  task.Wait();
+  EXPECT_OK(task);
+  ASSERT_EQ(static_cast<size_t>(1), resp.node.nodes_.size());
+  EXPECT_EQ(kPath1, resp.node.nodes_[0].key_);
+
+  SyncTask dir_task(base_.get());
+  EtcdClient::GetResponse dir_resp;
+  client_->Get(EtcdClient::Request(kDir), &dir_resp, dir_task.task());
+  dir_task.Wait();
+  EXPECT_OK(dir_task);
+  ASSERT_EQ(static_cast<size_t>(2), dir_resp.node.nodes_.size());
+  EXPECT_EQ(kDir + "/sub", dir_resp.node.nodes_[0].key_);
+  EXPECT_TRUE(dir_resp.node.nodes_[0].nodes_.empty());
+  EXPECT_EQ(kPath2, dir_resp.node.nodes_[1].key_);
+}
+
+
 // This test is not expected to pass with the real etcd, it tests an
 // aspect specific to the fake implementation.
 TEST_F(FakeEtcdTest, GetWaitOldIndex) {
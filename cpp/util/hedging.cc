@@ -0,0 +1,73 @@
+#include "util/hedging.h"
+
+#include <glog/logging.h>
+#include <algorithm>
+#include <cmath>
+
+using std::chrono::duration;
+using std::min;
+using std::vector;
+
+namespace cert_trans {
+
+
+LatencyWindow::LatencyWindow(size_t size) : size_(size), next_(0) {
+  CHECK_GT(size_, 0U);
+}
+
+
+void LatencyWindow::Add(const duration<double>& latency) {
+  if (samples_.size() < size_) {
+    samples_.push_back(latency.count());
+    return;
+  }
+  samples_[next_] = latency.count();
+  next_ = (next_ + 1) % size_;
+}
+
+
+bool LatencyWindow::Quantile(double quantile, size_t min_samples,
+                             duration<double>* latency) const {
+  CHECK_GE(quantile, 0);
+  CHECK_LE(quantile, 1);
+  if (samples_.empty() || samples_.size() < min_samples) {
+    return false;
+  }
+
+  vector<double> sorted(samples_);
+  // The smallest latency which at least |quantile| of them are under.
+  size_t rank(0);
+  if (quantile > 0) {
+    rank = min(sorted.size() - 1,
+               static_cast<size_t>(std::ceil(quantile * sorted.size())) - 1);
+  }
+  std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+  *CHECK_NOTNULL(latency) = duration<double>(sorted[rank]);
+  return true;
+}
+
+
+HedgeBudget::HedgeBudget(double fraction, double burst)
+    : fraction_(fraction), burst_(burst), available_(0) {
+  CHECK_GE(burst_, 1);
+}
+
+
+void HedgeBudget::AddRequest() {
+  if (fraction_ > 0) {
+    available_ = min(burst_, available_ + fraction_);
+  }
+}
+
+
+bool HedgeBudget::TryHedge() {
+  // Allowing for the rounding errors of adding up the fractions.
+  if (available_ < 1 - 1e-9) {
+    return false;
+  }
+  available_ -= 1;
+  return true;
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,63 @@
+#ifndef CERT_TRANS_UTIL_HEDGING_H_
+#define CERT_TRANS_UTIL_HEDGING_H_
+
+#include <stddef.h>
+#include <chrono>
+#include <vector>
+
+namespace cert_trans {
+
+
+// The latencies of the latest requests to a backend, from which to tell
+// how long a request to it can take before it is unusually slow, and is
+// worth hedging, that is, sending again to another backend.
+//
+// This class is not thread-safe.
+class LatencyWindow {
+ public:
+  // Keeps the latest |size| latencies.
+  explicit LatencyWindow(size_t size);
+
+  void Add(const std::chrono::duration<double>& latency);
+
+  // Sets |*latency| to the |quantile| (e.g. 0.95) of the latencies kept,
+  // and returns true, unless there are fewer than |min_samples| of them.
+  bool Quantile(double quantile, size_t min_samples,
+                std::chrono::duration<double>* latency) const;
+
+ private:
+  size_t size_;
+  std::vector<double> samples_;
+  // Where the next latency goes, once |samples_| holds |size_| of them.
+  size_t next_;
+};
+
+
+// Bounds the share of the requests which are hedged, so that a slow
+// backend does not have every request sent twice, and slow down the
+// other backends in turn.
+//
+// This class is not thread-safe.
+class HedgeBudget {
+ public:
+  // Allows hedging up to |fraction| of the requests, at most |burst| in
+  // a row. No request is hedged if |fraction| is not positive.
+  HedgeBudget(double fraction, double burst);
+
+  // Counts a request which could be hedged.
+  void AddRequest();
+
+  // Returns whether the budget allows for another hedge, in which case
+  // it is counted against it.
+  bool TryHedge();
+
+ private:
+  const double fraction_;
+  const double burst_;
+  double available_;
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_HEDGING_H_
@@ -0,0 +1,88 @@
+#include "util/hedging.h"
+
+#include <gtest/gtest.h>
+#include <chrono>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::chrono::duration;
+
+
+TEST(LatencyWindowTest, Quantile) {
+  LatencyWindow window(100);
+  duration<double> latency;
+  EXPECT_FALSE(window.Quantile(0.95, 1, &latency));
+
+  for (int i = 1; i <= 100; ++i) {
+    window.Add(duration<double>(i));
+  }
+  EXPECT_FALSE(window.Quantile(0.95, 101, &latency));
+  ASSERT_TRUE(window.Quantile(0.95, 100, &latency));
+  EXPECT_EQ(95, latency.count());
+  ASSERT_TRUE(window.Quantile(0.5, 100, &latency));
+  EXPECT_EQ(50, latency.count());
+  ASSERT_TRUE(window.Quantile(1, 100, &latency));
+  EXPECT_EQ(100, latency.count());
+  ASSERT_TRUE(window.Quantile(0, 100, &latency));
+  EXPECT_EQ(1, latency.count());
+}
+
+
+TEST(LatencyWindowTest, KeepsLatest) {
+  LatencyWindow window(10);
+  for (int i = 0; i < 10; ++i) {
+    window.Add(duration<double>(1000));
+  }
+  for (int i = 0; i < 10; ++i) {
+    window.Add(duration<double>(1));
+  }
+  duration<double> latency;
+  ASSERT_TRUE(window.Quantile(1, 10, &latency));
+  EXPECT_EQ(1, latency.count());
+}
+
+
+TEST(HedgeBudgetTest, AllowsFraction) {
+  HedgeBudget budget(0.1, 2);
+  EXPECT_FALSE(budget.TryHedge());
+
+  // One hedge every ten requests.
+  int hedges(0);
+  for (int i = 0; i < 100; ++i) {
+    budget.AddRequest();
+    if (budget.TryHedge()) {
+      ++hedges;
+    }
+  }
+  EXPECT_EQ(10, hedges);
+
+  // No more than the burst at once, however many requests went by.
+  for (int i = 0; i < 100; ++i) {
+    budget.AddRequest();
+  }
+  EXPECT_TRUE(budget.TryHedge());
+  EXPECT_TRUE(budget.TryHedge());
+  EXPECT_FALSE(budget.TryHedge());
+}
+
+
+TEST(HedgeBudgetTest, Disabled) {
+  HedgeBudget budget(0, 1);
+  for (int i = 0; i < 100; ++i) {
+    budget.AddRequest();
+  }
+  EXPECT_FALSE(budget.TryHedge());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,426 @@
+#include "util/json_reader.h"
+
+#include <glog/logging.h>
+#include <string.h>
+
+#include "util/base64.h"
+
+using std::string;
+
+namespace cert_trans {
+namespace {
+
+
+// Values nested deeper than this are not skipped, so that hostile input
+// cannot overflow the stack.
+const int kMaxSkipDepth = 64;
+
+
+// Decodes the padded base64 of |size| characters at |in| into |out|.
+bool DecodeBase64(const char* in, size_t size, string* out) {
+  out->resize(util::Base64DecodedMaxSize(size));
+  size_t decoded(0);
+  const bool ret(util::Base64Decode(in, size, &(*out)[0], &decoded));
+  out->resize(decoded);
+  return ret;
+}
+
+
+int HexValue(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+
+void AppendUtf8(uint32_t code_point, string* out) {
+  if (code_point < 0x80) {
+    out->push_back(static_cast<char>(code_point));
+  } else if (code_point < 0x800) {
+    out->push_back(static_cast<char>(0xc0 | (code_point >> 6)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+  } else if (code_point < 0x10000) {
+    out->push_back(static_cast<char>(0xe0 | (code_point >> 12)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+  } else {
+    out->push_back(static_cast<char>(0xf0 | (code_point >> 18)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3f)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3f)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3f)));
+  }
+}
+
+
+}  // namespace
+
+
+JsonReader::JsonReader(const char* data, size_t size)
+    : data_(data), size_(size), pos_(0), ok_(true), first_(false) {
+  CHECK(data || size == 0);
+}
+
+
+JsonReader::Type JsonReader::Peek() {
+  SkipWhitespace();
+  if (!ok_ || pos_ >= size_) {
+    return INVALID;
+  }
+  switch (data_[pos_]) {
+    case '{':
+      return OBJECT;
+    case '[':
+      return ARRAY;
+    case '"':
+      return STRING;
+    case 't':
+    case 'f':
+      return BOOLEAN;
+    case 'n':
+      return NULL_VALUE;
+    case '-':
+      return NUMBER;
+    default:
+      return data_[pos_] >= '0' && data_[pos_] <= '9' ? NUMBER : INVALID;
+  }
+}
+
+
+bool JsonReader::StartObject() {
+  SkipWhitespace();
+  first_ = true;
+  return Consume('{');
+}
+
+
+bool JsonReader::StartArray() {
+  SkipWhitespace();
+  first_ = true;
+  return Consume('[');
+}
+
+
+bool JsonReader::NextMember(string* name) {
+  if (!Next('}')) {
+    return false;
+  }
+  SkipWhitespace();
+  size_t end;
+  bool escaped;
+  if (!ScanString(&end, &escaped) || !Unescape(end, name)) {
+    return false;
+  }
+  SkipWhitespace();
+  return Consume(':');
+}
+
+
+bool JsonReader::NextElement() {
+  return Next(']');
+}
+
+
+bool JsonReader::ReadString(string* value) {
+  SkipWhitespace();
+  size_t end;
+  bool escaped;
+  return ScanString(&end, &escaped) && Unescape(end, value);
+}
+
+
+bool JsonReader::ReadInt(int64_t* value) {
+  SkipWhitespace();
+  const bool negative(pos_ < size_ && data_[pos_] == '-');
+  size_t i(pos_ + (negative ? 1 : 0));
+  if (i >= size_ || data_[i] < '0' || data_[i] > '9') {
+    return Fail();
+  }
+  // Accumulated negatively, so that the most negative value fits.
+  int64_t n(0);
+  for (; i < size_ && data_[i] >= '0' && data_[i] <= '9'; ++i) {
+    const int digit(data_[i] - '0');
+    if (n < (INT64_MIN + digit) / 10) {
+      return Fail();
+    }
+    n = n * 10 - digit;
+  }
+  if (i < size_ && (data_[i] == '.' || data_[i] == 'e' || data_[i] == 'E')) {
+    return Fail();
+  }
+  if (!negative) {
+    if (n == INT64_MIN) {
+      return Fail();
+    }
+    n = -n;
+  }
+  pos_ = i;
+  *value = n;
+  return true;
+}
+
+
+bool JsonReader::ReadBoolean(bool* value) {
+  const Type type(Peek());
+  if (type != BOOLEAN) {
+    return Fail();
+  }
+  *value = data_[pos_] == 't';
+  return SkipLiteral(*value ? "true" : "false");
+}
+
+
+bool JsonReader::ReadBase64(string* value) {
+  SkipWhitespace();
+  size_t end;
+  bool escaped;
+  if (!ScanString(&end, &escaped)) {
+    return false;
+  }
+  bool decoded;
+  if (!escaped) {
+    // The usual case, decoded straight from the text.
+    decoded = DecodeBase64(data_ + pos_ + 1, end - pos_ - 1, value);
+    pos_ = end + 1;
+  } else {
+    // Some encoders escape the slashes.
+    string unescaped;
+    if (!Unescape(end, &unescaped)) {
+      return false;
+    }
+    decoded = DecodeBase64(unescaped.data(), unescaped.size(), value);
+  }
+  if (!decoded) {
+    value->clear();
+  }
+  return decoded;
+}
+
+
+bool JsonReader::Skip() {
+  return SkipValue(0);
+}
+
+
+bool JsonReader::Fail() {
+  ok_ = false;
+  return false;
+}
+
+
+void JsonReader::SkipWhitespace() {
+  while (pos_ < size_ && (data_[pos_] == ' ' || data_[pos_] == '\n' ||
+                          data_[pos_] == '\r' || data_[pos_] == '\t')) {
+    ++pos_;
+  }
+}
+
+
+bool JsonReader::Consume(char c) {
+  if (!ok_ || pos_ >= size_ || data_[pos_] != c) {
+    return Fail();
+  }
+  ++pos_;
+  return true;
+}
+
+
+bool JsonReader::ScanString(size_t* end, bool* escaped) {
+  if (!ok_ || pos_ >= size_ || data_[pos_] != '"') {
+    return Fail();
+  }
+  *escaped = false;
+  for (size_t i = pos_ + 1; i < size_; ++i) {
+    const char c(data_[i]);
+    if (c == '"') {
+      *end = i;
+      return true;
+    }
+    if (c == '\\') {
+      *escaped = true;
+      ++i;
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      return Fail();
+    }
+  }
+  return Fail();
+}
+
+
+bool JsonReader::Unescape(size_t end, string* value) {
+  value->clear();
+  size_t i(pos_ + 1);
+  while (i < end) {
+    // Copies runs of characters that are not escaped at once.
+    const char* const backslash(static_cast<const char*>(
+        memchr(data_ + i, '\\', end - i)));
+    const size_t run_end(backslash ? backslash - data_ : end);
+    value->append(data_ + i, run_end - i);
+    i = run_end;
+    if (i >= end) {
+      break;
+    }
+
+    // ScanString() made sure that there is a character after it.
+    const char c(data_[++i]);
+    ++i;
+    switch (c) {
+      case '"':
+      case '\\':
+      case '/':
+        value->push_back(c);
+        break;
+      case 'b':
+        value->push_back('\b');
+        break;
+      case 'f':
+        value->push_back('\f');
+        break;
+      case 'n':
+        value->push_back('\n');
+        break;
+      case 'r':
+        value->push_back('\r');
+        break;
+      case 't':
+        value->push_back('\t');
+        break;
+      case 'u': {
+        uint32_t code_point(0);
+        for (int pair = 0; pair < 2; ++pair) {
+          if (end - i < 4) {
+            return Fail();
+          }
+          uint32_t unit(0);
+          for (int j = 0; j < 4; ++j) {
+            const int digit(HexValue(data_[i++]));
+            if (digit < 0) {
+              return Fail();
+            }
+            unit = unit << 4 | digit;
+          }
+          if (pair == 1) {
+            // The low half of a surrogate pair.
+            if (unit < 0xdc00 || unit > 0xdfff) {
+              return Fail();
+            }
+            code_point = 0x10000 + ((code_point - 0xd800) << 10) +
+                         (unit - 0xdc00);
+            break;
+          }
+          code_point = unit;
+          if (unit < 0xd800 || unit > 0xdbff) {
+            break;
+          }
+          if (end - i < 2 || data_[i] != '\\' || data_[i + 1] != 'u') {
+            return Fail();
+          }
+          i += 2;
+        }
+        AppendUtf8(code_point, value);
+        break;
+      }
+      default:
+        return Fail();
+    }
+  }
+  pos_ = end + 1;
+  return true;
+}
+
+
+bool JsonReader::SkipValue(int depth) {
+  if (depth > kMaxSkipDepth) {
+    return Fail();
+  }
+  switch (Peek()) {
+    case OBJECT: {
+      string name;
+      StartObject();
+      while (NextMember(&name)) {
+        if (!SkipValue(depth + 1)) {
+          return false;
+        }
+      }
+      return ok_;
+    }
+    case ARRAY:
+      StartArray();
+      while (NextElement()) {
+        if (!SkipValue(depth + 1)) {
+          return false;
+        }
+      }
+      return ok_;
+    case STRING: {
+      size_t end;
+      bool escaped;
+      if (!ScanString(&end, &escaped)) {
+        return false;
+      }
+      if (escaped) {
+        // Only to check the escapes.
+        string value;
+        return Unescape(end, &value);
+      }
+      pos_ = end + 1;
+      return true;
+    }
+    case NUMBER:
+      return SkipNumber();
+    case BOOLEAN:
+      return SkipLiteral(data_[pos_] == 't' ? "true" : "false");
+    case NULL_VALUE:
+      return SkipLiteral("null");
+    case INVALID:
+      return Fail();
+  }
+  return Fail();
+}
+
+
+bool JsonReader::SkipNumber() {
+  const size_t start(pos_);
+  while (pos_ < size_ && strchr("+-.0123456789eE", data_[pos_]) &&
+         data_[pos_] != '\0') {
+    ++pos_;
+  }
+  return pos_ > start || Fail();
+}
+
+
+bool JsonReader::SkipLiteral(const char* literal) {
+  const size_t len(strlen(literal));
+  if (size_ - pos_ < len || memcmp(data_ + pos_, literal, len) != 0) {
+    return Fail();
+  }
+  pos_ += len;
+  return true;
+}
+
+
+bool JsonReader::Next(char close) {
+  SkipWhitespace();
+  if (!ok_ || pos_ >= size_) {
+    return Fail();
+  }
+  const bool first(first_);
+  first_ = false;
+  if (data_[pos_] == close) {
+    ++pos_;
+    return false;
+  }
+  if (first) {
+    return true;
+  }
+  return Consume(',');
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,115 @@
+#ifndef CERT_TRANS_UTIL_JSON_READER_H_
+#define CERT_TRANS_UTIL_JSON_READER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// Reads JSON text in place, one value at a time as the caller asks for
+// them, rather than parsing all of it into a tree of objects first like
+// JsonObject does. Base64 strings are decoded straight into the
+// caller's strings, which can be reused so that reading many values
+// allocates nothing once they are large enough.
+//
+//   JsonReader json(body);
+//   string name;
+//   if (!json.StartObject()) ...
+//   while (json.NextMember(&name)) {
+//     if (name == "chain" && json.StartArray()) {
+//       while (json.NextElement()) {
+//         json.ReadBase64(&der);
+//         ...
+//       }
+//     } else {
+//       json.Skip();
+//     }
+//   }
+//   if (!json.ok()) ...
+//
+// Once the text turns out not to be valid JSON, or not what the caller
+// asked for, every method returns false and ok() does too. The text
+// must outlive the reader.
+class JsonReader {
+ public:
+  enum Type {
+    OBJECT,
+    ARRAY,
+    STRING,
+    NUMBER,
+    BOOLEAN,
+    NULL_VALUE,
+    INVALID,
+  };
+
+  JsonReader(const char* data, size_t size);
+  explicit JsonReader(const std::string& data)
+      : JsonReader(data.data(), data.size()) {
+  }
+  // The text would not outlive the reader.
+  explicit JsonReader(std::string&& data) = delete;
+
+  bool ok() const {
+    return ok_;
+  }
+
+  // The type of the next value, which is INVALID at the end of the text
+  // or if it is not valid JSON, without consuming it.
+  Type Peek();
+
+  // Start reading the next value, which must be an object or an array.
+  bool StartObject();
+  bool StartArray();
+
+  // Moves on to the next member of the object being read, setting
+  // |name| to its name, and returns true, after which its value must be
+  // read or skipped. Returns false at the end of the object (which is
+  // then done with) or on error.
+  bool NextMember(std::string* name);
+  // Like NextMember(), for the elements of the array being read.
+  bool NextElement();
+
+  bool ReadString(std::string* value);
+  bool ReadInt(int64_t* value);
+  bool ReadBoolean(bool* value);
+  // Reads a string of base64, decoded into |value|. Unlike the others,
+  // this only fails the reader if the next value is not a string: if it
+  // is not valid base64, it is consumed, |value| is cleared, and this
+  // returns false but ok() stays true.
+  bool ReadBase64(std::string* value);
+  // Consumes the next value, whatever it is.
+  bool Skip();
+
+ private:
+  bool Fail();
+  void SkipWhitespace();
+  bool Consume(char c);
+  // Finds the end of the string starting at |pos_|, and whether it has
+  // any escapes, without consuming it.
+  bool ScanString(size_t* end, bool* escaped);
+  bool Unescape(size_t end, std::string* value);
+  bool SkipValue(int depth);
+  bool SkipNumber();
+  bool SkipLiteral(const char* literal);
+  // Whether the value just started or read is followed by another in
+  // the current container, consuming the comma, where |close| closes it.
+  bool Next(char close);
+
+  const char* const data_;
+  const size_t size_;
+  size_t pos_;
+  bool ok_;
+  // Whether the next member or element is the first of its container.
+  bool first_;
+
+  DISALLOW_COPY_AND_ASSIGN(JsonReader);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_JSON_READER_H_
@@ -0,0 +1,209 @@
+#include "util/json_reader.h"
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "util/json_writer.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::vector;
+
+
+TEST(JsonReaderTest, Object) {
+  const string text(
+      " { \"tree_size\" : 42, \"hash\":\"YWJj\", \"ok\":true,"
+      " \"ignored\": [1, -2.5e3, {\"a\": null}, \"x\"], \"n\": -7 } ");
+  JsonReader json(text);
+  string name;
+  int64_t tree_size(0);
+  string hash;
+  bool ok(false);
+  int64_t n(0);
+  ASSERT_TRUE(json.StartObject());
+  vector<string> names;
+  while (json.NextMember(&name)) {
+    names.push_back(name);
+    if (name == "tree_size") {
+      EXPECT_TRUE(json.ReadInt(&tree_size));
+    } else if (name == "hash") {
+      EXPECT_TRUE(json.ReadBase64(&hash));
+    } else if (name == "ok") {
+      EXPECT_TRUE(json.ReadBoolean(&ok));
+    } else if (name == "n") {
+      EXPECT_TRUE(json.ReadInt(&n));
+    } else {
+      EXPECT_EQ(JsonReader::ARRAY, json.Peek());
+      EXPECT_TRUE(json.Skip());
+    }
+  }
+  EXPECT_TRUE(json.ok());
+  EXPECT_EQ(
+      (vector<string>{"tree_size", "hash", "ok", "ignored", "n"}), names);
+  EXPECT_EQ(42, tree_size);
+  EXPECT_EQ("abc", hash);
+  EXPECT_TRUE(ok);
+  EXPECT_EQ(-7, n);
+}
+
+
+TEST(JsonReaderTest, EmptyContainers) {
+  const string text("[[], {}, []]");
+  JsonReader json(text);
+  string name;
+  ASSERT_TRUE(json.StartArray());
+  int count(0);
+  while (json.NextElement()) {
+    if (json.Peek() == JsonReader::OBJECT) {
+      ASSERT_TRUE(json.StartObject());
+      EXPECT_FALSE(json.NextMember(&name));
+    } else {
+      ASSERT_TRUE(json.StartArray());
+      EXPECT_FALSE(json.NextElement());
+    }
+    ++count;
+  }
+  EXPECT_TRUE(json.ok());
+  EXPECT_EQ(3, count);
+}
+
+
+TEST(JsonReaderTest, Escapes) {
+  const string text(
+      "[\"a\\\"b\\\\c\\/d\\n\\t\\u0041\\u00e9\\u20ac\\ud83d\\ude00\"]");
+  JsonReader json(text);
+  string value;
+  ASSERT_TRUE(json.StartArray());
+  ASSERT_TRUE(json.NextElement());
+  ASSERT_TRUE(json.ReadString(&value));
+  EXPECT_FALSE(json.NextElement());
+  EXPECT_TRUE(json.ok());
+  EXPECT_EQ("a\"b\\c/d\n\tA\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80", value);
+}
+
+
+TEST(JsonReaderTest, Base64MatchesFromBase64) {
+  string data;
+  string decoded;
+  for (int i = 0; i < 200; ++i) {
+    const string encoded(util::ToBase64(data));
+    const string text("\"" + encoded + "\"");
+    JsonReader json(text);
+    ASSERT_TRUE(json.ReadBase64(&decoded)) << encoded;
+    EXPECT_EQ(data, decoded);
+    data.push_back(static_cast<char>(i * 37));
+  }
+}
+
+
+TEST(JsonReaderTest, Base64WithEscapedSlashes) {
+  // As json-c writes them.
+  const string text("\"\\/\\/8=\"");
+  JsonReader json(text);
+  string decoded;
+  ASSERT_TRUE(json.ReadBase64(&decoded));
+  EXPECT_EQ(string("\xff\xff", 2), decoded);
+}
+
+
+TEST(JsonReaderTest, InvalidBase64) {
+  const string text("[\"YWJ\", \"Y!Jj\", \"YWJj\"]");
+  JsonReader json(text);
+  string decoded("x");
+  ASSERT_TRUE(json.StartArray());
+  ASSERT_TRUE(json.NextElement());
+  EXPECT_FALSE(json.ReadBase64(&decoded));
+  EXPECT_TRUE(decoded.empty());
+  EXPECT_TRUE(json.ok());
+  ASSERT_TRUE(json.NextElement());
+  EXPECT_FALSE(json.ReadBase64(&decoded));
+  ASSERT_TRUE(json.NextElement());
+  EXPECT_TRUE(json.ReadBase64(&decoded));
+  EXPECT_EQ("abc", decoded);
+  EXPECT_FALSE(json.NextElement());
+  EXPECT_TRUE(json.ok());
+}
+
+
+bool ReadInt(const string& text, int64_t* value) {
+  JsonReader json(text);
+  return json.ReadInt(value);
+}
+
+
+TEST(JsonReaderTest, Ints) {
+  int64_t value;
+  EXPECT_TRUE(ReadInt("9223372036854775807", &value));
+  EXPECT_EQ(INT64_MAX, value);
+  EXPECT_TRUE(ReadInt("-9223372036854775808", &value));
+  EXPECT_EQ(INT64_MIN, value);
+  EXPECT_FALSE(ReadInt("9223372036854775808", &value));
+  EXPECT_FALSE(ReadInt("1.5", &value));
+  EXPECT_FALSE(ReadInt("-", &value));
+  EXPECT_FALSE(ReadInt("\"1\"", &value));
+}
+
+
+TEST(JsonReaderTest, Errors) {
+  for (const char* text :
+       {"", "[", "[1,]", "[1 2]", "{\"a\" 1}", "{\"a\":1,}", "{1:2}",
+        "\"unterminated", "\"\\x\"", "\"\\u12\"", "\"\\ud83d\"", "[tru]",
+        "{\"a\":[\"b\"}"}) {
+    const string str(text);
+    JsonReader json(str);
+    // Skipping reads everything there is.
+    EXPECT_FALSE(json.Skip()) << text;
+    EXPECT_FALSE(json.ok()) << text;
+    EXPECT_FALSE(json.StartArray()) << text;
+  }
+}
+
+
+TEST(JsonReaderTest, DeepNesting) {
+  const string text(10000, '[');
+  JsonReader json(text);
+  EXPECT_FALSE(json.Skip());
+  EXPECT_FALSE(json.ok());
+}
+
+
+TEST(JsonReaderTest, ReadsWhatJsonWriterWrites) {
+  string text;
+  JsonWriter writer(&text);
+  writer.StartObject();
+  writer.Add("name", "a \"quoted\"\n\x01 name");
+  writer.AddBase64("data", string(1000, '\xab'));
+  writer.EndObject();
+
+  JsonReader json(text);
+  string name;
+  string value;
+  string data;
+  ASSERT_TRUE(json.StartObject());
+  ASSERT_TRUE(json.NextMember(&name));
+  EXPECT_EQ("name", name);
+  ASSERT_TRUE(json.ReadString(&value));
+  EXPECT_EQ("a \"quoted\"\n\x01 name", value);
+  ASSERT_TRUE(json.NextMember(&name));
+  EXPECT_EQ("data", name);
+  ASSERT_TRUE(json.ReadBase64(&data));
+  EXPECT_EQ(string(1000, '\xab'), data);
+  EXPECT_FALSE(json.NextMember(&name));
+  EXPECT_TRUE(json.ok());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -190,6 +190,10 @@ class JsonArray : public JsonObject {
       : JsonObject(from, field, json_type_array) {
   }
 
+  JsonArray(const JsonArray& from, int offset)
+      : JsonObject(from, offset, json_type_array) {
+  }
+
   JsonArray() : JsonObject(json_object_new_array()) {
   }
 
@@ -0,0 +1,194 @@
+#include "util/json_writer.h"
+
+#include <event2/buffer.h>
+#include <glog/logging.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+#include "util/base64.h"
+
+using std::string;
+
+namespace cert_trans {
+namespace {
+
+
+const char kHexChars[] = "0123456789abcdef";
+
+// Input bytes encoded at a time, into kBase64Chunk * 4 / 3 characters.
+const size_t kBase64Chunk = 3 * 256;
+
+
+}  // namespace
+
+
+JsonWriter::JsonWriter(evbuffer* out)
+    : buffer_(CHECK_NOTNULL(out)),
+      string_(nullptr),
+      depth_(0),
+      after_key_(false) {
+}
+
+
+JsonWriter::JsonWriter(string* out)
+    : buffer_(nullptr),
+      string_(CHECK_NOTNULL(out)),
+      depth_(0),
+      after_key_(false) {
+}
+
+
+void JsonWriter::StartObject() {
+  StartContainer('{');
+}
+
+
+void JsonWriter::EndObject() {
+  EndContainer('}');
+}
+
+
+void JsonWriter::StartArray() {
+  StartContainer('[');
+}
+
+
+void JsonWriter::EndArray() {
+  EndContainer(']');
+}
+
+
+void JsonWriter::Key(const char* name) {
+  CHECK(!after_key_) << "missing the value of a key";
+  StartValue();
+  Append("\"", 1);
+  AppendEscaped(name, strlen(name));
+  Append("\":", 2);
+  after_key_ = true;
+}
+
+
+void JsonWriter::String(const string& value) {
+  StartValue();
+  Append("\"", 1);
+  AppendEscaped(value.data(), value.size());
+  Append("\"", 1);
+}
+
+
+void JsonWriter::Int(int64_t value) {
+  StartValue();
+  char buf[24];
+  const int len(
+      snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(value)));
+  Append(buf, len);
+}
+
+
+void JsonWriter::Boolean(bool value) {
+  StartValue();
+  if (value) {
+    Append("true", 4);
+  } else {
+    Append("false", 5);
+  }
+}
+
+
+void JsonWriter::Base64(const string& data) {
+  StartValue();
+  Append("\"", 1);
+  char out[kBase64Chunk / 3 * 4];
+  for (size_t start = 0; start < data.size(); start += kBase64Chunk) {
+    // Only the last chunk can have a partial group, to be padded.
+    const size_t size(std::min(data.size() - start, kBase64Chunk));
+    Append(out, util::Base64Encode(data.data() + start, size, out));
+  }
+  Append("\"", 1);
+}
+
+
+void JsonWriter::Raw(const char* json, size_t size) {
+  StartValue();
+  Append(json, size);
+}
+
+
+void JsonWriter::StartValue() {
+  if (after_key_) {
+    after_key_ = false;
+    return;
+  }
+  if (depth_ > 0) {
+    if (has_value_[depth_ - 1]) {
+      Append(",", 1);
+    }
+    has_value_[depth_ - 1] = true;
+  }
+}
+
+
+void JsonWriter::StartContainer(char c) {
+  CHECK_LT(depth_, kMaxDepth);
+  StartValue();
+  Append(&c, 1);
+  has_value_[depth_++] = false;
+}
+
+
+void JsonWriter::EndContainer(char c) {
+  CHECK_GT(depth_, 0);
+  CHECK(!after_key_) << "missing the value of a key";
+  --depth_;
+  Append(&c, 1);
+}
+
+
+void JsonWriter::Append(const char* data, size_t size) {
+  if (string_) {
+    string_->append(data, size);
+  } else {
+    CHECK_EQ(evbuffer_add(buffer_, data, size), 0);
+  }
+}
+
+
+void JsonWriter::AppendEscaped(const char* str, size_t size) {
+  // Appends runs of characters that need no escaping at once.
+  size_t run(0);
+  for (size_t i = 0; i < size; ++i) {
+    const unsigned char c(str[i]);
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    Append(str + run, i - run);
+    run = i + 1;
+    switch (c) {
+      case '"':
+        Append("\\\"", 2);
+        break;
+      case '\\':
+        Append("\\\\", 2);
+        break;
+      case '\n':
+        Append("\\n", 2);
+        break;
+      case '\r':
+        Append("\\r", 2);
+        break;
+      case '\t':
+        Append("\\t", 2);
+        break;
+      default: {
+        const char escaped[] = {'\\', 'u', '0', '0', kHexChars[c >> 4],
+                                kHexChars[c & 0xf]};
+        Append(escaped, sizeof(escaped));
+      }
+    }
+  }
+  Append(str + run, size - run);
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,98 @@
+#ifndef CERT_TRANS_UTIL_JSON_WRITER_H_
+#define CERT_TRANS_UTIL_JSON_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <bitset>
+#include <string>
+
+#include "base/macros.h"
+
+struct evbuffer;
+
+namespace cert_trans {
+
+
+// Writes JSON text as it goes, straight to the end of an evbuffer or a
+// string, without building a tree of objects first like JsonObject does.
+// Strings are escaped, and binary data base64-encoded, as they are
+// appended, so that nothing is allocated besides the output itself.
+//
+//   JsonWriter json(buffer);
+//   json.StartObject();
+//   json.Add("leaf_index", index);
+//   json.Key("audit_path");
+//   json.StartArray();
+//   for (const string& node : path) {
+//     json.Base64(node);
+//   }
+//   json.EndArray();
+//   json.EndObject();
+//
+// Values inside an object must each be preceded by their Key(), and
+// containers can be nested up to kMaxDepth deep. The text is compact,
+// without any whitespace.
+class JsonWriter {
+ public:
+  static const int kMaxDepth = 64;
+
+  explicit JsonWriter(evbuffer* out);
+  explicit JsonWriter(std::string* out);
+
+  void StartObject();
+  void EndObject();
+  void StartArray();
+  void EndArray();
+
+  // The name of the next member of the current object.
+  void Key(const char* name);
+
+  void String(const std::string& value);
+  void Int(int64_t value);
+  void Boolean(bool value);
+  // |data| as a base64 string.
+  void Base64(const std::string& data);
+  // Appends |size| bytes of |json| as is, which must be a whole value.
+  void Raw(const char* json, size_t size);
+
+  // Shorthands for a member of the current object, like JsonObject's.
+  void Add(const char* name, const std::string& value) {
+    Key(name);
+    String(value);
+  }
+  void Add(const char* name, int64_t value) {
+    Key(name);
+    Int(value);
+  }
+  void AddBoolean(const char* name, bool value) {
+    Key(name);
+    Boolean(value);
+  }
+  void AddBase64(const char* name, const std::string& data) {
+    Key(name);
+    Base64(data);
+  }
+
+ private:
+  // Separates the value about to be written from the previous one in
+  // the current container, if need be.
+  void StartValue();
+  void StartContainer(char c);
+  void EndContainer(char c);
+  void Append(const char* data, size_t size);
+  void AppendEscaped(const char* str, size_t size);
+
+  evbuffer* const buffer_;
+  std::string* const string_;
+  int depth_;
+  // Whether the container at each depth already has a value.
+  std::bitset<kMaxDepth> has_value_;
+  bool after_key_;
+
+  DISALLOW_COPY_AND_ASSIGN(JsonWriter);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_JSON_WRITER_H_
@@ -0,0 +1,134 @@
+#include "util/json_writer.h"
+
+#include <event2/buffer.h>
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+
+#include "util/json_wrapper.h"
+#include "util/testing.h"
+#include "util/util.h"
+
+namespace cert_trans {
+namespace {
+
+using std::string;
+using std::unique_ptr;
+
+
+TEST(JsonWriterTest, Object) {
+  string out;
+  JsonWriter json(&out);
+  json.StartObject();
+  json.Add("tree_size", static_cast<int64_t>(42));
+  json.Add("name", "log");
+  json.AddBoolean("success", false);
+  json.AddBase64("hash", "abc");
+  json.EndObject();
+
+  EXPECT_EQ(
+      "{\"tree_size\":42,\"name\":\"log\",\"success\":false,\"hash\":\"YWJj\"}",
+      out);
+}
+
+
+TEST(JsonWriterTest, Nested) {
+  string out;
+  JsonWriter json(&out);
+  json.StartObject();
+  json.Key("results");
+  json.StartArray();
+  json.StartObject();
+  json.Add("a", static_cast<int64_t>(-1));
+  json.EndObject();
+  json.StartObject();
+  json.EndObject();
+  json.StartArray();
+  json.EndArray();
+  json.Raw("{\"b\":2}", 7);
+  json.Boolean(true);
+  json.EndArray();
+  json.Key("empty");
+  json.StartArray();
+  json.EndArray();
+  json.EndObject();
+
+  EXPECT_EQ("{\"results\":[{\"a\":-1},{},[],{\"b\":2},true],\"empty\":[]}",
+            out);
+}
+
+
+TEST(JsonWriterTest, Escapes) {
+  const string value("a\"b\\c\nd\te\x01\x1f/\xc3\xa9");
+  string out;
+  JsonWriter json(&out);
+  json.StartObject();
+  json.Add("v", value);
+  json.EndObject();
+
+  EXPECT_EQ("{\"v\":\"a\\\"b\\\\c\\nd\\te\\u0001\\u001f/\xc3\xa9\"}", out);
+
+  // json-c reads it back the same.
+  JsonObject parsed(out);
+  ASSERT_TRUE(parsed.Ok());
+  JsonString parsed_value(parsed, "v");
+  ASSERT_TRUE(parsed_value.Ok());
+  EXPECT_EQ(value, parsed_value.Value());
+}
+
+
+TEST(JsonWriterTest, Base64MatchesToBase64) {
+  string data;
+  // Across the chunks the data is encoded in.
+  for (int i = 0; i < 2000; ++i) {
+    string out;
+    JsonWriter json(&out);
+    json.Base64(data);
+    EXPECT_EQ("\"" + util::ToBase64(data) + "\"", out) << i;
+    data.push_back(static_cast<char>(i * 37));
+  }
+}
+
+
+TEST(JsonWriterTest, Evbuffer) {
+  const unique_ptr<evbuffer, void (*)(evbuffer*)> buffer(evbuffer_new(),
+                                                         &evbuffer_free);
+  JsonWriter json(buffer.get());
+  json.StartObject();
+  json.Add("leaf_index", static_cast<int64_t>(3));
+  json.Key("audit_path");
+  json.StartArray();
+  json.Base64(string(32, '\xff'));
+  json.Base64(string(32, '\0'));
+  json.EndArray();
+  json.EndObject();
+
+  const string expected(
+      "{\"leaf_index\":3,\"audit_path\":["
+      "\"//////////////////////////////////////////8=\","
+      "\"AAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAAA=\"]}");
+  ASSERT_EQ(expected.size(), evbuffer_get_length(buffer.get()));
+  EXPECT_EQ(expected,
+            string(reinterpret_cast<const char*>(
+                       evbuffer_pullup(buffer.get(), -1)),
+                   expected.size()));
+}
+
+
+TEST(JsonWriterDeathTest, MissingValue) {
+  string out;
+  JsonWriter json(&out);
+  json.StartObject();
+  json.Key("a");
+  EXPECT_DEATH(json.EndObject(), "missing the value");
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
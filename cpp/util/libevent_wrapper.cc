@@ -6,9 +6,11 @@
 #ifdef HAVE_ARPA_NAMESER_H
 #include <arpa/nameser.h> /* DNS HEADER struct */
 #endif
+#include <event2/bufferevent_ssl.h>
 #include <event2/keyvalq_struct.h>
 #include <event2/thread.h>
 #include <evhtp.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <math.h>
 #include <climits>
@@ -20,18 +22,23 @@
 #include <netinet/in.h> /* inet_ functions / structs */
 #endif
 #include <resolv.h>
+#include <string.h>
 #include <sys/socket.h>
 #ifdef HAVE_SYS_TYPES_H
 #include <sys/types.h>
 #endif
 #include <signal.h>
 
+#include "monitoring/latency.h"
+#include "util/cached_resolver.h"
+
 using std::bind;
 using std::chrono::duration;
 using std::chrono::duration_cast;
 using std::chrono::microseconds;
 using std::chrono::milliseconds;
 using std::chrono::seconds;
+using std::chrono::steady_clock;
 using std::chrono::system_clock;
 using std::function;
 using std::lock_guard;
@@ -46,8 +53,32 @@ using std::unique_ptr;
 using std::vector;
 using util::TaskHold;
 
+DEFINE_int32(dns_cache_ttl_seconds, 60,
+             "how long to keep the addresses of the host names that the "
+             "clients connect to, refreshing them in the background, or "
+             "not at all if 0");
+DEFINE_int32(dns_cache_negative_ttl_seconds, 5,
+             "how long to keep the host names that could not be resolved "
+             "as such");
+
+DEFINE_int32(http_server_max_body_bytes, 64 << 20,
+             "largest request body that the HTTP servers accept, as it "
+             "is buffered in memory whole; larger ones get a 413, or none "
+             "at all if 0. The default is well above the largest add-chains "
+             "and add-jsons batches (see --max_chains_per_add_chains and "
+             "--max_jsons_per_add_jsons), of about 6MB");
+DEFINE_int32(http_server_max_headers_bytes, 64 << 10,
+             "largest request headers that the HTTP servers accept, or "
+             "none at all if 0");
+DEFINE_int32(http_server_timeout_seconds, 50,
+             "how long the HTTP servers wait on an idle connection, "
+             "including for the rest of a request, before closing it");
+
 namespace {
 
+const size_t kClosureQueueSize(1024);
+
+
 void FreeEvDns(evdns_base* dns) {
   if (dns) {
     evdns_base_free(dns, true);
@@ -80,10 +111,11 @@ void DelayDispatch(evutil_socket_t, short, void* userdata) {
 }
 
 
+// The Base whose dispatch loop is running on this thread, if any.
 #ifdef HAVE_THREAD_LOCAL
-thread_local bool on_event_thread = false;
+thread_local const cert_trans::libevent::Base* event_thread_base = nullptr;
 #elif HAVE___THREAD
-__thread bool on_event_thread = false;
+__thread const cert_trans::libevent::Base* event_thread_base = nullptr;
 #else
 #error No suitable thread local storage available
 #endif
@@ -95,6 +127,121 @@ namespace cert_trans {
 namespace libevent {
 
 
+std::atomic<int64_t> num_requests_handled(0);
+
+
+static Latency<microseconds> event_loop_lag_us(
+    "event_loop_lag_us",
+    "Time between closures being added to an idle event loop and it "
+    "getting to run them, in microseconds, which grows as the loop "
+    "gets busy");
+
+
+// Closures waiting to run on the event loop. Adding one takes no lock,
+// as long as the ring of |kClosureQueueSize| slots has room (this is a
+// bounded queue in the style of Dmitry Vyukov's, with a single
+// consumer). The slots are reused, so that closures small enough for
+// the inline storage of std::function are not allocated either. Once
+// the ring is full, closures go to an overflow vector under a lock, and
+// keep going there until it is drained, so that the closures added by
+// a given thread still run in order.
+class Base::ClosureQueue {
+ public:
+  ClosureQueue() : enqueue_pos_(0), dequeue_pos_(0), overflowed_(false) {
+    for (size_t i = 0; i < kClosureQueueSize; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  void Push(const function<void()>& closure) {
+    if (!overflowed_.load(std::memory_order_acquire) && TryPush(closure)) {
+      return;
+    }
+    lock_guard<mutex> lock(overflow_lock_);
+    overflow_.push_back(closure);
+    overflowed_.store(true, std::memory_order_release);
+  }
+
+  // Only called by the event thread. Returns false if the ring is
+  // empty, or the closure next in it is still being added.
+  bool Pop(function<void()>* closure) {
+    Cell* const cell(&cells_[dequeue_pos_ % kClosureQueueSize]);
+    const size_t sequence(cell->sequence.load(std::memory_order_acquire));
+    if (sequence != dequeue_pos_ + 1) {
+      return false;
+    }
+    *closure = std::move(cell->closure);
+    cell->closure = nullptr;
+    cell->sequence.store(dequeue_pos_ + kClosureQueueSize,
+                         std::memory_order_release);
+    ++dequeue_pos_;
+    return true;
+  }
+
+  // Only called by the event thread.
+  bool RingEmpty() const {
+    return enqueue_pos_.load(std::memory_order_acquire) == dequeue_pos_;
+  }
+
+  // Only called by the event thread. Moves the overflowed closures to
+  // |closures|, only once the ring is empty, since those in the ring
+  // were added before.
+  void TakeOverflow(vector<function<void()>>* closures) {
+    if (!overflowed_.load(std::memory_order_acquire)) {
+      return;
+    }
+    lock_guard<mutex> lock(overflow_lock_);
+    if (!RingEmpty()) {
+      return;
+    }
+    closures->swap(overflow_);
+    overflowed_.store(false, std::memory_order_release);
+  }
+
+ private:
+  struct Cell {
+    // The position this cell is next to be written at, or one past it
+    // once written, until it is read.
+    std::atomic<size_t> sequence;
+    function<void()> closure;
+  };
+
+  bool TryPush(const function<void()>& closure) {
+    size_t pos(enqueue_pos_.load(std::memory_order_relaxed));
+    Cell* cell;
+    while (true) {
+      cell = &cells_[pos % kClosureQueueSize];
+      const size_t sequence(cell->sequence.load(std::memory_order_acquire));
+      if (sequence == pos) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (sequence < pos) {
+        // The cell has not been read since the last time around.
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->closure = closure;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  Cell cells_[kClosureQueueSize];
+  std::atomic<size_t> enqueue_pos_;
+  // Only used by the event thread.
+  size_t dequeue_pos_;
+
+  std::atomic<bool> overflowed_;
+  mutex overflow_lock_;
+  vector<function<void()>> overflow_;
+
+  DISALLOW_COPY_AND_ASSIGN(ClosureQueue);
+};
+
+
 struct HttpServer::Handler {
   Handler(const string& _path, const HandlerCallback& _cb)
       : path(_path), cb(_cb) {
@@ -120,7 +267,7 @@ class ResolverImpl : public Base::Resolver {
     if (resolved != 0) {
       LOG(WARNING) << "Failed to resolve HTTPS hostname " << host << ": "
                    << gai_strerror(resolved);
-      return nullptr;
+      return string();
     }
 
     struct addrinfo* res(info);
@@ -144,7 +291,8 @@ class ResolverImpl : public Base::Resolver {
 
     if (!addr) {
       LOG(WARNING) << "Got no usable address for " << host;
-      return nullptr;
+      freeaddrinfo(info);
+      return string();
     }
 
     char addr_str[INET6_ADDRSTRLEN];
@@ -155,7 +303,38 @@ class ResolverImpl : public Base::Resolver {
 };
 
 
-Base::Base() : Base(unique_ptr<Resolver>(new ResolverImpl)) {
+namespace {
+
+
+Base::Resolver* SharedResolver() {
+  static Base::Resolver* const resolver(
+      FLAGS_dns_cache_ttl_seconds > 0
+          ? static_cast<Base::Resolver*>(new CachedResolver(
+                unique_ptr<Base::Resolver>(new ResolverImpl),
+                seconds(FLAGS_dns_cache_ttl_seconds),
+                seconds(FLAGS_dns_cache_negative_ttl_seconds)))
+          : new ResolverImpl);
+  return resolver;
+}
+
+
+// Lets every instance own a resolver, while they share the one cache.
+class SharedResolverRef : public Base::Resolver {
+ public:
+  string Resolve(const string& host) override {
+    return SharedResolver()->Resolve(host);
+  }
+
+  bool ResolveCached(const string& host, string* address) override {
+    return SharedResolver()->ResolveCached(host, address);
+  }
+};
+
+
+}  // namespace
+
+
+Base::Base() : Base(unique_ptr<Resolver>(new SharedResolverRef)) {
 }
 
 
@@ -164,12 +343,15 @@ Base::Base(unique_ptr<Resolver> resolver)
       dns_(nullptr, FreeEvDns),
       wake_closures_(event_new(base_.get(), -1, 0, &Base::RunClosures, this),
                      &event_free),
+      closures_(new ClosureQueue),
+      wake_pending_(false),
+      wake_requested_at_(0),
       resolver_(std::move(resolver)) {
   evthread_make_base_notifiable(base_.get());
 
   // So much stuff breaks if there's not a Dns client around to keep the
   // event loop doing stuff that we may as well just have one from the get go.
-  GetDns();
+  dns_.reset(CHECK_NOTNULL(evdns_base_new(base_.get(), 1)));
 }
 
 
@@ -179,7 +361,12 @@ Base::~Base() {
 
 // static
 bool Base::OnEventThread() {
-  return on_event_thread;
+  return event_thread_base != nullptr;
+}
+
+
+bool Base::IsEventThread() const {
+  return event_thread_base == this;
 }
 
 
@@ -190,9 +377,18 @@ void Base::CheckNotOnEventThread() {
 
 
 void Base::Add(const function<void()>& cb) {
-  lock_guard<mutex> lock(closures_lock_);
-  closures_.push_back(cb);
-  event_active(wake_closures_.get(), 0, 0);
+  closures_->Push(cb);
+  WakeClosures();
+}
+
+
+void Base::WakeClosures() {
+  if (!wake_pending_.exchange(true)) {
+    wake_requested_at_.store(
+        steady_clock::now().time_since_epoch().count(),
+        std::memory_order_relaxed);
+    event_active(wake_closures_.get(), 0, 0);
+  }
 }
 
 
@@ -237,12 +433,12 @@ void Base::Dispatch() {
   // There should /never/ be more than 1 thread trying to call Dispatch(), so
   // we should expect to always own the lock here.
   CHECK(dispatch_lock_.try_lock());
-  LOG_IF(WARNING, on_event_thread)
+  LOG_IF(WARNING, OnEventThread())
       << "Huh?, Are you calling Dispatch() from a libevent thread?";
-  const bool old_on_event_thread(on_event_thread);
-  on_event_thread = true;
+  const Base* const old_event_thread_base(event_thread_base);
+  event_thread_base = this;
   CHECK_EQ(event_base_dispatch(base_.get()), 0);
-  on_event_thread = old_on_event_thread;
+  event_thread_base = old_event_thread_base;
   dispatch_lock_.unlock();
 }
 
@@ -250,12 +446,12 @@ void Base::Dispatch() {
 void Base::DispatchOnce() {
   // Only one thread can be running a dispatch loop at a time
   lock_guard<mutex> lock(dispatch_lock_);
-  LOG_IF(WARNING, on_event_thread)
+  LOG_IF(WARNING, OnEventThread())
       << "Huh?, Are you calling Dispatch() from a libevent thread?";
-  const bool old_on_event_thread(on_event_thread);
-  on_event_thread = true;
+  const Base* const old_event_thread_base(event_thread_base);
+  event_thread_base = this;
   CHECK_EQ(event_base_loop(base_.get(), EVLOOP_ONCE), 0);
-  on_event_thread = old_on_event_thread;
+  event_thread_base = old_event_thread_base;
 }
 
 
@@ -277,18 +473,19 @@ evhttp* Base::HttpNew() const {
 
 
 evdns_base* Base::GetDns() {
-  lock_guard<mutex> lock(dns_lock_);
-
-  if (!dns_) {
-    dns_.reset(CHECK_NOTNULL(evdns_base_new(base_.get(), 1)));
-  }
-
   return dns_.get();
 }
 
 
 evhtp_connection_t* Base::HttpConnectionNew(const string& host,
                                             unsigned short port) {
+  // This is called on the event thread, so cannot wait for a lookup,
+  // but can skip the one evhtp would do if the address is known.
+  string address;
+  if (resolver_->ResolveCached(host, &address)) {
+    return CHECK_NOTNULL(
+        evhtp_connection_new(base_.get(), address.c_str(), port));
+  }
   return CHECK_NOTNULL(
       evhtp_connection_new_dns(base_.get(), GetDns(), host.c_str(), port));
 }
@@ -309,18 +506,73 @@ evhtp_connection_t* Base::HttpsConnectionNew(const string& host,
 }
 
 
+bufferevent* Base::BufferEventConnect(const string& host, unsigned short port,
+                                      SSL* ssl, bufferevent_data_cb readcb,
+                                      bufferevent_event_cb eventcb,
+                                      void* arg) {
+  CheckNotOnEventThread();
+  const string addr_str(resolver_->Resolve(host));
+  VLOG(1) << "Got addr: " << addr_str << ":" << port;
+  struct sockaddr_in sin;
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(port);
+  if (inet_pton(AF_INET, addr_str.c_str(), &sin.sin_addr) != 1) {
+    LOG(WARNING) << "Cannot parse address " << addr_str << " of " << host;
+    if (ssl) {
+      SSL_free(ssl);
+    }
+    return nullptr;
+  }
+
+  const int options(BEV_OPT_CLOSE_ON_FREE | BEV_OPT_THREADSAFE);
+  bufferevent* const bev(CHECK_NOTNULL(
+      ssl ? bufferevent_openssl_socket_new(base_.get(), -1, ssl,
+                                           BUFFEREVENT_SSL_CONNECTING,
+                                           options)
+          : bufferevent_socket_new(base_.get(), -1, options)));
+  bufferevent_setcb(bev, readcb, nullptr, eventcb, arg);
+  if (bufferevent_socket_connect(bev, reinterpret_cast<sockaddr*>(&sin),
+                                 sizeof(sin)) != 0) {
+    LOG(WARNING) << "Cannot connect to " << host << ":" << port;
+    bufferevent_free(bev);
+    return nullptr;
+  }
+  CHECK_EQ(bufferevent_enable(bev, EV_READ | EV_WRITE), 0);
+  return bev;
+}
+
+
 void Base::RunClosures(evutil_socket_t, short, void* userdata) {
   Base* self(static_cast<Base*>(CHECK_NOTNULL(userdata)));
 
-  vector<function<void()>> closures;
-  {
-    lock_guard<mutex> lock(self->closures_lock_);
-    closures.swap(self->closures_);
+  // Before |wake_pending_| is reset, after which it could be updated.
+  event_loop_lag_us.RecordLatency(
+      steady_clock::now() -
+      steady_clock::time_point(steady_clock::duration(
+          self->wake_requested_at_.load(std::memory_order_relaxed))));
+
+  // Closures added from now on activate the event again.
+  self->wake_pending_.store(false);
+
+  // Run at most as many closures as the ring holds before getting back
+  // to the other events, as closures may well add more of them.
+  function<void()> closure;
+  for (size_t i = 0; i < kClosureQueueSize && self->closures_->Pop(&closure);
+       ++i) {
+    closure();
   }
 
-  for (const auto& closure : closures) {
+  vector<function<void()>> overflow;
+  self->closures_->TakeOverflow(&overflow);
+  for (const auto& closure : overflow) {
     closure();
   }
+
+  // Those added before |wake_pending_| was reset, but not run yet.
+  if (!self->closures_->RingEmpty()) {
+    self->WakeClosures();
+  }
 }
 
 
@@ -356,6 +608,16 @@ void Event::Dispatch(evutil_socket_t sock, short events, void* userdata) {
 
 
 HttpServer::HttpServer(const Base& base) : http_(base.HttpNew()) {
+  // evhttp reads whole requests before handing them over, so slow or
+  // oversized ones would otherwise hold on to connections and memory.
+  if (FLAGS_http_server_max_body_bytes > 0) {
+    evhttp_set_max_body_size(http_, FLAGS_http_server_max_body_bytes);
+  }
+  if (FLAGS_http_server_max_headers_bytes > 0) {
+    evhttp_set_max_headers_size(http_, FLAGS_http_server_max_headers_bytes);
+  }
+  CHECK_GT(FLAGS_http_server_timeout_seconds, 0);
+  evhttp_set_timeout(http_, FLAGS_http_server_timeout_seconds);
 }
 
 
@@ -373,6 +635,33 @@ void HttpServer::Bind(const char* address, ev_uint16_t port) {
 }
 
 
+void HttpServer::BindReusePort(const char* address, ev_uint16_t port) {
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  if (address) {
+    CHECK_EQ(inet_pton(AF_INET, address, &addr.sin_addr), 1) << address;
+  } else {
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  }
+
+  const evutil_socket_t fd(socket(AF_INET, SOCK_STREAM, 0));
+  PCHECK(fd >= 0) << "socket";
+  const int one(1);
+  PCHECK(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) == 0)
+      << "setsockopt(SO_REUSEADDR)";
+  PCHECK(setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) == 0)
+      << "setsockopt(SO_REUSEPORT)";
+  PCHECK(bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) ==
+         0)
+      << "bind";
+  PCHECK(listen(fd, SOMAXCONN) == 0) << "listen";
+  CHECK_EQ(evutil_make_socket_nonblocking(fd), 0);
+  CHECK_EQ(evhttp_accept_socket(http_, fd), 0);
+}
+
+
 bool HttpServer::AddHandler(const string& path, const HandlerCallback& cb) {
   Handler* handler(new Handler(path, cb));
   handlers_.push_back(handler);
@@ -381,7 +670,14 @@ bool HttpServer::AddHandler(const string& path, const HandlerCallback& cb) {
 }
 
 
+// static
+int64_t HttpServer::NumRequestsHandled() {
+  return num_requests_handled.load(std::memory_order_relaxed);
+}
+
+
 void HttpServer::HandleRequest(evhttp_request* req, void* userdata) {
+  num_requests_handled.fetch_add(1, std::memory_order_relaxed);
   static_cast<Handler*>(userdata)->cb(req);
 }
 
@@ -1,11 +1,11 @@
 #ifndef CERT_TRANS_UTIL_LIBEVENT_WRAPPER_H_
 #define CERT_TRANS_UTIL_LIBEVENT_WRAPPER_H_
 
+#include <event2/bufferevent.h>
 #include <event2/dns.h>
 #include <event2/event.h>
 #include <atomic>
 #include <chrono>
-// TODO(alcutter): Use evhtp for the HttpServer too.
 #include <event2/http.h>
 #include <evhtp.h>
 #include <functional>
@@ -31,12 +31,26 @@ class Base : public util::Executor {
  public:
   class Resolver {
    public:
+    virtual ~Resolver() = default;
+
+    // Returns the address of |host|, or an empty string if it cannot be
+    // resolved. May block.
     virtual std::string Resolve(const std::string& host) = 0;
+
+    // Sets |*address| to the address of |host| if it is known without
+    // blocking, which is never, unless the resolver caches them.
+    virtual bool ResolveCached(const std::string& host,
+                               std::string* address) {
+      return false;
+    }
   };
 
+  // Whether the caller is running the dispatch loop of any instance.
   static bool OnEventThread();
   static void CheckNotOnEventThread();
 
+  // Resolves host names with getaddrinfo(), through a cache shared by
+  // all the instances, see --dns_cache_ttl_seconds.
   Base();
   Base(std::unique_ptr<Resolver> resolver);
   ~Base();
@@ -47,6 +61,9 @@ class Base : public util::Executor {
   void Delay(const std::chrono::duration<double>& delay,
              util::Task* task) override;
 
+  // Whether the caller is running the dispatch loop of this instance.
+  bool IsEventThread() const;
+
   void Dispatch();
   void DispatchOnce();
   void LoopExit();
@@ -59,22 +76,39 @@ class Base : public util::Executor {
   evhtp_connection_t* HttpsConnectionNew(const std::string& host,
                                          unsigned short port,
                                          SSL_CTX* ssl_ctx);
+  // Starts connecting a bufferevent to |host|:|port|, over TLS with
+  // |ssl| if it is not null, which the bufferevent then owns. The
+  // callbacks are set before connecting, so that none is missed.
+  // Returns null on failure. Resolves |host| first, like
+  // HttpsConnectionNew(), so must not be called on the event thread.
+  bufferevent* BufferEventConnect(const std::string& host,
+                                  unsigned short port, SSL* ssl,
+                                  bufferevent_data_cb readcb,
+                                  bufferevent_event_cb eventcb, void* arg);
 
  private:
+  class ClosureQueue;
+
   static void RunClosures(evutil_socket_t sock, short flag, void* userdata);
+  void WakeClosures();
 
   const std::unique_ptr<event_base, void (*)(event_base*)> base_;
   std::mutex dispatch_lock_;
 
-  std::mutex dns_lock_;
-  // "dns_" should be after base_, so that it gets destroyed first.
+  // "dns_" should be after base_, so that it gets destroyed first. It is
+  // set once, by the constructor.
   std::unique_ptr<evdns_base, void (*)(evdns_base*)> dns_;
 
-  std::mutex closures_lock_;
   // "wake_closures_" should be after base_, so that it gets destroyed
   // first.
   const std::unique_ptr<event, void (*)(event*)> wake_closures_;
-  std::vector<std::function<void()>> closures_;
+  const std::unique_ptr<ClosureQueue> closures_;
+  // Whether |wake_closures_| has been activated since RunClosures()
+  // last started, so that it is only done once for many closures.
+  std::atomic<bool> wake_pending_;
+  // When |wake_closures_| was last activated, in steady_clock ticks,
+  // to measure how long the loop takes to get to it.
+  std::atomic<int64_t> wake_requested_at_;
   std::unique_ptr<Resolver> resolver_;
 
   DISALLOW_COPY_AND_ASSIGN(Base);
@@ -101,6 +135,13 @@ class Event {
 };
 
 
+// An evhttp server, on one event loop. Several of them can share a port
+// (see BindReusePort()), each on an event loop of its own, to answer
+// requests on several threads. Handlers can stream their responses with
+// evhttp_send_reply_start() and evhttp_send_reply_chunk(), but requests
+// are always read whole, up to --http_server_max_body_bytes.
+//
+// TODO(alcutter): Use evhtp for the HttpServer too.
 class HttpServer {
  public:
   typedef std::function<void(evhttp_request*)> HandlerCallback;
@@ -109,10 +150,19 @@ class HttpServer {
   ~HttpServer();
 
   void Bind(const char* address, ev_uint16_t port);
+  // Like Bind(), but with SO_REUSEPORT, so that several instances, each
+  // with its own Base, can share the port, the kernel spreading the
+  // incoming connections between them. |address| must be an IPv4
+  // address, or NULL for any.
+  void BindReusePort(const char* address, ev_uint16_t port);
 
   // Returns false if there was an error adding the handler.
   bool AddHandler(const std::string& path, const HandlerCallback& cb);
 
+  // Returns the number of requests passed to a handler so far, by all
+  // the instances in this process.
+  static int64_t NumRequestsHandled();
+
  private:
   struct Handler;
 
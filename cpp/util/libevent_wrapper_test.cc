@@ -1,6 +1,8 @@
 #include "util/libevent_wrapper.h"
 
 #include <gtest/gtest.h>
+#include <thread>
+#include <vector>
 
 #include "util/testing.h"
 
@@ -43,6 +45,47 @@ TEST_F(LibEventWrapperTest, TestTurtlesAllTheWayDown) {
 }
 
 
+TEST_F(LibEventWrapperTest, TestIsEventThread) {
+  std::shared_ptr<Base> base(std::make_shared<Base>());
+  std::shared_ptr<Base> other(std::make_shared<Base>());
+  EXPECT_FALSE(base->IsEventThread());
+  base->Add([base, other]() {
+    EXPECT_TRUE(base->IsEventThread());
+    EXPECT_FALSE(other->IsEventThread());
+  });
+  base->DispatchOnce();
+  EXPECT_FALSE(base->IsEventThread());
+}
+
+
+TEST_F(LibEventWrapperTest, TestClosuresRunInOrder) {
+  std::shared_ptr<Base> base(std::make_shared<Base>());
+  // Enough for the closures not to fit in the queue before the event
+  // loop gets to them.
+  const int kNumThreads(4);
+  const int kNumClosures(5000);
+  std::vector<int> next(kNumThreads, 0);
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([base, i, &next]() {
+      for (int j = 0; j < kNumClosures; ++j) {
+        base->Add([i, j, &next]() {
+          EXPECT_EQ(next[i], j);
+          ++next[i];
+        });
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  while (next != std::vector<int>(kNumThreads, kNumClosures)) {
+    base->DispatchOnce();
+  }
+}
+
+
 TEST_F(LibEventWrapperDeathTest, TestCheckNotOnEventThread) {
   // Should be fine:
   Base::CheckNotOnEventThread();
@@ -28,6 +28,15 @@ DEFINE_int32(master_keepalive_interval_seconds, 60,
 DEFINE_int32(masterelection_retry_delay_seconds, 5,
              "Seconds to delay before retrying a failed attempt to create a "
              "proposal file.");
+DEFINE_int32(master_proposal_ttl_seconds, 0,
+             "Seconds after which the proposal of a candidate which stopped "
+             "refreshing it (e.g. because it died) expires, which is how "
+             "long a failed master can hold up the election, or 0 for twice "
+             "--master_keepalive_interval_seconds.");
+DEFINE_bool(master_keepalive_refresh, false,
+            "Refresh the TTL of the mastership proposal without rewriting "
+            "it, so that the keepalives do not wake up the watches of all "
+            "the candidates. Needs etcd 2.3 or later.");
 
 namespace {
 
@@ -50,6 +59,19 @@ static Counter<>* proposal_creation_failures(
 const char kNoBacking[] = "";
 
 
+// The TTL of the proposals, which must leave room for a keepalive to
+// arrive late.
+seconds ProposalTTL() {
+  const seconds ttl(FLAGS_master_proposal_ttl_seconds > 0
+                        ? FLAGS_master_proposal_ttl_seconds
+                        : FLAGS_master_keepalive_interval_seconds * 2);
+  CHECK_GT(ttl.count(), FLAGS_master_keepalive_interval_seconds)
+      << "--master_proposal_ttl_seconds must be longer than "
+      << "--master_keepalive_interval_seconds";
+  return ttl;
+}
+
+
 // Returns |s| with a '/' appended if the last char is not already a '/'
 string EnsureEndsWithSlash(const string& s) {
   if (s.empty() || s.back() != '/') {
@@ -266,8 +288,7 @@ void MasterElection::CreateProposal() {
   // and then restarted before the TTL expired.
   EtcdClient::Response* const resp(new EtcdClient::Response);
   client_->CreateWithTTL(
-      my_proposal_path_, kNoBacking,
-      seconds(FLAGS_master_keepalive_interval_seconds * 2), resp,
+      my_proposal_path_, kNoBacking, ProposalTTL(), resp,
       new Task(bind(&MasterElection::ProposalCreateDone, this, resp, _1),
                base_.get()));
 }
@@ -345,8 +366,7 @@ void MasterElection::UpdateProposal(const string& backed) {
 
   // TODO(alcutter): Set the HTTP timeout inside here to something sensible.
   EtcdClient::Response* const resp(new EtcdClient::Response);
-  client_->UpdateWithTTL(my_proposal_path_, backed,
-                         seconds(FLAGS_master_keepalive_interval_seconds * 2),
+  client_->UpdateWithTTL(my_proposal_path_, backed, ProposalTTL(),
                          my_proposal_modified_index_, resp,
                          new Task(bind(&MasterElection::ProposalUpdateDone,
                                        this, resp, _1),
@@ -370,6 +390,60 @@ void MasterElection::ProposalUpdateDone(EtcdClient::Response* resp,
 }
 
 
+bool MasterElection::MaybeRefreshProposal(const unique_lock<mutex>& lock) {
+  CHECK(lock.owns_lock());
+  if (proposal_state_ == ProposalState::UPDATING ||
+      proposal_state_ == ProposalState::AWAITING_UPDATE) {
+    VLOG(1) << my_proposal_path_ << ": Not refreshing proposal because "
+            << "already have a proposal update in flight.";
+    return false;
+  }
+  Transition(lock, ProposalState::AWAITING_UPDATE);
+  base_->Add(bind(&MasterElection::RefreshProposal, this));
+  return true;
+}
+
+
+void MasterElection::RefreshProposal() {
+  unique_lock<mutex> lock(mutex_);
+  Transition(lock, ProposalState::UPDATING);
+
+  VLOG(1) << my_proposal_path_ << ": Refreshing proposal";
+
+  EtcdClient::Response* const resp(new EtcdClient::Response);
+  client_->RefreshTTL(my_proposal_path_, ProposalTTL(),
+                      my_proposal_modified_index_, resp,
+                      new Task(bind(&MasterElection::ProposalRefreshDone, this,
+                                    resp, _1),
+                               base_.get()));
+}
+
+
+void MasterElection::ProposalRefreshDone(EtcdClient::Response* resp,
+                                         Task* task) {
+  unique_ptr<EtcdClient::Response> resp_deleter(resp);
+  unique_ptr<Task> task_deleter(task);
+  unique_lock<mutex> lock(mutex_);
+  // TODO(alcutter): Handle this
+  CHECK(task->status().ok()) << my_proposal_path_ << ": " << task->status();
+  Transition(lock, ProposalState::UP_TO_DATE);
+
+  my_proposal_modified_index_ = resp->etcd_index;
+  VLOG(1) << my_proposal_path_ << ": Proposal TTL refreshed @ "
+          << resp->etcd_index;
+
+  // Unlike an update, this does not come back through the watch, so a
+  // change of backing that was dropped while it was in flight has to be
+  // retried here.
+  EtcdClient::Node apparent_master;
+  if (running_ && DetermineApparentMaster(&apparent_master) &&
+      backed_proposal_ != apparent_master.key_ &&
+      MaybeUpdateProposal(lock, apparent_master.key_)) {
+    backed_proposal_ = apparent_master.key_;
+  }
+}
+
+
 void MasterElection::DeleteProposal() {
   unique_lock<mutex> lock(mutex_);
   Transition(lock, ProposalState::DELETING);
@@ -405,7 +479,11 @@ void MasterElection::ProposalKeepAliveCallback() {
     return;
   }
 
-  MaybeUpdateProposal(lock, backed_proposal_);
+  if (FLAGS_master_keepalive_refresh) {
+    MaybeRefreshProposal(lock);
+  } else {
+    MaybeUpdateProposal(lock, backed_proposal_);
+  }
 }
 
 
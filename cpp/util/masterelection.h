@@ -35,7 +35,10 @@ class PeriodicClosure;
 // This helps to detect failed candidates and clear up after them.
 // In order to keep this from happening to live candidates, each instance
 // maintains a periodic callback whose sole job is to update the TTL on its
-// proposal file.
+// proposal file. The TTL bounds how long the election takes to notice a
+// failed master, and with --master_keepalive_refresh, these updates only
+// push back the expiry of the proposal without waking up the watches of
+// the other candidates, so that it can be kept short.
 //
 // TODO(alcutter): Some enhancements:
 //   - Recover gracefully from a crash where an old proposal exists for this
@@ -107,6 +110,17 @@ class MasterElection {
   // Called when our proposal file has been refreshed by the KeepAlive thread.
   void ProposalUpdateDone(EtcdClient::Response* resp, util::Task* task);
 
+  // Will call RefreshProposal iff there is currently no other proposal
+  // update in-flight (which refreshes the TTL just as well).
+  bool MaybeRefreshProposal(const std::unique_lock<std::mutex>& lock);
+
+  // Pushes back the expiry of this node's proposal, leaving it as it is.
+  // This should only be called on the base_ event thread.
+  void RefreshProposal();
+
+  // Called once the TTL of our proposal file has been refreshed.
+  void ProposalRefreshDone(EtcdClient::Response* resp, util::Task* task);
+
   // Deletes this node's proposal.
   // This should only be called on the base_ event thread.
   void DeleteProposal();
@@ -53,6 +53,8 @@ DEFINE_string(etcd, "", "etcd server address");
 DEFINE_int32(etcd_port, 4001, "etcd server port");
 DECLARE_int32(master_keepalive_interval_seconds);
 DECLARE_int32(masterelection_retry_delay_seconds);
+DECLARE_int32(master_proposal_ttl_seconds);
+DECLARE_bool(master_keepalive_refresh);
 
 
 // Simple helper class, represents a thread of interest in participating in
@@ -299,6 +301,44 @@ TEST_F(ElectionTest, RetresCreatingProposal) {
 }
 
 
+TEST_F(ElectionTest, TakesOverFromExpiredMasterWithShortTTL) {
+  FLAGS_master_keepalive_interval_seconds = 1;
+  FLAGS_master_proposal_ttl_seconds = 3;
+  FLAGS_master_keepalive_refresh = true;
+  {
+    // The proposal of a master which died, and is no longer refreshed.
+    EtcdClient::Response resp;
+    SyncTask task(base_.get());
+    client_->CreateWithTTL(string(kProposalDir) + "0", "", seconds(3), &resp,
+                           task.task());
+    task.Wait();
+    ASSERT_OK(task.status());
+  }
+
+  Participant one(kProposalDir, "1", base_, client_.get());
+  one.StartElection();
+  sleep(1);
+  EXPECT_FALSE(one.IsMaster());
+  EXPECT_TRUE(one.WaitToBecomeMaster());
+
+  // Well past the TTL of the proposals, which the keepalives refreshed
+  // without disturbing the election.
+  Participant two(kProposalDir, "2", base_, client_.get());
+  two.StartElection();
+  sleep(5);
+  EXPECT_TRUE(one.IsMaster());
+  EXPECT_FALSE(two.IsMaster());
+
+  one.StopElection();
+  EXPECT_TRUE(two.WaitToBecomeMaster());
+  two.StopElection();
+
+  FLAGS_master_keepalive_interval_seconds = 60;
+  FLAGS_master_proposal_ttl_seconds = 0;
+  FLAGS_master_keepalive_refresh = false;
+}
+
+
 TEST_F(ElectionTest, ElectionMania) {
   const int kNumRounds(20);
   const int kNumParticipants(20);
@@ -0,0 +1,211 @@
+#include "util/memory_budget.h"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <vector>
+
+#include "monitoring/callback_gauge.h"
+
+DEFINE_int32(memory_budget_mb, 0,
+             "megabytes of memory to share between the caches of the "
+             "process, such as the get-entries JSON objects and the LevelDB "
+             "block cache, in proportion to the sizes of their own flags; "
+             "if 0, each cache is sized by its own flag alone");
+
+using std::lock_guard;
+using std::map;
+using std::mutex;
+using std::string;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+// Converts the values of one of the maps by name returned by a
+// MemoryBudget to those of a CallbackGauge labelled by "cache".
+template <class T>
+map<vector<string>, double> ByCache(const map<string, T>& values) {
+  map<vector<string>, double> retval;
+  for (const auto& value : values) {
+    retval[{value.first}] = static_cast<double>(value.second);
+  }
+  return retval;
+}
+
+
+void ExportMetrics(const MemoryBudget* budget) {
+  static CallbackGauge* const max_bytes(CallbackGauge::New(
+      "memory_budget_max_bytes", {"cache"},
+      "Number of bytes of the memory budget given to each cache",
+      [budget]() { return ByCache(budget->MaxBytesByName()); }));
+  static CallbackGauge* const bytes(CallbackGauge::New(
+      "memory_budget_bytes", {"cache"},
+      "Number of bytes held by each cache of the memory budget",
+      [budget]() { return ByCache(budget->BytesByName()); }));
+  static CallbackGauge* const hits(CallbackGauge::New(
+      "memory_budget_hits", {"cache"},
+      "Number of lookups found in each cache of the memory budget",
+      [budget]() { return ByCache(budget->HitsByName()); }));
+  static CallbackGauge* const misses(CallbackGauge::New(
+      "memory_budget_misses", {"cache"},
+      "Number of lookups not found in each cache of the memory budget",
+      [budget]() { return ByCache(budget->MissesByName()); }));
+  (void)max_bytes;
+  (void)bytes;
+  (void)hits;
+  (void)misses;
+}
+
+
+}  // namespace
+
+
+MemoryBudget::MemoryBudget(size_t max_bytes) : max_bytes_(max_bytes) {
+}
+
+
+MemoryBudget::~MemoryBudget() {
+  CHECK(consumers_.empty());
+}
+
+
+// static
+MemoryBudget* MemoryBudget::Default() {
+  static MemoryBudget* const budget([]() -> MemoryBudget* {
+    CHECK_GE(FLAGS_memory_budget_mb, 0);
+    if (FLAGS_memory_budget_mb == 0) {
+      return nullptr;
+    }
+    MemoryBudget* const retval(
+        new MemoryBudget(static_cast<size_t>(FLAGS_memory_budget_mb) << 20));
+    ExportMetrics(retval);
+    return retval;
+  }());
+  return budget;
+}
+
+
+void MemoryBudget::AddConsumer(const string& name, double weight,
+                               Consumer* consumer) {
+  CHECK_NOTNULL(consumer);
+  CHECK_GT(weight, 0);
+  lock_guard<mutex> lock(lock_);
+  // No share can be more than the whole budget, so it will be told its
+  // share by Rebalance(), even if that is 0.
+  const bool inserted(
+      consumers_.emplace(consumer, ConsumerInfo{name, weight, max_bytes_ + 1})
+          .second);
+  CHECK(inserted) << "consumer " << name << " added twice";
+  Rebalance();
+}
+
+
+void MemoryBudget::RemoveConsumer(Consumer* consumer) {
+  lock_guard<mutex> lock(lock_);
+  CHECK_EQ(consumers_.erase(consumer), 1U);
+  Rebalance();
+}
+
+
+void MemoryBudget::Reserve(const string& name, size_t bytes) {
+  lock_guard<mutex> lock(lock_);
+  reserved_[name] += bytes;
+  if (reserved_[name] > max_bytes_) {
+    LOG(WARNING) << "reserved " << reserved_[name] << " bytes for " << name
+                 << ", more than the budget of " << max_bytes_;
+  }
+  Rebalance();
+}
+
+
+void MemoryBudget::Release(const string& name, size_t bytes) {
+  lock_guard<mutex> lock(lock_);
+  const auto it(reserved_.find(name));
+  CHECK(it != reserved_.end());
+  CHECK_GE(it->second, bytes);
+  it->second -= bytes;
+  if (it->second == 0) {
+    reserved_.erase(it);
+  }
+  Rebalance();
+}
+
+
+size_t MemoryBudget::MaxBytes() const {
+  lock_guard<mutex> lock(lock_);
+  return max_bytes_;
+}
+
+
+void MemoryBudget::SetMaxBytes(size_t max_bytes) {
+  lock_guard<mutex> lock(lock_);
+  max_bytes_ = max_bytes;
+  Rebalance();
+}
+
+
+map<string, size_t> MemoryBudget::MaxBytesByName() const {
+  lock_guard<mutex> lock(lock_);
+  map<string, size_t> retval(reserved_);
+  for (const auto& consumer : consumers_) {
+    retval[consumer.second.name] += consumer.second.max_bytes;
+  }
+  return retval;
+}
+
+
+map<string, size_t> MemoryBudget::BytesByName() const {
+  lock_guard<mutex> lock(lock_);
+  map<string, size_t> retval(reserved_);
+  for (const auto& consumer : consumers_) {
+    retval[consumer.second.name] += consumer.first->Bytes();
+  }
+  return retval;
+}
+
+
+map<string, uint64_t> MemoryBudget::HitsByName() const {
+  lock_guard<mutex> lock(lock_);
+  map<string, uint64_t> retval;
+  for (const auto& consumer : consumers_) {
+    retval[consumer.second.name] += consumer.first->Hits();
+  }
+  return retval;
+}
+
+
+map<string, uint64_t> MemoryBudget::MissesByName() const {
+  lock_guard<mutex> lock(lock_);
+  map<string, uint64_t> retval;
+  for (const auto& consumer : consumers_) {
+    retval[consumer.second.name] += consumer.first->Misses();
+  }
+  return retval;
+}
+
+
+void MemoryBudget::Rebalance() {
+  size_t reserved(0);
+  for (const auto& it : reserved_) {
+    reserved += it.second;
+  }
+  const size_t available(reserved < max_bytes_ ? max_bytes_ - reserved : 0);
+
+  double total_weight(0);
+  for (const auto& consumer : consumers_) {
+    total_weight += consumer.second.weight;
+  }
+
+  for (auto& consumer : consumers_) {
+    const size_t share(static_cast<size_t>(
+        available * (consumer.second.weight / total_weight)));
+    if (share != consumer.second.max_bytes) {
+      consumer.second.max_bytes = share;
+      consumer.first->SetMaxBytes(share);
+    }
+  }
+}
+
+
+}  // namespace cert_trans
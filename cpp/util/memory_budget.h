@@ -0,0 +1,115 @@
+#ifndef CERT_TRANS_UTIL_MEMORY_BUDGET_H_
+#define CERT_TRANS_UTIL_MEMORY_BUDGET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// Shares a budget of memory between the caches of a process, so that
+// together they fill, but stay within, the memory set aside for them,
+// rather than each being sized by a flag of its own.
+//
+// Caches register as consumers, with a weight, and each is given a share
+// of the budget in proportion to its weight, once the fixed reservations
+// (for the caches which cannot be resized) are taken out. The shares are
+// worked out again whenever consumers come and go, or the budget
+// changes, so that the caches shrink as others register, or when the
+// budget is lowered under memory pressure.
+//
+// The process-wide budget, of --memory_budget_mb, exports the shares,
+// sizes and hit counts of the caches as metrics, by name.
+//
+// This class is thread-safe.
+class MemoryBudget {
+ public:
+  class Consumer {
+   public:
+    virtual ~Consumer() = default;
+
+    // The number of bytes held.
+    virtual size_t Bytes() const = 0;
+
+    // Sets the number of bytes which may be held, evicting down to it if
+    // needed. This is called with the budget locked, so it must not call
+    // back into it.
+    virtual void SetMaxBytes(size_t max_bytes) = 0;
+
+    // The number of lookups that found what they were looking for, and
+    // that did not, for the hit rates.
+    virtual uint64_t Hits() const {
+      return 0;
+    }
+    virtual uint64_t Misses() const {
+      return 0;
+    }
+
+   protected:
+    Consumer() = default;
+
+   private:
+    DISALLOW_COPY_AND_ASSIGN(Consumer);
+  };
+
+  explicit MemoryBudget(size_t max_bytes);
+  // All the consumers must have been removed first.
+  ~MemoryBudget();
+
+  // The budget of --memory_budget_mb, or NULL if it is 0, in which case
+  // the caches keep to the sizes of their own flags.
+  static MemoryBudget* Default();
+
+  // Adds |consumer|, which is told its share right away. Several
+  // consumers can have the same |name|, under which they are added up in
+  // the metrics.
+  void AddConsumer(const std::string& name, double weight,
+                   Consumer* consumer);
+  // The other consumers get its share back.
+  void RemoveConsumer(Consumer* consumer);
+
+  // Sets aside |bytes| of the budget under |name|, for a cache whose size
+  // was fixed when it was created, until they are released.
+  void Reserve(const std::string& name, size_t bytes);
+  void Release(const std::string& name, size_t bytes);
+
+  size_t MaxBytes() const;
+  void SetMaxBytes(size_t max_bytes);
+
+  // By name, the shares and reservations, and the bytes held by the
+  // consumers or reserved.
+  std::map<std::string, size_t> MaxBytesByName() const;
+  std::map<std::string, size_t> BytesByName() const;
+
+  // By name, the hits and misses of the consumers.
+  std::map<std::string, uint64_t> HitsByName() const;
+  std::map<std::string, uint64_t> MissesByName() const;
+
+ private:
+  struct ConsumerInfo {
+    std::string name;
+    double weight;
+    size_t max_bytes;
+  };
+
+  // Works out the shares of the consumers, and tells them those that
+  // changed.
+  void Rebalance();
+
+  mutable std::mutex lock_;
+  size_t max_bytes_;
+  std::map<Consumer*, ConsumerInfo> consumers_;
+  std::map<std::string, size_t> reserved_;
+
+  DISALLOW_COPY_AND_ASSIGN(MemoryBudget);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_MEMORY_BUDGET_H_
@@ -0,0 +1,156 @@
+#include "util/memory_budget.h"
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <map>
+#include <string>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+using std::map;
+using std::string;
+
+
+// Holds a fixed number of bytes, if it is allowed to.
+class FakeConsumer : public MemoryBudget::Consumer {
+ public:
+  explicit FakeConsumer(size_t wanted_bytes)
+      : wanted_bytes_(wanted_bytes), max_bytes_(0), calls_(0) {
+  }
+
+  size_t Bytes() const override {
+    return std::min(wanted_bytes_, max_bytes_);
+  }
+
+  void SetMaxBytes(size_t max_bytes) override {
+    max_bytes_ = max_bytes;
+    ++calls_;
+  }
+
+  uint64_t Hits() const override {
+    return 3;
+  }
+
+  size_t max_bytes() const {
+    return max_bytes_;
+  }
+
+  int calls() const {
+    return calls_;
+  }
+
+ private:
+  const size_t wanted_bytes_;
+  size_t max_bytes_;
+  int calls_;
+};
+
+
+TEST(MemoryBudgetTest, SharesByWeight) {
+  MemoryBudget budget(1000);
+  FakeConsumer a(1000), b(100);
+
+  budget.AddConsumer("a", 1, &a);
+  EXPECT_EQ(1000U, a.max_bytes());
+
+  // Adding another consumer shrinks the first one.
+  budget.AddConsumer("b", 3, &b);
+  EXPECT_EQ(250U, a.max_bytes());
+  EXPECT_EQ(750U, b.max_bytes());
+
+  EXPECT_EQ((map<string, size_t>{{"a", 250}, {"b", 750}}),
+            budget.MaxBytesByName());
+  EXPECT_EQ((map<string, size_t>{{"a", 250}, {"b", 100}}),
+            budget.BytesByName());
+  EXPECT_EQ((map<string, uint64_t>{{"a", 3}, {"b", 3}}), budget.HitsByName());
+  EXPECT_EQ((map<string, uint64_t>{{"a", 0}, {"b", 0}}),
+            budget.MissesByName());
+
+  // And it gets it back once the other one is removed.
+  budget.RemoveConsumer(&b);
+  EXPECT_EQ(1000U, a.max_bytes());
+  budget.RemoveConsumer(&a);
+}
+
+
+TEST(MemoryBudgetTest, AddsUpConsumersOfTheSameName) {
+  MemoryBudget budget(1000);
+  FakeConsumer a(1000), b(1000);
+
+  budget.AddConsumer("cache", 1, &a);
+  budget.AddConsumer("cache", 1, &b);
+  EXPECT_EQ((map<string, size_t>{{"cache", 1000}}), budget.MaxBytesByName());
+  EXPECT_EQ((map<string, uint64_t>{{"cache", 6}}), budget.HitsByName());
+
+  budget.RemoveConsumer(&a);
+  budget.RemoveConsumer(&b);
+}
+
+
+TEST(MemoryBudgetTest, ShrinksUnderPressure) {
+  MemoryBudget budget(1000);
+  FakeConsumer a(1000);
+  budget.AddConsumer("a", 1, &a);
+  EXPECT_EQ(1, a.calls());
+
+  budget.SetMaxBytes(400);
+  EXPECT_EQ(400U, budget.MaxBytes());
+  EXPECT_EQ(400U, a.max_bytes());
+  EXPECT_EQ(2, a.calls());
+
+  // Consumers are only told when their share changes.
+  budget.SetMaxBytes(400);
+  EXPECT_EQ(2, a.calls());
+
+  budget.RemoveConsumer(&a);
+}
+
+
+TEST(MemoryBudgetTest, Reservations) {
+  MemoryBudget budget(1000);
+  FakeConsumer a(1000);
+  budget.AddConsumer("a", 1, &a);
+
+  budget.Reserve("fixed", 600);
+  EXPECT_EQ(400U, a.max_bytes());
+  EXPECT_EQ((map<string, size_t>{{"a", 400}, {"fixed", 600}}),
+            budget.MaxBytesByName());
+  EXPECT_EQ((map<string, size_t>{{"a", 400}, {"fixed", 600}}),
+            budget.BytesByName());
+
+  // Reserving more than the budget leaves nothing for the consumers.
+  budget.Reserve("fixed", 600);
+  EXPECT_EQ(0U, a.max_bytes());
+
+  budget.Release("fixed", 600);
+  EXPECT_EQ(400U, a.max_bytes());
+  budget.Release("fixed", 600);
+  EXPECT_EQ(1000U, a.max_bytes());
+  EXPECT_EQ((map<string, size_t>{{"a", 1000}}), budget.MaxBytesByName());
+
+  budget.RemoveConsumer(&a);
+}
+
+
+TEST(MemoryBudgetTest, NewConsumerIsToldOfNoShare) {
+  MemoryBudget budget(1000);
+  budget.Reserve("fixed", 1000);
+  FakeConsumer a(1000);
+  budget.AddConsumer("a", 1, &a);
+  EXPECT_EQ(1, a.calls());
+  EXPECT_EQ(0U, a.max_bytes());
+  budget.RemoveConsumer(&a);
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,210 @@
+#include "util/numa.h"
+
+#include <glog/logging.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using std::ifstream;
+using std::string;
+using std::to_string;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+// From <numaif.h>, which comes with libnuma.
+const int kMpolDefault = 0;
+const int kMpolPreferred = 1;
+const int kMpolInterleave = 3;
+
+// Enough for any node number the kernel supports.
+const size_t kMaxNodes = 1024;
+const size_t kBitsPerWord = 8 * sizeof(unsigned long);
+
+const char kNodeDir[] = "/sys/devices/system/node/";
+
+
+bool ReadNumaList(const string& path, vector<int>* values) {
+  ifstream in(path);
+  string list;
+  return in && std::getline(in, list) && ParseNumaList(list, values);
+}
+
+
+#ifdef __linux__
+// The thread's CPU affinity, as the CPUs it can run on.
+bool GetCpus(vector<int>* cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) != 0) {
+    return false;
+  }
+  cpus->clear();
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) {
+      cpus->push_back(cpu);
+    }
+  }
+  return true;
+}
+
+
+bool SetCpus(const vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const int cpu : cpus) {
+    if (cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  return sched_setaffinity(0, sizeof(set), &set) == 0;
+}
+
+
+bool GetMemoryPolicy(int* mode, vector<unsigned long>* nodes) {
+  nodes->assign(kMaxNodes / kBitsPerWord, 0);
+  return syscall(SYS_get_mempolicy, mode, nodes->data(), kMaxNodes, nullptr,
+                 0) == 0;
+}
+
+
+bool SetMemoryPolicy(int mode, const vector<unsigned long>& nodes) {
+  return syscall(SYS_set_mempolicy, mode,
+                 mode == kMpolDefault ? nullptr : nodes.data(),
+                 mode == kMpolDefault ? 0 : kMaxNodes) == 0;
+}
+#else
+bool GetCpus(vector<int>*) {
+  return false;
+}
+
+
+bool SetCpus(const vector<int>&) {
+  return false;
+}
+
+
+bool GetMemoryPolicy(int*, vector<unsigned long>*) {
+  return false;
+}
+
+
+bool SetMemoryPolicy(int, const vector<unsigned long>&) {
+  return false;
+}
+#endif
+
+
+vector<unsigned long> NodeMask(const vector<int>& nodes) {
+  vector<unsigned long> mask(kMaxNodes / kBitsPerWord, 0);
+  for (const int node : nodes) {
+    CHECK_GE(node, 0);
+    CHECK_LT(static_cast<size_t>(node), kMaxNodes);
+    mask[node / kBitsPerWord] |= 1UL << (node % kBitsPerWord);
+  }
+  return mask;
+}
+
+
+}  // namespace
+
+
+bool ParseNumaList(const string& list, vector<int>* values) {
+  values->clear();
+  std::istringstream in(list);
+  string range;
+  while (std::getline(in, range, ',')) {
+    char* end;
+    const long first(strtol(range.c_str(), &end, 10));
+    long last(first);
+    if (end == range.c_str() || first < 0) {
+      return false;
+    }
+    if (*end == '-') {
+      const char* const start(end + 1);
+      last = strtol(start, &end, 10);
+      if (end == start || last < first) {
+        return false;
+      }
+    }
+    if (*end != '\0') {
+      return false;
+    }
+    for (long value = first; value <= last; ++value) {
+      values->push_back(value);
+    }
+  }
+  return !values->empty();
+}
+
+
+vector<int> NumaNodes() {
+  vector<int> nodes;
+  if (!ReadNumaList(string(kNodeDir) + "online", &nodes)) {
+    nodes.clear();
+  }
+  return nodes;
+}
+
+
+vector<int> NumaNodeCpus(int node) {
+  vector<int> cpus;
+  if (!ReadNumaList(string(kNodeDir) + "node" + to_string(node) + "/cpulist",
+                    &cpus)) {
+    cpus.clear();
+  }
+  return cpus;
+}
+
+
+bool InterleaveMemory() {
+  const vector<int> nodes(NumaNodes());
+  if (nodes.empty()) {
+    return false;
+  }
+  return SetMemoryPolicy(kMpolInterleave, NodeMask(nodes));
+}
+
+
+ScopedNumaNode::ScopedNumaNode(int node)
+    : node_(node), bound_(false), saved_mode_(kMpolDefault) {
+  if (node_ < 0) {
+    return;
+  }
+  const vector<int> cpus(NumaNodeCpus(node_));
+  if (cpus.empty() || !GetCpus(&saved_cpus_) ||
+      !GetMemoryPolicy(&saved_mode_, &saved_nodes_)) {
+    LOG(WARNING) << "cannot bind to NUMA node " << node_;
+    return;
+  }
+  if (!SetCpus(cpus)) {
+    LOG(WARNING) << "cannot run on the CPUs of NUMA node " << node_;
+    return;
+  }
+  bound_ = true;
+  // Preferred rather than bound, so that allocations can still succeed
+  // elsewhere once the node is full.
+  if (!SetMemoryPolicy(kMpolPreferred, NodeMask({node_}))) {
+    LOG(WARNING) << "cannot allocate memory on NUMA node " << node_;
+  }
+}
+
+
+ScopedNumaNode::~ScopedNumaNode() {
+  if (!bound_) {
+    return;
+  }
+  CHECK(SetCpus(saved_cpus_));
+  CHECK(SetMemoryPolicy(saved_mode_, saved_nodes_));
+}
+
+
+}  // namespace cert_trans
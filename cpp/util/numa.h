@@ -0,0 +1,57 @@
+#ifndef CERT_TRANS_UTIL_NUMA_H_
+#define CERT_TRANS_UTIL_NUMA_H_
+
+#include <string>
+#include <vector>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+// Placement of threads and memory on the NUMA nodes (sockets) of the
+// host, through the CPU affinity and memory policy of threads, which
+// the threads they create inherit. Without libnuma: the topology is read
+// from sysfs. Everything is a no-op, reporting failure, where that is
+// not available (e.g. on other systems than Linux).
+
+
+// Parses a list in the format of sysfs, e.g. "0-3,8,10-11", into
+// |values|, returning false if it is not one.
+bool ParseNumaList(const std::string& list, std::vector<int>* values);
+
+// The online NUMA nodes, or none if they cannot be read.
+std::vector<int> NumaNodes();
+
+// The CPUs of |node|, or none if they cannot be read.
+std::vector<int> NumaNodeCpus(int node);
+
+// Makes the memory of the calling thread, and of the threads it creates
+// from then on, interleaved across all the nodes, which suits large
+// structures shared by the threads of every node.
+bool InterleaveMemory();
+
+
+// Binds the calling thread to the CPUs of a NUMA node, and has it
+// allocate its memory there, until destroyed. The threads it creates
+// meanwhile (such as those of a ThreadPool or an EventPumpThread) stay
+// bound to it.
+class ScopedNumaNode {
+ public:
+  // Does nothing if |node| is negative.
+  explicit ScopedNumaNode(int node);
+  ~ScopedNumaNode();
+
+ private:
+  const int node_;
+  bool bound_;
+  std::vector<int> saved_cpus_;
+  int saved_mode_;
+  std::vector<unsigned long> saved_nodes_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedNumaNode);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_NUMA_H_
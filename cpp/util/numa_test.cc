@@ -0,0 +1,83 @@
+#include "util/numa.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <sched.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "util/testing.h"
+
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+
+vector<int> CurrentCpus() {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CHECK_EQ(0, sched_getaffinity(0, sizeof(set), &set));
+  vector<int> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &set)) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+
+TEST(NumaTest, ParseNumaList) {
+  vector<int> values;
+  ASSERT_TRUE(ParseNumaList("0", &values));
+  EXPECT_EQ(vector<int>({0}), values);
+  ASSERT_TRUE(ParseNumaList("0-3,8,10-11", &values));
+  EXPECT_EQ(vector<int>({0, 1, 2, 3, 8, 10, 11}), values);
+
+  EXPECT_FALSE(ParseNumaList("", &values));
+  EXPECT_FALSE(ParseNumaList("a", &values));
+  EXPECT_FALSE(ParseNumaList("3-1", &values));
+  EXPECT_FALSE(ParseNumaList("1-", &values));
+  EXPECT_FALSE(ParseNumaList("1,,2", &values));
+  EXPECT_FALSE(ParseNumaList("-1", &values));
+}
+
+
+TEST(NumaTest, ScopedNumaNode) {
+  const vector<int> cpus(CurrentCpus());
+  {
+    const ScopedNumaNode none(-1);
+    EXPECT_EQ(cpus, CurrentCpus());
+  }
+
+  const vector<int> nodes(NumaNodes());
+  if (nodes.empty()) {
+    LOG(WARNING) << "no NUMA topology, skipping the rest";
+    return;
+  }
+  const vector<int> node_cpus(NumaNodeCpus(nodes.front()));
+  ASSERT_FALSE(node_cpus.empty());
+  {
+    const ScopedNumaNode node(nodes.front());
+    vector<int> thread_cpus;
+    // Threads created meanwhile stay on the node.
+    std::thread([&thread_cpus]() { thread_cpus = CurrentCpus(); }).join();
+    for (const int cpu : thread_cpus) {
+      EXPECT_NE(node_cpus.end(),
+                std::find(node_cpus.begin(), node_cpus.end(), cpu));
+    }
+  }
+  EXPECT_EQ(cpus, CurrentCpus());
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
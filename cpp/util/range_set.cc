@@ -0,0 +1,79 @@
+#include "util/range_set.h"
+
+#include <glog/logging.h>
+#include <iterator>
+
+namespace cert_trans {
+
+
+bool RangeSet::Insert(int64_t value) {
+  CHECK_LT(value, INT64_MAX);
+  auto next(ranges_.upper_bound(value));
+  auto prev(next == ranges_.begin() ? ranges_.end() : std::prev(next));
+  if (prev != ranges_.end() && value < prev->second) {
+    return false;
+  }
+  ++size_;
+
+  const bool joins_prev(prev != ranges_.end() && prev->second == value);
+  const bool joins_next(next != ranges_.end() && next->first == value + 1);
+  if (joins_prev && joins_next) {
+    prev->second = next->second;
+    ranges_.erase(next);
+  } else if (joins_prev) {
+    prev->second = value + 1;
+  } else if (joins_next) {
+    const int64_t end(next->second);
+    ranges_.erase(next++);
+    ranges_.emplace_hint(next, value, end);
+  } else {
+    ranges_.emplace_hint(next, value, value + 1);
+  }
+  return true;
+}
+
+
+bool RangeSet::Contains(int64_t value) const {
+  const auto next(ranges_.upper_bound(value));
+  return next != ranges_.begin() && value < std::prev(next)->second;
+}
+
+
+bool RangeSet::LowerBound(int64_t value, int64_t* found) const {
+  CHECK_NOTNULL(found);
+  const auto next(ranges_.upper_bound(value));
+  if (next != ranges_.begin() && value < std::prev(next)->second) {
+    *found = value;
+    return true;
+  }
+  if (next == ranges_.end()) {
+    return false;
+  }
+  *found = next->first;
+  return true;
+}
+
+
+int64_t RangeSet::TakeRunFrom(int64_t value) {
+  auto next(ranges_.upper_bound(value));
+  if (next == ranges_.begin()) {
+    return value;
+  }
+  const auto it(std::prev(next));
+  if (value >= it->second) {
+    return value;
+  }
+
+  const int64_t end(it->second);
+  size_ -= end - value;
+  if (it->first == value) {
+    ranges_.erase(it);
+  } else {
+    // The values before |value| stay.
+    it->second = value;
+  }
+  return end;
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,64 @@
+#ifndef CERT_TRANS_UTIL_RANGE_SET_H_
+#define CERT_TRANS_UTIL_RANGE_SET_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <map>
+
+namespace cert_trans {
+
+
+// A set of integers, kept as the disjoint ranges of consecutive values
+// it holds, so that a set filled mostly in runs (such as the sequence
+// numbers of the entries fetched from a peer, a batch at a time) takes
+// one node per run rather than one per value.
+//
+// Like the fetcher's RangeMap, the ranges are keyed by their first
+// value, and ranges which become adjacent are coalesced.
+//
+// This class is not thread-safe.
+class RangeSet {
+ public:
+  RangeSet() : size_(0) {
+  }
+
+  // Adds |value|, returning false if it was already in the set.
+  bool Insert(int64_t value);
+
+  bool Contains(int64_t value) const;
+
+  // Sets |*found| to the smallest value in the set which is not below
+  // |value|, returning false if there is none.
+  bool LowerBound(int64_t value, int64_t* found) const;
+
+  // If the set holds |value|, removes the run of consecutive values
+  // which starts at |value|, and returns the value following it.
+  // Otherwise, returns |value|. This is how a contiguous size catches up
+  // with the values which were added ahead of it.
+  int64_t TakeRunFrom(int64_t value);
+
+  // The number of values in the set.
+  int64_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return ranges_.empty();
+  }
+
+  // The number of ranges the values are kept in.
+  size_t NumRanges() const {
+    return ranges_.size();
+  }
+
+ private:
+  // The end (exclusive) of the ranges, by their first value. No two are
+  // adjacent.
+  std::map<int64_t, int64_t> ranges_;
+  int64_t size_;
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_RANGE_SET_H_
@@ -0,0 +1,116 @@
+#include "util/range_set.h"
+
+#include <gtest/gtest.h>
+#include <set>
+
+#include "util/testing.h"
+
+namespace cert_trans {
+namespace {
+
+
+TEST(RangeSetTest, InsertCoalesces) {
+  RangeSet set;
+  EXPECT_TRUE(set.empty());
+  EXPECT_TRUE(set.Insert(5));
+  EXPECT_TRUE(set.Insert(7));
+  EXPECT_EQ(2U, set.NumRanges());
+  EXPECT_TRUE(set.Insert(6));
+  EXPECT_EQ(1U, set.NumRanges());
+  EXPECT_TRUE(set.Insert(4));
+  EXPECT_TRUE(set.Insert(8));
+  EXPECT_EQ(1U, set.NumRanges());
+  EXPECT_EQ(5, set.size());
+
+  for (int64_t i = 4; i <= 8; ++i) {
+    EXPECT_FALSE(set.Insert(i)) << i;
+    EXPECT_TRUE(set.Contains(i)) << i;
+  }
+  EXPECT_FALSE(set.Contains(3));
+  EXPECT_FALSE(set.Contains(9));
+  EXPECT_EQ(5, set.size());
+}
+
+
+TEST(RangeSetTest, LowerBound) {
+  RangeSet set;
+  int64_t found(-1);
+  EXPECT_FALSE(set.LowerBound(0, &found));
+
+  set.Insert(3);
+  set.Insert(4);
+  set.Insert(10);
+  EXPECT_TRUE(set.LowerBound(0, &found));
+  EXPECT_EQ(3, found);
+  EXPECT_TRUE(set.LowerBound(4, &found));
+  EXPECT_EQ(4, found);
+  EXPECT_TRUE(set.LowerBound(5, &found));
+  EXPECT_EQ(10, found);
+  EXPECT_TRUE(set.LowerBound(10, &found));
+  EXPECT_EQ(10, found);
+  EXPECT_FALSE(set.LowerBound(11, &found));
+}
+
+
+TEST(RangeSetTest, TakeRunFrom) {
+  RangeSet set;
+  EXPECT_EQ(1, set.TakeRunFrom(1));
+
+  for (int64_t i = 1; i < 5; ++i) {
+    set.Insert(i);
+  }
+  set.Insert(6);
+  EXPECT_EQ(0, set.TakeRunFrom(0));
+  EXPECT_EQ(5, set.TakeRunFrom(1));
+  EXPECT_FALSE(set.Contains(1));
+  EXPECT_EQ(1, set.size());
+  EXPECT_EQ(5, set.TakeRunFrom(5));
+  EXPECT_EQ(7, set.TakeRunFrom(6));
+  EXPECT_TRUE(set.empty());
+  EXPECT_EQ(0, set.size());
+}
+
+
+TEST(RangeSetTest, TakeRunFromTheMiddle) {
+  RangeSet set;
+  for (int64_t i = 10; i < 20; ++i) {
+    set.Insert(i);
+  }
+  EXPECT_EQ(20, set.TakeRunFrom(15));
+  EXPECT_EQ(5, set.size());
+  EXPECT_TRUE(set.Contains(14));
+  EXPECT_FALSE(set.Contains(15));
+  EXPECT_EQ(1U, set.NumRanges());
+}
+
+
+TEST(RangeSetTest, MatchesSet) {
+  RangeSet set;
+  std::set<int64_t> expected;
+  uint64_t state(12345);
+  for (int i = 0; i < 10000; ++i) {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    const int64_t value((state >> 33) % 2000);
+    EXPECT_EQ(expected.insert(value).second, set.Insert(value)) << value;
+  }
+  EXPECT_EQ(static_cast<int64_t>(expected.size()), set.size());
+  for (int64_t i = 0; i < 2001; ++i) {
+    EXPECT_EQ(expected.count(i) > 0, set.Contains(i)) << i;
+    int64_t found(-1);
+    const auto it(expected.lower_bound(i));
+    EXPECT_EQ(it != expected.end(), set.LowerBound(i, &found)) << i;
+    if (it != expected.end()) {
+      EXPECT_EQ(*it, found) << i;
+    }
+  }
+}
+
+
+}  // namespace
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
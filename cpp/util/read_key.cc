@@ -1,7 +1,11 @@
 #include "util/read_key.h"
 
+#include <openssl/opensslconf.h>
 #include <openssl/pem.h>
 #include <memory>
+#ifndef OPENSSL_NO_ENGINE
+#include <openssl/engine.h>
+#endif
 
 using std::unique_ptr;
 
@@ -56,4 +60,43 @@ util::StatusOr<EVP_PKEY*> ReadPublicKey(const std::string& file) {
 }
 
 
+#ifndef OPENSSL_NO_ENGINE
+util::StatusOr<EVP_PKEY*> ReadEnginePrivateKey(const std::string& engine,
+                                               const std::string& key_id) {
+  ENGINE_load_builtin_engines();
+  ENGINE* const e(ENGINE_by_id(engine.c_str()));
+  if (!e) {
+    return util::Status(util::error::NOT_FOUND,
+                        "OpenSSL engine not found: " + engine);
+  }
+  if (!ENGINE_init(e)) {
+    ENGINE_free(e);
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "cannot initialize OpenSSL engine: " + engine);
+  }
+  // Only the functional reference from ENGINE_init() is kept, for the
+  // key to use.
+  ENGINE_free(e);
+
+  EVP_PKEY* const retval(
+      ENGINE_load_private_key(e, key_id.c_str(), nullptr, nullptr));
+  if (!retval) {
+    ENGINE_finish(e);
+    return util::Status(util::error::FAILED_PRECONDITION,
+                        "cannot load key " + key_id + " from OpenSSL engine " +
+                            engine);
+  }
+
+  return retval;
+}
+#else
+util::StatusOr<EVP_PKEY*> ReadEnginePrivateKey(const std::string& engine,
+                                               const std::string&) {
+  return util::Status(util::error::UNIMPLEMENTED,
+                      "OpenSSL was built without engines, cannot use " +
+                          engine);
+}
+#endif
+
+
 }  // namespace cert_trans
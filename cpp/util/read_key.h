@@ -13,6 +13,12 @@ util::StatusOr<EVP_PKEY*> ReadPrivateKey(const std::string& file);
 
 util::StatusOr<EVP_PKEY*> ReadPublicKey(const std::string& file);
 
+// Loads the private key named |key_id| from the OpenSSL engine |engine|,
+// such as "pkcs11" for an HSM, which then makes its signatures. The
+// engine is left loaded for as long as the process runs.
+util::StatusOr<EVP_PKEY*> ReadEnginePrivateKey(const std::string& engine,
+                                               const std::string& key_id);
+
 
 }  // namespace cert_trans
 
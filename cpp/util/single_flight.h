@@ -0,0 +1,78 @@
+#ifndef CERT_TRANS_UTIL_SINGLE_FLIGHT_H_
+#define CERT_TRANS_UTIL_SINGLE_FLIGHT_H_
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "base/macros.h"
+
+namespace cert_trans {
+
+
+// Coalesces identical concurrent computations: while the value for a key
+// is being computed, the callers asking for the same key do not compute
+// it again, but get the same result once it is ready. This flattens the
+// herds of identical requests, e.g. from the monitors which all fetch the
+// same entries right after a new tree head.
+//
+// Nothing is kept once a value is computed, later callers compute it
+// anew. This class is thread-safe.
+template <class Key, class Value>
+class SingleFlight {
+ public:
+  typedef std::function<Value()> Compute;
+  typedef std::function<void(const Value&)> Callback;
+
+  SingleFlight() = default;
+
+  // Calls |compute| for |key|, then |done| with its return value, both
+  // before returning, unless the value for |key| is already being
+  // computed. In that case, returns right away, and |done| is called by
+  // the caller computing it, once it has the value. Returns whether this
+  // call computed the value.
+  bool Do(const Key& key, const Compute& compute, const Callback& done);
+
+ private:
+  std::mutex lock_;
+  // The callbacks waiting for the values being computed.
+  std::map<Key, std::vector<Callback>> in_flight_;
+
+  DISALLOW_COPY_AND_ASSIGN(SingleFlight);
+};
+
+
+template <class Key, class Value>
+bool SingleFlight<Key, Value>::Do(const Key& key, const Compute& compute,
+                                  const Callback& done) {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    const auto it(in_flight_.find(key));
+    if (it != in_flight_.end()) {
+      it->second.push_back(done);
+      return false;
+    }
+    in_flight_[key].push_back(done);
+  }
+
+  const Value value(compute());
+
+  std::vector<Callback> callbacks;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    const auto it(in_flight_.find(key));
+    callbacks = std::move(it->second);
+    in_flight_.erase(it);
+  }
+  for (const Callback& callback : callbacks) {
+    callback(value);
+  }
+  return true;
+}
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_SINGLE_FLIGHT_H_
@@ -0,0 +1,86 @@
+#include "util/single_flight.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "base/notification.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+
+using std::string;
+using std::thread;
+using std::vector;
+
+
+TEST(SingleFlightTest, ComputesWhenIdle) {
+  SingleFlight<int, string> flight;
+  int computed(0);
+  vector<string> values;
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_TRUE(flight.Do(1,
+                          [&computed]() {
+                            ++computed;
+                            return string("one");
+                          },
+                          [&values](const string& value) {
+                            values.push_back(value);
+                          }));
+  }
+  EXPECT_EQ(2, computed);
+  EXPECT_EQ(vector<string>({"one", "one"}), values);
+}
+
+
+TEST(SingleFlightTest, SharesValueBeingComputed) {
+  SingleFlight<int, string> flight;
+  Notification computing;
+  Notification release;
+  vector<string> values;
+  thread leader([&]() {
+    EXPECT_TRUE(flight.Do(1,
+                          [&computing, &release]() {
+                            computing.Notify();
+                            release.WaitForNotification();
+                            return string("one");
+                          },
+                          [&values](const string& value) {
+                            values.push_back("leader " + value);
+                          }));
+  });
+  computing.WaitForNotification();
+
+  // Not computed again, but called back with the value of the leader.
+  EXPECT_FALSE(flight.Do(1,
+                         []() {
+                           ADD_FAILURE() << "computed twice";
+                           return string("again");
+                         },
+                         [&values](const string& value) {
+                           values.push_back("follower " + value);
+                         }));
+  EXPECT_TRUE(values.empty());
+
+  // Other keys are not held up.
+  EXPECT_TRUE(flight.Do(2, []() { return string("two"); },
+                        [&values](const string& value) {
+                          values.push_back(value);
+                        }));
+  EXPECT_EQ(vector<string>({"two"}), values);
+
+  release.Notify();
+  leader.join();
+  EXPECT_EQ(vector<string>({"two", "leader one", "follower one"}), values);
+}
+
+
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -1,11 +1,36 @@
 #include "util/sync_task.h"
 
 #include <glog/logging.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
 
+#include "monitoring/callback_gauge.h"
+
+using cert_trans::CallbackGauge;
 using cert_trans::Notification;
+using std::atomic;
 using std::bind;
+using std::map;
+using std::string;
+using std::vector;
 
 namespace util {
+namespace {
+
+
+atomic<int> num_waiting(0);
+
+static CallbackGauge* const sync_task_waiting_threads(CallbackGauge::New(
+    "sync_task_waiting_threads", {},
+    "Number of threads blocked waiting for a SyncTask to be done", []() {
+      return map<vector<string>, double>{
+          {{}, static_cast<double>(num_waiting.load())}};
+    }));
+
+
+}  // namespace
 
 
 SyncTask::SyncTask(Executor* executor)
@@ -27,7 +52,9 @@ bool SyncTask::IsDone() const {
 
 
 void SyncTask::Wait() const {
+  ++num_waiting;
   notifier_.WaitForNotification();
+  --num_waiting;
 }
 
 
@@ -1,8 +1,18 @@
+#include "config.h"
 #include "util/thread_pool.h"
+#include "monitoring/callback_gauge.h"
+#include "monitoring/histogram.h"
 #include "util/task.h"
+#include "util/timer_wheel.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <map>
 #include <mutex>
 #include <queue>
 #include <thread>
@@ -12,61 +22,252 @@ using std::chrono::duration;
 using std::chrono::duration_cast;
 using std::chrono::seconds;
 using std::chrono::steady_clock;
+using std::atomic;
 using std::condition_variable;
+using std::deque;
 using std::function;
-using std::get;
 using std::lock_guard;
+using std::map;
 using std::mutex;
 using std::priority_queue;
+using std::string;
 using std::thread;
-using std::tuple;
 using std::unique_lock;
+using std::unique_ptr;
 using std::vector;
 
+DEFINE_bool(thread_pool_work_stealing, false,
+            "Give each thread of a ThreadPool its own queue, taking closures "
+            "from those of the other threads when it runs out, rather than "
+            "sharing a single queue between all of them.");
+
 namespace cert_trans {
 namespace {
 
-typedef tuple<steady_clock::time_point, function<void()>, util::Task*>
-    QueueEntry;
+const int kNumPriorities(2);
+const char kUnnamed[] = "unnamed";
+
+
+struct QueueEntry {
+  ThreadPool::Priority priority;
+  // Order in which the entry was added, to run entries of the same
+  // priority in that order.
+  uint64_t sequence;
+  function<void()> closure;
+  steady_clock::time_point queued_at;
+};
+
+
+struct QueuedClosure {
+  function<void()> closure;
+  steady_clock::time_point queued_at;
+};
+
+
+const char* PriorityName(ThreadPool::Priority priority) {
+  return priority == ThreadPool::Priority::BULK ? "bulk" : "normal";
+}
+
+
+// These are made on first use, since pools can be created during
+// static initialisation.
+Histogram<string, string>* WaitHistogram() {
+  static Histogram<string, string>* const histogram(
+      Histogram<string, string>::New(
+          "thread_pool_wait_us", "pool", "priority",
+          "Time closures waited for a thread of a ThreadPool, in "
+          "microseconds, by name of pool and priority"));
+  return histogram;
+}
+
+
+Histogram<string, string>* RunHistogram() {
+  static Histogram<string, string>* const histogram(
+      Histogram<string, string>::New(
+          "thread_pool_run_us", "pool", "priority",
+          "Time closures of a ThreadPool took to run, in microseconds, by "
+          "name of pool and priority"));
+  return histogram;
+}
+
+
+// The live pools, with their names, for the queue length gauge.
+class PoolRegistry {
+ public:
+  static PoolRegistry* Instance() {
+    static PoolRegistry* const registry(new PoolRegistry);
+    return registry;
+  }
+
+  void Add(const ThreadPool* pool, const string& name) {
+    lock_guard<mutex> lock(lock_);
+    CHECK(pools_.emplace(pool, name).second);
+  }
+
+  void Remove(const ThreadPool* pool) {
+    lock_guard<mutex> lock(lock_);
+    CHECK_EQ(static_cast<size_t>(1), pools_.erase(pool));
+  }
+
+ private:
+  PoolRegistry()
+      : queue_length_(CallbackGauge::New(
+            "thread_pool_queue_length", {"pool", "priority"},
+            "Number of closures waiting for a thread of a ThreadPool, by "
+            "name of pool and priority",
+            [this]() { return QueueLengths(); })) {
+  }
+
+  map<vector<string>, double> QueueLengths() const {
+    map<vector<string>, double> ret;
+    lock_guard<mutex> lock(lock_);
+    for (const auto& it : pools_) {
+      for (const auto priority :
+           {ThreadPool::Priority::NORMAL, ThreadPool::Priority::BULK}) {
+        ret[{it.second, PriorityName(priority)}] +=
+            it.first->QueueLength(priority);
+      }
+    }
+    return ret;
+  }
+
+  mutable mutex lock_;
+  map<const ThreadPool*, string> pools_;
+  const unique_ptr<CallbackGauge> queue_length_;
+
+  DISALLOW_COPY_AND_ASSIGN(PoolRegistry);
+};
 
 
 struct QueueOrdering {
   bool operator()(const QueueEntry& lhs, const QueueEntry& rhs) const {
-    return get<0>(lhs) > get<0>(rhs);
+    if (lhs.priority != rhs.priority) {
+      return lhs.priority > rhs.priority;
+    }
+    return lhs.sequence > rhs.sequence;
   }
 };
 
 
+// The work stealing pool whose worker is running on this thread, if
+// any, and the index of that worker.
+#ifdef HAVE_THREAD_LOCAL
+thread_local const void* worker_pool = nullptr;
+thread_local size_t worker_index = 0;
+#elif HAVE___THREAD
+__thread const void* worker_pool = nullptr;
+__thread size_t worker_index = 0;
+#else
+#error No suitable thread local storage available
+#endif
+
+
 }  // namespace
 
 
 class ThreadPool::Impl {
  public:
-  ~Impl();
+  explicit Impl(const string& name) : timers_(new TimerWheel) {
+    for (const auto priority : {Priority::NORMAL, Priority::BULK}) {
+      wait_us_[static_cast<int>(priority)] =
+          WaitHistogram()->Buckets(name, PriorityName(priority));
+      run_us_[static_cast<int>(priority)] =
+          RunHistogram()->Buckets(name, PriorityName(priority));
+    }
+  }
+  virtual ~Impl() = default;
+
+  virtual void Add(const function<void()>& closure, Priority priority) = 0;
+  virtual size_t QueueLength(Priority priority) const = 0;
+
+  TimerWheel* timers() const {
+    return timers_.get();
+  }
+
+ protected:
+  // Runs |closure|, recording how long it waited since |queued_at|,
+  // and how long it ran.
+  void RunClosure(Priority priority, const function<void()>& closure,
+                  const steady_clock::time_point& queued_at) const {
+    const steady_clock::time_point started_at(steady_clock::now());
+    closure();
+    const steady_clock::time_point finished_at(steady_clock::now());
+    wait_us_[static_cast<int>(priority)]->Record(
+        duration_cast<std::chrono::microseconds>(started_at - queued_at)
+            .count());
+    run_us_[static_cast<int>(priority)]->Record(
+        duration_cast<std::chrono::microseconds>(finished_at - started_at)
+            .count());
+  }
+
+  // Stopped by the destructors of the implementations before their
+  // threads exit, and destroyed once they have, cancelling the delayed
+  // tasks still pending.
+  unique_ptr<TimerWheel> timers_;
 
+ private:
+  HistogramBuckets* wait_us_[kNumPriorities];
+  HistogramBuckets* run_us_[kNumPriorities];
+};
+
+
+// All the threads share a single queue.
+class ThreadPool::SharedQueueImpl : public ThreadPool::Impl {
+ public:
+  SharedQueueImpl(const string& name, size_t num_threads);
+  ~SharedQueueImpl() override;
+
+  void Add(const function<void()>& closure, Priority priority) override;
+  size_t QueueLength(Priority priority) const override;
+
+ private:
   void Worker();
 
+  void Push(const unique_lock<mutex>& lock, const function<void()>& closure,
+            Priority priority);
+
+  // Whether the next closure in |queue_| can run now.
+  bool CanRunNext(const unique_lock<mutex>& lock) const;
+
   // TODO(pphaneuf): I'd like this to be const, but it required
   // jumping through a few more hoops, keeping it simple for now.
   vector<thread> threads_;
 
-  mutex queue_lock_;
+  mutable mutex queue_lock_;
   condition_variable queue_cond_var_;
+  // Closures ready to run.
   priority_queue<QueueEntry, vector<QueueEntry>, QueueOrdering> queue_;
+  uint64_t next_sequence_;
+  size_t queue_lengths_[kNumPriorities];
+  // Number of threads asked to exit.
+  size_t exit_requests_;
+  size_t running_bulk_;
 };
 
 
-ThreadPool::Impl::~Impl() {
-  // Start by sending an empty closure to every thread (and notify
-  // them), to have them exit cleanly.
+ThreadPool::SharedQueueImpl::SharedQueueImpl(const string& name,
+                                             size_t num_threads)
+    : Impl(name), next_sequence_(0), exit_requests_(0), running_bulk_(0) {
+  for (int i = 0; i < kNumPriorities; ++i) {
+    queue_lengths_[i] = 0;
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads_.emplace_back(thread(&SharedQueueImpl::Worker, this));
+  }
+}
+
+
+ThreadPool::SharedQueueImpl::~SharedQueueImpl() {
+  timers_->Stop();
+
+  // Then ask every thread to exit (and notify them), to have them exit
+  // cleanly.
   {
     lock_guard<mutex> lock(queue_lock_);
-    for (int i = threads_.size(); i > 0; --i)
-      queue_.emplace(
-          make_tuple(steady_clock::time_point(), function<void()>(), nullptr));
+    exit_requests_ = threads_.size();
   }
-  // Notify all the threads *after* adding all the empty closures, to
-  // avoid any races.
+  // Notify all the threads *after* asking all of them, to avoid any
+  // races.
   queue_cond_var_.notify_all();
 
   // Wait for the threads to exit.
@@ -74,111 +275,415 @@ ThreadPool::Impl::~Impl() {
     thread.join();
   }
 
+  // Anyone who tries to Add() more stuff when cancelled is going to
+  // cause a CHECK fail below, but at least they'll know about it that
+  // way.
+  timers_.reset();
+
   // Workers should've drained everything from the queue.
   CHECK(queue_.empty());
 }
 
 
-void ThreadPool::Impl::Worker() {
+void ThreadPool::SharedQueueImpl::Push(const unique_lock<mutex>& lock,
+                                       const function<void()>& closure,
+                                       Priority priority) {
+  CHECK(lock.owns_lock());
+  queue_.push(
+      QueueEntry{priority, next_sequence_++, closure, steady_clock::now()});
+  ++queue_lengths_[static_cast<int>(priority)];
+}
+
+
+bool ThreadPool::SharedQueueImpl::CanRunNext(
+    const unique_lock<mutex>& lock) const {
+  CHECK(lock.owns_lock());
+  if (queue_.empty()) {
+    return false;
+  }
+  // Keep a thread for normal closures.
+  return queue_.top().priority != Priority::BULK || threads_.size() == 1 ||
+         running_bulk_ + 1 < threads_.size();
+}
+
+
+void ThreadPool::SharedQueueImpl::Worker() {
   while (true) {
     QueueEntry entry;
 
     {
       unique_lock<mutex> lock(queue_lock_);
-      while (queue_.empty() || get<0>(queue_.top()) > steady_clock::now()) {
-        if (queue_.empty()) {
-          // If there's nothing to do, wait until there is.
-          queue_cond_var_.wait(lock);
-        } else {
-          // Otherwise, wait until the next thing we currently know about is
-          // ready.
-          const steady_clock::duration duration(get<0>(queue_.top()) -
-                                                steady_clock::now());
-          queue_cond_var_.wait_for(lock, duration);
+      while (true) {
+        if (exit_requests_ > 0) {
+          --exit_requests_;
+          return;
         }
+        if (CanRunNext(lock)) {
+          break;
+        }
+        // If there's nothing to do, wait until there is.
+        queue_cond_var_.wait(lock);
       }
 
       entry = queue_.top();
       queue_.pop();
+      --queue_lengths_[static_cast<int>(entry.priority)];
+      if (entry.priority == Priority::BULK) {
+        ++running_bulk_;
+      }
+    }
 
-      // If we received an empty entry, exit cleanly.
-      if (!get<1>(entry)) {
-        // Anything left in the queue must be either other exit sentinels, or
-        // future (delayed) tasks, so we'll cancel anything we find, up until
-        // either the next exit sentinel, or the end of the queue.
-        VLOG(1) << "Cancelling delayed tasks...";
-        vector<util::Task*> to_be_cancelled;
-        while (!queue_.empty() && get<2>(queue_.top())) {
-          to_be_cancelled.push_back(CHECK_NOTNULL(get<2>(queue_.top())));
-          queue_.pop();
-        }
+    // Make sure not to hold the lock while calling the closure.
+    RunClosure(entry.priority, entry.closure, entry.queued_at);
 
-        // Cancel the callbacks below outside of the lock to avoid deadlocking
-        // anyone who tries to Add() more stuff when they're cancelled.
-        // Anyone who does that is going to cause a CHECK fail in the d'tor of
-        // the pool anyway, but at least they'll know about it that way.
-        lock.unlock();
+    if (entry.priority == Priority::BULK) {
+      {
+        lock_guard<mutex> lock(queue_lock_);
+        --running_bulk_;
+      }
+      // Bulk closures may have been waiting for this one.
+      queue_cond_var_.notify_one();
+    }
+  }
+}
 
-        for (const auto& t : to_be_cancelled) {
-          t->Return(util::Status::CANCELLED);
-        }
 
-        VLOG(1) << "Cancelled " << to_be_cancelled.size() << " delayed tasks.";
-        return;
+void ThreadPool::SharedQueueImpl::Add(const function<void()>& closure,
+                                      Priority priority) {
+  {
+    unique_lock<mutex> lock(queue_lock_);
+    Push(lock, closure, priority);
+  }
+  queue_cond_var_.notify_one();
+}
+
+
+size_t ThreadPool::SharedQueueImpl::QueueLength(Priority priority) const {
+  lock_guard<mutex> lock(queue_lock_);
+  return queue_lengths_[static_cast<int>(priority)];
+}
+
+
+// Each thread has its own queue, which closures added from that thread
+// go to (others are spread across the threads in turn), and takes from
+// those of the other threads when it is empty, so that threads mostly
+// do not contend with each other. BULK closures all go to a shared
+// queue, which is only looked at once the queues of all the threads
+// are empty.
+class ThreadPool::WorkStealingImpl : public ThreadPool::Impl {
+ public:
+  WorkStealingImpl(const string& name, size_t num_threads);
+  ~WorkStealingImpl() override;
+
+  void Add(const function<void()>& closure, Priority priority) override;
+  size_t QueueLength(Priority priority) const override;
+
+ private:
+  struct Worker {
+    mutex lock;
+    deque<QueuedClosure> queue;
+    // Waited on with |idle_lock_|, while idle.
+    condition_variable cond;
+  };
+
+  void Run(size_t index);
+
+  // Takes the next closure for the thread |index| to run, from its own
+  // queue, from those of the other threads, or from |bulk_queue_|, in
+  // that order. Returns false if there is none that can run now.
+  bool Take(size_t index, QueuedClosure* closure, bool* bulk);
+
+  // Whether a closure is waiting that could run now.
+  bool HasWork() const;
+
+  // Whether a BULK closure can run now.
+  bool CanRunBulk(const unique_lock<mutex>& lock) const;
+
+  // Wakes up the thread |index| if it is idle, or else any other idle
+  // one.
+  void Wake(size_t index);
+
+  vector<unique_ptr<Worker>> workers_;
+  vector<thread> threads_;
+  // Next thread to queue a closure added from outside of the pool on.
+  atomic<size_t> next_worker_;
+  atomic<size_t> normal_length_;
+
+  mutable mutex bulk_lock_;
+  deque<QueuedClosure> bulk_queue_;
+  size_t running_bulk_;
+
+  mutex idle_lock_;
+  // Whether each thread is waiting for something to do.
+  vector<bool> idle_;
+  // Number of true entries in |idle_|, which is also read without
+  // |idle_lock_|, to skip taking it when no thread is idle.
+  atomic<size_t> num_idle_;
+  bool exiting_;
+};
+
+
+ThreadPool::WorkStealingImpl::WorkStealingImpl(const string& name,
+                                               size_t num_threads)
+    : Impl(name),
+      next_worker_(0),
+      normal_length_(0),
+      running_bulk_(0),
+      idle_(num_threads, false),
+      num_idle_(0),
+      exiting_(false) {
+  for (size_t i = 0; i < num_threads; ++i) {
+    workers_.emplace_back(new Worker);
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    threads_.emplace_back(thread(&WorkStealingImpl::Run, this, i));
+  }
+}
+
+
+ThreadPool::WorkStealingImpl::~WorkStealingImpl() {
+  timers_->Stop();
+
+  // The threads exit once they run out of closures.
+  {
+    lock_guard<mutex> lock(idle_lock_);
+    exiting_ = true;
+    for (const auto& worker : workers_) {
+      worker->cond.notify_one();
+    }
+  }
+  for (auto& thread : threads_) {
+    thread.join();
+  }
+
+  // Anyone who tries to Add() more stuff when cancelled is going to
+  // cause a CHECK fail below, but at least they'll know about it that
+  // way.
+  timers_.reset();
+
+  // Workers should've drained everything from the queues.
+  for (const auto& worker : workers_) {
+    CHECK(worker->queue.empty());
+  }
+  CHECK(bulk_queue_.empty());
+}
+
+
+bool ThreadPool::WorkStealingImpl::CanRunBulk(
+    const unique_lock<mutex>& lock) const {
+  CHECK(lock.owns_lock());
+  // Keep a thread for normal closures.
+  return workers_.size() == 1 || running_bulk_ + 1 < workers_.size();
+}
+
+
+bool ThreadPool::WorkStealingImpl::Take(size_t index, QueuedClosure* closure,
+                                        bool* bulk) {
+  for (size_t i = 0; i < workers_.size(); ++i) {
+    Worker* const worker(workers_[(index + i) % workers_.size()].get());
+    lock_guard<mutex> lock(worker->lock);
+    if (!worker->queue.empty()) {
+      *closure = std::move(worker->queue.front());
+      worker->queue.pop_front();
+      --normal_length_;
+      *bulk = false;
+      return true;
+    }
+  }
+
+  unique_lock<mutex> lock(bulk_lock_);
+  if (bulk_queue_.empty() || !CanRunBulk(lock)) {
+    return false;
+  }
+  *closure = std::move(bulk_queue_.front());
+  bulk_queue_.pop_front();
+  ++running_bulk_;
+  *bulk = true;
+  return true;
+}
+
+
+bool ThreadPool::WorkStealingImpl::HasWork() const {
+  if (normal_length_.load() > 0) {
+    return true;
+  }
+  unique_lock<mutex> lock(bulk_lock_);
+  return !bulk_queue_.empty() && CanRunBulk(lock);
+}
+
+
+void ThreadPool::WorkStealingImpl::Wake(size_t index) {
+  if (num_idle_.load() == 0) {
+    return;
+  }
+  lock_guard<mutex> lock(idle_lock_);
+  if (!idle_[index]) {
+    const auto it(std::find(idle_.begin(), idle_.end(), true));
+    if (it == idle_.end()) {
+      return;
+    }
+    index = it - idle_.begin();
+  }
+  idle_[index] = false;
+  --num_idle_;
+  workers_[index]->cond.notify_one();
+}
+
+
+void ThreadPool::WorkStealingImpl::Run(size_t index) {
+  worker_pool = this;
+  worker_index = index;
+
+  while (true) {
+    QueuedClosure closure;
+    bool bulk;
+    if (Take(index, &closure, &bulk)) {
+      // Make sure not to hold any lock while calling the closure.
+      RunClosure(bulk ? Priority::BULK : Priority::NORMAL, closure.closure,
+                 closure.queued_at);
+
+      if (bulk) {
+        bool bulk_waiting;
+        {
+          lock_guard<mutex> lock(bulk_lock_);
+          --running_bulk_;
+          bulk_waiting = !bulk_queue_.empty();
+        }
+        // Bulk closures may have been waiting for this one.
+        if (bulk_waiting) {
+          Wake(index);
+        }
       }
+      continue;
     }
 
-    // Make sure not to hold the lock while calling the closure.
-    get<1>(entry)();
+    unique_lock<mutex> lock(idle_lock_);
+    if (exiting_) {
+      return;
+    }
+    // Add() bumps the queue length before checking |num_idle_|, and
+    // this is done the other way around here, so that either it sees
+    // this thread idle, or this sees the new closure.
+    idle_[index] = true;
+    ++num_idle_;
+    if (!HasWork()) {
+      workers_[index]->cond.wait(lock,
+                                 [this, index]() {
+                                   return !idle_[index] || exiting_;
+                                 });
+    }
+    if (idle_[index]) {
+      idle_[index] = false;
+      --num_idle_;
+    }
   }
 }
 
 
-ThreadPool::ThreadPool()
-    : ThreadPool(thread::hardware_concurrency() > 0
-                     ? thread::hardware_concurrency()
-                     : 1) {
+void ThreadPool::WorkStealingImpl::Add(const function<void()>& closure,
+                                       Priority priority) {
+  if (priority == Priority::BULK) {
+    {
+      lock_guard<mutex> lock(bulk_lock_);
+      bulk_queue_.push_back(QueuedClosure{closure, steady_clock::now()});
+    }
+    Wake(next_worker_++ % workers_.size());
+    return;
+  }
+
+  // Closures added by a closure go to the queue of its thread, where
+  // they are likely to find a warm cache.
+  const size_t index(worker_pool == this
+                         ? worker_index
+                         : next_worker_++ % workers_.size());
+  {
+    lock_guard<mutex> lock(workers_[index]->lock);
+    workers_[index]->queue.push_back(
+        QueuedClosure{closure, steady_clock::now()});
+  }
+  ++normal_length_;
+  Wake(index);
 }
 
 
-ThreadPool::ThreadPool(size_t num_threads) : impl_(new Impl) {
+size_t ThreadPool::WorkStealingImpl::QueueLength(Priority priority) const {
+  if (priority == Priority::BULK) {
+    lock_guard<mutex> lock(bulk_lock_);
+    return bulk_queue_.size();
+  }
+  return normal_length_.load();
+}
+
+
+ThreadPool::ThreadPool() : ThreadPool(kUnnamed) {
+}
+
+
+ThreadPool::ThreadPool(size_t num_threads)
+    : ThreadPool(kUnnamed, num_threads) {
+}
+
+
+ThreadPool::ThreadPool(const string& name)
+    : ThreadPool(name, thread::hardware_concurrency() > 0
+                           ? thread::hardware_concurrency()
+                           : 1) {
+}
+
+
+ThreadPool::ThreadPool(const string& name, size_t num_threads)
+    : impl_(FLAGS_thread_pool_work_stealing
+                ? static_cast<Impl*>(new WorkStealingImpl(name, num_threads))
+                : new SharedQueueImpl(name, num_threads)) {
   CHECK_GT(num_threads, static_cast<size_t>(0));
-  LOG(INFO) << "ThreadPool starting with " << num_threads << " threads";
-  for (int i = 0; i < static_cast<int64_t>(num_threads); ++i)
-    impl_->threads_.emplace_back(thread(&Impl::Worker, impl_.get()));
+  LOG(INFO) << "ThreadPool \"" << name << "\" starting with " << num_threads
+            << " threads"
+            << (FLAGS_thread_pool_work_stealing ? " (work stealing)" : "");
+  PoolRegistry::Instance()->Add(this, name);
 }
 
 
 ThreadPool::~ThreadPool() {
-  // Need to have this method defined where the definition of
-  // ThreadPool::Impl is visible.
+  // Before |impl_| goes away.
+  PoolRegistry::Instance()->Remove(this);
 }
 
 
 void ThreadPool::Add(const function<void()>& closure) {
-  // Empty closures signal a thread to exit, don't allow that (also,
-  // it doesn't make sense).
+  Add(closure, Priority::NORMAL);
+}
+
+
+void ThreadPool::Add(const function<void()>& closure, Priority priority) {
+  // Empty closures used to signal a thread to exit, and do not make
+  // sense anyway.
   if (!closure) {
     return;
   }
+  impl_->Add(closure, priority);
+}
 
-  {
-    lock_guard<mutex> lock(impl_->queue_lock_);
-    impl_->queue_.emplace(make_tuple(steady_clock::now(), closure, nullptr));
-  }
-  impl_->queue_cond_var_.notify_one();
+
+size_t ThreadPool::QueueLength(Priority priority) const {
+  return impl_->QueueLength(priority);
 }
 
 
 void ThreadPool::Delay(const duration<double>& delay, util::Task* task) {
   CHECK_NOTNULL(task);
-  {
-    lock_guard<mutex> lock(impl_->queue_lock_);
-    impl_->queue_.emplace(make_tuple(
-        steady_clock::now() + duration_cast<std::chrono::microseconds>(delay),
-        [task]() { task->Return(); }, task));
-  }
-  impl_->queue_cond_var_.notify_one();
+  // Make sure the task is not done before the cancellation callback is
+  // set, should the timer be due already.
+  util::TaskHold hold(task);
+  TimerWheel* const timers(impl_->timers());
+  const TimerWheel::Id id(timers->Add(
+      steady_clock::now() + duration_cast<std::chrono::microseconds>(delay),
+      [task](const util::Status& status) { task->Return(status); }));
+  // Once Cancel() returns, the timer will not touch |task| anymore.
+  task->WhenCancelled([timers, id, task]() {
+    if (timers->Cancel(id)) {
+      task->Return(util::Status::CANCELLED);
+    }
+  });
 }
 
 
@@ -5,6 +5,7 @@
 #include <functional>
 #include <map>
 #include <memory>
+#include <string>
 
 #include "base/macros.h"
 #include "util/executor.h"
@@ -14,26 +15,58 @@ namespace cert_trans {
 
 // Provides a fixed size thread pool to run closures on. The pool is
 // sized according to the number of cores in the system.
+//
+// Closures are run in the order in which they were added, except that
+// BULK ones only run once no NORMAL ones are waiting, and never on the
+// last idle thread of a pool with more than one, so that long bulk work
+// cannot hold up the rest.
+//
+// With --thread_pool_work_stealing, each thread has a queue of its own
+// instead, and only the closures of a given queue are run in the order
+// in which they were added.
+//
+// The length of the queues, as well as the time closures wait for a
+// thread and take to run, are exported as metrics, by name of pool
+// and priority.
 class ThreadPool : public util::Executor {
  public:
+  enum class Priority {
+    NORMAL,
+    BULK,
+  };
+
   // Creates the threads.
   ThreadPool();
 
   // Creates the threads.
   ThreadPool(size_t num_threads);
 
+  // Creates the threads, in a pool whose metrics are labelled with
+  // |name|, rather than "unnamed". Pools with the same name share their
+  // metrics.
+  explicit ThreadPool(const std::string& name);
+  ThreadPool(const std::string& name, size_t num_threads);
+
   // The destructor will wait for any outstanding closures to finish.
   ~ThreadPool();
 
   // Arranges for "closure" to be called in the thread pool. The
   // function must not be empty.
   void Add(const std::function<void()>& closure) override;
+  void Add(const std::function<void()>& closure, Priority priority);
+
+  // The number of closures of |priority| waiting for a thread, not
+  // counting delayed ones.
+  size_t QueueLength(Priority priority) const;
 
   void Delay(const std::chrono::duration<double>& delay,
              util::Task* task) override;
 
  private:
   class Impl;
+  class SharedQueueImpl;
+  class WorkStealingImpl;
+
   const std::unique_ptr<Impl> impl_;
 
   DISALLOW_COPY_AND_ASSIGN(ThreadPool);
@@ -1,56 +1,83 @@
 #include "util/thread_pool.h"
 
+#include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 #include <atomic>
 #include <memory>
+#include <string>
+#include <vector>
 
 #include "base/notification.h"
+#include "monitoring/metric.h"
+#include "monitoring/registry.h"
 #include "util/sync_task.h"
 #include "util/testing.h"
 
+DECLARE_bool(thread_pool_work_stealing);
+
 namespace cert_trans {
 
 using std::chrono::milliseconds;
 using std::chrono::system_clock;
+using std::string;
 using std::unique_ptr;
+using std::vector;
 using util::SyncTask;
 
-class ThreadPoolTest : public ::testing::Test {
- public:
-  ThreadPoolTest() : pool_of_one_(1) {
+// Runs every test with the shared queue (false), then with work
+// stealing (true).
+class ThreadPoolTest : public ::testing::TestWithParam<bool> {
+ protected:
+  void SetUp() override {
+    FLAGS_thread_pool_work_stealing = GetParam();
+    pool_of_one_.reset(new ThreadPool(1));
   }
 
- protected:
-  ThreadPool pool_of_one_;
+  void TearDown() override {
+    pool_of_one_.reset();
+    FLAGS_thread_pool_work_stealing = false;
+  }
+
+  unique_ptr<ThreadPool> pool_of_one_;
 };
 
+
+const Metric* FindMetric(const string& name) {
+  for (const Metric* metric : Registry::Instance()->GetMetrics()) {
+    if (metric->Name() == name) {
+      return metric;
+    }
+  }
+  return nullptr;
+}
+
 typedef class ThreadPoolTest ThreadPoolDeathTest;
 
 
-TEST_F(ThreadPoolTest, Delay) {
-  SyncTask task(&pool_of_one_);
-  pool_of_one_.Delay(milliseconds(200), task.task());
+TEST_P(ThreadPoolTest, Delay) {
+  SyncTask task(pool_of_one_.get());
+  pool_of_one_->Delay(milliseconds(200), task.task());
   EXPECT_FALSE(task.IsDone());
   task.Wait();
 }
 
 
-TEST_F(ThreadPoolDeathTest, AddingMoreTasksAfterClosedGoesBang) {
+TEST_P(ThreadPoolDeathTest, AddingMoreTasksAfterClosedGoesBang) {
   unique_ptr<ThreadPool> my_pool_of_one(new ThreadPool(1));
   SyncTask task(my_pool_of_one.get());
   my_pool_of_one->Delay(milliseconds(200), task.task());
-  EXPECT_DEATH(my_pool_of_one.reset(), "queue_\\.empty()");
+  EXPECT_DEATH(my_pool_of_one.reset(), "queue_?\\.empty()");
   task.Wait();
 }
 
 
-TEST_F(ThreadPoolTest, DelayDoesNotBlockAThread) {
-  SyncTask delay_task(&pool_of_one_);
-  pool_of_one_.Delay(milliseconds(200), delay_task.task());
+TEST_P(ThreadPoolTest, DelayDoesNotBlockAThread) {
+  SyncTask delay_task(pool_of_one_.get());
+  pool_of_one_->Delay(milliseconds(200), delay_task.task());
 
   Notification inner_done;
-  pool_of_one_.Add([&inner_done]() {
+  pool_of_one_->Add([&inner_done]() {
     LOG(WARNING) << "Inner running";
     inner_done.Notify();
   });
@@ -63,12 +90,21 @@ TEST_F(ThreadPoolTest, DelayDoesNotBlockAThread) {
 }
 
 
-TEST_F(ThreadPoolTest, NaturalOrderingPreserved) {
-  SyncTask task1(&pool_of_one_);
-  SyncTask task2(&pool_of_one_);
+TEST_P(ThreadPoolTest, CancelDelay) {
+  SyncTask task(pool_of_one_.get());
+  pool_of_one_->Delay(std::chrono::seconds(60), task.task());
+  task.Cancel();
+  task.Wait();
+  EXPECT_EQ(util::Status::CANCELLED, task.status());
+}
+
 
-  pool_of_one_.Delay(milliseconds(200), task2.task());
-  pool_of_one_.Delay(milliseconds(100), task1.task());
+TEST_P(ThreadPoolTest, NaturalOrderingPreserved) {
+  SyncTask task1(pool_of_one_.get());
+  SyncTask task2(pool_of_one_.get());
+
+  pool_of_one_->Delay(milliseconds(200), task2.task());
+  pool_of_one_->Delay(milliseconds(100), task1.task());
 
   task1.Wait();
   EXPECT_FALSE(task2.IsDone());
@@ -76,10 +112,66 @@ TEST_F(ThreadPoolTest, NaturalOrderingPreserved) {
 }
 
 
-TEST_F(ThreadPoolTest, CancelsDelayTasks) {
+TEST_P(ThreadPoolTest, NormalBeforeBulk) {
+  Notification blocked;
+  Notification unblock;
+  pool_of_one_->Add([&blocked, &unblock]() {
+    blocked.Notify();
+    unblock.WaitForNotification();
+  });
+  blocked.WaitForNotification();
+
+  std::vector<int> order;
+  Notification done;
+  pool_of_one_->Add([&order]() { order.push_back(1); },
+                   ThreadPool::Priority::BULK);
+  pool_of_one_->Add([&order]() { order.push_back(2); });
+  pool_of_one_->Add([&order, &done]() {
+    order.push_back(3);
+    done.Notify();
+  }, ThreadPool::Priority::BULK);
+  EXPECT_EQ(2U, pool_of_one_->QueueLength(ThreadPool::Priority::BULK));
+  EXPECT_EQ(1U, pool_of_one_->QueueLength(ThreadPool::Priority::NORMAL));
+
+  unblock.Notify();
+  done.WaitForNotification();
+  EXPECT_EQ((std::vector<int>{2, 1, 3}), order);
+}
+
+
+TEST_P(ThreadPoolTest, BulkKeepsAThreadFree) {
+  ThreadPool pool(2);
+  Notification started;
+  Notification unblock;
+  std::atomic<int> bulk_run(0);
+  pool.Add([&started, &unblock, &bulk_run]() {
+    ++bulk_run;
+    started.Notify();
+    unblock.WaitForNotification();
+  }, ThreadPool::Priority::BULK);
+  started.WaitForNotification();
+  Notification bulk_done;
+  pool.Add([&bulk_run, &bulk_done]() {
+    ++bulk_run;
+    bulk_done.Notify();
+  }, ThreadPool::Priority::BULK);
+
+  // The second bulk closure waits, leaving a thread for this one.
+  Notification normal_done;
+  pool.Add([&normal_done]() { normal_done.Notify(); });
+  normal_done.WaitForNotification();
+  EXPECT_EQ(1, bulk_run.load());
+  EXPECT_EQ(1U, pool.QueueLength(ThreadPool::Priority::BULK));
+
+  unblock.Notify();
+  bulk_done.WaitForNotification();
+}
+
+
+TEST_P(ThreadPoolTest, CancelsDelayTasks) {
   unique_ptr<ThreadPool> pool(new ThreadPool(1));
 
-  SyncTask task1(&pool_of_one_);
+  SyncTask task1(pool_of_one_.get());
 
   pool->Delay(milliseconds(500), task1.task());
   pool.reset();
@@ -89,6 +181,43 @@ TEST_F(ThreadPoolTest, CancelsDelayTasks) {
 }
 
 
+TEST_P(ThreadPoolTest, Metrics) {
+  const string name(GetParam() ? "metrics_work_stealing" : "metrics_shared");
+  const vector<string> labels{name, "normal"};
+  unique_ptr<ThreadPool> pool(new ThreadPool(name, 1));
+  Notification started, unblock;
+  pool->Add([&started, &unblock]() {
+    started.Notify();
+    unblock.WaitForNotification();
+  });
+  started.WaitForNotification();
+  pool->Add([]() {});
+  pool->Add([]() {});
+
+  const Metric* const queue_length(FindMetric("thread_pool_queue_length"));
+  ASSERT_NE(nullptr, queue_length);
+  EXPECT_EQ(2, queue_length->CurrentValues().at(labels).second);
+
+  unblock.Notify();
+  // Waits for the closures to be done.
+  pool.reset();
+  EXPECT_EQ(0, queue_length->CurrentValues().count(labels));
+
+  const Metric* const wait_us(FindMetric("thread_pool_wait_us"));
+  ASSERT_NE(nullptr, wait_us);
+  EXPECT_EQ(3, wait_us->CurrentValues().at(labels).second);
+  const Metric* const run_us(FindMetric("thread_pool_run_us"));
+  ASSERT_NE(nullptr, run_us);
+  EXPECT_EQ(3, run_us->CurrentValues().at(labels).second);
+}
+
+
+INSTANTIATE_TEST_CASE_P(SharedQueueAndWorkStealing, ThreadPoolTest,
+                        ::testing::Bool());
+INSTANTIATE_TEST_CASE_P(SharedQueueAndWorkStealing, ThreadPoolDeathTest,
+                        ::testing::Bool());
+
+
 }  // namespace cert_trans
 
 
@@ -0,0 +1,254 @@
+#include "util/timer_wheel.h"
+
+#include <glog/logging.h>
+#include <algorithm>
+#include <limits>
+
+using std::chrono::duration_cast;
+using std::chrono::steady_clock;
+using std::list;
+using std::lock_guard;
+using std::mutex;
+using std::pair;
+using std::unique_lock;
+using std::vector;
+
+namespace cert_trans {
+namespace {
+
+const int kLevels(4);
+const int kSlotBits(8);
+const int kSlots(1 << kSlotBits);
+const uint64_t kSlotMask(kSlots - 1);
+// Timers further away than this go in the last slot of the top level,
+// and move down from there nevertheless.
+const uint64_t kMaxDelta((static_cast<uint64_t>(1) << (kLevels * kSlotBits)) -
+                         1);
+const uint64_t kNever(std::numeric_limits<uint64_t>::max());
+
+
+}  // namespace
+
+
+TimerWheel::TimerWheel(const steady_clock::duration& tick)
+    : tick_(tick),
+      epoch_(steady_clock::now()),
+      slots_(kLevels * kSlots),
+      next_id_(1),
+      current_tick_(0),
+      wake_tick_(0),
+      stopping_(false),
+      thread_(&TimerWheel::Run, this) {
+  CHECK_GT(tick_.count(), 0);
+}
+
+
+TimerWheel::~TimerWheel() {
+  Stop();
+
+  vector<Callback> cancelled;
+  {
+    lock_guard<mutex> lock(lock_);
+    for (auto& it : timers_) {
+      cancelled.emplace_back(std::move(it.second.cb));
+    }
+    timers_.clear();
+    for (auto& slot : slots_) {
+      slot.clear();
+    }
+  }
+
+  VLOG(1) << "Cancelling " << cancelled.size() << " timers.";
+  for (const auto& cb : cancelled) {
+    cb(util::Status::CANCELLED);
+  }
+}
+
+
+TimerWheel::Id TimerWheel::Add(const steady_clock::time_point& when,
+                               const Callback& cb) {
+  CHECK(cb);
+  unique_lock<mutex> lock(lock_);
+  if (timers_.empty()) {
+    // Nothing happened since the thread went to sleep, there is no
+    // need to go through all of those ticks.
+    current_tick_ = std::max(current_tick_, NowTick(lock));
+  }
+
+  uint64_t expiry(0);
+  if (when > epoch_) {
+    // Round up, never to run a callback early.
+    expiry = (when - epoch_ + tick_ - steady_clock::duration(1)) / tick_;
+  }
+
+  const Id id(next_id_++);
+  Timer* const timer(&timers_[id]);
+  timer->expiry = expiry;
+  timer->cb = cb;
+  Insert(lock, id, timer);
+
+  const bool wake(expiry < wake_tick_);
+  lock.unlock();
+  if (wake) {
+    cond_var_.notify_one();
+  }
+
+  return id;
+}
+
+
+bool TimerWheel::Cancel(Id id) {
+  // Destroyed outside of the lock, in case that ends up in here again.
+  Callback cb;
+  unique_lock<mutex> lock(lock_);
+  const auto it(timers_.find(id));
+  if (it != timers_.end()) {
+    it->second.slot->erase(it->second.position);
+    cb = std::move(it->second.cb);
+    timers_.erase(it);
+    return true;
+  }
+
+  if (std::this_thread::get_id() != thread_.get_id()) {
+    running_cond_var_.wait(lock,
+                           [this, id]() { return running_.count(id) == 0; });
+  }
+  return false;
+}
+
+
+void TimerWheel::Stop() {
+  {
+    lock_guard<mutex> lock(lock_);
+    stopping_ = true;
+  }
+  cond_var_.notify_one();
+
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+
+uint64_t TimerWheel::NowTick(const unique_lock<mutex>& lock) const {
+  CHECK(lock.owns_lock());
+  return (steady_clock::now() - epoch_) / tick_;
+}
+
+
+void TimerWheel::Insert(const unique_lock<mutex>& lock, Id id, Timer* timer) {
+  CHECK(lock.owns_lock());
+  const uint64_t delta(
+      std::min(std::max(timer->expiry, current_tick_) - current_tick_,
+               kMaxDelta));
+  const uint64_t slot_tick(current_tick_ + delta);
+
+  int level(0);
+  while (level + 1 < kLevels &&
+         delta >= static_cast<uint64_t>(1) << ((level + 1) * kSlotBits)) {
+    ++level;
+  }
+
+  list<Id>* const slot(
+      &slots_[level * kSlots +
+              ((slot_tick >> (level * kSlotBits)) & kSlotMask)]);
+  timer->slot = slot;
+  timer->position = slot->insert(slot->end(), id);
+}
+
+
+int TimerWheel::Cascade(const unique_lock<mutex>& lock, int level,
+                        int index) {
+  CHECK(lock.owns_lock());
+  list<Id> ids;
+  ids.swap(slots_[level * kSlots + index]);
+  for (const auto& id : ids) {
+    const auto it(timers_.find(id));
+    CHECK(it != timers_.end());
+    Insert(lock, id, &it->second);
+  }
+  return index;
+}
+
+
+void TimerWheel::Advance(const unique_lock<mutex>& lock, uint64_t now,
+                         vector<pair<Id, Callback>>* due) {
+  CHECK(lock.owns_lock());
+  while (!timers_.empty() && current_tick_ <= now) {
+    const int index(current_tick_ & kSlotMask);
+    // When the lowest ring wraps around, refill it from the next slot
+    // of the level above, and so on up.
+    if (index == 0) {
+      for (int level = 1; level < kLevels; ++level) {
+        if (Cascade(lock, level, (current_tick_ >> (level * kSlotBits)) &
+                                     kSlotMask) != 0) {
+          break;
+        }
+      }
+    }
+
+    list<Id>& slot(slots_[index]);
+    for (const auto& id : slot) {
+      const auto it(timers_.find(id));
+      CHECK(it != timers_.end());
+      due->emplace_back(id, std::move(it->second.cb));
+      timers_.erase(it);
+    }
+    slot.clear();
+    ++current_tick_;
+  }
+}
+
+
+uint64_t TimerWheel::NextWakeTick(const unique_lock<mutex>& lock) const {
+  CHECK(lock.owns_lock());
+  if (timers_.empty()) {
+    return kNever;
+  }
+
+  // Either a slot with timers in the lowest ring, or the end of the
+  // ring, where timers move down from the level above.
+  uint64_t tick(current_tick_);
+  while ((tick & kSlotMask) != 0 && slots_[tick & kSlotMask].empty()) {
+    ++tick;
+  }
+  return tick;
+}
+
+
+void TimerWheel::Run() {
+  unique_lock<mutex> lock(lock_);
+  while (!stopping_) {
+    vector<pair<Id, Callback>> due;
+    Advance(lock, NowTick(lock), &due);
+
+    if (!due.empty()) {
+      for (const auto& timer : due) {
+        running_.insert(timer.first);
+      }
+      // Make sure not to hold the lock while calling the callbacks.
+      lock.unlock();
+      for (const auto& timer : due) {
+        timer.second(util::Status::OK);
+      }
+      lock.lock();
+      running_.clear();
+      running_cond_var_.notify_all();
+      continue;
+    }
+
+    wake_tick_ = NextWakeTick(lock);
+    if (wake_tick_ == kNever) {
+      cond_var_.wait(lock);
+    } else {
+      cond_var_.wait_until(
+          lock, epoch_ + tick_ * static_cast<steady_clock::rep>(wake_tick_));
+    }
+    // Add() does not need to wake up the thread until it goes back to
+    // sleep.
+    wake_tick_ = 0;
+  }
+}
+
+
+}  // namespace cert_trans
@@ -0,0 +1,116 @@
+#ifndef CERT_TRANS_UTIL_TIMER_WHEEL_H_
+#define CERT_TRANS_UTIL_TIMER_WHEEL_H_
+
+#include <stdint.h>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "base/macros.h"
+#include "util/status.h"
+
+namespace cert_trans {
+
+
+// Runs callbacks once their time comes, on a thread of its own, so
+// that waiting timers do not get in the way of the threads doing the
+// actual work.
+//
+// Timers are kept in a hierarchical timing wheel: each level has a
+// ring of slots, each slot of a level covering as much time as the
+// whole ring of the level below, and the timers of a slot move down a
+// level when the ring of the level below gets to it. Adding and
+// cancelling a timer therefore take constant time, whatever the number
+// of timers, at the cost of rounding their time up to the next tick.
+class TimerWheel {
+ public:
+  typedef uint64_t Id;
+  // Called with OK once the time has come, or CANCELLED if the
+  // TimerWheel is destroyed before then.
+  typedef std::function<void(const util::Status&)> Callback;
+
+  // Starts the thread running the callbacks, every |tick| at most.
+  explicit TimerWheel(const std::chrono::steady_clock::duration& tick =
+                          std::chrono::milliseconds(1));
+
+  // Calls Stop(), then the callbacks of the timers still pending, with
+  // CANCELLED.
+  ~TimerWheel();
+
+  // Arranges for |cb| to be called at |when|, or at the next tick if
+  // it is in the past. Returns an identifier for Cancel().
+  Id Add(const std::chrono::steady_clock::time_point& when,
+         const Callback& cb);
+
+  // Removes the timer |id|, returning true if its callback had yet to
+  // be called, in which case it will not be. Otherwise, waits for the
+  // callback to return first if it is running (unless called from that
+  // callback), and returns false.
+  bool Cancel(Id id);
+
+  // Stops running the callbacks of the timers as they become due,
+  // leaving them to the destructor. Waits for the callbacks being run
+  // to return.
+  void Stop();
+
+ private:
+  struct Timer {
+    uint64_t expiry;
+    Callback cb;
+    std::list<Id>* slot;
+    std::list<Id>::iterator position;
+  };
+
+  void Run();
+
+  uint64_t NowTick(const std::unique_lock<std::mutex>& lock) const;
+
+  // Puts the timer |id| in the slot for its expiry, relative to
+  // |current_tick_|.
+  void Insert(const std::unique_lock<std::mutex>& lock, Id id, Timer* timer);
+
+  // Moves the timers of slot |index| of |level| to the levels below,
+  // returning |index|.
+  int Cascade(const std::unique_lock<std::mutex>& lock, int level,
+              int index);
+
+  // Processes the ticks up to |now|, moving the callbacks of the timers
+  // that are due to |due|.
+  void Advance(const std::unique_lock<std::mutex>& lock, uint64_t now,
+               std::vector<std::pair<Id, Callback>>* due);
+
+  // The next tick at which Advance() may have something to do.
+  uint64_t NextWakeTick(const std::unique_lock<std::mutex>& lock) const;
+
+  const std::chrono::steady_clock::duration tick_;
+  const std::chrono::steady_clock::time_point epoch_;
+
+  mutable std::mutex lock_;
+  std::condition_variable cond_var_;
+  // Signalled once the callbacks in |running_| have returned.
+  std::condition_variable running_cond_var_;
+  std::vector<std::list<Id>> slots_;
+  std::unordered_map<Id, Timer> timers_;
+  std::unordered_set<Id> running_;
+  Id next_id_;
+  // The next tick to process.
+  uint64_t current_tick_;
+  // When the thread is going to wake up next, if it is sleeping.
+  uint64_t wake_tick_;
+  bool stopping_;
+
+  std::thread thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(TimerWheel);
+};
+
+
+}  // namespace cert_trans
+
+#endif  // CERT_TRANS_UTIL_TIMER_WHEEL_H_
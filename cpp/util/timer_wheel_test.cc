@@ -0,0 +1,154 @@
+#include "util/timer_wheel.h"
+
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "base/notification.h"
+#include "util/status.h"
+#include "util/testing.h"
+
+namespace cert_trans {
+
+using std::chrono::milliseconds;
+using std::chrono::microseconds;
+using std::chrono::steady_clock;
+using std::lock_guard;
+using std::mutex;
+using std::unique_ptr;
+using std::vector;
+using util::Status;
+
+
+class TimerWheelTest : public ::testing::Test {
+ protected:
+  TimerWheelTest() : wheel_(new TimerWheel) {
+  }
+
+  unique_ptr<TimerWheel> wheel_;
+};
+
+
+TEST_F(TimerWheelTest, RunsWhenDue) {
+  const steady_clock::time_point when(steady_clock::now() +
+                                      milliseconds(100));
+  Notification done;
+  Status status(util::error::UNKNOWN, "not run");
+  wheel_->Add(when, [&done, &status](const Status& s) {
+    status = s;
+    done.Notify();
+  });
+  EXPECT_FALSE(done.HasBeenNotified());
+
+  done.WaitForNotification();
+  EXPECT_LE(when, steady_clock::now());
+  EXPECT_EQ(Status::OK, status);
+}
+
+
+TEST_F(TimerWheelTest, RunsInOrder) {
+  const steady_clock::time_point now(steady_clock::now());
+  mutex lock;
+  vector<int> order;
+  Notification done;
+  // Far enough apart to land in different slots, and further than the
+  // lowest ring for the last ones.
+  for (const int ms : {400, 20, 300, 5}) {
+    wheel_->Add(now + milliseconds(ms),
+                [ms, &lock, &order, &done](const Status&) {
+                  lock_guard<mutex> l(lock);
+                  order.push_back(ms);
+                  if (order.size() == 4) {
+                    done.Notify();
+                  }
+                });
+  }
+
+  done.WaitForNotification();
+  EXPECT_EQ((vector<int>{5, 20, 300, 400}), order);
+}
+
+
+TEST_F(TimerWheelTest, PastRunsAtOnce) {
+  Notification done;
+  wheel_->Add(steady_clock::now() - milliseconds(100),
+              [&done](const Status&) { done.Notify(); });
+  EXPECT_TRUE(done.WaitForNotificationWithTimeout(milliseconds(1000)));
+}
+
+
+TEST_F(TimerWheelTest, UpperLevels) {
+  // With a tick this short, these go in each of the levels.
+  wheel_.reset(new TimerWheel(microseconds(5)));
+  const steady_clock::time_point now(steady_clock::now());
+  std::atomic<int> num_run(0);
+  Notification done;
+  for (const int ms : {1, 50, 500}) {
+    const steady_clock::time_point when(now + milliseconds(ms));
+    wheel_->Add(when, [when, &num_run, &done](const Status&) {
+      EXPECT_LE(when, steady_clock::now());
+      if (++num_run == 3) {
+        done.Notify();
+      }
+    });
+  }
+
+  done.WaitForNotification();
+}
+
+
+TEST_F(TimerWheelTest, Cancel) {
+  const TimerWheel::Id id(
+      wheel_->Add(steady_clock::now() + milliseconds(50),
+                  [](const Status&) { ADD_FAILURE() << "cancelled"; }));
+  Notification done;
+  wheel_->Add(steady_clock::now() + milliseconds(100),
+              [&done](const Status&) { done.Notify(); });
+
+  EXPECT_TRUE(wheel_->Cancel(id));
+  EXPECT_FALSE(wheel_->Cancel(id));
+  done.WaitForNotification();
+}
+
+
+TEST_F(TimerWheelTest, CancelAfterRun) {
+  Notification done;
+  const TimerWheel::Id id(wheel_->Add(steady_clock::now(),
+                                      [&done](const Status&) {
+                                        done.Notify();
+                                      }));
+  done.WaitForNotification();
+  EXPECT_FALSE(wheel_->Cancel(id));
+}
+
+
+TEST_F(TimerWheelTest, CancelFromCallback) {
+  Notification done;
+  TimerWheel::Id id(0);
+  id = wheel_->Add(steady_clock::now(), [this, &id, &done](const Status&) {
+    EXPECT_FALSE(wheel_->Cancel(id));
+    done.Notify();
+  });
+  done.WaitForNotification();
+}
+
+
+TEST_F(TimerWheelTest, CancelledOnDestruction) {
+  Status status;
+  wheel_->Add(steady_clock::now() + std::chrono::hours(24),
+              [&status](const Status& s) { status = s; });
+  wheel_.reset();
+  EXPECT_EQ(Status::CANCELLED, status);
+}
+
+
+}  // namespace cert_trans
+
+
+int main(int argc, char** argv) {
+  cert_trans::test::InitTesting(argv[0], &argc, &argv, true);
+  return RUN_ALL_TESTS();
+}
@@ -2,7 +2,7 @@
 
 #include <glog/logging.h>
 #include <netinet/in.h>  // for resolv.h
-#include <resolv.h>      // for b64_ntop
+#include <resolv.h>      // for b64_pton
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -16,6 +16,7 @@
 #include <vector>
 
 #include "log/ct_extensions.h"
+#include "util/base64.h"
 #include "version.h"
 
 using std::getline;
@@ -177,26 +178,28 @@ string RandomString(size_t min_length, size_t max_length) {
 
 string FromBase64(const char* b64) {
   size_t length = strlen(b64);
-  // Lazy: base 64 encoding is always >= in length to decoded value
-  // (equality occurs for zero length).
-  u_char* buf = new u_char[length];
-  int rlength = b64_pton(b64, buf, length);
+  string ret(Base64DecodedMaxSize(length), '\0');
+  size_t size;
+  if (Base64Decode(b64, length, &ret[0], &size)) {
+    ret.resize(size);
+    return ret;
+  }
+
+  // Fall back on b64_pton() for what Base64Decode() is too strict for,
+  // such as whitespace. Lazy: base 64 encoding is always >= in length to
+  // decoded value (equality occurs for zero length).
+  ret.resize(length);
+  int rlength = b64_pton(b64, reinterpret_cast<u_char*>(&ret[0]), length);
   // Treat decode errors as empty strings.
   if (rlength < 0)
     rlength = 0;
-  string ret(reinterpret_cast<char*>(buf), rlength);
-  delete[] buf;
+  ret.resize(rlength);
   return ret;
 }
 
 string ToBase64(const string& from) {
-  // base 64 is 4 output bytes for every 3 input bytes (rounded up).
-  size_t length = ((from.size() + 2) / 3) * 4;
-  char* buf = new char[length + 1];
-  length =
-      b64_ntop((const u_char*)from.data(), from.length(), buf, length + 1);
-  string ret(buf, length);
-  delete[] buf;
+  string ret(Base64EncodedSize(from.size()), '\0');
+  Base64Encode(from.data(), from.size(), &ret[0]);
   return ret;
 }
 
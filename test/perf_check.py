@@ -0,0 +1,225 @@
+#!/usr/bin/env python
+"""Runs the benchmarks, and compares their results against a baseline.
+
+The benchmarks run with fixed dataset sizes (and their own fixed seeds),
+so that the results of two runs on the same machine can be compared.
+Each writes its results with --bench_results_out (bench_merkle_tree
+with --benchmark_out, whose counters are converted), and they are
+combined into one file, whose metrics are named
+"<benchmark>/<metric>", such as "bench_database/leveldb/insert/
+entries_per_second".
+
+A metric regresses when it is worse than its baseline by more than its
+threshold, a fraction of the baseline: that of the first of the
+[pattern, threshold] pairs of the "thresholds" of the baseline whose
+pattern (in fnmatch syntax) matches its name, or "default_threshold".
+Exits with 1 if any did.
+
+Typical use is through "make perf-baseline" on a quiet machine, which
+records the baseline with --update_baseline, then "make perf-check"
+after a change.
+"""
+
+from __future__ import print_function
+
+import argparse
+import fnmatch
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+
+# The benchmarks, the path of their program in the build directory, and
+# their flags.
+BENCHMARKS = [
+    ("bench_merkle_tree", "cpp/merkletree/bench_merkle_tree",
+     ["--max_leaves=100000", "--max_sparse_leaves=10000"]),
+    ("bench_database", "cpp/log/bench_database",
+     ["--num_entries=20000", "--num_lookups=50000", "--num_threads=4"]),
+    ("bench_sequencing", "cpp/log/bench_sequencing",
+     ["--num_submitters=4", "--entries_per_submitter=1000"]),
+    ("bench_thread_pool", "cpp/util/bench_thread_pool",
+     ["--num_producers=4", "--closures_per_producer=100000",
+      "--pool_threads=4"]),
+]
+
+# Only run against a log server given with --ct_server.
+BENCH_LOG = ("bench_log", "cpp/client/bench_log",
+             ["--qps=200", "--duration_seconds=30"])
+
+# The counters of bench_merkle_tree, and whether higher is better.
+MERKLE_TREE_COUNTERS = [
+    ("items_per_second", "items/s", "higher"),
+    ("allocs_per_leaf", "allocs", "lower"),
+    ("bytes_per_leaf", "bytes", "lower"),
+]
+
+
+def run(name, argv):
+    """Runs a benchmark, and returns its peak RSS, in bytes."""
+    print("running %s" % " ".join(argv), file=sys.stderr)
+    process = subprocess.Popen(argv)
+    _, status, rusage = os.wait4(process.pid, 0)
+    # The status has been reaped already.
+    process.returncode = 0
+    if status != 0:
+        sys.exit("%s failed with status %d" % (name, status))
+    # In kB on Linux.
+    return rusage.ru_maxrss * 1024
+
+
+def read_bench_results(name, path):
+    with open(path) as f:
+        results = json.load(f)
+    metrics = {}
+    for metric in results["metrics"]:
+        metrics["%s/%s" % (name, metric["name"])] = {
+            "value": metric["value"],
+            "unit": metric["unit"],
+            "better": metric["better"],
+        }
+    return metrics
+
+
+def read_merkle_tree_results(name, path):
+    with open(path) as f:
+        results = json.load(f)
+    metrics = {}
+    for benchmark in results["benchmarks"]:
+        if benchmark.get("run_type") == "aggregate":
+            continue
+        for counter, unit, better in MERKLE_TREE_COUNTERS:
+            if counter in benchmark:
+                metrics["%s/%s/%s" % (name, benchmark["name"], counter)] = {
+                    "value": benchmark[counter],
+                    "unit": unit,
+                    "better": better,
+                }
+    return metrics
+
+
+def run_benchmarks(args):
+    benchmarks = list(BENCHMARKS)
+    if args.ct_server:
+        name, program, flags = BENCH_LOG
+        benchmarks.append(
+            (name, program, flags + ["--ct_server=" + args.ct_server]))
+
+    metrics = {}
+    out_dir = tempfile.mkdtemp(prefix="perf_check.")
+    for name, program, flags in benchmarks:
+        path = os.path.join(args.build_dir, program)
+        if not os.path.exists(path):
+            # bench_merkle_tree is only built with Google Benchmark.
+            print("skipping %s, which is not built" % name, file=sys.stderr)
+            continue
+        out = os.path.join(out_dir, name + ".json")
+        if name == "bench_merkle_tree":
+            peak_rss = run(name, [path] + flags +
+                           ["--benchmark_out=" + out,
+                            "--benchmark_out_format=json"])
+            metrics.update(read_merkle_tree_results(name, out))
+            metrics[name + "/peak_rss_bytes"] = {
+                "value": peak_rss,
+                "unit": "bytes",
+                "better": "lower",
+            }
+        else:
+            run(name, [path] + flags + ["--bench_results_out=" + out])
+            metrics.update(read_bench_results(name, out))
+        os.remove(out)
+    os.rmdir(out_dir)
+    return metrics
+
+
+def threshold(baseline, name):
+    for pattern, value in baseline.get("thresholds", []):
+        if fnmatch.fnmatchcase(name, pattern):
+            return value
+    return baseline["default_threshold"]
+
+
+def compare(baseline, metrics):
+    """Prints the changes beyond their threshold, and returns the number of
+    regressions."""
+    regressions = 0
+    for name in sorted(baseline["metrics"]):
+        base = baseline["metrics"][name]
+        if name not in metrics:
+            print("%s: not measured" % name)
+            continue
+        value = metrics[name]["value"]
+        if value is None or base["value"] is None:
+            continue
+        limit = threshold(baseline, name)
+        if base["better"] == "higher":
+            regressed = value < base["value"] * (1 - limit)
+            improved = value > base["value"] * (1 + limit)
+        else:
+            regressed = value > base["value"] * (1 + limit)
+            improved = value < base["value"] * (1 - limit)
+        if regressed or improved:
+            if base["value"]:
+                change = "%+.1f%%" % (
+                    100.0 * (float(value) / base["value"] - 1))
+            else:
+                change = "from 0"
+            print("%s: %s %g %s (baseline %g, %s, threshold %g%%)" %
+                  (name, "REGRESSED to" if regressed else "improved to",
+                   value, base["unit"], base["value"], change, 100 * limit))
+        if regressed:
+            regressions += 1
+    for name in sorted(set(metrics) - set(baseline["metrics"])):
+        print("%s: not in the baseline" % name)
+    return regressions
+
+
+def main():
+    source_dir = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--build_dir", default=".",
+                        help="directory the benchmarks were built in")
+    parser.add_argument("--baseline",
+                        default=os.path.join(source_dir, "test",
+                                             "perf_baseline.json"),
+                        help="baseline to compare the results against")
+    parser.add_argument("--results_out", default="perf_results.json",
+                        help="file to write the results to")
+    parser.add_argument("--ct_server", default="",
+                        help="log server to run bench_log against, if any")
+    parser.add_argument("--update_baseline", action="store_true",
+                        help="record the results in the baseline, keeping "
+                        "its thresholds, rather than comparing them")
+    args = parser.parse_args()
+
+    with open(args.baseline) as f:
+        baseline = json.load(f)
+    metrics = run_benchmarks(args)
+    with open(args.results_out, "w") as f:
+        json.dump({"metrics": metrics}, f, indent=2, sort_keys=True)
+        f.write("\n")
+
+    if args.update_baseline:
+        baseline["metrics"] = metrics
+        with open(args.baseline, "w") as f:
+            json.dump(baseline, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print("recorded %d metrics in %s" % (len(metrics), args.baseline))
+        return 0
+
+    if not baseline["metrics"]:
+        print("%s has no metrics, record them with --update_baseline "
+              "(make perf-baseline) first" % args.baseline, file=sys.stderr)
+        return 1
+    regressions = compare(baseline, metrics)
+    if regressions:
+        print("%d metrics regressed" % regressions)
+        return 1
+    print("no regression")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())